@@ -29,6 +29,7 @@ import com.github.chenxiaolong.dualbootpatcher.socket.exceptions.MbtoolException
 import com.github.chenxiaolong.dualbootpatcher.socket.interfaces.MbtoolInterface
 import com.squareup.picasso.Picasso
 import mbtool.daemon.v3.FileOpenFlag
+import java.io.ByteArrayOutputStream
 import java.io.File
 import java.io.FileNotFoundException
 import java.io.FileOutputStream
@@ -206,20 +207,13 @@ object RomUtils {
             }
 
             // Read file into memory
-            val data = ByteArray(sb.st_size.toInt())
-            var nWritten = 0
-            while (nWritten < data.size) {
-                val newData = iface.fileRead(id, 10240)
-
-                val nRead = newData.limit() - newData.position()
-                newData.get(data, nWritten, nRead)
-                nWritten += nRead
-            }
+            val data = ByteArrayOutputStream(sb.st_size.toInt())
+            iface.fileReadStream(id, sb.st_size, data)
 
             iface.fileClose(id)
             id = -1
 
-            val xml = String(data, Charsets.UTF_8)
+            val xml = String(data.toByteArray(), Charsets.UTF_8)
             return xml.contains("component=")
         } finally {
             if (id >= 0) {
@@ -269,26 +263,15 @@ object RomUtils {
                 return CacheWallpaperResult.FAILED
             }
 
-            // Read file into memory
-            val data = ByteArray(sb.st_size.toInt())
-            var nWritten = 0
-            while (nWritten < data.size) {
-                val newData = iface.fileRead(id, 10240)
-
-                val nRead = newData.limit() - newData.position()
-                newData.get(data, nWritten, nRead)
-                nWritten += nRead
-            }
-
-            iface.fileClose(id)
-            id = -1
-
             FileOutputStream(wallpaperCacheFile).use { fos ->
                 // Compression can be very slow (more than 10 seconds) for a large wallpaper, so
                 // we'll just cache the actual file instead
-                fos.write(data)
+                iface.fileReadStream(id, sb.st_size, fos)
             }
 
+            iface.fileClose(id)
+            id = -1
+
             // Load into bitmap
             //Bitmap bitmap = BitmapFactory.decodeByteArray(data, 0, data.length)
             //if (bitmap == null) {
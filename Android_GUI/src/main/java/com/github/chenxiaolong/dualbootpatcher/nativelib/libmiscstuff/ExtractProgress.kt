@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+package com.github.chenxiaolong.dualbootpatcher.nativelib.libmiscstuff
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Progress of [LibMiscStuff.extractArchive], shared with the native code through a direct
+ * buffer so that it can be polled from any thread without JNI calls. The layout must match
+ * `struct ExtractProgress` in libmiscstuff.cpp.
+ */
+class ExtractProgress {
+    internal val buffer: ByteBuffer = ByteBuffer.allocateDirect(SIZE)
+            .order(ByteOrder.nativeOrder())
+
+    /** Number of bytes of the archive that have been read */
+    val currentBytes: Long
+        get() = buffer.getLong(OFFSET_CURRENT_BYTES)
+
+    /** Size of the archive */
+    val totalBytes: Long
+        get() = buffer.getLong(OFFSET_TOTAL_BYTES)
+
+    /** Request cancellation. The extraction fails with an InterruptedIOException. */
+    fun cancel() {
+        buffer.putInt(OFFSET_CANCELLED, 1)
+    }
+
+    companion object {
+        private const val OFFSET_CURRENT_BYTES = 0
+        private const val OFFSET_TOTAL_BYTES = 8
+        private const val OFFSET_CANCELLED = 16
+        private const val SIZE = 24
+    }
+}
@@ -18,10 +18,23 @@
 package com.github.chenxiaolong.dualbootpatcher.nativelib.libmiscstuff
 
 import java.io.IOException
+import java.nio.ByteBuffer
 
 object LibMiscStuff {
     @Throws(IOException::class)
-    external fun extractArchive(filename: String, target: String)
+    private external fun extractArchive(filename: String, target: String,
+                                        progress: ByteBuffer?)
+
+    /**
+     * Extract an archive into a directory
+     *
+     * @param progress If not null, receives the progress and allows the extraction to be
+     *                 cancelled from another thread
+     */
+    @Throws(IOException::class)
+    fun extractArchive(filename: String, target: String, progress: ExtractProgress? = null) {
+        extractArchive(filename, target, progress?.buffer)
+    }
 
     external fun mblogSetLogcat()
 
@@ -25,6 +25,8 @@ import com.github.chenxiaolong.dualbootpatcher.socket.exceptions.MbtoolCommandEx
 import com.github.chenxiaolong.dualbootpatcher.socket.exceptions.MbtoolException
 
 import java.io.IOException
+import java.io.InputStream
+import java.io.OutputStream
 import java.nio.ByteBuffer
 
 import mbtool.daemon.v3.FileOpenFlag
@@ -84,6 +86,23 @@ interface MbtoolInterface {
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     fun fileRead(id: Int, size: Long): ByteBuffer
 
+    /**
+     * Read data from an opened file in a single streaming request.
+     *
+     * Unlike [fileRead], the data is sent as a series of chunks without a round trip for each
+     * one.
+     *
+     * @param id File ID
+     * @param size Maximum number of bytes to read (reading stops early at EOF)
+     * @param output Stream to write the data to
+     * @return Number of bytes read
+     * @throws IOException
+     * @throws MbtoolException
+     * @throws MbtoolCommandException
+     */
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    fun fileReadStream(id: Int, size: Long, output: OutputStream): Long
+
     /**
      * Seek an opened file.
      *
@@ -127,6 +146,22 @@ interface MbtoolInterface {
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     fun fileWrite(id: Int, data: ByteArray): Long
 
+    /**
+     * Write the contents of a stream to an opened file in a single streaming request.
+     *
+     * Unlike [fileWrite], the data is sent as a series of chunks without a round trip for each
+     * one.
+     *
+     * @param id File ID
+     * @param input Stream to read the data from (read until EOF)
+     * @return Number of bytes actually written
+     * @throws IOException
+     * @throws MbtoolException
+     * @throws MbtoolCommandException
+     */
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    fun fileWriteStream(id: Int, input: InputStream): Long
+
     /**
      * Get SELinux label of an opened file.
      *
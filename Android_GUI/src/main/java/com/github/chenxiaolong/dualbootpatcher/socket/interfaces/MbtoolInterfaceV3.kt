@@ -47,9 +47,11 @@ class MbtoolInterfaceV3(
             ResponseType.FileCloseResponse -> FileCloseResponse()
             ResponseType.FileOpenResponse -> FileOpenResponse()
             ResponseType.FileReadResponse -> FileReadResponse()
+            ResponseType.FileReadStreamResponse -> FileReadStreamResponse()
             ResponseType.FileSeekResponse -> FileSeekResponse()
             ResponseType.FileStatResponse -> FileStatResponse()
             ResponseType.FileWriteResponse -> FileWriteResponse()
+            ResponseType.FileWriteStreamResponse -> FileWriteStreamResponse()
             ResponseType.FileSELinuxGetLabelResponse -> FileSELinuxGetLabelResponse()
             ResponseType.FileSELinuxSetLabelResponse -> FileSELinuxSetLabelResponse()
             ResponseType.PathChmodResponse -> PathChmodResponse()
@@ -71,6 +73,10 @@ class MbtoolInterfaceV3(
             ResponseType.MbGetPackagesCountResponse -> MbGetPackagesCountResponse()
             ResponseType.RebootResponse -> RebootResponse()
             ResponseType.ShutdownResponse -> ShutdownResponse()
+            ResponseType.BatchResponse -> BatchResponse()
+            ResponseType.JobStartResponse -> JobStartResponse()
+            ResponseType.JobCancelResponse -> JobCancelResponse()
+            ResponseType.JobEventResponse -> JobEventResponse()
             else -> throw MbtoolException(Reason.PROTOCOL_ERROR,
                     "Unknown response type: ${response.responseType()}")
         }
@@ -99,6 +105,11 @@ class MbtoolInterfaceV3(
         // Send request to daemon
         SocketUtils.writeBytes(sos, builder.sizedByteArray())
 
+        return receiveResponse(fbRequestType, expected)
+    }
+
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    private fun receiveResponse(fbRequestType: Byte, expected: Byte): Table {
         // Read response back as table
         val responseBytes = SocketUtils.readBytes(sis)
         val bb = ByteBuffer.wrap(responseBytes)
@@ -210,6 +221,68 @@ class MbtoolInterfaceV3(
         return response.dataAsByteBuffer()
     }
 
+    @Synchronized
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    override fun fileReadStream(id: Int, size: Long, output: OutputStream): Long {
+        // Create request
+        val builder = FlatBufferBuilder(FBB_SIZE)
+        FileReadStreamRequest.startFileReadStreamRequest(builder)
+        FileReadStreamRequest.addId(builder, id)
+        FileReadStreamRequest.addCount(builder, size)
+        FileReadStreamRequest.addChunkSize(builder, STREAM_CHUNK_SIZE.toLong())
+        val fbRequest = FileReadStreamRequest.endFileReadStreamRequest(builder)
+
+        // Send request
+        var response = sendRequest(builder, fbRequest, RequestType.FileReadStreamRequest,
+                ResponseType.FileReadStreamResponse) as FileReadStreamResponse
+
+        var error = response.error()
+        if (error != null) {
+            throw MbtoolCommandException(
+                    error.errnoValue(), "[$id]: read stream failed: ${error.msg()}")
+        }
+
+        // Receive chunks until the zero-length terminator. If writing to the output fails, keep
+        // reading so the connection stays in sync with the daemon.
+        val buf = ByteArray(STREAM_CHUNK_SIZE)
+        var outputError: IOException? = null
+
+        while (true) {
+            val length = SocketUtils.readInt32(sis)
+            if (length == 0) {
+                break
+            } else if (length < 0 || length > buf.size) {
+                throw MbtoolException(Reason.PROTOCOL_ERROR,
+                        "Invalid stream chunk length: $length")
+            }
+
+            SocketUtils.readFully(sis, buf, 0, length)
+
+            if (outputError == null) {
+                try {
+                    output.write(buf, 0, length)
+                } catch (e: IOException) {
+                    outputError = e
+                }
+            }
+        }
+
+        response = receiveResponse(RequestType.FileReadStreamRequest,
+                ResponseType.FileReadStreamResponse) as FileReadStreamResponse
+
+        if (outputError != null) {
+            throw outputError
+        }
+
+        error = response.error()
+        if (error != null) {
+            throw MbtoolCommandException(
+                    error.errnoValue(), "[$id]: read stream failed: ${error.msg()}")
+        }
+
+        return response.bytesRead()
+    }
+
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     override fun fileSeek(id: Int, offset: Long, whence: Short): Long {
@@ -295,6 +368,64 @@ class MbtoolInterfaceV3(
         return response.bytesWritten()
     }
 
+    @Synchronized
+    @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
+    override fun fileWriteStream(id: Int, input: InputStream): Long {
+        // Create request
+        val builder = FlatBufferBuilder(FBB_SIZE)
+        FileWriteStreamRequest.startFileWriteStreamRequest(builder)
+        FileWriteStreamRequest.addId(builder, id)
+        val fbRequest = FileWriteStreamRequest.endFileWriteStreamRequest(builder)
+
+        // Send request
+        var response = sendRequest(builder, fbRequest, RequestType.FileWriteStreamRequest,
+                ResponseType.FileWriteStreamResponse) as FileWriteStreamResponse
+
+        var error = response.error()
+        if (error != null) {
+            throw MbtoolCommandException(
+                    error.errnoValue(), "[$id]: write stream failed: ${error.msg()}")
+        }
+
+        // Send chunks followed by the zero-length terminator. If reading the input fails, the
+        // stream still needs to be terminated so the connection stays in sync with the daemon.
+        val buf = ByteArray(STREAM_CHUNK_SIZE)
+        var inputError: IOException? = null
+
+        while (true) {
+            val n = try {
+                input.read(buf)
+            } catch (e: IOException) {
+                inputError = e
+                break
+            }
+
+            if (n < 0) {
+                break
+            } else if (n > 0) {
+                SocketUtils.writeInt32(sos, n)
+                sos.write(buf, 0, n)
+            }
+        }
+
+        SocketUtils.writeInt32(sos, 0)
+
+        response = receiveResponse(RequestType.FileWriteStreamRequest,
+                ResponseType.FileWriteStreamResponse) as FileWriteStreamResponse
+
+        if (inputError != null) {
+            throw inputError
+        }
+
+        error = response.error()
+        if (error != null) {
+            throw MbtoolCommandException(
+                    error.errnoValue(), "[$id]: write stream failed: ${error.msg()}")
+        }
+
+        return response.bytesWritten()
+    }
+
     @Synchronized
     @Throws(IOException::class, MbtoolException::class, MbtoolCommandException::class)
     override fun fileSelinuxGetLabel(id: Int): String {
@@ -941,5 +1072,8 @@ class MbtoolInterfaceV3(
 
         /** Flatbuffers buffer size (same as the C++ default)  */
         private const val FBB_SIZE = 1024
+
+        /** Maximum chunk size for streaming file transfers (same as the daemon's default) */
+        private const val STREAM_CHUNK_SIZE = 256 * 1024
     }
 }
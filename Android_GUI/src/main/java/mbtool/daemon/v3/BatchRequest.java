@@ -0,0 +1,42 @@
+// Written to match flatc output for protocol/v3/batch.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class BatchRequest extends Table {
+  public static BatchRequest getRootAsBatchRequest(ByteBuffer _bb) { return getRootAsBatchRequest(_bb, new BatchRequest()); }
+  public static BatchRequest getRootAsBatchRequest(ByteBuffer _bb, BatchRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public BatchRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public BatchRequestItem requests(int j) { return requests(new BatchRequestItem(), j); }
+  public BatchRequestItem requests(BatchRequestItem obj, int j) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(__vector(o) + j * 4), bb) : null; }
+  public int requestsLength() { int o = __offset(4); return o != 0 ? __vector_len(o) : 0; }
+  public boolean stopOnFailure() { int o = __offset(6); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+
+  public static int createBatchRequest(FlatBufferBuilder builder,
+      int requestsOffset,
+      boolean stop_on_failure) {
+    builder.startObject(2);
+    BatchRequest.addRequests(builder, requestsOffset);
+    BatchRequest.addStopOnFailure(builder, stop_on_failure);
+    return BatchRequest.endBatchRequest(builder);
+  }
+
+  public static void startBatchRequest(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addRequests(FlatBufferBuilder builder, int requestsOffset) { builder.addOffset(0, requestsOffset, 0); }
+  public static int createRequestsVector(FlatBufferBuilder builder, int[] data) { builder.startVector(4, data.length, 4); for (int i = data.length - 1; i >= 0; i--) builder.addOffset(data[i]); return builder.endVector(); }
+  public static void startRequestsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(4, numElems, 4); }
+  public static void addStopOnFailure(FlatBufferBuilder builder, boolean stopOnFailure) { builder.addBoolean(1, stopOnFailure, false); }
+  public static int endBatchRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
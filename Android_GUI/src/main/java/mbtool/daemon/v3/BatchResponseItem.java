@@ -0,0 +1,39 @@
+// Written to match flatc output for protocol/v3/batch.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class BatchResponseItem extends Table {
+  public static BatchResponseItem getRootAsBatchResponseItem(ByteBuffer _bb) { return getRootAsBatchResponseItem(_bb, new BatchResponseItem()); }
+  public static BatchResponseItem getRootAsBatchResponseItem(ByteBuffer _bb, BatchResponseItem obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public BatchResponseItem __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int response(int j) { int o = __offset(4); return o != 0 ? bb.get(__vector(o) + j * 1) & 0xFF : 0; }
+  public int responseLength() { int o = __offset(4); return o != 0 ? __vector_len(o) : 0; }
+  public ByteBuffer responseAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer responseInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+
+  public static int createBatchResponseItem(FlatBufferBuilder builder,
+      int responseOffset) {
+    builder.startObject(1);
+    BatchResponseItem.addResponse(builder, responseOffset);
+    return BatchResponseItem.endBatchResponseItem(builder);
+  }
+
+  public static void startBatchResponseItem(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addResponse(FlatBufferBuilder builder, int responseOffset) { builder.addOffset(0, responseOffset, 0); }
+  public static int createResponseVector(FlatBufferBuilder builder, byte[] data) { builder.startVector(1, data.length, 1); for (int i = data.length - 1; i >= 0; i--) builder.addByte(data[i]); return builder.endVector(); }
+  public static void startResponseVector(FlatBufferBuilder builder, int numElems) { builder.startVector(1, numElems, 1); }
+  public static int endBatchResponseItem(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
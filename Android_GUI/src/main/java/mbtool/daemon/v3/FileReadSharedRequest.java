@@ -0,0 +1,38 @@
+// Written to match flatc output for protocol/v3/shared_buffer.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class FileReadSharedRequest extends Table {
+  public static FileReadSharedRequest getRootAsFileReadSharedRequest(ByteBuffer _bb) { return getRootAsFileReadSharedRequest(_bb, new FileReadSharedRequest()); }
+  public static FileReadSharedRequest getRootAsFileReadSharedRequest(ByteBuffer _bb, FileReadSharedRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public FileReadSharedRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int id() { int o = __offset(4); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+  public long count() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+
+  public static int createFileReadSharedRequest(FlatBufferBuilder builder,
+      int id,
+      long count) {
+    builder.startObject(2);
+    FileReadSharedRequest.addCount(builder, count);
+    FileReadSharedRequest.addId(builder, id);
+    return FileReadSharedRequest.endFileReadSharedRequest(builder);
+  }
+
+  public static void startFileReadSharedRequest(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addId(FlatBufferBuilder builder, int id) { builder.addInt(0, id, 0); }
+  public static void addCount(FlatBufferBuilder builder, long count) { builder.addLong(1, count, 0L); }
+  public static int endFileReadSharedRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,43 @@
+// Written to match flatc output for protocol/v3/shared_buffer.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class FileReadSharedResponse extends Table {
+  public static FileReadSharedResponse getRootAsFileReadSharedResponse(ByteBuffer _bb) { return getRootAsFileReadSharedResponse(_bb, new FileReadSharedResponse()); }
+  public static FileReadSharedResponse getRootAsFileReadSharedResponse(ByteBuffer _bb, FileReadSharedResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public FileReadSharedResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long offset() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesRead() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public SharedBufferError error() { return error(new SharedBufferError()); }
+  public SharedBufferError error(SharedBufferError obj) { int o = __offset(8); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createFileReadSharedResponse(FlatBufferBuilder builder,
+      long offset,
+      long bytes_read,
+      int errorOffset) {
+    builder.startObject(3);
+    FileReadSharedResponse.addBytesRead(builder, bytes_read);
+    FileReadSharedResponse.addOffset(builder, offset);
+    FileReadSharedResponse.addError(builder, errorOffset);
+    return FileReadSharedResponse.endFileReadSharedResponse(builder);
+  }
+
+  public static void startFileReadSharedResponse(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addOffset(FlatBufferBuilder builder, long offset) { builder.addLong(0, offset, 0L); }
+  public static void addBytesRead(FlatBufferBuilder builder, long bytesRead) { builder.addLong(1, bytesRead, 0L); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(2, errorOffset, 0); }
+  public static int endFileReadSharedResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,39 @@
+// Written to match flatc output for protocol/v3/file_read_stream.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class FileReadStreamResponse extends Table {
+  public static FileReadStreamResponse getRootAsFileReadStreamResponse(ByteBuffer _bb) { return getRootAsFileReadStreamResponse(_bb, new FileReadStreamResponse()); }
+  public static FileReadStreamResponse getRootAsFileReadStreamResponse(ByteBuffer _bb, FileReadStreamResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public FileReadStreamResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long bytesRead() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public FileReadStreamError error() { return error(new FileReadStreamError()); }
+  public FileReadStreamError error(FileReadStreamError obj) { int o = __offset(6); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createFileReadStreamResponse(FlatBufferBuilder builder,
+      long bytes_read,
+      int errorOffset) {
+    builder.startObject(2);
+    FileReadStreamResponse.addBytesRead(builder, bytes_read);
+    FileReadStreamResponse.addError(builder, errorOffset);
+    return FileReadStreamResponse.endFileReadStreamResponse(builder);
+  }
+
+  public static void startFileReadStreamResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addBytesRead(FlatBufferBuilder builder, long bytesRead) { builder.addLong(0, bytesRead, 0L); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(1, errorOffset, 0); }
+  public static int endFileReadStreamResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,34 @@
+// Written to match flatc output for protocol/v3/file_write_stream.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class FileWriteStreamRequest extends Table {
+  public static FileWriteStreamRequest getRootAsFileWriteStreamRequest(ByteBuffer _bb) { return getRootAsFileWriteStreamRequest(_bb, new FileWriteStreamRequest()); }
+  public static FileWriteStreamRequest getRootAsFileWriteStreamRequest(ByteBuffer _bb, FileWriteStreamRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public FileWriteStreamRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int id() { int o = __offset(4); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+
+  public static int createFileWriteStreamRequest(FlatBufferBuilder builder,
+      int id) {
+    builder.startObject(1);
+    FileWriteStreamRequest.addId(builder, id);
+    return FileWriteStreamRequest.endFileWriteStreamRequest(builder);
+  }
+
+  public static void startFileWriteStreamRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addId(FlatBufferBuilder builder, int id) { builder.addInt(0, id, 0); }
+  public static int endFileWriteStreamRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,39 @@
+// Written to match flatc output for protocol/v3/file_write_stream.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class FileWriteStreamResponse extends Table {
+  public static FileWriteStreamResponse getRootAsFileWriteStreamResponse(ByteBuffer _bb) { return getRootAsFileWriteStreamResponse(_bb, new FileWriteStreamResponse()); }
+  public static FileWriteStreamResponse getRootAsFileWriteStreamResponse(ByteBuffer _bb, FileWriteStreamResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public FileWriteStreamResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long bytesWritten() { int o = __offset(4); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public FileWriteStreamError error() { return error(new FileWriteStreamError()); }
+  public FileWriteStreamError error(FileWriteStreamError obj) { int o = __offset(6); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createFileWriteStreamResponse(FlatBufferBuilder builder,
+      long bytes_written,
+      int errorOffset) {
+    builder.startObject(2);
+    FileWriteStreamResponse.addBytesWritten(builder, bytes_written);
+    FileWriteStreamResponse.addError(builder, errorOffset);
+    return FileWriteStreamResponse.endFileWriteStreamResponse(builder);
+  }
+
+  public static void startFileWriteStreamResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addBytesWritten(FlatBufferBuilder builder, long bytesWritten) { builder.addLong(0, bytesWritten, 0L); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(1, errorOffset, 0); }
+  public static int endFileWriteStreamResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,36 @@
+// Written to match flatc output for protocol/v3/job.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobCancelError extends Table {
+  public static JobCancelError getRootAsJobCancelError(ByteBuffer _bb) { return getRootAsJobCancelError(_bb, new JobCancelError()); }
+  public static JobCancelError getRootAsJobCancelError(ByteBuffer _bb, JobCancelError obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobCancelError __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String msg() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer msgAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer msgInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+
+  public static int createJobCancelError(FlatBufferBuilder builder,
+      int msgOffset) {
+    builder.startObject(1);
+    JobCancelError.addMsg(builder, msgOffset);
+    return JobCancelError.endJobCancelError(builder);
+  }
+
+  public static void startJobCancelError(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addMsg(FlatBufferBuilder builder, int msgOffset) { builder.addOffset(0, msgOffset, 0); }
+  public static int endJobCancelError(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
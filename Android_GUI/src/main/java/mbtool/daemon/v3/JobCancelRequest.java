@@ -0,0 +1,34 @@
+// Written to match flatc output for protocol/v3/job.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobCancelRequest extends Table {
+  public static JobCancelRequest getRootAsJobCancelRequest(ByteBuffer _bb) { return getRootAsJobCancelRequest(_bb, new JobCancelRequest()); }
+  public static JobCancelRequest getRootAsJobCancelRequest(ByteBuffer _bb, JobCancelRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobCancelRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+
+  public static int createJobCancelRequest(FlatBufferBuilder builder,
+      long job_id) {
+    builder.startObject(1);
+    JobCancelRequest.addJobId(builder, job_id);
+    return JobCancelRequest.endJobCancelRequest(builder);
+  }
+
+  public static void startJobCancelRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addInt(0, (int)jobId, (int)0L); }
+  public static int endJobCancelRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,35 @@
+// Written to match flatc output for protocol/v3/job.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobCancelResponse extends Table {
+  public static JobCancelResponse getRootAsJobCancelResponse(ByteBuffer _bb) { return getRootAsJobCancelResponse(_bb, new JobCancelResponse()); }
+  public static JobCancelResponse getRootAsJobCancelResponse(ByteBuffer _bb, JobCancelResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobCancelResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public JobCancelError error() { return error(new JobCancelError()); }
+  public JobCancelError error(JobCancelError obj) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createJobCancelResponse(FlatBufferBuilder builder,
+      int errorOffset) {
+    builder.startObject(1);
+    JobCancelResponse.addError(builder, errorOffset);
+    return JobCancelResponse.endJobCancelResponse(builder);
+  }
+
+  public static void startJobCancelResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(0, errorOffset, 0); }
+  public static int endJobCancelResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,59 @@
+// Written to match flatc output for protocol/v3/job.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobEventResponse extends Table {
+  public static JobEventResponse getRootAsJobEventResponse(ByteBuffer _bb) { return getRootAsJobEventResponse(_bb, new JobEventResponse()); }
+  public static JobEventResponse getRootAsJobEventResponse(ByteBuffer _bb, JobEventResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobEventResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+  public long bytesDone() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long filesDone() { int o = __offset(8); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public boolean finished() { int o = __offset(10); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+  public boolean cancelled() { int o = __offset(12); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+  public int response(int j) { int o = __offset(14); return o != 0 ? bb.get(__vector(o) + j * 1) & 0xFF : 0; }
+  public int responseLength() { int o = __offset(14); return o != 0 ? __vector_len(o) : 0; }
+  public ByteBuffer responseAsByteBuffer() { return __vector_as_bytebuffer(14, 1); }
+  public ByteBuffer responseInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 14, 1); }
+
+  public static int createJobEventResponse(FlatBufferBuilder builder,
+      long job_id,
+      long bytes_done,
+      long files_done,
+      boolean finished,
+      boolean cancelled,
+      int responseOffset) {
+    builder.startObject(6);
+    JobEventResponse.addFilesDone(builder, files_done);
+    JobEventResponse.addBytesDone(builder, bytes_done);
+    JobEventResponse.addResponse(builder, responseOffset);
+    JobEventResponse.addJobId(builder, job_id);
+    JobEventResponse.addCancelled(builder, cancelled);
+    JobEventResponse.addFinished(builder, finished);
+    return JobEventResponse.endJobEventResponse(builder);
+  }
+
+  public static void startJobEventResponse(FlatBufferBuilder builder) { builder.startObject(6); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addInt(0, (int)jobId, (int)0L); }
+  public static void addBytesDone(FlatBufferBuilder builder, long bytesDone) { builder.addLong(1, bytesDone, 0L); }
+  public static void addFilesDone(FlatBufferBuilder builder, long filesDone) { builder.addLong(2, filesDone, 0L); }
+  public static void addFinished(FlatBufferBuilder builder, boolean finished) { builder.addBoolean(3, finished, false); }
+  public static void addCancelled(FlatBufferBuilder builder, boolean cancelled) { builder.addBoolean(4, cancelled, false); }
+  public static void addResponse(FlatBufferBuilder builder, int responseOffset) { builder.addOffset(5, responseOffset, 0); }
+  public static int createResponseVector(FlatBufferBuilder builder, byte[] data) { builder.startVector(1, data.length, 1); for (int i = data.length - 1; i >= 0; i--) builder.addByte(data[i]); return builder.endVector(); }
+  public static void startResponseVector(FlatBufferBuilder builder, int numElems) { builder.startVector(1, numElems, 1); }
+  public static int endJobEventResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
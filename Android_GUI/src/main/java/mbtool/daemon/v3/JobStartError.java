@@ -0,0 +1,36 @@
+// Written to match flatc output for protocol/v3/job.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobStartError extends Table {
+  public static JobStartError getRootAsJobStartError(ByteBuffer _bb) { return getRootAsJobStartError(_bb, new JobStartError()); }
+  public static JobStartError getRootAsJobStartError(ByteBuffer _bb, JobStartError obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobStartError __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String msg() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer msgAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer msgInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+
+  public static int createJobStartError(FlatBufferBuilder builder,
+      int msgOffset) {
+    builder.startObject(1);
+    JobStartError.addMsg(builder, msgOffset);
+    return JobStartError.endJobStartError(builder);
+  }
+
+  public static void startJobStartError(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addMsg(FlatBufferBuilder builder, int msgOffset) { builder.addOffset(0, msgOffset, 0); }
+  public static int endJobStartError(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,39 @@
+// Written to match flatc output for protocol/v3/job.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobStartRequest extends Table {
+  public static JobStartRequest getRootAsJobStartRequest(ByteBuffer _bb) { return getRootAsJobStartRequest(_bb, new JobStartRequest()); }
+  public static JobStartRequest getRootAsJobStartRequest(ByteBuffer _bb, JobStartRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobStartRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int request(int j) { int o = __offset(4); return o != 0 ? bb.get(__vector(o) + j * 1) & 0xFF : 0; }
+  public int requestLength() { int o = __offset(4); return o != 0 ? __vector_len(o) : 0; }
+  public ByteBuffer requestAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer requestInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+
+  public static int createJobStartRequest(FlatBufferBuilder builder,
+      int requestOffset) {
+    builder.startObject(1);
+    JobStartRequest.addRequest(builder, requestOffset);
+    return JobStartRequest.endJobStartRequest(builder);
+  }
+
+  public static void startJobStartRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addRequest(FlatBufferBuilder builder, int requestOffset) { builder.addOffset(0, requestOffset, 0); }
+  public static int createRequestVector(FlatBufferBuilder builder, byte[] data) { builder.startVector(1, data.length, 1); for (int i = data.length - 1; i >= 0; i--) builder.addByte(data[i]); return builder.endVector(); }
+  public static void startRequestVector(FlatBufferBuilder builder, int numElems) { builder.startVector(1, numElems, 1); }
+  public static int endJobStartRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,39 @@
+// Written to match flatc output for protocol/v3/job.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobStartResponse extends Table {
+  public static JobStartResponse getRootAsJobStartResponse(ByteBuffer _bb) { return getRootAsJobStartResponse(_bb, new JobStartResponse()); }
+  public static JobStartResponse getRootAsJobStartResponse(ByteBuffer _bb, JobStartResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobStartResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+  public JobStartError error() { return error(new JobStartError()); }
+  public JobStartError error(JobStartError obj) { int o = __offset(6); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createJobStartResponse(FlatBufferBuilder builder,
+      long job_id,
+      int errorOffset) {
+    builder.startObject(2);
+    JobStartResponse.addError(builder, errorOffset);
+    JobStartResponse.addJobId(builder, job_id);
+    return JobStartResponse.endJobStartResponse(builder);
+  }
+
+  public static void startJobStartResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addInt(0, (int)jobId, (int)0L); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(1, errorOffset, 0); }
+  public static int endJobStartResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
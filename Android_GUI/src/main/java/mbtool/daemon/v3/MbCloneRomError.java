@@ -0,0 +1,25 @@
+// Written to match flatc output for protocol/v3/mb_clone_rom.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbCloneRomError extends Table {
+  public static MbCloneRomError getRootAsMbCloneRomError(ByteBuffer _bb) { return getRootAsMbCloneRomError(_bb, new MbCloneRomError()); }
+  public static MbCloneRomError getRootAsMbCloneRomError(ByteBuffer _bb, MbCloneRomError obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbCloneRomError __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+
+  public static void startMbCloneRomError(FlatBufferBuilder builder) { builder.startObject(0); }
+  public static int endMbCloneRomError(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,42 @@
+// Written to match flatc output for protocol/v3/mb_clone_rom.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbCloneRomRequest extends Table {
+  public static MbCloneRomRequest getRootAsMbCloneRomRequest(ByteBuffer _bb) { return getRootAsMbCloneRomRequest(_bb, new MbCloneRomRequest()); }
+  public static MbCloneRomRequest getRootAsMbCloneRomRequest(ByteBuffer _bb, MbCloneRomRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbCloneRomRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String sourceRomId() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer sourceRomIdAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer sourceRomIdInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+  public String targetRomId() { int o = __offset(6); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer targetRomIdAsByteBuffer() { return __vector_as_bytebuffer(6, 1); }
+  public ByteBuffer targetRomIdInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 6, 1); }
+
+  public static int createMbCloneRomRequest(FlatBufferBuilder builder,
+      int source_rom_idOffset,
+      int target_rom_idOffset) {
+    builder.startObject(2);
+    MbCloneRomRequest.addTargetRomId(builder, target_rom_idOffset);
+    MbCloneRomRequest.addSourceRomId(builder, source_rom_idOffset);
+    return MbCloneRomRequest.endMbCloneRomRequest(builder);
+  }
+
+  public static void startMbCloneRomRequest(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addSourceRomId(FlatBufferBuilder builder, int sourceRomIdOffset) { builder.addOffset(0, sourceRomIdOffset, 0); }
+  public static void addTargetRomId(FlatBufferBuilder builder, int targetRomIdOffset) { builder.addOffset(1, targetRomIdOffset, 0); }
+  public static int endMbCloneRomRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
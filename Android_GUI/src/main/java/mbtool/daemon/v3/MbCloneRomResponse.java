@@ -0,0 +1,35 @@
+// Written to match flatc output for protocol/v3/mb_clone_rom.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbCloneRomResponse extends Table {
+  public static MbCloneRomResponse getRootAsMbCloneRomResponse(ByteBuffer _bb) { return getRootAsMbCloneRomResponse(_bb, new MbCloneRomResponse()); }
+  public static MbCloneRomResponse getRootAsMbCloneRomResponse(ByteBuffer _bb, MbCloneRomResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbCloneRomResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public MbCloneRomError error() { return error(new MbCloneRomError()); }
+  public MbCloneRomError error(MbCloneRomError obj) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createMbCloneRomResponse(FlatBufferBuilder builder,
+      int errorOffset) {
+    builder.startObject(1);
+    MbCloneRomResponse.addError(builder, errorOffset);
+    return MbCloneRomResponse.endMbCloneRomResponse(builder);
+  }
+
+  public static void startMbCloneRomResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(0, errorOffset, 0); }
+  public static int endMbCloneRomResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,34 @@
+// Written to match flatc output for protocol/v3/mb_get_stats.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbGetStatsRequest extends Table {
+  public static MbGetStatsRequest getRootAsMbGetStatsRequest(ByteBuffer _bb) { return getRootAsMbGetStatsRequest(_bb, new MbGetStatsRequest()); }
+  public static MbGetStatsRequest getRootAsMbGetStatsRequest(ByteBuffer _bb, MbGetStatsRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbGetStatsRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public boolean reset() { int o = __offset(4); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+
+  public static int createMbGetStatsRequest(FlatBufferBuilder builder,
+      boolean reset) {
+    builder.startObject(1);
+    MbGetStatsRequest.addReset(builder, reset);
+    return MbGetStatsRequest.endMbGetStatsRequest(builder);
+  }
+
+  public static void startMbGetStatsRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addReset(FlatBufferBuilder builder, boolean reset) { builder.addBoolean(0, reset, false); }
+  public static int endMbGetStatsRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
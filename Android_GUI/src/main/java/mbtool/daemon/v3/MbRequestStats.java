@@ -0,0 +1,66 @@
+// Written to match flatc output for protocol/v3/mb_get_stats.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbRequestStats extends Table {
+  public static MbRequestStats getRootAsMbRequestStats(ByteBuffer _bb) { return getRootAsMbRequestStats(_bb, new MbRequestStats()); }
+  public static MbRequestStats getRootAsMbRequestStats(ByteBuffer _bb, MbRequestStats obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbRequestStats __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int type() { int o = __offset(4); return o != 0 ? bb.get(o + bb_pos) & 0xFF : 0; }
+  public long count() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesIn() { int o = __offset(8); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesOut() { int o = __offset(10); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long totalUs() { int o = __offset(12); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long maxUs() { int o = __offset(14); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long p50Us() { int o = __offset(16); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long p90Us() { int o = __offset(18); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long p99Us() { int o = __offset(20); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+
+  public static int createMbRequestStats(FlatBufferBuilder builder,
+      int type,
+      long count,
+      long bytes_in,
+      long bytes_out,
+      long total_us,
+      long max_us,
+      long p50_us,
+      long p90_us,
+      long p99_us) {
+    builder.startObject(9);
+    MbRequestStats.addP99Us(builder, p99_us);
+    MbRequestStats.addP90Us(builder, p90_us);
+    MbRequestStats.addP50Us(builder, p50_us);
+    MbRequestStats.addMaxUs(builder, max_us);
+    MbRequestStats.addTotalUs(builder, total_us);
+    MbRequestStats.addBytesOut(builder, bytes_out);
+    MbRequestStats.addBytesIn(builder, bytes_in);
+    MbRequestStats.addCount(builder, count);
+    MbRequestStats.addType(builder, type);
+    return MbRequestStats.endMbRequestStats(builder);
+  }
+
+  public static void startMbRequestStats(FlatBufferBuilder builder) { builder.startObject(9); }
+  public static void addType(FlatBufferBuilder builder, int type) { builder.addByte(0, (byte)type, (byte)0); }
+  public static void addCount(FlatBufferBuilder builder, long count) { builder.addLong(1, count, 0L); }
+  public static void addBytesIn(FlatBufferBuilder builder, long bytesIn) { builder.addLong(2, bytesIn, 0L); }
+  public static void addBytesOut(FlatBufferBuilder builder, long bytesOut) { builder.addLong(3, bytesOut, 0L); }
+  public static void addTotalUs(FlatBufferBuilder builder, long totalUs) { builder.addLong(4, totalUs, 0L); }
+  public static void addMaxUs(FlatBufferBuilder builder, long maxUs) { builder.addLong(5, maxUs, 0L); }
+  public static void addP50Us(FlatBufferBuilder builder, long p50Us) { builder.addLong(6, p50Us, 0L); }
+  public static void addP90Us(FlatBufferBuilder builder, long p90Us) { builder.addLong(7, p90Us, 0L); }
+  public static void addP99Us(FlatBufferBuilder builder, long p99Us) { builder.addLong(8, p99Us, 0L); }
+  public static int endMbRequestStats(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
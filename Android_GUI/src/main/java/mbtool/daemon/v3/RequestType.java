@@ -1,4 +1,5 @@
-// automatically generated by the FlatBuffers compiler, do not modify
+// Written to match flatc output for protocol/request.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
 
 package mbtool.daemon.v3;
 
@@ -34,8 +35,17 @@ public final class RequestType {
   public static final byte CryptoDecryptRequest = 27;
   public static final byte CryptoGetPwTypeRequest = 28;
   public static final byte PathReadlinkRequest = 29;
+  public static final byte FileReadStreamRequest = 30;
+  public static final byte FileWriteStreamRequest = 31;
+  public static final byte BatchRequest = 32;
+  public static final byte MbGetStatsRequest = 33;
+  public static final byte SharedBufferSetupRequest = 34;
+  public static final byte FileReadSharedRequest = 35;
+  public static final byte MbCloneRomRequest = 36;
+  public static final byte JobStartRequest = 37;
+  public static final byte JobCancelRequest = 38;
 
-  public static final String[] names = { "NONE", "FileChmodRequest", "FileCloseRequest", "FileOpenRequest", "FileReadRequest", "FileSeekRequest", "FileStatRequest", "FileWriteRequest", "FileSELinuxGetLabelRequest", "FileSELinuxSetLabelRequest", "PathChmodRequest", "PathCopyRequest", "PathSELinuxGetLabelRequest", "PathSELinuxSetLabelRequest", "PathGetDirectorySizeRequest", "MbGetVersionRequest", "MbGetInstalledRomsRequest", "MbGetBootedRomIdRequest", "MbSwitchRomRequest", "MbSetKernelRequest", "MbWipeRomRequest", "MbGetPackagesCountRequest", "RebootRequest", "SignedExecRequest", "ShutdownRequest", "PathDeleteRequest", "PathMkdirRequest", "CryptoDecryptRequest", "CryptoGetPwTypeRequest", "PathReadlinkRequest", };
+  public static final String[] names = { "NONE", "FileChmodRequest", "FileCloseRequest", "FileOpenRequest", "FileReadRequest", "FileSeekRequest", "FileStatRequest", "FileWriteRequest", "FileSELinuxGetLabelRequest", "FileSELinuxSetLabelRequest", "PathChmodRequest", "PathCopyRequest", "PathSELinuxGetLabelRequest", "PathSELinuxSetLabelRequest", "PathGetDirectorySizeRequest", "MbGetVersionRequest", "MbGetInstalledRomsRequest", "MbGetBootedRomIdRequest", "MbSwitchRomRequest", "MbSetKernelRequest", "MbWipeRomRequest", "MbGetPackagesCountRequest", "RebootRequest", "SignedExecRequest", "ShutdownRequest", "PathDeleteRequest", "PathMkdirRequest", "CryptoDecryptRequest", "CryptoGetPwTypeRequest", "PathReadlinkRequest", "FileReadStreamRequest", "FileWriteStreamRequest", "BatchRequest", "MbGetStatsRequest", "SharedBufferSetupRequest", "FileReadSharedRequest", "MbCloneRomRequest", "JobStartRequest", "JobCancelRequest", };
 
   public static String name(int e) { return names[e]; }
 }
@@ -1,4 +1,5 @@
-// automatically generated by the FlatBuffers compiler, do not modify
+// Written to match flatc output for protocol/response.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
 
 package mbtool.daemon.v3;
 
@@ -37,8 +38,18 @@ public final class ResponseType {
   public static final byte CryptoDecryptResponse = 30;
   public static final byte CryptoGetPwTypeResponse = 31;
   public static final byte PathReadlinkResponse = 32;
+  public static final byte FileReadStreamResponse = 33;
+  public static final byte FileWriteStreamResponse = 34;
+  public static final byte BatchResponse = 35;
+  public static final byte MbGetStatsResponse = 36;
+  public static final byte SharedBufferSetupResponse = 37;
+  public static final byte FileReadSharedResponse = 38;
+  public static final byte MbCloneRomResponse = 39;
+  public static final byte JobStartResponse = 40;
+  public static final byte JobCancelResponse = 41;
+  public static final byte JobEventResponse = 42;
 
-  public static final String[] names = { "NONE", "Invalid", "Unsupported", "FileChmodResponse", "FileCloseResponse", "FileOpenResponse", "FileReadResponse", "FileSeekResponse", "FileStatResponse", "FileWriteResponse", "FileSELinuxGetLabelResponse", "FileSELinuxSetLabelResponse", "PathChmodResponse", "PathCopyResponse", "PathSELinuxGetLabelResponse", "PathSELinuxSetLabelResponse", "PathGetDirectorySizeResponse", "MbGetVersionResponse", "MbGetInstalledRomsResponse", "MbGetBootedRomIdResponse", "MbSwitchRomResponse", "MbSetKernelResponse", "MbWipeRomResponse", "MbGetPackagesCountResponse", "RebootResponse", "SignedExecOutputResponse", "SignedExecResponse", "ShutdownResponse", "PathDeleteResponse", "PathMkdirResponse", "CryptoDecryptResponse", "CryptoGetPwTypeResponse", "PathReadlinkResponse", };
+  public static final String[] names = { "NONE", "Invalid", "Unsupported", "FileChmodResponse", "FileCloseResponse", "FileOpenResponse", "FileReadResponse", "FileSeekResponse", "FileStatResponse", "FileWriteResponse", "FileSELinuxGetLabelResponse", "FileSELinuxSetLabelResponse", "PathChmodResponse", "PathCopyResponse", "PathSELinuxGetLabelResponse", "PathSELinuxSetLabelResponse", "PathGetDirectorySizeResponse", "MbGetVersionResponse", "MbGetInstalledRomsResponse", "MbGetBootedRomIdResponse", "MbSwitchRomResponse", "MbSetKernelResponse", "MbWipeRomResponse", "MbGetPackagesCountResponse", "RebootResponse", "SignedExecOutputResponse", "SignedExecResponse", "ShutdownResponse", "PathDeleteResponse", "PathMkdirResponse", "CryptoDecryptResponse", "CryptoGetPwTypeResponse", "PathReadlinkResponse", "FileReadStreamResponse", "FileWriteStreamResponse", "BatchResponse", "MbGetStatsResponse", "SharedBufferSetupResponse", "FileReadSharedResponse", "MbCloneRomResponse", "JobStartResponse", "JobCancelResponse", "JobEventResponse", };
 
   public static String name(int e) { return names[e]; }
 }
@@ -0,0 +1,40 @@
+// Written to match flatc output for protocol/v3/shared_buffer.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class SharedBufferError extends Table {
+  public static SharedBufferError getRootAsSharedBufferError(ByteBuffer _bb) { return getRootAsSharedBufferError(_bb, new SharedBufferError()); }
+  public static SharedBufferError getRootAsSharedBufferError(ByteBuffer _bb, SharedBufferError obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public SharedBufferError __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int errnoValue() { int o = __offset(4); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+  public String msg() { int o = __offset(6); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer msgAsByteBuffer() { return __vector_as_bytebuffer(6, 1); }
+  public ByteBuffer msgInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 6, 1); }
+
+  public static int createSharedBufferError(FlatBufferBuilder builder,
+      int errno_value,
+      int msgOffset) {
+    builder.startObject(2);
+    SharedBufferError.addMsg(builder, msgOffset);
+    SharedBufferError.addErrnoValue(builder, errno_value);
+    return SharedBufferError.endSharedBufferError(builder);
+  }
+
+  public static void startSharedBufferError(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addErrnoValue(FlatBufferBuilder builder, int errnoValue) { builder.addInt(0, errnoValue, 0); }
+  public static void addMsg(FlatBufferBuilder builder, int msgOffset) { builder.addOffset(1, msgOffset, 0); }
+  public static int endSharedBufferError(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
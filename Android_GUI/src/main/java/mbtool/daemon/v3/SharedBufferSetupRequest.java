@@ -0,0 +1,34 @@
+// Written to match flatc output for protocol/v3/shared_buffer.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class SharedBufferSetupRequest extends Table {
+  public static SharedBufferSetupRequest getRootAsSharedBufferSetupRequest(ByteBuffer _bb) { return getRootAsSharedBufferSetupRequest(_bb, new SharedBufferSetupRequest()); }
+  public static SharedBufferSetupRequest getRootAsSharedBufferSetupRequest(ByteBuffer _bb, SharedBufferSetupRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public SharedBufferSetupRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long size() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+
+  public static int createSharedBufferSetupRequest(FlatBufferBuilder builder,
+      long size) {
+    builder.startObject(1);
+    SharedBufferSetupRequest.addSize(builder, size);
+    return SharedBufferSetupRequest.endSharedBufferSetupRequest(builder);
+  }
+
+  public static void startSharedBufferSetupRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addSize(FlatBufferBuilder builder, long size) { builder.addInt(0, (int)size, (int)0L); }
+  public static int endSharedBufferSetupRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,39 @@
+// Written to match flatc output for protocol/v3/shared_buffer.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class SharedBufferSetupResponse extends Table {
+  public static SharedBufferSetupResponse getRootAsSharedBufferSetupResponse(ByteBuffer _bb) { return getRootAsSharedBufferSetupResponse(_bb, new SharedBufferSetupResponse()); }
+  public static SharedBufferSetupResponse getRootAsSharedBufferSetupResponse(ByteBuffer _bb, SharedBufferSetupResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public SharedBufferSetupResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long size() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+  public SharedBufferError error() { return error(new SharedBufferError()); }
+  public SharedBufferError error(SharedBufferError obj) { int o = __offset(6); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createSharedBufferSetupResponse(FlatBufferBuilder builder,
+      long size,
+      int errorOffset) {
+    builder.startObject(2);
+    SharedBufferSetupResponse.addError(builder, errorOffset);
+    SharedBufferSetupResponse.addSize(builder, size);
+    return SharedBufferSetupResponse.endSharedBufferSetupResponse(builder);
+  }
+
+  public static void startSharedBufferSetupResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addSize(FlatBufferBuilder builder, long size) { builder.addInt(0, (int)size, (int)0L); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(1, errorOffset, 0); }
+  public static int endSharedBufferSetupResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
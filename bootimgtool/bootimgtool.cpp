@@ -18,11 +18,17 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include <cassert>
 #include <climits>
@@ -31,17 +37,33 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+
+// libarchive
+#include <archive.h>
+#include <archive_entry.h>
 
 // rapidjson
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
 #include <rapidjson/filereadstream.h>
-#include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
 
 // libmbcommon
 #include <mbcommon/common.h>
+#include <mbcommon/file/fd.h>
+#include <mbcommon/file/memory.h>
+#include <mbcommon/file_util.h>
+#include <mbcommon/finally.h>
 #include <mbcommon/integer.h>
 #include <mbcommon/string.h>
 
@@ -75,12 +97,18 @@
 #  define CLOEXEC_FLAG "e"
 #endif
 
+// Path that refers to stdin or stdout
+#define STDIO_PATH                      "-"
+
 
 namespace rj = rapidjson;
 
 using namespace mb::bootimg;
 
 typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
+typedef std::unique_ptr<archive, decltype(archive_write_free) *> ScopedArchive;
+typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *>
+        ScopedArchiveEntry;
 
 #define HELP_HEADERS \
     "Header fields:\n" \
@@ -127,18 +155,24 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "Available commands:\n" \
     "  unpack         Unpack a boot image\n" \
     "  pack           Assemble boot image from unpacked files\n" \
+    "  batch          Run many unpack/pack commands in parallel\n" \
     "\n" \
     "Pass -h/--help as a argument to a command to see its available options.\n"
 
 #define HELP_UNPACK_USAGE \
     "Usage: bootimgtool unpack <input file> [<option>...]\n" \
     "\n" \
+    "If <input file> is \"-\", the boot image is read from stdin.\n" \
+    "\n" \
     "Options:\n" \
     "  -o, --output <output directory>\n" \
     "                  Output directory (current directory if unspecified)\n" \
+    "  -a, --archive <format>\n" \
+    "                  Write the items to stdout as an archive instead of to\n" \
+    "                  files (one of: tar, cpio)\n" \
     "  -p, --prefix <prefix>\n" \
     "                  Prefix to prepend to output filenames\n" \
-    "                  (defaults to \"<input file>-\")\n" \
+    "                  (defaults to \"<input file>-\" or nothing for stdin)\n" \
     "  -n, --noprefix  Do not prepend a prefix to the item filenames\n" \
     "  -t, --type <type>\n" \
     "                  Enable input format (all enabled if unspecified)\n" \
@@ -172,6 +206,9 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "If the --output-<item>=<item path> option is specified, then that particular\n" \
     "item is unpacked to the specified <item path>.\n" \
     "\n" \
+    "If --archive is specified, the same paths are used as the archive member\n" \
+    "names. The output directory defaults to none in that case.\n" \
+    "\n" \
     "Examples:\n" \
     "\n" \
     "1. Unpack a boot image to the current directory\n" \
@@ -181,17 +218,26 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "2. Unpack a boot image to a different directory, but put the kernel in /tmp/\n" \
     "\n" \
     "        bootimgtool unpack boot.img -o extracted --output-kernel /tmp/kernel.img\n" \
+    "\n" \
+    "3. Unpack a boot image from a device into a tar archive\n" \
+    "\n" \
+    "        adb exec-out dd if=/dev/block/bootdevice/by-name/boot \\\n" \
+    "            | bootimgtool unpack - -a tar > boot.tar\n" \
     "\n"
 
 #define HELP_PACK_USAGE \
     "Usage: bootimgtool pack <output file> [<option>...]\n" \
     "\n" \
+    "If <output file> is \"-\", the boot image is written to stdout. Sony ELF\n" \
+    "images are streamed directly. Other formats need to seek back to write the\n" \
+    "header, so they are assembled in memory first if stdout is not seekable.\n" \
+    "\n" \
     "Options:\n" \
     "  -i, --input <input directory>\n" \
     "                  Input directory (current directory if unspecified)\n" \
     "  -p, --prefix <prefix>\n" \
     "                  Prefix to prepend to item filenames\n" \
-    "                  (defaults to \"<output file>-\")\n" \
+    "                  (defaults to \"<output file>-\" or nothing for stdout)\n" \
     "  -n, --noprefix  Do not prepend a prefix to the item filenames\n" \
     "  -t, --type <type>\n" \
     "                  Output type of the boot image (default: android)\n" \
@@ -237,6 +283,32 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "        bootimgtool pack boot.img -i /tmp/android --input-kernel /tmp/newkernel\n" \
     "\n"
 
+#define HELP_BATCH_USAGE \
+    "Usage: bootimgtool batch <manifest file> [<option>...]\n" \
+    "\n" \
+    "Options:\n" \
+    "  -j, --jobs <count>\n" \
+    "                  Number of commands to run in parallel\n" \
+    "                  (number of CPUs if unspecified)\n" \
+    "\n" \
+    "Each line of the manifest file is an unpack or pack command, followed by its\n" \
+    "arguments, separated by whitespace. Empty lines and lines that begin with '#'\n" \
+    "following any leading whitespace are ignored. All lines are validated before\n" \
+    "any command is run. Arguments cannot contain whitespace and commands cannot\n" \
+    "use stdin or stdout.\n" \
+    "\n" \
+    "Once all commands complete, the time taken by each command is printed.\n" \
+    "\n" \
+    "Examples:\n" \
+    "\n" \
+    "1. Unpack two boot images using 4 threads\n" \
+    "\n" \
+    "        $ cat manifest.txt\n" \
+    "        unpack a/boot.img -o a/extracted\n" \
+    "        unpack b/boot.img -o b/extracted\n" \
+    "        bootimgtool batch manifest.txt -j 4\n" \
+    "\n"
+
 enum class SourceType
 {
     Header,
@@ -512,7 +584,7 @@ static bool read_header(const std::string &path, Header &header)
     return true;
 }
 
-static bool write_header(const std::string &path, const Header &header)
+static bool format_header(const Header &header, std::string &out)
 {
     // Try to use base relative to the default kernel offset
     std::optional<uint32_t> base;
@@ -524,17 +596,8 @@ static bool write_header(const std::string &path, const Header &header)
     absolute_to_offset(base, kernel_offset, ramdisk_offset, second_offset,
                        tags_offset);
 
-    ScopedFILE fp(fopen(path.c_str(), "wb" CLOEXEC_FLAG), fclose);
-    if (!fp) {
-        fprintf(stderr, "%s: Failed to open for writing: %s\n",
-                path.c_str(), strerror(errno));
-        return false;
-    }
-
-    // NOTE: RapidJSON has no way of reporting write errors at the moment
-    char write_buf[65536];
-    rj::FileWriteStream os(fp.get(), write_buf, sizeof(write_buf));
-    rj::PrettyWriter<rj::FileWriteStream> writer(os);
+    rj::StringBuffer os;
+    rj::PrettyWriter<rj::StringBuffer> writer(os);
 
     auto cmdline = header.kernel_cmdline();
     auto board_name = header.board_name();
@@ -572,9 +635,32 @@ static bool write_header(const std::string &path, const Header &header)
                     && !(writer.Key(FIELD_PAGE_SIZE) && writer.Uint(*page_size)))
             || !writer.EndObject();
 
-    writer.Flush();
-
     if (failed) {
+        fprintf(stderr, "Failed to serialize header\n");
+        return false;
+    }
+
+    out.assign(os.GetString(), os.GetSize());
+
+    return true;
+}
+
+static bool write_header(const std::string &path, const Header &header)
+{
+    std::string data;
+
+    if (!format_header(header, data)) {
+        return false;
+    }
+
+    ScopedFILE fp(fopen(path.c_str(), "wb" CLOEXEC_FLAG), fclose);
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (fwrite(data.data(), 1, data.size(), fp.get()) != data.size()) {
         fprintf(stderr, "%s: Failed to write file: %s\n",
                 path.c_str(), strerror(errno));
         return false;
@@ -689,6 +775,226 @@ static bool write_entry_to_file(const PathMap &paths, Reader &reader,
     return write_data_entry_to_file(path, reader);
 }
 
+static void set_binary_mode(FILE *fp)
+{
+#ifdef _WIN32
+    _setmode(_fileno(fp), _O_BINARY);
+#else
+    (void) fp;
+#endif
+}
+
+static bool is_seekable(FILE *fp)
+{
+#ifdef _WIN32
+    return _lseeki64(_fileno(fp), 0, SEEK_CUR) >= 0;
+#else
+    return lseek(fileno(fp), 0, SEEK_CUR) >= 0;
+#endif
+}
+
+/*!
+ * \brief Open stdin for reading a boot image
+ *
+ * The readers probe and parse the image at arbitrary offsets, so if stdin is a
+ * pipe, it is read into memory first.
+ */
+static bool open_stdin(Reader &reader)
+{
+    set_binary_mode(stdin);
+
+    if (is_seekable(stdin)) {
+        if (auto r = reader.open(std::make_unique<mb::FdFile>(
+                fileno(stdin), false)); !r) {
+            fprintf(stderr, "stdin: Failed to open for reading: %s\n",
+                    r.error().message().c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    std::vector<unsigned char> data;
+    size_t size = 0;
+
+    while (true) {
+        if (data.size() - size < 65536) {
+            data.resize(std::max<size_t>(data.size() * 2, 1024 * 1024));
+        }
+
+        auto n = fread(data.data() + size, 1, data.size() - size, stdin);
+        size += n;
+
+        if (n == 0) {
+            if (ferror(stdin)) {
+                fprintf(stderr, "stdin: Failed to read data: %s\n",
+                        strerror(errno));
+                return false;
+            }
+            break;
+        }
+    }
+
+    data.resize(size);
+
+    auto file = std::make_unique<mb::MemoryFile>();
+
+    auto r = file->open(std::move(data));
+    if (r) {
+        r = reader.open(std::move(file));
+    }
+    if (!r) {
+        fprintf(stderr, "stdin: Failed to open for reading: %s\n",
+                r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get the sizes of all input files for Writer::set_entry_sizes()
+ *
+ * \return Whether the size of every input file is known. Missing files are
+ *         treated as empty entries.
+ */
+static bool get_entry_sizes(const PathMap &paths, std::vector<Entry> &entries)
+{
+    static constexpr EntryType types[] = {
+        EntryType::Kernel,
+        EntryType::Ramdisk,
+        EntryType::SecondBoot,
+        EntryType::DeviceTree,
+        EntryType::Aboot,
+        EntryType::MtkKernelHeader,
+        EntryType::MtkRamdiskHeader,
+        EntryType::SonyIpl,
+        EntryType::SonyRpm,
+        EntryType::SonyAppsbl,
+    };
+
+    entries.clear();
+
+    for (auto type : types) {
+        auto it = paths.find(entry_type_to_source_type(type));
+        if (it == paths.end()) {
+            continue;
+        }
+
+        struct stat sb;
+
+        if (stat(it->second.c_str(), &sb) < 0) {
+            if (errno == ENOENT) {
+                continue;
+            }
+            return false;
+        } else if ((sb.st_mode & S_IFMT) != S_IFREG) {
+            return false;
+        }
+
+        Entry entry(type);
+        entry.set_size(static_cast<uint64_t>(sb.st_size));
+        entries.push_back(std::move(entry));
+    }
+
+    return true;
+}
+
+static bool write_archive_header(archive *a, const std::string &name,
+                                 uint64_t size)
+{
+    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
+    if (!entry) {
+        fprintf(stderr, "Failed to allocate archive entry\n");
+        return false;
+    }
+
+    archive_entry_set_pathname(entry.get(), name.c_str());
+    archive_entry_set_filetype(entry.get(), AE_IFREG);
+    archive_entry_set_perm(entry.get(), 0644);
+    archive_entry_set_size(entry.get(), static_cast<la_int64_t>(size));
+
+    if (archive_write_header(a, entry.get()) != ARCHIVE_OK) {
+        fprintf(stderr, "%s: Failed to write archive header: %s\n",
+                name.c_str(), archive_error_string(a));
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_archive_data(archive *a, const std::string &name,
+                               const void *data, size_t size)
+{
+    if (archive_write_data(a, data, size) != static_cast<la_ssize_t>(size)) {
+        fprintf(stderr, "%s: Failed to write archive data: %s\n",
+                name.c_str(), archive_error_string(a));
+        return false;
+    }
+
+    return true;
+}
+
+static bool write_header_to_archive(archive *a, const std::string &name,
+                                    const Header &header)
+{
+    std::string data;
+
+    return format_header(header, data)
+            && write_archive_header(a, name, data.size())
+            && write_archive_data(a, name, data.data(), data.size());
+}
+
+static bool write_entry_to_archive(archive *a, const PathMap &paths,
+                                   Reader &reader, const Entry &entry)
+{
+    auto const &name = paths.at(entry_type_to_source_type(entry.type()));
+    char buf[10240];
+
+    // The size is needed before the data is written, so buffer the entry if
+    // the format doesn't provide it
+    if (!entry.size()) {
+        std::string data;
+
+        while (true) {
+            auto n = reader.read_data(buf, sizeof(buf));
+            if (!n) {
+                fprintf(stderr, "Failed to read entry data: %s\n",
+                        n.error().message().c_str());
+                return false;
+            } else if (n.value() == 0) {
+                break;
+            }
+
+            data.append(buf, n.value());
+        }
+
+        return write_archive_header(a, name, data.size())
+                && write_archive_data(a, name, data.data(), data.size());
+    }
+
+    if (!write_archive_header(a, name, *entry.size())) {
+        return false;
+    }
+
+    while (true) {
+        auto n = reader.read_data(buf, sizeof(buf));
+        if (!n) {
+            fprintf(stderr, "Failed to read entry data: %s\n",
+                    n.error().message().c_str());
+            return false;
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        if (!write_archive_data(a, name, buf, n.value())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 struct SourceTypeArg
 {
     SourceType type;
@@ -704,16 +1010,43 @@ struct SourceTypeArg
     }
 };
 
-static bool unpack_main(int argc, char *argv[])
+enum class ArchiveFormat
+{
+    None,
+    Tar,
+    Cpio,
+};
+
+struct UnpackArgs
+{
+    std::string input_file;
+    std::string output_dir;
+    ArchiveFormat archive_format = ArchiveFormat::None;
+    Formats formats;
+    PathMap paths;
+};
+
+struct PackArgs
+{
+    std::string output_file;
+    Format format = Format::Android;
+    PathMap paths;
+};
+
+static bool parse_unpack_args(int argc, char *argv[], UnpackArgs &args,
+                              bool &help)
 {
     int opt;
     bool no_prefix = false;
     std::string input_file;
     std::string output_dir;
     std::string prefix;
+    ArchiveFormat archive_format = ArchiveFormat::None;
     Formats formats;
     PathMap paths;
 
+    help = false;
+
     constexpr char source_arg_prefix[] = "input-";
 
     auto sources = {
@@ -729,10 +1062,11 @@ static bool unpack_main(int argc, char *argv[])
         SourceTypeArg(SourceType::SonyAppsbl, source_arg_prefix),
     };
 
-    static const char short_options[] = "o:p:nt:" "h";
+    static const char short_options[] = "o:a:p:nt:" "h";
 
     std::vector<option> long_options{
         {"output",   required_argument, nullptr, 'o'},
+        {"archive",  required_argument, nullptr, 'a'},
         {"prefix",   required_argument, nullptr, 'p'},
         {"noprefix", required_argument, nullptr, 'n'},
         {"type",     required_argument, nullptr, 't'},
@@ -767,6 +1101,16 @@ static bool unpack_main(int argc, char *argv[])
         case 'o': output_dir = optarg; break;
         case 'p': prefix = optarg;     break;
         case 'n': no_prefix = true;    break;
+        case 'a':
+            if (strcmp(optarg, "tar") == 0) {
+                archive_format = ArchiveFormat::Tar;
+            } else if (strcmp(optarg, "cpio") == 0) {
+                archive_format = ArchiveFormat::Cpio;
+            } else {
+                fprintf(stderr, "Invalid archive format '%s'\n", optarg);
+                return false;
+            }
+            break;
         case 't': {
             if (auto f = name_to_format(optarg)) {
                 formats |= *f;
@@ -778,6 +1122,7 @@ static bool unpack_main(int argc, char *argv[])
         }
         case 'h':
             fputs(HELP_UNPACK_USAGE, stdout);
+            help = true;
             return true;
         default:
             fputs(HELP_UNPACK_USAGE, stderr);
@@ -795,42 +1140,91 @@ static bool unpack_main(int argc, char *argv[])
 
     if (no_prefix) {
         prefix.clear();
-    } else if (prefix.empty()) {
+    } else if (prefix.empty() && input_file != STDIO_PATH) {
         prefix = mb::io::base_name(input_file);
         prefix += "-";
     }
 
-    if (output_dir.empty()) {
+    // Archive member names are relative to the archive root by default
+    if (output_dir.empty() && archive_format == ArchiveFormat::None) {
         output_dir = ".";
     }
 
     for (auto const &s : sources) {
         if (paths.find(s.type) == paths.end()) {
-            paths[s.type] = mb::io::path_join({output_dir,
-                    prefix + std::string(get_default_filename(s.type))});
+            auto name = prefix + std::string(get_default_filename(s.type));
+
+            if (output_dir.empty()) {
+                paths[s.type] = std::move(name);
+            } else {
+                paths[s.type] = mb::io::path_join({output_dir, name});
+            }
         }
     }
 
-    if (auto r = mb::io::create_directories(output_dir); !r) {
+    if (!formats) {
+        formats = ALL_FORMATS;
+    }
+
+    args.input_file = std::move(input_file);
+    args.output_dir = std::move(output_dir);
+    args.archive_format = archive_format;
+    args.formats = formats;
+    args.paths = std::move(paths);
+
+    return true;
+}
+
+static bool unpack_image(const UnpackArgs &args)
+{
+    auto const &input_file = args.input_file;
+    auto paths = args.paths;
+
+    ScopedArchive a(nullptr, archive_write_free);
+
+    if (args.archive_format != ArchiveFormat::None) {
+        a.reset(archive_write_new());
+        if (!a) {
+            fprintf(stderr, "Failed to allocate archive\n");
+            return false;
+        }
+
+        auto ret = args.archive_format == ArchiveFormat::Tar
+                ? archive_write_set_format_pax_restricted(a.get())
+                : archive_write_set_format_cpio_newc(a.get());
+        if (ret != ARCHIVE_OK) {
+            fprintf(stderr, "Failed to set archive format: %s\n",
+                    archive_error_string(a.get()));
+            return false;
+        }
+
+        set_binary_mode(stdout);
+
+        if (archive_write_open_fd(a.get(), fileno(stdout)) != ARCHIVE_OK) {
+            fprintf(stderr, "stdout: Failed to open archive: %s\n",
+                    archive_error_string(a.get()));
+            return false;
+        }
+    } else if (auto r = mb::io::create_directories(args.output_dir); !r) {
         fprintf(stderr, "%s: Failed to create directory: %s\n",
-                output_dir.c_str(), r.error().message().c_str());
+                args.output_dir.c_str(), r.error().message().c_str());
         return false;
     }
 
     // Load the boot image
     Reader reader;
 
-    if (!formats) {
-        formats = ALL_FORMATS;
-    }
-
-    if (auto r = reader.enable_formats(formats); !r) {
+    if (auto r = reader.enable_formats(args.formats); !r) {
         fprintf(stderr, "Failed to enable formats: %s\n",
                 r.error().message().c_str());
         return false;
     }
 
-    if (auto r = reader.open_filename(input_file); !r) {
+    if (input_file == STDIO_PATH) {
+        if (!open_stdin(reader)) {
+            return false;
+        }
+    } else if (auto r = reader.open_filename(input_file); !r) {
         fprintf(stderr, "%s: Failed to open for reading: %s\n",
                 input_file.c_str(), r.error().message().c_str());
         return false;
@@ -843,7 +1237,12 @@ static bool unpack_main(int argc, char *argv[])
         return false;
     }
 
-    if (!write_header(paths[SourceType::Header], header.value())) {
+    if (a) {
+        if (!write_header_to_archive(a.get(), paths[SourceType::Header],
+                                     header.value())) {
+            return false;
+        }
+    } else if (!write_header(paths[SourceType::Header], header.value())) {
         return false;
     }
 
@@ -858,15 +1257,41 @@ static bool unpack_main(int argc, char *argv[])
             return false;
         }
 
-        if (!write_entry_to_file(paths, reader, entry.value())) {
+        if (a) {
+            if (!write_entry_to_archive(a.get(), paths, reader,
+                                        entry.value())) {
+                return false;
+            }
+        } else if (!write_entry_to_file(paths, reader, entry.value())) {
             return false;
         }
     }
 
+    if (a && archive_write_close(a.get()) != ARCHIVE_OK) {
+        fprintf(stderr, "stdout: Failed to close archive: %s\n",
+                archive_error_string(a.get()));
+        return false;
+    }
+
     return true;
 }
 
-static bool pack_main(int argc, char *argv[])
+static bool unpack_main(int argc, char *argv[])
+{
+    UnpackArgs args;
+    bool help;
+
+    if (!parse_unpack_args(argc, argv, args, help)) {
+        return false;
+    } else if (help) {
+        return true;
+    }
+
+    return unpack_image(args);
+}
+
+static bool parse_pack_args(int argc, char *argv[], PackArgs &args,
+                            bool &help)
 {
     int opt;
     bool no_prefix = false;
@@ -876,6 +1301,8 @@ static bool pack_main(int argc, char *argv[])
     Format format = Format::Android;
     PathMap paths;
 
+    help = false;
+
     constexpr char source_arg_prefix[] = "input-";
 
     auto sources = {
@@ -941,6 +1368,7 @@ static bool pack_main(int argc, char *argv[])
         }
         case 'h':
             fputs(HELP_PACK_USAGE, stdout);
+            help = true;
             return true;
         default:
             fputs(HELP_PACK_USAGE, stderr);
@@ -958,7 +1386,7 @@ static bool pack_main(int argc, char *argv[])
 
     if (no_prefix) {
         prefix.clear();
-    } else if (prefix.empty()) {
+    } else if (prefix.empty() && output_file != STDIO_PATH) {
         prefix = mb::io::base_name(output_file);
         prefix += "-";
     }
@@ -974,16 +1402,75 @@ static bool pack_main(int argc, char *argv[])
         }
     }
 
+    args.output_file = std::move(output_file);
+    args.format = format;
+    args.paths = std::move(paths);
+
+    return true;
+}
+
+static bool pack_image(const PackArgs &args)
+{
+    auto const &output_file = args.output_file;
+    auto paths = args.paths;
+
+    // When writing to a pipe, formats that can't be written sequentially are
+    // assembled in memory and copied to stdout at the end
+    mb::FdFile stdout_file;
+    void *mem_buf = nullptr;
+    size_t mem_buf_size = 0;
+    mb::MemoryFile mem_file;
+    bool buffered = false;
+
+    auto free_mem_buf = mb::finally([&] {
+        free(mem_buf);
+    });
+
     // Load the boot image
     Writer writer;
 
-    if (auto r = writer.set_format(format); !r) {
+    if (auto r = writer.set_format(args.format); !r) {
         fprintf(stderr, "Failed to set format: %s\n",
                 r.error().message().c_str());
         return false;
     }
 
-    if (auto r = writer.open_filename(output_file); !r) {
+    if (output_file == STDIO_PATH) {
+        set_binary_mode(stdout);
+
+        auto r = stdout_file.open(fileno(stdout), false);
+        if (r) {
+            r = writer.open(&stdout_file);
+        }
+        if (!r) {
+            fprintf(stderr, "stdout: Failed to open for writing: %s\n",
+                    r.error().message().c_str());
+            return false;
+        }
+
+        std::vector<Entry> entry_sizes;
+
+        if (!is_seekable(stdout)) {
+            if (!get_entry_sizes(paths, entry_sizes)
+                    || !writer.set_entry_sizes(entry_sizes)) {
+                buffered = true;
+            }
+        }
+
+        if (buffered) {
+            (void) writer.close();
+
+            r = mem_file.open(&mem_buf, &mem_buf_size);
+            if (r) {
+                r = writer.open(&mem_file);
+            }
+            if (!r) {
+                fprintf(stderr, "Failed to open memory buffer: %s\n",
+                        r.error().message().c_str());
+                return false;
+            }
+        }
+    } else if (auto r = writer.open_filename(output_file); !r) {
         fprintf(stderr, "%s: Failed to open for writing: %s\n",
                 output_file.c_str(), r.error().message().c_str());
         return false;
@@ -1028,9 +1515,236 @@ static bool pack_main(int argc, char *argv[])
         return false;
     }
 
+    if (buffered) {
+        if (auto r = mb::file_write_exact(stdout_file, mem_buf, mem_buf_size);
+                !r) {
+            fprintf(stderr, "stdout: Failed to write data: %s\n",
+                    r.error().message().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool pack_main(int argc, char *argv[])
+{
+    PackArgs args;
+    bool help;
+
+    if (!parse_pack_args(argc, argv, args, help)) {
+        return false;
+    } else if (help) {
+        return true;
+    }
+
+    return pack_image(args);
+}
+
+struct BatchJob
+{
+    std::string command_line;
+    std::function<bool()> run;
+    bool success = false;
+    std::chrono::steady_clock::duration duration{};
+};
+
+static bool parse_batch_line(const std::string &line, BatchJob &job)
+{
+    std::vector<std::string> args;
+
+    for (auto &arg : mb::split(line, " \t")) {
+        if (!arg.empty()) {
+            args.push_back(std::move(arg));
+        }
+    }
+
+    std::vector<char *> argv;
+    for (auto &arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    // getopt_long() keeps global state. Reset it so it parses from the start
+    // of each line.
+    optind = 0;
+
+    auto argc = static_cast<int>(argv.size() - 1);
+    bool help;
+
+    if (args[0] == "unpack") {
+        UnpackArgs unpack_args;
+
+        if (!parse_unpack_args(argc, argv.data(), unpack_args, help)
+                || help) {
+            return false;
+        } else if (unpack_args.input_file == STDIO_PATH
+                || unpack_args.archive_format != ArchiveFormat::None) {
+            fprintf(stderr, "Batch commands cannot use stdin or stdout\n");
+            return false;
+        }
+
+        job.run = [unpack_args = std::move(unpack_args)] {
+            return unpack_image(unpack_args);
+        };
+    } else if (args[0] == "pack") {
+        PackArgs pack_args;
+
+        if (!parse_pack_args(argc, argv.data(), pack_args, help) || help) {
+            return false;
+        } else if (pack_args.output_file == STDIO_PATH) {
+            fprintf(stderr, "Batch commands cannot use stdin or stdout\n");
+            return false;
+        }
+
+        job.run = [pack_args = std::move(pack_args)] {
+            return pack_image(pack_args);
+        };
+    } else {
+        fprintf(stderr, "Invalid batch command '%s'\n", args[0].c_str());
+        return false;
+    }
+
+    job.command_line = mb::join(args, ' ');
+
     return true;
 }
 
+static bool batch_main(int argc, char *argv[])
+{
+    int opt;
+    unsigned int jobs = 0;
+
+    static const char short_options[] = "j:" "h";
+
+    static const option long_options[] = {
+        {"jobs", required_argument, nullptr, 'j'},
+        {"help", no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, jobs) || jobs == 0) {
+                fprintf(stderr, "Invalid job count: %s\n", optarg);
+                return false;
+            }
+            break;
+        case 'h':
+            fputs(HELP_BATCH_USAGE, stdout);
+            return true;
+        default:
+            fputs(HELP_BATCH_USAGE, stderr);
+            return false;
+        }
+    }
+
+    // There should be one other argument
+    if (argc - optind != 1) {
+        fputs(HELP_BATCH_USAGE, stderr);
+        return false;
+    }
+
+    std::string manifest_file(argv[optind]);
+
+    std::ifstream manifest(manifest_file);
+    if (!manifest) {
+        fprintf(stderr, "%s: Failed to open for reading\n",
+                manifest_file.c_str());
+        return false;
+    }
+
+    // Parse all commands up front. getopt_long() is not thread safe and
+    // invalid lines should be reported before doing any work.
+    std::vector<BatchJob> batch;
+    std::string line;
+    size_t line_num = 0;
+
+    while (std::getline(manifest, line)) {
+        ++line_num;
+
+        mb::trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        BatchJob job;
+
+        if (!parse_batch_line(line, job)) {
+            fprintf(stderr, "%s:%" MB_PRIzu ": Invalid command: %s\n",
+                    manifest_file.c_str(), line_num, line.c_str());
+            return false;
+        }
+
+        batch.push_back(std::move(job));
+    }
+
+    if (manifest.bad()) {
+        fprintf(stderr, "%s: Failed to read file\n", manifest_file.c_str());
+        return false;
+    }
+
+    if (jobs == 0) {
+        jobs = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    jobs = static_cast<unsigned int>(
+            std::clamp<size_t>(batch.size(), 1, jobs));
+
+    // Each worker takes the next unstarted command until there are none left
+    std::atomic<size_t> next_job(0);
+
+    auto worker = [&] {
+        size_t i;
+
+        while ((i = next_job++) < batch.size()) {
+            auto &job = batch[i];
+            auto start = std::chrono::steady_clock::now();
+
+            job.success = job.run();
+            job.duration = std::chrono::steady_clock::now() - start;
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < jobs; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    auto total_duration = std::chrono::steady_clock::now() - start;
+
+    // Print summary
+    using SecondsDouble = std::chrono::duration<double>;
+    size_t failed = 0;
+
+    for (auto const &job : batch) {
+        printf("%9.3fs  %-6s  %s\n",
+               std::chrono::duration_cast<SecondsDouble>(job.duration).count(),
+               job.success ? "OK" : "FAILED", job.command_line.c_str());
+
+        if (!job.success) {
+            ++failed;
+        }
+    }
+
+    printf("Ran %" MB_PRIzu " commands (%" MB_PRIzu " failed) in %.3fs"
+           " using %u threads\n", batch.size(), failed,
+           std::chrono::duration_cast<SecondsDouble>(total_duration).count(),
+           jobs);
+
+    return failed == 0;
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -1045,6 +1759,8 @@ int main(int argc, char *argv[])
         ret = unpack_main(--argc, ++argv);
     } else if (command == "pack") {
         ret = pack_main(--argc, ++argv);
+    } else if (command == "batch") {
+        ret = batch_main(--argc, ++argv);
     } else {
         fputs(HELP_MAIN_USAGE, stderr);
         return EXIT_FAILURE;
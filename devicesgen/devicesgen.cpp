@@ -25,9 +25,11 @@
 
 #include <rapidjson/filewritestream.h>
 #include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 #include <yaml-cpp/yaml.h>
 
+#include "mbdevice/binary.h"
 #include "mbdevice/json.h"
 #include "mbdevice/schema.h"
 
@@ -161,6 +163,40 @@ static bool validate_and_write(Document &d, const SchemaDocument &sd,
     return true;
 }
 
+static bool validate_and_write_binary(Document &d, const SchemaDocument &sd,
+                                      FILE *fp)
+{
+    StringBuffer sb;
+    Writer<StringBuffer> writer(sb);
+
+    if (!validate_and_write(d, sd, writer)) {
+        return false;
+    }
+
+    std::vector<Device> devices;
+    JsonError error;
+
+    if (!device_list_from_json(sb.GetString(), devices, error)) {
+        fprintf(stderr, "Failed to load generated device list\n");
+        return false;
+    }
+
+    std::string data;
+
+    if (!device_list_to_binary(devices, data)) {
+        fprintf(stderr, "Device list is too large for the binary format\n");
+        return false;
+    }
+
+    if (fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+        fprintf(stderr, "Failed to write binary device list: %s\n",
+                strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
 static void usage(FILE *stream)
 {
     fprintf(stream,
@@ -170,7 +206,9 @@ static void usage(FILE *stream)
             "  -o, --output <file>\n"
             "                   Output file (outputs to stdout if omitted)\n"
             "  -h, --help       Display this help message\n"
-            "  --styled         Output in human-readable format\n");
+            "  --styled         Output in human-readable format\n"
+            "  --binary         Output in the binary format read by\n"
+            "                   BinaryDeviceDatabase\n");
 }
 
 int main(int argc, char *argv[])
@@ -179,12 +217,14 @@ int main(int argc, char *argv[])
 
     enum Options {
         OPT_STYLED             = 1000,
+        OPT_BINARY             = 1001,
     };
 
     static const char short_options[] = "o:h";
 
     static struct option long_options[] = {
         {"styled", no_argument, 0, OPT_STYLED},
+        {"binary", no_argument, 0, OPT_BINARY},
         {"output", required_argument, 0, 'o'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
@@ -194,6 +234,7 @@ int main(int argc, char *argv[])
 
     const char *output_file = nullptr;
     bool styled = false;
+    bool binary = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
@@ -202,6 +243,10 @@ int main(int argc, char *argv[])
             styled = true;
             break;
 
+        case OPT_BINARY:
+            binary = true;
+            break;
+
         case 'o':
             output_file = optarg;
             break;
@@ -245,7 +290,9 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (styled) {
+    if (binary) {
+        ret = validate_and_write_binary(d, *sd, fp);
+    } else if (styled) {
         PrettyWriter<FileWriteStream> writer(os);
         ret = validate_and_write(d, *sd, writer);
     } else {
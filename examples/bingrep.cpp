@@ -19,10 +19,12 @@
 
 #include "mbcommon/file_util.h"
 
+#include <algorithm>
 #include <limits>
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
@@ -36,6 +38,7 @@
 #include "mbcommon/file/standard.h"
 #include "mbcommon/file/posix.h"
 #include "mbcommon/integer.h"
+#include "mbcommon/thread_pool.h"
 
 static void usage(FILE *stream, const char *prog_name)
 {
@@ -46,8 +49,15 @@ static void usage(FILE *stream, const char *prog_name)
                     "                  Search file for hex pattern\n"
                     "  -t, --text <text pattern>\n"
                     "                  Search file for text pattern\n"
+                    "\n"
+                    "  -p and -t can be specified multiple times to search for\n"
+                    "  several patterns in a single pass.\n"
+                    "\n"
                     "  -n, --num-matches\n"
                     "                  Maximum number of matches\n"
+                    "  -j, --threads <threads>\n"
+                    "                  Search files in parallel chunks using the\n"
+                    "                  specified number of threads (0 = auto)\n"
                     "  --start-offset  Starting boundary offset for search\n"
                     "  --end-offset    Ending boundary offset for search\n",
                     prog_name);
@@ -94,7 +104,7 @@ static bool hex_to_binary(std::string_view hex, std::string &data)
 static bool search(const char *name, mb::File &file,
                    std::optional<uint64_t> start,
                    std::optional<uint64_t> end,
-                   std::string_view pattern,
+                   const std::vector<std::string> &patterns,
                    std::optional<uint64_t> max_matches)
 {
     using namespace std::placeholders;
@@ -109,7 +119,12 @@ static bool search(const char *name, mb::File &file,
         start = 0;
     }
 
-    mb::FileSearcher searcher(&file, pattern.data(), pattern.size());
+    std::vector<mb::FileSearcher::Pattern> search_patterns;
+    for (auto const &p : patterns) {
+        search_patterns.push_back({p.data(), p.size()});
+    }
+
+    mb::FileSearcher searcher(&file, std::move(search_patterns));
 
     while (true) {
         if (max_matches) {
@@ -119,13 +134,19 @@ static bool search(const char *name, mb::File &file,
             --*max_matches;
         }
 
-        if (auto r = searcher.next()) {
+        if (auto r = searcher.next_match()) {
             if (r.value()) {
-                if (end && (*r.value() + pattern.size()) > *end) {
+                auto const &match = *r.value();
+
+                if (end && (match.offset + patterns[match.pattern].size())
+                        > *end) {
                     // Artificial EOF
                     break;
+                } else if (patterns.size() > 1) {
+                    printf("%s: 0x%016" PRIx64 " (pattern %zu)\n",
+                           name, match.offset + *start, match.pattern + 1);
                 } else {
-                    printf("%s: 0x%016" PRIx64 "\n", name, *r.value() + *start);
+                    printf("%s: 0x%016" PRIx64 "\n", name, match.offset + *start);
                 }
             } else {
                 // No more matches
@@ -141,9 +162,65 @@ static bool search(const char *name, mb::File &file,
     return true;
 }
 
+static bool search_parallel(const char *name, mb::File &file,
+                            std::optional<uint64_t> start,
+                            std::optional<uint64_t> end,
+                            const std::vector<std::string> &patterns,
+                            std::optional<uint64_t> max_matches,
+                            unsigned int threads)
+{
+    auto file_size = file.seek(0, SEEK_END);
+    if (!file_size) {
+        fprintf(stderr, "%s: Failed to seek file: %s\n",
+                name, file_size.error().message().c_str());
+        return false;
+    }
+
+    uint64_t begin = start ? *start : 0;
+    uint64_t limit = end ? std::min(*end, file_size.value())
+            : file_size.value();
+
+    if (begin >= limit) {
+        return true;
+    }
+
+    std::vector<mb::FileSearcher::Pattern> search_patterns;
+    for (auto const &p : patterns) {
+        search_patterns.push_back({p.data(), p.size()});
+    }
+
+    mb::ThreadPool pool(threads);
+
+    auto r = mb::FileSearcher::search_parallel(
+            file, begin, limit - begin, search_patterns, pool);
+    if (!r) {
+        fprintf(stderr, "%s: Search failed: %s\n",
+                name, r.error().message().c_str());
+        return false;
+    }
+
+    for (auto const &match : r.value()) {
+        if (max_matches) {
+            if (*max_matches == 0) {
+                break;
+            }
+            --*max_matches;
+        }
+
+        if (patterns.size() > 1) {
+            printf("%s: 0x%016" PRIx64 " (pattern %zu)\n",
+                   name, match.offset + begin, match.pattern + 1);
+        } else {
+            printf("%s: 0x%016" PRIx64 "\n", name, match.offset + begin);
+        }
+    }
+
+    return true;
+}
+
 static bool search_stdin(std::optional<uint64_t> start,
                          std::optional<uint64_t> end,
-                         std::string_view pattern,
+                         const std::vector<std::string> &patterns,
                          std::optional<uint64_t> max_matches)
 {
     mb::PosixFile file;
@@ -155,14 +232,15 @@ static bool search_stdin(std::optional<uint64_t> start,
         return false;
     }
 
-    return search("stdin", file, start, end, pattern, max_matches);
+    return search("stdin", file, start, end, patterns, max_matches);
 }
 
 static bool search_file(const char *path,
                         std::optional<uint64_t> start,
                         std::optional<uint64_t> end,
-                        std::string_view pattern,
-                        std::optional<uint64_t> max_matches)
+                        const std::vector<std::string> &patterns,
+                        std::optional<uint64_t> max_matches,
+                        std::optional<unsigned int> threads)
 {
     mb::StandardFile file;
 
@@ -173,7 +251,12 @@ static bool search_file(const char *path,
         return false;
     }
 
-    return search(path, file, start, end, pattern, max_matches);
+    if (threads) {
+        return search_parallel(path, file, start, end, patterns, max_matches,
+                               *threads);
+    }
+
+    return search(path, file, start, end, patterns, max_matches);
 }
 
 int main(int argc, char *argv[])
@@ -181,7 +264,8 @@ int main(int argc, char *argv[])
     std::optional<uint64_t> start;
     std::optional<uint64_t> end;
     std::optional<uint64_t> max_matches;
-    std::optional<std::string> pattern;
+    std::optional<unsigned int> threads;
+    std::vector<std::string> patterns;
 
     int opt;
 
@@ -192,11 +276,12 @@ int main(int argc, char *argv[])
         OPT_END_OFFSET           = CHAR_MAX + 2,
     };
 
-    static const char short_options[] = "hn:p:t:";
+    static const char short_options[] = "hj:n:p:t:";
 
     static struct option long_options[] = {
         // Arguments with short versions
         {"help",         no_argument,       nullptr, 'h'},
+        {"threads",      required_argument, nullptr, 'j'},
         {"num-matches",  required_argument, nullptr, 'n'},
         {"hex",          required_argument, nullptr, 'p'},
         {"text",         required_argument, nullptr, 't'},
@@ -222,17 +307,29 @@ int main(int argc, char *argv[])
             break;
         }
 
+        case 'j': {
+            unsigned int value;
+            if (!mb::str_to_num(optarg, 10, value)) {
+                fprintf(stderr, "Invalid value for -j/--threads: %s\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            threads = value;
+            break;
+        }
+
         case 'p': {
-            pattern = "";
-            if (!hex_to_binary(optarg, *pattern)) {
+            std::string pattern;
+            if (!hex_to_binary(optarg, pattern)) {
                 fprintf(stderr, "Invalid hex pattern: %s\n", strerror(errno));
                 return EXIT_FAILURE;
             }
+            patterns.push_back(std::move(pattern));
             break;
         }
 
         case 't':
-            pattern = optarg;
+            patterns.push_back(optarg);
             break;
 
         case OPT_START_OFFSET: {
@@ -267,7 +364,7 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (!pattern) {
+    if (patterns.empty()) {
         fprintf(stderr, "No pattern provided\n");
         return EXIT_FAILURE;
     }
@@ -275,10 +372,11 @@ int main(int argc, char *argv[])
     bool ret = true;
 
     if (optind == argc) {
-        ret = search_stdin(start, end, *pattern, max_matches);
+        ret = search_stdin(start, end, patterns, max_matches);
     } else {
         for (int i = optind; i < argc; ++i) {
-            bool ret2 = search_file(argv[i], start, end, *pattern, max_matches);
+            bool ret2 = search_file(argv[i], start, end, patterns,
+                                    max_matches, threads);
             if (!ret2) {
                 ret = false;
             }
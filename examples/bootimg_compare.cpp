@@ -19,12 +19,10 @@
 
 #include <cstdio>
 #include <cstdlib>
-#include <cstring>
 
 #include <getopt.h>
 
-#include "mbbootimg/entry.h"
-#include "mbbootimg/header.h"
+#include "mbbootimg/compare.h"
 #include "mbbootimg/reader.h"
 
 static void usage(FILE *stream, const char *prog_name)
@@ -76,7 +74,6 @@ int main(int argc, char *argv[])
 
     Reader reader1;
     Reader reader2;
-    size_t entries = 0;
 
     // Set up reader formats
     if (auto r = reader1.enable_formats_all(); !r) {
@@ -102,107 +99,14 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    // Read headers
-    auto header1 = reader1.read_header();
-    if (!header1) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                filename1, header1.error().message().c_str());
+    auto equal = compare(reader1, reader2);
+    if (!equal) {
+        fprintf(stderr, "Failed to compare boot images: %s\n",
+                equal.error().message().c_str());
         return EXIT_FAILURE;
-    }
-    auto header2 = reader2.read_header();
-    if (!header2) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                filename2, header2.error().message().c_str());
-        return EXIT_FAILURE;
-    }
-
-    // Compare headers
-    if (header1.value() != header2.value()) {
+    } else if (!equal.value()) {
         return 2;
     }
 
-    // Count entries in first boot image
-    {
-        while (true) {
-            auto entry = reader1.read_entry();
-            if (!entry) {
-                if (entry.error() == ReaderError::EndOfEntries) {
-                    break;
-                }
-                fprintf(stderr, "%s: Failed to read entry: %s\n",
-                        filename1, entry.error().message().c_str());
-                return EXIT_FAILURE;
-            }
-            ++entries;
-        }
-    }
-
-    // Compare each entry in second image to first
-    {
-        while (true) {
-            auto entry2 = reader2.read_entry();
-            if (!entry2) {
-                if (entry2.error() == ReaderError::EndOfEntries) {
-                    break;
-                }
-                fprintf(stderr, "%s: Failed to read entry: %s",
-                        filename2, entry2.error().message().c_str());
-                return EXIT_FAILURE;
-            }
-
-            if (entries == 0) {
-                // Too few entries in second image
-                return 2;
-            }
-            --entries;
-
-            // Find the same entry in first image
-            auto entry1 = reader1.go_to_entry(entry2.value().type());
-            if (!entry1) {
-                if (entry1.error() == ReaderError::EndOfEntries) {
-                    // Cannot be equal if entry is missing
-                    return 2;
-                } else {
-                    fprintf(stderr, "%s: Failed to seek to entry: %s\n",
-                            filename1, entry1.error().message().c_str());
-                    return EXIT_FAILURE;
-                }
-            }
-
-            // Compare entries
-            if (entry1.value() != entry2.value()) {
-                return 2;
-            }
-
-            // Compare data
-            char buf1[10240];
-            char buf2[10240];
-
-            while (true) {
-                auto n1 = reader1.read_data(buf1, sizeof(buf1));
-                if (!n1) {
-                    fprintf(stderr, "%s: Failed to read data: %s\n", filename1,
-                            n1.error().message().c_str());
-                    return EXIT_FAILURE;
-                }
-
-                auto n2 = reader2.read_data(buf2, sizeof(buf2));
-                if (!n2) {
-                    fprintf(stderr, "%s: Failed to read data: %s\n", filename2,
-                            n2.error().message().c_str());
-                    return EXIT_FAILURE;
-                }
-
-                if (n1.value() == 0 && n2.value() == 0) {
-                    break;
-                } else if (n1.value() != n2.value()
-                        || memcmp(buf1, buf2, n1.value()) != 0) {
-                    // Data is not equivalent
-                    return 2;
-                }
-            }
-        }
-    }
-
     return EXIT_SUCCESS;
 }
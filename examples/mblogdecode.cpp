@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <getopt.h>
+
+#include "mblog/binary_logger.h"
+#include "mblog/log_record.h"
+
+using namespace mb::log;
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+static char level_char(LogLevel prio)
+{
+    switch (prio) {
+    case LogLevel::Error:
+        return 'E';
+    case LogLevel::Warning:
+        return 'W';
+    case LogLevel::Info:
+        return 'I';
+    case LogLevel::Debug:
+        return 'D';
+    case LogLevel::Verbose:
+        return 'V';
+    default:
+        return '?';
+    }
+}
+
+static std::string escape(const std::string &str)
+{
+    std::string result;
+
+    for (char c : str) {
+        switch (c) {
+        case '\\':
+            result += "\\\\";
+            break;
+        case '\t':
+            result += "\\t";
+            break;
+        case '\n':
+            result += "\\n";
+            break;
+        default:
+            result += c;
+            break;
+        }
+    }
+
+    return result;
+}
+
+static void print_text(const LogRecord &rec)
+{
+    using namespace std::chrono;
+
+    auto t = system_clock::to_time_t(rec.time);
+    auto nanos = duration_cast<nanoseconds>(
+            rec.time - time_point_cast<seconds>(rec.time)).count();
+
+    std::tm tm;
+    char buf[64];
+
+    if (!localtime_r(&t, &tm)
+            || strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm) == 0) {
+        buf[0] = '\0';
+    }
+
+    printf("[%s.%09lld][%" PRIu64 ":%" PRIu64 "][%c] %s: %s\n",
+           buf, static_cast<long long>(nanos), rec.pid, rec.tid,
+           level_char(rec.prio), rec.tag.c_str(), rec.msg.c_str());
+}
+
+static void print_tsv(const LogRecord &rec)
+{
+    using namespace std::chrono;
+
+    auto time = duration_cast<nanoseconds>(
+            rec.time.time_since_epoch()).count();
+    auto mono_time = duration_cast<nanoseconds>(
+            rec.mono_time.time_since_epoch()).count();
+
+    printf("%lld\t%lld\t%" PRIu64 "\t%" PRIu64 "\t%c\t%s\t%s\t%s\n",
+           static_cast<long long>(time), static_cast<long long>(mono_time),
+           rec.pid, rec.tid, level_char(rec.prio), escape(rec.tag).c_str(),
+           escape(rec.fmt).c_str(), escape(rec.msg).c_str());
+}
+
+static void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream,
+            "Usage: %s [OPTION]... <file>\n\n"
+            "Decode a log written by libmblog's BinaryLogger.\n\n"
+            "Options:\n"
+            "  -t, --tsv   Print tab-separated fields (wall clock time (ns),\n"
+            "              monotonic time (ns), PID, TID, level, tag, format\n"
+            "              string, message) instead of log lines\n"
+            "  -h, --help  Display this help message\n",
+            prog_name);
+}
+
+int main(int argc, char *argv[])
+{
+    bool tsv = false;
+
+    static struct option long_options[] = {
+        {"tsv",  no_argument, nullptr, 't'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "th", long_options, nullptr)) != -1) {
+        switch (opt) {
+        case 't':
+            tsv = true;
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *path = argv[optind];
+
+    ScopedFILE fp(fopen(path, "rb"), fclose);
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    BinaryLogReader reader(fp.get());
+
+    while (true) {
+        auto rec = reader.next();
+        if (!rec) {
+            fprintf(stderr, "%s: Failed to decode log: %s\n",
+                    path, rec.error().message().c_str());
+            return EXIT_FAILURE;
+        } else if (!rec.value()) {
+            break;
+        }
+
+        if (tsv) {
+            print_tsv(*rec.value());
+        } else {
+            print_text(*rec.value());
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -17,9 +17,13 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <chrono>
 #include <optional>
+#include <vector>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -27,24 +31,165 @@
 #include <getopt.h>
 #include <unistd.h>
 
+#include "mbcommon/file/standard.h"
 #include "mbcommon/integer.h"
+#include "mbcommon/string.h"
 
 #include "mbsystrace/hooks.h"
+#include "mbsystrace/syscalls.h"
+#include "mbsystrace/trace_file.h"
 #include "mbsystrace/tracer.h"
 #include "mbsystrace/tracee.h"
 
+// Match syscalls in every ABI that can be traced
+static constexpr mb::systrace::ArchAbi g_abis[] = {
+#if defined(__x86_64__)
+    mb::systrace::ArchAbi::X86_64,
+    mb::systrace::ArchAbi::X86_32,
+    mb::systrace::ArchAbi::X32,
+#elif defined(__i386__)
+    mb::systrace::ArchAbi::X86_32,
+#elif defined(__aarch64__)
+    mb::systrace::ArchAbi::Aarch64,
+    mb::systrace::ArchAbi::Eabi,
+#elif defined(__arm__)
+    mb::systrace::ArchAbi::Eabi,
+#endif
+};
 
 static void usage(FILE *stream, const char *prog_name)
 {
     fprintf(stream,
             "Usage: %s [option...] -- <cmd> [<arg>...]\n"
             "       %s [option...] -p <PID>\n"
+            "       %s -d <file>\n"
             "\n"
             "Options:\n"
+            "  -d, --decode <file>\n"
+            "                   Print events from a trace written with -o\n"
             "  -f, --follow     Trace new children of tracee\n"
             "  -h, --help       Display this help message\n"
-            "  -p, --pid <PID>  Attach to PID instead of running new command\n",
-            prog_name, prog_name);
+            "  -o, --output <file>\n"
+            "                   Write events to a binary trace file instead\n"
+            "                   of printing them\n"
+            "  -p, --pid <PID>  Attach to PID instead of running new command\n"
+            "  -S, --stats      Print tracer statistics to stderr when done\n"
+            "  -s, --syscalls <name>[,<name>...]\n"
+            "                   Only stop at the specified syscalls (uses a\n"
+            "                   seccomp filter; cannot be used with -p)\n",
+            prog_name, prog_name, prog_name);
+}
+
+static void print_record(const mb::systrace::TraceRecord &r)
+{
+    using namespace mb::systrace;
+
+    auto syscall_name = [&] {
+        auto name = SysCall(r.syscall, r.abi).name();
+        return name ? name : "<unknown>";
+    };
+
+    switch (r.type) {
+    case TraceRecordType::NewTracee:
+        printf("[%d] New tracee began executing\n", r.tid);
+        break;
+    case TraceRecordType::TraceeExit:
+        printf("[%d] Exited with status %d\n", r.tid, r.value);
+        break;
+    case TraceRecordType::TraceeDeath:
+        printf("[%d] Killed by signal %d\n", r.tid, r.value);
+        break;
+    case TraceRecordType::TraceeDisappear:
+        printf("[%d] Disappeared due to execve call\n", r.tid);
+        break;
+    case TraceRecordType::TraceeSignal:
+        printf("[%d] Received signal %d\n", r.tid, r.value);
+        break;
+    case TraceRecordType::GroupStop:
+        printf("[%d] Entering group stop from signal %d\n", r.tid, r.value);
+        break;
+    case TraceRecordType::InterruptStop:
+        printf("[%d] Interrupted\n", r.tid);
+        break;
+    case TraceRecordType::SysCallEntry:
+        printf("[%d] Entering syscall: %s\n", r.tid, syscall_name());
+        break;
+    case TraceRecordType::SysCallExit:
+        printf("[%d] Exiting syscall: %s\n", r.tid, syscall_name());
+        break;
+    case TraceRecordType::UnknownChild:
+        printf("[%d] Unknown child reported event with status 0x%x\n",
+               r.tid, r.value);
+        break;
+    }
+}
+
+static double to_ms(std::chrono::nanoseconds duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static void print_stats(const mb::systrace::TracerStats &stats)
+{
+    using namespace mb::systrace;
+
+    fprintf(stderr, "Events:           %" PRIu64 "\n", stats.events);
+    fprintf(stderr, "ptrace calls:     %" PRIu64 " (%.2f per event)\n",
+            stats.ptrace_calls, stats.events
+                    ? static_cast<double>(stats.ptrace_calls)
+                            / static_cast<double>(stats.events)
+                    : 0.0);
+    fprintf(stderr, "Time waiting:     %.3f ms\n", to_ms(stats.wait_time));
+    fprintf(stderr, "Time in hooks:    %.3f ms\n", to_ms(stats.hook_time));
+    fprintf(stderr, "Time stopped:     %.3f ms\n", to_ms(stats.stop_time));
+
+    std::vector<std::pair<SysCall, SysCallStopCounts>> syscalls;
+    for (auto const &[key, counts] : stats.syscalls) {
+        syscalls.emplace_back(SysCall(key.second, key.first), counts);
+    }
+
+    std::stable_sort(syscalls.begin(), syscalls.end(),
+                     [](auto const &a, auto const &b) {
+                         return a.second.entry + a.second.exit
+                                 > b.second.entry + b.second.exit;
+                     });
+
+    fprintf(stderr, "\n%-24s %4s %10s %10s\n",
+            "Syscall", "ABI", "Entries", "Exits");
+
+    for (auto const &[sc, counts] : syscalls) {
+        fprintf(stderr, "%-24s %4d %10" PRIu64 " %10" PRIu64 "\n",
+                sc.name(), static_cast<int>(sc.abi()),
+                counts.entry, counts.exit);
+    }
+}
+
+static int decode_trace(const char *path)
+{
+    mb::StandardFile file;
+
+    if (auto r = file.open(path, mb::FileOpenMode::ReadOnly); !r) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                path, r.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    mb::systrace::TraceReader reader(file);
+
+    while (true) {
+        auto record = reader.next();
+        if (!record) {
+            fprintf(stderr, "%s: Failed to read trace: %s\n",
+                    path, record.error().message().c_str());
+            return EXIT_FAILURE;
+        } else if (!record.value()) {
+            break;
+        }
+
+        print_record(*record.value());
+    }
+
+    return EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[])
@@ -53,26 +198,42 @@ int main(int argc, char *argv[])
 
     int opt;
 
-    static constexpr char short_options[] = "fhp:";
+    static constexpr char short_options[] = "d:fho:p:Ss:";
 
     static option long_options[] = {
-        {"follow", no_argument,       nullptr, 'f'},
-        {"help",   no_argument,       nullptr, 'h'},
-        {"pid",    required_argument, nullptr, 'p'},
-        {nullptr,  0,                 nullptr, 0},
+        {"decode",   required_argument, nullptr, 'd'},
+        {"follow",   no_argument,       nullptr, 'f'},
+        {"help",     no_argument,       nullptr, 'h'},
+        {"output",   required_argument, nullptr, 'o'},
+        {"pid",      required_argument, nullptr, 'p'},
+        {"stats",    no_argument,       nullptr, 'S'},
+        {"syscalls", required_argument, nullptr, 's'},
+        {nullptr,    0,                 nullptr, 0},
     };
 
+    const char *decode_path = nullptr;
+    const char *output_path = nullptr;
+    bool show_stats = false;
     std::optional<pid_t> pid;
+    std::optional<std::vector<SysCall>> syscalls;
     Flags flags;
     int long_index = 0;
 
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
         switch (opt) {
+        case 'd':
+            decode_path = optarg;
+            break;
+
         case 'f':
             flags |= Flag::TraceChildren;
             break;
 
+        case 'o':
+            output_path = optarg;
+            break;
+
         case 'p':
             pid_t value;
             if (!mb::str_to_num(optarg, 10, value)) {
@@ -82,6 +243,31 @@ int main(int argc, char *argv[])
             pid = value;
             break;
 
+        case 'S':
+            show_stats = true;
+            break;
+
+        case 's':
+            if (!syscalls) {
+                syscalls.emplace();
+            }
+            for (auto const &name : mb::split(optarg, ',')) {
+                bool found = false;
+
+                for (auto abi : g_abis) {
+                    if (SysCall sc(name.c_str(), abi); sc) {
+                        syscalls->push_back(sc);
+                        found = true;
+                    }
+                }
+
+                if (!found) {
+                    fprintf(stderr, "Unknown syscall: %s\n", name.c_str());
+                    return EXIT_FAILURE;
+                }
+            }
+            break;
+
         case 'h':
             usage(stdout, argv[0]);
             return EXIT_SUCCESS;
@@ -92,64 +278,107 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (pid ? (argc - optind > 0) : (argc - optind == 0)) {
+    if (decode_path) {
+        if (pid || syscalls || output_path || argc - optind > 0) {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        return decode_trace(decode_path);
+    }
+
+    if ((pid && syscalls)
+            || (pid ? (argc - optind > 0) : (argc - optind == 0))) {
         usage(stderr, argv[0]);
         return EXIT_FAILURE;
     }
 
+    mb::StandardFile output_file;
+    std::optional<TraceWriter> writer;
+
+    if (output_path) {
+        if (auto r = output_file.open(output_path,
+                                      mb::FileOpenMode::WriteOnly); !r) {
+            fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                    output_path, r.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        writer.emplace(output_file);
+    }
+
+    Tracer tracer;
+    bool write_failed = false;
+    auto start_time = std::chrono::steady_clock::now();
+
+    // Record event in the trace file or print it immediately
+    auto record = [&](TraceRecordType type, pid_t tid, int value = 0,
+                      SysCall sc = {}, SysCallRet ret = 0) {
+        auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_time);
+        TraceRecord r{type, static_cast<uint64_t>(time.count()), tid, value,
+                      sc.abi(), sc.num(), ret};
+
+        if (!writer) {
+            print_record(r);
+        } else if (auto w = writer->write(r); !w && !write_failed) {
+            fprintf(stderr, "%s: Failed to write trace: %s\n",
+                    output_path, w.error().message().c_str());
+            write_failed = true;
+            tracer.stop_after_hook();
+        }
+    };
+
     Hooks hooks;
 
-    hooks.new_tracee = [](auto tracee) {
-        printf("[%d] New tracee began executing\n", tracee->tid);
+    hooks.new_tracee = [&](auto tracee) {
+        record(TraceRecordType::NewTracee, tracee->tid);
     };
 
-    hooks.tracee_exit = [](auto tid, auto exit_code) {
-        printf("[%d] Exited with status %d\n", tid, exit_code);
+    hooks.tracee_exit = [&](auto tid, auto exit_code) {
+        record(TraceRecordType::TraceeExit, tid, exit_code);
         return action::Default{};
     };
 
-    hooks.tracee_death = [](auto tid, auto signal) {
-        printf("[%d] Killed by signal %d\n", tid, signal);
+    hooks.tracee_death = [&](auto tid, auto signal) {
+        record(TraceRecordType::TraceeDeath, tid, signal);
         return action::Default{};
     };
 
-    hooks.tracee_disappear = [](auto tid) {
-        printf("[%d] Disappeared due to execve call\n", tid);
+    hooks.tracee_disappear = [&](auto tid) {
+        record(TraceRecordType::TraceeDisappear, tid);
     };
 
-    hooks.tracee_signal = [](auto tracee, auto signal) {
-        printf("[%d] Received signal %d\n", tracee->tid, signal);
+    hooks.tracee_signal = [&](auto tracee, auto signal) {
+        record(TraceRecordType::TraceeSignal, tracee->tid, signal);
         return action::Default{};
     };
 
-    hooks.group_stop = [](auto tracee, auto signal) {
-        printf("[%d] Entering group stop from signal %d\n",
-               tracee->tid, signal);
+    hooks.group_stop = [&](auto tracee, auto signal) {
+        record(TraceRecordType::GroupStop, tracee->tid, signal);
         return action::Default{};
     };
 
-    hooks.interrupt_stop = [](auto tracee) {
-        printf("[%d] Interrupted\n", tracee->tid);
+    hooks.interrupt_stop = [&](auto tracee) {
+        record(TraceRecordType::InterruptStop, tracee->tid);
         return action::Default{};
     };
 
-    hooks.syscall_entry = [](auto tracee, auto &info) {
-        printf("[%d] Entering syscall: %s\n", tracee->tid, info.syscall.name());
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        record(TraceRecordType::SysCallEntry, tracee->tid, 0, info.syscall);
         return action::Default{};
     };
 
-    hooks.syscall_exit = [](auto tracee, auto &info) {
-        printf("[%d] Exiting syscall: %s\n", tracee->tid, info.syscall.name());
+    hooks.syscall_exit = [&](auto tracee, auto &info) {
+        record(TraceRecordType::SysCallExit, tracee->tid, 0, info.syscall,
+               info.ret);
         return action::Default{};
     };
 
-    hooks.unknown_child = [](auto tid, auto status) {
-        printf("[%d] Unknown child reported event with status 0x%x\n",
-               tid, status);
+    hooks.unknown_child = [&](auto tid, auto status) {
+        record(TraceRecordType::UnknownChild, tid, status);
     };
 
-    Tracer tracer;
-
     if (pid) {
         if (auto r = tracer.attach(*pid, flags); !r) {
             fprintf(stderr, "Failed to attach to PID %d: %s\n",
@@ -157,11 +386,15 @@ int main(int argc, char *argv[])
             return EXIT_FAILURE;
         }
     } else {
-        if (auto r = tracer.fork([&] {
-            execvp(argv[1], argv + 1);
+        auto child = [&] {
+            execvp(argv[optind], argv + optind);
             fprintf(stderr, "%s: Failed to execute: %s\n",
-                    argv[1], strerror(errno));
-        }, flags); !r) {
+                    argv[optind], strerror(errno));
+        };
+
+        if (auto r = syscalls
+                ? tracer.fork(child, *syscalls, flags)
+                : tracer.fork(child, flags); !r) {
             fprintf(stderr, "Failed to create process: %s\n",
                     r.error().message().c_str());
             return EXIT_FAILURE;
@@ -174,5 +407,23 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    if (show_stats) {
+        print_stats(tracer.stats());
+    }
+
+    if (writer) {
+        if (auto r = writer->flush(); !r && !write_failed) {
+            fprintf(stderr, "%s: Failed to write trace: %s\n",
+                    output_path, r.error().message().c_str());
+            write_failed = true;
+        }
+
+        if (auto r = output_file.close(); !r && !write_failed) {
+            fprintf(stderr, "%s: Failed to close file: %s\n",
+                    output_path, r.error().message().c_str());
+            write_failed = true;
+        }
+    }
+
+    return write_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -26,16 +26,14 @@
 #include <mbpatcher/errors.h>
 
 #include <QtCore/QStringBuilder>
+#include <QtGui/QScreen>
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QFrame>
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QGridLayout>
-#include <QtWidgets/QGroupBox>
 
 
-const int patcherPtrTypeId = qRegisterMetaType<PatcherPtr>("PatcherPtr");
-const int fileInfoPtrTypeId = qRegisterMetaType<FileInfoPtr>("FileInfoPtr");
-const int uint64TypeId = qRegisterMetaType<uint64_t>("uint64_t");
+const int patchJobsPtrTypeId = qRegisterMetaType<PatchJobsPtr>("PatchJobsPtr");
 
 MainWindowPrivate::MainWindowPrivate()
     : settings(qApp->applicationDirPath() % QStringLiteral("/settings.ini"),
@@ -54,10 +52,10 @@ MainWindow::MainWindow(mb::patcher::PatcherConfig *pc, QWidget *parent)
     // If we're passed an argument, switch to automatic mode
     if (qApp->arguments().size() > 2) {
         d->autoMode = true;
-        d->fileName = qApp->arguments().at(1);
+        d->fileNames = QStringList(qApp->arguments().at(1));
     } else {
         d->autoMode = false;
-        d->fileName.clear();
+        d->fileNames.clear();
     }
 
     d->pc = pc;
@@ -79,7 +77,7 @@ MainWindow::MainWindow(mb::patcher::PatcherConfig *pc, QWidget *parent)
 
     // Create thread
     d->thread = new QThread(this);
-    d->task = new PatcherTask();
+    d->task = new PatcherTask(d->pc);
     d->task->moveToThread(d->thread);
 
     connect(d->thread, &QThread::finished,
@@ -88,12 +86,18 @@ MainWindow::MainWindow(mb::patcher::PatcherConfig *pc, QWidget *parent)
             d->task, &PatcherTask::patch);
     connect(d->task, &PatcherTask::finished,
             this, &MainWindow::onPatchingFinished);
-    connect(d->task, &PatcherTask::progressUpdated,
-            this, &MainWindow::onProgressUpdated);
-    connect(d->task, &PatcherTask::filesUpdated,
-            this, &MainWindow::onFilesUpdated);
-    connect(d->task, &PatcherTask::detailsUpdated,
-            this, &MainWindow::onDetailsUpdated);
+
+    // Progress is polled instead of being sent as signals so that
+    // concurrent jobs cannot flood the event loop
+    qreal refreshRate = QGuiApplication::primaryScreen()->refreshRate();
+    if (refreshRate <= 0) {
+        refreshRate = 60;
+    }
+
+    d->refreshTimer = new QTimer(this);
+    d->refreshTimer->setInterval(qMax(1, qRound(1000 / refreshRate)));
+    connect(d->refreshTimer, &QTimer::timeout,
+            this, &MainWindow::onRefreshProgress);
 
     d->thread->start();
 }
@@ -102,11 +106,7 @@ MainWindow::~MainWindow()
 {
     Q_D(MainWindow);
 
-    if (d->patcher) {
-        d->patcher->cancel_patching();
-        d->pc->destroy_patcher(d->patcher);
-        d->patcher = nullptr;
-    }
+    d->task->cancel();
 
     if (d->thread != nullptr) {
         d->thread->quit();
@@ -211,77 +211,103 @@ void MainWindow::onChooseFileItemClicked(QAction *action)
     }
 }
 
-void MainWindow::onProgressUpdated(uint64_t bytes, uint64_t maxBytes)
+void MainWindow::onRefreshProgress()
 {
     Q_D(MainWindow);
 
     // Normalize values to 1000000
     static const int normalize = 1000000;
 
-    int value;
-    int max;
-    if (maxBytes == 0) {
-        value = 0;
-        max = 0;
-    } else {
-        value = static_cast<int>(static_cast<double>(bytes)
-                / static_cast<double>(maxBytes * normalize));
-        max = normalize;
-    }
+    d->task->takeChanges(d->jobStates);
+
+    for (size_t i = 0; i < d->jobStates.size(); ++i) {
+        const PatcherTask::JobState &state = d->jobStates[i];
+        if (!state.changed || i >= static_cast<size_t>(d->progressRows.size())) {
+            continue;
+        }
 
-    d->progressBar->setMaximum(max);
-    d->progressBar->setValue(value);
-    d->bytes = bytes;
-    d->maxBytes = maxBytes;
+        const ProgressRow &row = d->progressRows[static_cast<int>(i)];
 
-    updateProgressText();
+        int value;
+        int max;
+        double percentage;
+        if (state.maxBytes == 0) {
+            value = 0;
+            max = state.finished ? 1 : 0;
+            percentage = state.finished ? 100.0 : 0.0;
+        } else {
+            double ratio = static_cast<double>(state.bytes)
+                    / static_cast<double>(state.maxBytes);
+            value = static_cast<int>(ratio * normalize);
+            max = normalize;
+            percentage = 100.0 * ratio;
+        }
+
+        row.progressBar->setMaximum(max);
+        row.progressBar->setValue(
+                state.finished && !state.failed && max != 0 ? max : value);
+        row.progressBar->setFormat(tr("%1% - %2 / %3 files")
+                .arg(percentage, 0, 'f', 2).arg(state.files)
+                .arg(state.maxFiles));
+
+        if (state.finished) {
+            row.detailsLbl->setText(state.failed
+                    ? tr("Failed: %1").arg(state.errorMessage)
+                    : tr("Finished"));
+        } else {
+            row.detailsLbl->setText(QString::fromStdString(state.details));
+        }
+    }
 }
 
-void MainWindow::onFilesUpdated(uint64_t files, uint64_t maxFiles)
+void MainWindow::onPatchingFinished()
 {
     Q_D(MainWindow);
 
-    d->files = files;
-    d->maxFiles = maxFiles;
+    d->refreshTimer->stop();
+    onRefreshProgress();
 
-    updateProgressText();
+    d->state = MainWindowPrivate::FinishedPatching;
+    updateWidgetsVisibility();
 }
 
-void MainWindow::onDetailsUpdated(const QString &text)
+// Create a progress row for each selected file
+void MainWindow::createProgressRows()
 {
     Q_D(MainWindow);
 
-    d->detailsLbl->setText(text);
-}
+    for (const ProgressRow &row : d->progressRows) {
+        delete row.box;
+    }
+    d->progressRows.clear();
+    d->jobStates.clear();
 
-void MainWindow::onPatchingFinished(const QString &newFile, bool failed,
-                                    const QString &errorMessage)
-{
-    Q_D(MainWindow);
+    QLayout *layout = d->progressRowsContainer->layout();
 
-    d->pc->destroy_patcher(d->patcher);
-    d->patcher = nullptr;
+    for (const QString &fileName : d->fileNames) {
+        ProgressRow row;
 
-    d->patcherNewFile = newFile;
-    d->patcherFailed = failed;
-    d->patcherError = errorMessage;
+        row.box = new QGroupBox(d->progressRowsContainer);
+        row.box->setTitle(QFileInfo(fileName).fileName());
 
-    d->state = MainWindowPrivate::FinishedPatching;
-    updateWidgetsVisibility();
-}
+        row.detailsLbl = new QLabel(row.box);
+        row.detailsLbl->setWordWrap(true);
+        // Make sure the window doesn't change size while patching
+        row.detailsLbl->setFixedWidth(500);
 
-void MainWindow::updateProgressText()
-{
-    Q_D(MainWindow);
+        row.progressBar = new QProgressBar(row.box);
+        row.progressBar->setMaximum(0);
+        row.progressBar->setMinimum(0);
+        row.progressBar->setValue(0);
 
-    double percentage = 0.0;
-    if (d->maxBytes != 0) {
-        percentage = 100.0 * static_cast<double>(d->bytes)
-                / static_cast<double>(d->maxBytes);
-    }
+        QVBoxLayout *rowLayout = new QVBoxLayout(row.box);
+        rowLayout->addWidget(row.detailsLbl);
+        rowLayout->addWidget(row.progressBar);
+        row.box->setLayout(rowLayout);
 
-    d->progressBar->setFormat(tr("%1% - %2 / %3 files")
-            .arg(percentage, 0, 'f', 2).arg(d->files).arg(d->maxFiles));
+        layout->addWidget(row.box);
+        d->progressRows << row;
+    }
 }
 
 void MainWindow::addWidgets()
@@ -363,28 +389,13 @@ void MainWindow::addWidgets()
     QBoxLayout *progressLayout = new QVBoxLayout(d->progressContainer);
     progressLayout->setContentsMargins(0, 0, 0, 0);
 
-    QGroupBox *detailsBox = new QGroupBox(d->progressContainer);
-    detailsBox->setTitle(tr("Details"));
-
-    d->detailsLbl = new QLabel(detailsBox);
-    d->detailsLbl->setWordWrap(true);
-    // Make sure the window doesn't change size while patching
-    d->detailsLbl->setFixedWidth(500);
-
-    QVBoxLayout *detailsLayout = new QVBoxLayout(detailsBox);
-    detailsLayout->addWidget(d->detailsLbl);
-    detailsBox->setLayout(detailsLayout);
+    // One row per file is added by createProgressRows()
+    d->progressRowsContainer = new QWidget(d->progressContainer);
+    QVBoxLayout *rowsLayout = new QVBoxLayout(d->progressRowsContainer);
+    rowsLayout->setContentsMargins(0, 0, 0, 0);
+    d->progressRowsContainer->setLayout(rowsLayout);
 
-    d->progressBar = new QProgressBar(d->progressContainer);
-    //d->progressBar->setFormat(tr("%p% - %v / %m files"));
-    d->progressBar->setMaximum(0);
-    d->progressBar->setMinimum(0);
-    d->progressBar->setValue(0);
-
-    progressLayout->addWidget(detailsBox);
-    //progressLayout->addStretch(1);
-    progressLayout->addWidget(newHorizLine(d->progressContainer));
-    progressLayout->addWidget(d->progressBar);
+    progressLayout->addWidget(d->progressRowsContainer);
     d->progressContainer->setLayout(progressLayout);
 
 
@@ -500,19 +511,19 @@ void MainWindow::chooseFile(const QString &patterns)
 {
     Q_D(MainWindow);
 
-    QString fileName = QFileDialog::getOpenFileName(this, QString(),
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, QString(),
             d->settings.value(QStringLiteral("last_dir")).toString(),
             patterns);
-    if (fileName.isNull()) {
+    if (fileNames.isEmpty()) {
         return;
     }
 
     d->settings.setValue(QStringLiteral("last_dir"),
-                         QFileInfo(fileName).dir().absolutePath());
+                         QFileInfo(fileNames.first()).dir().absolutePath());
 
     d->state = MainWindowPrivate::ChoseFile;
 
-    d->fileName = fileName;
+    d->fileNames = fileNames;
 
     updateWidgetsVisibility();
 }
@@ -539,19 +550,31 @@ void MainWindow::updateWidgetsVisibility()
     }
 
     if (d->state == MainWindowPrivate::ChoseFile) {
-        d->messageLbl->setText(tr("File: %1").arg(d->fileName));
+        QString message;
+
+        for (const QString &fileName : d->fileNames) {
+            message.append(tr("File: %1\n").arg(fileName));
+        }
+
+        d->messageLbl->setText(message.trimmed());
     } else if (d->state == MainWindowPrivate::FinishedPatching) {
         QString message;
 
-        if (d->patcherFailed) {
-            message.append(tr("Failed to patch file: %1\n\n").arg(d->fileName));
-            message.append(d->patcherError);
-        } else {
-            message.append(tr("New file: %1\n\n").arg(d->patcherNewFile));
-            message.append(tr("Successfully patched file"));
+        for (size_t i = 0; i < d->jobStates.size(); ++i) {
+            const PatcherTask::JobState &state = d->jobStates[i];
+            const QString &fileName = d->fileNames[static_cast<int>(i)];
+
+            if (state.failed) {
+                message.append(tr("Failed to patch file: %1\n").arg(fileName));
+                message.append(state.errorMessage);
+            } else {
+                message.append(tr("New file: %1\n").arg(state.newFile));
+                message.append(tr("Successfully patched file"));
+            }
+            message.append(QStringLiteral("\n\n"));
         }
 
-        d->messageLbl->setText(message);
+        d->messageLbl->setText(message.trimmed());
     }
 }
 
@@ -559,14 +582,7 @@ void MainWindow::startPatching()
 {
     Q_D(MainWindow);
 
-    d->bytes = 0;
-    d->maxBytes = 0;
-    d->files = 0;
-    d->maxFiles = 0;
-
-    d->progressBar->setMaximum(0);
-    d->progressBar->setValue(0);
-    d->detailsLbl->clear();
+    createProgressRows();
 
     d->state = MainWindowPrivate::Patching;
     updateWidgetsVisibility();
@@ -587,42 +603,48 @@ void MainWindow::startPatching()
     suffixes << QStringLiteral(".tar.md5.xz");
     suffixes << QStringLiteral(".zip");
 
-    QFileInfo qFileInfo(d->fileName);
-    QString suffix;
-    QString outputName;
-
-    for (const QString &suffix : suffixes) {
-        if (d->fileName.endsWith(suffix)) {
-            // Input name: <parent path>/<base name>.<suffix>
-            // Output name: <parent path>/<base name>_<rom id>.zip
-            outputName = d->fileName.left(d->fileName.size() - suffix.size())
+    PatchJobsPtr jobs = new std::vector<PatchJob>();
+
+    for (const QString &fileName : d->fileNames) {
+        QFileInfo qFileInfo(fileName);
+        QString outputName;
+
+        for (const QString &suffix : suffixes) {
+            if (fileName.endsWith(suffix)) {
+                // Input name: <parent path>/<base name>.<suffix>
+                // Output name: <parent path>/<base name>_<rom id>.zip
+                outputName = fileName.left(fileName.size() - suffix.size())
+                        % QStringLiteral("_")
+                        % romId
+                        % QStringLiteral(".zip");
+                break;
+            }
+        }
+        if (outputName.isEmpty()) {
+            outputName = qFileInfo.completeBaseName()
                     % QStringLiteral("_")
                     % romId
-                    % QStringLiteral(".zip");
-            break;
+                    % QStringLiteral(".")
+                    % qFileInfo.suffix();
         }
-    }
-    if (outputName.isEmpty()) {
-        outputName = qFileInfo.completeBaseName()
-                % QStringLiteral("_")
-                % romId
-                % QStringLiteral(".")
-                % qFileInfo.suffix();
-    }
 
-    QString inputPath(QDir::toNativeSeparators(qFileInfo.filePath()));
-    QString outputPath(QDir::toNativeSeparators(
-            qFileInfo.dir().filePath(outputName)));
+        QString inputPath(QDir::toNativeSeparators(qFileInfo.filePath()));
+        QString outputPath(QDir::toNativeSeparators(
+                qFileInfo.dir().filePath(outputName)));
+
+        PatchJob job;
+        job.patcherId = d->patcherId;
+        job.info.set_input_path(inputPath.toUtf8().constData());
+        job.info.set_output_path(outputPath.toUtf8().constData());
+        job.info.set_device(*d->device);
+        job.info.set_rom_id(romId.toUtf8().constData());
 
-    FileInfoPtr fileInfo = new mb::patcher::FileInfo();
-    fileInfo->set_input_path(inputPath.toUtf8().constData());
-    fileInfo->set_output_path(outputPath.toUtf8().constData());
-    fileInfo->set_device(*d->device);
-    fileInfo->set_rom_id(romId.toUtf8().constData());
+        jobs->push_back(std::move(job));
+    }
 
-    d->patcher = d->pc->create_patcher(d->patcherId.toStdString());
+    d->refreshTimer->start();
 
-    emit runThread(d->patcher, fileInfo);
+    emit runThread(jobs);
 }
 
 QWidget * MainWindow::newHorizLine(QWidget *parent)
@@ -663,6 +685,8 @@ static QString errorToString(const mb::patcher::ErrorCode &error) {
         return QObject::tr("Failed to read archive data for file");
     case mb::patcher::ErrorCode::ArchiveReadHeaderError:
         return QObject::tr("Failed to read archive entry header");
+    case mb::patcher::ErrorCode::ArchiveChecksumError:
+        return QObject::tr("Archive checksum does not match");
     case mb::patcher::ErrorCode::ArchiveWriteOpenError:
         return QObject::tr("Failed to open archive for writing");
     case mb::patcher::ErrorCode::ArchiveWriteDataError:
@@ -683,45 +707,121 @@ static QString errorToString(const mb::patcher::ErrorCode &error) {
 }
 
 
-PatcherTask::PatcherTask(QWidget *parent)
+PatcherTask::PatcherTask(mb::patcher::PatcherConfig *pc, QObject *parent)
     : QObject(parent)
+    , m_pc(pc)
+    , m_queue(nullptr)
+    , m_cancelled(false)
 {
 }
 
-void PatcherTask::patch(PatcherPtr patcher, FileInfoPtr info)
+void PatcherTask::patch(PatchJobsPtr jobs)
 {
-    using namespace std::placeholders;
+    QScopedPointer<std::vector<PatchJob>> jobsPtr(jobs);
+
+    // Jobs are patched concurrently by the queue's worker threads
+    mb::patcher::PatchQueue queue(*m_pc);
 
-    patcher->set_file_info(info);
+    for (const PatchJob &job : *jobs) {
+        queue.add_job(job.patcherId.toStdString(), job.info);
+    }
 
-    bool ret = patcher->patch_file(
-            std::bind(&PatcherTask::progressUpdatedCb, this, _1, _2),
-            std::bind(&PatcherTask::filesUpdatedCb, this, _1, _2),
-            std::bind(&PatcherTask::detailsUpdatedCb, this, _1));
+    {
+        QMutexLocker locker(&m_mutex);
+        m_states.assign(jobs->size(), JobState());
+
+        if (m_cancelled) {
+            for (JobState &state : m_states) {
+                state.finished = true;
+                state.failed = true;
+                state.errorMessage = errorToString(
+                        mb::patcher::ErrorCode::PatchingCancelled);
+                state.changed = true;
+            }
 
-    QString newFile(QString::fromStdString(info->output_path()));
+            locker.unlock();
+            emit finished();
+            return;
+        }
 
-    patcher->set_file_info(nullptr);
-    delete info;
+        m_queue = &queue;
+    }
 
-    if (!ret) {
-        emit finished(QString(), true, errorToString(patcher->error()));
-    } else {
-        emit finished(newFile, false, QString());
+    queue.run(
+        [&](size_t job, uint64_t bytes, uint64_t maxBytes) {
+            QMutexLocker locker(&m_mutex);
+            m_states[job].bytes = bytes;
+            m_states[job].maxBytes = maxBytes;
+            m_states[job].changed = true;
+        },
+        [&](size_t job, uint64_t files, uint64_t maxFiles) {
+            QMutexLocker locker(&m_mutex);
+            m_states[job].files = files;
+            m_states[job].maxFiles = maxFiles;
+            m_states[job].changed = true;
+        },
+        [&](size_t job, const std::string &text) {
+            QMutexLocker locker(&m_mutex);
+            m_states[job].details = text;
+            m_states[job].changed = true;
+        },
+        [&](size_t job, bool ret) {
+            QMutexLocker locker(&m_mutex);
+            JobState &state = m_states[job];
+            state.finished = true;
+            state.failed = !ret;
+            if (ret) {
+                state.newFile = QString::fromStdString(
+                        (*jobs)[job].info.output_path());
+            } else {
+                state.errorMessage = errorToString(queue.job_error(job));
+            }
+            state.changed = true;
+        }
+    );
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_queue = nullptr;
+
+        // Jobs that never started because patching was cancelled
+        for (size_t i = 0; i < m_states.size(); ++i) {
+            JobState &state = m_states[i];
+            if (!state.finished) {
+                state.finished = true;
+                state.failed = true;
+                state.errorMessage = errorToString(queue.job_error(i));
+                state.changed = true;
+            }
+        }
     }
-}
 
-void PatcherTask::progressUpdatedCb(uint64_t bytes, uint64_t maxBytes)
-{
-    emit progressUpdated(bytes, maxBytes);
+    emit finished();
 }
 
-void PatcherTask::filesUpdatedCb(uint64_t files, uint64_t maxFiles)
+void PatcherTask::cancel()
 {
-    emit filesUpdated(files, maxFiles);
+    QMutexLocker locker(&m_mutex);
+
+    m_cancelled = true;
+    if (m_queue) {
+        m_queue->cancel();
+    }
 }
 
-void PatcherTask::detailsUpdatedCb(const std::string &text)
+// Copy the states of the jobs that changed since the last call into states
+void PatcherTask::takeChanges(std::vector<JobState> &states)
 {
-    emit detailsUpdated(QString::fromStdString(text));
+    QMutexLocker locker(&m_mutex);
+
+    states.resize(m_states.size());
+
+    for (size_t i = 0; i < m_states.size(); ++i) {
+        if (m_states[i].changed) {
+            states[i] = m_states[i];
+            m_states[i].changed = false;
+        } else {
+            states[i].changed = false;
+        }
+    }
 }
@@ -23,16 +23,25 @@
 #include <mbpatcher/fileinfo.h>
 #include <mbpatcher/patcherconfig.h>
 #include <mbpatcher/patcherinterface.h>
+#include <mbpatcher/patchqueue.h>
+
+#include <vector>
 
 #include <QtCore/QMetaType>
+#include <QtCore/QMutex>
 #include <QtWidgets/QAbstractButton>
 #include <QtWidgets/QWidget>
 
 
-typedef mb::patcher::Patcher * PatcherPtr;
-Q_DECLARE_METATYPE(PatcherPtr)
-typedef mb::patcher::FileInfo * FileInfoPtr;
-Q_DECLARE_METATYPE(FileInfoPtr)
+class PatchJob
+{
+public:
+    QString patcherId;
+    mb::patcher::FileInfo info;
+};
+
+typedef std::vector<PatchJob> * PatchJobsPtr;
+Q_DECLARE_METATYPE(PatchJobsPtr)
 
 class MainWindowPrivate;
 
@@ -45,7 +54,7 @@ public:
     ~MainWindow();
 
 signals:
-    void runThread(PatcherPtr patcher, FileInfoPtr info);
+    void runThread(PatchJobsPtr jobs);
 
 private slots:
     void onDeviceSelected(int index);
@@ -55,18 +64,15 @@ private slots:
     void onChooseFileItemClicked(QAction *action);
 
     // Progress
-    void onProgressUpdated(uint64_t bytes, uint64_t maxBytes);
-    void onFilesUpdated(uint64_t files, uint64_t maxFiles);
-    void onDetailsUpdated(const QString &text);
+    void onRefreshProgress();
 
-    void onPatchingFinished(const QString &newFile, bool failed,
-                            const QString &errorMessage);
+    void onPatchingFinished();
 
 private:
     virtual void closeEvent(QCloseEvent *event) override;
 
     void updateRomIdDescText(const QString &text);
-    void updateProgressText();
+    void createProgressRows();
 
     void addWidgets();
     void setWidgetActions();
@@ -84,27 +90,46 @@ private:
     Q_DECLARE_PRIVATE(MainWindow)
 };
 
-class PatcherTaskPrivate;
-
 class PatcherTask : public QObject
 {
     Q_OBJECT
 
 public:
-    PatcherTask(QWidget *parent = 0);
+    // Progress of a job. The patcher threads only update this and the GUI
+    // thread polls it, so progress updates do not go through the event loop.
+    struct JobState
+    {
+        uint64_t bytes = 0;
+        uint64_t maxBytes = 0;
+        uint64_t files = 0;
+        uint64_t maxFiles = 0;
+        std::string details;
+        bool finished = false;
+        bool failed = false;
+        QString newFile;
+        QString errorMessage;
+        // Whether the state changed since the last takeChanges()
+        bool changed = false;
+    };
+
+    PatcherTask(mb::patcher::PatcherConfig *pc, QObject *parent = 0);
+
+    void patch(PatchJobsPtr jobs);
+    void cancel();
+
+    void takeChanges(std::vector<JobState> &states);
 
-    void patch(PatcherPtr patcher, FileInfoPtr info);
+signals:
+    void finished();
 
-    void progressUpdatedCb(uint64_t bytes, uint64_t maxBytes);
-    void filesUpdatedCb(uint64_t files, uint64_t maxFiles);
-    void detailsUpdatedCb(const std::string &text);
+private:
+    mb::patcher::PatcherConfig *m_pc;
 
-signals:
-    void finished(const QString &newFile, bool failed,
-                  const QString &errorMessage);
-    void progressUpdated(uint64_t bytes, uint64_t maxBytes);
-    void filesUpdated(uint64_t files, uint64_t maxFiles);
-    void detailsUpdated(const QString &text);
+    // Guards m_states, m_queue and m_cancelled
+    QMutex m_mutex;
+    std::vector<JobState> m_states;
+    mb::patcher::PatchQueue *m_queue;
+    bool m_cancelled;
 };
 
 #endif // MAINWINDOW_H
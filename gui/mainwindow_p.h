@@ -31,9 +31,11 @@
 
 #include <QtCore/QSettings>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 #include <QtWidgets/QCheckBox>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QDialogButtonBox>
+#include <QtWidgets/QGroupBox>
 #include <QtWidgets/QLabel>
 #include <QtWidgets/QLineEdit>
 #include <QtWidgets/QMenu>
@@ -50,6 +52,14 @@ public:
     QString description;
 };
 
+class ProgressRow
+{
+public:
+    QGroupBox *box;
+    QLabel *detailsLbl;
+    QProgressBar *progressBar;
+};
+
 class MainWindowPrivate
 {
 public:
@@ -62,36 +72,29 @@ public:
 
     MainWindowPrivate();
 
-    uint64_t bytes;
-    uint64_t maxBytes;
-    uint64_t files;
-    uint64_t maxFiles;
-
     QSettings settings;
 
     // Current state of the patcher
     State state = FirstRun;
 
-    // Selected file
+    // Selected files
     QString patcherId;
-    QString fileName;
+    QStringList fileNames;
     bool autoMode;
 
     mb::patcher::PatcherConfig *pc = nullptr;
     std::vector<mb::device::Device> devices;
 
-    // Selected patcher
-    mb::patcher::Patcher *patcher = nullptr;
-
-    // Patcher finish status and error message
-    QString patcherNewFile;
-    bool patcherFailed;
-    QString patcherError;
+    // Latest state of each job
+    std::vector<PatcherTask::JobState> jobStates;
 
     // Threads
     QThread *thread;
     PatcherTask *task;
 
+    // Polls the job progress at the display refresh rate while patching
+    QTimer *refreshTimer;
+
     // Selected device
     mb::device::Device *device = nullptr;
 
@@ -114,8 +117,8 @@ public:
     QLabel *messageLbl;
 
     // Progress
-    QLabel *detailsLbl;
-    QProgressBar *progressBar;
+    QWidget *progressRowsContainer;
+    QList<ProgressRow> progressRows;
 
     // Menus
     QMenu *chooseFileMenu;
@@ -0,0 +1,591 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/integer.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+using Clock = std::chrono::steady_clock;
+
+// Allocation counting
+
+static std::atomic<uint64_t> g_allocations(0);
+
+void * operator new(size_t size)
+{
+    ++g_allocations;
+
+    if (void *ptr = malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void * operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void * operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    ++g_allocations;
+    return malloc(size == 0 ? 1 : size);
+}
+
+void * operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+// Synthetic images
+
+enum class Backend
+{
+    Memory,
+    Fd,
+};
+
+struct Options
+{
+    uint64_t image_size = 64 * 1024 * 1024;
+    unsigned int iterations = 5;
+    size_t read_buf_size = 64 * 1024;
+    std::vector<Format> formats;
+    std::vector<Backend> backends;
+    std::string tmpdir = "/tmp";
+};
+
+struct Result
+{
+    double seconds = 0;
+    uint64_t allocations = 0;
+    bool ok = true;
+};
+
+static const char *backend_name(Backend backend)
+{
+    switch (backend) {
+    case Backend::Memory:
+        return "memory";
+    case Backend::Fd:
+        return "fd";
+    default:
+        return "unknown";
+    }
+}
+
+/*!
+ * \brief Build aboot data that the Loki patcher recognizes
+ *
+ * The signature check function pattern of the first Loki target is placed at
+ * a fixed offset and the base address is chosen so that it matches.
+ */
+static std::vector<unsigned char> make_aboot()
+{
+    static constexpr unsigned char pattern[] = {
+        0xf0, 0xb5, 0x8f, 0xb0, 0x06, 0x46, 0xf0, 0xf7,
+    };
+    constexpr uint32_t check_sigs = 0x88e0ff98;
+    constexpr uint32_t pattern_offset = 0x108;
+    constexpr uint32_t base = check_sigs - pattern_offset + 0x28;
+
+    std::vector<unsigned char> aboot(0x4000);
+    memcpy(aboot.data() + pattern_offset, pattern, sizeof(pattern));
+    for (size_t i = 0; i < 4; ++i) {
+        aboot[12 + i] = static_cast<unsigned char>(base >> (i * 8));
+    }
+
+    return aboot;
+}
+
+static std::vector<unsigned char> make_mtk_header(const char *type)
+{
+    std::vector<unsigned char> hdr(512, 0xff);
+    memcpy(hdr.data(), "\x88\x16\x88\x58", 4);
+    memset(hdr.data() + 4, 0, 4 + 32);
+    memcpy(hdr.data() + 8, type, strlen(type));
+    return hdr;
+}
+
+/*!
+ * \brief Write a synthetic image of the given format
+ *
+ * Half of \p image_size is used for the kernel and the other half for the
+ * ramdisk. The data is written in 1 MiB chunks.
+ */
+static bool write_image(Writer &writer, Format format, uint64_t image_size,
+                        const std::vector<unsigned char> &chunk)
+{
+    auto header = writer.get_header();
+    if (!header) {
+        return false;
+    }
+
+    header.value().set_page_size(2048);
+    header.value().set_kernel_address(0x10008000);
+    header.value().set_ramdisk_address(0x11000000);
+    header.value().set_kernel_cmdline("console=null");
+    header.value().set_entrypoint_address(0x10008000);
+
+    if (!writer.write_header(header.value())) {
+        return false;
+    }
+
+    auto kernel_size = image_size / 2;
+    auto ramdisk_size = image_size - kernel_size;
+
+    auto write_bytes = [&](uint64_t size) {
+        while (size > 0) {
+            auto n = static_cast<size_t>(
+                    std::min<uint64_t>(size, chunk.size()));
+            if (!writer.write_data(chunk.data(), n)) {
+                return false;
+            }
+            size -= n;
+        }
+        return true;
+    };
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            if (entry.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            return false;
+        }
+
+        auto type = entry.value().type();
+        std::vector<unsigned char> data;
+        std::optional<uint64_t> size;
+
+        switch (type) {
+        case EntryType::Kernel:
+            size = kernel_size;
+            break;
+        case EntryType::Ramdisk:
+            size = ramdisk_size;
+            break;
+        case EntryType::MtkKernelHeader:
+            data = make_mtk_header("KERNEL");
+            break;
+        case EntryType::MtkRamdiskHeader:
+            data = make_mtk_header("ROOTFS");
+            break;
+        case EntryType::Aboot:
+            if (format == Format::Loki) {
+                data = make_aboot();
+            }
+            break;
+        default:
+            break;
+        }
+
+        if (!data.empty()) {
+            size = data.size();
+        }
+
+        // Let formats that need sizes upfront (eg. MTK) use their fast path
+        entry.value().set_size(size);
+
+        if (!writer.write_entry(entry.value())) {
+            return false;
+        }
+
+        if (!data.empty()) {
+            if (!writer.write_data(data.data(), data.size())) {
+                return false;
+            }
+        } else if (size && !write_bytes(*size)) {
+            return false;
+        }
+    }
+
+    return !!writer.close();
+}
+
+// Benchmarks
+
+class Bench
+{
+public:
+    Bench(const Options &opts, Format format, Backend backend)
+        : m_opts(opts)
+        , m_format(format)
+        , m_backend(backend)
+        , m_chunk(1024 * 1024)
+        , m_image(nullptr)
+        , m_image_size(0)
+    {
+        for (size_t i = 0; i < m_chunk.size(); ++i) {
+            m_chunk[i] = static_cast<unsigned char>(i * 7 + i / 4096);
+        }
+
+        m_path = opts.tmpdir + "/mbbootimg_bench_"
+                + std::to_string(getpid()) + ".img";
+    }
+
+    ~Bench()
+    {
+        free(m_image);
+
+        if (m_backend == Backend::Fd) {
+            unlink(m_path.c_str());
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Bench)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Bench)
+
+    Result run_write()
+    {
+        return measure([&] {
+            Writer writer;
+
+            if (!writer.set_format(m_format)) {
+                return false;
+            }
+
+            if (m_backend == Backend::Memory) {
+                free(m_image);
+                m_image = nullptr;
+                m_image_size = 0;
+
+                MemoryFile file(&m_image, &m_image_size);
+
+                return writer.open(&file)
+                        && write_image(writer, m_format, m_opts.image_size,
+                                       m_chunk);
+            } else {
+                FdFile file;
+
+                return file.open(m_path, FileOpenMode::ReadWriteTrunc)
+                        && writer.open(&file)
+                        && write_image(writer, m_format, m_opts.image_size,
+                                       m_chunk);
+            }
+        });
+    }
+
+    Result run_read_header()
+    {
+        return measure([&] {
+            return with_reader([](Reader &reader) {
+                return !!reader.read_header();
+            });
+        });
+    }
+
+    Result run_read_data()
+    {
+        std::vector<unsigned char> buf(m_opts.read_buf_size);
+
+        return measure([&] {
+            return with_reader([&](Reader &reader) {
+                if (!reader.read_header()) {
+                    return false;
+                }
+
+                while (true) {
+                    auto entry = reader.read_entry();
+                    if (!entry) {
+                        return entry.error() == ReaderError::EndOfEntries;
+                    }
+
+                    while (true) {
+                        auto n = reader.read_data(buf.data(), buf.size());
+                        if (!n) {
+                            return false;
+                        } else if (n.value() == 0) {
+                            break;
+                        }
+                    }
+                }
+            });
+        });
+    }
+
+private:
+    template<typename Fn>
+    bool with_reader(Fn fn)
+    {
+        Reader reader;
+
+        if (!reader.enable_formats_all()) {
+            return false;
+        }
+
+        if (m_backend == Backend::Memory) {
+            MemoryFile file(m_image, m_image_size);
+            return reader.open(&file) && fn(reader) && reader.close();
+        } else {
+            FdFile file;
+            return file.open(m_path, FileOpenMode::ReadOnly)
+                    && reader.open(&file) && fn(reader) && reader.close();
+        }
+    }
+
+    template<typename Fn>
+    Result measure(Fn fn)
+    {
+        Result result;
+        std::chrono::duration<double> total{};
+        uint64_t allocations = 0;
+
+        for (unsigned int i = 0; i < m_opts.iterations; ++i) {
+            auto allocs_before = g_allocations.load();
+            auto start = Clock::now();
+
+            if (!fn()) {
+                result.ok = false;
+                return result;
+            }
+
+            total += Clock::now() - start;
+            allocations += g_allocations.load() - allocs_before;
+        }
+
+        result.seconds = total.count() / m_opts.iterations;
+        result.allocations = allocations / m_opts.iterations;
+
+        return result;
+    }
+
+    const Options &m_opts;
+    Format m_format;
+    Backend m_backend;
+    std::vector<unsigned char> m_chunk;
+    void *m_image;
+    size_t m_image_size;
+    std::string m_path;
+};
+
+static void print_result(Format format, Backend backend, const char *op,
+                         const Result &result, uint64_t bytes)
+{
+    auto name = format_to_name(format);
+
+    if (!result.ok) {
+        printf("%-10.*s %-7s %-12s %12s\n", static_cast<int>(name.size()),
+               name.data(), backend_name(backend), op, "FAILED");
+        return;
+    }
+
+    char throughput[32] = "-";
+    if (bytes > 0 && result.seconds > 0) {
+        snprintf(throughput, sizeof(throughput), "%.1fMiB/s",
+                 static_cast<double>(bytes) / (1024.0 * 1024.0)
+                 / result.seconds);
+    }
+
+    printf("%-10.*s %-7s %-12s %10.3fms %16s %10" PRIu64 "\n",
+           static_cast<int>(name.size()), name.data(), backend_name(backend),
+           op, result.seconds * 1000, throughput, result.allocations);
+}
+
+static void usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: mbbootimg_benchmarks [<option>...]\n"
+            "\n"
+            "Options:\n"
+            "  -s, --size <MiB>       Size of kernel + ramdisk (default: 64)\n"
+            "  -n, --iterations <n>   Iterations per measurement (default: 5)\n"
+            "  -b, --buffer <KiB>     read_data() buffer size (default: 64)\n"
+            "  -f, --format <format>  Format to benchmark (default: all)\n"
+            "                         (can be specified multiple times)\n"
+            "  -B, --backend <name>   memory or fd (default: both)\n"
+            "                         (can be specified multiple times)\n"
+            "  -d, --tmpdir <dir>     Directory for fd backend images\n"
+            "                         (default: /tmp)\n"
+            "\n"
+            "Times are averages per iteration. read_header includes opening\n"
+            "the image with all format bidders enabled.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int opt;
+
+    static const char short_options[] = "s:n:b:f:B:d:h";
+
+    static const option long_options[] = {
+        {"size",       required_argument, nullptr, 's'},
+        {"iterations", required_argument, nullptr, 'n'},
+        {"buffer",     required_argument, nullptr, 'b'},
+        {"format",     required_argument, nullptr, 'f'},
+        {"backend",    required_argument, nullptr, 'B'},
+        {"tmpdir",     required_argument, nullptr, 'd'},
+        {"help",       no_argument,       nullptr, 'h'},
+        {nullptr,      0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 's': {
+            uint64_t mib;
+            if (!str_to_num(optarg, 10, mib) || mib == 0
+                    || mib > UINT32_MAX / (1024 * 1024)) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.image_size = mib * 1024 * 1024;
+            break;
+        }
+        case 'n':
+            if (!str_to_num(optarg, 10, opts.iterations)
+                    || opts.iterations == 0) {
+                fprintf(stderr, "Invalid iterations: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b': {
+            size_t kib;
+            if (!str_to_num(optarg, 10, kib) || kib == 0
+                    || kib > SIZE_MAX / 1024) {
+                fprintf(stderr, "Invalid buffer size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.read_buf_size = kib * 1024;
+            break;
+        }
+        case 'f':
+            if (auto f = name_to_format(optarg)) {
+                opts.formats.push_back(*f);
+            } else {
+                fprintf(stderr, "Invalid format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'B':
+            if (strcmp(optarg, "memory") == 0) {
+                opts.backends.push_back(Backend::Memory);
+            } else if (strcmp(optarg, "fd") == 0) {
+                opts.backends.push_back(Backend::Fd);
+            } else {
+                fprintf(stderr, "Invalid backend: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            opts.tmpdir = optarg;
+            break;
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 0) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.formats.empty()) {
+        for (auto format : ALL_FORMATS) {
+            opts.formats.push_back(format);
+        }
+    }
+    if (opts.backends.empty()) {
+        opts.backends = { Backend::Memory, Backend::Fd };
+    }
+
+    printf("%-10s %-7s %-12s %12s %16s %10s\n",
+           "format", "backend", "operation", "time", "throughput", "allocs");
+
+    bool ok = true;
+
+    for (auto format : opts.formats) {
+        for (auto backend : opts.backends) {
+            Bench bench(opts, format, backend);
+
+            // Later operations read the image produced by the write benchmark
+            auto result = bench.run_write();
+            print_result(format, backend, "write", result, opts.image_size);
+            if (!result.ok) {
+                ok = false;
+                continue;
+            }
+
+            result = bench.run_read_header();
+            print_result(format, backend, "read_header", result, 0);
+            ok = ok && result.ok;
+
+            result = bench.run_read_data();
+            print_result(format, backend, "read_data", result,
+                         opts.image_size);
+            ok = ok && result.ok;
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -47,6 +47,18 @@ enum class EntryType
 MB_DECLARE_FLAGS(EntryTypes, EntryType)
 MB_DECLARE_OPERATORS_FOR_FLAGS(EntryTypes)
 
+struct EntryLocation
+{
+    // Entry type
+    EntryType type;
+    // Offset of the entry data in the boot image file
+    uint64_t offset;
+    // Size of the entry data
+    uint64_t size;
+    // Whether the boot image may end before the end of the entry data
+    bool can_truncate;
+};
+
 class MB_EXPORT Entry
 {
 public:
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/file.h"
+
+namespace mb::bootimg
+{
+
+class Reader;
+
+namespace detail
+{
+class EntryDecoder;
+}
+
+//! Whether Reader::open_entry_stream() should decompress the entry data
+enum class Decompress
+{
+    //! Return the entry data as is
+    None,
+    //! Detect the compression format and decompress the data if it is known
+    Auto,
+};
+
+//! Compression format of an entry
+enum class Compression
+{
+    None,
+    Gzip,
+    Lz4Legacy,
+    Lz4Frame,
+    Xz,
+    Lzma,
+};
+
+class MB_EXPORT EntryStream : public File
+{
+public:
+    ~EntryStream() override;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EntryStream)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(EntryStream)
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    bool is_open() override;
+
+    Compression compression() const;
+
+private:
+    /*! \cond INTERNAL */
+    friend class Reader;
+
+    explicit EntryStream(Reader &reader);
+
+    oc::result<void> open(Decompress decompress);
+    oc::result<void> fill();
+
+    Reader *m_reader;
+    Compression m_compression;
+    std::unique_ptr<detail::EntryDecoder> m_decoder;
+
+    // Compressed data that has not been passed to the decoder yet
+    std::vector<unsigned char> m_in;
+    size_t m_in_pos;
+    size_t m_in_size;
+    bool m_in_eof;
+
+    // Whether the end of the compressed stream has been reached
+    bool m_ended;
+    /*! \endcond */
+};
+
+}
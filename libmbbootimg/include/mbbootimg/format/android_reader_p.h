@@ -48,6 +48,7 @@ public:
     oc::result<Entry> go_to_entry(File &file,
                                   std::optional<EntryType> entry_type) override;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size) override;
+    oc::result<std::vector<EntryLocation>> entries() override;
 
     static oc::result<std::pair<AndroidHeader, uint64_t>>
     find_header(File &file, uint64_t max_header_offset);
@@ -21,11 +21,13 @@
 
 #include "mbbootimg/guard_p.h"
 
+#include <memory>
 #include <optional>
 
 #include <openssl/sha.h>
 
 #include "mbbootimg/format/android_p.h"
+#include "mbbootimg/format/sha1_pipeline_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
 #include "mbbootimg/writer_p.h"
 
@@ -44,6 +46,7 @@ public:
 
     Format type() override;
 
+    oc::result<void> set_option(const char *key, const char *value) override;
     oc::result<void> open(File &file) override;
     oc::result<void> close(File &file) override;
     oc::result<Header> get_header(File &file) override;
@@ -54,12 +57,17 @@ public:
     oc::result<void> finish_entry(File &file) override;
 
 private:
+    oc::result<void> sha1_update(const void *data, size_t size);
+
     const bool m_is_bump;
+    bool m_pipelined_sha1;
 
     // Header values
     AndroidHeader m_hdr;
 
     SHA_CTX m_sha_ctx;
+    // Only set if the image is being hashed on a worker thread
+    std::unique_ptr<detail::Sha1Pipeline> m_sha_pipeline;
 
     std::optional<SegmentWriter> m_seg;
 };
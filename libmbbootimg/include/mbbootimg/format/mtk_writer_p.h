@@ -23,6 +23,8 @@
 
 #include <optional>
 
+#include <openssl/sha.h>
+
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/mtk_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
@@ -57,6 +59,19 @@ private:
     android::AndroidHeader m_hdr;
 
     std::optional<SegmentWriter> m_seg;
+
+    // Incremental SHA1 state. m_sha_valid is cleared if the hash cannot be
+    // computed while writing and the output must be re-read during close().
+    SHA_CTX m_sha_ctx;
+    bool m_sha_valid;
+
+    // Buffered copy of the MTK header currently being written. It is hashed
+    // once the size of the following entry is known.
+    MtkHeader m_mtkhdr;
+    size_t m_mtkhdr_size;
+
+    // Number of bytes written for the current entry
+    uint64_t m_entry_data_size;
 };
 
 }
@@ -33,6 +33,7 @@ enum class SegmentError
     ReadWouldOverflowInteger    = 12,
     WriteWouldOverflowInteger   = 13,
     InvalidEntrySize            = 14,
+    EntrySizeMismatch           = 15,
 };
 
 MB_EXPORT std::error_code make_error_code(SegmentError e);
@@ -54,6 +54,7 @@ public:
     SegmentReader() noexcept;
 
     const std::vector<SegmentReaderEntry> & entries() const;
+    std::vector<EntryLocation> entry_locations() const;
     oc::result<void> set_entries(std::vector<SegmentReaderEntry> entries);
 
     oc::result<Entry> move_to_entry(File &file,
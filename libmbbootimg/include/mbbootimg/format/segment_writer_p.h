@@ -55,6 +55,7 @@ public:
 
     const std::vector<SegmentWriterEntry> & entries() const;
     oc::result<void> set_entries(std::vector<SegmentWriterEntry> entries);
+    oc::result<void> set_sequential(uint64_t pos);
 
     std::vector<SegmentWriterEntry>::const_iterator entry() const;
 
@@ -74,6 +75,8 @@ private:
     uint32_t m_entry_size;
 
     std::optional<uint64_t> m_pos;
+
+    bool m_sequential;
 };
 
 }
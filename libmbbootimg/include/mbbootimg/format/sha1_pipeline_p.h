@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/common.h"
+
+
+namespace mb::bootimg::detail
+{
+
+class Sha1Pipeline
+{
+public:
+    static constexpr size_t DEFAULT_BUFFERS = 4;
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+    Sha1Pipeline(size_t buffers = DEFAULT_BUFFERS,
+                 size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    ~Sha1Pipeline() noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Sha1Pipeline)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Sha1Pipeline)
+
+    bool init();
+    bool update(const void *data, size_t size);
+    bool final(unsigned char digest[SHA_DIGEST_LENGTH]);
+
+private:
+    void submit_locked(std::unique_lock<std::mutex> &lock);
+    void stop() noexcept;
+    void worker();
+
+    SHA_CTX m_ctx;
+
+    std::vector<std::vector<unsigned char>> m_bufs;
+    size_t m_buf_size;
+
+    // Buffer being filled by update(). It is never queued.
+    size_t m_fill;
+
+    // Guarded by m_mutex
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    size_t m_head;
+    size_t m_queued;
+    bool m_stop;
+    bool m_failed;
+
+    std::thread m_thread;
+};
+
+}
@@ -47,6 +47,7 @@ public:
     oc::result<Entry> go_to_entry(File &file,
                                   std::optional<EntryType> entry_type) override;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size) override;
+    oc::result<std::vector<EntryLocation>> entries() override;
 
     static oc::result<Sony_Elf32_Ehdr>
     find_sony_elf_header(File &file);
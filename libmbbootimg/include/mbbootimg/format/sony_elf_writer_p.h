@@ -23,6 +23,7 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "mbbootimg/format/sony_elf_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
@@ -46,6 +47,8 @@ public:
     oc::result<void> open(File &file) override;
     oc::result<void> close(File &file) override;
     oc::result<Header> get_header(File &file) override;
+    oc::result<void> set_entry_sizes(File &file,
+                                     const std::vector<Entry> &entries) override;
     oc::result<void> write_header(File &file, const Header &header) override;
     oc::result<Entry> get_entry(File &file) override;
     oc::result<void> write_entry(File &file, const Entry &entry) override;
@@ -64,7 +67,13 @@ private:
 
     std::string m_cmdline;
 
+    // Sizes declared with set_entry_sizes()
+    std::optional<std::vector<Entry>> m_entry_sizes;
+
     std::optional<SegmentWriter> m_seg;
+
+    void set_entry_location(EntryType type, uint64_t offset, uint32_t size);
+    oc::result<void> write_headers(File &file);
 };
 
 }
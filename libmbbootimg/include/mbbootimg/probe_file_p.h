@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <optional>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+namespace mb::bootimg::detail
+{
+
+class ProbeFile : public File
+{
+public:
+    static constexpr size_t INITIAL_SIZE = 16 * 1024;
+    static constexpr size_t DEFAULT_MAX_SIZE = 256 * 1024;
+
+    ProbeFile(File &file, size_t max_size = DEFAULT_MAX_SIZE);
+    virtual ~ProbeFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProbeFile)
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+
+    bool is_open() override;
+
+    size_t cached_size() const noexcept;
+
+private:
+    oc::result<void> fill(uint64_t needed);
+
+    File &m_file;
+    size_t m_max_size;
+
+    // Cached prefix of the file
+    std::vector<unsigned char> m_cache;
+    // Whether the underlying file ends at the end of the cache
+    bool m_eof;
+
+    // Size of the underlying file, if it has been queried
+    std::optional<uint64_t> m_size;
+
+    uint64_t m_pos;
+};
+
+}
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <array>
 #include <memory>
 #include <optional>
 #include <string>
@@ -30,6 +31,7 @@
 #include "mbcommon/outcome.h"
 
 #include "mbbootimg/entry.h"
+#include "mbbootimg/entry_stream.h"
 #include "mbbootimg/format.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader_error.h"
@@ -42,6 +44,9 @@ class File;
 namespace bootimg
 {
 
+//! SHA-256 digest of an entry's data
+using EntryDigest = std::array<unsigned char, 32>;
+
 class MB_EXPORT Reader
 {
 public:
@@ -65,6 +70,15 @@ public:
     oc::result<Entry> read_entry();
     oc::result<Entry> go_to_entry(std::optional<EntryType> entry_type);
     oc::result<size_t> read_data(void *buf, size_t size);
+    oc::result<EntryDigest> entry_digest();
+    oc::result<std::unique_ptr<EntryStream>>
+    open_entry_stream(EntryType entry_type,
+                      Decompress decompress = Decompress::Auto);
+
+    // Random access
+    oc::result<std::vector<EntryLocation>> entries();
+    oc::result<size_t> read_entry_at(const EntryLocation &entry,
+                                     uint64_t offset, void *buf, size_t size);
 
     // Format operations
     std::optional<Format> format();
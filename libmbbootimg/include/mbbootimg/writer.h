@@ -22,8 +22,10 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <cstddef>
+#include <cstdint>
 
 #include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
@@ -41,6 +43,8 @@ class File;
 namespace bootimg
 {
 
+class Reader;
+
 class MB_EXPORT Writer
 {
 public:
@@ -61,14 +65,17 @@ public:
 
     // Operations
     oc::result<Header> get_header();
+    oc::result<void> set_entry_sizes(const std::vector<Entry> &entries);
     oc::result<void> write_header(const Header &header);
     oc::result<Entry> get_entry();
     oc::result<void> write_entry(const Entry &entry);
     oc::result<size_t> write_data(const void *buf, size_t size);
+    oc::result<uint64_t> write_data_from(Reader &reader);
 
     // Format operations
     std::optional<Format> format();
     oc::result<void> set_format(Format format);
+    oc::result<void> set_format_option(const char *key, const char *value);
 
     // Writer state
     bool is_open();
@@ -34,6 +34,7 @@ enum class WriterError
 
     // Format errors
     NoFormatRegistered      = 30,
+    UnsupportedOperation    = 31,
 
     EndOfEntries            = 40,
 };
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <cstddef>
 
@@ -56,6 +57,8 @@ public:
     virtual oc::result<Header>
     get_header(File &file) = 0;
     virtual oc::result<void>
+    set_entry_sizes(File &file, const std::vector<Entry> &entries);
+    virtual oc::result<void>
     write_header(File &file, const Header &header) = 0;
     virtual oc::result<Entry>
     get_entry(File &file) = 0;
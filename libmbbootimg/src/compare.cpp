@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/compare.h"
+
+#include <memory>
+
+#include <cstring>
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+
+namespace mb::bootimg
+{
+
+/*!
+ * \brief Compare two boot images.
+ *
+ * The headers are compared first. Then, each entry of \p reader2 is compared
+ * with the entry of the same type in \p reader1. Entry data is streamed from
+ * both readers at the same time and the comparison stops at the first
+ * difference, so neither image is read completely unless they are equal.
+ *
+ * \pre Both readers must be opened, but Reader::read_header() must not have
+ *      been called yet.
+ *
+ * \param reader1 Reader for the first boot image
+ * \param reader2 Reader for the second boot image
+ *
+ * \return Whether the boot images are equal. If an error occurs while reading
+ *         either image, a specific error code will be returned.
+ */
+oc::result<bool> compare(Reader &reader1, Reader &reader2)
+{
+    constexpr size_t buf_size = 64 * 1024;
+
+    OUTCOME_TRY(header1, reader1.read_header());
+    OUTCOME_TRY(header2, reader2.read_header());
+
+    if (header1 != header2) {
+        return false;
+    }
+
+    // Number of entries in the first image that haven't been matched yet
+    OUTCOME_TRY(entries1, reader1.entries());
+    auto remaining = entries1.size();
+
+    auto buf1 = std::make_unique<unsigned char[]>(buf_size);
+    auto buf2 = std::make_unique<unsigned char[]>(buf_size);
+
+    while (true) {
+        auto entry2 = reader2.read_entry();
+        if (!entry2) {
+            if (entry2.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            return entry2.as_failure();
+        }
+
+        if (remaining == 0) {
+            // Too many entries in second image
+            return false;
+        }
+        --remaining;
+
+        // Find the same entry in first image
+        auto entry1 = reader1.go_to_entry(entry2.value().type());
+        if (!entry1) {
+            if (entry1.error() == ReaderError::EndOfEntries) {
+                // Cannot be equal if entry is missing
+                return false;
+            }
+            return entry1.as_failure();
+        }
+
+        // Compare entries. This also compares the sizes if they are known.
+        if (entry1.value() != entry2.value()) {
+            return false;
+        }
+
+        // Compare data
+        while (true) {
+            OUTCOME_TRY(n1, reader1.read_data(buf1.get(), buf_size));
+            OUTCOME_TRY(n2, reader2.read_data(buf2.get(), buf_size));
+
+            if (n1 == 0 && n2 == 0) {
+                break;
+            } else if (n1 != n2 || memcmp(buf1.get(), buf2.get(), n1) != 0) {
+                return false;
+            }
+        }
+    }
+
+    // Too few entries in second image
+    return remaining == 0;
+}
+
+}
@@ -0,0 +1,672 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/entry_stream.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <cstring>
+
+#include <lz4.h>
+#include <lz4frame.h>
+#include <lzma.h>
+#include <zlib.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_error.h"
+
+#include "mbbootimg/reader.h"
+#include "mbbootimg/reader_error.h"
+
+/*!
+ * \file mbbootimg/entry_stream.h
+ * \brief Streaming reader for (compressed) boot image entries
+ */
+
+namespace mb::bootimg
+{
+
+namespace detail
+{
+
+//! Result of a single EntryDecoder::decode() call
+struct DecodeResult
+{
+    //! Number of input bytes consumed
+    size_t in_used;
+    //! Number of output bytes produced
+    size_t out_used;
+    //! Whether the end of the compressed stream was reached
+    bool ended;
+};
+
+class EntryDecoder
+{
+public:
+    EntryDecoder() = default;
+    virtual ~EntryDecoder() = default;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EntryDecoder)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(EntryDecoder)
+
+    /*!
+     * \brief Decompress some data
+     *
+     * \param in Compressed input
+     * \param in_size Size of compressed input
+     * \param in_eof Whether \p in contains the rest of the entry data
+     * \param out Output buffer
+     * \param out_size Size of output buffer
+     */
+    virtual oc::result<DecodeResult>
+    decode(const unsigned char *in, size_t in_size, bool in_eof,
+           unsigned char *out, size_t out_size) = 0;
+};
+
+}
+
+using namespace detail;
+
+// Size of the buffer for data read from the entry
+static constexpr size_t INPUT_BUFFER_SIZE = 256 * 1024;
+
+static constexpr unsigned char GZIP_MAGIC[] = { 0x1f, 0x8b };
+static constexpr unsigned char LZ4_LEGACY_MAGIC[] = { 0x02, 0x21, 0x4c, 0x18 };
+static constexpr unsigned char LZ4_FRAME_MAGIC[] = { 0x04, 0x22, 0x4d, 0x18 };
+static constexpr unsigned char XZ_MAGIC[] = { 0xfd, '7', 'z', 'X', 'Z', 0x00 };
+
+// Size of the lzma_alone header
+static constexpr size_t LZMA_ALONE_HEADER_SIZE = 13;
+
+// Fixed uncompressed block size of the LZ4 legacy format
+static constexpr size_t LZ4_LEGACY_BLOCK_SIZE = 8 * 1024 * 1024;
+
+template<typename T>
+static T clamp_size(size_t size)
+{
+    return static_cast<T>(std::min<size_t>(size, std::numeric_limits<T>::max()));
+}
+
+template<size_t N>
+static bool has_magic(const unsigned char *data, size_t size,
+                      const unsigned char (&magic)[N])
+{
+    return size >= N && memcmp(data, magic, N) == 0;
+}
+
+static uint32_t read_le32(const unsigned char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return mb_le32toh(value);
+}
+
+/*!
+ * \brief Check if data starts with an lzma_alone header
+ *
+ * The format has no magic, so this uses the same heuristics as xz: the
+ * properties byte must be the default (lc=3, lp=0, pb=2) that every encoder
+ * uses, the dictionary size must be 2^n or 2^n + 2^(n-1), and the uncompressed
+ * size must be unknown or less than 256 TiB.
+ */
+static bool is_lzma_alone(const unsigned char *data, size_t size)
+{
+    if (size < LZMA_ALONE_HEADER_SIZE || data[0] != 0x5d) {
+        return false;
+    }
+
+    uint32_t dict_size = read_le32(data + 1);
+    uint32_t low_bit = dict_size & (~dict_size + 1);
+
+    if (dict_size == 0 || (dict_size != low_bit && dict_size != 3 * low_bit
+            && dict_size != UINT32_MAX)) {
+        return false;
+    }
+
+    bool unknown_size = std::all_of(data + 5, data + 13, [](unsigned char c) {
+        return c == 0xff;
+    });
+
+    return unknown_size || (data[11] == 0 && data[12] == 0);
+}
+
+static Compression detect_compression(const unsigned char *data, size_t size)
+{
+    if (has_magic(data, size, GZIP_MAGIC)) {
+        return Compression::Gzip;
+    } else if (has_magic(data, size, LZ4_LEGACY_MAGIC)) {
+        return Compression::Lz4Legacy;
+    } else if (has_magic(data, size, LZ4_FRAME_MAGIC)) {
+        return Compression::Lz4Frame;
+    } else if (has_magic(data, size, XZ_MAGIC)) {
+        return Compression::Xz;
+    } else if (is_lzma_alone(data, size)) {
+        return Compression::Lzma;
+    } else {
+        return Compression::None;
+    }
+}
+
+namespace
+{
+
+class GzipDecoder : public EntryDecoder
+{
+public:
+    GzipDecoder() : m_zs(), m_initialized(false)
+    {
+    }
+
+    ~GzipDecoder() override
+    {
+        if (m_initialized) {
+            inflateEnd(&m_zs);
+        }
+    }
+
+    oc::result<void> init()
+    {
+        if (inflateInit2(&m_zs, 16 + MAX_WBITS) != Z_OK) {
+            return ReaderError::DecompressionFailed;
+        }
+
+        m_initialized = true;
+        return oc::success();
+    }
+
+    oc::result<DecodeResult>
+    decode(const unsigned char *in, size_t in_size, bool in_eof,
+           unsigned char *out, size_t out_size) override
+    {
+        (void) in_eof;
+
+        auto avail_in = clamp_size<uInt>(in_size);
+        auto avail_out = clamp_size<uInt>(out_size);
+
+        m_zs.next_in = const_cast<Bytef *>(in);
+        m_zs.avail_in = avail_in;
+        m_zs.next_out = out;
+        m_zs.avail_out = avail_out;
+
+        int ret = inflate(&m_zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            return ReaderError::DecompressionFailed;
+        }
+
+        return DecodeResult{
+            avail_in - m_zs.avail_in,
+            avail_out - m_zs.avail_out,
+            ret == Z_STREAM_END,
+        };
+    }
+
+private:
+    z_stream m_zs;
+    bool m_initialized;
+};
+
+class Lz4FrameDecoder : public EntryDecoder
+{
+public:
+    Lz4FrameDecoder() : m_dctx()
+    {
+    }
+
+    ~Lz4FrameDecoder() override
+    {
+        if (m_dctx) {
+            LZ4F_freeDecompressionContext(m_dctx);
+        }
+    }
+
+    oc::result<void> init()
+    {
+        if (LZ4F_isError(LZ4F_createDecompressionContext(
+                &m_dctx, LZ4F_VERSION))) {
+            m_dctx = nullptr;
+            return ReaderError::DecompressionFailed;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<DecodeResult>
+    decode(const unsigned char *in, size_t in_size, bool in_eof,
+           unsigned char *out, size_t out_size) override
+    {
+        (void) in_eof;
+
+        size_t in_used = in_size;
+        size_t out_used = out_size;
+
+        size_t ret = LZ4F_decompress(m_dctx, out, &out_used, in, &in_used,
+                                     nullptr);
+        if (LZ4F_isError(ret)) {
+            return ReaderError::DecompressionFailed;
+        }
+
+        // A return value of 0 means that the frame is fully decoded
+        return DecodeResult{in_used, out_used, ret == 0};
+    }
+
+private:
+    LZ4F_dctx *m_dctx;
+};
+
+/*!
+ * \brief Decoder for the LZ4 legacy format
+ *
+ * The format has no end marker, so the stream ends at the end of the entry or
+ * at the first block size that is larger than any valid block (eg. the
+ * uncompressed size that the kernel build appends to `Image.lz4`).
+ */
+class Lz4LegacyDecoder : public EntryDecoder
+{
+public:
+    Lz4LegacyDecoder()
+        : m_read_magic(false)
+        , m_word_size(0)
+        , m_block_size(0)
+        , m_out_pos(0)
+    {
+    }
+
+    oc::result<DecodeResult>
+    decode(const unsigned char *in, size_t in_size, bool in_eof,
+           unsigned char *out, size_t out_size) override
+    {
+        // Flush the previously decompressed block first
+        if (m_out_pos < m_out.size()) {
+            size_t n = std::min(out_size, m_out.size() - m_out_pos);
+            memcpy(out, m_out.data() + m_out_pos, n);
+            m_out_pos += n;
+            return DecodeResult{0, n, false};
+        }
+
+        if (m_block_size == 0) {
+            return read_word(in, in_size, in_eof);
+        }
+
+        const unsigned char *block;
+        size_t in_used;
+
+        if (m_block.empty() && in_size >= m_block_size) {
+            // Decompress directly from the input buffer if possible
+            block = in;
+            in_used = m_block_size;
+        } else {
+            in_used = std::min(in_size, m_block_size - m_block.size());
+            m_block.insert(m_block.end(), in, in + in_used);
+
+            if (m_block.size() < m_block_size) {
+                if (in_eof && in_used == in_size) {
+                    return FileError::UnexpectedEof;
+                }
+                return DecodeResult{in_used, 0, false};
+            }
+
+            block = m_block.data();
+        }
+
+        // Decompress directly to the output buffer if the block fits
+        bool direct = out_size >= LZ4_LEGACY_BLOCK_SIZE;
+        if (!direct) {
+            m_out.resize(LZ4_LEGACY_BLOCK_SIZE);
+        }
+
+        int n = LZ4_decompress_safe(
+                reinterpret_cast<const char *>(block),
+                reinterpret_cast<char *>(direct ? out : m_out.data()),
+                static_cast<int>(m_block_size),
+                static_cast<int>(LZ4_LEGACY_BLOCK_SIZE));
+        if (n < 0) {
+            return ReaderError::DecompressionFailed;
+        }
+
+        m_block_size = 0;
+        m_block.clear();
+
+        if (direct) {
+            return DecodeResult{in_used, static_cast<size_t>(n), false};
+        }
+
+        m_out.resize(static_cast<size_t>(n));
+        m_out_pos = std::min(out_size, m_out.size());
+        memcpy(out, m_out.data(), m_out_pos);
+
+        return DecodeResult{in_used, m_out_pos, false};
+    }
+
+private:
+    bool m_read_magic;
+
+    // Magic or block size being read
+    unsigned char m_word[4];
+    size_t m_word_size;
+
+    // Compressed size of the current block or 0 if it has not been read
+    size_t m_block_size;
+    // Compressed data of the current block if it is split across reads
+    std::vector<unsigned char> m_block;
+
+    // Decompressed data that did not fit in the output buffer
+    std::vector<unsigned char> m_out;
+    size_t m_out_pos;
+
+    oc::result<DecodeResult>
+    read_word(const unsigned char *in, size_t in_size, bool in_eof)
+    {
+        static const auto max_block_size = static_cast<size_t>(
+                LZ4_compressBound(static_cast<int>(LZ4_LEGACY_BLOCK_SIZE)));
+
+        size_t in_used = std::min(in_size, sizeof(m_word) - m_word_size);
+        memcpy(m_word + m_word_size, in, in_used);
+        m_word_size += in_used;
+
+        if (m_word_size < sizeof(m_word)) {
+            if (!in_eof || in_used < in_size) {
+                return DecodeResult{in_used, 0, false};
+            } else if (!m_read_magic) {
+                return FileError::UnexpectedEof;
+            }
+
+            // Fewer than 4 bytes of trailing data
+            return DecodeResult{in_used, 0, true};
+        }
+
+        m_word_size = 0;
+
+        if (has_magic(m_word, sizeof(m_word), LZ4_LEGACY_MAGIC)) {
+            // Initial magic or concatenated legacy streams
+            m_read_magic = true;
+            return DecodeResult{in_used, 0, false};
+        } else if (!m_read_magic) {
+            return ReaderError::DecompressionFailed;
+        }
+
+        size_t block_size = read_le32(m_word);
+        if (block_size == 0 || block_size > max_block_size) {
+            return DecodeResult{in_used, 0, true};
+        }
+
+        m_block_size = block_size;
+        return DecodeResult{in_used, 0, false};
+    }
+};
+
+class LzmaDecoder : public EntryDecoder
+{
+public:
+    LzmaDecoder() = default;
+
+    ~LzmaDecoder() override
+    {
+        lzma_end(&m_strm);
+    }
+
+    oc::result<void> init(Compression compression)
+    {
+        lzma_ret ret;
+
+        if (compression == Compression::Xz) {
+            ret = lzma_stream_decoder(&m_strm, UINT64_MAX, 0);
+        } else {
+            ret = lzma_alone_decoder(&m_strm, UINT64_MAX);
+        }
+
+        if (ret != LZMA_OK) {
+            return ReaderError::DecompressionFailed;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<DecodeResult>
+    decode(const unsigned char *in, size_t in_size, bool in_eof,
+           unsigned char *out, size_t out_size) override
+    {
+        m_strm.next_in = in;
+        m_strm.avail_in = in_size;
+        m_strm.next_out = out;
+        m_strm.avail_out = out_size;
+
+        lzma_ret ret = lzma_code(&m_strm, in_eof ? LZMA_FINISH : LZMA_RUN);
+        if (ret != LZMA_OK && ret != LZMA_STREAM_END && ret != LZMA_BUF_ERROR) {
+            return ReaderError::DecompressionFailed;
+        }
+
+        return DecodeResult{
+            in_size - m_strm.avail_in,
+            out_size - m_strm.avail_out,
+            ret == LZMA_STREAM_END,
+        };
+    }
+
+private:
+    lzma_stream m_strm = LZMA_STREAM_INIT;
+};
+
+}
+
+static oc::result<std::unique_ptr<EntryDecoder>>
+create_decoder(Compression compression)
+{
+    switch (compression) {
+    case Compression::None:
+        return nullptr;
+    case Compression::Gzip: {
+        auto decoder = std::make_unique<GzipDecoder>();
+        OUTCOME_TRYV(decoder->init());
+        return std::move(decoder);
+    }
+    case Compression::Lz4Legacy:
+        return std::make_unique<Lz4LegacyDecoder>();
+    case Compression::Lz4Frame: {
+        auto decoder = std::make_unique<Lz4FrameDecoder>();
+        OUTCOME_TRYV(decoder->init());
+        return std::move(decoder);
+    }
+    case Compression::Xz:
+    case Compression::Lzma: {
+        auto decoder = std::make_unique<LzmaDecoder>();
+        OUTCOME_TRYV(decoder->init(compression));
+        return std::move(decoder);
+    }
+    default:
+        MB_UNREACHABLE("Invalid compression format");
+    }
+}
+
+/*!
+ * \class EntryStream
+ *
+ * \brief File that reads the (decompressed) data of a boot image entry
+ *
+ * Instances are created by Reader::open_entry_stream(). Entry data is only
+ * read from the Reader as the stream is read, so callers that stop early (eg.
+ * after finding a file near the beginning of a ramdisk) do not decompress the
+ * rest of the entry. Data after the end of the compressed stream, such as the
+ * device trees appended to `zImage-dtb`, is not returned.
+ *
+ * The stream does not support writing or seeking.
+ */
+
+EntryStream::EntryStream(Reader &reader)
+    : m_reader(&reader)
+    , m_compression(Compression::None)
+    , m_in_pos(0)
+    , m_in_size(0)
+    , m_in_eof(false)
+    , m_ended(false)
+{
+}
+
+EntryStream::~EntryStream() = default;
+
+oc::result<void> EntryStream::open(Decompress decompress)
+{
+    m_in.resize(INPUT_BUFFER_SIZE);
+
+    OUTCOME_TRYV(fill());
+
+    if (decompress == Decompress::Auto) {
+        m_compression = detect_compression(m_in.data() + m_in_pos,
+                                           m_in_size - m_in_pos);
+    }
+
+    OUTCOME_TRY(decoder, create_decoder(m_compression));
+    m_decoder = std::move(decoder);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Read more entry data into the input buffer
+ */
+oc::result<void> EntryStream::fill()
+{
+    if (m_in_pos > 0) {
+        memmove(m_in.data(), m_in.data() + m_in_pos, m_in_size - m_in_pos);
+        m_in_size -= m_in_pos;
+        m_in_pos = 0;
+    }
+
+    size_t to_read = m_in.size() - m_in_size;
+
+    OUTCOME_TRY(n, m_reader->read_data(m_in.data() + m_in_size, to_read));
+
+    // Reader::read_data() only returns a short read at the end of the entry
+    m_in_size += n;
+    m_in_eof = n < to_read;
+
+    return oc::success();
+}
+
+oc::result<void> EntryStream::close()
+{
+    m_reader = nullptr;
+    m_decoder.reset();
+    m_in.clear();
+    m_in.shrink_to_fit();
+
+    return oc::success();
+}
+
+/*!
+ * \brief Read decompressed entry data
+ *
+ * \return Number of bytes read. This is only less than \p size if the end of
+ *         the (compressed) entry data is reached. If the data is invalid or
+ *         truncated, ReaderError::DecompressionFailed or
+ *         FileError::UnexpectedEof is returned.
+ */
+oc::result<size_t> EntryStream::read(void *buf, size_t size)
+{
+    if (!m_reader) {
+        return FileError::InvalidState;
+    }
+
+    auto out = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size && !m_ended) {
+        size_t remaining = size - total;
+
+        if (m_in_pos == m_in_size && !m_in_eof) {
+            if (!m_decoder && remaining >= m_in.size()) {
+                // Uncompressed data can be read without extra copies
+                OUTCOME_TRY(n, m_reader->read_data(out + total, remaining));
+                total += n;
+                m_ended = n < remaining;
+                continue;
+            }
+
+            OUTCOME_TRYV(fill());
+        }
+
+        if (!m_decoder) {
+            size_t n = std::min(remaining, m_in_size - m_in_pos);
+            memcpy(out + total, m_in.data() + m_in_pos, n);
+            m_in_pos += n;
+            total += n;
+            m_ended = m_in_eof && m_in_pos == m_in_size;
+            continue;
+        }
+
+        OUTCOME_TRY(result, m_decoder->decode(
+                m_in.data() + m_in_pos, m_in_size - m_in_pos, m_in_eof,
+                out + total, remaining));
+
+        m_in_pos += result.in_used;
+        total += result.out_used;
+
+        if (result.ended) {
+            m_ended = true;
+        } else if (result.in_used == 0 && result.out_used == 0) {
+            if (m_in_eof) {
+                return FileError::UnexpectedEof;
+            }
+
+            // The decoder should always make progress when there is input
+            return ReaderError::DecompressionFailed;
+        }
+    }
+
+    return total;
+}
+
+oc::result<size_t> EntryStream::write(const void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+    return FileError::UnsupportedWrite;
+}
+
+oc::result<uint64_t> EntryStream::seek(int64_t offset, int whence)
+{
+    (void) offset;
+    (void) whence;
+    return FileError::UnsupportedSeek;
+}
+
+oc::result<void> EntryStream::truncate(uint64_t size)
+{
+    (void) size;
+    return FileError::UnsupportedTruncate;
+}
+
+bool EntryStream::is_open()
+{
+    return m_reader != nullptr;
+}
+
+/*!
+ * \brief Get the compression format of the entry
+ *
+ * \return Detected format or Compression::None if the stream was opened with
+ *         Decompress::None or if the data is not compressed with a known
+ *         format
+ */
+Compression EntryStream::compression() const
+{
+    return m_compression;
+}
+
+}
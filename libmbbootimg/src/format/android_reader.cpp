@@ -189,6 +189,11 @@ AndroidFormatReader::read_data(File &file, void *buf, size_t buf_size)
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<std::vector<EntryLocation>> AndroidFormatReader::entries()
+{
+    return m_seg->entry_locations();
+}
+
 /*!
  * \brief Find and read Android boot image header
  *
@@ -26,6 +26,8 @@
 #include <cstdio>
 #include <cstring>
 
+#include <strings.h>
+
 #include <openssl/sha.h>
 
 #include "mbcommon/endian.h"
@@ -47,6 +49,7 @@ namespace mb::bootimg::android
 AndroidFormatWriter::AndroidFormatWriter(bool is_bump) noexcept
     : FormatWriter()
     , m_is_bump(is_bump)
+    , m_pipelined_sha1(false)
     , m_hdr()
     , m_sha_ctx()
 {
@@ -63,11 +66,34 @@ Format AndroidFormatWriter::type()
     }
 }
 
+oc::result<void> AndroidFormatWriter::set_option(const char *key,
+                                                 const char *value)
+{
+    if (strcmp(key, "pipelined_sha1") == 0) {
+        m_pipelined_sha1 = strcasecmp(value, "true") == 0
+                || strcasecmp(value, "yes") == 0
+                || strcasecmp(value, "y") == 0
+                || strcmp(value, "1") == 0;
+        return oc::success();
+    } else {
+        return FormatWriter::set_option(key, value);
+    }
+}
+
 oc::result<void> AndroidFormatWriter::open(File &file)
 {
     (void) file;
 
-    if (!SHA1_Init(&m_sha_ctx)) {
+    // Hash on a worker thread if requested. If the thread cannot be started,
+    // hash inline instead.
+    if (m_pipelined_sha1) {
+        m_sha_pipeline = std::make_unique<detail::Sha1Pipeline>();
+        if (!m_sha_pipeline->init()) {
+            m_sha_pipeline.reset();
+        }
+    }
+
+    if (!m_sha_pipeline && !SHA1_Init(&m_sha_ctx)) {
         return AndroidError::Sha1InitError;
     }
 
@@ -81,6 +107,7 @@ oc::result<void> AndroidFormatWriter::close(File &file)
     auto reset_state = finally([&] {
         m_hdr = {};
         m_sha_ctx = {};
+        m_sha_pipeline.reset();
         m_seg = {};
     });
 
@@ -100,7 +127,8 @@ oc::result<void> AndroidFormatWriter::close(File &file)
 
             // Set ID
             unsigned char digest[SHA_DIGEST_LENGTH];
-            if (!SHA1_Final(digest, &m_sha_ctx)) {
+            if (m_sha_pipeline ? !m_sha_pipeline->final(digest)
+                    : !SHA1_Final(digest, &m_sha_ctx)) {
                 return AndroidError::Sha1UpdateError;
             }
             memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
@@ -222,9 +250,7 @@ AndroidFormatWriter::write_data(File &file, const void *buf, size_t buf_size)
 
     // We always include the image in the hash. The size is sometimes included
     // and is handled in finish_entry().
-    if (!SHA1_Update(&m_sha_ctx, buf, n)) {
-        return AndroidError::Sha1UpdateError;
-    }
+    OUTCOME_TRYV(sha1_update(buf, n));
 
     return n;
 }
@@ -239,9 +265,8 @@ oc::result<void> AndroidFormatWriter::finish_entry(File &file)
     uint32_t le32_size = mb_htole32(*swentry->size);
 
     // Include size for everything except empty DT images
-    if ((swentry->type != EntryType::DeviceTree || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
-        return AndroidError::Sha1UpdateError;
+    if (swentry->type != EntryType::DeviceTree || *swentry->size > 0) {
+        OUTCOME_TRYV(sha1_update(&le32_size, sizeof(le32_size)));
     }
 
     switch (swentry->type) {
@@ -264,4 +289,15 @@ oc::result<void> AndroidFormatWriter::finish_entry(File &file)
     return oc::success();
 }
 
+oc::result<void> AndroidFormatWriter::sha1_update(const void *data,
+                                                  size_t size)
+{
+    if (m_sha_pipeline ? !m_sha_pipeline->update(data, size)
+            : !SHA1_Update(&m_sha_ctx, data, size)) {
+        return AndroidError::Sha1UpdateError;
+    }
+
+    return oc::success();
+}
+
 }
@@ -173,6 +173,11 @@ LokiFormatReader::read_data(File &file, void *buf, size_t buf_size)
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<std::vector<EntryLocation>> LokiFormatReader::entries()
+{
+    return m_seg->entry_locations();
+}
+
 /*!
  * \brief Find and read Loki boot image header
  *
@@ -306,53 +311,40 @@ LokiFormatReader::find_gzip_offset_old(File &file, uint32_t start_offset)
     // byte 8   : compression flags
     // byte 9   : operating system
 
-    static constexpr unsigned char gzip_deflate_magic[] = { 0x1f, 0x8b, 0x08 };
+    // Search for both flag values in a single pass so that the flags byte
+    // doesn't need to be read separately for every candidate
+    static constexpr unsigned char gzip_deflate_magic_flag0[] =
+            { 0x1f, 0x8b, 0x08, 0x00 };
+    static constexpr unsigned char gzip_deflate_magic_flag8[] =
+            { 0x1f, 0x8b, 0x08, 0x08 };
 
     OUTCOME_TRYV(file.seek(static_cast<int64_t>(start_offset), SEEK_SET));
 
-    FileSearcher searcher(&file, gzip_deflate_magic,
-                          sizeof(gzip_deflate_magic));
+    FileSearcher searcher(&file, {
+        {gzip_deflate_magic_flag0, sizeof(gzip_deflate_magic_flag0)},
+        {gzip_deflate_magic_flag8, sizeof(gzip_deflate_magic_flag8)},
+    });
     std::optional<uint64_t> flag0_offset;
     std::optional<uint64_t> flag8_offset;
 
     // Find first result with flags == 0x00 and flags == 0x08
-    while (true) {
-        OUTCOME_TRY(offset, searcher.next());
-        if (!offset) {
+    while (!flag0_offset || !flag8_offset) {
+        OUTCOME_TRY(match, searcher.next_match());
+        if (!match) {
             break;
         }
 
         // Offset is relative to starting position
-        *offset += start_offset;
-
-        // Save original position
-        OUTCOME_TRY(orig_offset, file.seek(0, SEEK_CUR));
-
-        // Seek to flags byte
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(*offset + 3), SEEK_SET));
+        auto offset = match->offset + start_offset;
 
-        // Read next bytes for flags
-        unsigned char flags;
-        if (auto r = file_read_exact(file, &flags, sizeof(flags)); !r) {
-            if (r.error() == FileError::UnexpectedEof) {
-                break;
-            } else {
-                return r.as_failure();
+        if (match->pattern == 0) {
+            if (!flag0_offset) {
+                flag0_offset = offset;
+            }
+        } else {
+            if (!flag8_offset) {
+                flag8_offset = offset;
             }
-        }
-
-        if (!flag0_offset && flags == 0x00) {
-            flag0_offset = *offset;
-        } else if (!flag8_offset && flags == 0x08) {
-            flag8_offset = *offset;
-        }
-
-        // Restore original position as per contract
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(orig_offset), SEEK_SET));
-
-        // Stop early if possible
-        if (flag0_offset && flag8_offset) {
-            break;
         }
     }
 
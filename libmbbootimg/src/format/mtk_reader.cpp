@@ -310,4 +310,9 @@ MtkFormatReader::read_data(File &file, void *buf, size_t buf_size)
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<std::vector<EntryLocation>> MtkFormatReader::entries()
+{
+    return m_seg->entry_locations();
+}
+
 }
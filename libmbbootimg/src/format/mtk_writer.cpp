@@ -136,6 +136,11 @@ _mtk_compute_sha1(SegmentWriter &seg, File &file,
 MtkFormatWriter::MtkFormatWriter() noexcept
     : FormatWriter()
     , m_hdr()
+    , m_sha_ctx()
+    , m_sha_valid(false)
+    , m_mtkhdr()
+    , m_mtkhdr_size(0)
+    , m_entry_data_size(0)
 {
 }
 
@@ -150,6 +155,11 @@ oc::result<void> MtkFormatWriter::open(File &file)
 {
     (void) file;
 
+    if (!SHA1_Init(&m_sha_ctx)) {
+        return android::AndroidError::Sha1InitError;
+    }
+
+    m_sha_valid = true;
     m_seg = SegmentWriter();
 
     return oc::success();
@@ -160,6 +170,11 @@ oc::result<void> MtkFormatWriter::close(File &file)
     auto reset_state = finally([&] {
         m_hdr = {};
         m_seg = {};
+        m_sha_ctx = {};
+        m_sha_valid = false;
+        m_mtkhdr = {};
+        m_mtkhdr_size = 0;
+        m_entry_data_size = 0;
     });
 
     if (m_seg) {
@@ -187,13 +202,23 @@ oc::result<void> MtkFormatWriter::close(File &file)
                 }
             }
 
-            // We need to take the performance hit and compute the SHA1 here.
-            // We can't fill in the sizes in the MTK headers when we're writing
-            // them. Thus, if we calculated the SHA1sum during write, it would
-            // be incorrect.
-            OUTCOME_TRYV(_mtk_compute_sha1(
-                    *m_seg, file,
-                    reinterpret_cast<unsigned char *>(m_hdr.id)));
+            if (m_sha_valid) {
+                // The kernel and ramdisk sizes were known before their data
+                // was written, so the hash already covers the final MTK
+                // headers
+                if (!SHA1_Final(reinterpret_cast<unsigned char *>(m_hdr.id),
+                                &m_sha_ctx)) {
+                    return android::AndroidError::Sha1UpdateError;
+                }
+            } else {
+                // We need to take the performance hit and compute the SHA1
+                // here. The sizes in the MTK headers weren't known when they
+                // were written, so the hash calculated during write would be
+                // incorrect.
+                OUTCOME_TRYV(_mtk_compute_sha1(
+                        *m_seg, file,
+                        reinterpret_cast<unsigned char *>(m_hdr.id)));
+            }
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -302,13 +327,57 @@ oc::result<Entry> MtkFormatWriter::get_entry(File &file)
 
 oc::result<void> MtkFormatWriter::write_entry(File &file, const Entry &entry)
 {
-    return m_seg->write_entry(file, entry);
+    OUTCOME_TRYV(m_seg->write_entry(file, entry));
+
+    auto swentry = m_seg->entry();
+
+    m_entry_data_size = 0;
+
+    if (swentry->type == EntryType::MtkKernelHeader
+            || swentry->type == EntryType::MtkRamdiskHeader) {
+        m_mtkhdr = {};
+        m_mtkhdr_size = 0;
+    } else if (m_sha_valid && (swentry->type == EntryType::Kernel
+            || swentry->type == EntryType::Ramdisk)) {
+        // The MTK header that precedes this entry can only be hashed once its
+        // size field is known. If the caller did not specify the entry size
+        // upfront, fall back to computing the hash when closing.
+        if (swentry->size) {
+            m_mtkhdr.size = mb_htole32(*swentry->size);
+
+            if (!SHA1_Update(&m_sha_ctx, &m_mtkhdr, sizeof(m_mtkhdr))) {
+                return android::AndroidError::Sha1UpdateError;
+            }
+        } else {
+            m_sha_valid = false;
+        }
+    }
+
+    return oc::success();
 }
 
 oc::result<size_t>
 MtkFormatWriter::write_data(File &file, const void *buf, size_t buf_size)
 {
-    return m_seg->write_data(file, buf, buf_size);
+    OUTCOME_TRY(n, m_seg->write_data(file, buf, buf_size));
+
+    auto swentry = m_seg->entry();
+
+    if (swentry->type == EntryType::MtkKernelHeader
+            || swentry->type == EntryType::MtkRamdiskHeader) {
+        // Buffer the header so it can be hashed with the final size. Sizes
+        // other than sizeof(MtkHeader) are rejected in finish_entry().
+        auto to_copy = std::min(n, sizeof(m_mtkhdr) - m_mtkhdr_size);
+        memcpy(reinterpret_cast<unsigned char *>(&m_mtkhdr) + m_mtkhdr_size,
+               buf, to_copy);
+        m_mtkhdr_size += to_copy;
+    } else if (m_sha_valid && !SHA1_Update(&m_sha_ctx, buf, n)) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    m_entry_data_size += n;
+
+    return n;
 }
 
 oc::result<void> MtkFormatWriter::finish_entry(File &file)
@@ -327,6 +396,41 @@ oc::result<void> MtkFormatWriter::finish_entry(File &file)
         return MtkError::InvalidEntrySizeForMtkHeader;
     }
 
+    // If the specified entry size does not match what was written, the data
+    // that was hashed is not what _mtk_compute_sha1() would have read
+    if (*swentry->size != m_entry_data_size) {
+        m_sha_valid = false;
+    }
+
+    if (m_sha_valid) {
+        uint32_t le32_size;
+        bool include_size = true;
+
+        switch (swentry->type) {
+        case EntryType::Kernel:
+        case EntryType::Ramdisk:
+            le32_size = mb_htole32(static_cast<uint32_t>(
+                    *swentry->size + sizeof(MtkHeader)));
+            break;
+        case EntryType::SecondBoot:
+            le32_size = mb_htole32(*swentry->size);
+            break;
+        case EntryType::DeviceTree:
+            le32_size = mb_htole32(*swentry->size);
+            include_size = *swentry->size > 0;
+            break;
+        default:
+            le32_size = 0;
+            include_size = false;
+            break;
+        }
+
+        if (include_size
+                && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
+            return android::AndroidError::Sha1UpdateError;
+        }
+    }
+
     switch (swentry->type) {
     case EntryType::Kernel:
         m_hdr.kernel_size = static_cast<uint32_t>(
@@ -60,6 +60,8 @@ std::string SegmentErrorCategory::message(int ev) const
         return "write would overflow integer";
     case SegmentError::InvalidEntrySize:
         return "invalid entry size";
+    case SegmentError::EntrySizeMismatch:
+        return "entry size does not match declared size";
     default:
         return "(unknown segment reader/writer error)";
     }
@@ -52,6 +52,20 @@ const std::vector<SegmentReaderEntry> & SegmentReader::entries() const
     return m_entries;
 }
 
+std::vector<EntryLocation> SegmentReader::entry_locations() const
+{
+    std::vector<EntryLocation> locations;
+    locations.reserve(m_entries.size());
+
+    for (auto const &srentry : m_entries) {
+        locations.push_back({
+            srentry.type, srentry.offset, srentry.size, srentry.can_truncate,
+        });
+    }
+
+    return locations;
+}
+
 oc::result<void> SegmentReader::set_entries(std::vector<SegmentReaderEntry> entries)
 {
     if (m_state != SegmentReaderState::Begin) {
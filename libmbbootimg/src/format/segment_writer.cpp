@@ -37,12 +37,28 @@
 namespace mb::bootimg
 {
 
+static oc::result<void> write_zeros(File &file, uint64_t size)
+{
+    static constexpr char zeros[4096] = {};
+
+    while (size > 0) {
+        auto n = std::min<uint64_t>(size, sizeof(zeros));
+
+        OUTCOME_TRYV(file_write_exact(file, zeros, static_cast<size_t>(n)));
+
+        size -= n;
+    }
+
+    return oc::success();
+}
+
 SegmentWriter::SegmentWriter() noexcept
     : m_state(SegmentWriterState::Begin)
     , m_entries()
     , m_entry()
     , m_entry_size()
     , m_pos()
+    , m_sequential(false)
 {
 }
 
@@ -63,6 +79,34 @@ oc::result<void> SegmentWriter::set_entries(std::vector<SegmentWriterEntry> entr
     return oc::success();
 }
 
+/*!
+ * \brief Write the entries strictly sequentially
+ *
+ * The file position is not queried and alignment padding is written as zeros
+ * instead of being skipped over, so the output does not need to be seekable.
+ * Every entry must already have a size and the writes must match those sizes
+ * exactly.
+ *
+ * \param pos Current position in the output file
+ */
+oc::result<void> SegmentWriter::set_sequential(uint64_t pos)
+{
+    if (m_state != SegmentWriterState::Begin) {
+        return SegmentError::AddEntryInIncorrectState;
+    }
+
+    for (auto const &entry : m_entries) {
+        if (!entry.size) {
+            return SegmentError::InvalidEntrySize;
+        }
+    }
+
+    m_sequential = true;
+    m_pos = pos;
+
+    return oc::success();
+}
+
 std::vector<SegmentWriterEntry>::const_iterator SegmentWriter::entry() const
 {
     return m_entry;
@@ -121,6 +165,8 @@ oc::result<void> SegmentWriter::write_entry(File &file, const Entry &entry)
         if (*size > UINT32_MAX) {
             //DEBUG("Invalid entry size: %" PRIu64, *size);
             return SegmentError::InvalidEntrySize;
+        } else if (m_sequential && *size != *m_entry->size) {
+            return SegmentError::EntrySizeMismatch;
         }
 
         update_size_if_unset(static_cast<uint32_t>(*size));
@@ -136,6 +182,8 @@ oc::result<size_t> SegmentWriter::write_data(File &file, const void *buf,
     if (buf_size > UINT32_MAX || m_entry_size > UINT32_MAX - buf_size
             || *m_pos > UINT64_MAX - buf_size) {
         return SegmentError::WriteWouldOverflowInteger;
+    } else if (m_sequential && buf_size > *m_entry->size - m_entry_size) {
+        return SegmentError::EntrySizeMismatch;
     }
 
     auto ret = file_write_exact(file, buf, buf_size);
@@ -154,6 +202,22 @@ oc::result<void> SegmentWriter::finish_entry(File &file)
     // Update size with number of bytes written
     update_size_if_unset(m_entry_size);
 
+    if (m_sequential) {
+        if (m_entry_size != *m_entry->size) {
+            return SegmentError::EntrySizeMismatch;
+        }
+
+        if (m_entry->align > 0) {
+            auto skip = align_page_size<uint64_t>(*m_pos, m_entry->align);
+
+            OUTCOME_TRYV(write_zeros(file, skip));
+
+            *m_pos += skip;
+        }
+
+        return oc::success();
+    }
+
     // Finish previous entry by aligning to page
     if (m_entry->align > 0) {
         auto skip = align_page_size<uint64_t>(*m_pos, m_entry->align);
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/format/sha1_pipeline_p.h"
+
+#include <algorithm>
+#include <system_error>
+
+#include <cstring>
+
+/*!
+ * \class mb::bootimg::detail::Sha1Pipeline
+ *
+ * \brief SHA1 context that hashes data on a worker thread
+ *
+ * Data passed to update() is copied into a ring of buffers. Full buffers are
+ * hashed by a worker thread while the caller continues with its I/O. The
+ * caller only blocks when every buffer is waiting to be hashed.
+ *
+ * The functions mirror SHA1_Init(), SHA1_Update(), and SHA1_Final() and must
+ * all be called from the same thread.
+ */
+
+namespace mb::bootimg::detail
+{
+
+/*!
+ * \brief Construct pipeline without starting the worker thread
+ *
+ * \param buffers Number of buffers in the ring (at least 2 are used)
+ * \param buffer_size Size of each buffer
+ */
+Sha1Pipeline::Sha1Pipeline(size_t buffers, size_t buffer_size)
+    : m_ctx()
+    , m_bufs(std::max<size_t>(buffers, 2))
+    , m_buf_size(std::max<size_t>(buffer_size, 1))
+    , m_fill(0)
+    , m_head(0)
+    , m_queued(0)
+    , m_stop(false)
+    , m_failed(false)
+{
+    for (auto &buf : m_bufs) {
+        buf.reserve(m_buf_size);
+    }
+}
+
+Sha1Pipeline::~Sha1Pipeline() noexcept
+{
+    stop();
+}
+
+/*!
+ * \brief Initialize SHA1 context and start the worker thread
+ *
+ * \return Whether the context was initialized and the thread was started
+ */
+bool Sha1Pipeline::init()
+{
+    stop();
+
+    for (auto &buf : m_bufs) {
+        buf.clear();
+    }
+
+    m_fill = 0;
+    m_head = 0;
+    m_queued = 0;
+    m_stop = false;
+    m_failed = false;
+
+    if (!SHA1_Init(&m_ctx)) {
+        return false;
+    }
+
+    try {
+        m_thread = std::thread(&Sha1Pipeline::worker, this);
+    } catch (const std::system_error &) {
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Queue data to be hashed
+ *
+ * \param data Data buffer
+ * \param size Size of data buffer
+ *
+ * \return Whether the data was queued. This returns false if hashing any
+ *         previously queued data failed.
+ */
+bool Sha1Pipeline::update(const void *data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    while (size > 0) {
+        auto &buf = m_bufs[m_fill];
+        auto to_copy = std::min(size, m_buf_size - buf.size());
+
+        buf.insert(buf.end(), ptr, ptr + to_copy);
+        ptr += to_copy;
+        size -= to_copy;
+
+        if (buf.size() == m_buf_size) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            submit_locked(lock);
+
+            if (m_failed) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Wait for all queued data to be hashed and compute the digest
+ *
+ * \param[out] digest Output digest
+ *
+ * \return Whether the digest was computed successfully
+ */
+bool Sha1Pipeline::final(unsigned char digest[SHA_DIGEST_LENGTH])
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        if (!m_bufs[m_fill].empty()) {
+            submit_locked(lock);
+        }
+
+        m_cv.wait(lock, [&] { return m_queued == 0; });
+    }
+
+    stop();
+
+    if (m_failed) {
+        return false;
+    }
+
+    return SHA1_Final(digest, &m_ctx);
+}
+
+/*!
+ * \brief Hand the current fill buffer to the worker thread
+ *
+ * This blocks until the next buffer in the ring is no longer queued.
+ */
+void Sha1Pipeline::submit_locked(std::unique_lock<std::mutex> &lock)
+{
+    ++m_queued;
+    m_fill = (m_fill + 1) % m_bufs.size();
+    m_cv.notify_all();
+
+    m_cv.wait(lock, [&] { return m_queued < m_bufs.size(); });
+}
+
+void Sha1Pipeline::stop() noexcept
+{
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+
+        m_thread.join();
+    }
+}
+
+void Sha1Pipeline::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_cv.wait(lock, [&] { return m_queued > 0 || m_stop; });
+
+        if (m_queued == 0) {
+            break;
+        }
+
+        // The producer never touches a queued buffer, so it can be hashed
+        // without holding the lock
+        auto &buf = m_bufs[m_head];
+        bool failed = m_failed;
+
+        lock.unlock();
+
+        if (!failed && !SHA1_Update(&m_ctx, buf.data(), buf.size())) {
+            failed = true;
+        }
+        buf.clear();
+
+        lock.lock();
+
+        m_failed = failed;
+        m_head = (m_head + 1) % m_bufs.size();
+        --m_queued;
+        m_cv.notify_all();
+    }
+}
+
+}
@@ -221,6 +221,11 @@ SonyElfFormatReader::read_data(File &file, void *buf, size_t buf_size)
     return m_seg->read_data(file, buf, buf_size);
 }
 
+oc::result<std::vector<EntryLocation>> SonyElfFormatReader::entries()
+{
+    return m_seg->entry_locations();
+}
+
 /*!
  * \brief Find and read Sony ELF boot image header
  *
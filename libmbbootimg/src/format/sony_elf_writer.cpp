@@ -34,6 +34,7 @@
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
+#include "mbbootimg/format/segment_error_p.h"
 #include "mbbootimg/format/sony_elf_defs.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/writer_p.h"
@@ -41,6 +42,9 @@
 namespace mb::bootimg::sonyelf
 {
 
+//! Offset of the first entry's data
+static constexpr uint64_t DATA_OFFSET = 4096;
+
 SonyElfFormatWriter::SonyElfFormatWriter() noexcept
     : FormatWriter()
     , m_hdr()
@@ -80,46 +84,20 @@ oc::result<void> SonyElfFormatWriter::close(File &file)
         m_hdr_rpm = {};
         m_hdr_appsbl = {};
         m_cmdline.clear();
+        m_entry_sizes = {};
         m_seg = {};
     });
 
     if (m_seg) {
         auto swentry = m_seg->entry();
 
-        // If successful, finish up the boot image
-        if (swentry == m_seg->entries().end()) {
-            // Write headers
-            struct {
-                const void *ptr;
-                size_t size;
-                bool can_write;
-            } headers[] = {
-                { &m_hdr, sizeof(m_hdr), true },
-                { &m_hdr_kernel, sizeof(m_hdr_kernel), m_hdr_kernel.p_filesz > 0 },
-                { &m_hdr_ramdisk, sizeof(m_hdr_ramdisk), m_hdr_ramdisk.p_filesz > 0 },
-                { &m_hdr_cmdline, sizeof(m_hdr_cmdline), m_hdr_cmdline.p_filesz > 0 },
-                { &m_hdr_ipl, sizeof(m_hdr_ipl), m_hdr_ipl.p_filesz > 0 },
-                { &m_hdr_rpm, sizeof(m_hdr_rpm), m_hdr_rpm.p_filesz > 0 },
-                { &m_hdr_appsbl, sizeof(m_hdr_appsbl), m_hdr_appsbl.p_filesz > 0 },
-            };
-
-            sony_elf_fix_ehdr_byte_order(m_hdr);
-            sony_elf_fix_phdr_byte_order(m_hdr_kernel);
-            sony_elf_fix_phdr_byte_order(m_hdr_ramdisk);
-            sony_elf_fix_phdr_byte_order(m_hdr_cmdline);
-            sony_elf_fix_phdr_byte_order(m_hdr_ipl);
-            sony_elf_fix_phdr_byte_order(m_hdr_rpm);
-            sony_elf_fix_phdr_byte_order(m_hdr_appsbl);
-
+        // If successful, finish up the boot image. When writing sequentially,
+        // the headers were already written by write_header().
+        if (swentry == m_seg->entries().end() && !m_entry_sizes) {
             // Seek back to beginning to write headers
             OUTCOME_TRYV(file.seek(0, SEEK_SET));
 
-            // Write headers
-            for (auto const &header : headers) {
-                if (header.can_write) {
-                    OUTCOME_TRYV(file_write_exact(file, header.ptr, header.size));
-                }
-            }
+            OUTCOME_TRYV(write_headers(file));
         }
     }
 
@@ -136,6 +114,24 @@ oc::result<Header> SonyElfFormatWriter::get_header(File &file)
     return std::move(header);
 }
 
+oc::result<void>
+SonyElfFormatWriter::set_entry_sizes(File &file,
+                                     const std::vector<Entry> &entries)
+{
+    (void) file;
+
+    for (auto const &entry : entries) {
+        auto size = entry.size();
+        if (!size || *size > UINT32_MAX) {
+            return SegmentError::InvalidEntrySize;
+        }
+    }
+
+    m_entry_sizes = entries;
+
+    return oc::success();
+}
+
 oc::result<void>
 SonyElfFormatWriter::write_header(File &file, const Header &header)
 {
@@ -239,12 +235,47 @@ SonyElfFormatWriter::write_header(File &file, const Header &header)
     entries.push_back({ EntryType::SonyRpm, 0, {}, 0 });
     entries.push_back({ EntryType::SonyAppsbl, 0, {}, 0 });
 
-    OUTCOME_TRYV(m_seg->set_entries(std::move(entries)));
+    if (!m_entry_sizes) {
+        OUTCOME_TRYV(m_seg->set_entries(std::move(entries)));
 
-    // Start writing at offset 4096
-    OUTCOME_TRYV(file.seek(4096, SEEK_SET));
+        // Start writing at offset 4096
+        OUTCOME_TRYV(file.seek(DATA_OFFSET, SEEK_SET));
 
-    return oc::success();
+        return oc::success();
+    }
+
+    // All sizes are known, so lay out the entries and write the headers now.
+    // Entries that were not declared are empty.
+    uint64_t offset = DATA_OFFSET;
+
+    for (auto &swentry : entries) {
+        uint64_t size = 0;
+
+        if (swentry.type == EntryType::SonyCmdline) {
+            size = m_cmdline.size();
+        } else {
+            for (auto const &entry : *m_entry_sizes) {
+                if (entry.type() == swentry.type) {
+                    size = *entry.size();
+                    break;
+                }
+            }
+        }
+
+        if (size > UINT32_MAX || offset > UINT32_MAX - size) {
+            return SegmentError::EntryWouldOverflowOffset;
+        }
+
+        swentry.size = static_cast<uint32_t>(size);
+        set_entry_location(swentry.type, offset, *swentry.size);
+
+        offset += size;
+    }
+
+    OUTCOME_TRYV(m_seg->set_entries(std::move(entries)));
+    OUTCOME_TRYV(m_seg->set_sequential(DATA_OFFSET));
+
+    return write_headers(file);
 }
 
 oc::result<Entry> SonyElfFormatWriter::get_entry(File &file)
@@ -285,46 +316,99 @@ oc::result<void> SonyElfFormatWriter::finish_entry(File &file)
 
     auto swentry = m_seg->entry();
 
-    switch (swentry->type) {
+    if (!m_entry_sizes) {
+        set_entry_location(swentry->type, swentry->offset, *swentry->size);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Fill in the program header for an entry
+ */
+void SonyElfFormatWriter::set_entry_location(EntryType type, uint64_t offset,
+                                             uint32_t size)
+{
+    Sony_Elf32_Phdr *phdr;
+
+    switch (type) {
     case EntryType::Kernel:
-        m_hdr_kernel.p_offset = static_cast<Elf32_Off>(swentry->offset);
-        m_hdr_kernel.p_filesz = *swentry->size;
-        m_hdr_kernel.p_memsz = *swentry->size;
+        phdr = &m_hdr_kernel;
         break;
     case EntryType::Ramdisk:
-        m_hdr_ramdisk.p_offset = static_cast<Elf32_Off>(swentry->offset);
-        m_hdr_ramdisk.p_filesz = *swentry->size;
-        m_hdr_ramdisk.p_memsz = *swentry->size;
+        phdr = &m_hdr_ramdisk;
         break;
     case EntryType::SonyCmdline:
-        m_hdr_cmdline.p_offset = static_cast<Elf32_Off>(swentry->offset);
-        m_hdr_cmdline.p_filesz = *swentry->size;
-        m_hdr_cmdline.p_memsz = *swentry->size;
+        phdr = &m_hdr_cmdline;
         break;
     case EntryType::SonyIpl:
-        m_hdr_ipl.p_offset = static_cast<Elf32_Off>(swentry->offset);
-        m_hdr_ipl.p_filesz = *swentry->size;
-        m_hdr_ipl.p_memsz = *swentry->size;
+        phdr = &m_hdr_ipl;
         break;
     case EntryType::SonyRpm:
-        m_hdr_rpm.p_offset = static_cast<Elf32_Off>(swentry->offset);
-        m_hdr_rpm.p_filesz = *swentry->size;
-        m_hdr_rpm.p_memsz = *swentry->size;
+        phdr = &m_hdr_rpm;
         break;
     case EntryType::SonyAppsbl:
-        m_hdr_appsbl.p_offset = static_cast<Elf32_Off>(swentry->offset);
-        m_hdr_appsbl.p_filesz = *swentry->size;
-        m_hdr_appsbl.p_memsz = *swentry->size;
+        phdr = &m_hdr_appsbl;
         break;
     default:
-        break;
+        return;
     }
 
-    if (*swentry->size > 0) {
+    phdr->p_offset = static_cast<Elf32_Off>(offset);
+    phdr->p_filesz = size;
+    phdr->p_memsz = size;
+
+    if (size > 0) {
         ++m_hdr.e_phnum;
     }
+}
 
-    return oc::success();
+/*!
+ * \brief Write the ELF header and the program headers of non-empty entries
+ *
+ * The headers are converted to the on-disk byte order in place, so this can
+ * only be called once. When writing sequentially, the headers are padded with
+ * zeros up to #DATA_OFFSET.
+ */
+oc::result<void> SonyElfFormatWriter::write_headers(File &file)
+{
+    struct {
+        const void *ptr;
+        size_t size;
+        bool can_write;
+    } headers[] = {
+        { &m_hdr, sizeof(m_hdr), true },
+        { &m_hdr_kernel, sizeof(m_hdr_kernel), m_hdr_kernel.p_filesz > 0 },
+        { &m_hdr_ramdisk, sizeof(m_hdr_ramdisk), m_hdr_ramdisk.p_filesz > 0 },
+        { &m_hdr_cmdline, sizeof(m_hdr_cmdline), m_hdr_cmdline.p_filesz > 0 },
+        { &m_hdr_ipl, sizeof(m_hdr_ipl), m_hdr_ipl.p_filesz > 0 },
+        { &m_hdr_rpm, sizeof(m_hdr_rpm), m_hdr_rpm.p_filesz > 0 },
+        { &m_hdr_appsbl, sizeof(m_hdr_appsbl), m_hdr_appsbl.p_filesz > 0 },
+    };
+
+    sony_elf_fix_ehdr_byte_order(m_hdr);
+    sony_elf_fix_phdr_byte_order(m_hdr_kernel);
+    sony_elf_fix_phdr_byte_order(m_hdr_ramdisk);
+    sony_elf_fix_phdr_byte_order(m_hdr_cmdline);
+    sony_elf_fix_phdr_byte_order(m_hdr_ipl);
+    sony_elf_fix_phdr_byte_order(m_hdr_rpm);
+    sony_elf_fix_phdr_byte_order(m_hdr_appsbl);
+
+    unsigned char buf[DATA_OFFSET] = {};
+    size_t buf_size = 0;
+
+    for (auto const &header : headers) {
+        if (header.can_write) {
+            memcpy(buf + buf_size, header.ptr, header.size);
+            buf_size += header.size;
+        }
+    }
+
+    if (m_entry_sizes) {
+        buf_size = sizeof(buf);
+    }
+
+    return file_write_exact(file, buf, buf_size);
 }
 
 }
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/probe_file_p.h"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+
+namespace mb::bootimg::detail
+{
+
+/*!
+ * \class ProbeFile
+ *
+ * \brief Read-only view of a File that caches its beginning.
+ *
+ * Every format reader looks for its magic near the start of the file while
+ * bidding in Reader::open(). This reads that region from the underlying file
+ * once and serves all of the bidders from memory. The cached prefix starts at
+ * INITIAL_SIZE bytes and grows as needed, up to the maximum size. Reads beyond
+ * that are passed through to the underlying file.
+ *
+ * The underlying file is only accessed with File::read_at() and
+ * File::seek(0, SEEK_END), so its file position is unspecified afterwards.
+ */
+
+/*!
+ * \brief Construct a ProbeFile for \p file
+ *
+ * \param file Underlying file. It must outlive the ProbeFile.
+ * \param max_size Maximum number of bytes to cache
+ */
+ProbeFile::ProbeFile(File &file, size_t max_size)
+    : m_file(file)
+    , m_max_size(max_size)
+    , m_eof(false)
+    , m_pos(0)
+{
+}
+
+ProbeFile::~ProbeFile() = default;
+
+/*!
+ * \brief Does nothing
+ *
+ * The underlying file is not closed.
+ */
+oc::result<void> ProbeFile::close()
+{
+    return oc::success();
+}
+
+oc::result<size_t> ProbeFile::read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, read_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> ProbeFile::write(const void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+    return FileError::UnsupportedWrite;
+}
+
+oc::result<uint64_t> ProbeFile::seek(int64_t offset, int whence)
+{
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        if (!m_size) {
+            OUTCOME_TRY(size, m_file.seek(0, SEEK_END));
+            m_size = size;
+        }
+        base = *m_size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if ((offset < 0 && static_cast<uint64_t>(-offset) > base)
+            || (offset > 0 && static_cast<uint64_t>(offset) > UINT64_MAX - base)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    m_pos = offset < 0 ? base - static_cast<uint64_t>(-offset)
+            : base + static_cast<uint64_t>(offset);
+
+    return m_pos;
+}
+
+oc::result<void> ProbeFile::truncate(uint64_t size)
+{
+    (void) size;
+    return FileError::UnsupportedTruncate;
+}
+
+/*!
+ * \brief Read from the cached prefix or the underlying file
+ *
+ * The cache is extended if the requested range starts within the maximum
+ * cache size.
+ */
+oc::result<size_t> ProbeFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    auto ptr = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    if (size > 0 && offset < m_max_size && offset + size > m_cache.size()
+            && !m_eof) {
+        OUTCOME_TRYV(fill(offset + size));
+    }
+
+    if (offset < m_cache.size()) {
+        total = std::min(size, m_cache.size() - static_cast<size_t>(offset));
+        memcpy(ptr, m_cache.data() + offset, total);
+    }
+
+    if (total == size || m_eof) {
+        return total;
+    }
+
+    // Remainder is beyond the cached prefix
+    OUTCOME_TRY(n, m_file.read_at(offset + total, ptr + total, size - total));
+
+    return total + n;
+}
+
+/*!
+ * \brief Returns true
+ */
+bool ProbeFile::is_open()
+{
+    return true;
+}
+
+/*!
+ * \brief Number of bytes currently cached
+ */
+size_t ProbeFile::cached_size() const noexcept
+{
+    return m_cache.size();
+}
+
+/*!
+ * \brief Extend the cached prefix to at least \p needed bytes
+ *
+ * The cache grows geometrically so that bidders reading successive structures
+ * do not each cause a read from the underlying file. It never grows beyond the
+ * maximum size.
+ */
+oc::result<void> ProbeFile::fill(uint64_t needed)
+{
+    size_t old_size = m_cache.size();
+    size_t new_size = std::max(INITIAL_SIZE, old_size * 2);
+    while (new_size < needed && new_size < m_max_size) {
+        new_size *= 2;
+    }
+    new_size = std::min(new_size, m_max_size);
+
+    m_cache.resize(new_size);
+
+    size_t cur_size = old_size;
+
+    while (cur_size < new_size) {
+        auto n = m_file.read_at(cur_size, m_cache.data() + cur_size,
+                                new_size - cur_size);
+        if (!n) {
+            m_cache.resize(cur_size);
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            m_eof = true;
+            break;
+        }
+
+        cur_size += n.value();
+    }
+
+    m_cache.resize(cur_size);
+
+    return oc::success();
+}
+
+}
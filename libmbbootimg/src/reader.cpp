@@ -19,6 +19,9 @@
 
 #include "mbbootimg/reader.h"
 
+#include <algorithm>
+#include <memory>
+
 #include <cassert>
 #include <cerrno>
 #include <cinttypes>
@@ -26,8 +29,12 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <openssl/sha.h>
+
 #include "mbcommon/file.h"
+#include "mbcommon/file/buffered.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_error.h"
 #include "mbcommon/finally.h"
 
 #include "mbbootimg/entry.h"
@@ -36,6 +43,7 @@
 #include "mbbootimg/format/mtk_reader_p.h"
 #include "mbbootimg/format/sony_elf_reader_p.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/probe_file_p.h"
 
 #define ENSURE_STATE_OR_RETURN(STATES, RETVAL) \
     do { \
@@ -176,6 +184,18 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::entries
+ *
+ * \brief Format reader callback to get the locations of all entries
+ *
+ * This is only called after read_header() succeeds.
+ *
+ * \return
+ *   * Return the entry locations in the order that read_entry() returns them
+ *   * Return ReaderError::UnsupportedEntries if the format cannot provide them
+ */
+
 ///
 
 namespace mb::bootimg
@@ -208,6 +228,11 @@ oc::result<Entry> FormatReader::go_to_entry(File &file,
     return ReaderError::UnsupportedGoTo;
 }
 
+oc::result<std::vector<EntryLocation>> FormatReader::entries()
+{
+    return ReaderError::UnsupportedEntries;
+}
+
 /*!
  * \brief Construct new Reader.
  */
@@ -274,7 +299,11 @@ oc::result<void> Reader::open_filename(const std::string &filename)
     auto file = std::make_unique<StandardFile>();
     OUTCOME_TRYV(file->open(filename, FileOpenMode::ReadOnly));
 
-    return open(std::move(file));
+    // Format readers issue many small reads and seeks
+    auto buffered = std::make_unique<BufferedFile>();
+    OUTCOME_TRYV(buffered->open(std::move(file)));
+
+    return open(std::move(buffered));
 }
 
 /*!
@@ -292,7 +321,11 @@ oc::result<void> Reader::open_filename_w(const std::wstring &filename)
     auto file = std::make_unique<StandardFile>();
     OUTCOME_TRYV(file->open(filename, FileOpenMode::ReadOnly));
 
-    return open(std::move(file));
+    // Format readers issue many small reads and seeks
+    auto buffered = std::make_unique<BufferedFile>();
+    OUTCOME_TRYV(buffered->open(std::move(file)));
+
+    return open(std::move(buffered));
 }
 
 /*!
@@ -339,28 +372,32 @@ oc::result<void> Reader::open(File *file)
     int best_bid = 0;
     FormatReader *format = nullptr;
 
+    // The bidders all read overlapping headers near the beginning of the file.
+    // Read that region once and share it between them.
+    ProbeFile probe(*file);
+
     auto close_format = finally([&] {
         if (format) {
-            (void) format->close(*file);
+            (void) format->close(probe);
         }
     });
 
     // Perform bid for autodetection
     for (auto &f : m_formats) {
         // Seek to beginning
-        OUTCOME_TRYV(file->seek(0, SEEK_SET));
+        OUTCOME_TRYV(probe.seek(0, SEEK_SET));
 
         auto close_f = finally([&] {
-            (void) f->close(*file);
+            (void) f->close(probe);
         });
 
         // Call bidder
-        OUTCOME_TRY(bid, f->open(*file, best_bid));
+        OUTCOME_TRY(bid, f->open(probe, best_bid));
 
         if (bid > best_bid) {
             // Close previous best format
             if (format) {
-                (void) format->close(*file);
+                (void) format->close(probe);
             }
 
             // Don't close this format
@@ -375,6 +412,8 @@ oc::result<void> Reader::open(File *file)
         return ReaderError::UnknownFileFormat;
     }
 
+    OUTCOME_TRYV(file->seek(0, SEEK_SET));
+
     // We've found a matching format, so don't close it
     close_format.dismiss();
 
@@ -499,6 +538,147 @@ oc::result<size_t> Reader::read_data(void *buf, size_t size)
     return m_format->read_data(*m_file, buf, size);
 }
 
+/*!
+ * \brief Compute the digest of the current entry's data.
+ *
+ * This reads the remaining data of the current entry, so it is usually called
+ * right after read_entry() or go_to_entry(). Unlike comparing the data
+ * directly, the digest can be cached by the caller and compared with the
+ * digests of other images later.
+ *
+ * \return SHA-256 digest of the remaining entry data. If an error occurs while
+ *         reading, a specific error code will be returned.
+ */
+oc::result<EntryDigest> Reader::entry_digest()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Data);
+
+    constexpr size_t buf_size = 64 * 1024;
+    auto buf = std::make_unique<unsigned char[]>(buf_size);
+    SHA256_CTX ctx;
+    EntryDigest digest;
+
+    if (!SHA256_Init(&ctx)) {
+        return ReaderError::DigestFailed;
+    }
+
+    while (true) {
+        OUTCOME_TRY(n, m_format->read_data(*m_file, buf.get(), buf_size));
+        if (n == 0) {
+            break;
+        }
+
+        if (!SHA256_Update(&ctx, buf.get(), n)) {
+            return ReaderError::DigestFailed;
+        }
+    }
+
+    if (!SHA256_Final(digest.data(), &ctx)) {
+        return ReaderError::DigestFailed;
+    }
+
+    return digest;
+}
+
+/*!
+ * \brief Open a stream for reading an entry's decompressed data.
+ *
+ * This goes to the entry with go_to_entry() and returns a File that reads the
+ * entry data through the decoder for its compression format (gzip, LZ4 legacy,
+ * LZ4 frame, xz, or lzma). The entry data is consumed as the stream is read,
+ * so callers that only need the beginning of the data can stop early.
+ *
+ * The stream reads from this Reader, so the Reader must outlive the stream and
+ * must not be used for anything else while the stream is being read.
+ *
+ * \param entry_type Entry type to open
+ * \param decompress Whether to detect the compression format and decompress
+ *                   the data
+ *
+ * \return Stream for reading the entry data. If the boot image entry is not
+ *         found, this function returns ReaderError::EndOfEntries. If any other
+ *         error occurs, a specific error code will be returned.
+ */
+oc::result<std::unique_ptr<EntryStream>>
+Reader::open_entry_stream(EntryType entry_type, Decompress decompress)
+{
+    OUTCOME_TRYV(go_to_entry(entry_type));
+
+    std::unique_ptr<EntryStream> stream(new EntryStream(*this));
+    OUTCOME_TRYV(stream->open(decompress));
+
+    return std::move(stream);
+}
+
+/*!
+ * \brief Get the locations of all boot image entries.
+ *
+ * This is available as soon as the header has been read. The offsets refer to
+ * the file that the Reader was opened with, so the entries can be read in any
+ * order with read_entry_at() or directly from the file (eg. with mmap()).
+ *
+ * \return The entry locations in the order that read_entry() returns them or
+ *         ReaderError::UnsupportedEntries if the format does not support this.
+ *         If any other error occurs, a specific error code will be returned.
+ */
+oc::result<std::vector<EntryLocation>> Reader::entries()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Entry | ReaderState::Data);
+
+    return m_format->entries();
+}
+
+/*!
+ * \brief Read boot image entry data at a specific offset.
+ *
+ * This does not use or change the current entry or the file position. It can
+ * be called from multiple threads at the same time if the underlying file's
+ * File::read_at() is thread safe, which is the case for files opened with
+ * open_filename().
+ *
+ * \param entry Entry location returned by entries()
+ * \param offset Offset within the entry data
+ * \param[out] buf Output buffer
+ * \param[in] size Size of output buffer
+ *
+ * \return Number of bytes read. This is only less than \p size if the end of
+ *         the entry is reached or if the entry is allowed to be truncated and
+ *         the end of the file is reached. If an error occurs, a specific error
+ *         code will be returned.
+ */
+oc::result<size_t> Reader::read_entry_at(const EntryLocation &entry,
+                                         uint64_t offset, void *buf,
+                                         size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Entry | ReaderState::Data);
+
+    if (entry.offset > UINT64_MAX - entry.size) {
+        return FileError::ArgumentOutOfRange;
+    } else if (offset >= entry.size) {
+        return 0;
+    }
+
+    auto to_read = static_cast<size_t>(
+            std::min<uint64_t>(size, entry.size - offset));
+    auto ptr = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < to_read) {
+        OUTCOME_TRY(n, m_file->read_at(entry.offset + offset + total,
+                                       ptr + total, to_read - total));
+        if (n == 0) {
+            if (!entry.can_truncate) {
+                return FileError::UnexpectedEof;
+            }
+            break;
+        }
+
+        total += n;
+    }
+
+    return total;
+}
+
 /*!
  * \brief Get detected boot image format code.
  *
@@ -62,6 +62,12 @@ std::string ReaderErrorCategory::message(int ev) const
         return "end of entries";
     case ReaderError::UnsupportedGoTo:
         return "go to entry not supported";
+    case ReaderError::UnsupportedEntries:
+        return "entry locations not supported";
+    case ReaderError::DigestFailed:
+        return "failed to compute digest";
+    case ReaderError::DecompressionFailed:
+        return "failed to decompress entry data";
     default:
         return "(unknown reader error)";
     }
@@ -25,6 +25,8 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <memory>
+
 #include "mbcommon/file.h"
 #include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
@@ -35,6 +37,7 @@
 #include "mbbootimg/format/mtk_writer_p.h"
 #include "mbbootimg/format/sony_elf_writer_p.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
 
 #define ENSURE_STATE_OR_RETURN(STATES, RETVAL) \
     do { \
@@ -61,8 +64,7 @@
  *
  * \brief Format writer callback to set option
  *
- * \note This is currently not exposed in the public API. There is no way to
- *       access this function.
+ * This is called by Writer::set_format_option().
  *
  * \param key Option key
  * \param value Option value
@@ -118,6 +120,23 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatWriter::set_entry_sizes
+ *
+ * \brief Format writer callback to declare the entry sizes up front
+ *
+ * This is called by Writer::set_entry_sizes().
+ *
+ * \param file Reference to file handle
+ * \param entries Entries with their sizes set
+ *
+ * \return
+ *   * Return nothing if the sizes are accepted
+ *   * Return WriterError::UnsupportedOperation if the format cannot make use of
+ *     the sizes
+ *   * Return a specific error code if an error occurs
+ */
+
 /*!
  * \fn FormatWriter::write_header
  *
@@ -203,6 +222,14 @@ oc::result<void> FormatWriter::set_option(const char *key, const char *value)
     return WriterError::UnknownOption;
 }
 
+oc::result<void> FormatWriter::set_entry_sizes(File &file,
+                                               const std::vector<Entry> &entries)
+{
+    (void) file;
+    (void) entries;
+    return WriterError::UnsupportedOperation;
+}
+
 oc::result<void> FormatWriter::open(File &file)
 {
     (void) file;
@@ -413,6 +440,37 @@ oc::result<Header> Writer::get_header()
     return m_format->get_header(*m_file);
 }
 
+/*!
+ * \brief Declare the sizes of all entries before writing them
+ *
+ * If the sizes of the entries are known before they are written (eg. when
+ * repacking an existing boot image), formats that support it will compute
+ * their headers in Writer::write_header() and then write the whole image
+ * strictly sequentially. The output file then does not need to support
+ * seeking, so it can be a pipe.
+ *
+ * Entries that are not listed are treated as empty. The data written for each
+ * entry must match its declared size exactly.
+ *
+ * Currently, only the Sony ELF format supports this. The other formats store a
+ * hash of all entries in the header, so they will always need to seek back.
+ *
+ * \pre Writer::open() must have been called and Writer::write_header() must not
+ *      have been called yet.
+ *
+ * \param entries Entries with their sizes set
+ *
+ * \return Nothing if the sizes are accepted. Otherwise,
+ *         WriterError::UnsupportedOperation if the format does not support this
+ *         or a specific error code.
+ */
+oc::result<void> Writer::set_entry_sizes(const std::vector<Entry> &entries)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(WriterState::Header);
+
+    return m_format->set_entry_sizes(*m_file, entries);
+}
+
 /*!
  * \brief Write boot image header
  *
@@ -505,6 +563,45 @@ oc::result<size_t> Writer::write_data(const void *buf, size_t size)
     return m_format->write_data(*m_file, buf, size);
 }
 
+/*!
+ * \brief Copy the remaining data of a reader's current entry.
+ *
+ * This writes the data from \p reader's current entry to the current entry
+ * without requiring the caller to provide an intermediate buffer. The data
+ * still passes through the format writer because most formats hash or
+ * otherwise process the entry data while it is being written.
+ *
+ * \pre Reader::read_entry() or Reader::go_to_entry() must have been called on
+ *      \p reader and Writer::write_entry() must have been called on this
+ *      writer.
+ *
+ * \param reader Reader to copy the entry data from
+ *
+ * \return Number of bytes copied. If any error occurs while reading or
+ *         writing, a specific error code will be returned.
+ */
+oc::result<uint64_t> Writer::write_data_from(Reader &reader)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(WriterState::Data);
+
+    constexpr size_t buf_size = 1024 * 1024;
+    auto buf = std::make_unique<unsigned char[]>(buf_size);
+    uint64_t total = 0;
+
+    while (true) {
+        OUTCOME_TRY(n_read, reader.read_data(buf.get(), buf_size));
+        if (n_read == 0) {
+            break;
+        }
+
+        OUTCOME_TRYV(m_format->write_data(*m_file, buf.get(), n_read));
+
+        total += n_read;
+    }
+
+    return total;
+}
+
 /*!
  * \brief Get selected boot image format code.
  *
@@ -553,6 +650,34 @@ oc::result<void> Writer::set_format(Format format)
     return oc::success();
 }
 
+/*!
+ * \brief Set format-specific option.
+ *
+ * The Android and Bump writers support the following options:
+ *
+ * * `pipelined_sha1`: If `true`, the image ID is computed on a worker thread
+ *   while the entry data is being written.
+ *
+ * \pre Writer::set_format() must have been called.
+ *
+ * \param key Option key
+ * \param value Option value
+ *
+ * \return Nothing if the option is successfully set. Otherwise,
+ *         WriterError::UnknownOption if the option is not supported by the
+ *         format or a specific error code.
+ */
+oc::result<void> Writer::set_format_option(const char *key, const char *value)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(WriterState::New);
+
+    if (!m_format) {
+        return WriterError::NoFormatRegistered;
+    }
+
+    return m_format->set_option(key, value);
+}
+
 /*!
  * \brief Check whether writer is opened
  *
@@ -56,6 +56,8 @@ std::string WriterErrorCategory::message(int ev) const
         return "unknown option";
     case WriterError::NoFormatRegistered:
         return "no format registered";
+    case WriterError::UnsupportedOperation:
+        return "operation not supported by format";
     case WriterError::EndOfEntries:
         return "end of entries";
     default:
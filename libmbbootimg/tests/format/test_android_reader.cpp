@@ -21,6 +21,7 @@
 
 #include "mbcommon/file.h"
 #include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/format/android_error.h"
@@ -350,3 +351,60 @@ TEST_F(AndroidReaderGoToEntryTest, GoToMissingEntryShouldFail)
     ASSERT_FALSE(entry);
     ASSERT_EQ(entry.error(), ReaderError::EndOfEntries);
 }
+
+TEST_F(AndroidReaderGoToEntryTest, EntryLocationsShouldMatch)
+{
+    auto entries = _reader.entries();
+    ASSERT_TRUE(entries);
+    ASSERT_EQ(entries.value().size(), 3u);
+
+    auto &kernel = entries.value()[0];
+    ASSERT_EQ(kernel.type, EntryType::Kernel);
+    ASSERT_EQ(kernel.offset, 2048u);
+    ASSERT_EQ(kernel.size, 6u);
+
+    auto &ramdisk = entries.value()[1];
+    ASSERT_EQ(ramdisk.type, EntryType::Ramdisk);
+    ASSERT_EQ(ramdisk.offset, 4096u);
+    ASSERT_EQ(ramdisk.size, 7u);
+
+    auto &second = entries.value()[2];
+    ASSERT_EQ(second.type, EntryType::SecondBoot);
+    ASSERT_EQ(second.offset, 6144u);
+    ASSERT_EQ(second.size, 10u);
+}
+
+TEST_F(AndroidReaderGoToEntryTest, ReadEntryAtShouldSucceed)
+{
+    char buf[50];
+
+    auto entries = _reader.entries();
+    ASSERT_TRUE(entries);
+    auto &ramdisk = entries.value()[1];
+
+    // Reading out of order does not affect the sequential API
+    ASSERT_EQ(_reader.read_entry_at(ramdisk, 3, buf, sizeof(buf)),
+              oc::success(4u));
+    ASSERT_EQ(memcmp(buf, "disk", 4), 0);
+    ASSERT_EQ(_reader.read_entry_at(ramdisk, 0, buf, 3), oc::success(3u));
+    ASSERT_EQ(memcmp(buf, "ram", 3), 0);
+    ASSERT_EQ(_reader.read_entry_at(ramdisk, 7, buf, sizeof(buf)),
+              oc::success(0u));
+
+    auto entry = _reader.read_entry();
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(entry.value().type(), EntryType::Kernel);
+    auto n = _reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+    ASSERT_EQ(memcmp(buf, "kernel", n.value()), 0);
+
+    // Entry that extends past the end of the file
+    EntryLocation truncated = ramdisk;
+    truncated.offset = _data.size() - 2;
+    ASSERT_EQ(_reader.read_entry_at(truncated, 0, buf, sizeof(buf)),
+              oc::failure(FileError::UnexpectedEof));
+    truncated.can_truncate = true;
+    ASSERT_EQ(_reader.read_entry_at(truncated, 0, buf, sizeof(buf)),
+              oc::success(2u));
+}
@@ -20,6 +20,9 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <vector>
+
+#include <openssl/sha.h>
 
 #include "mbcommon/file/memory.h"
 
@@ -155,3 +158,77 @@ TEST_F(AndroidWriterSHA1Test, HandlesKernelRamdiskSecondbootDT)
     TestChecksum(expected, EntryType::Kernel | EntryType::Ramdisk
             | EntryType::SecondBoot | EntryType::DeviceTree);
 }
+
+static void write_large_image(bool pipelined, std::vector<unsigned char> &out)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+    Writer writer;
+
+    ASSERT_TRUE(writer.set_format(Format::Android));
+    ASSERT_TRUE(writer.set_format_option("pipelined_sha1",
+                                         pipelined ? "true" : "false"));
+    ASSERT_TRUE(writer.open(&file));
+
+    auto header = writer.get_header();
+    ASSERT_TRUE(header);
+    ASSERT_TRUE(header.value().set_page_size(2048));
+    ASSERT_TRUE(writer.write_header(header.value()));
+
+    std::vector<unsigned char> data(5 * 1024 * 1024 + 123);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i % 251);
+    }
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+            break;
+        }
+
+        ASSERT_TRUE(writer.write_entry(entry.value()));
+
+        if (entry.value().type() == EntryType::Kernel) {
+            ASSERT_TRUE(writer.write_data("hello", 5));
+        } else if (entry.value().type() == EntryType::Ramdisk) {
+            // Write in odd-sized pieces
+            for (size_t offset = 0; offset < data.size(); offset += 65537) {
+                auto n = std::min<size_t>(65537, data.size() - offset);
+                ASSERT_TRUE(writer.write_data(data.data() + offset, n));
+            }
+        }
+    }
+
+    ASSERT_TRUE(writer.close());
+
+    auto ptr = static_cast<unsigned char *>(buf);
+    out.assign(ptr, ptr + buf_size);
+    free(buf);
+}
+
+TEST(AndroidWriterTest, PipelinedSha1MatchesInlineSha1)
+{
+    std::vector<unsigned char> inline_image;
+    std::vector<unsigned char> pipelined_image;
+
+    ASSERT_NO_FATAL_FAILURE(write_large_image(false, inline_image));
+    ASSERT_NO_FATAL_FAILURE(write_large_image(true, pipelined_image));
+
+    ASSERT_EQ(inline_image.size(), pipelined_image.size());
+    ASSERT_EQ(memcmp(inline_image.data() + 576, pipelined_image.data() + 576,
+                     SHA_DIGEST_LENGTH), 0);
+    ASSERT_EQ(inline_image, pipelined_image);
+}
+
+TEST(AndroidWriterTest, UnknownOptionFails)
+{
+    Writer writer;
+
+    ASSERT_EQ(writer.set_format_option("pipelined_sha1", "true").error(),
+              WriterError::NoFormatRegistered);
+    ASSERT_TRUE(writer.set_format(Format::Android));
+    ASSERT_EQ(writer.set_format_option("foo", "bar").error(),
+              WriterError::UnknownOption);
+}
@@ -18,3 +18,101 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <memory>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/mtk_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+static void write_mtk_image(std::vector<unsigned char> &out, bool set_sizes)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+    Writer writer;
+
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(writer.set_format(Format::Mtk));
+    ASSERT_TRUE(writer.open(&file));
+
+    auto header = writer.get_header();
+    ASSERT_TRUE(header);
+    ASSERT_TRUE(header.value().set_page_size(2048));
+    ASSERT_TRUE(writer.write_header(header.value()));
+
+    mtk::MtkHeader mtkhdr = {};
+    memcpy(mtkhdr.magic, mtk::MTK_MAGIC, mtk::MTK_MAGIC_SIZE);
+    memset(mtkhdr.unused, 0xff, sizeof(mtkhdr.unused));
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+            break;
+        }
+
+        const void *data;
+        size_t data_size;
+
+        switch (entry.value().type()) {
+        case EntryType::MtkKernelHeader:
+        case EntryType::MtkRamdiskHeader:
+            data = &mtkhdr;
+            data_size = sizeof(mtkhdr);
+            break;
+        case EntryType::Kernel:
+            data = "kernel";
+            data_size = 6;
+            break;
+        case EntryType::Ramdisk:
+            data = "ramdisk";
+            data_size = 7;
+            break;
+        default:
+            data = nullptr;
+            data_size = 0;
+            break;
+        }
+
+        if (set_sizes) {
+            entry.value().set_size(data_size);
+        }
+
+        ASSERT_TRUE(writer.write_entry(entry.value()));
+
+        if (data_size > 0) {
+            auto n = writer.write_data(data, data_size);
+            ASSERT_TRUE(n);
+            ASSERT_EQ(n.value(), data_size);
+        }
+    }
+
+    ASSERT_TRUE(writer.close());
+
+    auto ptr = static_cast<unsigned char *>(buf);
+    out.assign(ptr, ptr + buf_size);
+    free(buf);
+}
+
+TEST(MtkWriterTest, IncrementalSha1MatchesRecomputedSha1)
+{
+    std::vector<unsigned char> incremental;
+    std::vector<unsigned char> recomputed;
+
+    ASSERT_NO_FATAL_FAILURE(write_mtk_image(incremental, true));
+    ASSERT_NO_FATAL_FAILURE(write_mtk_image(recomputed, false));
+
+    ASSERT_GT(incremental.size(), 2048u);
+    ASSERT_EQ(incremental, recomputed);
+
+    // The ID must not be left empty
+    static const unsigned char zeros[20] = {};
+    ASSERT_NE(memcmp(incremental.data() + 576, zeros, sizeof(zeros)), 0);
+}
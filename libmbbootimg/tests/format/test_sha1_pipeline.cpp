@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <openssl/sha.h>
+
+#include "mbbootimg/format/sha1_pipeline_p.h"
+
+using namespace mb::bootimg::detail;
+
+static std::vector<unsigned char> make_data(size_t size)
+{
+    std::vector<unsigned char> data(size);
+
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<unsigned char>(i * 31 + i / 7);
+    }
+
+    return data;
+}
+
+TEST(Sha1PipelineTest, MatchesSha1ForUnalignedUpdates)
+{
+    auto data = make_data(100000);
+
+    unsigned char expected[SHA_DIGEST_LENGTH];
+    SHA1(data.data(), data.size(), expected);
+
+    // Small buffers so that the ring wraps around several times
+    Sha1Pipeline pipeline(2, 4096);
+    ASSERT_TRUE(pipeline.init());
+
+    size_t offset = 0;
+    size_t chunk = 1;
+    while (offset < data.size()) {
+        auto n = std::min(chunk, data.size() - offset);
+        ASSERT_TRUE(pipeline.update(data.data() + offset, n));
+        offset += n;
+        chunk = chunk * 3 + 1;
+    }
+
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    ASSERT_TRUE(pipeline.final(digest));
+    ASSERT_EQ(memcmp(digest, expected, sizeof(digest)), 0);
+}
+
+TEST(Sha1PipelineTest, CanBeReused)
+{
+    unsigned char expected[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>("hello"), 5, expected);
+
+    Sha1Pipeline pipeline(2, 4);
+
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(pipeline.init());
+        ASSERT_TRUE(pipeline.update("hello", 5));
+
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        ASSERT_TRUE(pipeline.final(digest));
+        ASSERT_EQ(memcmp(digest, expected, sizeof(digest)), 0);
+    }
+}
+
+TEST(Sha1PipelineTest, EmptyInput)
+{
+    unsigned char expected[SHA_DIGEST_LENGTH];
+    SHA1(nullptr, 0, expected);
+
+    Sha1Pipeline pipeline;
+    ASSERT_TRUE(pipeline.init());
+
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    ASSERT_TRUE(pipeline.final(digest));
+    ASSERT_EQ(memcmp(digest, expected, sizeof(digest)), 0);
+}
@@ -18,3 +18,193 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/segment_error_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+class UnseekableMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        (void) offset;
+        (void) whence;
+        return FileError::UnsupportedSeek;
+    }
+};
+
+static std::vector<Entry> entry_sizes()
+{
+    std::vector<Entry> entries;
+
+    Entry kernel(EntryType::Kernel);
+    kernel.set_size(6);
+    entries.push_back(std::move(kernel));
+
+    Entry ramdisk(EntryType::Ramdisk);
+    ramdisk.set_size(7);
+    entries.push_back(std::move(ramdisk));
+
+    return entries;
+}
+
+static void write_sony_elf_image(MemoryFile &file, bool set_sizes)
+{
+    Writer writer;
+
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(writer.set_format(Format::SonyElf));
+    ASSERT_TRUE(writer.open(&file));
+
+    if (set_sizes) {
+        ASSERT_TRUE(writer.set_entry_sizes(entry_sizes()));
+    }
+
+    auto header = writer.get_header();
+    ASSERT_TRUE(header);
+    ASSERT_TRUE(header.value().set_kernel_address(0x80008000));
+    ASSERT_TRUE(header.value().set_ramdisk_address(0x81000000));
+    ASSERT_TRUE(header.value().set_entrypoint_address(0x80008000));
+    ASSERT_TRUE(header.value().set_kernel_cmdline({"console=null"}));
+    ASSERT_TRUE(writer.write_header(header.value()));
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+            break;
+        }
+
+        const char *data;
+
+        switch (entry.value().type()) {
+        case EntryType::Kernel:
+            data = "kernel";
+            break;
+        case EntryType::Ramdisk:
+            data = "ramdisk";
+            break;
+        default:
+            data = nullptr;
+            break;
+        }
+
+        ASSERT_TRUE(writer.write_entry(entry.value()));
+
+        if (data) {
+            auto n = writer.write_data(data, strlen(data));
+            ASSERT_TRUE(n);
+            ASSERT_EQ(n.value(), strlen(data));
+        }
+    }
+
+    ASSERT_TRUE(writer.close());
+}
+
+static void write_sony_elf_image(std::vector<unsigned char> &out,
+                                 bool set_sizes)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+
+    write_sony_elf_image(file, set_sizes);
+
+    auto ptr = static_cast<unsigned char *>(buf);
+    out.assign(ptr, ptr + buf_size);
+    free(buf);
+}
+
+TEST(SonyElfWriterTest, SequentialOutputMatchesSeekingOutput)
+{
+    std::vector<unsigned char> sequential;
+    std::vector<unsigned char> seeking;
+
+    ASSERT_NO_FATAL_FAILURE(write_sony_elf_image(sequential, true));
+    ASSERT_NO_FATAL_FAILURE(write_sony_elf_image(seeking, false));
+
+    // Headers + kernel + ramdisk + cmdline
+    ASSERT_EQ(sequential.size(), 4096u + 6 + 7 + 12);
+    ASSERT_EQ(sequential, seeking);
+}
+
+TEST(SonyElfWriterTest, SequentialOutputDoesNotSeek)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    UnseekableMemoryFile file(&buf, &buf_size);
+
+    ASSERT_NO_FATAL_FAILURE(write_sony_elf_image(file, true));
+
+    std::vector<unsigned char> sequential;
+    auto ptr = static_cast<unsigned char *>(buf);
+    sequential.assign(ptr, ptr + buf_size);
+    free(buf);
+
+    std::vector<unsigned char> seeking;
+    ASSERT_NO_FATAL_FAILURE(write_sony_elf_image(seeking, false));
+
+    ASSERT_EQ(sequential, seeking);
+}
+
+TEST(SonyElfWriterTest, SequentialOutputRejectsSizeMismatch)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+    Writer writer;
+
+    ASSERT_TRUE(writer.set_format(Format::SonyElf));
+    ASSERT_TRUE(writer.open(&file));
+    ASSERT_TRUE(writer.set_entry_sizes(entry_sizes()));
+
+    auto header = writer.get_header();
+    ASSERT_TRUE(header);
+    ASSERT_TRUE(writer.write_header(header.value()));
+
+    auto entry = writer.get_entry();
+    ASSERT_TRUE(entry);
+    ASSERT_EQ(entry.value().type(), EntryType::Kernel);
+
+    // Written size is larger than the declared size
+    ASSERT_TRUE(writer.write_entry(entry.value()));
+    auto n = writer.write_data("kernel!", 7);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), SegmentError::EntrySizeMismatch);
+
+    (void) writer.close();
+    free(buf);
+}
+
+TEST(SonyElfWriterTest, EntrySizesUnsupportedByOtherFormats)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+    Writer writer;
+
+    ASSERT_TRUE(writer.set_format(Format::Android));
+    ASSERT_TRUE(writer.open(&file));
+
+    auto ret = writer.set_entry_sizes(entry_sizes());
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), WriterError::UnsupportedOperation);
+
+    ASSERT_TRUE(writer.close());
+    free(buf);
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/compare.h"
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+static void make_image(std::vector<unsigned char> &out,
+                       const std::string &kernel, const std::string &ramdisk,
+                       const char *cmdline = "")
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+    Writer writer;
+
+    ASSERT_TRUE(writer.set_format(Format::Android));
+    ASSERT_TRUE(writer.open(&file));
+
+    auto header = writer.get_header();
+    ASSERT_TRUE(header);
+    ASSERT_TRUE(header.value().set_page_size(2048));
+    ASSERT_TRUE(header.value().set_kernel_cmdline(std::string(cmdline)));
+    ASSERT_TRUE(writer.write_header(header.value()));
+
+    while (true) {
+        auto entry = writer.get_entry();
+        if (!entry) {
+            ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+            break;
+        }
+
+        ASSERT_TRUE(writer.write_entry(entry.value()));
+
+        if (entry.value().type() == EntryType::Kernel) {
+            ASSERT_TRUE(writer.write_data(kernel.data(), kernel.size()));
+        } else if (entry.value().type() == EntryType::Ramdisk) {
+            ASSERT_TRUE(writer.write_data(ramdisk.data(), ramdisk.size()));
+        }
+    }
+
+    ASSERT_TRUE(writer.close());
+
+    auto ptr = static_cast<unsigned char *>(buf);
+    out.assign(ptr, ptr + buf_size);
+    free(buf);
+}
+
+struct CompareTest : testing::Test
+{
+    std::vector<unsigned char> _data1;
+    std::vector<unsigned char> _data2;
+
+    oc::result<bool> compare_images()
+    {
+        MemoryFile file1(_data1.data(), _data1.size());
+        MemoryFile file2(_data2.data(), _data2.size());
+        Reader reader1;
+        Reader reader2;
+
+        OUTCOME_TRYV(reader1.enable_formats_all());
+        OUTCOME_TRYV(reader2.enable_formats_all());
+        OUTCOME_TRYV(reader1.open(&file1));
+        OUTCOME_TRYV(reader2.open(&file2));
+
+        return compare(reader1, reader2);
+    }
+};
+
+TEST_F(CompareTest, EqualImages)
+{
+    std::string kernel(100000, 'k');
+
+    ASSERT_NO_FATAL_FAILURE(make_image(_data1, kernel, "ramdisk"));
+    ASSERT_NO_FATAL_FAILURE(make_image(_data2, kernel, "ramdisk"));
+
+    auto ret = compare_images();
+    ASSERT_TRUE(ret);
+    ASSERT_TRUE(ret.value());
+}
+
+TEST_F(CompareTest, DifferentHeaders)
+{
+    ASSERT_NO_FATAL_FAILURE(make_image(_data1, "kernel", "ramdisk", "a"));
+    ASSERT_NO_FATAL_FAILURE(make_image(_data2, "kernel", "ramdisk", "b"));
+
+    auto ret = compare_images();
+    ASSERT_TRUE(ret);
+    ASSERT_FALSE(ret.value());
+}
+
+TEST_F(CompareTest, DifferentData)
+{
+    std::string kernel1(100000, 'k');
+    std::string kernel2(kernel1);
+    kernel2[99999] = 'x';
+
+    ASSERT_NO_FATAL_FAILURE(make_image(_data1, kernel1, "ramdisk"));
+    ASSERT_NO_FATAL_FAILURE(make_image(_data2, kernel2, "ramdisk"));
+
+    auto ret = compare_images();
+    ASSERT_TRUE(ret);
+    ASSERT_FALSE(ret.value());
+}
+
+TEST_F(CompareTest, MissingEntry)
+{
+    ASSERT_NO_FATAL_FAILURE(make_image(_data1, "kernel", "ramdisk"));
+    ASSERT_NO_FATAL_FAILURE(make_image(_data2, "kernel", ""));
+
+    auto ret = compare_images();
+    ASSERT_TRUE(ret);
+    ASSERT_FALSE(ret.value());
+
+    std::swap(_data1, _data2);
+
+    ret = compare_images();
+    ASSERT_TRUE(ret);
+    ASSERT_FALSE(ret.value());
+}
+
+TEST(EntryDigestTest, DigestDependsOnlyOnData)
+{
+    std::vector<unsigned char> data1;
+    std::vector<unsigned char> data2;
+
+    ASSERT_NO_FATAL_FAILURE(make_image(data1, "kernel", "ramdisk", "a"));
+    ASSERT_NO_FATAL_FAILURE(make_image(data2, "kernel", "other", "b"));
+
+    auto digest = [](std::vector<unsigned char> &data, EntryType type)
+            -> oc::result<EntryDigest> {
+        MemoryFile file(data.data(), data.size());
+        Reader reader;
+
+        OUTCOME_TRYV(reader.enable_formats_all());
+        OUTCOME_TRYV(reader.open(&file));
+        OUTCOME_TRYV(reader.read_header());
+        OUTCOME_TRYV(reader.go_to_entry(type));
+
+        return reader.entry_digest();
+    };
+
+    auto kernel1 = digest(data1, EntryType::Kernel);
+    auto kernel2 = digest(data2, EntryType::Kernel);
+    auto ramdisk1 = digest(data1, EntryType::Ramdisk);
+    auto ramdisk2 = digest(data2, EntryType::Ramdisk);
+
+    ASSERT_TRUE(kernel1);
+    ASSERT_TRUE(kernel2);
+    ASSERT_TRUE(ramdisk1);
+    ASSERT_TRUE(ramdisk2);
+
+    ASSERT_EQ(kernel1.value(), kernel2.value());
+    ASSERT_NE(ramdisk1.value(), ramdisk2.value());
+    ASSERT_NE(kernel1.value(), ramdisk1.value());
+}
+
+TEST(EntryDigestTest, RequiresEntry)
+{
+    Reader reader;
+
+    ASSERT_EQ(reader.entry_digest().error(), ReaderError::InvalidState);
+}
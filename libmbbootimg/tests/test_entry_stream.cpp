@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <lz4.h>
+#include <lz4frame.h>
+#include <lzma.h>
+#include <zlib.h>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/entry_stream.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+static constexpr size_t LZ4_LEGACY_BLOCK_SIZE = 8 * 1024 * 1024;
+
+struct FreeDeleter
+{
+    void operator()(void *ptr) const
+    {
+        free(ptr);
+    }
+};
+
+// Somewhat compressible data that is larger than the stream's input buffer
+static std::string make_data(size_t size)
+{
+    std::string data;
+    data.reserve(size);
+
+    uint32_t state = 1;
+    while (data.size() < size) {
+        state = state * 1103515245 + 12345;
+        data += static_cast<char>('a' + ((state >> 16) % 16));
+    }
+
+    return data;
+}
+
+static std::string compress_gzip(const std::string &data)
+{
+    z_stream zs = {};
+    EXPECT_EQ(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                           16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY), Z_OK);
+
+    std::string out(deflateBound(&zs, static_cast<uLong>(data.size())), '\0');
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    zs.avail_in = static_cast<uInt>(data.size());
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = static_cast<uInt>(out.size());
+
+    EXPECT_EQ(deflate(&zs, Z_FINISH), Z_STREAM_END);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    return out;
+}
+
+static std::string compress_lz4_legacy(const std::string &data)
+{
+    std::string out("\x02\x21\x4c\x18", 4);
+
+    for (size_t pos = 0; pos < data.size(); pos += LZ4_LEGACY_BLOCK_SIZE) {
+        auto size = std::min(data.size() - pos, LZ4_LEGACY_BLOCK_SIZE);
+        std::string block(static_cast<size_t>(
+                LZ4_compressBound(static_cast<int>(size))), '\0');
+
+        int n = LZ4_compress_default(data.data() + pos, block.data(),
+                                     static_cast<int>(size),
+                                     static_cast<int>(block.size()));
+        EXPECT_GT(n, 0);
+
+        for (int i = 0; i < 4; ++i) {
+            out += static_cast<char>((n >> (8 * i)) & 0xff);
+        }
+        out.append(block.data(), static_cast<size_t>(n));
+    }
+
+    return out;
+}
+
+static std::string compress_lz4_frame(const std::string &data)
+{
+    std::string out(LZ4F_compressFrameBound(data.size(), nullptr), '\0');
+
+    size_t n = LZ4F_compressFrame(out.data(), out.size(), data.data(),
+                                  data.size(), nullptr);
+    EXPECT_FALSE(LZ4F_isError(n));
+    out.resize(n);
+
+    return out;
+}
+
+static std::string compress_lzma(const std::string &data, bool xz)
+{
+    lzma_stream strm = LZMA_STREAM_INIT;
+
+    if (xz) {
+        EXPECT_EQ(lzma_easy_encoder(&strm, 1, LZMA_CHECK_CRC32), LZMA_OK);
+    } else {
+        lzma_options_lzma opts;
+        EXPECT_FALSE(lzma_lzma_preset(&opts, 1));
+        EXPECT_EQ(lzma_alone_encoder(&strm, &opts), LZMA_OK);
+    }
+
+    std::string out(data.size() + data.size() / 2 + 1024, '\0');
+    strm.next_in = reinterpret_cast<const uint8_t *>(data.data());
+    strm.avail_in = data.size();
+    strm.next_out = reinterpret_cast<uint8_t *>(out.data());
+    strm.avail_out = out.size();
+
+    EXPECT_EQ(lzma_code(&strm, LZMA_FINISH), LZMA_STREAM_END);
+    out.resize(strm.total_out);
+    lzma_end(&strm);
+
+    return out;
+}
+
+class EntryStreamTest : public ::testing::Test
+{
+protected:
+    std::unique_ptr<void, FreeDeleter> m_owner;
+    void *m_buf = nullptr;
+    size_t m_size = 0;
+
+    MemoryFile m_file;
+    Reader m_reader;
+
+    // Create an Android boot image with the specified ramdisk and open it
+    void open_image(const std::string &ramdisk)
+    {
+        {
+            MemoryFile file(&m_buf, &m_size);
+            Writer writer;
+
+            ASSERT_TRUE(writer.set_format(Format::Android));
+            ASSERT_TRUE(writer.open(&file));
+
+            auto header = writer.get_header();
+            ASSERT_TRUE(header);
+            ASSERT_TRUE(header.value().set_page_size(2048));
+            ASSERT_TRUE(writer.write_header(header.value()));
+
+            while (true) {
+                auto entry = writer.get_entry();
+                if (!entry) {
+                    ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                    break;
+                }
+
+                ASSERT_TRUE(writer.write_entry(entry.value()));
+
+                if (entry.value().type() == EntryType::Kernel) {
+                    ASSERT_TRUE(writer.write_data("kernel", 6));
+                } else if (entry.value().type() == EntryType::Ramdisk) {
+                    ASSERT_TRUE(writer.write_data(ramdisk.data(),
+                                                  ramdisk.size()));
+                }
+            }
+
+            ASSERT_TRUE(writer.close());
+        }
+        m_owner.reset(m_buf);
+
+        ASSERT_TRUE(m_file.open(m_buf, m_size));
+        ASSERT_TRUE(m_reader.enable_formats_all());
+        ASSERT_TRUE(m_reader.open(&m_file));
+        ASSERT_TRUE(m_reader.read_header());
+    }
+
+    // Read the whole stream using reads of the specified size
+    static std::string read_all(EntryStream &stream, size_t chunk_size)
+    {
+        std::string result;
+        std::string chunk(chunk_size, '\0');
+
+        while (true) {
+            auto n = stream.read(chunk.data(), chunk.size());
+            EXPECT_TRUE(n);
+            if (!n || n.value() == 0) {
+                break;
+            }
+            result.append(chunk.data(), n.value());
+        }
+
+        return result;
+    }
+
+    void check_decompress(const std::string &data,
+                          const std::string &compressed,
+                          Compression compression)
+    {
+        ASSERT_NO_FATAL_FAILURE(open_image(compressed));
+
+        // Small reads exercise the decoders' partial output paths
+        for (size_t chunk_size : {size_t(4093), size_t(16 * 1024 * 1024)}) {
+            auto stream = m_reader.open_entry_stream(EntryType::Ramdisk);
+            ASSERT_TRUE(stream);
+            ASSERT_EQ(stream.value()->compression(), compression);
+            ASSERT_EQ(read_all(*stream.value(), chunk_size), data);
+        }
+    }
+};
+
+TEST_F(EntryStreamTest, DecompressGzip)
+{
+    auto data = make_data(1024 * 1024);
+    check_decompress(data, compress_gzip(data), Compression::Gzip);
+}
+
+TEST_F(EntryStreamTest, DecompressLz4Legacy)
+{
+    // Spans multiple blocks
+    auto data = make_data(LZ4_LEGACY_BLOCK_SIZE + 12345);
+    check_decompress(data, compress_lz4_legacy(data), Compression::Lz4Legacy);
+}
+
+TEST_F(EntryStreamTest, DecompressLz4Frame)
+{
+    auto data = make_data(1024 * 1024);
+    check_decompress(data, compress_lz4_frame(data), Compression::Lz4Frame);
+}
+
+TEST_F(EntryStreamTest, DecompressXz)
+{
+    auto data = make_data(1024 * 1024);
+    check_decompress(data, compress_lzma(data, true), Compression::Xz);
+}
+
+TEST_F(EntryStreamTest, DecompressLzma)
+{
+    auto data = make_data(1024 * 1024);
+    check_decompress(data, compress_lzma(data, false), Compression::Lzma);
+}
+
+TEST_F(EntryStreamTest, UncompressedDataIsReturnedAsIs)
+{
+    auto data = make_data(1024 * 1024);
+    check_decompress(data, data, Compression::None);
+}
+
+TEST_F(EntryStreamTest, DecompressNoneReturnsCompressedData)
+{
+    auto compressed = compress_gzip(make_data(1024 * 1024));
+    ASSERT_NO_FATAL_FAILURE(open_image(compressed));
+
+    auto stream = m_reader.open_entry_stream(EntryType::Ramdisk,
+                                             Decompress::None);
+    ASSERT_TRUE(stream);
+    ASSERT_EQ(stream.value()->compression(), Compression::None);
+    ASSERT_EQ(read_all(*stream.value(), 4096), compressed);
+}
+
+TEST_F(EntryStreamTest, GzipTrailingDataIsIgnored)
+{
+    auto data = make_data(1024 * 1024);
+
+    // Device trees appended to the kernel
+    check_decompress(data, compress_gzip(data) + "trailing dtb",
+                     Compression::Gzip);
+}
+
+TEST_F(EntryStreamTest, Lz4LegacyTrailingDataIsIgnored)
+{
+    auto data = make_data(1024 * 1024);
+
+    // Uncompressed size appended by the kernel build
+    check_decompress(data, compress_lz4_legacy(data) + "\x00\x00\x10\xff",
+                     Compression::Lz4Legacy);
+}
+
+TEST_F(EntryStreamTest, TruncatedDataShouldFail)
+{
+    auto compressed = compress_gzip(make_data(1024 * 1024));
+    compressed.resize(compressed.size() / 2);
+    ASSERT_NO_FATAL_FAILURE(open_image(compressed));
+
+    auto stream = m_reader.open_entry_stream(EntryType::Ramdisk);
+    ASSERT_TRUE(stream);
+
+    std::string buf(4096, '\0');
+    oc::result<size_t> n = oc::success(size_t(0));
+
+    do {
+        n = stream.value()->read(buf.data(), buf.size());
+    } while (n && n.value() > 0);
+
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnexpectedEof);
+}
+
+TEST_F(EntryStreamTest, CorruptDataShouldFail)
+{
+    auto compressed = compress_lz4_frame(make_data(1024 * 1024));
+    for (size_t i = 64; i < compressed.size(); i += 1024) {
+        compressed[i] = static_cast<char>(~compressed[i]);
+    }
+    ASSERT_NO_FATAL_FAILURE(open_image(compressed));
+
+    auto stream = m_reader.open_entry_stream(EntryType::Ramdisk);
+    ASSERT_TRUE(stream);
+
+    std::string buf(4096, '\0');
+    oc::result<size_t> n = oc::success(size_t(0));
+
+    do {
+        n = stream.value()->read(buf.data(), buf.size());
+    } while (n && n.value() > 0);
+
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), ReaderError::DecompressionFailed);
+}
+
+TEST_F(EntryStreamTest, MissingEntryShouldFail)
+{
+    ASSERT_NO_FATAL_FAILURE(open_image("ramdisk"));
+
+    auto stream = m_reader.open_entry_stream(EntryType::SecondBoot);
+    ASSERT_FALSE(stream);
+    ASSERT_EQ(stream.error(), ReaderError::EndOfEntries);
+}
+
+TEST_F(EntryStreamTest, StreamIsReadOnly)
+{
+    ASSERT_NO_FATAL_FAILURE(open_image("ramdisk"));
+
+    auto stream = m_reader.open_entry_stream(EntryType::Ramdisk);
+    ASSERT_TRUE(stream);
+
+    auto &file = *stream.value();
+    ASSERT_EQ(file.write("x", 1).error(), FileError::UnsupportedWrite);
+    ASSERT_EQ(file.seek(0, SEEK_SET).error(), FileError::UnsupportedSeek);
+    ASSERT_EQ(file.truncate(0).error(), FileError::UnsupportedTruncate);
+
+    ASSERT_TRUE(file.close());
+    ASSERT_FALSE(file.is_open());
+    ASSERT_EQ(file.read(nullptr, 0).error(), FileError::InvalidState);
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/probe_file_p.h"
+
+using namespace mb;
+using namespace mb::bootimg::detail;
+
+class CountingMemoryFile : public MemoryFile
+{
+public:
+    using MemoryFile::MemoryFile;
+
+    oc::result<size_t> read_at(uint64_t offset, void *buf,
+                               size_t size) override
+    {
+        ++reads;
+        return MemoryFile::read_at(offset, buf, size);
+    }
+
+    size_t reads = 0;
+};
+
+struct ProbeFileTest : testing::Test
+{
+    std::vector<unsigned char> _data;
+    CountingMemoryFile _file;
+
+    void SetUp() override
+    {
+        _data.resize(64 * 1024);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<unsigned char>(i * 7);
+        }
+
+        ASSERT_TRUE(_file.open(_data.data(), _data.size()));
+    }
+};
+
+TEST_F(ProbeFileTest, RepeatedReadsAreCached)
+{
+    ProbeFile probe(_file);
+    unsigned char buf[512];
+
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(probe.seek(100, SEEK_SET));
+        ASSERT_TRUE(file_read_exact(probe, buf, sizeof(buf)));
+        ASSERT_EQ(memcmp(buf, _data.data() + 100, sizeof(buf)), 0);
+    }
+
+    ASSERT_EQ(probe.cached_size(), ProbeFile::INITIAL_SIZE);
+    ASSERT_EQ(_file.reads, 1u);
+}
+
+TEST_F(ProbeFileTest, CacheGrowsAndPassesThrough)
+{
+    ProbeFile probe(_file, 32 * 1024);
+    unsigned char buf[1024];
+
+    // Extends cache
+    ASSERT_EQ(probe.read_at(20 * 1024, buf, sizeof(buf)),
+              oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, _data.data() + 20 * 1024, sizeof(buf)), 0);
+    ASSERT_EQ(probe.cached_size(), 32u * 1024);
+
+    // Straddles end of cache
+    ASSERT_EQ(probe.read_at(32 * 1024 - 10, buf, sizeof(buf)),
+              oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, _data.data() + 32 * 1024 - 10, sizeof(buf)), 0);
+
+    // Beyond the cache
+    ASSERT_EQ(probe.read_at(_data.size() - 10, buf, sizeof(buf)),
+              oc::success(10u));
+    ASSERT_EQ(memcmp(buf, _data.data() + _data.size() - 10, 10), 0);
+    ASSERT_EQ(probe.cached_size(), 32u * 1024);
+}
+
+TEST_F(ProbeFileTest, SmallFile)
+{
+    ASSERT_TRUE(_file.close());
+    ASSERT_TRUE(_file.open(_data.data(), 100));
+
+    ProbeFile probe(_file);
+    unsigned char buf[200];
+
+    ASSERT_EQ(probe.read(buf, sizeof(buf)), oc::success(100u));
+    ASSERT_EQ(probe.read(buf, sizeof(buf)), oc::success(0u));
+    ASSERT_EQ(_file.reads, 2u);
+
+    ASSERT_EQ(probe.seek(-10, SEEK_END), oc::success(90u));
+    ASSERT_EQ(probe.read(buf, sizeof(buf)), oc::success(10u));
+    ASSERT_EQ(_file.reads, 2u);
+
+    ASSERT_EQ(probe.seek(-101, SEEK_END),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(ProbeFileTest, ReadOnly)
+{
+    ProbeFile probe(_file);
+
+    ASSERT_EQ(probe.write("x", 1), oc::failure(FileError::UnsupportedWrite));
+    ASSERT_EQ(probe.truncate(0), oc::failure(FileError::UnsupportedTruncate));
+}
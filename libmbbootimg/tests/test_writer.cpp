@@ -18,3 +18,115 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+struct FreeDeleter
+{
+    void operator()(void *ptr) const
+    {
+        free(ptr);
+    }
+};
+
+TEST(WriterTest, WriteDataFromReaderCopiesEntries)
+{
+    void *src_buf = nullptr;
+    size_t src_size = 0;
+    std::unique_ptr<void, FreeDeleter> src_owner;
+
+    // Create source image
+    {
+        MemoryFile file(&src_buf, &src_size);
+        Writer writer;
+
+        ASSERT_TRUE(writer.set_format(Format::Android));
+        ASSERT_TRUE(writer.open(&file));
+
+        auto header = writer.get_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(header.value().set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto entry = writer.get_entry();
+            if (!entry) {
+                ASSERT_EQ(entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            ASSERT_TRUE(writer.write_entry(entry.value()));
+
+            if (entry.value().type() == EntryType::Kernel) {
+                std::vector<unsigned char> data(3 * 1024 * 1024 + 7, 'k');
+                ASSERT_TRUE(writer.write_data(data.data(), data.size()));
+            } else if (entry.value().type() == EntryType::Ramdisk) {
+                ASSERT_TRUE(writer.write_data("ramdisk", 7));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+    src_owner.reset(src_buf);
+
+    void *dst_buf = nullptr;
+    size_t dst_size = 0;
+    std::unique_ptr<void, FreeDeleter> dst_owner;
+
+    // Copy entries to new image
+    {
+        MemoryFile src_file(src_buf, src_size);
+        MemoryFile dst_file(&dst_buf, &dst_size);
+        Reader reader;
+        Writer writer;
+
+        ASSERT_TRUE(reader.enable_formats_all());
+        ASSERT_TRUE(reader.open(&src_file));
+        ASSERT_TRUE(writer.set_format(Format::Android));
+        ASSERT_TRUE(writer.open(&dst_file));
+
+        auto header = reader.read_header();
+        ASSERT_TRUE(header);
+        ASSERT_TRUE(writer.write_header(header.value()));
+
+        while (true) {
+            auto out_entry = writer.get_entry();
+            if (!out_entry) {
+                ASSERT_EQ(out_entry.error(), WriterError::EndOfEntries);
+                break;
+            }
+
+            auto in_entry = reader.go_to_entry(out_entry.value().type());
+            if (!in_entry) {
+                // Empty entries are not returned by the reader
+                ASSERT_EQ(in_entry.error(), ReaderError::EndOfEntries);
+                ASSERT_TRUE(writer.write_entry(out_entry.value()));
+                continue;
+            }
+
+            ASSERT_TRUE(writer.write_entry(in_entry.value()));
+
+            auto n = writer.write_data_from(reader);
+            ASSERT_TRUE(n);
+            ASSERT_EQ(n.value(), *in_entry.value().size());
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+    dst_owner.reset(dst_buf);
+
+    ASSERT_EQ(dst_size, src_size);
+    ASSERT_EQ(memcmp(dst_buf, src_buf, src_size), 0);
+}
@@ -0,0 +1,819 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/posix.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/thread_pool.h"
+
+#ifdef _WIN32
+#  include "mbcommon/file/win32.h"
+#else
+#  include "mbcommon/file/mmap.h"
+#endif
+
+using namespace mb;
+
+using Clock = std::chrono::steady_clock;
+
+// Syscall counting
+
+/*!
+ * \brief Get the number of read and write syscalls made by this process
+ *
+ * This uses `/proc/self/io`, which only exists on Linux. Seeks are not
+ * counted.
+ */
+static std::optional<uint64_t> io_syscalls()
+{
+    FILE *fp = fopen("/proc/self/io", "r");
+    if (!fp) {
+        return std::nullopt;
+    }
+
+    char line[128];
+    uint64_t total = 0;
+    unsigned int found = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        uint64_t value;
+
+        if (sscanf(line, "syscr: %" SCNu64, &value) == 1
+                || sscanf(line, "syscw: %" SCNu64, &value) == 1) {
+            total += value;
+            ++found;
+        }
+    }
+
+    fclose(fp);
+
+    if (found != 2) {
+        return std::nullopt;
+    }
+
+    return total;
+}
+
+// Backends
+
+enum class Backend
+{
+    Memory,
+    Fd,
+    Posix,
+    Standard,
+    Buffered,
+#ifdef _WIN32
+    Win32,
+#else
+    Mmap,
+#endif
+};
+
+static constexpr Backend ALL_BACKENDS[] = {
+    Backend::Memory,
+    Backend::Fd,
+    Backend::Posix,
+    Backend::Standard,
+    Backend::Buffered,
+#ifdef _WIN32
+    Backend::Win32,
+#else
+    Backend::Mmap,
+#endif
+};
+
+static const char *backend_name(Backend backend)
+{
+    switch (backend) {
+    case Backend::Memory:
+        return "memory";
+    case Backend::Fd:
+        return "fd";
+    case Backend::Posix:
+        return "posix";
+    case Backend::Standard:
+        return "standard";
+    case Backend::Buffered:
+        return "buffered";
+#ifdef _WIN32
+    case Backend::Win32:
+        return "win32";
+#else
+    case Backend::Mmap:
+        return "mmap";
+#endif
+    default:
+        return "unknown";
+    }
+}
+
+static std::optional<Backend> name_to_backend(const char *name)
+{
+    for (auto backend : ALL_BACKENDS) {
+        if (strcmp(name, backend_name(backend)) == 0) {
+            return backend;
+        }
+    }
+
+    return std::nullopt;
+}
+
+static bool backend_can_write(Backend backend)
+{
+#ifdef _WIN32
+    (void) backend;
+    return true;
+#else
+    return backend != Backend::Mmap;
+#endif
+}
+
+struct Options
+{
+    uint64_t file_size = 64 * 1024 * 1024;
+    unsigned int iterations = 3;
+    unsigned int random_ops = 4096;
+    std::vector<size_t> buf_sizes;
+    std::vector<Backend> backends;
+    std::string tmpdir = "/tmp";
+};
+
+struct Result
+{
+    double seconds = 0;
+    std::optional<uint64_t> syscalls;
+    bool ok = true;
+};
+
+// Benchmarks
+
+class Bench
+{
+public:
+    Bench(const Options &opts, Backend backend)
+        : m_opts(opts)
+        , m_backend(backend)
+        , m_mem(nullptr)
+        , m_mem_size(0)
+        , m_rng(1234)
+    {
+        auto prefix = opts.tmpdir + "/mbcommon_bench_"
+                + std::to_string(getpid());
+        m_path = prefix + ".dat";
+        m_write_path = prefix + "_write.dat";
+
+        auto overhead1 = io_syscalls();
+        auto overhead2 = io_syscalls();
+        if (overhead1 && overhead2) {
+            m_syscall_overhead = *overhead2 - *overhead1;
+        }
+    }
+
+    ~Bench()
+    {
+        free(m_mem);
+
+        if (m_backend != Backend::Memory) {
+            unlink(m_path.c_str());
+            unlink(m_write_path.c_str());
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Bench)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Bench)
+
+    /*!
+     * \brief Create the file that the read benchmarks use
+     *
+     * The data avoids the search pattern, so every search scans the whole
+     * file.
+     */
+    bool prepare()
+    {
+        std::vector<unsigned char> chunk(1024 * 1024);
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            chunk[i] = static_cast<unsigned char>(i * 7 + i / 4096) & 0x7f;
+        }
+
+        MemoryFile mem_file;
+        FdFile fd_file;
+        File *file;
+
+        if (m_backend == Backend::Memory) {
+            free(m_mem);
+            m_mem = nullptr;
+            m_mem_size = 0;
+
+            if (!mem_file.open(&m_mem, &m_mem_size)) {
+                return false;
+            }
+            file = &mem_file;
+        } else {
+            if (!fd_file.open(m_path, FileOpenMode::WriteOnly)) {
+                return false;
+            }
+            file = &fd_file;
+        }
+
+        for (uint64_t remain = m_opts.file_size; remain > 0;) {
+            auto n = static_cast<size_t>(
+                    std::min<uint64_t>(remain, chunk.size()));
+            if (!file_write_exact(*file, chunk.data(), n)) {
+                return false;
+            }
+            remain -= n;
+        }
+
+        return !!file->close();
+    }
+
+    Result run_seq_write(size_t buf_size)
+    {
+        std::vector<unsigned char> buf(buf_size, 0x55);
+
+        return measure([&] {
+            auto file = open_file(true);
+            if (!file) {
+                return false;
+            }
+
+            for (uint64_t remain = m_opts.file_size; remain > 0;) {
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(remain, buf.size()));
+                if (!file_write_exact(*file, buf.data(), n)) {
+                    return false;
+                }
+                remain -= n;
+            }
+
+            return !!file->close();
+        });
+    }
+
+    Result run_seq_read(size_t buf_size)
+    {
+        std::vector<unsigned char> buf(buf_size);
+
+        return measure([&] {
+            auto file = open_file(false);
+            if (!file) {
+                return false;
+            }
+
+            uint64_t total = 0;
+
+            while (true) {
+                auto n = file_read_retry(*file, buf.data(), buf.size());
+                if (!n) {
+                    return false;
+                } else if (n.value() == 0) {
+                    break;
+                }
+                total += n.value();
+            }
+
+            return total == m_opts.file_size && file->close();
+        });
+    }
+
+    Result run_random_read(size_t buf_size)
+    {
+        std::vector<unsigned char> buf(buf_size);
+        auto offsets = random_offsets(buf_size);
+
+        return measure([&] {
+            auto file = open_file(false);
+            if (!file) {
+                return false;
+            }
+
+            for (auto offset : offsets) {
+                if (!file->read_at(offset, buf.data(), buf.size())) {
+                    return false;
+                }
+            }
+
+            return !!file->close();
+        });
+    }
+
+    Result run_seek()
+    {
+        auto offsets = random_offsets(1);
+
+        return measure([&] {
+            auto file = open_file(false);
+            if (!file) {
+                return false;
+            }
+
+            for (auto offset : offsets) {
+                if (!file->seek(static_cast<int64_t>(offset), SEEK_SET)
+                        || !file->seek(0, SEEK_CUR)) {
+                    return false;
+                }
+            }
+
+            return !!file->close();
+        });
+    }
+
+    Result run_move()
+    {
+        // Overlapping move towards the end of the file
+        auto size = m_opts.file_size / 2;
+        auto dest = m_opts.file_size / 4;
+
+        return measure([&] {
+            auto file = open_file_rw();
+            if (!file) {
+                return false;
+            }
+
+            auto n = file_move(*file, 0, dest, size);
+            return n && n.value() == size && file->close();
+        });
+    }
+
+    Result run_search()
+    {
+        return measure([&] {
+            auto file = open_file(false);
+            if (!file) {
+                return false;
+            }
+
+            FileSearcher searcher(file.get(), SEARCH_PATTERN,
+                                  sizeof(SEARCH_PATTERN) - 1);
+            auto match = searcher.next();
+
+            return match && !match.value() && file->close();
+        });
+    }
+
+    Result run_search_parallel(size_t chunk_size, ThreadPool &pool)
+    {
+        FileSearcher::Pattern pattern{SEARCH_PATTERN,
+                                      sizeof(SEARCH_PATTERN) - 1};
+
+        return measure([&] {
+            auto file = open_file(false);
+            if (!file) {
+                return false;
+            }
+
+            auto matches = FileSearcher::search_parallel(
+                    *file, 0, m_opts.file_size, {pattern}, pool, chunk_size);
+
+            return matches && matches.value().empty() && file->close();
+        });
+    }
+
+private:
+    // Contains a byte that prepare() never writes
+    static constexpr char SEARCH_PATTERN[] = "\xffMBSEARCH";
+
+    std::unique_ptr<File> open_file(bool write)
+    {
+        auto read = FileOpenMode::ReadOnly;
+        auto trunc = FileOpenMode::WriteOnly;
+
+        if (m_backend == Backend::Memory) {
+            if (write) {
+                free(m_write_mem);
+                m_write_mem = nullptr;
+                m_write_mem_size = 0;
+
+                return checked(std::make_unique<MemoryFile>(
+                        &m_write_mem, &m_write_mem_size));
+            }
+            return checked(std::make_unique<MemoryFile>(m_mem, m_mem_size));
+        }
+
+        auto &path = write ? m_write_path : m_path;
+        auto mode = write ? trunc : read;
+
+        switch (m_backend) {
+        case Backend::Fd:
+            return checked(std::make_unique<FdFile>(path, mode));
+        case Backend::Posix:
+            return checked(std::make_unique<PosixFile>(path, mode));
+        case Backend::Standard:
+            return checked(std::make_unique<StandardFile>(path, mode));
+        case Backend::Buffered: {
+            auto inner = checked(std::make_unique<FdFile>(path, mode));
+            if (!inner) {
+                return nullptr;
+            }
+            return checked(std::make_unique<BufferedFile>(std::move(inner)));
+        }
+#ifdef _WIN32
+        case Backend::Win32:
+            return checked(std::make_unique<Win32File>(path, mode));
+#else
+        case Backend::Mmap:
+            return checked(std::make_unique<MmapFile>(path));
+#endif
+        default:
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<File> open_file_rw()
+    {
+        switch (m_backend) {
+        case Backend::Memory:
+            return open_file(false);
+        case Backend::Buffered: {
+            auto inner = checked(std::make_unique<FdFile>(
+                    m_path, FileOpenMode::ReadWrite));
+            if (!inner) {
+                return nullptr;
+            }
+            return checked(std::make_unique<BufferedFile>(std::move(inner)));
+        }
+        case Backend::Fd:
+            return checked(std::make_unique<FdFile>(
+                    m_path, FileOpenMode::ReadWrite));
+        case Backend::Posix:
+            return checked(std::make_unique<PosixFile>(
+                    m_path, FileOpenMode::ReadWrite));
+        case Backend::Standard:
+            return checked(std::make_unique<StandardFile>(
+                    m_path, FileOpenMode::ReadWrite));
+#ifdef _WIN32
+        case Backend::Win32:
+            return checked(std::make_unique<Win32File>(
+                    m_path, FileOpenMode::ReadWrite));
+#endif
+        default:
+            return nullptr;
+        }
+    }
+
+    static std::unique_ptr<File> checked(std::unique_ptr<File> file)
+    {
+        if (!file->is_open()) {
+            return nullptr;
+        }
+        return file;
+    }
+
+    std::vector<uint64_t> random_offsets(size_t size)
+    {
+        std::vector<uint64_t> offsets;
+
+        if (size > m_opts.file_size) {
+            return offsets;
+        }
+
+        std::uniform_int_distribution<uint64_t> dist(
+                0, m_opts.file_size - size);
+
+        offsets.reserve(m_opts.random_ops);
+        for (unsigned int i = 0; i < m_opts.random_ops; ++i) {
+            offsets.push_back(dist(m_rng));
+        }
+
+        return offsets;
+    }
+
+    template<typename Fn>
+    Result measure(Fn fn)
+    {
+        Result result;
+        std::chrono::duration<double> total{};
+        uint64_t syscalls = 0;
+        bool have_syscalls = true;
+
+        for (unsigned int i = 0; i < m_opts.iterations; ++i) {
+            auto syscalls_before = io_syscalls();
+            auto start = Clock::now();
+
+            if (!fn()) {
+                result.ok = false;
+                return result;
+            }
+
+            total += Clock::now() - start;
+
+            auto syscalls_after = io_syscalls();
+            if (syscalls_before && syscalls_after) {
+                syscalls += *syscalls_after - *syscalls_before
+                        - m_syscall_overhead;
+            } else {
+                have_syscalls = false;
+            }
+        }
+
+        result.seconds = total.count() / m_opts.iterations;
+        if (have_syscalls) {
+            result.syscalls = syscalls / m_opts.iterations;
+        }
+
+        return result;
+    }
+
+    const Options &m_opts;
+    Backend m_backend;
+    std::string m_path;
+    std::string m_write_path;
+    void *m_mem;
+    size_t m_mem_size;
+    void *m_write_mem = nullptr;
+    size_t m_write_mem_size = 0;
+    std::mt19937_64 m_rng;
+    uint64_t m_syscall_overhead = 0;
+};
+
+static void print_result(Backend backend, const char *op,
+                         std::optional<size_t> buf_size,
+                         const Result &result, uint64_t bytes, uint64_t ops)
+{
+    char size_str[32] = "-";
+    if (buf_size) {
+        if (*buf_size % (1024 * 1024) == 0) {
+            snprintf(size_str, sizeof(size_str), "%zuMiB",
+                     *buf_size / (1024 * 1024));
+        } else if (*buf_size % 1024 == 0) {
+            snprintf(size_str, sizeof(size_str), "%zuKiB", *buf_size / 1024);
+        } else {
+            snprintf(size_str, sizeof(size_str), "%zuB", *buf_size);
+        }
+    }
+
+    if (!result.ok) {
+        printf("%-9s %-16s %8s %12s\n", backend_name(backend), op, size_str,
+               "FAILED");
+        return;
+    }
+
+    char rate[32] = "-";
+    if (bytes > 0 && result.seconds > 0) {
+        snprintf(rate, sizeof(rate), "%.1fMiB/s",
+                 static_cast<double>(bytes) / (1024.0 * 1024.0)
+                 / result.seconds);
+    } else if (ops > 0) {
+        snprintf(rate, sizeof(rate), "%.1fns/op",
+                 result.seconds * 1e9 / static_cast<double>(ops));
+    }
+
+    char syscalls[32] = "-";
+    if (result.syscalls) {
+        snprintf(syscalls, sizeof(syscalls), "%" PRIu64, *result.syscalls);
+    }
+
+    printf("%-9s %-16s %8s %10.3fms %16s %10s\n", backend_name(backend), op,
+           size_str, result.seconds * 1000, rate, syscalls);
+}
+
+static bool parse_size(const char *str, size_t &out)
+{
+    size_t value;
+    size_t multiplier = 1;
+    std::string num(str);
+
+    if (!num.empty()) {
+        switch (num.back()) {
+        case 'K': case 'k':
+            multiplier = 1024;
+            num.pop_back();
+            break;
+        case 'M': case 'm':
+            multiplier = 1024 * 1024;
+            num.pop_back();
+            break;
+        }
+    }
+
+    if (!str_to_num(num.c_str(), 10, value) || value == 0
+            || value > SIZE_MAX / multiplier) {
+        return false;
+    }
+
+    out = value * multiplier;
+    return true;
+}
+
+static void usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: mbcommon_benchmarks [<option>...]\n"
+            "\n"
+            "Options:\n"
+            "  -s, --size <MiB>       Size of the test file (default: 64)\n"
+            "  -n, --iterations <n>   Iterations per measurement (default: 3)\n"
+            "  -r, --random-ops <n>   Operations for random read and seek\n"
+            "                         benchmarks (default: 4096)\n"
+            "  -b, --buffer <size>    Buffer size with optional K or M suffix\n"
+            "                         (default: 4K, 10K, 64K, 1M)\n"
+            "                         (can be specified multiple times)\n"
+            "  -B, --backend <name>   memory, fd, posix, standard, buffered,\n"
+#ifdef _WIN32
+            "                         or win32 (default: all)\n"
+#else
+            "                         or mmap (default: all)\n"
+#endif
+            "                         (can be specified multiple times)\n"
+            "  -d, --tmpdir <dir>     Directory for the test files\n"
+            "                         (default: /tmp)\n"
+            "\n"
+            "Times are averages per iteration. Reads are served from the page\n"
+            "cache. Syscalls are the read and write syscalls per iteration\n"
+            "(Linux only). The buffer size is the size passed to read() and\n"
+            "write() or the chunk size for search_parallel.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int opt;
+
+    static const char short_options[] = "s:n:r:b:B:d:h";
+
+    static const option long_options[] = {
+        {"size",       required_argument, nullptr, 's'},
+        {"iterations", required_argument, nullptr, 'n'},
+        {"random-ops", required_argument, nullptr, 'r'},
+        {"buffer",     required_argument, nullptr, 'b'},
+        {"backend",    required_argument, nullptr, 'B'},
+        {"tmpdir",     required_argument, nullptr, 'd'},
+        {"help",       no_argument,       nullptr, 'h'},
+        {nullptr,      0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 's': {
+            uint64_t mib;
+            if (!str_to_num(optarg, 10, mib) || mib == 0
+                    || mib > UINT32_MAX / (1024 * 1024)) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.file_size = mib * 1024 * 1024;
+            break;
+        }
+        case 'n':
+            if (!str_to_num(optarg, 10, opts.iterations)
+                    || opts.iterations == 0) {
+                fprintf(stderr, "Invalid iterations: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            if (!str_to_num(optarg, 10, opts.random_ops)
+                    || opts.random_ops == 0) {
+                fprintf(stderr, "Invalid random operations: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b': {
+            size_t size;
+            if (!parse_size(optarg, size)) {
+                fprintf(stderr, "Invalid buffer size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.buf_sizes.push_back(size);
+            break;
+        }
+        case 'B':
+            if (auto b = name_to_backend(optarg)) {
+                opts.backends.push_back(*b);
+            } else {
+                fprintf(stderr, "Invalid backend: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'd':
+            opts.tmpdir = optarg;
+            break;
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 0) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (opts.buf_sizes.empty()) {
+        opts.buf_sizes = { 4 * 1024, 10240, 64 * 1024, 1024 * 1024 };
+    }
+    if (opts.backends.empty()) {
+        opts.backends.assign(std::begin(ALL_BACKENDS), std::end(ALL_BACKENDS));
+    }
+
+    printf("%-9s %-16s %8s %12s %16s %10s\n",
+           "backend", "operation", "buffer", "time", "rate", "syscalls");
+
+    ThreadPool pool;
+    bool ok = true;
+
+    auto check = [&](const Result &result) {
+        ok = ok && result.ok;
+    };
+
+    for (auto backend : opts.backends) {
+        Bench bench(opts, backend);
+
+        if (!bench.prepare()) {
+            printf("%-9s %-16s %8s %12s\n", backend_name(backend), "prepare",
+                   "-", "FAILED");
+            ok = false;
+            continue;
+        }
+
+        for (auto buf_size : opts.buf_sizes) {
+            if (backend_can_write(backend)) {
+                auto result = bench.run_seq_write(buf_size);
+                print_result(backend, "seq_write", buf_size, result,
+                             opts.file_size, 0);
+                check(result);
+            }
+
+            auto result = bench.run_seq_read(buf_size);
+            print_result(backend, "seq_read", buf_size, result,
+                         opts.file_size, 0);
+            check(result);
+
+            result = bench.run_random_read(buf_size);
+            print_result(backend, "random_read", buf_size, result,
+                         static_cast<uint64_t>(buf_size) * opts.random_ops,
+                         0);
+            check(result);
+        }
+
+        auto result = bench.run_seek();
+        print_result(backend, "seek", std::nullopt, result, 0,
+                     2 * static_cast<uint64_t>(opts.random_ops));
+        check(result);
+
+        result = bench.run_search();
+        print_result(backend, "search", std::nullopt, result,
+                     opts.file_size, 0);
+        check(result);
+
+        for (auto buf_size : opts.buf_sizes) {
+            result = bench.run_search_parallel(buf_size, pool);
+            print_result(backend, "search_parallel", buf_size, result,
+                         opts.file_size, 0);
+            check(result);
+        }
+
+        // Last because it modifies the file
+        if (backend_can_write(backend)) {
+            result = bench.run_move();
+            print_result(backend, "file_move", std::nullopt, result,
+                         opts.file_size / 2, 0);
+            check(result);
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
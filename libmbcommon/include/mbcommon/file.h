@@ -29,6 +29,27 @@
 namespace mb
 {
 
+struct IoVec
+{
+    void *data;
+    size_t size;
+};
+
+struct ConstIoVec
+{
+    const void *data;
+    size_t size;
+};
+
+enum class FileAdvice
+{
+    Normal,
+    Sequential,
+    Random,
+    WillNeed,
+    DontNeed,
+};
+
 class MB_EXPORT File
 {
 public:
@@ -46,6 +67,21 @@ public:
     virtual oc::result<uint64_t> seek(int64_t offset, int whence) = 0;
     virtual oc::result<void> truncate(uint64_t size) = 0;
 
+    // Positional file operations
+    virtual oc::result<size_t> read_at(uint64_t offset,
+                                       void *buf, size_t size);
+    virtual oc::result<size_t> write_at(uint64_t offset,
+                                        const void *buf, size_t size);
+
+    // Vectored file operations
+    virtual oc::result<size_t> read_vectored(const IoVec *iov, size_t count);
+    virtual oc::result<size_t> write_vectored(const ConstIoVec *iov,
+                                              size_t count);
+
+    // Access pattern hints
+    virtual oc::result<void> advise(uint64_t offset, uint64_t size,
+                                    FileAdvice advice);
+
     // File state
     virtual bool is_open() = 0;
 };
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <memory>
+#include <vector>
+
+namespace mb
+{
+
+class MB_EXPORT BufferedFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    BufferedFile();
+    BufferedFile(File &file, size_t block_size = DEFAULT_BLOCK_SIZE);
+    BufferedFile(std::unique_ptr<File> file,
+                 size_t block_size = DEFAULT_BLOCK_SIZE);
+    virtual ~BufferedFile();
+
+    BufferedFile(BufferedFile &&other) noexcept;
+    BufferedFile & operator=(BufferedFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BufferedFile)
+
+    oc::result<void> open(File &file, size_t block_size = DEFAULT_BLOCK_SIZE);
+    oc::result<void> open(std::unique_ptr<File> file,
+                          size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    oc::result<void> advise(uint64_t offset, uint64_t size,
+                            FileAdvice advice) override;
+
+    bool is_open() override;
+
+    oc::result<void> flush();
+
+private:
+    /*! \cond INTERNAL */
+    enum class BufferMode
+    {
+        None,
+        Reading,
+        Writing,
+    };
+
+    oc::result<void> open(File *file, size_t block_size);
+    oc::result<void> sync_position();
+
+    void clear() noexcept;
+
+    std::unique_ptr<File> m_owned_file;
+    File *m_file;
+
+    std::vector<unsigned char> m_buf;
+    BufferMode m_mode;
+    // File offset of m_buf[0]. Only meaningful if m_pos_known is true.
+    uint64_t m_buf_start;
+    // Number of valid bytes in m_buf
+    size_t m_buf_len;
+    // Read cursor within m_buf when reading
+    size_t m_buf_off;
+    // Whether the underlying file could report its position when opened
+    bool m_pos_known;
+    /*! \endcond */
+};
+
+}
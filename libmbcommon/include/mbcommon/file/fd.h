@@ -52,6 +52,18 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence) override;
     oc::result<void> truncate(uint64_t size) override;
 
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
+    oc::result<size_t> read_vectored(const IoVec *iov, size_t count) override;
+    oc::result<size_t> write_vectored(const ConstIoVec *iov,
+                                      size_t count) override;
+
+    oc::result<void> advise(uint64_t offset, uint64_t size,
+                            FileAdvice advice) override;
+
     bool is_open() override;
 
 protected:
@@ -22,6 +22,9 @@
 #include <cstddef>
 
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/uio.h>
+#endif
 
 /*! \cond INTERNAL */
 namespace mb
@@ -38,6 +41,8 @@ struct FdFileFuncs
     virtual int fn_wopen(const wchar_t *path, int flags, mode_t mode) = 0;
 #else
     virtual int fn_open(const char *path, int flags, mode_t mode) = 0;
+    virtual int fn_posix_fadvise64(int fd, off64_t offset, off64_t len,
+                                   int advice) = 0;
 #endif
 
     // sys/stat.h
@@ -49,6 +54,14 @@ struct FdFileFuncs
     virtual off64_t fn_lseek64(int fd, off64_t offset, int whence) = 0;
     virtual ssize_t fn_read(int fd, void *buf, size_t count) = 0;
     virtual ssize_t fn_write(int fd, const void *buf, size_t count) = 0;
+#ifndef _WIN32
+    virtual ssize_t fn_pread64(int fd, void *buf, size_t count,
+                               off64_t offset) = 0;
+    virtual ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                                off64_t offset) = 0;
+    virtual ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) = 0;
+    virtual ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) = 0;
+#endif
 };
 
 }
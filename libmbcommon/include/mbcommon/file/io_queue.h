@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace mb
+{
+
+class MB_EXPORT IoQueue
+{
+public:
+    static constexpr size_t DEFAULT_DEPTH = 4;
+
+    IoQueue(File &file, size_t depth = DEFAULT_DEPTH);
+    ~IoQueue();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(IoQueue)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(IoQueue)
+
+    oc::result<void> submit_read(uint64_t offset, void *buf, size_t size);
+    oc::result<void> submit_write(uint64_t offset, const void *buf,
+                                  size_t size);
+
+    oc::result<void> wait();
+
+    size_t depth() const;
+
+private:
+    /*! \cond INTERNAL */
+    struct Request
+    {
+        bool write;
+        uint64_t offset;
+        void *buf;
+        size_t size;
+    };
+
+    oc::result<void> submit(Request req);
+    void worker();
+    std::error_code perform(const Request &req);
+
+    File &m_file;
+    size_t m_depth;
+
+    std::mutex m_mutex;
+    // Signalled when a request is queued or the queue is stopped
+    std::condition_variable m_cv_queued;
+    // Signalled when a request completes
+    std::condition_variable m_cv_done;
+
+    std::deque<Request> m_queue;
+    // Number of requests queued or being performed
+    size_t m_in_flight;
+    // First error since the last call to wait()
+    std::error_code m_error;
+    bool m_stop;
+
+    std::vector<std::thread> m_threads;
+    /*! \endcond */
+};
+
+}
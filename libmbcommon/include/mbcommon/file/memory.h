@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "mbcommon/file.h"
 
 namespace mb
@@ -30,6 +32,7 @@ public:
     MemoryFile();
     MemoryFile(void *buf, size_t size);
     MemoryFile(void **buf_ptr, size_t *size_ptr);
+    MemoryFile(std::vector<unsigned char> &&buf);
     virtual ~MemoryFile();
 
     MemoryFile(MemoryFile &&other) noexcept;
@@ -39,6 +42,9 @@ public:
 
     oc::result<void> open(void *buf, size_t size);
     oc::result<void> open(void **buf_ptr, size_t *size_ptr);
+    oc::result<void> open(std::vector<unsigned char> &&buf);
+
+    oc::result<std::vector<unsigned char>> release();
 
     oc::result<void> close() override;
 
@@ -47,16 +53,28 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence) override;
     oc::result<void> truncate(uint64_t size) override;
 
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+
     bool is_open() override;
 
 private:
     /*! \cond INTERNAL */
     void clear() noexcept;
 
+    oc::result<void> reserve(size_t capacity);
+    void resize(size_t size) noexcept;
+
     bool m_is_open;
 
     void *m_data;
     size_t m_size;
+    // Allocated size of a dynamic buffer. Bytes past m_size are always zero
+    size_t m_capacity;
+
+    // Backing storage when the file owns the buffer
+    std::vector<unsigned char> m_owned;
+    bool m_is_owned;
 
     void **m_data_ptr;
     size_t *m_size_ptr;
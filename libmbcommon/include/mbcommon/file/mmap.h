@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include <string>
+
+#include "mbcommon/file/mmap_p.h"
+
+namespace mb
+{
+
+struct MmapView
+{
+    const unsigned char *data;
+    size_t size;
+};
+
+class MB_EXPORT MmapFile : public File
+{
+public:
+    MmapFile();
+    MmapFile(int fd);
+    MmapFile(const std::string &filename);
+    MmapFile(const std::wstring &filename);
+    virtual ~MmapFile();
+
+    MmapFile(MmapFile &&other) noexcept;
+    MmapFile & operator=(MmapFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MmapFile)
+
+    oc::result<void> open(int fd);
+    oc::result<void> open(const std::string &filename);
+    oc::result<void> open(const std::wstring &filename);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+
+    oc::result<void> advise(uint64_t offset, uint64_t size,
+                            FileAdvice advice) override;
+
+    bool is_open() override;
+
+    // Zero-copy access
+    const unsigned char * data() const;
+    size_t size() const;
+
+    oc::result<MmapView> view(uint64_t offset, size_t size) const;
+    oc::result<MmapView> read_view(size_t size);
+
+protected:
+    /*! \cond INTERNAL */
+    MmapFile(detail::MmapFileFuncs *funcs);
+    MmapFile(detail::MmapFileFuncs *funcs, int fd);
+    MmapFile(detail::MmapFileFuncs *funcs, const std::string &filename);
+    MmapFile(detail::MmapFileFuncs *funcs, const std::wstring &filename);
+    /*! \endcond */
+
+private:
+    /*! \cond INTERNAL */
+    oc::result<void> map(int fd);
+
+    void clear() noexcept;
+
+    detail::MmapFileFuncs *m_funcs;
+
+    bool m_is_open;
+
+    void *m_data;
+    size_t m_size;
+
+    size_t m_pos;
+    /*! \endcond */
+};
+
+}
@@ -30,6 +30,8 @@ enum class FileOpenMode
     ReadWriteTrunc,
     Append,
     ReadAppend,
+    ReadOnlyDirect,
+    WriteOnlyDirect,
 };
 
 }
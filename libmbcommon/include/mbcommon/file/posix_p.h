@@ -39,6 +39,7 @@ struct PosixFileFuncs
     // stdio.h
     virtual int fn_fclose(FILE *stream) = 0;
     virtual int fn_ferror(FILE *stream) = 0;
+    virtual int fn_fflush(FILE *stream) = 0;
     virtual int fn_fileno(FILE *stream) = 0;
 #ifdef _WIN32
     virtual FILE * fn_wfopen(const wchar_t *filename, const wchar_t *mode) = 0;
@@ -54,6 +55,16 @@ struct PosixFileFuncs
 
     // unistd.h
     virtual int fn_ftruncate64(int fd, off64_t length) = 0;
+#ifndef _WIN32
+    virtual ssize_t fn_pread64(int fd, void *buf, size_t count,
+                               off64_t offset) = 0;
+    virtual ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                                off64_t offset) = 0;
+
+    // fcntl.h
+    virtual int fn_posix_fadvise64(int fd, off64_t offset, off64_t len,
+                                   int advice) = 0;
+#endif
 };
 
 }
@@ -21,6 +21,8 @@
 
 #include "mbcommon/file.h"
 
+#include <memory>
+
 #include "mbcommon/file/open_mode.h"
 #include "mbcommon/file/win32_p.h"
 
@@ -54,6 +56,11 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence) override;
     oc::result<void> truncate(uint64_t size) override;
 
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+    oc::result<size_t> write_at(uint64_t offset,
+                                const void *buf, size_t size) override;
+
     bool is_open() override;
 
 protected:
@@ -73,6 +80,18 @@ private:
 
     void clear() noexcept;
 
+    oc::result<size_t> overlapped_io(bool write, uint64_t offset,
+                                     void *buf, size_t size);
+
+    oc::result<void> stream_init();
+    oc::result<void> stream_start(size_t index, bool write,
+                                  uint64_t offset, size_t size);
+    oc::result<void> stream_finish(size_t index);
+    oc::result<void> stream_sync();
+    oc::result<size_t> stream_read(void *buf, size_t size);
+    oc::result<size_t> stream_write(const void *buf, size_t size);
+    oc::result<uint64_t> stream_seek(int64_t offset, int whence);
+
     detail::Win32FileFuncs *m_funcs;
 
     HANDLE m_handle;
@@ -86,6 +105,9 @@ private:
     DWORD m_attrib;
 
     bool m_append;
+
+    // Read-ahead and write-behind state for the streaming modes
+    std::unique_ptr<detail::Win32FileStream> m_stream;
     /*! \endcond */
 };
 
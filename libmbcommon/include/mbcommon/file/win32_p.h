@@ -27,6 +27,8 @@ namespace mb
 namespace detail
 {
 
+struct Win32FileStream;
+
 struct Win32FileFuncs
 {
     virtual ~Win32FileFuncs();
@@ -40,6 +42,14 @@ struct Win32FileFuncs
                                   DWORD dwCreationDisposition,
                                   DWORD dwFlagsAndAttributes,
                                   HANDLE hTemplateFile) = 0;
+    virtual HANDLE fn_CreateEventW(LPSECURITY_ATTRIBUTES lpEventAttributes,
+                                   BOOL bManualReset,
+                                   BOOL bInitialState,
+                                   LPCWSTR lpName) = 0;
+    virtual BOOL fn_GetOverlappedResult(HANDLE hFile,
+                                        LPOVERLAPPED lpOverlapped,
+                                        LPDWORD lpNumberOfBytesTransferred,
+                                        BOOL bWait) = 0;
     virtual BOOL fn_ReadFile(HANDLE hFile,
                              LPVOID lpBuffer,
                              DWORD nNumberOfBytesToRead,
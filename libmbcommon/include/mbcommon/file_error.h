@@ -37,6 +37,7 @@ enum class FileError
     UnsupportedWrite        = 31,
     UnsupportedSeek         = 32,
     UnsupportedTruncate     = 33,
+    UnsupportedAdvise       = 34,
 
     UnexpectedEof           = 40,
 
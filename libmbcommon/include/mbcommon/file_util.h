@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <array>
 #include <functional>
 #include <optional>
 #include <vector>
@@ -27,6 +28,7 @@
 #endif
 
 #include "mbcommon/file.h"
+#include "mbcommon/thread_pool.h"
 
 namespace mb
 {
@@ -41,6 +43,7 @@ namespace std2 = std;
 #endif
 
 constexpr size_t DEFAULT_BUFFER_SIZE = 8 * 1024 * 1024;
+constexpr uint64_t DEFAULT_SEARCH_CHUNK_SIZE = 64 * 1024 * 1024;
 
 }
 
@@ -54,6 +57,13 @@ MB_EXPORT oc::result<void> file_read_exact(File &file,
 MB_EXPORT oc::result<void> file_write_exact(File &file,
                                             const void *buf, size_t size);
 
+MB_EXPORT oc::result<void> file_read_vectored_exact(File &file,
+                                                    const IoVec *iov,
+                                                    size_t count);
+MB_EXPORT oc::result<void> file_write_vectored_exact(File &file,
+                                                     const ConstIoVec *iov,
+                                                     size_t count);
+
 MB_EXPORT oc::result<uint64_t> file_read_discard(File &file, uint64_t size);
 
 MB_EXPORT oc::result<uint64_t> file_move(File &file, uint64_t src,
@@ -62,7 +72,22 @@ MB_EXPORT oc::result<uint64_t> file_move(File &file, uint64_t src,
 class MB_EXPORT FileSearcher final
 {
 public:
+    struct Pattern
+    {
+        const void *data;
+        size_t size;
+    };
+
+    struct Match
+    {
+        // Offset relative to the starting file position
+        uint64_t offset;
+        // Index of the matching pattern
+        size_t pattern;
+    };
+
     FileSearcher(File *file, const void *pattern, size_t pattern_size);
+    FileSearcher(File *file, std::vector<Pattern> patterns);
 
     MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FileSearcher)
 
@@ -70,18 +95,42 @@ public:
     FileSearcher & operator=(FileSearcher &&rhs) noexcept;
 
     oc::result<std::optional<uint64_t>> next();
+    oc::result<std::optional<Match>> next_match();
+
+    static oc::result<std::vector<Match>>
+    search_parallel(File &file, uint64_t offset, uint64_t size,
+                    const std::vector<Pattern> &patterns,
+                    ThreadPool &pool = ThreadPool::shared(),
+                    uint64_t chunk_size = detail::DEFAULT_SEARCH_CHUNK_SIZE);
 
 private:
+    FileSearcher(File *file, std::vector<Pattern> patterns,
+                 size_t buf_size);
+
+    static oc::result<void> search_range(File &file, uint64_t begin,
+                                         uint64_t end, uint64_t limit,
+                                         const std::vector<Pattern> &patterns,
+                                         std::vector<Match> &matches);
+
+    std::optional<Match> search_region();
+    const unsigned char * find_candidate(const unsigned char *begin,
+                                         const unsigned char *end) const;
+
     void clear() noexcept;
 
     // File to search
     File *m_file;
-    // Pattern to search for
-    const void *m_pattern;
-    size_t m_pattern_size;
-    // Boyer-Moore searcher (NOTE std::byte does not work on Android)
+    // Patterns to search for
+    std::vector<Pattern> m_patterns;
+    size_t m_max_pattern_size;
+    // Boyer-Moore searcher for a single long pattern (NOTE std::byte does not
+    // work on Android)
     std::optional<detail::std2::boyer_moore_searcher<
             const unsigned char *>> m_searcher;
+    // First bytes of all patterns for the prefilter. If all patterns start
+    // with the same byte, memchr() is used instead of the lookup table.
+    std::array<bool, 256> m_first_bytes;
+    std::optional<unsigned char> m_first_byte;
     // Search buffer
     std::vector<unsigned char> m_buf;
     // Boundaries of current search area within buffer
@@ -89,6 +138,8 @@ private:
     size_t m_region_end;
     // File offset of byte 0 of `m_buf`, relative to the starting point
     uint64_t m_offset;
+    // Whether the end of the file has been reached
+    bool m_eof;
 };
 
 }
@@ -58,6 +58,13 @@ MB_PRINTF(1, 2)
 MB_EXPORT std::string format(const char *fmt, ...);
 MB_EXPORT oc::result<std::string> format_v_safe(const char *fmt, va_list ap);
 MB_EXPORT std::string format_v(const char *fmt, va_list ap);
+MB_PRINTF(2, 3)
+MB_EXPORT oc::result<void> format_to_safe(std::string &out, const char *fmt, ...);
+MB_PRINTF(2, 3)
+MB_EXPORT void format_to(std::string &out, const char *fmt, ...);
+MB_EXPORT oc::result<void> format_v_to_safe(std::string &out, const char *fmt,
+                                            va_list ap);
+MB_EXPORT void format_v_to(std::string &out, const char *fmt, va_list ap);
 
 // String starts with
 MB_EXPORT bool starts_with(std::string_view string, std::string_view prefix);
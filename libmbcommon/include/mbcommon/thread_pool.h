@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+class MB_EXPORT CancellationToken
+{
+public:
+    CancellationToken();
+
+    void cancel();
+    bool is_cancelled() const;
+
+private:
+    /*! \cond INTERNAL */
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+    /*! \endcond */
+};
+
+class MB_EXPORT ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    static constexpr size_t DEFAULT_CAPACITY = 256;
+
+    explicit ThreadPool(unsigned int threads = 0,
+                        size_t capacity = DEFAULT_CAPACITY);
+    ~ThreadPool();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ThreadPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ThreadPool)
+
+    void submit(Task task);
+    bool try_submit(Task task);
+
+    unsigned int size() const;
+
+    static ThreadPool & shared();
+
+private:
+    /*! \cond INTERNAL */
+    friend class TaskGroup;
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool push(Task &task, bool block);
+    bool run_one(bool block);
+    Task take(size_t first);
+    bool is_worker() const;
+    void worker(size_t index);
+
+    size_t m_capacity;
+
+    std::mutex m_mutex;
+    // Signalled when a task is queued or the pool is stopped
+    std::condition_variable m_cv_queued;
+    // Signalled when a task is dequeued
+    std::condition_variable m_cv_space;
+
+    // Number of queued tasks, including ones that are still being pushed
+    size_t m_reserved;
+    // Number of queued tasks that are not yet claimed by a thread
+    size_t m_available;
+    // Queue for the next task submitted from outside the pool
+    size_t m_next;
+    bool m_stop;
+
+    // One queue per worker
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    /*! \endcond */
+};
+
+class MB_EXPORT TaskGroup
+{
+public:
+    using Task = std::function<oc::result<void>()>;
+
+    explicit TaskGroup(ThreadPool &pool = ThreadPool::shared());
+    ~TaskGroup();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TaskGroup)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TaskGroup)
+
+    void run(Task task);
+    oc::result<void> wait();
+
+    void cancel();
+    const CancellationToken & token() const;
+
+private:
+    /*! \cond INTERNAL */
+    struct State
+    {
+        std::mutex mutex;
+        // Signalled when the last pending task completes
+        std::condition_variable cv;
+        size_t pending = 0;
+        // First error since the last call to wait()
+        std::error_code error;
+    };
+
+    ThreadPool &m_pool;
+    CancellationToken m_token;
+    std::shared_ptr<State> m_state;
+    /*! \endcond */
+};
+
+}
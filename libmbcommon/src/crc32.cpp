@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/crc32.h"
+
+#include <array>
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define CRC32_X86_PCLMUL 1
+#  include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+#  define CRC32_ARM64 1
+#  include <sys/auxv.h>
+#  ifndef HWCAP_CRC32
+#    define HWCAP_CRC32 (1 << 7)
+#  endif
+#endif
+
+/*!
+ * \file mbcommon/crc32.h
+ * \brief CRC32 checksum (IEEE 802.3 polynomial)
+ */
+
+namespace mb
+{
+
+/*! \cond INTERNAL */
+
+// Reflected form of 0x04C11DB7
+static constexpr uint32_t CRC32_POLY = 0xedb88320;
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+static constexpr Crc32Tables make_crc32_tables()
+{
+    Crc32Tables tables{};
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int j = 0; j < 8; ++j) {
+            c = (c & 1) ? (c >> 1) ^ CRC32_POLY : c >> 1;
+        }
+        tables[0][i] = c;
+    }
+
+    for (size_t t = 1; t < tables.size(); ++t) {
+        for (size_t i = 0; i < 256; ++i) {
+            uint32_t prev = tables[t - 1][i];
+            tables[t][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+
+    return tables;
+}
+
+static constexpr Crc32Tables g_tables = make_crc32_tables();
+
+using Crc32Fn = uint32_t (*)(uint32_t crc, const unsigned char *buf,
+                             size_t size);
+
+/*!
+ * \brief Portable slicing-by-8 implementation
+ *
+ * \note \p crc is the internal (inverted) CRC value
+ */
+static uint32_t crc32_generic(uint32_t crc, const unsigned char *buf,
+                              size_t size)
+{
+    while (size >= 8) {
+        uint32_t lo = static_cast<uint32_t>(buf[0])
+                | static_cast<uint32_t>(buf[1]) << 8
+                | static_cast<uint32_t>(buf[2]) << 16
+                | static_cast<uint32_t>(buf[3]) << 24;
+        lo ^= crc;
+
+        crc = g_tables[7][lo & 0xff]
+                ^ g_tables[6][(lo >> 8) & 0xff]
+                ^ g_tables[5][(lo >> 16) & 0xff]
+                ^ g_tables[4][lo >> 24]
+                ^ g_tables[3][buf[4]]
+                ^ g_tables[2][buf[5]]
+                ^ g_tables[1][buf[6]]
+                ^ g_tables[0][buf[7]];
+
+        buf += 8;
+        size -= 8;
+    }
+
+    while (size > 0) {
+        crc = (crc >> 8) ^ g_tables[0][(crc ^ *buf) & 0xff];
+        ++buf;
+        --size;
+    }
+
+    return crc;
+}
+
+#if CRC32_X86_PCLMUL
+
+// Minimum size for the folding implementation
+static constexpr size_t PCLMUL_MIN_SIZE = 64;
+
+/*!
+ * \brief Carry-less multiplication implementation
+ *
+ * This folds 64 bytes at a time and then reduces the result with Barrett
+ * reduction, as described in Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction" white paper. The constants are the
+ * bit-reflected values for the IEEE polynomial from the paper.
+ *
+ * \pre \p size >= PCLMUL_MIN_SIZE and \p size is a multiple of 16
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul_blocks(uint32_t crc, const unsigned char *buf,
+                                    size_t size)
+{
+    alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+    alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+    alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+    alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+    auto load = [](const unsigned char *p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = load(buf + 0x00);
+    x2 = load(buf + 0x10);
+    x3 = load(buf + 0x20);
+    x4 = load(buf + 0x30);
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+
+    buf += 64;
+    size -= 64;
+
+    // Fold 64 bytes at a time
+    while (size >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), load(buf + 0x00));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), load(buf + 0x10));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), load(buf + 0x20));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), load(buf + 0x30));
+
+        buf += 64;
+        size -= 64;
+    }
+
+    // Fold into 128 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+
+    for (__m128i next : { x2, x3, x4 }) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+    }
+
+    // Fold remaining 16 byte blocks
+    while (size >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, load(buf)), x5);
+
+        buf += 16;
+        size -= 16;
+    }
+
+    // Fold 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *buf,
+                             size_t size)
+{
+    if (size >= PCLMUL_MIN_SIZE) {
+        size_t n = size & ~static_cast<size_t>(15);
+        crc = crc32_pclmul_blocks(crc, buf, n);
+        buf += n;
+        size -= n;
+    }
+
+    return crc32_generic(crc, buf, size);
+}
+
+#elif CRC32_ARM64
+
+#  ifdef __clang__
+#    define CRC32_ARM64_TARGET __attribute__((target("crc")))
+#    define CRC32_ARM64_U8(crc, v) __builtin_arm_crc32b(crc, v)
+#    define CRC32_ARM64_U64(crc, v) __builtin_arm_crc32d(crc, v)
+#  else
+#    define CRC32_ARM64_TARGET __attribute__((target("+crc")))
+#    define CRC32_ARM64_U8(crc, v) __builtin_aarch64_crc32b(crc, v)
+#    define CRC32_ARM64_U64(crc, v) __builtin_aarch64_crc32x(crc, v)
+#  endif
+
+/*!
+ * \brief ARMv8 CRC32 instruction implementation
+ */
+CRC32_ARM64_TARGET
+static uint32_t crc32_arm64(uint32_t crc, const unsigned char *buf,
+                            size_t size)
+{
+    while (size >= 8) {
+        uint64_t v;
+        memcpy(&v, buf, sizeof(v));
+        crc = CRC32_ARM64_U64(crc, v);
+        buf += 8;
+        size -= 8;
+    }
+
+    while (size > 0) {
+        crc = CRC32_ARM64_U8(crc, *buf);
+        ++buf;
+        --size;
+    }
+
+    return crc;
+}
+
+#endif
+
+static Crc32Fn select_crc32_impl()
+{
+#if CRC32_X86_PCLMUL
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        return &crc32_pclmul;
+    }
+#elif CRC32_ARM64
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        return &crc32_arm64;
+    }
+#endif
+
+    return &crc32_generic;
+}
+
+/*! \endcond */
+
+/*!
+ * \brief Update CRC32 checksum with more data
+ *
+ * This computes the same checksum as zlib's `crc32()`. The initial value should
+ * be 0. Hardware acceleration (PCLMULQDQ on x86 and the CRC32 instructions on
+ * ARMv8) is used if the CPU supports it.
+ *
+ * \param crc Checksum of the previous data
+ * \param buf Data
+ * \param size Size of \p buf
+ *
+ * \return Checksum of the previous data followed by \p buf
+ */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t size)
+{
+    static const Crc32Fn impl = select_crc32_impl();
+
+    return ~impl(~crc, static_cast<const unsigned char *>(buf), size);
+}
+
+}
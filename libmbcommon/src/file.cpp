@@ -19,6 +19,10 @@
 
 #include "mbcommon/file.h"
 
+#include <cstdio>
+
+#include "mbcommon/file_error.h"
+
 // File documentation
 
 /*!
@@ -29,6 +33,54 @@
 namespace mb
 {
 
+/*!
+ * \struct IoVec
+ *
+ * \brief Buffer descriptor for File::read_vectored()
+ */
+
+/*!
+ * \struct ConstIoVec
+ *
+ * \brief Buffer descriptor for File::write_vectored()
+ */
+
+/*!
+ * \enum FileAdvice
+ *
+ * \brief Access pattern hints for File::advise()
+ */
+
+/*!
+ * \var FileAdvice::Normal
+ *
+ * \brief No particular access pattern. This resets previous hints.
+ */
+
+/*!
+ * \var FileAdvice::Sequential
+ *
+ * \brief Data will be accessed sequentially. Readahead may be increased.
+ */
+
+/*!
+ * \var FileAdvice::Random
+ *
+ * \brief Data will be accessed randomly. Readahead may be disabled.
+ */
+
+/*!
+ * \var FileAdvice::WillNeed
+ *
+ * \brief Data will be accessed soon and may be read ahead of time.
+ */
+
+/*!
+ * \var FileAdvice::DontNeed
+ *
+ * \brief Data will not be accessed again and may be evicted from the cache.
+ */
+
 /*!
  * \class File
  *
@@ -164,6 +216,221 @@ File::~File() = default;
  */
 
 /*!
+ * \brief Read from a File handle at a specific offset.
+ *
+ * This function reads up to \p size bytes starting at \p offset. The current
+ * file position is neither used nor changed, so subclasses backed by a native
+ * positional read primitive (eg. `pread()`) can be used from multiple threads
+ * at the same time.
+ *
+ * The default implementation emulates the operation by saving the current file
+ * position, calling File::seek() and File::read(), and then restoring the file
+ * position. It is *not* safe to call concurrently.
+ *
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ *
+ * \return
+ *   * Number of bytes read if some bytes are successfully read or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedSeek if the file does not support seeking
+ *   * FileError::UnsupportedRead if the file does not support reading
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+    OUTCOME_TRYV(seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto n = read(buf, size);
+
+    // Always attempt to restore the file position
+    auto restored = seek(static_cast<int64_t>(orig_pos), SEEK_SET);
+
+    if (!n) {
+        return n.as_failure();
+    } else if (!restored) {
+        return restored.as_failure();
+    }
+
+    return n.value();
+}
+
+/*!
+ * \brief Write to a File handle at a specific offset.
+ *
+ * This function writes up to \p size bytes starting at \p offset. The current
+ * file position is neither used nor changed, so subclasses backed by a native
+ * positional write primitive (eg. `pwrite()`) can be used from multiple threads
+ * at the same time.
+ *
+ * The default implementation emulates the operation by saving the current file
+ * position, calling File::seek() and File::write(), and then restoring the file
+ * position. It is *not* safe to call concurrently.
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return
+ *   * Number of bytes written if some bytes are successfully written or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedSeek if the file does not support seeking
+ *   * FileError::UnsupportedWrite if the file does not support writing
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::write_at(uint64_t offset, const void *buf,
+                                  size_t size)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(orig_pos, seek(0, SEEK_CUR));
+    OUTCOME_TRYV(seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto n = write(buf, size);
+
+    // Always attempt to restore the file position
+    auto restored = seek(static_cast<int64_t>(orig_pos), SEEK_SET);
+
+    if (!n) {
+        return n.as_failure();
+    } else if (!restored) {
+        return restored.as_failure();
+    }
+
+    return n.value();
+}
+
+/*!
+ * \brief Read from a File handle into multiple buffers.
+ *
+ * This function behaves like File::read(), except that the data is scattered
+ * into the buffers described by \p iov, in order. Each buffer is completely
+ * filled before moving onto the next one. Like File::read(), fewer bytes than
+ * the total size of the buffers may be read.
+ *
+ * The default implementation calls File::read() for each buffer and stops at
+ * the first short read. If an error occurs after some bytes were already read,
+ * the number of bytes read so far is returned instead of the error.
+ *
+ * \param iov Array of buffer descriptors
+ * \param count Number of buffer descriptors in \p iov
+ *
+ * \return
+ *   * Number of bytes read if some bytes are successfully read or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedRead if the file does not support reading
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::read_vectored(const IoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = read(iov[i].data, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Write to a File handle from multiple buffers.
+ *
+ * This function behaves like File::write(), except that the data is gathered
+ * from the buffers described by \p iov, in order. Like File::write(), fewer
+ * bytes than the total size of the buffers may be written.
+ *
+ * The default implementation calls File::write() for each buffer and stops at
+ * the first short write. If an error occurs after some bytes were already
+ * written, the number of bytes written so far is returned instead of the error.
+ *
+ * \param iov Array of buffer descriptors
+ * \param count Number of buffer descriptors in \p iov
+ *
+ * \return
+ *   * Number of bytes written if some bytes are successfully written or EOF is
+ *     reached
+ *   * std::errc::interrupted if the same operation should be reattempted
+ *   * FileError::UnsupportedWrite if the file does not support writing
+ *   * Otherwise, a specific error code
+ */
+oc::result<size_t> File::write_vectored(const ConstIoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = write(iov[i].data, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Advise the File handle about the expected access pattern.
+ *
+ * The hint applies to the range [\p offset, \p offset + \p size). If \p size is
+ * 0, the range extends to the end of the file. Hints never affect the
+ * correctness of other operations, so callers that do not care whether the
+ * hint was applied can ignore the return value.
+ *
+ * The default implementation returns FileError::UnsupportedAdvise.
+ *
+ * \param offset Starting offset of range
+ * \param size Size of range
+ * \param advice Access pattern hint
+ *
+ * \return
+ *   * Nothing if the hint is accepted
+ *   * FileError::UnsupportedAdvise if the file does not support hints
+ *   * Otherwise, a specific error code
+ */
+oc::result<void> File::advise(uint64_t offset, uint64_t size,
+                              FileAdvice advice)
+{
+    (void) offset;
+    (void) size;
+    (void) advice;
+
+    return FileError::UnsupportedAdvise;
+}
+
+/*!
+ * \fn File::is_open()
+ *
  * \brief Check whether file is opened
  *
  * \return Whether file is opened
@@ -0,0 +1,511 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/buffered.h"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/buffered.h
+ * \brief Add read-ahead and write-behind buffering to another File handle
+ */
+
+namespace mb
+{
+
+/*!
+ * \class BufferedFile
+ *
+ * \brief Buffering decorator for another File handle.
+ *
+ * Reads from the underlying file are performed in blocks of the configured size
+ * and small reads, as well as seeks that land within the buffered block, are
+ * serviced from memory. Small writes are collected and written to the
+ * underlying file when the buffer is full, when switching between reading and
+ * writing, when seeking, or when flush() or close() is called.
+ *
+ * Reads and writes that are at least as large as the block size bypass the
+ * buffer entirely.
+ *
+ * \note The underlying file must not be accessed directly while it is wrapped
+ *       by a BufferedFile. Its file position is unspecified until the
+ *       BufferedFile is closed.
+ */
+
+/*!
+ * \var BufferedFile::DEFAULT_BLOCK_SIZE
+ *
+ * \brief Default buffer size
+ */
+
+/*!
+ * \brief Construct unbound BufferedFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+BufferedFile::BufferedFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Wrap a File handle without taking ownership.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File &, size_t)
+ *
+ * \param file File handle to wrap
+ * \param block_size Buffer size
+ */
+BufferedFile::BufferedFile(File &file, size_t block_size)
+    : BufferedFile()
+{
+    (void) open(file, block_size);
+}
+
+/*!
+ * \brief Wrap a File handle and take ownership of it.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(std::unique_ptr<File>, size_t)
+ *
+ * \param file File handle to wrap
+ * \param block_size Buffer size
+ */
+BufferedFile::BufferedFile(std::unique_ptr<File> file, size_t block_size)
+    : BufferedFile()
+{
+    (void) open(std::move(file), block_size);
+}
+
+BufferedFile::~BufferedFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+BufferedFile::BufferedFile(BufferedFile &&other) noexcept
+    : BufferedFile()
+{
+    std::swap(m_owned_file, other.m_owned_file);
+    std::swap(m_file, other.m_file);
+    std::swap(m_buf, other.m_buf);
+    std::swap(m_mode, other.m_mode);
+    std::swap(m_buf_start, other.m_buf_start);
+    std::swap(m_buf_len, other.m_buf_len);
+    std::swap(m_buf_off, other.m_buf_off);
+    std::swap(m_pos_known, other.m_pos_known);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+BufferedFile & BufferedFile::operator=(BufferedFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_owned_file, rhs.m_owned_file);
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_buf, rhs.m_buf);
+        std::swap(m_mode, rhs.m_mode);
+        std::swap(m_buf_start, rhs.m_buf_start);
+        std::swap(m_buf_len, rhs.m_buf_len);
+        std::swap(m_buf_off, rhs.m_buf_off);
+        std::swap(m_pos_known, rhs.m_pos_known);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Wrap a File handle without taking ownership.
+ *
+ * When this handle is closed, pending writes are flushed and the file position
+ * of \p file is moved to the logical file position of this handle. \p file
+ * itself is *not* closed.
+ *
+ * \param file File handle to wrap
+ * \param block_size Buffer size
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::open(File &file, size_t block_size)
+{
+    return open(&file, block_size);
+}
+
+/*!
+ * \brief Wrap a File handle and take ownership of it.
+ *
+ * When this handle is closed, pending writes are flushed and \p file is
+ * closed.
+ *
+ * \param file File handle to wrap
+ * \param block_size Buffer size
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::open(std::unique_ptr<File> file,
+                                    size_t block_size)
+{
+    OUTCOME_TRYV(open(file.get(), block_size));
+
+    // Underlying pointer is not invalidated during a move
+    m_owned_file = std::move(file);
+    return oc::success();
+}
+
+oc::result<void> BufferedFile::open(File *file, size_t block_size)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    if (!file || block_size == 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Unseekable files can still be buffered, but all seeks are forwarded
+    auto pos = file->seek(0, SEEK_CUR);
+    if (pos) {
+        m_buf_start = pos.value();
+        m_pos_known = true;
+    } else if (pos.error() == FileErrorC::Unsupported) {
+        m_buf_start = 0;
+        m_pos_known = false;
+    } else {
+        return pos.as_failure();
+    }
+
+    m_file = file;
+    m_buf.resize(block_size);
+    m_mode = BufferMode::None;
+    m_buf_len = 0;
+    m_buf_off = 0;
+
+    return oc::success();
+}
+
+oc::result<void> BufferedFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    // Leave an unowned file at the logical file position
+    auto ret = m_owned_file ? flush() : sync_position();
+
+    if (m_owned_file) {
+        auto close_ret = m_owned_file->close();
+        if (ret && !close_ret) {
+            ret = std::move(close_ret);
+        }
+    }
+
+    return ret;
+}
+
+oc::result<size_t> BufferedFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(flush());
+
+    if (m_mode == BufferMode::Reading) {
+        if (m_buf_off < m_buf_len) {
+            auto n = std::min(m_buf_len - m_buf_off, size);
+            memcpy(buf, m_buf.data() + m_buf_off, n);
+            m_buf_off += n;
+            return n;
+        }
+
+        // Buffer is exhausted
+        m_buf_start += m_buf_len;
+        m_buf_len = 0;
+        m_buf_off = 0;
+        m_mode = BufferMode::None;
+    }
+
+    // Large reads bypass the buffer
+    if (size >= m_buf.size()) {
+        OUTCOME_TRY(n, m_file->read(buf, size));
+        m_buf_start += n;
+        return n;
+    }
+
+    OUTCOME_TRY(n, m_file->read(m_buf.data(), m_buf.size()));
+    if (n == 0) {
+        return 0;
+    }
+
+    m_mode = BufferMode::Reading;
+    m_buf_len = n;
+    m_buf_off = std::min(n, size);
+
+    memcpy(buf, m_buf.data(), m_buf_off);
+
+    return m_buf_off;
+}
+
+oc::result<size_t> BufferedFile::write(const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_mode == BufferMode::Reading) {
+        OUTCOME_TRYV(sync_position());
+    } else if (m_mode == BufferMode::Writing
+            && size > m_buf.size() - m_buf_len) {
+        OUTCOME_TRYV(flush());
+    }
+
+    // Large writes bypass the buffer
+    if (m_mode == BufferMode::None && size >= m_buf.size()) {
+        OUTCOME_TRY(n, m_file->write(buf, size));
+        m_buf_start += n;
+        return n;
+    }
+
+    memcpy(m_buf.data() + m_buf_len, buf, size);
+    m_buf_len += size;
+    m_mode = BufferMode::Writing;
+
+    return size;
+}
+
+oc::result<uint64_t> BufferedFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_pos_known && (whence == SEEK_SET || whence == SEEK_CUR)) {
+        uint64_t logical = m_buf_start
+                + (m_mode == BufferMode::Reading ? m_buf_off : m_buf_len);
+        uint64_t target;
+
+        if (whence == SEEK_SET) {
+            if (offset < 0) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = static_cast<uint64_t>(offset);
+        } else if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > logical) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = logical - static_cast<uint64_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > UINT64_MAX - logical) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = logical + static_cast<uint64_t>(offset);
+        }
+
+        if (target == logical) {
+            return target;
+        } else if (m_mode == BufferMode::Reading && target >= m_buf_start
+                && target - m_buf_start <= m_buf_len) {
+            // Seek within the read buffer
+            m_buf_off = static_cast<size_t>(target - m_buf_start);
+            return target;
+        }
+
+        if (target > INT64_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        // Position is absolute, so there's no need to rewind the read-ahead
+        OUTCOME_TRYV(flush());
+
+        m_mode = BufferMode::None;
+        m_buf_len = 0;
+        m_buf_off = 0;
+
+        offset = static_cast<int64_t>(target);
+        whence = SEEK_SET;
+    } else {
+        OUTCOME_TRYV(sync_position());
+    }
+
+    OUTCOME_TRY(pos, m_file->seek(offset, whence));
+    m_buf_start = pos;
+
+    return pos;
+}
+
+oc::result<void> BufferedFile::truncate(uint64_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(sync_position());
+
+    return m_file->truncate(size);
+}
+
+/*!
+ * \brief Read from file at a specific offset.
+ *
+ * Pending writes are flushed and the read is forwarded to the underlying file.
+ */
+oc::result<size_t> BufferedFile::read_at(uint64_t offset, void *buf,
+                                         size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(flush());
+
+    return m_file->read_at(offset, buf, size);
+}
+
+/*!
+ * \brief Write to file at a specific offset.
+ *
+ * Pending writes are flushed, the read buffer is discarded, and the write is
+ * forwarded to the underlying file.
+ */
+oc::result<size_t> BufferedFile::write_at(uint64_t offset, const void *buf,
+                                          size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(sync_position());
+
+    return m_file->write_at(offset, buf, size);
+}
+
+/*!
+ * \brief Advise the underlying file about the expected access pattern.
+ *
+ * The hint is forwarded to the underlying file. The buffer is not affected.
+ */
+oc::result<void> BufferedFile::advise(uint64_t offset, uint64_t size,
+                                      FileAdvice advice)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    return m_file->advise(offset, size, advice);
+}
+
+bool BufferedFile::is_open()
+{
+    return m_file != nullptr;
+}
+
+/*!
+ * \brief Write pending data to the underlying file.
+ *
+ * If the underlying file accepts only part of the pending data, the remaining
+ * data is kept in the buffer and FileError::UnexpectedEof is returned.
+ *
+ * \return Nothing if all pending data was written. Otherwise, the error code.
+ */
+oc::result<void> BufferedFile::flush()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_mode != BufferMode::Writing) {
+        return oc::success();
+    }
+
+    OUTCOME_TRY(n, file_write_retry(*m_file, m_buf.data(), m_buf_len));
+
+    m_buf_start += n;
+
+    if (n < m_buf_len) {
+        memmove(m_buf.data(), m_buf.data() + n, m_buf_len - n);
+        m_buf_len -= n;
+        return FileError::UnexpectedEof;
+    }
+
+    m_mode = BufferMode::None;
+    m_buf_len = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Empty the buffer and make the underlying file position match the
+ *        logical file position.
+ */
+oc::result<void> BufferedFile::sync_position()
+{
+    switch (m_mode) {
+    case BufferMode::None:
+        return oc::success();
+    case BufferMode::Writing:
+        return flush();
+    case BufferMode::Reading:
+        if (m_buf_off < m_buf_len) {
+            // Give back the data that was read ahead
+            OUTCOME_TRYV(m_file->seek(
+                    -static_cast<int64_t>(m_buf_len - m_buf_off), SEEK_CUR));
+        }
+
+        m_buf_start += m_buf_off;
+        m_buf_len = 0;
+        m_buf_off = 0;
+        m_mode = BufferMode::None;
+
+        return oc::success();
+    }
+
+    MB_UNREACHABLE("Invalid buffer mode: %d", static_cast<int>(m_mode));
+}
+
+void BufferedFile::clear() noexcept
+{
+    m_owned_file.reset();
+    m_file = nullptr;
+    m_buf.clear();
+    m_buf.shrink_to_fit();
+    m_mode = BufferMode::None;
+    m_buf_start = 0;
+    m_buf_len = 0;
+    m_buf_off = 0;
+    m_pos_known = false;
+}
+
+}
@@ -19,6 +19,8 @@
 
 #include "mbcommon/file/fd.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
@@ -46,6 +48,11 @@ using namespace detail;
 static constexpr mode_t DEFAULT_MODE =
         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 
+#ifndef _WIN32
+//! Maximum number of buffers submitted in a single `readv()`/`writev()` call
+static constexpr size_t MAX_IOV_BATCH = 64;
+#endif
+
 /*! \cond INTERNAL */
 struct RealFdFileFuncs : public FdFileFuncs
 {
@@ -59,6 +66,12 @@ struct RealFdFileFuncs : public FdFileFuncs
     {
         return open(path, flags, mode);
     }
+
+    int fn_posix_fadvise64(int fd, off64_t offset, off64_t len,
+                           int advice) override
+    {
+        return posix_fadvise64(fd, offset, len, advice);
+    }
 #endif
 
     int fn_fstat(int fildes, struct stat *buf) override
@@ -90,6 +103,30 @@ struct RealFdFileFuncs : public FdFileFuncs
     {
         return write(fd, buf, count);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return readv(fd, iov, iovcnt);
+    }
+
+    ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return writev(fd, iov, iovcnt);
+    }
+#endif
 };
 /*! \endcond */
 
@@ -128,6 +165,18 @@ static int convert_mode(FileOpenMode mode)
     case FileOpenMode::ReadAppend:
         ret |= O_RDWR | O_CREAT | O_APPEND;
         break;
+    case FileOpenMode::ReadOnlyDirect:
+        ret |= O_RDONLY;
+#ifdef O_DIRECT
+        ret |= O_DIRECT;
+#endif
+        break;
+    case FileOpenMode::WriteOnlyDirect:
+        ret |= O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+        ret |= O_DIRECT;
+#endif
+        break;
     default:
         MB_UNREACHABLE("Invalid mode: %d", static_cast<int>(mode));
     }
@@ -135,6 +184,51 @@ static int convert_mode(FileOpenMode mode)
     return ret;
 }
 
+#ifndef _WIN32
+static int convert_advice(FileAdvice advice)
+{
+    switch (advice) {
+    case FileAdvice::Normal:
+        return POSIX_FADV_NORMAL;
+    case FileAdvice::Sequential:
+        return POSIX_FADV_SEQUENTIAL;
+    case FileAdvice::Random:
+        return POSIX_FADV_RANDOM;
+    case FileAdvice::WillNeed:
+        return POSIX_FADV_WILLNEED;
+    case FileAdvice::DontNeed:
+        return POSIX_FADV_DONTNEED;
+    default:
+        MB_UNREACHABLE("Invalid advice: %d", static_cast<int>(advice));
+    }
+}
+
+/*!
+ * \brief Convert buffer descriptors to `struct iovec`s
+ *
+ * At most MAX_IOV_BATCH descriptors are converted and the total size is
+ * limited to SSIZE_MAX bytes.
+ *
+ * \return Number of entries in \p out that were populated
+ */
+template<typename Vec>
+static int to_native_iov(const Vec *iov, size_t count,
+                         struct iovec (&out)[MAX_IOV_BATCH])
+{
+    size_t n = std::min(count, MAX_IOV_BATCH);
+    size_t total = 0;
+    size_t i = 0;
+
+    for (; i < n && total < SSIZE_MAX; ++i) {
+        out[i].iov_base = const_cast<void *>(iov[i].data);
+        out[i].iov_len = std::min<size_t>(iov[i].size, SSIZE_MAX - total);
+        total += out[i].iov_len;
+    }
+
+    return static_cast<int>(i);
+}
+#endif
+
 /*! \endcond */
 
 /*!
@@ -483,6 +577,163 @@ oc::result<void> FdFile::truncate(uint64_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from file at a specific offset.
+ *
+ * On Unix-like systems, this is implemented with `pread64()` and is safe to
+ * call from multiple threads. On Windows, the default File::read_at()
+ * implementation is used.
+ */
+oc::result<size_t> FdFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+#ifdef _WIN32
+    return File::read_at(offset, buf, size);
+#else
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pread64(m_fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+/*!
+ * \brief Write to file at a specific offset.
+ *
+ * On Unix-like systems, this is implemented with `pwrite64()` and is safe to
+ * call from multiple threads. On Windows, the default File::write_at()
+ * implementation is used.
+ *
+ * \note On Linux, if the file was opened in append mode, the data is appended
+ *       to the end of the file regardless of \p offset.
+ */
+oc::result<size_t> FdFile::write_at(uint64_t offset, const void *buf,
+                                    size_t size)
+{
+#ifdef _WIN32
+    return File::write_at(offset, buf, size);
+#else
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(m_fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+/*!
+ * \brief Read from file into multiple buffers.
+ *
+ * On Unix-like systems, this is implemented with a single `readv()` call. At
+ * most 64 buffers are filled per call. On Windows, the default
+ * File::read_vectored() implementation is used.
+ */
+oc::result<size_t> FdFile::read_vectored(const IoVec *iov, size_t count)
+{
+#ifdef _WIN32
+    return File::read_vectored(iov, count);
+#else
+    if (!is_open()) return FileError::InvalidState;
+
+    struct iovec native[MAX_IOV_BATCH];
+    int native_count = to_native_iov(iov, count, native);
+
+    if (native_count == 0) {
+        return 0;
+    }
+
+    ssize_t n = m_funcs->fn_readv(m_fd, native, native_count);
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+/*!
+ * \brief Write to file from multiple buffers.
+ *
+ * On Unix-like systems, this is implemented with a single `writev()` call. At
+ * most 64 buffers are written per call. On Windows, the default
+ * File::write_vectored() implementation is used.
+ */
+oc::result<size_t> FdFile::write_vectored(const ConstIoVec *iov, size_t count)
+{
+#ifdef _WIN32
+    return File::write_vectored(iov, count);
+#else
+    if (!is_open()) return FileError::InvalidState;
+
+    struct iovec native[MAX_IOV_BATCH];
+    int native_count = to_native_iov(iov, count, native);
+
+    if (native_count == 0) {
+        return 0;
+    }
+
+    ssize_t n = m_funcs->fn_writev(m_fd, native, native_count);
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+/*!
+ * \brief Advise the kernel about the expected access pattern.
+ *
+ * On Unix-like systems, this is implemented with `posix_fadvise64()`. On
+ * Windows, the default File::advise() implementation is used.
+ */
+oc::result<void> FdFile::advise(uint64_t offset, uint64_t size,
+                                FileAdvice advice)
+{
+#ifdef _WIN32
+    return File::advise(offset, size, advice);
+#else
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset > INT64_MAX || size > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    int ret = m_funcs->fn_posix_fadvise64(m_fd, static_cast<off64_t>(offset),
+                                          static_cast<off64_t>(size),
+                                          convert_advice(advice));
+    if (ret != 0) {
+        return std::error_code(ret, std::generic_category());
+    }
+
+    return oc::success();
+#endif
+}
+
 bool FdFile::is_open()
 {
     return m_fd >= 0;
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/io_queue.h"
+
+#include <algorithm>
+
+#include "mbcommon/file_error.h"
+
+/*!
+ * \file mbcommon/file/io_queue.h
+ * \brief Keep multiple positional reads and writes in flight
+ */
+
+namespace mb
+{
+
+/*!
+ * \class IoQueue
+ *
+ * \brief Perform positional I/O on a File handle with several requests in
+ *        flight.
+ *
+ * Requests are performed by a fixed pool of worker threads with File::read_at()
+ * and File::write_at(). This keeps the storage device's queue busy when
+ * transferring large amounts of data, which a single synchronous read or write
+ * loop cannot do.
+ *
+ * The kernels on the devices this runs on predate io_uring and bionic does not
+ * provide libaio, so a thread pool is the only portable backend.
+ *
+ * \note The file must implement read_at() and write_at() natively (eg. FdFile
+ *       or Win32File) so that they are safe to call concurrently. The default
+ *       implementations move the file position and must not be used with this
+ *       class. Buffers must remain valid until wait() returns.
+ */
+
+/*!
+ * \var IoQueue::DEFAULT_DEPTH
+ *
+ * \brief Default number of requests in flight
+ */
+
+/*!
+ * \brief Construct a queue for a File handle.
+ *
+ * \param file File handle to perform I/O on. It must outlive the queue.
+ * \param depth Maximum number of requests in flight. If 0, the default depth is
+ *              used.
+ */
+IoQueue::IoQueue(File &file, size_t depth)
+    : m_file(file)
+    , m_depth(depth == 0 ? DEFAULT_DEPTH : depth)
+    , m_in_flight(0)
+    , m_stop(false)
+{
+    m_threads.reserve(m_depth);
+
+    for (size_t i = 0; i < m_depth; ++i) {
+        m_threads.emplace_back(&IoQueue::worker, this);
+    }
+}
+
+/*!
+ * \brief Wait for all pending requests and stop the worker threads.
+ *
+ * Errors from requests that have not been collected with wait() are discarded.
+ */
+IoQueue::~IoQueue()
+{
+    (void) wait();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_cv_queued.notify_all();
+
+    for (auto &t : m_threads) {
+        t.join();
+    }
+}
+
+/*!
+ * \brief Queue a read of exactly \p size bytes at \p offset.
+ *
+ * This blocks while the queue is full.
+ *
+ * \param offset File offset to read from
+ * \param buf Buffer to read into
+ * \param size Number of bytes to read
+ *
+ * \return Nothing if the request is queued. If a previous request failed, its
+ *         error is returned and the request is not queued. A read that reaches
+ *         EOF before \p size bytes are read fails with FileError::UnexpectedEof
+ *         when wait() is called.
+ */
+oc::result<void> IoQueue::submit_read(uint64_t offset, void *buf, size_t size)
+{
+    return submit({false, offset, buf, size});
+}
+
+/*!
+ * \brief Queue a write of exactly \p size bytes at \p offset.
+ *
+ * This blocks while the queue is full.
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from
+ * \param size Number of bytes to write
+ *
+ * \return Nothing if the request is queued. If a previous request failed, its
+ *         error is returned and the request is not queued.
+ */
+oc::result<void> IoQueue::submit_write(uint64_t offset, const void *buf,
+                                       size_t size)
+{
+    return submit({true, offset, const_cast<void *>(buf), size});
+}
+
+/*!
+ * \brief Wait for all queued requests to complete.
+ *
+ * \return Nothing if all requests since the last call to wait() succeeded.
+ *         Otherwise, the error from the first request that failed.
+ */
+oc::result<void> IoQueue::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_cv_done.wait(lock, [&] { return m_in_flight == 0; });
+
+    auto ec = m_error;
+    m_error.clear();
+
+    if (ec) {
+        return ec;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Get the maximum number of requests in flight.
+ */
+size_t IoQueue::depth() const
+{
+    return m_depth;
+}
+
+oc::result<void> IoQueue::submit(Request req)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        m_cv_done.wait(lock, [&] {
+            return m_in_flight < m_depth || m_error;
+        });
+
+        if (m_error) {
+            return m_error;
+        }
+
+        m_queue.push_back(req);
+        ++m_in_flight;
+    }
+
+    m_cv_queued.notify_one();
+
+    return oc::success();
+}
+
+void IoQueue::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_cv_queued.wait(lock, [&] { return m_stop || !m_queue.empty(); });
+
+        if (m_queue.empty()) {
+            // Stopped
+            break;
+        }
+
+        Request req = m_queue.front();
+        m_queue.pop_front();
+
+        // Skip the remaining requests once one has failed
+        std::error_code ec;
+        if (!m_error) {
+            lock.unlock();
+            ec = perform(req);
+            lock.lock();
+        }
+
+        if (ec && !m_error) {
+            m_error = ec;
+        }
+
+        --m_in_flight;
+
+        m_cv_done.notify_all();
+    }
+}
+
+std::error_code IoQueue::perform(const Request &req)
+{
+    auto *ptr = static_cast<unsigned char *>(req.buf);
+    uint64_t offset = req.offset;
+    size_t remain = req.size;
+
+    while (remain > 0) {
+        auto n = req.write
+                ? m_file.write_at(offset, ptr, remain)
+                : m_file.read_at(offset, ptr, remain);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            return n.error();
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        ptr += n.value();
+        offset += n.value();
+        remain -= n.value();
+    }
+
+    return {};
+}
+
+}
@@ -91,6 +91,22 @@ MemoryFile::MemoryFile(void **buf_ptr, size_t *size_ptr)
     (void) open(buf_ptr, size_ptr);
 }
 
+/*!
+ * \brief Open File handle from an adopted memory buffer.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(std::vector<unsigned char> &&)
+ *
+ * \param buf Data buffer to take ownership of
+ */
+MemoryFile::MemoryFile(std::vector<unsigned char> &&buf)
+    : MemoryFile()
+{
+    (void) open(std::move(buf));
+}
+
 MemoryFile::~MemoryFile()
 {
     (void) close();
@@ -111,6 +127,9 @@ MemoryFile::MemoryFile(MemoryFile &&other) noexcept
     std::swap(m_is_open, other.m_is_open);
     std::swap(m_data, other.m_data);
     std::swap(m_size, other.m_size);
+    std::swap(m_capacity, other.m_capacity);
+    std::swap(m_owned, other.m_owned);
+    std::swap(m_is_owned, other.m_is_owned);
     std::swap(m_data_ptr, other.m_data_ptr);
     std::swap(m_size_ptr, other.m_size_ptr);
     std::swap(m_pos, other.m_pos);
@@ -134,6 +153,9 @@ MemoryFile & MemoryFile::operator=(MemoryFile &&rhs) noexcept
         std::swap(m_is_open, rhs.m_is_open);
         std::swap(m_data, rhs.m_data);
         std::swap(m_size, rhs.m_size);
+        std::swap(m_capacity, rhs.m_capacity);
+        std::swap(m_owned, rhs.m_owned);
+        std::swap(m_is_owned, rhs.m_is_owned);
         std::swap(m_data_ptr, rhs.m_data_ptr);
         std::swap(m_size_ptr, rhs.m_size_ptr);
         std::swap(m_pos, rhs.m_pos);
@@ -159,6 +181,7 @@ oc::result<void> MemoryFile::open(void *buf, size_t size)
     m_is_open = true;
     m_data = buf;
     m_size = size;
+    m_capacity = size;
     m_data_ptr = nullptr;
     m_size_ptr = nullptr;
     m_pos = 0;
@@ -183,6 +206,7 @@ oc::result<void> MemoryFile::open(void **buf_ptr, size_t *size_ptr)
     m_is_open = true;
     m_data = *buf_ptr;
     m_size = *size_ptr;
+    m_capacity = *size_ptr;
     m_data_ptr = buf_ptr;
     m_size_ptr = size_ptr;
     m_pos = 0;
@@ -191,6 +215,60 @@ oc::result<void> MemoryFile::open(void **buf_ptr, size_t *size_ptr)
     return oc::success();
 }
 
+/*!
+ * \brief Open from an adopted memory buffer.
+ *
+ * The file takes ownership of \p buf without copying it. The buffer grows as
+ * needed when writing and can be taken back with release().
+ *
+ * \param buf Data buffer to take ownership of
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MemoryFile::open(std::vector<unsigned char> &&buf)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    m_owned = std::move(buf);
+
+    m_is_open = true;
+    m_data = m_owned.data();
+    m_size = m_owned.size();
+    m_capacity = m_owned.size();
+    m_is_owned = true;
+    m_data_ptr = nullptr;
+    m_size_ptr = nullptr;
+    m_pos = 0;
+    m_fixed_size = false;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Give the owned memory buffer back to the caller.
+ *
+ * The buffer is returned without copying it and is sized to the current file
+ * size. The file is closed afterwards.
+ *
+ * \return
+ *   * The buffer if the file was opened with open(std::vector<unsigned char> &&)
+ *   * FileError::InvalidState if the file is not open or does not own its
+ *     buffer
+ */
+oc::result<std::vector<unsigned char>> MemoryFile::release()
+{
+    if (!is_open() || !m_is_owned) return FileError::InvalidState;
+
+    // Shrinking does not reallocate
+    m_owned.resize(m_size);
+    auto buf = std::move(m_owned);
+
+    clear();
+
+    return buf;
+}
+
 oc::result<void> MemoryFile::close()
 {
     if (!is_open()) return FileError::InvalidState;
@@ -231,24 +309,15 @@ oc::result<size_t> MemoryFile::write(const void *buf, size_t size)
         if (m_fixed_size) {
             to_write = m_pos <= m_size ? m_size - m_pos : 0;
         } else {
-            // Enlarge buffer
-            void *new_data = realloc(m_data, desired_size);
-            if (!new_data) {
-                return ec_from_errno();
+            // Grow geometrically so that many small writes don't each
+            // reallocate and copy the whole buffer
+            if (desired_size > m_capacity) {
+                size_t new_capacity = m_capacity > SIZE_MAX / 2
+                        ? SIZE_MAX : m_capacity * 2;
+                OUTCOME_TRYV(reserve(std::max(new_capacity, desired_size)));
             }
 
-            // Zero-initialize new space
-            std::fill_n(static_cast<char *>(new_data) + m_size,
-                        desired_size - m_size, 0);
-
-            m_data = new_data;
-            m_size = desired_size;
-            if (m_data_ptr) {
-                *m_data_ptr = m_data;
-            }
-            if (m_size_ptr) {
-                *m_size_ptr = m_size;
-            }
+            resize(desired_size);
         }
     }
 
@@ -304,31 +373,42 @@ oc::result<void> MemoryFile::truncate(uint64_t size)
     if (m_fixed_size) {
         // Cannot truncate fixed buffer
         return FileError::UnsupportedTruncate;
-    } else {
-        void *new_data = realloc(m_data, static_cast<size_t>(size));
-        if (!new_data) {
-            return ec_from_errno();
-        }
+    } else if (size > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
 
-        // Zero-initialize new space
-        if (size > m_size) {
-            std::fill_n(static_cast<char *>(new_data) + m_size,
-                        static_cast<size_t>(size) - m_size, 0);
-        }
+    auto new_size = static_cast<size_t>(size);
 
-        m_data = new_data;
-        m_size = static_cast<size_t>(size);
-        if (m_data_ptr) {
-            *m_data_ptr = m_data;
-        }
-        if (m_size_ptr) {
-            *m_size_ptr = m_size;
-        }
+    if (new_size > m_capacity) {
+        OUTCOME_TRYV(reserve(new_size));
     }
 
+    resize(new_size);
+
     return oc::success();
 }
 
+/*!
+ * \brief Read from memory buffer at a specific offset.
+ *
+ * The file position is not used or changed.
+ */
+oc::result<size_t> MemoryFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset >= m_size) {
+        return 0;
+    }
+
+    auto pos = static_cast<size_t>(offset);
+    size_t to_read = std::min(m_size - pos, size);
+
+    memcpy(buf, static_cast<char *>(m_data) + pos, to_read);
+
+    return to_read;
+}
+
 bool MemoryFile::is_open()
 {
     return m_is_open;
@@ -339,10 +419,61 @@ void MemoryFile::clear() noexcept
     m_is_open = false;
     m_data = nullptr;
     m_size = 0;
+    m_capacity = 0;
+    std::vector<unsigned char>().swap(m_owned);
+    m_is_owned = false;
     m_data_ptr = nullptr;
     m_size_ptr = nullptr;
     m_pos = 0;
     m_fixed_size = false;
 }
 
+
+/*!
+ * \brief Enlarge the dynamic buffer to \p capacity bytes.
+ *
+ * The new space is zero-initialized. The file size is not changed.
+ */
+oc::result<void> MemoryFile::reserve(size_t capacity)
+{
+    if (m_is_owned) {
+        m_owned.resize(capacity);
+        m_data = m_owned.data();
+    } else {
+        void *new_data = realloc(m_data, capacity);
+        if (!new_data) {
+            return ec_from_errno();
+        }
+
+        // Zero-initialize new space
+        std::fill_n(static_cast<char *>(new_data) + m_capacity,
+                    capacity - m_capacity, 0);
+
+        m_data = new_data;
+        if (m_data_ptr) {
+            *m_data_ptr = m_data;
+        }
+    }
+
+    m_capacity = capacity;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Set the file size within the current capacity.
+ */
+void MemoryFile::resize(size_t size) noexcept
+{
+    // Keep the space past the end zeroed for when the file grows again
+    if (size < m_size) {
+        std::fill_n(static_cast<char *>(m_data) + size, m_size - size, 0);
+    }
+
+    m_size = size;
+    if (m_size_ptr) {
+        *m_size_ptr = m_size;
+    }
+}
+
 }
@@ -0,0 +1,611 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/mmap.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/locale.h"
+
+/*!
+ * \file mbcommon/file/mmap.h
+ * \brief Open file as a read-only memory mapping
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*! \cond INTERNAL */
+struct RealMmapFileFuncs : public MmapFileFuncs
+{
+    int fn_open(const char *path, int flags, mode_t mode) override
+    {
+        return ::open(path, flags, mode);
+    }
+
+    void * fn_mmap(void *addr, size_t length, int prot, int flags,
+                   int fd, off_t offset) override
+    {
+        return mmap(addr, length, prot, flags, fd, offset);
+    }
+
+    int fn_munmap(void *addr, size_t length) override
+    {
+        return munmap(addr, length);
+    }
+
+    int fn_madvise(void *addr, size_t length, int advice) override
+    {
+        return madvise(addr, length, advice);
+    }
+
+    int fn_fstat(int fildes, struct stat *buf) override
+    {
+        return fstat(fildes, buf);
+    }
+
+    int fn_close(int fd) override
+    {
+        return ::close(fd);
+    }
+
+    off64_t fn_lseek64(int fd, off64_t offset, int whence) override
+    {
+        return lseek64(fd, offset, whence);
+    }
+};
+/*! \endcond */
+
+static RealMmapFileFuncs g_default_funcs;
+
+/*! \cond INTERNAL */
+
+MmapFileFuncs::~MmapFileFuncs() = default;
+
+/*! \endcond */
+
+/*!
+ * \struct MmapView
+ *
+ * \brief Non-owning view of a range of bytes in a MmapFile.
+ *
+ * The view is only valid until the MmapFile it was obtained from is closed,
+ * moved from, or destroyed.
+ */
+
+/*!
+ * \class MmapFile
+ *
+ * \brief Open file as a read-only, private memory mapping.
+ *
+ * In addition to the normal File API, this class allows callers to access the
+ * file contents directly via data(), view(), and read_view() without copying
+ * the data into a separate buffer. Writing and truncation are not supported.
+ *
+ * Both regular files and block devices can be mapped. If the underlying file
+ * is truncated by another process while it is mapped, accessing the truncated
+ * region will raise `SIGBUS`.
+ */
+
+/*!
+ * \brief Construct unbound MmapFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+MmapFile::MmapFile()
+    : MmapFile(&g_default_funcs)
+{
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(int)
+ *
+ * \param fd File descriptor
+ */
+MmapFile::MmapFile(int fd)
+    : MmapFile(&g_default_funcs, fd)
+{
+}
+
+/*!
+ * \brief Open File handle from a multi-byte filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::string &)
+ *
+ * \param filename MBS filename
+ */
+MmapFile::MmapFile(const std::string &filename)
+    : MmapFile(&g_default_funcs, filename)
+{
+}
+
+/*!
+ * \brief Open File handle from a wide-character filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(const std::wstring &)
+ *
+ * \param filename WCS filename
+ */
+MmapFile::MmapFile(const std::wstring &filename)
+    : MmapFile(&g_default_funcs, filename)
+{
+}
+
+/*! \cond INTERNAL */
+
+MmapFile::MmapFile(MmapFileFuncs *funcs)
+    : File(), m_funcs(funcs)
+{
+    clear();
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs, int fd)
+    : MmapFile(funcs)
+{
+    (void) open(fd);
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs, const std::string &filename)
+    : MmapFile(funcs)
+{
+    (void) open(filename);
+}
+
+MmapFile::MmapFile(MmapFileFuncs *funcs, const std::wstring &filename)
+    : MmapFile(funcs)
+{
+    (void) open(filename);
+}
+
+/*! \endcond */
+
+MmapFile::~MmapFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Move construct new File handle.
+ *
+ * \p other will be left in a state as if it was newly constructed with the
+ * default constructor.
+ *
+ * \param other File handle to move from
+ */
+MmapFile::MmapFile(MmapFile &&other) noexcept
+    : m_funcs(&g_default_funcs)
+{
+    clear();
+
+    std::swap(m_funcs, other.m_funcs);
+    std::swap(m_is_open, other.m_is_open);
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_pos, other.m_pos);
+}
+
+/*!
+ * \brief Move assign a File handle
+ *
+ * This file handle will be closed and then \p rhs will be moved into this
+ * object. \p rhs will be left in a state as if it was newly constructed with
+ * the default constructor.
+ *
+ * \param rhs File handle to move from
+ */
+MmapFile & MmapFile::operator=(MmapFile &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_funcs, rhs.m_funcs);
+        std::swap(m_is_open, rhs.m_is_open);
+        std::swap(m_data, rhs.m_data);
+        std::swap(m_size, rhs.m_size);
+        std::swap(m_pos, rhs.m_pos);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Map file from file descriptor.
+ *
+ * The file descriptor is *not* owned by the File handle. Since the mapping
+ * stays valid after the file descriptor is closed, the caller may close \p fd
+ * as soon as this function returns.
+ *
+ * \param fd File descriptor
+ *
+ * \return Nothing if the file is successfully mapped. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(int fd)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    return map(fd);
+}
+
+/*!
+ * \brief Map file from a multi-byte filename.
+ *
+ * \p filename is opened read-only and the file descriptor is closed once the
+ * file is mapped.
+ *
+ * \param filename MBS filename
+ *
+ * \return Nothing if the file is successfully mapped. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::string &filename)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    int fd = m_funcs->fn_open(filename.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        m_funcs->fn_close(fd);
+    });
+
+    return map(fd);
+}
+
+/*!
+ * \brief Map file from a wide-character filename.
+ *
+ * \p filename is converted to MBS using wcs_to_mbs() before being passed to
+ * `open()`.
+ *
+ * \param filename WCS filename
+ *
+ * \return Nothing if the file is successfully mapped. Otherwise, the error
+ *         code.
+ */
+oc::result<void> MmapFile::open(const std::wstring &filename)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    auto converted = wcs_to_mbs(filename);
+    if (!converted) {
+        return FileError::CannotConvertEncoding;
+    }
+
+    return open(converted.value());
+}
+
+oc::result<void> MmapFile::map(int fd)
+{
+    struct stat sb;
+
+    if (m_funcs->fn_fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    uint64_t file_size;
+
+    if (S_ISDIR(sb.st_mode)) {
+        return std::make_error_code(std::errc::is_a_directory);
+    } else if (S_ISBLK(sb.st_mode)) {
+        // st_size is not meaningful for block devices
+        off64_t ret = m_funcs->fn_lseek64(fd, 0, SEEK_END);
+        if (ret < 0) {
+            return ec_from_errno();
+        }
+        file_size = static_cast<uint64_t>(ret);
+    } else if (S_ISREG(sb.st_mode)) {
+        file_size = static_cast<uint64_t>(sb.st_size);
+    } else {
+        return FileError::UnsupportedSeek;
+    }
+
+    if (file_size > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    void *data = nullptr;
+
+    // mmap() does not allow zero-length mappings
+    if (file_size > 0) {
+        data = m_funcs->fn_mmap(nullptr, static_cast<size_t>(file_size),
+                                PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            return ec_from_errno();
+        }
+    }
+
+    m_is_open = true;
+    m_data = data;
+    m_size = static_cast<size_t>(file_size);
+    m_pos = 0;
+
+    return oc::success();
+}
+
+oc::result<void> MmapFile::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // Reset to allow opening another file
+    auto reset = finally([&] {
+        clear();
+    });
+
+    if (m_data && m_funcs->fn_munmap(m_data, m_size) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> MmapFile::read(void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRY(v, read_view(size));
+
+    if (v.size > 0) {
+        memcpy(buf, v.data, v.size);
+    }
+
+    return v.size;
+}
+
+oc::result<size_t> MmapFile::write(const void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+
+    if (!is_open()) return FileError::InvalidState;
+
+    return FileError::UnsupportedWrite;
+}
+
+oc::result<uint64_t> MmapFile::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0 || static_cast<uint64_t>(offset) > SIZE_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = static_cast<size_t>(offset);
+    case SEEK_CUR:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos -= static_cast<size_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > SIZE_MAX - m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos += static_cast<size_t>(offset);
+        }
+    case SEEK_END:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_size) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos = m_size - static_cast<size_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > SIZE_MAX - m_size) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos = m_size + static_cast<size_t>(offset);
+        }
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+}
+
+oc::result<void> MmapFile::truncate(uint64_t size)
+{
+    (void) size;
+
+    if (!is_open()) return FileError::InvalidState;
+
+    return FileError::UnsupportedTruncate;
+}
+
+/*!
+ * \brief Read from mapping at a specific offset.
+ *
+ * The file position is not used or changed. This is safe to call from multiple
+ * threads.
+ */
+oc::result<size_t> MmapFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    OUTCOME_TRY(v, view(offset, size));
+
+    if (v.size > 0) {
+        memcpy(buf, v.data, v.size);
+    }
+
+    return v.size;
+}
+
+/*!
+ * \brief Advise the kernel about the expected access pattern.
+ *
+ * This is implemented with `madvise()` on the mapping. The range is extended
+ * to start at a page boundary and is clamped to the end of the file.
+ */
+oc::result<void> MmapFile::advise(uint64_t offset, uint64_t size,
+                                  FileAdvice advice)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (offset >= m_size) {
+        return oc::success();
+    }
+
+    size_t end = size == 0 || size > m_size - offset
+            ? m_size : static_cast<size_t>(offset + size);
+
+    auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = static_cast<size_t>(offset) & ~(page_size - 1);
+
+    int native_advice;
+
+    switch (advice) {
+    case FileAdvice::Normal:
+        native_advice = MADV_NORMAL;
+        break;
+    case FileAdvice::Sequential:
+        native_advice = MADV_SEQUENTIAL;
+        break;
+    case FileAdvice::Random:
+        native_advice = MADV_RANDOM;
+        break;
+    case FileAdvice::WillNeed:
+        native_advice = MADV_WILLNEED;
+        break;
+    case FileAdvice::DontNeed:
+        // The mapping is private and read-only, so dropped pages are simply
+        // faulted in from the file again
+        native_advice = MADV_DONTNEED;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid advice: %d", static_cast<int>(advice));
+    }
+
+    if (m_funcs->fn_madvise(static_cast<unsigned char *>(m_data) + start,
+                            end - start, native_advice) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+bool MmapFile::is_open()
+{
+    return m_is_open;
+}
+
+/*!
+ * \brief Get pointer to the mapped file contents
+ *
+ * \return Pointer to the beginning of the mapping or nullptr if the file is
+ *         not opened or is empty
+ */
+const unsigned char * MmapFile::data() const
+{
+    return static_cast<const unsigned char *>(m_data);
+}
+
+/*!
+ * \brief Get size of the mapped file
+ *
+ * \return Size of the mapping or 0 if the file is not opened
+ */
+size_t MmapFile::size() const
+{
+    return m_size;
+}
+
+/*!
+ * \brief Get view of a range of the mapped file
+ *
+ * The range is clamped to the end of the file. If \p offset is at or beyond the
+ * end of the file, an empty view is returned. The file position is not
+ * changed.
+ *
+ * \param offset Offset of the beginning of the range
+ * \param size Size of the range
+ *
+ * \return
+ *   * View of the range if the file is opened
+ *   * FileError::InvalidState if the file is not opened
+ */
+oc::result<MmapView> MmapFile::view(uint64_t offset, size_t size) const
+{
+    if (!m_is_open) return FileError::InvalidState;
+
+    if (offset >= m_size) {
+        return MmapView{data() + m_size, 0};
+    }
+
+    auto pos = static_cast<size_t>(offset);
+
+    return MmapView{data() + pos, std::min(m_size - pos, size)};
+}
+
+/*!
+ * \brief Read from file without copying
+ *
+ * This function behaves like read(), except that instead of copying the data
+ * into a buffer, a view of the mapped data is returned. The file position is
+ * advanced by the size of the view.
+ *
+ * \param size Maximum number of bytes to read
+ *
+ * \return
+ *   * View of the data that was read. The view's size is 0 if EOF is reached.
+ *   * FileError::InvalidState if the file is not opened
+ */
+oc::result<MmapView> MmapFile::read_view(size_t size)
+{
+    OUTCOME_TRY(v, view(m_pos, size));
+
+    m_pos += v.size;
+
+    return v;
+}
+
+void MmapFile::clear() noexcept
+{
+    m_is_open = false;
+    m_data = nullptr;
+    m_size = 0;
+    m_pos = 0;
+}
+
+}
@@ -82,4 +82,26 @@ namespace mb
  * always occurs at the end of the file.
  */
 
+/*!
+ * \var FileOpenMode::ReadOnlyDirect
+ *
+ * \brief Open file for reading, bypassing the page cache if possible.
+ *
+ * This is the same as FileOpenMode::ReadOnly, except that direct I/O
+ * (`O_DIRECT` or `FILE_FLAG_NO_BUFFERING`) is requested. Buffers, sizes, and
+ * file offsets must then be aligned to the logical block size of the
+ * underlying device. Backends that cannot perform direct I/O open the file
+ * normally.
+ */
+
+/*!
+ * \var FileOpenMode::WriteOnlyDirect
+ *
+ * \brief Truncate file and open for writing, bypassing the page cache if
+ *        possible.
+ *
+ * This is the same as FileOpenMode::WriteOnly, except that direct I/O is
+ * requested. See FileOpenMode::ReadOnlyDirect for the alignment requirements.
+ */
+
 }
@@ -20,10 +20,12 @@
 #include "mbcommon/file/posix.h"
 
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -64,6 +66,11 @@ struct RealPosixFileFuncs : public PosixFileFuncs
         return ferror(stream);
     }
 
+    int fn_fflush(FILE *stream) override
+    {
+        return fflush(stream);
+    }
+
     int fn_fileno(FILE *stream) override
     {
         return fileno(stream);
@@ -106,6 +113,26 @@ struct RealPosixFileFuncs : public PosixFileFuncs
     {
         return ftruncate64(fd, length);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+
+    int fn_posix_fadvise64(int fd, off64_t offset, off64_t len,
+                           int advice) override
+    {
+        return posix_fadvise64(fd, offset, len, advice);
+    }
+#endif
 };
 /*! \endcond */
 
@@ -120,10 +147,12 @@ static const wchar_t * convert_mode(FileOpenMode mode)
 {
     switch (mode) {
     case FileOpenMode::ReadOnly:
+    case FileOpenMode::ReadOnlyDirect:
         return L"rbN";
     case FileOpenMode::ReadWrite:
         return L"r+bN";
     case FileOpenMode::WriteOnly:
+    case FileOpenMode::WriteOnlyDirect:
         return L"wbN";
     case FileOpenMode::ReadWriteTrunc:
         return L"w+bN";
@@ -140,10 +169,12 @@ static const char * convert_mode(FileOpenMode mode)
 {
     switch (mode) {
     case FileOpenMode::ReadOnly:
+    case FileOpenMode::ReadOnlyDirect:
         return "rbe";
     case FileOpenMode::ReadWrite:
         return "r+be";
     case FileOpenMode::WriteOnly:
+    case FileOpenMode::WriteOnlyDirect:
         return "wbe";
     case FileOpenMode::ReadWriteTrunc:
         return "w+be";
@@ -155,6 +186,24 @@ static const char * convert_mode(FileOpenMode mode)
         MB_UNREACHABLE("Invalid mode: %d", static_cast<int>(mode));
     }
 }
+
+static int convert_advice(FileAdvice advice)
+{
+    switch (advice) {
+    case FileAdvice::Normal:
+        return POSIX_FADV_NORMAL;
+    case FileAdvice::Sequential:
+        return POSIX_FADV_SEQUENTIAL;
+    case FileAdvice::Random:
+        return POSIX_FADV_RANDOM;
+    case FileAdvice::WillNeed:
+        return POSIX_FADV_WILLNEED;
+    case FileAdvice::DontNeed:
+        return POSIX_FADV_DONTNEED;
+    default:
+        MB_UNREACHABLE("Invalid advice: %d", static_cast<int>(advice));
+    }
+}
 #endif
 
 /*! \endcond */
@@ -535,6 +584,131 @@ oc::result<void> PosixFile::truncate(uint64_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from file at a specific offset.
+ *
+ * On Unix-like systems, any buffered data is flushed with `fflush()` and the
+ * data is then read from the underlying file descriptor with `pread64()`,
+ * bypassing stdio's buffering. This is safe to call from multiple threads. On
+ * Windows or if the `FILE *` is not backed by a file descriptor, the default
+ * File::read_at() implementation is used.
+ */
+oc::result<size_t> PosixFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_can_seek) {
+        return FileError::UnsupportedSeek;
+    }
+
+#ifndef _WIN32
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd >= 0) {
+        if (offset > INT64_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        if (size > SSIZE_MAX) {
+            size = SSIZE_MAX;
+        }
+
+        if (m_funcs->fn_fflush(m_fp) == EOF) {
+            return ec_from_errno();
+        }
+
+        ssize_t n = m_funcs->fn_pread64(fd, buf, size,
+                                        static_cast<off64_t>(offset));
+        if (n < 0) {
+            return ec_from_errno();
+        }
+
+        return static_cast<size_t>(n);
+    }
+#endif
+
+    return File::read_at(offset, buf, size);
+}
+
+/*!
+ * \brief Write to file at a specific offset.
+ *
+ * On Unix-like systems, any buffered data is flushed with `fflush()` and the
+ * data is then written to the underlying file descriptor with `pwrite64()`,
+ * bypassing stdio's buffering. This is safe to call from multiple threads. On
+ * Windows or if the `FILE *` is not backed by a file descriptor, the default
+ * File::write_at() implementation is used.
+ */
+oc::result<size_t> PosixFile::write_at(uint64_t offset, const void *buf,
+                                       size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (!m_can_seek) {
+        return FileError::UnsupportedSeek;
+    }
+
+#ifndef _WIN32
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd >= 0) {
+        if (offset > INT64_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        if (size > SSIZE_MAX) {
+            size = SSIZE_MAX;
+        }
+
+        if (m_funcs->fn_fflush(m_fp) == EOF) {
+            return ec_from_errno();
+        }
+
+        ssize_t n = m_funcs->fn_pwrite64(fd, buf, size,
+                                         static_cast<off64_t>(offset));
+        if (n < 0) {
+            return ec_from_errno();
+        }
+
+        return static_cast<size_t>(n);
+    }
+#endif
+
+    return File::write_at(offset, buf, size);
+}
+
+/*!
+ * \brief Advise the kernel about the expected access pattern.
+ *
+ * On Unix-like systems, this is implemented with `posix_fadvise64()` on the
+ * underlying file descriptor. stdio's own buffering is not affected. On Windows
+ * or if the `FILE *` is not backed by a file descriptor,
+ * FileError::UnsupportedAdvise is returned.
+ */
+oc::result<void> PosixFile::advise(uint64_t offset, uint64_t size,
+                                   FileAdvice advice)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+#ifndef _WIN32
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (fd >= 0) {
+        if (offset > INT64_MAX || size > INT64_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        int ret = m_funcs->fn_posix_fadvise64(
+                fd, static_cast<off64_t>(offset), static_cast<off64_t>(size),
+                convert_advice(advice));
+        if (ret != 0) {
+            return std::error_code(ret, std::generic_category());
+        }
+
+        return oc::success();
+    }
+#endif
+
+    return File::advise(offset, size, advice);
+}
+
 bool PosixFile::is_open()
 {
     return m_fp;
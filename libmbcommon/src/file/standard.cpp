@@ -143,6 +143,35 @@ oc::result<void> StandardFile::truncate(uint64_t size)
     return m_file.truncate(size);
 }
 
+oc::result<size_t> StandardFile::read_at(uint64_t offset, void *buf,
+                                         size_t size)
+{
+    return m_file.read_at(offset, buf, size);
+}
+
+oc::result<size_t> StandardFile::write_at(uint64_t offset, const void *buf,
+                                          size_t size)
+{
+    return m_file.write_at(offset, buf, size);
+}
+
+oc::result<size_t> StandardFile::read_vectored(const IoVec *iov, size_t count)
+{
+    return m_file.read_vectored(iov, count);
+}
+
+oc::result<size_t> StandardFile::write_vectored(const ConstIoVec *iov,
+                                                size_t count)
+{
+    return m_file.write_vectored(iov, count);
+}
+
+oc::result<void> StandardFile::advise(uint64_t offset, uint64_t size,
+                                     FileAdvice advice)
+{
+    return m_file.advise(offset, size, advice);
+}
+
 bool StandardFile::is_open()
 {
     return m_file.is_open();
@@ -19,6 +19,10 @@
 
 #include "mbcommon/file/win32.h"
 
+#include <algorithm>
+#include <array>
+#include <mutex>
+
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
@@ -63,6 +67,24 @@ struct RealWin32FileFuncs : public Win32FileFuncs
                            dwFlagsAndAttributes, hTemplateFile);
     }
 
+    virtual HANDLE fn_CreateEventW(LPSECURITY_ATTRIBUTES lpEventAttributes,
+                                   BOOL bManualReset,
+                                   BOOL bInitialState,
+                                   LPCWSTR lpName) override
+    {
+        return CreateEventW(lpEventAttributes, bManualReset, bInitialState,
+                            lpName);
+    }
+
+    virtual BOOL fn_GetOverlappedResult(HANDLE hFile,
+                                        LPOVERLAPPED lpOverlapped,
+                                        LPDWORD lpNumberOfBytesTransferred,
+                                        BOOL bWait) override
+    {
+        return GetOverlappedResult(hFile, lpOverlapped,
+                                   lpNumberOfBytesTransferred, bWait);
+    }
+
     virtual BOOL fn_ReadFile(HANDLE hFile,
                              LPVOID lpBuffer,
                              DWORD nNumberOfBytesToRead,
@@ -105,17 +127,57 @@ struct RealWin32FileFuncs : public Win32FileFuncs
 
 static RealWin32FileFuncs g_default_funcs;
 
+//! Size of each read-ahead or write-behind buffer in the streaming modes
+static constexpr size_t STREAM_BUFFER_SIZE = 1024 * 1024;
+
 /*! \cond INTERNAL */
 
 Win32FileFuncs::~Win32FileFuncs() = default;
 
+struct detail::Win32FileStream
+{
+    enum class Mode
+    {
+        None,
+        Read,
+        Write,
+    };
+
+    struct Buffer
+    {
+        std::unique_ptr<unsigned char[]> data;
+        OVERLAPPED overlapped;
+        // Whether GetOverlappedResult() still needs to be called
+        bool pending;
+        bool write;
+        // File offset of the first byte in the buffer
+        uint64_t offset;
+        // Number of bytes read or number of bytes to write
+        size_t size;
+    };
+
+    std::mutex mutex;
+    Mode mode = Mode::None;
+    std::array<Buffer, 2> buffers = {};
+    // Buffer that is currently being consumed or filled
+    size_t current = 0;
+    // Whether the current buffer corresponds to the file position
+    bool valid = false;
+    // Position of the next read in the current buffer
+    size_t read_pos = 0;
+    // Logical file position. The Win32 file pointer is not used for
+    // overlapped handles.
+    uint64_t pos = 0;
+};
+
 static void convert_mode(FileOpenMode mode,
                          DWORD &access_out,
                          DWORD &sharing_out,
                          SECURITY_ATTRIBUTES &sa_out,
                          DWORD &creation_out,
                          DWORD &attrib_out,
-                         bool &append_out)
+                         bool &append_out,
+                         bool &stream_out)
 {
     DWORD access = 0;
     // Match open()/_wopen() behavior
@@ -125,11 +187,15 @@ static void convert_mode(FileOpenMode mode,
     DWORD attrib = 0;
     // Win32 does not have a native append mode
     bool append = false;
+    // Whether to use overlapped read-ahead and write-behind buffers
+    bool stream = false;
 
     switch (mode) {
     case FileOpenMode::ReadOnly:
         access = GENERIC_READ;
         creation = OPEN_EXISTING;
+        attrib = FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED;
+        stream = true;
         break;
     case FileOpenMode::ReadWrite:
         access = GENERIC_READ | GENERIC_WRITE;
@@ -138,6 +204,8 @@ static void convert_mode(FileOpenMode mode,
     case FileOpenMode::WriteOnly:
         access = GENERIC_WRITE;
         creation = CREATE_ALWAYS;
+        attrib = FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED;
+        stream = true;
         break;
     case FileOpenMode::ReadWriteTrunc:
         access = GENERIC_READ | GENERIC_WRITE;
@@ -153,6 +221,16 @@ static void convert_mode(FileOpenMode mode,
         creation = OPEN_ALWAYS;
         append = true;
         break;
+    case FileOpenMode::ReadOnlyDirect:
+        access = GENERIC_READ;
+        creation = OPEN_EXISTING;
+        attrib = FILE_FLAG_NO_BUFFERING;
+        break;
+    case FileOpenMode::WriteOnlyDirect:
+        access = GENERIC_WRITE;
+        creation = CREATE_ALWAYS;
+        attrib = FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+        break;
     default:
         MB_UNREACHABLE("Invalid mode: %d", static_cast<int>(mode));
     }
@@ -167,6 +245,7 @@ static void convert_mode(FileOpenMode mode,
     creation_out = creation;
     attrib_out = attrib;
     append_out = append;
+    stream_out = stream;
 }
 
 /*! \endcond */
@@ -177,6 +256,15 @@ static void convert_mode(FileOpenMode mode,
  * \brief Open file using Win32 API.
  *
  * This class supports opening large files (64-bit offsets) on Windows.
+ *
+ * When a file is opened by name with FileOpenMode::ReadOnly or
+ * FileOpenMode::WriteOnly, it is opened for overlapped I/O with the
+ * `FILE_FLAG_SEQUENTIAL_SCAN` hint. read() then serves small reads from two
+ * 1 MiB buffers, one of which is always being filled in the background, and
+ * write() collects small writes into buffers that are written in the
+ * background while the next one is filled. Errors from background writes are
+ * reported by the next write(), seek(), truncate(), or close() call. Large
+ * reads and writes bypass the buffers.
  */
 
 /*!
@@ -297,6 +385,7 @@ Win32File::Win32File(Win32File &&other) noexcept
     std::swap(m_creation, other.m_creation);
     std::swap(m_attrib, other.m_attrib);
     std::swap(m_append, other.m_append);
+    std::swap(m_stream, other.m_stream);
 }
 
 /*!
@@ -323,6 +412,7 @@ Win32File & Win32File::operator=(Win32File &&rhs) noexcept
         std::swap(m_creation, rhs.m_creation);
         std::swap(m_attrib, rhs.m_attrib);
         std::swap(m_append, rhs.m_append);
+        std::swap(m_stream, rhs.m_stream);
     }
 
     return *this;
@@ -381,8 +471,13 @@ oc::result<void> Win32File::open(const std::string &filename, FileOpenMode mode)
     m_owned = true;
     m_filename = std::move(converted.value());
 
+    bool stream;
     convert_mode(mode, m_access, m_sharing, m_sa, m_creation, m_attrib,
-                 m_append);
+                 m_append, stream);
+
+    if (stream) {
+        m_stream = std::make_unique<Win32FileStream>();
+    }
 
     return open();
 }
@@ -406,8 +501,13 @@ oc::result<void> Win32File::open(const std::wstring &filename, FileOpenMode mode
     m_owned = true;
     m_filename = filename;
 
+    bool stream;
     convert_mode(mode, m_access, m_sharing, m_sa, m_creation, m_attrib,
-                 m_append);
+                 m_append, stream);
+
+    if (stream) {
+        m_stream = std::make_unique<Win32FileStream>();
+    }
 
     return open();
 }
@@ -441,11 +541,31 @@ oc::result<void> Win32File::close()
         clear();
     });
 
+    std::error_code stream_ec;
+
+    if (m_stream) {
+        std::lock_guard<std::mutex> lock(m_stream->mutex);
+
+        if (auto r = stream_sync(); !r) {
+            stream_ec = r.error();
+        }
+
+        for (auto &b : m_stream->buffers) {
+            if (b.overlapped.hEvent) {
+                m_funcs->fn_CloseHandle(b.overlapped.hEvent);
+            }
+        }
+    }
+
     if (m_owned && m_handle != INVALID_HANDLE_VALUE
             && !m_funcs->fn_CloseHandle(m_handle)) {
         return ec_from_win32();
     }
 
+    if (stream_ec) {
+        return stream_ec;
+    }
+
     return oc::success();
 }
 
@@ -453,6 +573,11 @@ oc::result<size_t> Win32File::read(void *buf, size_t size)
 {
     if (!is_open()) return FileError::InvalidState;
 
+    if (m_stream) {
+        std::lock_guard<std::mutex> lock(m_stream->mutex);
+        return stream_read(buf, size);
+    }
+
     DWORD n = 0;
 
     if (size > UINT_MAX) {
@@ -478,6 +603,11 @@ oc::result<size_t> Win32File::write(const void *buf, size_t size)
 {
     if (!is_open()) return FileError::InvalidState;
 
+    if (m_stream) {
+        std::lock_guard<std::mutex> lock(m_stream->mutex);
+        return stream_write(buf, size);
+    }
+
     DWORD n = 0;
 
     // We have to seek manually in append mode because the Win32 API has no
@@ -509,6 +639,11 @@ oc::result<uint64_t> Win32File::seek(int64_t offset, int whence)
 {
     if (!is_open()) return FileError::InvalidState;
 
+    if (m_stream) {
+        std::lock_guard<std::mutex> lock(m_stream->mutex);
+        return stream_seek(offset, whence);
+    }
+
     DWORD move_method;
     LARGE_INTEGER pos;
     LARGE_INTEGER new_pos;
@@ -547,6 +682,11 @@ oc::result<void> Win32File::truncate(uint64_t size)
 {
     if (!is_open()) return FileError::InvalidState;
 
+    if (m_stream) {
+        std::lock_guard<std::mutex> lock(m_stream->mutex);
+        OUTCOME_TRYV(stream_sync());
+    }
+
     FILE_END_OF_FILE_INFO info;
     info.EndOfFile.QuadPart = static_cast<int64_t>(size);
 
@@ -561,6 +701,120 @@ oc::result<void> Win32File::truncate(uint64_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from file at a specific offset.
+ *
+ * The offset is passed to `ReadFile()` via an `OVERLAPPED` structure, so
+ * concurrent calls do not race on a shared seek and read pair.
+ *
+ * \note If the handle is opened for synchronous I/O, Windows moves the file
+ *       pointer to the end of the region that was read.
+ */
+oc::result<size_t> Win32File::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_stream) {
+        {
+            std::lock_guard<std::mutex> lock(m_stream->mutex);
+            if (m_stream->mode == Win32FileStream::Mode::Write) {
+                OUTCOME_TRYV(stream_sync());
+            }
+        }
+
+        return overlapped_io(false, offset, buf, size);
+    }
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    DWORD n = 0;
+    OVERLAPPED overlapped = {};
+
+    overlapped.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    bool ret = m_funcs->fn_ReadFile(
+        m_handle,   // hFile
+        buf,        // lpBuffer
+        size,       // nNumberOfBytesToRead
+        &n,         // lpNumberOfBytesRead
+        &overlapped // lpOverlapped
+    );
+
+    if (!ret) {
+        DWORD error = GetLastError();
+
+        // Reading at or beyond EOF is not an error
+        if (error == ERROR_HANDLE_EOF) {
+            return 0;
+        }
+
+        return ec_from_win32(error);
+    }
+
+    return n;
+}
+
+/*!
+ * \brief Write to file at a specific offset.
+ *
+ * The offset is passed to `WriteFile()` via an `OVERLAPPED` structure, so
+ * concurrent calls do not race on a shared seek and write pair.
+ *
+ * \note If the handle is opened for synchronous I/O, Windows moves the file
+ *       pointer to the end of the region that was written.
+ */
+oc::result<size_t> Win32File::write_at(uint64_t offset, const void *buf,
+                                       size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_stream) {
+        {
+            std::lock_guard<std::mutex> lock(m_stream->mutex);
+            if (m_stream->mode != Win32FileStream::Mode::None) {
+                OUTCOME_TRYV(stream_sync());
+            }
+        }
+
+        return overlapped_io(true, offset, const_cast<void *>(buf), size);
+    }
+
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    DWORD n = 0;
+    OVERLAPPED overlapped = {};
+
+    overlapped.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    bool ret = m_funcs->fn_WriteFile(
+        m_handle,   // hFile
+        buf,        // lpBuffer
+        size,       // nNumberOfBytesToWrite
+        &n,         // lpNumberOfBytesWritten
+        &overlapped // lpOverlapped
+    );
+
+    if (!ret) {
+        return ec_from_win32();
+    }
+
+    return n;
+}
+
 bool Win32File::is_open()
 {
     return m_handle != INVALID_HANDLE_VALUE;
@@ -577,6 +831,417 @@ void Win32File::clear() noexcept
     m_creation = 0;
     m_attrib = 0;
     m_append = false;
+    m_stream.reset();
 }
 
+/*! \cond INTERNAL */
+
+oc::result<size_t> Win32File::overlapped_io(bool write, uint64_t offset,
+                                            void *buf, size_t size)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > UINT_MAX) {
+        size = UINT_MAX;
+    }
+
+    // Each call has its own event so that concurrent calls do not wake each
+    // other up
+    HANDLE event = m_funcs->fn_CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    if (!event) {
+        return ec_from_win32();
+    }
+
+    auto close_event = finally([&] {
+        m_funcs->fn_CloseHandle(event);
+    });
+
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    overlapped.hEvent = event;
+
+    bool ret = write
+            ? m_funcs->fn_WriteFile(m_handle, buf, static_cast<DWORD>(size),
+                                    nullptr, &overlapped)
+            : m_funcs->fn_ReadFile(m_handle, buf, static_cast<DWORD>(size),
+                                   nullptr, &overlapped);
+
+    if (!ret) {
+        DWORD error = GetLastError();
+
+        if (!write && error == ERROR_HANDLE_EOF) {
+            return 0;
+        } else if (error != ERROR_IO_PENDING) {
+            return ec_from_win32(error);
+        }
+    }
+
+    DWORD n = 0;
+
+    if (!m_funcs->fn_GetOverlappedResult(m_handle, &overlapped, &n, TRUE)) {
+        DWORD error = GetLastError();
+
+        // Reading at or beyond EOF is not an error
+        if (!write && error == ERROR_HANDLE_EOF) {
+            return 0;
+        }
+
+        return ec_from_win32(error);
+    }
+
+    return n;
+}
+
+oc::result<void> Win32File::stream_init()
+{
+    for (auto &b : m_stream->buffers) {
+        if (!b.overlapped.hEvent) {
+            b.overlapped.hEvent = m_funcs->fn_CreateEventW(
+                    nullptr, TRUE, FALSE, nullptr);
+            if (!b.overlapped.hEvent) {
+                return ec_from_win32();
+            }
+        }
+
+        if (!b.data) {
+            b.data.reset(new unsigned char[STREAM_BUFFER_SIZE]);
+        }
+    }
+
+    return oc::success();
+}
+
+oc::result<void> Win32File::stream_start(size_t index, bool write,
+                                         uint64_t offset, size_t size)
+{
+    auto &b = m_stream->buffers[index];
+
+    b.write = write;
+    b.offset = offset;
+    b.size = size;
+    b.overlapped.Internal = 0;
+    b.overlapped.InternalHigh = 0;
+    b.overlapped.Offset = static_cast<DWORD>(offset & 0xffffffffu);
+    b.overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    bool ret = write
+            ? m_funcs->fn_WriteFile(m_handle, b.data.get(),
+                                    static_cast<DWORD>(size), nullptr,
+                                    &b.overlapped)
+            : m_funcs->fn_ReadFile(m_handle, b.data.get(),
+                                   static_cast<DWORD>(size), nullptr,
+                                   &b.overlapped);
+
+    if (!ret) {
+        DWORD error = GetLastError();
+
+        if (!write && error == ERROR_HANDLE_EOF) {
+            b.size = 0;
+            return oc::success();
+        } else if (error != ERROR_IO_PENDING) {
+            b.size = 0;
+            return ec_from_win32(error);
+        }
+    }
+
+    b.pending = true;
+
+    return oc::success();
+}
+
+oc::result<void> Win32File::stream_finish(size_t index)
+{
+    auto &b = m_stream->buffers[index];
+
+    if (!b.pending) {
+        return oc::success();
+    }
+
+    b.pending = false;
+
+    DWORD n = 0;
+
+    if (!m_funcs->fn_GetOverlappedResult(m_handle, &b.overlapped, &n, TRUE)) {
+        DWORD error = GetLastError();
+
+        if (b.write || error != ERROR_HANDLE_EOF) {
+            b.size = 0;
+            return ec_from_win32(error);
+        }
+
+        n = 0;
+    }
+
+    if (b.write) {
+        if (n != b.size) {
+            b.size = 0;
+            return ec_from_win32(ERROR_HANDLE_DISK_FULL);
+        }
+        b.size = 0;
+    } else {
+        b.size = n;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * Write out any buffered data and wait for all background I/O. The file
+ * position is left unchanged.
+ */
+oc::result<void> Win32File::stream_sync()
+{
+    auto &s = *m_stream;
+    std::error_code ec;
+
+    if (s.mode == Win32FileStream::Mode::Write && s.valid) {
+        auto &cur = s.buffers[s.current];
+
+        if (cur.size > 0) {
+            if (auto r = stream_start(s.current, true, cur.offset, cur.size);
+                    !r) {
+                ec = r.error();
+            }
+        }
+    }
+
+    for (size_t i = 0; i < s.buffers.size(); ++i) {
+        if (auto r = stream_finish(i); !r && !ec
+                && s.mode == Win32FileStream::Mode::Write) {
+            ec = r.error();
+        }
+    }
+
+    s.mode = Win32FileStream::Mode::None;
+    s.valid = false;
+
+    if (ec) {
+        return ec;
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> Win32File::stream_read(void *buf, size_t size)
+{
+    auto &s = *m_stream;
+
+    if (s.mode != Win32FileStream::Mode::Read) {
+        OUTCOME_TRYV(stream_sync());
+        OUTCOME_TRYV(stream_init());
+        s.mode = Win32FileStream::Mode::Read;
+    }
+
+    auto *out = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (size > 0) {
+        if (!s.valid) {
+            if (size >= STREAM_BUFFER_SIZE) {
+                // Nothing is buffered, so read directly into the caller's
+                // buffer
+                OUTCOME_TRY(n, overlapped_io(false, s.pos, out, size));
+                s.pos += n;
+                total += n;
+                break;
+            }
+
+            OUTCOME_TRYV(stream_start(s.current, false, s.pos,
+                                      STREAM_BUFFER_SIZE));
+            s.valid = true;
+            s.read_pos = 0;
+
+            OUTCOME_TRYV(stream_start(s.current ^ 1, false,
+                                      s.pos + STREAM_BUFFER_SIZE,
+                                      STREAM_BUFFER_SIZE));
+        }
+
+        auto &cur = s.buffers[s.current];
+
+        if (auto r = stream_finish(s.current); !r) {
+            // Drop the buffers so that the next read retries
+            (void) stream_sync();
+            if (total > 0) {
+                break;
+            }
+            return r.as_failure();
+        }
+
+        if (s.read_pos == cur.size) {
+            if (cur.size < STREAM_BUFFER_SIZE) {
+                // EOF
+                break;
+            }
+
+            // Switch to the read-ahead buffer and refill this one
+            auto next_offset = cur.offset + 2 * STREAM_BUFFER_SIZE;
+            auto prev = s.current;
+
+            s.current ^= 1;
+            s.read_pos = 0;
+
+            if (auto r = stream_start(prev, false, next_offset,
+                                      STREAM_BUFFER_SIZE); !r) {
+                (void) stream_sync();
+                if (total > 0) {
+                    break;
+                }
+                return r.as_failure();
+            }
+
+            continue;
+        }
+
+        auto n = std::min(size, cur.size - s.read_pos);
+        memcpy(out, cur.data.get() + s.read_pos, n);
+
+        s.read_pos += n;
+        s.pos += n;
+        out += n;
+        size -= n;
+        total += n;
+    }
+
+    return total;
+}
+
+oc::result<size_t> Win32File::stream_write(const void *buf, size_t size)
+{
+    auto &s = *m_stream;
+
+    if (s.mode != Win32FileStream::Mode::Write) {
+        OUTCOME_TRYV(stream_sync());
+        OUTCOME_TRYV(stream_init());
+        s.mode = Win32FileStream::Mode::Write;
+    }
+
+    if (!s.valid) {
+        s.buffers[s.current].offset = s.pos;
+        s.buffers[s.current].size = 0;
+        s.valid = true;
+    }
+
+    auto *in = static_cast<const unsigned char *>(buf);
+    size_t total = 0;
+
+    while (size > 0) {
+        auto &cur = s.buffers[s.current];
+
+        if (cur.size == 0 && size >= STREAM_BUFFER_SIZE) {
+            // Nothing is buffered, so write directly from the caller's
+            // buffer once the previous background write completes
+            OUTCOME_TRYV(stream_finish(s.current ^ 1));
+            OUTCOME_TRY(n, overlapped_io(
+                    true, s.pos, const_cast<unsigned char *>(in), size));
+            if (n == 0) {
+                break;
+            }
+
+            s.pos += n;
+            in += n;
+            size -= n;
+            total += n;
+            cur.offset = s.pos;
+            continue;
+        }
+
+        auto n = std::min(size, STREAM_BUFFER_SIZE - cur.size);
+        memcpy(cur.data.get() + cur.size, in, n);
+
+        cur.size += n;
+        s.pos += n;
+        in += n;
+        size -= n;
+        total += n;
+
+        if (cur.size == STREAM_BUFFER_SIZE) {
+            // Write this buffer in the background and continue with the
+            // other one once its previous write completes
+            OUTCOME_TRYV(stream_start(s.current, true, cur.offset, cur.size));
+
+            s.current ^= 1;
+
+            OUTCOME_TRYV(stream_finish(s.current));
+            s.buffers[s.current].offset = s.pos;
+            s.buffers[s.current].size = 0;
+        }
+    }
+
+    return total;
+}
+
+oc::result<uint64_t> Win32File::stream_seek(int64_t offset, int whence)
+{
+    auto &s = *m_stream;
+
+    DWORD move_method;
+    LARGE_INTEGER pos;
+    LARGE_INTEGER new_pos;
+
+    switch (whence) {
+    case SEEK_CUR:
+        if (offset > 0 && s.pos > static_cast<uint64_t>(INT64_MAX - offset)) {
+            return FileError::ArgumentOutOfRange;
+        }
+        pos.QuadPart = static_cast<int64_t>(s.pos) + offset;
+        move_method = FILE_BEGIN;
+        break;
+    case SEEK_SET:
+        pos.QuadPart = offset;
+        move_method = FILE_BEGIN;
+        break;
+    case SEEK_END:
+        pos.QuadPart = offset;
+        move_method = FILE_END;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (move_method == FILE_BEGIN && pos.QuadPart >= 0) {
+        auto target = static_cast<uint64_t>(pos.QuadPart);
+
+        // Querying the position must not flush the write-behind buffers
+        if (target == s.pos) {
+            return s.pos;
+        }
+
+        // Seeking within the current read buffer keeps the buffers
+        if (s.mode == Win32FileStream::Mode::Read && s.valid) {
+            auto &cur = s.buffers[s.current];
+
+            if (!cur.pending && target >= cur.offset
+                    && target - cur.offset <= cur.size) {
+                s.read_pos = static_cast<size_t>(target - cur.offset);
+                s.pos = target;
+                return s.pos;
+            }
+        }
+    }
+
+    OUTCOME_TRYV(stream_sync());
+
+    // The file pointer is not used for I/O on overlapped handles, but it is
+    // still updated and validated by the OS
+    bool ret = m_funcs->fn_SetFilePointerEx(
+        m_handle,   // hFile
+        pos,        // liDistanceToMove
+        &new_pos,   // lpNewFilePointer
+        move_method // dwMoveMethod
+    );
+
+    if (!ret) {
+        return ec_from_win32();
+    }
+
+    s.pos = static_cast<uint64_t>(new_pos.QuadPart);
+
+    return s.pos;
+}
+
+/*! \endcond */
+
 }
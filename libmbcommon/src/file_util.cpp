@@ -188,6 +188,145 @@ oc::result<void> file_write_exact(File &file, const void *buf, size_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from a File handle into multiple buffers.
+ *
+ * This function differs from File::read_vectored() in that it will keep
+ * reading until every buffer in \p iov is completely filled. If the underlying
+ * read returns std::errc::interrupted, then the read operation will be
+ * automatically reattempted. If EOF is reached before all of the buffers are
+ * filled, then FileError::UnexpectedEof will be returned.
+ *
+ * If this function fails, the contents of the buffers are unspecified.
+ *
+ * \param[in] file File handle
+ * \param[in] iov Array of buffer descriptors
+ * \param[in] count Number of buffer descriptors in \p iov
+ *
+ * \return Nothing if all of the buffers were successfully filled. Otherwise,
+ *         the error code.
+ */
+oc::result<void> file_read_vectored_exact(File &file, const IoVec *iov,
+                                          size_t count)
+{
+    size_t index = 0;
+    // Number of bytes already read into iov[index]
+    size_t offset = 0;
+
+    while (true) {
+        // Skip buffers that are already full
+        while (index < count && offset == iov[index].size) {
+            ++index;
+            offset = 0;
+        }
+
+        if (index == count) {
+            break;
+        }
+
+        // Finish a partially filled buffer with a normal read so that the
+        // remaining descriptors can be passed through unmodified
+        auto n = offset > 0
+                ? file.read(static_cast<char *>(iov[index].data) + offset,
+                            iov[index].size - offset)
+                : file.read_vectored(iov + index, count - index);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        for (size_t remain = n.value(); remain > 0 && index < count;) {
+            auto avail = iov[index].size - offset;
+
+            if (remain >= avail) {
+                remain -= avail;
+                ++index;
+                offset = 0;
+            } else {
+                offset += remain;
+                remain = 0;
+            }
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write to a File handle from multiple buffers.
+ *
+ * This function differs from File::write_vectored() in that it will keep
+ * writing until every buffer in \p iov is completely written. If the
+ * underlying write returns std::errc::interrupted, then the write operation
+ * will be automatically reattempted. If EOF is reached before all of the
+ * buffers are written, then FileError::UnexpectedEof will be returned.
+ *
+ * If this function fails, it is unspecified how many bytes were written.
+ *
+ * \param file File handle
+ * \param iov Array of buffer descriptors
+ * \param count Number of buffer descriptors in \p iov
+ *
+ * \return Nothing if all of the buffers were successfully written. Otherwise,
+ *         the error code.
+ */
+oc::result<void> file_write_vectored_exact(File &file, const ConstIoVec *iov,
+                                           size_t count)
+{
+    size_t index = 0;
+    // Number of bytes already written from iov[index]
+    size_t offset = 0;
+
+    while (true) {
+        // Skip buffers that are already written
+        while (index < count && offset == iov[index].size) {
+            ++index;
+            offset = 0;
+        }
+
+        if (index == count) {
+            break;
+        }
+
+        // Finish a partially written buffer with a normal write so that the
+        // remaining descriptors can be passed through unmodified
+        auto n = offset > 0
+                ? file.write(static_cast<const char *>(iov[index].data)
+                                     + offset,
+                             iov[index].size - offset)
+                : file.write_vectored(iov + index, count - index);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        for (size_t remain = n.value(); remain > 0 && index < count;) {
+            auto avail = iov[index].size - offset;
+
+            if (remain >= avail) {
+                remain -= avail;
+                ++index;
+                offset = 0;
+            } else {
+                offset += remain;
+                remain = 0;
+            }
+        }
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Read from a File handle and discard the data.
  *
@@ -222,10 +361,28 @@ oc::result<uint64_t> file_read_discard(File &file, uint64_t size)
     return bytes_discarded;
 }
 
+// Single patterns at least this long are searched for with Boyer-Moore. Shorter
+// patterns and multiple patterns use a first byte prefilter instead.
+static constexpr size_t BOYER_MOORE_MIN_PATTERN_SIZE = 8;
+
 /*!
  * \class FileSearcher
  *
- * \brief Search file for binary sequence
+ * \brief Search file for one or more binary sequences
+ */
+
+/*!
+ * \struct FileSearcher::Pattern
+ *
+ * \brief Search pattern
+ *
+ * The data pointed to must remain valid for the lifetime of the FileSearcher.
+ */
+
+/*!
+ * \struct FileSearcher::Match
+ *
+ * \brief Search result
  */
 
 /*!
@@ -236,21 +393,71 @@ oc::result<uint64_t> file_read_discard(File &file, uint64_t size)
  * \param pattern_size Size of pattern
  */
 FileSearcher::FileSearcher(File *file, const void *pattern, size_t pattern_size)
+    : FileSearcher(file, {{pattern, pattern_size}})
+{
+}
+
+/*!
+ * \brief Construct with multiple search patterns
+ *
+ * All patterns are searched for in a single pass through the file. Patterns
+ * with a size of 0 never match.
+ *
+ * \param file File to search
+ * \param patterns Patterns to search for
+ */
+FileSearcher::FileSearcher(File *file, std::vector<Pattern> patterns)
+    : FileSearcher(file, std::move(patterns), DEFAULT_BUFFER_SIZE)
+{
+}
+
+/*!
+ * \brief Construct with multiple search patterns and a specific buffer size
+ *
+ * The buffer is enlarged if needed to fit twice the longest pattern.
+ */
+FileSearcher::FileSearcher(File *file, std::vector<Pattern> patterns,
+                           size_t buf_size)
     : m_file(file)
-    , m_pattern(pattern)
-    , m_pattern_size(pattern_size)
-    , m_searcher({static_cast<const unsigned char *>(pattern),
-                  static_cast<const unsigned char *>(pattern) + pattern_size})
+    , m_patterns(std::move(patterns))
+    , m_max_pattern_size(0)
+    , m_first_bytes()
     , m_region_begin(0)
     , m_region_end(0)
     , m_offset(0)
+    , m_eof(false)
 {
-    auto buf_size = DEFAULT_BUFFER_SIZE;
+    size_t first_byte_count = 0;
+
+    for (auto const &p : m_patterns) {
+        if (p.size == 0) {
+            continue;
+        }
+
+        auto c = *static_cast<const unsigned char *>(p.data);
+        if (!m_first_bytes[c]) {
+            m_first_bytes[c] = true;
+            m_first_byte = c;
+            ++first_byte_count;
+        }
+
+        m_max_pattern_size = std::max(m_max_pattern_size, p.size);
+    }
 
-    if (pattern_size > SIZE_MAX / 2) {
+    if (first_byte_count != 1) {
+        m_first_byte = std::nullopt;
+    }
+
+    if (m_patterns.size() == 1
+            && m_patterns[0].size >= BOYER_MOORE_MIN_PATTERN_SIZE) {
+        auto begin = static_cast<const unsigned char *>(m_patterns[0].data);
+        m_searcher.emplace(begin, begin + m_patterns[0].size);
+    }
+
+    if (m_max_pattern_size > SIZE_MAX / 2) {
         buf_size = SIZE_MAX;
     } else {
-        buf_size = std::max(buf_size, pattern_size * 2);
+        buf_size = std::max(buf_size, m_max_pattern_size * 2);
     }
 
     m_buf.resize(buf_size);
@@ -269,13 +476,16 @@ FileSearcher::FileSearcher(FileSearcher &&other) noexcept
     clear();
 
     std::swap(m_file, other.m_file);
-    std::swap(m_pattern, other.m_pattern);
-    std::swap(m_pattern_size, other.m_pattern_size);
+    std::swap(m_patterns, other.m_patterns);
+    std::swap(m_max_pattern_size, other.m_max_pattern_size);
     std::swap(m_searcher, other.m_searcher);
+    std::swap(m_first_bytes, other.m_first_bytes);
+    std::swap(m_first_byte, other.m_first_byte);
     std::swap(m_buf, other.m_buf);
     std::swap(m_region_begin, other.m_region_begin);
     std::swap(m_region_end, other.m_region_end);
     std::swap(m_offset, other.m_offset);
+    std::swap(m_eof, other.m_eof);
 }
 
 /*!
@@ -292,18 +502,42 @@ FileSearcher & FileSearcher::operator=(FileSearcher &&rhs) noexcept
         clear();
 
         std::swap(m_file, rhs.m_file);
-        std::swap(m_pattern, rhs.m_pattern);
-        std::swap(m_pattern_size, rhs.m_pattern_size);
+        std::swap(m_patterns, rhs.m_patterns);
+        std::swap(m_max_pattern_size, rhs.m_max_pattern_size);
         std::swap(m_searcher, rhs.m_searcher);
+        std::swap(m_first_bytes, rhs.m_first_bytes);
+        std::swap(m_first_byte, rhs.m_first_byte);
         std::swap(m_buf, rhs.m_buf);
         std::swap(m_region_begin, rhs.m_region_begin);
         std::swap(m_region_end, rhs.m_region_end);
         std::swap(m_offset, rhs.m_offset);
+        std::swap(m_eof, rhs.m_eof);
     }
 
     return *this;
 }
 
+/*!
+ * \brief Find next match in the file
+ *
+ * This is equivalent to next_match(), except only the offset is returned.
+ *
+ * \return
+ *   * The match offset if a pattern is found
+ *   * std::nullopt if there are no more matches
+ *   * Otherwise, an appropriate error code
+ */
+oc::result<std::optional<uint64_t>> FileSearcher::next()
+{
+    OUTCOME_TRY(match, next_match());
+
+    if (match) {
+        return match->offset;
+    } else {
+        return std::nullopt;
+    }
+}
+
 /*!
  * \brief Find next match in the file
  *
@@ -314,84 +548,422 @@ FileSearcher & FileSearcher::operator=(FileSearcher &&rhs) noexcept
  * However, the file position *must* be restored to the original position before
  * the next call to this function. Note that the file position is not guaranteed
  * (and even unlikely) to equal the match offset due to in-memory buffering.
-  *
+ *
  * \note We do not do overlapping searches. For example, if a file's contents
  *       is `ababababab` and the search pattern is `abab`, the resulting offsets
  *       will be (0 and 4), *not* (0, 2, 4, 6). In other words, the next search
  *       begins at the end of the curent match.
  *
+ * \note If multiple patterns match at the same offset, the one that appears
+ *       first in the pattern list is returned.
+ *
  * \note The file position after this function returns is unspecified. Be sure
  *       to seek to a known location before attempting further read or write
  *       operations.
  *
  * \return
- *   * The match offset if the pattern is found
+ *   * The match if a pattern is found
  *   * std::nullopt if there are no more matches
  *   * Otherwise, an appropriate error code
  */
-oc::result<std::optional<uint64_t>> FileSearcher::next()
+oc::result<std::optional<FileSearcher::Match>> FileSearcher::next_match()
 {
     if (!m_file) {
         return FileError::InvalidState;
     }
 
-    if (m_pattern_size == 0) {
+    if (m_max_pattern_size == 0) {
         return std::nullopt;
     }
 
     while (true) {
         // Find pattern in current buffer
-        if (auto it = std2::search(m_buf.data() + m_region_begin,
-                                   m_buf.data() + m_region_end, *m_searcher);
-                it != m_buf.data() + m_region_end) {
-            auto match_index = static_cast<size_t>(it - m_buf.data());
-            auto match_offset = m_offset + match_index;
-
-            // We don't do overlapping searches
-            m_region_begin += match_index + m_pattern_size;
-
-            return match_offset;
+        if (auto match = search_region()) {
+            return match;
+        } else if (m_eof) {
+            return std::nullopt;
         }
 
-        // If the pattern is not found, up to pattern_size - 1 bytes may still
-        // match, so move those to the beginning. We will move fewer than
-        // pattern_size - 1 bytes if there was a match close to the end.
-        auto to_move = std::min(m_region_end - m_region_begin,
-                                m_pattern_size - 1);
-        m_offset += m_region_end - to_move;
-        memmove(m_buf.data(), m_buf.data() + m_region_end - to_move, to_move);
+        // search_region() leaves the unsearched tail, which is shorter than
+        // the longest pattern, in the region, so move it to the beginning.
+        auto to_move = m_region_end - m_region_begin;
+        m_offset += m_region_begin;
+        memmove(m_buf.data(), m_buf.data() + m_region_begin, to_move);
         m_region_begin = 0;
         m_region_end = to_move;
 
         // Fill up buffer. Dereferencing m_buf_end is always okay because it is
-        // guaranteed to be m_pattern_size - 1 bytes or less into the buffer.
+        // guaranteed to be m_max_pattern_size - 1 bytes or less into the
+        // buffer.
         OUTCOME_TRY(n, file_read_retry(*m_file, m_buf.data() + m_region_end,
                                        m_buf.size() - m_region_end));
 
         m_region_end += n;
 
-        if (m_region_end < m_pattern_size) {
-            // Reached EOF
-            return std::nullopt;
+        if (n == 0) {
+            // Reached EOF. Search the tail once more for shorter patterns.
+            m_eof = true;
         }
 
         // Ensure match offset cannot overflow
-        if (m_offset > UINT64_MAX - (m_region_end - m_pattern_size)) {
+        if (m_offset > UINT64_MAX - m_region_end) {
             return std::errc::result_out_of_range;
         }
     }
 }
 
+namespace
+{
+
+/*!
+ * \brief Read-only view of a range of a file
+ *
+ * Reads are done with File::read_at(), so multiple views of the same file can
+ * be read from concurrently if the file implements it natively.
+ */
+class FileRangeView final : public File
+{
+public:
+    FileRangeView(File &file, uint64_t offset, uint64_t size)
+        : m_file(file), m_offset(offset), m_size(size), m_pos(0)
+    {
+    }
+
+    oc::result<void> close() override
+    {
+        return oc::success();
+    }
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(size, m_size - m_pos));
+        if (to_read == 0) {
+            return 0;
+        }
+
+        OUTCOME_TRY(n, m_file.read_at(m_offset + m_pos, buf, to_read));
+
+        m_pos += n;
+        return n;
+    }
+
+    oc::result<size_t> write(const void *buf, size_t size) override
+    {
+        (void) buf;
+        (void) size;
+        return FileError::UnsupportedWrite;
+    }
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        (void) offset;
+        (void) whence;
+        return FileError::UnsupportedSeek;
+    }
+
+    oc::result<void> truncate(uint64_t size) override
+    {
+        (void) size;
+        return FileError::UnsupportedTruncate;
+    }
+
+    bool is_open() override
+    {
+        return true;
+    }
+
+private:
+    File &m_file;
+    uint64_t m_offset;
+    uint64_t m_size;
+    uint64_t m_pos;
+};
+
+}
+
+/*!
+ * \brief Search a range of a file with a sequential FileSearcher
+ *
+ * \param file File to search
+ * \param begin Offset to start searching at
+ * \param end Only matches starting before this offset are returned
+ * \param limit End of the data that may be read
+ * \param patterns Patterns to search for
+ * \param matches Matches are appended here, relative to offset 0
+ */
+oc::result<void>
+FileSearcher::search_range(File &file, uint64_t begin, uint64_t end,
+                           uint64_t limit, const std::vector<Pattern> &patterns,
+                           std::vector<Match> &matches)
+{
+    FileRangeView view(file, begin, limit - begin);
+    // No need for a buffer larger than the range
+    FileSearcher searcher(&view, patterns, static_cast<size_t>(
+            std::min<uint64_t>(limit - begin, DEFAULT_BUFFER_SIZE)));
+
+    while (true) {
+        OUTCOME_TRY(match, searcher.next_match());
+
+        if (!match || begin + match->offset >= end) {
+            break;
+        }
+
+        matches.push_back({begin + match->offset, match->pattern});
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Search a file for one or more binary sequences on multiple threads
+ *
+ * The range is split into chunks that are searched concurrently. Each chunk
+ * is read together with the first `longest pattern size - 1` bytes of the next
+ * chunk so that matches crossing a chunk boundary are found. The results are
+ * identical to those of next_match() with a sequential FileSearcher, including
+ * the handling of overlapping matches.
+ *
+ * \note The file must implement read_at() natively (eg. FdFile on Unix-like
+ *       systems or MemoryFile) because it is read from multiple threads at the
+ *       same time.
+ *
+ * \param file File to search
+ * \param offset Offset to start searching at
+ * \param size Number of bytes to search
+ * \param patterns Patterns to search for
+ * \param pool Thread pool to search the chunks on
+ * \param chunk_size Number of bytes each task searches
+ *
+ * \return
+ *   * The matches in offset order. The offsets are relative to \p offset.
+ *   * Otherwise, the error code for the first chunk that failed
+ */
+oc::result<std::vector<FileSearcher::Match>>
+FileSearcher::search_parallel(File &file, uint64_t offset, uint64_t size,
+                              const std::vector<Pattern> &patterns,
+                              ThreadPool &pool, uint64_t chunk_size)
+{
+    if (size > UINT64_MAX - offset) {
+        return std::errc::result_out_of_range;
+    }
+
+    size_t max_pattern_size = 0;
+    for (auto const &p : patterns) {
+        max_pattern_size = std::max(max_pattern_size, p.size);
+    }
+
+    std::vector<Match> result;
+
+    if (size == 0 || max_pattern_size == 0) {
+        return std::move(result);
+    }
+
+    chunk_size = std::max<uint64_t>(chunk_size, 1);
+
+    auto file_end = offset + size;
+    auto overlap = static_cast<uint64_t>(max_pattern_size - 1);
+    auto n_chunks = static_cast<size_t>((size - 1) / chunk_size + 1);
+
+    auto chunk_begin = [&](size_t i) {
+        return offset + static_cast<uint64_t>(i) * chunk_size;
+    };
+    auto chunk_end = [&](size_t i) {
+        return std::min(chunk_begin(i) + chunk_size, file_end);
+    };
+    auto chunk_limit = [&](size_t i) {
+        return chunk_end(i) + std::min(overlap, file_end - chunk_end(i));
+    };
+
+    std::vector<std::vector<Match>> chunk_matches(n_chunks);
+
+    {
+        TaskGroup group(pool);
+
+        for (size_t i = 0; i < n_chunks; ++i) {
+            group.run([&, i]() -> oc::result<void> {
+                return search_range(file, chunk_begin(i), chunk_end(i),
+                                    chunk_limit(i), patterns,
+                                    chunk_matches[i]);
+            });
+        }
+
+        OUTCOME_TRYV(group.wait());
+    }
+
+    // Merge the results. Matches are not allowed to overlap, so a match that
+    // crosses into the next chunk may hide matches that the next chunk found
+    // near its beginning. In that case, the chunk is searched again starting
+    // from the end of the previous match, which is rare.
+    uint64_t next_allowed = offset;
+
+    for (size_t i = 0; i < n_chunks; ++i) {
+        auto &matches = chunk_matches[i];
+
+        if (!matches.empty() && matches.front().offset < next_allowed) {
+            matches.clear();
+
+            if (next_allowed < chunk_end(i)) {
+                OUTCOME_TRYV(search_range(file, next_allowed, chunk_end(i),
+                                          chunk_limit(i), patterns, matches));
+            }
+        }
+
+        for (auto const &m : matches) {
+            result.push_back({m.offset - offset, m.pattern});
+            next_allowed = m.offset + patterns[m.pattern].size;
+        }
+    }
+
+    return std::move(result);
+}
+
+/*!
+ * \brief Search the current region of the buffer
+ *
+ * If no match is found, the region is shrunk to the tail that could still
+ * contain the beginning of a match once more data is read.
+ */
+std::optional<FileSearcher::Match> FileSearcher::search_region()
+{
+    const unsigned char *buf = m_buf.data();
+    auto *begin = buf + m_region_begin;
+    auto *end = buf + m_region_end;
+
+    if (m_searcher) {
+        auto const &pattern = m_patterns[0];
+
+        if (auto it = std2::search(begin, end, *m_searcher); it != end) {
+            auto match_index = static_cast<size_t>(it - buf);
+
+            // We don't do overlapping searches
+            m_region_begin = match_index + pattern.size;
+
+            return Match{m_offset + match_index, 0};
+        }
+
+        // If the pattern is not found, up to pattern_size - 1 bytes may still
+        // match. We will keep fewer than pattern_size - 1 bytes if there was a
+        // match close to the end.
+        m_region_begin = m_region_end - std::min(m_region_end - m_region_begin,
+                                                 pattern.size - 1);
+        return std::nullopt;
+    }
+
+    for (auto *it = begin; (it = find_candidate(it, end)) != end; ++it) {
+        auto avail = static_cast<size_t>(end - it);
+
+        for (size_t i = 0; i < m_patterns.size(); ++i) {
+            auto const &pattern = m_patterns[i];
+
+            if (pattern.size == 0) {
+                continue;
+            } else if (pattern.size > avail) {
+                if (m_eof) {
+                    continue;
+                }
+
+                // Not enough data to rule out a match at this offset
+                m_region_begin = static_cast<size_t>(it - buf);
+                return std::nullopt;
+            } else if (memcmp(it, pattern.data, pattern.size) == 0) {
+                auto match_index = static_cast<size_t>(it - buf);
+
+                // We don't do overlapping searches
+                m_region_begin = match_index + pattern.size;
+
+                return Match{m_offset + match_index, i};
+            }
+        }
+    }
+
+    m_region_begin = m_region_end;
+    return std::nullopt;
+}
+
+/*!
+ * \brief Find the next byte in [\p begin, \p end) that begins any pattern
+ */
+const unsigned char * FileSearcher::find_candidate(const unsigned char *begin,
+                                                   const unsigned char *end) const
+{
+    if (m_first_byte) {
+        // memchr() is vectorized in every libc we care about
+        auto *ptr = memchr(begin, *m_first_byte,
+                           static_cast<size_t>(end - begin));
+        return ptr ? static_cast<const unsigned char *>(ptr) : end;
+    }
+
+    return std::find_if(begin, end, [&](unsigned char c) {
+        return m_first_bytes[c];
+    });
+}
+
 void FileSearcher::clear() noexcept
 {
     m_file = nullptr;
-    m_pattern = nullptr;
-    m_pattern_size = 0;
+    m_patterns.clear();
+    m_max_pattern_size = 0;
     m_searcher = std::nullopt;
+    m_first_bytes.fill(false);
+    m_first_byte = std::nullopt;
     m_buf.clear();
     m_region_begin = 0;
     m_region_end = 0;
     m_offset = 0;
+    m_eof = false;
+}
+
+static constexpr size_t FILE_MOVE_BUFFER_SIZE = 1024 * 1024;
+
+static oc::result<size_t> read_at_retry(File &file, uint64_t offset,
+                                        void *buf, size_t size)
+{
+    size_t bytes_read = 0;
+
+    while (bytes_read < size) {
+        auto n = file.read_at(offset + bytes_read,
+                              static_cast<char *>(buf) + bytes_read,
+                              size - bytes_read);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        bytes_read += n.value();
+    }
+
+    return bytes_read;
+}
+
+static oc::result<size_t> write_at_retry(File &file, uint64_t offset,
+                                         const void *buf, size_t size)
+{
+    size_t bytes_written = 0;
+
+    while (bytes_written < size) {
+        auto n = file.write_at(offset + bytes_written,
+                               static_cast<const char *>(buf) + bytes_written,
+                               size - bytes_written);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        bytes_written += n.value();
+    }
+
+    return bytes_written;
 }
 
 /*!
@@ -402,9 +974,10 @@ void FileSearcher::clear() noexcept
  * case where \p src == \p dest or \p size == 0, no operation will be performed,
  * but the function will return \p size accordingly.
  *
- * \note This function is very seek-heavy and may be slow if the handle cannot
- *       seek efficiently. It will perform two seeks per loop interation. Each
- *       iteration moves up to 10240 bytes.
+ * \note This function uses File::read_at() and File::write_at(). If the handle
+ *       does not implement them natively, it will perform several seeks per
+ *       loop iteration and may be slow if the handle cannot seek efficiently.
+ *       Each iteration moves up to 1 MiB.
  *
  * \note If the return value, \p r, is less than \p size, then the *first* \p r
  *       bytes have been copied from offset \p src to offset \p dest. This is
@@ -431,32 +1004,29 @@ oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
         return FileError::ArgumentOutOfRange;
     }
 
-    char buf[10240];
+    std::vector<unsigned char> buf(static_cast<size_t>(
+            std::min<uint64_t>(FILE_MOVE_BUFFER_SIZE, size)));
     uint64_t size_moved = 0;
     const bool copy_forwards = dest < src;
 
     while (size_moved < size) {
-        auto to_read = std::min<uint64_t>(sizeof(buf), size - size_moved);
-
-        // Seek to source offset
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(
-                copy_forwards ? src + size_moved
-                        : src + size - size_moved - to_read), SEEK_SET));
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(buf.size(), size - size_moved));
 
         // Read data from source
-        OUTCOME_TRY(n_read, file_read_retry(
-                file, buf, static_cast<size_t>(to_read)));
+        OUTCOME_TRY(n_read, read_at_retry(
+                file, copy_forwards ? src + size_moved
+                        : src + size - size_moved - to_read,
+                buf.data(), to_read));
         if (n_read == 0) {
             break;
         }
 
-        // Seek to destination offset
-        OUTCOME_TRYV(file.seek(static_cast<int64_t>(
-                copy_forwards ? dest + size_moved
-                        : dest + size - size_moved - n_read), SEEK_SET));
-
         // Write data to destination
-        OUTCOME_TRY(n_written, file_write_retry(file, buf, n_read));
+        OUTCOME_TRY(n_written, write_at_retry(
+                file, copy_forwards ? dest + size_moved
+                        : dest + size - size_moved - n_read,
+                buf.data(), n_read));
 
         size_moved += n_written;
 
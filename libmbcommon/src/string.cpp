@@ -161,68 +161,166 @@ std::string format(const char *fmt, ...)
  * \return Resulting formatted string or error.
  */
 oc::result<std::string> format_v_safe(const char *fmt, va_list ap)
+{
+    std::string buf;
+
+    OUTCOME_TRYV(format_v_to_safe(buf, fmt, ap));
+
+    return buf;
+}
+
+/*!
+ * \brief Format a string using a `va_list`
+ *
+ * \note This uses the `*printf()` family of functions in the system's C
+ *       library. The format string may not be understood the same way by every
+ *       platform.
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are preserved if
+ *       this function does not fail.
+ *
+ * \param fmt Format string
+ * \param ap Format arguments as `va_list`
+ *
+ * \return Resulting formatted string.
+ * \throws std::exception If an error occurs while formatting the string.
+ */
+std::string format_v(const char *fmt, va_list ap)
+{
+    auto result = format_v_safe(fmt, ap);
+    if (!result) {
+        // TODO: This should use exceptions to report errors, but we currently
+        // don't support them due to the substantial size increase of the
+        // compiled binaries.
+        std::terminate();
+    }
+    return std::move(result.value());
+}
+
+/*!
+ * \brief Format a string and append it to a buffer
+ *
+ * This behaves like format_safe(), but appends the result to \p out instead of
+ * returning a new string. Reusing the same buffer avoids an allocation per call
+ * once it has grown large enough.
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are preserved if
+ *       this function does not fail.
+ *
+ * \param[in,out] out Buffer to append to. It is left unchanged on failure.
+ * \param fmt Format string
+ * \param ... Format arguments
+ *
+ * \return Nothing if successful or the error code if formatting fails.
+ */
+oc::result<void> format_to_safe(std::string &out, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    auto result = format_v_to_safe(out, fmt, ap);
+    va_end(ap);
+
+    return result;
+}
+
+/*!
+ * \brief Format a string and append it to a buffer
+ *
+ * \see format_to_safe()
+ *
+ * \param[in,out] out Buffer to append to
+ * \param fmt Format string
+ * \param ... Format arguments
+ *
+ * \throws std::exception If an error occurs while formatting the string.
+ */
+void format_to(std::string &out, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    format_v_to(out, fmt, ap);
+    va_end(ap);
+}
+
+/*!
+ * \brief Format a string using a `va_list` and append it to a buffer
+ *
+ * Most strings fit in a small stack buffer, in which case the format string is
+ * only processed once. Otherwise, the result is written directly into \p out.
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are always
+ *       preserved.
+ *
+ * \param[in,out] out Buffer to append to. It is left unchanged on failure.
+ * \param fmt Format string
+ * \param ap Format arguments as `va_list`
+ *
+ * \return Nothing if successful or the error code if formatting fails.
+ */
+oc::result<void> format_v_to_safe(std::string &out, const char *fmt,
+                                  va_list ap)
 {
     static_assert(INT_MAX <= SIZE_MAX, "INT_MAX > SIZE_MAX");
 
     ErrorRestorer restorer;
+    char small[256];
     int ret;
     va_list copy;
-    std::string buf;
 
     va_copy(copy, ap);
-    ret = vsnprintf(nullptr, 0, fmt, copy);
+    ret = vsnprintf(small, sizeof(small), fmt, copy);
     va_end(copy);
 
     if (ret < 0) {
         return ec_from_errno();
-    } else if (static_cast<size_t>(ret) == SIZE_MAX) {
+    } else if (static_cast<size_t>(ret) < sizeof(small)) {
+        out.append(small, static_cast<size_t>(ret));
+        return oc::success();
+    } else if (static_cast<size_t>(ret) >= SIZE_MAX - out.size()) {
         return std::make_error_code(std::errc::value_too_large);
     }
 
     // C++11 guarantees that the memory is contiguous, but does not guarantee
     // that the internal buffer is NULL-terminated, so we'll make room for '\0'
     // and then get rid of it.
-    buf.resize(static_cast<size_t>(ret) + 1);
+    auto old_size = out.size();
+    out.resize(old_size + static_cast<size_t>(ret) + 1);
 
     va_copy(copy, ap);
-    ret = vsnprintf(buf.data(), buf.size(), fmt, copy);
+    ret = vsnprintf(out.data() + old_size, out.size() - old_size, fmt, copy);
     va_end(copy);
 
     if (ret < 0) {
+        out.resize(old_size);
         return ec_from_errno();
     }
 
-    buf.resize(static_cast<size_t>(ret));
+    out.resize(old_size + static_cast<size_t>(ret));
 
-    return std::move(buf);
+    return oc::success();
 }
 
 /*!
- * \brief Format a string using a `va_list`
+ * \brief Format a string using a `va_list` and append it to a buffer
  *
- * \note This uses the `*printf()` family of functions in the system's C
- *       library. The format string may not be understood the same way by every
- *       platform.
- *
- * \note The value of `errno` and `GetLastError()` (on Win32) are preserved if
- *       this function does not fail.
+ * \see format_v_to_safe()
  *
+ * \param[in,out] out Buffer to append to
  * \param fmt Format string
  * \param ap Format arguments as `va_list`
  *
- * \return Resulting formatted string.
  * \throws std::exception If an error occurs while formatting the string.
  */
-std::string format_v(const char *fmt, va_list ap)
+void format_v_to(std::string &out, const char *fmt, va_list ap)
 {
-    auto result = format_v_safe(fmt, ap);
-    if (!result) {
+    if (!format_v_to_safe(out, fmt, ap)) {
         // TODO: This should use exceptions to report errors, but we currently
         // don't support them due to the substantial size increase of the
         // compiled binaries.
         std::terminate();
     }
-    return std::move(result.value());
 }
 
 /*!
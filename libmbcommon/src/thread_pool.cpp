@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+/*!
+ * \file mbcommon/thread_pool.h
+ * \brief Shared pool of worker threads
+ */
+
+namespace mb
+{
+
+// Pool that the current thread is a worker of and its queue index. These are
+// plain pointers/integers so there is no TLS constructor or destructor, which
+// does not work reliably in static executables.
+static thread_local ThreadPool *t_pool = nullptr;
+static thread_local size_t t_index = 0;
+
+/*!
+ * \class CancellationToken
+ *
+ * \brief Cooperative cancellation flag
+ *
+ * Copies of a token share the same state, so a task can capture a copy and
+ * periodically check is_cancelled() to stop early.
+ */
+
+/*!
+ * \brief Construct a token that is not cancelled
+ */
+CancellationToken::CancellationToken()
+    : m_cancelled(std::make_shared<std::atomic_bool>(false))
+{
+}
+
+/*!
+ * \brief Cancel the token and all of its copies
+ */
+void CancellationToken::cancel()
+{
+    m_cancelled->store(true, std::memory_order_release);
+}
+
+/*!
+ * \brief Check whether the token has been cancelled
+ */
+bool CancellationToken::is_cancelled() const
+{
+    return m_cancelled->load(std::memory_order_acquire);
+}
+
+/*!
+ * \class ThreadPool
+ *
+ * \brief Fixed set of worker threads with a bounded task queue
+ *
+ * Each worker has its own queue. Tasks submitted from outside the pool are
+ * distributed among the queues round-robin and tasks submitted from a worker
+ * go to that worker's queue. A worker runs the tasks from its own queue in
+ * order and steals the oldest task from another queue when its own is empty.
+ *
+ * At most `capacity` tasks can be queued. submit() blocks while the queue is
+ * full, except when called from a worker thread, where the task is run
+ * immediately instead so that a full pool cannot deadlock on itself.
+ *
+ * \note Threads do not survive `fork()`. A pool must not be used in a child
+ *       process that was forked after the pool was created.
+ */
+
+/*!
+ * \var ThreadPool::DEFAULT_CAPACITY
+ *
+ * \brief Default maximum number of queued tasks
+ */
+
+/*!
+ * \brief Start a pool
+ *
+ * \param threads Number of worker threads. If 0, the number of CPUs is used.
+ * \param capacity Maximum number of queued tasks. If 0, the default capacity is
+ *                 used.
+ */
+ThreadPool::ThreadPool(unsigned int threads, size_t capacity)
+    : m_capacity(capacity == 0 ? DEFAULT_CAPACITY : capacity)
+    , m_reserved(0)
+    , m_available(0)
+    , m_next(0)
+    , m_stop(false)
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    m_queues.reserve(threads);
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_queues.push_back(std::make_unique<Queue>());
+    }
+
+    m_threads.reserve(threads);
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_threads.emplace_back(&ThreadPool::worker, this, i);
+    }
+}
+
+/*!
+ * \brief Run all queued tasks and stop the worker threads
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_cv_queued.notify_all();
+
+    for (auto &t : m_threads) {
+        t.join();
+    }
+}
+
+/*!
+ * \brief Queue a task
+ *
+ * This blocks while the queue is full. If called from one of the pool's worker
+ * threads while the queue is full, the task is run on the calling thread
+ * before this function returns.
+ *
+ * \param task Task to run
+ */
+void ThreadPool::submit(Task task)
+{
+    (void) push(task, true);
+}
+
+/*!
+ * \brief Queue a task if there is room
+ *
+ * \param task Task to run
+ *
+ * \return Whether the task was queued. If false, \p task is left untouched.
+ */
+bool ThreadPool::try_submit(Task task)
+{
+    return push(task, false);
+}
+
+/*!
+ * \brief Get number of worker threads
+ */
+unsigned int ThreadPool::size() const
+{
+    return static_cast<unsigned int>(m_threads.size());
+}
+
+/*!
+ * \brief Get the process-wide pool
+ *
+ * The pool has one thread per CPU and is started on first use. Subsystems
+ * should use this instead of creating their own threads so that concurrent
+ * operations do not oversubscribe the CPUs.
+ */
+ThreadPool & ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+bool ThreadPool::push(Task &task, bool block)
+{
+    size_t index;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        if (m_reserved >= m_capacity) {
+            if (!block) {
+                return false;
+            } else if (is_worker()) {
+                lock.unlock();
+                task();
+                return true;
+            }
+
+            m_cv_space.wait(lock, [&] {
+                return m_reserved < m_capacity;
+            });
+        }
+
+        ++m_reserved;
+        index = is_worker() ? t_index : m_next++ % m_queues.size();
+    }
+
+    {
+        auto &queue = *m_queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_available;
+    }
+
+    m_cv_queued.notify_one();
+
+    return true;
+}
+
+/*!
+ * \brief Claim and run one queued task
+ *
+ * \param block Whether to wait for a task to be queued
+ *
+ * \return Whether a task was run. If \p block is true, false is only returned
+ *         once the pool is stopped and all tasks have run.
+ */
+bool ThreadPool::run_one(bool block)
+{
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        if (block) {
+            m_cv_queued.wait(lock, [&] {
+                return m_available > 0 || m_stop;
+            });
+        }
+
+        if (m_available == 0) {
+            return false;
+        }
+
+        --m_available;
+    }
+
+    auto task = take(is_worker() ? t_index : 0);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_reserved;
+    }
+
+    m_cv_space.notify_one();
+
+    task();
+
+    return true;
+}
+
+/*!
+ * \brief Remove a claimed task from the queues
+ *
+ * The caller must have claimed a task by decrementing m_available, which
+ * guarantees that one can be found.
+ *
+ * \param first Queue to look in first
+ */
+ThreadPool::Task ThreadPool::take(size_t first)
+{
+    size_t n = m_queues.size();
+
+    while (true) {
+        for (size_t i = 0; i < n; ++i) {
+            auto &queue = *m_queues[(first + i) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+
+            if (queue.tasks.empty()) {
+                continue;
+            }
+
+            auto task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return task;
+        }
+
+        // Another claimed task is still being pushed or another thread took
+        // the task from a queue that was already checked
+        std::this_thread::yield();
+    }
+}
+
+bool ThreadPool::is_worker() const
+{
+    return t_pool == this;
+}
+
+void ThreadPool::worker(size_t index)
+{
+    t_pool = this;
+    t_index = index;
+
+    while (run_one(true));
+}
+
+/*!
+ * \class TaskGroup
+ *
+ * \brief Set of related tasks on a ThreadPool that can be waited on together
+ *
+ * When a task fails, the group's cancellation token is cancelled and tasks
+ * of the group that have not started yet are skipped. Running tasks can check
+ * token() to stop early.
+ *
+ * While waiting, the calling thread runs queued tasks of the pool, so groups
+ * can be nested inside tasks without exhausting the worker threads.
+ */
+
+/*!
+ * \brief Construct a group
+ *
+ * \param pool Pool to run the tasks on. It must outlive the group.
+ */
+TaskGroup::TaskGroup(ThreadPool &pool)
+    : m_pool(pool)
+    , m_state(std::make_shared<State>())
+{
+}
+
+/*!
+ * \brief Wait for all tasks of the group
+ *
+ * Errors that have not been collected with wait() are discarded.
+ */
+TaskGroup::~TaskGroup()
+{
+    (void) wait();
+}
+
+/*!
+ * \brief Queue a task in the group
+ *
+ * This blocks while the pool's queue is full. If the group was cancelled, the
+ * task is not queued.
+ *
+ * \param task Task to run
+ */
+void TaskGroup::run(Task task)
+{
+    if (m_token.is_cancelled()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        ++m_state->pending;
+    }
+
+    m_pool.submit([state = m_state, token = m_token,
+                   task = std::move(task)]() mutable {
+        if (!token.is_cancelled()) {
+            if (auto ret = task(); !ret) {
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->error) {
+                        state->error = ret.error();
+                    }
+                }
+                token.cancel();
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (--state->pending == 0) {
+            state->cv.notify_all();
+        }
+    });
+}
+
+/*!
+ * \brief Wait for all queued tasks of the group to complete
+ *
+ * \return Nothing if all tasks succeeded. Otherwise, the error of the first task
+ *         that failed is returned or `std::errc::operation_canceled` if the
+ *         group was cancelled with cancel(). The group remains cancelled.
+ */
+oc::result<void> TaskGroup::wait()
+{
+    auto &state = *m_state;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (state.pending == 0) {
+                break;
+            }
+        }
+
+        if (m_pool.run_one(false)) {
+            continue;
+        }
+
+        // All of the group's tasks are running. Recheck periodically in case
+        // one of them queues more work that nothing else is free to pick up.
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.cv.wait_for(lock, std::chrono::milliseconds(10), [&] {
+            return state.pending == 0;
+        });
+    }
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    if (auto ec = std::exchange(state.error, {})) {
+        return ec;
+    } else if (m_token.is_cancelled()) {
+        return std::errc::operation_canceled;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Cancel the group
+ *
+ * Tasks that have not started yet are skipped and new tasks are not queued.
+ */
+void TaskGroup::cancel()
+{
+    m_token.cancel();
+}
+
+/*!
+ * \brief Get the group's cancellation token
+ */
+const CancellationToken & TaskGroup::token() const
+{
+    return m_token;
+}
+
+}
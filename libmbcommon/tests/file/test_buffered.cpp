@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <memory>
+
+#include <cstring>
+
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+
+#include "mock_test_file.h"
+
+using namespace mb;
+using namespace testing;
+
+// MockFile that forwards to a MemoryFile so that calls can be counted
+struct BufferedFileTest : Test
+{
+    char m_data[32];
+    MemoryFile m_mem;
+    NiceMock<MockFile> m_file;
+
+    BufferedFileTest()
+    {
+        for (size_t i = 0; i < sizeof(m_data); ++i) {
+            m_data[i] = static_cast<char>('a' + i % 26);
+        }
+
+        (void) m_mem.open(m_data, sizeof(m_data));
+
+        ON_CALL(m_file, read(_, _))
+                .WillByDefault(Invoke(&m_mem, &MemoryFile::read));
+        ON_CALL(m_file, write(_, _))
+                .WillByDefault(Invoke(&m_mem, &MemoryFile::write));
+        ON_CALL(m_file, seek(_, _))
+                .WillByDefault(Invoke(&m_mem, &MemoryFile::seek));
+        ON_CALL(m_file, truncate(_))
+                .WillByDefault(Invoke(&m_mem, &MemoryFile::truncate));
+        ON_CALL(m_file, is_open())
+                .WillByDefault(Return(true));
+    }
+};
+
+TEST_F(BufferedFileTest, CheckInvalidStates)
+{
+    BufferedFile file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_EQ(file.flush(), error);
+
+    ASSERT_TRUE(file.open(m_file));
+    ASSERT_EQ(file.open(m_file), error);
+}
+
+TEST_F(BufferedFileTest, OpenZeroBlockSize)
+{
+    BufferedFile file;
+    ASSERT_EQ(file.open(m_file, 0),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_FALSE(file.is_open());
+}
+
+TEST_F(BufferedFileTest, OpenPropagatesSeekError)
+{
+    EXPECT_CALL(m_file, seek(0, SEEK_CUR))
+            .WillOnce(Return(std::make_error_code(std::errc::io_error)));
+
+    BufferedFile file;
+    ASSERT_EQ(file.open(m_file),
+              oc::failure(std::make_error_code(std::errc::io_error)));
+    ASSERT_FALSE(file.is_open());
+}
+
+TEST_F(BufferedFileTest, ReadAhead)
+{
+    EXPECT_CALL(m_file, read(_, _))
+            .Times(2);
+
+    BufferedFile file(m_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+
+    // First read fills the buffer
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(sizeof(buf)));
+        ASSERT_EQ(memcmp(buf, m_data + i * 4, sizeof(buf)), 0);
+    }
+
+    // Buffer is exhausted, so this fetches the next block
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, m_data + 16, sizeof(buf)), 0);
+}
+
+TEST_F(BufferedFileTest, LargeReadBypassesBuffer)
+{
+    EXPECT_CALL(m_file, read(_, 20))
+            .Times(1);
+
+    BufferedFile file(m_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[20];
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, m_data, sizeof(buf)), 0);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(20u));
+}
+
+TEST_F(BufferedFileTest, SeekWithinBuffer)
+{
+    // Only the position probe in open() and the rewind in close()
+    EXPECT_CALL(m_file, seek(0, SEEK_CUR))
+            .Times(1);
+    EXPECT_CALL(m_file, seek(Ne(0), SEEK_CUR))
+            .Times(1);
+    EXPECT_CALL(m_file, seek(_, SEEK_SET))
+            .Times(0);
+
+    BufferedFile file(m_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, 'a');
+
+    ASSERT_EQ(file.seek(10, SEEK_SET), oc::success(10u));
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, 'k');
+
+    ASSERT_EQ(file.seek(-5, SEEK_CUR), oc::success(6u));
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, 'g');
+
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(7u));
+    ASSERT_EQ(file.seek(-8, SEEK_CUR),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(BufferedFileTest, SeekOutsideBuffer)
+{
+    BufferedFile file(m_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+
+    EXPECT_CALL(m_file, seek(_, _))
+            .Times(AnyNumber());
+    EXPECT_CALL(m_file, seek(30, SEEK_SET))
+            .Times(1);
+    ASSERT_EQ(file.seek(30, SEEK_SET), oc::success(30u));
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, m_data[30]);
+
+    ASSERT_EQ(file.seek(-2, SEEK_END), oc::success(30u));
+    ASSERT_EQ(file.read(&c, 1), oc::success(1u));
+    ASSERT_EQ(c, m_data[30]);
+}
+
+TEST_F(BufferedFileTest, WriteBehind)
+{
+    {
+        InSequence seq;
+
+        EXPECT_CALL(m_file, write(_, 8))
+                .Times(1);
+        EXPECT_CALL(m_file, write(_, 4))
+                .Times(1);
+    }
+
+    BufferedFile file(m_file, 8);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("ABCD", 4), oc::success(4u));
+    ASSERT_EQ(file.write("EFGH", 4), oc::success(4u));
+    ASSERT_EQ(memcmp(m_data, "abcd", 4), 0);
+
+    // Buffer is full, so this flushes the first 8 bytes
+    ASSERT_EQ(file.write("IJKL", 4), oc::success(4u));
+    ASSERT_EQ(memcmp(m_data, "ABCDEFGHijkl", 12), 0);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(12u));
+
+    ASSERT_TRUE(file.flush());
+    ASSERT_EQ(memcmp(m_data, "ABCDEFGHIJKL", 12), 0);
+}
+
+TEST_F(BufferedFileTest, SeekFlushesWrites)
+{
+    BufferedFile file(m_file, 8);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("AB", 2), oc::success(2u));
+    ASSERT_EQ(file.seek(4, SEEK_SET), oc::success(4u));
+    ASSERT_EQ(memcmp(m_data, "AB", 2), 0);
+
+    ASSERT_EQ(file.write("CD", 2), oc::success(2u));
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(memcmp(m_data, "ABcdCD", 6), 0);
+}
+
+TEST_F(BufferedFileTest, WriteAfterRead)
+{
+    BufferedFile file(m_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[2];
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(sizeof(buf)));
+
+    // The underlying file must be rewound to the logical position
+    ASSERT_EQ(file.write("XY", 2), oc::success(2u));
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "ef", 2), 0);
+    ASSERT_EQ(memcmp(m_data, "abXYef", 6), 0);
+}
+
+TEST_F(BufferedFileTest, CloseRestoresUnownedPosition)
+{
+    EXPECT_CALL(m_file, close())
+            .Times(0);
+
+    BufferedFile file(m_file, 16);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[3];
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(sizeof(buf)));
+    ASSERT_TRUE(file.close());
+
+    ASSERT_EQ(m_mem.seek(0, SEEK_CUR), oc::success(3u));
+}
+
+TEST_F(BufferedFileTest, CloseOwnedFile)
+{
+    auto owned = std::make_unique<MemoryFile>(m_data, sizeof(m_data));
+
+    BufferedFile file(std::move(owned), 16);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("Z", 1), oc::success(1u));
+    ASSERT_TRUE(file.close());
+    ASSERT_FALSE(file.is_open());
+    ASSERT_EQ(m_data[0], 'Z');
+}
+
+TEST_F(BufferedFileTest, PartialFlush)
+{
+    EXPECT_CALL(m_file, write(_, 4))
+            .WillOnce(Return(2u));
+    EXPECT_CALL(m_file, write(_, 2))
+            .WillRepeatedly(Return(0u));
+
+    BufferedFile file(m_file, 8);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("ABCD", 4), oc::success(4u));
+    ASSERT_EQ(file.flush(), oc::failure(FileError::UnexpectedEof));
+
+    // Remaining data is retried when closing
+    ASSERT_EQ(file.close(), oc::failure(FileError::UnexpectedEof));
+}
@@ -20,6 +20,7 @@
 #include <gmock/gmock.h>
 
 #include <climits>
+#include <vector>
 
 #include <fcntl.h>
 
@@ -49,6 +50,18 @@ struct MockFdFileFuncs : public FdFileFuncs
     MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
     MOCK_METHOD3(fn_read, ssize_t(int fd, void *buf, size_t count));
     MOCK_METHOD3(fn_write, ssize_t(int fd, const void *buf, size_t count));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+    MOCK_METHOD3(fn_readv, ssize_t(int fd, const struct iovec *iov,
+                                   int iovcnt));
+    MOCK_METHOD3(fn_writev, ssize_t(int fd, const struct iovec *iov,
+                                    int iovcnt));
+    MOCK_METHOD4(fn_posix_fadvise64, int(int fd, off64_t offset, off64_t len,
+                                         int advice));
+#endif
 
     struct stat _sb_regfile{};
 
@@ -76,6 +89,18 @@ struct MockFdFileFuncs : public FdFileFuncs
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_write(_, _, _))
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_readv(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_writev(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_posix_fadvise64(_, _, _, _))
+                .WillByDefault(Return(EIO));
+#endif
     }
 
     void report_as_regular_file()
@@ -551,3 +576,189 @@ TEST_F(FileFdTest, TruncateFailed)
 
     ASSERT_EQ(file.truncate(1024), oc::failure(std::errc::io_error));
 }
+
+#ifndef _WIN32
+TEST_F(FileFdTest, ReadAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that pread is used and the file position is untouched
+    EXPECT_CALL(_funcs, fn_pread64(_, _, 5, 100))
+            .Times(1)
+            .WillOnce(Return(5));
+    EXPECT_CALL(_funcs, fn_lseek64(_, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c[5];
+    ASSERT_EQ(file.read_at(100, c, sizeof(c)), oc::success(5u));
+}
+
+TEST_F(FileFdTest, ReadAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(0, &c, 1), oc::failure(std::errc::io_error));
+    ASSERT_EQ(file.read_at(static_cast<uint64_t>(INT64_MAX) + 1, &c, 1),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(FileFdTest, WriteAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, 5, 100))
+            .Times(1)
+            .WillOnce(Return(5));
+    EXPECT_CALL(_funcs, fn_lseek64(_, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(100, "hello", 5), oc::success(5u));
+}
+
+TEST_F(FileFdTest, WriteAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(_, _, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(0, "x", 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, ReadVectoredSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    char a[2];
+    char b[3];
+    IoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    // Ensure that a single readv call is made
+    EXPECT_CALL(_funcs, fn_readv(_, _, 2))
+            .Times(1)
+            .WillOnce(Return(5));
+    EXPECT_CALL(_funcs, fn_read(_, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.read_vectored(iov, 2), oc::success(5u));
+}
+
+TEST_F(FileFdTest, ReadVectoredBatchLimit)
+{
+    _funcs.report_as_regular_file();
+
+    char c;
+    std::vector<IoVec> iov(100, IoVec{&c, 1});
+
+    EXPECT_CALL(_funcs, fn_readv(_, _, 64))
+            .Times(1)
+            .WillOnce(Return(64));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.read_vectored(iov.data(), iov.size()), oc::success(64u));
+}
+
+TEST_F(FileFdTest, ReadVectoredFailure)
+{
+    _funcs.report_as_regular_file();
+
+    char c;
+    IoVec iov[] = { { &c, 1 } };
+
+    EXPECT_CALL(_funcs, fn_readv(_, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.read_vectored(iov, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, WriteVectoredSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    ConstIoVec iov[] = { { "ab", 2 }, { "cde", 3 } };
+
+    EXPECT_CALL(_funcs, fn_writev(_, _, 2))
+            .Times(1)
+            .WillOnce(Return(5));
+    EXPECT_CALL(_funcs, fn_write(_, _, _))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_vectored(iov, 2), oc::success(5u));
+}
+
+TEST_F(FileFdTest, WriteVectoredFailure)
+{
+    _funcs.report_as_regular_file();
+
+    ConstIoVec iov[] = { { "x", 1 } };
+
+    EXPECT_CALL(_funcs, fn_writev(_, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_vectored(iov, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileFdTest, AdviseSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_posix_fadvise64(0, 100, 0, POSIX_FADV_SEQUENTIAL))
+            .Times(1)
+            .WillOnce(Return(0));
+    EXPECT_CALL(_funcs, fn_posix_fadvise64(0, 0, 10, POSIX_FADV_DONTNEED))
+            .Times(1)
+            .WillOnce(Return(0));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.advise(100, 0, FileAdvice::Sequential));
+    ASSERT_TRUE(file.advise(0, 10, FileAdvice::DontNeed));
+}
+
+TEST_F(FileFdTest, AdviseFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_posix_fadvise64(_, _, _, _))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.advise(0, 0, FileAdvice::WillNeed),
+              oc::failure(std::errc::io_error));
+    ASSERT_EQ(file.advise(UINT64_MAX, 0, FileAdvice::WillNeed),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+#endif
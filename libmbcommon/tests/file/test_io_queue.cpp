@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/io_queue.h"
+#include "mbcommon/file_error.h"
+
+using namespace mb;
+
+// Fixed size file with thread-safe positional I/O
+class PositionalFile : public File
+{
+public:
+    explicit PositionalFile(size_t size) : _data(size)
+    {
+    }
+
+    oc::result<void> close() override
+    {
+        return oc::success();
+    }
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        (void) buf;
+        (void) size;
+        return FileError::UnsupportedRead;
+    }
+
+    oc::result<size_t> write(const void *buf, size_t size) override
+    {
+        (void) buf;
+        (void) size;
+        return FileError::UnsupportedWrite;
+    }
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        (void) offset;
+        (void) whence;
+        return FileError::UnsupportedSeek;
+    }
+
+    oc::result<void> truncate(uint64_t size) override
+    {
+        (void) size;
+        return FileError::UnsupportedTruncate;
+    }
+
+    oc::result<size_t> read_at(uint64_t offset, void *buf,
+                               size_t size) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (offset >= _data.size()) {
+            return 0;
+        }
+
+        // Return short reads to exercise the retry loop
+        size_t n = std::min({size, _data.size() - offset, _max_io});
+        memcpy(buf, _data.data() + offset, n);
+        return n;
+    }
+
+    oc::result<size_t> write_at(uint64_t offset, const void *buf,
+                                size_t size) override
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (offset >= _data.size()) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        size_t n = std::min({size, _data.size() - offset, _max_io});
+        memcpy(_data.data() + offset, buf, n);
+        return n;
+    }
+
+    bool is_open() override
+    {
+        return true;
+    }
+
+    std::mutex _mutex;
+    std::vector<unsigned char> _data;
+    size_t _max_io = 3;
+};
+
+TEST(IoQueueTest, WriteAndReadBack)
+{
+    PositionalFile file(1000);
+
+    std::vector<unsigned char> in(file._data.size());
+    std::iota(in.begin(), in.end(), 0);
+
+    {
+        IoQueue queue(file);
+        ASSERT_EQ(queue.depth(), IoQueue::DEFAULT_DEPTH);
+
+        for (size_t i = 0; i < in.size(); i += 100) {
+            ASSERT_TRUE(queue.submit_write(i, in.data() + i, 100));
+        }
+        ASSERT_TRUE(queue.wait());
+    }
+
+    ASSERT_EQ(file._data, in);
+
+    std::vector<unsigned char> out(in.size());
+
+    IoQueue queue(file, 2);
+    ASSERT_EQ(queue.depth(), 2u);
+
+    for (size_t i = 0; i < out.size(); i += 250) {
+        ASSERT_TRUE(queue.submit_read(i, out.data() + i, 250));
+    }
+    ASSERT_TRUE(queue.wait());
+
+    ASSERT_EQ(out, in);
+}
+
+TEST(IoQueueTest, ReadPastEof)
+{
+    PositionalFile file(10);
+    IoQueue queue(file);
+
+    char buf[20];
+    ASSERT_TRUE(queue.submit_read(0, buf, sizeof(buf)));
+    ASSERT_EQ(queue.wait(), oc::failure(FileError::UnexpectedEof));
+
+    // Error is cleared after it is reported
+    ASSERT_TRUE(queue.submit_read(0, buf, 10));
+    ASSERT_TRUE(queue.wait());
+}
+
+TEST(IoQueueTest, SubmitAfterFailure)
+{
+    PositionalFile file(10);
+    IoQueue queue(file, 1);
+
+    ASSERT_TRUE(queue.submit_write(20, "x", 1));
+
+    // Either the failure is reported on submit or on wait
+    auto r = queue.submit_write(0, "x", 1);
+    if (r) {
+        ASSERT_EQ(queue.wait(), oc::failure(FileError::ArgumentOutOfRange));
+    } else {
+        ASSERT_EQ(r, oc::failure(FileError::ArgumentOutOfRange));
+        ASSERT_EQ(queue.wait(), oc::failure(FileError::ArgumentOutOfRange));
+    }
+}
@@ -20,6 +20,9 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <vector>
+
+#include <cstring>
 
 #include "mbcommon/file.h"
 #include "mbcommon/file/memory.h"
@@ -252,6 +255,26 @@ TEST(FileDynamicMemoryTest, CloseFile)
     free(in);
 }
 
+TEST(FileStaticMemoryTest, ReadAt)
+{
+    char in[] = "hello";
+    constexpr size_t in_size = 5;
+    char out[4];
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.read_at(1, out, sizeof(out)), oc::success(4u));
+    ASSERT_EQ(memcmp(out, "ello", 4), 0);
+    ASSERT_EQ(file.read_at(3, out, sizeof(out)), oc::success(2u));
+    ASSERT_EQ(memcmp(out, "lo", 2), 0);
+    ASSERT_EQ(file.read_at(5, out, sizeof(out)), oc::success(0u));
+    ASSERT_EQ(file.read_at(UINT64_MAX, out, sizeof(out)), oc::success(0u));
+
+    // File position is unchanged
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
 TEST(FileDynamicMemoryTest, ReadInBounds)
 {
     void *in = strdup("x");
@@ -479,3 +502,83 @@ TEST(FileDynamicMemoryTest, TruncateFile)
 
     free(in);
 }
+
+TEST(FileOwnedMemoryTest, AdoptAndRelease)
+{
+    std::vector<unsigned char> buf{'a', 'b', 'c'};
+    auto data = buf.data();
+
+    MemoryFile file(std::move(buf));
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(1, &c, 1), oc::success(1u));
+    ASSERT_EQ(c, 'b');
+
+    // Overwriting in place does not reallocate
+    ASSERT_EQ(file.write("x", 1), oc::success(1u));
+
+    auto released = file.release();
+    ASSERT_TRUE(released);
+    ASSERT_FALSE(file.is_open());
+    ASSERT_EQ(released.value().data(), data);
+    ASSERT_EQ(released.value(),
+              (std::vector<unsigned char>{'x', 'b', 'c'}));
+}
+
+TEST(FileOwnedMemoryTest, WriteGrowsAndZeroFills)
+{
+    MemoryFile file(std::vector<unsigned char>{});
+    ASSERT_TRUE(file.is_open());
+
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(file.write("x", 1), oc::success(1u));
+    }
+
+    ASSERT_TRUE(file.truncate(10));
+    ASSERT_TRUE(file.seek(12, SEEK_SET));
+    ASSERT_EQ(file.write("y", 1), oc::success(1u));
+
+    auto released = file.release();
+    ASSERT_TRUE(released);
+
+    std::vector<unsigned char> expected(13, 'x');
+    expected[10] = '\0';
+    expected[11] = '\0';
+    expected[12] = 'y';
+    ASSERT_EQ(released.value(), expected);
+}
+
+TEST(FileOwnedMemoryTest, ReleaseUnowned)
+{
+    void *in = nullptr;
+    size_t in_size = 0;
+
+    MemoryFile file;
+    ASSERT_EQ(file.release(), oc::failure(FileError::InvalidState));
+
+    ASSERT_TRUE(file.open(&in, &in_size));
+    ASSERT_EQ(file.release(), oc::failure(FileError::InvalidState));
+}
+
+TEST(FileDynamicMemoryTest, WriteGrowsGeometrically)
+{
+    void *in = nullptr;
+    size_t in_size = 0;
+
+    MemoryFile file(&in, &in_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("abcd", 4), oc::success(4u));
+    ASSERT_EQ(in_size, 4u);
+
+    // Buffer has room for the next write, so it must not move
+    ASSERT_EQ(file.write("e", 1), oc::success(1u));
+    auto *data = in;
+    ASSERT_EQ(file.write("fgh", 3), oc::success(3u));
+    ASSERT_EQ(in, data);
+    ASSERT_EQ(in_size, 8u);
+    ASSERT_EQ(memcmp(in, "abcdefgh", 8), 0);
+
+    free(in);
+}
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file_error.h"
+
+using namespace mb;
+using namespace mb::detail;
+using namespace testing;
+
+struct MockMmapFileFuncs : public MmapFileFuncs
+{
+    // fcntl.h
+    MOCK_METHOD3(fn_open, int(const char *path, int flags, mode_t mode));
+
+    // sys/mman.h
+    MOCK_METHOD6(fn_mmap, void *(void *addr, size_t length, int prot,
+                                 int flags, int fd, off_t offset));
+    MOCK_METHOD2(fn_munmap, int(void *addr, size_t length));
+    MOCK_METHOD3(fn_madvise, int(void *addr, size_t length, int advice));
+
+    // sys/stat.h
+    MOCK_METHOD2(fn_fstat, int(int fildes, struct stat *buf));
+
+    // unistd.h
+    MOCK_METHOD1(fn_close, int(int fd));
+    MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
+
+    char _contents[6] = "hello";
+    struct stat _sb_regfile{};
+
+    MockMmapFileFuncs()
+    {
+        _sb_regfile.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+        _sb_regfile.st_size = 5;
+
+        // Fail everything by default
+        ON_CALL(*this, fn_open(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_mmap(_, _, _, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, MAP_FAILED));
+        ON_CALL(*this, fn_munmap(_, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_madvise(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fstat(_, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_close(_))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_lseek64(_, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+    }
+
+    void report_as_regular_file()
+    {
+        ON_CALL(*this, fn_fstat(_, _))
+                .WillByDefault(DoAll(
+                        SetArgPointee<1>(_sb_regfile),
+                        Return(0)));
+    }
+
+    void map_with_success()
+    {
+        ON_CALL(*this, fn_mmap(_, _, _, _, _, _))
+                .WillByDefault(Return(_contents));
+        ON_CALL(*this, fn_munmap(_, _))
+                .WillByDefault(Return(0));
+    }
+};
+
+class TestableMmapFile : public MmapFile
+{
+public:
+    TestableMmapFile(MmapFileFuncs *funcs)
+        : MmapFile(funcs)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs, int fd)
+        : MmapFile(funcs, fd)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs, const std::string &filename)
+        : MmapFile(funcs, filename)
+    {
+    }
+};
+
+struct FileMmapTest : Test
+{
+    NiceMock<MockMmapFileFuncs> _funcs;
+};
+
+TEST_F(FileMmapTest, CheckInvalidStates)
+{
+    TestableMmapFile file(&_funcs);
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.read(nullptr, 0), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+    ASSERT_EQ(file.truncate(1024), error);
+    ASSERT_FALSE(file.view(0, 0));
+    ASSERT_FALSE(file.read_view(0));
+
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    ASSERT_TRUE(file.open(0));
+    ASSERT_EQ(file.open(0), error);
+    ASSERT_EQ(file.open("x"), error);
+    ASSERT_EQ(file.open(L"x"), error);
+}
+
+TEST_F(FileMmapTest, OpenFilenameSuccess)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_open(_, O_RDONLY | O_CLOEXEC, _))
+            .Times(1)
+            .WillOnce(Return(3));
+    EXPECT_CALL(_funcs, fn_mmap(_, 5, PROT_READ, MAP_PRIVATE, 3, 0))
+            .Times(1);
+    // File descriptor is not needed after mapping
+    EXPECT_CALL(_funcs, fn_close(3))
+            .Times(1)
+            .WillOnce(Return(0));
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open("x"));
+    ASSERT_EQ(file.size(), 5u);
+}
+
+TEST_F(FileMmapTest, OpenFilenameFailure)
+{
+    EXPECT_CALL(_funcs, fn_open(_, _, _))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_EQ(file.open("x"), oc::failure(std::errc::io_error));
+    ASSERT_FALSE(file.is_open());
+}
+
+TEST_F(FileMmapTest, OpenMmapFailed)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_mmap(_, _, _, _, _, _))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_EQ(file.open(0), oc::failure(std::errc::io_error));
+    ASSERT_FALSE(file.is_open());
+}
+
+TEST_F(FileMmapTest, OpenDirectory)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    EXPECT_CALL(_funcs, fn_fstat(_, _))
+            .Times(1)
+            .WillOnce(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_EQ(file.open(0), oc::failure(std::errc::is_a_directory));
+}
+
+TEST_F(FileMmapTest, OpenBlockDevice)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFBLK | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_fstat(_, _))
+            .Times(1)
+            .WillOnce(DoAll(SetArgPointee<1>(sb), Return(0)));
+    EXPECT_CALL(_funcs, fn_lseek64(0, 0, SEEK_END))
+            .Times(1)
+            .WillOnce(Return(4));
+    EXPECT_CALL(_funcs, fn_mmap(_, 4, _, _, _, _))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open(0));
+    ASSERT_EQ(file.size(), 4u);
+}
+
+TEST_F(FileMmapTest, OpenEmptyFile)
+{
+    struct stat sb = _funcs._sb_regfile;
+    sb.st_size = 0;
+
+    EXPECT_CALL(_funcs, fn_fstat(_, _))
+            .Times(1)
+            .WillOnce(DoAll(SetArgPointee<1>(sb), Return(0)));
+    EXPECT_CALL(_funcs, fn_mmap(_, _, _, _, _, _))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_munmap(_, _))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open(0));
+    ASSERT_EQ(file.size(), 0u);
+
+    char c;
+    ASSERT_EQ(file.read(&c, 1), oc::success(0u));
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileMmapTest, CloseUnmaps)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_munmap(_funcs._contents, 5))
+            .Times(1);
+    // The file descriptor is not owned
+    EXPECT_CALL(_funcs, fn_close(_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 0);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.close());
+    ASSERT_FALSE(file.is_open());
+}
+
+TEST_F(FileMmapTest, CloseFailure)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_munmap(_, _))
+            .Times(1)
+            .WillOnce(SetErrnoAndReturn(EINVAL, -1));
+
+    TestableMmapFile file(&_funcs, 0);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_EQ(file.close(), oc::failure(std::errc::invalid_argument));
+    ASSERT_FALSE(file.is_open());
+}
+
+TEST_F(FileMmapTest, ReadAndSeek)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[3];
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(3u));
+    ASSERT_EQ(memcmp(buf, "hel", 3), 0);
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(2u));
+    ASSERT_EQ(memcmp(buf, "lo", 2), 0);
+    ASSERT_EQ(file.read(buf, sizeof(buf)), oc::success(0u));
+
+    ASSERT_EQ(file.seek(-4, SEEK_END), oc::success(1u));
+    ASSERT_EQ(file.read(buf, 1), oc::success(1u));
+    ASSERT_EQ(buf[0], 'e');
+
+    ASSERT_EQ(file.seek(10, SEEK_SET), oc::success(10u));
+    ASSERT_EQ(file.read(buf, 1), oc::success(0u));
+
+    ASSERT_EQ(file.seek(-11, SEEK_CUR),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(FileMmapTest, ReadAt)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[3];
+    ASSERT_EQ(file.read_at(2, buf, sizeof(buf)), oc::success(3u));
+    ASSERT_EQ(memcmp(buf, "llo", 3), 0);
+    ASSERT_EQ(file.read_at(4, buf, sizeof(buf)), oc::success(1u));
+    ASSERT_EQ(file.read_at(5, buf, sizeof(buf)), oc::success(0u));
+
+    // File position is unchanged
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+}
+
+TEST_F(FileMmapTest, WriteAndTruncateUnsupported)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("x", 1), oc::failure(FileError::UnsupportedWrite));
+    ASSERT_EQ(file.truncate(0), oc::failure(FileError::UnsupportedTruncate));
+}
+
+TEST_F(FileMmapTest, ZeroCopyViews)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_EQ(file.data(),
+              reinterpret_cast<const unsigned char *>(_funcs._contents));
+
+    auto v = file.view(1, 3);
+    ASSERT_TRUE(v);
+    ASSERT_EQ(v.value().data, file.data() + 1);
+    ASSERT_EQ(v.value().size, 3u);
+
+    // Clamped to end of file
+    v = file.view(3, 10);
+    ASSERT_TRUE(v);
+    ASSERT_EQ(v.value().size, 2u);
+
+    v = file.view(10, 10);
+    ASSERT_TRUE(v);
+    ASSERT_EQ(v.value().size, 0u);
+
+    // view() does not move the file position, but read_view() does
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(0u));
+
+    v = file.read_view(4);
+    ASSERT_TRUE(v);
+    ASSERT_EQ(v.value().data, file.data());
+    ASSERT_EQ(v.value().size, 4u);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(4u));
+
+    v = file.read_view(4);
+    ASSERT_TRUE(v);
+    ASSERT_EQ(v.value().size, 1u);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(5u));
+}
+
+TEST_F(FileMmapTest, Advise)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_madvise(_funcs._contents, 5, MADV_SEQUENTIAL))
+            .Times(1)
+            .WillOnce(Return(0));
+    EXPECT_CALL(_funcs, fn_madvise(_funcs._contents, 3, MADV_WILLNEED))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs, 0);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.advise(0, 0, FileAdvice::Sequential));
+    ASSERT_EQ(file.advise(0, 3, FileAdvice::WillNeed),
+              oc::failure(std::errc::io_error));
+
+    // Nothing is mapped past the end of the file
+    ASSERT_TRUE(file.advise(10, 0, FileAdvice::DontNeed));
+}
+
+TEST_F(FileMmapTest, MoveConstruct)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_munmap(_, _))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs, 0);
+    ASSERT_TRUE(file.is_open());
+
+    MmapFile file2(std::move(file));
+    ASSERT_FALSE(file.is_open());
+    ASSERT_TRUE(file2.is_open());
+    ASSERT_EQ(file2.size(), 5u);
+}
@@ -19,6 +19,8 @@
 
 #include <gmock/gmock.h>
 
+#include <fcntl.h>
+
 #include "mbcommon/file.h"
 #include "mbcommon/file/posix.h"
 #include "mbcommon/file_error.h"
@@ -38,6 +40,7 @@ struct MockPosixFileFuncs : public PosixFileFuncs
     // stdio.h
     MOCK_METHOD1(fn_fclose, int(FILE *stream));
     MOCK_METHOD1(fn_ferror, int(FILE *stream));
+    MOCK_METHOD1(fn_fflush, int(FILE *stream));
     MOCK_METHOD1(fn_fileno, int(FILE *stream));
 #ifdef _WIN32
     MOCK_METHOD2(fn_wfopen, FILE *(const wchar_t *filename,
@@ -54,6 +57,14 @@ struct MockPosixFileFuncs : public PosixFileFuncs
 
     // unistd.h
     MOCK_METHOD2(fn_ftruncate64, int(int fd, off64_t length));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+    MOCK_METHOD4(fn_posix_fadvise64, int(int fd, off64_t offset, off64_t len,
+                                         int advice));
+#endif
 
     bool stream_error = false;
 
@@ -91,6 +102,16 @@ struct MockPosixFileFuncs : public PosixFileFuncs
                         SetErrnoAndReturn(EIO, 0)));
         ON_CALL(*this, fn_ftruncate64(_, _))
                 .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fflush(_))
+                .WillByDefault(SetErrnoAndReturn(EIO, EOF));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(_, _, _, _))
+                .WillByDefault(SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_posix_fadvise64(_, _, _, _))
+                .WillByDefault(Return(EIO));
+#endif
     }
 
     void set_ferror_fail()
@@ -607,3 +628,132 @@ TEST_F(FilePosixTest, TruncateFailed)
 
     ASSERT_EQ(file.truncate(1024), oc::failure(std::errc::io_error));
 }
+
+#ifndef _WIN32
+TEST_F(FilePosixTest, ReadAtSuccess)
+{
+    ON_CALL(_funcs, fn_fileno(_))
+            .WillByDefault(Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(_, _))
+            .WillByDefault(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    // Ensure that buffered data is flushed before pread is used
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_funcs, fn_fflush(g_fp))
+                .Times(1)
+                .WillOnce(Return(0));
+        EXPECT_CALL(_funcs, fn_pread64(0, _, 5, 100))
+                .Times(1)
+                .WillOnce(Return(5));
+    }
+    EXPECT_CALL(_funcs, fn_fseeko(_, _, _))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c[5];
+    ASSERT_EQ(file.read_at(100, c, sizeof(c)), oc::success(5u));
+}
+
+TEST_F(FilePosixTest, ReadAtFlushFailed)
+{
+    ON_CALL(_funcs, fn_fileno(_))
+            .WillByDefault(Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(_, _))
+            .WillByDefault(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    EXPECT_CALL(_funcs, fn_fflush(_))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(0, &c, 1), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FilePosixTest, WriteAtSuccess)
+{
+    ON_CALL(_funcs, fn_fileno(_))
+            .WillByDefault(Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(_, _))
+            .WillByDefault(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    EXPECT_CALL(_funcs, fn_fflush(g_fp))
+            .Times(1)
+            .WillOnce(Return(0));
+    EXPECT_CALL(_funcs, fn_pwrite64(0, _, 5, 100))
+            .Times(1)
+            .WillOnce(Return(5));
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write_at(100, "hello", 5), oc::success(5u));
+}
+
+TEST_F(FilePosixTest, ReadAtUnsupported)
+{
+    EXPECT_CALL(_funcs, fn_pread64(_, _, _, _))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    ASSERT_EQ(file.read_at(0, &c, 1),
+              oc::failure(FileError::UnsupportedSeek));
+    ASSERT_EQ(file.write_at(0, &c, 1),
+              oc::failure(FileError::UnsupportedSeek));
+}
+
+TEST_F(FilePosixTest, AdviseSuccess)
+{
+    ON_CALL(_funcs, fn_fileno(_))
+            .WillByDefault(Return(0));
+
+    struct stat sb{};
+    sb.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    ON_CALL(_funcs, fn_fstat(_, _))
+            .WillByDefault(DoAll(SetArgPointee<1>(sb), Return(0)));
+
+    EXPECT_CALL(_funcs, fn_posix_fadvise64(0, 0, 0, POSIX_FADV_RANDOM))
+            .Times(1)
+            .WillOnce(Return(0));
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.advise(0, 0, FileAdvice::Random));
+}
+
+TEST_F(FilePosixTest, AdviseUnsupported)
+{
+    EXPECT_CALL(_funcs, fn_posix_fadvise64(_, _, _, _))
+            .Times(0);
+
+    TestablePosixFile file(&_funcs, g_fp, true);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.advise(0, 0, FileAdvice::Random),
+              oc::failure(FileError::UnsupportedAdvise));
+}
+#endif
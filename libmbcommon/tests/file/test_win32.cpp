@@ -20,6 +20,7 @@
 #include <gmock/gmock.h>
 
 #include <climits>
+#include <unordered_map>
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/file.h"
@@ -74,6 +75,14 @@ struct MockWin32FileFuncs : public Win32FileFuncs
                                         DWORD dwCreationDisposition,
                                         DWORD dwFlagsAndAttributes,
                                         HANDLE hTemplateFile));
+    MOCK_METHOD4(fn_CreateEventW, HANDLE(LPSECURITY_ATTRIBUTES lpEventAttributes,
+                                         BOOL bManualReset,
+                                         BOOL bInitialState,
+                                         LPCWSTR lpName));
+    MOCK_METHOD4(fn_GetOverlappedResult, BOOL(HANDLE hFile,
+                                              LPOVERLAPPED lpOverlapped,
+                                              LPDWORD lpNumberOfBytesTransferred,
+                                              BOOL bWait));
     MOCK_METHOD5(fn_ReadFile, BOOL(HANDLE hFile,
                                    LPVOID lpBuffer,
                                    DWORD nNumberOfBytesToRead,
@@ -102,6 +111,12 @@ struct MockWin32FileFuncs : public Win32FileFuncs
         ON_CALL(*this, fn_CreateFileW(_, _, _, _, _, _, _))
                 .WillByDefault(SetWin32ErrorAndReturn(ERROR_INVALID_HANDLE,
                                                       INVALID_HANDLE_VALUE));
+        ON_CALL(*this, fn_CreateEventW(_, _, _, _))
+                .WillByDefault(SetWin32ErrorAndReturn(ERROR_INVALID_HANDLE,
+                                                      nullptr));
+        ON_CALL(*this, fn_GetOverlappedResult(_, _, _, _))
+                .WillByDefault(SetWin32ErrorAndReturn(ERROR_INVALID_HANDLE,
+                                                      FALSE));
         ON_CALL(*this, fn_ReadFile(_, _, _, _, _))
                 .WillByDefault(SetWin32ErrorAndReturn(ERROR_INVALID_HANDLE,
                                                       FALSE));
@@ -185,6 +200,25 @@ TEST_F(FileWin32Test, OpenFilenameMbsSuccess)
     ASSERT_TRUE(file.open("x", FileOpenMode::ReadOnly));
 }
 
+TEST_F(FileWin32Test, OpenFilenameStreamingFlags)
+{
+    constexpr DWORD flags = FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED;
+
+    EXPECT_CALL(_funcs, fn_CreateFileW(_, _, _, _, _, flags, _))
+            .Times(2)
+            .WillRepeatedly(Return(reinterpret_cast<HANDLE>(1)));
+    EXPECT_CALL(_funcs, fn_CreateFileW(_, _, _, _, _, 0, _))
+            .Times(1)
+            .WillOnce(Return(reinterpret_cast<HANDLE>(1)));
+
+    TestableWin32File file1(&_funcs);
+    ASSERT_TRUE(file1.open("x", FileOpenMode::ReadOnly));
+    TestableWin32File file2(&_funcs);
+    ASSERT_TRUE(file2.open("x", FileOpenMode::WriteOnly));
+    TestableWin32File file3(&_funcs);
+    ASSERT_TRUE(file3.open("x", FileOpenMode::ReadWrite));
+}
+
 TEST_F(FileWin32Test, OpenFilenameMbsFailure)
 {
     EXPECT_CALL(_funcs, fn_CreateFileW(_, _, _, _, _, _, _))
@@ -487,3 +521,194 @@ TEST_F(FileWin32Test, TruncateFailed)
     ASSERT_EQ(file.truncate(1024),
               oc::failure(ec_from_win32(ERROR_INVALID_HANDLE)));
 }
+
+// Simulates an overlapped file handle backed by a string
+struct FileWin32StreamTest : FileWin32Test
+{
+    std::string _data;
+    std::unordered_map<LPOVERLAPPED, DWORD> _results;
+    uintptr_t _events = 0;
+    unsigned int _reads = 0;
+    unsigned int _writes = 0;
+
+    static uint64_t offset_of(LPOVERLAPPED overlapped)
+    {
+        return overlapped->Offset
+                | (static_cast<uint64_t>(overlapped->OffsetHigh) << 32);
+    }
+
+    void SetUp() override
+    {
+        ON_CALL(_funcs, fn_CreateFileW(_, _, _, _, _, _, _))
+                .WillByDefault(Return(reinterpret_cast<HANDLE>(1)));
+        ON_CALL(_funcs, fn_CloseHandle(_))
+                .WillByDefault(Return(TRUE));
+        ON_CALL(_funcs, fn_CreateEventW(_, _, _, _))
+                .WillByDefault(InvokeWithoutArgs([this] {
+                    return reinterpret_cast<HANDLE>(++_events + 100);
+                }));
+        ON_CALL(_funcs, fn_ReadFile(_, _, _, _, _))
+                .WillByDefault(Invoke([this](HANDLE, LPVOID buf, DWORD size,
+                                             LPDWORD, LPOVERLAPPED ov) {
+                    ++_reads;
+
+                    auto offset = offset_of(ov);
+                    if (offset >= _data.size()) {
+                        SetLastError(ERROR_HANDLE_EOF);
+                        return FALSE;
+                    }
+
+                    auto n = std::min<uint64_t>(size, _data.size() - offset);
+                    memcpy(buf, _data.data() + offset, n);
+                    _results[ov] = static_cast<DWORD>(n);
+
+                    SetLastError(ERROR_IO_PENDING);
+                    return FALSE;
+                }));
+        ON_CALL(_funcs, fn_WriteFile(_, _, _, _, _))
+                .WillByDefault(Invoke([this](HANDLE, LPCVOID buf, DWORD size,
+                                             LPDWORD, LPOVERLAPPED ov) {
+                    ++_writes;
+
+                    auto offset = offset_of(ov);
+                    if (_data.size() < offset + size) {
+                        _data.resize(offset + size);
+                    }
+
+                    memcpy(_data.data() + offset, buf, size);
+                    _results[ov] = size;
+
+                    return TRUE;
+                }));
+        ON_CALL(_funcs, fn_SetFilePointerEx(_, _, _, _))
+                .WillByDefault(Invoke([this](HANDLE, LARGE_INTEGER distance,
+                                             PLARGE_INTEGER new_pos,
+                                             DWORD method) {
+                    new_pos->QuadPart = distance.QuadPart;
+                    if (method == FILE_END) {
+                        new_pos->QuadPart += _data.size();
+                    }
+                    return TRUE;
+                }));
+        ON_CALL(_funcs, fn_GetOverlappedResult(_, _, _, _))
+                .WillByDefault(Invoke([this](HANDLE, LPOVERLAPPED ov,
+                                             LPDWORD n, BOOL) {
+                    auto it = _results.find(ov);
+                    if (it == _results.end()) {
+                        SetLastError(ERROR_INVALID_PARAMETER);
+                        return FALSE;
+                    }
+
+                    *n = it->second;
+                    _results.erase(it);
+                    return TRUE;
+                }));
+    }
+};
+
+TEST_F(FileWin32StreamTest, ReadSmallChunks)
+{
+    // Not a multiple of the buffer size
+    _data.resize(3 * 1024 * 1024 + 10);
+    for (size_t i = 0; i < _data.size(); ++i) {
+        _data[i] = static_cast<char>(i * 7);
+    }
+
+    TestableWin32File file(&_funcs, "x", FileOpenMode::ReadOnly);
+    ASSERT_TRUE(file.is_open());
+
+    std::string result;
+    char buf[4000];
+
+    while (true) {
+        auto n = file.read(buf, sizeof(buf));
+        ASSERT_TRUE(n);
+        if (n.value() == 0) {
+            break;
+        }
+        result.append(buf, n.value());
+    }
+
+    ASSERT_EQ(result, _data);
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(_data.size()));
+
+    // Four buffers of data plus one read-ahead at EOF
+    ASSERT_EQ(_reads, 5u);
+    ASSERT_TRUE(file.close());
+    ASSERT_TRUE(_results.empty());
+}
+
+TEST_F(FileWin32StreamTest, ReadSeekWithinBuffer)
+{
+    _data = "abcdefghij";
+
+    TestableWin32File file(&_funcs, "x", FileOpenMode::ReadOnly);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+    ASSERT_EQ(file.read(buf, 2), oc::success(2u));
+    ASSERT_EQ(file.seek(6, SEEK_SET), oc::success(6u));
+    ASSERT_EQ(file.read(buf, 4), oc::success(4u));
+    ASSERT_EQ(std::string(buf, 4), "ghij");
+    ASSERT_EQ(file.seek(-8, SEEK_CUR), oc::success(2u));
+    ASSERT_EQ(file.read(buf, 1), oc::success(1u));
+    ASSERT_EQ(buf[0], 'c');
+
+    // The seeks did not discard the buffer
+    ASSERT_EQ(_reads, 2u);
+}
+
+TEST_F(FileWin32StreamTest, WriteSmallChunks)
+{
+    std::string expected;
+    expected.resize(2 * 1024 * 1024 + 100);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        expected[i] = static_cast<char>(i * 13);
+    }
+
+    TestableWin32File file(&_funcs, "x", FileOpenMode::WriteOnly);
+    ASSERT_TRUE(file.is_open());
+
+    for (size_t i = 0; i < expected.size(); i += 1000) {
+        auto size = std::min<size_t>(1000, expected.size() - i);
+        ASSERT_EQ(file.write(expected.data() + i, size), oc::success(size));
+        ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(i + size));
+    }
+
+    // Two full buffers were written in the background
+    ASSERT_EQ(_writes, 2u);
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(_writes, 3u);
+    ASSERT_EQ(_data, expected);
+}
+
+TEST_F(FileWin32StreamTest, WriteThenSeekAndOverwrite)
+{
+    TestableWin32File file(&_funcs, "x", FileOpenMode::WriteOnly);
+    ASSERT_TRUE(file.is_open());
+
+    std::string large(1024 * 1024, 'x');
+
+    ASSERT_EQ(file.write("hello", 5), oc::success(5u));
+    ASSERT_EQ(file.write(large.data(), large.size()),
+              oc::success(large.size()));
+    ASSERT_EQ(file.seek(1, SEEK_SET), oc::success(1u));
+    ASSERT_EQ(file.write("E", 1), oc::success(1u));
+    ASSERT_TRUE(file.close());
+
+    ASSERT_EQ(_data, "hEllo" + large);
+}
+
+TEST_F(FileWin32StreamTest, WriteFailureReportedOnClose)
+{
+    EXPECT_CALL(_funcs, fn_WriteFile(_, _, _, _, _))
+            .Times(1)
+            .WillOnce(SetWin32ErrorAndReturn(ERROR_HANDLE_DISK_FULL, FALSE));
+
+    TestableWin32File file(&_funcs, "x", FileOpenMode::WriteOnly);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file.write("x", 1), oc::success(1u));
+    ASSERT_EQ(file.close(),
+              oc::failure(ec_from_win32(ERROR_HANDLE_DISK_FULL)));
+}
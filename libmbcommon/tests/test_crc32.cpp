@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "mbcommon/crc32.h"
+
+using namespace mb;
+
+// Bitwise reference implementation
+static uint32_t crc32_reference(uint32_t crc, const unsigned char *buf,
+                                size_t size)
+{
+    crc = ~crc;
+
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= buf[i];
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+        }
+    }
+
+    return ~crc;
+}
+
+TEST(Crc32Test, KnownValues)
+{
+    ASSERT_EQ(crc32_update(0, "", 0), 0u);
+    ASSERT_EQ(crc32_update(0, "123456789", 9), 0xcbf43926u);
+    ASSERT_EQ(crc32_update(0, "The quick brown fox jumps over the lazy dog",
+                           43), 0x414fa339u);
+}
+
+TEST(Crc32Test, MatchesReferenceForAllSizes)
+{
+    std::vector<unsigned char> data(1024 + 37);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 31 + (i >> 3));
+    }
+
+    for (size_t size = 0; size <= data.size(); size += 7) {
+        ASSERT_EQ(crc32_update(0, data.data(), size),
+                  crc32_reference(0, data.data(), size))
+                << "Size: " << size;
+    }
+
+    // Unaligned start
+    ASSERT_EQ(crc32_update(0, data.data() + 3, 500),
+              crc32_reference(0, data.data() + 3, 500));
+}
+
+TEST(Crc32Test, Incremental)
+{
+    std::vector<unsigned char> data(4096, 0xa5);
+
+    uint32_t crc = 0;
+    crc = crc32_update(crc, data.data(), 100);
+    crc = crc32_update(crc, data.data() + 100, 1000);
+    crc = crc32_update(crc, data.data() + 1100, data.size() - 1100);
+
+    ASSERT_EQ(crc, crc32_update(0, data.data(), data.size()));
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_error.h"
+
+#include "file/mock_test_file.h"
+
+using namespace mb;
+using namespace testing;
+
+struct FileTest : Test
+{
+    NiceMock<MockFile> _file;
+
+    void SetUp() override
+    {
+        EXPECT_CALL(_file, is_open())
+                .WillRepeatedly(Return(true));
+    }
+};
+
+TEST_F(FileTest, DefaultReadAtRestoresPosition)
+{
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_file, seek(0, SEEK_CUR))
+                .WillOnce(Return(10u));
+        EXPECT_CALL(_file, seek(100, SEEK_SET))
+                .WillOnce(Return(100u));
+        EXPECT_CALL(_file, read(_, 5))
+                .WillOnce(Return(5u));
+        EXPECT_CALL(_file, seek(10, SEEK_SET))
+                .WillOnce(Return(10u));
+    }
+
+    char buf[5];
+    ASSERT_EQ(_file.read_at(100, buf, sizeof(buf)), oc::success(5u));
+}
+
+TEST_F(FileTest, DefaultReadAtRestoresPositionOnFailure)
+{
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_file, seek(0, SEEK_CUR))
+                .WillOnce(Return(10u));
+        EXPECT_CALL(_file, seek(100, SEEK_SET))
+                .WillOnce(Return(100u));
+        EXPECT_CALL(_file, read(_, _))
+                .WillOnce(Return(std::make_error_code(std::errc::io_error)));
+        EXPECT_CALL(_file, seek(10, SEEK_SET))
+                .WillOnce(Return(10u));
+    }
+
+    char buf[5];
+    ASSERT_EQ(_file.read_at(100, buf, sizeof(buf)),
+              oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileTest, DefaultReadAtUnseekable)
+{
+    EXPECT_CALL(_file, seek(_, _))
+            .WillOnce(Return(FileError::UnsupportedSeek));
+    EXPECT_CALL(_file, read(_, _))
+            .Times(0);
+
+    char buf[5];
+    ASSERT_EQ(_file.read_at(100, buf, sizeof(buf)),
+              oc::failure(FileError::UnsupportedSeek));
+}
+
+TEST_F(FileTest, DefaultWriteAtRestoresPosition)
+{
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_file, seek(0, SEEK_CUR))
+                .WillOnce(Return(10u));
+        EXPECT_CALL(_file, seek(100, SEEK_SET))
+                .WillOnce(Return(100u));
+        EXPECT_CALL(_file, write(_, 5))
+                .WillOnce(Return(5u));
+        EXPECT_CALL(_file, seek(10, SEEK_SET))
+                .WillOnce(Return(10u));
+    }
+
+    ASSERT_EQ(_file.write_at(100, "hello", 5), oc::success(5u));
+}
+
+TEST_F(FileTest, DefaultPositionalOutOfRange)
+{
+    EXPECT_CALL(_file, seek(_, _))
+            .Times(0);
+
+    char buf[5];
+    auto offset = static_cast<uint64_t>(INT64_MAX) + 1;
+
+    ASSERT_EQ(_file.read_at(offset, buf, sizeof(buf)),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_EQ(_file.write_at(offset, buf, sizeof(buf)),
+              oc::failure(FileError::ArgumentOutOfRange));
+}
+
+TEST_F(FileTest, DefaultReadVectoredStopsAtShortRead)
+{
+    char a[2];
+    char b[3];
+    char c[4];
+    IoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) }, { c, sizeof(c) } };
+
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_file, read(a, 2))
+                .WillOnce(Return(2u));
+        EXPECT_CALL(_file, read(b, 3))
+                .WillOnce(Return(1u));
+    }
+
+    ASSERT_EQ(_file.read_vectored(iov, 3), oc::success(3u));
+}
+
+TEST_F(FileTest, DefaultReadVectoredPartialFailure)
+{
+    char a[2];
+    char b[3];
+    IoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    auto error = std::make_error_code(std::errc::io_error);
+
+    // Error is only reported if nothing was read
+    EXPECT_CALL(_file, read(_, _))
+            .WillOnce(Return(2u))
+            .WillOnce(Return(error))
+            .WillOnce(Return(error));
+
+    ASSERT_EQ(_file.read_vectored(iov, 2), oc::success(2u));
+    ASSERT_EQ(_file.read_vectored(iov, 2), oc::failure(std::errc::io_error));
+}
+
+TEST_F(FileTest, DefaultWriteVectored)
+{
+    ConstIoVec iov[] = { { "ab", 2 }, { "cde", 3 } };
+
+    EXPECT_CALL(_file, write(_, _))
+            .WillOnce(Return(2u))
+            .WillOnce(Return(3u));
+
+    ASSERT_EQ(_file.write_vectored(iov, 2), oc::success(5u));
+}
+
+TEST_F(FileTest, DefaultAdviseUnsupported)
+{
+    ASSERT_EQ(_file.advise(0, 0, FileAdvice::Sequential),
+              oc::failure(FileError::UnsupportedAdvise));
+}
@@ -222,6 +222,87 @@ TEST_F(FileUtilTest, WriteExactPartialFail)
               oc::failure(std::error_code()));
 }
 
+TEST(FileUtilVectoredTest, ReadVectoredExactNormal)
+{
+    char in[] = "abcdefghi";
+    char a[2];
+    char b[3];
+    char c[4];
+    IoVec iov[] = { { a, sizeof(a) }, { nullptr, 0 }, { b, sizeof(b) },
+                    { c, sizeof(c) } };
+
+    MemoryFile file(in, 9);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_read_vectored_exact(file, iov, 4));
+    ASSERT_EQ(memcmp(a, "ab", 2), 0);
+    ASSERT_EQ(memcmp(b, "cde", 3), 0);
+    ASSERT_EQ(memcmp(c, "fghi", 4), 0);
+}
+
+TEST(FileUtilVectoredTest, ReadVectoredExactEOF)
+{
+    char in[] = "abcd";
+    char a[2];
+    char b[3];
+    IoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    MemoryFile file(in, 4);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_EQ(file_read_vectored_exact(file, iov, 2),
+              oc::failure(FileError::UnexpectedEof));
+}
+
+TEST_F(FileUtilTest, ReadVectoredExactPartial)
+{
+    auto eintr = std::make_error_code(std::errc::interrupted);
+
+    char a[4];
+    char b[4];
+    IoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    // The remainder of a partially filled buffer is read without going through
+    // the vectored path
+    EXPECT_CALL(_file, read(_, _))
+            .WillOnce(Return(eintr))
+            .WillOnce(Return(1u))
+            .WillOnce(Return(1u))
+            .WillOnce(Return(2u))
+            .WillOnce(Return(4u));
+
+    ASSERT_TRUE(file_read_vectored_exact(_file, iov, 2));
+}
+
+TEST(FileUtilVectoredTest, WriteVectoredExactNormal)
+{
+    void *out = nullptr;
+    size_t out_size = 0;
+    ConstIoVec iov[] = { { "ab", 2 }, { "", 0 }, { "cde", 3 } };
+
+    MemoryFile file(&out, &out_size);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_vectored_exact(file, iov, 3));
+    ASSERT_EQ(out_size, 5u);
+    ASSERT_EQ(memcmp(out, "abcde", 5), 0);
+
+    free(out);
+}
+
+TEST_F(FileUtilTest, WriteVectoredExactEOF)
+{
+    ConstIoVec iov[] = { { "ab", 2 }, { "cde", 3 } };
+
+    EXPECT_CALL(_file, write(_, _))
+            .WillOnce(Return(2u))
+            .WillOnce(Return(0u))
+            .WillOnce(Return(0u));
+
+    ASSERT_EQ(file_write_vectored_exact(_file, iov, 2),
+              oc::failure(FileError::UnexpectedEof));
+}
+
 TEST_F(FileUtilTest, ReadDiscardNormal)
 {
     EXPECT_CALL(_file, read(_, _))
@@ -351,6 +432,195 @@ TEST(FileSearchTest, FindNonMatchingAtBoundary)
     ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
 }
 
+TEST(FileSearchTest, FindLongPatternOnBoundaryOfBuffer)
+{
+    std::string buf;
+    buf.resize(DEFAULT_BUFFER_SIZE - 8);
+    buf += "abcdefghijklmnop";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, "abcdefghijklmnop", 16);
+    // gtest fails to compile with ASSERT_EQ due to operator<<() shenanigans
+    ASSERT_TRUE(searcher.next() == oc::success(DEFAULT_BUFFER_SIZE - 8));
+    ASSERT_TRUE(searcher.next() == oc::success(std::nullopt));
+}
+
+TEST(FileSearchTest, FindMultiplePatterns)
+{
+    std::string buf = "xxbarxxfooxxbazxxfoo";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, {{"foo", 3}, {"bar", 3}, {"", 0}});
+
+    std::vector<std::pair<uint64_t, size_t>> matches;
+
+    while (true) {
+        auto r = searcher.next_match();
+        ASSERT_TRUE(r);
+        if (!r.value()) {
+            break;
+        }
+        matches.emplace_back(r.value()->offset, r.value()->pattern);
+    }
+
+    std::vector<std::pair<uint64_t, size_t>> expected{
+        {2, 1}, {7, 0}, {17, 0},
+    };
+    ASSERT_EQ(matches, expected);
+}
+
+TEST(FileSearchTest, FindMultiplePatternsPrefersEarlierPattern)
+{
+    std::string buf = "xxabcdxx";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, {{"abcd", 4}, {"ab", 2}});
+
+    auto r = searcher.next_match();
+    ASSERT_TRUE(r);
+    ASSERT_TRUE(r.value());
+    ASSERT_EQ(r.value()->offset, 2u);
+    ASSERT_EQ(r.value()->pattern, 0u);
+}
+
+TEST(FileSearchTest, FindMultiplePatternsOnBoundaryOfBuffer)
+{
+    // "ab" would fit in the first buffer, but "abcd" must not be missed
+    std::string buf;
+    buf.resize(DEFAULT_BUFFER_SIZE - 2);
+    buf += "abcd";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, {{"abcd", 4}, {"ab", 2}});
+
+    auto r = searcher.next_match();
+    ASSERT_TRUE(r);
+    ASSERT_TRUE(r.value());
+    ASSERT_EQ(r.value()->offset, DEFAULT_BUFFER_SIZE - 2);
+    ASSERT_EQ(r.value()->pattern, 0u);
+
+    r = searcher.next_match();
+    ASSERT_TRUE(r);
+    ASSERT_FALSE(r.value());
+}
+
+TEST(FileSearchTest, FindShorterPatternAtEndOfFile)
+{
+    std::string buf = "xxxxab";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    FileSearcher searcher(&file, {{"abcd", 4}, {"ab", 2}});
+
+    auto r = searcher.next_match();
+    ASSERT_TRUE(r);
+    ASSERT_TRUE(r.value());
+    ASSERT_EQ(r.value()->offset, 4u);
+    ASSERT_EQ(r.value()->pattern, 1u);
+}
+
+static std::vector<std::pair<uint64_t, size_t>>
+search_sequential(File &file, std::vector<FileSearcher::Pattern> patterns)
+{
+    std::vector<std::pair<uint64_t, size_t>> matches;
+    FileSearcher searcher(&file, std::move(patterns));
+
+    while (true) {
+        auto r = searcher.next_match();
+        EXPECT_TRUE(r);
+        if (!r || !r.value()) {
+            break;
+        }
+        matches.emplace_back(r.value()->offset, r.value()->pattern);
+    }
+
+    return matches;
+}
+
+static std::vector<std::pair<uint64_t, size_t>>
+to_pairs(const std::vector<FileSearcher::Match> &matches)
+{
+    std::vector<std::pair<uint64_t, size_t>> result;
+    for (auto const &m : matches) {
+        result.emplace_back(m.offset, m.pattern);
+    }
+    return result;
+}
+
+TEST(FileSearchTest, FindParallelMatchesSequentialSearch)
+{
+    std::string buf;
+    for (int i = 0; i < 2000; ++i) {
+        buf += "xxbarxababab"[i * 7 % 12];
+        if (i % 97 == 0) {
+            buf += "foobar";
+        }
+    }
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<FileSearcher::Pattern> patterns{
+        {"abab", 4}, {"foobar", 6}, {"bar", 3}, {"", 0},
+    };
+
+    auto expected = search_sequential(file, patterns);
+    ASSERT_FALSE(expected.empty());
+
+    ThreadPool pool(4);
+
+    for (uint64_t chunk_size : {1, 2, 3, 5, 64, 4096}) {
+        auto r = FileSearcher::search_parallel(file, 0, buf.size(), patterns,
+                                               pool, chunk_size);
+        ASSERT_TRUE(r);
+        ASSERT_EQ(to_pairs(r.value()), expected)
+                << "Chunk size: " << chunk_size;
+    }
+}
+
+TEST(FileSearchTest, FindParallelDoesNotOverlapAcrossChunks)
+{
+    std::string buf = "ababababab";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    ThreadPool pool(2);
+
+    auto r = FileSearcher::search_parallel(file, 0, buf.size(), {{"abab", 4}},
+                                           pool, 3);
+    ASSERT_TRUE(r);
+
+    std::vector<std::pair<uint64_t, size_t>> expected{{0, 0}, {4, 0}};
+    ASSERT_EQ(to_pairs(r.value()), expected);
+}
+
+TEST(FileSearchTest, FindParallelInRange)
+{
+    std::string buf = "fooxxfooxxfooxxfoo";
+
+    MemoryFile file(buf.data(), buf.size());
+    ASSERT_TRUE(file.is_open());
+
+    ThreadPool pool(2);
+
+    // The last match would extend past the end of the range
+    auto r = FileSearcher::search_parallel(file, 3, 13, {{"foo", 3}}, pool, 4);
+    ASSERT_TRUE(r);
+
+    std::vector<std::pair<uint64_t, size_t>> expected{{2, 0}, {7, 0}};
+    ASSERT_EQ(to_pairs(r.value()), expected);
+}
+
 TEST(FileMoveTest, DegenerateCasesShouldSucceed)
 {
     char buf[] = "abcdef";
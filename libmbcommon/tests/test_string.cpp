@@ -46,6 +46,28 @@ TEST(StringTest, FormatSizeT)
     ASSERT_EQ(format("%" MB_PRIzX, unsigned_val), "FFFFFFFF");
 }
 
+TEST(StringTest, FormatToAppends)
+{
+    std::string buf("Hello");
+
+    format_to(buf, ", %s", "World");
+    format_to(buf, "%c", '!');
+    ASSERT_EQ(buf, "Hello, World!");
+
+    format_to(buf, "%s", "");
+    ASSERT_EQ(buf, "Hello, World!");
+}
+
+TEST(StringTest, FormatToLargeString)
+{
+    std::string large(1000, 'x');
+    std::string buf("prefix:");
+
+    ASSERT_TRUE(format_to_safe(buf, "%s:%d", large.c_str(), 42));
+    ASSERT_EQ(buf, "prefix:" + large + ":42");
+    ASSERT_EQ(format("%s", large.c_str()), large);
+}
+
 TEST(StringTest, CheckStartsWithNormal)
 {
     // Check equal strings
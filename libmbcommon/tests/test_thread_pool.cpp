@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include "mbcommon/thread_pool.h"
+
+using namespace mb;
+
+TEST(ThreadPoolTest, RunsAllTasks)
+{
+    std::atomic_int count(0);
+
+    {
+        ThreadPool pool(4);
+        ASSERT_EQ(pool.size(), 4u);
+
+        for (int i = 0; i < 1000; ++i) {
+            pool.submit([&] { ++count; });
+        }
+    }
+
+    ASSERT_EQ(count, 1000);
+}
+
+TEST(ThreadPoolTest, TrySubmitFailsWhenFull)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool started = false;
+    bool release = false;
+
+    ThreadPool pool(1, 1);
+
+    pool.submit([&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        started = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return release; });
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return started; });
+    }
+
+    // The worker is busy, so this fills the queue
+    ASSERT_TRUE(pool.try_submit([] {}));
+    ASSERT_FALSE(pool.try_submit([] {}));
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release = true;
+    }
+    cv.notify_all();
+}
+
+TEST(ThreadPoolTest, GroupWaitsForTasks)
+{
+    ThreadPool pool(2);
+    TaskGroup group(pool);
+    std::atomic_int count(0);
+
+    for (int i = 0; i < 100; ++i) {
+        group.run([&]() -> oc::result<void> {
+            ++count;
+            return oc::success();
+        });
+    }
+
+    ASSERT_TRUE(group.wait());
+    ASSERT_EQ(count, 100);
+}
+
+TEST(ThreadPoolTest, GroupReportsFirstError)
+{
+    ThreadPool pool(1);
+    TaskGroup group(pool);
+    std::atomic_int count(0);
+
+    group.run([]() -> oc::result<void> {
+        return std::errc::io_error;
+    });
+    for (int i = 0; i < 100; ++i) {
+        group.run([&]() -> oc::result<void> {
+            ++count;
+            return oc::success();
+        });
+    }
+
+    auto ret = group.wait();
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::io_error);
+    ASSERT_TRUE(group.token().is_cancelled());
+    ASSERT_LT(count, 100);
+}
+
+TEST(ThreadPoolTest, GroupCancel)
+{
+    ThreadPool pool(1);
+    TaskGroup group(pool);
+    bool ran = false;
+
+    group.cancel();
+    group.run([&]() -> oc::result<void> {
+        ran = true;
+        return oc::success();
+    });
+
+    auto ret = group.wait();
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::operation_canceled);
+    ASSERT_FALSE(ran);
+}
+
+TEST(ThreadPoolTest, NestedGroupsDoNotDeadlock)
+{
+    ThreadPool pool(1, 2);
+    TaskGroup outer(pool);
+    std::atomic_int count(0);
+
+    for (int i = 0; i < 4; ++i) {
+        outer.run([&]() -> oc::result<void> {
+            TaskGroup inner(pool);
+
+            for (int j = 0; j < 8; ++j) {
+                inner.run([&]() -> oc::result<void> {
+                    ++count;
+                    return oc::success();
+                });
+            }
+
+            return inner.wait();
+        });
+    }
+
+    ASSERT_TRUE(outer.wait());
+    ASSERT_EQ(count, 32);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mbdevice/device.h"
+
+namespace mb::device
+{
+
+class BinaryDeviceDatabase;
+
+class MB_EXPORT BinaryDeviceRef
+{
+public:
+    std::string_view id() const;
+    std::string_view name() const;
+    std::string_view architecture() const;
+    DeviceFlags flags() const;
+
+    size_t codename_count() const;
+    std::string_view codename(size_t index) const;
+
+    Device to_device() const;
+
+private:
+    BinaryDeviceRef(const BinaryDeviceDatabase &db, size_t offset);
+
+    const BinaryDeviceDatabase *m_db;
+    size_t m_offset;
+
+    friend class BinaryDeviceDatabase;
+};
+
+class MB_EXPORT BinaryDeviceDatabase
+{
+public:
+    BinaryDeviceDatabase();
+
+    bool open(std::string_view data);
+
+    size_t size() const;
+
+    std::optional<BinaryDeviceRef> at(size_t index) const;
+    std::optional<BinaryDeviceRef> find_by_id(std::string_view id) const;
+    std::optional<BinaryDeviceRef>
+    find_by_codename(std::string_view codename) const;
+
+    static bool is_binary(std::string_view data);
+
+private:
+    uint32_t word(size_t offset) const;
+    std::string_view string(size_t offset) const;
+    std::optional<BinaryDeviceRef>
+    find(size_t index_offset, size_t count, std::string_view key) const;
+
+    std::string_view m_data;
+    size_t m_device_count;
+    size_t m_devices_offset;
+    size_t m_id_count;
+    size_t m_id_index_offset;
+    size_t m_codename_count;
+    size_t m_codename_index_offset;
+    size_t m_lists_offset;
+    size_t m_strings_offset;
+
+    friend class BinaryDeviceRef;
+};
+
+MB_EXPORT bool device_list_to_binary(const std::vector<Device> &devices,
+                                     std::string &data);
+
+}
@@ -19,6 +19,13 @@
 
 #pragma once
 
+#include <memory>
+#include <string_view>
+
+#include "mbcommon/file.h"
+#include "mbcommon/flags.h"
+#include "mbcommon/outcome.h"
+
 #include "mbdevice/device.h"
 
 namespace mb::device
@@ -53,4 +60,63 @@ MB_EXPORT bool device_list_from_json(const std::string &json,
 
 MB_EXPORT bool device_to_json(const Device &device, std::string &json);
 
+namespace detail
+{
+struct DeviceJsonWriterData;
+}
+
+class MB_EXPORT DeviceJsonWriter
+{
+public:
+    DeviceJsonWriter();
+    ~DeviceJsonWriter();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DeviceJsonWriter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(DeviceJsonWriter)
+
+    bool write(const Device &device);
+    oc::result<void> write(const Device &device, File &file);
+
+    std::string_view data() const;
+
+private:
+    std::unique_ptr<detail::DeviceJsonWriterData> m_data;
+};
+
+enum class DeviceDatabaseFlag : uint8_t
+{
+    // Skip schema validation. Only use this for inputs that are known to be
+    // valid, such as a signed devices.json shipped with the patcher.
+    SkipValidation = 1 << 0,
+};
+MB_DECLARE_FLAGS(DeviceDatabaseFlags, DeviceDatabaseFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(DeviceDatabaseFlags)
+
+namespace detail
+{
+struct DeviceDatabaseData;
+}
+
+class MB_EXPORT DeviceDatabase
+{
+public:
+    DeviceDatabase();
+    ~DeviceDatabase();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DeviceDatabase)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(DeviceDatabase)
+
+    bool load(const std::string &json, DeviceDatabaseFlags flags,
+              JsonError &error);
+
+    size_t size() const;
+
+    const Device * at(size_t index) const;
+    const Device * find_by_id(std::string_view id) const;
+    const Device * find_by_codename(std::string_view codename) const;
+
+private:
+    std::unique_ptr<detail::DeviceDatabaseData> m_data;
+};
+
 }
@@ -0,0 +1,689 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/binary.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+// Binary device list format
+//
+// All integers are 32-bit little endian words. Offsets in the header are byte
+// offsets from the beginning of the data. The file is laid out so that it can
+// be mmap'd and accessed directly without any parsing or allocation.
+//
+// Header:
+//   char[8]    Magic ("MBDEVDB\0")
+//   u32        Version
+//   u32        Number of devices
+//   u32        Offset of device records
+//   u32        Number of ID index entries
+//   u32        Offset of ID index
+//   u32        Number of codename index entries
+//   u32        Offset of codename index
+//   u32        Offset of string list table
+//   u32        Number of string list table entries
+//   u32        Offset of string table
+//   u32        Size of string table
+//
+// A string reference is a pair of words: the offset of the string in the
+// string table and its length. Strings are followed by a NUL terminator that
+// is not included in the length.
+//
+// A list reference is a pair of words: the index of the first string
+// reference in the string list table and the number of items.
+//
+// Device records have a fixed size and contain the fields listed in the
+// DeviceField enum below. Index entries consist of a string reference and a
+// device index and are sorted by the raw bytes of the string. If multiple
+// devices have the same ID or codename, only the first one is indexed.
+
+namespace mb::device
+{
+
+static constexpr char BINARY_MAGIC[] = "MBDEVDB";
+static constexpr size_t BINARY_MAGIC_SIZE = sizeof(BINARY_MAGIC);
+static constexpr uint32_t BINARY_VERSION = 1;
+
+enum HeaderField : size_t
+{
+    H_VERSION = BINARY_MAGIC_SIZE,
+    H_DEVICE_COUNT = H_VERSION + 4,
+    H_DEVICES_OFFSET = H_DEVICE_COUNT + 4,
+    H_ID_COUNT = H_DEVICES_OFFSET + 4,
+    H_ID_INDEX_OFFSET = H_ID_COUNT + 4,
+    H_CODENAME_COUNT = H_ID_INDEX_OFFSET + 4,
+    H_CODENAME_INDEX_OFFSET = H_CODENAME_COUNT + 4,
+    H_LISTS_OFFSET = H_CODENAME_INDEX_OFFSET + 4,
+    H_LISTS_COUNT = H_LISTS_OFFSET + 4,
+    H_STRINGS_OFFSET = H_LISTS_COUNT + 4,
+    H_STRINGS_SIZE = H_STRINGS_OFFSET + 4,
+    HEADER_SIZE = H_STRINGS_SIZE + 4,
+};
+
+// Word offsets of fields in a device record
+enum DeviceField : size_t
+{
+    D_ID = 0,
+    D_NAME = D_ID + 2,
+    D_ARCHITECTURE = D_NAME + 2,
+    D_CODENAMES = D_ARCHITECTURE + 2,
+    D_FLAGS = D_CODENAMES + 2,
+    D_BASE_DIRS = D_FLAGS + 1,
+    D_SYSTEM_DEVS = D_BASE_DIRS + 2,
+    D_CACHE_DEVS = D_SYSTEM_DEVS + 2,
+    D_DATA_DEVS = D_CACHE_DEVS + 2,
+    D_BOOT_DEVS = D_DATA_DEVS + 2,
+    D_RECOVERY_DEVS = D_BOOT_DEVS + 2,
+    D_EXTRA_DEVS = D_RECOVERY_DEVS + 2,
+    D_TW_SUPPORTED = D_EXTRA_DEVS + 2,
+    D_TW_FLAGS = D_TW_SUPPORTED + 1,
+    D_TW_PIXEL_FORMAT = D_TW_FLAGS + 1,
+    D_TW_FORCE_PIXEL_FORMAT = D_TW_PIXEL_FORMAT + 1,
+    D_TW_OVERSCAN_PERCENT = D_TW_FORCE_PIXEL_FORMAT + 1,
+    D_TW_DEFAULT_X_OFFSET = D_TW_OVERSCAN_PERCENT + 1,
+    D_TW_DEFAULT_Y_OFFSET = D_TW_DEFAULT_X_OFFSET + 1,
+    D_TW_BRIGHTNESS_PATH = D_TW_DEFAULT_Y_OFFSET + 1,
+    D_TW_SECONDARY_BRIGHTNESS_PATH = D_TW_BRIGHTNESS_PATH + 2,
+    D_TW_MAX_BRIGHTNESS = D_TW_SECONDARY_BRIGHTNESS_PATH + 2,
+    D_TW_DEFAULT_BRIGHTNESS = D_TW_MAX_BRIGHTNESS + 1,
+    D_TW_BATTERY_PATH = D_TW_DEFAULT_BRIGHTNESS + 1,
+    D_TW_CPU_TEMP_PATH = D_TW_BATTERY_PATH + 2,
+    D_TW_INPUT_BLACKLIST = D_TW_CPU_TEMP_PATH + 2,
+    D_TW_INPUT_WHITELIST = D_TW_INPUT_BLACKLIST + 2,
+    D_TW_GRAPHICS_BACKENDS = D_TW_INPUT_WHITELIST + 2,
+    D_TW_THEME = D_TW_GRAPHICS_BACKENDS + 2,
+    DEVICE_WORDS = D_TW_THEME + 2,
+};
+
+static constexpr size_t g_device_string_fields[] = {
+    D_ID,
+    D_NAME,
+    D_ARCHITECTURE,
+    D_TW_BRIGHTNESS_PATH,
+    D_TW_SECONDARY_BRIGHTNESS_PATH,
+    D_TW_BATTERY_PATH,
+    D_TW_CPU_TEMP_PATH,
+    D_TW_INPUT_BLACKLIST,
+    D_TW_INPUT_WHITELIST,
+    D_TW_THEME,
+};
+
+static constexpr size_t g_device_list_fields[] = {
+    D_CODENAMES,
+    D_BASE_DIRS,
+    D_SYSTEM_DEVS,
+    D_CACHE_DEVS,
+    D_DATA_DEVS,
+    D_BOOT_DEVS,
+    D_RECOVERY_DEVS,
+    D_EXTRA_DEVS,
+    D_TW_GRAPHICS_BACKENDS,
+};
+
+static constexpr size_t INDEX_ENTRY_WORDS = 3;
+
+static inline uint32_t read_word(std::string_view data, size_t offset)
+{
+    uint32_t value;
+    memcpy(&value, data.data() + offset, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static inline bool range_valid(size_t size, uint64_t offset, uint64_t length)
+{
+    return offset <= size && length <= size - offset;
+}
+
+/*!
+ * \class BinaryDeviceRef
+ *
+ * \brief Reference to a device in a BinaryDeviceDatabase
+ *
+ * The reference and the strings returned by its functions point directly into
+ * the database's data and remain valid for as long as the data does.
+ */
+
+BinaryDeviceRef::BinaryDeviceRef(const BinaryDeviceDatabase &db, size_t offset)
+    : m_db(&db)
+    , m_offset(offset)
+{
+}
+
+std::string_view BinaryDeviceRef::id() const
+{
+    return m_db->string(m_offset + D_ID * 4);
+}
+
+std::string_view BinaryDeviceRef::name() const
+{
+    return m_db->string(m_offset + D_NAME * 4);
+}
+
+std::string_view BinaryDeviceRef::architecture() const
+{
+    return m_db->string(m_offset + D_ARCHITECTURE * 4);
+}
+
+DeviceFlags BinaryDeviceRef::flags() const
+{
+    return static_cast<DeviceFlag>(m_db->word(m_offset + D_FLAGS * 4)
+            & DEVICE_FLAG_MASK);
+}
+
+size_t BinaryDeviceRef::codename_count() const
+{
+    return m_db->word(m_offset + (D_CODENAMES + 1) * 4);
+}
+
+/*!
+ * \brief Get codename at index
+ *
+ * \pre \p index must be less than codename_count()
+ */
+std::string_view BinaryDeviceRef::codename(size_t index) const
+{
+    size_t first = m_db->word(m_offset + D_CODENAMES * 4);
+    return m_db->string(m_db->m_lists_offset + (first + index) * 8);
+}
+
+/*!
+ * \brief Construct Device containing all fields of the referenced device
+ */
+Device BinaryDeviceRef::to_device() const
+{
+    auto str = [&](size_t field) {
+        return std::string(m_db->string(m_offset + field * 4));
+    };
+    auto list = [&](size_t field) {
+        size_t first = m_db->word(m_offset + field * 4);
+        size_t count = m_db->word(m_offset + (field + 1) * 4);
+
+        std::vector<std::string> result;
+        result.reserve(count);
+
+        for (size_t i = 0; i < count; ++i) {
+            result.emplace_back(m_db->string(
+                    m_db->m_lists_offset + (first + i) * 8));
+        }
+
+        return result;
+    };
+    auto num = [&](size_t field) {
+        return static_cast<int>(static_cast<int32_t>(
+                m_db->word(m_offset + field * 4)));
+    };
+
+    Device device;
+
+    device.set_id(str(D_ID));
+    device.set_codenames(list(D_CODENAMES));
+    device.set_name(str(D_NAME));
+    device.set_architecture(str(D_ARCHITECTURE));
+    device.set_flags(flags());
+
+    device.set_block_dev_base_dirs(list(D_BASE_DIRS));
+    device.set_system_block_devs(list(D_SYSTEM_DEVS));
+    device.set_cache_block_devs(list(D_CACHE_DEVS));
+    device.set_data_block_devs(list(D_DATA_DEVS));
+    device.set_boot_block_devs(list(D_BOOT_DEVS));
+    device.set_recovery_block_devs(list(D_RECOVERY_DEVS));
+    device.set_extra_block_devs(list(D_EXTRA_DEVS));
+
+    device.set_tw_supported(m_db->word(m_offset + D_TW_SUPPORTED * 4) != 0);
+    device.set_tw_flags(static_cast<TwFlag>(
+            m_db->word(m_offset + D_TW_FLAGS * 4) & TW_FLAG_MASK));
+    device.set_tw_pixel_format(static_cast<TwPixelFormat>(
+            m_db->word(m_offset + D_TW_PIXEL_FORMAT * 4)));
+    device.set_tw_force_pixel_format(static_cast<TwForcePixelFormat>(
+            m_db->word(m_offset + D_TW_FORCE_PIXEL_FORMAT * 4)));
+    device.set_tw_overscan_percent(num(D_TW_OVERSCAN_PERCENT));
+    device.set_tw_default_x_offset(num(D_TW_DEFAULT_X_OFFSET));
+    device.set_tw_default_y_offset(num(D_TW_DEFAULT_Y_OFFSET));
+    device.set_tw_brightness_path(str(D_TW_BRIGHTNESS_PATH));
+    device.set_tw_secondary_brightness_path(
+            str(D_TW_SECONDARY_BRIGHTNESS_PATH));
+    device.set_tw_max_brightness(num(D_TW_MAX_BRIGHTNESS));
+    device.set_tw_default_brightness(num(D_TW_DEFAULT_BRIGHTNESS));
+    device.set_tw_battery_path(str(D_TW_BATTERY_PATH));
+    device.set_tw_cpu_temp_path(str(D_TW_CPU_TEMP_PATH));
+    device.set_tw_input_blacklist(str(D_TW_INPUT_BLACKLIST));
+    device.set_tw_input_whitelist(str(D_TW_INPUT_WHITELIST));
+    device.set_tw_graphics_backends(list(D_TW_GRAPHICS_BACKENDS));
+    device.set_tw_theme(str(D_TW_THEME));
+
+    return device;
+}
+
+/*!
+ * \class BinaryDeviceDatabase
+ *
+ * \brief Zero-copy reader for binary device lists generated by devicesgen
+ *
+ * The database does not copy the data passed to open(). The caller must keep
+ * it alive (eg. by keeping the file mmap'd) for as long as the database or
+ * any BinaryDeviceRef is in use. Lookups do not allocate memory.
+ */
+
+BinaryDeviceDatabase::BinaryDeviceDatabase()
+    : m_device_count(0)
+    , m_devices_offset(0)
+    , m_id_count(0)
+    , m_id_index_offset(0)
+    , m_codename_count(0)
+    , m_codename_index_offset(0)
+    , m_lists_offset(0)
+    , m_strings_offset(0)
+{
+}
+
+/*!
+ * \brief Check if data looks like a binary device list
+ */
+bool BinaryDeviceDatabase::is_binary(std::string_view data)
+{
+    return data.size() >= BINARY_MAGIC_SIZE
+            && memcmp(data.data(), BINARY_MAGIC, BINARY_MAGIC_SIZE) == 0;
+}
+
+/*!
+ * \brief Open binary device list
+ *
+ * The bounds of every table, string, and list are checked once here so that
+ * the accessors do not need to do any checking.
+ *
+ * \param data Binary device list
+ *
+ * \return Whether the data is a valid binary device list. If the data is
+ *         invalid, the previously opened list is kept.
+ */
+bool BinaryDeviceDatabase::open(std::string_view data)
+{
+    if (data.size() < HEADER_SIZE || !is_binary(data)
+            || read_word(data, H_VERSION) != BINARY_VERSION) {
+        return false;
+    }
+
+    const size_t size = data.size();
+    const uint64_t device_count = read_word(data, H_DEVICE_COUNT);
+    const uint64_t devices_offset = read_word(data, H_DEVICES_OFFSET);
+    const uint64_t id_count = read_word(data, H_ID_COUNT);
+    const uint64_t id_index_offset = read_word(data, H_ID_INDEX_OFFSET);
+    const uint64_t codename_count = read_word(data, H_CODENAME_COUNT);
+    const uint64_t codename_index_offset =
+            read_word(data, H_CODENAME_INDEX_OFFSET);
+    const uint64_t lists_offset = read_word(data, H_LISTS_OFFSET);
+    const uint64_t lists_count = read_word(data, H_LISTS_COUNT);
+    const uint64_t strings_offset = read_word(data, H_STRINGS_OFFSET);
+    const uint64_t strings_size = read_word(data, H_STRINGS_SIZE);
+
+    if (!range_valid(size, devices_offset, device_count * DEVICE_WORDS * 4)
+            || !range_valid(size, id_index_offset,
+                            id_count * INDEX_ENTRY_WORDS * 4)
+            || !range_valid(size, codename_index_offset,
+                            codename_count * INDEX_ENTRY_WORDS * 4)
+            || !range_valid(size, lists_offset, lists_count * 8)
+            || !range_valid(size, strings_offset, strings_size)) {
+        return false;
+    }
+
+    auto string_valid = [&](uint64_t offset) {
+        return range_valid(strings_size, read_word(data, offset),
+                           read_word(data, offset + 4));
+    };
+    auto list_valid = [&](uint64_t offset) {
+        return range_valid(lists_count, read_word(data, offset),
+                           read_word(data, offset + 4));
+    };
+    auto string_at = [&](uint64_t offset) {
+        return data.substr(strings_offset + read_word(data, offset),
+                           read_word(data, offset + 4));
+    };
+
+    for (uint64_t i = 0; i < lists_count; ++i) {
+        if (!string_valid(lists_offset + i * 8)) {
+            return false;
+        }
+    }
+
+    for (uint64_t i = 0; i < device_count; ++i) {
+        auto offset = devices_offset + i * DEVICE_WORDS * 4;
+
+        for (auto field : g_device_string_fields) {
+            if (!string_valid(offset + field * 4)) {
+                return false;
+            }
+        }
+        for (auto field : g_device_list_fields) {
+            if (!list_valid(offset + field * 4)) {
+                return false;
+            }
+        }
+    }
+
+    // Binary search requires the indexes to be sorted
+    auto index_valid = [&](uint64_t offset, uint64_t count) {
+        std::string_view prev;
+
+        for (uint64_t i = 0; i < count; ++i) {
+            auto entry = offset + i * INDEX_ENTRY_WORDS * 4;
+
+            if (!string_valid(entry)
+                    || read_word(data, entry + 8) >= device_count) {
+                return false;
+            }
+
+            auto key = string_at(entry);
+            if (i > 0 && !(prev < key)) {
+                return false;
+            }
+            prev = key;
+        }
+
+        return true;
+    };
+
+    if (!index_valid(id_index_offset, id_count)
+            || !index_valid(codename_index_offset, codename_count)) {
+        return false;
+    }
+
+    m_data = data;
+    m_device_count = device_count;
+    m_devices_offset = devices_offset;
+    m_id_count = id_count;
+    m_id_index_offset = id_index_offset;
+    m_codename_count = codename_count;
+    m_codename_index_offset = codename_index_offset;
+    m_lists_offset = lists_offset;
+    m_strings_offset = strings_offset;
+
+    return true;
+}
+
+/*!
+ * \brief Get number of devices in the list
+ */
+size_t BinaryDeviceDatabase::size() const
+{
+    return m_device_count;
+}
+
+/*!
+ * \brief Get device at index
+ *
+ * \return Device reference or std::nullopt if \p index is out of range
+ */
+std::optional<BinaryDeviceRef> BinaryDeviceDatabase::at(size_t index) const
+{
+    if (index >= m_device_count) {
+        return std::nullopt;
+    }
+
+    return BinaryDeviceRef(*this, m_devices_offset + index * DEVICE_WORDS * 4);
+}
+
+/*!
+ * \brief Find device by ID
+ *
+ * \return Device reference or std::nullopt if no device has the ID
+ */
+std::optional<BinaryDeviceRef>
+BinaryDeviceDatabase::find_by_id(std::string_view id) const
+{
+    return find(m_id_index_offset, m_id_count, id);
+}
+
+/*!
+ * \brief Find device by codename
+ *
+ * \return Device reference or std::nullopt if no device has the codename
+ */
+std::optional<BinaryDeviceRef>
+BinaryDeviceDatabase::find_by_codename(std::string_view codename) const
+{
+    return find(m_codename_index_offset, m_codename_count, codename);
+}
+
+uint32_t BinaryDeviceDatabase::word(size_t offset) const
+{
+    return read_word(m_data, offset);
+}
+
+std::string_view BinaryDeviceDatabase::string(size_t offset) const
+{
+    return m_data.substr(m_strings_offset + word(offset), word(offset + 4));
+}
+
+std::optional<BinaryDeviceRef>
+BinaryDeviceDatabase::find(size_t index_offset, size_t count,
+                           std::string_view key) const
+{
+    size_t low = 0;
+    size_t high = count;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        auto entry = index_offset + mid * INDEX_ENTRY_WORDS * 4;
+        auto value = string(entry);
+
+        if (value < key) {
+            low = mid + 1;
+        } else if (key < value) {
+            high = mid;
+        } else {
+            return at(word(entry + 8));
+        }
+    }
+
+    return std::nullopt;
+}
+
+namespace
+{
+
+class BinaryBuilder
+{
+public:
+    void add_word(std::vector<uint32_t> &out, uint32_t value)
+    {
+        out.push_back(value);
+    }
+
+    void add_string(std::vector<uint32_t> &out, const std::string &str)
+    {
+        auto [it, inserted] = m_string_offsets.emplace(str, m_strings.size());
+        if (inserted) {
+            m_strings += str;
+            m_strings += '\0';
+        }
+
+        out.push_back(static_cast<uint32_t>(it->second));
+        out.push_back(static_cast<uint32_t>(str.size()));
+    }
+
+    void add_list(std::vector<uint32_t> &out,
+                  const std::vector<std::string> &list)
+    {
+        out.push_back(static_cast<uint32_t>(m_lists.size() / 2));
+        out.push_back(static_cast<uint32_t>(list.size()));
+
+        for (auto const &item : list) {
+            add_string(m_lists, item);
+        }
+    }
+
+    void add_index(std::vector<uint32_t> &out,
+                   std::vector<std::pair<std::string, uint32_t>> entries)
+    {
+        // Stable sort so the first device with a key is the one that's kept
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](auto const &a, auto const &b) {
+            return std::string_view(a.first) < std::string_view(b.first);
+        });
+        entries.erase(std::unique(entries.begin(), entries.end(),
+                                  [](auto const &a, auto const &b) {
+            return a.first == b.first;
+        }), entries.end());
+
+        for (auto const &[key, index] : entries) {
+            add_string(out, key);
+            out.push_back(index);
+        }
+    }
+
+    const std::vector<uint32_t> & lists() const
+    {
+        return m_lists;
+    }
+
+    const std::string & strings() const
+    {
+        return m_strings;
+    }
+
+private:
+    std::vector<uint32_t> m_lists;
+    std::string m_strings;
+    std::unordered_map<std::string, size_t> m_string_offsets;
+};
+
+}
+
+static void append_words(std::string &data, const std::vector<uint32_t> &words)
+{
+    for (auto w : words) {
+        w = mb_htole32(w);
+        data.append(reinterpret_cast<const char *>(&w), sizeof(w));
+    }
+}
+
+/*!
+ * \brief Convert device list to the binary format
+ *
+ * \param[in] devices List of devices
+ * \param[out] data Binary device list
+ *
+ * \return Whether the list fits in the binary format
+ */
+bool device_list_to_binary(const std::vector<Device> &devices,
+                           std::string &data)
+{
+    BinaryBuilder b;
+    std::vector<uint32_t> records;
+    std::vector<std::pair<std::string, uint32_t>> ids;
+    std::vector<std::pair<std::string, uint32_t>> codenames;
+
+    if (devices.size() > UINT32_MAX / (DEVICE_WORDS * 4)) {
+        return false;
+    }
+
+    records.reserve(devices.size() * DEVICE_WORDS);
+
+    for (size_t i = 0; i < devices.size(); ++i) {
+        auto const &d = devices[i];
+        auto index = static_cast<uint32_t>(i);
+
+        b.add_string(records, d.id());
+        b.add_string(records, d.name());
+        b.add_string(records, d.architecture());
+        b.add_list(records, d.codenames());
+        b.add_word(records, static_cast<uint32_t>(d.flags()));
+        b.add_list(records, d.block_dev_base_dirs());
+        b.add_list(records, d.system_block_devs());
+        b.add_list(records, d.cache_block_devs());
+        b.add_list(records, d.data_block_devs());
+        b.add_list(records, d.boot_block_devs());
+        b.add_list(records, d.recovery_block_devs());
+        b.add_list(records, d.extra_block_devs());
+        b.add_word(records, d.tw_supported());
+        b.add_word(records, static_cast<uint32_t>(d.tw_flags()));
+        b.add_word(records, static_cast<uint32_t>(d.tw_pixel_format()));
+        b.add_word(records, static_cast<uint32_t>(d.tw_force_pixel_format()));
+        b.add_word(records, static_cast<uint32_t>(d.tw_overscan_percent()));
+        b.add_word(records, static_cast<uint32_t>(d.tw_default_x_offset()));
+        b.add_word(records, static_cast<uint32_t>(d.tw_default_y_offset()));
+        b.add_string(records, d.tw_brightness_path());
+        b.add_string(records, d.tw_secondary_brightness_path());
+        b.add_word(records, static_cast<uint32_t>(d.tw_max_brightness()));
+        b.add_word(records, static_cast<uint32_t>(d.tw_default_brightness()));
+        b.add_string(records, d.tw_battery_path());
+        b.add_string(records, d.tw_cpu_temp_path());
+        b.add_string(records, d.tw_input_blacklist());
+        b.add_string(records, d.tw_input_whitelist());
+        b.add_list(records, d.tw_graphics_backends());
+        b.add_string(records, d.tw_theme());
+
+        ids.emplace_back(d.id(), index);
+        for (auto &codename : d.codenames()) {
+            codenames.emplace_back(std::move(codename), index);
+        }
+    }
+
+    std::vector<uint32_t> id_index;
+    std::vector<uint32_t> codename_index;
+
+    b.add_index(id_index, std::move(ids));
+    b.add_index(codename_index, std::move(codenames));
+
+    auto const &lists = b.lists();
+    auto const &strings = b.strings();
+
+    uint64_t devices_offset = HEADER_SIZE;
+    uint64_t id_index_offset = devices_offset + records.size() * 4;
+    uint64_t codename_index_offset = id_index_offset + id_index.size() * 4;
+    uint64_t lists_offset = codename_index_offset + codename_index.size() * 4;
+    uint64_t strings_offset = lists_offset + lists.size() * 4;
+
+    if (strings_offset + strings.size() > UINT32_MAX) {
+        return false;
+    }
+
+    std::string result;
+    result.reserve(strings_offset + strings.size());
+    result.append(BINARY_MAGIC, BINARY_MAGIC_SIZE);
+
+    append_words(result, {
+        BINARY_VERSION,
+        static_cast<uint32_t>(devices.size()),
+        static_cast<uint32_t>(devices_offset),
+        static_cast<uint32_t>(id_index.size() / INDEX_ENTRY_WORDS),
+        static_cast<uint32_t>(id_index_offset),
+        static_cast<uint32_t>(codename_index.size() / INDEX_ENTRY_WORDS),
+        static_cast<uint32_t>(codename_index_offset),
+        static_cast<uint32_t>(lists_offset),
+        static_cast<uint32_t>(lists.size() / 2),
+        static_cast<uint32_t>(strings_offset),
+        static_cast<uint32_t>(strings.size()),
+    });
+    append_words(result, records);
+    append_words(result, id_index);
+    append_words(result, codename_index);
+    append_words(result, lists);
+    result += strings;
+
+    data.swap(result);
+    return true;
+}
+
+}
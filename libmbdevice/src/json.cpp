@@ -20,16 +20,22 @@
 #include "mbdevice/json.h"
 
 #include <array>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 
 #include <cassert>
 #include <cstring>
 
 #include <rapidjson/document.h>
 #include <rapidjson/error/en.h>
+#include <rapidjson/reader.h>
 #include <rapidjson/schema.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbdevice/schema.h"
 
@@ -284,33 +290,187 @@ static void process_device(Device &device, const Value &node)
     }
 }
 
-bool device_from_json(const std::string &json, Device &device, JsonError &error)
+namespace
 {
-    DeviceSchemaProvider<> sp;
-    const SchemaDocument *sd = sp.GetSchema("device.json");
-    if (!sd) {
-        assert(false);
+
+/*!
+ * \brief SAX handler that forwards events to a Document
+ *
+ * This allows a pooled validator, whose output handler is fixed when it is
+ * constructed, to populate a different Document each time it is used.
+ */
+class DocumentForwarder
+{
+public:
+    using Ch = Document::Ch;
+
+    Document *target = nullptr;
+
+    bool Null() { return target->Null(); }
+    bool Bool(bool b) { return target->Bool(b); }
+    bool Int(int i) { return target->Int(i); }
+    bool Uint(unsigned i) { return target->Uint(i); }
+    bool Int64(int64_t i) { return target->Int64(i); }
+    bool Uint64(uint64_t i) { return target->Uint64(i); }
+    bool Double(double d) { return target->Double(d); }
+    bool RawNumber(const Ch *str, SizeType length, bool copy)
+    {
+        return target->RawNumber(str, length, copy);
+    }
+    bool String(const Ch *str, SizeType length, bool copy)
+    {
+        return target->String(str, length, copy);
+    }
+    bool StartObject() { return target->StartObject(); }
+    bool Key(const Ch *str, SizeType length, bool copy)
+    {
+        return target->Key(str, length, copy);
+    }
+    bool EndObject(SizeType member_count)
+    {
+        return target->EndObject(member_count);
+    }
+    bool StartArray() { return target->StartArray(); }
+    bool EndArray(SizeType element_count)
+    {
+        return target->EndArray(element_count);
+    }
+};
+
+struct PooledValidator
+{
+    DocumentForwarder forwarder;
+    GenericSchemaValidator<SchemaDocument, DocumentForwarder> validator;
+
+    explicit PooledValidator(const SchemaDocument &sd)
+        : validator(sd, forwarder)
+    {
+    }
+};
+
+/*!
+ * \brief Pool of reusable validators for a schema
+ *
+ * Constructing a validator allocates its schema and document stacks, so idle
+ * validators are kept around for the next caller instead.
+ */
+class ValidatorPool
+{
+public:
+    explicit ValidatorPool(const SchemaDocument &sd) : m_sd(sd)
+    {
+    }
+
+    std::unique_ptr<PooledValidator> acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (!m_idle.empty()) {
+                auto validator = std::move(m_idle.back());
+                m_idle.pop_back();
+                return validator;
+            }
+        }
+
+        return std::make_unique<PooledValidator>(m_sd);
+    }
+
+    void release(std::unique_ptr<PooledValidator> validator)
+    {
+        validator->validator.Reset();
+        validator->forwarder.target = nullptr;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (m_idle.size() < MAX_IDLE) {
+            m_idle.push_back(std::move(validator));
+        }
+    }
+
+private:
+    static constexpr size_t MAX_IDLE = 4;
+
+    const SchemaDocument &m_sd;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<PooledValidator>> m_idle;
+};
+
+/*!
+ * \brief Process-wide compiled schemas
+ *
+ * The schema documents resolve all of their remote references when they are
+ * constructed, so the provider is never used again afterwards. The documents
+ * are immutable and can be shared by validators on any thread.
+ */
+struct CompiledSchemas
+{
+    DeviceSchemaProvider<> provider;
+    const SchemaDocument *device;
+    const SchemaDocument *device_list;
+    std::optional<ValidatorPool> device_pool;
+    std::optional<ValidatorPool> device_list_pool;
+
+    CompiledSchemas()
+        : device(provider.GetSchema("device.json"))
+        , device_list(provider.GetSchema("device_list.json"))
+    {
+        assert(device && device_list);
+
+        if (device) {
+            device_pool.emplace(*device);
+        }
+        if (device_list) {
+            device_list_pool.emplace(*device_list);
+        }
+    }
+};
+
+}
+
+static CompiledSchemas & compiled_schemas()
+{
+    static CompiledSchemas schemas;
+    return schemas;
+}
+
+static bool parse_validated(const std::string &json,
+                            std::optional<ValidatorPool> &pool, Document &d,
+                            JsonError &error)
+{
+    if (!pool) {
         return false;
     }
 
-    Document d;
+    auto v = pool->acquire();
+    auto release_validator = finally([&] {
+        pool->release(std::move(v));
+    });
+
+    Reader reader;
     StringStream is(json.c_str());
-    SchemaValidatingReader<kParseDefaultFlags, StringStream, UTF8<>> reader(is, *sd);
-    d.Populate(reader);
+    ParseResult result;
+
+    auto generator = [&](Document &handler) {
+        v->forwarder.target = &handler;
+        result = reader.Parse(is, v->validator);
+        return !result.IsError();
+    };
+    d.Populate(generator);
 
-    const ParseResult &result = reader.GetParseResult();
     if (!result) {
-        if (!reader.IsValid()) {
+        if (!v->validator.IsValid()) {
             StringBuffer sb;
-            reader.GetInvalidSchemaPointer().StringifyUriFragment(sb);
+            v->validator.GetInvalidSchemaPointer().StringifyUriFragment(sb);
             std::string schema_uri{sb.GetString(), sb.GetLength()};
             sb.Clear();
-            reader.GetInvalidDocumentPointer().StringifyUriFragment(sb);
+            v->validator.GetInvalidDocumentPointer().StringifyUriFragment(sb);
             std::string document_uri{sb.GetString(), sb.GetLength()};
 
             json_error_set_schema_validation_failure(
                     error, std::move(schema_uri),
-                    reader.GetInvalidSchemaKeyword(), std::move(document_uri));
+                    v->validator.GetInvalidSchemaKeyword(),
+                    std::move(document_uri));
         } else {
             json_error_set_parse_error(error, result.Offset(),
                                        GetParseError_En(result.Code()));
@@ -318,6 +478,16 @@ bool device_from_json(const std::string &json, Device &device, JsonError &error)
         return false;
     }
 
+    return true;
+}
+
+bool device_from_json(const std::string &json, Device &device, JsonError &error)
+{
+    Document d;
+    if (!parse_validated(json, compiled_schemas().device_pool, d, error)) {
+        return false;
+    }
+
     device = Device();
     process_device(device, d);
     return true;
@@ -327,35 +497,9 @@ bool device_list_from_json(const std::string &json,
                            std::vector<Device> &devices,
                            JsonError &error)
 {
-    DeviceSchemaProvider<> sp;
-    const SchemaDocument *sd = sp.GetSchema("device_list.json");
-    if (!sd) {
-        assert(false);
-        return false;
-    }
-
     Document d;
-    StringStream is(json.c_str());
-    SchemaValidatingReader<kParseDefaultFlags, StringStream, UTF8<>> reader(is, *sd);
-    d.Populate(reader);
-
-    const ParseResult &result = reader.GetParseResult();
-    if (!result) {
-        if (!reader.IsValid()) {
-            StringBuffer sb;
-            reader.GetInvalidSchemaPointer().StringifyUriFragment(sb);
-            std::string schema_uri{sb.GetString(), sb.GetLength()};
-            sb.Clear();
-            reader.GetInvalidDocumentPointer().StringifyUriFragment(sb);
-            std::string document_uri{sb.GetString(), sb.GetLength()};
-
-            json_error_set_schema_validation_failure(
-                    error, std::move(schema_uri),
-                    reader.GetInvalidSchemaKeyword(), std::move(document_uri));
-        } else {
-            json_error_set_parse_error(error, result.Offset(),
-                                       GetParseError_En(result.Code()));
-        }
+    if (!parse_validated(json, compiled_schemas().device_list_pool, d,
+                         error)) {
         return false;
     }
 
@@ -371,248 +515,557 @@ bool device_list_from_json(const std::string &json,
     return true;
 }
 
-bool device_to_json(const Device &device, std::string &json)
+template<typename Mapping, typename T>
+static const char * find_mapping_name(const Mapping &mappings, T value)
 {
-    Document d;
-    d.SetObject();
-
-    auto &alloc = d.GetAllocator();
-
-    auto const &id = device.id();
-    if (!id.empty()) {
-        d.AddMember("id", id, alloc);
-    }
-
-    auto const &codenames = device.codenames();
-    if (!codenames.empty()) {
-        Value array(kArrayType);
-        for (auto const &c : codenames) {
-            array.PushBack(StringRef(c), alloc);
+    for (auto const &item : mappings) {
+        if (item.second == value) {
+            return item.first;
         }
-        d.AddMember("codenames", array, alloc);
     }
+    return nullptr;
+}
 
-    auto const &name = device.name();
-    if (!name.empty()) {
-        d.AddMember("name", name, alloc);
+/*!
+ * \brief SAX event emitter for device serialization
+ *
+ * Once any handler call fails, the remaining calls are skipped and ok()
+ * returns false.
+ */
+template<typename Handler>
+class JsonEmitter
+{
+public:
+    explicit JsonEmitter(Handler &handler) : m_handler(handler), m_ok(true)
+    {
     }
 
-    auto const &architecture = device.architecture();
-    if (!architecture.empty()) {
-        d.AddMember("architecture", architecture, alloc);
+    bool ok() const
+    {
+        return m_ok;
     }
 
-    auto const flags = device.flags();
-    if (flags) {
-        Value array(kArrayType);
-        for (auto const &item : g_device_flag_mappings) {
-            if (flags & item.second) {
-                array.PushBack(StringRef(item.first), alloc);
-            }
-        }
-        d.AddMember("flags", array, alloc);
+    void start_object(std::string_view key)
+    {
+        this->key(key);
+        m_ok = m_ok && m_handler.StartObject();
     }
 
-    /* Block devs */
-    Value block_devs(kObjectType);
+    void start_object()
+    {
+        m_ok = m_ok && m_handler.StartObject();
+    }
 
-    auto const &base_dirs = device.block_dev_base_dirs();
-    if (!base_dirs.empty()) {
-        Value array(kArrayType);
-        for (auto const &p : base_dirs) {
-            array.PushBack(StringRef(p), alloc);
-        }
-        block_devs.AddMember("base_dirs", array, alloc);
+    void end_object(SizeType members)
+    {
+        m_ok = m_ok && m_handler.EndObject(members);
     }
 
-    auto const &system_devs = device.system_block_devs();
-    if (!system_devs.empty()) {
-        Value array(kArrayType);
-        for (auto const &p : system_devs) {
-            array.PushBack(StringRef(p), alloc);
+    void string_member(SizeType &members, std::string_view key,
+                       std::string_view value)
+    {
+        if (!value.empty()) {
+            this->key(key);
+            string(value);
+            ++members;
         }
-        block_devs.AddMember("system", array, alloc);
     }
 
-    auto const &cache_devs = device.cache_block_devs();
-    if (!cache_devs.empty()) {
-        Value array(kArrayType);
-        for (auto const &p : cache_devs) {
-            array.PushBack(StringRef(p), alloc);
+    void int_member(SizeType &members, std::string_view key, int value,
+                    int default_value)
+    {
+        if (value != default_value) {
+            this->key(key);
+            m_ok = m_ok && m_handler.Int(value);
+            ++members;
         }
-        block_devs.AddMember("cache", array, alloc);
     }
 
-    auto const &data_devs = device.data_block_devs();
-    if (!data_devs.empty()) {
-        Value array(kArrayType);
-        for (auto const &p : data_devs) {
-            array.PushBack(StringRef(p), alloc);
+    void bool_member(SizeType &members, std::string_view key, bool value)
+    {
+        if (value) {
+            this->key(key);
+            m_ok = m_ok && m_handler.Bool(value);
+            ++members;
         }
-        block_devs.AddMember("data", array, alloc);
     }
 
-    auto const &boot_devs = device.boot_block_devs();
-    if (!boot_devs.empty()) {
-        Value array(kArrayType);
-        for (auto const &p : boot_devs) {
-            array.PushBack(StringRef(p), alloc);
+    void array_member(SizeType &members, std::string_view key,
+                      const std::vector<std::string> &values)
+    {
+        if (!values.empty()) {
+            this->key(key);
+            m_ok = m_ok && m_handler.StartArray();
+            for (auto const &value : values) {
+                string(value);
+            }
+            m_ok = m_ok && m_handler.EndArray(
+                    static_cast<SizeType>(values.size()));
+            ++members;
         }
-        block_devs.AddMember("boot", array, alloc);
     }
 
-    auto const &recovery_devs = device.recovery_block_devs();
-    if (!recovery_devs.empty()) {
-        Value array(kArrayType);
-        for (auto const &p : recovery_devs) {
-            array.PushBack(StringRef(p), alloc);
+    template<typename Mapping, typename T>
+    void flags_member(SizeType &members, std::string_view key, T flags,
+                      const Mapping &mappings)
+    {
+        if (flags) {
+            SizeType count = 0;
+
+            this->key(key);
+            m_ok = m_ok && m_handler.StartArray();
+            for (auto const &item : mappings) {
+                if (flags & item.second) {
+                    string(item.first);
+                    ++count;
+                }
+            }
+            m_ok = m_ok && m_handler.EndArray(count);
+            ++members;
         }
-        block_devs.AddMember("recovery", array, alloc);
     }
 
-    auto const &extra_devs = device.extra_block_devs();
-    if (!extra_devs.empty()) {
-        Value array(kArrayType);
-        for (auto const &p : extra_devs) {
-            array.PushBack(StringRef(p), alloc);
-        }
-        block_devs.AddMember("extra", array, alloc);
+private:
+    void key(std::string_view key)
+    {
+        m_ok = m_ok && m_handler.Key(
+                key.data(), static_cast<SizeType>(key.size()), false);
     }
 
-    if (!block_devs.ObjectEmpty()) {
-        d.AddMember("block_devs", block_devs, alloc);
+    void string(std::string_view value)
+    {
+        m_ok = m_ok && m_handler.String(
+                value.data(), static_cast<SizeType>(value.size()), false);
     }
 
-    /* Boot UI */
-    Value boot_ui(kObjectType);
+    Handler &m_handler;
+    bool m_ok;
+};
 
-    if (device.tw_supported()) {
-        boot_ui.AddMember("supported", true, alloc);
-    }
+/*!
+ * \brief Serialize device as SAX events
+ *
+ * Members are emitted in the same order as device_to_json() has always used
+ * and members with default values are omitted.
+ */
+template<typename Handler>
+static bool write_device(const Device &device, Handler &handler)
+{
+    JsonEmitter<Handler> e(handler);
+    SizeType members = 0;
 
-    auto const tw_flags = device.tw_flags();
-    if (tw_flags) {
-        Value array(kArrayType);
-        for (auto const &item : g_tw_flag_mappings) {
-            if (tw_flags & item.second) {
-                array.PushBack(StringRef(item.first), alloc);
-            }
-        }
-        boot_ui.AddMember("flags", array, alloc);
-    }
+    e.start_object();
 
-    auto const pixel_format = device.tw_pixel_format();
-    if (pixel_format != TwPixelFormat::Default) {
-        for (auto const &item : g_tw_pxfmt_mappings) {
-            if (pixel_format == item.second) {
-                boot_ui.AddMember("pixel_format", StringRef(item.first), alloc);
-                break;
-            }
-        }
-    }
+    e.string_member(members, "id", device.id());
+    e.array_member(members, "codenames", device.codenames());
+    e.string_member(members, "name", device.name());
+    e.string_member(members, "architecture", device.architecture());
+    e.flags_member(members, "flags", device.flags(), g_device_flag_mappings);
 
-    auto const force_pixel_format = device.tw_force_pixel_format();
-    if (force_pixel_format != TwForcePixelFormat::None) {
-        for (auto const &item : g_tw_force_pxfmt_mappings) {
-            if (force_pixel_format == item.second) {
-                boot_ui.AddMember("force_pixel_format", StringRef(item.first),
-                                  alloc);
-                break;
-            }
-        }
+    /* Block devs */
+    auto const base_dirs = device.block_dev_base_dirs();
+    auto const system_devs = device.system_block_devs();
+    auto const cache_devs = device.cache_block_devs();
+    auto const data_devs = device.data_block_devs();
+    auto const boot_devs = device.boot_block_devs();
+    auto const recovery_devs = device.recovery_block_devs();
+    auto const extra_devs = device.extra_block_devs();
+
+    if (!base_dirs.empty() || !system_devs.empty() || !cache_devs.empty()
+            || !data_devs.empty() || !boot_devs.empty()
+            || !recovery_devs.empty() || !extra_devs.empty()) {
+        SizeType n = 0;
+
+        e.start_object("block_devs");
+        e.array_member(n, "base_dirs", base_dirs);
+        e.array_member(n, "system", system_devs);
+        e.array_member(n, "cache", cache_devs);
+        e.array_member(n, "data", data_devs);
+        e.array_member(n, "boot", boot_devs);
+        e.array_member(n, "recovery", recovery_devs);
+        e.array_member(n, "extra", extra_devs);
+        e.end_object(n);
+        ++members;
     }
 
+    /* Boot UI */
+    auto const supported = device.tw_supported();
+    auto const tw_flags = device.tw_flags();
+    // The default pixel formats are omitted
+    auto const pixel_format =
+            device.tw_pixel_format() == TwPixelFormat::Default
+            ? nullptr
+            : find_mapping_name(g_tw_pxfmt_mappings, device.tw_pixel_format());
+    auto const force_pixel_format =
+            device.tw_force_pixel_format() == TwForcePixelFormat::None
+            ? nullptr
+            : find_mapping_name(g_tw_force_pxfmt_mappings,
+                                device.tw_force_pixel_format());
     auto const overscan_percent = device.tw_overscan_percent();
-    if (overscan_percent != 0) {
-        boot_ui.AddMember("overscan_percent", overscan_percent, alloc);
-    }
-
     auto const default_x_offset = device.tw_default_x_offset();
-    if (default_x_offset != 0) {
-        boot_ui.AddMember("default_x_offset", default_x_offset, alloc);
-    }
-
     auto const default_y_offset = device.tw_default_y_offset();
-    if (default_y_offset != 0) {
-        boot_ui.AddMember("default_y_offset", default_y_offset, alloc);
+    auto const brightness_path = device.tw_brightness_path();
+    auto const secondary_brightness_path =
+            device.tw_secondary_brightness_path();
+    auto const max_brightness = device.tw_max_brightness();
+    auto const default_brightness = device.tw_default_brightness();
+    auto const battery_path = device.tw_battery_path();
+    auto const cpu_temp_path = device.tw_cpu_temp_path();
+    auto const input_blacklist = device.tw_input_blacklist();
+    auto const input_whitelist = device.tw_input_whitelist();
+    auto const graphics_backends = device.tw_graphics_backends();
+    auto const theme = device.tw_theme();
+
+    if (supported || tw_flags || pixel_format || force_pixel_format
+            || overscan_percent != 0 || default_x_offset != 0
+            || default_y_offset != 0 || !brightness_path.empty()
+            || !secondary_brightness_path.empty() || max_brightness != -1
+            || default_brightness != -1 || !battery_path.empty()
+            || !cpu_temp_path.empty() || !input_blacklist.empty()
+            || !input_whitelist.empty() || !graphics_backends.empty()
+            || !theme.empty()) {
+        SizeType n = 0;
+
+        e.start_object("boot_ui");
+        e.bool_member(n, "supported", supported);
+        e.flags_member(n, "flags", tw_flags, g_tw_flag_mappings);
+        e.string_member(n, "pixel_format",
+                        pixel_format ? pixel_format : "");
+        e.string_member(n, "force_pixel_format",
+                        force_pixel_format ? force_pixel_format : "");
+        e.int_member(n, "overscan_percent", overscan_percent, 0);
+        e.int_member(n, "default_x_offset", default_x_offset, 0);
+        e.int_member(n, "default_y_offset", default_y_offset, 0);
+        e.string_member(n, "brightness_path", brightness_path);
+        e.string_member(n, "secondary_brightness_path",
+                        secondary_brightness_path);
+        e.int_member(n, "max_brightness", max_brightness, -1);
+        e.int_member(n, "default_brightness", default_brightness, -1);
+        e.string_member(n, "battery_path", battery_path);
+        e.string_member(n, "cpu_temp_path", cpu_temp_path);
+        e.string_member(n, "input_blacklist", input_blacklist);
+        e.string_member(n, "input_whitelist", input_whitelist);
+        e.array_member(n, "graphics_backends", graphics_backends);
+        e.string_member(n, "theme", theme);
+        e.end_object(n);
+        ++members;
     }
 
-    auto const &brightness_path = device.tw_brightness_path();
-    if (!brightness_path.empty()) {
-        boot_ui.AddMember("brightness_path", brightness_path, alloc);
+    e.end_object(members);
+
+    return e.ok();
+}
+
+bool device_to_json(const Device &device, std::string &json)
+{
+    const SchemaDocument *sd = compiled_schemas().device;
+    if (!sd) {
+        return false;
     }
 
-    auto const &secondary_brightness_path =
-            device.tw_secondary_brightness_path();
-    if (!secondary_brightness_path.empty()) {
-        boot_ui.AddMember("secondary_brightness_path",
-                          secondary_brightness_path, alloc);
+    StringBuffer sb;
+    Writer<StringBuffer> writer(sb);
+    GenericSchemaValidator<SchemaDocument, decltype(writer)> sv(*sd, writer);
+
+    if (!write_device(device, sv)) {
+        return false;
     }
 
-    auto const max_brightness = device.tw_max_brightness();
-    if (max_brightness != -1) {
-        boot_ui.AddMember("max_brightness", max_brightness, alloc);
+    json = {sb.GetString(), sb.GetSize()};
+    return true;
+}
+
+namespace detail
+{
+
+struct DeviceJsonWriterData
+{
+    StringBuffer sb;
+    Writer<StringBuffer> writer;
+
+    DeviceJsonWriterData() : writer(sb)
+    {
     }
+};
 
-    auto const default_brightness = device.tw_default_brightness();
-    if (default_brightness != -1) {
-        boot_ui.AddMember("default_brightness", default_brightness, alloc);
+}
+
+/*!
+ * \class DeviceJsonWriter
+ *
+ * \brief Reusable device serializer
+ *
+ * Unlike device_to_json(), the writer streams the device straight into an
+ * internal buffer without building a DOM or running the schema validator. The
+ * buffer and the writer state are kept between calls, so serializing many
+ * devices with the same instance does not reallocate once the buffer is large
+ * enough. Devices are checked with Device::validate() instead.
+ */
+
+DeviceJsonWriter::DeviceJsonWriter()
+    : m_data(std::make_unique<detail::DeviceJsonWriterData>())
+{
+}
+
+DeviceJsonWriter::~DeviceJsonWriter() = default;
+
+/*!
+ * \brief Serialize device into the internal buffer
+ *
+ * \return Whether the device is valid and was serialized. The result can be
+ *         accessed with data().
+ */
+bool DeviceJsonWriter::write(const Device &device)
+{
+    auto &d = *m_data;
+
+    d.sb.Clear();
+    d.writer.Reset(d.sb);
+
+    if (device.validate()) {
+        return false;
     }
 
-    auto const &battery_path = device.tw_battery_path();
-    if (!battery_path.empty()) {
-        boot_ui.AddMember("battery_path", battery_path, alloc);
+    return write_device(device, d.writer) && d.writer.IsComplete();
+}
+
+/*!
+ * \brief Serialize device and write it to a file
+ *
+ * \return Nothing if the device was serialized and written. Otherwise, returns
+ *         std::errc::invalid_argument if the device is invalid or the error
+ *         from writing to the file.
+ */
+oc::result<void> DeviceJsonWriter::write(const Device &device, File &file)
+{
+    if (!write(device)) {
+        return std::make_error_code(std::errc::invalid_argument);
     }
 
-    auto const &cpu_temp_path = device.tw_cpu_temp_path();
-    if (!cpu_temp_path.empty()) {
-        boot_ui.AddMember("cpu_temp_path", cpu_temp_path, alloc);
+    auto json = data();
+    return file_write_exact(file, json.data(), json.size());
+}
+
+/*!
+ * \brief Get result of the last write() call
+ *
+ * The data remains valid until the next write() call.
+ */
+std::string_view DeviceJsonWriter::data() const
+{
+    auto &sb = m_data->sb;
+    return {sb.GetString(), sb.GetSize()};
+}
+
+namespace detail
+{
+
+struct DeviceDatabaseData
+{
+    Document doc;
+    // Index and codename maps refer to strings owned by |doc|
+    std::unordered_map<std::string_view, size_t> by_id;
+    std::unordered_map<std::string_view, size_t> by_codename;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Device>> devices;
+};
+
+}
+
+/*!
+ * \brief Check the parts of an unvalidated device list needed for indexing
+ *
+ * This is not a replacement for schema validation. It only makes sure that
+ * building the index does not access nodes with the wrong type.
+ */
+static bool check_trusted_list(const Document &d, JsonError &error)
+{
+    if (!d.IsArray()) {
+        json_error_set_schema_validation_failure(error, "#", "type", "#");
+        return false;
     }
 
-    auto const &input_blacklist = device.tw_input_blacklist();
-    if (!input_blacklist.empty()) {
-        boot_ui.AddMember("input_blacklist", input_blacklist, alloc);
+    for (SizeType i = 0; i < d.Size(); ++i) {
+        auto const &item = d[i];
+        auto document_uri = "#/" + std::to_string(i);
+
+        if (!item.IsObject()) {
+            json_error_set_schema_validation_failure(
+                    error, "#/items", "type", std::move(document_uri));
+            return false;
+        }
+
+        if (auto it = item.FindMember("id");
+                it != item.MemberEnd() && !it->value.IsString()) {
+            json_error_set_schema_validation_failure(
+                    error, "#/items/properties/id", "type",
+                    document_uri + "/id");
+            return false;
+        }
+
+        if (auto it = item.FindMember("codenames"); it != item.MemberEnd()) {
+            if (!it->value.IsArray()) {
+                json_error_set_schema_validation_failure(
+                        error, "#/items/properties/codenames", "type",
+                        document_uri + "/codenames");
+                return false;
+            }
+
+            for (auto const &c : it->value.GetArray()) {
+                if (!c.IsString()) {
+                    json_error_set_schema_validation_failure(
+                            error, "#/items/properties/codenames/items",
+                            "type", document_uri + "/codenames");
+                    return false;
+                }
+            }
+        }
     }
 
-    auto const &input_whitelist = device.tw_input_whitelist();
-    if (!input_whitelist.empty()) {
-        boot_ui.AddMember("input_whitelist", input_whitelist, alloc);
+    return true;
+}
+
+static inline std::string_view get_string_view(const Value &node)
+{
+    return {node.GetString(), node.GetStringLength()};
+}
+
+/*!
+ * \class DeviceDatabase
+ *
+ * \brief Indexed device list
+ *
+ * The database keeps the parsed JSON document and only converts an entry to a
+ * Device the first time it is accessed. Lookups by ID and codename use hash
+ * tables that are built when the list is loaded. If multiple devices share the
+ * same ID or codename, the first one in the list wins.
+ *
+ * Lookups are thread safe. Returned pointers remain valid until the next call
+ * to load() or until the database is destroyed.
+ */
+
+DeviceDatabase::DeviceDatabase()
+    : m_data(std::make_unique<detail::DeviceDatabaseData>())
+{
+}
+
+DeviceDatabase::~DeviceDatabase() = default;
+
+/*!
+ * \brief Load device list
+ *
+ * \param json JSON device list
+ * \param flags Load flags. If DeviceDatabaseFlag::SkipValidation is set, the
+ *              schema validation pass is skipped. This is significantly faster,
+ *              but the input must be trusted since invalid entries have
+ *              undefined results when they are accessed.
+ * \param error JSON error info if loading fails
+ *
+ * \return Whether the list was loaded. If loading fails, the previously loaded
+ *         list is kept.
+ */
+bool DeviceDatabase::load(const std::string &json, DeviceDatabaseFlags flags,
+                          JsonError &error)
+{
+    auto data = std::make_unique<detail::DeviceDatabaseData>();
+    auto &d = data->doc;
+
+    if (flags & DeviceDatabaseFlag::SkipValidation) {
+        d.Parse(json.c_str());
+
+        if (d.HasParseError()) {
+            json_error_set_parse_error(error, d.GetErrorOffset(),
+                                       GetParseError_En(d.GetParseError()));
+            return false;
+        }
+
+        if (!check_trusted_list(d, error)) {
+            return false;
+        }
+    } else if (!parse_validated(json, compiled_schemas().device_list_pool,
+                                d, error)) {
+        return false;
     }
 
-    auto const &graphics_backends = device.tw_graphics_backends();
-    if (!graphics_backends.empty()) {
-        Value array(kArrayType);
-        for (auto const &b : graphics_backends) {
-            array.PushBack(StringRef(b), alloc);
+    data->devices.resize(d.Size());
+
+    for (SizeType i = 0; i < d.Size(); ++i) {
+        auto const &item = d[i];
+
+        if (auto it = item.FindMember("id"); it != item.MemberEnd()) {
+            data->by_id.emplace(get_string_view(it->value), i);
+        }
+
+        if (auto it = item.FindMember("codenames"); it != item.MemberEnd()) {
+            for (auto const &c : it->value.GetArray()) {
+                data->by_codename.emplace(get_string_view(c), i);
+            }
         }
-        boot_ui.AddMember("graphics_backends", array, alloc);
     }
 
-    auto const &theme = device.tw_theme();
-    if (!theme.empty()) {
-        boot_ui.AddMember("theme", theme, alloc);
+    m_data = std::move(data);
+    return true;
+}
+
+/*!
+ * \brief Get number of devices in the list
+ */
+size_t DeviceDatabase::size() const
+{
+    return m_data->devices.size();
+}
+
+/*!
+ * \brief Get device at index
+ *
+ * \return Device or nullptr if \p index is out of range
+ */
+const Device * DeviceDatabase::at(size_t index) const
+{
+    if (index >= m_data->devices.size()) {
+        return nullptr;
     }
 
-    if (!boot_ui.ObjectEmpty()) {
-        d.AddMember("boot_ui", boot_ui, alloc);
+    std::lock_guard<std::mutex> lock(m_data->mutex);
+
+    auto &device = m_data->devices[index];
+    if (!device) {
+        device = std::make_unique<Device>();
+        process_device(*device, m_data->doc[static_cast<SizeType>(index)]);
     }
 
-    StringBuffer sb;
-    Writer<StringBuffer> writer(sb);
-    DeviceSchemaProvider<> sp;
-    const SchemaDocument *sd = sp.GetSchema("device.json");
-    if (!sd) {
-        assert(false);
-        return false;
+    return device.get();
+}
+
+/*!
+ * \brief Find device by ID
+ *
+ * \return Device or nullptr if no device has the ID
+ */
+const Device * DeviceDatabase::find_by_id(std::string_view id) const
+{
+    auto it = m_data->by_id.find(id);
+    if (it == m_data->by_id.end()) {
+        return nullptr;
     }
-    GenericSchemaValidator<SchemaDocument, decltype(writer)> sv(*sd, writer);
 
-    if (!d.Accept(sv)) {
-        return false;
+    return at(it->second);
+}
+
+/*!
+ * \brief Find device by codename
+ *
+ * \return Device or nullptr if no device has the codename
+ */
+const Device * DeviceDatabase::find_by_codename(std::string_view codename) const
+{
+    auto it = m_data->by_codename.find(codename);
+    if (it == m_data->by_codename.end()) {
+        return nullptr;
     }
 
-    json = {sb.GetString(), sb.GetSize()};
-    return true;
+    return at(it->second);
 }
 
 }
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbdevice/binary.h"
+
+using namespace mb::device;
+
+static std::vector<Device> sample_devices()
+{
+    Device d1;
+    d1.set_id("test1");
+    d1.set_codenames({"test1", "shared"});
+    d1.set_name("Test 1");
+    d1.set_architecture(ARCH_ARMEABI_V7A);
+    d1.set_flags(DeviceFlag::HasCombinedBootAndRecovery);
+    d1.set_system_block_devs({"/dev/block/system"});
+    d1.set_boot_block_devs({"/dev/block/boot"});
+
+    Device d2;
+    d2.set_id("test2");
+    d2.set_codenames({"test2a", "test2b", "shared"});
+    d2.set_name("Test 2");
+    d2.set_architecture(ARCH_ARM64_V8A);
+    d2.set_block_dev_base_dirs({"/dev/block/bootdevice/by-name"});
+    d2.set_system_block_devs({"/dev/block/bootdevice/by-name/system"});
+    d2.set_cache_block_devs({"/dev/block/bootdevice/by-name/cache"});
+    d2.set_data_block_devs({"/dev/block/bootdevice/by-name/userdata"});
+    d2.set_boot_block_devs({"/dev/block/bootdevice/by-name/boot"});
+    d2.set_recovery_block_devs({"/dev/block/bootdevice/by-name/recovery"});
+    d2.set_extra_block_devs({"/dev/block/bootdevice/by-name/modem"});
+    d2.set_tw_supported(true);
+    d2.set_tw_flags(TwFlag::TouchscreenSwapXY | TwFlag::RoundScreen);
+    d2.set_tw_pixel_format(TwPixelFormat::Rgba8888);
+    d2.set_tw_force_pixel_format(TwForcePixelFormat::Rgb565);
+    d2.set_tw_overscan_percent(10);
+    d2.set_tw_default_x_offset(-20);
+    d2.set_tw_default_y_offset(30);
+    d2.set_tw_brightness_path("/sys/brightness");
+    d2.set_tw_secondary_brightness_path("/sys/brightness2");
+    d2.set_tw_max_brightness(255);
+    d2.set_tw_default_brightness(100);
+    d2.set_tw_battery_path("/sys/battery");
+    d2.set_tw_cpu_temp_path("/sys/temp");
+    d2.set_tw_input_blacklist("foo");
+    d2.set_tw_input_whitelist("bar");
+    d2.set_tw_graphics_backends({"overlay_msm_old", "fbdev"});
+    d2.set_tw_theme("portrait_hdpi");
+
+    return {d1, d2};
+}
+
+TEST(BinaryTest, RoundTrip)
+{
+    auto devices = sample_devices();
+
+    std::string data;
+    ASSERT_TRUE(device_list_to_binary(devices, data));
+    ASSERT_TRUE(BinaryDeviceDatabase::is_binary(data));
+
+    BinaryDeviceDatabase db;
+    ASSERT_TRUE(db.open(data));
+    ASSERT_EQ(db.size(), 2u);
+
+    for (size_t i = 0; i < devices.size(); ++i) {
+        auto ref = db.at(i);
+        ASSERT_TRUE(ref);
+        ASSERT_EQ(ref->to_device(), devices[i]);
+    }
+
+    ASSERT_FALSE(db.at(2));
+}
+
+TEST(BinaryTest, Lookup)
+{
+    std::string data;
+    ASSERT_TRUE(device_list_to_binary(sample_devices(), data));
+
+    BinaryDeviceDatabase db;
+    ASSERT_TRUE(db.open(data));
+
+    auto d1 = db.find_by_id("test2");
+    ASSERT_TRUE(d1);
+    ASSERT_EQ(d1->name(), "Test 2");
+    ASSERT_EQ(d1->architecture(), ARCH_ARM64_V8A);
+    ASSERT_FALSE(d1->flags());
+    ASSERT_EQ(d1->codename_count(), 3u);
+    ASSERT_EQ(d1->codename(1), "test2b");
+
+    auto d2 = db.find_by_codename("test2a");
+    ASSERT_TRUE(d2);
+    ASSERT_EQ(d2->id(), "test2");
+
+    // First device with a codename wins
+    auto d3 = db.find_by_codename("shared");
+    ASSERT_TRUE(d3);
+    ASSERT_EQ(d3->id(), "test1");
+    ASSERT_EQ(d3->flags(),
+              DeviceFlags(DeviceFlag::HasCombinedBootAndRecovery));
+
+    ASSERT_FALSE(db.find_by_id("test3"));
+    ASSERT_FALSE(db.find_by_codename("test3"));
+}
+
+TEST(BinaryTest, RejectInvalidData)
+{
+    std::string data;
+    ASSERT_TRUE(device_list_to_binary(sample_devices(), data));
+
+    BinaryDeviceDatabase db;
+    ASSERT_FALSE(db.open({}));
+    ASSERT_FALSE(db.open("MBDEVDB"));
+    ASSERT_FALSE(db.open(std::string_view(data).substr(0, data.size() - 1)));
+
+    auto bad_version = data;
+    bad_version[8] = 2;
+    ASSERT_FALSE(db.open(bad_version));
+
+    // Failed opens keep the previous list
+    ASSERT_TRUE(db.open(data));
+    ASSERT_FALSE(db.open({}));
+    ASSERT_EQ(db.size(), 2u);
+}
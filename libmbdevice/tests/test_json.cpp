@@ -19,6 +19,8 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+
 #include "mbdevice/device.h"
 #include "mbdevice/json.h"
 #include "mbdevice/capi/json.h"
@@ -390,6 +392,103 @@ TEST(JsonTest, LoadMultiple)
     ASSERT_EQ(e2.document_uri, "#");
 }
 
+TEST(JsonTest, LoadDatabase)
+{
+    DeviceDatabase db;
+    JsonError e1;
+    ASSERT_TRUE(db.load(sample_multiple, {}, e1));
+    ASSERT_EQ(db.size(), 2u);
+
+    auto d1 = db.find_by_codename("test2");
+    ASSERT_NE(d1, nullptr);
+    ASSERT_EQ(d1->id(), "test2");
+    ASSERT_EQ(d1->architecture(), "arm64-v8a");
+    ASSERT_EQ(db.at(1), d1);
+
+    auto d2 = db.find_by_id("test1");
+    ASSERT_NE(d2, nullptr);
+    ASSERT_EQ(d2->name(), "test1");
+    ASSERT_EQ(db.at(0), d2);
+
+    ASSERT_EQ(db.find_by_id("test3"), nullptr);
+    ASSERT_EQ(db.find_by_codename("test3"), nullptr);
+    ASSERT_EQ(db.at(2), nullptr);
+
+    std::vector<Device> devices;
+    ASSERT_TRUE(device_list_from_json(sample_multiple, devices, e1));
+    ASSERT_EQ(*db.at(0), devices[0]);
+    ASSERT_EQ(*db.at(1), devices[1]);
+
+    JsonError e2;
+    ASSERT_FALSE(db.load(sample_complete, {}, e2));
+    ASSERT_EQ(e2.type, JsonErrorType::SchemaValidationFailure);
+    ASSERT_EQ(db.size(), 2u);
+}
+
+TEST(JsonTest, LoadTrustedDatabase)
+{
+    DeviceDatabase db;
+    JsonError e1;
+    ASSERT_TRUE(db.load(sample_multiple, DeviceDatabaseFlag::SkipValidation,
+                        e1));
+    ASSERT_EQ(db.size(), 2u);
+
+    auto d1 = db.find_by_codename("test1");
+    ASSERT_NE(d1, nullptr);
+    ASSERT_EQ(d1->id(), "test1");
+
+    JsonError e2;
+    ASSERT_FALSE(db.load(sample_complete, DeviceDatabaseFlag::SkipValidation,
+                         e2));
+    ASSERT_EQ(e2.type, JsonErrorType::SchemaValidationFailure);
+    ASSERT_EQ(e2.document_uri, "#");
+
+    JsonError e3;
+    ASSERT_FALSE(db.load(sample_malformed, DeviceDatabaseFlag::SkipValidation,
+                         e3));
+    ASSERT_EQ(e3.type, JsonErrorType::ParseError);
+}
+
+TEST(JsonTest, LoadConcurrently)
+{
+    std::vector<std::thread> threads;
+    std::vector<int> failures(4);
+
+    for (size_t i = 0; i < failures.size(); ++i) {
+        threads.emplace_back([&failures, i] {
+            for (int j = 0; j < 50; ++j) {
+                Device d1;
+                JsonError e1;
+                if (!device_from_json(sample_complete, d1, e1)) {
+                    ++failures[i];
+                }
+
+                Device d2;
+                JsonError e2;
+                if (device_from_json(sample_invalid_key, d2, e2)
+                        || e2.type != JsonErrorType::SchemaValidationFailure) {
+                    ++failures[i];
+                }
+
+                std::vector<Device> d3;
+                JsonError e3;
+                if (!device_list_from_json(sample_multiple, d3, e3)
+                        || d3.size() != 2) {
+                    ++failures[i];
+                }
+            }
+        });
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (auto f : failures) {
+        ASSERT_EQ(f, 0);
+    }
+}
+
 TEST(JsonTest, CreateJson)
 {
     Device d1;
@@ -406,6 +505,32 @@ TEST(JsonTest, CreateJson)
     ASSERT_EQ(d1, d2);
 }
 
+TEST(JsonTest, ReuseJsonWriter)
+{
+    Device d1;
+    JsonError e1;
+    ASSERT_TRUE(device_from_json(sample_complete, d1, e1));
+
+    std::string json;
+    ASSERT_TRUE(device_to_json(d1, json));
+
+    DeviceJsonWriter writer;
+    ASSERT_TRUE(writer.write(d1));
+    ASSERT_EQ(writer.data(), json);
+
+    std::vector<Device> d2;
+    ASSERT_TRUE(device_list_from_json(sample_multiple, d2, e1));
+    ASSERT_TRUE(writer.write(d2[0]));
+
+    Device d3;
+    JsonError e3;
+    ASSERT_TRUE(device_from_json(std::string(writer.data()), d3, e3));
+    ASSERT_EQ(d3, d2[0]);
+
+    // Invalid devices are rejected
+    ASSERT_FALSE(writer.write(Device()));
+}
+
 TEST(JsonTest, CheckCapiFlagsEqual)
 {
     ASSERT_EQ(TO_U(JsonErrorType, ParseError),
@@ -35,7 +35,11 @@ public:
 
     virtual void log(const LogRecord &rec) = 0;
 
+    virtual void flush();
+
     virtual bool formatted() = 0;
+
+    virtual bool structured();
 };
 
 }
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+#include <cstdio>
+
+#include "mbcommon/outcome.h"
+
+#include "mblog/base_logger.h"
+
+namespace mb::log
+{
+
+class MB_EXPORT BinaryLogger : public BaseLogger
+{
+public:
+    explicit BinaryLogger(FILE *stream);
+    virtual ~BinaryLogger();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BinaryLogger)
+
+    virtual void log(const LogRecord &rec) override;
+
+    virtual void flush() override;
+
+    virtual bool formatted() override;
+
+    virtual bool structured() override;
+
+private:
+    uint64_t intern(std::unordered_map<std::string, uint64_t> &ids,
+                    uint8_t type, const std::string &str);
+
+    FILE *_stream;
+    //! Encoded entries that have not been written yet
+    std::string _buf;
+    std::unordered_map<std::string, uint64_t> _tag_ids;
+    std::unordered_map<std::string, uint64_t> _fmt_ids;
+    //! Times of the previous record in nanoseconds
+    int64_t _time;
+    int64_t _mono_time;
+};
+
+class MB_EXPORT BinaryLogReader final
+{
+public:
+    explicit BinaryLogReader(FILE *stream);
+    ~BinaryLogReader();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BinaryLogReader)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(BinaryLogReader)
+
+    oc::result<std::optional<LogRecord>> next();
+
+private:
+    oc::result<std::optional<uint8_t>> get_byte();
+    oc::result<uint8_t> get_required_byte();
+    oc::result<uint64_t> get_varint();
+    oc::result<int64_t> get_signed_varint();
+    oc::result<std::string> get_string();
+
+    FILE *_stream;
+    bool _read_header;
+    std::vector<std::string> _tags;
+    std::vector<std::string> _fmts;
+    //! Times of the previous record in nanoseconds
+    int64_t _time;
+    int64_t _mono_time;
+};
+
+}
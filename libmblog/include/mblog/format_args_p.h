@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <cstdarg>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::log::detail
+{
+
+void put_varint(std::string &out, uint64_t value);
+void put_signed_varint(std::string &out, int64_t value);
+void put_string(std::string &out, std::string_view str);
+
+bool get_varint(std::string_view &in, uint64_t &value);
+bool get_signed_varint(std::string_view &in, int64_t &value);
+bool get_string(std::string_view &in, std::string_view &str);
+
+bool encode_format_args(std::string &out, const char *fmt, va_list ap);
+oc::result<std::string> decode_format_args(std::string_view fmt,
+                                           std::string_view args);
+
+}
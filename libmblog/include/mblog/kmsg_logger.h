@@ -19,6 +19,14 @@
 
 #pragma once
 
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <cstdint>
+
 #include "mblog/base_logger.h"
 
 namespace mb::log
@@ -30,13 +38,47 @@ public:
     KmsgLogger(bool force_error_prio);
     virtual ~KmsgLogger();
 
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(KmsgLogger)
+
     virtual void log(const LogRecord &rec) override;
 
+    virtual void flush() override;
+
     virtual bool formatted() override;
 
+    void set_batching(bool enabled);
+    void set_rate_limit(unsigned int burst, unsigned int per_second);
+    bool set_spill_file(const std::string &path);
+    std::string recent_spilled_records();
+
 private:
+    struct TokenBucket
+    {
+        double tokens;
+        std::chrono::steady_clock::time_point last;
+        uint64_t suppressed;
+    };
+
+    bool take_token(const std::string &tag, uint64_t &suppressed);
+    void append(const char *kprio, const std::string &msg);
+    void write_batch();
+    void spill(const LogRecord &rec);
+
+    std::mutex _mutex;
     int _fd;
     bool _force_error_prio;
+
+    bool _batching;
+    const char *_batch_prio;
+    std::string _batch;
+
+    unsigned int _burst;
+    unsigned int _per_second;
+    std::unordered_map<std::string, TokenBucket> _buckets;
+
+    int _spill_fd;
+    std::deque<std::string> _spill_ring;
+    std::size_t _spill_ring_size;
 };
 
 }
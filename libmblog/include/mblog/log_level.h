@@ -19,16 +19,23 @@
 
 #pragma once
 
+// Numeric values of the log levels for use in preprocessor conditionals
+#define MB_LOG_LEVEL_ERROR      0
+#define MB_LOG_LEVEL_WARNING    1
+#define MB_LOG_LEVEL_INFO       2
+#define MB_LOG_LEVEL_DEBUG      3
+#define MB_LOG_LEVEL_VERBOSE    4
+
 namespace mb::log
 {
 
 enum class LogLevel
 {
-    Error,
-    Warning,
-    Info,
-    Debug,
-    Verbose
+    Error = MB_LOG_LEVEL_ERROR,
+    Warning = MB_LOG_LEVEL_WARNING,
+    Info = MB_LOG_LEVEL_INFO,
+    Debug = MB_LOG_LEVEL_DEBUG,
+    Verbose = MB_LOG_LEVEL_VERBOSE,
 };
 
 }
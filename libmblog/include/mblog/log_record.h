@@ -30,12 +30,17 @@ namespace mb::log
 struct LogRecord
 {
     std::chrono::system_clock::time_point time;
+    std::chrono::steady_clock::time_point mono_time;
     uint64_t pid;
     uint64_t tid;
     LogLevel prio;
     std::string tag;
     std::string msg;
     std::string fmt_msg;
+    // Only set for loggers that are structured(). If fmt is empty, the record
+    // only has msg.
+    std::string fmt;
+    std::string args;
 };
 
 }
@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include <cstdarg>
@@ -27,16 +28,29 @@
 
 #include "mblog/log_level.h"
 
-#define TLOGE(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
-#define TLOGW(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Warning, (TAG), __VA_ARGS__)
-#define TLOGI(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Info, (TAG), __VA_ARGS__)
-#define TLOGD(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Debug, (TAG), __VA_ARGS__)
-#define TLOGV(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__)
+// Most verbose log level that is compiled in. Log calls for more verbose levels
+// are removed entirely, including the evaluation of their arguments.
+#ifndef MB_LOG_MIN_LEVEL
+#  define MB_LOG_MIN_LEVEL MB_LOG_LEVEL_VERBOSE
+#endif
+
+#define MB_LOG_IS_LOGGABLE(PRIO) \
+    (static_cast<int>(PRIO) <= MB_LOG_MIN_LEVEL \
+            && mb::log::is_loggable(PRIO))
+
+#define MB_LOG_CALL(FUNC, PRIO, TAG, ...) \
+    (MB_LOG_IS_LOGGABLE(PRIO) ? FUNC((PRIO), (TAG), __VA_ARGS__) : (void) 0)
+
+#define TLOGE(TAG, ...) MB_LOG_CALL(mb::log::log, \
+    mb::log::LogLevel::Error, TAG, __VA_ARGS__)
+#define TLOGW(TAG, ...) MB_LOG_CALL(mb::log::log, \
+    mb::log::LogLevel::Warning, TAG, __VA_ARGS__)
+#define TLOGI(TAG, ...) MB_LOG_CALL(mb::log::log, \
+    mb::log::LogLevel::Info, TAG, __VA_ARGS__)
+#define TLOGD(TAG, ...) MB_LOG_CALL(mb::log::log, \
+    mb::log::LogLevel::Debug, TAG, __VA_ARGS__)
+#define TLOGV(TAG, ...) MB_LOG_CALL(mb::log::log, \
+    mb::log::LogLevel::Verbose, TAG, __VA_ARGS__)
 
 #define LOGE(...) TLOGE(LOG_TAG, __VA_ARGS__)
 #define LOGW(...) TLOGW(LOG_TAG, __VA_ARGS__)
@@ -44,16 +58,16 @@
 #define LOGD(...) TLOGD(LOG_TAG, __VA_ARGS__)
 #define LOGV(...) TLOGV(LOG_TAG, __VA_ARGS__)
 
-#define TVLOGE(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
-#define TVLOGW(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Warning, (TAG), __VA_ARGS__)
-#define TVLOGI(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Info, (TAG), __VA_ARGS__)
-#define TVLOGD(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Debug, (TAG), __VA_ARGS__)
-#define TVLOGV(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__)
+#define TVLOGE(TAG, ...) MB_LOG_CALL(mb::log::log_v, \
+    mb::log::LogLevel::Error, TAG, __VA_ARGS__)
+#define TVLOGW(TAG, ...) MB_LOG_CALL(mb::log::log_v, \
+    mb::log::LogLevel::Warning, TAG, __VA_ARGS__)
+#define TVLOGI(TAG, ...) MB_LOG_CALL(mb::log::log_v, \
+    mb::log::LogLevel::Info, TAG, __VA_ARGS__)
+#define TVLOGD(TAG, ...) MB_LOG_CALL(mb::log::log_v, \
+    mb::log::LogLevel::Debug, TAG, __VA_ARGS__)
+#define TVLOGV(TAG, ...) MB_LOG_CALL(mb::log::log_v, \
+    mb::log::LogLevel::Verbose, TAG, __VA_ARGS__)
 
 #define VLOGE(...) TVLOGE(LOG_TAG, __VA_ARGS__)
 #define VLOGW(...) TVLOGW(LOG_TAG, __VA_ARGS__)
@@ -66,6 +80,27 @@ namespace mb::log
 
 class BaseLogger;
 
+namespace detail
+{
+
+MB_EXPORT extern std::atomic<int> g_level;
+
+}
+
+/*!
+ * \brief Check if a record with the given level would be logged
+ *
+ * This is checked by the log macros before the message is formatted.
+ */
+inline bool is_loggable(LogLevel prio)
+{
+    return static_cast<int>(prio)
+            <= detail::g_level.load(std::memory_order_relaxed);
+}
+
+MB_EXPORT LogLevel level();
+MB_EXPORT void set_level(LogLevel level);
+
 MB_EXPORT std::shared_ptr<BaseLogger> logger();
 MB_EXPORT void set_logger(std::shared_ptr<BaseLogger> logger);
 
@@ -73,6 +108,9 @@ MB_PRINTF(3, 4)
 MB_EXPORT void log(LogLevel prio, const char *tag, const char *fmt, ...);
 MB_EXPORT void log_v(LogLevel prio, const char *tag, const char *fmt, va_list ap);
 
+MB_EXPORT void set_async(bool enabled);
+MB_EXPORT void flush();
+
 MB_EXPORT std::string format();
 MB_EXPORT void set_format(std::string fmt);
 
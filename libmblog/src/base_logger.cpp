@@ -30,4 +30,28 @@ BaseLogger::~BaseLogger()
 {
 }
 
+/*!
+ * \brief Write out records that the logger buffered
+ *
+ * This is called after each record when logging synchronously and after each
+ * batch of records when logging asynchronously. The default implementation
+ * does nothing.
+ */
+void BaseLogger::flush()
+{
+}
+
+/*!
+ * \brief Whether the logger wants the format string and encoded arguments
+ *
+ * If true, the message is not formatted. Instead, LogRecord::fmt and
+ * LogRecord::args are set, unless the format string uses conversions that
+ * cannot be encoded. In that case, only LogRecord::msg is set as usual. The
+ * default implementation returns false.
+ */
+bool BaseLogger::structured()
+{
+    return false;
+}
+
 }
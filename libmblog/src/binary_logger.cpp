@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/binary_logger.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include "mbcommon/error_code.h"
+
+#include "mblog/format_args_p.h"
+
+// Binary log format
+//
+// The file begins with LOG_MAGIC followed by LOG_VERSION (1 byte). The rest of
+// the file is a sequence of entries, each beginning with the entry type
+// (1 byte):
+//
+// * EntryType::Tag: tag string
+// * EntryType::Format: format string
+// * EntryType::Record: level (1 byte), tag ID, format ID, PID, TID, wall clock
+//   time and monotonic time in nanoseconds relative to the previous record,
+//   encoded arguments (as a string)
+//
+// Tags and format strings are assigned IDs in the order they appear, starting
+// from 0, and are written before the first record that uses them. Records
+// without a format string are stored with the format "%s" and the message as
+// the argument. Integers are LEB128 varints and signed integers (the times) are
+// zigzag encoded first. Strings are a varint length followed by the bytes.
+
+namespace mb::log
+{
+
+using namespace detail;
+
+enum class EntryType : uint8_t
+{
+    Tag = 1,
+    Format = 2,
+    Record = 3,
+};
+
+static constexpr char LOG_MAGIC[] = "MBLOGBIN";
+static constexpr size_t LOG_MAGIC_SIZE = sizeof(LOG_MAGIC) - 1;
+static constexpr uint8_t LOG_VERSION = 1;
+
+//! Size at which the logger writes its buffer without waiting for flush()
+static constexpr size_t WRITE_BUFFER_SIZE = 64 * 1024;
+
+//! Maximum number of bytes in a LEB128 encoded 64-bit integer
+static constexpr size_t MAX_VARINT_SIZE = 10;
+
+/*!
+ * \class BinaryLogger
+ *
+ * \brief Logger that writes compact binary records
+ *
+ * Messages are not formatted. The records store the format string and the
+ * encoded arguments instead and tags and format strings are only written once.
+ * This makes logging cheaper and the logs smaller and preserves the timestamps
+ * and the arguments for later analysis. Use BinaryLogReader to decode the
+ * records.
+ */
+
+/*!
+ * \brief Construct a new BinaryLogger
+ *
+ * \param stream Stream to write the records to. It is not closed when the
+ *               BinaryLogger is destroyed.
+ */
+BinaryLogger::BinaryLogger(FILE *stream)
+    : _stream(stream)
+    , _time(0)
+    , _mono_time(0)
+{
+    _buf.append(LOG_MAGIC, LOG_MAGIC_SIZE);
+    _buf += static_cast<char>(LOG_VERSION);
+}
+
+BinaryLogger::~BinaryLogger()
+{
+    flush();
+}
+
+void BinaryLogger::log(const LogRecord &rec)
+{
+    using namespace std::chrono;
+
+    static const std::string msg_fmt{"%s"};
+
+    auto tag_id = intern(_tag_ids, static_cast<uint8_t>(EntryType::Tag),
+                         rec.tag);
+    auto fmt_id = intern(_fmt_ids, static_cast<uint8_t>(EntryType::Format),
+                         rec.fmt.empty() ? msg_fmt : rec.fmt);
+
+    int64_t time = duration_cast<nanoseconds>(
+            rec.time.time_since_epoch()).count();
+    int64_t mono_time = duration_cast<nanoseconds>(
+            rec.mono_time.time_since_epoch()).count();
+
+    _buf += static_cast<char>(EntryType::Record);
+    _buf += static_cast<char>(rec.prio);
+    put_varint(_buf, tag_id);
+    put_varint(_buf, fmt_id);
+    put_varint(_buf, rec.pid);
+    put_varint(_buf, rec.tid);
+    put_signed_varint(_buf, time - _time);
+    put_signed_varint(_buf, mono_time - _mono_time);
+
+    if (rec.fmt.empty()) {
+        std::string args;
+        put_string(args, rec.msg);
+        put_string(_buf, args);
+    } else {
+        put_string(_buf, rec.args);
+    }
+
+    _time = time;
+    _mono_time = mono_time;
+
+    if (_buf.size() >= WRITE_BUFFER_SIZE) {
+        flush();
+    }
+}
+
+void BinaryLogger::flush()
+{
+    if (!_buf.empty()) {
+        fwrite(_buf.data(), 1, _buf.size(), _stream);
+        _buf.clear();
+    }
+
+    fflush(_stream);
+}
+
+bool BinaryLogger::formatted()
+{
+    return false;
+}
+
+bool BinaryLogger::structured()
+{
+    return true;
+}
+
+uint64_t BinaryLogger::intern(std::unordered_map<std::string, uint64_t> &ids,
+                              uint8_t type, const std::string &str)
+{
+    if (auto it = ids.find(str); it != ids.end()) {
+        return it->second;
+    }
+
+    uint64_t id = ids.size();
+    ids.emplace(str, id);
+
+    _buf += static_cast<char>(type);
+    put_string(_buf, str);
+
+    return id;
+}
+
+/*!
+ * \class BinaryLogReader
+ *
+ * \brief Reader for logs written by BinaryLogger
+ */
+
+/*!
+ * \brief Construct a new BinaryLogReader
+ *
+ * \param stream Stream to read the records from. It is not closed when the
+ *               BinaryLogReader is destroyed.
+ */
+BinaryLogReader::BinaryLogReader(FILE *stream)
+    : _stream(stream)
+    , _read_header(false)
+    , _time(0)
+    , _mono_time(0)
+{
+}
+
+BinaryLogReader::~BinaryLogReader() = default;
+
+/*!
+ * \brief Read next record from the log
+ *
+ * The returned record has the format string, the encoded arguments, and the
+ * formatted message set. LogRecord::fmt_msg is not set.
+ *
+ * \return
+ *   * The next record if successful
+ *   * std::nullopt if the end of the log is reached
+ *   * `std::errc::bad_message` if the log is truncated or corrupt
+ *   * Otherwise, the error that occurred while reading from the stream
+ */
+oc::result<std::optional<LogRecord>> BinaryLogReader::next()
+{
+    using namespace std::chrono;
+
+    if (!_read_header) {
+        char magic[LOG_MAGIC_SIZE];
+        for (auto &c : magic) {
+            OUTCOME_TRY(byte, get_required_byte());
+            c = static_cast<char>(byte);
+        }
+
+        if (memcmp(magic, LOG_MAGIC, LOG_MAGIC_SIZE) != 0) {
+            return std::errc::bad_message;
+        }
+
+        OUTCOME_TRY(version, get_required_byte());
+        if (version != LOG_VERSION) {
+            return std::errc::bad_message;
+        }
+
+        _read_header = true;
+    }
+
+    while (true) {
+        OUTCOME_TRY(type, get_byte());
+        if (!type) {
+            return std::nullopt;
+        }
+
+        switch (static_cast<EntryType>(*type)) {
+        case EntryType::Tag: {
+            OUTCOME_TRY(tag, get_string());
+            _tags.push_back(std::move(tag));
+            break;
+        }
+
+        case EntryType::Format: {
+            OUTCOME_TRY(fmt, get_string());
+            _fmts.push_back(std::move(fmt));
+            break;
+        }
+
+        case EntryType::Record: {
+            LogRecord rec;
+
+            OUTCOME_TRY(prio, get_required_byte());
+            if (prio > static_cast<uint8_t>(LogLevel::Verbose)) {
+                return std::errc::bad_message;
+            }
+            rec.prio = static_cast<LogLevel>(prio);
+
+            OUTCOME_TRY(tag_id, get_varint());
+            OUTCOME_TRY(fmt_id, get_varint());
+            if (tag_id >= _tags.size() || fmt_id >= _fmts.size()) {
+                return std::errc::bad_message;
+            }
+            rec.tag = _tags[static_cast<size_t>(tag_id)];
+            rec.fmt = _fmts[static_cast<size_t>(fmt_id)];
+
+            OUTCOME_TRY(pid, get_varint());
+            OUTCOME_TRY(tid, get_varint());
+            rec.pid = pid;
+            rec.tid = tid;
+
+            OUTCOME_TRY(time_delta, get_signed_varint());
+            OUTCOME_TRY(mono_time_delta, get_signed_varint());
+            _time += time_delta;
+            _mono_time += mono_time_delta;
+            rec.time = system_clock::time_point(duration_cast<
+                    system_clock::duration>(nanoseconds(_time)));
+            rec.mono_time = steady_clock::time_point(duration_cast<
+                    steady_clock::duration>(nanoseconds(_mono_time)));
+
+            OUTCOME_TRY(args, get_string());
+            rec.args = std::move(args);
+
+            OUTCOME_TRY(msg, decode_format_args(rec.fmt, rec.args));
+            rec.msg = std::move(msg);
+
+            return std::move(rec);
+        }
+
+        default:
+            return std::errc::bad_message;
+        }
+    }
+}
+
+oc::result<std::optional<uint8_t>> BinaryLogReader::get_byte()
+{
+    int c = getc(_stream);
+    if (c == EOF) {
+        if (ferror(_stream)) {
+            return ec_from_errno();
+        }
+        return std::nullopt;
+    }
+
+    return static_cast<uint8_t>(c);
+}
+
+oc::result<uint8_t> BinaryLogReader::get_required_byte()
+{
+    OUTCOME_TRY(byte, get_byte());
+    if (!byte) {
+        return std::errc::bad_message;
+    }
+
+    return *byte;
+}
+
+oc::result<uint64_t> BinaryLogReader::get_varint()
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < MAX_VARINT_SIZE; ++i) {
+        OUTCOME_TRY(byte, get_required_byte());
+
+        value |= static_cast<uint64_t>(byte & 0x7f) << (i * 7);
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+
+    return std::errc::bad_message;
+}
+
+oc::result<int64_t> BinaryLogReader::get_signed_varint()
+{
+    OUTCOME_TRY(value, get_varint());
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+oc::result<std::string> BinaryLogReader::get_string()
+{
+    OUTCOME_TRY(size, get_varint());
+
+    std::string str;
+
+    // Don't trust the size for allocating the whole string up front
+    while (str.size() < size) {
+        char buf[4096];
+        auto n = std::min<uint64_t>(size - str.size(), sizeof(buf));
+
+        if (fread(buf, 1, static_cast<size_t>(n), _stream) != n) {
+            if (ferror(_stream)) {
+                return ec_from_errno();
+            }
+            return std::errc::bad_message;
+        }
+
+        str.append(buf, static_cast<size_t>(n));
+    }
+
+    return std::move(str);
+}
+
+}
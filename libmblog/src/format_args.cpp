@@ -0,0 +1,579 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/format_args_p.h"
+
+#include <optional>
+#include <type_traits>
+
+#include <cstddef>
+#include <cstring>
+
+#include "mbcommon/string.h"
+
+// Format arguments are encoded so that records can be stored without
+// formatting the message. The encoding follows the conversion specifiers in
+// the format string, which is needed to decode the arguments again:
+//
+// * Signed integers and `*` widths and precisions: zigzag encoded varint
+// * Unsigned integers, characters, and pointers: varint
+// * Floating point numbers: IEEE 754 double (8 bytes, little endian)
+// * Strings: varint length followed by the bytes, without the terminator. Only
+//   the bytes covered by the precision, if any, are stored.
+//
+// Varints are LEB128 encoded. Positional arguments, `%n`, `%m`, wide
+// characters and strings, and `long double` are not supported.
+
+namespace mb::log::detail
+{
+
+//! Maximum number of bytes in a LEB128 encoded 64-bit integer
+static constexpr size_t MAX_VARINT_SIZE = 10;
+
+enum class LengthModifier
+{
+    None,
+    Char,
+    Short,
+    Long,
+    LongLong,
+    IntMax,
+    Size,
+    PtrDiff,
+    LongDouble,
+};
+
+enum class FieldType
+{
+    //! Not specified
+    None,
+    //! Specified in the format string
+    Literal,
+    //! Specified by an argument (`*`)
+    Argument,
+};
+
+struct ConversionSpec
+{
+    std::string_view flags;
+    FieldType width_type;
+    std::string_view width;
+    FieldType precision_type;
+    std::string_view precision;
+    LengthModifier length;
+    char conversion;
+};
+
+static uint64_t zigzag_encode(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1)
+            ^ static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1)
+            ^ -static_cast<int64_t>(value & 1);
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/*!
+ * \brief Parse conversion specifier
+ *
+ * \param[in,out] fmt Format string starting after the `%`. On success, the
+ *                    specifier is removed from the front.
+ * \param[out] spec Parsed specifier
+ *
+ * \return Whether the specifier is valid and supported
+ */
+static bool parse_spec(std::string_view &fmt, ConversionSpec &spec)
+{
+    size_t pos = 0;
+
+    auto parse_field = [&](FieldType &type, std::string_view &text) {
+        size_t begin = pos;
+
+        if (pos < fmt.size() && fmt[pos] == '*') {
+            type = FieldType::Argument;
+            ++pos;
+        } else {
+            while (pos < fmt.size() && is_digit(fmt[pos])) {
+                ++pos;
+            }
+            type = FieldType::Literal;
+        }
+
+        text = fmt.substr(begin, pos - begin);
+    };
+
+    // Flags
+    while (pos < fmt.size() && strchr("-+ #0'", fmt[pos])) {
+        ++pos;
+    }
+    spec.flags = fmt.substr(0, pos);
+
+    // Width
+    parse_field(spec.width_type, spec.width);
+    if (spec.width_type == FieldType::Literal && spec.width.empty()) {
+        spec.width_type = FieldType::None;
+    }
+
+    // Positional arguments are not supported
+    if (pos < fmt.size() && fmt[pos] == '$') {
+        return false;
+    }
+
+    // Precision
+    if (pos < fmt.size() && fmt[pos] == '.') {
+        ++pos;
+        parse_field(spec.precision_type, spec.precision);
+    } else {
+        spec.precision_type = FieldType::None;
+    }
+
+    // Length modifier
+    spec.length = LengthModifier::None;
+
+    if (pos < fmt.size()) {
+        switch (fmt[pos]) {
+        case 'h':
+            ++pos;
+            if (pos < fmt.size() && fmt[pos] == 'h') {
+                spec.length = LengthModifier::Char;
+                ++pos;
+            } else {
+                spec.length = LengthModifier::Short;
+            }
+            break;
+        case 'l':
+            ++pos;
+            if (pos < fmt.size() && fmt[pos] == 'l') {
+                spec.length = LengthModifier::LongLong;
+                ++pos;
+            } else {
+                spec.length = LengthModifier::Long;
+            }
+            break;
+        case 'q':
+            spec.length = LengthModifier::LongLong;
+            ++pos;
+            break;
+        case 'j':
+            spec.length = LengthModifier::IntMax;
+            ++pos;
+            break;
+        case 'z':
+            spec.length = LengthModifier::Size;
+            ++pos;
+            break;
+        case 't':
+            spec.length = LengthModifier::PtrDiff;
+            ++pos;
+            break;
+        case 'L':
+            spec.length = LengthModifier::LongDouble;
+            ++pos;
+            break;
+        }
+    }
+
+    if (pos == fmt.size()) {
+        return false;
+    }
+
+    spec.conversion = fmt[pos++];
+
+    switch (spec.conversion) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        if (spec.length == LengthModifier::LongDouble) {
+            return false;
+        }
+        break;
+    case 'c': case 's': case 'p':
+        if (spec.length != LengthModifier::None) {
+            return false;
+        }
+        break;
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a':
+    case 'A':
+        if (spec.length != LengthModifier::None
+                && spec.length != LengthModifier::Long) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    fmt.remove_prefix(pos);
+    return true;
+}
+
+static int64_t get_signed_arg(LengthModifier length, va_list *ap)
+{
+    switch (length) {
+    case LengthModifier::Char:
+        return static_cast<signed char>(va_arg(*ap, int));
+    case LengthModifier::Short:
+        return static_cast<short>(va_arg(*ap, int));
+    case LengthModifier::Long:
+        return va_arg(*ap, long);
+    case LengthModifier::LongLong:
+        return va_arg(*ap, long long);
+    case LengthModifier::IntMax:
+        return va_arg(*ap, intmax_t);
+    case LengthModifier::Size:
+        return va_arg(*ap, std::make_signed_t<size_t>);
+    case LengthModifier::PtrDiff:
+        return va_arg(*ap, ptrdiff_t);
+    default:
+        return va_arg(*ap, int);
+    }
+}
+
+static uint64_t get_unsigned_arg(LengthModifier length, va_list *ap)
+{
+    switch (length) {
+    case LengthModifier::Char:
+        return static_cast<unsigned char>(va_arg(*ap, unsigned int));
+    case LengthModifier::Short:
+        return static_cast<unsigned short>(va_arg(*ap, unsigned int));
+    case LengthModifier::Long:
+        return va_arg(*ap, unsigned long);
+    case LengthModifier::LongLong:
+        return va_arg(*ap, unsigned long long);
+    case LengthModifier::IntMax:
+        return va_arg(*ap, uintmax_t);
+    case LengthModifier::Size:
+        return va_arg(*ap, size_t);
+    case LengthModifier::PtrDiff:
+        return va_arg(*ap, std::make_unsigned_t<ptrdiff_t>);
+    default:
+        return va_arg(*ap, unsigned int);
+    }
+}
+
+static bool is_signed_conversion(char c)
+{
+    return c == 'd' || c == 'i';
+}
+
+static bool is_unsigned_conversion(char c)
+{
+    return c == 'u' || c == 'o' || c == 'x' || c == 'X';
+}
+
+void put_varint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+void put_signed_varint(std::string &out, int64_t value)
+{
+    put_varint(out, zigzag_encode(value));
+}
+
+void put_string(std::string &out, std::string_view str)
+{
+    put_varint(out, str.size());
+    out += str;
+}
+
+bool get_varint(std::string_view &in, uint64_t &value)
+{
+    value = 0;
+
+    for (size_t i = 0; i < MAX_VARINT_SIZE && i < in.size(); ++i) {
+        auto byte = static_cast<unsigned char>(in[i]);
+
+        value |= static_cast<uint64_t>(byte & 0x7f) << (i * 7);
+        if (!(byte & 0x80)) {
+            in.remove_prefix(i + 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool get_signed_varint(std::string_view &in, int64_t &value)
+{
+    uint64_t raw;
+    if (!get_varint(in, raw)) {
+        return false;
+    }
+
+    value = zigzag_decode(raw);
+    return true;
+}
+
+bool get_string(std::string_view &in, std::string_view &str)
+{
+    uint64_t size;
+    if (!get_varint(in, size) || size > in.size()) {
+        return false;
+    }
+
+    str = in.substr(0, static_cast<size_t>(size));
+    in.remove_prefix(static_cast<size_t>(size));
+    return true;
+}
+
+static bool encode_args(std::string &out, const char *fmt, va_list *ap)
+{
+    std::string_view remain(fmt);
+
+    while (true) {
+        auto pos = remain.find('%');
+        if (pos == std::string_view::npos) {
+            break;
+        }
+
+        remain.remove_prefix(pos + 1);
+
+        if (!remain.empty() && remain.front() == '%') {
+            remain.remove_prefix(1);
+            continue;
+        }
+
+        ConversionSpec spec;
+        if (!parse_spec(remain, spec)) {
+            return false;
+        }
+
+        if (spec.width_type == FieldType::Argument) {
+            put_signed_varint(out, va_arg(*ap, int));
+        }
+
+        std::optional<int> precision;
+
+        if (spec.precision_type == FieldType::Argument) {
+            int value = va_arg(*ap, int);
+            put_signed_varint(out, value);
+            if (value >= 0) {
+                precision = value;
+            }
+        } else if (spec.precision_type == FieldType::Literal) {
+            precision = 0;
+            for (char c : spec.precision) {
+                precision = *precision * 10 + (c - '0');
+            }
+        }
+
+        if (is_signed_conversion(spec.conversion)) {
+            put_signed_varint(out, get_signed_arg(spec.length, ap));
+        } else if (is_unsigned_conversion(spec.conversion)) {
+            put_varint(out, get_unsigned_arg(spec.length, ap));
+        } else if (spec.conversion == 'c') {
+            put_varint(out, static_cast<unsigned char>(va_arg(*ap, int)));
+        } else if (spec.conversion == 'p') {
+            put_varint(out, reinterpret_cast<uintptr_t>(va_arg(*ap, void *)));
+        } else if (spec.conversion == 's') {
+            const char *str = va_arg(*ap, const char *);
+            if (!str) {
+                str = "(null)";
+            }
+
+            size_t size = precision
+                    ? strnlen(str, static_cast<size_t>(*precision))
+                    : strlen(str);
+            put_string(out, {str, size});
+        } else {
+            double value = va_arg(*ap, double);
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+
+            for (int i = 0; i < 8; ++i) {
+                out += static_cast<char>(bits >> (i * 8));
+            }
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Encode the arguments for a format string
+ *
+ * \param[out] out Output buffer. The encoded arguments are appended.
+ * \param fmt printf-style format string
+ * \param ap Arguments for \p fmt
+ *
+ * \return Whether \p fmt only uses supported conversion specifiers. If false is
+ *         returned, the contents of \p out are unspecified.
+ */
+bool encode_format_args(std::string &out, const char *fmt, va_list ap)
+{
+    // The helpers need a pointer to a va_list, which can't be taken from a
+    // parameter portably because va_list may be an array type
+    va_list copy;
+    va_copy(copy, ap);
+
+    bool ret = encode_args(out, fmt, &copy);
+
+    va_end(copy);
+
+    return ret;
+}
+
+/*!
+ * \brief Format a message from arguments encoded by encode_format_args()
+ *
+ * \param fmt printf-style format string
+ * \param args Encoded arguments for \p fmt
+ *
+ * \return Formatted message if successful or `std::errc::bad_message` if \p fmt
+ *         is not supported or \p args does not match \p fmt
+ */
+oc::result<std::string> decode_format_args(std::string_view fmt,
+                                           std::string_view args)
+{
+    std::string result;
+    std::string spec_fmt;
+
+    while (true) {
+        auto pos = fmt.find('%');
+        result += fmt.substr(0, pos);
+
+        if (pos == std::string_view::npos) {
+            break;
+        }
+
+        fmt.remove_prefix(pos + 1);
+
+        if (!fmt.empty() && fmt.front() == '%') {
+            result += '%';
+            fmt.remove_prefix(1);
+            continue;
+        }
+
+        ConversionSpec spec;
+        if (!parse_spec(fmt, spec)) {
+            return std::errc::bad_message;
+        }
+
+        spec_fmt = '%';
+        spec_fmt += spec.flags;
+
+        if (spec.width_type == FieldType::Argument) {
+            int64_t width;
+            if (!get_signed_varint(args, width)) {
+                return std::errc::bad_message;
+            }
+            // A negative width is a '-' flag followed by a positive width.
+            // The '-' is parsed as a flag even after other flags.
+            spec_fmt += std::to_string(width);
+        } else {
+            spec_fmt += spec.width;
+        }
+
+        if (spec.precision_type == FieldType::Argument) {
+            int64_t precision;
+            if (!get_signed_varint(args, precision)) {
+                return std::errc::bad_message;
+            }
+            // A negative precision is taken as if it were omitted
+            if (precision >= 0 && spec.conversion != 's') {
+                spec_fmt += '.';
+                spec_fmt += std::to_string(precision);
+            }
+        } else if (spec.precision_type == FieldType::Literal
+                && spec.conversion != 's') {
+            spec_fmt += '.';
+            spec_fmt += spec.precision;
+        }
+
+        if (is_signed_conversion(spec.conversion)) {
+            int64_t value;
+            if (!get_signed_varint(args, value)) {
+                return std::errc::bad_message;
+            }
+            spec_fmt += "ll";
+            spec_fmt += spec.conversion;
+            mb::format_to(result, spec_fmt.c_str(),
+                          static_cast<long long>(value));
+        } else if (is_unsigned_conversion(spec.conversion)) {
+            uint64_t value;
+            if (!get_varint(args, value)) {
+                return std::errc::bad_message;
+            }
+            spec_fmt += "ll";
+            spec_fmt += spec.conversion;
+            mb::format_to(result, spec_fmt.c_str(),
+                          static_cast<unsigned long long>(value));
+        } else if (spec.conversion == 'c') {
+            uint64_t value;
+            if (!get_varint(args, value)) {
+                return std::errc::bad_message;
+            }
+            spec_fmt += 'c';
+            mb::format_to(result, spec_fmt.c_str(), static_cast<int>(value));
+        } else if (spec.conversion == 'p') {
+            uint64_t value;
+            if (!get_varint(args, value)) {
+                return std::errc::bad_message;
+            }
+            spec_fmt += 'p';
+            mb::format_to(result, spec_fmt.c_str(), reinterpret_cast<void *>(
+                    static_cast<uintptr_t>(value)));
+        } else if (spec.conversion == 's') {
+            std::string_view str;
+            if (!get_string(args, str)) {
+                return std::errc::bad_message;
+            }
+            // Only the bytes covered by the precision were stored
+            spec_fmt += ".*s";
+            mb::format_to(result, spec_fmt.c_str(),
+                          static_cast<int>(str.size()), str.data());
+        } else {
+            if (args.size() < 8) {
+                return std::errc::bad_message;
+            }
+
+            uint64_t bits = 0;
+            for (int i = 0; i < 8; ++i) {
+                bits |= static_cast<uint64_t>(
+                        static_cast<unsigned char>(args[i])) << (i * 8);
+            }
+            args.remove_prefix(8);
+
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+
+            spec_fmt += spec.conversion;
+            mb::format_to(result, spec_fmt.c_str(), value);
+        }
+    }
+
+    if (!args.empty()) {
+        return std::errc::bad_message;
+    }
+
+    return std::move(result);
+}
+
+}
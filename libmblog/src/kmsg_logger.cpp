@@ -19,7 +19,7 @@
 
 #include "mblog/kmsg_logger.h"
 
-#include <array>
+#include <algorithm>
 
 #include <cstddef>
 #include <cstdio>
@@ -28,7 +28,6 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
-#include <sys/uio.h>
 #include <unistd.h>
 
 namespace mb::log
@@ -46,8 +45,24 @@ static constexpr char KMSG_LEVEL_ALERT[[maybe_unused]][]    = "<1>";
 static constexpr char KMSG_LEVEL_EMERG[[maybe_unused]][]    = "<0>";
 static constexpr char KMSG_LEVEL_DEFAULT[]                  = "<d>";
 
+// Records from a single tag that are allowed in a burst and the number of
+// records per second that the burst allowance is refilled with
+static constexpr unsigned int KMSG_RATE_LIMIT_BURST        = 200;
+static constexpr unsigned int KMSG_RATE_LIMIT_PER_SECOND   = 50;
+
+static constexpr char KMSG_TRUNC[]                          = " [trunc...]\n";
+
+// Bytes of the most recent rate limited records to keep in memory
+static constexpr std::size_t KMSG_SPILL_RING_SIZE           = 64 * 1024;
+
 KmsgLogger::KmsgLogger(bool force_error_prio)
     : _force_error_prio(force_error_prio)
+    , _batching(true)
+    , _batch_prio(nullptr)
+    , _burst(KMSG_RATE_LIMIT_BURST)
+    , _per_second(KMSG_RATE_LIMIT_PER_SECOND)
+    , _spill_fd(-1)
+    , _spill_ring_size(0)
 {
     static constexpr int open_mode = O_WRONLY | O_NOCTTY | O_CLOEXEC;
     static constexpr char kmsg[] = "/dev/kmsg";
@@ -68,17 +83,31 @@ KmsgLogger::KmsgLogger(bool force_error_prio)
 
 KmsgLogger::~KmsgLogger()
 {
+    write_batch();
+
     if (_fd > 0) {
         close(_fd);
     }
+    if (_spill_fd >= 0) {
+        close(_spill_fd);
+    }
 }
 
 void KmsgLogger::log(const LogRecord &rec)
 {
+    std::lock_guard<std::mutex> guard(_mutex);
+
     if (_fd < 0) {
         return;
     }
 
+    uint64_t suppressed;
+
+    if (!take_token(rec.tag, suppressed)) {
+        spill(rec);
+        return;
+    }
+
     const char *kprio = KMSG_LEVEL_DEFAULT;
 
     if (_force_error_prio) {
@@ -103,22 +132,25 @@ void KmsgLogger::log(const LogRecord &rec)
         }
     }
 
-    std::array<iovec, 3> iov;
-    iov[0].iov_base = const_cast<char *>(kprio);
-    iov[0].iov_len = strlen(kprio);
-    iov[1].iov_base = const_cast<char *>(rec.fmt_msg.c_str());
-    iov[1].iov_len = rec.fmt_msg.size();
-    iov[2].iov_base = const_cast<char *>("\n");
-    iov[2].iov_len = 1;
+    if (suppressed > 0) {
+        std::string msg(rec.tag);
+        msg += ": ";
+        msg += std::to_string(suppressed);
+        msg += _spill_fd >= 0
+                ? " records were rate limited and written to the spill file"
+                : " records were rate limited and dropped";
 
-    if (iov[0].iov_len + iov[1].iov_len >= KMSG_BUF_SIZE) {
-        static constexpr char trunc[] = " [trunc...]\n";
-        iov[1].iov_len = KMSG_BUF_SIZE - iov[0].iov_len - sizeof(trunc) + 1;
-        iov[2].iov_base = const_cast<char *>(trunc);
-        iov[2].iov_len = sizeof(trunc) - 1;
+        append(_force_error_prio ? KMSG_LEVEL_ERROR : KMSG_LEVEL_WARNING, msg);
     }
 
-    writev(_fd, iov.data(), iov.size());
+    append(kprio, rec.fmt_msg);
+}
+
+void KmsgLogger::flush()
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    write_batch();
 }
 
 bool KmsgLogger::formatted()
@@ -126,4 +158,209 @@ bool KmsgLogger::formatted()
     return true;
 }
 
+/*!
+ * \brief Enable or disable combining records into a single write
+ *
+ * When enabled, records with the same kernel log level are combined into one
+ * write to the kmsg device until flush() is called or the kernel's limit for a
+ * single write is reached. The kernel stores each write as a single record,
+ * which is then printed as multiple lines. This uses less ring buffer space
+ * and counts as only one message for the kernel's rate limiting of userspace
+ * writes. Batching is enabled by default.
+ *
+ * \param enabled Whether to enable batching
+ */
+void KmsgLogger::set_batching(bool enabled)
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    _batching = enabled;
+
+    if (!_batching) {
+        write_batch();
+    }
+}
+
+/*!
+ * \brief Set the per-tag rate limit
+ *
+ * Each tag has a token bucket that holds at most \p burst tokens and is
+ * refilled with \p per_second tokens per second. Records from a tag with an
+ * empty bucket are written to the spill file, if one is set, or discarded.
+ * The number of records that were rate limited is logged with the next record
+ * from the tag that is allowed through.
+ *
+ * \param burst Maximum number of records to allow in a burst. 0 disables rate
+ *              limiting.
+ * \param per_second Number of records per second to allow after a burst
+ */
+void KmsgLogger::set_rate_limit(unsigned int burst, unsigned int per_second)
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    _burst = burst;
+    _per_second = per_second;
+    _buckets.clear();
+}
+
+/*!
+ * \brief Set file to write rate limited records to
+ *
+ * The file is truncated if it exists. This is meant to be called once a
+ * writable partition is available. If this is the first spill file, the rate
+ * limited records that are still held in memory are written to it first.
+ *
+ * \param path Path to spill file
+ *
+ * \return Whether the file was successfully opened
+ */
+bool KmsgLogger::set_spill_file(const std::string &path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND
+                  | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    if (_spill_fd >= 0) {
+        close(_spill_fd);
+    } else {
+        for (auto const &msg : _spill_ring) {
+            MB_IGNORE_VALUE(write(fd, msg.data(), msg.size()));
+        }
+    }
+    _spill_fd = fd;
+
+    return true;
+}
+
+/*!
+ * \brief Get the most recent rate limited records
+ *
+ * The last 64 KiB of records that did not make it to the kernel log are kept
+ * in memory regardless of whether a spill file is set, so that they can be
+ * saved along with the kernel log when there is no time to look for the
+ * spill file, such as during an emergency reboot.
+ *
+ * \return Newline-terminated records, oldest first
+ */
+std::string KmsgLogger::recent_spilled_records()
+{
+    std::lock_guard<std::mutex> guard(_mutex);
+
+    std::string result;
+    result.reserve(_spill_ring_size);
+
+    for (auto const &msg : _spill_ring) {
+        result += msg;
+    }
+
+    return result;
+}
+
+bool KmsgLogger::take_token(const std::string &tag, uint64_t &suppressed)
+{
+    using namespace std::chrono;
+
+    suppressed = 0;
+
+    if (_burst == 0) {
+        return true;
+    }
+
+    auto now = steady_clock::now();
+    auto it = _buckets.find(tag);
+
+    if (it == _buckets.end()) {
+        it = _buckets.emplace(tag, TokenBucket{
+            static_cast<double>(_burst), now, 0
+        }).first;
+    } else {
+        auto &bucket = it->second;
+        auto elapsed = duration<double>(now - bucket.last).count();
+
+        bucket.tokens = std::min(bucket.tokens + elapsed * _per_second,
+                                 static_cast<double>(_burst));
+        bucket.last = now;
+    }
+
+    auto &bucket = it->second;
+
+    if (bucket.tokens < 1) {
+        ++bucket.suppressed;
+        return false;
+    }
+
+    bucket.tokens -= 1;
+    suppressed = bucket.suppressed;
+    bucket.suppressed = 0;
+
+    return true;
+}
+
+void KmsgLogger::append(const char *kprio, const std::string &msg)
+{
+    size_t prio_len = strlen(kprio);
+    size_t msg_len = msg.size();
+    const char *end = "\n";
+
+    if (prio_len + msg_len >= KMSG_BUF_SIZE) {
+        msg_len = KMSG_BUF_SIZE - prio_len - sizeof(KMSG_TRUNC) + 1;
+        end = KMSG_TRUNC;
+    }
+
+    size_t line_len = msg_len + strlen(end);
+
+    if (!_batch.empty() && (kprio != _batch_prio
+            || _batch.size() + line_len > KMSG_BUF_SIZE)) {
+        write_batch();
+    }
+
+    if (_batch.empty()) {
+        _batch += kprio;
+        _batch_prio = kprio;
+    }
+
+    _batch.append(msg, 0, msg_len);
+    _batch += end;
+
+    if (!_batching) {
+        write_batch();
+    }
+}
+
+void KmsgLogger::write_batch()
+{
+    if (_batch.empty()) {
+        return;
+    }
+
+    if (_fd >= 0) {
+        MB_IGNORE_VALUE(write(_fd, _batch.data(), _batch.size()));
+    }
+
+    _batch.clear();
+    _batch_prio = nullptr;
+}
+
+void KmsgLogger::spill(const LogRecord &rec)
+{
+    std::string msg(rec.fmt_msg);
+    msg += '\n';
+
+    if (_spill_fd >= 0) {
+        MB_IGNORE_VALUE(write(_spill_fd, msg.data(), msg.size()));
+    }
+
+    _spill_ring_size += msg.size();
+    _spill_ring.push_back(std::move(msg));
+
+    while (_spill_ring_size > KMSG_SPILL_RING_SIZE) {
+        _spill_ring_size -= _spill_ring.front().size();
+        _spill_ring.pop_front();
+    }
+}
+
 }
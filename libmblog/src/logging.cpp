@@ -19,10 +19,14 @@
 
 #include "mblog/logging.h"
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <mutex>
-#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
@@ -33,9 +37,8 @@
 #if defined(_WIN32)
 #  include <windows.h>
 #else
-#  if defined(__APPLE__)
-#    include <pthread.h>
-#  elif defined(__linux__)
+#  include <pthread.h>
+#  if defined(__linux__)
 #    include <sys/syscall.h>
 #  endif
 #  include <unistd.h>
@@ -45,6 +48,7 @@
 #include "mbcommon/string.h"
 #include "mbcommon/type_traits.h"
 
+#include "mblog/format_args_p.h"
 #include "mblog/log_record.h"
 #include "mblog/stdio_logger.h"
 
@@ -66,6 +70,10 @@ using Tid = pid_t;
 static std::shared_ptr<BaseLogger> g_logger;
 static std::mutex g_mutex;
 
+std::atomic<int> detail::g_level{MB_LOG_LEVEL_VERBOSE};
+// Whether g_logger is structured. Checked without taking g_mutex.
+static std::atomic<bool> g_structured;
+
 static std::string g_format{"[%t][%P:%T][%l] %N: %m"};
 
 // %l - Level
@@ -76,6 +84,85 @@ static std::string g_format{"[%t][%P:%T][%l] %N: %m"};
 // %P - Process ID
 // %T - Thread ID
 
+enum class FormatOpType
+{
+    Literal,
+    Level,
+    Message,
+    Tag,
+    ShortTag,
+    Time,
+    ProcessId,
+    ThreadId,
+};
+
+struct FormatOp
+{
+    FormatOpType type;
+    std::string text;
+};
+
+/*!
+ * \brief Compile format string into a list of operations
+ *
+ * Consecutive literal characters are merged into a single operation. Unknown
+ * format specifiers are treated as literals and a trailing '%' is kept as is.
+ */
+static std::vector<FormatOp> _compile_format(std::string_view fmt)
+{
+    std::vector<FormatOp> ops;
+
+    auto add_char = [&](char c) {
+        if (ops.empty() || ops.back().type != FormatOpType::Literal) {
+            ops.push_back({FormatOpType::Literal, {}});
+        }
+        ops.back().text += c;
+    };
+
+    for (auto it = fmt.begin(); it != fmt.end(); ++it) {
+        if (*it != '%') {
+            add_char(*it);
+            continue;
+        } else if (it + 1 == fmt.end()) {
+            add_char('%');
+            break;
+        }
+
+        ++it;
+
+        switch (*it) {
+        case 'l':
+            ops.push_back({FormatOpType::Level, {}});
+            break;
+        case 'm':
+            ops.push_back({FormatOpType::Message, {}});
+            break;
+        case 'n':
+            ops.push_back({FormatOpType::Tag, {}});
+            break;
+        case 'N':
+            ops.push_back({FormatOpType::ShortTag, {}});
+            break;
+        case 't':
+            ops.push_back({FormatOpType::Time, {}});
+            break;
+        case 'P':
+            ops.push_back({FormatOpType::ProcessId, {}});
+            break;
+        case 'T':
+            ops.push_back({FormatOpType::ThreadId, {}});
+            break;
+        default:
+            add_char(*it);
+            break;
+        }
+    }
+
+    return ops;
+}
+
+static std::vector<FormatOp> g_format_ops = _compile_format(g_format);
+
 
 static Pid _get_pid()
 {
@@ -273,21 +360,94 @@ static bool _local_time_ns(const std::chrono::system_clock::time_point &tp,
     return true;
 }
 
-static std::string _format_iso8601(const std::tm &tm, long nanoseconds,
-                                   long gmtoff)
+//! Local time formatting state for the last second that was formatted
+struct TimeCache
+{
+    bool valid = false;
+    std::chrono::system_clock::time_point second;
+    // Sample: 2017-09-17T23:27:00.
+    std::string prefix;
+    // Sample: +00:00
+    std::string suffix;
+};
+
+static void _append_u64(std::string &buf, uint64_t value)
+{
+    char tmp[20];
+    char *end = tmp + sizeof(tmp);
+    char *ptr = end;
+
+    do {
+        *--ptr = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    buf.append(ptr, end);
+}
+
+static void _append_nanos(std::string &buf, long nanos)
+{
+    char tmp[9];
+
+    for (auto i = sizeof(tmp); i > 0; --i) {
+        tmp[i - 1] = static_cast<char>('0' + nanos % 10);
+        nanos /= 10;
+    }
+
+    buf.append(tmp, sizeof(tmp));
+}
+
+static void _fill_time_cache(TimeCache &cache,
+                             std::chrono::system_clock::time_point second)
 {
-    // Sample: 2017-09-17T23:27:00.000000000+00:00
-    return mb::format("%04d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02ld:%02ld",
-                      tm.tm_year + 1900,
-                      tm.tm_mon + 1,
-                      tm.tm_mday,
-                      tm.tm_hour,
-                      tm.tm_min,
-                      tm.tm_sec,
-                      nanoseconds,
-                      gmtoff >= 0 ? '+' : '-',
-                      std::abs(gmtoff) / 3600,
-                      std::abs(gmtoff / 60) % 60);
+    std::tm tm;
+    long nanos;
+    long gmtoff;
+
+    if (!_local_time_ns(second, tm, nanos, gmtoff)) {
+        tm = _tm_epoch();
+        gmtoff = 0;
+    }
+
+    // Reuse the buffers since this runs once per second
+    cache.prefix.clear();
+    mb::format_to(cache.prefix, "%04d-%02d-%02dT%02d:%02d:%02d.",
+                  tm.tm_year + 1900,
+                  tm.tm_mon + 1,
+                  tm.tm_mday,
+                  tm.tm_hour,
+                  tm.tm_min,
+                  tm.tm_sec);
+    cache.suffix.clear();
+    mb::format_to(cache.suffix, "%c%02ld:%02ld",
+                  gmtoff >= 0 ? '+' : '-',
+                  std::abs(gmtoff) / 3600,
+                  std::abs(gmtoff / 60) % 60);
+    cache.second = second;
+    cache.valid = true;
+}
+
+/*!
+ * \brief Append ISO 8601 timestamp with nanosecond precision
+ *
+ * The local time conversion is only done once per second. A timezone change
+ * takes effect at the next second.
+ */
+static void _append_iso8601(std::string &buf, TimeCache &cache,
+                            std::chrono::system_clock::time_point tp)
+{
+    using namespace std::chrono;
+
+    auto second = floor<seconds>(tp);
+
+    if (!cache.valid || cache.second != second) {
+        _fill_time_cache(cache, second);
+    }
+
+    buf += cache.prefix;
+    _append_nanos(buf, static_cast<long>(
+            duration_cast<nanoseconds>(tp - second).count()));
+    buf += cache.suffix;
 }
 
 static char _format_prio(LogLevel prio)
@@ -308,96 +468,454 @@ static char _format_prio(LogLevel prio)
     }
 }
 
-static std::string _format_short_tag(std::string_view tag)
+static void _append_short_tag(std::string &buf, std::string_view tag)
 {
     // Keep first letter in each component
-    auto pieces = split_sv(tag, '/');
-    if (!pieces.empty()) {
-        for (auto it = pieces.begin(); it != pieces.end() - 1; ++it) {
-            if (!it->empty() && isalnum(it->front())) {
-                *it = it->substr(0, 1);
+    while (true) {
+        auto pos = tag.find('/');
+        if (pos == std::string_view::npos) {
+            buf += tag;
+            break;
+        }
+
+        auto piece = tag.substr(0, pos);
+        if (!piece.empty() && isalnum(piece.front())) {
+            buf += piece.front();
+        } else {
+            buf += piece;
+        }
+        buf += '/';
+
+        tag.remove_prefix(pos + 1);
+    }
+}
+
+/*!
+ * \brief Format record according to the compiled format
+ *
+ * \pre The caller must hold g_mutex
+ */
+static void _format_rec(LogRecord &rec)
+{
+    // Protected by g_mutex. Reused to avoid reallocating while formatting.
+    static std::string buf;
+    static TimeCache time_cache;
+
+    buf.clear();
+
+    for (auto const &op : g_format_ops) {
+        switch (op.type) {
+        case FormatOpType::Literal:
+            buf += op.text;
+            break;
+        case FormatOpType::Level:
+            buf += _format_prio(rec.prio);
+            break;
+        case FormatOpType::Message:
+            buf += rec.msg;
+            break;
+        case FormatOpType::Tag:
+            buf += rec.tag;
+            break;
+        case FormatOpType::ShortTag:
+            _append_short_tag(buf, rec.tag);
+            break;
+        case FormatOpType::Time:
+            _append_iso8601(buf, time_cache, rec.time);
+            break;
+        case FormatOpType::ProcessId:
+            _append_u64(buf, rec.pid);
+            break;
+        case FormatOpType::ThreadId:
+            _append_u64(buf, rec.tid);
+            break;
+        }
+    }
+
+    rec.fmt_msg.assign(buf);
+}
+
+static void _log_locked(LogRecord &rec)
+{
+    if (!g_logger) {
+        g_logger = std::make_shared<StdioLogger>(stdout);
+    }
+
+    // The logger may have been replaced by one that is not structured after
+    // the record was queued
+    if (!rec.fmt.empty() && !g_logger->structured()) {
+        if (auto msg = detail::decode_format_args(rec.fmt, rec.args)) {
+            rec.msg = std::move(msg.value());
+        } else {
+            rec.msg = rec.fmt;
+        }
+        rec.fmt.clear();
+        rec.args.clear();
+    }
+
+    if (g_logger->formatted()) {
+        _format_rec(rec);
+    }
+
+    g_logger->log(rec);
+}
+
+// Asynchronous logging
+//
+// Records are pushed into a bounded MPSC queue based on Dmitry Vyukov's
+// design. Each slot has a sequence number that tells producers and the
+// consumer whether the slot is free or holds a published record, so pushing
+// a record only needs a single CAS on the enqueue position. When the queue is
+// full, the record is dropped and counted. The drain thread reports the number
+// of dropped records the next time it logs.
+
+struct AsyncSlot
+{
+    std::atomic<size_t> seq;
+    LogRecord rec;
+};
+
+static constexpr size_t ASYNC_QUEUE_SIZE = 1024;
+static constexpr size_t ASYNC_QUEUE_MASK = ASYNC_QUEUE_SIZE - 1;
+static constexpr size_t ASYNC_BATCH_SIZE = 64;
+
+static_assert((ASYNC_QUEUE_SIZE & ASYNC_QUEUE_MASK) == 0,
+              "Queue size must be a power of 2");
+
+static AsyncSlot g_slots[ASYNC_QUEUE_SIZE];
+static std::atomic<size_t> g_enqueue_pos;
+static std::atomic<size_t> g_dequeue_pos;
+static std::atomic<uint64_t> g_dropped;
+
+static std::atomic<bool> g_async;
+// Protects starting and stopping the drain thread
+static std::mutex g_async_mutex;
+// Never freed so that a forked child can forget about the parent's thread
+static std::thread *g_thread;
+
+// Protects sleeping and waking up of the drain thread and flush waiters
+static std::mutex g_wake_mutex;
+static std::condition_variable g_wake_cv;
+static std::condition_variable g_flush_cv;
+static std::atomic<bool> g_waiting;
+static bool g_stop;
+
+static void _async_reset()
+{
+    for (size_t i = 0; i < ASYNC_QUEUE_SIZE; ++i) {
+        g_slots[i].seq.store(i, std::memory_order_relaxed);
+        g_slots[i].rec = {};
+    }
+
+    g_enqueue_pos.store(0, std::memory_order_relaxed);
+    g_dequeue_pos.store(0, std::memory_order_relaxed);
+    g_dropped.store(0, std::memory_order_relaxed);
+}
+
+static bool _async_push(LogRecord &rec)
+{
+    size_t pos = g_enqueue_pos.load(std::memory_order_relaxed);
+
+    while (true) {
+        auto &slot = g_slots[pos & ASYNC_QUEUE_MASK];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+        if (diff == 0) {
+            if (g_enqueue_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                slot.rec = std::move(rec);
+                slot.seq.store(pos + 1, std::memory_order_release);
+                return true;
             }
+        } else if (diff < 0) {
+            // Queue is full
+            return false;
+        } else {
+            pos = g_enqueue_pos.load(std::memory_order_relaxed);
         }
     }
-    return join(pieces, '/');
 }
 
-static std::string _format_rec(const LogRecord &rec)
+//! Whether the next record is published. Must only be called by the consumer.
+static bool _async_ready()
 {
-    std::string buf;
-    std::optional<std::string> time_buf;
+    size_t pos = g_dequeue_pos.load(std::memory_order_relaxed);
+    auto &slot = g_slots[pos & ASYNC_QUEUE_MASK];
+
+    return slot.seq.load(std::memory_order_acquire) == pos + 1;
+}
 
-    for (auto it = g_format.begin(); it != g_format.end(); ++it) {
-        if (*it == '%') {
-            if (it + 1 == g_format.end()) {
-                buf += '%';
-                break;
+//! Pop the next record. Must only be called by the consumer.
+static bool _async_pop(LogRecord &rec)
+{
+    size_t pos = g_dequeue_pos.load(std::memory_order_relaxed);
+    auto &slot = g_slots[pos & ASYNC_QUEUE_MASK];
+
+    if (slot.seq.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+    }
+
+    rec = std::move(slot.rec);
+    slot.seq.store(pos + ASYNC_QUEUE_SIZE, std::memory_order_release);
+    g_dequeue_pos.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+/*!
+ * \brief Log all published records
+ *
+ * \return Whether any records were logged
+ */
+static bool _async_drain()
+{
+    bool logged = false;
+    LogRecord rec;
+
+    while (true) {
+        size_t count = 0;
+
+        {
+            std::lock_guard<std::mutex> guard(g_mutex);
+
+            if (auto dropped = g_dropped.exchange(0); dropped > 0) {
+                LogRecord drop_rec;
+                drop_rec.time = std::chrono::system_clock::now();
+                drop_rec.mono_time = std::chrono::steady_clock::now();
+                drop_rec.pid = static_cast<uint64_t>(_get_pid());
+                drop_rec.tid = static_cast<uint64_t>(_get_tid());
+                drop_rec.prio = LogLevel::Warning;
+                drop_rec.tag = "mblog";
+                drop_rec.msg = mb::format(
+                        "Dropped %" PRIu64 " log records", dropped);
+
+                _log_locked(drop_rec);
             }
 
-            ++it;
-
-            switch (*it) {
-            case 'l':
-                buf += _format_prio(rec.prio);
-                break;
-
-            case 'm':
-                buf += rec.msg;
-                break;
-
-            case 'n':
-                buf += rec.tag;
-                break;
-
-            case 'N':
-                buf += _format_short_tag(rec.tag);
-                break;
-
-            case 't':
-                if (!time_buf) {
-                    std::tm tm;
-                    long nanos;
-                    long gmtoff;
-
-                    if (!_local_time_ns(rec.time, tm, nanos, gmtoff)) {
-                        tm = _tm_epoch();
-                        nanos = 0;
-                        gmtoff = 0;
-                    }
-
-                    time_buf = _format_iso8601(tm, nanos, gmtoff);
-                }
-                buf += *time_buf;
-                break;
-
-            case 'P':
-                buf += mb::format("%" PRIu64, rec.pid);
-                break;
-
-            case 'T':
-                buf += mb::format("%" PRIu64, rec.tid);
-                break;
-
-            default:
-                buf += *it;
-                break;
+            for (; count < ASYNC_BATCH_SIZE && _async_pop(rec); ++count) {
+                _log_locked(rec);
+            }
+
+            if (g_logger) {
+                g_logger->flush();
             }
-        } else {
-            buf += *it;
         }
+
+        if (count == 0) {
+            break;
+        }
+
+        logged = true;
     }
 
-    return buf;
+    return logged;
 }
 
+static void _async_thread_func()
+{
+    while (true) {
+        _async_drain();
+
+        std::unique_lock<std::mutex> lock(g_wake_mutex);
+
+        g_flush_cv.notify_all();
+
+        if (g_stop && !_async_ready()) {
+            break;
+        }
+
+        // Pairs with the fence in _async_wake(). Either the producer sees that
+        // we are waiting or we see its published record.
+        g_waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (!g_stop && !_async_ready()) {
+            // The timeout is only a fallback for a producer that claimed a
+            // slot, but has not published it yet
+            g_wake_cv.wait_for(lock, std::chrono::milliseconds(100));
+        }
+
+        g_waiting.store(false, std::memory_order_relaxed);
+    }
+}
+
+static void _async_wake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (g_waiting.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> guard(g_wake_mutex);
+        g_wake_cv.notify_one();
+    }
+}
+
+static void _async_stop()
+{
+    std::lock_guard<std::mutex> guard(g_async_mutex);
+
+    if (!g_thread) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> wake_guard(g_wake_mutex);
+        g_stop = true;
+        g_wake_cv.notify_one();
+    }
+
+    g_thread->join();
+    delete g_thread;
+    g_thread = nullptr;
+
+    {
+        std::lock_guard<std::mutex> wake_guard(g_wake_mutex);
+        g_async.store(false, std::memory_order_release);
+        g_stop = false;
+        g_flush_cv.notify_all();
+    }
+
+    // Log records pushed by threads that raced with the shutdown. We are the
+    // only consumer now.
+    _async_drain();
+}
+
+#ifndef _WIN32
+static void _atfork_prepare()
+{
+    g_async_mutex.lock();
+    g_mutex.lock();
+    g_wake_mutex.lock();
+}
+
+static void _atfork_parent()
+{
+    g_wake_mutex.unlock();
+    g_mutex.unlock();
+    g_async_mutex.unlock();
+}
+
+static void _atfork_child()
+{
+    // The drain thread does not exist in the child. The queued records belong
+    // to the parent, which will log them, so discard them and log
+    // synchronously instead.
+    if (g_thread) {
+        g_thread = nullptr;
+        g_async.store(false, std::memory_order_relaxed);
+        g_waiting.store(false, std::memory_order_relaxed);
+        _async_reset();
+    }
+
+    _atfork_parent();
+}
+
+// Registered for synchronous logging too so that a child forked while another
+// thread is logging does not inherit a locked mutex
+static const int g_atfork_registered =
+        pthread_atfork(&_atfork_prepare, &_atfork_parent, &_atfork_child);
+#endif
+
 std::shared_ptr<BaseLogger> logger()
 {
+    std::lock_guard<std::mutex> guard(g_mutex);
     return g_logger;
 }
 
 void set_logger(std::shared_ptr<BaseLogger> logger)
 {
+    std::lock_guard<std::mutex> guard(g_mutex);
     g_logger = std::move(logger);
+    g_structured.store(g_logger && g_logger->structured(),
+                       std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Enable or disable asynchronous logging
+ *
+ * When enabled, log() and log_v() only format the message and push the record
+ * into a bounded queue. A background thread formats the complete record and
+ * passes it to the logger. If the queue is full, the record is dropped and a
+ * warning with the number of dropped records is logged later.
+ *
+ * Disabling asynchronous logging waits for all queued records to be logged.
+ * This also happens automatically at exit(), but not at _exit(), exec*(), or
+ * reboot. Call flush() or set_async(false) before those.
+ *
+ * Forked children always log synchronously.
+ *
+ * \param enabled Whether to enable asynchronous logging
+ */
+void set_async(bool enabled)
+{
+    if (!enabled) {
+        _async_stop();
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(g_async_mutex);
+
+    if (g_thread) {
+        return;
+    }
+
+    static std::once_flag once;
+    std::call_once(once, [] {
+        _async_reset();
+        atexit(&_async_stop);
+    });
+
+    g_thread = new std::thread(&_async_thread_func);
+    g_async.store(true, std::memory_order_release);
+}
+
+/*!
+ * \brief Wait for all records queued so far to be logged
+ *
+ * If asynchronous logging is disabled, this only flushes the logger.
+ */
+void flush()
+{
+    if (!g_async.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> guard(g_mutex);
+        if (g_logger) {
+            g_logger->flush();
+        }
+        return;
+    }
+
+    size_t target = g_enqueue_pos.load(std::memory_order_acquire);
+
+    std::unique_lock<std::mutex> lock(g_wake_mutex);
+    g_wake_cv.notify_one();
+
+    g_flush_cv.wait(lock, [&] {
+        return !g_async.load(std::memory_order_acquire)
+                || g_dequeue_pos.load(std::memory_order_acquire) >= target;
+    });
+}
+
+/*!
+ * \brief Get the most verbose level that is logged
+ */
+LogLevel level()
+{
+    return static_cast<LogLevel>(
+            detail::g_level.load(std::memory_order_relaxed));
+}
+
+/*!
+ * \brief Set the most verbose level that is logged
+ *
+ * Records with a more verbose level are discarded before their messages are
+ * formatted. Note that log calls above `MB_LOG_MIN_LEVEL` are compiled out and
+ * cannot be enabled at runtime.
+ *
+ * \param level Most verbose level to log
+ */
+void set_level(LogLevel level)
+{
+    detail::g_level.store(static_cast<int>(level), std::memory_order_relaxed);
 }
 
 void log(LogLevel prio, const char *tag, const char *fmt, ...)
@@ -412,36 +930,58 @@ void log(LogLevel prio, const char *tag, const char *fmt, ...)
 
 void log_v(LogLevel prio, const char *tag, const char *fmt, va_list ap)
 {
+    if (!is_loggable(prio)) {
+        return;
+    }
+
     ErrorRestorer restorer;
     LogRecord rec;
-    std::lock_guard<std::mutex> guard(g_mutex);
 
     rec.time = std::chrono::system_clock::now();
+    rec.mono_time = std::chrono::steady_clock::now();
     rec.pid = static_cast<uint64_t>(_get_pid());
     rec.tid = static_cast<uint64_t>(_get_tid());
     rec.prio = prio;
     rec.tag = tag;
-    rec.msg = format_v(fmt, ap);
 
-    if (!g_logger) {
-        g_logger = std::make_shared<StdioLogger>(stdout);
+    if (g_structured.load(std::memory_order_relaxed)) {
+        if (detail::encode_format_args(rec.args, fmt, ap)) {
+            rec.fmt = fmt;
+        } else {
+            rec.args.clear();
+            rec.msg = format_v(fmt, ap);
+        }
+    } else {
+        rec.msg = format_v(fmt, ap);
     }
 
-    if (g_logger->formatted()) {
-        rec.fmt_msg = _format_rec(rec);
+    if (g_async.load(std::memory_order_acquire)) {
+        if (_async_push(rec)) {
+            _async_wake();
+        } else {
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
     }
 
-    g_logger->log(rec);
+    std::lock_guard<std::mutex> guard(g_mutex);
+    _log_locked(rec);
+    g_logger->flush();
 }
 
 std::string format()
 {
+    std::lock_guard<std::mutex> guard(g_mutex);
     return g_format;
 }
 
 void set_format(std::string fmt)
 {
+    auto ops = _compile_format(fmt);
+
+    std::lock_guard<std::mutex> guard(g_mutex);
     g_format = std::move(fmt);
+    g_format_ops = std::move(ops);
 }
 
 }
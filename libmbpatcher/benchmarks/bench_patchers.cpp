@@ -0,0 +1,896 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+
+#include "mbdevice/device.h"
+#include "mbdevice/flags.h"
+#include "mbdevice/json.h"
+
+#include "mblog/base_logger.h"
+#include "mblog/logging.h"
+
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patcherinterface.h"
+
+#include "mbpio/delete.h"
+
+using namespace mb;
+using namespace mb::patcher;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr char SYSTEM_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/system";
+static constexpr char CACHE_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/cache";
+static constexpr char DATA_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/userdata";
+static constexpr char BOOT_BLOCK_DEV[] =
+        "/dev/block/platform/msm_sdcc.1/by-name/boot";
+
+/*!
+ * \brief Only print warnings and errors so the patchers' debug output does not
+ *        end up in the measurements
+ */
+class QuietLogger : public log::BaseLogger
+{
+public:
+    void log(const log::LogRecord &rec) override
+    {
+        if (rec.prio == log::LogLevel::Error
+                || rec.prio == log::LogLevel::Warning) {
+            fprintf(stderr, "%s\n", rec.fmt_msg.c_str());
+        }
+    }
+
+    bool formatted() override
+    {
+        return true;
+    }
+};
+
+struct Options
+{
+    uint64_t size = 128 * 1024 * 1024;
+    unsigned int iterations = 3;
+    std::string device_file;
+    std::string data_dir;
+    std::string rom_id = "dual";
+    std::string tmpdir = "/tmp";
+    bool synthetic = true;
+    std::vector<std::string> inputs;
+};
+
+struct Input
+{
+    std::string path;
+    std::string patcher_id;
+};
+
+struct Result
+{
+    double seconds = 0;
+    uint64_t peak_rss = 0;
+    Patcher::PhaseTimes phases;
+    bool ok = true;
+};
+
+// Synthetic inputs
+
+/*!
+ * \brief Deterministic generator for data that compresses roughly like the
+ *        contents of a real system image
+ *
+ * The output alternates between runs of words from a small dictionary and
+ * runs of random bytes.
+ */
+class DataGenerator
+{
+public:
+    explicit DataGenerator(uint64_t seed) : m_state(seed | 1)
+    {
+    }
+
+    void fill(std::string &buf, size_t size)
+    {
+        static const char *words[] = {
+            "android", "system", "framework", "vendor", "lib", "bin",
+            "persist", "ro.build", "property", "service", "class", "main",
+            "0x00000000", "\n", "/dev/block/", "selinux", "context", " ",
+        };
+
+        buf.clear();
+        buf.reserve(size);
+
+        while (buf.size() < size) {
+            auto run = static_cast<size_t>(next() % 4096) + 64;
+            run = std::min(run, size - buf.size());
+
+            if (next() % 3 == 0) {
+                for (size_t i = 0; i < run; ++i) {
+                    buf.push_back(static_cast<char>(next()));
+                }
+            } else {
+                while (run > 0) {
+                    const char *word = words[next() % std::size(words)];
+                    size_t n = std::min(strlen(word), run);
+                    buf.append(word, n);
+                    run -= n;
+                }
+            }
+        }
+    }
+
+private:
+    uint64_t next()
+    {
+        // xorshift64
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+        return m_state;
+    }
+
+    uint64_t m_state;
+};
+
+static bool write_file(const std::string &path, const std::string &data)
+{
+    FILE *fp = fopen(path.c_str(), "wbe");
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    ok = fclose(fp) == 0 && ok;
+
+    if (!ok) {
+        fprintf(stderr, "%s: Failed to write: %s\n",
+                path.c_str(), strerror(errno));
+    }
+
+    return ok;
+}
+
+static bool read_file(const std::string &path, std::string &data)
+{
+    FILE *fp = fopen(path.c_str(), "rbe");
+    if (!fp) {
+        return false;
+    }
+
+    data.clear();
+
+    char buf[65536];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.append(buf, n);
+    }
+
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static bool make_dirs(const std::string &path)
+{
+    for (size_t pos = 1; pos <= path.size(); ++pos) {
+        if (pos == path.size() || path[pos] == '/') {
+            std::string dir = path.substr(0, pos);
+            if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+                fprintf(stderr, "%s: Failed to create directory: %s\n",
+                        dir.c_str(), strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Add an entry to an archive being written by libarchive
+ */
+static bool la_add_entry(archive *a, const std::string &name,
+                         const std::string &data)
+{
+    std::unique_ptr<archive_entry, decltype(archive_entry_free) *> entry(
+            archive_entry_new(), &archive_entry_free);
+    if (!entry) {
+        return false;
+    }
+
+    archive_entry_set_pathname(entry.get(), name.c_str());
+    archive_entry_set_filetype(entry.get(), AE_IFREG);
+    archive_entry_set_perm(entry.get(), 0644);
+    archive_entry_set_size(entry.get(), static_cast<la_int64_t>(data.size()));
+    archive_entry_set_mtime(entry.get(), 1514764800, 0);
+
+    if (archive_write_header(a, entry.get()) != ARCHIVE_OK) {
+        fprintf(stderr, "%s: Failed to write header: %s\n",
+                name.c_str(), archive_error_string(a));
+        return false;
+    }
+
+    for (size_t pos = 0; pos < data.size();) {
+        auto n = archive_write_data(a, data.data() + pos,
+                                    std::min<size_t>(data.size() - pos,
+                                                     1024 * 1024));
+        if (n <= 0) {
+            fprintf(stderr, "%s: Failed to write data: %s\n",
+                    name.c_str(), archive_error_string(a));
+            return false;
+        }
+        pos += static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+static std::string make_updater_script(unsigned int blocks)
+{
+    std::string script;
+
+    for (unsigned int i = 0; i < blocks; ++i) {
+        script += format(
+                "ui_print(\"Installing part %u\");\n"
+                "mount(\"ext4\", \"EMMC\", \"%s\", \"/system\");\n"
+                "package_extract_dir(\"system\", \"/system\");\n"
+                "run_program(\"/sbin/busybox\", \"mount\", \"/system\");\n"
+                "set_metadata_recursive(\"/system/bin\", \"uid\", 0, "
+                "\"gid\", 2000, \"dmode\", 0755, \"fmode\", 0755);\n"
+                "unmount(\"/system\");\n"
+                "format(\"ext4\", \"EMMC\", \"%s\", \"0\", \"/cache\");\n",
+                i, SYSTEM_BLOCK_DEV, CACHE_BLOCK_DEV);
+    }
+
+    return script;
+}
+
+/*!
+ * \brief Create a flashable zip resembling a block-based ROM
+ *
+ * Most of the size is in system.new.dat. The rest is split into many small
+ * files to measure the per-entry overhead.
+ */
+static bool create_synthetic_zip(const std::string &path, uint64_t size)
+{
+    std::unique_ptr<archive, decltype(archive_write_free) *> a(
+            archive_write_new(), &archive_write_free);
+    if (!a) {
+        return false;
+    }
+
+    if (archive_write_set_format_zip(a.get()) != ARCHIVE_OK
+            || archive_write_open_filename(a.get(), path.c_str())
+                    != ARCHIVE_OK) {
+        fprintf(stderr, "%s: Failed to open: %s\n",
+                path.c_str(), archive_error_string(a.get()));
+        return false;
+    }
+
+    DataGenerator gen(0x5eed);
+    std::string data;
+
+    if (!la_add_entry(a.get(), "META-INF/com/google/android/updater-script",
+                      make_updater_script(500))) {
+        return false;
+    }
+
+    gen.fill(data, 256 * 1024);
+    if (!la_add_entry(a.get(), "META-INF/com/google/android/update-binary",
+                      data)) {
+        return false;
+    }
+
+    if (!la_add_entry(a.get(), "system.transfer.list",
+                      "3\n1024\n0\n0\n"
+                      "erase 2,0,262144\n"
+                      "new 4,0,512,1024,1536\n")) {
+        return false;
+    }
+
+    gen.fill(data, 8 * 1024 * 1024);
+    if (!la_add_entry(a.get(), "boot.img", data)) {
+        return false;
+    }
+
+    uint64_t small_total = size * 3 / 10;
+    constexpr size_t small_size = 64 * 1024;
+
+    for (uint64_t i = 0; i < small_total / small_size; ++i) {
+        gen.fill(data, small_size);
+        if (!la_add_entry(a.get(), format("system/app/App%" PRIu64
+                                          "/App%" PRIu64 ".apk", i, i),
+                          data)) {
+            return false;
+        }
+    }
+
+    gen.fill(data, static_cast<size_t>(size - small_total));
+    if (!la_add_entry(a.get(), "system.new.dat", data)) {
+        return false;
+    }
+
+    if (archive_write_close(a.get()) != ARCHIVE_OK) {
+        fprintf(stderr, "%s: Failed to close: %s\n",
+                path.c_str(), archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief LZ4-compress data with libarchive, like the *.lz4 images in Odin
+ *        tarballs
+ */
+static bool lz4_compress(const std::string &in, std::string &out)
+{
+    std::unique_ptr<archive, decltype(archive_write_free) *> a(
+            archive_write_new(), &archive_write_free);
+    if (!a) {
+        return false;
+    }
+
+    out.resize(in.size() + in.size() / 16 + 1024 * 1024);
+    size_t used = 0;
+
+    if (archive_write_add_filter_lz4(a.get()) != ARCHIVE_OK
+            || archive_write_set_format_raw(a.get()) != ARCHIVE_OK
+            || archive_write_set_bytes_in_last_block(a.get(), 1) != ARCHIVE_OK
+            || archive_write_open_memory(a.get(), out.data(), out.size(),
+                                         &used) != ARCHIVE_OK) {
+        fprintf(stderr, "Failed to set up LZ4 compression: %s\n",
+                archive_error_string(a.get()));
+        return false;
+    }
+
+    if (!la_add_entry(a.get(), "data", in)
+            || archive_write_close(a.get()) != ARCHIVE_OK) {
+        fprintf(stderr, "Failed to LZ4-compress data: %s\n",
+                archive_error_string(a.get()));
+        return false;
+    }
+
+    out.resize(used);
+    return true;
+}
+
+/*!
+ * \brief Create an Odin tarball with the images handled by OdinPatcher
+ */
+static bool create_synthetic_tar(const std::string &path, uint64_t size)
+{
+    std::unique_ptr<archive, decltype(archive_write_free) *> a(
+            archive_write_new(), &archive_write_free);
+    if (!a) {
+        return false;
+    }
+
+    if (archive_write_set_format_ustar(a.get()) != ARCHIVE_OK
+            || archive_write_open_filename(a.get(), path.c_str())
+                    != ARCHIVE_OK) {
+        fprintf(stderr, "%s: Failed to open: %s\n",
+                path.c_str(), archive_error_string(a.get()));
+        return false;
+    }
+
+    DataGenerator gen(0x0d1);
+    std::string data;
+    std::string compressed;
+
+    gen.fill(data, 8 * 1024 * 1024);
+    if (!la_add_entry(a.get(), "boot.img", data)) {
+        return false;
+    }
+
+    // Skipped by the patcher
+    gen.fill(data, 4 * 1024 * 1024);
+    if (!la_add_entry(a.get(), "modem.bin", data)) {
+        return false;
+    }
+
+    gen.fill(data, static_cast<size_t>(size * 3 / 4));
+    if (!lz4_compress(data, compressed)
+            || !la_add_entry(a.get(), "system.img.ext4.lz4", compressed)) {
+        return false;
+    }
+
+    gen.fill(data, static_cast<size_t>(size / 4));
+    if (!la_add_entry(a.get(), "cache.img.ext4", data)) {
+        return false;
+    }
+
+    if (archive_write_close(a.get()) != ARCHIVE_OK) {
+        fprintf(stderr, "%s: Failed to close: %s\n",
+                path.c_str(), archive_error_string(a.get()));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Create placeholders for the binaries and scripts that the patchers
+ *        add to the output
+ */
+static bool create_data_dir(const std::string &dir, const std::string &arch)
+{
+    std::string arch_dir = dir + "/binaries/android/" + arch;
+
+    if (!make_dirs(arch_dir) || !make_dirs(dir + "/scripts")) {
+        return false;
+    }
+
+    DataGenerator gen(0xda7a);
+    std::string data;
+
+    for (auto const &name : {
+        "mbtool_recovery", "file-contexts-tool", "fsck-wrapper", "mbtool",
+        "mount.exfat", "odinupdater", "fuse-sparse",
+    }) {
+        gen.fill(data, 1024 * 1024);
+        if (!write_file(arch_dir + "/" + name, data)) {
+            return false;
+        }
+
+        gen.fill(data, 512);
+        if (!write_file(arch_dir + "/" + name + ".sig", data)) {
+            return false;
+        }
+    }
+
+    gen.fill(data, 4096);
+    if (!write_file(dir + "/scripts/bb-wrapper.sh", data)) {
+        return false;
+    }
+
+    gen.fill(data, 512);
+    return write_file(dir + "/scripts/bb-wrapper.sh.sig", data);
+}
+
+static device::Device default_device()
+{
+    device::Device device;
+    device.set_id("benchmark");
+    device.set_codenames({"benchmark"});
+    device.set_name("Benchmark device");
+    device.set_architecture(device::ARCH_ARMEABI_V7A);
+    device.set_block_dev_base_dirs({"/dev/block/platform/msm_sdcc.1/by-name"});
+    device.set_system_block_devs({SYSTEM_BLOCK_DEV});
+    device.set_cache_block_devs({CACHE_BLOCK_DEV});
+    device.set_data_block_devs({DATA_BLOCK_DEV});
+    device.set_boot_block_devs({BOOT_BLOCK_DEV});
+    return device;
+}
+
+static bool load_device(const std::string &path, device::Device &device)
+{
+    std::string contents;
+    if (!read_file(path, contents)) {
+        fprintf(stderr, "%s: Failed to read file: %s\n",
+                path.c_str(), strerror(errno));
+        return false;
+    }
+
+    device::JsonError error;
+
+    if (!device::device_from_json(contents, device, error)) {
+        fprintf(stderr, "%s: Failed to load device\n", path.c_str());
+        return false;
+    }
+
+    if (device.validate() != 0) {
+        fprintf(stderr, "%s: Validation failed\n", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Measurements
+
+/*!
+ * \brief Reset the peak RSS counter of this process
+ *
+ * \return Whether VmHWM will only cover what happens after this call
+ */
+static bool reset_peak_rss()
+{
+    FILE *fp = fopen("/proc/self/clear_refs", "we");
+    if (!fp) {
+        return false;
+    }
+
+    bool ok = fputs("5", fp) >= 0;
+    ok = fclose(fp) == 0 && ok;
+    return ok;
+}
+
+/*!
+ * \brief Get the peak RSS of this process in bytes
+ */
+static uint64_t peak_rss()
+{
+    if (FILE *fp = fopen("/proc/self/status", "re")) {
+        char line[256];
+        uint64_t kib = 0;
+        bool found = false;
+
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "VmHWM: %" SCNu64 " kB", &kib) == 1) {
+                found = true;
+                break;
+            }
+        }
+
+        fclose(fp);
+
+        if (found) {
+            return kib * 1024;
+        }
+    }
+
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+    }
+
+    return 0;
+}
+
+static std::optional<uint64_t> file_size(const std::string &path)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return std::nullopt;
+    }
+    return static_cast<uint64_t>(sb.st_size);
+}
+
+static Result run_patcher(PatcherConfig &pc, const device::Device &device,
+                          const Options &opts, const Input &input,
+                          const std::string &output_path)
+{
+    Result result;
+    Clock::duration total{};
+    bool peak_is_exact = true;
+
+    FileInfo fi;
+    fi.set_device(device);
+    fi.set_input_path(input.path);
+    fi.set_output_path(output_path);
+    fi.set_rom_id(opts.rom_id);
+
+    for (unsigned int i = 0; i < opts.iterations; ++i) {
+        unlink(output_path.c_str());
+
+        auto *patcher = pc.create_patcher(input.patcher_id);
+        if (!patcher) {
+            fprintf(stderr, "Invalid patcher ID: %s\n",
+                    input.patcher_id.c_str());
+            result.ok = false;
+            return result;
+        }
+
+        patcher->set_file_info(&fi);
+
+        peak_is_exact = reset_peak_rss() && peak_is_exact;
+
+        auto start = Clock::now();
+        bool ret = patcher->patch_file(nullptr, nullptr, nullptr);
+        total += Clock::now() - start;
+
+        result.peak_rss = std::max(result.peak_rss, peak_rss());
+
+        if (!ret) {
+            fprintf(stderr, "%s: Failed to patch: error %d\n",
+                    input.path.c_str(), static_cast<int>(patcher->error()));
+            pc.destroy_patcher(patcher);
+            result.ok = false;
+            return result;
+        }
+
+        auto phases = patcher->phase_times();
+        if (i == 0) {
+            result.phases = std::move(phases);
+        } else if (phases.size() == result.phases.size()) {
+            for (size_t j = 0; j < phases.size(); ++j) {
+                result.phases[j].second += phases[j].second;
+            }
+        }
+
+        pc.destroy_patcher(patcher);
+    }
+
+    if (!peak_is_exact) {
+        fprintf(stderr, "Warning: Peak RSS could not be reset; "
+                "it includes earlier inputs\n");
+    }
+
+    unlink(output_path.c_str());
+
+    result.seconds =
+            std::chrono::duration<double>(total).count() / opts.iterations;
+    for (auto &phase : result.phases) {
+        phase.second /= opts.iterations;
+    }
+
+    return result;
+}
+
+static void print_result(const Input &input, const Result &result,
+                         uint64_t bytes)
+{
+    auto slash = input.path.rfind('/');
+    auto name = slash == std::string::npos
+            ? input.path : input.path.substr(slash + 1);
+
+    if (!result.ok) {
+        printf("%-28s %-12s %12s\n", name.c_str(), input.patcher_id.c_str(),
+               "FAILED");
+        return;
+    }
+
+    char throughput[32] = "-";
+    if (bytes > 0 && result.seconds > 0) {
+        snprintf(throughput, sizeof(throughput), "%.1fMiB/s",
+                 static_cast<double>(bytes) / (1024.0 * 1024.0)
+                 / result.seconds);
+    }
+
+    printf("%-28s %-12s %10.1fMiB %10.3fs %14s %10.1fMiB\n",
+           name.c_str(), input.patcher_id.c_str(),
+           static_cast<double>(bytes) / (1024.0 * 1024.0), result.seconds,
+           throughput,
+           static_cast<double>(result.peak_rss) / (1024.0 * 1024.0));
+
+    for (auto const &[phase, duration] : result.phases) {
+        double seconds = std::chrono::duration<double>(duration).count();
+
+        printf("    %-24s %10.3fs %6.1f%%\n", phase.c_str(), seconds,
+               result.seconds > 0 ? 100.0 * seconds / result.seconds : 0.0);
+    }
+}
+
+static std::optional<std::string> patcher_for_path(const std::string &path)
+{
+    if (ends_with(path, ".zip")) {
+        return "ZipPatcher";
+    } else if (ends_with(path, ".tar") || ends_with(path, ".tar.md5")) {
+        return "OdinPatcher";
+    }
+    return std::nullopt;
+}
+
+static bool run_benchmarks(const Options &opts, const device::Device &device,
+                           const std::string &workdir,
+                           std::vector<Input> inputs)
+{
+    std::string data_dir = opts.data_dir;
+    if (data_dir.empty()) {
+        data_dir = workdir + "/data";
+        if (!create_data_dir(data_dir, device.architecture())) {
+            return false;
+        }
+    }
+
+    if (opts.synthetic) {
+        std::string zip_path = workdir + "/synthetic-rom.zip";
+        std::string tar_path = workdir + "/synthetic-odin.tar.md5";
+
+        printf("Generating synthetic inputs...\n");
+
+        if (!create_synthetic_zip(zip_path, opts.size)
+                || !create_synthetic_tar(tar_path, opts.size)) {
+            return false;
+        }
+
+        inputs.insert(inputs.begin(), {
+            {zip_path, "ZipPatcher"},
+            {tar_path, "OdinPatcher"},
+        });
+    }
+
+    PatcherConfig pc;
+    pc.set_data_directory(data_dir);
+
+    printf("%-28s %-12s %13s %11s %14s %13s\n",
+           "input", "patcher", "size", "time", "throughput", "peak RSS");
+
+    bool ok = true;
+
+    for (auto const &input : inputs) {
+        auto size = file_size(input.path);
+        if (!size) {
+            fprintf(stderr, "%s: Failed to stat: %s\n",
+                    input.path.c_str(), strerror(errno));
+            ok = false;
+            continue;
+        }
+
+        auto result = run_patcher(pc, device, opts, input,
+                                  workdir + "/output.zip");
+        print_result(input, result, *size);
+        ok = ok && result.ok;
+    }
+
+    return ok;
+}
+
+static void usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: mbpatcher_benchmarks [<option>...] [<input>...]\n"
+            "\n"
+            "Options:\n"
+            "  -s, --size <MiB>       Size of the synthetic inputs\n"
+            "                         (default: 128)\n"
+            "  -n, --iterations <n>   Iterations per input (default: 3)\n"
+            "  -D, --device <file>    Device definition JSON file\n"
+            "                         (default: built-in armeabi-v7a device)\n"
+            "  -d, --data-dir <dir>   Patcher data directory\n"
+            "                         (default: generated placeholders)\n"
+            "  -r, --rom-id <id>      ROM ID to patch for (default: dual)\n"
+            "  -t, --tmpdir <dir>     Directory for temporary files\n"
+            "                         (default: /tmp)\n"
+            "  -S, --no-synthetic     Only benchmark the given inputs\n"
+            "\n"
+            "Inputs ending in .zip are patched with ZipPatcher and inputs\n"
+            "ending in .tar or .tar.md5 are patched with OdinPatcher.\n"
+            "\n"
+            "Times are averages per iteration and throughput is based on the\n"
+            "input size. Peak RSS is the maximum over the iterations.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int opt;
+
+    static const char short_options[] = "s:n:D:d:r:t:Sh";
+
+    static const option long_options[] = {
+        {"size",         required_argument, nullptr, 's'},
+        {"iterations",   required_argument, nullptr, 'n'},
+        {"device",       required_argument, nullptr, 'D'},
+        {"data-dir",     required_argument, nullptr, 'd'},
+        {"rom-id",       required_argument, nullptr, 'r'},
+        {"tmpdir",       required_argument, nullptr, 't'},
+        {"no-synthetic", no_argument,       nullptr, 'S'},
+        {"help",         no_argument,       nullptr, 'h'},
+        {nullptr,        0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 's': {
+            uint64_t mib;
+            if (!str_to_num(optarg, 10, mib) || mib == 0
+                    || mib > UINT32_MAX / (1024 * 1024)) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.size = mib * 1024 * 1024;
+            break;
+        }
+        case 'n':
+            if (!str_to_num(optarg, 10, opts.iterations)
+                    || opts.iterations == 0) {
+                fprintf(stderr, "Invalid iterations: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'D':
+            opts.device_file = optarg;
+            break;
+        case 'd':
+            opts.data_dir = optarg;
+            break;
+        case 'r':
+            opts.rom_id = optarg;
+            break;
+        case 't':
+            opts.tmpdir = optarg;
+            break;
+        case 'S':
+            opts.synthetic = false;
+            break;
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        opts.inputs.emplace_back(argv[i]);
+    }
+
+    if (!opts.synthetic && opts.inputs.empty()) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Input> inputs;
+
+    for (auto const &path : opts.inputs) {
+        auto id = patcher_for_path(path);
+        if (!id) {
+            fprintf(stderr, "%s: Unknown input type\n", path.c_str());
+            return EXIT_FAILURE;
+        }
+        inputs.push_back({path, std::move(*id)});
+    }
+
+    log::set_logger(std::make_shared<QuietLogger>());
+
+    auto device = default_device();
+    if (!opts.device_file.empty() && !load_device(opts.device_file, device)) {
+        return EXIT_FAILURE;
+    }
+
+    std::string tmpl = opts.tmpdir + "/mbpatcher_benchmarks.XXXXXX";
+    if (!mkdtemp(tmpl.data())) {
+        fprintf(stderr, "%s: Failed to create temporary directory: %s\n",
+                tmpl.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+    const std::string &workdir = tmpl;
+
+    bool ok = run_benchmarks(opts, device, workdir, inputs);
+
+    if (auto r = io::delete_recursively(workdir); !r) {
+        fprintf(stderr, "%s: Failed to delete: %s\n",
+                workdir.c_str(), r.error().message().c_str());
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
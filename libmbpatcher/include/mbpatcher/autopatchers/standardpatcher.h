@@ -49,12 +49,15 @@ public:
     std::vector<std::string> existing_files() const override;
 
     bool patch_files(const std::string &directory) override;
+    bool patch_data(FileMap &files) override;
 
-    bool patch_updater(const std::string &directory);
-    bool patch_transfer_list(const std::string &directory);
+    bool patch_updater(std::string &contents);
+    bool patch_transfer_list(std::vector<std::string> &lines);
 
 private:
     const FileInfo &m_info;
+    // Whether block_image_update() can be replaced with update-binary-tool
+    bool m_native_block_image;
 };
 
 }
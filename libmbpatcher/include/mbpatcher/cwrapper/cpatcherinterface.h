@@ -31,6 +31,26 @@ typedef void (*ProgressUpdatedCallback) (uint64_t, uint64_t, void *);
 typedef void (*FilesUpdatedCallback) (uint64_t, uint64_t, void *);
 typedef void (*DetailsUpdatedCallback) (const char *, void *);
 
+typedef struct CProgressOptions
+{
+    /* Minimum time between two callbacks of the same kind */
+    uint32_t min_interval_ms;
+    /* Minimum change in bytes before progress_cb is called again */
+    uint64_t min_bytes_delta;
+    /* Minimum change in files before files_cb is called again */
+    uint64_t min_files_delta;
+} CProgressOptions;
+
+typedef struct CPatcherProgress
+{
+    uint64_t bytes;
+    uint64_t max_bytes;
+    uint64_t files;
+    uint64_t max_files;
+    /* Number of updates published so far */
+    uint64_t generation;
+} CPatcherProgress;
+
 MB_EXPORT /* enum ErrorCode */ int mbpatcher_patcher_error(const CPatcher *patcher);
 MB_EXPORT char * mbpatcher_patcher_id(const CPatcher *patcher);
 MB_EXPORT void mbpatcher_patcher_set_fileinfo(CPatcher *patcher, const CFileInfo *info);
@@ -39,8 +59,21 @@ MB_EXPORT bool mbpatcher_patcher_patch_file(CPatcher *patcher,
                                       FilesUpdatedCallback files_cb,
                                       DetailsUpdatedCallback details_cb,
                                       void *userdata);
+MB_EXPORT bool mbpatcher_patcher_patch_file_coalesced(CPatcher *patcher,
+                                                      const CProgressOptions *options,
+                                                      CProgressState *state,
+                                                      ProgressUpdatedCallback progress_cb,
+                                                      FilesUpdatedCallback files_cb,
+                                                      DetailsUpdatedCallback details_cb,
+                                                      void *userdata);
 MB_EXPORT void mbpatcher_patcher_cancel_patching(CPatcher *patcher);
 
+MB_EXPORT CProgressState * mbpatcher_progress_create(void);
+MB_EXPORT void mbpatcher_progress_destroy(CProgressState *state);
+MB_EXPORT void mbpatcher_progress_get(const CProgressState *state,
+                                      CPatcherProgress *progress);
+MB_EXPORT char * mbpatcher_progress_details(const CProgressState *state);
+
 
 MB_EXPORT /* enum ErrorCode */ int mbpatcher_autopatcher_error(const CAutoPatcher *patcher);
 MB_EXPORT char * mbpatcher_autopatcher_id(const CAutoPatcher *patcher);
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mbcommon/common.h"
+#include "mbpatcher/cwrapper/ctypes.h"
+
+MB_BEGIN_C_DECLS
+
+typedef void (*QueueProgressUpdatedCallback) (size_t, uint64_t, uint64_t, void *);
+typedef void (*QueueFilesUpdatedCallback) (size_t, uint64_t, uint64_t, void *);
+typedef void (*QueueDetailsUpdatedCallback) (size_t, const char *, void *);
+typedef void (*QueueJobFinishedCallback) (size_t, bool, void *);
+
+MB_EXPORT CPatchQueue * mbpatcher_queue_create(CPatcherConfig *pc,
+                                               unsigned int max_threads);
+MB_EXPORT void mbpatcher_queue_destroy(CPatchQueue *queue);
+
+MB_EXPORT size_t mbpatcher_queue_add_job(CPatchQueue *queue,
+                                         const char *patcher_id,
+                                         const CFileInfo *info);
+MB_EXPORT size_t mbpatcher_queue_jobs(const CPatchQueue *queue);
+MB_EXPORT /* enum ErrorCode */ int mbpatcher_queue_job_error(const CPatchQueue *queue,
+                                                             size_t job);
+
+MB_EXPORT bool mbpatcher_queue_run(CPatchQueue *queue,
+                                   QueueProgressUpdatedCallback progress_cb,
+                                   QueueFilesUpdatedCallback files_cb,
+                                   QueueDetailsUpdatedCallback details_cb,
+                                   QueueJobFinishedCallback finished_cb,
+                                   void *userdata);
+MB_EXPORT void mbpatcher_queue_cancel(CPatchQueue *queue);
+
+MB_END_C_DECLS
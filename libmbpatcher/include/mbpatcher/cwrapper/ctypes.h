@@ -29,6 +29,12 @@ typedef struct CFileInfo CFileInfo;
 struct CPatcherConfig;
 typedef struct CPatcherConfig CPatcherConfig;
 
+struct CPatchQueue;
+typedef struct CPatchQueue CPatchQueue;
+
+struct CProgressState;
+typedef struct CProgressState CProgressState;
+
 struct CPatcher;
 typedef struct CPatcher CPatcher;
 struct CAutoPatcher;
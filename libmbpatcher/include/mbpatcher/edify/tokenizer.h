@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <deque>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -50,7 +51,7 @@ MB_EXPORT const std::error_category & edify_error_category();
 class EdifyTokenIf
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "if";
     }
@@ -59,7 +60,7 @@ public:
 class EdifyTokenThen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "then";
     }
@@ -68,7 +69,7 @@ public:
 class EdifyTokenElse
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "else";
     }
@@ -77,7 +78,7 @@ public:
 class EdifyTokenEndif
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "endif";
     }
@@ -86,7 +87,7 @@ public:
 class EdifyTokenAnd
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "&&";
     }
@@ -95,7 +96,7 @@ public:
 class EdifyTokenOr
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "||";
     }
@@ -104,7 +105,7 @@ public:
 class EdifyTokenEquals
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "==";
     }
@@ -113,7 +114,7 @@ public:
 class EdifyTokenNotEquals
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "!=";
     }
@@ -122,7 +123,7 @@ public:
 class EdifyTokenNot
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "!";
     }
@@ -131,7 +132,7 @@ public:
 class EdifyTokenLeftParen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "(";
     }
@@ -140,7 +141,7 @@ public:
 class EdifyTokenRightParen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ")";
     }
@@ -149,7 +150,7 @@ public:
 class EdifyTokenSemicolon
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ";";
     }
@@ -158,7 +159,7 @@ public:
 class EdifyTokenComma
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ",";
     }
@@ -167,7 +168,7 @@ public:
 class EdifyTokenConcat
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "+";
     }
@@ -176,7 +177,7 @@ public:
 class EdifyTokenNewline
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "\n";
     }
@@ -185,7 +186,7 @@ public:
 class EdifyTokenWhitespace
 {
 public:
-    EdifyTokenWhitespace(std::string str) : m_str(std::move(str))
+    EdifyTokenWhitespace(std::string_view str) : m_str(str)
     {
         assert(!m_str.empty());
 
@@ -194,49 +195,65 @@ public:
         }
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
         return m_str;
     }
 
 private:
-    std::string m_str;
+    std::string_view m_str;
 };
 
 class EdifyTokenComment
 {
 public:
-    EdifyTokenComment(std::string str) : m_str(std::move(str))
+    // The comment includes the leading '#' character
+    EdifyTokenComment(std::string_view str) : m_str(str)
     {
+        assert(!m_str.empty() && m_str.front() == '#');
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
-        return '#' + m_str;
+        return m_str;
     }
 
 private:
-    std::string m_str;
+    std::string_view m_str;
+};
+
+class EdifyStringArena
+{
+public:
+    std::string_view add(std::string str);
+
+private:
+    // Elements of a deque are never moved when adding to the end
+    std::deque<std::string> m_strings;
 };
 
 class EdifyTokenString
 {
 public:
-    static oc::result<EdifyTokenString> from_raw(std::string str, bool quoted);
-    static oc::result<EdifyTokenString> from_string(std::string str, bool make_quoted);
+    static oc::result<EdifyTokenString> from_raw(std::string_view str,
+                                                 bool quoted);
+    static oc::result<EdifyTokenString> from_string(std::string_view str,
+                                                    bool make_quoted,
+                                                    EdifyStringArena &arena);
 
-    std::string generate() const;
+    std::string_view generate() const;
 
     oc::result<std::string> unescaped_string() const;
 
-    std::string raw_string() const;
+    std::string_view raw_string() const;
 
     bool quoted() const;
 
     static bool is_valid_unquoted(char c);
 
 protected:
-    std::string m_str;
+    // Includes the quotes if the string is quoted
+    std::string_view m_str;
     bool m_quoted;
 
     EdifyTokenString() = default;
@@ -248,17 +265,18 @@ protected:
 class EdifyTokenUnknown
 {
 public:
-    EdifyTokenUnknown(char c) : m_char(c)
+    EdifyTokenUnknown(std::string_view c) : m_char(c)
     {
+        assert(m_char.size() == 1);
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
-        return std::string(1, m_char);
+        return m_char;
     }
 
 private:
-    char m_char;
+    std::string_view m_char;
 };
 
 using EdifyToken = std::variant<
@@ -291,6 +309,9 @@ public:
     static std::string untokenize(std::vector<EdifyToken>::const_iterator begin,
                                   std::vector<EdifyToken>::const_iterator end);
 
+    static std::vector<std::size_t>
+    matching_parens(const std::vector<EdifyToken> &tokens);
+
     static void dump(const std::vector<EdifyToken> &tokens);
 
 private:
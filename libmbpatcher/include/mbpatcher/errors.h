@@ -51,6 +51,7 @@ enum ErrorCode
     ArchiveReadOpenError = 200,
     ArchiveReadDataError = 201,
     ArchiveReadHeaderError = 202,
+    ArchiveChecksumError = 203,
     ArchiveWriteOpenError = 210,
     ArchiveWriteDataError = 211,
     ArchiveWriteHeaderError = 212,
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "mbcommon/common.h"
@@ -69,7 +70,9 @@ private:
     // Errors
     ErrorCode m_error;
 
-    // Created patchers
+    // Created patchers. Patchers may be created and destroyed from multiple
+    // threads by PatchQueue.
+    std::mutex m_patchers_mutex;
     std::vector<std::unique_ptr<Patcher>> m_patchers;
     std::vector<std::unique_ptr<AutoPatcher>> m_auto_patchers;
 };
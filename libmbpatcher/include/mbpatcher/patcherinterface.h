@@ -19,12 +19,18 @@
 
 #pragma once
 
+#include <chrono>
 #include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "mbcommon/common.h"
 
 #include "mbpatcher/errors.h"
 #include "mbpatcher/fileinfo.h"
+#include "mbpatcher/private/scriptfile.h"
 
 
 namespace mb::patcher
@@ -44,6 +50,8 @@ public:
     using ProgressUpdatedCallback = std::function<void(uint64_t, uint64_t)>;
     using FilesUpdatedCallback = std::function<void(uint64_t, uint64_t)>;
     using DetailsUpdatedCallback = std::function<void(const std::string &)>;
+    using PhaseTimes =
+            std::vector<std::pair<std::string, std::chrono::nanoseconds>>;
 
     virtual ~Patcher() {}
 
@@ -87,6 +95,19 @@ public:
      * useful if the patching operation is being done on a thread.
      */
     virtual void cancel_patching() = 0;
+
+    /*!
+     * \brief Time spent in each phase of the last patch_file() call
+     *
+     * This is meant for benchmarking. Patchers that do not record their phases
+     * return an empty list.
+     *
+     * \return List of (phase name, duration) pairs in the order they ran
+     */
+    virtual PhaseTimes phase_times() const
+    {
+        return {};
+    }
 };
 
 
@@ -103,6 +124,14 @@ public:
 class AutoPatcher
 {
 public:
+    /*!
+     * \brief Contents of files in the zip file, keyed by their paths
+     *
+     * The same map is passed to every AutoPatcher in turn, so each file is
+     * only read and split into lines once and only serialized once.
+     */
+    using FileMap = std::unordered_map<std::string, ScriptFile>;
+
     virtual ~AutoPatcher() {}
 
     /*!
@@ -138,6 +167,14 @@ public:
      * \param directory Directory containing the files to be patched
      */
     virtual bool patch_files(const std::string &directory) = 0;
+
+    /*!
+     * \brief Patch files in memory
+     *
+     * \param files Contents of the files listed by existing_files() that exist
+     *              in the zip file. Patched files are modified in place.
+     */
+    virtual bool patch_data(FileMap &files) = 0;
 };
 
 }
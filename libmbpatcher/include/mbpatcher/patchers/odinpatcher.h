@@ -19,13 +19,17 @@
 
 #pragma once
 
+#include <memory>
 #include <unordered_set>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbdevice/json.h"
+
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/private/phasetimer.h"
 
 #ifdef __ANDROID__
 #  include "mbcommon/file/fd.h"
@@ -38,6 +42,7 @@ namespace mb::patcher
 {
 
 struct ZipCtx;
+class TarMd5Verifier;
 
 class OdinPatcher : public Patcher
 {
@@ -61,6 +66,8 @@ public:
 
     void cancel_patching() override;
 
+    PhaseTimes phase_times() const override;
+
 private:
     PatcherConfig &m_pc;
     const FileInfo *m_info;
@@ -73,7 +80,14 @@ private:
 
     ErrorCode m_error;
 
+    PhaseTimer m_timer;
+
+    // Reused for the device.json of every patched file
+    device::DeviceJsonWriter m_device_json;
+
     unsigned char m_la_buf[10240];
+    // Set while the input is a .tar.md5 file being verified
+    std::unique_ptr<TarMd5Verifier> m_la_md5;
 #ifdef __ANDROID__
     FdFile m_la_file;
     int m_fd;
@@ -96,6 +110,7 @@ private:
     bool process_file(archive *a, archive_entry *entry, bool sparse);
     bool process_contents(archive *a, unsigned int depth,
                           const char *raw_entry_path);
+    bool check_md5(TarMd5Verifier &verifier, const char *name);
     bool open_input_archive();
     bool close_input_archive();
     bool open_output_archive();
@@ -20,16 +20,22 @@
 #pragma once
 
 #include <unordered_set>
+#include <vector>
+
+#include "mbdevice/json.h"
 
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/private/phasetimer.h"
 
 
 namespace mb::patcher
 {
 
+class DataFileCache;
 struct UnzCtx;
 struct ZipCtx;
+enum class ZipOpenMode;
 
 class ZipPatcher : public Patcher
 {
@@ -56,14 +62,21 @@ public:
 
     void cancel_patching() override;
 
+    PhaseTimes phase_times() const override;
+
+    void set_data_file_cache(DataFileCache *cache);
+
     static std::string create_info_prop(const std::string &rom_id);
 
 private:
     PatcherConfig &m_pc;
     const FileInfo *m_info;
+    DataFileCache *m_data_file_cache;
 
     uint64_t m_bytes;
     uint64_t m_max_bytes;
+    // Last value passed to the progress callback
+    uint64_t m_reported_bytes;
     uint64_t m_files;
     uint64_t m_max_files;
 
@@ -71,6 +84,11 @@ private:
 
     ErrorCode m_error;
 
+    PhaseTimer m_timer;
+
+    // Reused for the device.json of every patched file
+    device::DeviceJsonWriter m_device_json;
+
     // Callbacks
     const ProgressUpdatedCallback *m_progress_cb;
     const FilesUpdatedCallback *m_files_cb;
@@ -83,13 +101,15 @@ private:
 
     bool patch_zip();
 
-    bool pass1(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &exclude);
-    bool pass2(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &files);
+    bool copy_untouched_entries(const std::unordered_set<std::string> &exclude,
+                                std::vector<bool> &copied);
+    bool pass1(AutoPatcher::FileMap &ap_files,
+               const std::unordered_set<std::string> &exclude,
+               const std::vector<bool> &copied);
+    bool pass2(AutoPatcher::FileMap &ap_files);
     bool open_input_archive();
     void close_input_archive();
-    bool open_output_archive();
+    bool open_output_archive(ZipOpenMode mode);
     void close_output_archive();
 
     void update_progress(uint64_t bytes, uint64_t max_bytes);
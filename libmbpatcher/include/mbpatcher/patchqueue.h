@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/errors.h"
+#include "mbpatcher/fileinfo.h"
+
+
+namespace mb::patcher
+{
+
+class DataFileCache;
+class Patcher;
+class PatcherConfig;
+
+class MB_EXPORT PatchQueue
+{
+public:
+    using ProgressUpdatedCallback =
+            std::function<void(size_t, uint64_t, uint64_t)>;
+    using FilesUpdatedCallback =
+            std::function<void(size_t, uint64_t, uint64_t)>;
+    using DetailsUpdatedCallback =
+            std::function<void(size_t, const std::string &)>;
+    using JobFinishedCallback = std::function<void(size_t, bool)>;
+
+    PatchQueue(PatcherConfig &pc, unsigned int max_threads = 0);
+    ~PatchQueue();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PatchQueue)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PatchQueue)
+
+    size_t add_job(std::string patcher_id, FileInfo info);
+
+    size_t jobs() const;
+    ErrorCode job_error(size_t job) const;
+
+    bool run(const ProgressUpdatedCallback &progress_cb,
+             const FilesUpdatedCallback &files_cb,
+             const DetailsUpdatedCallback &details_cb,
+             const JobFinishedCallback &finished_cb);
+
+    void cancel();
+
+private:
+    struct Job
+    {
+        std::string patcher_id;
+        FileInfo info;
+        ErrorCode error;
+    };
+
+    PatcherConfig &m_pc;
+    unsigned int m_max_threads;
+
+    std::vector<Job> m_jobs;
+
+    // Guards m_next_job and m_running
+    std::mutex m_mutex;
+    size_t m_next_job;
+    std::vector<Patcher *> m_running;
+    std::atomic_bool m_cancelled;
+
+    // Serializes the callbacks
+    std::mutex m_cb_mutex;
+    const ProgressUpdatedCallback *m_progress_cb;
+    const FilesUpdatedCallback *m_files_cb;
+    const DetailsUpdatedCallback *m_details_cb;
+    const JobFinishedCallback *m_finished_cb;
+
+    void worker(DataFileCache &cache);
+    bool run_job(size_t index, DataFileCache &cache);
+};
+
+}
@@ -24,6 +24,7 @@
 #include "mbcommon/file/standard.h"
 
 #include "mbpatcher/errors.h"
+#include "mbpatcher/patcherinterface.h"
 
 
 namespace mb::patcher
@@ -45,6 +46,9 @@ public:
     static std::string system_temporary_dir();
 
     static std::string create_temporary_dir(const std::string &directory);
+
+    static bool patch_files_in_directory(AutoPatcher &ap,
+                                         const std::string &directory);
 };
 
 }
@@ -21,8 +21,14 @@
 
 #include <functional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include <ctime>
+
+#include "mbcommon/common.h"
+
 #include "mz.h"
 #include "mz_zip.h"
 
@@ -38,6 +44,8 @@ enum class ZipOpenMode
 {
     Read,
     Write,
+    // Add entries to an existing archive
+    Append,
 };
 
 class MinizipUtils
@@ -49,15 +57,53 @@ public:
         uint64_t total_size;
     };
 
+    struct ZipEntry
+    {
+        std::string name;
+        uint64_t compressed_size;
+        uint64_t uncompressed_size;
+        // Position of the entry's header in the central directory
+        int64_t cd_pos;
+    };
+
+    class ZipEntryTable
+    {
+    public:
+        ZipEntryTable() = default;
+
+        MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ZipEntryTable)
+        MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ZipEntryTable)
+
+        const std::vector<ZipEntry> & entries() const;
+
+        const ZipEntry * find(std::string_view name) const;
+
+        ArchiveStats stats(const std::vector<std::string> &ignore) const;
+
+    private:
+        std::vector<ZipEntry> m_entries;
+        // Views of the names in m_entries
+        std::unordered_map<std::string_view, size_t> m_index;
+
+        friend class MinizipUtils;
+    };
+
     static void * ctx_get_zip_handle(ZipCtx *ctx);
 
+    static const ZipEntryTable * ctx_get_entry_table(ZipCtx *ctx);
+
     static ZipCtx * open_zip_file(std::string path, ZipOpenMode mode);
 
     static int close_zip_file(ZipCtx *ctx);
 
-    static ErrorCode archive_stats(const std::string &path,
-                                   ArchiveStats &stats,
-                                   const std::vector<std::string> &ignore);
+    static bool goto_entry(void *handle, const ZipEntry &entry);
+
+    static ErrorCode copy_entries_raw(
+            const ZipEntryTable &table, const std::string &input_path,
+            const std::string &output_path,
+            const std::function<bool(const ZipEntry &entry)> &filter,
+            const std::function<bool(uint64_t bytes)> &cb,
+            std::vector<bool> &copied);
 
     static bool copy_file_raw(void *source_handle,
                               void *target_handle,
@@ -72,7 +118,8 @@ public:
 
     static ErrorCode add_file_from_data(void *handle,
                                         const std::string &name,
-                                        const std::string &data);
+                                        std::string_view data,
+                                        time_t modified_date = 0);
 
     static ErrorCode add_file_from_path(void *handle,
                                         const std::string &name,
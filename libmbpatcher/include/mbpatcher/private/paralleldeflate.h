@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+
+namespace mb::patcher
+{
+
+class ParallelDeflater
+{
+public:
+    using WriteFn = std::function<bool(const void *data, size_t size)>;
+
+    ParallelDeflater(WriteFn write_fn, unsigned int threads = 0,
+                     int level = -1);
+    ~ParallelDeflater();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelDeflater)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelDeflater)
+
+    bool write(const void *data, size_t size);
+    bool finish();
+
+    uint32_t crc() const;
+    uint64_t size() const;
+
+private:
+    struct Job
+    {
+        std::string dict;
+        std::string input;
+        bool last;
+        bool taken;
+        bool done;
+        bool ok;
+        std::string output;
+        uint32_t crc;
+    };
+
+    WriteFn m_write_fn;
+    int m_level;
+
+    std::mutex m_mutex;
+    // Signalled when a job is queued or finished or when stopping
+    std::condition_variable m_cv;
+    // Jobs in submission order
+    std::deque<Job> m_jobs;
+    size_t m_max_jobs;
+    bool m_stop;
+    std::vector<std::thread> m_threads;
+
+    // Only accessed by the producer thread
+    bool m_finished;
+    std::string m_pending;
+    std::string m_dict;
+    uint32_t m_crc;
+    uint64_t m_size;
+
+    bool submit(std::string input, bool last);
+    bool drain(bool all);
+    void worker();
+};
+
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <chrono>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/patcherinterface.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \brief Records the time spent in consecutive phases of a patcher
+ *
+ * Each call to end_phase() records the time elapsed since the last phase ended
+ * (or since start() was called).
+ */
+class PhaseTimer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    PhaseTimer() : m_start(Clock::now())
+    {
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PhaseTimer)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PhaseTimer)
+
+    void start()
+    {
+        m_times.clear();
+        m_start = Clock::now();
+    }
+
+    void end_phase(const char *name)
+    {
+        auto now = Clock::now();
+        m_times.emplace_back(name, now - m_start);
+        m_start = now;
+    }
+
+    const Patcher::PhaseTimes & times() const
+    {
+        return m_times;
+    }
+
+private:
+    Patcher::PhaseTimes m_times;
+    Clock::time_point m_start;
+};
+
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/patcherinterface.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \brief Progress values that can be polled from another thread
+ *
+ * There is a single writer (the patching thread). The numeric values are
+ * published with a sequence lock, so readers never block the writer and always
+ * see a consistent snapshot. The details text is protected by a mutex because
+ * it is expected to be polled much less often than it is updated.
+ */
+class ProgressState
+{
+public:
+    struct Snapshot
+    {
+        uint64_t bytes;
+        uint64_t max_bytes;
+        uint64_t files;
+        uint64_t max_files;
+        //! Number of updates published so far
+        uint64_t generation;
+    };
+
+    ProgressState();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProgressState)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProgressState)
+
+    void set_progress(uint64_t bytes, uint64_t max_bytes);
+    void set_files(uint64_t files, uint64_t max_files);
+    void set_details(const std::string &text);
+
+    Snapshot snapshot() const;
+    std::string details() const;
+
+private:
+    void begin_write();
+    void end_write();
+
+    std::atomic<uint64_t> m_seq;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_max_bytes;
+    std::atomic<uint64_t> m_files;
+    std::atomic<uint64_t> m_max_files;
+
+    mutable std::mutex m_details_lock;
+    std::string m_details;
+};
+
+/*!
+ * \brief Rate limit the progress callbacks of a Patcher
+ *
+ * A progress or files update is forwarded only if at least \a min_interval has
+ * passed since the previous update of the same kind and the value changed by
+ * at least the corresponding minimum delta. Updates that change the maximum
+ * value or reach it are always forwarded. Details are forwarded at most once
+ * per interval. flush() delivers the latest values that were held back.
+ *
+ * This class is not thread safe. All functions must be called from the
+ * patching thread.
+ */
+class ProgressCoalescer
+{
+public:
+    struct Options
+    {
+        std::chrono::milliseconds min_interval;
+        uint64_t min_bytes_delta;
+        uint64_t min_files_delta;
+    };
+
+    ProgressCoalescer(const Options &options,
+                      Patcher::ProgressUpdatedCallback progress_cb,
+                      Patcher::FilesUpdatedCallback files_cb,
+                      Patcher::DetailsUpdatedCallback details_cb);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProgressCoalescer)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProgressCoalescer)
+
+    void update_progress(uint64_t bytes, uint64_t max_bytes);
+    void update_files(uint64_t files, uint64_t max_files);
+    void update_details(const std::string &text);
+
+    void flush();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Channel
+    {
+        uint64_t value;
+        uint64_t max_value;
+        bool pending;
+        bool reported;
+        uint64_t reported_value;
+        uint64_t reported_max_value;
+        Clock::time_point reported_time;
+    };
+
+    bool should_report(const Channel &channel, uint64_t min_delta,
+                       Clock::time_point now) const;
+
+    Options m_options;
+    Patcher::ProgressUpdatedCallback m_progress_cb;
+    Patcher::FilesUpdatedCallback m_files_cb;
+    Patcher::DetailsUpdatedCallback m_details_cb;
+
+    Channel m_progress;
+    Channel m_files;
+
+    std::string m_details;
+    bool m_details_pending;
+    bool m_details_reported;
+    Clock::time_point m_details_time;
+};
+
+}
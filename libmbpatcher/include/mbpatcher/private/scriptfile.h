@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace mb::patcher
+{
+
+class ScriptFile
+{
+public:
+    ScriptFile();
+    explicit ScriptFile(std::string contents);
+
+    std::string & text();
+    std::vector<std::string> & lines();
+
+    bool starts_with(std::string_view prefix) const;
+
+private:
+    //! Whether the contents are currently stored in \a m_lines
+    bool m_split;
+    std::string m_text;
+    std::vector<std::string> m_lines;
+};
+
+}
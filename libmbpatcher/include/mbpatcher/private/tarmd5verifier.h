@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <cstddef>
+
+#include <openssl/md5.h>
+
+#include "mbcommon/common.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \brief Verify the MD5 trailer of a Samsung `.tar.md5` file while streaming
+ *
+ * The data is hashed on a separate thread. The reader gets its buffers from
+ * next_buffer() and passes each filled buffer to submit(). Because there are
+ * two buffers, hashing one buffer overlaps with reading into the other.
+ *
+ * The last few KiB of the stream are held back from the hash until finish()
+ * is called. finish() then finds the `<md5>  <filename>` trailer line and
+ * compares the digest of everything before it.
+ */
+class TarMd5Verifier
+{
+public:
+    enum class Result
+    {
+        Match,
+        Mismatch,
+        NoChecksum,
+    };
+
+    TarMd5Verifier();
+    ~TarMd5Verifier();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TarMd5Verifier)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TarMd5Verifier)
+
+    unsigned char * next_buffer();
+    size_t buffer_size() const;
+    void submit(const unsigned char *buf, size_t size);
+
+    Result finish();
+
+    const std::string & expected() const;
+    const std::string & actual() const;
+
+private:
+    struct Block
+    {
+        size_t index;
+        size_t size;
+    };
+
+    std::array<std::unique_ptr<unsigned char[]>, 2> m_bufs;
+    std::array<bool, 2> m_busy;
+    size_t m_next;
+
+    std::mutex m_mutex;
+    // Signalled when a block is queued or hashed or when stopping
+    std::condition_variable m_cv;
+    std::deque<Block> m_queue;
+    bool m_stop;
+    std::thread m_thread;
+
+    // Only accessed by the hashing thread until it exits
+    MD5_CTX m_ctx;
+    std::string m_tail;
+
+    std::string m_expected;
+    std::string m_actual;
+
+    void hash(const unsigned char *data, size_t size);
+    void worker();
+};
+
+}
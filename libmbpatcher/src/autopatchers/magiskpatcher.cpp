@@ -78,28 +78,17 @@ static void replace_all(std::string &source, std::string_view from,
     }
 }
 
-static bool patch_file(const std::string &path, bool is_updater)
+static void patch_line(std::string &line)
 {
-    std::string contents;
-
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
-    }
-
-    if (is_updater && !starts_with(contents, "#MAGISK")) {
-        return true;
-    }
-
-    replace_all(contents, "mount /data", "/update-binary-tool mount /data");
-    replace_all(contents, "mount /cache", "/update-binary-tool mount /cache");
-    replace_all(contents, "mount -o ro /system", "/update-binary-tool mount /system");
+    replace_all(line, "mount /data", "/update-binary-tool mount /data");
+    replace_all(line, "mount /cache", "/update-binary-tool mount /cache");
+    replace_all(line, "mount -o ro /system", "/update-binary-tool mount /system");
 
     // Not a dual boot bug, but the installer uses a Java program to determine
     // if a boot image is signed and that program fails to run properly on
     // certain devices. /system/bin/dalvikvm would always exit with status 0,
     // but nothing would be executed.
-    replace_all(contents, "BOOTSIGNED=true", "BOOTSIGNED=false");
+    replace_all(line, "BOOTSIGNED=true", "BOOTSIGNED=false");
 
     // Also not a dual boot bug, but on AOSP-style custom ROMs, Magisk installs
     // an addon.d script to repatch the boot image during the installation.
@@ -107,20 +96,34 @@ static bool patch_file(const std::string &path, bool is_updater)
     // flashed, the script forks a background process and waits 5 seconds before
     // continuing. This race condition leads to a corrupted boot image on
     // devices with slow internal storage like the Galaxy S4.
-    replace_all(contents, "sleep 5", "sleep 10");
-
-    FileUtils::write_from_string(path, contents);
-
-    return true;
+    replace_all(line, "sleep 5", "sleep 10");
 }
 
 bool MagiskPatcher::patch_files(const std::string &directory)
 {
-    patch_file(directory + "/" + StandardPatcher::UpdaterScript, true);
-    patch_file(directory + "/" + AddonDScript, false);
-    patch_file(directory + "/" + UtilFunctions, false);
+    return FileUtils::patch_files_in_directory(*this, directory);
+}
+
+bool MagiskPatcher::patch_data(FileMap &files)
+{
+    for (auto const &name : existing_files()) {
+        auto it = files.find(name);
+        if (it == files.end()) {
+            continue;
+        }
+
+        // The updater-script is only a shell script for Magisk's installer
+        if (name == StandardPatcher::UpdaterScript
+                && !it->second.starts_with("#MAGISK")) {
+            continue;
+        }
+
+        // None of the patterns span multiple lines
+        for (auto &line : it->second.lines()) {
+            patch_line(line);
+        }
+    }
 
-    // Don't fail if an error occurs
     return true;
 }
 
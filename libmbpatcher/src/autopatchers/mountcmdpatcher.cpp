@@ -72,17 +72,8 @@ static bool space_or_end(const char *ptr)
     return !*ptr || isspace(*ptr);
 }
 
-static bool patch_file(const std::string &path)
+static void patch_lines(std::vector<std::string> &lines)
 {
-    std::string contents;
-
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
-    }
-
-    auto lines = split(contents, '\n');
-
     for (auto &line : lines) {
         const char *ptr = line.data();
 
@@ -94,19 +85,21 @@ static bool patch_file(const std::string &path)
             line.insert(static_cast<size_t>(ptr - line.data()), "/sbin/");
         }
     }
-
-    contents = join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
-
-    return true;
 }
 
 bool MountCmdPatcher::patch_files(const std::string &directory)
 {
-    patch_file(directory + "/" + FlashScript);
-    patch_file(directory + "/" + InstallerScript);
+    return FileUtils::patch_files_in_directory(*this, directory);
+}
+
+bool MountCmdPatcher::patch_data(FileMap &files)
+{
+    for (auto const &name : existing_files()) {
+        if (auto it = files.find(name); it != files.end()) {
+            patch_lines(it->second.lines());
+        }
+    }
 
-    // Don't fail if an error occurs
     return true;
 }
 
@@ -19,10 +19,13 @@
 
 #include "mbpatcher/autopatchers/standardpatcher.h"
 
+#include <algorithm>
 #include <optional>
+#include <string_view>
 
 #include <cstring>
 
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 
@@ -52,10 +55,14 @@ static constexpr char UNMOUNT_FMT[] =
         "(run_program(\"/update-binary-tool\", \"unmount\", \"%s\") == 0)";
 static constexpr char FORMAT_FMT[] =
         "(run_program(\"/update-binary-tool\", \"format\", \"%s\") == 0)";
+static constexpr char BLOCK_IMAGE_UPDATE_FMT[] =
+        "(run_program(\"/update-binary-tool\", \"block-image-update\", "
+        "\"%s\", \"%s\", \"%s\") == 0)";
 
 
 StandardPatcher::StandardPatcher(const PatcherConfig &pc, const FileInfo &info)
     : m_info(info)
+    , m_native_block_image(false)
 {
     (void) pc;
 }
@@ -82,11 +89,11 @@ std::vector<std::string> StandardPatcher::existing_files() const
     return { UpdaterScript, SystemTransferList };
 }
 
-static bool find_items_in_string(const std::string &haystack,
+static bool find_items_in_string(std::string_view haystack,
                                  const std::vector<std::string> &needles)
 {
     for (auto const &needle : needles) {
-        if (haystack.find(needle) != std::string::npos) {
+        if (haystack.find(needle) != std::string_view::npos) {
             return true;
         }
     }
@@ -94,41 +101,49 @@ static bool find_items_in_string(const std::string &haystack,
     return false;
 }
 
-using TokenIter = std::vector<EdifyToken>::iterator;
-
 struct FunctionBounds
 {
-    TokenIter func_name;
-    TokenIter left_paren;
-    TokenIter right_paren;
+    std::size_t func_name;
+    std::size_t left_paren;
+    std::size_t right_paren;
 };
 
+/*!
+ * \brief Find the next function call
+ *
+ * \param tokens List of edify tokens
+ * \param parens Matching parentheses from EdifyTokenizer::matching_parens()
+ * \param begin Index of the first token to search
+ *
+ * \return Bounds of the function call or nothing if there are no more function
+ *         calls or if a function call is missing its right parenthesis
+ */
 static std::optional<FunctionBounds>
-find_function(const TokenIter begin, const TokenIter end)
+find_function(const std::vector<EdifyToken> &tokens,
+              const std::vector<std::size_t> &parens, std::size_t begin)
 {
     FunctionBounds bounds;
 
-    for (auto it = begin; it != end; ++it) {
+    for (auto i = begin; i < tokens.size(); ++i) {
         // Find string representing the function name
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+        if (!std::holds_alternative<EdifyTokenString>(tokens[i])) {
             continue;
         }
 
-        bounds.func_name = it;
+        bounds.func_name = i;
 
         bool found_left_paren = false;
-        bool found_right_paren = false;
 
         // Barring any whitespace, newlines, or comments, the function name
         // should be followed by a left parenthesis
-        for (auto it2 = it + 1; it2 != end; ++it2) {
-            if (std::holds_alternative<EdifyTokenWhitespace>(*it2)
-                    || std::holds_alternative<EdifyTokenNewline>(*it2)
-                    || std::holds_alternative<EdifyTokenComment>(*it2)) {
+        for (auto j = i + 1; j < tokens.size(); ++j) {
+            if (std::holds_alternative<EdifyTokenWhitespace>(tokens[j])
+                    || std::holds_alternative<EdifyTokenNewline>(tokens[j])
+                    || std::holds_alternative<EdifyTokenComment>(tokens[j])) {
                 continue;
-            } else if (std::holds_alternative<EdifyTokenLeftParen>(*it2)) {
+            } else if (std::holds_alternative<EdifyTokenLeftParen>(tokens[j])) {
                 found_left_paren = true;
-                bounds.left_paren = it2;
+                bounds.left_paren = j;
             }
             break;
         }
@@ -139,26 +154,12 @@ find_function(const TokenIter begin, const TokenIter end)
             continue;
         }
 
-        // Left for matching right parenthesis
-        std::size_t depth = 0;
-
-        for (auto it2 = bounds.left_paren; it2 != end; ++it2) {
-            if (std::holds_alternative<EdifyTokenLeftParen>(*it2)) {
-                ++depth;
-            } else if (std::holds_alternative<EdifyTokenRightParen>(*it2)) {
-                --depth;
-            }
-            if (depth == 0) {
-                found_right_paren = true;
-                bounds.right_paren = it2;
-                break;
-            }
-        }
+        bounds.right_paren = parens[bounds.left_paren];
 
         // If a right parenthesis was not found, but the function name and left
         // parenthesis were found, then assume there's a syntax error and bail
         // out
-        if (!found_right_paren) {
+        if (bounds.right_paren == std::string::npos) {
             return {};
         }
 
@@ -169,160 +170,90 @@ find_function(const TokenIter begin, const TokenIter end)
 }
 
 /*!
- * \brief Replace edify function
- *
- * \param tokens List of edify tokens
- * \param bounds Iterator bounds of the function to replace
- * \param replacement Replacement edify function (in string form)
+ * \brief Get the type of partition that a string refers to
  *
- * \return New iterator pointing to position *after* the right parenthesis of
- *         the replaced function. Returns tokens.end() if the replacement
- *         string could not be tokenized.
+ * \return "/system", "/cache", "/data", or nullptr if the string does not refer
+ *         to any of those partitions
  */
-static TokenIter
-replace_function(std::vector<EdifyToken> &tokens,
-                 const FunctionBounds &bounds, const std::string &replacement)
+static const char * find_partition(std::string_view str,
+                                   const std::vector<std::string> &system_devs,
+                                   const std::vector<std::string> &cache_devs,
+                                   const std::vector<std::string> &data_devs)
 {
-    auto ret = EdifyTokenizer::tokenize(replacement);
-    if (!ret) {
-        LOGE("Failed to tokenize replacement function string: %s: %s",
-             replacement.c_str(), ret.error().message().c_str());
-        return tokens.end();
+    if (str.find("/system") != std::string_view::npos
+            || find_items_in_string(str, system_devs)) {
+        return "/system";
+    } else if (str.find("/cache") != std::string_view::npos
+            || find_items_in_string(str, cache_devs)) {
+        return "/cache";
+    } else if (str.find("/data") != std::string_view::npos
+            || str.find("/userdata") != std::string_view::npos
+            || find_items_in_string(str, data_devs)) {
+        return "/data";
     }
-    auto &rtokens = ret.value();
-
-    // Remove replaced tokens
-    auto it = tokens.erase(bounds.func_name, bounds.right_paren + 1);
-
-    // Add replacement tokens
-    it = tokens.insert(it, rtokens.begin(), rtokens.end());
-
-    // Move iterator to the end of the replaced tokens
-    it += static_cast<ptrdiff_t>(rtokens.size());
 
-    return it;
+    return nullptr;
 }
 
 /*!
- * \brief Replace edify mount() command
+ * \brief Replace edify function that takes a partition as an argument
  *
- * \param tokens List of edify tokens
- * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
- *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
- */
-static TokenIter
-replace_edify_mount(std::vector<EdifyToken> &tokens,
-                    const FunctionBounds &bounds,
-                    const std::vector<std::string> &system_devs,
-                    const std::vector<std::string> &cache_devs,
-                    const std::vector<std::string> &data_devs)
-{
-    // For the mount() edify function, replace with the corresponding
-    // update-binary-tool command
-    for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
-            continue;
-        }
-
-        auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
-
-        bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
-        bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
-        bool is_data = str.find("/data") != std::string::npos
-                || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
-
-        if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/data"));
-        }
-    }
-    return bounds.right_paren + 1;
-}
-
-/*!
- * \brief Replace edify unmount() command
+ * This is used for mount(), unmount(), and format(), which are replaced with
+ * the corresponding update-binary-tool command.
  *
  * \param tokens List of edify tokens
- * \param bounds Iterator bounds of the function to replace
+ * \param bounds Bounds of the function to replace
+ * \param fmt Format string for the replacement command
  * \param system_devs List of system partition block devices
  * \param cache_devs List of cache partition block devices
  * \param data_devs List of data partition block devices
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Replacement for the function or nothing if the function should not
+ *         be replaced
  */
-static TokenIter
-replace_edify_unmount(std::vector<EdifyToken> &tokens,
-                      const FunctionBounds &bounds,
-                      const std::vector<std::string> &system_devs,
-                      const std::vector<std::string> &cache_devs,
-                      const std::vector<std::string> &data_devs)
+static std::optional<std::string>
+replace_edify_partition_function(const std::vector<EdifyToken> &tokens,
+                                 const FunctionBounds &bounds, const char *fmt,
+                                 const std::vector<std::string> &system_devs,
+                                 const std::vector<std::string> &cache_devs,
+                                 const std::vector<std::string> &data_devs)
 {
-    // For the unmount() edify function, replace with the corresponding
-    // update-binary-tool command
-    for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+    for (auto i = bounds.left_paren + 1; i != bounds.right_paren; ++i) {
+        if (!std::holds_alternative<EdifyTokenString>(tokens[i])) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
-
-        bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
-        bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
-        bool is_data = str.find("/data") != std::string::npos
-                || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
-
-        if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/data"));
+        auto const &token = std::get<EdifyTokenString>(tokens[i]);
+
+        if (auto *partition = find_partition(token.raw_string(), system_devs,
+                                             cache_devs, data_devs)) {
+            return format(fmt, partition);
         }
     }
-    return bounds.right_paren + 1;
+
+    return {};
 }
 
 /*!
  * \brief Replace edify run_program() command
  *
- * \param tokens List of edify tokens
- * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param[in] tokens List of edify tokens
+ * \param[in] bounds Bounds of the function to replace
+ * \param[in] system_devs List of system partition block devices
+ * \param[in] cache_devs List of cache partition block devices
+ * \param[in] data_devs List of data partition block devices
+ * \param[out] replacement Replacement for the function or nothing if the
+ *                         function should not be replaced
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the arguments could be parsed
  */
-static TokenIter
-replace_edify_run_program(std::vector<EdifyToken> &tokens,
+static bool
+replace_edify_run_program(const std::vector<EdifyToken> &tokens,
                           const FunctionBounds &bounds,
                           const std::vector<std::string> &system_devs,
                           const std::vector<std::string> &cache_devs,
-                          const std::vector<std::string> &data_devs)
+                          const std::vector<std::string> &data_devs,
+                          std::optional<std::string> &replacement)
 {
     bool found_reboot = false;
     bool found_mount = false;
@@ -333,17 +264,19 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
     bool is_cache = false;
     bool is_data = false;
 
-    for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+    for (auto i = bounds.left_paren + 1; i != bounds.right_paren; ++i) {
+        if (!std::holds_alternative<EdifyTokenString>(tokens[i])) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
+        auto const &token = std::get<EdifyTokenString>(tokens[i]);
         auto ret = token.unescaped_string();
         if (!ret) {
-            LOGE("Failed to unescape string token: %s: %s",
-                 token.raw_string().c_str(), ret.error().message().c_str());
-            return tokens.end();
+            auto raw = token.raw_string();
+            LOGE("Failed to unescape string token: %.*s: %s",
+                 static_cast<int>(raw.size()), raw.data(),
+                 ret.error().message().c_str());
+            return false;
         }
         auto const &unescaped = ret.value();
 
@@ -364,177 +297,232 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
         }
 
         if (unescaped.find("/system") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), system_devs)) {
+                || find_items_in_string(unescaped, system_devs)) {
             is_system = true;
         }
         if (unescaped.find("/cache") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), cache_devs)) {
+                || find_items_in_string(unescaped, cache_devs)) {
             is_cache = true;
         }
         if (unescaped.find("/data") != std::string::npos
                 || unescaped.find("/userdata") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), data_devs)) {
+                || find_items_in_string(unescaped, data_devs)) {
             is_data = true;
         }
     }
 
+    const char *partition = is_system ? "/system"
+            : is_cache ? "/cache"
+            : is_data ? "/data"
+            : nullptr;
+
+    replacement = {};
+
     if (found_reboot) {
-        return replace_function(tokens, bounds,
-                                "(ui_print(\"Removed reboot command\") == 0)");
+        replacement = "(ui_print(\"Removed reboot command\") == 0)";
     } else if (found_umount) {
-        if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/data"));
+        if (partition) {
+            replacement = format(UNMOUNT_FMT, partition);
         }
     } else if (found_mount) {
-        if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/data"));
+        if (partition) {
+            replacement = format(MOUNT_FMT, partition);
         }
     } else if (found_format_sh) {
-        return replace_function(tokens, bounds,
-                                format(FORMAT_FMT, "/system"));
+        replacement = format(FORMAT_FMT, "/system");
     } else if (found_mke2fs) {
-        if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/data"));
+        if (partition) {
+            replacement = format(FORMAT_FMT, partition);
         }
     }
 
-    return bounds.right_paren + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify delete_recursive() command
  *
- * \param tokens List of edify tokens
- * \param bounds Iterator bounds of the function to replace
+ * \param[in] tokens List of edify tokens
+ * \param[in] bounds Bounds of the function to replace
+ * \param[out] replacement Replacement for the function or nothing if the
+ *                         function should not be replaced
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the arguments could be parsed
  */
-static TokenIter
-replace_edify_delete_recursive(std::vector<EdifyToken> &tokens,
-                               const FunctionBounds &bounds)
+static bool
+replace_edify_delete_recursive(const std::vector<EdifyToken> &tokens,
+                               const FunctionBounds &bounds,
+                               std::optional<std::string> &replacement)
 {
-    for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+    replacement = {};
+
+    for (auto i = bounds.left_paren + 1; i != bounds.right_paren; ++i) {
+        if (!std::holds_alternative<EdifyTokenString>(tokens[i])) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
+        auto const &token = std::get<EdifyTokenString>(tokens[i]);
         auto ret = token.unescaped_string();
         if (!ret) {
-            LOGE("Failed to unescape string token: %s: %s",
-                 token.raw_string().c_str(), ret.error().message().c_str());
-            return tokens.end();
+            auto raw = token.raw_string();
+            LOGE("Failed to unescape string token: %.*s: %s",
+                 static_cast<int>(raw.size()), raw.data(),
+                 ret.error().message().c_str());
+            return false;
         }
         auto const &unescaped = ret.value();
 
         if (unescaped == "/system" || unescaped == "/system/") {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/system"));
+            replacement = format(FORMAT_FMT, "/system");
+            break;
         } else if (unescaped == "/cache" || unescaped == "/cache/") {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/cache"));
+            replacement = format(FORMAT_FMT, "/cache");
+            break;
         }
     }
-    return bounds.right_paren + 1;
+
+    return true;
 }
 
 /*!
- * \brief Replace edify format() command
+ * \brief Check if a transfer list is for a full OTA
  *
- * \param tokens List of edify tokens
- * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * mbtool can only apply transfer lists that do not depend on the existing
+ * contents of the partition, which are the ones that only contain erase, zero,
+ * and new commands.
+ */
+static bool is_full_transfer_list(const std::vector<std::string> &lines)
+{
+    if (lines.size() < 2) {
+        return false;
+    }
+
+    unsigned int version;
+    if (!str_to_num(lines[0].c_str(), 10, version)
+            || version < 1 || version > 4) {
+        return false;
+    }
+
+    // Version 2 and newer have two more lines for the stash limits
+    std::size_t first_command = version >= 2 ? 4 : 2;
+    if (lines.size() < first_command) {
+        return false;
+    }
+
+    for (auto i = first_command; i < lines.size(); ++i) {
+        auto const &line = lines[i];
+
+        if (!line.empty() && !starts_with(line, "erase ")
+                && !starts_with(line, "zero ")
+                && !starts_with(line, "new ")) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Replace edify block_image_update() command
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * The call is only replaced if it writes the uncompressed new data for
+ * SystemTransferList to the system partition.
+ *
+ * \param[in] tokens List of edify tokens
+ * \param[in] bounds Bounds of the function to replace
+ * \param[in] system_devs List of system partition block devices
+ * \param[out] replacement Replacement for the function or nothing if the
+ *                         function should not be replaced
+ *
+ * \return Whether the arguments could be parsed
  */
-static TokenIter
-replace_edify_format(std::vector<EdifyToken> &tokens,
-                     const FunctionBounds &bounds,
-                     const std::vector<std::string> &system_devs,
-                     const std::vector<std::string> &cache_devs,
-                     const std::vector<std::string> &data_devs)
+static bool
+replace_edify_block_image_update(const std::vector<EdifyToken> &tokens,
+                                 const FunctionBounds &bounds,
+                                 const std::vector<std::string> &system_devs,
+                                 std::optional<std::string> &replacement)
 {
-    // For the format() edify function, replace with the corresponding
-    // update-binary-tool command
-    for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
+    bool first = true;
+    bool is_system = false;
+    std::string transfer_list;
+    std::string new_data;
+
+    replacement = {};
+
+    for (auto i = bounds.left_paren + 1; i != bounds.right_paren; ++i) {
+        if (!std::holds_alternative<EdifyTokenString>(tokens[i])) {
             continue;
         }
 
-        auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
-
-        bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
-        bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
-        bool is_data = str.find("/data") != std::string::npos
-                || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
-
-        if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/system"));
-        } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/cache"));
-        } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/data"));
+        auto const &token = std::get<EdifyTokenString>(tokens[i]);
+        auto ret = token.unescaped_string();
+        if (!ret) {
+            auto raw = token.raw_string();
+            LOGE("Failed to unescape string token: %.*s: %s",
+                 static_cast<int>(raw.size()), raw.data(),
+                 ret.error().message().c_str());
+            return false;
+        }
+        auto const &unescaped = ret.value();
+
+        // The first argument is the block device
+        if (first) {
+            is_system = unescaped.find("/system") != std::string::npos
+                    || find_items_in_string(unescaped, system_devs);
+            first = false;
+        } else if (unescaped == StandardPatcher::SystemTransferList) {
+            transfer_list = unescaped;
+        } else if (ends_with(unescaped, ".new.dat")
+                && unescaped.find_first_of("\"\\") == std::string::npos) {
+            new_data = unescaped;
         }
     }
-    return bounds.right_paren + 1;
+
+    // Brotli-compressed new data is left to the ROM's updater
+    if (is_system && !transfer_list.empty() && !new_data.empty()) {
+        replacement = format(BLOCK_IMAGE_UPDATE_FMT, "/system",
+                             transfer_list.c_str(), new_data.c_str());
+    }
+
+    return true;
+}
+
+static void append_tokens(std::string &output,
+                          const std::vector<EdifyToken> &tokens,
+                          std::size_t begin, std::size_t end)
+{
+    for (auto i = begin; i < end; ++i) {
+        output += std::visit([](auto &&t) -> std::string_view {
+            return t.generate();
+        }, tokens[i]);
+    }
 }
 
 bool StandardPatcher::patch_files(const std::string &directory)
 {
-    if (!patch_updater(directory)) {
+    return FileUtils::patch_files_in_directory(*this, directory);
+}
+
+bool StandardPatcher::patch_data(FileMap &files)
+{
+    auto tl = files.find(SystemTransferList);
+    m_native_block_image = tl != files.end()
+            && is_full_transfer_list(tl->second.lines());
+
+    if (auto it = files.find(UpdaterScript); it != files.end()
+            && !patch_updater(it->second.text())) {
         return false;
     }
 
-    if (!patch_transfer_list(directory)) {
+    if (tl != files.end() && !patch_transfer_list(tl->second.lines())) {
         return false;
     }
 
     return true;
 }
 
-bool StandardPatcher::patch_updater(const std::string &directory)
+bool StandardPatcher::patch_updater(std::string &contents)
 {
-    std::string contents;
-    std::string path;
-
-    path += directory;
-    path += "/";
-    path += UpdaterScript;
-
-    FileUtils::read_to_string(path, &contents);
-
     if (starts_with(contents, "#!")) {
         // Ignore any script with a shebang line
         return true;
@@ -557,90 +545,107 @@ bool StandardPatcher::patch_updater(const std::string &directory)
     auto cache_devs = device.cache_block_devs();
     auto data_devs = device.data_block_devs();
 
-    TokenIter begin = tokens.begin();
-    TokenIter end;
+    // The script is patched in a single pass. Tokens are copied to the output
+    // until a function call that needs to be replaced is found, in which case
+    // its replacement is written instead and the pass continues after the
+    // call's right parenthesis.
+    auto parens = EdifyTokenizer::matching_parens(tokens);
 
-    while (true) {
-        end = tokens.end();
+    std::string output;
+    output.reserve(contents.size());
 
+    std::size_t begin = 0;
+
+    while (true) {
         // Need to find:
         // 1. String containing function name
         // 2. Left parenthesis for the function
         // 3. Right parenthesis for the function
-        auto bounds = find_function(begin, end);
+        auto bounds = find_function(tokens, parens, begin);
         if (!bounds) {
             break;
         }
 
-        // Tokens (types are checked by findFunction())
-        auto const &t_func_name = std::get<EdifyTokenString>(*bounds->func_name);
+        append_tokens(output, tokens, begin, bounds->func_name);
+
+        // Tokens (types are checked by find_function())
+        auto const &t_func_name = std::get<EdifyTokenString>(
+                tokens[bounds->func_name]);
         auto unescaped = t_func_name.unescaped_string();
         if (!unescaped) {
-            LOGE("Failed to unescape string token: %s: %s",
-                 t_func_name.raw_string().c_str(),
+            auto raw = t_func_name.raw_string();
+            LOGE("Failed to unescape string token: %.*s: %s",
+                 static_cast<int>(raw.size()), raw.data(),
                  unescaped.error().message().c_str());
             return false;
         }
 
-        if (unescaped.value() == "mount") {
-            begin = replace_edify_mount(tokens, *bounds,
-                                        system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "unmount") {
-            begin = replace_edify_unmount(tokens, *bounds,
-                                          system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "run_program") {
-            begin = replace_edify_run_program(tokens, *bounds,
-                                              system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "delete_recursive") {
-            begin = replace_edify_delete_recursive(tokens, *bounds);
-        } else if (unescaped.value() == "format") {
-            begin = replace_edify_format(tokens, *bounds,
-                                         system_devs, cache_devs, data_devs);
+        auto const &name = unescaped.value();
+        bool known = true;
+        std::optional<std::string> replacement;
+
+        if (name == "mount") {
+            replacement = replace_edify_partition_function(
+                    tokens, *bounds, MOUNT_FMT,
+                    system_devs, cache_devs, data_devs);
+        } else if (name == "unmount") {
+            replacement = replace_edify_partition_function(
+                    tokens, *bounds, UNMOUNT_FMT,
+                    system_devs, cache_devs, data_devs);
+        } else if (name == "run_program") {
+            if (!replace_edify_run_program(tokens, *bounds, system_devs,
+                                           cache_devs, data_devs,
+                                           replacement)) {
+                return false;
+            }
+        } else if (name == "delete_recursive") {
+            if (!replace_edify_delete_recursive(tokens, *bounds,
+                                                replacement)) {
+                return false;
+            }
+        } else if (name == "block_image_update" && m_native_block_image) {
+            if (!replace_edify_block_image_update(tokens, *bounds, system_devs,
+                                                  replacement)) {
+                return false;
+            }
+        } else if (name == "format") {
+            replacement = replace_edify_partition_function(
+                    tokens, *bounds, FORMAT_FMT,
+                    system_devs, cache_devs, data_devs);
+        } else {
+            known = false;
+        }
+
+        if (replacement) {
+            output += *replacement;
+            begin = bounds->right_paren + 1;
+        } else if (known) {
+            // Functions that are handled, but don't need to be replaced, are
+            // copied as is without looking at nested function calls
+            append_tokens(output, tokens, bounds->func_name,
+                          bounds->right_paren + 1);
+            begin = bounds->right_paren + 1;
         } else {
             // Only skip function name so that we catch nested function calls
+            append_tokens(output, tokens, bounds->func_name,
+                          bounds->func_name + 1);
             begin = bounds->func_name + 1;
         }
-
-        if (begin == tokens.end()) {
-            return false;
-        }
     }
 
-#if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
-#endif
+    append_tokens(output, tokens, begin, tokens.size());
 
-    FileUtils::write_from_string(path, EdifyTokenizer::untokenize(tokens));
+    contents = std::move(output);
 
     return true;
 }
 
-bool StandardPatcher::patch_transfer_list(const std::string &directory)
+bool StandardPatcher::patch_transfer_list(std::vector<std::string> &lines)
 {
-    std::string contents;
-    std::string path;
-
-    path += directory;
-    path += "/";
-    path += SystemTransferList;
-
-    auto ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return ret == ErrorCode::FileOpenError;
-    }
-
-    auto lines = split_sv(contents, '\n');
-
-    for (auto it = lines.begin(); it != lines.end();) {
-        if (starts_with(*it, "erase ")) {
-            it = lines.erase(it);
-        } else {
-            ++it;
-        }
-    }
-
-    contents = join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
+    lines.erase(std::remove_if(lines.begin(), lines.end(),
+                               [](const std::string &line) {
+        return starts_with(line, "erase ");
+    }), lines.end());
 
     return true;
 }
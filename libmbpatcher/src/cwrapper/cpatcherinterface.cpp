@@ -19,11 +19,14 @@
 
 #include "mbpatcher/cwrapper/cpatcherinterface.h"
 
+#include <chrono>
+
 #include <cassert>
 
 #include "mbcommon/capi/util.h"
 
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/private/progresscoalescer.h"
 
 
 #define CASTP(x) \
@@ -32,6 +35,12 @@
 #define CCASTP(x) \
     assert(x != nullptr); \
     auto const *p = reinterpret_cast<const mb::patcher::Patcher *>(x);
+#define CASTPS(x) \
+    assert(x != nullptr); \
+    auto *ps = reinterpret_cast<mb::patcher::ProgressState *>(x);
+#define CCASTPS(x) \
+    assert(x != nullptr); \
+    auto const *ps = reinterpret_cast<const mb::patcher::ProgressState *>(x);
 #define CASTAP(x) \
     assert(x != nullptr); \
     auto *ap = reinterpret_cast<mb::patcher::AutoPatcher *>(x);
@@ -48,6 +57,10 @@
  * details. The C functions directly correspond to the member functions of the
  * patcher classes.
  *
+ * mbpatcher_patcher_patch_file_coalesced() and the CProgressState functions
+ * have no C++ equivalent. They exist to reduce the number of calls across the
+ * language boundary when patching files with many entries.
+ *
  * \sa Patcher, AutoPatcher
  */
 
@@ -145,6 +158,91 @@ bool mbpatcher_patcher_patch_file(CPatcher *patcher,
     );
 }
 
+/*!
+ * \brief Start patching the file with rate limited progress reporting
+ *
+ * A progress or files callback is only called if at least
+ * \p options->min_interval_ms milliseconds have passed since the previous call
+ * of the same callback and the value changed by at least the corresponding
+ * minimum delta. Changes of the maximum value and reaching the maximum value
+ * are always reported. Details are reported at most once per interval. The
+ * latest values that were held back are reported before this function
+ * returns.
+ *
+ * If \p state is not NULL, it is updated with every progress value, regardless
+ * of the options. It can be polled from another thread with
+ * mbpatcher_progress_get() instead of passing callbacks.
+ *
+ * \param patcher CPatcher object
+ * \param options Rate limiting options or NULL to report every update
+ * \param state CProgressState to update or NULL
+ * \param progress_cb Callback for receiving current progress value
+ * \param files_cb Callback for receiving current files count
+ * \param details_cb Callback for receiving detailed progress text
+ * \param userdata Pointer to pass to callback functions
+ * \return true on success, otherwise false (and error set appropriately)
+ *
+ * \sa Patcher::patchFile()
+ */
+bool mbpatcher_patcher_patch_file_coalesced(CPatcher *patcher,
+                                            const CProgressOptions *options,
+                                            CProgressState *state,
+                                            ProgressUpdatedCallback progress_cb,
+                                            FilesUpdatedCallback files_cb,
+                                            DetailsUpdatedCallback details_cb,
+                                            void *userdata)
+{
+    CASTP(patcher);
+
+    auto *ps = reinterpret_cast<mb::patcher::ProgressState *>(state);
+
+    mb::patcher::ProgressCoalescer::Options coalescer_options{};
+    if (options) {
+        coalescer_options.min_interval =
+                std::chrono::milliseconds(options->min_interval_ms);
+        coalescer_options.min_bytes_delta = options->min_bytes_delta;
+        coalescer_options.min_files_delta = options->min_files_delta;
+    }
+
+    mb::patcher::ProgressCoalescer coalescer(
+        coalescer_options,
+        progress_cb ? [&](uint64_t bytes, uint64_t max_bytes) {
+            progress_cb(bytes, max_bytes, userdata);
+        } : mb::patcher::Patcher::ProgressUpdatedCallback(),
+        files_cb ? [&](uint64_t files, uint64_t max_files) {
+            files_cb(files, max_files, userdata);
+        } : mb::patcher::Patcher::FilesUpdatedCallback(),
+        details_cb ? [&](const std::string &text) {
+            details_cb(text.c_str(), userdata);
+        } : mb::patcher::Patcher::DetailsUpdatedCallback()
+    );
+
+    bool ret = p->patch_file(
+        [&](uint64_t bytes, uint64_t max_bytes) {
+            if (ps) {
+                ps->set_progress(bytes, max_bytes);
+            }
+            coalescer.update_progress(bytes, max_bytes);
+        },
+        [&](uint64_t files, uint64_t max_files) {
+            if (ps) {
+                ps->set_files(files, max_files);
+            }
+            coalescer.update_files(files, max_files);
+        },
+        [&](const std::string &text) {
+            if (ps) {
+                ps->set_details(text);
+            }
+            coalescer.update_details(text);
+        }
+    );
+
+    coalescer.flush();
+
+    return ret;
+}
+
 /*!
  * \brief Cancel the patching of a file
  *
@@ -158,6 +256,68 @@ void mbpatcher_patcher_cancel_patching(CPatcher *patcher)
     p->cancel_patching();
 }
 
+/*!
+ * \brief Create a new CProgressState object.
+ *
+ * \note The returned object must be freed with mbpatcher_progress_destroy().
+ *
+ * \return New CProgressState
+ */
+CProgressState * mbpatcher_progress_create(void)
+{
+    return reinterpret_cast<CProgressState *>(
+            new mb::patcher::ProgressState());
+}
+
+/*!
+ * \brief Destroys a CProgressState object.
+ *
+ * \param state CProgressState to destroy
+ */
+void mbpatcher_progress_destroy(CProgressState *state)
+{
+    CASTPS(state);
+    delete ps;
+}
+
+/*!
+ * \brief Get a consistent snapshot of the progress values
+ *
+ * This function does not block the patching thread and can be called from any
+ * thread.
+ *
+ * \param state CProgressState object
+ * \param progress Pointer to store the progress values
+ */
+void mbpatcher_progress_get(const CProgressState *state,
+                            CPatcherProgress *progress)
+{
+    CCASTPS(state);
+    assert(progress != nullptr);
+
+    auto snapshot = ps->snapshot();
+    progress->bytes = snapshot.bytes;
+    progress->max_bytes = snapshot.max_bytes;
+    progress->files = snapshot.files;
+    progress->max_files = snapshot.max_files;
+    progress->generation = snapshot.generation;
+}
+
+/*!
+ * \brief Get the latest detailed progress text
+ *
+ * \note The returned string is dynamically allocated. It should be free()'d
+ *       when it is no longer needed.
+ *
+ * \param state CProgressState object
+ * \return Latest details text
+ */
+char * mbpatcher_progress_details(const CProgressState *state)
+{
+    CCASTPS(state);
+    return mb::capi_str_to_cstr(ps->details());
+}
+
 /*!
  * \brief Get the error information
  *
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbpatcher/cwrapper/cpatchqueue.h"
+
+#include <cassert>
+
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patchqueue.h"
+
+
+#define CAST(x) \
+    assert(x != nullptr); \
+    auto *q = reinterpret_cast<mb::patcher::PatchQueue *>(x);
+#define CCAST(x) \
+    assert(x != nullptr); \
+    auto const *q = reinterpret_cast<const mb::patcher::PatchQueue *>(x);
+
+
+/*!
+ * \file cpatchqueue.h
+ * \brief C Wrapper for PatchQueue
+ *
+ * Please see the documentation for PatchQueue from the C++ API for more
+ * details. The C functions directly correspond to the PatchQueue member
+ * functions.
+ *
+ * \sa PatchQueue
+ */
+
+extern "C"
+{
+
+/*!
+ * \brief Create a new CPatchQueue object.
+ *
+ * \note The returned object must be freed with mbpatcher_queue_destroy().
+ *
+ * \param pc CPatcherConfig used to create the patchers. It must outlive the
+ *           queue.
+ * \param max_threads Maximum number of jobs to run at the same time or 0 to
+ *                    use the number of hardware threads
+ *
+ * \return New CPatchQueue
+ */
+CPatchQueue * mbpatcher_queue_create(CPatcherConfig *pc,
+                                     unsigned int max_threads)
+{
+    assert(pc != nullptr);
+    auto *config = reinterpret_cast<mb::patcher::PatcherConfig *>(pc);
+    return reinterpret_cast<CPatchQueue *>(
+            new mb::patcher::PatchQueue(*config, max_threads));
+}
+
+/*!
+ * \brief Destroys a CPatchQueue object.
+ *
+ * \param queue CPatchQueue to destroy
+ */
+void mbpatcher_queue_destroy(CPatchQueue *queue)
+{
+    CAST(queue);
+    delete q;
+}
+
+/*!
+ * \brief Add a job to the queue
+ *
+ * \param queue CPatchQueue object
+ * \param patcher_id ID of the Patcher to use
+ * \param info CFileInfo describing the file to be patched. It is copied, so it
+ *             can be destroyed after this function returns.
+ *
+ * \return Index of the job
+ *
+ * \sa PatchQueue::add_job()
+ */
+size_t mbpatcher_queue_add_job(CPatchQueue *queue, const char *patcher_id,
+                               const CFileInfo *info)
+{
+    CAST(queue);
+    assert(info != nullptr);
+    auto const *fi = reinterpret_cast<const mb::patcher::FileInfo *>(info);
+    return q->add_job(patcher_id, *fi);
+}
+
+/*!
+ * \brief Get the number of jobs in the queue
+ *
+ * \param queue CPatchQueue object
+ *
+ * \return Number of jobs
+ *
+ * \sa PatchQueue::jobs()
+ */
+size_t mbpatcher_queue_jobs(const CPatchQueue *queue)
+{
+    CCAST(queue);
+    return q->jobs();
+}
+
+/*!
+ * \brief Get the error for a job
+ *
+ * \param queue CPatchQueue object
+ * \param job Job index
+ *
+ * \return ErrorCode
+ *
+ * \sa PatchQueue::job_error()
+ */
+/* enum ErrorCode */ int mbpatcher_queue_job_error(const CPatchQueue *queue,
+                                                   size_t job)
+{
+    CCAST(queue);
+    return static_cast<int>(q->job_error(job));
+}
+
+/*!
+ * \brief Patch all of the files in the queue
+ *
+ * \param queue CPatchQueue object
+ * \param progress_cb Callback for receiving current progress value
+ * \param files_cb Callback for receiving current files count
+ * \param details_cb Callback for receiving detailed progress text
+ * \param finished_cb Callback for receiving the result of a job
+ * \param userdata Pointer to pass to callback functions
+ * \return true if all jobs succeeded, otherwise false (and the job errors set
+ *         appropriately)
+ *
+ * \sa PatchQueue::run()
+ */
+bool mbpatcher_queue_run(CPatchQueue *queue,
+                         QueueProgressUpdatedCallback progress_cb,
+                         QueueFilesUpdatedCallback files_cb,
+                         QueueDetailsUpdatedCallback details_cb,
+                         QueueJobFinishedCallback finished_cb,
+                         void *userdata)
+{
+    CAST(queue);
+
+    return q->run(
+        [&](size_t job, uint64_t bytes, uint64_t max_bytes) {
+            if (progress_cb) {
+                progress_cb(job, bytes, max_bytes, userdata);
+            }
+        },
+        [&](size_t job, uint64_t files, uint64_t max_files) {
+            if (files_cb) {
+                files_cb(job, files, max_files, userdata);
+            }
+        },
+        [&](size_t job, const std::string &text) {
+            if (details_cb) {
+                details_cb(job, text.c_str(), userdata);
+            }
+        },
+        [&](size_t job, bool ret) {
+            if (finished_cb) {
+                finished_cb(job, ret, userdata);
+            }
+        }
+    );
+}
+
+/*!
+ * \brief Cancel the jobs in the queue
+ *
+ * \param queue CPatchQueue object
+ *
+ * \sa PatchQueue::cancel()
+ */
+void mbpatcher_queue_cancel(CPatchQueue *queue)
+{
+    CAST(queue);
+    q->cancel();
+}
+
+}
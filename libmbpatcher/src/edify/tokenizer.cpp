@@ -77,8 +77,28 @@ std::string EdifyErrorCategory::message(int ev) const
     }
 }
 
+/*!
+ * \brief Copy a string into the arena
+ *
+ * \param str String to store
+ *
+ * \return View of the stored string, which is valid for the lifetime of the
+ *         arena
+ */
+std::string_view EdifyStringArena::add(std::string str)
+{
+    return m_strings.emplace_back(std::move(str));
+}
+
+/*!
+ * \brief Create string token from its text in a script
+ *
+ * \param str Text of the token, including quotes if \p quoted is true. The
+ *            token refers to this text, so it must outlive the token.
+ * \param quoted Whether the text is a quoted string
+ */
 oc::result<EdifyTokenString>
-EdifyTokenString::from_raw(std::string str, bool quoted)
+EdifyTokenString::from_raw(std::string_view str, bool quoted)
 {
     if (quoted && (str.size() < 2 || str.front() != '"' || str.back() != '"')) {
         return EdifyError::ValueNotQuoted;
@@ -86,17 +106,21 @@ EdifyTokenString::from_raw(std::string str, bool quoted)
 
     EdifyTokenString token;
     token.m_quoted = quoted;
-    if (quoted) {
-        token.m_str = str.substr(1, str.size() - 2);
-    } else {
-        token.m_str = std::move(str);
-    }
+    token.m_str = str;
 
     return std::move(token);
 }
 
+/*!
+ * \brief Create string token from an arbitrary string
+ *
+ * \param str String to store in the token
+ * \param make_quoted Whether to escape and quote the string
+ * \param arena Arena that owns the token's text
+ */
 oc::result<EdifyTokenString>
-EdifyTokenString::from_string(std::string str, bool make_quoted)
+EdifyTokenString::from_string(std::string_view str, bool make_quoted,
+                              EdifyStringArena &arena)
 {
     if (!make_quoted) {
         for (char c : str) {
@@ -109,40 +133,39 @@ EdifyTokenString::from_string(std::string str, bool make_quoted)
     EdifyTokenString token;
     token.m_quoted = make_quoted;
     if (make_quoted) {
-        token.m_str = escape(str);
+        std::string buf;
+        buf += '"';
+        buf += escape(str);
+        buf += '"';
+        token.m_str = arena.add(std::move(buf));
     } else {
-        token.m_str = std::move(str);
+        token.m_str = arena.add(std::string(str));
     }
 
     return std::move(token);
 }
 
-std::string EdifyTokenString::generate() const
+std::string_view EdifyTokenString::generate() const
 {
-    std::string buf;
-    buf.reserve(2 + m_str.size());
-    if (m_quoted) {
-        buf += '"';
-    }
-    buf += m_str;
-    if (m_quoted) {
-        buf += '"';
-    }
-    return buf;
+    return m_str;
 }
 
 oc::result<std::string> EdifyTokenString::unescaped_string() const
 {
     if (m_quoted) {
-        return unescape(m_str);
+        return unescape(raw_string());
     } else {
-        return m_str;
+        return std::string(m_str);
     }
 }
 
-std::string EdifyTokenString::raw_string() const
+std::string_view EdifyTokenString::raw_string() const
 {
-    return m_str;
+    if (m_quoted) {
+        return m_str.substr(1, m_str.size() - 2);
+    } else {
+        return m_str;
+    }
 }
 
 bool EdifyTokenString::quoted() const
@@ -270,9 +293,9 @@ oc::result<std::string> EdifyTokenString::unescape(std::string_view str)
     return std::move(output);
 }
 
-static std::string generate_token(const EdifyToken &token)
+static std::string_view generate_token(const EdifyToken &token)
 {
-    return std::visit([](auto &&t) {
+    return std::visit([](auto &&t) -> std::string_view {
         return t.generate();
     }, token);
 }
@@ -328,65 +351,62 @@ oc::result<EdifyToken> EdifyTokenizer::next_token(std::string_view str,
         consumed = 1;
         return EdifyTokenNewline();
     } else if (char c = str.front(); c != '\n' && std::isspace(c)) {
-        std::string buf;
-        buf += c;
         consumed = 1;
-        for (auto it = str.begin() + 1;
-                it != str.end() && *it != '\n' && std::isspace(*it); ++it) {
-            buf += *it;
-            consumed += 1;
+        while (consumed < str.size() && str[consumed] != '\n'
+                && std::isspace(str[consumed])) {
+            ++consumed;
         }
-        return EdifyTokenWhitespace(std::move(buf));
+        return EdifyTokenWhitespace(str.substr(0, consumed));
     } else if (str.front() == '#') {
-        std::string buf;
-        // Omit '#' character
         consumed = 1;
-        for (auto it = str.begin() + 1; it != str.end() && *it != '\n'; ++it) {
-            buf += *it;
-            consumed += 1;
+        while (consumed < str.size() && str[consumed] != '\n') {
+            ++consumed;
         }
-        return EdifyTokenComment(std::move(buf));
+        return EdifyTokenComment(str.substr(0, consumed));
     } else if (char c = str.front(); EdifyTokenString::is_valid_unquoted(c)) {
-        std::string buf;
-        buf += c;
         consumed = 1;
-        for (auto it = str.begin() + 1;
-                it != str.end() && EdifyTokenString::is_valid_unquoted(*it);
-                ++it) {
-            buf += *it;
-            consumed += 1;
+        while (consumed < str.size()
+                && EdifyTokenString::is_valid_unquoted(str[consumed])) {
+            ++consumed;
         }
-        OUTCOME_TRY(r, EdifyTokenString::from_raw(std::move(buf), false));
+        OUTCOME_TRY(r, EdifyTokenString::from_raw(
+                str.substr(0, consumed), false));
         return std::move(r);
     } else if (char c = str.front(); c == '"') {
-        std::string buf;
-        buf += c;
         consumed = 1;
         bool escaped = false;
         bool terminated = false;
-        for (auto it = str.begin() + 1; it != str.end(); ++it) {
-            if (*it == '\\' || escaped) {
+        for (; consumed < str.size(); ++consumed) {
+            if (str[consumed] == '\\' || escaped) {
                 escaped = !escaped;
-            } else if (!escaped && *it == '"') {
-                buf += *it;
-                consumed += 1;
+            } else if (!escaped && str[consumed] == '"') {
+                ++consumed;
                 terminated = true;
                 break;
             }
-            buf += *it;
-            consumed += 1;
         }
         if (!terminated) {
             return EdifyError::UnterminatedQuote;
         }
-        OUTCOME_TRY(r,  EdifyTokenString::from_raw(std::move(buf), true));
+        OUTCOME_TRY(r, EdifyTokenString::from_raw(
+                str.substr(0, consumed), true));
         return std::move(r);
     } else {
         consumed = 1;
-        return EdifyTokenUnknown(str.front());
+        return EdifyTokenUnknown(str.substr(0, 1));
     }
 }
 
+/*!
+ * \brief Split an edify script into tokens
+ *
+ * The tokens refer to the text of the script instead of copying it, so \p str
+ * must outlive the returned tokens.
+ *
+ * \param str Edify script
+ *
+ * \return List of tokens or an error if the script is malformed
+ */
 oc::result<std::vector<EdifyToken>>
 EdifyTokenizer::tokenize(std::string_view str)
 {
@@ -422,6 +442,38 @@ std::string EdifyTokenizer::untokenize(std::vector<EdifyToken>::const_iterator b
     return output;
 }
 
+/*!
+ * \brief Find the matching parenthesis of every left parenthesis
+ *
+ * This allows the end of any function call to be found without scanning its
+ * arguments.
+ *
+ * \param tokens List of tokens
+ *
+ * \return List with the same size as \p tokens. For every left parenthesis
+ *         token, the element is the index of the matching right parenthesis
+ *         token. All other elements, including those of unmatched left
+ *         parentheses, are std::string::npos.
+ */
+std::vector<std::size_t>
+EdifyTokenizer::matching_parens(const std::vector<EdifyToken> &tokens)
+{
+    std::vector<std::size_t> result(tokens.size(), std::string::npos);
+    std::vector<std::size_t> open;
+
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        if (std::holds_alternative<EdifyTokenLeftParen>(tokens[i])) {
+            open.push_back(i);
+        } else if (std::holds_alternative<EdifyTokenRightParen>(tokens[i])
+                && !open.empty()) {
+            result[open.back()] = i;
+            open.pop_back();
+        }
+    }
+
+    return result;
+}
+
 void EdifyTokenizer::dump(const std::vector<EdifyToken> &tokens)
 {
     for (std::size_t i = 0; i < tokens.size(); ++i) {
@@ -473,8 +525,10 @@ void EdifyTokenizer::dump(const std::vector<EdifyToken> &tokens)
             t
         );
 
-        LOGD("%" MB_PRIzu ": %-20s: %s",
-             i, token_name, generate_token(t).c_str());
+        auto text = generate_token(t);
+
+        LOGD("%" MB_PRIzu ": %-20s: %.*s", i, token_name,
+             static_cast<int>(text.size()), text.data());
     }
 }
 
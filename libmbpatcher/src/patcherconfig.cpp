@@ -163,6 +163,7 @@ Patcher * PatcherConfig::create_patcher(const std::string &id)
     }
 
     auto *ptr = p.get();
+    std::lock_guard<std::mutex> lock(m_patchers_mutex);
     m_patchers.push_back(std::move(p));
     return ptr;
 }
@@ -193,6 +194,7 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
     }
 
     auto *ptr = ap.get();
+    std::lock_guard<std::mutex> lock(m_patchers_mutex);
     m_auto_patchers.push_back(std::move(ap));
     return ptr;
 }
@@ -204,6 +206,8 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
  */
 void PatcherConfig::destroy_patcher(Patcher *patcher)
 {
+    std::lock_guard<std::mutex> lock(m_patchers_mutex);
+
     auto it = std::find_if(
         m_patchers.begin(),
         m_patchers.end(),
@@ -222,6 +226,8 @@ void PatcherConfig::destroy_patcher(Patcher *patcher)
  */
 void PatcherConfig::destroy_auto_patcher(AutoPatcher *patcher)
 {
+    std::lock_guard<std::mutex> lock(m_patchers_mutex);
+
     auto it = std::find_if(
         m_auto_patchers.begin(),
         m_auto_patchers.end(),
@@ -32,6 +32,8 @@
 #  include <cerrno>
 #endif
 
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/locale.h"
 #include "mbcommon/string.h"
@@ -44,6 +46,8 @@
 #include "mbpatcher/patchers/zippatcher.h"
 #include "mbpatcher/private/fileutils.h"
 #include "mbpatcher/private/miniziputils.h"
+#include "mbpatcher/private/paralleldeflate.h"
+#include "mbpatcher/private/tarmd5verifier.h"
 
 // minizip
 #include "mz_zip.h"
@@ -66,6 +70,7 @@ OdinPatcher::OdinPatcher(PatcherConfig &pc)
     , m_cancelled(0)
     , m_error()
     , m_la_buf()
+    , m_la_md5()
     , m_la_file()
 #ifdef __ANDROID__
     , m_fd(-1)
@@ -100,6 +105,11 @@ void OdinPatcher::cancel_patching()
     m_cancelled = true;
 }
 
+Patcher::PhaseTimes OdinPatcher::phase_times() const
+{
+    return m_timer.times();
+}
+
 bool OdinPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
                              const FilesUpdatedCallback &files_cb,
                              const DetailsUpdatedCallback &details_cb)
@@ -117,6 +127,8 @@ bool OdinPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
     m_bytes = 0;
     m_max_bytes = 0;
 
+    m_timer.start();
+
     bool ret = patch_tar();
 
     m_progress_cb = nullptr;
@@ -129,6 +141,9 @@ bool OdinPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
         close_output_archive();
     }
 
+    // Writing the central directory
+    m_timer.end_phase("close");
+
     if (m_cancelled) {
         m_error = ErrorCode::PatchingCancelled;
         return false;
@@ -169,6 +184,8 @@ bool OdinPatcher::patch_tar()
         return false;
     }
 
+    m_timer.end_phase("open");
+
     if (m_cancelled) return false;
 
     // Get file size and seek back to original location
@@ -204,6 +221,32 @@ bool OdinPatcher::patch_tar()
         return false;
     }
 
+    if (m_la_md5) {
+        // libarchive stops reading at the end-of-archive marker, so hash
+        // the remaining padding and the trailer
+        while (true) {
+            unsigned char *buf = m_la_md5->next_buffer();
+
+            auto n = m_la_file.read(buf, m_la_md5->buffer_size());
+            if (!n) {
+                LOGE("%s: Failed to read: %s", m_info->input_path().c_str(),
+                     n.error().message().c_str());
+                m_error = ErrorCode::FileReadError;
+                return false;
+            } else if (n.value() == 0) {
+                break;
+            }
+
+            m_la_md5->submit(buf, n.value());
+        }
+
+        if (!check_md5(*m_la_md5, m_info->input_path().c_str())) {
+            return false;
+        }
+    }
+
+    m_timer.end_phase("process_contents");
+
     std::string arch_dir(m_pc.data_directory());
     arch_dir += "/binaries/android/";
     arch_dir += m_info->device().architecture();
@@ -269,6 +312,8 @@ bool OdinPatcher::patch_tar()
         }
     }
 
+    m_timer.end_phase("add_files");
+
     if (m_cancelled) return false;
 
     update_details("multiboot/info.prop");
@@ -285,19 +330,20 @@ bool OdinPatcher::patch_tar()
 
     update_details("multiboot/device.json");
 
-    std::string json;
-    if (!device::device_to_json(m_info->device(), json)) {
+    if (!m_device_json.write(m_info->device())) {
         m_error = ErrorCode::MemoryAllocationError;
         return false;
     }
 
     result = MinizipUtils::add_file_from_data(
-            handle, "multiboot/device.json", json);
+            handle, "multiboot/device.json", m_device_json.data());
     if (result != ErrorCode::NoError) {
         m_error = result;
         return false;
     }
 
+    m_timer.end_phase("metadata");
+
     if (m_cancelled) return false;
 
     return true;
@@ -322,26 +368,48 @@ bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
 
     void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
 
-    // Open file in output zip
-    int mz_ret = mz_zip_entry_write_open(handle, &file_info,
-                                         MZ_COMPRESS_LEVEL_DEFAULT, nullptr);
+    // Open raw file in output zip. The data is deflated by ParallelDeflater
+    // instead of minizip so that images, which are several GiB, are compressed
+    // on all CPUs while libarchive reads and decompresses the next blocks.
+    int mz_ret = mz_zip_entry_write_open(handle, &file_info, 0, nullptr);
     if (mz_ret != MZ_OK) {
         LOGE("minizip: Failed to open new file in output zip: %d", mz_ret);
         m_error = ErrorCode::ArchiveWriteHeaderError;
         return false;
     }
 
+    auto close_inner_write = finally([&] {
+        mz_zip_entry_close(handle);
+    });
+
+    ParallelDeflater deflater([&](const void *data, size_t size) {
+        // minizip no longer supports buffers larger than UINT16_MAX
+        auto *ptr = static_cast<const char *>(data);
+
+        while (size > 0) {
+            auto n = static_cast<uint32_t>(std::min<size_t>(size, UINT16_MAX));
+
+            int n_written = mz_zip_entry_write(handle, ptr, n);
+            if (n_written < 0 || static_cast<uint32_t>(n_written) != n) {
+                LOGE("minizip: Failed to write %s in output zip",
+                     zip_name.c_str());
+                return false;
+            }
+
+            ptr += n;
+            size -= n;
+        }
+
+        return true;
+    });
+
     la_ssize_t n_read;
     char buf[10240];
     while ((n_read = archive_read_data(a, buf, sizeof(buf))) > 0) {
         if (m_cancelled) return false;
 
-        int n_written = mz_zip_entry_write(
-                handle, buf, static_cast<uint32_t>(n_read));
-        if (static_cast<la_ssize_t>(n_written) != n_read) {
-            LOGE("minizip: Failed to write %s in output zip", zip_name.c_str());
+        if (!deflater.write(buf, static_cast<size_t>(n_read))) {
             m_error = ErrorCode::ArchiveWriteDataError;
-            mz_zip_entry_close(handle);
             return false;
         }
     }
@@ -350,12 +418,19 @@ bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
         LOGE("libarchive: Failed to read %s: %s",
              name, archive_error_string(a));
         m_error = ErrorCode::ArchiveReadDataError;
-        mz_zip_entry_close(handle);
         return false;
     }
 
+    if (!deflater.finish()) {
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    close_inner_write.dismiss();
+
     // Close file in output zip
-    mz_ret = mz_zip_entry_close(handle);
+    mz_ret = mz_zip_entry_close_raw(
+            handle, static_cast<int64_t>(deflater.size()), deflater.crc());
     if (mz_ret != MZ_OK) {
         LOGE("minizip: Failed to close file in output zip: %d", mz_ret);
         m_error = ErrorCode::ArchiveWriteDataError;
@@ -384,6 +459,8 @@ struct NestedCtx
     archive *nested;
     archive *parent;
     char buf[10240];
+    // Set if the nested archive is a .tar.md5 file
+    std::unique_ptr<TarMd5Verifier> md5;
 
     NestedCtx(archive *a) : nested(archive_read_new()), parent(a)
     {
@@ -440,6 +517,10 @@ bool OdinPatcher::process_contents(archive *a, unsigned int depth,
 
             archive_read_support_format_tar(ctx.nested);
 
+            if (ends_with(name, ".tar.md5")) {
+                ctx.md5 = std::make_unique<TarMd5Verifier>();
+            }
+
             int ret = archive_read_open2(ctx.nested, &ctx, nullptr,
                                          &la_nested_read_cb, nullptr, nullptr);
             if (ret != ARCHIVE_OK) {
@@ -452,6 +533,25 @@ bool OdinPatcher::process_contents(archive *a, unsigned int depth,
             if (!process_contents(ctx.nested, depth + 1, nullptr)) {
                 return false;
             }
+
+            if (ctx.md5) {
+                // Hash whatever the tar reader did not need
+                la_ssize_t n;
+                const void *buf;
+
+                while ((n = la_nested_read_cb(ctx.nested, &ctx, &buf)) > 0);
+
+                if (n < 0) {
+                    LOGE("libarchive: Failed to read data: %s",
+                         archive_error_string(a));
+                    m_error = ErrorCode::ArchiveReadDataError;
+                    return false;
+                }
+
+                if (!check_md5(*ctx.md5, name)) {
+                    return false;
+                }
+            }
         } else if (ends_with(name, ".lz4")) {
             LOGV("%sHandling nested LZ4-compressed image: %s",
                  indent(depth), name);
@@ -520,6 +620,30 @@ bool OdinPatcher::process_contents(archive *a, unsigned int depth,
     return true;
 }
 
+/*!
+ * \brief Check the result of verifying a .tar.md5 file
+ *
+ * Tarballs without an MD5 trailer are accepted.
+ */
+bool OdinPatcher::check_md5(TarMd5Verifier &verifier, const char *name)
+{
+    switch (verifier.finish()) {
+    case TarMd5Verifier::Result::Match:
+        LOGD("%s: MD5 checksum matches", name);
+        return true;
+    case TarMd5Verifier::Result::NoChecksum:
+        LOGD("%s: No MD5 checksum to verify", name);
+        return true;
+    case TarMd5Verifier::Result::Mismatch:
+        LOGE("%s: MD5 checksum mismatch: expected %s, but got %s", name,
+             verifier.expected().c_str(), verifier.actual().c_str());
+        m_error = ErrorCode::ArchiveChecksumError;
+        return false;
+    }
+
+    return false;
+}
+
 bool OdinPatcher::open_input_archive()
 {
     assert(m_a_input == nullptr);
@@ -634,6 +758,17 @@ la_ssize_t OdinPatcher::la_nested_read_cb(archive *a, void *userdata,
 
     NestedCtx *ctx = static_cast<NestedCtx *>(userdata);
 
+    if (ctx->md5) {
+        unsigned char *buf = ctx->md5->next_buffer();
+        *buffer = buf;
+
+        auto n = archive_read_data(ctx->parent, buf, ctx->md5->buffer_size());
+        if (n > 0) {
+            ctx->md5->submit(buf, static_cast<size_t>(n));
+        }
+        return n;
+    }
+
     *buffer = ctx->buf;
 
     return archive_read_data(ctx->parent, ctx->buf, sizeof(ctx->buf));
@@ -644,9 +779,12 @@ la_ssize_t OdinPatcher::la_read_cb(archive *a, void *userdata,
 {
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
-    *buffer = p->m_la_buf;
+    unsigned char *buf = p->m_la_md5 ? p->m_la_md5->next_buffer()
+            : p->m_la_buf;
+    *buffer = buf;
 
-    auto bytes_read = p->m_la_file.read(p->m_la_buf, sizeof(p->m_la_buf));
+    auto bytes_read = p->m_la_file.read(buf, p->m_la_md5
+            ? p->m_la_md5->buffer_size() : sizeof(p->m_la_buf));
     if (!bytes_read) {
         LOGE("%s: Failed to read: %s", p->m_info->input_path().c_str(),
              bytes_read.error().message().c_str());
@@ -654,6 +792,10 @@ la_ssize_t OdinPatcher::la_read_cb(archive *a, void *userdata,
         return -1;
     }
 
+    if (p->m_la_md5) {
+        p->m_la_md5->submit(buf, bytes_read.value());
+    }
+
     p->m_bytes += bytes_read.value();
     p->update_progress(p->m_bytes, p->m_max_bytes);
     return static_cast<la_ssize_t>(bytes_read.value());
@@ -665,6 +807,11 @@ la_int64_t OdinPatcher::la_skip_cb(archive *a, void *userdata,
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
 
+    // Every byte must be hashed, so make libarchive read the data instead
+    if (p->m_la_md5) {
+        return 0;
+    }
+
     auto seek_ret = p->m_la_file.seek(request, SEEK_CUR);
     if (!seek_ret) {
         LOGE("%s: Failed to seek: %s", p->m_info->input_path().c_str(),
@@ -711,6 +858,32 @@ int OdinPatcher::la_open_cb(archive *a, void *userdata)
         return -1;
     }
 
+    // Samsung's .tar.md5 files are plain tarballs followed by an MD5 trailer,
+    // which is checked while the tarball is read. The input path may be a
+    // file descriptor, so check the contents instead of the extension.
+    p->m_la_md5.reset();
+
+    unsigned char header[512];
+
+    auto n = file_read_retry(p->m_la_file, header, sizeof(header));
+    if (!n) {
+        LOGE("%s: Failed to read: %s", p->m_info->input_path().c_str(),
+             n.error().message().c_str());
+        p->m_error = ErrorCode::FileReadError;
+        return -1;
+    }
+
+    if (n.value() == sizeof(header) && memcmp(header + 257, "ustar", 5) == 0) {
+        p->m_la_md5 = std::make_unique<TarMd5Verifier>();
+    }
+
+    if (auto r = p->m_la_file.seek(0, SEEK_SET); !r) {
+        LOGE("%s: Failed to seek: %s", p->m_info->input_path().c_str(),
+             r.error().message().c_str());
+        p->m_error = ErrorCode::FileSeekError;
+        return -1;
+    }
+
     return 0;
 }
 
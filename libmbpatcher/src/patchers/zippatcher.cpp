@@ -29,13 +29,12 @@
 #include "mbcommon/version.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
-#include "mbpio/delete.h"
 
 #include "mbpatcher/autopatchers/magiskpatcher.h"
 #include "mbpatcher/autopatchers/mountcmdpatcher.h"
 #include "mbpatcher/autopatchers/standardpatcher.h"
 #include "mbpatcher/patcherconfig.h"
-#include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/datafilecache.h"
 #include "mbpatcher/private/miniziputils.h"
 
 // minizip
@@ -53,8 +52,10 @@ const std::string ZipPatcher::Id("ZipPatcher");
 ZipPatcher::ZipPatcher(PatcherConfig &pc)
     : m_pc(pc)
     , m_info(nullptr)
+    , m_data_file_cache(nullptr)
     , m_bytes(0)
     , m_max_bytes(0)
+    , m_reported_bytes(0)
     , m_files(0)
     , m_max_files(0)
     , m_cancelled(false)
@@ -89,6 +90,25 @@ void ZipPatcher::cancel_patching()
     m_cancelled = true;
 }
 
+Patcher::PhaseTimes ZipPatcher::phase_times() const
+{
+    return m_timer.times();
+}
+
+/*!
+ * \brief Set the cache for the binaries and scripts added to the output zip
+ *
+ * This allows several ZipPatcher instances running at the same time to share
+ * the files from the data directory. If no cache is set, the files are read
+ * for every patch_file() call.
+ *
+ * \param cache Cache that outlives the patching operation or nullptr
+ */
+void ZipPatcher::set_data_file_cache(DataFileCache *cache)
+{
+    m_data_file_cache = cache;
+}
+
 bool ZipPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
                             const FilesUpdatedCallback &files_cb,
                             const DetailsUpdatedCallback &details_cb)
@@ -103,9 +123,12 @@ bool ZipPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
 
     m_bytes = 0;
     m_max_bytes = 0;
+    m_reported_bytes = 0;
     m_files = 0;
     m_max_files = 0;
 
+    m_timer.start();
+
     bool ret = patch_zip();
 
     m_progress_cb = nullptr;
@@ -124,6 +147,9 @@ bool ZipPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
         close_output_archive();
     }
 
+    // Writing the central directory
+    m_timer.end_phase("close");
+
     if (m_cancelled) {
         m_error = ErrorCode::PatchingCancelled;
         return false;
@@ -161,24 +187,27 @@ bool ZipPatcher::patch_zip()
         }
     }
 
-    // Unlike the old patcher, we'll write directly to the new file
-    if (!open_output_archive()) {
+    if (m_cancelled) return false;
+
+    // The input archive is opened once and its central directory is only
+    // read once. The resulting entry table is used for the totals and both
+    // passes.
+    if (!open_input_archive()) {
         return false;
     }
 
-    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
-
-    if (m_cancelled) return false;
-
-    MinizipUtils::ArchiveStats stats;
-    auto result = MinizipUtils::archive_stats(m_info->input_path(), stats, {});
-    if (result != ErrorCode::NoError) {
-        m_error = result;
+    auto const *entries = MinizipUtils::ctx_get_entry_table(m_z_input);
+    if (!entries) {
+        m_error = ErrorCode::ArchiveReadHeaderError;
         return false;
     }
 
+    auto stats = entries->stats({});
+
     m_max_bytes = stats.total_size;
 
+    m_timer.end_phase("entry_table");
+
     if (m_cancelled) return false;
 
     std::string arch_dir(m_pc.data_directory());
@@ -222,29 +251,47 @@ bool ZipPatcher::patch_zip()
     m_max_files = stats.files + to_copy.size() + 2;
     update_files(m_files, m_max_files);
 
-    if (!open_input_archive()) {
+    std::vector<bool> copied;
+    if (!copy_untouched_entries(exclude_from_pass1, copied)) {
+        return false;
+    }
+
+    m_timer.end_phase("copy_raw");
+
+    if (m_cancelled) return false;
+
+    // Unlike the old patcher, we'll write directly to the new file
+    bool any_copied = std::find(copied.begin(), copied.end(), true)
+            != copied.end();
+    if (!open_output_archive(any_copied
+            ? ZipOpenMode::Append : ZipOpenMode::Write)) {
         return false;
     }
 
-    // Create temporary dir for extracted files for autopatchers
-    std::string temp_dir =
-            FileUtils::create_temporary_dir(m_pc.temp_directory());
+    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
+    // Files for the autopatchers are kept in memory. They are only small
+    // scripts and transfer lists.
+    AutoPatcher::FileMap ap_files;
 
-    if (!pass1(temp_dir, exclude_from_pass1)) {
-        (void) io::delete_recursively(temp_dir);
+    if (!pass1(ap_files, exclude_from_pass1, copied)) {
         return false;
     }
 
+    m_timer.end_phase("pass1");
+
     if (m_cancelled) return false;
 
     // On the second pass, run the autopatchers on the rest of the files
 
-    if (!pass2(temp_dir, exclude_from_pass1)) {
-        (void) io::delete_recursively(temp_dir);
+    if (!pass2(ap_files)) {
         return false;
     }
 
-    (void) io::delete_recursively(temp_dir);
+    m_timer.end_phase("pass2");
+
+    DataFileCache local_cache;
+    auto &cache = m_data_file_cache ? *m_data_file_cache : local_cache;
 
     for (const CopySpec &spec : to_copy) {
         if (m_cancelled) return false;
@@ -252,20 +299,30 @@ bool ZipPatcher::patch_zip()
         update_files(++m_files, m_max_files);
         update_details(spec.target);
 
-        result = MinizipUtils::add_file_from_path(
-                handle, spec.target, spec.source);
+        std::shared_ptr<const DataFile> file;
+
+        auto result = cache.get(spec.source, file);
+        if (result != ErrorCode::NoError) {
+            m_error = result;
+            return false;
+        }
+
+        result = MinizipUtils::add_file_from_data(
+                handle, spec.target, file->data, file->modified_date);
         if (result != ErrorCode::NoError) {
             m_error = result;
             return false;
         }
     }
 
+    m_timer.end_phase("add_files");
+
     if (m_cancelled) return false;
 
     update_files(++m_files, m_max_files);
     update_details("multiboot/info.prop");
 
-    result = MinizipUtils::add_file_from_data(
+    auto result = MinizipUtils::add_file_from_data(
             handle, "multiboot/info.prop",
             create_info_prop(m_info->rom_id()));
     if (result != ErrorCode::NoError) {
@@ -278,91 +335,134 @@ bool ZipPatcher::patch_zip()
     update_files(++m_files, m_max_files);
     update_details("multiboot/device.json");
 
-    std::string json;
-    if (!device::device_to_json(m_info->device(), json)) {
+    if (!m_device_json.write(m_info->device())) {
         m_error = ErrorCode::MemoryAllocationError;
         return false;
     }
 
     result = MinizipUtils::add_file_from_data(
-            handle, "multiboot/device.json", json);
+            handle, "multiboot/device.json", m_device_json.data());
     if (result != ErrorCode::NoError) {
         m_error = result;
         return false;
     }
 
+    m_timer.end_phase("metadata");
+
     if (m_cancelled) return false;
 
     return true;
 }
 
+/*!
+ * \brief Copy the entries that are not modified as raw byte ranges
+ *
+ * This creates the output zip. Runs of consecutive entries that are neither
+ * patched by an AutoPatcher nor renamed are copied from the input in bulk,
+ * which for big ROM zips is most of the data. The remaining entries are
+ * handled by pass1().
+ *
+ * \param exclude Files that will be extracted for the AutoPatchers
+ * \param copied Whether each entry of the input zip's entry table was copied
+ */
+bool ZipPatcher::copy_untouched_entries(
+        const std::unordered_set<std::string> &exclude,
+        std::vector<bool> &copied)
+{
+    auto const *entries = MinizipUtils::ctx_get_entry_table(m_z_input);
+
+    auto filter = [&](const MinizipUtils::ZipEntry &entry) {
+        return exclude.find(entry.name) == exclude.end()
+                && entry.name != "META-INF/com/google/android/update-binary";
+    };
+
+    auto cb = [&](uint64_t bytes) {
+        m_bytes += bytes;
+        update_progress(m_bytes, m_max_bytes);
+        return !m_cancelled;
+    };
+
+    auto ret = MinizipUtils::copy_entries_raw(
+            *entries, m_info->input_path(), m_info->output_path(), filter, cb,
+            copied);
+    if (ret != ErrorCode::NoError) {
+        m_error = ret;
+        return false;
+    }
+
+    auto n = static_cast<uint64_t>(
+            std::count(copied.begin(), copied.end(), true));
+    if (n > 0) {
+        m_files += n;
+        update_files(m_files, m_max_files);
+    }
+
+    return true;
+}
+
 /*!
  * \brief First pass of patching operation
  *
- * This performs the following operations:
+ * This performs the following operations on the entries that were not already
+ * copied by copy_untouched_entries():
  *
- * - Files needed by an AutoPatcher are extracted to the temporary directory.
+ * - Files needed by an AutoPatcher are read into \p ap_files.
  * - Otherwise, the file is copied directly to the output zip.
  */
-bool ZipPatcher::pass1(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &exclude)
+bool ZipPatcher::pass1(AutoPatcher::FileMap &ap_files,
+                       const std::unordered_set<std::string> &exclude,
+                       const std::vector<bool> &copied)
 {
     using namespace std::placeholders;
 
     void *h_in = MinizipUtils::ctx_get_zip_handle(m_z_input);
     void *h_out = MinizipUtils::ctx_get_zip_handle(m_z_output);
+    auto const *entries = MinizipUtils::ctx_get_entry_table(m_z_input);
 
-    int ret = mz_zip_goto_first_entry(h_in);
-    if (ret != MZ_OK && ret != MZ_END_OF_LIST) {
-        m_error = ErrorCode::ArchiveReadHeaderError;
-        return false;
-    }
-
-    if (ret != MZ_END_OF_LIST) {
-        do {
-            if (m_cancelled) return false;
-
-            mz_zip_file *file_info;
+    for (size_t i = 0; i < entries->entries().size(); ++i) {
+        if (m_cancelled) return false;
 
-            ret = mz_zip_entry_get_info(h_in, &file_info);
-            if (ret != MZ_OK) {
-                m_error = ErrorCode::ArchiveReadHeaderError;
-                return false;
-            }
+        if (copied[i]) {
+            continue;
+        }
 
-            std::string cur_file{file_info->filename, file_info->filename_size};
+        auto const &entry = entries->entries()[i];
 
-            update_files(++m_files, m_max_files);
-            update_details(cur_file);
+        if (!MinizipUtils::goto_entry(h_in, entry)) {
+            m_error = ErrorCode::ArchiveReadHeaderError;
+            return false;
+        }
 
-            // Skip files that should be patched and added in pass 2
-            if (exclude.find(cur_file) != exclude.end()) {
-                if (!MinizipUtils::extract_file(h_in, temporary_dir)) {
-                    m_error = ErrorCode::ArchiveReadDataError;
-                    return false;
-                }
-                continue;
-            }
+        std::string cur_file = entry.name;
 
-            // Rename the installer for mbtool
-            if (cur_file == "META-INF/com/google/android/update-binary") {
-                cur_file = "META-INF/com/google/android/update-binary.orig";
-            }
+        update_files(++m_files, m_max_files);
+        update_details(cur_file);
 
-            if (!MinizipUtils::copy_file_raw(h_in, h_out, cur_file,
-                    std::bind(&ZipPatcher::la_progress_cb, this, _1))) {
-                LOGW("minizip: Failed to copy raw data: %s", cur_file.c_str());
-                m_error = ErrorCode::ArchiveWriteDataError;
+        // Skip files that should be patched and added in pass 2
+        if (exclude.find(cur_file) != exclude.end()) {
+            std::string data;
+            if (!MinizipUtils::read_to_memory(h_in, data, {})) {
+                m_error = ErrorCode::ArchiveReadDataError;
                 return false;
             }
+            ap_files.insert_or_assign(std::move(cur_file),
+                                     ScriptFile(std::move(data)));
+            continue;
+        }
 
-            m_bytes += file_info->uncompressed_size;
-        } while ((ret = mz_zip_goto_next_entry(h_in)) == MZ_OK);
+        // Rename the installer for mbtool
+        if (cur_file == "META-INF/com/google/android/update-binary") {
+            cur_file = "META-INF/com/google/android/update-binary.orig";
+        }
 
-        if (ret != MZ_END_OF_LIST) {
-            m_error = ErrorCode::ArchiveReadHeaderError;
+        if (!MinizipUtils::copy_file_raw(h_in, h_out, cur_file,
+                std::bind(&ZipPatcher::la_progress_cb, this, _1))) {
+            LOGW("minizip: Failed to copy raw data: %s", cur_file.c_str());
+            m_error = ErrorCode::ArchiveWriteDataError;
             return false;
         }
+
+        m_bytes += entry.uncompressed_size;
     }
 
     if (m_cancelled) return false;
@@ -375,44 +475,43 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
  *
  * This performs the following operations:
  *
- * - Patch files in the temporary directory using the AutoPatchers and add the
+ * - Patch the files read in the first pass using the AutoPatchers and add the
  *   resulting files to the output zip
  */
-bool ZipPatcher::pass2(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &files)
+bool ZipPatcher::pass2(AutoPatcher::FileMap &ap_files)
 {
     void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
 
     for (auto *ap : m_auto_patchers) {
         if (m_cancelled) return false;
-        if (!ap->patch_files(temporary_dir)) {
+        if (!ap->patch_data(ap_files)) {
             m_error = ap->error();
             return false;
         }
     }
 
+    m_timer.end_phase("autopatchers");
+
     // TODO Headers are being discarded
 
-    for (auto const &file : files) {
+    for (auto &[file, script] : ap_files) {
         if (m_cancelled) return false;
 
+        // Serialize the shared script model now that all of the autopatchers
+        // are done editing it
+        auto const &data = script.text();
         ErrorCode ret;
 
         if (file == "META-INF/com/google/android/update-binary") {
-            ret = MinizipUtils::add_file_from_path(
+            ret = MinizipUtils::add_file_from_data(
                     handle,
                     "META-INF/com/google/android/update-binary.orig",
-                    temporary_dir + "/" + file);
+                    data);
         } else {
-            ret = MinizipUtils::add_file_from_path(
-                    handle,
-                    file,
-                    temporary_dir + "/" + file);
+            ret = MinizipUtils::add_file_from_data(handle, file, data);
         }
 
-        if (ret == ErrorCode::FileOpenError) {
-            LOGW("File does not exist in temporary directory: %s", file.c_str());
-        } else if (ret != ErrorCode::NoError) {
+        if (ret != ErrorCode::NoError) {
             m_error = ret;
             return false;
         }
@@ -452,12 +551,11 @@ void ZipPatcher::close_input_archive()
     m_z_input = nullptr;
 }
 
-bool ZipPatcher::open_output_archive()
+bool ZipPatcher::open_output_archive(ZipOpenMode mode)
 {
     assert(m_z_output == nullptr);
 
-    m_z_output = MinizipUtils::open_zip_file(m_info->output_path(),
-                                             ZipOpenMode::Write);
+    m_z_output = MinizipUtils::open_zip_file(m_info->output_path(), mode);
 
     if (!m_z_output) {
         LOGE("minizip: Failed to open for writing: %s",
@@ -483,6 +581,14 @@ void ZipPatcher::close_output_archive()
 
 void ZipPatcher::update_progress(uint64_t bytes, uint64_t max_bytes)
 {
+    // Progress is reported for every buffer that is copied. Only pass on
+    // changes of at least 0.1% to avoid flooding the callback.
+    if (bytes != max_bytes && bytes >= m_reported_bytes
+            && bytes - m_reported_bytes < max_bytes / 1000) {
+        return;
+    }
+    m_reported_bytes = bytes;
+
     if (m_progress_cb && *m_progress_cb) {
         (*m_progress_cb)(bytes, max_bytes);
     }
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbpatcher/patchqueue.h"
+
+#include <algorithm>
+#include <thread>
+
+#include <cassert>
+
+#include "mbcommon/finally.h"
+
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/patchers/zippatcher.h"
+#include "mbpatcher/private/datafilecache.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class PatchQueue
+ * \brief Patches several files concurrently
+ *
+ * Each job is patched by a new Patcher created from the PatcherConfig. Up to
+ * \p max_threads jobs are run at the same time. Files that are identical for
+ * every job, like the signed binaries and scripts added to each zip, are only
+ * read once per run() and are shared between the jobs.
+ */
+
+/*!
+ * \brief Construct a new patch queue
+ *
+ * \param pc PatcherConfig used to create the patchers. It must outlive the
+ *           queue.
+ * \param max_threads Maximum number of jobs to run at the same time. If 0, the
+ *                    number of hardware threads is used.
+ */
+PatchQueue::PatchQueue(PatcherConfig &pc, unsigned int max_threads)
+    : m_pc(pc)
+    , m_max_threads(max_threads)
+    , m_next_job(0)
+    , m_cancelled(false)
+    , m_progress_cb(nullptr)
+    , m_files_cb(nullptr)
+    , m_details_cb(nullptr)
+    , m_finished_cb(nullptr)
+{
+}
+
+PatchQueue::~PatchQueue() = default;
+
+/*!
+ * \brief Add a job to the queue
+ *
+ * \note This must not be called while run() is executing.
+ *
+ * \param patcher_id ID of the Patcher to use
+ * \param info FileInfo describing the file to be patched
+ *
+ * \return Index of the job
+ */
+size_t PatchQueue::add_job(std::string patcher_id, FileInfo info)
+{
+    m_jobs.push_back({std::move(patcher_id), std::move(info), {}});
+    return m_jobs.size() - 1;
+}
+
+/*!
+ * \brief Get the number of jobs in the queue
+ *
+ * \return Number of jobs
+ */
+size_t PatchQueue::jobs() const
+{
+    return m_jobs.size();
+}
+
+/*!
+ * \brief Get the error for a job
+ *
+ * \note The returned ErrorCode contains valid information only if the job has
+ *       failed in the last call to run().
+ *
+ * \param job Job index
+ *
+ * \return ErrorCode containing information about the error
+ */
+ErrorCode PatchQueue::job_error(size_t job) const
+{
+    assert(job < m_jobs.size());
+    return m_jobs[job].error;
+}
+
+/*!
+ * \brief Patch all of the files in the queue
+ *
+ * This blocks until every job has finished or until the queue is cancelled.
+ * The callbacks receive the job index as their first parameter and are called
+ * from the worker threads, but never concurrently. The callback parameters can
+ * be passed nullptr if they are not needed.
+ *
+ * \param progress_cb Callback for receiving current progress values
+ * \param files_cb Callback for receiving current files count
+ * \param details_cb Callback for receiving detailed progress text
+ * \param finished_cb Callback for receiving the result of a job
+ *
+ * \return Whether all jobs completed successfully. If false, job_error() can
+ *         be used to find which jobs failed.
+ */
+bool PatchQueue::run(const ProgressUpdatedCallback &progress_cb,
+                     const FilesUpdatedCallback &files_cb,
+                     const DetailsUpdatedCallback &details_cb,
+                     const JobFinishedCallback &finished_cb)
+{
+    m_progress_cb = &progress_cb;
+    m_files_cb = &files_cb;
+    m_details_cb = &details_cb;
+    m_finished_cb = &finished_cb;
+
+    auto reset_callbacks = finally([&] {
+        m_progress_cb = nullptr;
+        m_files_cb = nullptr;
+        m_details_cb = nullptr;
+        m_finished_cb = nullptr;
+    });
+
+    m_next_job = 0;
+    m_cancelled = false;
+
+    for (auto &job : m_jobs) {
+        job.error = ErrorCode::NoError;
+    }
+
+    unsigned int threads = m_max_threads;
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = static_cast<unsigned int>(
+            std::min<size_t>(threads, m_jobs.size()));
+
+    // Only keep the shared files in memory for the duration of the run
+    DataFileCache cache;
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers.emplace_back(&PatchQueue::worker, this, std::ref(cache));
+    }
+
+    for (auto &t : workers) {
+        t.join();
+    }
+
+    // Jobs that were never started because of a cancellation
+    for (size_t i = m_next_job; i < m_jobs.size(); ++i) {
+        m_jobs[i].error = ErrorCode::PatchingCancelled;
+    }
+
+    return std::all_of(m_jobs.begin(), m_jobs.end(), [](const Job &job) {
+        return job.error == ErrorCode::NoError;
+    });
+}
+
+/*!
+ * \brief Cancel the jobs in the queue
+ *
+ * The running jobs are cancelled and the remaining ones are not started. This
+ * is only useful if run() is being called on another thread or from one of the
+ * callbacks.
+ */
+void PatchQueue::cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_cancelled = true;
+
+    for (auto *p : m_running) {
+        p->cancel_patching();
+    }
+}
+
+void PatchQueue::worker(DataFileCache &cache)
+{
+    while (true) {
+        size_t index;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (m_cancelled || m_next_job == m_jobs.size()) {
+                return;
+            }
+
+            index = m_next_job++;
+        }
+
+        bool ret = run_job(index, cache);
+
+        std::lock_guard<std::mutex> lock(m_cb_mutex);
+        if (*m_finished_cb) {
+            (*m_finished_cb)(index, ret);
+        }
+    }
+}
+
+bool PatchQueue::run_job(size_t index, DataFileCache &cache)
+{
+    Job &job = m_jobs[index];
+    Patcher *patcher;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        patcher = m_pc.create_patcher(job.patcher_id);
+        if (!patcher) {
+            job.error = ErrorCode::PatcherCreateError;
+            return false;
+        }
+
+        m_running.push_back(patcher);
+    }
+
+    auto destroy_patcher = finally([&] {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_running.erase(std::find(m_running.begin(), m_running.end(),
+                                  patcher));
+        m_pc.destroy_patcher(patcher);
+    });
+
+    if (job.patcher_id == ZipPatcher::Id) {
+        static_cast<ZipPatcher *>(patcher)->set_data_file_cache(&cache);
+    }
+
+    patcher->set_file_info(&job.info);
+
+    // Patcher::patch_file() resets its cancellation state, so a cancel() that
+    // happens just before it starts is forwarded again on the next callback
+    auto check_cancelled = [&] {
+        if (m_cancelled) {
+            patcher->cancel_patching();
+        }
+    };
+
+    bool ret = patcher->patch_file(
+        [&](uint64_t bytes, uint64_t max_bytes) {
+            check_cancelled();
+            std::lock_guard<std::mutex> lock(m_cb_mutex);
+            if (*m_progress_cb) {
+                (*m_progress_cb)(index, bytes, max_bytes);
+            }
+        },
+        [&](uint64_t files, uint64_t max_files) {
+            check_cancelled();
+            std::lock_guard<std::mutex> lock(m_cb_mutex);
+            if (*m_files_cb) {
+                (*m_files_cb)(index, files, max_files);
+            }
+        },
+        [&](const std::string &text) {
+            check_cancelled();
+            std::lock_guard<std::mutex> lock(m_cb_mutex);
+            if (*m_details_cb) {
+                (*m_details_cb)(index, text);
+            }
+        }
+    );
+
+    if (!ret) {
+        job.error = patcher->error();
+    }
+
+    return ret;
+}
+
+}
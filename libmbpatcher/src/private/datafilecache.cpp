@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbpatcher/private/datafilecache.h"
+
+#include "mblog/logging.h"
+
+#include "mbpatcher/private/fileutils.h"
+
+#include "mz.h"
+#include "mz_os.h"
+
+#define LOG_TAG "mbpatcher/private/datafilecache"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class DataFileCache
+ * \brief Thread-safe cache of files from the data directory
+ *
+ * Patchers add the same signed binaries and scripts to every output file. When
+ * several files are patched at the same time, the cache allows each of those
+ * files to be read only once.
+ */
+
+DataFileCache::DataFileCache() = default;
+
+DataFileCache::~DataFileCache() = default;
+
+/*!
+ * \brief Get the contents of a file, reading it if it is not cached yet
+ *
+ * \param[in] path Path to file
+ * \param[out] file Output shared pointer to the file's contents and
+ *                  modification time
+ *
+ * \return ErrorCode::NoError if the file was found in the cache or was read
+ *         successfully. Otherwise, the error from reading the file.
+ */
+ErrorCode DataFileCache::get(const std::string &path,
+                             std::shared_ptr<const DataFile> &file)
+{
+    // The lock is held while reading so that concurrent patchers needing the
+    // same file wait for the first read instead of all reading it
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (auto it = m_files.find(path); it != m_files.end()) {
+        file = it->second;
+        return ErrorCode::NoError;
+    }
+
+    auto df = std::make_shared<DataFile>();
+
+    auto ret = FileUtils::read_to_string(path, &df->data);
+    if (ret != ErrorCode::NoError) {
+        return ret;
+    }
+
+    time_t accessed_date;
+    time_t creation_date;
+
+    int mz_ret = mz_os_get_file_date(path.c_str(), &df->modified_date,
+                                     &accessed_date, &creation_date);
+    if (mz_ret != MZ_OK) {
+        LOGE("%s: Failed to get modification time: %d", path.c_str(), mz_ret);
+        return ErrorCode::FileOpenError;
+    }
+
+    file = df;
+    m_files.emplace(path, std::move(df));
+
+    return ErrorCode::NoError;
+}
+
+}
@@ -294,4 +294,43 @@ std::string FileUtils::create_temporary_dir(const std::string &directory)
 #endif
 }
 
+/*!
+ * \brief Run an AutoPatcher on files in a directory
+ *
+ * The files from AutoPatcher::existing_files() that exist in \p directory are
+ * loaded, patched with AutoPatcher::patch_data(), and written back.
+ *
+ * \param ap AutoPatcher to run
+ * \param directory Directory containing the files to be patched
+ *
+ * \return Whether the files were patched and written successfully
+ */
+bool FileUtils::patch_files_in_directory(AutoPatcher &ap,
+                                         const std::string &directory)
+{
+    AutoPatcher::FileMap files;
+
+    for (auto const &name : ap.existing_files()) {
+        std::string contents;
+
+        if (read_to_string(directory + "/" + name, &contents)
+                == ErrorCode::NoError) {
+            files.emplace(name, ScriptFile(std::move(contents)));
+        }
+    }
+
+    if (!ap.patch_data(files)) {
+        return false;
+    }
+
+    for (auto &[name, script] : files) {
+        if (write_from_string(directory + "/" + name, script.text())
+                != ErrorCode::NoError) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 }
@@ -20,6 +20,7 @@
 #include "mbpatcher/private/miniziputils.h"
 
 #include <algorithm>
+#include <optional>
 
 #include <cassert>
 #include <cerrno>
@@ -32,6 +33,7 @@
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/locale.h"
 
@@ -67,13 +69,121 @@ struct ZipCtx
     void *stream;
     void *buf_stream;
     void *handle;
+    // Parsed central directory of an archive opened for reading
+    std::optional<MinizipUtils::ZipEntryTable> entries;
 };
 
+const std::vector<MinizipUtils::ZipEntry> &
+MinizipUtils::ZipEntryTable::entries() const
+{
+    return m_entries;
+}
+
+/*!
+ * \brief Find entry by name
+ *
+ * \return Entry or nullptr if the archive does not contain \p name
+ */
+const MinizipUtils::ZipEntry *
+MinizipUtils::ZipEntryTable::find(std::string_view name) const
+{
+    if (auto it = m_index.find(name); it != m_index.end()) {
+        return &m_entries[it->second];
+    }
+    return nullptr;
+}
+
+/*!
+ * \brief Get number of entries and total uncompressed size
+ *
+ * \param ignore Names of entries to exclude from the totals
+ */
+MinizipUtils::ArchiveStats
+MinizipUtils::ZipEntryTable::stats(const std::vector<std::string> &ignore) const
+{
+    ArchiveStats stats{0, 0};
+
+    for (auto const &entry : m_entries) {
+        if (std::find(ignore.begin(), ignore.end(), entry.name) == ignore.end()) {
+            ++stats.files;
+            stats.total_size += entry.uncompressed_size;
+        }
+    }
+
+    return stats;
+}
+
+static bool read_entries(void *handle,
+                         std::vector<MinizipUtils::ZipEntry> &entries)
+{
+    mz_zip_file *file_info;
+
+    int ret = mz_zip_goto_first_entry(handle);
+    if (ret != MZ_OK && ret != MZ_END_OF_LIST) {
+        LOGE("minizip: Failed to move to first file: %d", ret);
+        return false;
+    }
+
+    if (ret != MZ_END_OF_LIST) {
+        do {
+            ret = mz_zip_entry_get_info(handle, &file_info);
+            if (ret != MZ_OK) {
+                LOGE("minizip: Failed to get inner file metadata: %d", ret);
+                return false;
+            }
+
+            entries.push_back({
+                {file_info->filename, file_info->filename_size},
+                static_cast<uint64_t>(file_info->compressed_size),
+                static_cast<uint64_t>(file_info->uncompressed_size),
+                mz_zip_get_entry(handle),
+            });
+        } while ((ret = mz_zip_goto_next_entry(handle)) == MZ_OK);
+
+        if (ret != MZ_END_OF_LIST) {
+            LOGE("minizip: Finished before EOF: %d", ret);
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void * MinizipUtils::ctx_get_zip_handle(ZipCtx *ctx)
 {
     return ctx->handle;
 }
 
+/*!
+ * \brief Get the entry table of an archive opened for reading
+ *
+ * The central directory is traversed once, on the first call. Afterwards,
+ * entries are looked up in the table and opened with goto_entry() instead of
+ * traversing the central directory again.
+ *
+ * \return Entry table or nullptr if the central directory could not be read
+ */
+const MinizipUtils::ZipEntryTable *
+MinizipUtils::ctx_get_entry_table(ZipCtx *ctx)
+{
+    if (!ctx->entries) {
+        auto &table = ctx->entries.emplace();
+
+        if (!read_entries(ctx->handle, table.m_entries)) {
+            ctx->entries.reset();
+            return nullptr;
+        }
+
+        // The names do not move once the vector is no longer modified
+        table.m_index.reserve(table.m_entries.size());
+        for (size_t i = 0; i < table.m_entries.size(); ++i) {
+            table.m_index.emplace(table.m_entries[i].name, i);
+        }
+    }
+
+    return &*ctx->entries;
+}
+
 ZipCtx * MinizipUtils::open_zip_file(std::string path, ZipOpenMode mode)
 {
     ZipCtx *ctx = new(std::nothrow) ZipCtx();
@@ -123,6 +233,11 @@ ZipCtx * MinizipUtils::open_zip_file(std::string path, ZipOpenMode mode)
         file_mode = zip_mode = MZ_OPEN_MODE_READWRITE;
         file_mode |= MZ_OPEN_MODE_CREATE;
         break;
+    case ZipOpenMode::Append:
+        // New entries overwrite the old central directory, which minizip
+        // keeps in memory and writes back out when the archive is closed
+        file_mode = zip_mode = MZ_OPEN_MODE_READWRITE | MZ_OPEN_MODE_APPEND;
+        break;
     default:
         return nullptr;
     }
@@ -158,53 +273,488 @@ int MinizipUtils::close_zip_file(ZipCtx *ctx)
     return ret;
 }
 
-ErrorCode MinizipUtils::archive_stats(const std::string &path,
-                                      MinizipUtils::ArchiveStats &stats,
-                                      const std::vector<std::string> &ignore)
+/*!
+ * \brief Make an entry from the entry table the current entry
+ */
+bool MinizipUtils::goto_entry(void *handle, const ZipEntry &entry)
 {
-    ZipCtx *ctx = open_zip_file(path, ZipOpenMode::Read);
-    if (!ctx) {
-        LOGE("minizip: Failed to open for reading: %s", path.c_str());
-        return ErrorCode::ArchiveReadOpenError;
+    int ret = mz_zip_goto_entry(handle, entry.cd_pos);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to move to file: %s: %d",
+             entry.name.c_str(), ret);
+        return false;
     }
 
-    auto close_ctx = finally([&] {
-        close_zip_file(ctx);
-    });
+    return true;
+}
 
-    uint64_t count = 0;
-    uint64_t total_size = 0;
-    mz_zip_file *file_info;
+// Zip structures used by copy_entries_raw()
+static constexpr uint32_t ZIP_CD_HEADER_SIG = 0x02014b50;
+static constexpr uint32_t ZIP_EOCD_SIG = 0x06054b50;
+static constexpr uint32_t ZIP64_EOCD_SIG = 0x06064b50;
+static constexpr uint32_t ZIP64_EOCD_LOCATOR_SIG = 0x07064b50;
+static constexpr size_t ZIP_CD_HEADER_SIZE = 46;
+static constexpr size_t ZIP_EOCD_SIZE = 22;
+static constexpr size_t ZIP_MAX_COMMENT_SIZE = UINT16_MAX;
+static constexpr size_t ZIP64_EOCD_SIZE = 56;
+static constexpr size_t ZIP64_EOCD_LOCATOR_SIZE = 20;
+static constexpr uint16_t ZIP64_EXTRA_ID = 0x0001;
+static constexpr uint16_t ZIP64_VERSION_NEEDED = 45;
+
+// Size of the buffer used for copying runs of entries
+static constexpr size_t RAW_COPY_BUFFER_SIZE = 4 * 1024 * 1024;
+
+static uint16_t get_le16(std::string_view buf, size_t pos)
+{
+    return static_cast<uint16_t>(
+            static_cast<unsigned char>(buf[pos])
+            | static_cast<unsigned char>(buf[pos + 1]) << 8);
+}
 
-    int ret = mz_zip_goto_first_entry(ctx->handle);
-    if (ret != MZ_OK && ret != MZ_END_OF_LIST) {
-        LOGE("minizip: Failed to move to first file: %d", ret);
-        return ErrorCode::ArchiveReadHeaderError;
+static uint32_t get_le32(std::string_view buf, size_t pos)
+{
+    return static_cast<uint32_t>(get_le16(buf, pos))
+            | static_cast<uint32_t>(get_le16(buf, pos + 2)) << 16;
+}
+
+static uint64_t get_le64(std::string_view buf, size_t pos)
+{
+    return static_cast<uint64_t>(get_le32(buf, pos))
+            | static_cast<uint64_t>(get_le32(buf, pos + 4)) << 32;
+}
+
+static void put_le(std::string &buf, size_t pos, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        buf[pos + i] = static_cast<char>((value >> (8 * i)) & 0xff);
     }
+}
 
-    if (ret != MZ_END_OF_LIST) {
-        do {
-            ret = mz_zip_entry_get_info(ctx->handle, &file_info);
-            if (ret != MZ_OK) {
-                LOGE("minizip: Failed to get inner file metadata: %d", ret);
-                return ErrorCode::ArchiveReadHeaderError;
-            }
+static void append_le(std::string &buf, uint64_t value, size_t size)
+{
+    buf.resize(buf.size() + size);
+    put_le(buf, buf.size() - size, value, size);
+}
+
+struct RawCdRecord
+{
+    // Complete central directory header, including the variable fields
+    std::string data;
+    // Local header offset and where it is stored in data
+    uint64_t local_offset;
+    size_t offset_pos;
+    size_t offset_size;
+    // End of the local entry (start of the next entry or of the central
+    // directory)
+    uint64_t local_end;
+};
 
-            std::string filename{file_info->filename, file_info->filename_size};
-            if (std::find(ignore.begin(), ignore.end(), filename) == ignore.end()) {
-                ++count;
-                total_size += file_info->uncompressed_size;
+static oc::result<void> read_exact_at(File &file, uint64_t offset,
+                                      std::string &buf, size_t size)
+{
+    buf.resize(size);
+
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+    return file_read_exact(file, buf.data(), size);
+}
+
+/*!
+ * \brief Find where the local header offset of a central directory header is
+ *        stored
+ *
+ * If the 32-bit field is saturated, the offset is in the zip64 extra field
+ * after the sizes that are also saturated.
+ */
+static bool find_local_offset(RawCdRecord &record)
+{
+    std::string_view data = record.data;
+
+    if (get_le32(data, 42) != UINT32_MAX) {
+        record.local_offset = get_le32(data, 42);
+        record.offset_pos = 42;
+        record.offset_size = 4;
+        return true;
+    }
+
+    size_t extra_pos = ZIP_CD_HEADER_SIZE + get_le16(data, 28);
+    size_t extra_end = extra_pos + get_le16(data, 30);
+
+    while (extra_pos + 4 <= extra_end) {
+        uint16_t id = get_le16(data, extra_pos);
+        uint16_t size = get_le16(data, extra_pos + 2);
+        size_t field_pos = extra_pos + 4;
+
+        if (field_pos + size > extra_end) {
+            break;
+        } else if (id == ZIP64_EXTRA_ID) {
+            if (get_le32(data, 24) == UINT32_MAX) {
+                field_pos += 8;
+            }
+            if (get_le32(data, 20) == UINT32_MAX) {
+                field_pos += 8;
+            }
+            if (field_pos + 8 > extra_pos + 4 + size) {
+                break;
             }
-        } while ((ret = mz_zip_goto_next_entry(ctx->handle)) == MZ_OK);
 
-        if (ret != MZ_END_OF_LIST) {
-            LOGE("minizip: Finished before EOF: %d", ret);
-            return ErrorCode::ArchiveReadHeaderError;
+            record.local_offset = get_le64(data, field_pos);
+            record.offset_pos = field_pos;
+            record.offset_size = 8;
+            return true;
+        }
+
+        extra_pos = field_pos + size;
+    }
+
+    return false;
+}
+
+/*!
+ * \brief Read the central directory headers of a zip file
+ *
+ * \return Whether the zip file is one that copy_entries_raw() can handle. Zip
+ *         files that are split, have data prepended to them, or are otherwise
+ *         unusual are left to minizip.
+ */
+static bool read_raw_cd(File &file, std::vector<RawCdRecord> &records)
+{
+    auto file_size = file.seek(0, SEEK_END);
+    if (!file_size) {
+        return false;
+    }
+
+    // Find the end of central directory record, which is followed by a
+    // comment of up to 64 KiB
+    std::string buf;
+    size_t tail_size = static_cast<size_t>(std::min<uint64_t>(
+            file_size.value(), ZIP_EOCD_SIZE + ZIP_MAX_COMMENT_SIZE));
+    uint64_t tail_offset = file_size.value() - tail_size;
+
+    if (!read_exact_at(file, tail_offset, buf, tail_size)) {
+        return false;
+    }
+
+    std::optional<size_t> eocd_pos;
+
+    for (size_t pos = tail_size; pos >= ZIP_EOCD_SIZE; --pos) {
+        size_t start = pos - ZIP_EOCD_SIZE;
+        if (get_le32(buf, start) == ZIP_EOCD_SIG
+                && start + ZIP_EOCD_SIZE + get_le16(buf, start + 20)
+                        == tail_size) {
+            eocd_pos = start;
+            break;
+        }
+    }
+
+    if (!eocd_pos || get_le16(buf, *eocd_pos + 4) != 0
+            || get_le16(buf, *eocd_pos + 6) != 0) {
+        return false;
+    }
+
+    uint64_t entries = get_le16(buf, *eocd_pos + 10);
+    uint64_t cd_size = get_le32(buf, *eocd_pos + 12);
+    uint64_t cd_offset = get_le32(buf, *eocd_pos + 16);
+    uint64_t eocd_offset = tail_offset + *eocd_pos;
+
+    if (entries == UINT16_MAX || cd_size == UINT32_MAX
+            || cd_offset == UINT32_MAX) {
+        std::string zip64;
+
+        if (eocd_offset < ZIP64_EOCD_LOCATOR_SIZE || !read_exact_at(
+                file, eocd_offset - ZIP64_EOCD_LOCATOR_SIZE, zip64,
+                ZIP64_EOCD_LOCATOR_SIZE)
+                || get_le32(zip64, 0) != ZIP64_EOCD_LOCATOR_SIG
+                || get_le32(zip64, 4) != 0) {
+            return false;
+        }
+
+        if (!read_exact_at(file, get_le64(zip64, 8), zip64, ZIP64_EOCD_SIZE)
+                || get_le32(zip64, 0) != ZIP64_EOCD_SIG
+                || get_le32(zip64, 16) != 0 || get_le32(zip64, 20) != 0) {
+            return false;
+        }
+
+        entries = get_le64(zip64, 32);
+        cd_size = get_le64(zip64, 40);
+        cd_offset = get_le64(zip64, 48);
+    }
+
+    if (cd_offset + cd_size > eocd_offset
+            || !read_exact_at(file, cd_offset, buf,
+                              static_cast<size_t>(cd_size))) {
+        return false;
+    }
+
+    records.clear();
+
+    for (size_t pos = 0; pos < buf.size();) {
+        if (pos + ZIP_CD_HEADER_SIZE > buf.size()
+                || get_le32(buf, pos) != ZIP_CD_HEADER_SIG
+                || get_le16(buf, pos + 34) != 0) {
+            return false;
+        }
+
+        size_t size = ZIP_CD_HEADER_SIZE + get_le16(buf, pos + 28)
+                + get_le16(buf, pos + 30) + get_le16(buf, pos + 32);
+        if (pos + size > buf.size()) {
+            return false;
+        }
+
+        auto &record = records.emplace_back();
+        record.data = buf.substr(pos, size);
+
+        if (!find_local_offset(record) || record.local_offset >= cd_offset) {
+            return false;
+        }
+
+        pos += size;
+    }
+
+    if (records.size() != entries) {
+        return false;
+    }
+
+    // Each local entry extends to the next one
+    std::vector<RawCdRecord *> sorted;
+    for (auto &record : records) {
+        sorted.push_back(&record);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) {
+        return a->local_offset < b->local_offset;
+    });
+
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        sorted[i]->local_end = i + 1 < sorted.size()
+                ? sorted[i + 1]->local_offset : cd_offset;
+        if (sorted[i]->local_end == sorted[i]->local_offset) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Copy a byte range between files with a large buffer
+ */
+static oc::result<void> copy_range(File &input, File &output, uint64_t offset,
+                                   uint64_t size, std::string &buf,
+                                   const std::function<bool(uint64_t)> &cb)
+{
+    OUTCOME_TRYV(input.seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf.size()));
+
+        OUTCOME_TRYV(file_read_exact(input, buf.data(), n));
+        OUTCOME_TRYV(file_write_exact(output, buf.data(), n));
+
+        size -= n;
+
+        if (cb && !cb(n)) {
+            return std::errc::operation_canceled;
         }
     }
 
-    stats.files = count;
-    stats.total_size = total_size;
+    return oc::success();
+}
+
+/*!
+ * \brief Copy entries of a zip file into a new zip file as raw byte ranges
+ *
+ * Runs of consecutive local entries (local header, data, and data descriptor)
+ * that pass \p filter are each copied as one contiguous byte range. Only the
+ * local header offsets in the copied central directory headers are rewritten.
+ * The output is a complete zip file that can be opened in
+ * ZipOpenMode::Append mode to add the remaining entries.
+ *
+ * If the input cannot be handled (eg. split archives or archives with data
+ * prepended to them), nothing is copied and the output file is not touched.
+ *
+ * \param table Entry table of the input zip
+ * \param input_path Input zip path
+ * \param output_path Output zip path
+ * \param filter Returns whether an entry can be copied unmodified
+ * \param cb Called with the estimated uncompressed size of the data copied
+ *           since the previous call. Copying is cancelled if it returns false.
+ * \param copied Whether each entry in \p table was copied
+ *
+ * \return ErrorCode::NoError if the entries were copied or if the input is not
+ *         supported. Otherwise, the error that occurred.
+ */
+ErrorCode MinizipUtils::copy_entries_raw(
+        const ZipEntryTable &table, const std::string &input_path,
+        const std::string &output_path,
+        const std::function<bool(const ZipEntry &entry)> &filter,
+        const std::function<bool(uint64_t bytes)> &cb,
+        std::vector<bool> &copied)
+{
+    auto const &entries = table.entries();
+
+    copied.assign(entries.size(), false);
+
+    StandardFile input;
+
+    if (auto r = FileUtils::open_file(input, input_path,
+                                      FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open for reading: %s",
+             input_path.c_str(), r.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    std::vector<RawCdRecord> records;
+
+    if (!read_raw_cd(input, records) || records.size() != entries.size()) {
+        LOGW("%s: Cannot copy raw entries from zip", input_path.c_str());
+        return ErrorCode::NoError;
+    }
+
+    // Copy in the order of the local entries
+    std::vector<size_t> order;
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        auto const &data = records[i].data;
+        std::string_view name(data.data() + ZIP_CD_HEADER_SIZE,
+                              get_le16(data, 28));
+
+        if (name != entries[i].name) {
+            LOGW("%s: Central directory does not match minizip's",
+                 input_path.c_str());
+            return ErrorCode::NoError;
+        }
+
+        if (filter(entries[i])) {
+            order.push_back(i);
+        }
+    }
+
+    if (order.empty()) {
+        return ErrorCode::NoError;
+    }
+
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return records[a].local_offset < records[b].local_offset;
+    });
+
+    StandardFile output;
+
+    if (auto r = FileUtils::open_file(output, output_path,
+                                      FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             output_path.c_str(), r.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    std::string buf(RAW_COPY_BUFFER_SIZE, '\0');
+    uint64_t out_offset = 0;
+
+    for (size_t i = 0; i < order.size();) {
+        // Extend the run while the next entry immediately follows
+        size_t j = i + 1;
+        while (j < order.size() && records[order[j]].local_offset
+                == records[order[j - 1]].local_end) {
+            ++j;
+        }
+
+        uint64_t run_start = records[order[i]].local_offset;
+        uint64_t run_size = records[order[j - 1]].local_end - run_start;
+        uint64_t run_uncompressed = 0;
+
+        for (size_t k = i; k < j; ++k) {
+            auto &record = records[order[k]];
+
+            put_le(record.data, record.offset_pos,
+                   out_offset + (record.local_offset - run_start),
+                   record.offset_size);
+            run_uncompressed += entries[order[k]].uncompressed_size;
+        }
+
+        // Scale the progress to the uncompressed size
+        uint64_t run_copied = 0;
+        uint64_t run_reported = 0;
+
+        auto run_cb = [&](uint64_t n) {
+            run_copied += n;
+            auto value = static_cast<uint64_t>(
+                    static_cast<double>(run_copied)
+                    / static_cast<double>(run_size)
+                    * static_cast<double>(run_uncompressed));
+            if (run_copied == run_size) {
+                value = run_uncompressed;
+            }
+            bool ret = !cb || cb(value - run_reported);
+            run_reported = value;
+            return ret;
+        };
+
+        if (auto r = copy_range(input, output, run_start, run_size, buf,
+                                run_cb); !r) {
+            if (r.error() == std::errc::operation_canceled) {
+                return ErrorCode::PatchingCancelled;
+            }
+            LOGE("%s: Failed to copy raw entries to %s: %s",
+                 input_path.c_str(), output_path.c_str(),
+                 r.error().message().c_str());
+            return ErrorCode::FileWriteError;
+        }
+
+        out_offset += run_size;
+        i = j;
+    }
+
+    // Write the central directory and the end of central directory records
+    uint64_t cd_offset = out_offset;
+    std::string trailer;
+
+    for (size_t i : order) {
+        trailer += records[i].data;
+        copied[i] = true;
+    }
+
+    uint64_t cd_size = trailer.size();
+    uint64_t count = order.size();
+
+    if (count >= UINT16_MAX || cd_size >= UINT32_MAX
+            || cd_offset >= UINT32_MAX) {
+        uint64_t zip64_offset = cd_offset + cd_size;
+
+        append_le(trailer, ZIP64_EOCD_SIG, 4);
+        append_le(trailer, ZIP64_EOCD_SIZE - 12, 8);
+        append_le(trailer, ZIP64_VERSION_NEEDED, 2);
+        append_le(trailer, ZIP64_VERSION_NEEDED, 2);
+        append_le(trailer, 0, 4);
+        append_le(trailer, 0, 4);
+        append_le(trailer, count, 8);
+        append_le(trailer, count, 8);
+        append_le(trailer, cd_size, 8);
+        append_le(trailer, cd_offset, 8);
+
+        append_le(trailer, ZIP64_EOCD_LOCATOR_SIG, 4);
+        append_le(trailer, 0, 4);
+        append_le(trailer, zip64_offset, 8);
+        append_le(trailer, 1, 4);
+    }
+
+    append_le(trailer, ZIP_EOCD_SIG, 4);
+    append_le(trailer, 0, 2);
+    append_le(trailer, 0, 2);
+    append_le(trailer, std::min<uint64_t>(count, UINT16_MAX), 2);
+    append_le(trailer, std::min<uint64_t>(count, UINT16_MAX), 2);
+    append_le(trailer, std::min<uint64_t>(cd_size, UINT32_MAX), 4);
+    append_le(trailer, std::min<uint64_t>(cd_offset, UINT32_MAX), 4);
+    append_le(trailer, 0, 2);
+
+    if (auto r = file_write_exact(output, trailer.data(), trailer.size()); !r) {
+        LOGE("%s: Failed to write central directory: %s",
+             output_path.c_str(), r.error().message().c_str());
+        return ErrorCode::FileWriteError;
+    }
+
+    if (auto r = output.close(); !r) {
+        LOGE("%s: Failed to close file: %s",
+             output_path.c_str(), r.error().message().c_str());
+        return ErrorCode::FileCloseError;
+    }
 
     return ErrorCode::NoError;
 }
@@ -429,12 +979,14 @@ bool MinizipUtils::extract_file(void *handle, const std::string &directory)
 
 ErrorCode MinizipUtils::add_file_from_data(void *handle,
                                            const std::string &name,
-                                           const std::string &data)
+                                           std::string_view data,
+                                           time_t modified_date)
 {
     mz_zip_file file_info = {};
     file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
     file_info.filename = name.c_str();
     file_info.filename_size = static_cast<uint16_t>(name.size());
+    file_info.modified_date = modified_date;
 
     int ret = mz_zip_entry_write_open(handle, &file_info,
                                       MZ_COMPRESS_LEVEL_DEFAULT, nullptr);
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbpatcher/private/paralleldeflate.h"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "mbcommon/finally.h"
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbpatcher/private/paralleldeflate"
+
+
+namespace mb::patcher
+{
+
+// Amount of uncompressed data deflated by each worker at a time
+static constexpr size_t BLOCK_SIZE = 128 * 1024;
+// Size of the deflate window, which is also the maximum dictionary size
+static constexpr size_t DICT_SIZE = 32 * 1024;
+
+/*!
+ * \brief Deflate one block of a raw deflate stream
+ *
+ * \param dict Up to 32 KiB of input preceding \p input
+ * \param input Block to compress
+ * \param last Whether this is the last block of the stream
+ * \param level zlib compression level
+ * \param output Raw deflate output
+ */
+static bool deflate_block(const std::string &dict, const std::string &input,
+                          bool last, int level, std::string &output)
+{
+    z_stream zs = {};
+
+    if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        LOGE("Failed to initialize deflate stream");
+        return false;
+    }
+
+    auto end_stream = finally([&] {
+        deflateEnd(&zs);
+    });
+
+    if (!dict.empty() && deflateSetDictionary(
+            &zs, reinterpret_cast<const Bytef *>(dict.data()),
+            static_cast<uInt>(dict.size())) != Z_OK) {
+        LOGE("Failed to set deflate dictionary");
+        return false;
+    }
+
+    // Every block except the last is flushed to a byte boundary without
+    // marking the end of the deflate stream
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    int ret;
+
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    zs.avail_in = static_cast<uInt>(input.size());
+
+    output.clear();
+
+    do {
+        size_t used = output.size();
+        size_t avail = deflateBound(&zs, static_cast<uLong>(input.size())) + 16;
+
+        output.resize(used + avail);
+        zs.next_out = reinterpret_cast<Bytef *>(output.data() + used);
+        zs.avail_out = static_cast<uInt>(avail);
+
+        ret = deflate(&zs, flush);
+        if (ret == Z_STREAM_ERROR) {
+            LOGE("Failed to deflate data");
+            return false;
+        }
+
+        output.resize(used + avail - zs.avail_out);
+    } while (zs.avail_out == 0);
+
+    if (zs.avail_in != 0 || (last && ret != Z_STREAM_END)) {
+        LOGE("Failed to deflate all data");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \class ParallelDeflater
+ *
+ * \brief Streaming raw deflate compressor that uses multiple threads
+ *
+ * The input is split into 128 KiB blocks that are deflated concurrently by a
+ * pool of worker threads. Each block uses the preceding 32 KiB of input as its
+ * dictionary and all but the last are flushed to a byte boundary, so the
+ * compressed blocks concatenate into a single deflate stream that can be
+ * stored in a zip entry as is. The CRC32 of the input is computed along the
+ * way.
+ *
+ * Compressed blocks are passed to the write callback on the thread that calls
+ * write() and finish(). The number of blocks in flight is bounded, so write()
+ * blocks when the workers fall behind.
+ */
+
+/*!
+ * \brief Construct a compressor and start the worker threads
+ *
+ * \param write_fn Function to call with each chunk of output
+ * \param threads Number of worker threads. 0 uses one thread per CPU.
+ * \param level zlib compression level
+ */
+ParallelDeflater::ParallelDeflater(WriteFn write_fn, unsigned int threads,
+                                   int level)
+    : m_write_fn(std::move(write_fn))
+    , m_level(level)
+    , m_stop(false)
+    , m_finished(false)
+    , m_crc(static_cast<uint32_t>(crc32(0L, Z_NULL, 0)))
+    , m_size(0)
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    m_max_jobs = threads * 2;
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_threads.emplace_back(&ParallelDeflater::worker, this);
+    }
+}
+
+/*!
+ * \brief Stop the worker threads
+ *
+ * If finish() was not called, any pending output is discarded.
+ */
+ParallelDeflater::~ParallelDeflater()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+/*!
+ * \brief Compress data
+ *
+ * \return Whether the data was queued and all compressed blocks that were
+ *         ready were written successfully
+ */
+bool ParallelDeflater::write(const void *data, size_t size)
+{
+    if (m_finished) {
+        LOGE("Deflate stream is already finished");
+        return false;
+    }
+
+    if (size > 0) {
+        m_pending.append(static_cast<const char *>(data), size);
+    }
+
+    // A block is only submitted once more data follows it because the last
+    // block must be compressed differently
+    while (m_pending.size() > BLOCK_SIZE) {
+        if (!submit(m_pending.substr(0, BLOCK_SIZE), false)) {
+            return false;
+        }
+        m_pending.erase(0, BLOCK_SIZE);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compress the remaining data and end the deflate stream
+ *
+ * This waits for all workers to finish. No more data can be written after this
+ * is called.
+ */
+bool ParallelDeflater::finish()
+{
+    if (!write(nullptr, 0)) {
+        return false;
+    }
+
+    m_finished = true;
+
+    return submit(std::move(m_pending), true) && drain(true);
+}
+
+/*!
+ * \brief CRC32 of the data that has been written out so far
+ */
+uint32_t ParallelDeflater::crc() const
+{
+    return m_crc;
+}
+
+/*!
+ * \brief Size of the uncompressed data that has been written out so far
+ */
+uint64_t ParallelDeflater::size() const
+{
+    return m_size;
+}
+
+bool ParallelDeflater::submit(std::string input, bool last)
+{
+    // Make room by writing out finished blocks
+    if (!drain(false)) {
+        return false;
+    }
+
+    std::string dict;
+    if (!last) {
+        dict = input.substr(input.size() - DICT_SIZE);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push_back({
+            std::move(m_dict), std::move(input), last, false, false, false,
+            {}, 0,
+        });
+    }
+    m_cv.notify_all();
+
+    m_dict = std::move(dict);
+
+    return true;
+}
+
+/*!
+ * \brief Write finished blocks in order
+ *
+ * \param all Wait for all blocks instead of only waiting for enough blocks to
+ *            finish to allow another one to be submitted
+ */
+bool ParallelDeflater::drain(bool all)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_jobs.empty()) {
+        if (!m_jobs.front().done) {
+            if (!all && m_jobs.size() < m_max_jobs) {
+                break;
+            }
+
+            m_cv.wait(lock, [&] { return m_jobs.front().done; });
+        }
+
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+
+        if (!job.ok) {
+            return false;
+        }
+
+        m_crc = static_cast<uint32_t>(crc32_combine(
+                m_crc, job.crc, static_cast<z_off_t>(job.input.size())));
+        m_size += job.input.size();
+
+        if (!m_write_fn(job.output.data(), job.output.size())) {
+            return false;
+        }
+
+        lock.lock();
+    }
+
+    return true;
+}
+
+void ParallelDeflater::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        auto it = m_jobs.end();
+
+        m_cv.wait(lock, [&] {
+            it = std::find_if(m_jobs.begin(), m_jobs.end(),
+                              [](const Job &j) { return !j.taken; });
+            return m_stop || it != m_jobs.end();
+        });
+
+        if (m_stop) {
+            return;
+        }
+
+        // References to deque elements stay valid while other elements are
+        // added to the back or removed from the front
+        Job &job = *it;
+        job.taken = true;
+        lock.unlock();
+
+        job.crc = static_cast<uint32_t>(crc32(
+                0L, reinterpret_cast<const Bytef *>(job.input.data()),
+                static_cast<uInt>(job.input.size())));
+        bool ok = deflate_block(job.dict, job.input, job.last, m_level,
+                                job.output);
+
+        lock.lock();
+        job.ok = ok;
+        job.done = true;
+        m_cv.notify_all();
+    }
+}
+
+}
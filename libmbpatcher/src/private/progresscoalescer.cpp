@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/progresscoalescer.h"
+
+#include <utility>
+
+
+namespace mb::patcher
+{
+
+ProgressState::ProgressState()
+    : m_seq(0)
+    , m_bytes(0)
+    , m_max_bytes(0)
+    , m_files(0)
+    , m_max_files(0)
+{
+}
+
+void ProgressState::begin_write()
+{
+    m_seq.store(m_seq.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ProgressState::end_write()
+{
+    m_seq.store(m_seq.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+}
+
+void ProgressState::set_progress(uint64_t bytes, uint64_t max_bytes)
+{
+    begin_write();
+    m_bytes.store(bytes, std::memory_order_relaxed);
+    m_max_bytes.store(max_bytes, std::memory_order_relaxed);
+    end_write();
+}
+
+void ProgressState::set_files(uint64_t files, uint64_t max_files)
+{
+    begin_write();
+    m_files.store(files, std::memory_order_relaxed);
+    m_max_files.store(max_files, std::memory_order_relaxed);
+    end_write();
+}
+
+void ProgressState::set_details(const std::string &text)
+{
+    std::lock_guard<std::mutex> lock(m_details_lock);
+    m_details = text;
+}
+
+ProgressState::Snapshot ProgressState::snapshot() const
+{
+    Snapshot result;
+    uint64_t seq_begin;
+    uint64_t seq_end;
+
+    do {
+        seq_begin = m_seq.load(std::memory_order_acquire);
+
+        result.bytes = m_bytes.load(std::memory_order_relaxed);
+        result.max_bytes = m_max_bytes.load(std::memory_order_relaxed);
+        result.files = m_files.load(std::memory_order_relaxed);
+        result.max_files = m_max_files.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq_end = m_seq.load(std::memory_order_relaxed);
+    } while ((seq_begin & 1) || seq_begin != seq_end);
+
+    result.generation = seq_begin / 2;
+
+    return result;
+}
+
+std::string ProgressState::details() const
+{
+    std::lock_guard<std::mutex> lock(m_details_lock);
+    return m_details;
+}
+
+ProgressCoalescer::ProgressCoalescer(const Options &options,
+                                     Patcher::ProgressUpdatedCallback progress_cb,
+                                     Patcher::FilesUpdatedCallback files_cb,
+                                     Patcher::DetailsUpdatedCallback details_cb)
+    : m_options(options)
+    , m_progress_cb(std::move(progress_cb))
+    , m_files_cb(std::move(files_cb))
+    , m_details_cb(std::move(details_cb))
+    , m_progress()
+    , m_files()
+    , m_details_pending(false)
+    , m_details_reported(false)
+{
+}
+
+bool ProgressCoalescer::should_report(const Channel &channel,
+                                      uint64_t min_delta,
+                                      Clock::time_point now) const
+{
+    if (!channel.reported || channel.max_value != channel.reported_max_value) {
+        return true;
+    }
+
+    if (channel.value == channel.reported_value) {
+        return false;
+    } else if (channel.value == channel.max_value) {
+        return true;
+    }
+
+    uint64_t delta = channel.value > channel.reported_value
+            ? channel.value - channel.reported_value
+            : channel.reported_value - channel.value;
+
+    return delta >= min_delta
+            && now - channel.reported_time >= m_options.min_interval;
+}
+
+void ProgressCoalescer::update_progress(uint64_t bytes, uint64_t max_bytes)
+{
+    auto now = Clock::now();
+
+    m_progress.value = bytes;
+    m_progress.max_value = max_bytes;
+
+    if (!should_report(m_progress, m_options.min_bytes_delta, now)) {
+        m_progress.pending = true;
+        return;
+    }
+
+    m_progress.pending = false;
+    m_progress.reported = true;
+    m_progress.reported_value = bytes;
+    m_progress.reported_max_value = max_bytes;
+    m_progress.reported_time = now;
+
+    if (m_progress_cb) {
+        m_progress_cb(bytes, max_bytes);
+    }
+}
+
+void ProgressCoalescer::update_files(uint64_t files, uint64_t max_files)
+{
+    auto now = Clock::now();
+
+    m_files.value = files;
+    m_files.max_value = max_files;
+
+    if (!should_report(m_files, m_options.min_files_delta, now)) {
+        m_files.pending = true;
+        return;
+    }
+
+    m_files.pending = false;
+    m_files.reported = true;
+    m_files.reported_value = files;
+    m_files.reported_max_value = max_files;
+    m_files.reported_time = now;
+
+    if (m_files_cb) {
+        m_files_cb(files, max_files);
+    }
+}
+
+void ProgressCoalescer::update_details(const std::string &text)
+{
+    auto now = Clock::now();
+
+    if (m_details_reported
+            && now - m_details_time < m_options.min_interval) {
+        m_details = text;
+        m_details_pending = true;
+        return;
+    }
+
+    m_details_pending = false;
+    m_details_reported = true;
+    m_details_time = now;
+
+    if (m_details_cb) {
+        m_details_cb(text);
+    }
+}
+
+void ProgressCoalescer::flush()
+{
+    if (m_progress.pending) {
+        m_progress.pending = false;
+        m_progress.reported_value = m_progress.value;
+        m_progress.reported_max_value = m_progress.max_value;
+
+        if (m_progress_cb) {
+            m_progress_cb(m_progress.value, m_progress.max_value);
+        }
+    }
+
+    if (m_files.pending) {
+        m_files.pending = false;
+        m_files.reported_value = m_files.value;
+        m_files.reported_max_value = m_files.max_value;
+
+        if (m_files_cb) {
+            m_files_cb(m_files.value, m_files.max_value);
+        }
+    }
+
+    if (m_details_pending) {
+        m_details_pending = false;
+
+        if (m_details_cb) {
+            m_details_cb(m_details);
+        }
+    }
+}
+
+}
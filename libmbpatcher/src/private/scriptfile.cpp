@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/scriptfile.h"
+
+#include "mbcommon/string.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class ScriptFile
+ * \brief In-memory file shared by the AutoPatchers
+ *
+ * The contents are stored either as a single string or as a list of lines,
+ * depending on what the last AutoPatcher to edit the file needed. The
+ * contents are only converted when an AutoPatcher asks for the other form, so
+ * a script that is only ever edited line by line is split once when it is
+ * first patched and joined once when it is written to the output.
+ */
+
+ScriptFile::ScriptFile()
+    : m_split(false)
+{
+}
+
+ScriptFile::ScriptFile(std::string contents)
+    : m_split(false)
+    , m_text(std::move(contents))
+{
+}
+
+/*!
+ * \brief Get the contents as a single string
+ *
+ * The returned reference can be modified. It is invalidated by a call to
+ * lines().
+ */
+std::string & ScriptFile::text()
+{
+    if (m_split) {
+        m_text = join(m_lines, '\n');
+        m_lines.clear();
+        m_split = false;
+    }
+
+    return m_text;
+}
+
+/*!
+ * \brief Get the contents as a list of lines
+ *
+ * The lines do not include the newline characters. If the contents end with a
+ * newline, the last line is empty. The returned reference can be modified. It
+ * is invalidated by a call to text().
+ */
+std::vector<std::string> & ScriptFile::lines()
+{
+    if (!m_split) {
+        m_lines = split(m_text, '\n');
+        m_text.clear();
+        m_split = true;
+    }
+
+    return m_lines;
+}
+
+/*!
+ * \brief Check if the contents start with a prefix without converting them
+ */
+bool ScriptFile::starts_with(std::string_view prefix) const
+{
+    if (!m_split) {
+        return mb::starts_with(m_text, prefix);
+    }
+
+    for (auto it = m_lines.begin(); it != m_lines.end(); ++it) {
+        if (it != m_lines.begin()) {
+            if (prefix.empty()) {
+                return true;
+            } else if (prefix.front() != '\n') {
+                return false;
+            }
+            prefix.remove_prefix(1);
+        }
+
+        if (prefix.size() <= it->size()) {
+            return mb::starts_with(*it, prefix);
+        } else if (!mb::starts_with(prefix, *it)) {
+            return false;
+        }
+
+        prefix.remove_prefix(it->size());
+    }
+
+    return prefix.empty();
+}
+
+}
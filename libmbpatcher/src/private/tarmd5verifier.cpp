@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/tarmd5verifier.h"
+
+#include <algorithm>
+#include <string_view>
+
+#include <cctype>
+
+#include "mbcommon/string.h"
+
+
+namespace mb::patcher
+{
+
+// Size of each read buffer
+static constexpr size_t BUFFER_SIZE = 256 * 1024;
+// Bytes held back from the hash. This must be larger than the trailer line.
+static constexpr size_t TAIL_SIZE = 4096;
+// Length of an MD5 digest in hex
+static constexpr size_t MD5_HEX_SIZE = MD5_DIGEST_LENGTH * 2;
+
+TarMd5Verifier::TarMd5Verifier()
+    : m_busy()
+    , m_next(0)
+    , m_stop(false)
+{
+    for (auto &buf : m_bufs) {
+        buf = std::make_unique<unsigned char[]>(BUFFER_SIZE);
+    }
+
+    MD5_Init(&m_ctx);
+
+    m_thread = std::thread(&TarMd5Verifier::worker, this);
+}
+
+TarMd5Verifier::~TarMd5Verifier()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+/*!
+ * \brief Get the buffer to read the next block into
+ *
+ * This waits for the hashing thread if it has not finished with the buffer.
+ */
+unsigned char * TarMd5Verifier::next_buffer()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    size_t index = m_next;
+    m_cv.wait(lock, [&] { return !m_busy[index]; });
+
+    m_next = (m_next + 1) % m_bufs.size();
+
+    return m_bufs[index].get();
+}
+
+size_t TarMd5Verifier::buffer_size() const
+{
+    return BUFFER_SIZE;
+}
+
+/*!
+ * \brief Queue a buffer returned by next_buffer() for hashing
+ *
+ * \param buf Buffer returned by next_buffer()
+ * \param size Number of bytes in \p buf
+ */
+void TarMd5Verifier::submit(const unsigned char *buf, size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    auto it = std::find_if(m_bufs.begin(), m_bufs.end(),
+                           [&](auto const &b) { return b.get() == buf; });
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto index = static_cast<size_t>(it - m_bufs.begin());
+        m_busy[index] = true;
+        m_queue.push_back({index, size});
+    }
+    m_cv.notify_all();
+}
+
+/*!
+ * \brief Wait for all data to be hashed and check the trailer
+ *
+ * No more data may be submitted after this is called.
+ *
+ * \return Result::Match or Result::Mismatch if a trailer was found or
+ *         Result::NoChecksum if the stream does not end with a trailer
+ */
+TarMd5Verifier::Result TarMd5Verifier::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+
+    // The trailer is the last line and follows the tar's NUL padding
+    if (m_tail.size() < 2 || m_tail.back() != '\n') {
+        return Result::NoChecksum;
+    }
+
+    auto pos = m_tail.find_last_of(std::string("\n\0", 2), m_tail.size() - 2);
+    size_t start = pos == std::string::npos ? 0 : pos + 1;
+
+    std::string_view line(m_tail);
+    line = line.substr(start, line.size() - start - 1);
+
+    if (line.size() <= MD5_HEX_SIZE + 1 || line[MD5_HEX_SIZE] != ' '
+            || !std::all_of(line.begin(), line.begin() + MD5_HEX_SIZE,
+                            [](char c) { return isxdigit(c); })) {
+        return Result::NoChecksum;
+    }
+
+    m_expected = line.substr(0, MD5_HEX_SIZE);
+    std::transform(m_expected.begin(), m_expected.end(), m_expected.begin(),
+                   [](char c) { return static_cast<char>(tolower(c)); });
+
+    MD5_Update(&m_ctx, m_tail.data(), start);
+
+    unsigned char digest[MD5_DIGEST_LENGTH];
+    MD5_Final(digest, &m_ctx);
+
+    m_actual.clear();
+    for (auto b : digest) {
+        m_actual += format("%02x", b);
+    }
+
+    return m_actual == m_expected ? Result::Match : Result::Mismatch;
+}
+
+//! Expected digest from the trailer (valid after finish())
+const std::string & TarMd5Verifier::expected() const
+{
+    return m_expected;
+}
+
+//! Digest of the data (valid after finish())
+const std::string & TarMd5Verifier::actual() const
+{
+    return m_actual;
+}
+
+void TarMd5Verifier::hash(const unsigned char *data, size_t size)
+{
+    if (size >= TAIL_SIZE) {
+        // Everything before the new tail has definitely not been the trailer
+        MD5_Update(&m_ctx, m_tail.data(), m_tail.size());
+        MD5_Update(&m_ctx, data, size - TAIL_SIZE);
+        m_tail.assign(reinterpret_cast<const char *>(data) + size - TAIL_SIZE,
+                      TAIL_SIZE);
+    } else {
+        m_tail.append(reinterpret_cast<const char *>(data), size);
+
+        if (m_tail.size() > TAIL_SIZE) {
+            size_t excess = m_tail.size() - TAIL_SIZE;
+            MD5_Update(&m_ctx, m_tail.data(), excess);
+            m_tail.erase(0, excess);
+        }
+    }
+}
+
+void TarMd5Verifier::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_cv.wait(lock, [&] { return m_stop || !m_queue.empty(); });
+
+        if (m_queue.empty()) {
+            break;
+        }
+
+        Block block = m_queue.front();
+        m_queue.pop_front();
+
+        lock.unlock();
+        hash(m_bufs[block.index].get(), block.size);
+        lock.lock();
+
+        m_busy[block.index] = false;
+        m_cv.notify_all();
+    }
+}
+
+}
@@ -31,70 +31,187 @@ namespace mb::io::win32
 {
 
 using ScopedFindHandle = std::unique_ptr<std::remove_pointer_t<HANDLE>, decltype(FindClose) *>;
+using ScopedHandle = std::unique_ptr<std::remove_pointer_t<HANDLE>, decltype(CloseHandle) *>;
 
-static oc::result<void> _win32_recursive_delete(const std::wstring &path)
+// FileDispositionInfoEx is missing from older SDKs and MinGW
+static constexpr auto FILE_DISPOSITION_INFO_EX_CLASS =
+        static_cast<FILE_INFO_BY_HANDLE_CLASS>(21);
+static constexpr DWORD DISPOSITION_FLAG_DELETE = 0x1;
+static constexpr DWORD DISPOSITION_FLAG_POSIX_SEMANTICS = 0x2;
+static constexpr DWORD DISPOSITION_FLAG_IGNORE_READONLY_ATTRIBUTE = 0x10;
+
+struct DispositionInfoEx
+{
+    DWORD Flags;
+};
+
+struct DeleteContext
+{
+    // Whether FileDispositionInfoEx with POSIX semantics works. With POSIX
+    // semantics, the name is removed immediately, even if another process
+    // (eg. an antivirus scanner) still has the file open. Otherwise, the
+    // parent directory cannot be removed until those handles are closed.
+    bool posix_semantics = true;
+};
+
+static oc::result<ScopedHandle> _win32_open_for_delete(const std::wstring &path)
+{
+    // Symlinks and junctions are opened instead of their targets
+    HANDLE handle = CreateFileW(
+        path.c_str(),                           // lpFileName
+        DELETE | FILE_WRITE_ATTRIBUTES,         // dwDesiredAccess
+        FILE_SHARE_READ | FILE_SHARE_WRITE
+                | FILE_SHARE_DELETE,            // dwShareMode
+        nullptr,                                // lpSecurityAttributes
+        OPEN_EXISTING,                          // dwCreationDisposition
+        FILE_FLAG_BACKUP_SEMANTICS
+                | FILE_FLAG_OPEN_REPARSE_POINT, // dwFlagsAndAttributes
+        nullptr                                 // hTemplateFile
+    );
+    if (handle == INVALID_HANDLE_VALUE) {
+        return ec_from_win32();
+    }
+
+    return ScopedHandle(handle, &CloseHandle);
+}
+
+static oc::result<void> _win32_mark_for_deletion(DeleteContext &ctx,
+                                                 HANDLE handle,
+                                                 DWORD attributes)
+{
+    if (ctx.posix_semantics) {
+        DispositionInfoEx info;
+        info.Flags = DISPOSITION_FLAG_DELETE
+                | DISPOSITION_FLAG_POSIX_SEMANTICS
+                | DISPOSITION_FLAG_IGNORE_READONLY_ATTRIBUTE;
+
+        if (SetFileInformationByHandle(handle, FILE_DISPOSITION_INFO_EX_CLASS,
+                                       &info, sizeof(info))) {
+            return oc::success();
+        }
+
+        // Windows versions before 10 1607 and some file systems (eg. FAT32)
+        // do not support this
+        if (auto error = GetLastError(); error != ERROR_INVALID_PARAMETER
+                && error != ERROR_NOT_SUPPORTED
+                && error != ERROR_INVALID_FUNCTION) {
+            return ec_from_win32(error);
+        }
+
+        ctx.posix_semantics = false;
+    }
+
+    // Read-only files cannot be deleted with FileDispositionInfo
+    if (attributes & FILE_ATTRIBUTE_READONLY) {
+        FILE_BASIC_INFO basic_info = {};
+        basic_info.FileAttributes = attributes & ~(FILE_ATTRIBUTE_READONLY
+                | FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_REPARSE_POINT);
+        if (basic_info.FileAttributes == 0) {
+            basic_info.FileAttributes = FILE_ATTRIBUTE_NORMAL;
+        }
+
+        if (!SetFileInformationByHandle(handle, FileBasicInfo, &basic_info,
+                                        sizeof(basic_info))) {
+            return ec_from_win32();
+        }
+    }
+
+    FILE_DISPOSITION_INFO info;
+    info.DeleteFile = TRUE;
+
+    if (!SetFileInformationByHandle(handle, FileDispositionInfo, &info,
+                                    sizeof(info))) {
+        return ec_from_win32();
+    }
+
+    return oc::success();
+}
+
+static oc::result<void> _win32_recursive_delete(DeleteContext &ctx,
+                                                const std::wstring &path,
+                                                DWORD attributes);
+
+static oc::result<void> _win32_delete_contents(DeleteContext &ctx,
+                                               const std::wstring &path)
 {
     std::wstring mask(path);
     mask += L"\\*";
 
     WIN32_FIND_DATAW find_data;
 
-    // First, delete the contents of the directory, recursively for subdirectories
+    // Skip the short names and fetch the entries in larger batches
     HANDLE _search_handle = FindFirstFileExW(
-        mask.c_str(),           // lpFileName
-        FindExInfoBasic,        // fInfoLevelId
-        &find_data,             // lpFindFileData
-        FindExSearchNameMatch,  // fSearchOp
-        nullptr,                // lpSearchFilter
-        0                       // dwAdditionalFlags
+        mask.c_str(),               // lpFileName
+        FindExInfoBasic,            // fInfoLevelId
+        &find_data,                 // lpFindFileData
+        FindExSearchNameMatch,      // fSearchOp
+        nullptr,                    // lpSearchFilter
+        FIND_FIRST_EX_LARGE_FETCH   // dwAdditionalFlags
     );
     if (_search_handle == INVALID_HANDLE_VALUE) {
         if (auto error = GetLastError(); error != ERROR_FILE_NOT_FOUND) {
             return ec_from_win32(error);
         }
-    } else {
-        ScopedFindHandle search_handle(_search_handle, &FindClose);
-
-        while (true) {
-            if (wcscmp(find_data.cFileName, L".") != 0
-                    && wcscmp(find_data.cFileName, L"..") != 0) {
-                bool is_directory = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-                        || (find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
-                std::wstring child_path(path);
-                child_path += L'\\';
-                child_path += find_data.cFileName;
-
-                if (is_directory) {
-                    OUTCOME_TRYV(_win32_recursive_delete(child_path));
-                } else {
-                    if (!DeleteFileW(child_path.c_str())) {
-                        return ec_from_win32();
-                    }
-                }
-            }
+        return oc::success();
+    }
+
+    ScopedFindHandle search_handle(_search_handle, &FindClose);
+    std::wstring child_path(path);
+    child_path += L'\\';
+    auto prefix_size = child_path.size();
+
+    while (true) {
+        if (wcscmp(find_data.cFileName, L".") != 0
+                && wcscmp(find_data.cFileName, L"..") != 0) {
+            child_path.resize(prefix_size);
+            child_path += find_data.cFileName;
 
-            // Advance to the next file in the directory
-            if (!FindNextFileW(search_handle.get(), &find_data)) {
-                if (auto error = GetLastError(); error != ERROR_NO_MORE_FILES) {
-                    return ec_from_win32(error);
-                }
-                break;
+            OUTCOME_TRYV(_win32_recursive_delete(
+                    ctx, child_path, find_data.dwFileAttributes));
+        }
+
+        // Advance to the next file in the directory
+        if (!FindNextFileW(search_handle.get(), &find_data)) {
+            if (auto error = GetLastError(); error != ERROR_NO_MORE_FILES) {
+                return ec_from_win32(error);
             }
+            break;
         }
     }
 
-    if (!RemoveDirectoryW(path.c_str())) {
-        return ec_from_win32();
+    return oc::success();
+}
+
+static oc::result<void> _win32_recursive_delete(DeleteContext &ctx,
+                                                const std::wstring &path,
+                                                DWORD attributes)
+{
+    // The handle is kept open while the contents are deleted so that the
+    // directory itself is deleted through it. The deletion takes effect when
+    // the handle is closed.
+    OUTCOME_TRY(handle, _win32_open_for_delete(path));
+
+    // Directory symlinks and junctions are deleted without following them
+    if ((attributes & FILE_ATTRIBUTE_DIRECTORY)
+            && !(attributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+        OUTCOME_TRYV(_win32_delete_contents(ctx, path));
     }
 
-    return oc::success();
+    return _win32_mark_for_deletion(ctx, handle.get(), attributes);
 }
 
 oc::result<void> delete_recursively(const std::string &path)
 {
     OUTCOME_TRY(w_path, mb::utf8_to_wcs(path));
 
-    return _win32_recursive_delete(w_path);
+    DWORD attributes = GetFileAttributesW(w_path.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        return ec_from_win32();
+    }
+
+    DeleteContext ctx;
+
+    return _win32_recursive_delete(ctx, w_path, attributes);
 }
 
 }
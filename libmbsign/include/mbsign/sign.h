@@ -21,7 +21,10 @@
 
 #include "mbcommon/common.h"
 
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <openssl/evp.h>
 
@@ -53,4 +56,25 @@ sign_data(BIO &bio_data_in, BIO &bio_sig_out, EVP_PKEY &pkey);
 MB_EXPORT Result<void>
 verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey);
 
+MB_EXPORT Result<void>
+sign_file(const char *path, const char *sig_path, EVP_PKEY &pkey);
+MB_EXPORT Result<void>
+verify_file(const char *path, const char *sig_path, EVP_PKEY &pkey);
+
+struct BatchFile
+{
+    std::string path;
+    std::string sig_path;
+};
+
+using BatchCallback =
+        std::function<void(size_t index, const Result<void> &result)>;
+
+MB_EXPORT bool
+sign_files(const std::vector<BatchFile> &files, EVP_PKEY &pkey,
+           unsigned int threads, const BatchCallback &cb);
+MB_EXPORT bool
+verify_files(const std::vector<BatchFile> &files, EVP_PKEY &pkey,
+             unsigned int threads, const BatchCallback &cb);
+
 }
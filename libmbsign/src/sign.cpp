@@ -19,9 +19,15 @@
 
 #include "mbsign/sign.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include <cstdio>
 #include <cstring>
 
 #ifdef __clang__
@@ -34,6 +40,7 @@
 #ifdef OPENSSL_IS_BORINGSSL
 #include <openssl/mem.h>
 #endif
+#include <openssl/err.h>
 #include <openssl/pem.h>
 #include <openssl/pkcs12.h>
 
@@ -49,6 +56,9 @@ constexpr size_t MAGIC_SIZE                 = 8;
 constexpr uint32_t VERSION_1_SHA512_DGST    = 1u;
 constexpr uint32_t VERSION_LATEST           = VERSION_1_SHA512_DGST;
 
+// Read size for sign_file() and verify_file()
+constexpr size_t FILE_BUF_SIZE              = 1024 * 1024;
+
 // NOTE: All integers are stored in little endian form
 struct SigHeader
 {
@@ -65,6 +75,7 @@ template <typename T>
 using ScopedMallocable = std::unique_ptr<T, decltype(free) *>;
 
 using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 using ScopedPKCS12 = std::unique_ptr<PKCS12, decltype(PKCS12_free) *>;
 
 /*!
@@ -505,4 +516,271 @@ verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey)
     }
 }
 
+static void md_ctx_free(EVP_MD_CTX *ctx) noexcept
+{
+    EVP_MD_CTX_destroy(ctx);
+}
+
+using ScopedEVP_MD_CTX = std::unique_ptr<EVP_MD_CTX, decltype(md_ctx_free) *>;
+
+/*!
+ * \brief Feed the contents of a file to a sign or verify context
+ *
+ * \param fp Input file
+ * \param mctx Context initialized with EVP_DigestSignInit() (if \a sign is
+ *             true) or EVP_DigestVerifyInit()
+ * \param sign Whether \a mctx is a signing context
+ */
+static Result<void> digest_file(FILE *fp, EVP_MD_CTX *mctx, bool sign)
+{
+    std::vector<unsigned char> buf(FILE_BUF_SIZE);
+
+    while (true) {
+        size_t n = fread(buf.data(), 1, buf.size(), fp);
+        if (n > 0) {
+            int ret = sign
+                    ? EVP_DigestSignUpdate(mctx, buf.data(), n)
+                    : EVP_DigestVerifyUpdate(mctx, buf.data(), n);
+            if (!ret) {
+                return ErrorInfo{Error::OpensslError, true};
+            }
+        }
+        if (n < buf.size()) {
+            if (ferror(fp)) {
+                return ErrorInfo{Error::IoError, false};
+            }
+            break;
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Sign a file
+ *
+ * This produces the same signature as sign_data(), but reads the file in large
+ * chunks and feeds them directly to the signing context.
+ *
+ * \param path Path of file to sign
+ * \param sig_path Path of output signature file
+ * \param pkey Private key
+ *
+ * \return Whether the signing operation was successful
+ */
+Result<void> sign_file(const char *path, const char *sig_path, EVP_PKEY &pkey)
+{
+    ScopedFILE fp(fopen(path, "rb"), fclose);
+    if (!fp) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    ScopedEVP_MD_CTX mctx(EVP_MD_CTX_create(), md_ctx_free);
+    if (!mctx) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    if (!EVP_DigestSignInit(mctx.get(), nullptr, EVP_sha512(), nullptr,
+                            &pkey)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    OUTCOME_TRYV(digest_file(fp.get(), mctx.get(), true));
+
+    size_t len;
+    if (!EVP_DigestSignFinal(mctx.get(), nullptr, &len)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    std::vector<unsigned char> sig(len);
+    if (!EVP_DigestSignFinal(mctx.get(), sig.data(), &len)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    SigHeader hdr = {};
+    memcpy(hdr.magic, MAGIC, MAGIC_SIZE);
+    hdr.version = VERSION_LATEST;
+
+    ScopedFILE fp_sig(fopen(sig_path, "wb"), fclose);
+    if (!fp_sig) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp_sig.get()) != 1
+            || fwrite(sig.data(), 1, len, fp_sig.get()) != len
+            || fclose(fp_sig.release()) != 0) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Verify signature of a file
+ *
+ * \param path Path of file to verify
+ * \param sig_path Path of signature file
+ * \param pkey Public key
+ *
+ * \return Whether the verification operation completed successfully. If the
+ *         signature is invalid, the error code will be set to
+ *         Error::BadSignature.
+ */
+Result<void>
+verify_file(const char *path, const char *sig_path, EVP_PKEY &pkey)
+{
+    // Read signature
+    std::vector<unsigned char> sig(static_cast<size_t>(EVP_PKEY_size(&pkey)));
+    SigHeader hdr;
+    size_t siglen;
+
+    {
+        ScopedFILE fp_sig(fopen(sig_path, "rb"), fclose);
+        if (!fp_sig) {
+            return ErrorInfo{Error::IoError, false};
+        }
+
+        if (fread(&hdr, sizeof(hdr), 1, fp_sig.get()) != 1) {
+            return ErrorInfo{Error::IoError, false};
+        }
+
+        if (memcmp(hdr.magic, MAGIC, MAGIC_SIZE) != 0) {
+            return ErrorInfo{Error::InvalidSignatureMagic, false};
+        }
+
+        if (hdr.version != VERSION_1_SHA512_DGST) {
+            return ErrorInfo{Error::InvalidSignatureVersion, false};
+        }
+
+        siglen = fread(sig.data(), 1, sig.size(), fp_sig.get());
+        if (siglen == 0 || ferror(fp_sig.get())) {
+            return ErrorInfo{Error::IoError, false};
+        }
+    }
+
+    ScopedFILE fp(fopen(path, "rb"), fclose);
+    if (!fp) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    ScopedEVP_MD_CTX mctx(EVP_MD_CTX_create(), md_ctx_free);
+    if (!mctx) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    if (!EVP_DigestVerifyInit(mctx.get(), nullptr, EVP_sha512(), nullptr,
+                              &pkey)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    OUTCOME_TRYV(digest_file(fp.get(), mctx.get(), false));
+
+    int n = EVP_DigestVerifyFinal(mctx.get(), sig.data(), siglen);
+    if (n == 1) {
+        return oc::success();
+    } else if (n == 0) {
+        return ErrorInfo{Error::BadSignature, false};
+    } else {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+}
+
+/*!
+ * \brief Run \a fn on every file using a pool of threads
+ *
+ * \return Whether \a fn succeeded for every file
+ */
+template<typename Fn>
+static bool run_batch(const std::vector<BatchFile> &files,
+                      unsigned int threads, const BatchCallback &cb, Fn fn)
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = static_cast<unsigned int>(
+            std::min<size_t>(threads, std::max<size_t>(files.size(), 1)));
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    std::mutex cb_mutex;
+
+    auto worker = [&] {
+        for (size_t i; (i = next++) < files.size();) {
+            auto const &file = files[i];
+            auto ret = fn(file.path.c_str(), file.sig_path.c_str());
+
+            if (!ret) {
+                ok = false;
+            }
+
+            if (cb) {
+                std::lock_guard<std::mutex> lock(cb_mutex);
+                cb(i, ret);
+            }
+
+            // The error queue is per thread. Anything left over belongs to
+            // this file only.
+            ERR_clear_error();
+        }
+    };
+
+    if (threads == 1) {
+        worker();
+    } else {
+        std::vector<std::thread> pool;
+        pool.reserve(threads);
+
+        for (unsigned int i = 0; i < threads; ++i) {
+            pool.emplace_back(worker);
+        }
+        for (auto &t : pool) {
+            t.join();
+        }
+    }
+
+    return ok;
+}
+
+/*!
+ * \brief Sign several files concurrently
+ *
+ * Each file is signed with sign_file().
+ *
+ * \param files List of files to sign and their output signature paths
+ * \param pkey Private key. It is shared by all threads and must not be
+ *             modified until this function returns.
+ * \param threads Number of threads to use (0 to use one per CPU)
+ * \param cb Callback invoked with the index and result of each file once it is
+ *           processed. Calls are serialized, but happen on the thread that
+ *           processed the file, so OpenSSL's error queue for that file can be
+ *           inspected from the callback.
+ *
+ * \return Whether all files were signed successfully
+ */
+bool sign_files(const std::vector<BatchFile> &files, EVP_PKEY &pkey,
+                unsigned int threads, const BatchCallback &cb)
+{
+    return run_batch(files, threads, cb,
+                     [&pkey](const char *path, const char *sig_path) {
+        return sign_file(path, sig_path, pkey);
+    });
+}
+
+/*!
+ * \brief Verify the signatures of several files concurrently
+ *
+ * Each file is verified with verify_file(). See sign_files() for the meaning
+ * of the parameters.
+ *
+ * \return Whether all signatures were verified to be valid
+ */
+bool verify_files(const std::vector<BatchFile> &files, EVP_PKEY &pkey,
+                  unsigned int threads, const BatchCallback &cb)
+{
+    return run_batch(files, threads, cb,
+                     [&pkey](const char *path, const char *sig_path) {
+        return verify_file(path, sig_path, pkey);
+    });
+}
+
 }
@@ -20,6 +20,10 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <string>
+#include <vector>
+
+#include <cstdio>
 
 #include <openssl/err.h>
 #include <openssl/pem.h>
@@ -173,3 +177,98 @@ TEST(SignTest, TestLoadValidPemKeysWithInvalidPassphrase)
     auto private_key_read = load_private_key(*bio, KeyFormat::Pem, "gnitset");
     ASSERT_FALSE(private_key_read);
 }
+
+static void write_test_file(const std::string &path, const std::string &data)
+{
+    FILE *fp = fopen(path.c_str(), "wb");
+    ASSERT_NE(fp, nullptr) << "Failed to open " << path;
+    ASSERT_EQ(fwrite(data.data(), 1, data.size(), fp), data.size());
+    ASSERT_EQ(fclose(fp), 0);
+}
+
+struct SignFilesTest : testing::Test
+{
+    ScopedEVP_PKEY m_private_key{nullptr, EVP_PKEY_free};
+    ScopedEVP_PKEY m_public_key{nullptr, EVP_PKEY_free};
+    std::vector<BatchFile> m_files;
+
+    void SetUp() override
+    {
+        generate_keys(m_private_key, m_public_key);
+
+        // Includes an empty file and files larger than the read buffer
+        for (size_t i = 0; i < 8; ++i) {
+            std::string path = "mbsign_test_file_" + std::to_string(i);
+            std::string data(i * 300 * 1024 + i, static_cast<char>('a' + i));
+
+            m_files.push_back({path, path + ".sig"});
+            write_test_file(path, data);
+        }
+    }
+
+    void TearDown() override
+    {
+        for (auto const &file : m_files) {
+            std::remove(file.path.c_str());
+            std::remove(file.sig_path.c_str());
+        }
+    }
+};
+
+TEST_F(SignFilesTest, SignAndVerifyFiles)
+{
+    std::vector<int> calls(m_files.size());
+
+    ASSERT_TRUE(sign_files(m_files, *m_private_key, 4,
+                           [&](size_t i, const Result<void> &ret) {
+        ++calls[i];
+        EXPECT_TRUE(ret) << m_files[i].path << ": " << ret.error().ec.message();
+    }));
+    ASSERT_EQ(calls, std::vector<int>(m_files.size(), 1));
+
+    ASSERT_TRUE(verify_files(m_files, *m_public_key, 4, nullptr));
+
+    // Signatures are compatible with the BIO-based API
+    for (auto const &file : m_files) {
+        ScopedBIO bio_data(BIO_new_file(file.path.c_str(), "rb"), BIO_free);
+        ASSERT_TRUE(!!bio_data);
+        ScopedBIO bio_sig(BIO_new_file(file.sig_path.c_str(), "rb"), BIO_free);
+        ASSERT_TRUE(!!bio_sig);
+
+        ASSERT_TRUE(verify_data(*bio_data, *bio_sig, *m_public_key))
+                << file.path;
+    }
+}
+
+TEST_F(SignFilesTest, VerifyModifiedFile)
+{
+    ASSERT_TRUE(sign_files(m_files, *m_private_key, 0, nullptr));
+
+    write_test_file(m_files[3].path, "modified");
+
+    std::vector<int> calls(m_files.size());
+
+    ASSERT_FALSE(verify_files(m_files, *m_public_key, 3,
+                              [&](size_t i, const Result<void> &ret) {
+        ++calls[i];
+        if (i == 3) {
+            ASSERT_FALSE(ret);
+            ASSERT_EQ(ret.error().ec, Error::BadSignature);
+        } else {
+            ASSERT_TRUE(ret) << m_files[i].path;
+        }
+    }));
+    ASSERT_EQ(calls, std::vector<int>(m_files.size(), 1));
+}
+
+TEST_F(SignFilesTest, MissingFile)
+{
+    auto files = m_files;
+    files.push_back({"mbsign_test_nonexistent", "mbsign_test_nonexistent.sig"});
+
+    ASSERT_FALSE(sign_files(files, *m_private_key, 2, nullptr));
+
+    // All other files are still signed
+    ASSERT_TRUE(verify_files(m_files, *m_public_key, 2, nullptr));
+}
+
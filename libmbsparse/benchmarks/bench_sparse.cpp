@@ -0,0 +1,838 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/integer.h"
+
+#include "mbsparse/sparse.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+
+// Synthetic images
+
+enum class Mix
+{
+    // Mostly fill chunks (eg. a freshly formatted filesystem)
+    Fill,
+    // Mostly raw chunks (eg. a full system image)
+    Raw,
+    // Equal parts raw, fill, and don't care chunks
+    Mixed,
+};
+
+static constexpr Mix ALL_MIXES[] = {
+    Mix::Fill,
+    Mix::Raw,
+    Mix::Mixed,
+};
+
+static const char *mix_name(Mix mix)
+{
+    switch (mix) {
+    case Mix::Fill:
+        return "fill";
+    case Mix::Raw:
+        return "raw";
+    case Mix::Mixed:
+        return "mixed";
+    default:
+        return "unknown";
+    }
+}
+
+static std::optional<Mix> name_to_mix(const char *name)
+{
+    for (auto mix : ALL_MIXES) {
+        if (strcmp(name, mix_name(mix)) == 0) {
+            return mix;
+        }
+    }
+
+    return std::nullopt;
+}
+
+static constexpr Seekability ALL_SEEKABILITIES[] = {
+    Seekability::CanSeek,
+    Seekability::CanSkip,
+    Seekability::CanRead,
+};
+
+static const char *seekability_name(Seekability seekability)
+{
+    switch (seekability) {
+    case Seekability::CanSeek:
+        return "seek";
+    case Seekability::CanSkip:
+        return "skip";
+    case Seekability::CanRead:
+        return "read";
+    default:
+        return "unknown";
+    }
+}
+
+/*!
+ * \brief Sparse image that is generated on the fly
+ *
+ * Only the chunk layout is kept in memory, so multi-gigabyte images with tens
+ * of thousands of chunks can be benchmarked without touching the disk. Raw
+ * chunk data is a per-chunk byte value.
+ */
+class GeneratedImage : public File
+{
+public:
+    GeneratedImage(Mix mix, uint64_t size, uint32_t chunks, uint64_t seed)
+        : m_pos(0)
+        , m_cur(0)
+    {
+        generate(mix, size, chunks, seed);
+    }
+
+    oc::result<void> close() override
+    {
+        return oc::success();
+    }
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        auto ptr = static_cast<unsigned char *>(buf);
+        size_t total = 0;
+
+        // Sparse header
+        if (m_pos < sizeof(m_shdr) && size > 0) {
+            auto n = std::min<size_t>(size, sizeof(m_shdr) - m_pos);
+            memcpy(ptr, reinterpret_cast<const unsigned char *>(&m_shdr)
+                   + m_pos, n);
+            ptr += n;
+            size -= n;
+            total += n;
+            m_pos += n;
+        }
+
+        while (size > 0 && m_pos < m_src_size) {
+            auto &chunk = chunk_at(m_pos);
+            auto rel = m_pos - chunk.src_begin;
+            auto avail = chunk.src_end - m_pos;
+            size_t n;
+
+            if (rel < sizeof(ChunkHeader)) {
+                ChunkHeader chdr = {};
+                chdr.chunk_type = mb_htole16(chunk.type);
+                chdr.chunk_sz = mb_htole32(chunk.blocks);
+                chdr.total_sz = mb_htole32(static_cast<uint32_t>(
+                        chunk.src_end - chunk.src_begin));
+
+                n = std::min<size_t>(size, sizeof(chdr) - rel);
+                memcpy(ptr, reinterpret_cast<const unsigned char *>(&chdr)
+                       + rel, n);
+            } else if (chunk.type == CHUNK_TYPE_FILL) {
+                auto fill_val = mb_htole32(chunk.value);
+                auto data_rel = rel - sizeof(ChunkHeader);
+
+                n = std::min<size_t>(size, sizeof(fill_val) - data_rel);
+                memcpy(ptr, reinterpret_cast<const unsigned char *>(&fill_val)
+                       + data_rel, n);
+            } else {
+                n = static_cast<size_t>(std::min<uint64_t>(size, avail));
+                memset(ptr, static_cast<unsigned char>(chunk.value), n);
+            }
+
+            ptr += n;
+            size -= n;
+            total += n;
+            m_pos += n;
+        }
+
+        return total;
+    }
+
+    oc::result<size_t> write(const void *buf, size_t size) override
+    {
+        (void) buf;
+        (void) size;
+        return FileError::UnsupportedWrite;
+    }
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        uint64_t base;
+
+        switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = m_pos;
+            break;
+        case SEEK_END:
+            base = m_src_size;
+            break;
+        default:
+            return FileError::ArgumentOutOfRange;
+        }
+
+        if (offset < 0 && static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        m_pos = base + static_cast<uint64_t>(offset);
+        return m_pos;
+    }
+
+    oc::result<void> truncate(uint64_t size) override
+    {
+        (void) size;
+        return FileError::UnsupportedTruncate;
+    }
+
+    bool is_open() override
+    {
+        return true;
+    }
+
+    uint64_t source_size() const
+    {
+        return m_src_size;
+    }
+
+private:
+    struct Chunk
+    {
+        uint16_t type;
+        uint32_t blocks;
+        uint32_t value;
+        uint64_t src_begin;
+        uint64_t src_end;
+    };
+
+    void generate(Mix mix, uint64_t size, uint32_t chunks, uint64_t seed)
+    {
+        std::mt19937_64 rng(seed);
+
+        auto total_blocks = static_cast<uint32_t>(size / BLOCK_SIZE);
+        chunks = std::clamp<uint32_t>(chunks, 1, total_blocks);
+
+        // Pick random chunk boundaries
+        std::vector<uint32_t> bounds;
+        std::uniform_int_distribution<uint32_t> bound_dist(1, total_blocks - 1);
+
+        bounds.reserve(chunks + 1);
+        while (bounds.size() < chunks - 1) {
+            bounds.push_back(bound_dist(rng));
+            if (bounds.size() == chunks - 1) {
+                std::sort(bounds.begin(), bounds.end());
+                bounds.erase(std::unique(bounds.begin(), bounds.end()),
+                             bounds.end());
+            }
+        }
+        bounds.insert(bounds.begin(), 0);
+        bounds.push_back(total_blocks);
+
+        std::uniform_int_distribution<unsigned int> type_dist(0, 9);
+        uint64_t src_offset = sizeof(SparseHeader);
+        uint16_t prev_type = 0;
+
+        m_chunks.reserve(bounds.size() - 1);
+
+        for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+            auto roll = type_dist(rng);
+            uint16_t type;
+
+            switch (mix) {
+            case Mix::Fill:
+                type = roll < 9 ? CHUNK_TYPE_FILL : CHUNK_TYPE_RAW;
+                break;
+            case Mix::Raw:
+                type = roll < 9 ? CHUNK_TYPE_RAW : CHUNK_TYPE_FILL;
+                break;
+            default:
+                type = roll < 3 ? CHUNK_TYPE_RAW
+                        : roll < 6 ? CHUNK_TYPE_FILL
+                        : CHUNK_TYPE_DONT_CARE;
+                break;
+            }
+
+            // Real images never contain consecutive don't care chunks
+            if (type == CHUNK_TYPE_DONT_CARE && prev_type == type) {
+                type = CHUNK_TYPE_FILL;
+            }
+            prev_type = type;
+
+            Chunk chunk;
+            chunk.type = type;
+            chunk.blocks = bounds[i + 1] - bounds[i];
+            chunk.value = static_cast<uint32_t>(rng());
+            chunk.src_begin = src_offset;
+            chunk.src_end = src_offset + sizeof(ChunkHeader);
+
+            if (type == CHUNK_TYPE_RAW) {
+                chunk.src_end += static_cast<uint64_t>(chunk.blocks)
+                        * BLOCK_SIZE;
+            } else if (type == CHUNK_TYPE_FILL) {
+                chunk.src_end += sizeof(uint32_t);
+            }
+
+            src_offset = chunk.src_end;
+            m_chunks.push_back(chunk);
+        }
+
+        m_src_size = src_offset;
+
+        m_shdr = {};
+        m_shdr.magic = mb_htole32(SPARSE_HEADER_MAGIC);
+        m_shdr.major_version = mb_htole16(SPARSE_HEADER_MAJOR_VER);
+        m_shdr.minor_version = mb_htole16(0);
+        m_shdr.file_hdr_sz = mb_htole16(sizeof(SparseHeader));
+        m_shdr.chunk_hdr_sz = mb_htole16(sizeof(ChunkHeader));
+        m_shdr.blk_sz = mb_htole32(BLOCK_SIZE);
+        m_shdr.total_blks = mb_htole32(total_blocks);
+        m_shdr.total_chunks = mb_htole32(
+                static_cast<uint32_t>(m_chunks.size()));
+        m_shdr.image_checksum = mb_htole32(0);
+    }
+
+    const Chunk & chunk_at(uint64_t offset)
+    {
+        // Sequential reads stay in the current or next chunk
+        if (offset >= m_chunks[m_cur].src_begin) {
+            if (offset < m_chunks[m_cur].src_end) {
+                return m_chunks[m_cur];
+            } else if (m_cur + 1 < m_chunks.size()
+                    && offset < m_chunks[m_cur + 1].src_end) {
+                return m_chunks[++m_cur];
+            }
+        }
+
+        auto it = std::upper_bound(
+                m_chunks.begin(), m_chunks.end(), offset,
+                [](uint64_t o, const Chunk &c) { return o < c.src_end; });
+        m_cur = static_cast<size_t>(it - m_chunks.begin());
+
+        return *it;
+    }
+
+    SparseHeader m_shdr;
+    std::vector<Chunk> m_chunks;
+    uint64_t m_src_size;
+    uint64_t m_pos;
+    size_t m_cur;
+};
+
+/*!
+ * \brief Wrapper that restricts the seek operations of a file
+ *
+ * This makes SparseFile use the code paths for pipes (CanRead) and for files
+ * that can only skip forward (CanSkip).
+ */
+class SeekLimitedFile : public File
+{
+public:
+    SeekLimitedFile(File &file, Seekability seekability)
+        : m_file(file)
+        , m_seekability(seekability)
+    {
+    }
+
+    oc::result<void> close() override
+    {
+        return oc::success();
+    }
+
+    oc::result<size_t> read(void *buf, size_t size) override
+    {
+        return m_file.read(buf, size);
+    }
+
+    oc::result<size_t> write(const void *buf, size_t size) override
+    {
+        (void) buf;
+        (void) size;
+        return FileError::UnsupportedWrite;
+    }
+
+    oc::result<uint64_t> seek(int64_t offset, int whence) override
+    {
+        switch (m_seekability) {
+        case Seekability::CanSeek:
+            return m_file.seek(offset, whence);
+        case Seekability::CanSkip:
+            if (whence == SEEK_CUR && offset >= 0) {
+                return m_file.seek(offset, whence);
+            }
+            break;
+        default:
+            break;
+        }
+
+        return FileError::UnsupportedSeek;
+    }
+
+    oc::result<void> truncate(uint64_t size) override
+    {
+        (void) size;
+        return FileError::UnsupportedTruncate;
+    }
+
+    bool is_open() override
+    {
+        return true;
+    }
+
+private:
+    File &m_file;
+    Seekability m_seekability;
+};
+
+// Benchmarks
+
+struct Options
+{
+    uint64_t image_size = 1024 * 1024 * 1024;
+    uint32_t chunks = 20000;
+    unsigned int iterations = 3;
+    unsigned int random_ops = 10000;
+    size_t read_buf_size = 1024 * 1024;
+    std::vector<Mix> mixes;
+    std::vector<Seekability> seekabilities;
+    std::vector<std::string> corpus;
+};
+
+struct Result
+{
+    double seconds = 0;
+    uint64_t bytes = 0;
+    bool ok = true;
+};
+
+template<typename Fn>
+static Result measure(unsigned int iterations, Fn fn)
+{
+    Result result;
+    std::chrono::duration<double> total{};
+
+    for (unsigned int i = 0; i < iterations; ++i) {
+        uint64_t bytes = 0;
+        auto start = Clock::now();
+
+        if (!fn(bytes)) {
+            result.ok = false;
+            return result;
+        }
+
+        total += Clock::now() - start;
+        result.bytes = bytes;
+    }
+
+    result.seconds = total.count() / iterations;
+
+    return result;
+}
+
+/*!
+ * \brief Rewind the source file and open it with the specified seekability
+ */
+static bool open_sparse(File &source, Seekability seekability,
+                        std::unique_ptr<SeekLimitedFile> &limited,
+                        SparseFile &sparse)
+{
+    if (!source.seek(0, SEEK_SET)) {
+        return false;
+    }
+
+    limited = std::make_unique<SeekLimitedFile>(source, seekability);
+
+    return !!sparse.open(limited.get());
+}
+
+static Result bench_open(const Options &opts, File &source)
+{
+    return measure(opts.iterations, [&](uint64_t &) {
+        std::unique_ptr<SeekLimitedFile> limited;
+        SparseFile sparse;
+
+        return open_sparse(source, Seekability::CanSeek, limited, sparse);
+    });
+}
+
+static Result bench_decode(const Options &opts, File &source,
+                           Seekability seekability)
+{
+    std::vector<unsigned char> buf(opts.read_buf_size);
+
+    return measure(opts.iterations, [&](uint64_t &bytes) {
+        std::unique_ptr<SeekLimitedFile> limited;
+        SparseFile sparse;
+
+        if (!open_sparse(source, seekability, limited, sparse)) {
+            return false;
+        }
+
+        while (true) {
+            auto n = sparse.read(buf.data(), buf.size());
+            if (!n) {
+                return false;
+            } else if (n.value() == 0) {
+                break;
+            }
+            bytes += n.value();
+        }
+
+        return bytes == sparse.size();
+    });
+}
+
+/*!
+ * \brief Random seeks followed by a small read
+ *
+ * If \p warm is true, the chunk list is fully populated before the timer
+ * starts. Otherwise, chunks are discovered by move_to_chunk() as the seeks
+ * reach them.
+ */
+static Result bench_random_seek(const Options &opts, File &source, bool warm)
+{
+    std::unique_ptr<SeekLimitedFile> limited;
+    SparseFile sparse;
+
+    if (!open_sparse(source, Seekability::CanSeek, limited, sparse)) {
+        Result result;
+        result.ok = false;
+        return result;
+    }
+
+    auto image_size = sparse.size();
+    std::vector<uint64_t> offsets;
+    std::mt19937_64 rng(1234);
+    std::uniform_int_distribution<uint64_t> dist(
+            0, image_size > BLOCK_SIZE ? image_size - BLOCK_SIZE : 0);
+
+    offsets.reserve(opts.random_ops);
+    for (unsigned int i = 0; i < opts.random_ops; ++i) {
+        offsets.push_back(dist(rng));
+    }
+
+    if (warm && !sparse.seek(0, SEEK_END)) {
+        Result result;
+        result.ok = false;
+        return result;
+    }
+
+    unsigned char buf[BLOCK_SIZE];
+    bool first = true;
+
+    return measure(opts.iterations, [&](uint64_t &) {
+        // Cold runs need a fresh chunk list for every iteration
+        if (!warm && !first
+                && (!sparse.close() || !open_sparse(source,
+                        Seekability::CanSeek, limited, sparse))) {
+            return false;
+        }
+        first = false;
+
+        for (auto offset : offsets) {
+            if (!sparse.seek(static_cast<int64_t>(offset), SEEK_SET)
+                    || !sparse.read(buf, sizeof(buf))) {
+                return false;
+            }
+        }
+
+        return true;
+    });
+}
+
+/*!
+ * \brief Time to build the full chunk list by scanning versus loading a saved
+ *        index
+ */
+static Result bench_index(const Options &opts, File &source, bool load)
+{
+    std::vector<unsigned char> index;
+
+    if (load) {
+        std::unique_ptr<SeekLimitedFile> limited;
+        SparseFile sparse;
+
+        if (!open_sparse(source, Seekability::CanSeek, limited, sparse)) {
+            Result result;
+            result.ok = false;
+            return result;
+        }
+
+        auto data = sparse.save_index();
+        if (!data) {
+            Result result;
+            result.ok = false;
+            return result;
+        }
+
+        index = std::move(data.value());
+    }
+
+    return measure(opts.iterations, [&](uint64_t &) {
+        std::unique_ptr<SeekLimitedFile> limited;
+        SparseFile sparse;
+
+        if (!open_sparse(source, Seekability::CanSeek, limited, sparse)) {
+            return false;
+        }
+
+        if (load) {
+            return !!sparse.load_index(index.data(), index.size());
+        } else {
+            return !!sparse.seek(0, SEEK_END);
+        }
+    });
+}
+
+static void print_result(const char *image, const char *op,
+                         const char *seekability, const Result &result,
+                         uint64_t ops)
+{
+    if (!result.ok) {
+        printf("%-24s %-16s %-6s %12s\n", image, op, seekability, "FAILED");
+        return;
+    }
+
+    char rate[32] = "-";
+    if (ops > 0) {
+        snprintf(rate, sizeof(rate), "%.1fns/op",
+                 result.seconds * 1e9 / static_cast<double>(ops));
+    } else if (result.bytes > 0 && result.seconds > 0) {
+        snprintf(rate, sizeof(rate), "%.1fMiB/s",
+                 static_cast<double>(result.bytes) / (1024.0 * 1024.0)
+                 / result.seconds);
+    }
+
+    printf("%-24s %-16s %-6s %10.3fms %16s\n", image, op, seekability,
+           result.seconds * 1000, rate);
+}
+
+static bool run_image(const Options &opts, const char *name, File &source)
+{
+    bool ok = true;
+
+    auto report = [&](const char *op, const char *seekability,
+                      const Result &result, uint64_t ops) {
+        print_result(name, op, seekability, result, ops);
+        ok = ok && result.ok;
+    };
+
+    report("open", seekability_name(Seekability::CanSeek),
+           bench_open(opts, source), 0);
+
+    for (auto seekability : opts.seekabilities) {
+        report("decode", seekability_name(seekability),
+               bench_decode(opts, source, seekability), 0);
+    }
+
+    report("index_scan", seekability_name(Seekability::CanSeek),
+           bench_index(opts, source, false), 0);
+    report("index_load", seekability_name(Seekability::CanSeek),
+           bench_index(opts, source, true), 0);
+    report("random_seek_cold", seekability_name(Seekability::CanSeek),
+           bench_random_seek(opts, source, false), opts.random_ops);
+    report("random_seek_warm", seekability_name(Seekability::CanSeek),
+           bench_random_seek(opts, source, true), opts.random_ops);
+
+    return ok;
+}
+
+static void usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: mbsparse_benchmarks [<option>...] [<sparse image>...]\n"
+            "\n"
+            "Options:\n"
+            "  -s, --size <MiB>       Expanded size of the generated images\n"
+            "                         (default: 1024)\n"
+            "  -c, --chunks <n>       Chunks in the generated images\n"
+            "                         (default: 20000)\n"
+            "  -n, --iterations <n>   Iterations per measurement (default: 3)\n"
+            "  -r, --random-ops <n>   Seeks per random seek measurement\n"
+            "                         (default: 10000)\n"
+            "  -b, --buffer <KiB>     Read buffer size for decoding\n"
+            "                         (default: 1024)\n"
+            "  -m, --mix <mix>        fill, raw, or mixed (default: all)\n"
+            "                         (can be specified multiple times)\n"
+            "  -S, --seekability <s>  seek, skip, or read (default: all)\n"
+            "                         (can be specified multiple times)\n"
+            "\n"
+            "If sparse images are specified, they are benchmarked instead of\n"
+            "the generated images. Times are averages per iteration. Decode\n"
+            "rates are in terms of the expanded image size.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int opt;
+
+    static const char short_options[] = "s:c:n:r:b:m:S:h";
+
+    static const option long_options[] = {
+        {"size",        required_argument, nullptr, 's'},
+        {"chunks",      required_argument, nullptr, 'c'},
+        {"iterations",  required_argument, nullptr, 'n'},
+        {"random-ops",  required_argument, nullptr, 'r'},
+        {"buffer",      required_argument, nullptr, 'b'},
+        {"mix",         required_argument, nullptr, 'm'},
+        {"seekability", required_argument, nullptr, 'S'},
+        {"help",        no_argument,       nullptr, 'h'},
+        {nullptr,       0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 's': {
+            uint64_t mib;
+            // Block counts are 32-bit
+            if (!str_to_num(optarg, 10, mib) || mib == 0
+                    || mib > UINT32_MAX / (1024 * 1024 / BLOCK_SIZE)) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.image_size = mib * 1024 * 1024;
+            break;
+        }
+        case 'c':
+            if (!str_to_num(optarg, 10, opts.chunks) || opts.chunks == 0
+                    || opts.chunks >= UINT32_MAX) {
+                fprintf(stderr, "Invalid chunk count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            if (!str_to_num(optarg, 10, opts.iterations)
+                    || opts.iterations == 0) {
+                fprintf(stderr, "Invalid iterations: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r':
+            if (!str_to_num(optarg, 10, opts.random_ops)
+                    || opts.random_ops == 0) {
+                fprintf(stderr, "Invalid random operations: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'b': {
+            size_t kib;
+            if (!str_to_num(optarg, 10, kib) || kib == 0
+                    || kib > SIZE_MAX / 1024) {
+                fprintf(stderr, "Invalid buffer size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.read_buf_size = kib * 1024;
+            break;
+        }
+        case 'm':
+            if (auto m = name_to_mix(optarg)) {
+                opts.mixes.push_back(*m);
+            } else {
+                fprintf(stderr, "Invalid mix: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S': {
+            auto it = std::find_if(
+                    std::begin(ALL_SEEKABILITIES), std::end(ALL_SEEKABILITIES),
+                    [](Seekability s) {
+                        return strcmp(optarg, seekability_name(s)) == 0;
+                    });
+            if (it == std::end(ALL_SEEKABILITIES)) {
+                fprintf(stderr, "Invalid seekability: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.seekabilities.push_back(*it);
+            break;
+        }
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (int i = optind; i < argc; ++i) {
+        opts.corpus.emplace_back(argv[i]);
+    }
+
+    if (opts.mixes.empty()) {
+        opts.mixes.assign(std::begin(ALL_MIXES), std::end(ALL_MIXES));
+    }
+    if (opts.seekabilities.empty()) {
+        opts.seekabilities.assign(std::begin(ALL_SEEKABILITIES),
+                                  std::end(ALL_SEEKABILITIES));
+    }
+
+    printf("%-24s %-16s %-6s %12s %16s\n",
+           "image", "operation", "source", "time", "rate");
+
+    bool ok = true;
+
+    if (opts.corpus.empty()) {
+        for (auto mix : opts.mixes) {
+            GeneratedImage image(mix, opts.image_size, opts.chunks, 1234);
+
+            ok = run_image(opts, mix_name(mix), image) && ok;
+        }
+    } else {
+        for (auto const &path : opts.corpus) {
+            FdFile file;
+
+            if (auto r = file.open(path, FileOpenMode::ReadOnly); !r) {
+                fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                        path.c_str(), r.error().message().c_str());
+                ok = false;
+                continue;
+            }
+
+            ok = run_image(opts, path.c_str(), file) && ok;
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
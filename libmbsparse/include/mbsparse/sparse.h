@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include <optional>
 #include <vector>
 
 #include "mbcommon/file.h"
@@ -29,6 +30,26 @@
 namespace mb::sparse
 {
 
+enum class SparseExtentType
+{
+    // Data stored in the sparse file
+    Data,
+    // Range filled with a repeating 32-bit value
+    Fill,
+    // Range whose contents are unspecified ("don't care")
+    Hole,
+};
+
+struct SparseExtent
+{
+    SparseExtentType type;
+    // Byte range in the output file
+    uint64_t begin;
+    uint64_t end;
+    // [SparseExtentType::Fill only] Filler value in host byte order
+    uint32_t fill_val;
+};
+
 class MB_EXPORT SparseFile : public File
 {
 public:
@@ -51,11 +72,24 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence) override;
     oc::result<void> truncate(uint64_t size) override;
 
+    oc::result<size_t> read_at(uint64_t offset,
+                               void *buf, size_t size) override;
+
     bool is_open() override;
 
     // File size
     uint64_t size() noexcept;
 
+    // Chunk at the current file position
+    oc::result<std::optional<SparseExtent>> current_extent();
+
+    // Checksum verification
+    void set_verify_crc32(bool verify) noexcept;
+
+    // Chunk index
+    oc::result<std::vector<unsigned char>> save_index();
+    oc::result<void> load_index(const void *data, size_t size);
+
 private:
     void clear() noexcept;
 
@@ -85,12 +119,23 @@ private:
 
     oc::result<void> move_to_chunk(uint64_t offset) noexcept;
 
+    void update_crc32(uint64_t offset, const void *buf, size_t size) noexcept;
+    bool crc32_matches(uint64_t offset, uint32_t expected) const noexcept;
+
     File *m_file;
     detail::Seekability m_seekability;
+    // Position of the sparse data in the source file (if seekable)
+    uint64_t m_src_base_offset;
 
-    // Expected CRC32 checksum. We currently do *not* validate this. It would
-    // only work if the entire file was read sequentially anyway.
+    // Expected CRC32 checksum from the last CRC32 chunk
     uint32_t m_expected_crc32;
+    // Whether to verify checksums. This persists across open() calls.
+    bool m_verify_crc32 = false;
+    // CRC32 checksum of the data read so far. This is only valid if the file
+    // has been read sequentially from the beginning.
+    uint32_t m_crc32;
+    uint64_t m_crc32_offset;
+    bool m_crc32_valid;
     // Relative offset in input file
     uint64_t m_cur_src_offset;
     // Absolute offset in output file
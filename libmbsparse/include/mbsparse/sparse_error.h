@@ -44,6 +44,12 @@ enum class SparseFileError
     InvalidCrc32Chunk           = 36,
 
     InternalError               = 40,
+
+    // Verification errors
+    ChecksumMismatch            = 50,
+
+    // Chunk index errors
+    InvalidIndex                = 60,
 };
 
 MB_EXPORT std::error_code make_error_code(SparseFileError e);
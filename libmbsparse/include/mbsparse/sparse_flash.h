@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include "mbcommon/file.h"
+
+#include "mbsparse/sparse.h"
+
+namespace mb::sparse
+{
+
+/*!
+ * \brief Callbacks used by flash_sparse_file()
+ */
+struct SparseFlashCallbacks
+{
+    /*!
+     * \brief Called for holes. Returning false leaves the range untouched.
+     */
+    std::function<oc::result<bool>(uint64_t offset, uint64_t size)> discard;
+
+    /*!
+     * \brief Called for zero-filled ranges. Returning false makes
+     *        flash_sparse_file() write the zeros instead.
+     */
+    std::function<oc::result<bool>(uint64_t offset, uint64_t size)> zero_out;
+
+    /*!
+     * \brief Called as the output is written
+     */
+    std::function<void(uint64_t cur_bytes, uint64_t max_bytes)> progress;
+};
+
+MB_EXPORT oc::result<void>
+flash_sparse_file(SparseFile &sparse_file, File &out_file,
+                  const SparseFlashCallbacks &callbacks = {});
+
+}
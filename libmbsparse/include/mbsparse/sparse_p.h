@@ -90,6 +90,48 @@ struct ChunkInfo
     uint32_t fill_val;
 };
 
+constexpr uint32_t INDEX_MAGIC =            0x5844494d; // "MIDX"
+constexpr uint32_t INDEX_VERSION =          1;
+
+/*!
+ * \brief Header of a serialized chunk index
+ *
+ * All fields are little endian. The sparse header fields are used to check
+ * that the index belongs to the image it is loaded for.
+ */
+struct IndexHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint16_t file_hdr_sz;
+    uint16_t chunk_hdr_sz;
+    uint32_t blk_sz;
+    uint32_t total_blks;
+    uint32_t total_chunks;
+    uint32_t image_checksum;
+    uint32_t reserved;
+};
+
+/*!
+ * \brief Serialized chunk index entry
+ *
+ * A chunk starts where the previous chunk ends, so only the end offsets are
+ * stored. The first chunk starts at offset 0 in the output file and at
+ * SparseHeader::file_hdr_sz in the source file.
+ */
+struct IndexEntry
+{
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t fill_val;
+    uint64_t end;
+    uint64_t src_end;
+    uint64_t raw_begin;
+};
+
+static_assert(sizeof(IndexHeader) == 32, "Unexpected IndexHeader size");
+static_assert(sizeof(IndexEntry) == 32, "Unexpected IndexEntry size");
+
 enum class Seekability : uint8_t
 {
     CanSeek,
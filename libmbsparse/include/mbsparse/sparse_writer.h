@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+
+namespace mb::sparse
+{
+
+class MB_EXPORT SparseWriter : public File
+{
+public:
+    static constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096;
+    static constexpr size_t MAX_RAW_CHUNK_SIZE = 1024 * 1024;
+
+    SparseWriter();
+    SparseWriter(File *file, uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    virtual ~SparseWriter();
+
+    SparseWriter(SparseWriter &&other) noexcept;
+    SparseWriter & operator=(SparseWriter &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SparseWriter)
+
+    // File open
+    oc::result<void> open(File *file,
+                          uint32_t block_size = DEFAULT_BLOCK_SIZE);
+
+    oc::result<void> close() override;
+
+    oc::result<size_t> read(void *buf, size_t size) override;
+    oc::result<size_t> write(const void *buf, size_t size) override;
+    oc::result<uint64_t> seek(int64_t offset, int whence) override;
+    oc::result<void> truncate(uint64_t size) override;
+
+    bool is_open() override;
+
+private:
+    void clear() noexcept;
+
+    oc::result<void> wwrite(const void *buf, size_t size);
+
+    oc::result<void> write_sparse_header();
+    oc::result<void> flush_chunk();
+
+    oc::result<void> add_block(const unsigned char *data);
+    oc::result<void> add_dont_care(uint64_t blocks);
+
+    oc::result<void> skip(uint64_t size);
+    oc::result<void> finish();
+
+    File *m_file;
+    uint32_t m_block_size;
+
+    // Offset of the sparse header in the output file
+    uint64_t m_header_offset;
+    // Number of bytes written to the output file
+    uint64_t m_out_size;
+    // Position in the expanded image
+    uint64_t m_pos;
+
+    // Partially filled block
+    std::vector<unsigned char> m_block;
+    size_t m_block_used;
+
+    // Chunk that is still being extended
+    uint16_t m_chunk_type;
+    uint32_t m_chunk_blocks;
+    uint32_t m_chunk_fill_val;
+    std::vector<unsigned char> m_chunk_raw;
+
+    uint32_t m_total_blocks;
+    uint32_t m_total_chunks;
+};
+
+}
@@ -31,6 +31,7 @@
 #include <cstring>
 
 #include "mbcommon/algorithm.h"
+#include "mbcommon/crc32.h"
 #include "mbcommon/endian.h"
 #include "mbcommon/file_error.h"
 #include "mbcommon/file_util.h"
@@ -143,6 +144,44 @@ struct OffsetComp
     }
 };
 
+/*!
+ * \brief Fill \p buf with the expanded contents of a fill or skip chunk
+ *
+ * \param chunk Fill or skip chunk
+ * \param offset Output file offset corresponding to the start of \p buf
+ * \param buf Output buffer
+ * \param size Number of bytes to write to \p buf
+ */
+static void expand_chunk(const ChunkInfo &chunk, uint64_t offset, void *buf,
+                         size_t size) noexcept
+{
+    auto ptr = static_cast<unsigned char *>(buf);
+
+    if (chunk.type == CHUNK_TYPE_DONT_CARE) {
+        std::fill_n(ptr, size, 0);
+        return;
+    }
+
+    static_assert(sizeof(chunk.fill_val) == sizeof(uint32_t),
+                  "Mismatched fill_val size");
+    auto shift = (offset - chunk.begin) % sizeof(uint32_t);
+    uint32_t fill_val = mb_htole32(chunk.fill_val);
+    unsigned char shifted[4];
+    for (size_t i = 0; i < sizeof(uint32_t); ++i) {
+        shifted[i] = reinterpret_cast<unsigned char *>(&fill_val)
+                [(i + shift) % sizeof(uint32_t)];
+    }
+
+    // Write one copy of the pattern and then keep doubling it
+    size_t filled = std::min(sizeof(shifted), size);
+    memcpy(ptr, &shifted, filled);
+    while (filled < size) {
+        size_t to_copy = std::min(filled, size - filled);
+        memcpy(ptr + filled, ptr, to_copy);
+        filled += to_copy;
+    }
+}
+
 /*! \endcond */
 
 /*!
@@ -190,7 +229,12 @@ SparseFile::SparseFile(SparseFile &&other) noexcept
 
     std::swap(m_file, other.m_file);
     std::swap(m_seekability, other.m_seekability);
+    std::swap(m_src_base_offset, other.m_src_base_offset);
     std::swap(m_expected_crc32, other.m_expected_crc32);
+    std::swap(m_verify_crc32, other.m_verify_crc32);
+    std::swap(m_crc32, other.m_crc32);
+    std::swap(m_crc32_offset, other.m_crc32_offset);
+    std::swap(m_crc32_valid, other.m_crc32_valid);
     std::swap(m_cur_src_offset, other.m_cur_src_offset);
     std::swap(m_cur_tgt_offset, other.m_cur_tgt_offset);
     std::swap(m_file_size, other.m_file_size);
@@ -206,7 +250,12 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
 
         std::swap(m_file, rhs.m_file);
         std::swap(m_seekability, rhs.m_seekability);
+        std::swap(m_src_base_offset, rhs.m_src_base_offset);
         std::swap(m_expected_crc32, rhs.m_expected_crc32);
+        std::swap(m_verify_crc32, rhs.m_verify_crc32);
+        std::swap(m_crc32, rhs.m_crc32);
+        std::swap(m_crc32_offset, rhs.m_crc32_offset);
+        std::swap(m_crc32_valid, rhs.m_crc32_valid);
         std::swap(m_cur_src_offset, rhs.m_cur_src_offset);
         std::swap(m_cur_tgt_offset, rhs.m_cur_tgt_offset);
         std::swap(m_file_size, rhs.m_file_size);
@@ -276,6 +325,7 @@ oc::result<void> SparseFile::open(File *file)
     if (auto seek_ret = m_file->seek(0, SEEK_CUR)) {
         DEBUG("File supports forward skipping");
         m_seekability = Seekability::CanSkip;
+        m_src_base_offset = seek_ret.value();
     } else if (seek_ret.error() != FileErrorC::Unsupported) {
         return seek_ret.as_failure();
     }
@@ -358,6 +408,13 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
 
         if (m_chunk == m_chunks.end()) {
             OPER("Reached EOF");
+
+            if (m_shdr.image_checksum != 0
+                    && !crc32_matches(m_file_size, m_shdr.image_checksum)) {
+                DEBUG("Image checksum does not match");
+                return SparseFileError::ChecksumMismatch;
+            }
+
             break;
         }
 
@@ -399,29 +456,10 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
             n_read = to_read;
             break;
         }
-        case CHUNK_TYPE_FILL: {
-            static_assert(sizeof(m_chunk->fill_val) == sizeof(uint32_t),
-                          "Mismatched fill_val size");
-            auto shift = (m_cur_tgt_offset - m_chunk->begin) % sizeof(uint32_t);
-            uint32_t fill_val = mb_htole32(m_chunk->fill_val);
-            unsigned char shifted[4];
-            for (size_t i = 0; i < sizeof(uint32_t); ++i) {
-                shifted[i] = reinterpret_cast<unsigned char *>(&fill_val)
-                        [(i + shift) % sizeof(uint32_t)];
-            }
-            unsigned char *temp_buf = reinterpret_cast<unsigned char *>(buf);
-            while (to_read > 0) {
-                size_t to_write = std::min<size_t>(
-                        sizeof(shifted), static_cast<size_t>(to_read));
-                memcpy(temp_buf, &shifted, to_write);
-                n_read += to_write;
-                to_read -= to_write;
-                temp_buf += to_write;
-            }
-            break;
-        }
+        case CHUNK_TYPE_FILL:
         case CHUNK_TYPE_DONT_CARE:
-            std::fill_n(reinterpret_cast<unsigned char *>(buf), to_read, 0);
+            expand_chunk(*m_chunk, m_cur_tgt_offset, buf,
+                         static_cast<size_t>(to_read));
             n_read = to_read;
             break;
         default:
@@ -429,6 +467,7 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
         }
 
         OPER("Read %" PRIu64 " bytes", n_read);
+        update_crc32(m_cur_tgt_offset, buf, static_cast<size_t>(n_read));
         total_read += n_read;
         m_cur_tgt_offset += n_read;
         size -= static_cast<size_t>(n_read);
@@ -438,6 +477,74 @@ oc::result<size_t> SparseFile::read(void *buf, size_t size)
     return static_cast<size_t>(total_read);
 }
 
+/*!
+ * \brief Read sparse file at a specific offset
+ *
+ * Once all of the chunk headers are known, either because the entire file has
+ * been read or because of save_index() or load_index(), this function does not
+ * modify the SparseFile. If the source file's read_at() is safe to call from
+ * multiple threads (eg. because it uses `pread()`), then so is this function.
+ *
+ * Otherwise, this falls back to File::read_at(), which is not thread safe and
+ * requires the sparse file to be seekable.
+ *
+ * \note Data read with this function is not included in the CRC32 checksum
+ *       verification.
+ *
+ * \param offset Offset in the sparse file's output
+ * \param[out] buf Buffer to read data into
+ * \param size Number of bytes to read
+ *
+ * \return Number of bytes read, which is only less than \p size at EOF.
+ *         Otherwise, the error code.
+ */
+oc::result<size_t> SparseFile::read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_chunks.size() != m_shdr.total_chunks) {
+        return File::read_at(offset, buf, size);
+    }
+
+    auto ptr = static_cast<unsigned char *>(buf);
+    size_t total_read = 0;
+
+    while (size > 0) {
+        auto chunk = binary_find(m_chunks.cbegin(), m_chunks.cend(), offset,
+                                 OffsetComp());
+        if (chunk == m_chunks.cend()) {
+            break;
+        }
+
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(size, chunk->end - offset));
+
+        if (chunk->type == CHUNK_TYPE_RAW) {
+            uint64_t src_offset = m_src_base_offset + chunk->raw_begin
+                    + (offset - chunk->begin);
+
+            for (size_t n_read = 0; n_read < to_read;) {
+                OUTCOME_TRY(n, m_file->read_at(src_offset + n_read,
+                                               ptr + n_read, to_read - n_read));
+                if (n == 0) {
+                    DEBUG("Source file reached EOF in raw chunk");
+                    return FileError::UnexpectedEof;
+                }
+                n_read += n;
+            }
+        } else {
+            expand_chunk(*chunk, offset, ptr, to_read);
+        }
+
+        total_read += to_read;
+        offset += to_read;
+        ptr += to_read;
+        size -= to_read;
+    }
+
+    return total_read;
+}
+
 /*!
  * \brief Not supported
  *
@@ -546,10 +653,280 @@ uint64_t SparseFile::size() noexcept
     return m_file_size;
 }
 
+/*!
+ * \brief Get the extent containing the current file position
+ *
+ * This allows callers to handle the different chunk types without expanding
+ * them. For example, a caller writing the image to a block device can skip
+ * holes. The extent may have started before the current file position.
+ *
+ * If the source file is not seekable, this reads the chunk headers up to the
+ * current file position, just like read() would.
+ *
+ * \return The extent if the current file position is before EOF, std::nullopt
+ *         at EOF, or an error code if the chunk headers could not be read.
+ */
+oc::result<std::optional<SparseExtent>> SparseFile::current_extent()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    if (m_chunk == m_chunks.end()) {
+        return std::nullopt;
+    }
+
+    SparseExtent extent = {};
+    extent.begin = m_chunk->begin;
+    extent.end = m_chunk->end;
+
+    switch (m_chunk->type) {
+    case CHUNK_TYPE_RAW:
+        extent.type = SparseExtentType::Data;
+        break;
+    case CHUNK_TYPE_FILL:
+        extent.type = SparseExtentType::Fill;
+        extent.fill_val = mb_le32toh(m_chunk->fill_val);
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        extent.type = SparseExtentType::Hole;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid chunk type: %" PRIu16, m_chunk->type);
+    }
+
+    return extent;
+}
+
+/*!
+ * \brief Enable or disable CRC32 checksum verification
+ *
+ * When enabled, a CRC32 checksum of the data is computed as it is read. DONT_CARE
+ * chunks are included as zeros. read() fails with
+ * SparseFileError::ChecksumMismatch if the checksum does not match the value in
+ * a CRC32 chunk or, at the end of the file, the image checksum in the sparse
+ * header (if it is nonzero).
+ *
+ * Verification only happens while the file is read sequentially from the
+ * beginning. It stops silently once a read starts elsewhere.
+ *
+ * \param verify Whether to verify checksums
+ */
+void SparseFile::set_verify_crc32(bool verify) noexcept
+{
+    m_verify_crc32 = verify;
+}
+
+/*!
+ * \brief Serialize the chunk index
+ *
+ * This reads all of the remaining chunk headers in the sparse file and returns
+ * a compact, byte order independent representation of them. The result can be
+ * passed to load_index() when opening the same image again to avoid walking
+ * the chunk headers before the first seek.
+ *
+ * \note The file position is not changed.
+ *
+ * \return Serialized index if all chunk headers are successfully read.
+ *         Otherwise, the error code. If the source file does not support
+ *         random seeking, FileError::UnsupportedSeek is returned.
+ */
+oc::result<std::vector<unsigned char>> SparseFile::save_index()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_seekability != Seekability::CanSeek) {
+        return FileError::UnsupportedSeek;
+    }
+
+    // Read all remaining chunks
+    OUTCOME_TRYV(move_to_chunk(m_file_size));
+
+    if (m_chunks.size() != m_shdr.total_chunks) {
+        DEBUG("Only found %" MB_PRIzu " of %" PRIu32 " chunks",
+              m_chunks.size(), m_shdr.total_chunks);
+        return SparseFileError::InternalError;
+    }
+
+    // Keep the current chunk valid for the next read
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    std::vector<unsigned char> data(
+            sizeof(IndexHeader) + m_chunks.size() * sizeof(IndexEntry));
+    auto ptr = data.data();
+
+    IndexHeader ihdr = {};
+    ihdr.magic = mb_htole32(INDEX_MAGIC);
+    ihdr.version = mb_htole32(INDEX_VERSION);
+    ihdr.file_hdr_sz = mb_htole16(m_shdr.file_hdr_sz);
+    ihdr.chunk_hdr_sz = mb_htole16(m_shdr.chunk_hdr_sz);
+    ihdr.blk_sz = mb_htole32(m_shdr.blk_sz);
+    ihdr.total_blks = mb_htole32(m_shdr.total_blks);
+    ihdr.total_chunks = mb_htole32(m_shdr.total_chunks);
+    ihdr.image_checksum = mb_htole32(m_shdr.image_checksum);
+
+    memcpy(ptr, &ihdr, sizeof(ihdr));
+    ptr += sizeof(ihdr);
+
+    for (auto const &chunk : m_chunks) {
+        IndexEntry entry = {};
+        entry.type = mb_htole16(chunk.type);
+        entry.end = mb_htole64(chunk.end);
+        entry.src_end = mb_htole64(chunk.src_end);
+        if (chunk.type == CHUNK_TYPE_RAW) {
+            entry.raw_begin = mb_htole64(chunk.raw_begin);
+        } else if (chunk.type == CHUNK_TYPE_FILL) {
+            entry.fill_val = mb_htole32(chunk.fill_val);
+        }
+
+        memcpy(ptr, &entry, sizeof(entry));
+        ptr += sizeof(entry);
+    }
+
+    return std::move(data);
+}
+
+/*!
+ * \brief Load a chunk index produced by save_index()
+ *
+ * The index replaces any chunk headers that have already been read. It is
+ * checked against the sparse header and for internal consistency, but the
+ * chunk headers in the source file are not read again.
+ *
+ * \pre The sparse file must have been opened with a source file that supports
+ *      random seeking.
+ *
+ * \param data Serialized index
+ * \param size Size of \p data
+ *
+ * \return Nothing if the index is successfully loaded. Otherwise, the error
+ *         code. If the index is malformed or belongs to a different image,
+ *         SparseFileError::InvalidIndex is returned and the sparse file is left
+ *         unchanged.
+ */
+oc::result<void> SparseFile::load_index(const void *data, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    if (m_seekability != Seekability::CanSeek) {
+        return FileError::UnsupportedSeek;
+    }
+
+    auto ptr = static_cast<const unsigned char *>(data);
+    IndexHeader ihdr;
+
+    if (size < sizeof(ihdr)) {
+        DEBUG("Index is too small for header: %" MB_PRIzu " bytes", size);
+        return SparseFileError::InvalidIndex;
+    }
+
+    memcpy(&ihdr, ptr, sizeof(ihdr));
+    ptr += sizeof(ihdr);
+    size -= sizeof(ihdr);
+
+    if (mb_le32toh(ihdr.magic) != INDEX_MAGIC
+            || mb_le32toh(ihdr.version) != INDEX_VERSION) {
+        DEBUG("Invalid index magic or version");
+        return SparseFileError::InvalidIndex;
+    }
+
+    if (mb_le16toh(ihdr.file_hdr_sz) != m_shdr.file_hdr_sz
+            || mb_le16toh(ihdr.chunk_hdr_sz) != m_shdr.chunk_hdr_sz
+            || mb_le32toh(ihdr.blk_sz) != m_shdr.blk_sz
+            || mb_le32toh(ihdr.total_blks) != m_shdr.total_blks
+            || mb_le32toh(ihdr.total_chunks) != m_shdr.total_chunks
+            || mb_le32toh(ihdr.image_checksum) != m_shdr.image_checksum) {
+        DEBUG("Index does not match sparse header");
+        return SparseFileError::InvalidIndex;
+    }
+
+    if (size / sizeof(IndexEntry) != m_shdr.total_chunks
+            || size % sizeof(IndexEntry) != 0) {
+        DEBUG("Index size does not match chunk count");
+        return SparseFileError::InvalidIndex;
+    }
+
+    std::vector<ChunkInfo> chunks;
+    chunks.reserve(m_shdr.total_chunks);
+
+    uint64_t begin = 0;
+    uint64_t src_begin = m_shdr.file_hdr_sz;
+
+    for (uint32_t i = 0; i < m_shdr.total_chunks; ++i) {
+        IndexEntry entry;
+        memcpy(&entry, ptr, sizeof(entry));
+        ptr += sizeof(entry);
+
+        ChunkInfo ci = {};
+        ci.type = mb_le16toh(entry.type);
+        ci.begin = begin;
+        ci.end = mb_le64toh(entry.end);
+        ci.src_begin = src_begin;
+        ci.src_end = mb_le64toh(entry.src_end);
+
+        if (ci.end < ci.begin || ci.end > m_file_size
+                || (m_shdr.blk_sz != 0
+                        && (ci.end - ci.begin) % m_shdr.blk_sz != 0)
+                || ci.src_end < ci.src_begin + m_shdr.chunk_hdr_sz) {
+            DEBUG("Index entry #%" PRIu32 " has invalid bounds", i);
+            return SparseFileError::InvalidIndex;
+        }
+
+        bool valid;
+
+        switch (ci.type) {
+        case CHUNK_TYPE_RAW:
+            ci.raw_begin = mb_le64toh(entry.raw_begin);
+            ci.raw_end = ci.raw_begin + (ci.end - ci.begin);
+            valid = ci.raw_begin == ci.src_begin + m_shdr.chunk_hdr_sz
+                    && ci.raw_end == ci.src_end;
+            break;
+        case CHUNK_TYPE_FILL:
+            ci.fill_val = mb_le32toh(entry.fill_val);
+            valid = true;
+            break;
+        case CHUNK_TYPE_DONT_CARE:
+            valid = true;
+            break;
+        case CHUNK_TYPE_CRC32:
+            valid = ci.end == ci.begin;
+            break;
+        default:
+            valid = false;
+            break;
+        }
+
+        if (!valid) {
+            DEBUG("Index entry #%" PRIu32 " is invalid", i);
+            return SparseFileError::InvalidIndex;
+        }
+
+        begin = ci.end;
+        src_begin = ci.src_end;
+
+        chunks.push_back(ci);
+    }
+
+    if (begin != m_file_size) {
+        DEBUG("Index ends (%" PRIu64 ") before end of file (%" PRIu64 ")",
+              begin, m_file_size);
+        return SparseFileError::InvalidIndex;
+    }
+
+    m_chunks = std::move(chunks);
+    m_chunk = m_chunks.end();
+
+    return oc::success();
+}
+
 void SparseFile::clear() noexcept
 {
     m_file = nullptr;
+    m_src_base_offset = 0;
     m_expected_crc32 = 0;
+    m_crc32 = 0;
+    m_crc32_offset = 0;
+    m_crc32_valid = true;
     m_cur_src_offset = 0;
     m_cur_tgt_offset = 0;
     m_file_size = 0;
@@ -830,17 +1207,26 @@ SparseFile::process_crc32_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidCrc32Chunk;
     }
 
+    uint64_t src_begin = m_cur_src_offset - m_shdr.chunk_hdr_sz;
+
     OUTCOME_TRYV(wread(&crc32, sizeof(crc32)));
 
+    uint64_t src_end = m_cur_src_offset;
+
     m_expected_crc32 = mb_le32toh(crc32);
 
+    if (!crc32_matches(tgt_offset, m_expected_crc32)) {
+        DEBUG("CRC32 chunk checksum does not match");
+        return SparseFileError::ChecksumMismatch;
+    }
+
     ChunkInfo ci;
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
     ci.end = tgt_offset;
-    ci.src_begin = tgt_offset - m_shdr.chunk_hdr_sz;
-    ci.src_end = tgt_offset + data_size;
+    ci.src_begin = src_begin;
+    ci.src_end = src_end;
 
     return std::move(ci);
 }
@@ -1017,4 +1403,41 @@ oc::result<void> SparseFile::move_to_chunk(uint64_t offset) noexcept
     return oc::success();
 }
 
+
+/*!
+ * \brief Add data at \p offset to the running checksum
+ */
+void SparseFile::update_crc32(uint64_t offset, const void *buf,
+                              size_t size) noexcept
+{
+    if (!m_verify_crc32 || !m_crc32_valid) {
+        return;
+    }
+
+    if (offset != m_crc32_offset) {
+        DEBUG("Non-sequential read; disabling checksum verification");
+        m_crc32_valid = false;
+        return;
+    }
+
+    m_crc32 = crc32_update(m_crc32, buf, size);
+    m_crc32_offset += size;
+}
+
+/*!
+ * \brief Check the running checksum of the data before \p offset
+ *
+ * \return False if the checksum is known and differs from \p expected.
+ *         Otherwise, true.
+ */
+bool SparseFile::crc32_matches(uint64_t offset, uint32_t expected)
+    const noexcept
+{
+    if (!m_verify_crc32 || !m_crc32_valid || m_crc32_offset != offset) {
+        return true;
+    }
+
+    return m_crc32 == expected;
+}
+
 }
@@ -63,6 +63,10 @@ std::string SparseFileErrorCategory::message(int ev) const
         return "invalid 'crc32' chunk";
     case SparseFileError::InternalError:
         return "(internal error)";
+    case SparseFileError::ChecksumMismatch:
+        return "checksum mismatch";
+    case SparseFileError::InvalidIndex:
+        return "invalid chunk index";
     default:
         return "(unknown sparse file error)";
     }
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_flash.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstdio>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/sparse_error.h"
+
+/*!
+ * \file mbsparse/sparse_flash.h
+ * \brief Write Android sparse file images to block devices
+ */
+
+namespace mb::sparse
+{
+
+// Amount of expanded data handled per read/write
+static constexpr size_t FLASH_BUFFER_SIZE = 1024 * 1024;
+
+/*!
+ * \brief Write the expanded contents of a sparse file to \p out_file
+ *
+ * Unlike copying the output of SparseFile::read(), only the data that is
+ * actually needed is written:
+ *
+ * * Raw data is written as is.
+ * * Holes are not written at all. If \p callbacks.discard is set, it is called
+ *   for each hole so that the caller can discard the range (eg. with
+ *   `BLKDISCARD`).
+ * * Zero-filled ranges are passed to \p callbacks.zero_out if it is set (eg.
+ *   for `BLKZEROOUT`). If it is not set or returns false, the zeros are
+ *   written.
+ * * Other fill ranges are expanded into a large buffer and written.
+ *
+ * Ranges that are not written are still read from \p sparse_file, which only
+ * expands them in memory. This keeps checksum verification working.
+ *
+ * \pre \p sparse_file and \p out_file must both be positioned at the
+ *      beginning. \p out_file must support seeking and must already be at
+ *      least as large as the sparse file's output size if the last range is
+ *      skipped. This is always the case for block devices.
+ *
+ * \param sparse_file Sparse file to read from
+ * \param out_file File or block device to write to
+ * \param callbacks Optional callbacks for discarding ranges and progress
+ *                  reporting
+ *
+ * \return Nothing if the entire image is written. Otherwise, the error code.
+ */
+oc::result<void>
+flash_sparse_file(SparseFile &sparse_file, File &out_file,
+                  const SparseFlashCallbacks &callbacks)
+{
+    std::vector<unsigned char> buf(FLASH_BUFFER_SIZE);
+    uint64_t max_bytes = sparse_file.size();
+    uint64_t offset = 0;
+    uint64_t out_offset = 0;
+
+    if (callbacks.progress) {
+        callbacks.progress(0, max_bytes);
+    }
+
+    while (true) {
+        OUTCOME_TRY(extent, sparse_file.current_extent());
+        if (!extent) {
+            break;
+        }
+
+        bool write = true;
+
+        if (extent->type == SparseExtentType::Hole) {
+            if (callbacks.discard) {
+                OUTCOME_TRYV(callbacks.discard(offset, extent->end - offset));
+            }
+            write = false;
+        } else if (extent->type == SparseExtentType::Fill
+                && extent->fill_val == 0 && callbacks.zero_out) {
+            OUTCOME_TRY(handled, callbacks.zero_out(
+                    offset, extent->end - offset));
+            write = !handled;
+        }
+
+        while (offset < extent->end) {
+            auto to_read = static_cast<size_t>(std::min<uint64_t>(
+                    buf.size(), extent->end - offset));
+
+            OUTCOME_TRY(n, sparse_file.read(buf.data(), to_read));
+            if (n == 0) {
+                return FileError::UnexpectedEof;
+            }
+
+            if (write) {
+                if (out_offset != offset) {
+                    OUTCOME_TRYV(out_file.seek(
+                            static_cast<int64_t>(offset), SEEK_SET));
+                }
+
+                OUTCOME_TRYV(file_write_exact(out_file, buf.data(), n));
+                out_offset = offset + n;
+            }
+
+            offset += n;
+
+            if (callbacks.progress) {
+                callbacks.progress(offset, max_bytes);
+            }
+        }
+    }
+
+    // Reading at EOF checks the image checksum, if enabled
+    OUTCOME_TRY(n, sparse_file.read(buf.data(), 1));
+    if (n != 0) {
+        return SparseFileError::InternalError;
+    }
+
+    return oc::success();
+}
+
+}
@@ -0,0 +1,595 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_writer.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+#include "mbsparse/sparse_p.h"
+
+/*!
+ * \file mbsparse/sparse_writer.h
+ * \brief Encode Android sparse file images
+ */
+
+namespace mb::sparse
+{
+using namespace detail;
+
+static_assert(sizeof(SparseHeader) == 28, "Unexpected sparse header size");
+static_assert(sizeof(ChunkHeader) == 12, "Unexpected chunk header size");
+
+// Number of bytes compared per step when checking for fill blocks
+static constexpr size_t FILL_CHECK_STRIDE = 64;
+
+/*!
+ * \brief Check if a block consists of a single repeating 32-bit value.
+ *
+ * The block is compared in fixed size strides with no branches inside each
+ * stride, which allows the compiler to vectorize the comparison while still
+ * bailing out early for blocks with ordinary data.
+ *
+ * \param data Block data
+ * \param block_size Block size (must be a multiple of 4)
+ * \param[out] fill_val The 32-bit value, in the byte order it appears in the
+ *                      block
+ *
+ * \return Whether the block can be stored as a fill chunk
+ */
+static bool is_fill_block(const unsigned char *data, size_t block_size,
+                          uint32_t &fill_val) noexcept
+{
+    uint32_t pattern;
+    memcpy(&pattern, data, sizeof(pattern));
+
+    size_t i = 0;
+
+    for (; i + FILL_CHECK_STRIDE <= block_size; i += FILL_CHECK_STRIDE) {
+        uint32_t diff = 0;
+
+        for (size_t j = 0; j < FILL_CHECK_STRIDE; j += sizeof(uint32_t)) {
+            uint32_t word;
+            memcpy(&word, data + i + j, sizeof(word));
+            diff |= word ^ pattern;
+        }
+
+        if (diff != 0) {
+            return false;
+        }
+    }
+
+    for (; i < block_size; i += sizeof(uint32_t)) {
+        uint32_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word != pattern) {
+            return false;
+        }
+    }
+
+    fill_val = pattern;
+    return true;
+}
+
+/*!
+ * \class SparseWriter
+ *
+ * \brief Write Android sparse file image.
+ *
+ * Data written to this File handle is split into blocks. Each block is stored
+ * as a raw chunk or, if it consists of a single repeating 32-bit value, as a
+ * fill chunk. Consecutive blocks of the same kind are merged into a single
+ * chunk. Seeking forward skips over data, which is stored as a "don't care"
+ * chunk.
+ *
+ * \note The expanded image size is rounded up to a multiple of the block size.
+ *       The partial block at the end is padded with zeros.
+ */
+
+/*!
+ * \var SparseWriter::DEFAULT_BLOCK_SIZE
+ *
+ * \brief Default block size
+ */
+
+/*!
+ * \var SparseWriter::MAX_RAW_CHUNK_SIZE
+ *
+ * \brief Maximum size of the data in a raw chunk
+ *
+ * Raw data is buffered in memory until the chunk is complete because the chunk
+ * header, which contains the chunk size, precedes the data.
+ */
+
+/*!
+ * \brief Construct unbound SparseWriter.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to open a file.
+ */
+SparseWriter::SparseWriter()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open sparse file for writing from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, uint32_t)
+ *
+ * \param file File to write the sparse image to
+ * \param block_size Block size
+ */
+SparseWriter::SparseWriter(File *file, uint32_t block_size)
+    : SparseWriter()
+{
+    (void) open(file, block_size);
+}
+
+SparseWriter::~SparseWriter()
+{
+    (void) close();
+}
+
+SparseWriter::SparseWriter(SparseWriter &&other) noexcept
+{
+    clear();
+
+    std::swap(m_file, other.m_file);
+    std::swap(m_block_size, other.m_block_size);
+    std::swap(m_header_offset, other.m_header_offset);
+    std::swap(m_out_size, other.m_out_size);
+    std::swap(m_pos, other.m_pos);
+    std::swap(m_block, other.m_block);
+    std::swap(m_block_used, other.m_block_used);
+    std::swap(m_chunk_type, other.m_chunk_type);
+    std::swap(m_chunk_blocks, other.m_chunk_blocks);
+    std::swap(m_chunk_fill_val, other.m_chunk_fill_val);
+    std::swap(m_chunk_raw, other.m_chunk_raw);
+    std::swap(m_total_blocks, other.m_total_blocks);
+    std::swap(m_total_chunks, other.m_total_chunks);
+}
+
+SparseWriter & SparseWriter::operator=(SparseWriter &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) close();
+
+        std::swap(m_file, rhs.m_file);
+        std::swap(m_block_size, rhs.m_block_size);
+        std::swap(m_header_offset, rhs.m_header_offset);
+        std::swap(m_out_size, rhs.m_out_size);
+        std::swap(m_pos, rhs.m_pos);
+        std::swap(m_block, rhs.m_block);
+        std::swap(m_block_used, rhs.m_block_used);
+        std::swap(m_chunk_type, rhs.m_chunk_type);
+        std::swap(m_chunk_blocks, rhs.m_chunk_blocks);
+        std::swap(m_chunk_fill_val, rhs.m_chunk_fill_val);
+        std::swap(m_chunk_raw, rhs.m_chunk_raw);
+        std::swap(m_total_blocks, rhs.m_total_blocks);
+        std::swap(m_total_chunks, rhs.m_total_chunks);
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Open sparse file for writing
+ *
+ * \note The SparseWriter will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed.
+ *
+ * The sparse header is written when the sparse file is closed, so \p file must
+ * support seeking. Writing starts at the current file position.
+ *
+ * \param file File to write the sparse image to
+ * \param block_size Block size. Must be a nonzero multiple of 4.
+ *
+ * \return Nothing if the sparse file is successfully opened. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseWriter::open(File *file, uint32_t block_size)
+{
+    if (is_open()) return FileError::InvalidState;
+
+    if (!file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    if (block_size == 0 || block_size % sizeof(uint32_t) != 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    auto reset = finally([&] {
+        clear();
+    });
+
+    m_file = file;
+    m_block_size = block_size;
+
+    OUTCOME_TRY(offset, m_file->seek(0, SEEK_CUR));
+    m_header_offset = offset;
+
+    // Reserve space for the header
+    OUTCOME_TRYV(write_sparse_header());
+
+    m_block.resize(block_size);
+
+    reset.dismiss();
+
+    return oc::success();
+}
+
+/*!
+ * \brief Finish writing and close the sparse file
+ *
+ * This writes out the final chunk and the sparse header.
+ *
+ * \note If the sparse file is open, then no matter what value is returned, the
+ *       sparse file will be closed.
+ *
+ * \return Nothing if the sparse image is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> SparseWriter::close()
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    auto reset = finally([&] {
+        clear();
+    });
+
+    return finish();
+}
+
+oc::result<size_t> SparseWriter::read(void *buf, size_t size)
+{
+    (void) buf;
+    (void) size;
+    return FileError::UnsupportedRead;
+}
+
+/*!
+ * \brief Write data to the sparse file
+ *
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return Number of bytes written or the error code. If an error occurs, the
+ *         sparse file will be in an indeterminate state.
+ */
+oc::result<size_t> SparseWriter::write(const void *buf, size_t size)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    // The sparse header can only describe UINT32_MAX blocks
+    if (size > static_cast<uint64_t>(UINT32_MAX) * m_block_size - m_pos) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    auto ptr = static_cast<const unsigned char *>(buf);
+    size_t remain = size;
+
+    while (remain > 0) {
+        if (m_block_used == 0 && remain >= m_block_size) {
+            // Avoid the copy for whole blocks
+            OUTCOME_TRYV(add_block(ptr));
+            ptr += m_block_size;
+            remain -= m_block_size;
+            m_pos += m_block_size;
+            continue;
+        }
+
+        size_t n = std::min<size_t>(m_block_size - m_block_used, remain);
+        memcpy(m_block.data() + m_block_used, ptr, n);
+        m_block_used += n;
+        ptr += n;
+        remain -= n;
+        m_pos += n;
+
+        if (m_block_used == m_block_size) {
+            OUTCOME_TRYV(add_block(m_block.data()));
+            m_block_used = 0;
+        }
+    }
+
+    return size;
+}
+
+/*!
+ * \brief Seek sparse file
+ *
+ * Only forward seeks are supported. Skipped data is stored as "don't care"
+ * chunks where possible and as zeros otherwise.
+ *
+ * \param offset Offset
+ * \param whence SEEK_SET or SEEK_CUR
+ *
+ * \return New position in the expanded image or the error code.
+ *         FileError::UnsupportedSeek is returned for backward seeks and
+ *         SEEK_END.
+ */
+oc::result<uint64_t> SparseWriter::seek(int64_t offset, int whence)
+{
+    if (!is_open()) return FileError::InvalidState;
+
+    uint64_t target;
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        target = static_cast<uint64_t>(offset);
+        break;
+    case SEEK_CUR:
+        if (offset < 0) {
+            return FileError::UnsupportedSeek;
+        }
+        if (static_cast<uint64_t>(offset) > UINT64_MAX - m_pos) {
+            return FileError::ArgumentOutOfRange;
+        }
+        target = m_pos + static_cast<uint64_t>(offset);
+        break;
+    case SEEK_END:
+        return FileError::UnsupportedSeek;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (target < m_pos) {
+        return FileError::UnsupportedSeek;
+    } else if (target > static_cast<uint64_t>(UINT32_MAX) * m_block_size) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRYV(skip(target - m_pos));
+
+    return m_pos;
+}
+
+oc::result<void> SparseWriter::truncate(uint64_t size)
+{
+    (void) size;
+    return FileError::UnsupportedTruncate;
+}
+
+bool SparseWriter::is_open()
+{
+    return m_file;
+}
+
+void SparseWriter::clear() noexcept
+{
+    m_file = nullptr;
+    m_block_size = 0;
+    m_header_offset = 0;
+    m_out_size = 0;
+    m_pos = 0;
+    m_block.clear();
+    m_block_used = 0;
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+    m_chunk_fill_val = 0;
+    m_chunk_raw.clear();
+    m_total_blocks = 0;
+    m_total_chunks = 0;
+}
+
+oc::result<void> SparseWriter::wwrite(const void *buf, size_t size)
+{
+    OUTCOME_TRYV(file_write_exact(*m_file, buf, size));
+    m_out_size += size;
+    return oc::success();
+}
+
+/*!
+ * \brief Write sparse header with the current block and chunk counts
+ */
+oc::result<void> SparseWriter::write_sparse_header()
+{
+    SparseHeader shdr;
+    shdr.magic = mb_htole32(SPARSE_HEADER_MAGIC);
+    shdr.major_version = mb_htole16(SPARSE_HEADER_MAJOR_VER);
+    shdr.minor_version = mb_htole16(0);
+    shdr.file_hdr_sz = mb_htole16(sizeof(SparseHeader));
+    shdr.chunk_hdr_sz = mb_htole16(sizeof(ChunkHeader));
+    shdr.blk_sz = mb_htole32(m_block_size);
+    shdr.total_blks = mb_htole32(m_total_blocks);
+    shdr.total_chunks = mb_htole32(m_total_chunks);
+    // Checksum is optional
+    shdr.image_checksum = 0;
+
+    return wwrite(&shdr, sizeof(shdr));
+}
+
+/*!
+ * \brief Write out the chunk that is currently being extended
+ */
+oc::result<void> SparseWriter::flush_chunk()
+{
+    if (m_chunk_blocks == 0) {
+        return oc::success();
+    }
+
+    size_t data_size;
+
+    switch (m_chunk_type) {
+    case CHUNK_TYPE_RAW:
+        data_size = m_chunk_raw.size();
+        break;
+    case CHUNK_TYPE_FILL:
+        data_size = sizeof(m_chunk_fill_val);
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        data_size = 0;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid chunk type: %u", m_chunk_type);
+    }
+
+    ChunkHeader chdr;
+    chdr.chunk_type = mb_htole16(m_chunk_type);
+    chdr.reserved1 = 0;
+    chdr.chunk_sz = mb_htole32(m_chunk_blocks);
+    chdr.total_sz = mb_htole32(
+            static_cast<uint32_t>(sizeof(ChunkHeader) + data_size));
+
+    OUTCOME_TRYV(wwrite(&chdr, sizeof(chdr)));
+
+    if (m_chunk_type == CHUNK_TYPE_RAW) {
+        OUTCOME_TRYV(wwrite(m_chunk_raw.data(), m_chunk_raw.size()));
+        m_chunk_raw.clear();
+    } else if (m_chunk_type == CHUNK_TYPE_FILL) {
+        // Stored in the byte order it appeared in the data
+        OUTCOME_TRYV(wwrite(&m_chunk_fill_val, sizeof(m_chunk_fill_val)));
+    }
+
+    ++m_total_chunks;
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add a full block of data as a raw or fill chunk
+ */
+oc::result<void> SparseWriter::add_block(const unsigned char *data)
+{
+    uint32_t fill_val;
+
+    if (is_fill_block(data, m_block_size, fill_val)) {
+        if (m_chunk_type != CHUNK_TYPE_FILL || m_chunk_fill_val != fill_val
+                || m_chunk_blocks == UINT32_MAX) {
+            OUTCOME_TRYV(flush_chunk());
+            m_chunk_type = CHUNK_TYPE_FILL;
+            m_chunk_fill_val = fill_val;
+        }
+    } else {
+        if (m_chunk_type != CHUNK_TYPE_RAW
+                || m_chunk_raw.size() + m_block_size > MAX_RAW_CHUNK_SIZE) {
+            OUTCOME_TRYV(flush_chunk());
+            m_chunk_type = CHUNK_TYPE_RAW;
+        }
+
+        m_chunk_raw.insert(m_chunk_raw.end(), data, data + m_block_size);
+    }
+
+    ++m_chunk_blocks;
+    ++m_total_blocks;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add blocks that should be left untouched when flashing
+ */
+oc::result<void> SparseWriter::add_dont_care(uint64_t blocks)
+{
+    while (blocks > 0) {
+        if (m_chunk_type != CHUNK_TYPE_DONT_CARE
+                || m_chunk_blocks == UINT32_MAX) {
+            OUTCOME_TRYV(flush_chunk());
+            m_chunk_type = CHUNK_TYPE_DONT_CARE;
+        }
+
+        auto n = static_cast<uint32_t>(std::min<uint64_t>(
+                blocks, UINT32_MAX - m_chunk_blocks));
+
+        m_chunk_blocks += n;
+        m_total_blocks += n;
+        blocks -= n;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Skip over \p size bytes of the expanded image
+ *
+ * Partial blocks are filled with zeros and whole blocks become "don't care"
+ * chunks.
+ */
+oc::result<void> SparseWriter::skip(uint64_t size)
+{
+    if (m_block_used > 0 && size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(
+                m_block_size - m_block_used, size));
+        memset(m_block.data() + m_block_used, 0, n);
+        m_block_used += n;
+        m_pos += n;
+        size -= n;
+
+        if (m_block_used == m_block_size) {
+            OUTCOME_TRYV(add_block(m_block.data()));
+            m_block_used = 0;
+        }
+    }
+
+    uint64_t blocks = size / m_block_size;
+    OUTCOME_TRYV(add_dont_care(blocks));
+    m_pos += blocks * m_block_size;
+    size %= m_block_size;
+
+    if (size > 0) {
+        memset(m_block.data(), 0, static_cast<size_t>(size));
+        m_block_used = static_cast<size_t>(size);
+        m_pos += size;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write out remaining data and the final sparse header
+ */
+oc::result<void> SparseWriter::finish()
+{
+    if (m_block_used > 0) {
+        memset(m_block.data() + m_block_used, 0,
+               m_block_size - m_block_used);
+        OUTCOME_TRYV(add_block(m_block.data()));
+        m_block_used = 0;
+    }
+
+    OUTCOME_TRYV(flush_chunk());
+
+    uint64_t end_offset = m_header_offset + m_out_size;
+
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(m_header_offset),
+                              SEEK_SET));
+    OUTCOME_TRYV(write_sparse_header());
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(end_offset), SEEK_SET));
+
+    return oc::success();
+}
+
+}
@@ -19,8 +19,13 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+
+#include <cstddef>
+
 #include "mbsparse/sparse.h"
 
+#include "mbcommon/crc32.h"
 #include "mbcommon/endian.h"
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_error.h"
@@ -87,7 +92,8 @@ struct SparseTest : testing::Test
         ASSERT_TRUE(_source_file.open(&_data, &_size));
     }
 
-    void build_valid_data(bool oversized)
+    void build_valid_data(bool oversized, uint32_t crc32 = 0,
+                          uint32_t image_checksum = 0)
     {
         SparseHeader shdr = {};
         shdr.magic = SPARSE_HEADER_MAGIC;
@@ -98,7 +104,7 @@ struct SparseTest : testing::Test
         shdr.blk_sz = 4;
         shdr.total_blks = 12;
         shdr.total_chunks = 4;
-        shdr.image_checksum = 0;
+        shdr.image_checksum = image_checksum;
         fix_sparse_header_byte_order(shdr);
 
         ASSERT_TRUE(_source_file.write(&shdr, sizeof(shdr)));
@@ -161,7 +167,8 @@ struct SparseTest : testing::Test
         if (oversized) {
             ASSERT_TRUE(_source_file.write("\xaa\xbb\xcc\xdd", 4));
         }
-        ASSERT_TRUE(_source_file.write("\x00\x00\x00\x00", 4));
+        crc32 = mb_htole32(crc32);
+        ASSERT_TRUE(_source_file.write(&crc32, sizeof(crc32)));
 
         // Move back to beginning of the file
         ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
@@ -729,3 +736,189 @@ TEST_F(SparseTest, ReadValidDataWithUnseekableFile)
 
     ASSERT_TRUE(_file.close());
 }
+
+TEST_F(SparseTest, VerifyValidCrc32)
+{
+    char buf[1024];
+    uint32_t crc32 = crc32_update(0, expected_valid_data,
+                                  sizeof(expected_valid_data));
+    build_valid_data(false, crc32, crc32);
+
+    _file.set_verify_crc32(true);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, sizeof(expected_valid_data)), 0);
+
+    ASSERT_TRUE(_file.close());
+}
+
+TEST_F(SparseTest, VerifyMismatchedCrc32ChunkFailure)
+{
+    char buf[1024];
+    size_t total = 0;
+    build_valid_data(false, 0xdeadbeef);
+
+    _file.set_verify_crc32(true);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // The data preceding the CRC32 chunk is returned before the checksum can
+    // be checked
+    while (true) {
+        auto n = _file.read(buf + total, 1);
+        if (!n) {
+            ASSERT_EQ(n, oc::failure(SparseFileError::ChecksumMismatch));
+            break;
+        }
+        ASSERT_NE(n.value(), 0u);
+        total += n.value();
+    }
+
+    ASSERT_EQ(total, sizeof(expected_valid_data));
+}
+
+TEST_F(SparseTest, VerifyMismatchedImageChecksumFailure)
+{
+    char buf[1024];
+    build_valid_data(false, 0, 0xdeadbeef);
+
+    _file.set_verify_crc32(true);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::failure(SparseFileError::ChecksumMismatch));
+}
+
+TEST_F(SparseTest, VerifySkippedAfterSeek)
+{
+    char buf[1024];
+    build_valid_data(false, 0xdeadbeef, 0xdeadbeef);
+
+    _file.set_verify_crc32(true);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Non-sequential reads cannot be verified
+    ASSERT_TRUE(_file.seek(1, SEEK_SET));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data) - 1));
+}
+
+TEST_F(SparseTest, VerifyDisabledIgnoresMismatch)
+{
+    char buf[1024];
+    build_valid_data(false, 0xdeadbeef, 0xdeadbeef);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+}
+
+TEST_F(SparseTest, SaveAndLoadIndex)
+{
+    char buf[1024];
+    build_valid_data(false);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    auto index = _file.save_index();
+    ASSERT_TRUE(index);
+    ASSERT_TRUE(_file.close());
+
+    // Corrupt the header of the skip chunk. It should not be read again when
+    // the index is loaded.
+    uint16_t chunk_type = mb_htole16(0xffff);
+    ASSERT_TRUE(_source_file.seek(sizeof(SparseHeader) + sizeof(ChunkHeader)
+            + 16 + sizeof(ChunkHeader) + 4, SEEK_SET));
+    ASSERT_TRUE(_source_file.write(&chunk_type, sizeof(chunk_type)));
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.load_index(index.value().data(), index.value().size()));
+
+    ASSERT_TRUE(_file.seek(33, SEEK_SET));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)), oc::success(15u));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 33, 15), 0);
+
+    ASSERT_TRUE(_file.seek(0, SEEK_SET));
+    ASSERT_EQ(_file.read(buf, sizeof(buf)),
+              oc::success(sizeof(expected_valid_data)));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, sizeof(expected_valid_data)), 0);
+}
+
+TEST_F(SparseTest, LoadInvalidIndexFailure)
+{
+    build_valid_data(false);
+
+    ASSERT_TRUE(_file.open(&_source_file));
+    auto index = _file.save_index();
+    ASSERT_TRUE(index);
+    auto &data = index.value();
+
+    // Truncated
+    ASSERT_EQ(_file.load_index(data.data(), data.size() - 1),
+              oc::failure(SparseFileError::InvalidIndex));
+
+    // Mismatched sparse header
+    auto bad = data;
+    bad[offsetof(IndexHeader, blk_sz)] ^= 0xff;
+    ASSERT_EQ(_file.load_index(bad.data(), bad.size()),
+              oc::failure(SparseFileError::InvalidIndex));
+
+    // Non-contiguous chunks
+    bad = data;
+    bad[sizeof(IndexHeader) + offsetof(IndexEntry, end)] ^= 0x04;
+    ASSERT_EQ(_file.load_index(bad.data(), bad.size()),
+              oc::failure(SparseFileError::InvalidIndex));
+
+    ASSERT_TRUE(_file.load_index(data.data(), data.size()));
+}
+
+TEST_F(SparseTest, IndexRequiresSeekableFile)
+{
+    build_valid_data(false);
+
+    _source_file.set_seekability(Seekability::CanSkip);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    ASSERT_EQ(_file.save_index(), oc::failure(FileError::UnsupportedSeek));
+    ASSERT_EQ(_file.load_index(nullptr, 0),
+              oc::failure(FileError::UnsupportedSeek));
+}
+
+TEST_F(SparseTest, ReadAtWithCompleteIndex)
+{
+    char buf[1024];
+
+    // Sparse data does not start at the beginning of the source file
+    ASSERT_TRUE(_source_file.write("abcd", 4));
+    build_valid_data(true);
+    ASSERT_TRUE(_source_file.seek(4, SEEK_SET));
+
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    // Falls back to seeking before all chunk headers are read
+    ASSERT_EQ(_file.read_at(4, buf, 8), oc::success(8u));
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 4, 8), 0);
+
+    ASSERT_TRUE(_file.save_index());
+
+    for (size_t offset = 0; offset < sizeof(expected_valid_data); ++offset) {
+        size_t remaining = sizeof(expected_valid_data) - offset;
+
+        ASSERT_EQ(_file.read_at(offset, buf, sizeof(buf)),
+                  oc::success(remaining));
+        ASSERT_EQ(memcmp(buf, expected_valid_data + offset, remaining), 0);
+
+        ASSERT_EQ(_file.read_at(offset, buf, 3),
+                  oc::success(std::min<size_t>(3, remaining)));
+        ASSERT_EQ(memcmp(buf, expected_valid_data + offset,
+                         std::min<size_t>(3, remaining)), 0);
+    }
+
+    ASSERT_EQ(_file.read_at(sizeof(expected_valid_data), buf, sizeof(buf)),
+              oc::success(0u));
+
+    // The file position is not changed
+    ASSERT_EQ(_file.seek(0, SEEK_CUR), oc::success(0u));
+}
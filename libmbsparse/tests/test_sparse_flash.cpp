@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <utility>
+#include <vector>
+
+#include <cstring>
+
+#include "mbsparse/sparse_flash.h"
+
+#include "mbcommon/file/memory.h"
+
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+
+using Range = std::pair<uint64_t, uint64_t>;
+
+struct SparseFlashTest : testing::Test
+{
+    MemoryFile _sparse_source;
+    void *_sparse_data = nullptr;
+    size_t _sparse_size = 0;
+    SparseFile _sparse_file;
+    MemoryFile _out_file;
+
+    virtual ~SparseFlashTest()
+    {
+        free(_sparse_data);
+    }
+
+    void SetUp() override
+    {
+        // | raw | zero fill | 0x11 fill | hole | hole | raw |
+        SparseWriter writer;
+        unsigned char fill[8];
+
+        ASSERT_TRUE(_sparse_source.open(&_sparse_data, &_sparse_size));
+        ASSERT_TRUE(writer.open(&_sparse_source, 8));
+        ASSERT_TRUE(writer.write("01234567", 8));
+        memset(fill, 0, sizeof(fill));
+        ASSERT_TRUE(writer.write(fill, sizeof(fill)));
+        memset(fill, 0x11, sizeof(fill));
+        ASSERT_TRUE(writer.write(fill, sizeof(fill)));
+        ASSERT_TRUE(writer.seek(16, SEEK_CUR));
+        ASSERT_TRUE(writer.write("abcdefgh", 8));
+        ASSERT_TRUE(writer.close());
+
+        ASSERT_TRUE(_sparse_source.seek(0, SEEK_SET));
+        ASSERT_TRUE(_sparse_file.open(&_sparse_source));
+
+        ASSERT_TRUE(_out_file.open(std::vector<unsigned char>(48, 0xaa)));
+    }
+
+    std::vector<unsigned char> output()
+    {
+        auto data = _out_file.release();
+        EXPECT_TRUE(data);
+        return data ? std::move(data.value()) : std::vector<unsigned char>();
+    }
+
+    static std::vector<unsigned char> expected(unsigned char zero_fill)
+    {
+        std::vector<unsigned char> data;
+        data.insert(data.end(), {'0', '1', '2', '3', '4', '5', '6', '7'});
+        data.insert(data.end(), 8, zero_fill);
+        data.insert(data.end(), 8, 0x11);
+        data.insert(data.end(), 16, 0xaa);
+        data.insert(data.end(), {'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'});
+        return data;
+    }
+};
+
+TEST_F(SparseFlashTest, SkipHolesAndWriteZeros)
+{
+    ASSERT_TRUE(flash_sparse_file(_sparse_file, _out_file));
+
+    ASSERT_EQ(output(), expected(0));
+}
+
+TEST_F(SparseFlashTest, DiscardAndZeroOutCallbacks)
+{
+    std::vector<Range> discarded;
+    std::vector<Range> zeroed;
+    uint64_t last_progress = 0;
+
+    SparseFlashCallbacks callbacks;
+    callbacks.discard = [&](uint64_t offset, uint64_t size)
+            -> oc::result<bool> {
+        discarded.emplace_back(offset, size);
+        return true;
+    };
+    callbacks.zero_out = [&](uint64_t offset, uint64_t size)
+            -> oc::result<bool> {
+        zeroed.emplace_back(offset, size);
+        return true;
+    };
+    callbacks.progress = [&](uint64_t cur_bytes, uint64_t max_bytes) {
+        ASSERT_GE(cur_bytes, last_progress);
+        ASSERT_EQ(max_bytes, 48u);
+        last_progress = cur_bytes;
+    };
+
+    ASSERT_TRUE(flash_sparse_file(_sparse_file, _out_file, callbacks));
+
+    ASSERT_EQ(discarded, std::vector<Range>({{24, 16}}));
+    ASSERT_EQ(zeroed, std::vector<Range>({{8, 8}}));
+    ASSERT_EQ(last_progress, 48u);
+
+    // The zero-filled range was handled by the callback
+    ASSERT_EQ(output(), expected(0xaa));
+}
+
+TEST_F(SparseFlashTest, CallbackFailure)
+{
+    SparseFlashCallbacks callbacks;
+    callbacks.zero_out = [&](uint64_t, uint64_t) -> oc::result<bool> {
+        return std::make_error_code(std::errc::io_error);
+    };
+
+    ASSERT_EQ(flash_sparse_file(_sparse_file, _out_file, callbacks),
+              oc::failure(std::make_error_code(std::errc::io_error)));
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "mbsparse/sparse_writer.h"
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+
+#include "mbsparse/sparse.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+struct SparseWriterTest : testing::Test
+{
+    MemoryFile _target_file;
+    void *_data = nullptr;
+    size_t _size = 0;
+
+    virtual ~SparseWriterTest()
+    {
+        free(_data);
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_target_file.open(&_data, &_size));
+    }
+
+    SparseHeader read_sparse_header(size_t offset = 0)
+    {
+        SparseHeader shdr;
+        memcpy(&shdr, static_cast<char *>(_data) + offset, sizeof(shdr));
+        shdr.total_blks = mb_le32toh(shdr.total_blks);
+        shdr.total_chunks = mb_le32toh(shdr.total_chunks);
+        return shdr;
+    }
+};
+
+TEST_F(SparseWriterTest, CheckInvalidStates)
+{
+    SparseWriter file;
+
+    auto error = oc::failure(FileError::InvalidState);
+
+    ASSERT_EQ(file.close(), error);
+    ASSERT_EQ(file.write(nullptr, 0), error);
+    ASSERT_EQ(file.seek(0, SEEK_SET), error);
+
+    ASSERT_TRUE(file.open(&_target_file));
+    ASSERT_EQ(file.open(&_target_file), error);
+}
+
+TEST_F(SparseWriterTest, CheckUnsupportedOperations)
+{
+    SparseWriter file;
+
+    ASSERT_EQ(file.open(&_target_file, 6),
+              oc::failure(FileError::ArgumentOutOfRange));
+    ASSERT_FALSE(file.is_open());
+
+    ASSERT_TRUE(file.open(&_target_file, 4));
+
+    char c;
+    ASSERT_EQ(file.read(&c, 1), oc::failure(FileError::UnsupportedRead));
+    ASSERT_EQ(file.truncate(0), oc::failure(FileError::UnsupportedTruncate));
+    ASSERT_EQ(file.seek(0, SEEK_END), oc::failure(FileError::UnsupportedSeek));
+
+    ASSERT_EQ(file.write("abcd", 4), oc::success(4u));
+    ASSERT_EQ(file.seek(-1, SEEK_CUR), oc::failure(FileError::UnsupportedSeek));
+    ASSERT_EQ(file.seek(0, SEEK_SET), oc::failure(FileError::UnsupportedSeek));
+    ASSERT_EQ(file.seek(0, SEEK_CUR), oc::success(4u));
+}
+
+TEST_F(SparseWriterTest, WriteAndReadBack)
+{
+    SparseWriter file;
+    ASSERT_TRUE(file.open(&_target_file, 16));
+
+    // Raw block, written in pieces
+    ASSERT_EQ(file.write("0123456", 7), oc::success(7u));
+    ASSERT_EQ(file.write("789abcdef", 9), oc::success(9u));
+
+    // Two fill blocks
+    unsigned char fill[32];
+    for (size_t i = 0; i < sizeof(fill); i += 4) {
+        memcpy(fill + i, "\x78\x56\x34\x12", 4);
+    }
+    ASSERT_EQ(file.write(fill, sizeof(fill)), oc::success(32u));
+
+    // Two don't care blocks
+    ASSERT_EQ(file.seek(32, SEEK_CUR), oc::success(80u));
+
+    // Partial raw block, padded with zeros
+    ASSERT_EQ(file.write("tail", 4), oc::success(4u));
+
+    ASSERT_TRUE(file.close());
+
+    auto shdr = read_sparse_header();
+    ASSERT_EQ(shdr.total_blks, 6u);
+    ASSERT_EQ(shdr.total_chunks, 4u);
+
+    // 1 raw block + fill value + 1 raw block + headers
+    ASSERT_EQ(_size, sizeof(SparseHeader) + 4 * sizeof(ChunkHeader)
+            + 16 + 4 + 16);
+
+    ASSERT_TRUE(_target_file.seek(0, SEEK_SET));
+
+    SparseFile sparse_file;
+    ASSERT_TRUE(sparse_file.open(&_target_file));
+    ASSERT_EQ(sparse_file.size(), 96u);
+
+    unsigned char buf[96];
+    ASSERT_EQ(sparse_file.read(buf, sizeof(buf)), oc::success(96u));
+
+    unsigned char expected[96] = {};
+    memcpy(expected, "0123456789abcdef", 16);
+    memcpy(expected + 16, fill, sizeof(fill));
+    memcpy(expected + 80, "tail", 4);
+
+    ASSERT_EQ(memcmp(buf, expected, sizeof(buf)), 0);
+}
+
+TEST_F(SparseWriterTest, MergeAdjacentBlocks)
+{
+    SparseWriter file;
+    ASSERT_TRUE(file.open(&_target_file, 8));
+
+    ASSERT_EQ(file.write("abcdefghijklmnop", 16), oc::success(16u));
+    ASSERT_EQ(file.write("\0\0\0\0\0\0\0\0", 8), oc::success(8u));
+    // Unaligned skips are zero filled
+    ASSERT_EQ(file.seek(2, SEEK_CUR), oc::success(26u));
+    ASSERT_EQ(file.write("\0\0\0\0\0\0", 6), oc::success(6u));
+
+    ASSERT_TRUE(file.close());
+
+    auto shdr = read_sparse_header();
+    ASSERT_EQ(shdr.total_blks, 4u);
+    // One raw chunk and one fill chunk
+    ASSERT_EQ(shdr.total_chunks, 2u);
+}
+
+TEST_F(SparseWriterTest, HeaderAtCurrentOffset)
+{
+    ASSERT_TRUE(_target_file.write("xx", 2));
+
+    SparseWriter file;
+    ASSERT_TRUE(file.open(&_target_file, 4));
+    ASSERT_EQ(file.write("abcd", 4), oc::success(4u));
+    ASSERT_TRUE(file.close());
+
+    ASSERT_EQ(memcmp(_data, "xx", 2), 0);
+
+    auto shdr = read_sparse_header(2);
+    ASSERT_EQ(mb_le32toh(shdr.magic), SPARSE_HEADER_MAGIC);
+    ASSERT_EQ(shdr.total_blks, 1u);
+    ASSERT_EQ(shdr.total_chunks, 1u);
+
+    // File position is at the end of the sparse image
+    ASSERT_EQ(_target_file.seek(0, SEEK_CUR),
+              oc::success(2 + sizeof(SparseHeader) + sizeof(ChunkHeader) + 4));
+}
@@ -38,6 +38,9 @@ enum class ArchAbi : uint8_t
 
 constexpr ArchAbi NATIVE_ARCH_ABI = ArchAbi::Eabi;
 
+//! Number of values in ArchAbi
+constexpr size_t ARCH_ABI_COUNT = 1;
+
 constexpr size_t SYSCALL_OPSIZE = 4;
 
 class ArchRegs
@@ -89,9 +92,11 @@ private:
 
     friend oc::result<ArchRegs> read_regs(pid_t tid);
     friend oc::result<void> write_regs(pid_t tid, const ArchRegs &ar);
+    friend oc::result<void> write_syscall_num(pid_t tid, const ArchRegs &ar);
 };
 
 oc::result<ArchRegs> read_regs(pid_t tid);
 oc::result<void> write_regs(pid_t tid, const ArchRegs &ar);
+oc::result<void> write_syscall_num(pid_t tid, const ArchRegs &ar);
 
 }
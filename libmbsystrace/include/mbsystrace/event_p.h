@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <optional>
 #include <variant>
 
 #include <sys/signal.h>
@@ -26,6 +27,7 @@
 #include "mbcommon/outcome.h"
 
 #include "mbsystrace/arch.h"
+#include "mbsystrace/registers_p.h"
 #include "mbsystrace/types.h"
 
 namespace mb::systrace::detail
@@ -173,6 +175,40 @@ struct SysCallStopEvent
     pid_t tid;
     //! Register values at the time of the syscall-stop
     ArchRegs regs;
+    //! Which values in \ref regs are valid
+    RegsContent regs_content;
+};
+
+/*!
+ * \brief Event emitted when a seccomp filter requests that a tracee be traced
+ *
+ * This event is emitted when `waitpid()` returns a status such that
+ * `WIFSTOPPED(status)` is true and `status >> 8` is
+ * `SIGTRAP | (PTRACE_EVENT_SECCOMP << 8)`, indicating that a seccomp filter
+ * returned `SECCOMP_RET_TRACE` for a syscall the tracee is about to enter. This
+ * only occurs for tracees seized with SeizeFlag::TraceSecComp.
+ *
+ * On kernel 4.8 and newer, the seccomp-stop occurs after the syscall-entry-stop
+ * (if the tracee was continued with `PTRACE_SYSCALL`) and the tracer may modify
+ * the syscall number and arguments in the same way as during a syscall-entry
+ * stop. If the tracee is then continued with `PTRACE_SYSCALL`, the next
+ * syscall-related stop will be the syscall-exit stop.
+ *
+ * Upon receiving this event, the tracer must continue the execution of the
+ * tracee via Tracee::continue_exec(). Otherwise, it will remain in the
+ * seccomp-stop state until it is detached or killed.
+ *
+ * \sa The `ptrace()` and `seccomp()` manpages for details on
+ *     `PTRACE_O_TRACESECCOMP`
+ */
+struct SecCompStopEvent
+{
+    //! Tracee
+    pid_t tid;
+    //! Register values at the time of the seccomp-stop
+    ArchRegs regs;
+    //! Which values in \ref regs are valid
+    RegsContent regs_content;
 };
 
 /*!
@@ -405,6 +441,7 @@ using ProcessEvent = std::variant<
     ProcessExitEvent,
     ProcessDeathEvent,
     SysCallStopEvent,
+    SecCompStopEvent,
     SignalDeliveryStopEvent,
     GroupStopEvent,
     InterruptStopEvent,
@@ -414,5 +451,7 @@ using ProcessEvent = std::variant<
 >;
 
 oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept;
+oc::result<std::optional<ProcessEvent>> poll_event(pid_t pid_spec) noexcept;
+pid_t event_pid(const ProcessEvent &event) noexcept;
 
 }
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <sys/ptrace.h>
+
+
+namespace mb::systrace::detail
+{
+
+//! Number of ptrace() calls made on the current thread
+extern thread_local uint64_t g_ptrace_calls;
+
+/*!
+ * \brief Call ptrace() and count the call in \ref g_ptrace_calls
+ *
+ * The arguments are passed to ptrace() unchanged.
+ */
+template<typename... Args>
+inline long counted_ptrace(Args... args) noexcept
+{
+    ++g_ptrace_calls;
+    return ptrace(args...);
+}
+
+}
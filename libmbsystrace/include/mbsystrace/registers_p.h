@@ -19,14 +19,47 @@
 
 #pragma once
 
+#include <optional>
+
+#include <cstddef>
+#include <cstdint>
+
 #include <sys/uio.h>
 
 #include "mbcommon/outcome.h"
 
+#include "mbsystrace/arch.h"
+#include "mbsystrace/types.h"
+
 namespace mb::systrace::detail
 {
 
+//! Values that are valid in an ArchRegs instance
+enum class RegsContent : uint8_t
+{
+    //! All registers were read via read_regs()
+    All,
+    //! Only the ABI, syscall number, arguments, and instruction pointer
+    SysCallEntry,
+    //! Only the audit arch of the ABI, return value, and instruction pointer
+    SysCallExit,
+};
+
+//! Register values reported at a syscall-stop or seccomp-stop
+struct SysCallRegs
+{
+    ArchRegs regs;
+    RegsContent content;
+};
+
 oc::result<void> read_raw_regs(pid_t tid, iovec &iov);
 oc::result<void> write_raw_regs(pid_t tid, iovec &iov);
 
+oc::result<SysCallRegs> read_syscall_regs(pid_t tid);
+
+// Implemented in the architecture-specific source files
+uint32_t audit_arch(ArchAbi abi);
+std::optional<ArchAbi> abi_from_audit_arch(uint32_t arch, SysCallNum nr);
+size_t pointer_size(ArchAbi abi);
+
 }
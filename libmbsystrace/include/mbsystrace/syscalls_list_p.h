@@ -19,6 +19,9 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include "mbsystrace/types.h"
 
 
@@ -31,6 +34,228 @@ struct SysCallInfo
     SysCallNum num;
 };
 
-extern const SysCallInfo *g_syscalls_map[];
+// The syscall lists are indexed by "hash and displace" perfect hash tables that
+// are built at compile time. The first hash of a key selects a bucket and each
+// bucket stores a seed that was chosen so that the second hash of every key in
+// the bucket lands in a distinct slot. Lookups need exactly one comparison.
+
+//! Marker for a slot that does not refer to a syscall
+constexpr uint16_t SC_EMPTY_SLOT = UINT16_MAX;
+
+constexpr uint32_t sc_hash_mix(uint32_t h)
+{
+    // MurmurHash3 finalizer
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+constexpr uint32_t sc_hash_name(const char *name)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (; *name; ++name) {
+        h ^= static_cast<unsigned char>(*name);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+constexpr uint32_t sc_hash_num(SysCallNum num)
+{
+    auto value = static_cast<uint64_t>(num);
+    return static_cast<uint32_t>(value) ^ static_cast<uint32_t>(value >> 32);
+}
+
+constexpr uint32_t sc_bucket(uint32_t h)
+{
+    return sc_hash_mix(h);
+}
+
+constexpr uint32_t sc_slot(uint32_t h, uint16_t seed)
+{
+    return sc_hash_mix(h ^ (seed * 0x9e3779b9u));
+}
+
+constexpr size_t sc_next_pow2(size_t n)
+{
+    size_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+constexpr bool sc_str_equal(const char *a, const char *b)
+{
+    for (; *a && *a == *b; ++a, ++b);
+    return *a == *b;
+}
+
+constexpr size_t sc_bucket_count(size_t n)
+{
+    return sc_next_pow2(n / 2 + 1);
+}
+
+constexpr size_t sc_slot_count(size_t n)
+{
+    return sc_next_pow2(n * 2);
+}
+
+template<size_t N>
+struct SysCallHash
+{
+    //! Seed for the second hash of each bucket
+    uint16_t seeds[sc_bucket_count(N)];
+    //! Index into the syscall list for each slot
+    uint16_t slots[sc_slot_count(N)];
+    //! Whether a seed was found for every bucket
+    bool ok;
+};
+
+/*!
+ * \brief Build perfect hash table for a syscall list
+ *
+ * \tparam ByName Whether to use the names or the numbers as keys
+ *
+ * \param list Syscall list terminated by an entry with a null name. If a key
+ *             appears more than once, only the first entry is indexed.
+ */
+template<bool ByName, size_t N>
+constexpr SysCallHash<N> sc_build_hash(const SysCallInfo (&list)[N])
+{
+    static_assert(N < SC_EMPTY_SLOT, "Too many syscalls");
+
+    constexpr size_t bucket_mask = sc_bucket_count(N) - 1;
+    constexpr size_t slot_mask = sc_slot_count(N) - 1;
+
+    SysCallHash<N> result{};
+    for (auto &slot : result.slots) {
+        slot = SC_EMPTY_SLOT;
+    }
+
+    uint32_t hashes[N] = {};
+    size_t starts[sc_bucket_count(N) + 1] = {};
+    size_t sizes[sc_bucket_count(N)] = {};
+    uint16_t members[N] = {};
+
+    for (size_t i = 0; list[i].name; ++i) {
+        hashes[i] = ByName ? sc_hash_name(list[i].name)
+                : sc_hash_num(list[i].num);
+        ++starts[(sc_bucket(hashes[i]) & bucket_mask) + 1];
+    }
+
+    for (size_t b = 0; b <= bucket_mask; ++b) {
+        starts[b + 1] += starts[b];
+    }
+
+    // Group keys by bucket in list order, skipping duplicates
+    size_t max_size = 0;
+
+    for (size_t i = 0; list[i].name; ++i) {
+        auto b = sc_bucket(hashes[i]) & bucket_mask;
+        bool duplicate = false;
+
+        for (size_t k = starts[b]; k < starts[b] + sizes[b]; ++k) {
+            auto &other = list[members[k]];
+
+            if (ByName ? sc_str_equal(other.name, list[i].name)
+                    : other.num == list[i].num) {
+                duplicate = true;
+                break;
+            }
+        }
+
+        if (!duplicate) {
+            members[starts[b] + sizes[b]] = static_cast<uint16_t>(i);
+            ++sizes[b];
+            if (sizes[b] > max_size) {
+                max_size = sizes[b];
+            }
+        }
+    }
+
+    // Place the largest buckets first
+    for (size_t size = max_size; size > 0; --size) {
+        for (size_t b = 0; b <= bucket_mask; ++b) {
+            if (sizes[b] != size) {
+                continue;
+            }
+
+            bool placed = false;
+
+            for (uint16_t seed = 1; !placed && seed < UINT16_MAX; ++seed) {
+                placed = true;
+
+                for (size_t k = starts[b]; k < starts[b] + size; ++k) {
+                    auto &slot = result.slots[
+                            sc_slot(hashes[members[k]], seed) & slot_mask];
+
+                    if (slot != SC_EMPTY_SLOT) {
+                        placed = false;
+                        break;
+                    }
+
+                    slot = members[k];
+                }
+
+                if (placed) {
+                    result.seeds[b] = seed;
+                } else {
+                    // Undo partial placement
+                    for (size_t k = starts[b]; k < starts[b] + size; ++k) {
+                        auto &slot = result.slots[
+                                sc_slot(hashes[members[k]], seed) & slot_mask];
+
+                        if (slot == members[k]) {
+                            slot = SC_EMPTY_SLOT;
+                        }
+                    }
+                }
+            }
+
+            if (!placed) {
+                return result;
+            }
+        }
+    }
+
+    result.ok = true;
+    return result;
+}
+
+//! Syscall list and its perfect hash tables for an ABI
+struct SysCallTable
+{
+    const SysCallInfo *list;
+    const uint16_t *name_seeds;
+    const uint16_t *name_slots;
+    const uint16_t *num_seeds;
+    const uint16_t *num_slots;
+    uint32_t bucket_mask;
+    uint32_t slot_mask;
+};
+
+template<size_t N>
+constexpr SysCallTable sc_make_table(const SysCallInfo (&list)[N],
+                                     const SysCallHash<N> &by_name,
+                                     const SysCallHash<N> &by_num)
+{
+    return {
+        list,
+        by_name.seeds,
+        by_name.slots,
+        by_num.seeds,
+        by_num.slots,
+        static_cast<uint32_t>(sc_bucket_count(N) - 1),
+        static_cast<uint32_t>(sc_slot_count(N) - 1),
+    };
+}
+
+//! Syscall tables indexed by ArchAbi
+extern const SysCallTable g_syscall_tables[];
 
 }
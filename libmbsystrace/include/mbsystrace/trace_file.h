@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include <cstdint>
+
+#include <unistd.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/file.h"
+#include "mbcommon/outcome.h"
+
+#include "mbsystrace/arch.h"
+#include "mbsystrace/types.h"
+
+namespace mb::systrace
+{
+
+//! Type of a record in a binary trace
+enum class TraceRecordType : uint8_t
+{
+    //! Hooks::new_tracee was called
+    NewTracee = 1,
+    //! Hooks::tracee_exit was called (TraceRecord::value is the exit code)
+    TraceeExit,
+    //! Hooks::tracee_death was called (TraceRecord::value is the signal)
+    TraceeDeath,
+    //! Hooks::tracee_disappear was called
+    TraceeDisappear,
+    //! Hooks::tracee_signal was called (TraceRecord::value is the signal)
+    TraceeSignal,
+    //! Hooks::group_stop was called (TraceRecord::value is the signal)
+    GroupStop,
+    //! Hooks::interrupt_stop was called
+    InterruptStop,
+    //! Hooks::syscall_entry was called
+    SysCallEntry,
+    //! Hooks::syscall_exit was called
+    SysCallExit,
+    //! Hooks::unknown_child was called (TraceRecord::value is the raw
+    //! waitpid status)
+    UnknownChild,
+};
+
+//! Record in a binary trace
+struct TraceRecord
+{
+    //! Record type
+    TraceRecordType type;
+    //! Time in nanoseconds. Must not decrease between records.
+    uint64_t time;
+    //! Thread ID
+    pid_t tid;
+    //! Exit code, signal, or waitpid status, depending on \ref type
+    int value;
+    //! Syscall ABI for TraceRecordType::SysCallEntry and
+    //! TraceRecordType::SysCallExit
+    ArchAbi abi;
+    //! Syscall number for TraceRecordType::SysCallEntry and
+    //! TraceRecordType::SysCallExit
+    SysCallNum syscall;
+    //! Syscall return value for TraceRecordType::SysCallExit
+    SysCallRet ret;
+};
+
+class MB_EXPORT TraceWriter final
+{
+public:
+    explicit TraceWriter(File &file);
+    ~TraceWriter();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TraceWriter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TraceWriter)
+
+    oc::result<void> write(const TraceRecord &record);
+    oc::result<void> flush();
+
+private:
+    File &m_file;
+    //! Encoded records that have not been written yet
+    std::vector<unsigned char> m_buf;
+    //! Time of the previous record
+    uint64_t m_time;
+
+    void put_byte(uint8_t value);
+    void put_varint(uint64_t value);
+    void put_signed_varint(int64_t value);
+};
+
+class MB_EXPORT TraceReader final
+{
+public:
+    explicit TraceReader(File &file);
+    ~TraceReader();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TraceReader)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TraceReader)
+
+    oc::result<std::optional<TraceRecord>> next();
+
+private:
+    File &m_file;
+    //! Data that has been read, but not yet decoded
+    std::vector<unsigned char> m_buf;
+    //! Offset of the next byte to decode in \ref m_buf
+    size_t m_pos;
+    //! Number of valid bytes in \ref m_buf
+    size_t m_size;
+    //! Whether the header has been read
+    bool m_read_header;
+    //! Time of the previous record
+    uint64_t m_time;
+
+    oc::result<std::optional<uint8_t>> get_byte();
+    oc::result<uint8_t> get_required_byte();
+    oc::result<uint64_t> get_varint();
+    oc::result<int64_t> get_signed_varint();
+};
+
+}
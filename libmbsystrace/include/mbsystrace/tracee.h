@@ -19,7 +19,12 @@
 
 #pragma once
 
+#include <chrono>
 #include <optional>
+#include <string>
+#include <vector>
+
+#include <cstdint>
 
 #include "mbcommon/common.h"
 #include "mbcommon/flags.h"
@@ -39,6 +44,20 @@
 namespace mb::systrace
 {
 
+namespace detail
+{
+enum class RegsContent : uint8_t;
+
+//! Page of tracee memory cached during a ptrace stop
+struct CachedPage
+{
+    //! Page-aligned address
+    uintptr_t addr;
+    //! Page contents or empty if the page is not mapped
+    std::vector<char> data;
+};
+}
+
 //! Flags to use when performing a ptrace seize on a process
 enum class SeizeFlag
 {
@@ -46,6 +65,8 @@ enum class SeizeFlag
     TraceChildren = 1 << 0,
     //! Set `PTRACE_O_EXITKILL` if supported
     TryKillOnExit = 1 << 1,
+    //! Report `SECCOMP_RET_TRACE` seccomp filter results
+    TraceSecComp = 1 << 2,
 };
 MB_DECLARE_FLAGS(SeizeFlags, SeizeFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(SeizeFlags)
@@ -63,6 +84,8 @@ enum class TraceeState
     PreSysCallStop,
     //! Syscall-exit stop
     PostSysCallStop,
+    //! Seccomp stop for a syscall whose syscall-entry stop was already handled
+    SecCompStop,
     //! Signal delivery stop
     SignalStop,
     //! Group stop
@@ -116,12 +139,18 @@ public:
     ExecMode exec_mode() const;
     void set_exec_mode(ExecMode mode);
 
+    bool syscall_filter() const;
+    void set_syscall_filter(bool enabled);
+
     ArchRegs regs() const;
     void set_regs(ArchRegs regs);
+    oc::result<void> set_regs(ArchRegs regs, detail::RegsContent content);
 
     void syscall_entry_pre_hook();
     oc::result<void> syscall_exit_pre_hook();
 
+    void set_stop_time(std::chrono::steady_clock::time_point time);
+
     SysCallStatus syscall_status() const;
 
     // Child memory access
@@ -129,6 +158,7 @@ public:
     oc::result<size_t> read_mem(uintptr_t addr, void *buf, size_t size);
     oc::result<size_t> write_mem(uintptr_t addr, const void *buf, size_t size);
     oc::result<std::string> read_string(uintptr_t addr);
+    oc::result<std::vector<std::string>> read_strings(uintptr_t addr);
 
     // Child memory management
 
@@ -136,6 +166,9 @@ public:
                                int flags, int fd, off64_t offset);
     oc::result<void> munmap(uintptr_t addr, size_t length);
 
+    oc::result<uintptr_t> alloc_scratch(size_t size);
+    oc::result<uintptr_t> write_scratch(const void *buf, size_t size);
+
     // Syscall injection
 
     oc::result<SysCallRet> inject_syscall(SysCallNum num,
@@ -167,9 +200,28 @@ private:
     //! Whether the tracee is executing in user space or kernel space
     ExecMode m_exec_mode;
 
+    //! Whether syscall-entry stops are produced by a seccomp filter
+    bool m_syscall_filter;
+
     //! Registers prior to execution of syscall-entry/exit hooks
     ArchRegs m_regs;
 
+    //! Which values in \ref m_regs are valid
+    detail::RegsContent m_regs_content;
+
+    //! Whether \ref m_regs has changes that need to be written to the tracee
+    bool m_regs_dirty;
+
+    //! Whether the syscall number in \ref m_regs needs to be written to the
+    //! tracee (only used if \ref m_regs_dirty is false)
+    bool m_syscall_num_dirty;
+
+    //! Pages of tracee memory read during the current ptrace stop
+    std::vector<detail::CachedPage> m_page_cache;
+
+    //! Time when the current ptrace stop was received by the tracer
+    std::chrono::steady_clock::time_point m_stop_time;
+
     //! Syscall injection status
     SysCallStatus m_sc_status;
 
@@ -191,9 +243,20 @@ private:
     bool m_started_execve;
 #endif
 
+    oc::result<void> fetch_regs();
+    oc::result<void> flush_regs();
+    void set_syscall_num(SysCallNum num);
+
     oc::result<void> proceed_until_syscall();
 
+    // Cached memory access
+
+    oc::result<void> cache_pages(std::vector<uintptr_t> page_addrs);
+    oc::result<const detail::CachedPage *> cached_page(uintptr_t page_addr);
+    oc::result<void> read_cached(uintptr_t addr, void *buf, size_t size);
+
     oc::result<void> continue_exec_raw(int signal);
+    void account_stop_time();
 
     // Asynchronous syscall injection
 
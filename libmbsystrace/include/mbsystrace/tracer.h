@@ -19,13 +19,20 @@
 
 #pragma once
 
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <map>
 #include <memory>
 #include <optional>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include <cstddef>
+#include <cstdint>
+
 #include <unistd.h>
 
 #include "mbcommon/common.h"
@@ -34,6 +41,7 @@
 
 #include "mbsystrace/event_p.h"
 #include "mbsystrace/hooks.h"
+#include "mbsystrace/syscalls.h"
 
 namespace mb::systrace
 {
@@ -49,6 +57,58 @@ MB_DECLARE_OPERATORS_FOR_FLAGS(Flags)
 
 class Tracee;
 
+//! Number of syscall-entry and syscall-exit stops for a syscall
+struct SysCallStopCounts
+{
+    //! Number of syscall-entry stops
+    uint64_t entry = 0;
+    //! Number of syscall-exit stops
+    uint64_t exit = 0;
+};
+
+//! Counters for measuring the overhead of the tracer
+struct TracerStats
+{
+    //! Number of events dispatched by the event loop
+    uint64_t events = 0;
+    //! Number of ptrace() calls made on the tracer's thread
+    uint64_t ptrace_calls = 0;
+    //! Time spent waiting for events in the event loop
+    std::chrono::nanoseconds wait_time{};
+    //! Time spent in hooks, excluding hooks called from other hooks
+    std::chrono::nanoseconds hook_time{};
+    //! Time that tracees spent in ptrace stops that were reported to the
+    //! tracer, from when the stop was received until the tracee was resumed
+    std::chrono::nanoseconds stop_time{};
+    //! Stop counts for each syscall, keyed by ABI and syscall number
+    std::map<std::pair<ArchAbi, SysCallNum>, SysCallStopCounts> syscalls;
+};
+
+namespace detail
+{
+
+//! Mapping in a tracee's address space for passing data to syscalls
+struct ScratchArena
+{
+    //! Address of the mapping
+    uintptr_t addr;
+    //! Size of the mapping
+    size_t size;
+    //! Offset of the next allocation
+    size_t offset;
+};
+
+//! Event that was received, but not yet dispatched
+struct PendingEvent
+{
+    //! Event
+    ProcessEvent event;
+    //! Time when the event was received
+    std::chrono::steady_clock::time_point time;
+};
+
+}
+
 class MB_EXPORT Tracer final
 {
 public:
@@ -62,20 +122,45 @@ public:
     oc::result<void> execute(const Hooks &hooks, int pid_spec);
     void stop_after_hook() noexcept;
 
+    TracerStats stats() const;
+    void reset_stats();
+
     oc::result<Tracee *> fork(std::function<void()> child, Flags flags = {});
+    oc::result<Tracee *> fork(std::function<void()> child,
+                              const std::vector<SysCall> &syscalls,
+                              Flags flags = {});
     oc::result<std::vector<Tracee *>> attach(pid_t tid, Flags flags = {});
 
 private:
-    std::unordered_map<pid_t, std::unique_ptr<Tracee>> m_tracees;
+    //! Tracees sorted by TID
+    std::vector<std::pair<pid_t, std::unique_ptr<Tracee>>> m_tracees;
     std::unordered_set<pid_t> m_owned_tgids;
+    std::unordered_set<pid_t> m_filtered_tgids;
+    std::unordered_map<pid_t, detail::ScratchArena> m_scratch_arenas;
     std::optional<detail::ProcessEvent> m_requeued_event;
+    //! Events that were collected, but not yet dispatched
+    std::deque<detail::PendingEvent> m_pending_events;
     bool m_should_stop;
+    TracerStats m_stats;
+    //! Value of detail::g_ptrace_calls when the statistics were reset
+    uint64_t m_ptrace_calls_base;
+    //! Number of hooks that are currently executing
+    unsigned int m_hook_depth;
+
+    oc::result<Tracee *> fork_impl(std::function<void()> child,
+                                   const std::vector<SysCall> *syscalls,
+                                   Flags flags);
 
     oc::result<Tracee *> add_child(pid_t tgid, pid_t tid);
     bool remove_child(pid_t tid);
+    void inherit_syscall_filter(Tracee *tracee);
+
+    oc::result<detail::ProcessEvent> wait_event(pid_t pid_spec);
+    oc::result<detail::PendingEvent> next_pending_event(pid_t pid_spec);
+    std::vector<detail::PendingEvent> take_pending_events(pid_t tid);
 
     oc::result<bool>
-    dispatch_event(const Hooks &hooks, const detail::ProcessEvent &event);
+    dispatch_event(const Hooks &hooks, const detail::PendingEvent &pending);
 
     void
     execute_new_tracee_hook(const Hooks &hooks, Tracee *tracee);
@@ -103,6 +188,10 @@ private:
     execute_unknown_child_hook(const Hooks &hooks, pid_t tid, int status);
 
     Tracee * find_tracee(pid_t tid);
+    Tracee * insert_tracee(std::unique_ptr<Tracee> tracee);
+    std::unique_ptr<Tracee> take_tracee(pid_t tid);
+
+    friend class Tracee;
 };
 
 }
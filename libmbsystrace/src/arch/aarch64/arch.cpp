@@ -21,6 +21,7 @@
 
 #include "mbsystrace/arch.h"
 
+#include <linux/audit.h>
 #include <linux/elf.h>
 #include <sys/ptrace.h>
 #include <sys/uio.h>
@@ -28,6 +29,7 @@
 #include "mbcommon/error_code.h"
 #include "mbcommon/integer.h"
 
+#include "mbsystrace/ptrace_p.h"
 #include "mbsystrace/registers_p.h"
 
 #define AARCH64_ARG0            aarch64.regs[0]
@@ -363,21 +365,73 @@ oc::result<ArchRegs> read_regs(pid_t tid)
 
 oc::result<void> write_regs(pid_t tid, const ArchRegs &ar)
 {
+    OUTCOME_TRYV(write_syscall_num(tid, ar));
+
+    iovec iov;
+    iov.iov_base = const_cast<detail::RegsUnion *>(&ar.m_regs);
+    iov.iov_len = ar.m_abi == ArchAbi::Eabi
+            ? sizeof(ar.m_regs.arm) : sizeof(ar.m_regs.aarch64);
+
+    return detail::write_raw_regs(tid, iov);
+}
+
+oc::result<void> write_syscall_num(pid_t tid, const ArchRegs &ar)
+{
+    // The syscall number is not part of the general purpose registers
     if (ar.m_new_syscall) {
         uint32_t n = static_cast<uint16_t>(*ar.m_new_syscall);
         const iovec iov = { &n, sizeof(n) };
 
-        if (ptrace(PTRACE_SETREGSET, tid, NT_ARM_SYSTEM_CALL, &iov) != 0) {
+        if (detail::counted_ptrace(PTRACE_SETREGSET, tid, NT_ARM_SYSTEM_CALL,
+                                   &iov) != 0) {
             return ec_from_errno();
         }
     }
 
-    iovec iov;
-    iov.iov_base = const_cast<detail::RegsUnion *>(&ar.m_regs);
-    iov.iov_len = ar.m_abi == ArchAbi::Eabi
-            ? sizeof(ar.m_regs.arm) : sizeof(ar.m_regs.aarch64);
+    return oc::success();
+}
+
+namespace detail
+{
+
+uint32_t audit_arch(ArchAbi abi)
+{
+    switch (abi) {
+    case ArchAbi::Aarch64:
+        return AUDIT_ARCH_AARCH64;
+    case ArchAbi::Eabi:
+        return AUDIT_ARCH_ARM;
+    default:
+        MB_UNREACHABLE("Unknown ABI");
+    }
+}
+
+size_t pointer_size(ArchAbi abi)
+{
+    switch (abi) {
+    case ArchAbi::Aarch64:
+        return 8;
+    case ArchAbi::Eabi:
+        return 4;
+    default:
+        MB_UNREACHABLE("Unknown ABI");
+    }
+}
+
+std::optional<ArchAbi> abi_from_audit_arch(uint32_t arch, SysCallNum nr)
+{
+    (void) nr;
+
+    switch (arch) {
+    case AUDIT_ARCH_AARCH64:
+        return ArchAbi::Aarch64;
+    case AUDIT_ARCH_ARM:
+        return ArchAbi::Eabi;
+    default:
+        return std::nullopt;
+    }
+}
 
-    return detail::write_raw_regs(tid, iov);
 }
 
 }
@@ -23,17 +23,23 @@
 namespace mb::systrace::detail
 {
 
-static SysCallInfo g_aarch64_sc[] = {
+static constexpr SysCallInfo g_aarch64_sc[] = {
 #include "syscalls_list.aarch64.h"
 };
+static constexpr auto g_aarch64_sc_by_name = sc_build_hash<true>(g_aarch64_sc);
+static constexpr auto g_aarch64_sc_by_num = sc_build_hash<false>(g_aarch64_sc);
+static_assert(g_aarch64_sc_by_name.ok && g_aarch64_sc_by_num.ok);
 
-static SysCallInfo g_arm_sc[] = {
+static constexpr SysCallInfo g_arm_sc[] = {
 #include "syscalls_list.arm.h"
 };
+static constexpr auto g_arm_sc_by_name = sc_build_hash<true>(g_arm_sc);
+static constexpr auto g_arm_sc_by_num = sc_build_hash<false>(g_arm_sc);
+static_assert(g_arm_sc_by_name.ok && g_arm_sc_by_num.ok);
 
-const SysCallInfo *g_syscalls_map[] = {
-    g_aarch64_sc,
-    g_arm_sc,
+const SysCallTable g_syscall_tables[] = {
+    sc_make_table(g_aarch64_sc, g_aarch64_sc_by_name, g_aarch64_sc_by_num),
+    sc_make_table(g_arm_sc, g_arm_sc_by_name, g_arm_sc_by_num),
 };
 
 }
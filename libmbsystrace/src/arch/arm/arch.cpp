@@ -21,11 +21,13 @@
 
 #include "mbsystrace/arch.h"
 
+#include <linux/audit.h>
 #include <sys/ptrace.h>
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/integer.h"
 
+#include "mbsystrace/ptrace_p.h"
 #include "mbsystrace/registers_p.h"
 
 #define ARM_ARG0            uregs[0] // ARM_r0
@@ -181,19 +183,64 @@ oc::result<ArchRegs> read_regs(pid_t tid)
 
 oc::result<void> write_regs(pid_t tid, const ArchRegs &ar)
 {
+    OUTCOME_TRYV(write_syscall_num(tid, ar));
+
+    iovec iov;
+    iov.iov_base = const_cast<user_regs *>(&ar.m_regs);
+    iov.iov_len = sizeof(ar.m_regs);
+
+    return detail::write_raw_regs(tid, iov);
+}
+
+oc::result<void> write_syscall_num(pid_t tid, const ArchRegs &ar)
+{
+    // The syscall number is not part of the general purpose registers
     if (ar.m_new_syscall) {
         uint32_t n = static_cast<uint16_t>(*ar.m_new_syscall);
 
-        if (ptrace(PTRACE_SET_SYSCALL, tid, nullptr, n) != 0) {
+        if (detail::counted_ptrace(PTRACE_SET_SYSCALL, tid, nullptr, n) != 0) {
             return ec_from_errno();
         }
     }
 
-    iovec iov;
-    iov.iov_base = const_cast<user_regs *>(&ar.m_regs);
-    iov.iov_len = sizeof(ar.m_regs);
+    return oc::success();
+}
+
+namespace detail
+{
+
+uint32_t audit_arch(ArchAbi abi)
+{
+    switch (abi) {
+    case ArchAbi::Eabi:
+        return AUDIT_ARCH_ARM;
+    default:
+        MB_UNREACHABLE("Unknown ABI");
+    }
+}
+
+size_t pointer_size(ArchAbi abi)
+{
+    switch (abi) {
+    case ArchAbi::Eabi:
+        return 4;
+    default:
+        MB_UNREACHABLE("Unknown ABI");
+    }
+}
+
+std::optional<ArchAbi> abi_from_audit_arch(uint32_t arch, SysCallNum nr)
+{
+    (void) nr;
+
+    switch (arch) {
+    case AUDIT_ARCH_ARM:
+        return ArchAbi::Eabi;
+    default:
+        return std::nullopt;
+    }
+}
 
-    return detail::write_raw_regs(tid, iov);
 }
 
 }
@@ -19,8 +19,15 @@
 
 #include "mbsystrace/arch.h"
 
+#include <cstddef>
+
+#include <linux/audit.h>
+#include <sys/ptrace.h>
+
+#include "mbcommon/error_code.h"
 #include "mbcommon/integer.h"
 
+#include "mbsystrace/ptrace_p.h"
 #include "mbsystrace/registers_p.h"
 
 #define I386_ARG0               ebx
@@ -179,4 +186,52 @@ oc::result<void> write_regs(pid_t tid, const ArchRegs &ar)
     return detail::write_raw_regs(tid, iov);
 }
 
+oc::result<void> write_syscall_num(pid_t tid, const ArchRegs &ar)
+{
+    if (detail::counted_ptrace(PTRACE_POKEUSER, tid,
+                               offsetof(user_regs_struct, orig_eax),
+                               ar.m_regs.I386_SYSCALL) != 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+namespace detail
+{
+
+uint32_t audit_arch(ArchAbi abi)
+{
+    switch (abi) {
+    case ArchAbi::X86_32:
+        return AUDIT_ARCH_I386;
+    default:
+        MB_UNREACHABLE("Unknown ABI");
+    }
+}
+
+size_t pointer_size(ArchAbi abi)
+{
+    switch (abi) {
+    case ArchAbi::X86_32:
+        return 4;
+    default:
+        MB_UNREACHABLE("Unknown ABI");
+    }
+}
+
+std::optional<ArchAbi> abi_from_audit_arch(uint32_t arch, SysCallNum nr)
+{
+    (void) nr;
+
+    switch (arch) {
+    case AUDIT_ARCH_I386:
+        return ArchAbi::X86_32;
+    default:
+        return std::nullopt;
+    }
+}
+
+}
+
 }
@@ -23,12 +23,15 @@
 namespace mb::systrace::detail
 {
 
-static SysCallInfo g_x86_sc[] = {
+static constexpr SysCallInfo g_x86_sc[] = {
 #include "syscalls_list.x86.h"
 };
+static constexpr auto g_x86_sc_by_name = sc_build_hash<true>(g_x86_sc);
+static constexpr auto g_x86_sc_by_num = sc_build_hash<false>(g_x86_sc);
+static_assert(g_x86_sc_by_name.ok && g_x86_sc_by_num.ok);
 
-const SysCallInfo *g_syscalls_map[] = {
-    g_x86_sc,
+const SysCallTable g_syscall_tables[] = {
+    sc_make_table(g_x86_sc, g_x86_sc_by_name, g_x86_sc_by_num),
 };
 
 }
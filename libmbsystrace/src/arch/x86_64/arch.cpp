@@ -21,10 +21,16 @@
 
 #include "mbsystrace/arch.h"
 
+#include <cstddef>
+
+#include <linux/audit.h>
+#include <sys/ptrace.h>
 #include <sys/syscall.h>
 
+#include "mbcommon/error_code.h"
 #include "mbcommon/integer.h"
 
+#include "mbsystrace/ptrace_p.h"
 #include "mbsystrace/registers_p.h"
 
 #define X86_64_ARG0             x86_64.rdi
@@ -413,4 +419,68 @@ oc::result<void> write_regs(pid_t tid, const ArchRegs &ar)
     return detail::write_raw_regs(tid, iov);
 }
 
+oc::result<void> write_syscall_num(pid_t tid, const ArchRegs &ar)
+{
+    // The user area offsets differ for 32-bit tracees
+    if (ar.m_abi == ArchAbi::X86_32) {
+        return write_regs(tid, ar);
+    }
+
+    if (detail::counted_ptrace(PTRACE_POKEUSER, tid,
+                               offsetof(user_regs_struct, orig_rax),
+                               ar.m_regs.X86_64_SYSCALL) != 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+namespace detail
+{
+
+uint32_t audit_arch(ArchAbi abi)
+{
+    switch (abi) {
+    case ArchAbi::X86_64:
+        return AUDIT_ARCH_X86_64;
+    case ArchAbi::X86_32:
+        return AUDIT_ARCH_I386;
+    case ArchAbi::X32:
+        return AUDIT_ARCH_X86_64;
+    default:
+        MB_UNREACHABLE("Unknown ABI");
+    }
+}
+
+size_t pointer_size(ArchAbi abi)
+{
+    switch (abi) {
+    case ArchAbi::X86_64:
+        return 8;
+    case ArchAbi::X86_32:
+    case ArchAbi::X32:
+        return 4;
+    default:
+        MB_UNREACHABLE("Unknown ABI");
+    }
+}
+
+std::optional<ArchAbi> abi_from_audit_arch(uint32_t arch, SysCallNum nr)
+{
+    switch (arch) {
+    case AUDIT_ARCH_X86_64:
+        // x32 uses the x86_64 audit arch with __X32_SYSCALL_BIT set
+        if (nr & __X32_SYSCALL_BIT && make_signed_v(nr) != -1) {
+            return ArchAbi::X32;
+        }
+        return ArchAbi::X86_64;
+    case AUDIT_ARCH_I386:
+        return ArchAbi::X86_32;
+    default:
+        return std::nullopt;
+    }
+}
+
+}
+
 }
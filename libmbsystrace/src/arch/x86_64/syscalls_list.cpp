@@ -23,22 +23,31 @@
 namespace mb::systrace::detail
 {
 
-static SysCallInfo g_x86_64_sc[] = {
+static constexpr SysCallInfo g_x86_64_sc[] = {
 #include "syscalls_list.x86_64.h"
 };
+static constexpr auto g_x86_64_sc_by_name = sc_build_hash<true>(g_x86_64_sc);
+static constexpr auto g_x86_64_sc_by_num = sc_build_hash<false>(g_x86_64_sc);
+static_assert(g_x86_64_sc_by_name.ok && g_x86_64_sc_by_num.ok);
 
-static SysCallInfo g_x86_sc[] = {
+static constexpr SysCallInfo g_x86_sc[] = {
 #include "syscalls_list.x86.h"
 };
+static constexpr auto g_x86_sc_by_name = sc_build_hash<true>(g_x86_sc);
+static constexpr auto g_x86_sc_by_num = sc_build_hash<false>(g_x86_sc);
+static_assert(g_x86_sc_by_name.ok && g_x86_sc_by_num.ok);
 
-static SysCallInfo g_x32_sc[] = {
+static constexpr SysCallInfo g_x32_sc[] = {
 #include "syscalls_list.x32.h"
 };
-
-const SysCallInfo *g_syscalls_map[] = {
-    g_x86_64_sc,
-    g_x86_sc,
-    g_x32_sc,
+static constexpr auto g_x32_sc_by_name = sc_build_hash<true>(g_x32_sc);
+static constexpr auto g_x32_sc_by_num = sc_build_hash<false>(g_x32_sc);
+static_assert(g_x32_sc_by_name.ok && g_x32_sc_by_num.ok);
+
+const SysCallTable g_syscall_tables[] = {
+    sc_make_table(g_x86_64_sc, g_x86_64_sc_by_name, g_x86_64_sc_by_num),
+    sc_make_table(g_x86_sc, g_x86_sc_by_name, g_x86_sc_by_num),
+    sc_make_table(g_x32_sc, g_x32_sc_by_name, g_x32_sc_by_num),
 };
 
 }
@@ -30,6 +30,8 @@
 #include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
 
+#include "mbsystrace/ptrace_p.h"
+
 namespace mb::systrace::detail
 {
 
@@ -51,45 +53,16 @@ static oc::result<ProcessEvent> retry_or_failure(std::error_code ec)
 }
 
 /*!
- * \brief Wait for next event from child processes and tracees
- *
- * This function will wait for the next event using the waitpid/ptrace APIs.
- *
- * The caller must respond appropriately to the events as described in each
- * event's documentation.
+ * \brief Convert waitpid status to an event
  *
- * \note This function will only wait on children of the calling thread. Thus,
- *       multiple Tracer instances can be used as long as they're running on
- *       different threads.
+ * \param pid PID returned by `waitpid()`
+ * \param status Status returned by `waitpid()`
  *
- * \param pid_spec Same meaning as the \p pid parameter to waitpid().
- *   * If `< -1`, wait for any child process or tracee whose process group ID is
- *     `|pid|`
- *   * If `== -1`, wait for any child process or tracee
- *   * If `== 0`, wait for any child process or tracee whose process group ID
- *     matches that of the calling process
- *   * If `> 0`, wait for the child process or tracee whose process ID is equal
- *     to \p pid_spec
- *
- * \return Returns a ProcessEvent if an event is emitted and information about
- *         the event is successfully queried. Otherwise, returns an error code.
- *         Note that `EINTR` and `ECHILD` are not considered errors and an
- *         appropriate event will be returned.
+ * \return Returns a ProcessEvent if information about the event is successfully
+ *         queried. Otherwise, returns an error code.
  */
-oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
+static oc::result<ProcessEvent> decode_event(pid_t pid, int status) noexcept
 {
-    int status;
-    pid_t pid = waitpid(pid_spec, &status, __WALL | __WNOTHREAD);
-    if (pid == -1) {
-        if (errno == EINTR) {
-            return RetryEvent{};
-        } else if (errno == ECHILD) {
-            return NoChildrenEvent{};
-        } else {
-            return ec_from_errno();
-        }
-    }
-
     if (WIFEXITED(status)) {
         return ProcessExitEvent{pid, status, WEXITSTATUS(status)};
     } else if (WIFSIGNALED(status)) {
@@ -103,7 +76,8 @@ oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
             case PTRACE_EVENT_FORK:
             case PTRACE_EVENT_VFORK: {
                 unsigned long new_pid;
-                if (ptrace(PTRACE_GETEVENTMSG, pid, nullptr, &new_pid) != 0) {
+                if (counted_ptrace(PTRACE_GETEVENTMSG, pid, nullptr,
+                                   &new_pid) != 0) {
                     return retry_or_failure(ec_from_errno());
                 }
 
@@ -112,7 +86,8 @@ oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
 
             case PTRACE_EVENT_EXEC: {
                 unsigned long orig_tid;
-                if (ptrace(PTRACE_GETEVENTMSG, pid, nullptr, &orig_tid) != 0) {
+                if (counted_ptrace(PTRACE_GETEVENTMSG, pid, nullptr,
+                                   &orig_tid) != 0) {
                     return retry_or_failure(ec_from_errno());
                 }
 
@@ -121,13 +96,24 @@ oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
 
             case PTRACE_EVENT_EXIT: {
                 unsigned long code;
-                if (ptrace(PTRACE_GETEVENTMSG, pid, nullptr, &code) != 0) {
+                if (counted_ptrace(PTRACE_GETEVENTMSG, pid, nullptr,
+                                   &code) != 0) {
                     return retry_or_failure(ec_from_errno());
                 }
 
                 return ExitStopEvent{pid, static_cast<int>(code)};
             }
 
+            case PTRACE_EVENT_SECCOMP: {
+                auto regs = read_syscall_regs(pid);
+                if (!regs) {
+                    return retry_or_failure(regs.error());
+                }
+
+                return SecCompStopEvent{pid, std::move(regs.value().regs),
+                                        regs.value().content};
+            }
+
             case PTRACE_EVENT_STOP: {
                 if (signal == SIGSTOP || signal == SIGTSTP
                         || signal == SIGTTIN || signal == SIGTTOU) {
@@ -146,12 +132,13 @@ oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
 
             default: {
                 if (signal == (SIGTRAP | 0x80)) {
-                    auto regs = read_regs(pid);
+                    auto regs = read_syscall_regs(pid);
                     if (!regs) {
                         return retry_or_failure(regs.error());
                     }
 
-                    return SysCallStopEvent{pid, std::move(regs.value())};
+                    return SysCallStopEvent{pid, std::move(regs.value().regs),
+                                            regs.value().content};
                 } else {
                     return SignalDeliveryStopEvent{pid, signal};
                 }
@@ -162,4 +149,108 @@ oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
     }
 }
 
+/*!
+ * \brief Wait for next event from child processes and tracees
+ *
+ * This function will wait for the next event using the waitpid/ptrace APIs.
+ *
+ * The caller must respond appropriately to the events as described in each
+ * event's documentation.
+ *
+ * \note This function will only wait on children of the calling thread. Thus,
+ *       multiple Tracer instances can be used as long as they're running on
+ *       different threads.
+ *
+ * \param pid_spec Same meaning as the \p pid parameter to waitpid().
+ *   * If `< -1`, wait for any child process or tracee whose process group ID is
+ *     `|pid|`
+ *   * If `== -1`, wait for any child process or tracee
+ *   * If `== 0`, wait for any child process or tracee whose process group ID
+ *     matches that of the calling process
+ *   * If `> 0`, wait for the child process or tracee whose process ID is equal
+ *     to \p pid_spec
+ *
+ * \return Returns a ProcessEvent if an event is emitted and information about
+ *         the event is successfully queried. Otherwise, returns an error code.
+ *         Note that `EINTR` and `ECHILD` are not considered errors and an
+ *         appropriate event will be returned.
+ */
+oc::result<ProcessEvent> next_event(pid_t pid_spec) noexcept
+{
+    int status;
+    pid_t pid = waitpid(pid_spec, &status, __WALL | __WNOTHREAD);
+    if (pid == -1) {
+        if (errno == EINTR) {
+            return RetryEvent{};
+        } else if (errno == ECHILD) {
+            return NoChildrenEvent{};
+        } else {
+            return ec_from_errno();
+        }
+    }
+
+    return decode_event(pid, status);
+}
+
+/*!
+ * \brief Get next event from child processes and tracees without waiting
+ *
+ * This function behaves like next_event(), except that it will return
+ * immediately if no child process or tracee has a pending event. This allows
+ * all events that are already available to be collected after next_event()
+ * returns.
+ *
+ * \param pid_spec Same meaning as the \p pid_spec parameter to next_event()
+ *
+ * \return Returns a ProcessEvent if an event is pending and information about
+ *         the event is successfully queried. Returns std::nullopt if no event
+ *         is pending or if `waitpid()` returns `EINTR` or `ECHILD`. Otherwise,
+ *         returns an error code.
+ */
+oc::result<std::optional<ProcessEvent>> poll_event(pid_t pid_spec) noexcept
+{
+    int status;
+    pid_t pid = waitpid(pid_spec, &status, __WALL | __WNOTHREAD | WNOHANG);
+    if (pid == 0) {
+        return std::nullopt;
+    } else if (pid == -1) {
+        if (errno == EINTR || errno == ECHILD) {
+            return std::nullopt;
+        } else {
+            return ec_from_errno();
+        }
+    }
+
+    OUTCOME_TRY(event, decode_event(pid, status));
+    return std::move(event);
+}
+
+/*!
+ * \brief Get the process that an event was reported for
+ *
+ * \param event Event returned by next_event() or poll_event()
+ *
+ * \return Returns the PID that `waitpid()` returned for the event or -1 if the
+ *         event is a NoChildrenEvent or RetryEvent.
+ */
+pid_t event_pid(const ProcessEvent &event) noexcept
+{
+    return std::visit(
+        [](auto &&e) -> pid_t {
+            using T = std::decay_t<decltype(e)>;
+
+            if constexpr (std::is_same_v<T, NoChildrenEvent>
+                    || std::is_same_v<T, RetryEvent>) {
+                return -1;
+            } else if constexpr (std::is_same_v<T, ProcessExitEvent>
+                    || std::is_same_v<T, ProcessDeathEvent>) {
+                return e.pid;
+            } else {
+                return e.tid;
+            }
+        },
+        event
+    );
+}
+
 }
@@ -19,17 +19,65 @@
 
 #include "mbsystrace/registers_p.h"
 
+#include <atomic>
+
+#include <cerrno>
+
 #include <linux/elf.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "mbcommon/error_code.h"
 
+#include "mbsystrace/ptrace_p.h"
+
 namespace mb::systrace::detail
 {
 
+// Use our own definitions because depending on the libc, <sys/ptrace.h> either
+// does not have them or conflicts with <linux/ptrace.h>
+static constexpr long PTRACE_GET_SYSCALL_INFO_REQUEST = 0x420e;
+
+enum : uint8_t
+{
+    SYSCALL_INFO_NONE,
+    SYSCALL_INFO_ENTRY,
+    SYSCALL_INFO_EXIT,
+    SYSCALL_INFO_SECCOMP,
+};
+
+//! Same layout as `struct ptrace_syscall_info` from `<linux/ptrace.h>`
+struct PtraceSysCallInfo
+{
+    uint8_t op;
+    uint8_t pad[3];
+    uint32_t arch;
+    alignas(8) uint64_t instruction_pointer;
+    alignas(8) uint64_t stack_pointer;
+    union {
+        struct {
+            uint64_t nr;
+            uint64_t args[6];
+        } entry;
+        struct {
+            int64_t rval;
+            uint8_t is_error;
+        } exit;
+        struct {
+            uint64_t nr;
+            uint64_t args[6];
+            uint32_t ret_data;
+        } seccomp;
+    };
+};
+
+//! Whether PTRACE_GET_SYSCALL_INFO is known to be unsupported (kernel < 5.3)
+static std::atomic_bool g_no_syscall_info{false};
+
 oc::result<void> read_raw_regs(pid_t tid, iovec &iov)
 {
-    if (ptrace(PTRACE_GETREGSET, tid, NT_PRSTATUS, &iov) != 0) {
+    if (counted_ptrace(PTRACE_GETREGSET, tid, NT_PRSTATUS, &iov) != 0) {
         return ec_from_errno();
     }
 
@@ -38,11 +86,77 @@ oc::result<void> read_raw_regs(pid_t tid, iovec &iov)
 
 oc::result<void> write_raw_regs(pid_t tid, iovec &iov)
 {
-    if (ptrace(PTRACE_SETREGSET, tid, NT_PRSTATUS, &iov) != 0) {
+    if (counted_ptrace(PTRACE_SETREGSET, tid, NT_PRSTATUS, &iov) != 0) {
         return ec_from_errno();
     }
 
     return oc::success();
 }
 
+
+/*!
+ * \brief Read syscall number, arguments, and return value of a tracee
+ *
+ * If the kernel supports `PTRACE_GET_SYSCALL_INFO` (Linux 5.3+), only the
+ * syscall-related values are queried, which avoids copying the entire register
+ * set for every syscall-stop. Otherwise, this falls back to read_regs().
+ *
+ * \pre The tracee must be in a syscall-stop or seccomp-stop
+ *
+ * \param tid Tracee TID
+ *
+ * \return The register values and which of them are valid if successful.
+ *         Otherwise, the error code.
+ */
+oc::result<SysCallRegs> read_syscall_regs(pid_t tid)
+{
+    if (!g_no_syscall_info.load(std::memory_order_relaxed)) {
+        PtraceSysCallInfo info;
+
+        // Call the syscall directly since glibc's ptrace() prototype only
+        // accepts the requests that it knows about
+        ++g_ptrace_calls;
+        long ret = syscall(SYS_ptrace, PTRACE_GET_SYSCALL_INFO_REQUEST, tid,
+                           sizeof(info), &info);
+        if (ret < 0 && errno == EIO) {
+            g_no_syscall_info.store(true, std::memory_order_relaxed);
+        } else if (ret < 0) {
+            return ec_from_errno();
+        } else if (info.op == SYSCALL_INFO_ENTRY
+                || info.op == SYSCALL_INFO_SECCOMP) {
+            bool is_entry = info.op == SYSCALL_INFO_ENTRY;
+            uint64_t nr = is_entry ? info.entry.nr : info.seccomp.nr;
+            const uint64_t *args = is_entry
+                    ? info.entry.args : info.seccomp.args;
+
+            if (auto abi = abi_from_audit_arch(
+                    info.arch, static_cast<SysCallNum>(nr))) {
+                ArchRegs regs(*abi);
+                regs.set_ip(static_cast<KernelULong>(info.instruction_pointer));
+                regs.set_ptrace_syscall(static_cast<KernelULong>(nr));
+                regs.set_arg0(static_cast<KernelULong>(args[0]));
+                regs.set_arg1(static_cast<KernelULong>(args[1]));
+                regs.set_arg2(static_cast<KernelULong>(args[2]));
+                regs.set_arg3(static_cast<KernelULong>(args[3]));
+                regs.set_arg4(static_cast<KernelULong>(args[4]));
+                regs.set_arg5(static_cast<KernelULong>(args[5]));
+
+                return SysCallRegs{std::move(regs), RegsContent::SysCallEntry};
+            }
+        } else if (info.op == SYSCALL_INFO_EXIT) {
+            if (auto abi = abi_from_audit_arch(info.arch, 0)) {
+                ArchRegs regs(*abi);
+                regs.set_ip(static_cast<KernelULong>(info.instruction_pointer));
+                regs.set_ret(static_cast<KernelSLong>(info.exit.rval));
+
+                return SysCallRegs{std::move(regs), RegsContent::SysCallExit};
+            }
+        }
+    }
+
+    OUTCOME_TRY(regs, read_regs(tid));
+
+    return SysCallRegs{std::move(regs), RegsContent::All};
+}
+
 }
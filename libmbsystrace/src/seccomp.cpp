@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbsystrace/seccomp_p.h"
+
+#include <algorithm>
+
+#include <cstddef>
+#include <cstdio>
+
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <sys/prctl.h>
+#include <sys/utsname.h>
+
+#include "mbcommon/error_code.h"
+
+namespace mb::systrace::detail
+{
+
+struct AuditArch
+{
+    ArchAbi abi;
+    uint32_t arch;
+};
+
+// ABIs that share an audit arch (eg. x86_64 and x32) are distinguished by their
+// syscall numbers
+static constexpr AuditArch g_audit_arches[] = {
+#if defined(__x86_64__)
+    { ArchAbi::X86_64, AUDIT_ARCH_X86_64 },
+    { ArchAbi::X86_32, AUDIT_ARCH_I386 },
+    { ArchAbi::X32, AUDIT_ARCH_X86_64 },
+#elif defined(__i386__)
+    { ArchAbi::X86_32, AUDIT_ARCH_I386 },
+#elif defined(__aarch64__)
+    { ArchAbi::Aarch64, AUDIT_ARCH_AARCH64 },
+    { ArchAbi::Eabi, AUDIT_ARCH_ARM },
+#elif defined(__arm__)
+    { ArchAbi::Eabi, AUDIT_ARCH_ARM },
+#else
+#  error Unsupported architecture
+#endif
+};
+
+/*!
+ * \brief Check whether seccomp-stops occur after syscall-entry stops
+ *
+ * Prior to kernel 4.8, the seccomp-stop happened before the syscall-entry stop
+ * and the tracer could not change the syscall from the seccomp-stop reliably.
+ */
+static bool has_seccomp_after_ptrace()
+{
+    utsname uts;
+    int major;
+    int minor;
+
+    if (uname(&uts) != 0
+            || sscanf(uts.release, "%d.%d", &major, &minor) != 2) {
+        return false;
+    }
+
+    return major > 4 || (major == 4 && minor >= 8);
+}
+
+static sock_filter bpf_stmt(uint16_t code, uint32_t k)
+{
+    return BPF_STMT(code, k);
+}
+
+static sock_filter bpf_jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf)
+{
+    return BPF_JUMP(code, k, jt, jf);
+}
+
+/*!
+ * \brief Build seccomp filter that traces the specified syscalls
+ *
+ * The resulting filter returns `SECCOMP_RET_TRACE` for syscalls in \p syscalls
+ * and `SECCOMP_RET_ALLOW` for all other syscalls of the ABIs supported by the
+ * current architecture. Syscalls from unknown audit arches are traced so that
+ * they are not silently missed.
+ *
+ * \param syscalls List of syscalls to trace
+ *
+ * \return
+ *   * The BPF program if successful
+ *   * `std::errc::invalid_argument` if \p syscalls contains an invalid syscall
+ *   * `std::errc::argument_list_too_long` if the program is too large
+ *   * `std::errc::function_not_supported` if the kernel is older than 4.8
+ */
+oc::result<std::vector<sock_filter>>
+build_syscall_filter(const std::vector<SysCall> &syscalls)
+{
+    if (!has_seccomp_after_ptrace()) {
+        return std::errc::function_not_supported;
+    }
+
+    std::vector<std::pair<uint32_t, std::vector<uint32_t>>> arch_nums;
+
+    for (auto const &a : g_audit_arches) {
+        if (std::none_of(arch_nums.begin(), arch_nums.end(),
+                         [&](auto const &p) { return p.first == a.arch; })) {
+            arch_nums.emplace_back(a.arch, std::vector<uint32_t>());
+        }
+    }
+
+    for (auto const &sc : syscalls) {
+        if (!sc) {
+            return std::errc::invalid_argument;
+        }
+
+        auto it = std::find_if(std::begin(g_audit_arches),
+                               std::end(g_audit_arches),
+                               [&](auto const &a) { return a.abi == sc.abi(); });
+        if (it == std::end(g_audit_arches)) {
+            return std::errc::invalid_argument;
+        }
+
+        auto entry = std::find_if(arch_nums.begin(), arch_nums.end(),
+                                  [&](auto const &p) {
+            return p.first == it->arch;
+        });
+
+        entry->second.push_back(static_cast<uint32_t>(sc.num()));
+    }
+
+    std::vector<sock_filter> program;
+
+    program.push_back(bpf_stmt(BPF_LD | BPF_W | BPF_ABS,
+                               offsetof(seccomp_data, arch)));
+
+    for (auto &[arch, nums] : arch_nums) {
+        std::sort(nums.begin(), nums.end());
+        nums.erase(std::unique(nums.begin(), nums.end()), nums.end());
+
+        // Load syscall number, two instructions per syscall, and allow
+        auto block_size = static_cast<uint32_t>(1 + 2 * nums.size() + 1);
+
+        // BPF jump offsets are 8-bit, so skip the block with BPF_JA
+        program.push_back(bpf_jump(BPF_JMP | BPF_JEQ | BPF_K, arch, 1, 0));
+        program.push_back(bpf_stmt(BPF_JMP | BPF_JA, block_size));
+
+        program.push_back(bpf_stmt(BPF_LD | BPF_W | BPF_ABS,
+                                   offsetof(seccomp_data, nr)));
+        for (auto nr : nums) {
+            program.push_back(bpf_jump(BPF_JMP | BPF_JEQ | BPF_K, nr, 0, 1));
+            program.push_back(bpf_stmt(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+        }
+        program.push_back(bpf_stmt(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+    }
+
+    program.push_back(bpf_stmt(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+
+    if (program.size() > BPF_MAXINSNS) {
+        return std::errc::argument_list_too_long;
+    }
+
+    return std::move(program);
+}
+
+/*!
+ * \brief Install seccomp filter for the calling thread
+ *
+ * If the caller lacks `CAP_SYS_ADMIN`, `PR_SET_NO_NEW_PRIVS` will be set before
+ * installing the filter.
+ *
+ * \note This function is async-signal-safe and can be called in a child process
+ *       after `fork()`.
+ *
+ * \param program BPF program from build_syscall_filter()
+ *
+ * \return Nothing if successful. Otherwise, the error code.
+ */
+oc::result<void>
+install_syscall_filter(const std::vector<sock_filter> &program) noexcept
+{
+    sock_fprog prog = {
+        static_cast<unsigned short>(program.size()),
+        const_cast<sock_filter *>(program.data()),
+    };
+
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == 0) {
+        return oc::success();
+    } else if (errno != EACCES) {
+        return ec_from_errno();
+    }
+
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0
+            || prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) != 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+}
@@ -27,6 +27,36 @@
 namespace mb::systrace
 {
 
+using namespace detail;
+
+static const SysCallInfo * find_syscall(const SysCallTable &table,
+                                        SysCallNum num)
+{
+    auto h = sc_hash_num(num);
+    auto seed = table.num_seeds[sc_bucket(h) & table.bucket_mask];
+    auto index = table.num_slots[sc_slot(h, seed) & table.slot_mask];
+
+    if (index != SC_EMPTY_SLOT && table.list[index].num == num) {
+        return &table.list[index];
+    }
+
+    return nullptr;
+}
+
+static const SysCallInfo * find_syscall(const SysCallTable &table,
+                                        const char *name)
+{
+    auto h = sc_hash_name(name);
+    auto seed = table.name_seeds[sc_bucket(h) & table.bucket_mask];
+    auto index = table.name_slots[sc_slot(h, seed) & table.slot_mask];
+
+    if (index != SC_EMPTY_SLOT && strcmp(table.list[index].name, name) == 0) {
+        return &table.list[index];
+    }
+
+    return nullptr;
+}
+
 /*!
  * \class SysCall
  *
@@ -57,14 +87,11 @@ SysCall::SysCall(SysCallNum num, ArchAbi abi) noexcept
 {
     auto i = static_cast<std::underlying_type_t<ArchAbi>>(abi);
 
-    for (auto it = detail::g_syscalls_map[i]; it->name; ++it) {
-        if (it->num == num) {
-            m_num = num;
-            m_abi = abi;
-            m_name = it->name;
-            m_valid = true;
-            return;
-        }
+    if (auto info = find_syscall(g_syscall_tables[i], num)) {
+        m_num = num;
+        m_abi = abi;
+        m_name = info->name;
+        m_valid = true;
     }
 }
 
@@ -82,14 +109,11 @@ SysCall::SysCall(const char *name, ArchAbi abi) noexcept
 {
     auto i = static_cast<std::underlying_type_t<ArchAbi>>(abi);
 
-    for (auto it = detail::g_syscalls_map[i]; it->name; ++it) {
-        if (strcmp(it->name, name) == 0) {
-            m_num = it->num;
-            m_abi = abi;
-            m_name = name;
-            m_valid = true;
-            return;
-        }
+    if (auto info = find_syscall(g_syscall_tables[i], name)) {
+        m_num = info->num;
+        m_abi = abi;
+        m_name = info->name;
+        m_valid = true;
     }
 }
 
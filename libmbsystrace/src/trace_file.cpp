@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsystrace/trace_file.h"
+
+#include <cstring>
+
+#include "mbcommon/file_util.h"
+
+#include "mbsystrace/registers_p.h"
+
+namespace mb::systrace
+{
+
+using namespace detail;
+
+// Binary trace format
+//
+// The file begins with a header containing TRACE_MAGIC, TRACE_VERSION (1 byte),
+// and the audit arch of the native ABI (4 bytes, little endian). The header is
+// followed by the records. Each record begins with the record type (1 byte),
+// the time since the previous record, and the TID. The remaining fields depend
+// on the record type:
+//
+// * TraceeExit, TraceeDeath, TraceeSignal, GroupStop, UnknownChild: value
+// * SysCallEntry: ABI (1 byte), syscall number
+// * SysCallExit: ABI (1 byte), syscall number, return value
+//
+// Unless otherwise specified, fields are LEB128 varints. Signed fields (TID,
+// value, and return value) are zigzag encoded first.
+
+static constexpr char TRACE_MAGIC[] = "MBSTRACE";
+static constexpr size_t TRACE_MAGIC_SIZE = sizeof(TRACE_MAGIC) - 1;
+static constexpr uint8_t TRACE_VERSION = 1;
+
+//! Size at which the writer flushes its buffer
+static constexpr size_t WRITE_BUFFER_SIZE = 64 * 1024;
+//! Size of the reader's buffer
+static constexpr size_t READ_BUFFER_SIZE = 64 * 1024;
+
+//! Maximum number of bytes in a LEB128 encoded 64-bit integer
+static constexpr size_t MAX_VARINT_SIZE = 10;
+
+static uint64_t zigzag_encode(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1)
+            ^ static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1)
+            ^ -static_cast<int64_t>(value & 1);
+}
+
+static bool has_value(TraceRecordType type)
+{
+    switch (type) {
+    case TraceRecordType::TraceeExit:
+    case TraceRecordType::TraceeDeath:
+    case TraceRecordType::TraceeSignal:
+    case TraceRecordType::GroupStop:
+    case TraceRecordType::UnknownChild:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*!
+ * \class TraceWriter
+ *
+ * \brief Writer for compact binary traces
+ *
+ * Hooks can use this class to record events with much less overhead than
+ * formatting text. The records are buffered and only written to the file when
+ * the buffer is full, when flush() is called, or when the TraceWriter is
+ * destroyed. Use TraceReader to decode the trace.
+ */
+
+/*!
+ * \brief Construct a new TraceWriter
+ *
+ * The header is written along with the first records.
+ *
+ * \param file File to write the trace to. Must remain valid for the lifetime
+ *             of this TraceWriter.
+ */
+TraceWriter::TraceWriter(File &file)
+    : m_file(file)
+    , m_time(0)
+{
+    m_buf.reserve(WRITE_BUFFER_SIZE + 64);
+    m_buf.insert(m_buf.end(), TRACE_MAGIC, TRACE_MAGIC + TRACE_MAGIC_SIZE);
+    put_byte(TRACE_VERSION);
+
+    auto arch = audit_arch(NATIVE_ARCH_ABI);
+    for (int i = 0; i < 4; ++i) {
+        put_byte(static_cast<uint8_t>(arch >> (i * 8)));
+    }
+}
+
+/*!
+ * \brief Flush buffered records and destroy the TraceWriter
+ *
+ * Errors that occur while flushing are ignored. Call flush() explicitly to
+ * check for errors.
+ */
+TraceWriter::~TraceWriter()
+{
+    (void) flush();
+}
+
+/*!
+ * \brief Append record to the trace
+ *
+ * \param record Record to write. TraceRecord::time must not be lower than that
+ *               of the previous record.
+ *
+ * \return Returns nothing if the record is buffered or written successfully.
+ *         Returns `std::errc::invalid_argument` if the time of \p record is
+ *         lower than that of the previous record. Otherwise, returns the error
+ *         that occurred while writing to the file.
+ */
+oc::result<void> TraceWriter::write(const TraceRecord &record)
+{
+    if (record.time < m_time) {
+        return std::errc::invalid_argument;
+    }
+
+    put_byte(static_cast<uint8_t>(record.type));
+    put_varint(record.time - m_time);
+    put_signed_varint(record.tid);
+
+    if (has_value(record.type)) {
+        put_signed_varint(record.value);
+    } else if (record.type == TraceRecordType::SysCallEntry
+            || record.type == TraceRecordType::SysCallExit) {
+        put_byte(static_cast<uint8_t>(record.abi));
+        put_varint(record.syscall);
+
+        if (record.type == TraceRecordType::SysCallExit) {
+            put_signed_varint(record.ret);
+        }
+    }
+
+    m_time = record.time;
+
+    if (m_buf.size() >= WRITE_BUFFER_SIZE) {
+        return flush();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write buffered records to the file
+ *
+ * \return Returns nothing on success or the error that occurred while writing
+ *         to the file. If an error occurs, the buffered records are discarded.
+ */
+oc::result<void> TraceWriter::flush()
+{
+    if (m_buf.empty()) {
+        return oc::success();
+    }
+
+    auto ret = file_write_exact(m_file, m_buf.data(), m_buf.size());
+    m_buf.clear();
+
+    return ret;
+}
+
+void TraceWriter::put_byte(uint8_t value)
+{
+    m_buf.push_back(value);
+}
+
+void TraceWriter::put_varint(uint64_t value)
+{
+    while (value >= 0x80) {
+        m_buf.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    m_buf.push_back(static_cast<unsigned char>(value));
+}
+
+void TraceWriter::put_signed_varint(int64_t value)
+{
+    put_varint(zigzag_encode(value));
+}
+
+/*!
+ * \class TraceReader
+ *
+ * \brief Reader for binary traces created by TraceWriter
+ */
+
+/*!
+ * \brief Construct a new TraceReader
+ *
+ * \param file File to read the trace from. Must remain valid for the lifetime
+ *             of this TraceReader.
+ */
+TraceReader::TraceReader(File &file)
+    : m_file(file)
+    , m_buf(READ_BUFFER_SIZE)
+    , m_pos(0)
+    , m_size(0)
+    , m_read_header(false)
+    , m_time(0)
+{
+}
+
+TraceReader::~TraceReader() = default;
+
+/*!
+ * \brief Read next record from the trace
+ *
+ * \return
+ *   * The next record if successful
+ *   * std::nullopt if the end of the trace is reached
+ *   * `std::errc::bad_message` if the trace is truncated or corrupt
+ *   * `std::errc::function_not_supported` if the trace was created for a
+ *     different architecture
+ *   * Otherwise, the error that occurred while reading from the file
+ */
+oc::result<std::optional<TraceRecord>> TraceReader::next()
+{
+    if (!m_read_header) {
+        char magic[TRACE_MAGIC_SIZE];
+        for (auto &c : magic) {
+            OUTCOME_TRY(byte, get_required_byte());
+            c = static_cast<char>(byte);
+        }
+
+        if (memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0) {
+            return std::errc::bad_message;
+        }
+
+        OUTCOME_TRY(version, get_required_byte());
+        if (version != TRACE_VERSION) {
+            return std::errc::bad_message;
+        }
+
+        uint32_t arch = 0;
+        for (int i = 0; i < 4; ++i) {
+            OUTCOME_TRY(byte, get_required_byte());
+            arch |= static_cast<uint32_t>(byte) << (i * 8);
+        }
+
+        if (arch != audit_arch(NATIVE_ARCH_ABI)) {
+            return std::errc::function_not_supported;
+        }
+
+        m_read_header = true;
+    }
+
+    OUTCOME_TRY(type, get_byte());
+    if (!type) {
+        return std::nullopt;
+    } else if (*type < static_cast<uint8_t>(TraceRecordType::NewTracee)
+            || *type > static_cast<uint8_t>(TraceRecordType::UnknownChild)) {
+        return std::errc::bad_message;
+    }
+
+    TraceRecord record{};
+    record.type = static_cast<TraceRecordType>(*type);
+
+    OUTCOME_TRY(delta, get_varint());
+    record.time = m_time + delta;
+
+    OUTCOME_TRY(tid, get_signed_varint());
+    record.tid = static_cast<pid_t>(tid);
+
+    if (has_value(record.type)) {
+        OUTCOME_TRY(value, get_signed_varint());
+        record.value = static_cast<int>(value);
+    } else if (record.type == TraceRecordType::SysCallEntry
+            || record.type == TraceRecordType::SysCallExit) {
+        OUTCOME_TRY(abi, get_required_byte());
+        if (abi >= ARCH_ABI_COUNT) {
+            return std::errc::bad_message;
+        }
+        record.abi = static_cast<ArchAbi>(abi);
+
+        OUTCOME_TRY(num, get_varint());
+        record.syscall = static_cast<SysCallNum>(num);
+
+        if (record.type == TraceRecordType::SysCallExit) {
+            OUTCOME_TRY(ret, get_signed_varint());
+            record.ret = static_cast<SysCallRet>(ret);
+        }
+    }
+
+    m_time = record.time;
+
+    return std::move(record);
+}
+
+oc::result<std::optional<uint8_t>> TraceReader::get_byte()
+{
+    if (m_pos == m_size) {
+        OUTCOME_TRY(n, file_read_retry(m_file, m_buf.data(), m_buf.size()));
+        if (n == 0) {
+            return std::nullopt;
+        }
+
+        m_pos = 0;
+        m_size = n;
+    }
+
+    return m_buf[m_pos++];
+}
+
+oc::result<uint8_t> TraceReader::get_required_byte()
+{
+    OUTCOME_TRY(byte, get_byte());
+    if (!byte) {
+        return std::errc::bad_message;
+    }
+
+    return *byte;
+}
+
+oc::result<uint64_t> TraceReader::get_varint()
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < MAX_VARINT_SIZE; ++i) {
+        OUTCOME_TRY(byte, get_required_byte());
+
+        value |= static_cast<uint64_t>(byte & 0x7f) << (i * 7);
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+
+    return std::errc::bad_message;
+}
+
+oc::result<int64_t> TraceReader::get_signed_varint()
+{
+    OUTCOME_TRY(value, get_varint());
+    return zigzag_decode(value);
+}
+
+}
@@ -28,6 +28,8 @@
 
 #include "mbsystrace/event_p.h"
 #include "mbsystrace/procfs_p.h"
+#include "mbsystrace/ptrace_p.h"
+#include "mbsystrace/tracer.h"
 
 namespace mb::systrace
 {
@@ -66,6 +68,11 @@ Tracee::Tracee(Tracer *tracer, pid_t tgid, pid_t tid)
     , m_tracer(tracer)
     , m_state(TraceeState::Detached)
     , m_exec_mode(ExecMode::User)
+    , m_syscall_filter(false)
+    , m_regs_content(RegsContent::All)
+    , m_regs_dirty(false)
+    , m_syscall_num_dirty(false)
+    , m_stop_time()
     , m_sc_status(SysCallStatus::Normal)
     , m_inj_exec_mode()
     , m_suppress_orig_num()
@@ -152,8 +159,10 @@ oc::result<void> Tracee::signal_process(int signal)
  *   * state() will be updated to TraceeState::Executing
  *
  * \param signal If zero, continue the execution of the tracee until the next
- *               syscall is reached (or another stop event occurs). If positive,
- *               inject the specified syscall.
+ *               syscall is reached (or another stop event occurs). If
+ *               syscall_filter() is enabled, only syscalls matching the seccomp
+ *               filter are stopped at. If positive, inject the specified
+ *               syscall.
  *
  * \return Returns nothing on success or an error code on failure.
  */
@@ -195,10 +204,23 @@ oc::result<void> Tracee::continue_exec_raw(int signal)
             break;
     }
 
-    if (ptrace(PTRACE_SYSCALL, tid, nullptr, signal) != 0) {
+    OUTCOME_TRYV(flush_regs());
+    m_page_cache.clear();
+
+    // With a seccomp filter, the syscall-entry stops come from the filter, so
+    // PTRACE_SYSCALL is only needed to reach the syscall-exit stop of the
+    // current syscall or the syscall-entry stop of an injected/repeated syscall
+    bool stop_at_syscall = !m_syscall_filter
+            || new_exec_mode.value_or(m_exec_mode) == ExecMode::Kernel
+            || m_sc_status != SysCallStatus::Normal;
+
+    if (counted_ptrace(stop_at_syscall ? PTRACE_SYSCALL : PTRACE_CONT,
+                       tid, nullptr, signal) != 0) {
         return ec_from_errno();
     }
 
+    account_stop_time();
+
     if (new_exec_mode) {
         m_exec_mode = *new_exec_mode;
     }
@@ -226,10 +248,14 @@ oc::result<void> Tracee::continue_stopped()
         return std::errc::invalid_argument;
     }
 
-    if (ptrace(PTRACE_LISTEN, tid, nullptr, nullptr) != 0) {
+    m_page_cache.clear();
+
+    if (counted_ptrace(PTRACE_LISTEN, tid, nullptr, nullptr) != 0) {
         return ec_from_errno();
     }
 
+    account_stop_time();
+
     m_state = TraceeState::Executing;
 
     return oc::success();
@@ -252,7 +278,7 @@ oc::result<void> Tracee::interrupt()
         return std::errc::invalid_argument;
     }
 
-    if (ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) != 0) {
+    if (counted_ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) != 0) {
         return ec_from_errno();
     }
 
@@ -269,6 +295,10 @@ oc::result<void> Tracee::interrupt()
  * If SeizeFlag::TryKillOnExit is specified, the tracee will be killed by the
  * kernel when the tracer process exits.
  *
+ * If SeizeFlag::TraceSecComp is specified, syscalls for which a seccomp filter
+ * returns `SECCOMP_RET_TRACE` will produce a detail::SecCompStopEvent. Without
+ * this flag, those syscalls fail with `ENOSYS`.
+ *
  * \note SeizeFlag::TryKillOnExit requires kernel 3.8 to work. If running on a
  *       system with an older kernel, the flag is a no-op.
  *
@@ -297,16 +327,21 @@ oc::result<void> Tracee::seize(SeizeFlags flags)
                 | PTRACE_O_TRACEVFORK;
     }
 
+    if (flags & SeizeFlag::TraceSecComp) {
+        options |= PTRACE_O_TRACESECCOMP;
+    }
+
     long ret = -1;
     errno = EINVAL;
 
     if (flags & SeizeFlag::TryKillOnExit) {
-        ret = ptrace(PTRACE_SEIZE, tid, nullptr, options | PTRACE_O_EXITKILL);
+        ret = counted_ptrace(PTRACE_SEIZE, tid, nullptr,
+                             options | PTRACE_O_EXITKILL);
     }
 
     // PTRACE_O_EXITKILL was added in kernel 3.8
     if (ret != 0 && errno == EINVAL) {
-        ret = ptrace(PTRACE_SEIZE, tid, nullptr, options);
+        ret = counted_ptrace(PTRACE_SEIZE, tid, nullptr, options);
     }
 
     if (ret != 0) {
@@ -314,7 +349,7 @@ oc::result<void> Tracee::seize(SeizeFlags flags)
     }
 
     auto detach = finally([&] {
-        ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+        counted_ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
     });
 
     OUTCOME_TRYV(resolve_tgid());
@@ -365,7 +400,15 @@ oc::result<void> Tracee::detach()
         return std::errc::invalid_argument;
     }
 
-    if (ptrace(PTRACE_DETACH, tid, nullptr, nullptr) == 0) {
+    if (auto r = flush_regs();
+            !r && r.error() != std::errc::no_such_process) {
+        return r.as_failure();
+    }
+
+    m_page_cache.clear();
+
+    if (counted_ptrace(PTRACE_DETACH, tid, nullptr, nullptr) == 0) {
+        account_stop_time();
         m_state = TraceeState::Detached;
         return oc::success();
     } else if (errno != ESRCH) {
@@ -419,7 +462,7 @@ oc::result<void> Tracee::detach()
                 }
 
                 // Assume that this will succeed (like strace)
-                ptrace(PTRACE_DETACH, tid, nullptr, sig);
+                counted_ptrace(PTRACE_DETACH, tid, nullptr, sig);
                 return false;
             },
             event
@@ -489,9 +532,43 @@ void Tracee::set_exec_mode(ExecMode mode)
     m_exec_mode = mode;
 }
 
+/*!
+ * \brief Whether syscall-entry stops are produced by a seccomp filter
+ *
+ * If true, the tracee is running under a `SECCOMP_RET_TRACE` seccomp filter
+ * (see Tracer::fork()) and continue_exec() will resume the tracee with
+ * `PTRACE_CONT` when no syscall-exit stop is pending. Only syscalls matched by
+ * the filter will produce syscall-entry and syscall-exit stops.
+ *
+ * \return Whether the seccomp filter mode is enabled
+ */
+bool Tracee::syscall_filter() const
+{
+    return m_syscall_filter;
+}
+
+/*!
+ * \brief Set whether syscall-entry stops are produced by a seccomp filter
+ *
+ * \note This should normally not be changed. The owning Tracer will update this
+ *       value for tracees created with a syscall filter and their children.
+ *
+ * \param enabled Whether the seccomp filter mode is enabled
+ */
+void Tracee::set_syscall_filter(bool enabled)
+{
+    m_syscall_filter = enabled;
+}
+
 /*!
  * \brief State of registers during syscall-stop
  *
+ * \note Only the ABI, syscall number, syscall arguments (at syscall-entry),
+ *       syscall return value (at syscall-exit), and instruction pointer are
+ *       guaranteed to be valid. If the kernel supports
+ *       `PTRACE_GET_SYSCALL_INFO`, the remaining registers are not read until
+ *       the syscall is modified or a syscall is injected.
+ *
  * \pre state() must be TraceeState::PreSysCallStop or
  *      TraceeState::PostSysCallStop
  *
@@ -518,6 +595,114 @@ ArchRegs Tracee::regs() const
 void Tracee::set_regs(ArchRegs regs)
 {
     m_regs = regs;
+    m_regs_content = RegsContent::All;
+    m_regs_dirty = false;
+    m_syscall_num_dirty = false;
+}
+
+/*!
+ * \brief Set state of registers from partial register values
+ *
+ * If \p content is RegsContent::SysCallExit, the return value and instruction
+ * pointer are merged into the values cached at syscall-entry because the
+ * kernel does not report the syscall number at syscall-exit. If the ABI
+ * changed since syscall-entry (eg. after `execve`), all registers are read
+ * from the tracee instead.
+ *
+ * \note This function does **not** change the tracees registers. This should
+ *       not be called by anything other than the owning Tracer.
+ *
+ * \pre state() must be TraceeState::PreSysCallStop or
+ *      TraceeState::PostSysCallStop
+ *
+ * \param regs State of the registers
+ * \param content Which values in \p regs are valid
+ *
+ * \return Nothing if the register cache is successfully updated. Otherwise,
+ *         returns an appropriate error code.
+ */
+oc::result<void> Tracee::set_regs(ArchRegs regs, RegsContent content)
+{
+    if (content == RegsContent::SysCallExit) {
+        if (m_exec_mode == ExecMode::Kernel
+                && audit_arch(m_regs.abi()) == audit_arch(regs.abi())) {
+            m_regs.set_ip(regs.ip());
+            m_regs.set_ret(regs.ret());
+        } else {
+            OUTCOME_TRY(all_regs, read_regs(tid));
+            m_regs = std::move(all_regs);
+            content = RegsContent::All;
+        }
+    } else {
+        m_regs = std::move(regs);
+    }
+
+    m_regs_content = content;
+    m_regs_dirty = false;
+    m_syscall_num_dirty = false;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Read all registers if only partial values are cached
+ *
+ * This must be called before modifying any cached register other than the
+ * syscall number. A pending syscall number change is preserved.
+ *
+ * \return Nothing if all registers have been read. Otherwise, returns an
+ *         appropriate error code.
+ */
+oc::result<void> Tracee::fetch_regs()
+{
+    if (m_regs_content != RegsContent::All) {
+        OUTCOME_TRY(all_regs, read_regs(tid));
+        if (m_syscall_num_dirty) {
+            all_regs.set_ptrace_syscall(m_regs.ptrace_syscall());
+        }
+        m_regs = std::move(all_regs);
+        m_regs_content = RegsContent::All;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write modified registers back to the tracee
+ *
+ * Modifications made by the syscall-entry/exit hooks are only cached until the
+ * tracee is resumed, so that they can be written with a single ptrace call. If
+ * only the syscall number changed, the cheaper write_syscall_num() is used.
+ *
+ * \return Nothing if the registers are successfully written or if there are no
+ *         changes. Otherwise, returns an appropriate error code.
+ */
+oc::result<void> Tracee::flush_regs()
+{
+    if (m_regs_dirty) {
+        OUTCOME_TRYV(write_regs(tid, m_regs));
+    } else if (m_syscall_num_dirty) {
+        OUTCOME_TRYV(write_syscall_num(tid, m_regs));
+    }
+
+    m_regs_dirty = false;
+    m_syscall_num_dirty = false;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Set syscall number in the register cache
+ *
+ * \param num New syscall number. Nothing is marked for writing if this matches
+ *            the current syscall number.
+ */
+void Tracee::set_syscall_num(SysCallNum num)
+{
+    if (m_regs.ptrace_syscall() != num) {
+        m_regs.set_ptrace_syscall(num);
+        m_syscall_num_dirty = true;
+    }
 }
 
 /*!
@@ -555,6 +740,34 @@ oc::result<void> Tracee::syscall_exit_pre_hook()
     return suppress_syscall_post();
 }
 
+/*!
+ * \brief Set the time when the current ptrace stop was received
+ *
+ * The time until the tracee is resumed is added to Tracer::stats().
+ *
+ * \param time Time when the event for the ptrace stop was received
+ */
+void Tracee::set_stop_time(std::chrono::steady_clock::time_point time)
+{
+    m_stop_time = time;
+}
+
+/*!
+ * \brief Add the time since the current ptrace stop was received to the
+ *        tracer statistics
+ */
+void Tracee::account_stop_time()
+{
+    if (m_stop_time == std::chrono::steady_clock::time_point()) {
+        return;
+    }
+
+    m_tracer->m_stats.stop_time +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - m_stop_time);
+    m_stop_time = {};
+}
+
 /*!
  * \brief Syscall status during asynchronous injection
  *
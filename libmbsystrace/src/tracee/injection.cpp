@@ -28,12 +28,15 @@
 
 #include "mbcommon/error_code.h"
 
+#include "mbsystrace/registers_p.h"
 #include "mbsystrace/syscalls.h"
 #include "mbsystrace/tracer.h"
 
 namespace mb::systrace
 {
 
+using namespace detail;
+
 /*!
  * \brief Continue execution until tracee enters or exits a syscall
  *
@@ -110,8 +113,6 @@ Tracee::inject_syscall(SysCallNum num, const SysCallArgs &args)
             OUTCOME_TRYV(continue_exec_raw(0));
             OUTCOME_TRYV(proceed_until_syscall());
             // In syscall-exit state
-            OUTCOME_TRY(regs, read_regs(tid));
-            m_regs = regs;
             OUTCOME_TRY(ret, inject_syscall_entry_end(false));
             OUTCOME_TRYV(continue_exec_raw(0));
             OUTCOME_TRYV(proceed_until_syscall());
@@ -127,8 +128,6 @@ Tracee::inject_syscall(SysCallNum num, const SysCallArgs &args)
             OUTCOME_TRYV(continue_exec_raw(0));
             OUTCOME_TRYV(proceed_until_syscall());
             // In syscall-exit state
-            OUTCOME_TRY(regs, read_regs(tid));
-            m_regs = regs;
             OUTCOME_TRY(ret, inject_syscall_exit_end());
             return ret;
         }
@@ -270,6 +269,8 @@ oc::result<SysCallRet> Tracee::inject_syscall_async_end()
 oc::result<void>
 Tracee::inject_syscall_entry_start(SysCallNum num, const SysCallArgs &args)
 {
+    OUTCOME_TRYV(fetch_regs());
+
     m_sc_status = SysCallStatus::Injected;
     m_inj_exec_mode = m_exec_mode;
     m_inj_regs = m_regs;
@@ -298,13 +299,15 @@ Tracee::inject_syscall_entry_end(bool will_repeat)
     m_inj_regs.set_ip(m_inj_regs.ip() - SYSCALL_OPSIZE);
     m_inj_regs.set_pending_syscall(m_inj_regs.ptrace_syscall());
 
-    OUTCOME_TRYV(write_regs(tid, m_inj_regs));
+    auto ret = m_regs.ret();
+    set_regs(m_inj_regs);
+    m_regs_dirty = true;
 
     // Repeated status because the syscall-entry hook is invoked for the
     // original syscall again
     m_sc_status = will_repeat ? SysCallStatus::Repeated : SysCallStatus::Normal;
 
-    return m_regs.ret();
+    return ret;
 }
 
 /*!
@@ -324,6 +327,8 @@ Tracee::inject_syscall_entry_end(bool will_repeat)
 oc::result<void>
 Tracee::inject_syscall_exit_start(SysCallNum num, const SysCallArgs &args)
 {
+    OUTCOME_TRYV(fetch_regs());
+
     m_sc_status = SysCallStatus::Injected;
     m_inj_exec_mode = m_exec_mode;
     m_inj_regs = m_regs;
@@ -331,6 +336,7 @@ Tracee::inject_syscall_exit_start(SysCallNum num, const SysCallArgs &args)
     // Step back IP to redo syscall
     m_regs.set_ip(m_regs.ip() - SYSCALL_OPSIZE);
     m_regs.set_pending_syscall(num);
+    m_regs_dirty = true;
 
     return modify_syscall_args(num, args);
 }
@@ -349,11 +355,13 @@ Tracee::inject_syscall_exit_start(SysCallNum num, const SysCallArgs &args)
 oc::result<SysCallRet> Tracee::inject_syscall_exit_end()
 {
     // Restore register backup
-    OUTCOME_TRYV(write_regs(tid, m_inj_regs));
+    auto ret = m_regs.ret();
+    set_regs(m_inj_regs);
+    m_regs_dirty = true;
 
     m_sc_status = SysCallStatus::Normal;
 
-    return m_regs.ret();
+    return ret;
 }
 
 /*!
@@ -361,22 +369,40 @@ oc::result<SysCallRet> Tracee::inject_syscall_exit_end()
  *
  * \pre state() must be TraceeState::PreSysCallStop
  *
+ * \note The registers are written to the tracee when it is resumed.
+ *
  * \return Nothing if the syscall number and arguments are successfully changed.
  *         Otherwise, returns an appropriate error code.
  */
 oc::result<void>
 Tracee::modify_syscall_args(SysCallNum num, const SysCallArgs &args)
 {
-    m_regs.set_ptrace_syscall(num);
+    SysCallArgs cur_args{{
+        m_regs.arg0(),
+        m_regs.arg1(),
+        m_regs.arg2(),
+        m_regs.arg3(),
+        m_regs.arg4(),
+        m_regs.arg5(),
+    }};
+
+    // The arguments are not known at syscall-exit
+    if (m_regs_content == RegsContent::SysCallExit || args != cur_args) {
+        OUTCOME_TRYV(fetch_regs());
+
+        m_regs.set_arg0(args[0]);
+        m_regs.set_arg1(args[1]);
+        m_regs.set_arg2(args[2]);
+        m_regs.set_arg3(args[3]);
+        m_regs.set_arg4(args[4]);
+        m_regs.set_arg5(args[5]);
+
+        m_regs_dirty = true;
+    }
 
-    m_regs.set_arg0(args[0]);
-    m_regs.set_arg1(args[1]);
-    m_regs.set_arg2(args[2]);
-    m_regs.set_arg3(args[3]);
-    m_regs.set_arg4(args[4]);
-    m_regs.set_arg5(args[5]);
+    set_syscall_num(num);
 
-    return write_regs(tid, m_regs);
+    return oc::success();
 }
 
 /*!
@@ -384,17 +410,26 @@ Tracee::modify_syscall_args(SysCallNum num, const SysCallArgs &args)
  *
  * \pre state() must be TraceeState::PostSysCallStop
  *
+ * \note The registers are written to the tracee when it is resumed.
+ *
  * \return Nothing if the syscall number and return value are successfully
  *         changed. Otherwise, returns an appropriate error code.
  */
 oc::result<void>
 Tracee::modify_syscall_ret(SysCallNum num, SysCallRet ret)
 {
-    m_regs.set_ptrace_syscall(num);
+    // The return value is not known at syscall-entry
+    if (m_regs_content == RegsContent::SysCallEntry || m_regs.ret() != ret) {
+        OUTCOME_TRYV(fetch_regs());
+
+        m_regs.set_ret(ret);
 
-    m_regs.set_ret(ret);
+        m_regs_dirty = true;
+    }
 
-    return write_regs(tid, m_regs);
+    set_syscall_num(num);
+
+    return oc::success();
 }
 
 /*!
@@ -19,6 +19,7 @@
 
 #include "mbsystrace/tracee.h"
 
+#include <algorithm>
 #include <string_view>
 #include <vector>
 
@@ -29,6 +30,7 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
@@ -36,15 +38,28 @@
 
 #include "mbcommon/error_code.h"
 
+#include "mbsystrace/registers_p.h"
 #include "mbsystrace/syscalls.h"
+#include "mbsystrace/tracer.h"
 
 namespace mb::systrace
 {
 
+using namespace detail;
+
 // Maximum errno is 4095 on all architectures
 // https://elixir.bootlin.com/linux/v4.15.4/source/include/linux/err.h#L18
 static constexpr int MAX_ERRNO = 4095;
 
+//! Maximum number of pages kept in the page cache during a ptrace stop
+static constexpr size_t MAX_CACHED_PAGES = 128;
+
+//! Size of the scratch arena mapped into each address space
+static constexpr size_t SCRATCH_ARENA_SIZE = 256 * 1024;
+
+//! Alignment of scratch arena allocations
+static constexpr size_t SCRATCH_ALIGNMENT = 16;
+
 /*!
  * \brief Get process's page size
  *
@@ -157,6 +172,9 @@ Tracee::write_mem(uintptr_t addr, const void *buf, size_t size)
     std::vector<iovec> remote_iovs = split_iovs(addr, size, page_size);
     iovec local_iov{const_cast<void *>(buf), size};
 
+    // Any of the cached pages may be modified
+    m_page_cache.clear();
+
     auto n = process_vm_writev(tid, &local_iov, 1, remote_iovs.data(),
                                remote_iovs.size(), 0);
     if (n < 0) {
@@ -166,9 +184,157 @@ Tracee::write_mem(uintptr_t addr, const void *buf, size_t size)
     return static_cast<size_t>(n);
 }
 
+/*!
+ * \brief Read pages into the page cache
+ *
+ * The pages that are not already cached are read with as few
+ * `process_vm_readv` calls as possible. Unmapped pages are cached as empty
+ * pages. If there are more pages than the cache can hold, the oldest pages are
+ * evicted.
+ *
+ * \param page_addrs Page-aligned addresses. Duplicates are allowed.
+ *
+ * \return Nothing if the pages are successfully read or are unmapped.
+ *         Otherwise, returns an appropriate error code.
+ */
+oc::result<void> Tracee::cache_pages(std::vector<uintptr_t> page_addrs)
+{
+    OUTCOME_TRY(page_size, get_page_size());
+
+    std::sort(page_addrs.begin(), page_addrs.end());
+    page_addrs.erase(std::unique(page_addrs.begin(), page_addrs.end()),
+                     page_addrs.end());
+    page_addrs.erase(std::remove_if(page_addrs.begin(), page_addrs.end(),
+                                    [&](uintptr_t page_addr) {
+        return std::any_of(m_page_cache.begin(), m_page_cache.end(),
+                           [&](const CachedPage &page) {
+            return page.addr == page_addr;
+        });
+    }), page_addrs.end());
+
+    std::vector<char> buf;
+    std::vector<iovec> remote_iovs;
+
+    for (size_t start = 0; start < page_addrs.size();) {
+        auto count = std::min<size_t>(page_addrs.size() - start, IOV_MAX);
+
+        buf.resize(count * page_size);
+        remote_iovs.resize(count);
+
+        for (size_t i = 0; i < count; ++i) {
+            remote_iovs[i].iov_base =
+                    reinterpret_cast<void *>(page_addrs[start + i]);
+            remote_iovs[i].iov_len = page_size;
+        }
+
+        iovec local_iov{buf.data(), buf.size()};
+
+        // The read stops at the first unmapped page
+        auto n = process_vm_readv(tid, &local_iov, 1, remote_iovs.data(),
+                                  count, 0);
+        if (n < 0) {
+            if (errno != EFAULT) {
+                return ec_from_errno();
+            }
+            n = 0;
+        }
+
+        size_t pages_read = static_cast<size_t>(n) / page_size;
+
+        for (size_t i = 0; i <= pages_read && i < count; ++i) {
+            if (m_page_cache.size() >= MAX_CACHED_PAGES) {
+                m_page_cache.erase(m_page_cache.begin());
+            }
+
+            auto &page = m_page_cache.emplace_back();
+            page.addr = page_addrs[start + i];
+
+            if (i < pages_read) {
+                const char *begin = buf.data() + i * page_size;
+                page.data.assign(begin, begin + page_size);
+            }
+        }
+
+        start += std::min(pages_read + 1, count);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Get page from the page cache, reading it if needed
+ *
+ * \param page_addr Page-aligned address
+ *
+ * \return Pointer to the cached page, which is valid until the page cache is
+ *         modified. If the page is not mapped, `std::errc::bad_address` is
+ *         returned. On failure, returns an appropriate error code.
+ */
+oc::result<const CachedPage *> Tracee::cached_page(uintptr_t page_addr)
+{
+    auto find_page = [&] {
+        return std::find_if(m_page_cache.begin(), m_page_cache.end(),
+                            [&](const CachedPage &page) {
+            return page.addr == page_addr;
+        });
+    };
+
+    auto it = find_page();
+    if (it == m_page_cache.end()) {
+        OUTCOME_TRYV(cache_pages({page_addr}));
+        it = find_page();
+    }
+
+    if (it->data.empty()) {
+        return std::errc::bad_address;
+    }
+
+    return &*it;
+}
+
+/*!
+ * \brief Read memory from the process using the page cache
+ *
+ * \param addr Address to read from
+ * \param buf Buffer to read data into
+ * \param size Number of bytes to read
+ *
+ * \return Nothing if \p size bytes are read. If part of the address range is
+ *         unmapped, `std::errc::bad_address` is returned. On failure, returns
+ *         an appropriate error code.
+ */
+oc::result<void> Tracee::read_cached(uintptr_t addr, void *buf, size_t size)
+{
+    if (addr > std::numeric_limits<uintptr_t>::max() - size) {
+        return std::errc::value_too_large;
+    }
+
+    OUTCOME_TRY(page_size, get_page_size());
+
+    auto out = static_cast<char *>(buf);
+
+    while (size > 0) {
+        uintptr_t page_addr = addr - addr % page_size;
+        size_t offset = addr - page_addr;
+        size_t n = std::min(page_size - offset, size);
+
+        OUTCOME_TRY(page, cached_page(page_addr));
+        memcpy(out, page->data.data() + offset, n);
+
+        out += n;
+        addr += n;
+        size -= n;
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Read a NULL-terminated string from the process
  *
+ * The string is read one page at a time, so a string that ends before an
+ * unmapped page can be read.
+ *
  * \param addr Address to read string from
  *
  * \pre state() must be a ptrace stop state
@@ -177,27 +343,99 @@ Tracee::write_mem(uintptr_t addr, const void *buf, size_t size)
  */
 oc::result<std::string> Tracee::read_string(uintptr_t addr)
 {
-    std::string result;
-    result.reserve(64);
+    OUTCOME_TRY(page_size, get_page_size());
 
-    char buf[4096];
+    std::string result;
 
     while (true) {
-        OUTCOME_TRY(n, read_mem(addr, buf, sizeof(buf)));
+        uintptr_t page_addr = addr - addr % page_size;
+        size_t offset = addr - page_addr;
+        size_t avail = page_size - offset;
+
+        OUTCOME_TRY(page, cached_page(page_addr));
 
-        size_t str_n = strnlen(buf, n);
-        result += std::string_view(buf, str_n);
+        const char *ptr = page->data.data() + offset;
+        size_t str_n = strnlen(ptr, avail);
+        result += std::string_view(ptr, str_n);
 
-        if (str_n < n) {
+        if (str_n < avail) {
             break;
+        } else if (page_addr > std::numeric_limits<uintptr_t>::max()
+                - page_size) {
+            return std::errc::bad_address;
         }
 
-        addr += n;
+        addr = page_addr + page_size;
     }
 
     return result;
 }
 
+/*!
+ * \brief Read a NULL-terminated array of NULL-terminated strings from the
+ *        process
+ *
+ * This is meant for reading the `argv` and `envp` arrays passed to `execve`.
+ * The first page of every string is read with a single `process_vm_readv`
+ * call.
+ *
+ * \param addr Address of the array of string pointers. The size of the
+ *             pointers is determined by the ABI of the current syscall.
+ *
+ * \pre state() must be TraceeState::PreSysCallStop or
+ *      TraceeState::PostSysCallStop
+ *
+ * \return The resulting strings if successful. Otherwise, returns an error
+ *         code.
+ */
+oc::result<std::vector<std::string>> Tracee::read_strings(uintptr_t addr)
+{
+    OUTCOME_TRY(page_size, get_page_size());
+
+    const size_t ptr_size = pointer_size(m_regs.abi());
+    std::vector<uintptr_t> ptrs;
+
+    while (true) {
+        uintptr_t ptr;
+
+        if (ptr_size == sizeof(uint32_t)) {
+            uint32_t value;
+            OUTCOME_TRYV(read_cached(addr, &value, sizeof(value)));
+            ptr = value;
+        } else {
+            uint64_t value;
+            OUTCOME_TRYV(read_cached(addr, &value, sizeof(value)));
+            ptr = static_cast<uintptr_t>(value);
+        }
+
+        if (ptr == 0) {
+            break;
+        }
+
+        ptrs.push_back(ptr);
+        addr += ptr_size;
+    }
+
+    std::vector<uintptr_t> page_addrs;
+    page_addrs.reserve(ptrs.size());
+
+    for (auto ptr : ptrs) {
+        page_addrs.push_back(ptr - ptr % page_size);
+    }
+
+    OUTCOME_TRYV(cache_pages(std::move(page_addrs)));
+
+    std::vector<std::string> result;
+    result.reserve(ptrs.size());
+
+    for (auto ptr : ptrs) {
+        OUTCOME_TRY(str, read_string(ptr));
+        result.push_back(std::move(str));
+    }
+
+    return std::move(result);
+}
+
 /*!
  * \brief Execute mmap in the process
  *
@@ -296,4 +534,83 @@ oc::result<void> Tracee::munmap(uintptr_t addr, size_t length)
     return oc::success();
 }
 
+/*!
+ * \brief Allocate memory from the address space's scratch arena
+ *
+ * The scratch arena is a mapping that is created the first time this function
+ * is called for an address space. It is shared by all threads in the thread
+ * group and is forgotten once the address space is replaced by `execve`.
+ * Allocations are made with a bump allocator that wraps around once the end of
+ * the arena is reached, so an allocation stays valid until at least
+ * `SCRATCH_ARENA_SIZE - size` bytes have been allocated after it. This is
+ * meant for passing data, such as rewritten paths, to the current syscall.
+ *
+ * \pre state() must be TraceeState::PreSysCallStop or
+ *      TraceeState::PostSysCallStop
+ *
+ * \param size Number of bytes to allocate
+ *
+ * \return Address of the allocated memory if successful. If \p size is larger
+ *         than the arena, returns `std::errc::value_too_large`. If the arena
+ *         cannot be mapped, returns the error from mmap().
+ */
+oc::result<uintptr_t> Tracee::alloc_scratch(size_t size)
+{
+    if (size > SCRATCH_ARENA_SIZE) {
+        return std::errc::value_too_large;
+    }
+
+    auto &arenas = m_tracer->m_scratch_arenas;
+
+    auto it = arenas.find(tgid);
+    if (it == arenas.end()) {
+        OUTCOME_TRY(addr, mmap(0, SCRATCH_ARENA_SIZE, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+
+        it = arenas.insert_or_assign(
+                tgid, ScratchArena{addr, SCRATCH_ARENA_SIZE, 0}).first;
+    }
+
+    auto &arena = it->second;
+
+    if (arena.size - arena.offset < size) {
+        arena.offset = 0;
+    }
+
+    uintptr_t addr = arena.addr + arena.offset;
+
+    arena.offset += std::min(
+            (size + SCRATCH_ALIGNMENT - 1) / SCRATCH_ALIGNMENT
+                    * SCRATCH_ALIGNMENT,
+            arena.size - arena.offset);
+
+    return addr;
+}
+
+/*!
+ * \brief Copy data into the address space's scratch arena
+ *
+ * \sa alloc_scratch()
+ *
+ * \pre state() must be TraceeState::PreSysCallStop or
+ *      TraceeState::PostSysCallStop
+ *
+ * \param buf Buffer to write data from
+ * \param size Number of bytes to write
+ *
+ * \return Address of the data in the tracee if successful. Otherwise, returns
+ *         an appropriate error code.
+ */
+oc::result<uintptr_t> Tracee::write_scratch(const void *buf, size_t size)
+{
+    OUTCOME_TRY(addr, alloc_scratch(size));
+    OUTCOME_TRY(n, write_mem(addr, buf, size));
+
+    if (n != size) {
+        return std::errc::bad_address;
+    }
+
+    return addr;
+}
+
 }
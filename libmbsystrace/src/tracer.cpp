@@ -19,6 +19,7 @@
 
 #include "mbsystrace/tracer.h"
 
+#include <algorithm>
 #include <vector>
 
 #include <climits>
@@ -26,6 +27,7 @@
 #include <cstring>
 
 #include <signal.h>
+#include <sys/mman.h>
 #include <sys/ptrace.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
@@ -36,6 +38,8 @@
 #include "mbcommon/integer.h"
 
 #include "mbsystrace/procfs_p.h"
+#include "mbsystrace/ptrace_p.h"
+#include "mbsystrace/seccomp_p.h"
 #include "mbsystrace/syscalls.h"
 #include "mbsystrace/tracee.h"
 
@@ -50,6 +54,8 @@ namespace mb::systrace
 
 using namespace detail;
 
+thread_local uint64_t detail::g_ptrace_calls = 0;
+
 /*!
  * \class Tracer
  *
@@ -104,6 +110,8 @@ using namespace detail;
  */
 Tracer::Tracer()
     : m_should_stop(false)
+    , m_ptrace_calls_base(g_ptrace_calls)
+    , m_hook_depth(0)
 {
 }
 
@@ -139,6 +147,48 @@ Tracer::~Tracer()
  *         Otherwise, returns a specific error code.
  */
 oc::result<Tracee *> Tracer::fork(std::function<void()> child, Flags flags)
+{
+    return fork_impl(std::move(child), nullptr, flags);
+}
+
+/*!
+ * \brief Fork a new traced process that only stops at the specified syscalls
+ *
+ * This is similar to fork(std::function<void()>, Flags), except that a seccomp
+ * filter returning `SECCOMP_RET_TRACE` for \p syscalls is installed in the
+ * child process before \p child is called. The tracee and its children are
+ * resumed with `PTRACE_CONT` instead of `PTRACE_SYSCALL`, so Hooks::syscall_entry
+ * and Hooks::syscall_exit will only be called for the syscalls in \p syscalls.
+ * This avoids two ptrace stops for every other syscall executed by the tracee.
+ *
+ * Syscalls injected via Tracee::inject_syscall() and
+ * Tracee::inject_syscall_async() will still produce syscall-entry/exit events.
+ *
+ * \note This requires kernel 4.8 or newer. If the tracer is not privileged,
+ *       `PR_SET_NO_NEW_PRIVS` will be set for the child process.
+ *
+ * \param child Function to exit in child process. If the function does not
+ *              exit itself, then the child process will exit with status code
+ *              255.
+ * \param syscalls Syscalls to stop at. Syscalls for all ABIs supported by the
+ *                 current architecture may be specified.
+ * \param flags Flags to control how the child process is attached.
+ *
+ * \return If successful, returns the Tracee instance of the new tracee. If the
+ *         kernel does not support the seccomp filter, returns
+ *         std::errc::function_not_supported. Otherwise, returns a specific error
+ *         code.
+ */
+oc::result<Tracee *> Tracer::fork(std::function<void()> child,
+                                  const std::vector<SysCall> &syscalls,
+                                  Flags flags)
+{
+    return fork_impl(std::move(child), &syscalls, flags);
+}
+
+oc::result<Tracee *> Tracer::fork_impl(std::function<void()> child,
+                                       const std::vector<SysCall> *syscalls,
+                                       Flags flags)
 {
     SeizeFlags seize_flags = SeizeFlag::TryKillOnExit;
 
@@ -146,15 +196,56 @@ oc::result<Tracee *> Tracer::fork(std::function<void()> child, Flags flags)
         seize_flags |= SeizeFlag::TraceChildren;
     }
 
+    std::vector<sock_filter> filter;
+
+    if (syscalls) {
+        OUTCOME_TRY(program, build_syscall_filter(*syscalls));
+        filter = std::move(program);
+        seize_flags |= SeizeFlag::TraceSecComp;
+    }
+
+    // The filter must be installed before the handshake below since any
+    // syscall after the handshake may already be one to trace. The result is
+    // reported via shared memory because the write() or close() needed for a
+    // pipe could be blocked by the filter before the tracer has attached.
+    void *filter_errno = MAP_FAILED;
+
+    if (syscalls) {
+        filter_errno = mmap(nullptr, sizeof(int), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (filter_errno == MAP_FAILED) {
+            return ec_from_errno();
+        }
+    }
+
+    auto unmap_filter_errno = finally([&] {
+        if (filter_errno != MAP_FAILED) {
+            munmap(filter_errno, sizeof(int));
+        }
+    });
+
     pid_t pid = ::fork();
 
     if (pid == 0) {
+        int error = 0;
+
+        if (syscalls) {
+            if (auto r = install_syscall_filter(filter); !r) {
+                error = r.error().value();
+            }
+            *static_cast<int *>(filter_errno) = error;
+        }
+
         // Loop indefinitely until the parent attaches and changes the behavior
         // of the syscall. This is better than raise(SIGSTOP) and having the
         // the parent wait for a SIGSTOP because the parent would have no way of
         // determining which process sent the SIGSTOP.
         while (syscall(SYS_ppoll, nullptr, 0, nullptr, nullptr) != 0);
 
+        if (error != 0) {
+            _exit(255);
+        }
+
         child();
         _exit(255);
     } else if (pid < 0) {
@@ -168,12 +259,10 @@ oc::result<Tracee *> Tracer::fork(std::function<void()> child, Flags flags)
         while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
     });
 
-    m_tracees[pid] = std::make_unique<Tracee>(this, pid, pid);
-
-    auto &tracee = m_tracees[pid];
+    auto tracee = insert_tracee(std::make_unique<Tracee>(this, pid, pid));
 
     auto remove_tracee = finally([&] {
-        m_tracees.erase(pid);
+        take_tracee(pid);
     });
 
     OUTCOME_TRYV(tracee->seize(seize_flags));
@@ -192,21 +281,37 @@ oc::result<Tracee *> Tracer::fork(std::function<void()> child, Flags flags)
     hooks.syscall_exit = [this](auto *, auto &info) -> SysCallExitAction {
         if (strcmp(info.syscall.name(), "ppoll") == 0) {
             stop_after_hook();
+            return action::NoAction{};
         }
         return action::Default{};
     };
     OUTCOME_TRYV(execute(hooks, tracee->tid));
 
-    kill_child.dismiss();
-    remove_tracee.dismiss();
-
     // An external process could have killed the process before ppoll()
-    if (auto t = find_tracee(pid)) {
-        m_owned_tgids.insert(pid);
-        return oc::success(t);
-    } else {
+    auto t = find_tracee(pid);
+    if (!t) {
+        kill_child.dismiss();
+        remove_tracee.dismiss();
         return std::errc::no_such_process;
     }
+
+    if (syscalls) {
+        if (int error = *static_cast<int *>(filter_errno); error != 0) {
+            return ec_from_errno(error);
+        }
+
+        t->set_syscall_filter(true);
+        m_filtered_tgids.insert(pid);
+    }
+
+    // Resume from the syscall-exit stop of ppoll()
+    OUTCOME_TRYV(t->continue_exec(0));
+
+    kill_child.dismiss();
+    remove_tracee.dismiss();
+
+    m_owned_tgids.insert(pid);
+    return oc::success(t);
 }
 
 /*!
@@ -270,8 +375,7 @@ oc::result<std::vector<Tracee *>> Tracer::attach(pid_t tid, Flags flags)
     std::vector<Tracee *> result;
 
     for (auto &tracee : new_tracees) {
-        result.push_back(tracee.get());
-        m_tracees[tracee->tid] = std::move(tracee);
+        result.push_back(insert_tracee(std::move(tracee)));
     }
 
     return oc::success(std::move(result));
@@ -289,10 +393,44 @@ oc::result<std::vector<Tracee *>> Tracer::attach(pid_t tid, Flags flags)
  */
 oc::result<Tracee *> Tracer::add_child(pid_t tgid, pid_t tid)
 {
-    m_tracees[tid] = std::make_unique<Tracee>(this, tgid, tid);
-    m_tracees[tid]->set_state(TraceeState::Executing);
+    auto tracee = insert_tracee(std::make_unique<Tracee>(this, tgid, tid));
+    tracee->set_state(TraceeState::Executing);
 
-    return oc::success(m_tracees[tid].get());
+    return oc::success(tracee);
+}
+
+/*!
+ * \brief Enable the syscall filter mode for a new tracee if needed
+ *
+ * The seccomp filter installed by fork() is inherited by new threads and child
+ * processes. A new tracee runs under the filter if its thread group or its
+ * parent process is known to run under the filter.
+ *
+ * If the parent process cannot be determined, the tracee will not use the
+ * syscall filter mode. This is safe because seccomp-stops that follow an
+ * already handled syscall-entry stop are ignored.
+ *
+ * \pre The tgid of \p tracee must be known
+ *
+ * \param tracee New tracee
+ */
+void Tracer::inherit_syscall_filter(Tracee *tracee)
+{
+    if (m_filtered_tgids.empty()) {
+        return;
+    }
+
+    if (m_filtered_tgids.find(tracee->tgid) == m_filtered_tgids.end()) {
+        auto ppid = get_pid_status_field(tracee->tid, "PPid");
+        if (!ppid || m_filtered_tgids.find(ppid.value())
+                == m_filtered_tgids.end()) {
+            return;
+        }
+
+        m_filtered_tgids.insert(tracee->tgid);
+    }
+
+    tracee->set_syscall_filter(true);
 }
 
 /*!
@@ -304,26 +442,41 @@ oc::result<Tracee *> Tracer::add_child(pid_t tgid, pid_t tid)
  */
 bool Tracer::remove_child(pid_t tid)
 {
-    pid_t tgid;
-
-    if (auto it = m_tracees.find(tid); it != m_tracees.end()) {
-        tgid = it->second->tgid;
-        m_tracees.erase(it);
-    } else {
+    auto tracee = take_tracee(tid);
+    if (!tracee) {
         return false;
     }
 
+    pid_t tgid = tracee->tgid;
+
+    // Events that were collected for the tracee are stale now. If a signal was
+    // about to be delivered, send it again so that it is not lost when the
+    // tracee is detached.
+    for (auto const &pending : take_pending_events(tid)) {
+        auto e = std::get_if<SignalDeliveryStopEvent>(&pending.event);
+        if (e && tracee->state() != TraceeState::Exited) {
+            (void) tracee->signal_thread(e->signal);
+        }
+    }
+
+    tracee.reset();
+
+    bool tgid_traced = std::any_of(
+        m_tracees.begin(), m_tracees.end(),
+        [&](auto const &item) {
+            return item.second->tgid == tgid;
+        }
+    );
+
+    if (!tgid_traced) {
+        m_filtered_tgids.erase(tgid);
+        m_scratch_arenas.erase(tgid);
+    }
+
     // Make best effort to kill owned tgid if needed
     if (auto it = m_owned_tgids.find(tgid); it != m_owned_tgids.end()) {
-        auto matching_tgid = std::find_if(
-            m_tracees.begin(), m_tracees.end(),
-            [&](auto const &item) {
-                return item.second->tgid == tgid;
-            }
-        );
-
         // Kill only if there are no more tracees in the thread group
-        if (matching_tgid == m_tracees.end()) {
+        if (!tgid_traced) {
             if (kill(tgid, SIGKILL) == 0) {
                 while (true) {
                     auto e = next_event(tgid);
@@ -19,11 +19,13 @@
 
 #include "mbsystrace/tracer.h"
 
+#include <algorithm>
 #include <cstring>
 
 #include "mbcommon/finally.h"
 
 #include "mbsystrace/event_p.h"
+#include "mbsystrace/ptrace_p.h"
 #include "mbsystrace/syscalls.h"
 #include "mbsystrace/tracee.h"
 
@@ -48,6 +50,41 @@ struct AlwaysFalse : std::false_type
 {
 };
 
+/*!
+ * \brief Add the time spent in a hook to the tracer statistics
+ *
+ * Hooks can run nested event loops (eg. for synchronous syscall injection). The
+ * time is only added for the outermost hook so that it is not counted twice.
+ */
+class HookTimer
+{
+public:
+    HookTimer(TracerStats &stats, unsigned int &depth)
+        : m_stats(stats)
+        , m_depth(depth)
+        , m_start(std::chrono::steady_clock::now())
+    {
+        ++m_depth;
+    }
+
+    ~HookTimer()
+    {
+        if (--m_depth == 0) {
+            m_stats.hook_time +=
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - m_start);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(HookTimer)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(HookTimer)
+
+private:
+    TracerStats &m_stats;
+    unsigned int &m_depth;
+    std::chrono::steady_clock::time_point m_start;
+};
+
 }
 
 #if DEBUG_EVENTS
@@ -100,6 +137,15 @@ static void print_event(const ProcessEvent &event)
                       e.regs.arg0(), e.regs.arg1(), e.regs.arg2(),
                       e.regs.arg3(), e.regs.arg4(), e.regs.arg5(),
                       e.regs.ret());
+            } else if constexpr (std::is_same_v<T, SecCompStopEvent>) {
+                DEBUG("SecCompStopEvent { tid=%d, abi=%d, num=%lu/%s"
+                      ", arg0=0x%lx, arg1=0x%lx, arg2=0x%lx, arg3=0x%lx"
+                      ", arg4=0x%lx, arg5=0x%lx }\n",
+                      e.tid, static_cast<int>(e.regs.abi()),
+                      e.regs.ptrace_syscall(),
+                      syscall_string(e.regs.ptrace_syscall(), e.regs.abi()),
+                      e.regs.arg0(), e.regs.arg1(), e.regs.arg2(),
+                      e.regs.arg3(), e.regs.arg4(), e.regs.arg5());
             } else if constexpr (std::is_same_v<T, SignalDeliveryStopEvent>) {
                 DEBUG("SignalDeliveryStopEvent { tid=%d, signal=%d }\n",
                       e.tid, e.signal);
@@ -131,7 +177,7 @@ static void print_event(const ProcessEvent &event)
  * \brief Call the appropriate hooks based on an event
  *
  * \param hooks Callback hooks for tracee events
- * \param event Incoming event for a tracee
+ * \param pending Incoming event for a tracee
  *
  * \return
  *   * True if the event loop should continue
@@ -139,10 +185,12 @@ static void print_event(const ProcessEvent &event)
  *   * An appropriate error code if an error occurs
  */
 oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
-                                        const ProcessEvent &event)
+                                        const PendingEvent &pending)
 {
+    ++m_stats.events;
+
     auto ret = std::visit(
-        [this, &hooks](auto &&e) -> oc::result<bool> {
+        [this, &hooks, &pending](auto &&e) -> oc::result<bool> {
             using T = std::decay_t<decltype(e)>;
 
             if constexpr (std::is_same_v<T, NoChildrenEvent>) {
@@ -181,10 +229,10 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                 if (e.tid != e.orig_tid) {
                     bool need_new_tracee_hook = false;
 
-                    if (auto it = m_tracees.find(e.tid); it != m_tracees.end()) {
+                    if (auto leader = find_tracee(e.tid)) {
                         // The thread group leader will just disappear, so don't
                         // try to detach or kill it
-                        it->second->set_state(TraceeState::Exited);
+                        leader->set_state(TraceeState::Exited);
                     } else {
                         // We're not tracing the thread group leader, but we're
                         // about to, so make sure the new tracee hook is invoked
@@ -192,10 +240,9 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                     }
 
                     // orig_tid will magically become tid after execve()
-                    m_tracees[e.tid] = std::move(m_tracees[e.orig_tid]);
-                    m_tracees.erase(e.orig_tid);
-
-                    tracee->tid = e.tid;
+                    auto owned = take_tracee(e.orig_tid);
+                    owned->tid = e.tid;
+                    insert_tracee(std::move(owned));
 
                     execute_tracee_disappear_hook(hooks, e.orig_tid);
 
@@ -204,7 +251,12 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                     }
                 }
 
+                // The scratch arena was unmapped along with the rest of the
+                // old address space
+                m_scratch_arenas.erase(tracee->tgid);
+
                 tracee->set_state(TraceeState::ExecveStop);
+                tracee->set_stop_time(pending.time);
                 OUTCOME_TRYV(tracee->continue_exec(0));
                 return true;
             } else {
@@ -219,13 +271,31 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                     // tracee is a thread or not
                     OUTCOME_TRYV(new_tracee->resolve_tgid());
 
+                    // Seccomp filters are inherited by new threads and
+                    // processes
+                    inherit_syscall_filter(new_tracee);
+
                     execute_new_tracee_hook(hooks, new_tracee);
 
                     tracee = new_tracee;
                 }
 
-                if constexpr (std::is_same_v<T, SysCallStopEvent>) {
-                    tracee->set_regs(e.regs);
+                tracee->set_stop_time(pending.time);
+
+                if constexpr (std::is_same_v<T, SysCallStopEvent>
+                        || std::is_same_v<T, SecCompStopEvent>) {
+                    if constexpr (std::is_same_v<T, SecCompStopEvent>) {
+                        // If the tracee was continued with PTRACE_SYSCALL, the
+                        // syscall-entry hook was already called for this
+                        // syscall during the syscall-entry stop
+                        if (tracee->exec_mode() == ExecMode::Kernel) {
+                            tracee->set_state(TraceeState::SecCompStop);
+                            OUTCOME_TRYV(tracee->continue_exec(0));
+                            return true;
+                        }
+                    }
+
+                    OUTCOME_TRYV(tracee->set_regs(e.regs, e.regs_content));
 
                     switch (tracee->exec_mode()) {
                         case ExecMode::User: {
@@ -246,6 +316,9 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                             };
                             assert(info.syscall);
 
+                            ++m_stats.syscalls[{info.syscall.abi(),
+                                                info.syscall.num()}].entry;
+
                             OUTCOME_TRYV(execute_syscall_entry_hook(
                                     hooks, tracee, info));
                             break;
@@ -263,6 +336,9 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                             };
                             assert(info.syscall);
 
+                            ++m_stats.syscalls[{info.syscall.abi(),
+                                                info.syscall.num()}].exit;
+
                             OUTCOME_TRYV(execute_syscall_exit_hook(
                                     hooks, tracee, info));
                             break;
@@ -304,7 +380,7 @@ oc::result<bool> Tracer::dispatch_event(const Hooks &hooks,
                 }
             }
         },
-        event
+        pending.event
     );
 
     // A tracee may be killed at any point, so retry if we get an ESRCH. We
@@ -326,6 +402,7 @@ Tracer::execute_new_tracee_hook(const Hooks &hooks, Tracee *tracee)
     DEBUG("[Hook] NewTracee { tgid=%d, tid=%d }\n", tracee->tgid, tracee->tid);
 
     if (hooks.new_tracee) {
+        HookTimer timer(m_stats, m_hook_depth);
         hooks.new_tracee(tracee);
     }
 }
@@ -337,9 +414,11 @@ Tracer::execute_tracee_exit_hook(const Hooks &hooks, pid_t tid, int status,
     DEBUG("[Hook] TraceeExit { tid=%d, status=0x%x, exit_code=%d }\n",
           tid, status, exit_code);
 
-    auto ret = hooks.tracee_exit
-            ? hooks.tracee_exit(tid, exit_code)
-            : action::Default{};
+    TraceeExitAction ret = action::Default{};
+    if (hooks.tracee_exit) {
+        HookTimer timer(m_stats, m_hook_depth);
+        ret = hooks.tracee_exit(tid, exit_code);
+    }
 
     find_tracee(tid)->set_state(TraceeState::Exited);
 
@@ -367,9 +446,11 @@ Tracer::execute_tracee_death_hook(const Hooks &hooks, pid_t tid, int status,
     DEBUG("[Hook] TraceeDeath { tid=%d, status=0x%x, exit_signal=%d }\n",
           tid, status, exit_signal);
 
-    auto ret = hooks.tracee_death
-            ? hooks.tracee_death(tid, exit_signal)
-            : action::Default{};
+    TraceeDeathAction ret = action::Default{};
+    if (hooks.tracee_death) {
+        HookTimer timer(m_stats, m_hook_depth);
+        ret = hooks.tracee_death(tid, exit_signal);
+    }
 
     find_tracee(tid)->set_state(TraceeState::Exited);
 
@@ -396,6 +477,7 @@ Tracer::execute_tracee_disappear_hook(const Hooks &hooks, pid_t tid)
     DEBUG("[Hook] TraceeDisappear { tid=%d }\n", tid);
 
     if (hooks.tracee_disappear) {
+        HookTimer timer(m_stats, m_hook_depth);
         hooks.tracee_disappear(tid);
     }
 }
@@ -406,9 +488,11 @@ Tracer::execute_tracee_signal_hook(const Hooks &hooks, Tracee *tracee,
 {
     DEBUG("[Hook] TraceeSignal { tid=%d, signal=%d }\n", tracee->tid, signal);
 
-    auto ret = hooks.tracee_signal
-            ? hooks.tracee_signal(tracee, signal)
-            : action::Default{};
+    TraceeSignalAction ret = action::Default{};
+    if (hooks.tracee_signal) {
+        HookTimer timer(m_stats, m_hook_depth);
+        ret = hooks.tracee_signal(tracee, signal);
+    }
 
     return std::visit(
         [&](auto &&a) -> oc::result<void> {
@@ -439,9 +523,11 @@ Tracer::execute_group_stop_hook(const Hooks &hooks, Tracee *tracee, int signal)
 {
     DEBUG("[Hook] GroupStop { tid=%d, signal=%d }\n", tracee->tid, signal);
 
-    auto ret = hooks.group_stop
-            ? hooks.group_stop(tracee, signal)
-            : action::Default{};
+    GroupStopAction ret = action::Default{};
+    if (hooks.group_stop) {
+        HookTimer timer(m_stats, m_hook_depth);
+        ret = hooks.group_stop(tracee, signal);
+    }
 
     return std::visit(
         [&](auto &&a) -> oc::result<void> {
@@ -470,9 +556,11 @@ Tracer::execute_interrupt_stop_hook(const Hooks &hooks, Tracee *tracee)
 {
     DEBUG("[Hook] InterruptStop { tid=%d }\n", tracee->tid);
 
-    auto ret = hooks.interrupt_stop
-            ? hooks.interrupt_stop(tracee)
-            : action::Default{};
+    InterruptStopAction ret = action::Default{};
+    if (hooks.interrupt_stop) {
+        HookTimer timer(m_stats, m_hook_depth);
+        ret = hooks.interrupt_stop(tracee);
+    }
 
     return std::visit(
         [&](auto &&a) -> oc::result<void> {
@@ -508,9 +596,11 @@ Tracer::execute_syscall_entry_hook(const Hooks &hooks, Tracee *tracee,
           info.args[1], info.args[2], info.args[3], info.args[4], info.args[5],
           status_string(info.status));
 
-    auto ret = hooks.syscall_entry
-            ? hooks.syscall_entry(tracee, info)
-            : action::Default{};
+    SysCallEntryAction ret = action::Default{};
+    if (hooks.syscall_entry) {
+        HookTimer timer(m_stats, m_hook_depth);
+        ret = hooks.syscall_entry(tracee, info);
+    }
 
     return std::visit(
         [&](auto &&a) -> oc::result<void> {
@@ -549,9 +639,11 @@ Tracer::execute_syscall_exit_hook(const Hooks &hooks, Tracee *tracee,
           syscall_string(info.syscall.num(), info.syscall.abi()), info.ret,
           status_string(info.status));
 
-    auto hook_ret = hooks.syscall_exit
-            ? hooks.syscall_exit(tracee, info)
-            : action::Default{};
+    SysCallExitAction hook_ret = action::Default{};
+    if (hooks.syscall_exit) {
+        HookTimer timer(m_stats, m_hook_depth);
+        hook_ret = hooks.syscall_exit(tracee, info);
+    }
 
     return std::visit(
         [&](auto &&a) -> oc::result<void> {
@@ -583,10 +675,25 @@ Tracer::execute_unknown_child_hook(const Hooks &hooks, pid_t tid, int status)
     DEBUG("[Hook] UnknownChild { tid=%d, status=0x%x }\n", tid, status);
 
     if (hooks.unknown_child) {
+        HookTimer timer(m_stats, m_hook_depth);
         hooks.unknown_child(tid, status);
     }
 }
 
+/*!
+ * \brief Find position of tracee in sorted list of tracees
+ *
+ * \return Iterator to the first entry whose TID is not less than \p tid
+ */
+template<typename Container>
+static auto tracee_position(Container &tracees, pid_t tid)
+{
+    return std::lower_bound(tracees.begin(), tracees.end(), tid,
+                            [](auto const &item, pid_t t) {
+                                return item.first < t;
+                            });
+}
+
 /*!
  * \brief Find Tracee instance by its TID
  *
@@ -596,13 +703,167 @@ Tracer::execute_unknown_child_hook(const Hooks &hooks, pid_t tid, int status)
  */
 Tracee * Tracer::find_tracee(pid_t tid)
 {
-    if (auto it = m_tracees.find(tid); it != m_tracees.end()) {
+    auto it = tracee_position(m_tracees, tid);
+
+    if (it != m_tracees.end() && it->first == tid) {
         return it->second.get();
     } else {
         return nullptr;
     }
 }
 
+/*!
+ * \brief Add Tracee instance to the list of tracees
+ *
+ * If there is already a Tracee instance with the same TID, it will be replaced.
+ *
+ * \param tracee Tracee instance
+ *
+ * \return Pointer to \p tracee
+ */
+Tracee * Tracer::insert_tracee(std::unique_ptr<Tracee> tracee)
+{
+    pid_t tid = tracee->tid;
+    auto ptr = tracee.get();
+
+    auto it = tracee_position(m_tracees, tid);
+
+    if (it != m_tracees.end() && it->first == tid) {
+        it->second = std::move(tracee);
+    } else {
+        m_tracees.emplace(it, tid, std::move(tracee));
+    }
+
+    return ptr;
+}
+
+/*!
+ * \brief Remove Tracee instance from the list of tracees
+ *
+ * \param tid TID of tracee to remove
+ *
+ * \return Tracee instance if found. Otherwise, nullptr.
+ */
+std::unique_ptr<Tracee> Tracer::take_tracee(pid_t tid)
+{
+    auto it = tracee_position(m_tracees, tid);
+
+    if (it == m_tracees.end() || it->first != tid) {
+        return nullptr;
+    }
+
+    auto tracee = std::move(it->second);
+    m_tracees.erase(it);
+
+    return tracee;
+}
+
+/*!
+ * \brief Wait for next event and add the time spent waiting to the statistics
+ *
+ * \param pid_spec Same meaning as the \p pid_spec parameter to next_event()
+ *
+ * \return Returns the result of next_event()
+ */
+oc::result<ProcessEvent> Tracer::wait_event(pid_t pid_spec)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto event = next_event(pid_spec);
+
+    m_stats.wait_time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start);
+
+    return event;
+}
+
+/*!
+ * \brief Get next event to dispatch
+ *
+ * When waiting for events from any tracee, all events that are already pending
+ * are collected after the first one arrives. The collected events are then
+ * dispatched in the order that they were reported before waiting again. This
+ * avoids a blocking `waitpid()` call for every event when many tracees stop at
+ * the same time.
+ *
+ * When waiting for a specific tracee, a collected event for that tracee is
+ * returned first since `waitpid()` will not report it again.
+ *
+ * \param pid_spec Same meaning as the \p pid_spec parameter to next_event()
+ *
+ * \return Returns the next event or an error code if next_event() or
+ *         poll_event() fails.
+ */
+oc::result<PendingEvent> Tracer::next_pending_event(pid_t pid_spec)
+{
+    if (pid_spec > 0) {
+        auto it = std::find_if(m_pending_events.begin(),
+                               m_pending_events.end(),
+                               [&](auto const &p) {
+                                   return event_pid(p.event) == pid_spec;
+                               });
+
+        if (it != m_pending_events.end()) {
+            auto pending = std::move(*it);
+            m_pending_events.erase(it);
+            return std::move(pending);
+        }
+    } else if (pid_spec == -1 && !m_pending_events.empty()) {
+        auto pending = std::move(m_pending_events.front());
+        m_pending_events.pop_front();
+        return std::move(pending);
+    }
+
+    OUTCOME_TRY(event, wait_event(pid_spec));
+    auto now = std::chrono::steady_clock::now();
+
+    // Events are only collected when waiting for any tracee
+    if (pid_spec != -1
+            || std::holds_alternative<NoChildrenEvent>(event)
+            || std::holds_alternative<RetryEvent>(event)) {
+        return PendingEvent{std::move(event), now};
+    }
+
+    m_pending_events.push_back({std::move(event), now});
+
+    while (true) {
+        OUTCOME_TRY(polled, poll_event(pid_spec));
+        if (!polled) {
+            break;
+        }
+
+        m_pending_events.push_back({std::move(*polled),
+                                    std::chrono::steady_clock::now()});
+    }
+
+    auto pending = std::move(m_pending_events.front());
+    m_pending_events.pop_front();
+
+    return std::move(pending);
+}
+
+/*!
+ * \brief Remove collected events for a tracee
+ *
+ * \param tid TID of tracee
+ *
+ * \return Events that were collected for \p tid, but not yet dispatched
+ */
+std::vector<PendingEvent> Tracer::take_pending_events(pid_t tid)
+{
+    std::vector<PendingEvent> events;
+
+    for (auto it = m_pending_events.begin(); it != m_pending_events.end();) {
+        if (event_pid(it->event) == tid) {
+            events.push_back(std::move(*it));
+            it = m_pending_events.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return events;
+}
+
 /*!
  * \brief Start event loop
  *
@@ -655,23 +916,23 @@ oc::result<void> Tracer::execute(const Hooks &hooks, int pid_spec)
 {
     while (!m_should_stop && (pid_spec == -1
             ? !m_tracees.empty()
-            : m_tracees.find(pid_spec) != m_tracees.end())) {
-        ProcessEvent e;
+            : find_tracee(pid_spec) != nullptr)) {
+        PendingEvent e;
 
         if (m_requeued_event) {
-            e = *m_requeued_event;
+            e = {*m_requeued_event, std::chrono::steady_clock::now()};
             m_requeued_event.reset();
 
 #if DEBUG_EVENTS
             DEBUG("[Replayed] ");
 #endif
         } else {
-            OUTCOME_TRY(event, next_event(pid_spec));
+            OUTCOME_TRY(event, next_pending_event(pid_spec));
             e = event;
         }
 
 #if DEBUG_EVENTS
-        print_event(e);
+        print_event(e.event);
 #endif
 
         OUTCOME_TRY(should_continue, dispatch_event(hooks, e));
@@ -700,4 +961,30 @@ void Tracer::stop_after_hook() noexcept
     m_should_stop = true;
 }
 
+/*!
+ * \brief Get counters for measuring the overhead of the tracer
+ *
+ * \note The ptrace() calls are counted per thread. If multiple Tracer instances
+ *       are used on the same thread, TracerStats::ptrace_calls includes the
+ *       calls made by all of them.
+ *
+ * \return Counters accumulated since the Tracer was constructed or since the
+ *         last call to reset_stats()
+ */
+TracerStats Tracer::stats() const
+{
+    auto stats = m_stats;
+    stats.ptrace_calls = g_ptrace_calls - m_ptrace_calls_base;
+    return stats;
+}
+
+/*!
+ * \brief Reset all counters returned by stats()
+ */
+void Tracer::reset_stats()
+{
+    m_stats = {};
+    m_ptrace_calls_base = g_ptrace_calls;
+}
+
 }
@@ -20,6 +20,8 @@
 #include <gtest/gtest.h>
 
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "mbcommon/finally.h"
 
@@ -170,3 +172,132 @@ TEST(MemoryTest, ReadLargeNullTerminatedString)
 
     ASSERT_EQ(buf, expected);
 }
+
+TEST(MemoryTest, ReadStringBeforeUnmappedPage)
+{
+    static constexpr char expected[] = "foobar";
+
+    std::string buf;
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info)
+            -> SysCallEntryAction {
+        if (strcmp(info.syscall.name(), "chdir") == 0) {
+            buf = tracee->read_string(info.args[0]).value();
+
+            return action::SuppressSysCall{0};
+        } else {
+            return action::ContinueExec{};
+        }
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+        // Place string at the end of a page that is followed by an unmapped
+        // page
+        auto mem = static_cast<char *>(mmap(nullptr, page_size * 2,
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS,
+                                            -1, 0));
+        if (mem == MAP_FAILED || munmap(mem + page_size, page_size) != 0) {
+            _exit(1);
+        }
+
+        char *str = mem + page_size - sizeof(expected);
+        memcpy(str, expected, sizeof(expected));
+
+        MB_IGNORE_VALUE(chdir(str));
+    }));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(buf, expected);
+}
+
+TEST(MemoryTest, ReadStringArray)
+{
+    std::vector<std::string> expected{"foo", "", std::string(12345, 'x')};
+
+    std::vector<std::string> argv;
+    std::vector<std::string> envp;
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info)
+            -> SysCallEntryAction {
+        if (strcmp(info.syscall.name(), "execve") == 0) {
+            argv = tracee->read_strings(info.args[1]).value();
+            envp = tracee->read_strings(info.args[2]).value();
+
+            return action::SuppressSysCall{-ENOENT};
+        } else {
+            return action::ContinueExec{};
+        }
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        std::vector<char *> args;
+        for (auto &arg : expected) {
+            args.push_back(const_cast<char *>(arg.c_str()));
+        }
+        args.push_back(nullptr);
+
+        char *env = nullptr;
+
+        execve("/nonexistent", args.data(), &env);
+    }));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(argv, expected);
+    ASSERT_TRUE(envp.empty());
+}
+
+TEST(MemoryTest, WriteScratch)
+{
+    static constexpr char new_path[] = "/";
+
+    std::vector<uintptr_t> addrs;
+    int exit_code = -1;
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        if (strcmp(info.syscall.name(), "chdir") == 0) {
+            auto addr = tracee->write_scratch(new_path, sizeof(new_path));
+            if (addr) {
+                addrs.push_back(addr.value());
+
+                auto args = info.args;
+                args[0] = addr.value();
+                (void) tracee->modify_syscall_args(info.syscall.num(), args);
+            }
+        }
+
+        return action::ContinueExec{};
+    };
+    hooks.tracee_exit = [&](auto, auto ec) -> TraceeExitAction {
+        exit_code = ec;
+        return action::NoAction{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        if (chdir("/nonexistent") != 0 || chdir("/nonexistent") != 0) {
+            _exit(1);
+        }
+        _exit(0);
+    }));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(exit_code, 0);
+
+    // Both allocations are from the same arena
+    ASSERT_EQ(addrs.size(), 2u);
+    ASSERT_EQ(addrs[1] - addrs[0], 16u);
+}
@@ -27,6 +27,7 @@
 
 #include <sched.h>
 #include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "mbsystrace/tracee.h"
@@ -160,3 +161,70 @@ TEST_F(NewProcessTest, VerifyTgidAfterVfork)
         waitpid_wrapper(vfork);
     }, false, {"clone", "vfork"});
 }
+
+TEST_F(NewProcessTest, TraceManyConcurrentChildren)
+{
+    static constexpr int NUM_CHILDREN = 16;
+    static constexpr int NUM_SYSCALLS = 50;
+
+    Tracer tracer;
+
+    auto parent = tracer.fork([] {
+        for (int i = 0; i < NUM_CHILDREN; ++i) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                die_with_msg("fork");
+            } else if (pid == 0) {
+                for (int j = 0; j < NUM_SYSCALLS; ++j) {
+                    syscall(SYS_getppid);
+                }
+                _exit(0);
+            }
+        }
+
+        for (int i = 0; i < NUM_CHILDREN; ++i) {
+            if (TEMP_FAILURE_RETRY(wait(nullptr)) < 0) {
+                die_with_msg("wait");
+            }
+        }
+    }, Flag::TraceChildren);
+    ASSERT_TRUE(parent);
+
+    int new_tracees = 0;
+    int exited_tracees = 0;
+    int getppid_entries = 0;
+    int getppid_exits = 0;
+
+    Hooks hooks;
+
+    hooks.new_tracee = [&](auto *) {
+        ++new_tracees;
+        return action::Default{};
+    };
+
+    hooks.tracee_exit = [&](pid_t, int) {
+        ++exited_tracees;
+        return action::Default{};
+    };
+
+    hooks.syscall_entry = [&](auto, auto &info) {
+        if (std::string_view(info.syscall.name()) == "getppid") {
+            ++getppid_entries;
+        }
+        return action::Default{};
+    };
+
+    hooks.syscall_exit = [&](auto, auto &info) {
+        if (std::string_view(info.syscall.name()) == "getppid") {
+            ++getppid_exits;
+        }
+        return action::Default{};
+    };
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(new_tracees, NUM_CHILDREN);
+    ASSERT_EQ(exited_tracees, NUM_CHILDREN + 1);
+    ASSERT_EQ(getppid_entries, NUM_CHILDREN * NUM_SYSCALLS);
+    ASSERT_EQ(getppid_exits, NUM_CHILDREN * NUM_SYSCALLS);
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mbsystrace/syscalls.h"
+#include "mbsystrace/tracee.h"
+#include "mbsystrace/tracer.h"
+
+using namespace mb::systrace;
+
+TEST(SysCallFilterTest, OnlyStopsAtFilteredSysCalls)
+{
+    // Pair of (is entry?, syscall name)
+    std::vector<std::pair<bool, std::string>> syscalls;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto, auto &info) {
+        syscalls.emplace_back(true, info.syscall.name());
+        return action::Default{};
+    };
+    hooks.syscall_exit = [&](auto, auto &info) {
+        syscalls.emplace_back(false, info.syscall.name());
+        return action::Default{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        for (int i = 0; i < 10; ++i) {
+            syscall(SYS_getpid);
+            syscall(SYS_getppid);
+        }
+    }, {SysCall("getppid", NATIVE_ARCH_ABI)}));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(syscalls.size(), 20u);
+
+    for (size_t i = 0; i < syscalls.size(); ++i) {
+        ASSERT_EQ(syscalls[i].first, i % 2 == 0);
+        ASSERT_EQ(syscalls[i].second, "getppid");
+    }
+}
+
+TEST(SysCallFilterTest, SuppressFilteredSysCall)
+{
+    int exit_code = -1;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [](auto, auto &info) -> SysCallEntryAction {
+        if (strcmp(info.syscall.name(), "close") == 0) {
+            return action::SuppressSysCall{-EPERM};
+        }
+        return action::ContinueExec{};
+    };
+    hooks.tracee_exit = [&](auto, auto ec) -> TraceeExitAction {
+        exit_code = ec;
+        return action::NoAction{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        if (close(STDOUT_FILENO) < 0 && errno == EPERM) {
+            _exit(EXIT_SUCCESS);
+        } else {
+            _exit(EXIT_FAILURE);
+        }
+    }, {SysCall("close", NATIVE_ARCH_ABI)}));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(exit_code, EXIT_SUCCESS);
+}
+
+TEST(SysCallFilterTest, InjectIntoFilteredSysCall)
+{
+    std::optional<SysCallRet> injected_ret;
+    pid_t tgid = -1;
+    int entries = 0;
+    int exits = 0;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        ++entries;
+        if (!injected_ret) {
+            auto ret = tracee->inject_syscall(
+                    SysCall("getpid", info.syscall.abi()).num(), {});
+            if (ret) {
+                injected_ret = ret.value();
+            }
+        }
+        return action::Default{};
+    };
+    hooks.syscall_exit = [&](auto, auto &) {
+        ++exits;
+        return action::Default{};
+    };
+
+    Tracer tracer;
+
+    auto tracee = tracer.fork([&] {
+        syscall(SYS_getppid);
+    }, {SysCall("getppid", NATIVE_ARCH_ABI)});
+    ASSERT_TRUE(tracee);
+    tgid = tracee.value()->tgid;
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(injected_ret, tgid);
+    ASSERT_EQ(entries, 1);
+    ASSERT_EQ(exits, 1);
+}
+
+TEST(SysCallFilterTest, FilterAppliesToChildren)
+{
+    std::vector<pid_t> tids;
+    int clones = 0;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [&](auto tracee, auto &info) {
+        if (strcmp(info.syscall.name(), "getppid") == 0) {
+            tids.push_back(tracee->tid);
+        } else {
+            ++clones;
+        }
+        return action::Default{};
+    };
+
+    Tracer tracer;
+
+    auto parent = tracer.fork([&] {
+        pid_t pid = fork();
+        if (pid == 0) {
+            syscall(SYS_getppid);
+            _exit(EXIT_SUCCESS);
+        } else if (pid > 0) {
+            int status;
+            waitpid(pid, &status, 0);
+        }
+    }, {
+        SysCall("getppid", NATIVE_ARCH_ABI),
+        SysCall("clone", NATIVE_ARCH_ABI),
+    }, Flag::TraceChildren);
+    ASSERT_TRUE(parent);
+
+    auto parent_tid = parent.value()->tid;
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    // clone() in the parent
+    ASSERT_EQ(clones, 1);
+    ASSERT_EQ(tids.size(), 1u);
+    ASSERT_NE(tids[0], parent_tid);
+}
+
+TEST(SysCallFilterTest, InvalidSysCall)
+{
+    Tracer tracer;
+
+    auto r = tracer.fork([] {}, {SysCall()});
+    ASSERT_FALSE(r);
+    ASSERT_EQ(r.error(), std::errc::invalid_argument);
+}
@@ -29,6 +29,7 @@
 #include <sys/syscall.h>
 
 #include "mbsystrace/syscalls.h"
+#include "mbsystrace/syscalls_list_p.h"
 #include "mbsystrace/tracee.h"
 #include "mbsystrace/tracer.h"
 
@@ -72,6 +73,46 @@ TEST(SysCallsTest, CheckSysCallsListSanity)
     }
 }
 
+TEST(SysCallsTest, LookupMatchesSysCallsList)
+{
+    std::vector<ArchAbi> abis{
+#if defined(__x86_64__)
+        ArchAbi::X86_64,
+        ArchAbi::X32,
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+        ArchAbi::X86_32,
+#endif
+#if defined(__aarch64__)
+        ArchAbi::Aarch64,
+#endif
+#if defined(__arm__) || defined(__aarch64__)
+        ArchAbi::Eabi,
+#endif
+    };
+
+    for (auto abi : abis) {
+        auto i = static_cast<std::underlying_type_t<ArchAbi>>(abi);
+
+        for (auto it = detail::g_syscall_tables[i].list; it->name; ++it) {
+            SysCall by_name(it->name, abi);
+            ASSERT_TRUE(by_name) << "[" << it->name << ", " << i << "] "
+                    << "Syscall name not found";
+            ASSERT_EQ(by_name.num(), it->num);
+            ASSERT_STREQ(by_name.name(), it->name);
+
+            SysCall by_num(it->num, abi);
+            ASSERT_TRUE(by_num) << "[" << it->num << ", " << i << "] "
+                    << "Syscall number not found";
+            ASSERT_EQ(by_num.num(), it->num);
+        }
+
+        ASSERT_FALSE(SysCall("nonexistent", abi));
+        ASSERT_FALSE(SysCall("", abi));
+        ASSERT_FALSE(SysCall(0x7fffffff, abi));
+    }
+}
+
 TEST(SysCallsTest, CheckEntryAndExitMatch)
 {
     // Pair of (is entry?, syscall name)
@@ -191,6 +232,41 @@ TEST(SysCallsTest, ModifySysCallArgs)
     ASSERT_EQ(exit_code, 7);
 }
 
+TEST(SysCallsTest, ModifySysCallArgsMultipleTimes)
+{
+    int exit_code = -1;
+
+    Hooks hooks;
+
+    hooks.syscall_entry = [](auto tracee, auto &info) {
+        if (strcmp(info.syscall.name(), "read") == 0) {
+            SysCall sc("exit_group", info.syscall.abi());
+            assert(sc);
+            (void) tracee->modify_syscall_args(sc.num(), info.args);
+
+            auto args = info.args;
+            args[0] = 9;
+            (void) tracee->modify_syscall_args(sc.num(), args);
+        }
+
+        return action::ContinueExec{};
+    };
+    hooks.tracee_exit = [&](auto, auto ec) -> TraceeExitAction {
+        exit_code = ec;
+        return action::NoAction{};
+    };
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([&] {
+        read(7, nullptr, 0);
+    }));
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    ASSERT_EQ(exit_code, 9);
+}
+
 TEST(SysCallsTest, ModifySysCallRet)
 {
     int exit_code = -1;
@@ -223,3 +299,32 @@ TEST(SysCallsTest, ModifySysCallRet)
 
     ASSERT_EQ(exit_code, 7);
 }
+
+TEST(SysCallsTest, CountSysCallStops)
+{
+    static constexpr uint64_t NUM_SYSCALLS = 20;
+
+    Hooks hooks;
+
+    Tracer tracer;
+
+    ASSERT_TRUE(tracer.fork([] {
+        for (uint64_t i = 0; i < NUM_SYSCALLS; ++i) {
+            syscall(SYS_getppid);
+        }
+    }));
+
+    // Exclude the stops used by fork() to set up the tracee
+    tracer.reset_stats();
+
+    ASSERT_TRUE(tracer.execute(hooks));
+
+    auto stats = tracer.stats();
+    auto it = stats.syscalls.find({NATIVE_ARCH_ABI, SYS_getppid});
+    ASSERT_NE(it, stats.syscalls.end());
+
+    ASSERT_EQ(it->second.entry, NUM_SYSCALLS);
+    ASSERT_EQ(it->second.exit, NUM_SYSCALLS);
+    ASSERT_GE(stats.events, 2 * NUM_SYSCALLS);
+    ASSERT_GE(stats.ptrace_calls, 2 * NUM_SYSCALLS);
+}
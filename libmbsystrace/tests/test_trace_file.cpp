@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbsystrace/trace_file.h"
+
+using namespace mb;
+using namespace mb::systrace;
+
+
+static void assert_records_equal(const TraceRecord &a, const TraceRecord &b)
+{
+    ASSERT_EQ(a.type, b.type);
+    ASSERT_EQ(a.time, b.time);
+    ASSERT_EQ(a.tid, b.tid);
+    ASSERT_EQ(a.value, b.value);
+    ASSERT_EQ(a.abi, b.abi);
+    ASSERT_EQ(a.syscall, b.syscall);
+    ASSERT_EQ(a.ret, b.ret);
+}
+
+TEST(TraceFileTest, RoundTrip)
+{
+    const std::vector<TraceRecord> records{
+        {TraceRecordType::NewTracee, 0, 100, 0, {}, 0, 0},
+        {TraceRecordType::SysCallEntry, 10, 100, 0, NATIVE_ARCH_ABI, 59, 0},
+        {TraceRecordType::SysCallExit, 10, 100, 0, NATIVE_ARCH_ABI, 59, -2},
+        {TraceRecordType::SysCallExit, 5000000000, 101, 0, NATIVE_ARCH_ABI,
+                300, 0x7fffffff12345678},
+        {TraceRecordType::TraceeSignal, 5000000001, 101, 17, {}, 0, 0},
+        {TraceRecordType::UnknownChild, 5000000002, 102, 0x137f, {}, 0, 0},
+        {TraceRecordType::TraceeExit, 5000000003, 100, 255, {}, 0, 0},
+    };
+
+    void *data = nullptr;
+    size_t size = 0;
+    MemoryFile file(&data, &size);
+    ASSERT_TRUE(file.is_open());
+
+    {
+        TraceWriter writer(file);
+
+        for (auto const &record : records) {
+            ASSERT_TRUE(writer.write(record));
+        }
+
+        ASSERT_TRUE(writer.flush());
+    }
+
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+
+    TraceReader reader(file);
+
+    for (auto const &expected : records) {
+        auto record = reader.next();
+        ASSERT_TRUE(record);
+        ASSERT_TRUE(record.value());
+        assert_records_equal(*record.value(), expected);
+    }
+
+    auto end = reader.next();
+    ASSERT_TRUE(end);
+    ASSERT_FALSE(end.value());
+
+    free(data);
+}
+
+TEST(TraceFileTest, RejectDecreasingTime)
+{
+    MemoryFile file;
+    TraceWriter writer(file);
+
+    ASSERT_TRUE(writer.write({TraceRecordType::InterruptStop, 10, 1,
+                              0, {}, 0, 0}));
+    ASSERT_EQ(writer.write({TraceRecordType::InterruptStop, 9, 1,
+                            0, {}, 0, 0}).error(),
+              std::errc::invalid_argument);
+}
+
+TEST(TraceFileTest, RejectInvalidData)
+{
+    unsigned char bad_magic[] = "NOTATRACE";
+    MemoryFile bad_magic_file(bad_magic, sizeof(bad_magic));
+    TraceReader bad_magic_reader(bad_magic_file);
+
+    ASSERT_EQ(bad_magic_reader.next().error(), std::errc::bad_message);
+
+    void *data = nullptr;
+    size_t size = 0;
+    MemoryFile file(&data, &size);
+
+    {
+        TraceWriter writer(file);
+        ASSERT_TRUE(writer.write({TraceRecordType::SysCallExit, 0, 1, 0,
+                                  NATIVE_ARCH_ABI, 1, -1}));
+    }
+
+    // Cut off the return value
+    MemoryFile truncated_file(data, size - 1);
+    TraceReader truncated_reader(truncated_file);
+
+    ASSERT_EQ(truncated_reader.next().error(), std::errc::bad_message);
+
+    free(data);
+}
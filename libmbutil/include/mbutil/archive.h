@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -46,6 +47,21 @@ enum class CompressionType : uint8_t
     Lz4,
     Gzip,
     Xz,
+    Zstd,
+};
+
+struct CompressionOptions
+{
+    // Compression level (filter default if unset)
+    std::optional<int> level;
+    // Number of compression threads. 0 uses one thread per CPU. Gzip and lz4
+    // are compressed in parallel blocks by ParallelCompressor and xz and zstd
+    // use libarchive's multithreaded compression. Unused for no compression.
+    unsigned int threads = 1;
+    // Compress on a separate thread instead of on the thread that reads the
+    // files and writes the tar stream. Not needed (and ignored) when gzip or
+    // lz4 is compressed in parallel blocks.
+    bool pipelined = false;
 };
 
 int libarchive_copy_data(archive *in, archive *out, archive_entry *entry);
@@ -57,12 +73,18 @@ bool libarchive_tar_extract(const std::string &filename,
                             const std::string &target,
                             const std::vector<std::string> &patterns,
                             CompressionType compression,
-                            bool is_split);
+                            bool is_split,
+                            unsigned int threads = 1);
+bool libarchive_tar_verify(const std::string &filename,
+                           CompressionType compression,
+                           bool is_split,
+                           unsigned int threads = 1);
 bool libarchive_tar_create(const std::string &filename,
                            const std::string &base_dir,
                            const std::vector<std::string> &paths,
                            CompressionType compression,
-                           uint64_t split_archive_size);
+                           uint64_t split_archive_size,
+                           const CompressionOptions &options = {});
 
 bool extract_archive(const std::string &filename, const std::string &target);
 bool extract_files(const std::string &filename, const std::string &target,
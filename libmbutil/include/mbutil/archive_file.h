@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <archive.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+/*!
+ * \brief libarchive read callbacks for a File
+ *
+ * Binds any File to an archive reader. Reading starts at the file's current
+ * position. Skipping and seeking use File::seek(), so formats that need random
+ * access (eg. the seekable zip reader) work on any seekable file.
+ *
+ * When constructed from an MmapFile, blocks are handed to libarchive as views
+ * of the mapping instead of being copied. The reader then tracks its own
+ * position and leaves the file's position alone, so one mapping can be shared
+ * by several readers.
+ *
+ * The file and this object must outlive the archive.
+ */
+class ArchiveFileReader
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+    ArchiveFileReader(File &file, size_t block_size = DEFAULT_BLOCK_SIZE);
+    ArchiveFileReader(MmapFile &file, size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ArchiveFileReader)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ArchiveFileReader)
+
+    int open(archive *a);
+
+private:
+    File &m_file;
+    MmapFile *m_mmap;
+    size_t m_block_size;
+    std::vector<unsigned char> m_buf;
+    uint64_t m_pos;
+
+    static la_ssize_t la_read_cb(archive *a, void *userdata,
+                                 const void **buffer);
+    static la_int64_t la_skip_cb(archive *a, void *userdata,
+                                 la_int64_t request);
+    static la_int64_t la_seek_cb(archive *a, void *userdata,
+                                 la_int64_t offset, int whence);
+};
+
+/*!
+ * \brief libarchive write callbacks for a File
+ *
+ * The file and this object must outlive the archive.
+ */
+class ArchiveFileWriter
+{
+public:
+    ArchiveFileWriter(File &file);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ArchiveFileWriter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ArchiveFileWriter)
+
+    int open(archive *a);
+
+private:
+    File &m_file;
+
+    static la_ssize_t la_write_cb(archive *a, void *userdata,
+                                  const void *buffer, size_t length);
+};
+
+/*!
+ * \brief Input file for an archive reader
+ *
+ * The file is mapped if possible. Otherwise (eg. on FUSE filesystems without
+ * mmap support), it is read through a file descriptor.
+ *
+ * This object must outlive the archive.
+ */
+class ArchiveInputFile
+{
+public:
+    ArchiveInputFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ArchiveInputFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ArchiveInputFile)
+
+    oc::result<void> open(const std::string &path,
+                          size_t block_size
+                          = ArchiveFileReader::DEFAULT_BLOCK_SIZE);
+
+    int open_archive(archive *a);
+
+private:
+    MmapFile m_mmap;
+    FdFile m_fd;
+    std::optional<ArchiveFileReader> m_reader;
+};
+
+}
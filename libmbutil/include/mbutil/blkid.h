@@ -19,7 +19,12 @@
 
 #pragma once
 
+#include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
 
 #include "mbcommon/outcome.h"
 
@@ -27,5 +32,19 @@ namespace mb::util
 {
 
 oc::result<std::string> blkid_get_fs_type(const std::string &path);
+std::vector<oc::result<std::string>>
+blkid_get_fs_types(const std::vector<std::string> &paths);
+
+class BlkidCache
+{
+public:
+    std::vector<oc::result<std::string>>
+    get_fs_types(const std::vector<std::string> &paths);
+
+private:
+    // Value of /sys/kernel/uevent_seqnum when the cache was populated
+    std::optional<uint64_t> _seqnum;
+    std::unordered_map<dev_t, std::string> _types;
+};
 
 }
@@ -56,10 +56,20 @@ using CmdRawCb = std::function<void(std::string_view data, bool error)>;
  */
 using CmdLineCb = std::function<void(std::string_view line, bool error)>;
 
+/*!
+ * \brief Command output timeout callback
+ *
+ * Called when no output has been read for the timeout passed to the reader.
+ */
+using CmdTimeoutCb = std::function<void()>;
+
 struct CommandCtxPriv;
 
 struct CommandCtx
 {
+    CommandCtx();
+    ~CommandCtx();
+
     /*! Path to executable */
     std::string path;
     /*! Argument list */
@@ -85,7 +95,11 @@ bool command_start(CommandCtx &ctx);
 int command_wait(CommandCtx &ctx);
 
 bool command_raw_reader(CommandCtx &ctx, const CmdRawCb &cb);
+bool command_raw_reader(CommandCtx &ctx, const CmdRawCb &cb,
+                        int timeout_ms, const CmdTimeoutCb &timeout_cb);
 bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb);
+bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb,
+                         int timeout_ms, const CmdTimeoutCb &timeout_cb);
 
 int run_command(const std::string &path,
                 const std::vector<std::string> &argv,
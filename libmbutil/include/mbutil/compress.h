@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+struct z_stream_s;
+
+namespace mb::util
+{
+
+enum class ParallelFormat : uint8_t
+{
+    // Single-member gzip file (same output structure as pigz)
+    Gzip,
+    // LZ4 frame with independent blocks
+    Lz4Frame,
+    // LZ4 legacy format, which is the only one the kernel can decompress
+    Lz4Legacy,
+};
+
+class ParallelCompressor
+{
+public:
+    using WriteFn = std::function<bool(std::string_view data)>;
+
+    ParallelCompressor(ParallelFormat format, WriteFn write_fn,
+                       unsigned int threads = 0,
+                       std::optional<int> level = std::nullopt);
+    ~ParallelCompressor();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelCompressor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelCompressor)
+
+    bool write(const void *data, size_t size);
+    bool finish();
+
+private:
+    struct Job
+    {
+        std::string dict;
+        std::string input;
+        bool last;
+        bool taken;
+        bool done;
+        bool ok;
+        std::string output;
+        uint32_t crc;
+    };
+
+    ParallelFormat m_format;
+    WriteFn m_write_fn;
+    std::optional<int> m_level;
+    size_t m_block_size;
+
+    std::mutex m_mutex;
+    // Signalled when a job is queued or finished or when stopping
+    std::condition_variable m_cv;
+    // Jobs in submission order
+    std::deque<Job> m_jobs;
+    size_t m_max_jobs;
+    bool m_stop;
+    std::vector<std::thread> m_threads;
+
+    // Only accessed by the producer thread
+    bool m_wrote_header;
+    bool m_finished;
+    std::string m_pending;
+    std::string m_dict;
+    uint32_t m_crc;
+    uint64_t m_size;
+
+    bool write_header();
+    bool write_trailer();
+    bool submit(std::string input, bool last);
+    bool drain(bool all);
+    bool compress(Job &job);
+    void worker();
+};
+
+class StreamDecompressor
+{
+public:
+    using WriteFn = std::function<bool(std::string_view data)>;
+
+    StreamDecompressor(ParallelFormat format, WriteFn write_fn);
+    ~StreamDecompressor();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(StreamDecompressor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(StreamDecompressor)
+
+    static std::optional<ParallelFormat> detect_format(std::string_view data);
+
+    bool write(const void *data, size_t size);
+    bool finish();
+
+    const std::string & trailing_data() const;
+
+private:
+    ParallelFormat m_format;
+    WriteFn m_write_fn;
+
+    // Gzip state (zlib.h is not exposed in this header)
+    std::unique_ptr<z_stream_s> m_zs;
+    std::string m_out;
+
+    // LZ4 legacy state
+    bool m_read_magic;
+    std::string m_pending;
+
+    // Whether the end of the compressed stream has been reached
+    bool m_ended;
+    bool m_finished;
+    std::string m_trailing;
+
+    bool write_gzip(const char *data, size_t size);
+    bool write_lz4_legacy(bool at_eof);
+};
+
+}
@@ -24,6 +24,7 @@
 #include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
+#include "mbutil/file_op_progress.h"
 #include "mbutil/result/file_op_result.h"
 
 namespace mb::util
@@ -35,20 +36,32 @@ enum class CopyFlag : uint8_t
     CopyXattrs      = 1 << 1,
     ExcludeTopLevel = 1 << 2,
     FollowSymlinks  = 1 << 3,
+    Sparse          = 1 << 4,
+    // copy_dir() only: copy regular files on a pool of worker threads
+    Parallel        = 1 << 5,
+    // Clone regular files with FICLONE if the filesystem supports reflinks
+    Reflink         = 1 << 6,
 };
 MB_DECLARE_FLAGS(CopyFlags, CopyFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(CopyFlags)
 
-oc::result<void> copy_data_fd(int fd_source, int fd_target);
+oc::result<void> copy_data_fd(int fd_source, int fd_target,
+                              FileOpProgress *progress = nullptr);
+oc::result<void> copy_data_fd_sparse(int fd_source, int fd_target,
+                                     FileOpProgress *progress = nullptr);
 FileOpResult<void> copy_xattrs(const std::string &source,
                                const std::string &target);
 FileOpResult<void> copy_stat(const std::string &source,
                              const std::string &target);
 FileOpResult<void> copy_contents(const std::string &source,
-                                 const std::string &target);
+                                 const std::string &target,
+                                 CopyFlags flags = {},
+                                 FileOpProgress *progress = nullptr);
 FileOpResult<void> copy_file(const std::string &source,
-                             const std::string &target, CopyFlags flags);
+                             const std::string &target, CopyFlags flags,
+                             FileOpProgress *progress = nullptr);
 FileOpResult<void> copy_dir(const std::string &source,
-                            const std::string &target, CopyFlags flags);
+                            const std::string &target, CopyFlags flags,
+                            FileOpProgress *progress = nullptr);
 
 }
@@ -20,14 +20,31 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
+#include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
+#include "mbutil/file_op_progress.h"
 #include "mbutil/result/file_op_result.h"
 
 namespace mb::util
 {
 
-FileOpResult<void> delete_recursive(const std::string &path);
+enum class DeleteFlag : uint8_t
+{
+    // Delete subtrees concurrently on a pool of worker threads
+    Parallel = 1 << 0,
+};
+MB_DECLARE_FLAGS(DeleteFlags, DeleteFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(DeleteFlags)
+
+FileOpResult<void> delete_recursive(const std::string &path,
+                                    DeleteFlags flags = {},
+                                    FileOpProgress *progress = nullptr);
+FileOpResult<void> delete_contents(const std::string &path,
+                                   const std::vector<std::string> &exclusions,
+                                   DeleteFlags flags = {},
+                                   FileOpProgress *progress = nullptr);
 
 }
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <fts.h>
+#include <sys/stat.h>
+
+#include "mbcommon/flags.h"
+
+namespace mb::util
+{
+
+enum class DirWalkerFlag : uint8_t
+{
+    // If tree contains a mountpoint, traverse its contents
+    CrossMountPointBoundaries   = 1 << 0,
+    // Call on_reached_special_file() instead of separate functions
+    GroupSpecialFiles           = 1 << 1,
+    // Don't stat entries whose type is known from the directory listing. For
+    // those entries, fts_statp will be null. Directories are always stat'ed.
+    SkipStat                    = 1 << 2,
+};
+MB_DECLARE_FLAGS(DirWalkerFlags, DirWalkerFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(DirWalkerFlags)
+
+/*!
+ * \brief Lightweight FtsWrapper alternative
+ *
+ * This has the same hooks and traversal order semantics as FtsWrapper, but
+ * reads directories with `getdents64()`, stats entries relative to the parent
+ * directory's fd (or not at all with DirWalkerFlag::SkipStat) and does not
+ * allocate per entry. Symlinks are never followed.
+ *
+ * The current entry's fields have the same names as the `FTSENT` fields that
+ * FtsWrapper subclasses use, so switching the base class is straightforward.
+ * The pointers in an entry are only valid during the hook call.
+ */
+class DirWalker
+{
+public:
+    enum class Action : uint8_t
+    {
+        // Hook succeeded
+        Ok      = 1 << 0,
+        // Hook failed (run() will return false)
+        Fail    = 1 << 1,
+        // Skip current file or tree (in case of directory)
+        Skip    = 1 << 2,
+        // Stop traversal (if specified with Skip, behavior is undefined)
+        Stop    = 1 << 3,
+        // Go to next entry (only useful for on_changed_path(). If this is
+        // returned, then the on_reached_*() functions will not be called)
+        Next    = 1 << 4,
+    };
+    MB_DECLARE_FLAGS(Actions, Action)
+
+    struct Entry
+    {
+        // One of FTS_D, FTS_DP, FTS_F, FTS_SL, FTS_DEFAULT
+        unsigned short fts_info;
+        // Path for accessing the file (same as fts_path)
+        const char *fts_accpath;
+        // Path, including the input path as a prefix
+        const char *fts_path;
+        // File name
+        const char *fts_name;
+        // Depth (the input path is level 0)
+        short fts_level;
+        // stat() results (null if not stat'ed)
+        struct stat *fts_statp;
+
+        // Not in FTSENT
+
+        // Parent directory fd and the entry's path relative to it, for use
+        // with *at() syscalls. For the root, this is AT_FDCWD and the input
+        // path.
+        int at_fd;
+        const char *at_path;
+        // fd of the directory itself during on_reached_directory_post() (or
+        // -1 if the directory was not opened)
+        int dir_fd;
+    };
+
+    DirWalker(std::string path, DirWalkerFlags flags);
+    virtual ~DirWalker();
+
+    bool run();
+    std::string error();
+
+    virtual bool on_pre_execute();
+    virtual bool on_post_execute(bool success);
+    virtual Actions on_changed_path();
+    virtual Actions on_reached_directory_pre();
+    virtual Actions on_reached_directory_post();
+    virtual Actions on_reached_file();
+    virtual Actions on_reached_symlink();
+    virtual Actions on_reached_special_file();
+
+    // Special files
+    virtual Actions on_reached_block_device();
+    virtual Actions on_reached_character_device();
+    virtual Actions on_reached_fifo();
+    virtual Actions on_reached_socket();
+
+protected:
+    // Input path
+    std::string _path;
+    // Input flags
+    DirWalkerFlags _flags;
+    // Current entry
+    Entry *_curr;
+    // Root (level 0) entry
+    Entry *_root;
+    // Error message (valid only if run() returned false)
+    std::string _error_msg;
+
+private:
+    bool _ran;
+    bool _stop;
+    dev_t _dev;
+    // Path of the current entry. Each level appends its name to this.
+    std::string _pathbuf;
+    // Name of the root entry
+    std::string _root_name;
+    // Root entry and stat buffer
+    Entry _root_entry;
+    struct stat _root_sb;
+    // Directory listing buffers, indexed by level. These are reused for all
+    // directories at the same level.
+    std::vector<std::vector<char>> _dirbufs;
+
+    bool visit(int dirfd, const char *name, Entry &entry, struct stat &sb,
+               unsigned char d_type, size_t name_offset);
+    bool visit_directory(int dirfd, const char *name, Entry &entry,
+                         struct stat &sb, size_t name_offset);
+    bool visit_directory_post(Entry &entry, size_t name_offset);
+    bool read_directory(int fd, size_t level, size_t &size);
+    void set_entry_path(Entry &entry, size_t name_offset);
+};
+
+MB_DECLARE_OPERATORS_FOR_FLAGS(DirWalker::Actions)
+
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include <cstdint>
+
+namespace mb::util
+{
+
+/*!
+ * \brief Progress of a long-running file operation
+ *
+ * The counters are updated by the thread(s) performing the operation and may
+ * be read from any other thread at any time. The operation stops as soon as
+ * possible after cancelled is set and fails with
+ * `std::errc::operation_canceled`.
+ */
+struct FileOpProgress
+{
+    //! Number of bytes processed so far
+    std::atomic<uint64_t> bytes{0};
+    //! Number of files processed so far
+    std::atomic<uint64_t> files{0};
+    //! Set to request cancellation
+    std::atomic<bool> cancelled{false};
+};
+
+}
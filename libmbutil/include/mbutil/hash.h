@@ -20,7 +20,11 @@
 #pragma once
 
 #include <array>
+#include <functional>
 #include <string>
+#include <vector>
+
+#include <cstdint>
 
 #include <openssl/sha.h>
 
@@ -31,6 +35,26 @@ namespace mb::util
 
 using Sha512Digest = std::array<unsigned char, SHA512_DIGEST_LENGTH>;
 
+using HashCancelledFn = std::function<bool()>;
+using HashProgressFn = std::function<void(size_t done, size_t total)>;
+
+//! Byte range of a file to hash
+struct HashRange
+{
+    std::string path;
+    uint64_t offset;
+    //! Number of bytes to hash or UINT64_MAX to hash until EOF
+    uint64_t size;
+};
+
 oc::result<Sha512Digest> sha512_hash(const std::string &path);
+oc::result<std::vector<Sha512Digest>>
+sha512_hash_files(const std::vector<std::string> &paths,
+                  const HashCancelledFn &cancelled = {},
+                  const HashProgressFn &progress = {});
+oc::result<std::vector<Sha512Digest>>
+sha512_hash_ranges(const std::vector<HashRange> &ranges,
+                   const HashCancelledFn &cancelled = {},
+                   const HashProgressFn &progress = {});
 
 }
@@ -21,15 +21,29 @@
 
 #include <string>
 
+#include <cstddef>
+#include <cstdint>
+
 #include "mbcommon/outcome.h"
 
 namespace mb::util
 {
 
+struct LoopDeviceOptions
+{
+    //! Bypass the page cache (LO_FLAGS_DIRECT_IO) so that data is not cached
+    //! in both the loop device and the backing file
+    bool direct_io = false;
+    //! Logical block size of the loop device (0 for the kernel default)
+    uint32_t block_size = 0;
+};
+
+size_t loopdev_pool_init(int count);
 oc::result<std::string> loopdev_find_unused();
 oc::result<void> loopdev_set_up_device(const std::string &loopdev,
                                        const std::string &file,
-                                       uint64_t offset, bool ro);
+                                       uint64_t offset, bool ro,
+                                       const LoopDeviceOptions &options = {});
 oc::result<void> loopdev_remove_device(const std::string &loopdev);
 
 }
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include <sys/types.h>
+
+#include "mbcommon/flags.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+enum class MetadataFlag : uint8_t
+{
+    // Apply to the entire tree
+    Recursive   = 1 << 0,
+    // Process the top-level subtrees concurrently (implies Recursive)
+    Parallel    = 1 << 1,
+};
+MB_DECLARE_FLAGS(MetadataFlags, MetadataFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(MetadataFlags)
+
+struct Metadata
+{
+    //! Owner (symlinks themselves are changed)
+    std::optional<uid_t> uid;
+    //! Group (symlinks themselves are changed)
+    std::optional<gid_t> gid;
+    //! Permissions (not applied to symlinks)
+    std::optional<mode_t> mode;
+    //! SELinux label (symlinks themselves are changed)
+    std::optional<std::string> context;
+};
+
+oc::result<void> apply_metadata(const std::string &path,
+                                const Metadata &metadata,
+                                MetadataFlags flags);
+
+}
@@ -21,8 +21,12 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
+#include "mbutil/loopdev.h"
 
 namespace mb::util
 {
@@ -64,12 +68,39 @@ struct MountEntry
 
 oc::result<std::vector<MountEntry>> get_mount_entries();
 
+class MountTable
+{
+public:
+    MountTable();
+    ~MountTable();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MountTable)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(MountTable)
+
+    oc::result<bool> refresh();
+
+    const std::vector<MountEntry> & entries() const;
+    const MountEntry * find(std::string_view target) const;
+    std::vector<const MountEntry *> find_prefix(std::string_view prefix) const;
+
+private:
+    int _fd;
+    bool _mountinfo;
+    bool _loaded;
+    std::vector<MountEntry> _entries;
+    // Indexes into _entries, sorted by target and then by mount order
+    std::vector<size_t> _by_target;
+};
+
 oc::result<void> is_mounted(const std::string &mountpoint);
+oc::result<void> is_mounted(const std::string &mountpoint, MountTable &table);
 oc::result<void> unmount_all(const std::string &dir);
 oc::result<void> mount(const std::string &source, const std::string &target,
                        const std::string &fstype, unsigned long mount_flags,
-                       const std::string &data);
+                       const std::string &data,
+                       const LoopDeviceOptions &loop_options = {});
 oc::result<void> umount(const std::string &target);
+oc::result<void> umount(const std::string &target, const MountTable &table);
 
 oc::result<uint64_t> mount_get_total_size(const std::string &path);
 oc::result<uint64_t> mount_get_avail_size(const std::string &path);
@@ -21,6 +21,7 @@
 
 #include <chrono>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "mbcommon/outcome.h"
@@ -29,13 +30,18 @@ namespace mb::util
 {
 
 oc::result<std::string> get_cwd();
-std::string dir_name(std::string path);
-std::string base_name(std::string path);
+std::string_view dir_name_sv(std::string_view path);
+std::string_view base_name_sv(std::string_view path);
+std::string dir_name(std::string_view path);
+std::string base_name(std::string_view path);
 oc::result<std::string> read_link(const std::string &path);
 oc::result<std::string> real_path(const std::string &path);
 std::vector<std::string> path_split(std::string path);
+std::vector<std::string_view> path_split_sv(std::string_view path);
 std::string path_join(const std::vector<std::string> &components);
+std::string path_join(const std::vector<std::string_view> &components);
 void normalize_path(std::vector<std::string> &components);
+void normalize_path(std::vector<std::string_view> &components);
 oc::result<std::string> relative_path(const std::string &path,
                                       const std::string &start);
 int path_compare(const std::string &path1, const std::string &path2);
@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include <chrono>
 #include <string>
+#include <vector>
 
 #include <sys/types.h>
 
@@ -32,4 +34,9 @@ namespace mb::util
 oc::result<void> set_process_title_init(int argc, char *argv[]);
 oc::result<size_t> set_process_title(std::string_view title);
 
+void release_free_memory();
+
+bool wait_for_processes_exit(const std::vector<pid_t> &pids,
+                             std::chrono::milliseconds timeout);
+
 }
@@ -24,10 +24,16 @@
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "mbcommon/integer.h"
 
 
+namespace mb
+{
+struct prop_info;
+}
+
 namespace mb::util
 {
 
@@ -44,6 +50,8 @@ using PropertiesMap = std::unordered_map<std::string, std::string>;
 // Helper functions
 
 std::optional<std::string> property_get(const std::string &key);
+std::vector<std::optional<std::string>>
+property_get_many(const std::vector<std::string> &keys);
 std::string property_get_string(const std::string &key,
                                 const std::string &default_value);
 bool property_get_bool(const std::string &key, bool default_value);
@@ -68,6 +76,26 @@ bool property_iter(const std::function<PropertyIterCb> &fn);
 
 std::optional<PropertiesMap> property_get_all();
 
+class PropertyCache
+{
+public:
+    std::optional<std::string> get(const std::string &key);
+    std::vector<std::optional<std::string>>
+    get_many(const std::vector<std::string> &keys);
+
+private:
+    struct Entry
+    {
+        // Null if the property did not exist
+        const prop_info *pi;
+        // Property serial if pi is not null, otherwise the area serial
+        uint32_t serial;
+        std::string value;
+    };
+
+    std::unordered_map<std::string, Entry> _entries;
+};
+
 // Properties file functions
 
 std::optional<std::string> property_file_get(const std::string &path,
@@ -97,6 +125,9 @@ bool property_file_iter(const std::string &path, std::string_view filter,
                         const std::function<PropertyIterCb> &fn);
 
 std::optional<PropertiesMap> property_file_get_all(const std::string &path);
+std::optional<PropertiesMap>
+property_file_get_keys(const std::string &path,
+                       const std::vector<std::string_view> &keys);
 
 bool property_file_write_all(const std::string &path, const PropertiesMap &map);
 
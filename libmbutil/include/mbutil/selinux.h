@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 #include <sepol/policydb/policydb.h>
 
@@ -46,7 +47,10 @@ enum class SELinuxAttr
     SockCreate,
 };
 
+bool selinux_read_policy_data(std::string_view data, policydb_t *pdb);
 bool selinux_read_policy(const std::string &path, policydb_t *pdb);
+bool selinux_policy_to_image(policydb_t *pdb, std::string &out);
+bool selinux_write_policy_data(const std::string &path, std::string_view data);
 bool selinux_write_policy(const std::string &path, policydb_t *pdb);
 oc::result<std::string> selinux_get_context(const std::string &path);
 oc::result<std::string> selinux_lget_context(const std::string &path);
@@ -21,14 +21,29 @@
 
 #include <algorithm>
 #include <array>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_set>
 #include <cerrno>
+#include <cinttypes>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "mbcommon/common.h"
 #include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/archive_file.h"
+#include "mbutil/compress.h"
 #include "mbutil/directory.h"
 #include "mbutil/path.h"
 
@@ -84,16 +99,25 @@ int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
 /*!
  * \brief Copy sparse file on disk to an archive
  *
+ * Holes are reported by the disk reader as gaps between data blocks and are
+ * also recorded in the entry's sparse map. The pax writer stores the map as
+ * GNU sparse 1.0 headers and discards the bytes written for the holes, so they
+ * are never stored or compressed. They still need to be passed through
+ * archive_write_data() to advance the writer's position.
+ *
  * \see tar/write.c from libarchive's source code
  */
 bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
                                           archive_entry *entry)
 {
+    // Not const so it is placed in .bss. Large enough to skip over most holes
+    // in a few calls. It is only ever read.
+    static char null_buf[1024 * 1024];
+
     size_t bytes_read;
     ssize_t bytes_written;
     int64_t offset;
     int64_t progress = 0;
-    char null_buf[64 * 1024] = {};
     const void *buf;
     int ret;
 
@@ -193,7 +217,7 @@ struct SplitCtx
     {
         if (need_open) {
             if (file.is_open()) {
-                OUTCOME_TRYV(file.close());
+                OUTCOME_TRYV(close_file());
             }
 
             std::string filename(path);
@@ -203,12 +227,24 @@ struct SplitCtx
 
             OUTCOME_TRYV(file.open(filename, mode));
 
+            // Backups are streamed once from start to finish. The hints are
+            // best effort and not all files support them
+            (void) file.advise(0, 0, FileAdvice::Sequential);
+
             need_open = false;
         }
 
         return oc::success();
     }
 
+    oc::result<void> close_file()
+    {
+        // Avoid evicting more useful data from the page cache
+        (void) file.advise(0, 0, FileAdvice::DontNeed);
+
+        return file.close();
+    }
+
     void move_to_next()
     {
         ++split_num;
@@ -225,7 +261,7 @@ struct SplitCtx
         auto *ctx = static_cast<SplitCtx *>(userdata);
 
         if (ctx->file.is_open()) {
-            if (auto r = ctx->file.close(); !r) {
+            if (auto r = ctx->close_file(); !r) {
                 set_archive_error(a, r.error());
                 return ARCHIVE_FATAL;
             }
@@ -276,68 +312,1179 @@ struct SplitReaderCtx : SplitCtx
         }
     }
 
-    int archive_open(archive *a)
+    int archive_open(archive *a)
+    {
+        return archive_read_open(a, this, nullptr, &la_read_cb, &la_close_cb);
+    }
+};
+
+struct SplitWriterCtx : SplitCtx
+{
+    // Bytes written for current file
+    uint64_t bytes_written;
+    // Max size of split files
+    uint64_t max_size;
+
+    SplitWriterCtx(std::string path, uint64_t max_size)
+        : SplitCtx(std::move(path), max_size > 0)
+        , bytes_written(0)
+        , max_size(max_size)
+    {
+    }
+
+    oc::result<void> write(const void *data, size_t size)
+    {
+        const char *ptr = static_cast<const char *>(data);
+        size_t remain = size;
+
+        while (remain > 0) {
+            OUTCOME_TRYV(open_if_needed(FileOpenMode::WriteOnly));
+
+            auto to_write = static_cast<size_t>(std::min<uint64_t>(
+                    remain,
+                    is_split() ? (max_size - bytes_written) : remain));
+
+            OUTCOME_TRY(n, file.write(ptr, to_write));
+
+            bytes_written += n;
+            ptr += n;
+            remain -= n;
+
+            if (is_split() && bytes_written == max_size) {
+                bytes_written = 0;
+                move_to_next();
+            }
+        }
+
+        return oc::success();
+    }
+
+    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
+                                  size_t size)
+    {
+        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+
+        if (auto r = ctx->write(data, size); !r) {
+            set_archive_error(a, r.error());
+            return -1;
+        }
+
+        return static_cast<la_ssize_t>(size);
+    }
+
+    int archive_open(archive *a)
+    {
+        return archive_write_open(a, this, nullptr, &la_write_cb, &la_close_cb);
+    }
+};
+
+/*!
+ * \brief Compress an archive stream with ParallelCompressor
+ *
+ * The archive writer has no compression filter. Its output is compressed in
+ * blocks on a pool of worker threads and the compressed stream is written to
+ * the (possibly split) output files.
+ */
+struct ParallelWriterCtx
+{
+    SplitWriterCtx &split;
+    // Error from writing the compressed data, if any
+    std::error_code ec;
+    ParallelCompressor compressor;
+
+    ParallelWriterCtx(SplitWriterCtx &split, ParallelFormat format,
+                      const CompressionOptions &options)
+        : split(split)
+        , compressor(format, [this](std::string_view data) {
+            if (auto r = this->split.write(data.data(), data.size()); !r) {
+                ec = r.error();
+                return false;
+            }
+            return true;
+        }, options.threads, options.level)
+    {
+    }
+
+    void set_archive_error(archive *a)
+    {
+        if (ec) {
+            SplitCtx::set_archive_error(a, ec);
+        } else {
+            archive_set_error(a, ARCHIVE_ERRNO_MISC, "Failed to compress data");
+        }
+    }
+
+    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
+                                  size_t size)
+    {
+        auto *ctx = static_cast<ParallelWriterCtx *>(userdata);
+
+        if (!ctx->compressor.write(data, size)) {
+            ctx->set_archive_error(a);
+            return -1;
+        }
+
+        return static_cast<la_ssize_t>(size);
+    }
+
+    static int la_close_cb(archive *a, void *userdata)
+    {
+        auto *ctx = static_cast<ParallelWriterCtx *>(userdata);
+
+        if (!ctx->compressor.finish()) {
+            ctx->set_archive_error(a);
+            return ARCHIVE_FATAL;
+        }
+
+        return SplitCtx::la_close_cb(a, &ctx->split);
+    }
+
+    int archive_open(archive *a)
+    {
+        return archive_write_open(a, this, nullptr, &la_write_cb, &la_close_cb);
+    }
+};
+
+/*!
+ * \brief Compress an archive stream on a separate thread
+ *
+ * The blocks written by the tar writer are passed through a bounded queue to a
+ * worker thread, which feeds them to a second archive writer that uses the raw
+ * format and the compression filter. This allows reading the files and
+ * writing the tar stream to overlap with compression.
+ */
+class CompressorPipeline
+{
+public:
+    // Maximum number of blocks waiting to be compressed
+    static constexpr size_t MAX_QUEUED_BLOCKS = 64;
+
+    CompressorPipeline(archive *compressor, std::string filename)
+        : m_compressor(compressor)
+        , m_filename(std::move(filename))
+        , m_eof(false)
+        , m_failed(false)
+    {
+    }
+
+    ~CompressorPipeline()
+    {
+        (void) join();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CompressorPipeline)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(CompressorPipeline)
+
+    int archive_open(archive *a)
+    {
+        m_thread = std::thread(&CompressorPipeline::worker, this);
+
+        return archive_write_open(a, this, nullptr, &la_write_cb,
+                                  &la_close_cb);
+    }
+
+    /*!
+     * \brief Wait for the worker thread to finish compressing the stream
+     *
+     * \return Whether the compressed stream was successfully written
+     */
+    bool join()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_eof = true;
+        }
+        m_cv.notify_all();
+
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+
+        return !m_failed;
+    }
+
+private:
+    archive *m_compressor;
+    std::string m_filename;
+
+    std::mutex m_mutex;
+    // Signalled when a block is queued or dequeued or the state changes
+    std::condition_variable m_cv;
+    std::deque<std::string> m_blocks;
+    bool m_eof;
+    bool m_failed;
+
+    std::thread m_thread;
+
+    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
+                                  size_t size)
+    {
+        auto *ctx = static_cast<CompressorPipeline *>(userdata);
+
+        std::unique_lock lock(ctx->m_mutex);
+
+        ctx->m_cv.wait(lock, [&] {
+            return ctx->m_failed || ctx->m_blocks.size() < MAX_QUEUED_BLOCKS;
+        });
+
+        if (ctx->m_failed) {
+            archive_set_error(a, EIO, "Failed to compress data");
+            return -1;
+        }
+
+        ctx->m_blocks.emplace_back(static_cast<const char *>(data), size);
+        lock.unlock();
+        ctx->m_cv.notify_all();
+
+        return static_cast<la_ssize_t>(size);
+    }
+
+    static int la_close_cb(archive *a, void *userdata)
+    {
+        auto *ctx = static_cast<CompressorPipeline *>(userdata);
+
+        if (!ctx->join()) {
+            archive_set_error(a, EIO, "Failed to compress data");
+            return ARCHIVE_FATAL;
+        }
+
+        return ARCHIVE_OK;
+    }
+
+    void worker()
+    {
+        bool ret = write_stream();
+        if (!ret) {
+            // Don't let archive_write_free() try to flush the stream
+            archive_write_fail(m_compressor);
+        }
+
+        std::lock_guard lock(m_mutex);
+        m_failed = !ret;
+        m_blocks.clear();
+        m_cv.notify_all();
+    }
+
+    bool write_stream()
+    {
+        // The raw format writer passes the data of its only entry through
+        // unchanged
+        archive_entry *entry = archive_entry_new();
+        if (!entry) {
+            LOGE("%s: Out of memory when creating entry", m_filename.c_str());
+            return false;
+        }
+
+        auto free_entry = finally([&] {
+            archive_entry_free(entry);
+        });
+
+        archive_entry_set_filetype(entry, AE_IFREG);
+
+        if (archive_write_header(m_compressor, entry) != ARCHIVE_OK) {
+            LOGE("%s: Failed to write header: %s",
+                 m_filename.c_str(), archive_error_string(m_compressor));
+            return false;
+        }
+
+        while (true) {
+            std::string block;
+
+            {
+                std::unique_lock lock(m_mutex);
+
+                m_cv.wait(lock, [&] {
+                    return m_eof || !m_blocks.empty();
+                });
+
+                if (m_blocks.empty()) {
+                    break;
+                }
+
+                block = std::move(m_blocks.front());
+                m_blocks.pop_front();
+            }
+            m_cv.notify_all();
+
+            auto n = archive_write_data(m_compressor, block.data(),
+                                        block.size());
+            if (n < 0 || static_cast<size_t>(n) != block.size()) {
+                LOGE("%s: Failed to write data: %s",
+                     m_filename.c_str(), archive_error_string(m_compressor));
+                return false;
+            }
+        }
+
+        if (archive_write_close(m_compressor) != ARCHIVE_OK) {
+            LOGE("%s: %s", m_filename.c_str(),
+                 archive_error_string(m_compressor));
+            return false;
+        }
+
+        return true;
+    }
+};
+
+static bool add_decompression_filter(archive *a, CompressionType compression)
+{
+    switch (compression) {
+    case CompressionType::None:
+        return true;
+    case CompressionType::Lz4:
+        archive_read_support_filter_lz4(a);
+        return true;
+    case CompressionType::Gzip:
+        archive_read_support_filter_gzip(a);
+        return true;
+    case CompressionType::Xz:
+        archive_read_support_filter_xz(a);
+        return true;
+    case CompressionType::Zstd:
+        // Without libzstd, libarchive falls back to an external program
+        if (archive_read_support_filter_zstd(a) != ARCHIVE_OK) {
+            LOGE("zstd is not supported by libarchive: %s",
+                 archive_error_string(a));
+            return false;
+        }
+        return true;
+    default:
+        LOGE("Invalid compression type");
+        return false;
+    }
+}
+
+/*!
+ * \brief Decompress an archive stream on a separate thread
+ *
+ * This is the counterpart of CompressorPipeline. A worker thread reads the
+ * (possibly split) input files through a raw format reader with the
+ * decompression filter and passes the decompressed blocks through a bounded
+ * queue to the tar reader. This allows decompression to overlap with parsing
+ * the tar stream and writing the files.
+ */
+class DecompressorPipeline
+{
+public:
+    // Maximum number of blocks waiting to be parsed
+    static constexpr size_t MAX_QUEUED_BLOCKS = 64;
+    // Size of each decompressed block
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    DecompressorPipeline(std::string filename, bool is_split)
+        : m_decompressor(nullptr, archive_read_free)
+        , m_split(filename, is_split)
+        , m_filename(std::move(filename))
+        , m_eof(false)
+        , m_failed(false)
+        , m_stopped(false)
+    {
+    }
+
+    ~DecompressorPipeline()
+    {
+        stop();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DecompressorPipeline)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(DecompressorPipeline)
+
+    bool init(CompressionType compression)
+    {
+        m_decompressor.reset(archive_read_new());
+        if (!m_decompressor) {
+            LOGE("%s: Out of memory when creating decompressor", __FUNCTION__);
+            return false;
+        }
+
+        archive_read_support_format_raw(m_decompressor.get());
+
+        return add_decompression_filter(m_decompressor.get(), compression);
+    }
+
+    int archive_open(archive *a)
+    {
+        if (m_split.archive_open(m_decompressor.get()) != ARCHIVE_OK) {
+            archive_set_error(a, archive_errno(m_decompressor.get()), "%s",
+                              archive_error_string(m_decompressor.get()));
+            return ARCHIVE_FATAL;
+        }
+
+        m_thread = std::thread(&DecompressorPipeline::worker, this);
+
+        return archive_read_open(a, this, nullptr, &la_read_cb, &la_close_cb);
+    }
+
+private:
+    ScopedArchive m_decompressor;
+    SplitReaderCtx m_split;
+    std::string m_filename;
+
+    std::mutex m_mutex;
+    // Signalled when a block is queued or dequeued or the state changes
+    std::condition_variable m_cv;
+    std::deque<std::string> m_blocks;
+    bool m_eof;
+    bool m_failed;
+    bool m_stopped;
+
+    // Block currently being parsed by the tar reader
+    std::string m_current;
+
+    std::thread m_thread;
+
+    void stop()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cv.notify_all();
+
+        if (m_thread.joinable()) {
+            m_thread.join();
+            (void) archive_read_close(m_decompressor.get());
+        }
+    }
+
+    static la_ssize_t la_read_cb(archive *a, void *userdata,
+                                 const void **buffer)
+    {
+        auto *ctx = static_cast<DecompressorPipeline *>(userdata);
+
+        std::unique_lock lock(ctx->m_mutex);
+
+        ctx->m_cv.wait(lock, [&] {
+            return ctx->m_eof || !ctx->m_blocks.empty();
+        });
+
+        if (ctx->m_blocks.empty()) {
+            if (ctx->m_failed) {
+                archive_set_error(a, EIO, "Failed to decompress data");
+                return -1;
+            }
+            return 0;
+        }
+
+        ctx->m_current = std::move(ctx->m_blocks.front());
+        ctx->m_blocks.pop_front();
+        lock.unlock();
+        ctx->m_cv.notify_all();
+
+        *buffer = ctx->m_current.data();
+        return static_cast<la_ssize_t>(ctx->m_current.size());
+    }
+
+    static int la_close_cb(archive *a, void *userdata)
+    {
+        (void) a;
+
+        static_cast<DecompressorPipeline *>(userdata)->stop();
+
+        return ARCHIVE_OK;
+    }
+
+    void worker()
+    {
+        bool ret = read_stream();
+
+        std::lock_guard lock(m_mutex);
+        m_eof = true;
+        m_failed = !ret;
+        m_cv.notify_all();
+    }
+
+    bool read_stream()
+    {
+        // The raw format reader returns the decompressed stream as its only
+        // entry
+        archive_entry *entry;
+
+        if (archive_read_next_header(m_decompressor.get(), &entry)
+                != ARCHIVE_OK) {
+            LOGE("%s: Failed to read header: %s",
+                 m_filename.c_str(),
+                 archive_error_string(m_decompressor.get()));
+            return false;
+        }
+
+        while (true) {
+            std::string block(BLOCK_SIZE, '\0');
+
+            auto n = archive_read_data(m_decompressor.get(), block.data(),
+                                       block.size());
+            if (n < 0) {
+                LOGE("%s: Failed to read data: %s",
+                     m_filename.c_str(),
+                 archive_error_string(m_decompressor.get()));
+                return false;
+            } else if (n == 0) {
+                break;
+            }
+
+            block.resize(static_cast<size_t>(n));
+
+            {
+                std::unique_lock lock(m_mutex);
+
+                m_cv.wait(lock, [&] {
+                    return m_stopped || m_blocks.size() < MAX_QUEUED_BLOCKS;
+                });
+
+                if (m_stopped) {
+                    break;
+                }
+
+                m_blocks.push_back(std::move(block));
+            }
+            m_cv.notify_all();
+        }
+
+        return true;
+    }
+};
+
+/*!
+ * \brief Owner, mode, timestamps, and xattrs of an extracted entry
+ */
+struct EntryMetadata
+{
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+    std::array<timespec, 2> times;
+    std::vector<std::pair<std::string, std::string>> xattrs;
+
+    explicit EntryMetadata(archive_entry *entry)
+        : uid(static_cast<uid_t>(archive_entry_uid(entry)))
+        , gid(static_cast<gid_t>(archive_entry_gid(entry)))
+        , mode(archive_entry_perm(entry))
+        , times{}
+    {
+        times[0].tv_nsec = UTIME_OMIT;
+        times[1].tv_nsec = UTIME_OMIT;
+
+        if (archive_entry_atime_is_set(entry)) {
+            times[0].tv_sec = archive_entry_atime(entry);
+            times[0].tv_nsec = archive_entry_atime_nsec(entry);
+        }
+        if (archive_entry_mtime_is_set(entry)) {
+            times[1].tv_sec = archive_entry_mtime(entry);
+            times[1].tv_nsec = archive_entry_mtime_nsec(entry);
+        }
+
+        const char *name;
+        const void *value;
+        size_t size;
+
+        archive_entry_xattr_reset(entry);
+        while (archive_entry_xattr_next(entry, &name, &value, &size)
+                == ARCHIVE_OK) {
+            xattrs.emplace_back(name, std::string(
+                    static_cast<const char *>(value), size));
+        }
+    }
+};
+
+/*!
+ * \brief Write extracted entries to disk on a pool of worker threads
+ *
+ * This replaces libarchive's disk writer for restoring backups. The thread
+ * reading the archive creates directories, symlinks, and special files itself
+ * and queues regular files, along with their data, for the worker threads.
+ * Files that are too large to be buffered are written by the reading thread.
+ * All paths are resolved relative to a file descriptor for the target
+ * directory.
+ *
+ * Metadata is applied after the data. For regular files, this is done through
+ * the file descriptor that was used to write the data. The metadata for
+ * directories is applied in one batch once all files have been written so that
+ * creating their children doesn't change their timestamps and so that
+ * read-only directories can be populated.
+ */
+class ParallelDiskWriter
+{
+public:
+    // Maximum number of bytes of file data waiting to be written
+    static constexpr size_t MAX_QUEUED_BYTES = 64 * 1024 * 1024;
+    // Files larger than this are written by the reading thread
+    static constexpr int64_t MAX_QUEUED_FILE_SIZE = 8 * 1024 * 1024;
+
+    ParallelDiskWriter(std::string target, unsigned int threads)
+        : m_target(std::move(target))
+        , m_root_fd(-1)
+        , m_queued_bytes(0)
+        , m_done(false)
+        , m_failed(false)
+    {
+        if (threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        m_threads.reserve(threads);
+        for (unsigned int i = 0; i < threads; ++i) {
+            m_threads.emplace_back(&ParallelDiskWriter::worker, this);
+        }
+    }
+
+    ~ParallelDiskWriter()
+    {
+        join();
+
+        if (m_root_fd >= 0) {
+            close(m_root_fd);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelDiskWriter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelDiskWriter)
+
+    bool open()
+    {
+        if (auto r = mkdir_recursive(m_target, 0755); !r) {
+            LOGE("%s: Failed to create directory: %s",
+                 m_target.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        m_root_fd = ::open(m_target.c_str(),
+                           O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (m_root_fd < 0) {
+            LOGE("%s: Failed to open directory: %s",
+                 m_target.c_str(), strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
+    /*!
+     * \brief Extract an entry
+     *
+     * \param in Archive reader positioned at the entry's data
+     * \param entry Entry to extract
+     * \param path Path of the entry relative to the target directory
+     *
+     * \return Whether the entry was extracted or queued for extraction
+     */
+    bool extract(archive *in, archive_entry *entry, const std::string &path)
+    {
+        std::string rel_path;
+        if (!normalize_path(path, rel_path)) {
+            return false;
+        } else if (rel_path.empty()) {
+            // Nothing to do for the target directory itself
+            return true;
+        } else if (!create_parents(rel_path)) {
+            return false;
+        }
+
+        if (const char *link = archive_entry_hardlink(entry)) {
+            std::string rel_link;
+            if (!normalize_path(link, rel_link) || rel_link.empty()) {
+                return false;
+            }
+
+            // The target may not have been written yet
+            m_hardlinks.emplace_back(std::move(rel_link), std::move(rel_path));
+            return true;
+        }
+
+        EntryMetadata metadata(entry);
+
+        switch (archive_entry_filetype(entry)) {
+        case AE_IFREG:
+            return extract_file(in, entry, std::move(rel_path),
+                                std::move(metadata));
+
+        case AE_IFDIR:
+            if (mkdirat(m_root_fd, rel_path.c_str(), 0700) < 0
+                    && errno != EEXIST) {
+                LOGE("%s: Failed to create directory: %s",
+                     rel_path.c_str(), strerror(errno));
+                return false;
+            }
+
+            m_dirs.insert(rel_path);
+            m_dir_metadata.emplace_back(std::move(rel_path),
+                                        std::move(metadata));
+            return true;
+
+        case AE_IFLNK:
+            if (!unlink_existing(rel_path)) {
+                return false;
+            } else if (symlinkat(archive_entry_symlink(entry), m_root_fd,
+                                 rel_path.c_str()) < 0) {
+                LOGE("%s: Failed to create symlink: %s",
+                     rel_path.c_str(), strerror(errno));
+                return false;
+            }
+
+            m_symlinks.insert(rel_path);
+            return apply_metadata_at(rel_path, metadata, true);
+
+        case AE_IFCHR:
+        case AE_IFBLK:
+        case AE_IFIFO:
+        case AE_IFSOCK:
+            if (!unlink_existing(rel_path)) {
+                return false;
+            } else if (mknodat(m_root_fd, rel_path.c_str(),
+                               archive_entry_filetype(entry) | 0600,
+                               archive_entry_rdev(entry)) < 0) {
+                LOGE("%s: Failed to create special file: %s",
+                     rel_path.c_str(), strerror(errno));
+                return false;
+            }
+
+            return apply_metadata_at(rel_path, metadata, false);
+
+        default:
+            LOGE("%s: Unsupported file type", rel_path.c_str());
+            return false;
+        }
+    }
+
+    /*!
+     * \brief Wait for all files to be written and apply deferred metadata
+     *
+     * \return Whether all entries were successfully extracted
+     */
+    bool finish()
+    {
+        if (!join()) {
+            return false;
+        }
+
+        for (auto const &[target, path] : m_hardlinks) {
+            if (!unlink_existing(path)) {
+                return false;
+            } else if (linkat(m_root_fd, target.c_str(), m_root_fd,
+                              path.c_str(), 0) < 0) {
+                LOGE("%s: Failed to create hard link to %s: %s",
+                     path.c_str(), target.c_str(), strerror(errno));
+                return false;
+            }
+        }
+
+        // Children first so that restrictive permissions on a parent
+        // directory cannot prevent opening the children
+        for (auto it = m_dir_metadata.rbegin(); it != m_dir_metadata.rend();
+                ++it) {
+            int fd = openat(m_root_fd, it->first.c_str(),
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0) {
+                LOGE("%s: Failed to open directory: %s",
+                     it->first.c_str(), strerror(errno));
+                return false;
+            }
+
+            bool ret = apply_metadata_fd(fd, it->first, it->second);
+            close(fd);
+
+            if (!ret) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    struct DataBlock
+    {
+        int64_t offset;
+        std::string data;
+    };
+
+    struct FileJob
+    {
+        std::string path;
+        EntryMetadata metadata;
+        int64_t size;
+        std::vector<DataBlock> blocks;
+        size_t bytes;
+    };
+
+    std::string m_target;
+    int m_root_fd;
+
+    std::mutex m_mutex;
+    // Signalled when a job is queued or finished or the state changes
+    std::condition_variable m_cv;
+    std::deque<FileJob> m_jobs;
+    size_t m_queued_bytes;
+    bool m_done;
+    bool m_failed;
+
+    std::vector<std::thread> m_threads;
+
+    // These are only accessed by the reading thread
+    std::unordered_set<std::string> m_dirs;
+    std::unordered_set<std::string> m_symlinks;
+    std::vector<std::pair<std::string, EntryMetadata>> m_dir_metadata;
+    std::vector<std::pair<std::string, std::string>> m_hardlinks;
+
+    bool join()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_done = true;
+        }
+        m_cv.notify_all();
+
+        for (auto &t : m_threads) {
+            t.join();
+        }
+        m_threads.clear();
+
+        return !m_failed;
+    }
+
+    /*!
+     * \brief Make path relative and reject paths that escape the target
+     *
+     * This provides the same guarantees as ARCHIVE_EXTRACT_SECURE_NODOTDOT and
+     * ARCHIVE_EXTRACT_SECURE_SYMLINKS. Since the only symlinks that can be
+     * traversed are ones created by this extraction (the target is wiped
+     * beforehand), only those need to be checked.
+     */
+    bool normalize_path(std::string_view path, std::string &result)
+    {
+        result.clear();
+
+        for (auto const &component : split_sv(path, "/")) {
+            if (component.empty() || component == ".") {
+                continue;
+            } else if (component == "..") {
+                LOGE("%s: Path contains '..'", std::string(path).c_str());
+                return false;
+            }
+
+            if (!result.empty()) {
+                if (m_symlinks.find(result) != m_symlinks.end()) {
+                    LOGE("%s: Path traverses symlink: %s",
+                         std::string(path).c_str(), result.c_str());
+                    return false;
+                }
+                result += '/';
+            }
+            result += component;
+        }
+
+        return true;
+    }
+
+    /*!
+     * \brief Create parent directories that are not in the archive
+     */
+    bool create_parents(const std::string &path)
+    {
+        for (size_t pos = path.find('/'); pos != std::string::npos;
+                pos = path.find('/', pos + 1)) {
+            std::string parent = path.substr(0, pos);
+
+            if (m_dirs.find(parent) != m_dirs.end()) {
+                continue;
+            }
+
+            if (mkdirat(m_root_fd, parent.c_str(), 0755) < 0
+                    && errno != EEXIST) {
+                LOGE("%s: Failed to create directory: %s",
+                     parent.c_str(), strerror(errno));
+                return false;
+            }
+
+            m_dirs.insert(std::move(parent));
+        }
+
+        return true;
+    }
+
+    bool unlink_existing(const std::string &path)
+    {
+        if (unlinkat(m_root_fd, path.c_str(), 0) < 0 && errno != ENOENT) {
+            LOGE("%s: Failed to remove existing file: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
+    bool extract_file(archive *in, archive_entry *entry, std::string path,
+                      EntryMetadata metadata)
+    {
+        int64_t size = archive_entry_size(entry);
+
+        if (!archive_entry_size_is_set(entry) || size > MAX_QUEUED_FILE_SIZE) {
+            return write_file_streamed(in, path, metadata, size);
+        }
+
+        FileJob job{std::move(path), std::move(metadata), size, {}, 0};
+
+        const void *buf;
+        size_t n;
+        int64_t offset;
+        int ret;
+
+        while ((ret = archive_read_data_block(in, &buf, &n, &offset))
+                == ARCHIVE_OK) {
+            job.blocks.push_back({offset, std::string(
+                    static_cast<const char *>(buf), n)});
+            job.bytes += n;
+        }
+
+        if (ret != ARCHIVE_EOF) {
+            LOGE("%s: Failed to read data: %s",
+                 job.path.c_str(), archive_error_string(in));
+            return false;
+        }
+
+        std::unique_lock lock(m_mutex);
+
+        m_cv.wait(lock, [&] {
+            return m_failed || m_jobs.empty()
+                    || m_queued_bytes + job.bytes <= MAX_QUEUED_BYTES;
+        });
+
+        if (m_failed) {
+            return false;
+        }
+
+        m_queued_bytes += job.bytes;
+        m_jobs.push_back(std::move(job));
+        lock.unlock();
+        m_cv.notify_all();
+
+        return true;
+    }
+
+    void worker()
+    {
+        while (true) {
+            std::optional<FileJob> job;
+
+            {
+                std::unique_lock lock(m_mutex);
+
+                m_cv.wait(lock, [&] {
+                    return m_done || !m_jobs.empty();
+                });
+
+                if (m_jobs.empty()) {
+                    break;
+                }
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+
+            bool failed;
+            {
+                std::lock_guard lock(m_mutex);
+                failed = m_failed;
+            }
+
+            // Don't keep writing files after a failure
+            bool ret = !failed && write_file(*job);
+
+            {
+                std::lock_guard lock(m_mutex);
+                m_queued_bytes -= job->bytes;
+                if (!ret) {
+                    m_failed = true;
+                }
+            }
+            m_cv.notify_all();
+        }
+    }
+
+    int open_file(const std::string &path)
+    {
+        if (!unlink_existing(path)) {
+            return -1;
+        }
+
+        int fd = openat(m_root_fd, path.c_str(),
+                        O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC,
+                        0600);
+        if (fd < 0) {
+            LOGE("%s: Failed to open for writing: %s",
+                 path.c_str(), strerror(errno));
+        }
+
+        return fd;
+    }
+
+    static bool write_block(int fd, const std::string &path,
+                            const void *data, size_t size, int64_t offset)
+    {
+        auto ptr = static_cast<const char *>(data);
+
+        while (size > 0) {
+            ssize_t n = pwrite64(fd, ptr, size, offset);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                LOGE("%s: Failed to write data: %s",
+                     path.c_str(), strerror(errno));
+                return false;
+            }
+
+            ptr += n;
+            size -= static_cast<size_t>(n);
+            offset += n;
+        }
+
+        return true;
+    }
+
+    /*!
+     * \brief Set length, which creates any trailing hole, and apply metadata
+     */
+    static bool finish_file(int fd, const std::string &path,
+                            const EntryMetadata &metadata, int64_t size)
+    {
+        if (size >= 0 && ftruncate64(fd, size) < 0) {
+            LOGE("%s: Failed to set file size: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        return apply_metadata_fd(fd, path, metadata);
+    }
+
+    bool write_file(const FileJob &job)
     {
-        return archive_read_open(a, this, nullptr, &la_read_cb, &la_close_cb);
-    }
-};
+        int fd = open_file(job.path);
+        if (fd < 0) {
+            return false;
+        }
 
-struct SplitWriterCtx : SplitCtx
-{
-    // Bytes written for current file
-    uint64_t bytes_written;
-    // Max size of split files
-    uint64_t max_size;
+        auto close_fd = finally([&] {
+            close(fd);
+        });
 
-    SplitWriterCtx(std::string path, uint64_t max_size)
-        : SplitCtx(std::move(path), max_size > 0)
-        , bytes_written(0)
-        , max_size(max_size)
-    {
+        // Holes are not written, so sparse files stay sparse
+        for (auto const &block : job.blocks) {
+            if (!write_block(fd, job.path, block.data.data(),
+                             block.data.size(), block.offset)) {
+                return false;
+            }
+        }
+
+        return finish_file(fd, job.path, job.metadata, job.size);
     }
 
-    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
-                                  size_t size)
+    bool write_file_streamed(archive *in, const std::string &path,
+                             const EntryMetadata &metadata, int64_t size)
     {
-        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+        int fd = open_file(path);
+        if (fd < 0) {
+            return false;
+        }
 
-        const char *ptr = static_cast<const char *>(data);
-        size_t remain = size;
+        auto close_fd = finally([&] {
+            close(fd);
+        });
 
-        while (remain > 0) {
-            if (auto r = ctx->open_if_needed(FileOpenMode::WriteOnly); !r) {
-                set_archive_error(a, r.error());
-                return -1;
+        const void *buf;
+        size_t n;
+        int64_t offset;
+        int ret;
+
+        while ((ret = archive_read_data_block(in, &buf, &n, &offset))
+                == ARCHIVE_OK) {
+            if (!write_block(fd, path, buf, n, offset)) {
+                return false;
             }
+        }
 
-            auto to_write = static_cast<size_t>(std::min<uint64_t>(
-                    remain,
-                    ctx->is_split()
-                    ? (ctx->max_size - ctx->bytes_written)
-                    : remain));
+        if (ret != ARCHIVE_EOF) {
+            LOGE("%s: Failed to read data: %s",
+                 path.c_str(), archive_error_string(in));
+            return false;
+        }
 
-            auto n = ctx->file.write(ptr, to_write);
-            if (!n) {
-                set_archive_error(a, n.error());
-                return -1;
-            }
+        return finish_file(fd, path, metadata, size);
+    }
 
-            ctx->bytes_written += n.value();
-            ptr += n.value();
-            remain -= n.value();
+    static bool apply_metadata_fd(int fd, const std::string &path,
+                                  const EntryMetadata &metadata)
+    {
+        // The owner must be set first because chown() clears the setuid and
+        // setgid bits and security.capability
+        if (fchown(fd, metadata.uid, metadata.gid) < 0) {
+            LOGE("%s: Failed to set owner: %s", path.c_str(), strerror(errno));
+            return false;
+        }
 
-            if (ctx->is_split() && ctx->bytes_written == ctx->max_size) {
-                ctx->bytes_written = 0;
-                ctx->move_to_next();
+        if (fchmod(fd, metadata.mode) < 0) {
+            LOGE("%s: Failed to set mode: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        for (auto const &[name, value] : metadata.xattrs) {
+            if (fsetxattr(fd, name.c_str(), value.data(), value.size(), 0)
+                    < 0) {
+                LOGE("%s: Failed to set xattr %s: %s",
+                     path.c_str(), name.c_str(), strerror(errno));
+                return false;
             }
         }
 
-        return static_cast<la_ssize_t>(size);
+        if (futimens(fd, metadata.times.data()) < 0) {
+            LOGE("%s: Failed to set timestamps: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        return true;
     }
 
-    int archive_open(archive *a)
+    /*!
+     * \brief Apply metadata to entries that cannot be opened for writing
+     */
+    bool apply_metadata_at(const std::string &path,
+                           const EntryMetadata &metadata, bool is_symlink)
     {
-        return archive_write_open(a, this, nullptr, &la_write_cb, &la_close_cb);
+        if (fchownat(m_root_fd, path.c_str(), metadata.uid, metadata.gid,
+                     AT_SYMLINK_NOFOLLOW) < 0) {
+            LOGE("%s: Failed to set owner: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        // Symlink permissions are ignored on Linux
+        if (!is_symlink && fchmodat(m_root_fd, path.c_str(),
+                                    metadata.mode, 0) < 0) {
+            LOGE("%s: Failed to set mode: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        // There is no *at() variant of lsetxattr()
+        std::string full_path(m_target);
+        full_path += '/';
+        full_path += path;
+
+        for (auto const &[name, value] : metadata.xattrs) {
+            if (lsetxattr(full_path.c_str(), name.c_str(), value.data(),
+                          value.size(), 0) < 0) {
+                LOGE("%s: Failed to set xattr %s: %s",
+                     path.c_str(), name.c_str(), strerror(errno));
+                return false;
+            }
+        }
+
+        if (utimensat(m_root_fd, path.c_str(), metadata.times.data(),
+                      AT_SYMLINK_NOFOLLOW) < 0) {
+            LOGE("%s: Failed to set timestamps: %s",
+                 path.c_str(), strerror(errno));
+            return false;
+        }
+
+        return true;
     }
 };
 
@@ -348,17 +1495,41 @@ struct SplitWriterCtx : SplitCtx
  * warning because an incomplete archive is useless for backups and restores.
  */
 
+/*!
+ * \brief Extract tar archive
+ *
+ * If \p threads is not 1, the archive is decompressed on a separate thread
+ * and the files are written by a ParallelDiskWriter. ACLs, file flags, and
+ * Mac metadata are not restored in this mode, but backups do not contain any.
+ *
+ * \param filename Archive path (base path if split)
+ * \param target Target directory
+ * \param patterns Only extract paths that match these patterns
+ * \param compression Compression type
+ * \param is_split Whether the archive is split into multiple files
+ * \param threads Number of threads for writing files. 0 uses one thread per
+ *                CPU.
+ *
+ * \return Whether the extraction was successful
+ */
 bool libarchive_tar_extract(const std::string &filename,
                             const std::string &target,
                             const std::vector<std::string> &patterns,
                             CompressionType compression,
-                            bool is_split)
+                            bool is_split,
+                            unsigned int threads)
 {
     if (target.empty()) {
         LOGE("%s: Invalid target path for extraction", target.c_str());
         return false;
     }
 
+    bool parallel = threads != 1;
+
+    // When running in parallel, the tar stream is decompressed by a separate
+    // reader. This must outlive the tar reader, which closes it.
+    std::optional<DecompressorPipeline> pipeline;
+
     ScopedArchive matcher(archive_match_new(), archive_match_free);
     if (!matcher) {
         LOGE("%s: Out of memory when creating matcher", __FUNCTION__);
@@ -369,10 +1540,13 @@ bool libarchive_tar_extract(const std::string &filename,
         LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
         return false;
     }
-    ScopedArchive out(archive_write_disk_new(), archive_write_free);
-    if (!out) {
-        LOGE("%s: Out of memory when creating disk writer", __FUNCTION__);
-        return false;
+    ScopedArchive out(nullptr, archive_write_free);
+    if (!parallel) {
+        out.reset(archive_write_disk_new());
+        if (!out) {
+            LOGE("%s: Out of memory when creating disk writer", __FUNCTION__);
+            return false;
+        }
     }
 
     // Set up matcher parameters
@@ -388,29 +1562,39 @@ bool libarchive_tar_extract(const std::string &filename,
     //archive_read_support_format_gnutar(in.get());
     archive_read_support_format_tar(in.get());
 
-    switch (compression) {
-    case CompressionType::None:
-        break;
-    case CompressionType::Lz4:
-        archive_read_support_filter_lz4(in.get());
-        break;
-    case CompressionType::Gzip:
-        archive_read_support_filter_gzip(in.get());
-        break;
-    case CompressionType::Xz:
-        archive_read_support_filter_xz(in.get());
-        break;
-    default:
-        LOGE("Invalid compression type");
+    if (parallel && compression != CompressionType::None) {
+        pipeline.emplace(filename, is_split);
+
+        if (!pipeline->init(compression)) {
+            return false;
+        }
+    } else if (!add_decompression_filter(in.get(), compression)) {
         return false;
     }
 
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(out.get());
-    archive_write_disk_set_options(out.get(), LIBARCHIVE_DISK_WRITER_FLAGS);
+    std::optional<ParallelDiskWriter> writer;
+
+    if (parallel) {
+        writer.emplace(target, threads);
+
+        if (!writer->open()) {
+            return false;
+        }
+    } else {
+        // Set up disk writer parameters
+        archive_write_disk_set_standard_lookup(out.get());
+        archive_write_disk_set_options(out.get(), LIBARCHIVE_DISK_WRITER_FLAGS);
+    }
 
     SplitReaderCtx ctx(filename, is_split);
-    if (ctx.archive_open(in.get()) != ARCHIVE_OK) {
+
+    if (pipeline) {
+        if (pipeline->archive_open(in.get()) != ARCHIVE_OK) {
+            LOGE("%s: Failed to open file: %s",
+                 filename.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+    } else if (ctx.archive_open(in.get()) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
              filename.c_str(), archive_error_string(in.get()));
         return false;
@@ -419,6 +1603,7 @@ bool libarchive_tar_extract(const std::string &filename,
     archive_entry *entry;
     int ret;
     std::string target_path;
+    std::string entry_path;
 
     while (true) {
         ret = archive_read_next_header(in.get(), &entry);
@@ -441,12 +1626,15 @@ bool libarchive_tar_extract(const std::string &filename,
 
         LOGV("%s", path);
 
+        // Setting the pathname invalidates path
+        entry_path = path;
+
         // Build path
         target_path = target;
-        if (target_path.back() != '/' && *path != '/') {
+        if (target_path.back() != '/' && entry_path.front() != '/') {
             target_path += '/';
         }
-        target_path += path;
+        target_path += entry_path;
 
         archive_entry_set_pathname(entry, target_path.c_str());
 
@@ -456,11 +1644,17 @@ bool libarchive_tar_extract(const std::string &filename,
         }
 
         // Extract file
-        ret = archive_read_extract2(in.get(), entry, out.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", archive_entry_pathname(entry),
-                 archive_error_string(in.get()));
-            return false;
+        if (writer) {
+            if (!writer->extract(in.get(), entry, entry_path)) {
+                return false;
+            }
+        } else {
+            ret = archive_read_extract2(in.get(), entry, out.get());
+            if (ret != ARCHIVE_OK) {
+                LOGE("%s: %s", archive_entry_pathname(entry),
+                     archive_error_string(in.get()));
+                return false;
+            }
         }
     }
 
@@ -469,6 +1663,10 @@ bool libarchive_tar_extract(const std::string &filename,
         return false;
     }
 
+    if (writer && !writer->finish()) {
+        return false;
+    }
+
     // Check that all patterns were matched
     const char *pattern;
     while ((ret = archive_match_path_unmatched_inclusions_next(
@@ -483,6 +1681,96 @@ bool libarchive_tar_extract(const std::string &filename,
     return archive_match_path_unmatched_inclusions(matcher.get()) == 0;
 }
 
+/*!
+ * \brief Check that a tar archive can be fully read
+ *
+ * Every header and all of the file data are read (and decompressed) and then
+ * discarded. Nothing is written to disk.
+ *
+ * \param filename Archive path
+ * \param compression Compression type
+ * \param is_split Whether the archive is split into multiple files
+ * \param threads If not 1, the data is decompressed on a separate thread
+ *
+ * \return Whether the archive was successfully read
+ */
+bool libarchive_tar_verify(const std::string &filename,
+                           CompressionType compression,
+                           bool is_split,
+                           unsigned int threads)
+{
+    // Must outlive the tar reader, which closes it
+    std::optional<DecompressorPipeline> pipeline;
+
+    ScopedArchive in(archive_read_new(), archive_read_free);
+    if (!in) {
+        LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
+        return false;
+    }
+
+    archive_read_support_format_tar(in.get());
+
+    if (threads != 1 && compression != CompressionType::None) {
+        pipeline.emplace(filename, is_split);
+
+        if (!pipeline->init(compression)) {
+            return false;
+        }
+    } else if (!add_decompression_filter(in.get(), compression)) {
+        return false;
+    }
+
+    SplitReaderCtx ctx(filename, is_split);
+
+    if ((pipeline ? pipeline->archive_open(in.get())
+            : ctx.archive_open(in.get())) != ARCHIVE_OK) {
+        LOGE("%s: Failed to open file: %s",
+             filename.c_str(), archive_error_string(in.get()));
+        return false;
+    }
+
+    archive_entry *entry;
+    const void *buf;
+    size_t size;
+    la_int64_t offset;
+    uint64_t entries = 0;
+    int ret;
+
+    while (true) {
+        ret = archive_read_next_header(in.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            LOGW("%s: Retrying header read", filename.c_str());
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("%s: Failed to read header: %s",
+                 filename.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+
+        while ((ret = archive_read_data_block(
+                in.get(), &buf, &size, &offset)) == ARCHIVE_OK);
+
+        if (ret != ARCHIVE_EOF) {
+            LOGE("%s: %s: Failed to read data: %s", filename.c_str(),
+                 archive_entry_pathname(entry), archive_error_string(in.get()));
+            return false;
+        }
+
+        ++entries;
+    }
+
+    if (archive_read_close(in.get()) != ARCHIVE_OK) {
+        LOGE("%s: %s", filename.c_str(), archive_error_string(in.get()));
+        return false;
+    }
+
+    LOGV("%s: Read %" PRIu64 " entries", filename.c_str(), entries);
+
+    return true;
+}
+
 static bool write_file(archive *in, archive *out, archive_entry *entry)
 {
     int ret;
@@ -511,12 +1799,104 @@ static int metadata_filter(archive *a, void *data, archive_entry *entry)
     return 1;
 }
 
+/*!
+ * \brief Apply compression level and thread count to the archive's filter
+ */
+static bool add_compression_filter(archive *a, CompressionType compression)
+{
+    switch (compression) {
+    case CompressionType::None:
+        return true;
+    case CompressionType::Lz4:
+        archive_write_add_filter_lz4(a);
+        return true;
+    case CompressionType::Gzip:
+        archive_write_add_filter_gzip(a);
+        return true;
+    case CompressionType::Xz:
+        archive_write_add_filter_xz(a);
+        return true;
+    case CompressionType::Zstd:
+        // Without libzstd, libarchive falls back to an external program
+        if (archive_write_add_filter_zstd(a) != ARCHIVE_OK) {
+            LOGE("zstd is not supported by libarchive: %s",
+                 archive_error_string(a));
+            return false;
+        }
+        return true;
+    default:
+        LOGE("Invalid compression type");
+        return false;
+    }
+}
+
+static bool set_compression_options(archive *a, CompressionType compression,
+                                    const CompressionOptions &options)
+{
+    if (options.level) {
+        auto level = std::to_string(*options.level);
+
+        if (archive_write_set_filter_option(
+                a, nullptr, "compression-level", level.c_str())
+                != ARCHIVE_OK) {
+            LOGE("Invalid compression level: %s: %s",
+                 level.c_str(), archive_error_string(a));
+            return false;
+        }
+    }
+
+    if (options.threads != 1 && (compression == CompressionType::Xz
+            || compression == CompressionType::Zstd)) {
+        unsigned int threads = options.threads;
+        if (threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+
+        auto value = std::to_string(threads);
+
+        // Older libarchive versions do not support multithreaded zstd
+        if (archive_write_set_filter_option(
+                a, nullptr, "threads", value.c_str()) != ARCHIVE_OK) {
+            LOGW("Multithreaded compression not supported: %s",
+                 archive_error_string(a));
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get the ParallelCompressor format to use for a compression type
+ *
+ * \return Format if the compression should be done by ParallelCompressor
+ *         instead of by a libarchive filter
+ */
+static std::optional<ParallelFormat>
+parallel_format(CompressionType compression, const CompressionOptions &options)
+{
+    if (options.threads == 1) {
+        return std::nullopt;
+    }
+
+    switch (compression) {
+    case CompressionType::Gzip:
+        return ParallelFormat::Gzip;
+    case CompressionType::Lz4:
+        return ParallelFormat::Lz4Frame;
+    default:
+        return std::nullopt;
+    }
+}
+
 /*!
  * \brief Create pax archive with all metadata
  *
  * \param filename Target archive path
  * \param base_dir Base directory for \a paths
  * \param paths List of paths to add to the archive
+ * \param compression Compression type
+ * \param split_archive_size Max size for each split file (0 to disable)
+ * \param options Compression level and thread count
  *
  * \return Whether the archive creation was successful
  */
@@ -524,7 +1904,8 @@ bool libarchive_tar_create(const std::string &filename,
                            const std::string &base_dir,
                            const std::vector<std::string> &paths,
                            CompressionType compression,
-                           uint64_t split_archive_size)
+                           uint64_t split_archive_size,
+                           const CompressionOptions &options)
 {
     if (base_dir.empty() && paths.empty()) {
         LOGE("%s: No base directory or paths specified", filename.c_str());
@@ -569,20 +1950,33 @@ bool libarchive_tar_create(const std::string &filename,
     archive_write_set_format_pax_restricted(out.get());
     archive_write_set_bytes_per_block(out.get(), 10240);
 
-    switch (compression) {
-    case CompressionType::None:
-        break;
-    case CompressionType::Lz4:
-        archive_write_add_filter_lz4(out.get());
-        break;
-    case CompressionType::Gzip:
-        archive_write_add_filter_gzip(out.get());
-        break;
-    case CompressionType::Xz:
-        archive_write_add_filter_xz(out.get());
-        break;
-    default:
-        LOGE("Invalid compression type");
+    // Gzip and LZ4 can be compressed in parallel blocks. This already moves
+    // compression off of this thread, so pipelining is not needed.
+    auto block_format = parallel_format(compression, options);
+
+    // When pipelining, the tar stream is compressed by a separate writer
+    ScopedArchive compressor(nullptr, archive_write_free);
+    archive *filtered = out.get();
+
+    if (block_format) {
+        // Nothing to set up
+    } else if (options.pipelined && compression != CompressionType::None) {
+        compressor.reset(archive_write_new());
+        if (!compressor) {
+            LOGE("%s: Out of memory when creating compressor", __FUNCTION__);
+            return false;
+        }
+
+        archive_write_set_format_raw(compressor.get());
+        archive_write_set_bytes_per_block(compressor.get(), 10240);
+        // Padding is applied to the compressed stream only
+        archive_write_set_bytes_in_last_block(out.get(), 1);
+
+        filtered = compressor.get();
+    }
+
+    if (!block_format && (!add_compression_filter(filtered, compression)
+            || !set_compression_options(filtered, compression, options))) {
         return false;
     }
 
@@ -592,12 +1986,51 @@ bool libarchive_tar_create(const std::string &filename,
 
     // Open output file
     SplitWriterCtx ctx(filename, split_archive_size);
-    if (ctx.archive_open(out.get()) != ARCHIVE_OK) {
+    std::optional<ParallelWriterCtx> parallel_ctx;
+
+    if (block_format) {
+        parallel_ctx.emplace(ctx, *block_format, options);
+
+        if (parallel_ctx->archive_open(filtered) != ARCHIVE_OK) {
+            LOGE("%s: Failed to open file: %s",
+                 filename.c_str(), archive_error_string(filtered));
+            return false;
+        }
+    } else if (ctx.archive_open(filtered) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
-             filename.c_str(), archive_error_string(out.get()));
+             filename.c_str(), archive_error_string(filtered));
         return false;
     }
 
+    // If the archive is not completed, the tar writer must not try to flush
+    // into the compressor after it has been destroyed
+    auto stop_compressor = finally([&] {
+        if (parallel_ctx) {
+            archive_write_fail(out.get());
+        }
+    });
+
+    std::optional<CompressorPipeline> pipeline;
+
+    if (compressor) {
+        pipeline.emplace(compressor.get(), filename);
+
+        if (pipeline->archive_open(out.get()) != ARCHIVE_OK) {
+            LOGE("%s: Failed to open compressor pipeline: %s",
+                 filename.c_str(), archive_error_string(out.get()));
+            return false;
+        }
+    }
+
+    // If the archive is not completed, the tar writer must not try to flush
+    // into the pipeline after it has been destroyed
+    auto stop_pipeline = finally([&] {
+        if (pipeline) {
+            archive_write_fail(out.get());
+            (void) pipeline->join();
+        }
+    });
+
     archive_entry *entry = nullptr;
     archive_entry *sparse_entry = nullptr;
     int ret;
@@ -748,7 +2181,8 @@ bool libarchive_tar_create(const std::string &filename,
     return true;
 }
 
-static bool set_up_input(archive *in, const std::string &filename)
+static bool set_up_input(archive *in, const std::string &filename,
+                         ArchiveInputFile &file)
 {
     // Add more as needed
     //archive_read_support_format_all(in);
@@ -757,7 +2191,13 @@ static bool set_up_input(archive *in, const std::string &filename)
     archive_read_support_format_zip(in);
     //archive_read_support_filter_xz(in);
 
-    if (archive_read_open_filename(in, filename.c_str(), 10240) != ARCHIVE_OK) {
+    if (auto r = file.open(filename); !r) {
+        LOGE("%s: Failed to open file: %s",
+             filename.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (file.open_archive(in) != ARCHIVE_OK) {
         LOGE("%s: Failed to open archive: %s",
              filename.c_str(), archive_error_string(in));
         return false;
@@ -781,6 +2221,7 @@ static void set_up_output(archive *out)
 
 bool extract_archive(const std::string &filename, const std::string &target)
 {
+    ArchiveInputFile file;
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
 
@@ -799,7 +2240,7 @@ bool extract_archive(const std::string &filename, const std::string &target)
         return false;
     }
 
-    if (!set_up_input(in.get(), filename)) {
+    if (!set_up_input(in.get(), filename, file)) {
         return false;
     }
 
@@ -843,6 +2284,7 @@ bool extract_files(const std::string &filename, const std::string &target,
         return false;
     }
 
+    ArchiveInputFile file;
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
 
@@ -862,7 +2304,7 @@ bool extract_files(const std::string &filename, const std::string &target,
         return false;
     }
 
-    if (!set_up_input(in.get(), filename)) {
+    if (!set_up_input(in.get(), filename, file)) {
         return false;
     }
 
@@ -916,6 +2358,7 @@ bool extract_files2(const std::string &filename,
         return false;
     }
 
+    ArchiveInputFile file;
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
 
@@ -928,7 +2371,7 @@ bool extract_files2(const std::string &filename,
     int ret;
     unsigned int count = 0;
 
-    if (!set_up_input(in.get(), filename)) {
+    if (!set_up_input(in.get(), filename, file)) {
         return false;
     }
 
@@ -971,6 +2414,7 @@ bool archive_exists(const std::string &filename,
         return false;
     }
 
+    ArchiveInputFile file;
     ScopedArchive in(archive_read_new(), archive_read_free);
 
     if (!in) {
@@ -985,7 +2429,7 @@ bool archive_exists(const std::string &filename,
         info.exists = false;
     }
 
-    if (!set_up_input(in.get(), filename)) {
+    if (!set_up_input(in.get(), filename, file)) {
         return false;
     }
 
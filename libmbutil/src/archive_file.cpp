@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/archive_file.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+
+namespace mb::util
+{
+
+static void set_archive_error(archive *a, std::error_code ec)
+{
+    archive_set_error(a, ec.value(), "%s", ec.message().c_str());
+}
+
+ArchiveFileReader::ArchiveFileReader(File &file, size_t block_size)
+    : m_file(file)
+    , m_mmap(nullptr)
+    , m_block_size(block_size)
+    , m_pos(0)
+{
+}
+
+ArchiveFileReader::ArchiveFileReader(MmapFile &file, size_t block_size)
+    : m_file(file)
+    , m_mmap(&file)
+    , m_block_size(block_size)
+    , m_pos(0)
+{
+}
+
+/*!
+ * \brief Open archive for reading with the callbacks
+ *
+ * \param a Archive reader with its formats and filters already enabled
+ *
+ * \return Return value of archive_read_open1()
+ */
+int ArchiveFileReader::open(archive *a)
+{
+    if (m_mmap) {
+        auto pos = m_mmap->seek(0, SEEK_CUR);
+        if (!pos) {
+            set_archive_error(a, pos.error());
+            return ARCHIVE_FATAL;
+        }
+
+        m_pos = pos.value();
+    } else {
+        m_buf.resize(m_block_size);
+    }
+
+    archive_read_set_callback_data(a, this);
+    archive_read_set_read_callback(a, &la_read_cb);
+    archive_read_set_skip_callback(a, &la_skip_cb);
+    archive_read_set_seek_callback(a, &la_seek_cb);
+
+    return archive_read_open1(a);
+}
+
+la_ssize_t ArchiveFileReader::la_read_cb(archive *a, void *userdata,
+                                         const void **buffer)
+{
+    auto *ctx = static_cast<ArchiveFileReader *>(userdata);
+
+    if (ctx->m_mmap) {
+        auto view = ctx->m_mmap->view(ctx->m_pos, ctx->m_block_size);
+        if (!view) {
+            set_archive_error(a, view.error());
+            return -1;
+        }
+
+        ctx->m_pos += view.value().size;
+
+        *buffer = view.value().data;
+        return static_cast<la_ssize_t>(view.value().size);
+    }
+
+    auto n = file_read_retry(ctx->m_file, ctx->m_buf.data(),
+                             ctx->m_buf.size());
+    if (!n) {
+        set_archive_error(a, n.error());
+        return -1;
+    }
+
+    *buffer = ctx->m_buf.data();
+    return static_cast<la_ssize_t>(n.value());
+}
+
+la_int64_t ArchiveFileReader::la_skip_cb(archive *a, void *userdata,
+                                         la_int64_t request)
+{
+    (void) a;
+
+    auto *ctx = static_cast<ArchiveFileReader *>(userdata);
+
+    if (ctx->m_mmap) {
+        auto size = ctx->m_mmap->size();
+        auto remain = ctx->m_pos < size ? size - ctx->m_pos : 0;
+        auto n = std::min<uint64_t>(static_cast<uint64_t>(request), remain);
+
+        ctx->m_pos += n;
+
+        return static_cast<la_int64_t>(n);
+    }
+
+    // If the file can't seek, libarchive will read and discard the data
+    if (!ctx->m_file.seek(request, SEEK_CUR)) {
+        return 0;
+    }
+
+    return request;
+}
+
+la_int64_t ArchiveFileReader::la_seek_cb(archive *a, void *userdata,
+                                         la_int64_t offset, int whence)
+{
+    auto *ctx = static_cast<ArchiveFileReader *>(userdata);
+
+    if (ctx->m_mmap) {
+        int64_t base;
+
+        switch (whence) {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = static_cast<int64_t>(ctx->m_pos);
+            break;
+        case SEEK_END:
+            base = static_cast<int64_t>(ctx->m_mmap->size());
+            break;
+        default:
+            archive_set_error(a, EINVAL, "Invalid whence: %d", whence);
+            return ARCHIVE_FATAL;
+        }
+
+        if ((offset < 0 && base < -offset)
+                || (offset > 0 && base > INT64_MAX - offset)) {
+            archive_set_error(a, EINVAL, "Invalid seek offset");
+            return ARCHIVE_FATAL;
+        }
+
+        ctx->m_pos = static_cast<uint64_t>(base + offset);
+
+        return static_cast<la_int64_t>(ctx->m_pos);
+    }
+
+    auto pos = ctx->m_file.seek(offset, whence);
+    if (!pos) {
+        set_archive_error(a, pos.error());
+        return ARCHIVE_FATAL;
+    }
+
+    return static_cast<la_int64_t>(pos.value());
+}
+
+ArchiveFileWriter::ArchiveFileWriter(File &file)
+    : m_file(file)
+{
+}
+
+/*!
+ * \brief Open archive for writing with the callbacks
+ *
+ * \param a Archive writer with its format and filters already set
+ *
+ * \return Return value of archive_write_open()
+ */
+int ArchiveFileWriter::open(archive *a)
+{
+    return archive_write_open(a, this, nullptr, &la_write_cb, nullptr);
+}
+
+la_ssize_t ArchiveFileWriter::la_write_cb(archive *a, void *userdata,
+                                          const void *buffer, size_t length)
+{
+    auto *ctx = static_cast<ArchiveFileWriter *>(userdata);
+
+    if (auto r = file_write_exact(ctx->m_file, buffer, length); !r) {
+        set_archive_error(a, r.error());
+        return -1;
+    }
+
+    return static_cast<la_ssize_t>(length);
+}
+
+ArchiveInputFile::ArchiveInputFile() = default;
+
+/*!
+ * \brief Open file for reading
+ *
+ * \param path Path to file
+ * \param block_size Block size when the file cannot be mapped
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> ArchiveInputFile::open(const std::string &path,
+                                        size_t block_size)
+{
+    m_reader.reset();
+    (void) m_mmap.close();
+    (void) m_fd.close();
+
+    if (m_mmap.open(path)) {
+        m_reader.emplace(m_mmap, block_size);
+    } else {
+        OUTCOME_TRYV(m_fd.open(path, FileOpenMode::ReadOnly));
+        m_reader.emplace(m_fd, block_size);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Open archive for reading from the file
+ *
+ * \pre ArchiveInputFile::open() must have succeeded.
+ *
+ * \return Return value of ArchiveFileReader::open()
+ */
+int ArchiveInputFile::open_archive(archive *a)
+{
+    return m_reader->open(a);
+}
+
+}
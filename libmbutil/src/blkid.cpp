@@ -19,16 +19,23 @@
 
 #include "mbutil/blkid.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <vector>
 
 #include <cerrno>
+#include <cinttypes>
+#include <cstdio>
 #include <cstring>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
+#include "mbutil/file.h"
 
 // NOTE: We don't use libblkid from util-linux because we don't need most of its
 // features and it increases mbtool's binary size more than 200KiB (armeabi-v7a)
@@ -36,6 +43,11 @@
 namespace mb::util
 {
 
+// Large enough for all of the magic offsets below (btrfs is the furthest in)
+static constexpr size_t PROBE_SIZE = 68 * 1024;
+
+static constexpr char UEVENT_SEQNUM_PATH[] = "/sys/kernel/uevent_seqnum";
+
 static inline bool check_magic(const void *data, size_t data_size,
                                const void *magic, size_t magic_size,
                                size_t offset)
@@ -131,10 +143,9 @@ static oc::result<size_t> read_all(int fd, void *buf, size_t size)
     return total;
 }
 
-oc::result<std::string> blkid_get_fs_type(const std::string &path)
+static oc::result<std::string> probe_fs_type(const std::string &path,
+                                             unsigned char *buf)
 {
-    std::vector<unsigned char> buf(1024 * 1024);
-
     int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd < 0) {
         return ec_from_errno();
@@ -144,10 +155,10 @@ oc::result<std::string> blkid_get_fs_type(const std::string &path)
         close(fd);
     });
 
-    OUTCOME_TRY(n, read_all(fd, buf.data(), buf.size()));
+    OUTCOME_TRY(n, read_all(fd, buf, PROBE_SIZE));
 
     for (auto const &pf : g_probe_funcs) {
-        if (pf.func(buf.data(), n)) {
+        if (pf.func(buf, n)) {
             return pf.name;
         }
     }
@@ -155,4 +166,162 @@ oc::result<std::string> blkid_get_fs_type(const std::string &path)
     return "";
 }
 
+oc::result<std::string> blkid_get_fs_type(const std::string &path)
+{
+    std::vector<unsigned char> buf(PROBE_SIZE);
+
+    return probe_fs_type(path, buf.data());
+}
+
+/*!
+ * \brief Detect filesystem types of multiple devices concurrently
+ *
+ * The devices are probed by up to `std::thread::hardware_concurrency()` worker
+ * threads, so that slow devices (eg. SD cards) don't block each other.
+ *
+ * \param paths Paths to block devices or images
+ *
+ * \return Results of blkid_get_fs_type(), in the same order as \p paths
+ */
+std::vector<oc::result<std::string>>
+blkid_get_fs_types(const std::vector<std::string> &paths)
+{
+    std::vector<std::string> types(paths.size());
+    std::vector<std::error_code> errors(paths.size());
+    std::atomic<size_t> next{0};
+
+    auto worker = [&] {
+        std::vector<unsigned char> buf(PROBE_SIZE);
+
+        for (size_t i; (i = next++) < paths.size();) {
+            if (auto r = probe_fs_type(paths[i], buf.data())) {
+                types[i] = std::move(r.value());
+            } else {
+                errors[i] = r.error();
+            }
+        }
+    };
+
+    size_t threads = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), paths.size());
+
+    if (threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(worker);
+        }
+        for (auto &t : workers) {
+            t.join();
+        }
+    }
+
+    std::vector<oc::result<std::string>> results;
+    results.reserve(paths.size());
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (errors[i]) {
+            results.emplace_back(errors[i]);
+        } else {
+            results.emplace_back(std::move(types[i]));
+        }
+    }
+
+    return results;
+}
+
+static std::optional<uint64_t> get_uevent_seqnum()
+{
+    auto contents = file_read_all(UEVENT_SEQNUM_PATH);
+    if (!contents) {
+        return std::nullopt;
+    }
+
+    uint64_t seqnum;
+    if (sscanf(contents.value().c_str(), "%" SCNu64, &seqnum) != 1) {
+        return std::nullopt;
+    }
+
+    return seqnum;
+}
+
+/*!
+ * \class BlkidCache
+ *
+ * \brief Cache of filesystem types keyed by block device number
+ *
+ * The cache is invalidated whenever the kernel's uevent sequence number
+ * changes, ie. when a device is added, removed, or changed. If the sequence
+ * number is unavailable, nothing is cached. Paths that are not block devices
+ * are always probed.
+ */
+
+/*!
+ * \brief Get filesystem types of multiple devices
+ *
+ * Devices that are not in the cache are probed with blkid_get_fs_types().
+ *
+ * \param paths Paths to block devices or images
+ *
+ * \return Filesystem types, in the same order as \p paths
+ */
+std::vector<oc::result<std::string>>
+BlkidCache::get_fs_types(const std::vector<std::string> &paths)
+{
+    auto seqnum = get_uevent_seqnum();
+    if (!seqnum || seqnum != _seqnum) {
+        _types.clear();
+    }
+    _seqnum = seqnum;
+
+    std::vector<std::optional<dev_t>> devs(paths.size());
+    std::vector<std::string> to_probe;
+    std::vector<size_t> probe_indexes;
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        struct stat sb;
+
+        if (seqnum && stat(paths[i].c_str(), &sb) == 0
+                && S_ISBLK(sb.st_mode)) {
+            devs[i] = sb.st_rdev;
+
+            if (_types.find(sb.st_rdev) != _types.end()) {
+                continue;
+            }
+        }
+
+        to_probe.push_back(paths[i]);
+        probe_indexes.push_back(i);
+    }
+
+    auto probed = blkid_get_fs_types(to_probe);
+    std::vector<std::optional<oc::result<std::string>>> uncached(paths.size());
+
+    for (size_t i = 0; i < probed.size(); ++i) {
+        size_t index = probe_indexes[i];
+
+        if (probed[i] && devs[index]) {
+            _types[*devs[index]] = probed[i].value();
+        }
+
+        uncached[index] = std::move(probed[i]);
+    }
+
+    std::vector<oc::result<std::string>> results;
+    results.reserve(paths.size());
+
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (uncached[i]) {
+            results.push_back(std::move(*uncached[i]));
+        } else {
+            results.emplace_back(_types[*devs[i]]);
+        }
+    }
+
+    return results;
+}
+
 }
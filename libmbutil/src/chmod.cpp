@@ -26,18 +26,19 @@
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/string.h"
-#include "mbutil/fts.h"
+#include "mbutil/dir_walker.h"
 
 
 namespace mb::util
 {
 
-class RecursiveChmod : public FtsWrapper {
+class RecursiveChmod : public DirWalker {
 public:
     std::error_code ec;
 
     RecursiveChmod(std::string path, mode_t perms)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+        : DirWalker(std::move(path), DirWalkerFlag::GroupSpecialFiles
+                                   | DirWalkerFlag::SkipStat)
         , _perms(perms)
     {
     }
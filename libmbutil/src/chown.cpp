@@ -28,7 +28,7 @@
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
-#include "mbutil/fts.h"
+#include "mbutil/dir_walker.h"
 
 
 namespace mb::util
@@ -54,13 +54,14 @@ static oc::result<void> chown_internal(const std::string &path,
     return oc::success();
 }
 
-class RecursiveChown : public FtsWrapper {
+class RecursiveChown : public DirWalker {
 public:
     std::error_code ec;
 
     RecursiveChown(std::string path, uid_t uid, gid_t gid,
                    bool follow_symlinks)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+        : DirWalker(std::move(path), DirWalkerFlag::GroupSpecialFiles
+                                   | DirWalkerFlag::SkipStat)
         , _uid(uid)
         , _gid(gid)
         , _follow_symlinks(follow_symlinks)
@@ -28,6 +28,8 @@
 
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -94,6 +96,11 @@ struct CommandCtxPriv
     std::array<int, 2> stderr_pipe;
 };
 
+CommandCtx::CommandCtx() = default;
+
+// Defined here since CommandCtxPriv is incomplete in the header
+CommandCtx::~CommandCtx() = default;
+
 static void initialize_priv(CommandCtxPriv &priv)
 {
     priv.pid = -1;
@@ -103,8 +110,83 @@ static void initialize_priv(CommandCtxPriv &priv)
     priv.stderr_pipe[1] = -1;
 }
 
+enum class ChildStage : int
+{
+    Chdir,
+    Chroot,
+    RedirectStdout,
+    RedirectStderr,
+    Exec,
+};
+
+struct ChildError
+{
+    ChildStage stage;
+    int error;
+};
+
+/*!
+ * \brief Report error from the vfork()'d child to the parent
+ *
+ * The child shares the parent's memory, so it must not log or allocate. The
+ * failure is sent over a close-on-exec pipe and logged by the parent instead.
+ */
+[[noreturn]] static void child_fail(int error_fd, ChildStage stage)
+{
+    ChildError error{stage, errno};
+    (void) !write(error_fd, &error, sizeof(error));
+    _exit(127);
+}
+
+static void log_child_error(const CommandCtx &ctx, const ChildError &error)
+{
+    const char *msg = strerror(error.error);
+
+    switch (error.stage) {
+    case ChildStage::Chdir:
+        LOGE("%s: Failed to chdir: %s", ctx.chroot_dir.c_str(), msg);
+        break;
+    case ChildStage::Chroot:
+        LOGE("%s: Failed to chroot: %s", ctx.chroot_dir.c_str(), msg);
+        break;
+    case ChildStage::RedirectStdout:
+        LOGE("Failed to redirect stdout: %s", msg);
+        break;
+    case ChildStage::RedirectStderr:
+        LOGE("Failed to redirect stderr: %s", msg);
+        break;
+    case ChildStage::Exec:
+        LOGE("%s: Failed to exec: %s", ctx.path.c_str(), msg);
+        break;
+    }
+}
+
+/*!
+ * \brief Start command
+ *
+ * The child is created with `vfork()`, so the parent's page tables are never
+ * copied. Everything the child needs is prepared beforehand and the child only
+ * makes async-signal-safe calls before `exec()`. Errors in the child are
+ * reported back to the parent and logged from there.
+ *
+ * \note If the command cannot be executed, this function still returns true
+ *       and command_wait() will return an exit status of 127.
+ *
+ * \param ctx Command context
+ *
+ * \return Whether the process was successfully created
+ */
 bool command_start(CommandCtx &ctx)
 {
+    std::vector<const char *> c_argv;
+    std::vector<const char *> c_envp;
+    std::array<int, 2> error_pipe{-1, -1};
+    sigset_t all_signals;
+    sigset_t old_signals;
+    ChildError child_error;
+    ssize_t n;
+    int saved_errno;
+
     if (ctx._priv || ctx.path.empty()
             || ctx.argv.empty() || ctx.argv[0].empty()) {
         errno = EINVAL;
@@ -131,67 +213,69 @@ bool command_start(CommandCtx &ctx)
             goto error;
         }
 
-        // Make read ends non-blocking
+        // Make read ends non-blocking. The child must not inherit them.
         if (fcntl(ctx._priv->stdout_pipe[0], F_SETFL, O_NONBLOCK) < 0
-                || fcntl(ctx._priv->stderr_pipe[0], F_SETFL, O_NONBLOCK) < 0) {
+                || fcntl(ctx._priv->stderr_pipe[0], F_SETFL, O_NONBLOCK) < 0
+                || fcntl(ctx._priv->stdout_pipe[0], F_SETFD, FD_CLOEXEC) < 0
+                || fcntl(ctx._priv->stderr_pipe[0], F_SETFD, FD_CLOEXEC) < 0) {
             goto error;
         }
     }
 
-    ctx._priv->pid = fork();
-    if (ctx._priv->pid < 0) {
-        LOGE("Failed to fork: %s", strerror(errno));
+    if (pipe2(error_pipe.data(), O_CLOEXEC) < 0) {
+        error_pipe = {-1, -1};
         goto error;
-    } else if (ctx._priv->pid == 0) {
-        std::vector<const char *> c_argv;
-        for (auto const &arg : ctx.argv) {
-            c_argv.push_back(arg.c_str());
-        }
-        c_argv.push_back(nullptr);
+    }
 
-        std::vector<const char *> c_envp;
-        if (ctx.envp) {
-            for (auto const &env : *ctx.envp) {
-                c_envp.push_back(env.c_str());
-            }
-            c_envp.push_back(nullptr);
-        }
+    // The child cannot allocate memory, so build the arrays here
+    for (auto const &arg : ctx.argv) {
+        c_argv.push_back(arg.c_str());
+    }
+    c_argv.push_back(nullptr);
 
-        // Close read end of the pipes
-        if (ctx.redirect_stdio) {
-            safely_close(ctx._priv->stdout_pipe[0]);
-            safely_close(ctx._priv->stderr_pipe[0]);
+    if (ctx.envp) {
+        for (auto const &env : *ctx.envp) {
+            c_envp.push_back(env.c_str());
         }
+        c_envp.push_back(nullptr);
+    }
+
+    // Block signals so that the parent's handlers never run in the child
+    // while it shares the parent's memory. exec() resets caught signals to
+    // their defaults.
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+    ctx._priv->pid = vfork();
+    if (ctx._priv->pid == 0) {
+        // Only plain syscalls are allowed here. In particular, the fd
+        // variables must not be modified since they belong to the parent.
 
         // Chroot if needed
         if (!ctx.chroot_dir.empty()) {
             if (chdir(ctx.chroot_dir.c_str()) < 0) {
-                LOGE("%s: Failed to chdir: %s",
-                     ctx.chroot_dir.c_str(), strerror(errno));
-                goto child_error;
+                child_fail(error_pipe[1], ChildStage::Chdir);
             }
             if (chroot(ctx.chroot_dir.c_str()) < 0) {
-                LOGE("%s: Failed to chroot: %s",
-                     ctx.chroot_dir.c_str(), strerror(errno));
-                goto child_error;
+                child_fail(error_pipe[1], ChildStage::Chroot);
             }
         }
 
         // Reassign stdout/stderr fds
         if (ctx.redirect_stdio) {
             if (dup2(ctx._priv->stdout_pipe[1], STDOUT_FILENO) < 0) {
-                LOGE("Failed to redirect stdout: %s", strerror(errno));
-                goto child_error;
+                child_fail(error_pipe[1], ChildStage::RedirectStdout);
             }
             if (dup2(ctx._priv->stderr_pipe[1], STDERR_FILENO) < 0) {
-                LOGE("Failed to redirect stderr: %s", strerror(errno));
-                goto child_error;
+                child_fail(error_pipe[1], ChildStage::RedirectStderr);
             }
 
-            safely_close(ctx._priv->stdout_pipe[1]);
-            safely_close(ctx._priv->stderr_pipe[1]);
+            close(ctx._priv->stdout_pipe[1]);
+            close(ctx._priv->stderr_pipe[1]);
         }
 
+        pthread_sigmask(SIG_SETMASK, &old_signals, nullptr);
+
         if (ctx.envp) {
             execvpe(ctx.path.c_str(),
                     const_cast<char * const *>(c_argv.data()),
@@ -201,28 +285,43 @@ bool command_start(CommandCtx &ctx)
                    const_cast<char * const *>(c_argv.data()));
         }
 
-        LOGE("%s: Failed to exec: %s", ctx.path.c_str(), strerror(errno));
+        child_fail(error_pipe[1], ChildStage::Exec);
+    }
 
-    child_error:
-        if (ctx.redirect_stdio) {
-            safely_close(ctx._priv->stdout_pipe[0]);
-            safely_close(ctx._priv->stdout_pipe[1]);
-            safely_close(ctx._priv->stderr_pipe[0]);
-            safely_close(ctx._priv->stderr_pipe[1]);
-        }
+    saved_errno = errno;
+    pthread_sigmask(SIG_SETMASK, &old_signals, nullptr);
 
-        _exit(127);
-    } else {
-        // Close write ends of the pipes
-        if (ctx.redirect_stdio) {
-            safely_close(ctx._priv->stdout_pipe[1]);
-            safely_close(ctx._priv->stderr_pipe[1]);
-        }
+    if (ctx._priv->pid < 0) {
+        LOGE("Failed to vfork: %s", strerror(saved_errno));
+        errno = saved_errno;
+        goto error;
+    }
+
+    // Close write ends of the pipes
+    if (ctx.redirect_stdio) {
+        safely_close(ctx._priv->stdout_pipe[1]);
+        safely_close(ctx._priv->stderr_pipe[1]);
+    }
+
+    // The child has already exec'd or exited by the time vfork() returns, so
+    // this never blocks
+    safely_close(error_pipe[1]);
+
+    do {
+        n = read(error_pipe[0], &child_error, sizeof(child_error));
+    } while (n < 0 && errno == EINTR);
+
+    if (n == sizeof(child_error)) {
+        log_child_error(ctx, child_error);
     }
 
+    safely_close(error_pipe[0]);
+
     return true;
 
 error:
+    safely_close(error_pipe[0]);
+    safely_close(error_pipe[1]);
     if (ctx._priv && ctx.redirect_stdio) {
         safely_close(ctx._priv->stdout_pipe[0]);
         safely_close(ctx._priv->stdout_pipe[1]);
@@ -264,6 +363,12 @@ int command_wait(CommandCtx &ctx)
 }
 
 bool command_raw_reader(CommandCtx &ctx, const CmdRawCb &cb)
+{
+    return command_raw_reader(ctx, cb, -1, {});
+}
+
+bool command_raw_reader(CommandCtx &ctx, const CmdRawCb &cb,
+                        int timeout_ms, const CmdTimeoutCb &timeout_cb)
 {
     bool ret = true;
     char buf[8192];
@@ -287,7 +392,11 @@ bool command_raw_reader(CommandCtx &ctx, const CmdRawCb &cb)
             break;
         }
 
-        if (poll(fds.data(), fds.size(), -1) <= 0) {
+        int n_ready = poll(fds.data(), fds.size(), timeout_ms);
+        if (n_ready == 0 && timeout_cb) {
+            timeout_cb();
+        }
+        if (n_ready <= 0) {
             continue;
         }
 
@@ -388,12 +497,18 @@ static void command_line_reader_cb(CommandLineReaderCtx &ctx,
 }
 
 bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb)
+{
+    return command_line_reader(ctx, cb, -1, {});
+}
+
+bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb,
+                         int timeout_ms, const CmdTimeoutCb &timeout_cb)
 {
     CommandLineReaderCtx reader_ctx;
 
     return command_raw_reader(ctx, [&](std::string_view data, bool error) {
         command_line_reader_cb(reader_ctx, data, error, cb);
-    });
+    }, timeout_ms, timeout_cb);
 }
 
 int run_command(const std::string &path,
@@ -0,0 +1,740 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/compress.h"
+
+#include <algorithm>
+
+#include <lz4.h>
+#include <lz4hc.h>
+#include <zlib.h>
+
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbutil/compress"
+
+namespace mb::util
+{
+
+// Amount of uncompressed data deflated by each gzip worker at a time
+static constexpr size_t GZIP_BLOCK_SIZE = 128 * 1024;
+// Size of the deflate window, which is also the maximum dictionary size
+static constexpr size_t GZIP_DICT_SIZE = 32 * 1024;
+// Maximum block size advertised in the LZ4 frame header (4 MiB)
+static constexpr size_t LZ4_FRAME_BLOCK_SIZE = 4 * 1024 * 1024;
+// Fixed block size of the LZ4 legacy format, which is what `lz4 -l` and the
+// kernel's decompressor use
+static constexpr size_t LZ4_LEGACY_BLOCK_SIZE = 8 * 1024 * 1024;
+// Set in the size of an LZ4 frame block that is stored uncompressed
+static constexpr uint32_t LZ4_UNCOMPRESSED_FLAG = 0x80000000u;
+
+// Header: magic, deflate, no flags, no mtime, no extra flags, Unix
+static constexpr std::string_view GZIP_HEADER{
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x00\x03", 10
+};
+// Header: magic, version 1 with independent blocks and no checksums, 4 MiB
+// maximum block size, and the header checksum for those two bytes
+static constexpr std::string_view LZ4_FRAME_HEADER{
+    "\x04\x22\x4d\x18\x60\x70\x73", 7
+};
+// Header: magic
+static constexpr std::string_view LZ4_LEGACY_HEADER{
+    "\x02\x21\x4c\x18", 4
+};
+
+static void append_le32(std::string &buf, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        buf += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+/*!
+ * \brief Deflate one block of a gzip stream
+ *
+ * \param dict Up to 32 KiB of input preceding \p input
+ * \param input Block to compress
+ * \param last Whether this is the last block of the stream
+ * \param level zlib compression level
+ * \param output Raw deflate output
+ */
+static bool gzip_deflate_block(std::string_view dict, std::string_view input,
+                               bool last, int level, std::string &output)
+{
+    z_stream zs = {};
+
+    if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        LOGE("Failed to initialize deflate stream");
+        return false;
+    }
+
+    auto end_stream = finally([&] {
+        deflateEnd(&zs);
+    });
+
+    if (!dict.empty() && deflateSetDictionary(
+            &zs, reinterpret_cast<const Bytef *>(dict.data()),
+            static_cast<uInt>(dict.size())) != Z_OK) {
+        LOGE("Failed to set deflate dictionary");
+        return false;
+    }
+
+    // Every block except the last is flushed to a byte boundary without
+    // marking the end of the deflate stream
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    int ret;
+
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+    zs.avail_in = static_cast<uInt>(input.size());
+
+    output.clear();
+
+    do {
+        size_t used = output.size();
+        size_t avail = deflateBound(&zs, static_cast<uLong>(input.size())) + 16;
+
+        output.resize(used + avail);
+        zs.next_out = reinterpret_cast<Bytef *>(output.data() + used);
+        zs.avail_out = static_cast<uInt>(avail);
+
+        ret = deflate(&zs, flush);
+        if (ret == Z_STREAM_ERROR) {
+            LOGE("Failed to deflate data");
+            return false;
+        }
+
+        output.resize(used + avail - zs.avail_out);
+    } while (zs.avail_out == 0);
+
+    if (zs.avail_in != 0 || (last && ret != Z_STREAM_END)) {
+        LOGE("Failed to deflate all data");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compress one independent LZ4 block
+ *
+ * \param input Block to compress
+ * \param level Use LZ4HC with this level if set. Otherwise, use the fast
+ *              compressor.
+ * \param output Block size (LE32) followed by the compressed data
+ * \param allow_uncompressed Store the block uncompressed if it does not
+ *                           shrink (only supported by the frame format)
+ */
+static bool lz4_compress_block(std::string_view input, std::optional<int> level,
+                               std::string &output, bool allow_uncompressed)
+{
+    auto src_size = static_cast<int>(input.size());
+    int bound = LZ4_compressBound(src_size);
+
+    output.resize(4 + static_cast<size_t>(bound));
+
+    int n = level
+            ? LZ4_compress_HC(input.data(), output.data() + 4, src_size, bound,
+                              *level)
+            : LZ4_compress_default(input.data(), output.data() + 4, src_size,
+                                   bound);
+    if (n <= 0) {
+        LOGE("Failed to compress LZ4 block");
+        return false;
+    }
+
+    output.resize(4 + static_cast<size_t>(n));
+
+    if (allow_uncompressed && static_cast<size_t>(n) >= input.size()) {
+        output.clear();
+        append_le32(output, static_cast<uint32_t>(input.size())
+                | LZ4_UNCOMPRESSED_FLAG);
+        output += input;
+    } else {
+        for (int i = 0; i < 4; ++i) {
+            output[static_cast<size_t>(i)] = static_cast<char>(
+                    (static_cast<uint32_t>(n) >> (8 * i)) & 0xff);
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \class ParallelCompressor
+ *
+ * \brief Streaming compressor that compresses blocks on multiple threads
+ *
+ * The input is split into blocks that are compressed concurrently by a pool of
+ * worker threads and the results are written in order, so the output is a
+ * regular stream that the standard tools (and for the LZ4 legacy format, the
+ * kernel) can decompress.
+ *
+ * * Gzip: each block uses the preceding 32 KiB of input as its dictionary
+ *   and all but the last are flushed to a byte boundary, so the compressed
+ *   blocks concatenate into a single deflate stream (the same approach as
+ *   pigz).
+ * * LZ4: the frame and legacy formats both support independently compressed
+ *   blocks, which are 4 MiB and 8 MiB respectively.
+ *
+ * Compressed blocks are passed to the write callback on the thread that calls
+ * write() and finish(). The number of blocks in flight is bounded, so write()
+ * blocks when the workers fall behind.
+ */
+
+/*!
+ * \brief Construct a compressor and start the worker threads
+ *
+ * \param format Output format
+ * \param write_fn Function to call with each chunk of output
+ * \param threads Number of worker threads. 0 uses one thread per CPU.
+ * \param level Compression level. The zlib default is used for gzip if unset.
+ *              For LZ4, a level enables the LZ4HC compressor. The legacy
+ *              format defaults to LZ4HC's default level to match images
+ *              produced by `lz4 -l -9`, and the frame format defaults to the
+ *              fast compressor.
+ */
+ParallelCompressor::ParallelCompressor(ParallelFormat format, WriteFn write_fn,
+                                       unsigned int threads,
+                                       std::optional<int> level)
+    : m_format(format)
+    , m_write_fn(std::move(write_fn))
+    , m_level(level)
+    , m_stop(false)
+    , m_wrote_header(false)
+    , m_finished(false)
+    , m_crc(static_cast<uint32_t>(crc32(0L, Z_NULL, 0)))
+    , m_size(0)
+{
+    switch (format) {
+    case ParallelFormat::Gzip:
+        m_block_size = GZIP_BLOCK_SIZE;
+        break;
+    case ParallelFormat::Lz4Frame:
+        m_block_size = LZ4_FRAME_BLOCK_SIZE;
+        break;
+    case ParallelFormat::Lz4Legacy:
+        m_block_size = LZ4_LEGACY_BLOCK_SIZE;
+        if (!m_level) {
+            m_level = LZ4HC_CLEVEL_DEFAULT;
+        }
+        break;
+    default:
+        MB_UNREACHABLE("Invalid format: %d", static_cast<int>(format));
+    }
+
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    m_max_jobs = threads * 2;
+
+    for (unsigned int i = 0; i < threads; ++i) {
+        m_threads.emplace_back(&ParallelCompressor::worker, this);
+    }
+}
+
+/*!
+ * \brief Stop the worker threads
+ *
+ * If finish() was not called, any pending output is discarded.
+ */
+ParallelCompressor::~ParallelCompressor()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+/*!
+ * \brief Compress data
+ *
+ * \return Whether the data was queued and all compressed blocks that were
+ *         ready were written successfully
+ */
+bool ParallelCompressor::write(const void *data, size_t size)
+{
+    if (m_finished) {
+        LOGE("Compressed stream is already finished");
+        return false;
+    }
+
+    if (!m_wrote_header) {
+        if (!write_header()) {
+            return false;
+        }
+        m_wrote_header = true;
+    }
+
+    if (size > 0) {
+        m_pending.append(static_cast<const char *>(data), size);
+    }
+
+    // A block is only submitted once more data follows it because the last
+    // gzip block must be compressed differently
+    while (m_pending.size() > m_block_size) {
+        if (!submit(m_pending.substr(0, m_block_size), false)) {
+            return false;
+        }
+        m_pending.erase(0, m_block_size);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compress the remaining data and write the end of the stream
+ *
+ * This waits for all workers to finish. No more data can be written after this
+ * is called.
+ */
+bool ParallelCompressor::finish()
+{
+    if (!write(nullptr, 0)) {
+        return false;
+    }
+
+    m_finished = true;
+
+    // LZ4 streams must not contain empty blocks (a zero size is the frame's
+    // end mark), but the last gzip block is always needed to end the deflate
+    // stream
+    if ((m_format == ParallelFormat::Gzip || !m_pending.empty())
+            && !submit(std::move(m_pending), true)) {
+        return false;
+    }
+
+    return drain(true) && write_trailer();
+}
+
+bool ParallelCompressor::write_header()
+{
+    switch (m_format) {
+    case ParallelFormat::Gzip:
+        return m_write_fn(GZIP_HEADER);
+    case ParallelFormat::Lz4Frame:
+        return m_write_fn(LZ4_FRAME_HEADER);
+    case ParallelFormat::Lz4Legacy:
+        return m_write_fn(LZ4_LEGACY_HEADER);
+    }
+
+    MB_UNREACHABLE("Invalid format: %d", static_cast<int>(m_format));
+}
+
+bool ParallelCompressor::write_trailer()
+{
+    std::string trailer;
+
+    switch (m_format) {
+    case ParallelFormat::Gzip:
+        // CRC32 and size modulo 2^32
+        append_le32(trailer, m_crc);
+        append_le32(trailer, static_cast<uint32_t>(m_size));
+        break;
+    case ParallelFormat::Lz4Frame:
+        // End mark
+        append_le32(trailer, 0);
+        break;
+    case ParallelFormat::Lz4Legacy:
+        // The legacy format just ends after the last block
+        return true;
+    }
+
+    return m_write_fn(trailer);
+}
+
+bool ParallelCompressor::submit(std::string input, bool last)
+{
+    // Make room by writing out finished blocks
+    if (!drain(false)) {
+        return false;
+    }
+
+    std::string dict;
+    if (m_format == ParallelFormat::Gzip && !last) {
+        dict = input.substr(input.size() - GZIP_DICT_SIZE);
+    }
+
+    {
+        std::lock_guard lock(m_mutex);
+        m_jobs.push_back({
+            std::move(m_dict), std::move(input), last, false, false, false,
+            {}, 0,
+        });
+    }
+    m_cv.notify_all();
+
+    m_dict = std::move(dict);
+
+    return true;
+}
+
+/*!
+ * \brief Write finished blocks in order
+ *
+ * \param all Wait for all blocks instead of only waiting for enough blocks to
+ *            finish to allow another one to be submitted
+ */
+bool ParallelCompressor::drain(bool all)
+{
+    std::unique_lock lock(m_mutex);
+
+    while (!m_jobs.empty()) {
+        if (!m_jobs.front().done) {
+            if (!all && m_jobs.size() < m_max_jobs) {
+                break;
+            }
+
+            m_cv.wait(lock, [&] { return m_jobs.front().done; });
+        }
+
+        Job job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        lock.unlock();
+
+        if (!job.ok) {
+            return false;
+        }
+
+        if (m_format == ParallelFormat::Gzip) {
+            m_crc = static_cast<uint32_t>(crc32_combine(
+                    m_crc, job.crc, static_cast<z_off_t>(job.input.size())));
+        }
+        m_size += job.input.size();
+
+        if (!m_write_fn(job.output)) {
+            return false;
+        }
+
+        lock.lock();
+    }
+
+    return true;
+}
+
+bool ParallelCompressor::compress(Job &job)
+{
+    switch (m_format) {
+    case ParallelFormat::Gzip:
+        job.crc = static_cast<uint32_t>(crc32(
+                0L, reinterpret_cast<const Bytef *>(job.input.data()),
+                static_cast<uInt>(job.input.size())));
+        return gzip_deflate_block(job.dict, job.input, job.last,
+                                  m_level.value_or(Z_DEFAULT_COMPRESSION),
+                                  job.output);
+    case ParallelFormat::Lz4Frame:
+        return lz4_compress_block(job.input, m_level, job.output, true);
+    case ParallelFormat::Lz4Legacy:
+        return lz4_compress_block(job.input, m_level, job.output, false);
+    }
+
+    MB_UNREACHABLE("Invalid format: %d", static_cast<int>(m_format));
+}
+
+void ParallelCompressor::worker()
+{
+    std::unique_lock lock(m_mutex);
+
+    while (true) {
+        auto it = m_jobs.end();
+
+        m_cv.wait(lock, [&] {
+            it = std::find_if(m_jobs.begin(), m_jobs.end(),
+                              [](const Job &j) { return !j.taken; });
+            return m_stop || it != m_jobs.end();
+        });
+
+        if (m_stop) {
+            return;
+        }
+
+        // References to deque elements stay valid while other elements are
+        // added to the back or removed from the front
+        Job &job = *it;
+        job.taken = true;
+        lock.unlock();
+
+        bool ok = compress(job);
+
+        lock.lock();
+        job.ok = ok;
+        job.done = true;
+        m_cv.notify_all();
+    }
+}
+
+/*!
+ * \class StreamDecompressor
+ *
+ * \brief Streaming decompressor for gzip and LZ4 legacy streams
+ *
+ * This is the counterpart of ParallelCompressor for the formats that kernels
+ * are compressed with. Decompressed data is passed to the write callback as
+ * soon as it is available.
+ *
+ * Data that follows the end of the compressed stream (eg. the device trees
+ * appended to `Image.gz-dtb` or the size appended to `Image.lz4`) is not
+ * treated as an error and is available from trailing_data() afterwards. The
+ * LZ4 legacy format has no end marker, so the stream ends at EOF or at the
+ * first block size that is larger than any valid block.
+ */
+
+/*!
+ * \brief Construct a decompressor
+ *
+ * \param format Input format. ParallelFormat::Lz4Frame is not supported.
+ * \param write_fn Function to call with each chunk of output
+ */
+StreamDecompressor::StreamDecompressor(ParallelFormat format,
+                                       WriteFn write_fn)
+    : m_format(format)
+    , m_write_fn(std::move(write_fn))
+    , m_read_magic(false)
+    , m_ended(false)
+    , m_finished(false)
+{
+    if (format == ParallelFormat::Gzip) {
+        m_zs = std::make_unique<z_stream>();
+
+        if (inflateInit2(m_zs.get(), 16 + MAX_WBITS) != Z_OK) {
+            LOGE("Failed to initialize inflate stream");
+            m_zs.reset();
+        }
+    }
+}
+
+StreamDecompressor::~StreamDecompressor()
+{
+    if (m_zs) {
+        inflateEnd(m_zs.get());
+    }
+}
+
+/*!
+ * \brief Detect the format of a compressed stream
+ *
+ * \param data Beginning of the stream (at least 4 bytes)
+ *
+ * \return Format if the data starts with a gzip or LZ4 legacy header
+ */
+std::optional<ParallelFormat>
+StreamDecompressor::detect_format(std::string_view data)
+{
+    if (data.substr(0, 3) == GZIP_HEADER.substr(0, 3)) {
+        return ParallelFormat::Gzip;
+    } else if (data.substr(0, LZ4_LEGACY_HEADER.size()) == LZ4_LEGACY_HEADER) {
+        return ParallelFormat::Lz4Legacy;
+    }
+
+    return std::nullopt;
+}
+
+/*!
+ * \brief Decompress data
+ *
+ * \return Whether the data was valid and all decompressed output was written
+ *         successfully
+ */
+bool StreamDecompressor::write(const void *data, size_t size)
+{
+    if (m_finished) {
+        LOGE("Decompressed stream is already finished");
+        return false;
+    }
+
+    auto ptr = static_cast<const char *>(data);
+
+    if (m_ended) {
+        m_trailing.append(ptr, size);
+        return true;
+    }
+
+    switch (m_format) {
+    case ParallelFormat::Gzip:
+        return write_gzip(ptr, size);
+    case ParallelFormat::Lz4Legacy:
+        m_pending.append(ptr, size);
+        return write_lz4_legacy(false);
+    default:
+        LOGE("Unsupported decompression format: %d",
+             static_cast<int>(m_format));
+        return false;
+    }
+}
+
+/*!
+ * \brief Finish decompressing
+ *
+ * \return Whether the stream was complete and all output was written
+ */
+bool StreamDecompressor::finish()
+{
+    if (m_finished) {
+        LOGE("Decompressed stream is already finished");
+        return false;
+    }
+
+    m_finished = true;
+
+    if (!m_ended && m_format == ParallelFormat::Lz4Legacy) {
+        return write_lz4_legacy(true);
+    } else if (!m_ended) {
+        LOGE("Compressed stream is truncated");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get data that followed the compressed stream
+ *
+ * This is only complete after finish() returns successfully.
+ */
+const std::string & StreamDecompressor::trailing_data() const
+{
+    return m_trailing;
+}
+
+bool StreamDecompressor::write_gzip(const char *data, size_t size)
+{
+    if (!m_zs) {
+        return false;
+    }
+
+    m_zs->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    m_zs->avail_in = static_cast<uInt>(size);
+
+    m_out.resize(GZIP_BLOCK_SIZE);
+
+    while (m_zs->avail_in > 0) {
+        m_zs->next_out = reinterpret_cast<Bytef *>(m_out.data());
+        m_zs->avail_out = static_cast<uInt>(m_out.size());
+
+        int ret = inflate(m_zs.get(), Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            LOGE("Failed to inflate data: %s",
+                 m_zs->msg ? m_zs->msg : "(no message)");
+            return false;
+        }
+
+        size_t n = m_out.size() - m_zs->avail_out;
+        if (n > 0 && !m_write_fn({m_out.data(), n})) {
+            return false;
+        }
+
+        if (ret == Z_STREAM_END) {
+            m_ended = true;
+            m_trailing.append(reinterpret_cast<const char *>(m_zs->next_in),
+                              m_zs->avail_in);
+            break;
+        } else if (n == 0 && m_zs->avail_in > 0 && m_zs->avail_out > 0) {
+            // No progress is possible (should not happen with Z_NO_FLUSH)
+            LOGE("Inflate stream stalled");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool StreamDecompressor::write_lz4_legacy(bool at_eof)
+{
+    static const auto max_block_size = static_cast<uint32_t>(
+            LZ4_compressBound(static_cast<int>(LZ4_LEGACY_BLOCK_SIZE)));
+
+    size_t pos = 0;
+
+    auto finish_stream = [&] {
+        m_ended = true;
+        m_trailing.append(m_pending, pos);
+        m_pending.clear();
+        return true;
+    };
+
+    if (!m_read_magic) {
+        if (m_pending.size() < LZ4_LEGACY_HEADER.size()) {
+            if (at_eof) {
+                LOGE("Compressed stream is truncated");
+                return false;
+            }
+            return true;
+        } else if (std::string_view(m_pending).substr(
+                0, LZ4_LEGACY_HEADER.size()) != LZ4_LEGACY_HEADER) {
+            LOGE("Invalid LZ4 legacy header");
+            return false;
+        }
+
+        pos = LZ4_LEGACY_HEADER.size();
+        m_read_magic = true;
+    }
+
+    while (m_pending.size() - pos >= 4) {
+        uint32_t block_size = 0;
+        for (int i = 0; i < 4; ++i) {
+            block_size |= static_cast<uint32_t>(static_cast<unsigned char>(
+                    m_pending[pos + static_cast<size_t>(i)])) << (8 * i);
+        }
+
+        if (std::string_view(m_pending).substr(pos, 4) == LZ4_LEGACY_HEADER) {
+            // Concatenated legacy streams
+            pos += 4;
+            continue;
+        } else if (block_size == 0 || block_size > max_block_size) {
+            return finish_stream();
+        } else if (m_pending.size() - pos - 4 < block_size) {
+            break;
+        }
+
+        m_out.resize(LZ4_LEGACY_BLOCK_SIZE);
+
+        int n = LZ4_decompress_safe(m_pending.data() + pos + 4, m_out.data(),
+                                    static_cast<int>(block_size),
+                                    static_cast<int>(m_out.size()));
+        if (n < 0) {
+            LOGE("Failed to decompress LZ4 block");
+            return false;
+        }
+
+        if (!m_write_fn({m_out.data(), static_cast<size_t>(n)})) {
+            return false;
+        }
+
+        pos += 4 + block_size;
+    }
+
+    if (at_eof) {
+        // An incomplete block at EOF is trailing data (eg. an appended size
+        // that happens to be small enough to look like a block size)
+        return finish_stream();
+    }
+
+    m_pending.erase(0, pos);
+
+    return true;
+}
+
+}
@@ -19,20 +19,36 @@
 
 #include "mbutil/copy.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
 #include <cerrno>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <fts.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/fts.h"
+#include "mbutil/dir_walker.h"
 #include "mbutil/path.h"
 #include "mbutil/string.h"
 
@@ -44,35 +60,471 @@
 namespace mb::util
 {
 
-oc::result<void> copy_data_fd(int fd_source, int fd_target)
+// Maximum number of bytes to transfer per kernel copy syscall
+static constexpr size_t KERNEL_COPY_CHUNK_SIZE = 1u << 30;
+// Buffer size and alignment for the userspace fallback
+static constexpr size_t COPY_BUF_SIZE = 1024 * 1024;
+static constexpr size_t COPY_BUF_ALIGN = 4096;
+// Number of extents to fetch per FIEMAP ioctl
+static constexpr size_t FIEMAP_EXTENT_COUNT = 64;
+// Maximum number of bytes per kernel copy syscall when progress is reported
+static constexpr size_t PROGRESS_COPY_CHUNK_SIZE = 16 * 1024 * 1024;
+
+// Older kernel headers (eg. in the NDK) do not define this
+#ifndef FICLONE
+#  define FICLONE _IOW(0x94, 9, int)
+#endif
+
+// Passed as the size to copy everything until EOF
+static constexpr uint64_t COPY_TO_EOF = UINT64_MAX;
+
+/*!
+ * \brief Copy data with a kernel-side copy syscall
+ *
+ * \param fn Function that performs the syscall for at most the given number of
+ *           bytes using (and advancing) the file positions of both fds
+ * \param remain Number of bytes to copy or COPY_TO_EOF. This is updated with
+ *               the number of bytes that remain to be copied.
+ * \param progress Progress to update after each syscall or nullptr
+ *
+ * \return
+ *   * True if all data was copied
+ *   * False if the syscall is not supported for these fds. Any data that was
+ *     already copied is reflected in the file positions and \p remain, so the
+ *     caller can continue with another method.
+ *   * Otherwise, the error code
+ */
+template<typename Fn>
+static oc::result<bool> copy_data_fd_kernel(Fn fn, uint64_t &remain,
+                                            FileOpProgress *progress)
+{
+    // Smaller chunks so that progress is updated regularly and cancellation
+    // takes effect quickly
+    size_t chunk_size = progress
+            ? PROGRESS_COPY_CHUNK_SIZE : KERNEL_COPY_CHUNK_SIZE;
+
+    while (remain > 0) {
+        if (progress && progress->cancelled) {
+            return std::make_error_code(std::errc::operation_canceled);
+        }
+
+        ssize_t n = fn(static_cast<size_t>(
+                std::min<uint64_t>(remain, chunk_size)));
+        if (n == 0) {
+            break;
+        } else if (n > 0) {
+            if (remain != COPY_TO_EOF) {
+                remain -= static_cast<uint64_t>(n);
+            }
+            if (progress) {
+                progress->bytes += static_cast<uint64_t>(n);
+            }
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == ENOSYS || errno == EINVAL || errno == EXDEV
+                || errno == EOPNOTSUPP || errno == ENOTSUP || errno == EBADF) {
+            return false;
+        } else {
+            return ec_from_errno();
+        }
+    }
+
+    return true;
+}
+
+static oc::result<void> copy_data_fd_buffered(int fd_source, int fd_target,
+                                              uint64_t remain,
+                                              FileOpProgress *progress)
 {
-    char buf[10240];
-    ssize_t nread;
+    void *ptr;
+
+    if (int ret = posix_memalign(&ptr, COPY_BUF_ALIGN, COPY_BUF_SIZE);
+            ret != 0) {
+        return std::error_code(ret, std::generic_category());
+    }
+
+    auto free_buf = finally([&] {
+        free(ptr);
+    });
+
+    char *buf = static_cast<char *>(ptr);
+
+    while (remain > 0) {
+        if (progress && progress->cancelled) {
+            return std::make_error_code(std::errc::operation_canceled);
+        }
+
+        ssize_t nread = read(fd_source, buf, static_cast<size_t>(
+                std::min<uint64_t>(remain, COPY_BUF_SIZE)));
+        if (nread < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (nread == 0) {
+            break;
+        }
+
+        if (remain != COPY_TO_EOF) {
+            remain -= static_cast<uint64_t>(nread);
+        }
 
-    while ((nread = read(fd_source, buf, sizeof(buf))) > 0) {
         char *out_ptr = buf;
         ssize_t nwritten;
 
         do {
             if ((nwritten = write(fd_target, out_ptr,
                                   static_cast<size_t>(nread))) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
                 return ec_from_errno();
             }
 
             nread -= nwritten;
             out_ptr += nwritten;
+
+            if (progress) {
+                progress->bytes += static_cast<uint64_t>(nwritten);
+            }
         } while (nread > 0);
     }
 
-    if (nread < 0) {
+    return oc::success();
+}
+
+/*!
+ * \brief Copy up to \p size bytes from the current position of one fd to
+ *        another
+ */
+static oc::result<void> copy_data_fd_range(int fd_source, int fd_target,
+                                           const struct stat &sb_source,
+                                           const struct stat &sb_target,
+                                           uint64_t size,
+                                           FileOpProgress *progress)
+{
+    uint64_t remain = size;
+
+#ifdef __NR_copy_file_range
+    // Some pseudo-filesystems report a size of 0 for files with contents and
+    // copy_file_range() would treat them as empty
+    if (S_ISREG(sb_source.st_mode) && sb_source.st_size > 0
+            && S_ISREG(sb_target.st_mode)) {
+        OUTCOME_TRY(done, copy_data_fd_kernel([&](size_t n) {
+            return static_cast<ssize_t>(syscall(
+                    __NR_copy_file_range, fd_source, nullptr, fd_target,
+                    nullptr, n, 0u));
+        }, remain, progress));
+        if (done) {
+            return oc::success();
+        }
+    }
+#endif
+
+    if ((S_ISREG(sb_source.st_mode) && sb_source.st_size > 0)
+            || S_ISBLK(sb_source.st_mode)) {
+        OUTCOME_TRY(done, copy_data_fd_kernel([&](size_t n) {
+            return sendfile(fd_target, fd_source, nullptr, n);
+        }, remain, progress));
+        if (done) {
+            return oc::success();
+        }
+    }
+
+    if (S_ISFIFO(sb_source.st_mode) || S_ISFIFO(sb_target.st_mode)) {
+        OUTCOME_TRY(done, copy_data_fd_kernel([&](size_t n) {
+            return splice(fd_source, nullptr, fd_target, nullptr, n,
+                          SPLICE_F_MOVE);
+        }, remain, progress));
+        if (done) {
+            return oc::success();
+        }
+    }
+
+    return copy_data_fd_buffered(fd_source, fd_target, remain, progress);
+}
+
+/*!
+ * \brief Copy data from the current position of one fd to another until EOF
+ *
+ * The copy is done in the kernel when possible. In order, this tries:
+ *
+ * 1. `copy_file_range()` if both fds refer to regular files
+ * 2. `sendfile()` if the source is a regular file or block device
+ * 3. `splice()` if the source or target is a pipe
+ * 4. A userspace read/write loop
+ *
+ * The file positions of both fds are advanced by the amount of data copied.
+ *
+ * \param fd_source Source fd
+ * \param fd_target Target fd
+ * \param progress Progress to update with the number of bytes copied or
+ *                 nullptr. If cancellation is requested, this fails with
+ *                 `std::errc::operation_canceled`.
+ *
+ * \return Nothing if all data is successfully copied. Otherwise, the error
+ *         code.
+ */
+oc::result<void> copy_data_fd(int fd_source, int fd_target,
+                              FileOpProgress *progress)
+{
+    struct stat sb_source;
+    struct stat sb_target;
+
+    if (fstat(fd_source, &sb_source) < 0 || fstat(fd_target, &sb_target) < 0) {
+        return ec_from_errno();
+    }
+
+    return copy_data_fd_range(fd_source, fd_target, sb_source, sb_target,
+                              COPY_TO_EOF, progress);
+}
+
+/*!
+ * \brief Copy the range [\p start, \p end) of the source to the same offsets
+ *        (relative to \p src_base and \p tgt_base) in the target
+ */
+static oc::result<void> copy_data_fd_extent(int fd_source, int fd_target,
+                                            const struct stat &sb_source,
+                                            const struct stat &sb_target,
+                                            off64_t src_base, off64_t tgt_base,
+                                            off64_t start, off64_t end,
+                                            FileOpProgress *progress)
+{
+    if (lseek64(fd_source, start, SEEK_SET) < 0
+            || lseek64(fd_target, tgt_base + (start - src_base), SEEK_SET) < 0) {
+        return ec_from_errno();
+    }
+
+    return copy_data_fd_range(fd_source, fd_target, sb_source, sb_target,
+                              static_cast<uint64_t>(end - start), progress);
+}
+
+/*!
+ * \brief Find data extents with FIEMAP and copy them
+ *
+ * \return True if the extents were copied, false if FIEMAP is not supported,
+ *         or the error code
+ */
+static oc::result<bool> copy_data_fd_fiemap(int fd_source, int fd_target,
+                                            const struct stat &sb_source,
+                                            const struct stat &sb_target,
+                                            off64_t src_base, off64_t src_end,
+                                            off64_t tgt_base,
+                                            FileOpProgress *progress)
+{
+    std::vector<unsigned char> buf(sizeof(fiemap)
+            + FIEMAP_EXTENT_COUNT * sizeof(fiemap_extent));
+    auto *fm = reinterpret_cast<fiemap *>(buf.data());
+    auto start = static_cast<uint64_t>(src_base);
+    auto file_end = static_cast<uint64_t>(src_end);
+
+    while (start < file_end) {
+        memset(buf.data(), 0, buf.size());
+        fm->fm_start = start;
+        fm->fm_length = file_end - start;
+        fm->fm_flags = FIEMAP_FLAG_SYNC;
+        fm->fm_extent_count = FIEMAP_EXTENT_COUNT;
+
+        if (ioctl(fd_source, FS_IOC_FIEMAP, fm) < 0) {
+            if (errno == ENOTTY || errno == EOPNOTSUPP || errno == ENOTSUP
+                    || errno == EINVAL) {
+                return false;
+            }
+            return ec_from_errno();
+        } else if (fm->fm_mapped_extents == 0) {
+            break;
+        }
+
+        bool last = false;
+
+        for (uint32_t i = 0; i < fm->fm_mapped_extents; ++i) {
+            auto const &extent = fm->fm_extents[i];
+            uint64_t extent_start = std::max<uint64_t>(
+                    extent.fe_logical, start);
+            uint64_t extent_end = std::min<uint64_t>(
+                    extent.fe_logical + extent.fe_length, file_end);
+
+            // Unwritten extents read back as zeros
+            if (!(extent.fe_flags & FIEMAP_EXTENT_UNWRITTEN)
+                    && extent_start < extent_end) {
+                OUTCOME_TRYV(copy_data_fd_extent(
+                        fd_source, fd_target, sb_source, sb_target,
+                        src_base, tgt_base,
+                        static_cast<off64_t>(extent_start),
+                        static_cast<off64_t>(extent_end), progress));
+            }
+
+            start = extent.fe_logical + extent.fe_length;
+
+            if (extent.fe_flags & FIEMAP_EXTENT_LAST) {
+                last = true;
+            }
+        }
+
+        if (last) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Copy data from the current position of one fd to another until EOF,
+ *        preserving holes
+ *
+ * If both fds refer to regular files, only the data regions of the source are
+ * copied. The target range corresponding to holes in the source is skipped and
+ * the target is extended to its final size with `ftruncate()`, so the target
+ * must not contain any existing data in that range (eg. it was created or
+ * truncated).
+ *
+ * Data regions are found with `lseek(SEEK_DATA)`/`lseek(SEEK_HOLE)` or, on
+ * kernels where those are not supported, the `FS_IOC_FIEMAP` ioctl. If neither
+ * is supported or either fd is not a regular file, this behaves like
+ * copy_data_fd().
+ *
+ * \param fd_source Source fd
+ * \param fd_target Target fd
+ * \param progress Progress to update with the number of bytes copied or
+ *                 nullptr (see copy_data_fd())
+ *
+ * \return Nothing if all data is successfully copied. Otherwise, the error
+ *         code.
+ */
+oc::result<void> copy_data_fd_sparse(int fd_source, int fd_target,
+                                     FileOpProgress *progress)
+{
+    struct stat sb_source;
+    struct stat sb_target;
+
+    if (fstat(fd_source, &sb_source) < 0 || fstat(fd_target, &sb_target) < 0) {
+        return ec_from_errno();
+    }
+
+    if (!S_ISREG(sb_source.st_mode) || !S_ISREG(sb_target.st_mode)) {
+        return copy_data_fd_range(fd_source, fd_target, sb_source, sb_target,
+                                  COPY_TO_EOF, progress);
+    }
+
+    off64_t src_base = lseek64(fd_source, 0, SEEK_CUR);
+    off64_t tgt_base = lseek64(fd_target, 0, SEEK_CUR);
+    off64_t src_end = sb_source.st_size;
+
+    if (src_base < 0 || tgt_base < 0) {
+        return ec_from_errno();
+    }
+
+    if (src_base >= src_end) {
+        return oc::success();
+    }
+
+    off64_t pos = src_base;
+
+    while (pos < src_end) {
+        off64_t data = lseek64(fd_source, pos, SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                // Only a hole remains
+                break;
+            } else if (errno != EINVAL && errno != ENOTSUP
+                    && errno != EOPNOTSUPP) {
+                return ec_from_errno();
+            } else if (pos != src_base) {
+                return ec_from_errno();
+            }
+
+            // SEEK_DATA is not supported
+            OUTCOME_TRY(done, copy_data_fd_fiemap(
+                    fd_source, fd_target, sb_source, sb_target,
+                    src_base, src_end, tgt_base, progress));
+            if (!done) {
+                if (lseek64(fd_source, src_base, SEEK_SET) < 0) {
+                    return ec_from_errno();
+                }
+                return copy_data_fd_range(fd_source, fd_target, sb_source,
+                                          sb_target, COPY_TO_EOF, progress);
+            }
+            break;
+        }
+
+        off64_t hole = lseek64(fd_source, data, SEEK_HOLE);
+        if (hole < 0) {
+            return ec_from_errno();
+        }
+        hole = std::min(hole, src_end);
+
+        OUTCOME_TRYV(copy_data_fd_extent(
+                fd_source, fd_target, sb_source, sb_target,
+                src_base, tgt_base, data, hole, progress));
+
+        pos = hole;
+    }
+
+    // Extend the target to cover trailing holes and leave both fds at the end
+    off64_t tgt_end = tgt_base + (src_end - src_base);
+
+    if (ftruncate64(fd_target, tgt_end) < 0
+            || lseek64(fd_source, src_end, SEEK_SET) < 0
+            || lseek64(fd_target, tgt_end, SEEK_SET) < 0) {
         return ec_from_errno();
     }
 
     return oc::success();
 }
 
+/*!
+ * \brief Make the target share the source's data extents with `FICLONE`
+ *
+ * Both fds must refer to regular files and the target must be empty.
+ *
+ * \return True if the file was cloned, false if the filesystem (or kernel)
+ *         does not support reflinks for these fds, or the error code
+ */
+static oc::result<bool> clone_data_fd(int fd_source, int fd_target)
+{
+    if (ioctl(fd_target, FICLONE, fd_source) < 0) {
+        if (errno == ENOTTY || errno == EOPNOTSUPP || errno == ENOTSUP
+                || errno == EINVAL || errno == EXDEV || errno == EBADF
+                || errno == ENOSYS) {
+            return false;
+        }
+        return ec_from_errno();
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Copy all data from a newly opened source fd to an empty target fd
+ *
+ * If \p flags contains CopyFlag::Reflink, cloning the file is attempted first.
+ * Otherwise, or if it is not supported, this falls back to
+ * copy_data_fd_sparse() or copy_data_fd() depending on CopyFlag::Sparse.
+ */
+static oc::result<void> copy_data_fds(int fd_source, int fd_target,
+                                      CopyFlags flags,
+                                      FileOpProgress *progress)
+{
+    if (flags & CopyFlag::Reflink) {
+        OUTCOME_TRY(cloned, clone_data_fd(fd_source, fd_target));
+        if (cloned) {
+            struct stat sb;
+            if (progress && fstat(fd_source, &sb) == 0) {
+                progress->bytes += static_cast<uint64_t>(sb.st_size);
+            }
+            return oc::success();
+        }
+    }
+
+    return (flags & CopyFlag::Sparse)
+            ? copy_data_fd_sparse(fd_source, fd_target, progress)
+            : copy_data_fd(fd_source, fd_target, progress);
+}
+
 static FileOpResult<void> copy_data(const std::string &source,
-                                    const std::string &target)
+                                    const std::string &target,
+                                    CopyFlags flags, FileOpProgress *progress)
 {
     int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd_source < 0) {
@@ -93,7 +545,7 @@ static FileOpResult<void> copy_data(const std::string &source,
         close(fd_target);
     });
 
-    if (auto r = copy_data_fd(fd_source, fd_target); !r) {
+    if (auto r = copy_data_fds(fd_source, fd_target, flags, progress); !r) {
         // TODO: OR SOURCE?
         return FileOpErrorInfo{target, r.error()};
     }
@@ -104,6 +556,10 @@ static FileOpResult<void> copy_data(const std::string &source,
         return FileOpErrorInfo{target, ec_from_errno()};
     }
 
+    if (progress) {
+        ++progress->files;
+    }
+
     return oc::success();
 }
 
@@ -182,8 +638,24 @@ FileOpResult<void> copy_stat(const std::string &source,
     return oc::success();
 }
 
+/*!
+ * \brief Copy the contents of a file, truncating the target if it exists
+ *
+ * If \p flags contains CopyFlag::Reflink and the filesystem supports it, the
+ * target shares the source's data extents instead of copying them. If \p flags
+ * contains CopyFlag::Sparse and both the source and the target are regular
+ * files, holes in the source are preserved. Other flags are ignored.
+ *
+ * \param source Source path
+ * \param target Target path
+ * \param flags Copy flags
+ * \param progress Progress to update with the number of bytes copied or
+ *                 nullptr. If cancellation is requested, this fails with
+ *                 `std::errc::operation_canceled`.
+ */
 FileOpResult<void> copy_contents(const std::string &source,
-                                 const std::string &target)
+                                 const std::string &target,
+                                 CopyFlags flags, FileOpProgress *progress)
 {
     int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
     if (fd_source < 0) {
@@ -204,16 +676,21 @@ FileOpResult<void> copy_contents(const std::string &source,
         close(fd_target);
     });
 
-    if (auto r = copy_data_fd(fd_source, fd_target); !r) {
+    if (auto r = copy_data_fds(fd_source, fd_target, flags, progress); !r) {
         // TODO: OR SOURCE?
-        return FileOpErrorInfo{target, ec_from_errno()};
+        return FileOpErrorInfo{target, r.error()};
+    }
+
+    if (progress) {
+        ++progress->files;
     }
 
     return oc::success();
 }
 
 FileOpResult<void> copy_file(const std::string &source,
-                             const std::string &target, CopyFlags flags)
+                             const std::string &target, CopyFlags flags,
+                             FileOpProgress *progress)
 {
     mode_t old_umask = umask(0);
 
@@ -270,7 +747,7 @@ FileOpResult<void> copy_file(const std::string &source,
         [[fallthrough]];
 
     case S_IFREG:
-        if (auto r = copy_data(source, target); !r) {
+        if (auto r = copy_data(source, target, flags, progress); !r) {
             return r.as_failure();
         }
         break;
@@ -292,14 +769,212 @@ FileOpResult<void> copy_file(const std::string &source,
 }
 
 
-class RecursiveCopier : public FtsWrapper
+/*!
+ * \brief Copy a regular file found during a recursive copy
+ *
+ * Any existing file at \p target is removed first. Attributes and extended
+ * attributes are copied afterwards if requested by \p flags.
+ */
+static FileOpResult<void> copy_tree_file(const std::string &source,
+                                         const std::string &target,
+                                         CopyFlags flags,
+                                         FileOpProgress *progress)
+{
+    if (unlink(target.c_str()) < 0 && errno != ENOENT) {
+        return FileOpErrorInfo{target, ec_from_errno()};
+    }
+
+    OUTCOME_TRYV(copy_data(source, target, flags, progress));
+
+    if (flags & CopyFlag::CopyAttributes) {
+        OUTCOME_TRYV(copy_stat(source, target));
+    }
+    if (flags & CopyFlag::CopyXattrs) {
+        OUTCOME_TRYV(copy_xattrs(source, target));
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Work-stealing pool for copying regular files
+ *
+ * Each worker owns a queue. Jobs are distributed round-robin by push(). A
+ * worker takes jobs from the back of its own queue and, once it runs dry,
+ * steals from the front of the other workers' queues. Failures do not stop
+ * the remaining jobs so that, like the serial copy, as much as possible is
+ * copied.
+ */
+class FileCopyPool
+{
+public:
+    FileCopyPool(unsigned int threads, CopyFlags flags,
+                 FileOpProgress *progress)
+        : _flags(flags)
+        , _progress(progress)
+        , _queues(std::max(threads, 1u))
+    {
+        _workers.reserve(_queues.size());
+        for (size_t i = 0; i < _queues.size(); ++i) {
+            _workers.emplace_back(&FileCopyPool::worker, this, i);
+        }
+    }
+
+    ~FileCopyPool()
+    {
+        (void) finish();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FileCopyPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(FileCopyPool)
+
+    void push(std::string source, std::string target)
+    {
+        auto &queue = _queues[_next_queue];
+        _next_queue = (_next_queue + 1) % _queues.size();
+
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back({std::move(source), std::move(target)});
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            ++_pending;
+        }
+        _cv.notify_one();
+    }
+
+    /*!
+     * \brief Wait for all queued jobs to complete
+     *
+     * \return Nothing if all jobs succeeded. Otherwise, the error from the
+     *         first job that failed.
+     */
+    FileOpResult<void> finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closing = true;
+        }
+        _cv.notify_all();
+
+        for (auto &t : _workers) {
+            t.join();
+        }
+        _workers.clear();
+
+        if (_error) {
+            return std::move(*_error);
+        }
+        return oc::success();
+    }
+
+private:
+    struct Job
+    {
+        std::string source;
+        std::string target;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    CopyFlags _flags;
+    FileOpProgress *_progress;
+    std::vector<Queue> _queues;
+    std::vector<std::thread> _workers;
+    size_t _next_queue = 0;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    size_t _pending = 0;
+    bool _closing = false;
+    std::optional<FileOpErrorInfo> _error;
+
+    bool take(size_t index, Job &job)
+    {
+        {
+            auto &queue = _queues[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty()) {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < _queues.size(); ++i) {
+            auto &victim = _queues[(index + i) % _queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void worker(size_t index)
+    {
+        Job job;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [&] { return _pending > 0 || _closing; });
+                if (_pending == 0) {
+                    return;
+                }
+                --_pending;
+            }
+
+            // A job is guaranteed to be available since _pending was
+            // non-zero and each job is only counted once
+            while (!take(index, job)) {
+                std::this_thread::yield();
+            }
+
+            // Drain the remaining jobs without copying them once cancelled
+            if (_progress && _progress->cancelled) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_error) {
+                    _error = FileOpErrorInfo{std::move(job.source),
+                            std::make_error_code(
+                                    std::errc::operation_canceled)};
+                }
+                continue;
+            }
+
+            if (auto r = copy_tree_file(job.source, job.target, _flags,
+                                        _progress); !r) {
+                LOGW("%s: Failed to copy file: %s",
+                     job.source.c_str(), r.error().message().c_str());
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_error) {
+                    _error = std::move(r.error());
+                }
+            }
+        }
+    }
+};
+
+class RecursiveCopier : public DirWalker
 {
 public:
     FileOpErrorInfo error;
 
-    RecursiveCopier(std::string path, std::string target, CopyFlags copyflags)
-        : FtsWrapper(path, 0)
+    RecursiveCopier(std::string path, std::string target, CopyFlags copyflags,
+                    FileOpProgress *progress)
+        : DirWalker(path, 0)
         , _copyflags(copyflags)
+        , _progress(progress)
         , _target(std::move(target))
     {
     }
@@ -331,11 +1006,55 @@ public:
             return false;
         }
 
+        if (_copyflags & CopyFlag::Parallel) {
+            _pool = std::make_unique<FileCopyPool>(
+                    std::thread::hardware_concurrency(), _copyflags,
+                    _progress);
+        }
+
         return true;
     }
 
+    bool on_post_execute(bool success) override
+    {
+        (void) success;
+
+        if (!_pool) {
+            return true;
+        }
+
+        bool ret = true;
+
+        // All regular files must be written before any directory attributes
+        // are applied. Otherwise, the directory timestamps would be updated
+        // by the file copies or a read-only directory mode would prevent the
+        // files from being created.
+        if (auto r = _pool->finish(); !r) {
+            error = std::move(r.error());
+            ret = false;
+        }
+        _pool.reset();
+
+        // Directories were recorded in post-order, which matches the order in
+        // which the serial copy applies their attributes
+        for (auto const &[source, target] : _deferred_dirs) {
+            if (!cp_attrs(source, target) || !cp_xattrs(source, target)) {
+                ret = false;
+            }
+        }
+        _deferred_dirs.clear();
+
+        return ret;
+    }
+
     Actions on_changed_path() override
     {
+        if (_progress && _progress->cancelled) {
+            error = {_curr->fts_path,
+                     std::make_error_code(std::errc::operation_canceled)};
+            return Action::Fail | Action::Stop;
+        }
+
         // Make sure we aren't copying the target on top of itself
         if (sb_target.st_dev == _curr->fts_statp->st_dev
                 && sb_target.st_ino == _curr->fts_statp->st_ino) {
@@ -349,7 +1068,7 @@ public:
         // give us a relative path we can append to the target.
         _curtgtpath.clear();
 
-        char *relpath = _curr->fts_path + _path.size();
+        const char *relpath = _curr->fts_path + _path.size();
 
         _curtgtpath += _target;
         if (!(_copyflags & CopyFlag::ExcludeTopLevel)) {
@@ -410,6 +1129,11 @@ public:
 
     Actions on_reached_directory_post() override
     {
+        if (_pool) {
+            _deferred_dirs.emplace_back(_curr->fts_accpath, _curtgtpath);
+            return Action::Ok;
+        }
+
         if (!cp_attrs()) {
             return Action::Fail;
         }
@@ -423,24 +1147,17 @@ public:
 
     Actions on_reached_file() override
     {
-        if (!remove_existing_file()) {
-            return Action::Fail;
+        if (_pool) {
+            _pool->push(_curr->fts_accpath, _curtgtpath);
+            return Action::Ok;
         }
 
-        // Copy file contents
-        if (auto r = copy_data(_curr->fts_accpath, _curtgtpath); !r) {
+        if (auto r = copy_tree_file(_curr->fts_accpath, _curtgtpath,
+                                    _copyflags, _progress); !r) {
             error = r.error();
             return Action::Fail;
         }
 
-        if (!cp_attrs()) {
-            return Action::Fail;
-        }
-
-        if (!cp_xattrs()) {
-            return Action::Fail;
-        }
-
         return Action::Ok;
     }
 
@@ -550,9 +1267,12 @@ public:
 
 private:
     CopyFlags _copyflags;
+    FileOpProgress *_progress;
     std::string _target;
     struct stat sb_target;
     std::string _curtgtpath;
+    std::unique_ptr<FileCopyPool> _pool;
+    std::vector<std::pair<std::string, std::string>> _deferred_dirs;
 
     bool remove_existing_file()
     {
@@ -565,9 +1285,14 @@ private:
     }
 
     bool cp_attrs()
+    {
+        return cp_attrs(_curr->fts_accpath, _curtgtpath);
+    }
+
+    bool cp_attrs(const std::string &source, const std::string &target)
     {
         if (_copyflags & CopyFlag::CopyAttributes) {
-            if (auto r = copy_stat(_curr->fts_accpath, _curtgtpath); !r) {
+            if (auto r = copy_stat(source, target); !r) {
                 error = r.error();
                 return false;
             }
@@ -576,9 +1301,14 @@ private:
     }
 
     bool cp_xattrs()
+    {
+        return cp_xattrs(_curr->fts_accpath, _curtgtpath);
+    }
+
+    bool cp_xattrs(const std::string &source, const std::string &target)
     {
         if (_copyflags & CopyFlag::CopyXattrs) {
-            if (auto r = copy_xattrs(_curr->fts_accpath, _curtgtpath); !r) {
+            if (auto r = copy_xattrs(source, target); !r) {
                 error = r.error();
                 return false;
             }
@@ -590,7 +1320,8 @@ private:
 
 // Copy as much as possible
 FileOpResult<void> copy_dir(const std::string &source,
-                            const std::string &target, CopyFlags flags)
+                            const std::string &target, CopyFlags flags,
+                            FileOpProgress *progress)
 {
     mode_t old_umask = umask(0);
 
@@ -598,7 +1329,7 @@ FileOpResult<void> copy_dir(const std::string &source,
         umask(old_umask);
     });
 
-    RecursiveCopier copier(source, target, flags);
+    RecursiveCopier copier(source, target, flags, progress);
 
     if (!copier.run()) {
         return std::move(copier.error);
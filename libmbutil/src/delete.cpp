@@ -19,27 +19,65 @@
 
 #include "mbutil/delete.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
-#include "mbutil/fts.h"
+#include "mbcommon/finally.h"
+#include "mbutil/dir_walker.h"
 
 
 namespace mb::util
 {
 
-class RecursiveDeleter : public FtsWrapper {
+class RecursiveDeleter : public DirWalker {
 public:
     std::string error_path;
     std::error_code error;
 
-    RecursiveDeleter(std::string path)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+    RecursiveDeleter(std::string path, std::vector<std::string> exclusions,
+                     bool keep_root, FileOpProgress *progress)
+        : DirWalker(std::move(path), DirWalkerFlag::GroupSpecialFiles
+                                   | DirWalkerFlag::SkipStat)
+        , _exclusions(std::move(exclusions))
+        , _keep_root(keep_root)
+        , _progress(progress)
     {
     }
 
+    Actions on_changed_path() override
+    {
+        if (_progress && _progress->cancelled) {
+            error_path = _curr->fts_path;
+            error = std::make_error_code(std::errc::operation_canceled);
+            return Action::Fail | Action::Stop;
+        }
+
+        // Exclude first-level paths
+        if (_curr->fts_level == 1
+                && std::find(_exclusions.begin(), _exclusions.end(),
+                             _curr->fts_name) != _exclusions.end()) {
+            return Action::Skip;
+        }
+
+        return Action::Ok;
+    }
+
     Actions on_reached_directory_pre() override
     {
         // Do nothing. Need depth-first search, so directories are deleted in
@@ -54,32 +92,338 @@ public:
 
     Actions on_reached_file() override
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        return delete_path(true) ? Action::Ok : Action::Fail;
     }
 
     Actions on_reached_symlink() override
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        return delete_path(true) ? Action::Ok : Action::Fail;
     }
 
     Actions on_reached_special_file() override
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        return delete_path(true) ? Action::Ok : Action::Fail;
     }
 
 private:
-    bool delete_path()
+    std::vector<std::string> _exclusions;
+    bool _keep_root;
+    FileOpProgress *_progress;
+
+    bool delete_path(bool is_file = false)
     {
+        if (_keep_root && _curr->fts_level == 0) {
+            return true;
+        }
+
         if (remove(_curr->fts_accpath) < 0) {
             error_path = _curr->fts_path;
             error = ec_from_errno();
             return false;
         }
+
+        if (is_file && _progress) {
+            ++_progress->files;
+        }
         return true;
     }
 };
 
-FileOpResult<void> delete_recursive(const std::string &path)
+/*!
+ * \brief Multithreaded recursive deleter
+ *
+ * Every directory is a node that is processed by one of the worker threads.
+ * Processing a node opens the directory relative to its parent's fd, unlinks
+ * all non-directory entries with `unlinkat()` and queues a child node for each
+ * subdirectory. Each node counts its unfinished children (plus one for its own
+ * scan) and once that reaches zero, the directory is removed from its parent
+ * and the parent's count is decremented. Thus, a directory's fd is only kept
+ * open while it still has children being deleted.
+ *
+ * Like the serial deleter, symlinks are never followed and directories on
+ * other filesystems are not descended into (removing them will fail).
+ */
+class ParallelDeleter
+{
+public:
+    ParallelDeleter(std::string path, std::vector<std::string> exclusions,
+                    bool keep_root, FileOpProgress *progress)
+        : _path(std::move(path))
+        , _exclusions(std::move(exclusions))
+        , _keep_root(keep_root)
+        , _progress(progress)
+    {
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelDeleter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelDeleter)
+
+    FileOpResult<void> run()
+    {
+        struct stat sb;
+
+        if (lstat(_path.c_str(), &sb) < 0) {
+            return FileOpErrorInfo{_path, ec_from_errno()};
+        }
+
+        if (!S_ISDIR(sb.st_mode)) {
+            if (!_keep_root && remove(_path.c_str()) < 0) {
+                return FileOpErrorInfo{_path, ec_from_errno()};
+            }
+            return oc::success();
+        }
+
+        _dev = sb.st_dev;
+
+        auto root = std::make_shared<Node>();
+        root->path = _path;
+        root->fd = open(_path.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (root->fd < 0) {
+            return FileOpErrorInfo{_path, ec_from_errno()};
+        }
+
+        push(std::move(root));
+
+        unsigned int threads = std::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+
+        for (unsigned int i = 0; i < threads; ++i) {
+            workers.emplace_back(&ParallelDeleter::worker, this);
+        }
+
+        for (auto &t : workers) {
+            t.join();
+        }
+
+        if (_error) {
+            return std::move(*_error);
+        }
+        return oc::success();
+    }
+
+private:
+    struct Node
+    {
+        std::shared_ptr<Node> parent;
+        // Name relative to the parent directory
+        std::string name;
+        // Full path (for error reporting)
+        std::string path;
+        int fd = -1;
+        // Number of unfinished children, plus one for the node's own scan
+        std::atomic<size_t> pending{1};
+    };
+
+    std::string _path;
+    std::vector<std::string> _exclusions;
+    bool _keep_root;
+    FileOpProgress *_progress;
+    dev_t _dev = 0;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::shared_ptr<Node>> _queue;
+    bool _done = false;
+    std::optional<FileOpErrorInfo> _error;
+
+    void set_error(const std::string &path, std::error_code ec)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_error) {
+            _error = FileOpErrorInfo{path, ec};
+        }
+    }
+
+    void push(std::shared_ptr<Node> node)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.push_back(std::move(node));
+        }
+        _cv.notify_one();
+    }
+
+    void worker()
+    {
+        while (true) {
+            std::shared_ptr<Node> node;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [&] { return !_queue.empty() || _done; });
+                if (_queue.empty()) {
+                    return;
+                }
+
+                // Process the most recently queued directory first to keep
+                // the traversal (and number of open fds) depth-first
+                node = std::move(_queue.back());
+                _queue.pop_back();
+            }
+
+            scan(node);
+        }
+    }
+
+    void scan(const std::shared_ptr<Node> &node)
+    {
+        // Unwind the remaining nodes without scanning them once cancelled.
+        // Their directories are not empty, so the parents are left behind.
+        if (_progress && _progress->cancelled) {
+            set_error(node->path,
+                      std::make_error_code(std::errc::operation_canceled));
+            finish(node);
+            return;
+        }
+
+        if (node->parent) {
+            node->fd = openat(node->parent->fd, node->name.c_str(),
+                              O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (node->fd < 0) {
+                if (errno != ENOENT) {
+                    set_error(node->path, ec_from_errno());
+                }
+                finish(node);
+                return;
+            }
+
+            struct stat sb;
+
+            if (fstat(node->fd, &sb) < 0) {
+                set_error(node->path, ec_from_errno());
+                finish(node);
+                return;
+            } else if (sb.st_dev != _dev) {
+                // Don't cross mountpoint boundaries
+                finish(node);
+                return;
+            }
+        }
+
+        int dup_fd = fcntl(node->fd, F_DUPFD_CLOEXEC, 0);
+        if (dup_fd < 0) {
+            set_error(node->path, ec_from_errno());
+            finish(node);
+            return;
+        }
+
+        DIR *dp = fdopendir(dup_fd);
+        if (!dp) {
+            set_error(node->path, ec_from_errno());
+            close(dup_fd);
+            finish(node);
+            return;
+        }
+
+        auto close_dp = finally([&] {
+            closedir(dp);
+        });
+
+        dirent *ent;
+
+        while (true) {
+            errno = 0;
+            if (!(ent = readdir(dp))) {
+                if (errno != 0) {
+                    set_error(node->path, ec_from_errno());
+                }
+                break;
+            }
+
+            if (strcmp(ent->d_name, ".") == 0
+                    || strcmp(ent->d_name, "..") == 0) {
+                continue;
+            }
+
+            // Exclude first-level paths
+            if (!node->parent && std::find(_exclusions.begin(),
+                                           _exclusions.end(), ent->d_name)
+                    != _exclusions.end()) {
+                continue;
+            }
+
+            bool is_dir = ent->d_type == DT_DIR;
+
+            if (ent->d_type == DT_UNKNOWN) {
+                struct stat sb;
+
+                if (fstatat(node->fd, ent->d_name, &sb,
+                            AT_SYMLINK_NOFOLLOW) < 0) {
+                    if (errno != ENOENT) {
+                        set_error(node->path + "/" + ent->d_name,
+                                  ec_from_errno());
+                    }
+                    continue;
+                }
+
+                is_dir = S_ISDIR(sb.st_mode);
+            }
+
+            if (is_dir) {
+                auto child = std::make_shared<Node>();
+                child->parent = node;
+                child->name = ent->d_name;
+                child->path = node->path + "/" + ent->d_name;
+
+                ++node->pending;
+                push(std::move(child));
+            } else if (unlinkat(node->fd, ent->d_name, 0) < 0) {
+                if (errno != ENOENT) {
+                    set_error(node->path + "/" + ent->d_name,
+                              ec_from_errno());
+                }
+            } else if (_progress) {
+                ++_progress->files;
+            }
+        }
+
+        close_dp.dismiss();
+        closedir(dp);
+
+        finish(node);
+    }
+
+    void finish(std::shared_ptr<Node> node)
+    {
+        // Remove directories whose children have all been deleted, walking
+        // up the tree as long as this was the last child of the parent
+        while (--node->pending == 0) {
+            if (node->fd >= 0) {
+                close(node->fd);
+                node->fd = -1;
+            }
+
+            auto parent = node->parent;
+
+            if (!parent) {
+                if (!_keep_root && rmdir(node->path.c_str()) < 0) {
+                    set_error(node->path, ec_from_errno());
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _done = true;
+                }
+                _cv.notify_all();
+                break;
+            }
+
+            if (unlinkat(parent->fd, node->name.c_str(), AT_REMOVEDIR) < 0
+                    && errno != ENOENT) {
+                set_error(node->path, ec_from_errno());
+            }
+
+            node = std::move(parent);
+        }
+    }
+};
+
+static FileOpResult<void> delete_tree(const std::string &path,
+                                      std::vector<std::string> exclusions,
+                                      bool keep_root, DeleteFlags flags,
+                                      FileOpProgress *progress)
 {
     struct stat sb;
     if (stat(path.c_str(), &sb) < 0 && errno == ENOENT) {
@@ -87,7 +431,14 @@ FileOpResult<void> delete_recursive(const std::string &path)
         return oc::success();
     }
 
-    RecursiveDeleter deleter(path);
+    if (flags & DeleteFlag::Parallel) {
+        ParallelDeleter deleter(path, std::move(exclusions), keep_root,
+                                progress);
+        return deleter.run();
+    }
+
+    RecursiveDeleter deleter(path, std::move(exclusions), keep_root,
+                             progress);
     if (!deleter.run()) {
         return FileOpErrorInfo{std::move(deleter.error_path), deleter.error};
     }
@@ -95,4 +446,43 @@ FileOpResult<void> delete_recursive(const std::string &path)
     return oc::success();
 }
 
+/*!
+ * \brief Recursively delete a path
+ *
+ * Symlinks are not followed and directories on other filesystems are not
+ * descended into. If the path does not exist, this function succeeds.
+ *
+ * \param path Path to delete
+ * \param flags If DeleteFlag::Parallel is specified, subtrees are deleted
+ *              concurrently using `openat()`/`unlinkat()` relative to the
+ *              directory fds. Deletion continues after errors and the first
+ *              error is returned.
+ * \param progress Progress to update with the number of non-directory entries
+ *                 deleted or nullptr. If cancellation is requested, this
+ *                 stops early and fails with `std::errc::operation_canceled`.
+ */
+FileOpResult<void> delete_recursive(const std::string &path, DeleteFlags flags,
+                                    FileOpProgress *progress)
+{
+    return delete_tree(path, {}, false, flags, progress);
+}
+
+/*!
+ * \brief Recursively delete the contents of a directory
+ *
+ * Like delete_recursive(), except that \p path itself is kept and first-level
+ * entries named in \p exclusions are not deleted.
+ *
+ * \param path Directory to wipe
+ * \param exclusions First-level names to exclude
+ * \param flags Delete flags (see delete_recursive())
+ * \param progress Progress to update or nullptr (see delete_recursive())
+ */
+FileOpResult<void> delete_contents(const std::string &path,
+                                   const std::vector<std::string> &exclusions,
+                                   DeleteFlags flags, FileOpProgress *progress)
+{
+    return delete_tree(path, exclusions, true, flags, progress);
+}
+
 }
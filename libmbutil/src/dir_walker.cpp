@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/dir_walker.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+
+
+namespace mb::util
+{
+
+// Initial size of the directory listing buffer for each level
+static constexpr size_t DIRBUF_INITIAL_SIZE = 32 * 1024;
+// The buffer is grown if less than this much space (one maximum size entry) is
+// available for the next getdents64() call
+static constexpr size_t DIRBUF_MIN_FREE = sizeof(struct dirent64);
+
+static mode_t dtype_to_mode(unsigned char d_type)
+{
+    switch (d_type) {
+    case DT_BLK:  return S_IFBLK;
+    case DT_CHR:  return S_IFCHR;
+    case DT_DIR:  return S_IFDIR;
+    case DT_FIFO: return S_IFIFO;
+    case DT_LNK:  return S_IFLNK;
+    case DT_REG:  return S_IFREG;
+    case DT_SOCK: return S_IFSOCK;
+    default:      return 0;
+    }
+}
+
+DirWalker::DirWalker(std::string path, DirWalkerFlags flags)
+    : _path(std::move(path))
+    , _flags(flags)
+    , _curr(nullptr)
+    , _root(nullptr)
+    , _ran(false)
+    , _stop(false)
+    , _dev(0)
+    , _root_entry()
+    , _root_sb()
+{
+}
+
+DirWalker::~DirWalker() = default;
+
+bool DirWalker::run()
+{
+    if (_ran) {
+        _error_msg = "Already ran";
+        return false;
+    }
+    _ran = true;
+
+    // Pre-execute hook
+    if (!on_pre_execute()) {
+        return false;
+    }
+
+    // Like fts, the root's name is the last path component (which is empty if
+    // the path has a trailing slash)
+    auto slash = _path.rfind('/');
+    _root_name = slash == std::string::npos ? _path : _path.substr(slash + 1);
+    _pathbuf = _path;
+
+    _root_entry.fts_level = 0;
+    _root = &_root_entry;
+
+    bool ret = visit(AT_FDCWD, _path.c_str(), _root_entry, _root_sb,
+                     DT_UNKNOWN, 0);
+
+    _curr = nullptr;
+
+    if (!on_post_execute(ret)) {
+        return false;
+    }
+
+    return ret;
+}
+
+std::string DirWalker::error()
+{
+    return _error_msg;
+}
+
+/*!
+ * \brief Visit an entry
+ *
+ * \param dirfd fd of the parent directory (or AT_FDCWD for the root)
+ * \param name Name of the entry relative to \p dirfd
+ * \param entry Entry to populate. The level must already be set.
+ * \param sb stat buffer for the entry
+ * \param d_type Type from the directory listing
+ * \param name_offset Offset of the name in the path buffer
+ *
+ * \return Whether all hooks succeeded
+ */
+bool DirWalker::visit(int dirfd, const char *name, Entry &entry,
+                      struct stat &sb, unsigned char d_type,
+                      size_t name_offset)
+{
+    set_entry_path(entry, name_offset);
+    entry.fts_statp = nullptr;
+    entry.at_fd = dirfd;
+    entry.at_path = name;
+    entry.dir_fd = -1;
+
+    mode_t type;
+
+    if (!(_flags & DirWalkerFlag::SkipStat)
+            || d_type == DT_UNKNOWN || d_type == DT_DIR) {
+        if (fstatat(dirfd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+            _error_msg = format("%s: Failed to stat: %s",
+                                entry.fts_path, strerror(errno));
+            return false;
+        }
+
+        entry.fts_statp = &sb;
+        type = sb.st_mode & S_IFMT;
+    } else {
+        type = dtype_to_mode(d_type);
+    }
+
+    if (entry.fts_level == 0) {
+        _dev = sb.st_dev;
+    }
+
+    switch (type) {
+    case S_IFDIR: entry.fts_info = FTS_D; break;
+    case S_IFREG: entry.fts_info = FTS_F; break;
+    case S_IFLNK: entry.fts_info = FTS_SL; break;
+    default:      entry.fts_info = FTS_DEFAULT; break;
+    }
+
+    _curr = &entry;
+
+    // Current path hook
+    _error_msg = "Handler returned failure";
+    Actions result = on_changed_path();
+    bool ret = !(result & Action::Fail);
+
+    if (result & Action::Next) {
+        return ret;
+    }
+    if (result & Action::Skip) {
+        // Like fts, skipped directories are still visited in post-order
+        if (entry.fts_info == FTS_D) {
+            ret = visit_directory_post(entry, name_offset) && ret;
+        }
+        return ret;
+    }
+    if (result & Action::Stop) {
+        _stop = true;
+        return ret;
+    }
+
+    // Call other hooks
+    _error_msg = "Handler returned failure";
+
+    switch (entry.fts_info) {
+    case FTS_D:
+        return visit_directory(dirfd, name, entry, sb, name_offset) && ret;
+    case FTS_F:
+        result = on_reached_file();
+        break;
+    case FTS_SL:
+        result = on_reached_symlink();
+        break;
+    default:
+        if (_flags & DirWalkerFlag::GroupSpecialFiles) {
+            result = on_reached_special_file();
+        } else {
+            switch (type) {
+            case S_IFBLK: result = on_reached_block_device(); break;
+            case S_IFCHR: result = on_reached_character_device(); break;
+            case S_IFIFO: result = on_reached_fifo(); break;
+            case S_IFSOCK: result = on_reached_socket(); break;
+            default: result = Action::Skip; break;
+            }
+        }
+        break;
+    }
+
+    if (result & Action::Fail) {
+        ret = false;
+    }
+    if (!(result & Action::Skip) && (result & Action::Stop)) {
+        _stop = true;
+    }
+
+    return ret;
+}
+
+bool DirWalker::visit_directory(int dirfd, const char *name, Entry &entry,
+                                struct stat &sb, size_t name_offset)
+{
+    Actions result = on_reached_directory_pre();
+    bool ret = !(result & Action::Fail);
+
+    if (result & Action::Skip) {
+        return visit_directory_post(entry, name_offset) && ret;
+    }
+    if (result & Action::Stop) {
+        _stop = true;
+        return ret;
+    }
+
+    // Don't cross mountpoint boundaries by default
+    if (!(_flags & DirWalkerFlag::CrossMountPointBoundaries)
+            && sb.st_dev != _dev) {
+        return visit_directory_post(entry, name_offset) && ret;
+    }
+
+    int fd = openat(dirfd, name,
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        _error_msg = format("%s: Failed to open directory: %s",
+                            entry.fts_path, strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    auto level = static_cast<size_t>(entry.fts_level);
+    size_t size;
+
+    if (!read_directory(fd, level, size)) {
+        _error_msg = format("%s: Failed to read directory: %s",
+                            entry.fts_path, strerror(errno));
+        return false;
+    }
+
+    // The buffer's data is not reallocated while the children are visited
+    // because deeper levels use their own buffers
+    const char *data = _dirbufs[level].data();
+    size_t pathlen = _pathbuf.size();
+
+    Entry child{};
+    struct stat child_sb;
+    child.fts_level = static_cast<short>(entry.fts_level + 1);
+
+    for (size_t offset = 0; offset < size && !_stop;) {
+        auto const *ent = reinterpret_cast<const struct dirent64 *>(
+                data + offset);
+        offset += ent->d_reclen;
+
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        if (_pathbuf.empty() || _pathbuf.back() != '/') {
+            _pathbuf += '/';
+        }
+        size_t child_name_offset = _pathbuf.size();
+        _pathbuf += ent->d_name;
+
+        if (!visit(fd, ent->d_name, child, child_sb, ent->d_type,
+                   child_name_offset)) {
+            ret = false;
+        }
+
+        _pathbuf.resize(pathlen);
+    }
+
+    if (_stop) {
+        return ret;
+    }
+
+    entry.dir_fd = fd;
+
+    return visit_directory_post(entry, name_offset) && ret;
+}
+
+bool DirWalker::visit_directory_post(Entry &entry, size_t name_offset)
+{
+    // The path buffer may have been reallocated while visiting the children
+    set_entry_path(entry, name_offset);
+    entry.fts_info = FTS_DP;
+    _curr = &entry;
+
+    // Current path hook
+    _error_msg = "Handler returned failure";
+    Actions result = on_changed_path();
+    bool ret = !(result & Action::Fail);
+
+    if (result & (Action::Next | Action::Skip)) {
+        return ret;
+    }
+    if (result & Action::Stop) {
+        _stop = true;
+        return ret;
+    }
+
+    _error_msg = "Handler returned failure";
+    result = on_reached_directory_post();
+
+    if (result & Action::Fail) {
+        ret = false;
+    }
+    if (!(result & Action::Skip) && (result & Action::Stop)) {
+        _stop = true;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Read all entries of a directory into the buffer for \p level
+ *
+ * \param[in] fd Directory fd
+ * \param[in] level Level of the directory
+ * \param[out] size Number of bytes of `dirent64` records in the buffer
+ *
+ * \return Whether the directory was successfully read. If false, errno is set.
+ */
+bool DirWalker::read_directory(int fd, size_t level, size_t &size)
+{
+    if (_dirbufs.size() <= level) {
+        _dirbufs.resize(level + 1);
+    }
+
+    auto &buf = _dirbufs[level];
+    if (buf.size() < DIRBUF_INITIAL_SIZE) {
+        buf.resize(DIRBUF_INITIAL_SIZE);
+    }
+
+    size = 0;
+
+    while (true) {
+        if (buf.size() - size < DIRBUF_MIN_FREE) {
+            buf.resize(buf.size() * 2);
+        }
+
+        auto n = syscall(SYS_getdents64, fd, buf.data() + size,
+                         buf.size() - size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+
+        size += static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+void DirWalker::set_entry_path(Entry &entry, size_t name_offset)
+{
+    if (entry.fts_level == 0) {
+        entry.fts_path = _path.c_str();
+        entry.fts_name = _root_name.c_str();
+    } else {
+        entry.fts_path = _pathbuf.c_str();
+        entry.fts_name = _pathbuf.c_str() + name_offset;
+    }
+    entry.fts_accpath = entry.fts_path;
+}
+
+bool DirWalker::on_pre_execute()
+{
+    return true;
+}
+
+bool DirWalker::on_post_execute(bool success)
+{
+    (void) success;
+    return true;
+}
+
+DirWalker::Actions DirWalker::on_changed_path()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_directory_pre()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_directory_post()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_file()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_symlink()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_special_file()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_block_device()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_character_device()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_fifo()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_socket()
+{
+    return Action::Ok;
+}
+
+}
@@ -1531,6 +1531,12 @@ int __system_property_add(const char* name, unsigned int namelen, const char* va
 
 // Wait for non-locked serial, and retrieve it with acquire semantics.
 uint32_t __system_property_serial(const prop_info* pi) {
+#if MB_ENABLE_COMPAT_PROPERTIES
+  if (__predict_false(compat_mode)) {
+    return __system_property_serial_compat(pi);
+  }
+#endif
+
   uint32_t serial = load_const_atomic(&pi->serial, memory_order_acquire);
   while (SERIAL_DIRTY(serial)) {
     __futex_wait(const_cast<_Atomic(uint_least32_t)*>(&pi->serial), serial, nullptr);
@@ -19,51 +19,98 @@
 
 #include "mbutil/hash.h"
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 
-#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
 
 
 namespace mb::util
 {
 
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+// Read size for hashing. This is large enough to keep the number of syscalls
+// low without needing mmap(), which would turn a concurrent truncation into a
+// SIGBUS.
+static constexpr size_t HASH_BUF_SIZE = 1024 * 1024;
 
 /*!
- * \brief Compute SHA512 hash of a file
+ * \brief Compute SHA512 hash of a file range using the provided buffer
  *
- * \param path Path to file
+ * \param range File range
+ * \param buf Buffer of HASH_BUF_SIZE bytes
+ * \param cancelled Cancellation callback (checked before each read). May be
+ *                  empty.
  *
- * \return The digest on success or the error code on failure
+ * \return The digest on success, std::errc::operation_canceled if the
+ *         operation was cancelled, or the error code on failure. If the file
+ *         ends before the end of a range with a fixed size, the error is
+ *         std::errc::io_error.
  */
-oc::result<Sha512Digest> sha512_hash(const std::string &path)
+static oc::result<Sha512Digest> sha512_hash_range(const HashRange &range,
+                                                  unsigned char *buf,
+                                                  const HashCancelledFn &cancelled)
 {
-    ScopedFILE fp(fopen(path.c_str(), "rbe"), fclose);
-    if (!fp) {
+    int fd = open(range.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return ec_from_errno();
     }
 
-    std::array<unsigned char, 10240> buf;
-    size_t n;
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    bool to_eof = range.size == UINT64_MAX;
+
+    (void) posix_fadvise(fd, static_cast<off_t>(range.offset),
+                         to_eof ? 0 : static_cast<off_t>(range.size),
+                         POSIX_FADV_SEQUENTIAL);
 
     SHA512_CTX ctx;
     if (!SHA512_Init(&ctx)) {
         return std::errc::io_error;
     }
 
-    while ((n = fread(buf.data(), 1, buf.size(), fp.get())) > 0) {
-        if (!SHA512_Update(&ctx, buf.data(), n)) {
-            return std::errc::io_error;
+    uint64_t offset = range.offset;
+    uint64_t remain = range.size;
+
+    while (remain > 0) {
+        if (cancelled && cancelled()) {
+            return std::errc::operation_canceled;
         }
-        if (n < buf.size()) {
+
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(remain, HASH_BUF_SIZE));
+
+        ssize_t n = pread(fd, buf, to_read, static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            if (!to_eof) {
+                return std::errc::io_error;
+            }
             break;
         }
-    }
 
-    if (ferror(fp.get())) {
-        return ec_from_errno();
+        if (!SHA512_Update(&ctx, buf, static_cast<size_t>(n))) {
+            return std::errc::io_error;
+        }
+
+        offset += static_cast<uint64_t>(n);
+        if (!to_eof) {
+            remain -= static_cast<uint64_t>(n);
+        }
     }
 
     Sha512Digest digest;
@@ -75,4 +122,143 @@ oc::result<Sha512Digest> sha512_hash(const std::string &path)
     return std::move(digest);
 }
 
+/*!
+ * \brief Compute SHA512 hash of a file
+ *
+ * \param path Path to file
+ *
+ * \return The digest on success or the error code on failure
+ */
+oc::result<Sha512Digest> sha512_hash(const std::string &path)
+{
+    auto buf = std::make_unique<unsigned char[]>(HASH_BUF_SIZE);
+
+    return sha512_hash_range({path, 0, UINT64_MAX}, buf.get(), {});
+}
+
+/*!
+ * \brief Compute SHA512 hashes of multiple files concurrently
+ *
+ * This is equivalent to calling sha512_hash_ranges() with a range covering
+ * each whole file.
+ *
+ * \param paths Paths to files
+ * \param cancelled Optional cancellation callback (see sha512_hash_ranges())
+ * \param progress Optional progress callback (see sha512_hash_ranges())
+ *
+ * \return The digests, in the same order as \p paths, on success. If the
+ *         operation was cancelled, std::errc::operation_canceled. Otherwise,
+ *         the error code for the first path (in input order) that failed.
+ */
+oc::result<std::vector<Sha512Digest>>
+sha512_hash_files(const std::vector<std::string> &paths,
+                  const HashCancelledFn &cancelled,
+                  const HashProgressFn &progress)
+{
+    std::vector<HashRange> ranges;
+    ranges.reserve(paths.size());
+
+    for (auto const &path : paths) {
+        ranges.push_back({path, 0, UINT64_MAX});
+    }
+
+    return sha512_hash_ranges(ranges, cancelled, progress);
+}
+
+/*!
+ * \brief Compute SHA512 hashes of multiple file ranges concurrently
+ *
+ * The ranges are distributed among up to `std::thread::hardware_concurrency()`
+ * worker threads, so splitting a large file into several ranges allows it to
+ * be hashed in parallel. If any range fails to hash, the remaining work is
+ * abandoned.
+ *
+ * \param ranges File ranges
+ * \param cancelled Optional callback that returns true if the operation should
+ *                  be cancelled. It is called from the worker threads
+ *                  (potentially concurrently) before each read.
+ * \param progress Optional callback that is called after each range is hashed
+ *                 with the number of ranges completed and the total number of
+ *                 ranges. It is called from the worker threads, but never
+ *                 concurrently.
+ *
+ * \return The digests, in the same order as \p ranges, on success. If the
+ *         operation was cancelled, std::errc::operation_canceled. Otherwise,
+ *         the error code for the first range (in input order) that failed.
+ */
+oc::result<std::vector<Sha512Digest>>
+sha512_hash_ranges(const std::vector<HashRange> &ranges,
+                   const HashCancelledFn &cancelled,
+                   const HashProgressFn &progress)
+{
+    std::vector<Sha512Digest> digests(ranges.size());
+    std::vector<std::optional<std::error_code>> errors(ranges.size());
+
+    std::atomic<size_t> next{0};
+    std::atomic_bool failed{false};
+    std::mutex progress_mutex;
+    size_t done = 0;
+
+    auto is_cancelled = [&] {
+        return failed || (cancelled && cancelled());
+    };
+
+    auto worker = [&] {
+        auto buf = std::make_unique<unsigned char[]>(HASH_BUF_SIZE);
+
+        for (size_t i; (i = next++) < ranges.size();) {
+            if (auto r = sha512_hash_range(ranges[i], buf.get(),
+                                           is_cancelled)) {
+                digests[i] = r.value();
+            } else {
+                errors[i] = r.error();
+                failed = true;
+                break;
+            }
+
+            if (progress) {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                progress(++done, ranges.size());
+            }
+        }
+    };
+
+    size_t threads = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), ranges.size());
+
+    if (threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(worker);
+        }
+        for (auto &t : workers) {
+            t.join();
+        }
+    }
+
+    if (failed) {
+        // Report the user's cancellation over the cancellations caused by
+        // another range failing
+        std::optional<std::error_code> cancel_error;
+
+        for (auto const &error : errors) {
+            if (!error) {
+                continue;
+            } else if (*error != std::errc::operation_canceled) {
+                return *error;
+            } else if (!cancel_error) {
+                cancel_error = error;
+            }
+        }
+
+        return *cancel_error;
+    }
+
+    return std::move(digests);
+}
+
 }
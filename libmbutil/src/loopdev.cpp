@@ -19,9 +19,12 @@
 
 #include "mbutil/loopdev.h"
 
+#include <algorithm>
+#include <mutex>
 #include <vector>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -38,8 +41,11 @@
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
+#include "mblog/logging.h"
 #include "mbutil/string.h"
 
+#define LOG_TAG "mbutil/loopdev"
+
 
 // See https://lkml.org/lkml/2011/7/30/110
 
@@ -49,6 +55,33 @@
 
 #define MAX_LOOPDEVS    1024
 
+// Not defined in older kernel headers
+
+// Linux 4.4
+#ifndef LOOP_SET_DIRECT_IO
+#  define LOOP_SET_DIRECT_IO 0x4C08
+#endif
+#ifndef LO_FLAGS_DIRECT_IO
+#  define LO_FLAGS_DIRECT_IO 16
+#endif
+
+// Linux 4.14
+#ifndef LOOP_SET_BLOCK_SIZE
+#  define LOOP_SET_BLOCK_SIZE 0x4C09
+#endif
+
+// Linux 5.8
+#ifndef LOOP_CONFIGURE
+#  define LOOP_CONFIGURE 0x4C0A
+struct loop_config
+{
+    __u32 fd;
+    __u32 block_size;
+    struct loop_info64 info;
+    __u64 __reserved[8];
+};
+#endif
+
 
 namespace mb::util
 {
@@ -152,8 +185,177 @@ static oc::result<int> find_loopdev_by_scanning()
     return std::errc::no_such_file_or_directory;
 }
 
+/*!
+ * \brief Loop devices that were set up ahead of time by loopdev_pool_init()
+ *
+ * The pool only tracks the devices handed out by this process. Other processes
+ * may still claim a device, so each one is checked before it is returned.
+ */
+struct LoopDevicePool
+{
+    std::mutex mutex;
+    //! Free loop device numbers, with the lowest number at the end
+    std::vector<int> free;
+    //! Whether each loop device number is in \ref free
+    std::vector<bool> in_pool;
+};
+
+static LoopDevicePool g_pool;
+
+/*!
+ * \brief Check if a loop device is not attached to any file
+ *
+ * \return
+ *   * True if the loop device is free
+ *   * False if it is in use or is not a loop device
+ *   * The error code if the loop device could not be opened
+ */
+static oc::result<bool> is_loopdev_free(int n)
+{
+    char loopdev[64];
+    sprintf(loopdev, LOOP_FMT, n);
+
+    int fd = open(loopdev, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    loop_info64 loopinfo;
+    return ioctl(fd, LOOP_GET_STATUS64, &loopinfo) < 0 && errno == ENXIO;
+}
+
+/*!
+ * \brief Set up free loop devices ahead of time
+ *
+ * Starting from /dev/block/loop1, loop devices are created with LOOP_CTL_ADD
+ * (if /dev/loop-control exists) and their device nodes are created in
+ * /dev/block until \p count free devices have been found. These are added to
+ * a pool that loopdev_find_unused() takes devices from without searching.
+ * Devices released with loopdev_remove_device() are returned to the pool.
+ *
+ * /dev/block/loop0 is never part of the pool since some installers are
+ * hardcoded to use it.
+ *
+ * Calling this function again replaces the existing pool.
+ *
+ * \param count Number of free loop devices to set up
+ *
+ * \return Number of free loop devices in the pool. This is less than \p count
+ *         if the kernel does not have enough loop devices.
+ */
+size_t loopdev_pool_init(int count)
+{
+    int ctl_fd = open(LOOP_CONTROL, O_RDWR | O_CLOEXEC);
+
+    auto close_ctl_fd = finally([&] {
+        if (ctl_fd >= 0) {
+            close(ctl_fd);
+        }
+    });
+
+    std::vector<int> free;
+
+    for (int n = 1; n < MAX_LOOPDEVS
+            && free.size() < static_cast<size_t>(std::max(count, 0)); ++n) {
+        if (ctl_fd >= 0 && ioctl(ctl_fd, LOOP_CTL_ADD, n) < 0
+                && errno != EEXIST) {
+            LOGV("Failed to add loop device %d: %s", n, strerror(errno));
+        }
+
+        char loopdev[64];
+        sprintf(loopdev, LOOP_FMT, n);
+
+        if (mknod(loopdev, S_IFBLK | 0644,
+                  static_cast<dev_t>(makedev(7, n))) < 0 && errno != EEXIST) {
+            continue;
+        }
+
+        if (auto r = is_loopdev_free(n); !r) {
+            // Kernels without loop-control have a fixed number of devices
+            if (ctl_fd < 0
+                    && r.error() == std::errc::no_such_device_or_address) {
+                break;
+            }
+        } else if (r.value()) {
+            free.push_back(n);
+        }
+    }
+
+    // Hand out the lowest numbers first
+    std::reverse(free.begin(), free.end());
+
+    std::vector<bool> in_pool(free.empty()
+            ? 0 : static_cast<size_t>(free.front()) + 1);
+    for (int n : free) {
+        in_pool[static_cast<size_t>(n)] = true;
+    }
+
+    LOGD("Loop device pool has %zu/%d free devices", free.size(), count);
+
+    std::lock_guard lock(g_pool.mutex);
+    g_pool.free.swap(free);
+    g_pool.in_pool.swap(in_pool);
+
+    return g_pool.free.size();
+}
+
+/*!
+ * \brief Take a free loop device from the pool
+ *
+ * \return Loop device number or -1 if the pool has no free devices
+ */
+static int take_loopdev_from_pool()
+{
+    std::lock_guard lock(g_pool.mutex);
+
+    while (!g_pool.free.empty()) {
+        int n = g_pool.free.back();
+        g_pool.free.pop_back();
+        g_pool.in_pool[static_cast<size_t>(n)] = false;
+
+        if (auto r = is_loopdev_free(n); r && r.value()) {
+            return n;
+        }
+    }
+
+    return -1;
+}
+
+/*!
+ * \brief Return a loop device to the pool if it belongs to the pool
+ */
+static void return_loopdev_to_pool(int n)
+{
+    std::lock_guard lock(g_pool.mutex);
+
+    if (n > 0 && static_cast<size_t>(n) < g_pool.in_pool.size()
+            && !g_pool.in_pool[static_cast<size_t>(n)]) {
+        g_pool.free.push_back(n);
+        g_pool.in_pool[static_cast<size_t>(n)] = true;
+    }
+}
+
+/*!
+ * \brief Find an unused loop device
+ *
+ * If loopdev_pool_init() was called, the device is taken from the pool.
+ * Otherwise, or if the pool is exhausted, the kernel is asked for a free
+ * device via /dev/loop-control and, as a last resort, the loop devices are
+ * scanned one by one.
+ *
+ * \return Loop device path or the error code if no free loop device was
+ *         found
+ */
 oc::result<std::string> loopdev_find_unused()
 {
+    if (int pooled = take_loopdev_from_pool(); pooled > 0) {
+        return format(LOOP_FMT, pooled);
+    }
+
     auto n = find_loopdev_by_loop_control();
 
     // Also search by scanning if n == 0, since some installers hardcode
@@ -168,9 +370,58 @@ oc::result<std::string> loopdev_find_unused()
     return format(LOOP_FMT, n.value());
 }
 
+/*!
+ * \brief Set up loop device with LOOP_CONFIGURE
+ *
+ * \return
+ *   * True if the loop device was configured
+ *   * False if the kernel does not support LOOP_CONFIGURE
+ *   * The error code if the ioctl failed for any other reason
+ */
+static oc::result<bool> configure_loopdev(int lfd, int ffd,
+                                          const loop_info64 &loopinfo,
+                                          const LoopDeviceOptions &options)
+{
+    loop_config config = {};
+
+    config.fd = static_cast<__u32>(ffd);
+    config.block_size = options.block_size;
+    config.info = loopinfo;
+
+    if (ioctl(lfd, LOOP_CONFIGURE, &config) < 0) {
+        // Older kernels return EINVAL for unknown loop ioctls
+        if (errno == EINVAL || errno == ENOTTY) {
+            return false;
+        }
+        return ec_from_errno();
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Attach file to a loop device
+ *
+ * If the kernel supports it (Linux 5.8+), the loop device is configured with
+ * a single LOOP_CONFIGURE ioctl. Otherwise, it is set up with LOOP_SET_FD and
+ * LOOP_SET_STATUS64, followed by LOOP_SET_BLOCK_SIZE and LOOP_SET_DIRECT_IO if
+ * requested in \p options. Failure to apply \p options is not an error since
+ * older kernels do not support them and direct I/O may be unsupported by the
+ * backing filesystem.
+ *
+ * \param loopdev Loop device path
+ * \param file Backing file
+ * \param offset Offset of the data in \p file
+ * \param ro Whether to set up a read-only loop device
+ * \param options Block size and direct I/O options
+ *
+ * \return Nothing if the file was attached to the loop device. Otherwise, the
+ *         error code.
+ */
 oc::result<void> loopdev_set_up_device(const std::string &loopdev,
                                        const std::string &file,
-                                       uint64_t offset, bool ro)
+                                       uint64_t offset, bool ro,
+                                       const LoopDeviceOptions &options)
 {
     int ffd = open(file.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC);
     if (ffd < 0) {
@@ -196,6 +447,22 @@ oc::result<void> loopdev_set_up_device(const std::string &loopdev,
             LO_NAME_SIZE);
     loopinfo.lo_offset = offset;
 
+    {
+        loop_info64 config_info = loopinfo;
+        if (ro) {
+            config_info.lo_flags |= LO_FLAGS_READ_ONLY;
+        }
+        if (options.direct_io) {
+            config_info.lo_flags |= LO_FLAGS_DIRECT_IO;
+        }
+
+        OUTCOME_TRY(configured, configure_loopdev(lfd, ffd, config_info,
+                                                  options));
+        if (configured) {
+            return oc::success();
+        }
+    }
+
     if (ioctl(lfd, LOOP_SET_FD, ffd) < 0) {
         return ec_from_errno();
     }
@@ -206,6 +473,21 @@ oc::result<void> loopdev_set_up_device(const std::string &loopdev,
         return ec_from_errno(saved_errno);
     }
 
+    // The block size must be set first since direct I/O requires it to be at
+    // least the backing device's logical block size
+    if (options.block_size != 0
+            && ioctl(lfd, LOOP_SET_BLOCK_SIZE,
+                     static_cast<unsigned long>(options.block_size)) < 0) {
+        LOGW("%s: Failed to set block size to %" PRIu32 ": %s",
+             loopdev.c_str(), options.block_size, strerror(errno));
+    }
+
+    if (options.direct_io
+            && ioctl(lfd, LOOP_SET_DIRECT_IO, 1UL) < 0) {
+        LOGW("%s: Failed to enable direct I/O: %s",
+             loopdev.c_str(), strerror(errno));
+    }
+
     return oc::success();
 }
 
@@ -224,6 +506,12 @@ oc::result<void> loopdev_remove_device(const std::string &loopdev)
         return ec_from_errno();
     }
 
+    struct stat sb;
+    if (fstat(lfd, &sb) == 0 && S_ISBLK(sb.st_mode)
+            && major(sb.st_rdev) == 7) {
+        return_loopdev_to_pool(static_cast<int>(minor(sb.st_rdev)));
+    }
+
     return oc::success();
 }
 
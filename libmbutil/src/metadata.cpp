@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/metadata.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbutil/dir_walker.h"
+#include "mbutil/selinux.h"
+
+
+namespace mb::util
+{
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+/*!
+ * \brief Apply metadata to a single entry
+ *
+ * The ownership and mode are changed with *at() syscalls relative to the
+ * parent directory fd. The label is set on the directory fd if there is one.
+ * Otherwise, it is set by path since `fsetxattr()` cannot be used on symlinks.
+ * Ownership is changed first because it may clear the set-user-ID and
+ * set-group-ID bits.
+ *
+ * \param at_fd Parent directory fd (or AT_FDCWD)
+ * \param at_path Path relative to \p at_fd
+ * \param path Full path
+ * \param dir_fd fd of the entry if it is an open directory (or -1)
+ * \param is_symlink Whether the entry is a symlink
+ * \param metadata Metadata to apply
+ */
+static oc::result<void> apply_at(int at_fd, const char *at_path,
+                                 const char *path, int dir_fd,
+                                 bool is_symlink, const Metadata &metadata)
+{
+    if (metadata.uid || metadata.gid) {
+        if (fchownat(at_fd, at_path,
+                     metadata.uid ? *metadata.uid : static_cast<uid_t>(-1),
+                     metadata.gid ? *metadata.gid : static_cast<gid_t>(-1),
+                     AT_SYMLINK_NOFOLLOW) < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    if (metadata.mode && !is_symlink) {
+        if (fchmodat(at_fd, at_path, *metadata.mode, 0) < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    if (metadata.context) {
+        if (dir_fd >= 0) {
+            OUTCOME_TRYV(selinux_fset_context(dir_fd, *metadata.context));
+        } else {
+            OUTCOME_TRYV(selinux_lset_context(path, *metadata.context));
+        }
+    }
+
+    return oc::success();
+}
+
+class MetadataWalker : public DirWalker
+{
+public:
+    std::error_code ec;
+
+    MetadataWalker(std::string path, const Metadata &metadata)
+        : DirWalker(std::move(path), DirWalkerFlag::GroupSpecialFiles
+                                   | DirWalkerFlag::SkipStat)
+        , _metadata(metadata)
+    {
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        // Do nothing. Need depth-first search in case the new mode removes
+        // search permission.
+        return Action::Ok;
+    }
+
+    Actions on_reached_directory_post() override
+    {
+        return apply(false) ? Action::Ok : Action::Fail;
+    }
+
+    Actions on_reached_file() override
+    {
+        return apply(false) ? Action::Ok : Action::Fail;
+    }
+
+    Actions on_reached_symlink() override
+    {
+        return apply(true) ? Action::Ok : Action::Fail;
+    }
+
+    Actions on_reached_special_file() override
+    {
+        return apply(false) ? Action::Ok : Action::Fail;
+    }
+
+private:
+    const Metadata &_metadata;
+
+    bool apply(bool is_symlink)
+    {
+        if (auto r = apply_at(_curr->at_fd, _curr->at_path,
+                              _curr->fts_accpath, _curr->dir_fd, is_symlink,
+                              _metadata); !r) {
+            ec = r.error();
+            return false;
+        }
+        return true;
+    }
+};
+
+static oc::result<void> apply_recursive(const std::string &path,
+                                        const Metadata &metadata)
+{
+    MetadataWalker walker(path, metadata);
+    if (!walker.run()) {
+        // Traversal errors are not reported through ec
+        return walker.ec ? walker.ec : ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Apply metadata to each top-level subtree on a separate thread
+ *
+ * Top-level subdirectories on other filesystems are not descended into, same
+ * as in the single-threaded walk.
+ */
+static oc::result<void> apply_parallel(const std::string &path,
+                                       const Metadata &metadata)
+{
+    int fd = open(path.c_str(),
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOTDIR || errno == ELOOP) {
+            // Not a directory, so there's nothing to parallelize
+            return apply_recursive(path, metadata);
+        }
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    std::vector<std::string> names;
+
+    {
+        int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (dup_fd < 0) {
+            return ec_from_errno();
+        }
+
+        ScopedDIR dp(fdopendir(dup_fd), closedir);
+        if (!dp) {
+            int saved_errno = errno;
+            close(dup_fd);
+            return ec_from_errno(saved_errno);
+        }
+
+        errno = 0;
+        while (auto *ent = readdir(dp.get())) {
+            if (strcmp(ent->d_name, ".") != 0
+                    && strcmp(ent->d_name, "..") != 0) {
+                names.emplace_back(ent->d_name);
+            }
+            errno = 0;
+        }
+        if (errno) {
+            return ec_from_errno();
+        }
+    }
+
+    std::vector<std::error_code> errors(names.size());
+    std::atomic<size_t> next{0};
+
+    auto worker = [&] {
+        std::string child_path;
+
+        for (size_t i; (i = next++) < names.size();) {
+            child_path = path;
+            if (child_path.empty() || child_path.back() != '/') {
+                child_path += '/';
+            }
+            child_path += names[i];
+
+            struct stat child_sb;
+            oc::result<void> r = oc::success();
+
+            if (fstatat(fd, names[i].c_str(), &child_sb,
+                        AT_SYMLINK_NOFOLLOW) < 0) {
+                r = ec_from_errno();
+            } else if (S_ISDIR(child_sb.st_mode)
+                    && child_sb.st_dev != sb.st_dev) {
+                r = apply_at(fd, names[i].c_str(), child_path.c_str(), -1,
+                             false, metadata);
+            } else {
+                r = apply_recursive(child_path, metadata);
+            }
+
+            if (!r) {
+                errors[i] = r.error();
+            }
+        }
+    };
+
+    size_t threads = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), names.size());
+
+    if (threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(worker);
+        }
+        for (auto &t : workers) {
+            t.join();
+        }
+    }
+
+    for (auto const &ec : errors) {
+        if (ec) {
+            return ec;
+        }
+    }
+
+    // The root is done last, same as in the single-threaded walk
+    return apply_at(AT_FDCWD, path.c_str(), path.c_str(), fd, false,
+                    metadata);
+}
+
+/*!
+ * \brief Change ownership, mode, and SELinux label in a single pass
+ *
+ * This is equivalent to running chown(), chmod() and
+ * selinux_lset_context_recursive() (or their non-recursive variants) on
+ * \p path, except that the tree is only traversed once and the syscalls are
+ * relative to the parent directory's fd. Unset fields in \p metadata are left
+ * unchanged. Symlinks are never followed and mount points are not crossed.
+ *
+ * \param path Path to file or directory
+ * \param metadata Metadata to apply
+ * \param flags \ref MetadataFlag::Recursive to apply to the whole tree and
+ *              \ref MetadataFlag::Parallel to do so with multiple threads
+ *
+ * \return Nothing on success or the first error encountered
+ */
+oc::result<void> apply_metadata(const std::string &path,
+                                const Metadata &metadata,
+                                MetadataFlags flags)
+{
+    if (flags & MetadataFlag::Parallel) {
+        return apply_parallel(path, metadata);
+    } else if (flags & MetadataFlag::Recursive) {
+        return apply_recursive(path, metadata);
+    }
+
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    return apply_at(AT_FDCWD, path.c_str(), path.c_str(), -1,
+                    S_ISLNK(sb.st_mode), metadata);
+}
+
+}
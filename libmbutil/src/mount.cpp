@@ -28,6 +28,8 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
@@ -116,8 +118,8 @@ static std::string unescape_octals(std::string_view in)
 static void strip_deleted_suffix(std::string &path)
 {
     struct stat sb;
-    if (lstat(path.c_str(), &sb) < 0 && errno == ENOENT
-            && ends_with(path, DELETED_SUFFIX)) {
+    if (ends_with(path, DELETED_SUFFIX)
+            && lstat(path.c_str(), &sb) < 0 && errno == ENOENT) {
         path.erase(path.size() - DELETED_SUFFIX.size());
     }
 }
@@ -156,7 +158,125 @@ split_options(std::string_view options)
     return {join(vfs_list, ','), join(fs_list, ',')};
 }
 
-oc::result<std::vector<MountEntry>> get_mount_entries()
+static oc::result<void> parse_mountinfo_line(char *line, MountEntry &entry)
+{
+    unsigned int id;
+    unsigned int parent;
+    unsigned int dev_maj, dev_min;
+    int root_begin, root_end;
+    int target_begin, target_end;
+    int vfs_opts_begin, vfs_opts_end;
+    int type_begin, type_end;
+    int source_begin, source_end;
+    int fs_opts_begin, fs_opts_end;
+    int count;
+
+    count = std::sscanf(line,
+                        "%u "      // [1] ID
+                        "%u "      // [2] Parent
+                        "%u:%u "   // [3] Device major:minor
+                        "%n%*s%n " // [4] Bind mount root
+                        "%n%*s%n " // [5] Mount point
+                        "%n%*s%n", // [6] VFS options
+                        &id,
+                        &parent,
+                        &dev_maj, &dev_min,
+                        &root_begin, &root_end,
+                        &target_begin, &target_end,
+                        &vfs_opts_begin, &vfs_opts_end);
+    if (count != 4) {
+        return std::errc::invalid_argument;
+    }
+
+    // [7] Skip over optional fields
+    char *dash = strstr(line + target_end, " - ");
+    if (!dash) {
+        return std::errc::invalid_argument;
+    }
+
+    count = sscanf(dash, " - "
+                         "%n%*s%n " // [8] FS type
+                         "%n%*s%n " // [9] Source device
+                         "%n%*s%n", // [10] FS options
+                         &type_begin, &type_end,
+                         &source_begin, &source_end,
+                         &fs_opts_begin, &fs_opts_end);
+    if (count != 0) {
+        return std::errc::invalid_argument;
+    }
+
+    // NULL terminate entries
+    line[root_end] = '\0';
+    line[target_end] = '\0';
+    line[vfs_opts_end] = '\0';
+    dash[type_end] = '\0';
+    dash[source_end] = '\0';
+    dash[fs_opts_end] = '\0';
+
+    entry.id = id;
+    entry.parent = parent;
+    entry.dev = makedev(dev_maj, dev_min);
+    entry.root = unescape_octals(line + root_begin);
+    entry.target = unescape_octals(line + target_begin);
+    entry.vfs_options = unescape_octals(line + vfs_opts_begin);
+    entry.type = unescape_octals(dash + type_begin);
+    entry.source = unescape_octals(dash + source_begin);
+    entry.fs_options = unescape_octals(dash + fs_opts_begin);
+
+    strip_deleted_suffix(entry.target);
+    remove_duplicate_options(entry.vfs_options, entry.fs_options);
+
+    return oc::success();
+}
+
+static oc::result<void> parse_mounts_line(char *line, MountEntry &entry)
+{
+    int source_begin, source_end;
+    int target_begin, target_end;
+    int type_begin, type_end;
+    int opts_begin, opts_end;
+    int freq;
+    int passno;
+    int count;
+
+    count = std::sscanf(line,
+                        "%n%*s%n " // [1] Source device
+                        "%n%*s%n " // [2] Mount point
+                        "%n%*s%n " // [3] FS type
+                        "%n%*s%n " // [4] Options
+                        "%d "      // [5] Dump frequency in days
+                        "%d",      // [6] Parallel fsck pass number
+                        &source_begin, &source_end,
+                        &target_begin, &target_end,
+                        &type_begin, &type_end,
+                        &opts_begin, &opts_end,
+                        &freq,
+                        &passno);
+    if (count != 2) {
+        return std::errc::invalid_argument;
+    }
+
+    // NULL terminate entries
+    line[source_end] = '\0';
+    line[target_end] = '\0';
+    line[type_end] = '\0';
+    line[opts_end] = '\0';
+
+    entry.source = unescape_octals(line + source_begin);
+    entry.target = unescape_octals(line + target_begin);
+    entry.type = unescape_octals(line + type_begin);
+    std::tie(entry.vfs_options, entry.fs_options) =
+            split_options(unescape_octals(line + opts_begin));
+    entry.freq = freq;
+    entry.passno = passno;
+
+    strip_deleted_suffix(entry.target);
+
+    return oc::success();
+}
+
+static oc::result<std::vector<MountEntry>>
+read_mount_entries(FILE *fp, bool mountinfo)
 {
     std::vector<MountEntry> entries;
 
@@ -167,155 +287,259 @@ oc::result<std::vector<MountEntry>> get_mount_entries()
         free(line);
     });
 
-    {
-        ScopedFILE fp(fopen(PROC_MOUNTINFO, "re"), fclose);
-        if (fp) {
-            while (getline(&line, &len, fp.get()) != -1) {
-                MountEntry &entry = entries.emplace_back();
-
-                unsigned int id;
-                unsigned int parent;
-                unsigned int dev_maj, dev_min;
-                int root_begin, root_end;
-                int target_begin, target_end;
-                int vfs_opts_begin, vfs_opts_end;
-                int type_begin, type_end;
-                int source_begin, source_end;
-                int fs_opts_begin, fs_opts_end;
-                int count;
-
-                count = std::sscanf(line,
-                                    "%u "      // [1] ID
-                                    "%u "      // [2] Parent
-                                    "%u:%u "   // [3] Device major:minor
-                                    "%n%*s%n " // [4] Bind mount root
-                                    "%n%*s%n " // [5] Mount point
-                                    "%n%*s%n", // [6] VFS options
-                                    &id,
-                                    &parent,
-                                    &dev_maj, &dev_min,
-                                    &root_begin, &root_end,
-                                    &target_begin, &target_end,
-                                    &vfs_opts_begin, &vfs_opts_end);
-                if (count != 4) {
-                    return std::errc::invalid_argument;
-                }
+    while (getline(&line, &len, fp) != -1) {
+        MountEntry &entry = entries.emplace_back();
 
-                // [7] Skip over optional fields
-                char *dash = strstr(line + target_end, " - ");
-                if (!dash) {
-                    return std::errc::invalid_argument;
-                }
+        if (mountinfo) {
+            OUTCOME_TRYV(parse_mountinfo_line(line, entry));
+        } else {
+            OUTCOME_TRYV(parse_mounts_line(line, entry));
+        }
+    }
 
-                count = sscanf(dash, " - "
-                                     "%n%*s%n " // [8] FS type
-                                     "%n%*s%n " // [9] Source device
-                                     "%n%*s%n", // [10] FS options
-                                     &type_begin, &type_end,
-                                     &source_begin, &source_end,
-                                     &fs_opts_begin, &fs_opts_end);
-                if (count != 0) {
-                    return std::errc::invalid_argument;
-                }
+    if (ferror(fp)) {
+        return ec_from_errno();
+    }
 
-                // NULL terminate entries
-                line[root_end] = '\0';
-                line[target_end] = '\0';
-                line[vfs_opts_end] = '\0';
-                dash[type_end] = '\0';
-                dash[source_end] = '\0';
-                dash[fs_opts_end] = '\0';
-
-                entry.id = id;
-                entry.parent = parent;
-                entry.dev = makedev(dev_maj, dev_min);
-                entry.root = unescape_octals(line + root_begin);
-                entry.target = unescape_octals(line + target_begin);
-                entry.vfs_options = unescape_octals(line + vfs_opts_begin);
-                entry.type = unescape_octals(dash + type_begin);
-                entry.source = unescape_octals(dash + source_begin);
-                entry.fs_options = unescape_octals(dash + fs_opts_begin);
-
-                strip_deleted_suffix(entry.target);
-                remove_duplicate_options(entry.vfs_options, entry.fs_options);
-            }
+    return std::move(entries);
+}
 
-            if (ferror(fp.get())) {
+oc::result<std::vector<MountEntry>> get_mount_entries()
+{
+    if (ScopedFILE fp(fopen(PROC_MOUNTINFO, "re"), fclose); fp) {
+        return read_mount_entries(fp.get(), true);
+    }
+
+    if (ScopedFILE fp(fopen(PROC_MOUNTS, "re"), fclose); fp) {
+        return read_mount_entries(fp.get(), false);
+    }
+
+    // fopen failed
+    return ec_from_errno();
+}
+
+/*!
+ * \class MountTable
+ *
+ * \brief Cached snapshot of the mount table
+ *
+ * This keeps `/proc/self/mountinfo` (or `/proc/mounts` if unavailable) open
+ * and only reparses it when `poll()` reports that the mount table changed
+ * since the last read. Entries are indexed by mount point for fast lookups.
+ *
+ * The file descriptor refers to the mount namespace of the process at the
+ * time of the first refresh(), so a table should not outlive an `unshare()`.
+ * This class is not thread safe.
+ */
+
+MountTable::MountTable()
+    : _fd(-1)
+    , _mountinfo(false)
+    , _loaded(false)
+{
+}
+
+MountTable::~MountTable()
+{
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+/*!
+ * \brief Update snapshot if the mount table changed
+ *
+ * \return
+ *   * True if the mount table was (re)loaded
+ *   * False if the mount table has not changed since the last refresh
+ *   * The error code if the mount table could not be read. The previous
+ *     snapshot is kept, but the next call will always reread the table.
+ */
+oc::result<bool> MountTable::refresh()
+{
+    if (_fd < 0) {
+        _fd = open(PROC_MOUNTINFO, O_RDONLY | O_CLOEXEC);
+        _mountinfo = _fd >= 0;
+
+        if (_fd < 0) {
+            _fd = open(PROC_MOUNTS, O_RDONLY | O_CLOEXEC);
+            if (_fd < 0) {
                 return ec_from_errno();
             }
+        }
+    } else if (_loaded) {
+        // The kernel reports POLLERR | POLLPRI when the mount namespace's
+        // event counter differs from the one last seen by this fd
+        pollfd pfd = {_fd, POLLPRI, 0};
+        int n;
 
-            return std::move(entries);
+        do {
+            n = poll(&pfd, 1, 0);
+        } while (n < 0 && errno == EINTR);
+
+        if (n < 0) {
+            return ec_from_errno();
+        } else if (!(pfd.revents & (POLLERR | POLLPRI))) {
+            return false;
         }
     }
 
-    {
-        ScopedFILE fp(fopen(PROC_MOUNTS, "re"), fclose);
-        if (fp) {
-            while (getline(&line, &len, fp.get()) != -1) {
-                MountEntry &entry = entries.emplace_back();
-
-                int source_begin, source_end;
-                int target_begin, target_end;
-                int type_begin, type_end;
-                int opts_begin, opts_end;
-                int freq;
-                int passno;
-                int count;
-
-                count = std::sscanf(line,
-                                    "%n%*s%n " // [1] Source device
-                                    "%n%*s%n " // [2] Mount point
-                                    "%n%*s%n " // [3] FS type
-                                    "%n%*s%n " // [4] Options
-                                    "%d "      // [5] Dump frequency in days
-                                    "%d",      // [6] Parallel fsck pass number
-                                    &source_begin, &source_end,
-                                    &target_begin, &target_end,
-                                    &type_begin, &type_end,
-                                    &opts_begin, &opts_end,
-                                    &freq,
-                                    &passno);
-                if (count != 2) {
-                    return std::errc::invalid_argument;
-                }
+    // Make sure the next refresh() retries if this one fails
+    _loaded = false;
 
-                // NULL terminate entries
-                line[source_end] = '\0';
-                line[target_end] = '\0';
-                line[type_end] = '\0';
-                line[opts_end] = '\0';
-
-                entry.source = unescape_octals(line + source_begin);
-                entry.target = unescape_octals(line + target_begin);
-                entry.type = unescape_octals(line + type_begin);
-                std::tie(entry.vfs_options, entry.fs_options) =
-                        split_options(unescape_octals(line + opts_begin));
-                entry.freq = freq;
-                entry.passno = passno;
-
-                strip_deleted_suffix(entry.target);
-            }
+    if (lseek(_fd, 0, SEEK_SET) < 0) {
+        return ec_from_errno();
+    }
 
-            if (ferror(fp.get())) {
-                return ec_from_errno();
+    // Read everything at once so the snapshot is as consistent as procfs
+    // allows
+    std::string buf;
+    size_t size = 0;
+
+    while (true) {
+        if (buf.size() - size < 4096) {
+            buf.resize(std::max<size_t>(buf.size() * 2, 16384));
+        }
+
+        ssize_t n = read(_fd, buf.data() + size, buf.size() - size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
+        }
 
-            return std::move(entries);
+        size += static_cast<size_t>(n);
+    }
+
+    buf.resize(size);
+
+    std::vector<MountEntry> entries;
+
+    for (size_t begin = 0; begin < buf.size();) {
+        auto end = buf.find('\n', begin);
+        if (end == std::string::npos) {
+            end = buf.size();
+        } else {
+            buf[end] = '\0';
         }
+
+        char *line = buf.data() + begin;
+        MountEntry &entry = entries.emplace_back();
+
+        if (_mountinfo) {
+            OUTCOME_TRYV(parse_mountinfo_line(line, entry));
+        } else {
+            OUTCOME_TRYV(parse_mounts_line(line, entry));
+        }
+
+        begin = end + 1;
     }
 
-    // fopen failed
-    return ec_from_errno();
+    _entries = std::move(entries);
+
+    _by_target.resize(_entries.size());
+    for (size_t i = 0; i < _by_target.size(); ++i) {
+        _by_target[i] = i;
+    }
+    std::stable_sort(_by_target.begin(), _by_target.end(),
+                     [&](size_t a, size_t b) {
+        return _entries[a].target < _entries[b].target;
+    });
+
+    _loaded = true;
+
+    return true;
+}
+
+/*!
+ * \brief Get all entries in mount order
+ */
+const std::vector<MountEntry> & MountTable::entries() const
+{
+    return _entries;
+}
+
+/*!
+ * \brief Find entry for a mount point
+ *
+ * \param target Mount point (exact string compare)
+ *
+ * \return The most recent (ie. visible) mount at \p target or nullptr if
+ *         \p target is not a mount point
+ */
+const MountEntry * MountTable::find(std::string_view target) const
+{
+    auto it = std::upper_bound(_by_target.begin(), _by_target.end(), target,
+                               [&](std::string_view t, size_t i) {
+        return t < _entries[i].target;
+    });
+
+    if (it != _by_target.begin() && _entries[*(it - 1)].target == target) {
+        return &_entries[*(it - 1)];
+    }
+
+    return nullptr;
+}
+
+/*!
+ * \brief Find entries whose mount point starts with a prefix
+ *
+ * \param prefix Mount point prefix (plain string prefix match)
+ *
+ * \return Matching entries in mount order
+ */
+std::vector<const MountEntry *>
+MountTable::find_prefix(std::string_view prefix) const
+{
+    auto it = std::lower_bound(_by_target.begin(), _by_target.end(), prefix,
+                               [&](size_t i, std::string_view p) {
+        return _entries[i].target < p;
+    });
+
+    std::vector<size_t> indexes;
+
+    for (; it != _by_target.end() && starts_with(_entries[*it].target, prefix);
+            ++it) {
+        indexes.push_back(*it);
+    }
+
+    std::sort(indexes.begin(), indexes.end());
+
+    std::vector<const MountEntry *> result;
+    result.reserve(indexes.size());
+
+    for (auto i : indexes) {
+        result.push_back(&_entries[i]);
+    }
+
+    return result;
 }
 
 oc::result<void> is_mounted(const std::string &mountpoint)
 {
-    OUTCOME_TRY(entries, get_mount_entries());
+    MountTable table;
+    return is_mounted(mountpoint, table);
+}
 
-    for (auto const &entry : entries) {
-        if (entry.target == mountpoint) {
-            return oc::success();
-        }
+/*!
+ * \brief Check if a path is a mount point
+ *
+ * \param mountpoint Mount point (exact string compare)
+ * \param table Mount table to refresh and search
+ *
+ * \return Nothing if \p mountpoint is mounted, MountError::PathNotMounted if it
+ *         is not mounted, or the error code if the mount table could not be
+ *         read
+ */
+oc::result<void> is_mounted(const std::string &mountpoint, MountTable &table)
+{
+    OUTCOME_TRYV(table.refresh());
+
+    if (table.find(mountpoint)) {
+        return oc::success();
     }
 
     return MountError::PathNotMounted;
@@ -323,6 +547,7 @@ oc::result<void> is_mounted(const std::string &mountpoint)
 
 oc::result<void> unmount_all(const std::string &dir)
 {
+    MountTable table;
     std::vector<std::string> to_unmount;
     int failed = 0;
     std::error_code ec;
@@ -332,20 +557,19 @@ oc::result<void> unmount_all(const std::string &dir)
         to_unmount.clear();
         ec.clear();
 
-        OUTCOME_TRY(entries, get_mount_entries());
+        // Only reparsed if something was unmounted by the previous try
+        OUTCOME_TRYV(table.refresh());
 
-        for (auto const &entry : entries) {
-            // TODO: Use path_compare() instead of dumb string prefix matching
-            if (starts_with(entry.target, dir)) {
-                to_unmount.push_back(std::move(entry.target));
-            }
+        // TODO: Use path_compare() instead of dumb string prefix matching
+        for (auto const *entry : table.find_prefix(dir)) {
+            to_unmount.push_back(entry->target);
         }
 
         // Unmount in reverse order
         for (auto it = to_unmount.rbegin(); it != to_unmount.rend(); ++it) {
             LOGD("Attempting to unmount %s", it->c_str());
 
-            if (auto ret = umount(*it); !ret) {
+            if (auto ret = umount(*it, table); !ret) {
                 LOGW("%s: Failed to unmount: %s",
                      it->c_str(), ret.error().message().c_str());
                 ++failed;
@@ -380,6 +604,7 @@ oc::result<void> unmount_all(const std::string &dir)
  * \param fstype See man mount(2)
  * \param mount_flags See man mount(2)
  * \param data See man mount(2)
+ * \param loop_options Options for the loop device if one is needed
  *
  * \return Nothing if mount(2) is successful. The error code if mount(2) is
  *         unsuccessful or the loopdev could not be created or be associated
@@ -387,7 +612,8 @@ oc::result<void> unmount_all(const std::string &dir)
  */
 oc::result<void> mount(const std::string &source, const std::string &target,
                        const std::string &fstype, unsigned long mount_flags,
-                       const std::string &data)
+                       const std::string &data,
+                       const LoopDeviceOptions &loop_options)
 {
     bool need_loopdev = false;
     struct stat sb;
@@ -416,7 +642,8 @@ oc::result<void> mount(const std::string &source, const std::string &target,
     if (need_loopdev) {
         OUTCOME_TRY(loopdev, loopdev_find_unused());
         OUTCOME_TRYV(loopdev_set_up_device(loopdev, source, 0,
-                                           mount_flags & MS_RDONLY));
+                                           mount_flags & MS_RDONLY,
+                                           loop_options));
 
         if (::mount(loopdev.c_str(), target.c_str(), fstype_real.c_str(),
                     mount_flags, data.c_str()) < 0) {
@@ -452,19 +679,34 @@ oc::result<void> mount(const std::string &source, const std::string &target,
  * \return Nothing if umount(2) is successful. Otherwise, the error code.
  */
 oc::result<void> umount(const std::string &target)
+{
+    MountTable table;
+
+    if (auto r = table.refresh(); !r) {
+        LOGW("Failed to get mount entries: %s", r.error().message().c_str());
+    }
+
+    return umount(target, table);
+}
+
+/*!
+ * \brief Unmount filesystem using a mount table snapshot
+ *
+ * Same as umount(const std::string &), except the source device is looked up
+ * in \p table without refreshing it. This allows unmounting many mount points
+ * without reparsing the mount table after each one.
+ *
+ * \param target See `man umount(2)`
+ * \param table Mount table snapshot
+ *
+ * \return Nothing if umount(2) is successful. Otherwise, the error code.
+ */
+oc::result<void> umount(const std::string &target, const MountTable &table)
 {
     std::string source;
-    std::string mnt_dir;
 
-    if (auto entries = get_mount_entries()) {
-        for (auto const &entry : entries.value()) {
-            if (entry.target == target) {
-                source = entry.source;
-            }
-        }
-    } else {
-        LOGW("Failed to get mount entries: %s",
-             entries.error().message().c_str());
+    if (auto entry = table.find(target)) {
+        source = entry->source;
     }
 
     oc::result<void> ret = oc::success();
@@ -19,6 +19,7 @@
 
 #include "mbutil/path.h"
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
 #include <vector>
@@ -26,13 +27,14 @@
 #include <cerrno>
 #include <climits>
 #include <cstdlib>
-#include <cstring>
 
-#include <libgen.h>
+#include <poll.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
 
 
 namespace mb::util
@@ -48,14 +50,75 @@ oc::result<std::string> get_cwd()
     return cwd.get();
 }
 
-std::string dir_name(std::string path)
+/*!
+ * \brief Get the parent directory of a path without allocating
+ *
+ * This has the same semantics as POSIX dirname(): trailing slashes are
+ * ignored, "." is returned for paths without a directory component, and "/" is
+ * returned for the root directory.
+ *
+ * \return View into \p path or a static string
+ */
+std::string_view dir_name_sv(std::string_view path)
 {
-    return dirname(path.data());
+    auto end = path.find_last_not_of('/');
+    if (end == std::string_view::npos) {
+        return path.empty() ? "." : "/";
+    }
+
+    auto slash = path.rfind('/', end);
+    if (slash == std::string_view::npos) {
+        return ".";
+    }
+
+    auto parent_end = path.find_last_not_of('/', slash);
+    if (parent_end == std::string_view::npos) {
+        return "/";
+    }
+
+    return path.substr(0, parent_end + 1);
 }
 
-std::string base_name(std::string path)
+/*!
+ * \brief Get the last component of a path without allocating
+ *
+ * This has the same semantics as POSIX basename(): trailing slashes are
+ * ignored, "." is returned for an empty path, and "/" is returned for the root
+ * directory.
+ *
+ * \return View into \p path or a static string
+ */
+std::string_view base_name_sv(std::string_view path)
 {
-    return basename(path.data());
+    auto end = path.find_last_not_of('/');
+    if (end == std::string_view::npos) {
+        return path.empty() ? "." : "/";
+    }
+
+    auto slash = path.rfind('/', end);
+    auto start = slash == std::string_view::npos ? 0 : slash + 1;
+
+    return path.substr(start, end + 1 - start);
+}
+
+/*!
+ * \brief Get the parent directory of a path
+ *
+ * \sa dir_name_sv()
+ */
+std::string dir_name(std::string_view path)
+{
+    return std::string(dir_name_sv(path));
+}
+
+/*!
+ * \brief Get the last component of a path
+ *
+ * \sa base_name_sv()
+ */
+std::string base_name(std::string_view path)
+{
+    return std::string(base_name_sv(path));
 }
 
 oc::result<std::string> read_link(const std::string &path)
@@ -115,44 +178,61 @@ oc::result<std::string> real_path(const std::string &path)
  */
 std::vector<std::string> path_split(std::string path)
 {
-    char *p;
-    char *save_ptr;
+    auto pieces = path_split_sv(path);
+    return {pieces.begin(), pieces.end()};
+}
 
-    std::vector<std::string> split;
+/*!
+ * \brief Split a path into pieces without copying them
+ *
+ * This is the same as path_split(), except that the pieces are views into
+ * \p path.
+ *
+ * \param path Path to split
+ *
+ * \return Split pieces of the path
+ */
+std::vector<std::string_view> path_split_sv(std::string_view path)
+{
+    std::vector<std::string_view> split;
 
     // For absolute paths
     if (!path.empty() && path[0] == '/') {
-        split.push_back(std::string());
+        split.emplace_back();
     }
 
-    p = strtok_r(path.data(), "/", &save_ptr);
-    while (p != nullptr) {
-        // Ignore useless references to '.' in the path
-        if (strcmp(p, ".") != 0) {
-            split.push_back(p);
+    size_t begin = 0;
+
+    while (begin < path.size()) {
+        auto end = path.find('/', begin);
+        if (end == std::string_view::npos) {
+            end = path.size();
         }
-        p = strtok_r(nullptr, "/", &save_ptr);
+
+        auto piece = path.substr(begin, end - begin);
+
+        // Ignore empty pieces and useless references to '.' in the path
+        if (!piece.empty() && piece != ".") {
+            split.push_back(piece);
+        }
+
+        begin = end + 1;
     }
 
     return split;
 }
 
-/*!
- * \brief Join path pieces into a path
- *
- * This function simply joins each piece with the directory separator character.
- * If the first piece is empty, then the path is treated as an absolute path and
- * a directory separator character will be placed at the beginning of the
- * resulting path. If the pieces contain only a single empty piece, then the
- * root directory '/' is returned.
- *
- * \param components Path pieces to join
- *
- * \return Joined path
- */
-std::string path_join(const std::vector<std::string> &components)
+template<typename T>
+static std::string path_join_impl(const std::vector<T> &components)
 {
+    size_t size = 0;
+    for (auto const &piece : components) {
+        size += piece.size() + 1;
+    }
+
     std::string path;
+    path.reserve(size);
+
     for (auto it = components.begin(); it != components.end(); ++it) {
         if (it->empty()) {
             path += "/";
@@ -167,25 +247,37 @@ std::string path_join(const std::vector<std::string> &components)
 }
 
 /*!
- * \brief Normalize path to remove '..' pieces
+ * \brief Join path pieces into a path
  *
- * This function will remove a '..' piece if any of the following conditions are
- * met:
- * - If the previous piece is the root directory '/', only the '..' piece is
- *   removed as '..' is meaning less for the root directory (ie. '/' == '/..')
- * - If the previous piece is not '..', then remove both the previous
- *   piece and the '..' (eg. 'a/b/..' -> 'a')
+ * This function simply joins each piece with the directory separator character.
+ * If the first piece is empty, then the path is treated as an absolute path and
+ * a directory separator character will be placed at the beginning of the
+ * resulting path. If the pieces contain only a single empty piece, then the
+ * root directory '/' is returned.
  *
- * \note This function will not treat '.' pieces specially as they should have
- *       been stripped out by path_split(). If the path pieces are manually
- *       created, take care to not add '.'. Otherwise, the result will be
- *       incorrect. For example, '/usr/bin/./..' will become '/usr/bin'.
+ * \param components Path pieces to join
  *
- * \param components Reference to list of path pieces
+ * \return Joined path
  */
-void normalize_path(std::vector<std::string> &components)
+std::string path_join(const std::vector<std::string> &components)
 {
-    std::vector<std::string>::iterator prev_it;
+    return path_join_impl(components);
+}
+
+/*!
+ * \brief Join path pieces into a path
+ *
+ * \sa path_join(const std::vector<std::string> &)
+ */
+std::string path_join(const std::vector<std::string_view> &components)
+{
+    return path_join_impl(components);
+}
+
+template<typename T>
+static void normalize_path_impl(std::vector<T> &components)
+{
+    typename std::vector<T>::iterator prev_it;
 
     for (auto it = components.begin(); it != components.end();) {
         if (it != components.begin()) {
@@ -211,6 +303,38 @@ void normalize_path(std::vector<std::string> &components)
     }
 }
 
+/*!
+ * \brief Normalize path to remove '..' pieces
+ *
+ * This function will remove a '..' piece if any of the following conditions are
+ * met:
+ * - If the previous piece is the root directory '/', only the '..' piece is
+ *   removed as '..' is meaning less for the root directory (ie. '/' == '/..')
+ * - If the previous piece is not '..', then remove both the previous
+ *   piece and the '..' (eg. 'a/b/..' -> 'a')
+ *
+ * \note This function will not treat '.' pieces specially as they should have
+ *       been stripped out by path_split(). If the path pieces are manually
+ *       created, take care to not add '.'. Otherwise, the result will be
+ *       incorrect. For example, '/usr/bin/./..' will become '/usr/bin'.
+ *
+ * \param components Reference to list of path pieces
+ */
+void normalize_path(std::vector<std::string> &components)
+{
+    normalize_path_impl(components);
+}
+
+/*!
+ * \brief Normalize path pieces returned by path_split_sv()
+ *
+ * \sa normalize_path(std::vector<std::string> &)
+ */
+void normalize_path(std::vector<std::string_view> &components)
+{
+    normalize_path_impl(components);
+}
+
 /*!
  * \brief Get the relative path from a starting directory
  *
@@ -246,9 +370,9 @@ oc::result<std::string> relative_path(const std::string &path,
         return std::errc::invalid_argument;
     }
 
-    std::vector<std::string> path_pieces(path_split(path));
-    std::vector<std::string> start_pieces(path_split(start));
-    std::vector<std::string> result_pieces;
+    auto path_pieces = path_split_sv(path);
+    auto start_pieces = path_split_sv(start);
+    std::vector<std::string_view> result_pieces;
 
     normalize_path(path_pieces);
     normalize_path(start_pieces);
@@ -296,8 +420,8 @@ int path_compare(const std::string &path1, const std::string &path2)
         return false;
     }
 
-    std::vector<std::string> path1_pieces(path_split(path1));
-    std::vector<std::string> path2_pieces(path_split(path2));
+    auto path1_pieces = path_split_sv(path1);
+    auto path2_pieces = path_split_sv(path2);
 
     normalize_path(path1_pieces);
     normalize_path(path2_pieces);
@@ -305,20 +429,72 @@ int path_compare(const std::string &path1, const std::string &path2)
     return path_join(path1_pieces).compare(path_join(path2_pieces));
 }
 
+/*!
+ * \brief Wait for a path to exist
+ *
+ * The parent directory is watched with inotify so that this returns as soon
+ * as the path is created. If the parent directory does not exist yet or
+ * cannot be watched, the path is polled instead.
+ *
+ * \param path Path to wait for
+ * \param timeout Maximum amount of time to wait
+ *
+ * \return Whether the path exists
+ */
 bool wait_for_path(const std::string &path, std::chrono::milliseconds timeout)
 {
     using namespace std::chrono;
     using namespace std::chrono_literals;
 
     auto until = steady_clock::now() + timeout;
+    auto parent = dir_name(path);
     struct stat sb;
-    int ret;
 
-    while ((ret = stat(path.c_str(), &sb)) < 0 && steady_clock::now() < until) {
-        std::this_thread::sleep_for(10ms);
-    }
+    int ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    int wd = -1;
+
+    auto close_ifd = finally([&] {
+        if (ifd >= 0) {
+            close(ifd);
+        }
+    });
+
+    while (true) {
+        // Watch before checking the path so that no event can be missed
+        if (ifd >= 0 && wd < 0) {
+            wd = inotify_add_watch(ifd, parent.c_str(),
+                                   IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+        }
+
+        if (stat(path.c_str(), &sb) == 0) {
+            return true;
+        }
 
-    return ret == 0;
+        auto now = steady_clock::now();
+        if (now >= until) {
+            return false;
+        }
+
+        if (wd < 0) {
+            std::this_thread::sleep_for(10ms);
+            continue;
+        }
+
+        // Bound the wait in case the parent directory is replaced, which
+        // would remove the watch
+        auto remaining = std::min<milliseconds>(
+                duration_cast<milliseconds>(until - now) + 1ms, 100ms);
+
+        pollfd pfd = {};
+        pfd.fd = ifd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, static_cast<int>(remaining.count())) > 0) {
+            // Discard the events. Only the existence of the path matters.
+            alignas(inotify_event) char buf[4096];
+            while (read(ifd, buf, sizeof(buf)) > 0);
+        }
+    }
 }
 
 bool path_exists(const std::string &path, bool follow_symlinks)
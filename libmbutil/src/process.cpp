@@ -19,14 +19,27 @@
 
 #include "mbutil/process.h"
 
+#include <thread>
+
 #include <cerrno>
+#include <csignal>
 #include <cstdlib>
 #include <cstring>
 
+#include <malloc.h>
+#include <poll.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include "mbcommon/finally.h"
+
 #include "mbutil/string.h"
 
+// Linux 5.3
+#ifndef __NR_pidfd_open
+#  define __NR_pidfd_open 434
+#endif
+
 namespace mb::util
 {
 
@@ -117,4 +130,82 @@ oc::result<size_t> set_process_title(std::string_view title)
     return to_copy;
 }
 
+
+/*!
+ * \brief Return freed heap memory to the kernel
+ *
+ * The allocator keeps freed pages around for reuse. Long-lived processes
+ * should call this once they are done with one-shot work (eg. parsing large
+ * files during startup) so that that memory does not stay resident. This is a
+ * no-op if the C library provides no way to do it.
+ */
+void release_free_memory()
+{
+#if defined(M_PURGE)
+    // bionic
+    mallopt(M_PURGE, 0);
+#elif defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
+
+/*!
+ * \brief Wait for processes to exit
+ *
+ * The processes do not need to be children of the current process. Where
+ * supported (Linux 5.3+), this waits for each process to exit by polling a
+ * pidfd. Otherwise, the processes are checked for existence periodically.
+ *
+ * \param pids Processes to wait for
+ * \param timeout Maximum amount of time to wait for all of the processes
+ *
+ * \return Whether all of the processes exited before the timeout
+ */
+bool wait_for_processes_exit(const std::vector<pid_t> &pids,
+                             std::chrono::milliseconds timeout)
+{
+    using namespace std::chrono;
+    using namespace std::chrono_literals;
+
+    auto until = steady_clock::now() + timeout;
+
+    for (pid_t pid : pids) {
+        int pidfd = static_cast<int>(syscall(__NR_pidfd_open, pid, 0));
+        if (pidfd >= 0) {
+            auto close_pidfd = finally([&] {
+                close(pidfd);
+            });
+
+            pollfd pfd = {};
+            pfd.fd = pidfd;
+            pfd.events = POLLIN;
+
+            while (true) {
+                auto now = steady_clock::now();
+                auto remaining = now < until
+                        ? duration_cast<milliseconds>(until - now) + 1ms : 0ms;
+
+                int ret = poll(&pfd, 1, static_cast<int>(remaining.count()));
+                if (ret > 0) {
+                    break;
+                } else if (ret == 0 || errno != EINTR) {
+                    return false;
+                }
+            }
+        } else if (errno == ESRCH) {
+            // Already exited
+            continue;
+        } else {
+            while (kill(pid, 0) == 0 || errno != ESRCH) {
+                if (steady_clock::now() >= until) {
+                    return false;
+                }
+                std::this_thread::sleep_for(10ms);
+            }
+        }
+    }
+
+    return true;
+}
+
 }
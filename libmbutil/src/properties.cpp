@@ -28,7 +28,10 @@
 #include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
@@ -45,17 +48,14 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 namespace mb::util
 {
 
-static bool initialized = false;
-static std::mutex initialized_lock;
+static std::once_flag initialized;
 
 static void initialize_properties()
 {
-    std::lock_guard<std::mutex> lock(initialized_lock);
-
-    if (!initialized) {
+    // Unlike a plain mutex, this does not lock after the first call
+    std::call_once(initialized, [] {
         __system_properties_init();
-        initialized = true;
-    }
+    });
 }
 
 // Helper functions
@@ -103,6 +103,29 @@ static PropertyIterAction read_property_cb(const prop_info *pi,
     return ctx.result;
 }
 
+static uint32_t read_property_value(const prop_info *pi, std::string &value)
+{
+    struct Ctx
+    {
+        std::string *value;
+        uint32_t serial;
+    };
+
+    Ctx ctx{&value, 0};
+
+    __system_property_read_callback(
+            pi, [](void *cookie, const char *name, const char *value_,
+                   uint32_t serial) {
+        (void) name;
+        auto *ctx_ = static_cast<Ctx *>(cookie);
+
+        *ctx_->value = value_;
+        ctx_->serial = serial;
+    }, &ctx);
+
+    return ctx.serial;
+}
+
 std::optional<std::string> property_get(const std::string &key)
 {
     initialize_properties();
@@ -113,16 +136,38 @@ std::optional<std::string> property_get(const std::string &key)
     }
 
     std::string result;
-
-    read_property_cb(pi, [&](std::string_view key_, std::string_view value) {
-        (void) key_;
-        result = value;
-        return PropertyIterAction::Stop;
-    });
+    read_property_value(pi, result);
 
     return std::move(result);
 }
 
+/*!
+ * \brief Get multiple properties
+ *
+ * \param keys Property keys
+ *
+ * \return Values, in the same order as \p keys. Properties that do not exist
+ *         are std::nullopt.
+ */
+std::vector<std::optional<std::string>>
+property_get_many(const std::vector<std::string> &keys)
+{
+    std::vector<std::optional<std::string>> result;
+    result.reserve(keys.size());
+
+    initialize_properties();
+
+    for (auto const &key : keys) {
+        auto &value = result.emplace_back();
+
+        if (const prop_info *pi = __system_property_find(key.c_str())) {
+            read_property_value(pi, value.emplace());
+        }
+    }
+
+    return result;
+}
+
 std::string property_get_string(const std::string &key,
                                 const std::string &default_value)
 {
@@ -211,6 +256,84 @@ std::optional<PropertiesMap> property_get_all()
     }
 }
 
+/*!
+ * \class PropertyCache
+ *
+ * \brief Cache of system property values
+ *
+ * Cached values are validated against the property's serial number, which
+ * changes whenever the property is updated. Properties that did not exist are
+ * only looked up again if the property area's global serial number changed.
+ * This avoids the trie lookup and the copy for properties that are read
+ * repeatedly. This class is not thread safe.
+ */
+
+/*!
+ * \brief Get property value
+ *
+ * \param key Property key
+ *
+ * \return Property value or std::nullopt if the property does not exist
+ */
+std::optional<std::string> PropertyCache::get(const std::string &key)
+{
+    initialize_properties();
+
+    auto it = _entries.find(key);
+
+    if (it != _entries.end()) {
+        Entry &entry = it->second;
+
+        if (entry.pi) {
+            // Properties are never deleted, so the prop_info stays valid
+            if (__system_property_serial(entry.pi) != entry.serial) {
+                entry.serial = read_property_value(entry.pi, entry.value);
+            }
+            return entry.value;
+        } else if (__system_property_area_serial() == entry.serial) {
+            return std::nullopt;
+        }
+    } else {
+        it = _entries.emplace(key, Entry{}).first;
+    }
+
+    Entry &entry = it->second;
+
+    // Read the area serial first so that a concurrent add is noticed next time
+    uint32_t area_serial = __system_property_area_serial();
+
+    entry.pi = __system_property_find(key.c_str());
+    if (!entry.pi) {
+        entry.serial = area_serial;
+        entry.value.clear();
+        return std::nullopt;
+    }
+
+    entry.serial = read_property_value(entry.pi, entry.value);
+    return entry.value;
+}
+
+/*!
+ * \brief Get multiple property values
+ *
+ * \param keys Property keys
+ *
+ * \return Values, in the same order as \p keys. Properties that do not exist
+ *         are std::nullopt.
+ */
+std::vector<std::optional<std::string>>
+PropertyCache::get_many(const std::vector<std::string> &keys)
+{
+    std::vector<std::optional<std::string>> result;
+    result.reserve(keys.size());
+
+    for (auto const &key : keys) {
+        result.push_back(get(key));
+    }
+
+    return result;
+}
+
 // Properties file functions
 
 // Same as boost
@@ -246,18 +369,92 @@ static std::string_view trim_whitespace(std::string_view sv)
     return sv;
 }
 
+/*!
+ * \brief Read-only view of a file's contents
+ *
+ * Regular files are mmap'd so that parsing does not need to copy or allocate.
+ * Other files (eg. in procfs) are read into a buffer.
+ */
+class FileContents
+{
+public:
+    FileContents() = default;
+
+    ~FileContents()
+    {
+        if (_map != MAP_FAILED) {
+            munmap(_map, _map_size);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FileContents)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(FileContents)
+
+    bool load(int fd, const struct stat &sb)
+    {
+        if (S_ISREG(sb.st_mode)) {
+            if (sb.st_size == 0) {
+                return true;
+            }
+
+            _map_size = static_cast<size_t>(sb.st_size);
+            _map = mmap(nullptr, _map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (_map == MAP_FAILED) {
+                return false;
+            }
+
+            _data = {static_cast<const char *>(_map), _map_size};
+        } else {
+            char buf[4096];
+            ssize_t n;
+
+            while ((n = read(fd, buf, sizeof(buf))) != 0) {
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                _buf.append(buf, static_cast<size_t>(n));
+            }
+
+            _data = _buf;
+        }
+
+        return true;
+    }
+
+    std::string_view data() const
+    {
+        return _data;
+    }
+
+private:
+    void *_map = MAP_FAILED;
+    size_t _map_size = 0;
+    std::string _buf;
+    std::string_view _data;
+};
+
 static bool property_file_iter_impl(const std::string &path,
                                     std::string_view filter,
                                     const std::function<PropertyIterCb> &cb,
-                                    DevInodeSet &seen_files)
+                                    DevInodeSet &seen_files,
+                                    bool &stopped)
 {
-    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
-    if (!fp) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return false;
     }
 
+    auto close_fd = finally([&] {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    });
+
     struct stat sb;
-    if (fstat(fileno(fp.get()), &sb) < 0) {
+    if (fstat(fd, &sb) < 0) {
         return false;
     }
 
@@ -269,16 +466,22 @@ static bool property_file_iter_impl(const std::string &path,
 
     seen_files.emplace(di);
 
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read;
+    FileContents contents;
+    if (!contents.load(fd, sb)) {
+        return false;
+    }
 
-    auto free_line = finally([&] {
-        free(line);
-    });
+    std::string_view data = contents.data();
 
-    while ((read = getline(&line, &len, fp.get())) >= 0) {
-        std::string_view sv(line, static_cast<size_t>(read));
+    while (!data.empty()) {
+        auto newline = data.find('\n');
+        std::string_view sv = data.substr(0, newline);
+
+        if (newline == std::string_view::npos) {
+            data = {};
+        } else {
+            data.remove_prefix(newline + 1);
+        }
 
         sv = trim_whitespace(sv);
 
@@ -299,10 +502,13 @@ static bool property_file_iter_impl(const std::string &path,
             }
 
             if (!property_file_iter_impl(std::string(sv), new_filter, cb,
-                                         seen_files) && errno != ENOENT) {
+                                         seen_files, stopped)
+                    && errno != ENOENT) {
                 // Missing files are OK
                 // (follows the AOSP implementation behavior)
                 return false;
+            } else if (stopped) {
+                return true;
             }
         } else {
             auto equals = sv.find('=');
@@ -326,12 +532,13 @@ static bool property_file_iter_impl(const std::string &path,
             }
 
             if (cb(key, value) == PropertyIterAction::Stop) {
+                stopped = true;
                 return true;
             }
         }
     }
 
-    return !ferror(fp.get());
+    return true;
 }
 
 std::optional<std::string> property_file_get(const std::string &path,
@@ -374,11 +581,27 @@ bool property_file_get_bool(const std::string &path, const std::string &key,
     return default_value;
 }
 
+/*!
+ * \brief Iterate through properties in a `build.prop`-style file
+ *
+ * The file is mmap'd and \p fn receives views into the mapping, so no memory
+ * is allocated per property. The views are only valid during the call to
+ * \p fn. If \p fn returns PropertyIterAction::Stop, iteration stops, including
+ * in files that are `import`ed.
+ *
+ * \param path Path to properties file
+ * \param filter Only iterate through properties with this key. If the filter
+ *               ends with `*`, then it is treated as a prefix.
+ * \param fn Callback for each property
+ *
+ * \return Whether the file (and its imports) were successfully read
+ */
 bool property_file_iter(const std::string &path, std::string_view filter,
                         const std::function<PropertyIterCb> &fn)
 {
     DevInodeSet seen_files;
-    return property_file_iter_impl(path, filter, fn, seen_files);
+    bool stopped = false;
+    return property_file_iter_impl(path, filter, fn, seen_files, stopped);
 }
 
 std::optional<PropertiesMap> property_file_get_all(const std::string &path)
@@ -396,6 +619,41 @@ std::optional<PropertiesMap> property_file_get_all(const std::string &path)
     }
 }
 
+/*!
+ * \brief Get a few properties from a properties file
+ *
+ * Parsing stops as soon as all of \p keys have been found. As with
+ * property_file_get(), the first definition of a key wins.
+ *
+ * \param path Path to properties file
+ * \param keys Keys to look up
+ *
+ * \return Map containing the keys that were found or std::nullopt if the file
+ *         could not be read
+ */
+std::optional<PropertiesMap>
+property_file_get_keys(const std::string &path,
+                       const std::vector<std::string_view> &keys)
+{
+    PropertiesMap result;
+
+    if (property_file_iter(path, {},
+            [&](std::string_view key, std::string_view value) {
+        if (std::find(keys.begin(), keys.end(), key) != keys.end()) {
+            result.try_emplace(std::string{key}, value);
+
+            if (result.size() == keys.size()) {
+                return PropertyIterAction::Stop;
+            }
+        }
+        return PropertyIterAction::Continue;
+    })) {
+        return std::move(result);
+    } else {
+        return std::nullopt;
+    }
+}
+
 bool property_file_write_all(const std::string &path, const PropertiesMap &map)
 {
     ScopedFILE fp(fopen(path.c_str(), "wbe"), fclose);
@@ -139,6 +139,9 @@ static void pre_shutdown_tasks()
     std::this_thread::sleep_for(100ms);
 
     LOGV("Ready for shutdown");
+
+    // Nothing queued for asynchronous logging survives the reboot
+    log::flush();
 }
 
 bool reboot_via_framework(bool show_confirm_dialog)
@@ -38,7 +38,7 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/fts.h"
+#include "mbutil/dir_walker.h"
 
 #define LOG_TAG "mbutil/selinux"
 
@@ -50,12 +50,13 @@ static constexpr int OPEN_ATTEMPTS = 5;
 namespace mb::util
 {
 
-class RecursiveSetContext : public FtsWrapper
+class RecursiveSetContext : public DirWalker
 {
 public:
     RecursiveSetContext(std::string path, std::string context,
                         bool follow_symlinks)
-        : FtsWrapper(path, FtsFlag::GroupSpecialFiles)
+        : DirWalker(path, DirWalkerFlag::GroupSpecialFiles
+                        | DirWalkerFlag::SkipStat)
         , _context(std::move(context))
         , _follow_symlinks(follow_symlinks)
         , _result(oc::success())
@@ -102,11 +103,31 @@ private:
     }
 };
 
+/*!
+ * \brief Load a policy from memory
+ *
+ * libsepol reads directly from \p data, so it may be a read-only mapping.
+ */
+bool selinux_read_policy_data(std::string_view data, policydb_t *pdb)
+{
+    struct policy_file pf;
+
+    policy_file_init(&pf);
+    pf.type = PF_USE_MEMORY;
+    pf.data = const_cast<char *>(data.data());
+    pf.len = data.size();
+
+    auto destroy_pf = finally([&] {
+        sepol_handle_destroy(pf.handle);
+    });
+
+    return policydb_read(pdb, &pf, 0) == 0;
+}
+
 bool selinux_read_policy(const std::string &path, policydb_t *pdb)
 {
     using namespace std::chrono_literals;
 
-    struct policy_file pf;
     struct stat sb;
     void *map;
     int fd;
@@ -146,47 +167,63 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
         munmap(map, static_cast<size_t>(sb.st_size));
     });
 
+    return selinux_read_policy_data({static_cast<char *>(map),
+                                     static_cast<size_t>(sb.st_size)}, pdb);
+}
+
+/*!
+ * \brief Serialize a policy into a string
+ *
+ * The size of the image is computed first so that libsepol can write directly
+ * into \p out instead of into a temporary buffer that would need to be copied.
+ */
+bool selinux_policy_to_image(policydb_t *pdb, std::string &out)
+{
+    struct policy_file pf;
+
+    // Don't print warnings to stderr
     policy_file_init(&pf);
-    pf.type = PF_USE_MEMORY;
-    pf.data = static_cast<char *>(map);
-    pf.len = static_cast<size_t>(sb.st_size);
+    pf.handle = sepol_handle_create();
+    sepol_msg_set_callback(pf.handle, nullptr, nullptr);
 
-    auto destroy_pf = finally([&] {
+    auto destroy_handle = finally([&] {
         sepol_handle_destroy(pf.handle);
     });
 
-    return policydb_read(pdb, &pf, 0) == 0;
+    pf.type = PF_LEN;
+    if (policydb_write(pdb, &pf) != 0) {
+        LOGE("Failed to compute size of policydb image");
+        return false;
+    }
+
+    size_t size = pf.len;
+    out.resize(size);
+
+    pf.type = PF_USE_MEMORY;
+    pf.data = out.data();
+    pf.len = size;
+
+    if (policydb_write(pdb, &pf) != 0) {
+        LOGE("Failed to write policydb to memory");
+        out.clear();
+        return false;
+    }
+
+    // pf.len is the space that was left over
+    out.resize(size - pf.len);
+
+    return true;
 }
 
 // /sys/fs/selinux/load requires the entire policy to be written in a single
 // write(2) call.
 // See: http://marc.info/?l=selinux&m=141882521027239&w=2
-bool selinux_write_policy(const std::string &path, policydb_t *pdb)
+bool selinux_write_policy_data(const std::string &path, std::string_view data)
 {
     using namespace std::chrono_literals;
 
-    void *data;
-    size_t len;
-    sepol_handle_t *handle;
     int fd;
 
-    // Don't print warnings to stderr
-    handle = sepol_handle_create();
-    sepol_msg_set_callback(handle, nullptr, nullptr);
-
-    auto destroy_handle = finally([&] {
-        sepol_handle_destroy(handle);
-    });
-
-    if (policydb_to_image(handle, pdb, &data, &len) < 0) {
-        LOGE("Failed to write policydb to memory");
-        return false;
-    }
-
-    auto free_data = finally([&] {
-        free(data);
-    });
-
     for (int i = 0; i < OPEN_ATTEMPTS; ++i) {
         fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
         if (fd < 0) {
@@ -206,14 +243,27 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
         close(fd);
     });
 
-    if (write(fd, data, len) < 0) {
+    auto n = write(fd, data.data(), data.size());
+    if (n < 0) {
         LOGE("%s: Failed to write sepolicy: %s", path.c_str(), strerror(errno));
         return false;
+    } else if (static_cast<size_t>(n) != data.size()) {
+        LOGE("%s: Short write of sepolicy: %zd of %zu bytes",
+             path.c_str(), n, data.size());
+        return false;
     }
 
     return true;
 }
 
+bool selinux_write_policy(const std::string &path, policydb_t *pdb)
+{
+    std::string data;
+
+    return selinux_policy_to_image(pdb, data)
+            && selinux_write_policy_data(path, data);
+}
+
 oc::result<std::string> selinux_get_context(const std::string &path)
 {
     std::string value;
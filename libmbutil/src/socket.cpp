@@ -293,8 +293,18 @@ oc::result<void> socket_receive_fds(int fd, std::vector<int> &fds)
     cmsg->cmsg_level = SOL_SOCKET;
     cmsg->cmsg_type = SCM_RIGHTS;
 
-    if (recvmsg(fd, &msg, 0) < 0) {
+    ssize_t n = recvmsg(fd, &msg, 0);
+    if (n < 0) {
         return ec_from_errno();
+    } else if (n == 0) {
+        // Peer closed the connection
+        return std::errc::io_error;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+            || cmsg->cmsg_type != SCM_RIGHTS) {
+        return std::errc::bad_message;
     }
 
     int *data = reinterpret_cast<int *>(CMSG_DATA(cmsg));
@@ -19,7 +19,20 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "mbutil/archive.h"
+#include "mbutil/delete.h"
 
 using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
 using ScopedArchiveEntry =
@@ -66,3 +79,238 @@ TEST(ArchiveTest, CheckUtf8FilenamesWork)
     ASSERT_EQ(archive_write_close(a.get()), ARCHIVE_OK)
             << archive_error_string(a.get());
 }
+
+class ArchiveExtractTest : public ::testing::Test
+{
+protected:
+    std::string m_dir;
+    std::string m_archive;
+    std::string m_target;
+
+    void SetUp() override
+    {
+        char tmpl[] = "/tmp/mbutil-archive-XXXXXX";
+        ASSERT_TRUE(mkdtemp(tmpl)) << strerror(errno);
+
+        m_dir = tmpl;
+        m_archive = m_dir + "/test.tar";
+        m_target = m_dir + "/target";
+    }
+
+    void TearDown() override
+    {
+        // The restored read-only directory must be writable to remove it
+        chmod((m_target + "/ro").c_str(), 0755);
+        (void) mb::util::delete_recursive(m_dir);
+    }
+
+    // Write a pax archive containing the specified entries. Each entry is a
+    // (path, type, data) tuple where data is the symlink or hard link target
+    // for links.
+    void write_archive(const std::vector<std::tuple<
+            std::string, mode_t, std::string>> &entries)
+    {
+        ScopedArchive a(archive_write_new(), archive_write_free);
+        ASSERT_TRUE(a);
+
+        ASSERT_EQ(archive_write_set_format_pax_restricted(a.get()), ARCHIVE_OK)
+                << archive_error_string(a.get());
+        ASSERT_EQ(archive_write_open_filename(a.get(), m_archive.c_str()),
+                  ARCHIVE_OK) << archive_error_string(a.get());
+
+        for (auto const &[path, type, data] : entries) {
+            ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
+            ASSERT_TRUE(entry);
+
+            archive_entry_set_pathname(entry.get(), path.c_str());
+            archive_entry_set_mtime(entry.get(), 1000000000, 0);
+            archive_entry_set_uid(entry.get(), getuid());
+            archive_entry_set_gid(entry.get(), getgid());
+
+            if (type == 0) {
+                archive_entry_set_hardlink(entry.get(), data.c_str());
+            } else {
+                archive_entry_set_filetype(entry.get(), type & S_IFMT);
+                archive_entry_set_perm(entry.get(), type & 07777);
+            }
+
+            if (S_ISLNK(type)) {
+                archive_entry_set_symlink(entry.get(), data.c_str());
+            } else if (S_ISREG(type)) {
+                archive_entry_set_size(entry.get(),
+                                       static_cast<la_int64_t>(data.size()));
+            }
+
+            ASSERT_EQ(archive_write_header(a.get(), entry.get()), ARCHIVE_OK)
+                    << archive_error_string(a.get());
+
+            if (S_ISREG(type)) {
+                ASSERT_EQ(archive_write_data(a.get(), data.data(),
+                                             data.size()),
+                          static_cast<la_ssize_t>(data.size()))
+                        << archive_error_string(a.get());
+            }
+        }
+
+        ASSERT_EQ(archive_write_close(a.get()), ARCHIVE_OK)
+                << archive_error_string(a.get());
+    }
+};
+
+TEST_F(ArchiveExtractTest, ParallelExtractRestoresEntries)
+{
+    ASSERT_NO_FATAL_FAILURE(write_archive({
+        {"ro", S_IFDIR | 0555, {}},
+        {"ro/file", S_IFREG | 0640, "Hello, world!"},
+        {"implicit/parent/file", S_IFREG | 04755, "data"},
+        {"link", S_IFLNK | 0777, "ro/file"},
+        {"hardlink", 0, "ro/file"},
+    }));
+
+    ASSERT_TRUE(mb::util::libarchive_tar_extract(
+            m_archive, m_target, {}, mb::util::CompressionType::None, false,
+            4));
+
+    struct stat sb;
+
+    ASSERT_EQ(stat((m_target + "/ro").c_str(), &sb), 0);
+    ASSERT_TRUE(S_ISDIR(sb.st_mode));
+    ASSERT_EQ(sb.st_mode & 07777, 0555u);
+    ASSERT_EQ(sb.st_mtime, 1000000000);
+
+    ASSERT_EQ(stat((m_target + "/ro/file").c_str(), &sb), 0);
+    ASSERT_EQ(sb.st_mode & 07777, 0640u);
+    ASSERT_EQ(sb.st_size, 13);
+    ASSERT_EQ(sb.st_mtime, 1000000000);
+    ASSERT_EQ(sb.st_nlink, 2u);
+
+    ASSERT_EQ(stat((m_target + "/implicit/parent/file").c_str(), &sb), 0);
+    ASSERT_EQ(sb.st_mode & 07777, 04755u);
+
+    char buf[64];
+    auto n = readlink((m_target + "/link").c_str(), buf, sizeof(buf));
+    ASSERT_EQ(std::string_view(buf, static_cast<size_t>(n)), "ro/file");
+}
+
+TEST_F(ArchiveExtractTest, ParallelExtractRejectsUnsafePaths)
+{
+    ASSERT_NO_FATAL_FAILURE(write_archive({
+        {"link", S_IFLNK | 0777, m_dir},
+        {"link/escaped", S_IFREG | 0644, "data"},
+    }));
+
+    ASSERT_FALSE(mb::util::libarchive_tar_extract(
+            m_archive, m_target, {}, mb::util::CompressionType::None, false,
+            4));
+
+    struct stat sb;
+    ASSERT_LT(stat((m_dir + "/escaped").c_str(), &sb), 0);
+
+    ASSERT_NO_FATAL_FAILURE(write_archive({
+        {"../escaped", S_IFREG | 0644, "data"},
+    }));
+
+    ASSERT_FALSE(mb::util::libarchive_tar_extract(
+            m_archive, m_target, {}, mb::util::CompressionType::None, false,
+            4));
+    ASSERT_LT(stat((m_dir + "/escaped").c_str(), &sb), 0);
+}
+
+TEST_F(ArchiveExtractTest, SparseFilesStaySparse)
+{
+    constexpr off_t hole_size = 64 * 1024 * 1024;
+
+    auto source = m_dir + "/source";
+    ASSERT_EQ(mkdir(source.c_str(), 0755), 0) << strerror(errno);
+
+    auto path = source + "/sparse.img";
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_GE(fd, 0) << strerror(errno);
+        ASSERT_EQ(pwrite(fd, "head", 4, 0), 4);
+        ASSERT_EQ(pwrite(fd, "tail", 4, hole_size), 4);
+        ASSERT_EQ(ftruncate(fd, 2 * hole_size), 0);
+        close(fd);
+    }
+
+    struct stat sb;
+    ASSERT_EQ(stat(path.c_str(), &sb), 0);
+    if (sb.st_blocks * 512 >= hole_size) {
+        GTEST_SKIP() << "Filesystem does not support holes";
+    }
+
+    ASSERT_TRUE(mb::util::libarchive_tar_create(
+            m_archive, source, {"sparse.img"},
+            mb::util::CompressionType::None, 0));
+
+    // Only the data and the sparse map are stored
+    ASSERT_EQ(stat(m_archive.c_str(), &sb), 0);
+    ASSERT_LT(sb.st_size, 1024 * 1024);
+
+    for (unsigned int threads : {1u, 4u}) {
+        ASSERT_TRUE(mb::util::libarchive_tar_extract(
+                m_archive, m_target, {}, mb::util::CompressionType::None,
+                false, threads));
+
+        auto target = m_target + "/sparse.img";
+
+        ASSERT_EQ(stat(target.c_str(), &sb), 0);
+        ASSERT_EQ(sb.st_size, 2 * hole_size);
+        ASSERT_LT(sb.st_blocks * 512, hole_size);
+
+        int fd = open(target.c_str(), O_RDONLY);
+        ASSERT_GE(fd, 0) << strerror(errno);
+
+        char buf[4];
+        ASSERT_EQ(pread(fd, buf, sizeof(buf), 0), 4);
+        ASSERT_EQ(std::string_view(buf, sizeof(buf)), "head");
+        ASSERT_EQ(pread(fd, buf, sizeof(buf), hole_size), 4);
+        ASSERT_EQ(std::string_view(buf, sizeof(buf)), "tail");
+        ASSERT_EQ(pread(fd, buf, sizeof(buf), hole_size / 2), 4);
+        ASSERT_EQ(std::string_view(buf, sizeof(buf)),
+                  std::string_view("\0\0\0\0", 4));
+        close(fd);
+
+        ASSERT_TRUE(mb::util::delete_recursive(target));
+    }
+}
+
+TEST_F(ArchiveExtractTest, VerifyReadsWholeArchive)
+{
+    auto source = m_dir + "/source";
+    ASSERT_EQ(mkdir(source.c_str(), 0755), 0) << strerror(errno);
+
+    {
+        std::string data;
+        for (int i = 0; i < 100000; ++i) {
+            data += std::to_string(i);
+        }
+
+        int fd = open((source + "/file").c_str(),
+                      O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ASSERT_GE(fd, 0) << strerror(errno);
+        ASSERT_EQ(write(fd, data.data(), data.size()),
+                  static_cast<ssize_t>(data.size()));
+        close(fd);
+    }
+
+    ASSERT_TRUE(mb::util::libarchive_tar_create(
+            m_archive, source, {"file"}, mb::util::CompressionType::Gzip, 0));
+
+    for (unsigned int threads : {1u, 4u}) {
+        ASSERT_TRUE(mb::util::libarchive_tar_verify(
+                m_archive, mb::util::CompressionType::Gzip, false, threads));
+    }
+
+    // Nothing is extracted
+    struct stat sb;
+    ASSERT_LT(stat(m_target.c_str(), &sb), 0);
+
+    ASSERT_EQ(stat(m_archive.c_str(), &sb), 0);
+    ASSERT_EQ(truncate(m_archive.c_str(), sb.st_size / 2), 0);
+
+    for (unsigned int threads : {1u, 4u}) {
+        ASSERT_FALSE(mb::util::libarchive_tar_verify(
+                m_archive, mb::util::CompressionType::Gzip, false, threads));
+    }
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <archive_entry.h>
+#include <unistd.h>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file_util.h"
+
+#include "mbutil/archive_file.h"
+
+using namespace mb;
+using namespace mb::util;
+
+using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
+using ScopedArchiveEntry =
+        std::unique_ptr<archive_entry, decltype(archive_entry_free) *>;
+
+struct ArchiveFileTest : testing::Test
+{
+    std::vector<std::pair<std::string, std::string>> m_entries{
+        {"a.txt", "Hello, world!"},
+        {"b.bin", std::string(300000, 'b')},
+        {"c.txt", "Goodbye, world!"},
+    };
+
+    void write_archive(File &file, bool zip)
+    {
+        ScopedArchive a(archive_write_new(), archive_write_free);
+        ASSERT_TRUE(a);
+
+        if (zip) {
+            ASSERT_EQ(archive_write_set_format_zip(a.get()), ARCHIVE_OK)
+                    << archive_error_string(a.get());
+        } else {
+            ASSERT_EQ(archive_write_set_format_pax_restricted(a.get()),
+                      ARCHIVE_OK) << archive_error_string(a.get());
+        }
+
+        ArchiveFileWriter writer(file);
+        ASSERT_EQ(writer.open(a.get()), ARCHIVE_OK)
+                << archive_error_string(a.get());
+
+        for (auto const &[name, data] : m_entries) {
+            ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
+            ASSERT_TRUE(entry);
+
+            archive_entry_set_pathname(entry.get(), name.c_str());
+            archive_entry_set_filetype(entry.get(), AE_IFREG);
+            archive_entry_set_perm(entry.get(), 0644);
+            archive_entry_set_size(entry.get(),
+                                   static_cast<la_int64_t>(data.size()));
+
+            ASSERT_EQ(archive_write_header(a.get(), entry.get()), ARCHIVE_OK)
+                    << archive_error_string(a.get());
+            ASSERT_EQ(archive_write_data(a.get(), data.data(), data.size()),
+                      static_cast<la_ssize_t>(data.size()))
+                    << archive_error_string(a.get());
+        }
+
+        ASSERT_EQ(archive_write_close(a.get()), ARCHIVE_OK)
+                << archive_error_string(a.get());
+    }
+
+    // Read every entry, skipping the data of entries in `skip`
+    void read_archive(ArchiveFileReader &reader, bool zip,
+                      const std::string &skip = {})
+    {
+        ScopedArchive a(archive_read_new(), archive_read_free);
+        ASSERT_TRUE(a);
+
+        if (zip) {
+            archive_read_support_format_zip_seekable(a.get());
+        } else {
+            archive_read_support_format_tar(a.get());
+        }
+
+        ASSERT_EQ(reader.open(a.get()), ARCHIVE_OK)
+                << archive_error_string(a.get());
+
+        archive_entry *entry;
+
+        for (auto const &[name, data] : m_entries) {
+            ASSERT_EQ(archive_read_next_header(a.get(), &entry), ARCHIVE_OK)
+                    << archive_error_string(a.get());
+            ASSERT_EQ(archive_entry_pathname(entry), name);
+
+            if (name == skip) {
+                continue;
+            }
+
+            std::string buf(data.size() + 1, '\0');
+            auto n = archive_read_data(a.get(), buf.data(), buf.size());
+            ASSERT_EQ(n, static_cast<la_ssize_t>(data.size()))
+                    << archive_error_string(a.get());
+            buf.resize(data.size());
+            ASSERT_EQ(buf, data);
+        }
+
+        ASSERT_EQ(archive_read_next_header(a.get(), &entry), ARCHIVE_EOF)
+                << archive_error_string(a.get());
+    }
+};
+
+TEST_F(ArchiveFileTest, RoundTripTarThroughFile)
+{
+    std::vector<unsigned char> buf;
+
+    {
+        void *data = nullptr;
+        size_t size = 0;
+        MemoryFile file(&data, &size);
+
+        ASSERT_NO_FATAL_FAILURE(write_archive(file, false));
+
+        auto ptr = static_cast<unsigned char *>(data);
+        buf.assign(ptr, ptr + size);
+        free(data);
+    }
+
+    MemoryFile file(buf.data(), buf.size());
+
+    {
+        ArchiveFileReader reader(file, 4096);
+        ASSERT_NO_FATAL_FAILURE(read_archive(reader, false));
+    }
+
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+
+    {
+        ArchiveFileReader reader(file);
+        ASSERT_NO_FATAL_FAILURE(read_archive(reader, false, "b.bin"));
+    }
+}
+
+TEST_F(ArchiveFileTest, SeekableZipThroughFile)
+{
+    void *data = nullptr;
+    size_t size = 0;
+    MemoryFile file(&data, &size);
+
+    ASSERT_NO_FATAL_FAILURE(write_archive(file, true));
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+
+    ArchiveFileReader reader(file);
+    ASSERT_NO_FATAL_FAILURE(read_archive(reader, true, "b.bin"));
+
+    ASSERT_TRUE(file.close());
+    free(data);
+}
+
+struct ArchiveMmapFileTest : ArchiveFileTest
+{
+    std::string m_path;
+
+    void SetUp() override
+    {
+        char tmpl[] = "/tmp/mbutil-archive-file-XXXXXX";
+        int fd = mkstemp(tmpl);
+        ASSERT_GE(fd, 0) << strerror(errno);
+        close(fd);
+
+        m_path = tmpl;
+    }
+
+    void TearDown() override
+    {
+        unlink(m_path.c_str());
+    }
+
+    void write_file(bool zip)
+    {
+        void *data = nullptr;
+        size_t size = 0;
+        MemoryFile file(&data, &size);
+
+        ASSERT_NO_FATAL_FAILURE(write_archive(file, zip));
+
+        FILE *fp = fopen(m_path.c_str(), "wb");
+        ASSERT_TRUE(fp) << strerror(errno);
+        ASSERT_EQ(fwrite(data, 1, size, fp), size);
+        ASSERT_EQ(fclose(fp), 0);
+
+        free(data);
+    }
+};
+
+TEST_F(ArchiveMmapFileTest, BlocksPointIntoMapping)
+{
+    ASSERT_NO_FATAL_FAILURE(write_file(false));
+
+    MmapFile file;
+    ASSERT_TRUE(file.open(m_path));
+
+    ArchiveFileReader reader(file);
+
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    ASSERT_TRUE(a);
+    archive_read_support_format_tar(a.get());
+    ASSERT_EQ(reader.open(a.get()), ARCHIVE_OK)
+            << archive_error_string(a.get());
+
+    archive_entry *entry;
+    ASSERT_EQ(archive_read_next_header(a.get(), &entry), ARCHIVE_OK)
+            << archive_error_string(a.get());
+
+    const void *block;
+    size_t block_size;
+    la_int64_t offset;
+
+    ASSERT_EQ(archive_read_data_block(a.get(), &block, &block_size, &offset),
+              ARCHIVE_OK) << archive_error_string(a.get());
+
+    auto ptr = static_cast<const unsigned char *>(block);
+    ASSERT_GE(ptr, file.data());
+    ASSERT_LE(ptr + block_size, file.data() + file.size());
+    ASSERT_EQ(std::string(static_cast<const char *>(block), block_size),
+              m_entries[0].second);
+}
+
+TEST_F(ArchiveMmapFileTest, ReadersCanShareMapping)
+{
+    ASSERT_NO_FATAL_FAILURE(write_file(true));
+
+    MmapFile file;
+    ASSERT_TRUE(file.open(m_path));
+
+    ArchiveFileReader reader1(file);
+    ArchiveFileReader reader2(file);
+
+    ASSERT_NO_FATAL_FAILURE(read_archive(reader1, true));
+    ASSERT_NO_FATAL_FAILURE(read_archive(reader2, true, "a.txt"));
+
+    // The file position is untouched
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+}
+
+TEST_F(ArchiveMmapFileTest, InputFileReadsArchive)
+{
+    ASSERT_NO_FATAL_FAILURE(write_file(false));
+
+    ArchiveInputFile file;
+    ASSERT_TRUE(file.open(m_path));
+
+    ScopedArchive a(archive_read_new(), archive_read_free);
+    ASSERT_TRUE(a);
+    archive_read_support_format_tar(a.get());
+    ASSERT_EQ(file.open_archive(a.get()), ARCHIVE_OK)
+            << archive_error_string(a.get());
+
+    archive_entry *entry;
+    size_t count = 0;
+
+    while (archive_read_next_header(a.get(), &entry) == ARCHIVE_OK) {
+        ASSERT_EQ(archive_entry_pathname(entry), m_entries[count].first);
+        ++count;
+    }
+
+    ASSERT_EQ(count, m_entries.size());
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <lz4.h>
+#include <lz4frame.h>
+#include <zlib.h>
+
+#include "mbutil/compress.h"
+
+using namespace mb::util;
+
+static std::string make_input(size_t size)
+{
+    std::string data;
+    data.reserve(size);
+
+    // Somewhat compressible data that does not repeat within a block
+    uint32_t state = 1;
+    while (data.size() < size) {
+        state = state * 1103515245u + 12345u;
+        data += std::to_string(state >> 20);
+        data += (state & 0x100) ? '\n' : ' ';
+    }
+    data.resize(size);
+
+    return data;
+}
+
+static std::string compress(ParallelFormat format, const std::string &input,
+                            unsigned int threads)
+{
+    std::string output;
+
+    ParallelCompressor compressor(format, [&](std::string_view data) {
+        output += data;
+        return true;
+    }, threads);
+
+    // Write in odd-sized chunks to exercise the block splitting
+    for (size_t i = 0; i < input.size(); i += 100000) {
+        EXPECT_TRUE(compressor.write(input.data() + i,
+                                     std::min<size_t>(100000, input.size() - i)));
+    }
+    EXPECT_TRUE(compressor.finish());
+
+    return output;
+}
+
+static std::string gunzip(const std::string &data)
+{
+    z_stream zs = {};
+    EXPECT_EQ(inflateInit2(&zs, 16 + MAX_WBITS), Z_OK);
+
+    std::string output;
+    char buf[65536];
+    int ret;
+
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    zs.avail_in = static_cast<uInt>(data.size());
+
+    do {
+        zs.next_out = reinterpret_cast<Bytef *>(buf);
+        zs.avail_out = sizeof(buf);
+        ret = inflate(&zs, Z_NO_FLUSH);
+        output.append(buf, sizeof(buf) - zs.avail_out);
+    } while (ret == Z_OK);
+
+    EXPECT_EQ(ret, Z_STREAM_END);
+    // Single-member stream
+    EXPECT_EQ(zs.avail_in, 0u);
+
+    inflateEnd(&zs);
+    return output;
+}
+
+static std::string lz4_frame_decompress(const std::string &data)
+{
+    LZ4F_dctx *dctx;
+    EXPECT_FALSE(LZ4F_isError(LZ4F_createDecompressionContext(
+            &dctx, LZ4F_VERSION)));
+
+    std::string output;
+    char buf[65536];
+    size_t offset = 0;
+    size_t ret;
+
+    do {
+        size_t in_size = data.size() - offset;
+        size_t out_size = sizeof(buf);
+
+        ret = LZ4F_decompress(dctx, buf, &out_size, data.data() + offset,
+                              &in_size, nullptr);
+        EXPECT_FALSE(LZ4F_isError(ret)) << LZ4F_getErrorName(ret);
+        if (LZ4F_isError(ret)) {
+            break;
+        }
+
+        offset += in_size;
+        output.append(buf, out_size);
+    } while (ret != 0);
+
+    EXPECT_EQ(offset, data.size());
+
+    LZ4F_freeDecompressionContext(dctx);
+    return output;
+}
+
+// Same algorithm as the kernel's unlz4()
+static std::string lz4_legacy_decompress(const std::string &data)
+{
+    auto read_le32 = [&](size_t offset) {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            value |= static_cast<uint32_t>(
+                    static_cast<unsigned char>(data[offset + i])) << (8 * i);
+        }
+        return value;
+    };
+
+    EXPECT_GE(data.size(), 4u);
+    EXPECT_EQ(read_le32(0), 0x184c2102u);
+
+    std::string output;
+    std::string buf(8 * 1024 * 1024, '\0');
+    size_t offset = 4;
+
+    while (offset < data.size()) {
+        uint32_t size = read_le32(offset);
+        offset += 4;
+
+        int n = LZ4_decompress_safe(data.data() + offset, buf.data(),
+                                    static_cast<int>(size),
+                                    static_cast<int>(buf.size()));
+        EXPECT_GE(n, 0);
+        if (n < 0) {
+            break;
+        }
+
+        output.append(buf.data(), static_cast<size_t>(n));
+        offset += size;
+    }
+
+    return output;
+}
+
+struct ParallelCompressorTest
+    : testing::TestWithParam<std::tuple<size_t, unsigned int>>
+{
+};
+
+TEST_P(ParallelCompressorTest, GzipRoundTrip)
+{
+    auto [size, threads] = GetParam();
+    auto input = make_input(size);
+
+    ASSERT_EQ(gunzip(compress(ParallelFormat::Gzip, input, threads)), input);
+}
+
+TEST_P(ParallelCompressorTest, Lz4FrameRoundTrip)
+{
+    auto [size, threads] = GetParam();
+    auto input = make_input(size);
+
+    ASSERT_EQ(lz4_frame_decompress(
+            compress(ParallelFormat::Lz4Frame, input, threads)), input);
+}
+
+TEST_P(ParallelCompressorTest, Lz4LegacyRoundTrip)
+{
+    auto [size, threads] = GetParam();
+    auto input = make_input(size);
+
+    ASSERT_EQ(lz4_legacy_decompress(
+            compress(ParallelFormat::Lz4Legacy, input, threads)), input);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Sizes,
+    ParallelCompressorTest,
+    testing::Combine(
+        // Empty, smaller than a block, and multiple blocks of each format
+        testing::Values(0, 1000, 128 * 1024, 20 * 1024 * 1024 + 17),
+        testing::Values(1u, 4u)
+    )
+);
+
+TEST(ParallelCompressorErrorTest, WriteErrorIsReported)
+{
+    ParallelCompressor compressor(ParallelFormat::Gzip, [](std::string_view) {
+        return false;
+    });
+
+    ASSERT_FALSE(compressor.write("x", 1));
+}
+
+static std::string decompress(ParallelFormat format, const std::string &input,
+                              std::string *trailing)
+{
+    std::string output;
+
+    StreamDecompressor decompressor(format, [&](std::string_view data) {
+        output += data;
+        return true;
+    });
+
+    for (size_t i = 0; i < input.size(); i += 4099) {
+        EXPECT_TRUE(decompressor.write(input.data() + i,
+                                       std::min<size_t>(4099, input.size() - i)));
+    }
+    EXPECT_TRUE(decompressor.finish());
+
+    *trailing = decompressor.trailing_data();
+
+    return output;
+}
+
+struct StreamDecompressorTest
+    : testing::TestWithParam<std::tuple<ParallelFormat, size_t>>
+{
+};
+
+TEST_P(StreamDecompressorTest, RoundTripWithTrailingData)
+{
+    auto [format, size] = GetParam();
+    auto input = make_input(size);
+    auto compressed = compress(format, input, 2);
+
+    ASSERT_EQ(StreamDecompressor::detect_format(compressed), format);
+
+    std::string trailing;
+    ASSERT_EQ(decompress(format, compressed, &trailing), input);
+    ASSERT_EQ(trailing, "");
+
+    // Appended device tree (gzip) or uncompressed size (lz4)
+    std::string suffix("\xd0\x0d\xfe\xed\x00\x00\x10\x00", 8);
+    ASSERT_EQ(decompress(format, compressed + suffix, &trailing), input);
+    ASSERT_EQ(trailing, suffix);
+
+    // A small appended size looks like the size of a truncated block
+    std::string size_suffix("\x10\x00\x00\x00", 4);
+    ASSERT_EQ(decompress(format, compressed + size_suffix, &trailing), input);
+    ASSERT_EQ(trailing, size_suffix);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Formats,
+    StreamDecompressorTest,
+    testing::Combine(
+        testing::Values(ParallelFormat::Gzip, ParallelFormat::Lz4Legacy),
+        testing::Values(1000, 20 * 1024 * 1024 + 17)
+    )
+);
+
+TEST(StreamDecompressorErrorTest, TruncatedGzipIsReported)
+{
+    auto compressed = compress(ParallelFormat::Gzip, make_input(100000), 1);
+    compressed.resize(compressed.size() / 2);
+
+    StreamDecompressor decompressor(ParallelFormat::Gzip,
+                                    [](std::string_view) { return true; });
+
+    ASSERT_TRUE(decompressor.write(compressed.data(), compressed.size()));
+    ASSERT_FALSE(decompressor.finish());
+}
+
+TEST(StreamDecompressorErrorTest, UnknownFormatIsNotDetected)
+{
+    ASSERT_FALSE(StreamDecompressor::detect_format("ARMd"));
+    ASSERT_FALSE(StreamDecompressor::detect_format(""));
+}
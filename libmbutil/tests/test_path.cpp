@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbutil/path.h"
+
+using namespace mb::util;
+
+TEST(PathTest, DirNameMatchesPosix)
+{
+    ASSERT_EQ(dir_name_sv("/usr/lib"), "/usr");
+    ASSERT_EQ(dir_name_sv("/usr//lib//"), "/usr");
+    ASSERT_EQ(dir_name_sv("/usr/"), "/");
+    ASSERT_EQ(dir_name_sv("/usr"), "/");
+    ASSERT_EQ(dir_name_sv("usr"), ".");
+    ASSERT_EQ(dir_name_sv("usr/lib"), "usr");
+    ASSERT_EQ(dir_name_sv("/"), "/");
+    ASSERT_EQ(dir_name_sv("///"), "/");
+    ASSERT_EQ(dir_name_sv(""), ".");
+    ASSERT_EQ(dir_name("/data/media/0"), "/data/media");
+}
+
+TEST(PathTest, BaseNameMatchesPosix)
+{
+    ASSERT_EQ(base_name_sv("/usr/lib"), "lib");
+    ASSERT_EQ(base_name_sv("/usr/lib//"), "lib");
+    ASSERT_EQ(base_name_sv("usr"), "usr");
+    ASSERT_EQ(base_name_sv("/"), "/");
+    ASSERT_EQ(base_name_sv("//"), "/");
+    ASSERT_EQ(base_name_sv(""), ".");
+    ASSERT_EQ(base_name("/system/build.prop"), "build.prop");
+}
+
+TEST(PathTest, SplitViewsIntoInput)
+{
+    std::string path("/a//./b/c/");
+    auto pieces = path_split_sv(path);
+
+    ASSERT_EQ(pieces, (std::vector<std::string_view>{"", "a", "b", "c"}));
+    ASSERT_EQ(pieces[1].data(), path.data() + 1);
+    ASSERT_EQ(path_split(path),
+              (std::vector<std::string>{"", "a", "b", "c"}));
+
+    ASSERT_EQ(path_split_sv("a/b"),
+              (std::vector<std::string_view>{"a", "b"}));
+    ASSERT_TRUE(path_split_sv("").empty());
+}
+
+TEST(PathTest, NormalizeAndJoin)
+{
+    auto pieces = path_split_sv("/../usr/include/../bin");
+    normalize_path(pieces);
+    ASSERT_EQ(path_join(pieces), "/usr/bin");
+
+    pieces = path_split_sv("../a/..");
+    normalize_path(pieces);
+    ASSERT_EQ(path_join(pieces), "..");
+
+    ASSERT_EQ(path_join(std::vector<std::string_view>{""}), "/");
+}
+
+TEST(PathTest, RelativePath)
+{
+    ASSERT_EQ(relative_path("/usr/bin", "/usr/include/glib-2.0/..").value(),
+              "../bin");
+    ASSERT_EQ(relative_path("/a/b/c", "/a").value(), "b/c");
+    ASSERT_EQ(relative_path("/a", "/a").value(), "");
+    ASSERT_FALSE(relative_path("a", "/a"));
+    ASSERT_FALSE(relative_path("a/b", ".."));
+}
+
+TEST(PathTest, Compare)
+{
+    ASSERT_EQ(path_compare("/a//b/./c", "/a/b/c"), 0);
+    ASSERT_EQ(path_compare("/a/b/../c", "/a/c"), 0);
+    ASSERT_NE(path_compare("/a/b", "/a/c"), 0);
+}
+
+TEST(PathTest, WaitForPath)
+{
+    using namespace std::chrono_literals;
+
+    char tmpl[] = "/tmp/mbutil-path-XXXXXX";
+    ASSERT_TRUE(mkdtemp(tmpl)) << strerror(errno);
+
+    std::string dir = tmpl;
+    std::string path = dir + "/file";
+
+    ASSERT_FALSE(wait_for_path(path, 50ms));
+
+    std::thread creator([&] {
+        std::this_thread::sleep_for(50ms);
+        close(open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600));
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    bool found = wait_for_path(path, 10s);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    creator.join();
+
+    ASSERT_TRUE(found);
+    ASSERT_LT(elapsed, 5s);
+    ASSERT_TRUE(wait_for_path(path, 0ms));
+
+    unlink(path.c_str());
+    rmdir(dir.c_str());
+}
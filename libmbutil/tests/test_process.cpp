@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include <csignal>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mbutil/process.h"
+
+using namespace mb::util;
+using namespace std::chrono_literals;
+
+TEST(ProcessTest, WaitForProcessesExit)
+{
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+
+    if (pid == 0) {
+        std::this_thread::sleep_for(50ms);
+        _exit(0);
+    }
+
+    ASSERT_TRUE(wait_for_processes_exit({pid}, 10s));
+    ASSERT_EQ(waitpid(pid, nullptr, 0), pid);
+}
+
+TEST(ProcessTest, WaitForProcessesExitTimeout)
+{
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+
+    if (pid == 0) {
+        pause();
+        _exit(0);
+    }
+
+    ASSERT_FALSE(wait_for_processes_exit({pid}, 50ms));
+
+    kill(pid, SIGKILL);
+    ASSERT_EQ(waitpid(pid, nullptr, 0), pid);
+}
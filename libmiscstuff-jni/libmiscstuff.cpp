@@ -17,13 +17,21 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
 
 #include <cerrno>
 #include <cstdarg>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
+#include <sys/stat.h>
+
 #include <archive.h>
 #include <archive_entry.h>
 
@@ -32,6 +40,7 @@
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
 
+#include "mbbootimg/compare.h"
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
@@ -45,6 +54,7 @@
     Java_com_github_chenxiaolong_dualbootpatcher_nativelib_libmiscstuff_LibMiscStuff_ ## method
 
 #define IOException             "java/io/IOException"
+#define InterruptedIOException  "java/io/InterruptedIOException"
 #define OutOfMemoryError        "java/lang/OutOfMemoryError"
 
 using namespace mb;
@@ -52,6 +62,24 @@ using namespace mb::bootimg;
 
 typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
 
+// Block size for reading archives
+static constexpr size_t ARCHIVE_BLOCK_SIZE = 256 * 1024;
+
+/*!
+ * Layout of the direct ByteBuffer that is shared with ExtractProgress.kt. The
+ * fields are accessed with relaxed atomics so that the Java side can poll the
+ * progress and request cancellation without any JNI calls.
+ */
+struct ExtractProgress
+{
+    // Number of bytes of the archive file that have been read
+    int64_t current_bytes;
+    // Size of the archive file
+    int64_t total_bytes;
+    // Set to non-zero by the Java side to cancel the extraction
+    int32_t cancelled;
+};
+
 extern "C" {
 
 MB_PRINTF(3, 4)
@@ -83,12 +111,52 @@ static bool throw_exception(JNIEnv *env, const char *class_name,
     return env->ThrowNew(clazz, buf) == 0;
 }
 
+/*!
+ * \brief Publish the extraction progress and check for cancellation
+ *
+ * \return False if the extraction was cancelled, in which case an exception
+ *         was thrown
+ */
+static bool update_progress(JNIEnv *env, archive *a, ExtractProgress *progress,
+                            const char *filename)
+{
+    if (!progress) {
+        return true;
+    }
+
+    // Position in the compressed input
+    __atomic_store_n(&progress->current_bytes, archive_filter_bytes(a, -1),
+                     __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&progress->cancelled, __ATOMIC_RELAXED)) {
+        throw_exception(env, InterruptedIOException,
+                        "%s: Extraction was cancelled", filename);
+        return false;
+    }
+
+    return true;
+}
+
 JNIEXPORT void JNICALL
 CLASS_METHOD(extractArchive)(JNIEnv *env, jclass clazz, jstring jfilename,
-                            jstring jtarget)
+                            jstring jtarget, jobject jprogress)
 {
     (void) clazz;
 
+    ExtractProgress *progress = nullptr;
+
+    if (jprogress) {
+        progress = static_cast<ExtractProgress *>(
+                env->GetDirectBufferAddress(jprogress));
+        if (!progress || env->GetDirectBufferCapacity(jprogress)
+                < static_cast<jlong>(sizeof(ExtractProgress))) {
+            throw_exception(env, IOException,
+                            "Progress buffer is not a large enough direct "
+                            "buffer");
+            return;
+        }
+    }
+
     const char *filename = env->GetStringUTFChars(jfilename, nullptr);
     if (!filename) {
         return;
@@ -124,7 +192,15 @@ CLASS_METHOD(extractArchive)(JNIEnv *env, jclass clazz, jstring jfilename,
     archive_read_support_format_zip(in.get());
     archive_read_support_filter_xz(in.get());
 
-    if (archive_read_open_filename(in.get(), filename, 10240) != ARCHIVE_OK) {
+    if (progress) {
+        struct stat sb;
+        int64_t total = stat(filename, &sb) == 0 ? sb.st_size : 0;
+        __atomic_store_n(&progress->current_bytes, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&progress->total_bytes, total, __ATOMIC_RELAXED);
+    }
+
+    if (archive_read_open_filename(in.get(), filename, ARCHIVE_BLOCK_SIZE)
+            != ARCHIVE_OK) {
         throw_exception(env, IOException,
                         "%s: Failed to open archive: %s",
                         filename, archive_error_string(in.get()));
@@ -169,6 +245,10 @@ CLASS_METHOD(extractArchive)(JNIEnv *env, jclass clazz, jstring jfilename,
     int laret;
 
     while ((laret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
+        if (!update_progress(env, in.get(), progress, filename)) {
+            return;
+        }
+
         if ((laret = archive_write_header(out.get(), entry)) != ARCHIVE_OK) {
             throw_exception(env, IOException,
                             "%s: Failed to write header: %s",
@@ -189,6 +269,10 @@ CLASS_METHOD(extractArchive)(JNIEnv *env, jclass clazz, jstring jfilename,
                                 target, archive_error_string(out.get()));
                 return;
             }
+
+            if (!update_progress(env, in.get(), progress, filename)) {
+                return;
+            }
         }
 
         if (laret != ARCHIVE_EOF) {
@@ -218,17 +302,69 @@ CLASS_METHOD(mblogSetLogcat)(JNIEnv *env, jclass clazz)
 
 struct LaBootImgCtx
 {
-    Reader reader;
-    char buf[10240];
+    std::unique_ptr<EntryStream> stream;
+    char buf[65536];
 };
 
+// Cache of ROM IDs (or the lack of one) found in boot image ramdisks. The ROM
+// list is refreshed often and the images rarely change, so this avoids
+// decompressing the same ramdisks over and over.
+static std::mutex g_romid_cache_lock;
+static std::unordered_map<std::string, std::optional<std::string>>
+        g_romid_cache;
+
+/*!
+ * \brief Build the ROM ID cache key for a boot image
+ *
+ * The key consists of the path, the ramdisk location, and the first and last
+ * 1 KiB of the (compressed) ramdisk. Compressed ramdisks end with a checksum
+ * of their contents, so modifying the ramdisk changes the key even if the size
+ * stays the same.
+ */
+static std::optional<std::string>
+romid_cache_key(Reader &reader, const char *filename)
+{
+    auto entries = reader.entries();
+    if (!entries) {
+        return std::nullopt;
+    }
+
+    auto it = std::find_if(entries.value().begin(), entries.value().end(),
+                           [](const EntryLocation &loc) {
+        return loc.type == EntryType::Ramdisk;
+    });
+    if (it == entries.value().end()) {
+        return std::nullopt;
+    }
+
+    std::string key(filename);
+    key += '\0';
+    key += std::to_string(it->offset);
+    key += ':';
+    key += std::to_string(it->size);
+    key += '\0';
+
+    char buf[1024];
+    uint64_t tail_offset = it->size > sizeof(buf) ? it->size - sizeof(buf) : 0;
+
+    for (uint64_t offset : {uint64_t(0), tail_offset}) {
+        auto n = reader.read_entry_at(*it, offset, buf, sizeof(buf));
+        if (!n) {
+            return std::nullopt;
+        }
+        key.append(buf, n.value());
+    }
+
+    return key;
+}
+
 static la_ssize_t laBootImgReadCb(archive *a, void *userdata,
                                   const void **buffer)
 {
     (void) a;
     LaBootImgCtx *ctx = static_cast<LaBootImgCtx *>(userdata);
 
-    auto bytesRead = ctx->reader.read_data(ctx->buf, sizeof(ctx->buf));
+    auto bytesRead = ctx->stream->read(ctx->buf, sizeof(ctx->buf));
     if (!bytesRead) {
         return -1;
     }
@@ -277,39 +413,56 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         return nullptr;
     }
 
-    // Go to ramdisk
-    if (auto entry = reader.go_to_entry(EntryType::Ramdisk); !entry) {
-        if (entry.error() == ReaderError::EndOfEntries) {
+    auto cache_key = romid_cache_key(reader, filename);
+
+    if (cache_key) {
+        std::lock_guard<std::mutex> lock(g_romid_cache_lock);
+
+        if (auto it = g_romid_cache.find(*cache_key);
+                it != g_romid_cache.end()) {
+            return it->second ? env->NewStringUTF(it->second->c_str())
+                    : nullptr;
+        }
+    }
+
+    auto cache_result = [&](std::optional<std::string> romid) {
+        if (cache_key) {
+            std::lock_guard<std::mutex> lock(g_romid_cache_lock);
+            g_romid_cache[*cache_key] = std::move(romid);
+        }
+    };
+
+    // Open decompressed ramdisk. The entry stream only decompresses as much
+    // of the ramdisk as libarchive reads before /romid is found.
+    auto ctx = std::make_unique<LaBootImgCtx>();
+
+    if (auto stream = reader.open_entry_stream(EntryType::Ramdisk); !stream) {
+        if (stream.error() == ReaderError::EndOfEntries) {
             throw_exception(env, IOException,
                             "%s: Boot image is missing ramdisk", filename);
         } else {
             throw_exception(env, IOException,
-                            "%s: Failed to find ramdisk entry: %s",
-                            filename, entry.error().message().c_str());
+                            "%s: Failed to open ramdisk entry: %s",
+                            filename, stream.error().message().c_str());
         }
         return nullptr;
+    } else {
+        ctx->stream = std::move(stream.value());
     }
 
     ScopedArchive a(archive_read_new(), &archive_read_free);
     archive_entry *aEntry;
-    LaBootImgCtx ctx;
 
     if (!a) {
         throw_exception(env, IOException, "Failed to allocate archive");
         return nullptr;
     }
 
-    // Enable support for common ramdisk formats
-    archive_read_support_filter_gzip(a.get());
-    archive_read_support_filter_lz4(a.get());
-    archive_read_support_filter_lzma(a.get());
-    archive_read_support_filter_xz(a.get());
     archive_read_support_format_cpio(a.get());
 
     // Open ramdisk archive
-    ctx.reader = std::move(reader);
-    int laret = archive_read_open(a.get(), &ctx, nullptr, &laBootImgReadCb,
-                                  nullptr);
+    int laret = archive_read_open(a.get(), ctx.get(), nullptr,
+                                  &laBootImgReadCb, nullptr);
     if (laret != ARCHIVE_OK) {
         throw_exception(env, IOException,
                         "%s: Failed to open ramdisk: %s",
@@ -350,6 +503,8 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
                 return nullptr;
             }
 
+            cache_result(std::string(buf));
+
             return env->NewStringUTF(buf);
         }
     }
@@ -361,6 +516,8 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         return nullptr;
     }
 
+    cache_result(std::nullopt);
+
     return nullptr;
 }
 
@@ -372,7 +529,6 @@ CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
 
     Reader reader1;
     Reader reader2;
-    size_t entries = 0;
 
     const char *filename1 = env->GetStringUTFChars(jfilename1, nullptr);
     if (!filename1) {
@@ -424,115 +580,15 @@ CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
         return false;
     }
 
-    // Read headers
-    auto header1 = reader1.read_header();
-    if (!header1) {
+    auto equal = compare(reader1, reader2);
+    if (!equal) {
         throw_exception(env, IOException,
-                        "%s: Failed to read header: %s",
-                        filename1, header1.error().message().c_str());
-        return false;
-    }
-    auto header2 = reader2.read_header();
-    if (!header2) {
-        throw_exception(env, IOException,
-                        "%s: Failed to read header: %s",
-                        filename2, header2.error().message().c_str());
+                        "Failed to compare boot images: %s",
+                        equal.error().message().c_str());
         return false;
     }
 
-    // Compare headers
-    if (header1.value() != header2.value()) {
-        return false;
-    }
-
-    // Count entries in first boot image
-    {
-        while (true) {
-            auto entry = reader1.read_entry();
-            if (!entry) {
-                if (entry.error() == ReaderError::EndOfEntries) {
-                    break;
-                }
-                throw_exception(env, IOException,
-                                "%s: Failed to read entry: %s",
-                                filename1, entry.error().message().c_str());
-                return false;
-            }
-            ++entries;
-        }
-    }
-
-    // Compare each entry in second image to first
-    {
-        while (true) {
-            auto entry2 = reader2.read_entry();
-            if (!entry2) {
-                if (entry2.error() == ReaderError::EndOfEntries) {
-                    break;
-                }
-                throw_exception(env, IOException,
-                                "%s: Failed to read entry: %s",
-                                filename2, entry2.error().message().c_str());
-                return false;
-            }
-
-            if (entries == 0) {
-                // Too few entries in second image
-                return false;
-            }
-            --entries;
-
-            // Find the same entry in first image
-            auto entry1 = reader1.go_to_entry(entry2.value().type());
-            if (!entry1) {
-                if (entry1.error() == ReaderError::EndOfEntries) {
-                    // Cannot be equal if entry is missing
-                } else {
-                    throw_exception(env, IOException,
-                                    "%s: Failed to seek to entry: %s", filename1,
-                                    entry1.error().message().c_str());
-                }
-                return false;
-            }
-
-            // Compare entries
-            if (entry1.value() != entry2.value()) {
-                return 2;
-            }
-
-            // Compare data
-            char buf1[10240];
-            char buf2[10240];
-
-            while (true) {
-                auto n1 = reader1.read_data(buf1, sizeof(buf1));
-                if (!n1) {
-                    throw_exception(env, IOException,
-                                    "%s: Failed to read data: %s", filename1,
-                                    n1.error().message().c_str());
-                    return false;
-                }
-
-                auto n2 = reader2.read_data(buf2, sizeof(buf2));
-                if (!n2) {
-                    throw_exception(env, IOException,
-                                    "%s: Failed to read data: %s", filename2,
-                                    n2.error().message().c_str());
-                    return false;
-                }
-
-                if (n1.value() == 0 && n2.value() == 0) {
-                    break;
-                } else if (n1.value() != n2.value()
-                        || memcmp(buf1, buf2, n1.value()) != 0) {
-                    // Data is not equivalent
-                    return false;
-                }
-            }
-        }
-    }
-
-    return true;
+    return equal.value();
 }
 
 }
@@ -23,6 +23,8 @@ std::string tw_resource_path = "/bootui/theme";
 std::string tw_settings_path = "/bootui/settings.bin";
 std::string tw_screenshots_path = "/bootui/screenshots";
 std::string tw_theme_zip_path = "/bootui/theme.zip";
+std::string tw_image_cache_path;
+std::string tw_frame_stats_path = "/bootui/framestats";
 
 int tw_android_sdk_version = 0;
 
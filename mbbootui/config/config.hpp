@@ -25,6 +25,10 @@ extern std::string tw_resource_path;
 extern std::string tw_settings_path;
 extern std::string tw_screenshots_path;
 extern std::string tw_theme_zip_path;
+// Directory for caching decoded theme images (disabled if empty)
+extern std::string tw_image_cache_path;
+// Directory for frame statistics dumps
+extern std::string tw_frame_stats_path;
 
 // TODO: Make TW_USE_KEY_CODE_TOUCH_SYNC an option
 
@@ -43,6 +43,7 @@
 #include "variables.h"
 
 #include "gui/blanktimer.hpp"
+#include "gui/framestats.hpp"
 #include "gui/gui.h"
 #include "gui/hardwarekeyboard.hpp"
 
@@ -167,6 +168,7 @@ GUIAction::GUIAction(xml_node<>* node)
         ADD_ACTION(sleep);
         ADD_ACTION(screenshot);
         ADD_ACTION(setbrightness);
+        ADD_ACTION(framestats);
         ADD_ACTION(setlanguage);
         ADD_ACTION(autoboot_cancel);
         ADD_ACTION(autoboot_skip);
@@ -614,6 +616,29 @@ int GUIAction::setbrightness(const std::string& arg)
     return TWFunc::Set_Brightness(arg);
 }
 
+// Control frame statistics collection. The argument is one of "start",
+// "stop", "reset", "overlay" (toggles the overlay) or "dump".
+int GUIAction::framestats(const std::string& arg)
+{
+    if (arg == "start") {
+        FrameStats::SetEnabled(true);
+    } else if (arg == "stop") {
+        FrameStats::SetEnabled(false);
+    } else if (arg == "reset") {
+        FrameStats::Reset();
+    } else if (arg == "overlay") {
+        FrameStats::SetOverlayVisible(!FrameStats::IsOverlayVisible());
+    } else if (arg == "dump") {
+        if (!FrameStats::Dump(tw_frame_stats_path)) {
+            return -1;
+        }
+    } else {
+        LOGE("Invalid framestats argument: '%s'", arg.c_str());
+        return -1;
+    }
+    return 0;
+}
+
 int GUIAction::autoboot(const std::string& arg __unused)
 {
     struct timespec wait_end;
@@ -84,6 +84,7 @@ protected:
     int sleep(const std::string& arg);
     int screenshot(const std::string& arg);
     int setbrightness(const std::string& arg);
+    int framestats(const std::string& arg);
 
     // (originally) threaded actions
     int autoboot(const std::string& arg);
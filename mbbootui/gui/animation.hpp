@@ -35,6 +35,13 @@ public:
     //  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
     virtual int Update();
 
+    // GetDamage - Returns the area that changed in the last update
+    virtual bool GetDamage(int& x, int& y, int& w, int& h)
+    {
+        GetRenderPos(x, y, w, h);
+        return true;
+    }
+
 protected:
     AnimationResource* mAnimation;
     int mFrame;
@@ -178,6 +178,7 @@ GUIConsole::GUIConsole(xml_node<>* node) : GUIScrollList(node)
     mSlideoutX = mSlideoutY = mSlideoutW = mSlideoutH = 0;
     mSlideout = 0;
     mSlideoutState = visible;
+    mSlideoutChanged = false;
 
     allowSelection = false; // console doesn't support list item selections
 
@@ -266,6 +267,8 @@ int GUIConsole::Render()
 
 int GUIConsole::Update()
 {
+    mSlideoutChanged = false;
+
     if (mSlideout && mSlideoutState != visible) {
         if (mSlideoutState == hidden) {
             return 0;
@@ -283,6 +286,7 @@ int GUIConsole::Update()
         SetVisibleListLocation(rConsole.size() - 1);
         mUpdate = 1;
         scrollToEnd = true;
+        mSlideoutChanged = true;
     }
 
     if (AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor)) {
@@ -300,13 +304,23 @@ int GUIConsole::Update()
 
     if (mUpdate) {
         mUpdate = 0;
-        if (Render() == 0) {
-            return 2;
-        }
+        // Repainted by PageManager within GetDamage()
+        return 2;
     }
     return 0;
 }
 
+bool GUIConsole::GetDamage(int& x, int& y, int& w, int& h)
+{
+    // The slideout button is drawn outside of the console area and
+    // showing or hiding the console changes what is below it
+    if (mSlideout && (mSlideoutState != visible || mSlideoutChanged)) {
+        return false;
+    }
+
+    return GUIScrollList::GetDamage(x, y, w, h);
+}
+
 // IsInRegion - Checks if the request is handled by this object
 //  Return 1 if this object handles the request, 0 if not
 int GUIConsole::IsInRegion(int x, int y)
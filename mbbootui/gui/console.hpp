@@ -34,6 +34,9 @@ public:
     //  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
     virtual int Update();
 
+    // GetDamage - Returns the area that changed in the last update
+    virtual bool GetDamage(int& x, int& y, int& w, int& h);
+
     // IsInRegion - Checks if the request is handled by this object
     //  Return 1 if this object handles the request, 0 if not
     virtual int IsInRegion(int x, int y);
@@ -63,6 +66,7 @@ protected:
     int mSlideoutX, mSlideoutY, mSlideoutW, mSlideoutH;
     int mSlideout;
     SlideoutState mSlideoutState;
+    bool mSlideoutChanged; // slideout state changed in the last update
     std::vector<std::string> rConsole;
     std::vector<std::string> rConsoleColor;
 
@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gui/framestats.hpp"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <cxxabi.h>
+
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+
+#include "config/config.hpp"
+
+#include "minuitwrp/minui.h"
+
+#include "gui/blanktimer.hpp"
+#include "gui/objects.hpp"
+#include "gui/pages.hpp"
+#include "gui/placement.h"
+#include "gui/resources.hpp"
+
+#define LOG_TAG "mbbootui/gui/framestats"
+
+// Number of rendered frames kept in the history
+#define FRAME_HISTORY_SIZE      512
+// Number of recent frames summarized by the overlay
+#define OVERLAY_FRAMES          30
+// Number of text lines in the overlay
+#define OVERLAY_LINES           3
+// Font used by the overlay
+#define OVERLAY_FONT            "font_s"
+
+using namespace std::chrono;
+
+struct FrameRecord
+{
+    // Time at which the frame was flipped
+    int64_t timestamp_us;
+    // Time since the previous rendered frame
+    int64_t interval_us;
+    // Work done since the previous rendered frame, by phase
+    int64_t phase_us[FrameStats::PHASE_COUNT];
+    // Repainted area (-1 if the whole screen was flipped)
+    int64_t damage_px;
+    unsigned int objects;
+    const std::type_info* slowest_type;
+    int slowest_x;
+    int slowest_y;
+    int64_t slowest_us;
+};
+
+struct ObjectKey
+{
+    std::type_index type;
+    int x;
+    int y;
+    int w;
+    int h;
+
+    bool operator<(const ObjectKey& other) const
+    {
+        if (type != other.type) {
+            return type < other.type;
+        }
+        if (x != other.x) {
+            return x < other.x;
+        }
+        if (y != other.y) {
+            return y < other.y;
+        }
+        if (w != other.w) {
+            return w < other.w;
+        }
+        return h < other.h;
+    }
+};
+
+struct ObjectTotals
+{
+    uint64_t renders;
+    int64_t total_us;
+    int64_t max_us;
+};
+
+bool FrameStats::sEnabled = false;
+bool FrameStats::sOverlayVisible = false;
+
+static std::array<FrameRecord, FRAME_HISTORY_SIZE> g_frames;
+static size_t g_frame_next;
+static size_t g_frame_count;
+static uint64_t g_frame_total;
+
+static FrameRecord g_current;
+static steady_clock::time_point g_last_frame;
+static bool g_have_last_frame;
+
+static std::map<ObjectKey, ObjectTotals> g_objects;
+static std::unordered_map<std::type_index, std::string> g_type_names;
+
+static volatile sig_atomic_t g_toggle_overlay_requested;
+static volatile sig_atomic_t g_dump_requested;
+
+static int64_t elapsed_us(steady_clock::time_point start)
+{
+    return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+static const char* get_type_name(std::type_index type)
+{
+    auto it = g_type_names.find(type);
+    if (it == g_type_names.end()) {
+        int status;
+        char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr,
+                                              &status);
+        it = g_type_names.emplace(
+                type, status == 0 ? demangled : type.name()).first;
+        free(demangled);
+    }
+    return it->second.c_str();
+}
+
+static const FrameRecord& get_frame(size_t age)
+{
+    return g_frames[(g_frame_next + FRAME_HISTORY_SIZE - 1 - age)
+            % FRAME_HISTORY_SIZE];
+}
+
+FrameStats::PhaseTimer::PhaseTimer(Phase phase)
+    : mPhase(phase), mActive(sEnabled)
+{
+    if (mActive) {
+        mStart = steady_clock::now();
+    }
+}
+
+FrameStats::PhaseTimer::~PhaseTimer()
+{
+    if (mActive && sEnabled) {
+        g_current.phase_us[mPhase] += elapsed_us(mStart);
+    }
+}
+
+FrameStats::ObjectTimer::ObjectTimer(RenderObject* object)
+    : mObject(sEnabled ? object : nullptr)
+{
+    if (mObject) {
+        mStart = steady_clock::now();
+    }
+}
+
+FrameStats::ObjectTimer::~ObjectTimer()
+{
+    if (!mObject || !sEnabled) {
+        return;
+    }
+
+    int64_t us = elapsed_us(mStart);
+
+    ObjectKey key{typeid(*mObject), 0, 0, 0, 0};
+    mObject->GetRenderPos(key.x, key.y, key.w, key.h);
+
+    auto& totals = g_objects[key];
+    ++totals.renders;
+    totals.total_us += us;
+    totals.max_us = std::max(totals.max_us, us);
+
+    ++g_current.objects;
+    if (!g_current.slowest_type || us > g_current.slowest_us) {
+        g_current.slowest_type = &typeid(*mObject);
+        g_current.slowest_x = key.x;
+        g_current.slowest_y = key.y;
+        g_current.slowest_us = us;
+    }
+}
+
+void FrameStats::SetEnabled(bool enabled)
+{
+    if (enabled == sEnabled) {
+        return;
+    }
+
+    sEnabled = enabled;
+    g_current = {};
+    g_have_last_frame = false;
+
+    LOGI("Frame statistics collection %s", enabled ? "started" : "stopped");
+
+    if (!enabled) {
+        SetOverlayVisible(false);
+    }
+}
+
+void FrameStats::Reset()
+{
+    g_frame_next = 0;
+    g_frame_count = 0;
+    g_frame_total = 0;
+    g_current = {};
+    g_have_last_frame = false;
+    g_objects.clear();
+}
+
+void FrameStats::EndFrame(bool rendered)
+{
+    if (!sEnabled || !rendered) {
+        return;
+    }
+
+    auto now = steady_clock::now();
+
+    g_current.timestamp_us = duration_cast<microseconds>(
+            now.time_since_epoch()).count();
+    g_current.interval_us = g_have_last_frame
+            ? duration_cast<microseconds>(now - g_last_frame).count() : 0;
+
+    int x, y, w, h;
+    if (PageManager::GetFlipRegion(x, y, w, h)) {
+        g_current.damage_px = static_cast<int64_t>(w) * h;
+    } else {
+        g_current.damage_px = -1;
+    }
+
+    g_frames[g_frame_next] = g_current;
+    g_frame_next = (g_frame_next + 1) % FRAME_HISTORY_SIZE;
+    g_frame_count = std::min<size_t>(g_frame_count + 1, FRAME_HISTORY_SIZE);
+    ++g_frame_total;
+
+    g_current = {};
+    g_last_frame = now;
+    g_have_last_frame = true;
+}
+
+void FrameStats::SetOverlayVisible(bool visible)
+{
+    if (visible == sOverlayVisible) {
+        return;
+    }
+
+    sOverlayVisible = visible;
+    if (visible) {
+        SetEnabled(true);
+    }
+
+    // Paint or remove the overlay right away
+    gui_forceRender();
+}
+
+bool FrameStats::GetOverlayRect(int& x, int& y, int& w, int& h)
+{
+    auto resources = PageManager::GetResources();
+    if (!resources) {
+        return false;
+    }
+
+    auto font = resources->FindFont(OVERLAY_FONT);
+    if (!font) {
+        return false;
+    }
+
+    x = 0;
+    y = 0;
+    w = gr_fb_width();
+    h = font->GetHeight() * OVERLAY_LINES;
+    return true;
+}
+
+// Draw a summary of the recent frames at the top of the screen. The caller
+// must include the overlay rect in the repainted region.
+void FrameStats::RenderOverlay()
+{
+    if (!sOverlayVisible || blankTimer.isScreenOff()) {
+        return;
+    }
+
+    int x, y, w, h;
+    if (!GetOverlayRect(x, y, w, h)) {
+        return;
+    }
+
+    FontResource* font = PageManager::GetResources()->FindFont(OVERLAY_FONT);
+    int line_h = font->GetHeight();
+
+    size_t count = std::min<size_t>(g_frame_count, OVERLAY_FRAMES);
+    int64_t interval_us = 0;
+    int64_t phase_us[PHASE_COUNT] = {};
+    int64_t max_us = 0;
+    const FrameRecord* slowest = nullptr;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto& frame = get_frame(i);
+        int64_t total_us = 0;
+
+        interval_us += frame.interval_us;
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            phase_us[p] += frame.phase_us[p];
+            total_us += frame.phase_us[p];
+        }
+        max_us = std::max(max_us, total_us);
+
+        if (frame.slowest_type && (!slowest
+                || frame.slowest_us > slowest->slowest_us)) {
+            slowest = &frame;
+        }
+    }
+
+    char lines[OVERLAY_LINES][128];
+
+    if (count == 0) {
+        snprintf(lines[0], sizeof(lines[0]), "No frames recorded");
+        lines[1][0] = '\0';
+        lines[2][0] = '\0';
+    } else {
+        double n = static_cast<double>(count);
+        snprintf(lines[0], sizeof(lines[0]),
+                 "%.1f fps, work avg %.1f ms, max %.1f ms",
+                 interval_us > 0 ? n * 1000000.0 / interval_us : 0.0,
+                 (phase_us[PHASE_INPUT] + phase_us[PHASE_UPDATE]
+                         + phase_us[PHASE_RENDER] + phase_us[PHASE_FLIP])
+                         / n / 1000.0,
+                 max_us / 1000.0);
+        snprintf(lines[1], sizeof(lines[1]),
+                 "input %.1f, update %.1f, render %.1f, flip %.1f ms",
+                 phase_us[PHASE_INPUT] / n / 1000.0,
+                 phase_us[PHASE_UPDATE] / n / 1000.0,
+                 phase_us[PHASE_RENDER] / n / 1000.0,
+                 phase_us[PHASE_FLIP] / n / 1000.0);
+        if (slowest) {
+            snprintf(lines[2], sizeof(lines[2]),
+                     "slowest: %s at %d,%d: %.1f ms",
+                     get_type_name(*slowest->slowest_type),
+                     slowest->slowest_x, slowest->slowest_y,
+                     slowest->slowest_us / 1000.0);
+        } else {
+            lines[2][0] = '\0';
+        }
+    }
+
+    gr_color(0, 0, 0, 255);
+    gr_fill(x, y, w, h);
+    gr_color(255, 255, 255, 255);
+    for (int i = 0; i < OVERLAY_LINES; ++i) {
+        gr_textEx_scaleW(x, y + i * line_h, lines[i], font->GetResource(),
+                         w, TOP_LEFT, 0);
+    }
+}
+
+static bool dump_frames(const std::string& path)
+{
+    FILE* fp = fopen(path.c_str(), "we");
+    if (!fp) {
+        LOGE("%s: Failed to open: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    fprintf(fp, "frame,timestamp_us,interval_us,input_us,update_us,"
+                "render_us,flip_us,damage_px,objects,slowest_object,"
+                "slowest_x,slowest_y,slowest_us\n");
+
+    for (size_t i = g_frame_count; i-- > 0;) {
+        auto& frame = get_frame(i);
+        fprintf(fp, "%" PRIu64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64
+                    ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%u,%s,%d,%d,%" PRId64
+                    "\n",
+                g_frame_total - 1 - i,
+                frame.timestamp_us,
+                frame.interval_us,
+                frame.phase_us[FrameStats::PHASE_INPUT],
+                frame.phase_us[FrameStats::PHASE_UPDATE],
+                frame.phase_us[FrameStats::PHASE_RENDER],
+                frame.phase_us[FrameStats::PHASE_FLIP],
+                frame.damage_px,
+                frame.objects,
+                frame.slowest_type ? get_type_name(*frame.slowest_type) : "",
+                frame.slowest_x,
+                frame.slowest_y,
+                frame.slowest_us);
+    }
+
+    if (fclose(fp) != 0) {
+        LOGE("%s: Failed to close: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool dump_objects(const std::string& path)
+{
+    FILE* fp = fopen(path.c_str(), "we");
+    if (!fp) {
+        LOGE("%s: Failed to open: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Most expensive objects first
+    std::vector<const std::pair<const ObjectKey, ObjectTotals>*> objects;
+    objects.reserve(g_objects.size());
+    for (auto const& item : g_objects) {
+        objects.push_back(&item);
+    }
+    std::sort(objects.begin(), objects.end(), [](auto a, auto b) {
+        return a->second.total_us > b->second.total_us;
+    });
+
+    fprintf(fp, "object,x,y,w,h,renders,total_us,avg_us,max_us\n");
+
+    for (auto item : objects) {
+        auto& key = item->first;
+        auto& totals = item->second;
+        fprintf(fp, "%s,%d,%d,%d,%d,%" PRIu64 ",%" PRId64 ",%" PRId64
+                    ",%" PRId64 "\n",
+                get_type_name(key.type), key.x, key.y, key.w, key.h,
+                totals.renders, totals.total_us,
+                totals.total_us / static_cast<int64_t>(totals.renders),
+                totals.max_us);
+    }
+
+    if (fclose(fp) != 0) {
+        LOGE("%s: Failed to close: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool FrameStats::Dump(const std::string& dir)
+{
+    if (auto r = mb::util::mkdir_recursive(dir, 0755); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             dir.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (!dump_frames(dir + "/frames.csv")
+            || !dump_objects(dir + "/objects.csv")) {
+        return false;
+    }
+
+    LOGI("Dumped statistics for %zu frames and %zu objects to %s",
+         g_frame_count, g_objects.size(), dir.c_str());
+    return true;
+}
+
+static void signal_handler(int sig)
+{
+    if (sig == SIGUSR1) {
+        g_toggle_overlay_requested = 1;
+    } else if (sig == SIGUSR2) {
+        g_dump_requested = 1;
+    }
+    ev_wake();
+}
+
+// Allow the overlay and dumps to be requested from a shell, eg. from the
+// terminal: kill -USR1 <pid> toggles the overlay and kill -USR2 <pid> dumps
+// the statistics to tw_frame_stats_path.
+void FrameStats::InstallSignalHandlers()
+{
+    struct sigaction sa = {};
+    sa.sa_handler = &signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+
+    sigaction(SIGUSR1, &sa, nullptr);
+    sigaction(SIGUSR2, &sa, nullptr);
+}
+
+void FrameStats::ProcessSignals()
+{
+    if (g_toggle_overlay_requested) {
+        g_toggle_overlay_requested = 0;
+        SetOverlayVisible(!sOverlayVisible);
+    }
+
+    if (g_dump_requested) {
+        g_dump_requested = 0;
+        if (!sEnabled) {
+            // Start collecting so that the next dump has data
+            LOGW("Frame statistics are not being collected");
+            SetEnabled(true);
+        } else {
+            Dump(tw_frame_stats_path);
+        }
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+
+class RenderObject;
+
+// Frame timing instrumentation for finding slow widgets. Collection is off by
+// default and every hook reduces to a single branch until it is enabled.
+class FrameStats
+{
+public:
+    enum Phase
+    {
+        PHASE_INPUT,
+        PHASE_UPDATE,
+        PHASE_RENDER,
+        PHASE_FLIP,
+        PHASE_COUNT,
+    };
+
+    // Accumulates the time spent in a phase of the current frame
+    class PhaseTimer
+    {
+    public:
+        explicit PhaseTimer(Phase phase);
+        ~PhaseTimer();
+
+    private:
+        Phase mPhase;
+        bool mActive;
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    // Records the time spent rendering an object
+    class ObjectTimer
+    {
+    public:
+        explicit ObjectTimer(RenderObject* object);
+        ~ObjectTimer();
+
+    private:
+        RenderObject* mObject;
+        std::chrono::steady_clock::time_point mStart;
+    };
+
+    static bool IsEnabled()
+    {
+        return sEnabled;
+    }
+
+    static void SetEnabled(bool enabled);
+    static void Reset();
+
+    // Commits the current frame to the history if something was rendered.
+    // Work done in iterations that did not render is counted towards the
+    // next rendered frame.
+    static void EndFrame(bool rendered);
+
+    static bool IsOverlayVisible()
+    {
+        return sOverlayVisible;
+    }
+
+    // Showing the overlay also enables collection
+    static void SetOverlayVisible(bool visible);
+    static bool GetOverlayRect(int& x, int& y, int& w, int& h);
+    static void RenderOverlay();
+
+    // Writes frames.csv and objects.csv to the directory
+    static bool Dump(const std::string& dir);
+
+    // Handle requests sent with SIGUSR1 (toggle overlay) and SIGUSR2 (dump)
+    static void InstallSignalHandlers();
+    static void ProcessSignals();
+
+private:
+    static bool sEnabled;
+    static bool sOverlayVisible;
+};
@@ -18,6 +18,7 @@
 
 #include "gui/gui.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 
@@ -36,6 +37,7 @@
 #include "minuitwrp/minui.h"
 
 #include "gui/blanktimer.hpp"
+#include "gui/framestats.hpp"
 #include "gui/hardwarekeyboard.hpp"
 #include "gui/mousecursor.hpp"
 #include "gui/objects.hpp"
@@ -43,9 +45,6 @@
 
 #define LOG_TAG "mbbootui/gui/gui"
 
-// Enable to print render time of each frame to the log file
-//#define PRINT_RENDER_TIME 1
-
 #ifdef _EVENT_LOGGING
 #define LOGEVENT(...) LOGE(__VA_ARGS__)
 #else
@@ -82,6 +81,19 @@ void flip()
     gr_flip();
 }
 
+// Flip the frame rendered by PageManager::RenderDamage()
+static void flip_damage()
+{
+    int x, y, w, h;
+
+    if (gRecorder != -1 || !PageManager::GetFlipRegion(x, y, w, h)) {
+        flip();
+        return;
+    }
+
+    gr_flip_region(x, y, w, h);
+}
+
 void rapidxml::parse_error_handler(const char *what, void *where)
 {
     fprintf(stderr, "Parser error: %s\n", what);
@@ -153,6 +165,7 @@ private:
     struct timespec touchStart; // used to track time for long press / key repeat
 
     void processHoldAndRepeat();
+    void updateHoldTimer();
     void process_EV_REL(input_event& ev);
     void process_EV_ABS(input_event& ev);
     void process_EV_KEY(input_event& ev);
@@ -169,15 +182,20 @@ bool InputHandler::processInput(int timeout_ms)
     int ret = ev_get(&ev, timeout_ms);
 
     if (ret < 0) {
+        FrameStats::PhaseTimer timer(FrameStats::PHASE_INPUT);
+
         // This path means that we did not get any new touch data, but
         // we do not get new touch data if you press and hold on either
         // the screen or on a keyboard key or mouse button
         if (touch_status || key_status) {
             processHoldAndRepeat();
         }
+        updateHoldTimer();
         return (ret != -2);  // -2 means no more events in the queue
     }
 
+    FrameStats::PhaseTimer timer(FrameStats::PHASE_INPUT);
+
     switch (ev.type) {
     case EV_ABS:
         process_EV_ABS(ev);
@@ -193,9 +211,38 @@ bool InputHandler::processInput(int timeout_ms)
     }
 
     blankTimer.resetTimerAndUnblank();
+    updateHoldTimer();
     return true;  // we got an event, so there might be more in the queue
 }
 
+// Arm the event loop's timer so that it wakes up when the current touch or key
+// hold becomes due instead of polling for it
+void InputHandler::updateHoldTimer()
+{
+    int interval;
+
+    if (touch_status == TS_TOUCH_AND_HOLD) {
+        interval = touch_hold_ms;
+    } else if (touch_status == TS_TOUCH_REPEAT) {
+        interval = touch_repeat_ms;
+    } else if (key_status == KS_KEY_PRESSED) {
+        interval = key_hold_ms;
+    } else if (key_status == KS_KEY_REPEAT) {
+        interval = key_repeat_ms;
+    } else {
+        ev_set_timer(0);
+        return;
+    }
+
+    struct timespec curTime;
+    clock_gettime(CLOCK_MONOTONIC, &curTime);
+    long mtime = (curTime.tv_sec - touchStart.tv_sec) * 1000
+            + (curTime.tv_nsec - touchStart.tv_nsec) / 1000000;
+
+    // processHoldAndRepeat() fires only once the interval has been exceeded
+    ev_set_timer(std::max(interval - mtime + 1, 1L));
+}
+
 void InputHandler::processHoldAndRepeat()
 {
     HardwareKeyboard *kb = PageManager::GetHardwareKeyboard();
@@ -352,6 +399,7 @@ void InputHandler::handleDrag()
     // This allows us to only send one NotifyTouch event per render
     // cycle to reduce overhead and perceived input latency.
     static int prevx = 0, prevy = 0; // these track where the last drag notice was so that we don't send duplicate drag notices
+    FrameStats::PhaseTimer timer(FrameStats::PHASE_INPUT);
     if (touch_status && (x != prevx || y != prevy)) {
         prevx = x;
         prevy = y;
@@ -380,6 +428,13 @@ static void loopTimer(int input_timeout_ms)
 
     do {
         bool got_event = input_handler.processInput(input_timeout_ms); // get inputs but don't send drag notices
+        if (gForceRender) {
+            // Woken up by gui_forceRender()
+            lastCall = steady_clock::now();
+            input_handler.handleDrag();
+            return;
+        }
+
         auto curTime = steady_clock::now();
         auto diff = duration_cast<nanoseconds>(curTime - lastCall);
 
@@ -397,10 +452,13 @@ static void loopTimer(int input_timeout_ms)
             return;
         }
 
-        // We need to sleep some period time microseconds
-        //unsigned int sleepTime = 33333 -(diff.tv_nsec / 1000);
-        //usleep(sleepTime); // removed so we can scan for input
-        input_timeout_ms = 0;
+        // Wait for input until the next frame is due instead of spinning
+        if (got_event) {
+            input_timeout_ms = 0;
+        } else {
+            input_timeout_ms = static_cast<int>(
+                    (timeout - diff.count() + 999999) / 1000000);
+        }
     } while (1);
 }
 
@@ -426,6 +484,7 @@ static int runPages(const char *page_name, const int stop_on_page_done)
     int idle_frames = 0;
 
     for (;;) {
+        FrameStats::ProcessSignals();
         loopTimer(input_timeout_ms);
         if (g_pty_fd > 0) {
             // TODO: this is not nice, we should have one central select for input, pty
@@ -440,7 +499,11 @@ static int runPages(const char *page_name, const int stop_on_page_done)
         }
 
         if (!gForceRender) {
-            int ret = PageManager::Update();
+            int ret;
+            {
+                FrameStats::PhaseTimer timer(FrameStats::PHASE_UPDATE);
+                ret = PageManager::Update();
+            }
             if (ret == 0) {
                 ++idle_frames;
             } else if (ret == -2) {
@@ -451,36 +514,38 @@ static int runPages(const char *page_name, const int stop_on_page_done)
             // due to possible animation objects, we need to delay activating the input timeout
             input_timeout_ms = idle_frames > 15 ? 1000 : 0;
 
-#ifndef PRINT_RENDER_TIME
-            if (ret > 1) {
-                PageManager::Render();
-            }
-
             if (ret > 0) {
-                flip();
+                // The overlay covers whatever was drawn below it
+                int x, y, w, h;
+                bool overlay = FrameStats::IsOverlayVisible()
+                        && FrameStats::GetOverlayRect(x, y, w, h);
+                if (overlay) {
+                    PageManager::AddDamage(x, y, w, h);
+                }
+
+                {
+                    FrameStats::PhaseTimer timer(FrameStats::PHASE_RENDER);
+                    PageManager::RenderDamage(ret > 1 || overlay);
+                }
+                FrameStats::RenderOverlay();
+                {
+                    FrameStats::PhaseTimer timer(FrameStats::PHASE_FLIP);
+                    flip_damage();
+                }
             }
-#else
-            if (ret > 1) {
-                auto start = steady_clock::now();
+            FrameStats::EndFrame(ret > 0);
+        } else {
+            gForceRender = 0;
+            {
+                FrameStats::PhaseTimer timer(FrameStats::PHASE_RENDER);
                 PageManager::Render();
-                auto end = steady_clock::now();
-                auto render_t = duration_cast<milliseconds>(end - start);
-
-                flip();
-                auto flip_end = steady_clock::now();
-                auto flip_t = duration_cast<milliseconds>(flip_end - end);
-
-                LOGI("Render(): %" PRId64 " ms, flip(): %" PRId64 " ms, total: %" PRId64 " ms",
-                     render_t.count(), flip_t.count(),
-                     render_t.count() + flip_t.count());
-            } else if (ret > 0) {
+            }
+            FrameStats::RenderOverlay();
+            {
+                FrameStats::PhaseTimer timer(FrameStats::PHASE_FLIP);
                 flip();
             }
-#endif
-        } else {
-            gForceRender = 0;
-            PageManager::Render();
-            flip();
+            FrameStats::EndFrame(true);
             input_timeout_ms = 0;
         }
 
@@ -500,6 +565,8 @@ static int runPages(const char *page_name, const int stop_on_page_done)
 int gui_forceRender()
 {
     gForceRender = 1;
+    // Don't wait for the input timeout before rendering
+    ev_wake();
     return 0;
 }
 
@@ -507,7 +574,7 @@ int gui_changePage(std::string newPage)
 {
     LOGI("Set page: '%s'", newPage.c_str());
     PageManager::ChangePage(newPage);
-    gForceRender = 1;
+    gui_forceRender();
     return 0;
 }
 
@@ -515,7 +582,7 @@ int gui_changeOverlay(std::string overlay)
 {
     LOGI("Set overlay: '%s'", overlay.c_str());
     PageManager::ChangeOverlay(overlay);
-    gForceRender = 1;
+    gui_forceRender();
     return 0;
 }
 
@@ -607,6 +674,7 @@ extern "C" int gui_init()
     }
 
     ev_init();
+    FrameStats::InstallSignalHandlers();
     return 0;
 }
 
@@ -50,6 +50,15 @@ public:
         return 0;
     }
 
+    // GetDamage - Returns the area that changed when Update() returns >0
+    //  Return false if the whole screen must be redrawn. Objects that return
+    //  true must never draw outside of that area.
+    virtual bool GetDamage(int& x __unused, int& y __unused,
+                           int& w __unused, int& h __unused)
+    {
+        return false;
+    }
+
     // GetRenderPos - Returns the current position of the object
     virtual int GetRenderPos(int& x, int& y, int& w, int& h)
     {
@@ -21,6 +21,7 @@
 #include "gui/objects.hpp"
 
 #include <algorithm>
+#include <iterator>
 
 #include <cstring>
 
@@ -50,6 +51,7 @@
 #include "gui/console.hpp"
 #include "gui/fileselector.hpp"
 #include "gui/fill.hpp"
+#include "gui/framestats.hpp"
 #include "gui/hardwarekeyboard.hpp"
 #include "gui/image.hpp"
 #include "gui/input.hpp"
@@ -83,6 +85,9 @@ MouseCursor *PageManager::mMouseCursor = nullptr;
 HardwareKeyboard *PageManager::mHardwareKeyboard = nullptr;
 bool PageManager::mReloadTheme = false;
 std::string PageManager::mStartPage = "main";
+DamageRect PageManager::mDamage;
+DamageRect PageManager::mDamageHistory[2];
+DamageRect PageManager::mFlipDamage;
 std::vector<language_struct> Language_List;
 
 int tw_x_offset = 0;
@@ -509,6 +514,43 @@ bool Page::ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, in
     return true;
 }
 
+void DamageRect::Add(int x, int y, int w, int h)
+{
+    if (full || w <= 0 || h <= 0) {
+        return;
+    }
+
+    if (IsEmpty()) {
+        x1 = x;
+        y1 = y;
+        x2 = x + w;
+        y2 = y + h;
+    } else {
+        x1 = std::min(x1, x);
+        y1 = std::min(y1, y);
+        x2 = std::max(x2, x + w);
+        y2 = std::max(y2, y + h);
+    }
+}
+
+void DamageRect::Add(const DamageRect& other)
+{
+    if (other.full) {
+        full = true;
+    } else if (!other.IsEmpty()) {
+        Add(other.x1, other.y1, other.x2 - other.x1, other.y2 - other.y1);
+    }
+}
+
+bool DamageRect::Intersects(int x, int y, int w, int h) const
+{
+    if (full) {
+        return true;
+    }
+
+    return x < x2 && x + w > x1 && y < y2 && y + h > y1;
+}
+
 int Page::Render()
 {
     // Render background
@@ -517,6 +559,7 @@ int Page::Render()
 
     // Render remaining objects
     for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
+        FrameStats::ObjectTimer timer(*iter);
         if ((*iter)->Render()) {
             LOGE("A render request has failed.");
         }
@@ -524,7 +567,33 @@ int Page::Render()
     return 0;
 }
 
-int Page::Update()
+// Repaint the part of the page inside the damaged region. Objects that report
+// their damage are known to draw only inside their render area, so they are
+// skipped if they do not intersect the region. Everything else is rendered and
+// relies on the clip bounds set by the caller.
+int Page::RenderDamage(const DamageRect& damage)
+{
+    gr_color(mBackground.red, mBackground.green, mBackground.blue, mBackground.alpha);
+    gr_fill(damage.x1, damage.y1, damage.x2 - damage.x1, damage.y2 - damage.y1);
+
+    for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
+        // Objects that report their damage stay within their bounds
+        int x, y, w, h;
+        if ((*iter)->GetDamage(x, y, w, h)) {
+            (*iter)->GetRenderPos(x, y, w, h);
+            if (!damage.Intersects(x, y, w, h)) {
+                continue;
+            }
+        }
+        FrameStats::ObjectTimer timer(*iter);
+        if ((*iter)->Render()) {
+            LOGE("A render request has failed.");
+        }
+    }
+    return 0;
+}
+
+int Page::Update(DamageRect& damage)
 {
     int retCode = 0;
 
@@ -532,9 +601,19 @@ int Page::Update()
         int ret = (*iter)->Update();
         if (ret < 0) {
             LOGE("An update request has failed.");
+            continue;
         } else if (ret > retCode) {
             retCode = ret;
         }
+
+        if (ret > 0) {
+            int x, y, w, h;
+            if ((*iter)->GetDamage(x, y, w, h)) {
+                damage.Add(x, y, w, h);
+            } else {
+                damage.full = true;
+            }
+        }
     }
 
     return retCode;
@@ -972,6 +1051,11 @@ const ResourceManager* PageSet::GetResources()
     return mResources;
 }
 
+void PageSet::WaitForResources()
+{
+    mResources->WaitForResources();
+}
+
 Page* PageSet::FindPage(const std::string& name)
 {
     for (auto iter = mPages.begin(); iter != mPages.end(); iter++) {
@@ -1091,17 +1175,35 @@ int PageSet::Render()
     return ret;
 }
 
-int PageSet::Update()
+int PageSet::RenderDamage(const DamageRect& damage)
 {
     int ret;
 
-    ret = (mCurrentPage ? mCurrentPage->Update() : -1);
+    ret = (mCurrentPage ? mCurrentPage->RenderDamage(damage) : -1);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (auto iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
+        ret = ((*iter) ? (*iter)->RenderDamage(damage) : -1);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return ret;
+}
+
+int PageSet::Update(DamageRect& damage)
+{
+    int ret;
+
+    ret = (mCurrentPage ? mCurrentPage->Update(damage) : -1);
     if (ret < 0 || ret > 1) {
         return ret;
     }
 
     for (auto iter = mOverlays.begin(); iter != mOverlays.end(); iter++) {
-        ret = ((*iter) ? (*iter)->Update() : -1);
+        ret = ((*iter) ? (*iter)->Update(damage) : -1);
         if (ret < 0) {
             return ret;
         }
@@ -1394,6 +1496,9 @@ int PageManager::LoadPackage(const std::string& name,
     ret = mCurrentSet->Load(ctx, mainxmlfilename);
     currentLoadingContext = nullptr;
 
+    // Images are decoded in the background and read from the zip
+    mCurrentSet->WaitForResources();
+
     if (ret == 0) {
         mCurrentSet->SetPage(startpage);
         mPageSets.insert(std::pair<std::string, PageSet*>(name, mCurrentSet));
@@ -1582,9 +1687,89 @@ int PageManager::Render()
     if (mMouseCursor) {
         mMouseCursor->Render();
     }
+
+    DamageRect full;
+    full.full = true;
+    PushDamageHistory(full);
+    mFlipDamage = full;
+
+    return res;
+}
+
+// Bring the drawing surface up to date after an Update() that returned a
+// positive value. With buffer age tracking, only the region that changed since
+// the surface was last displayed is repainted. Objects that rendered
+// themselves during Update() do not need a repaint unless the surface is older
+// than the previous frame.
+int PageManager::RenderDamage(bool needRender)
+{
+    if (blankTimer.isScreenOff()) {
+        return 0;
+    }
+
+    int age = gr_buffer_age();
+    DamageRect region = mDamage;
+
+    if (age <= 0 || age > static_cast<int>(std::size(mDamageHistory)) + 1) {
+        region.full = true;
+    } else {
+        for (int i = 0; i < age - 1; ++i) {
+            region.Add(mDamageHistory[i]);
+        }
+    }
+
+    if (region.full) {
+        return Render();
+    }
+
+    int res = 0;
+
+    if ((needRender || age > 1) && !region.IsEmpty()) {
+        gr_set_clip_bounds(region.x1, region.y1,
+                           region.x2 - region.x1, region.y2 - region.y1);
+        res = (mCurrentSet ? mCurrentSet->RenderDamage(region) : -1);
+        if (mMouseCursor) {
+            mMouseCursor->Render();
+        }
+        gr_reset_clip_bounds();
+    }
+
+    PushDamageHistory(mDamage);
+    mFlipDamage = mDamage;
+
     return res;
 }
 
+// Get the region that changed in the frame about to be flipped. Returns false
+// if the whole screen must be flipped.
+bool PageManager::GetFlipRegion(int& x, int& y, int& w, int& h)
+{
+    if (mFlipDamage.full) {
+        return false;
+    }
+
+    x = mFlipDamage.x1;
+    y = mFlipDamage.y1;
+    w = mFlipDamage.x2 - mFlipDamage.x1;
+    h = mFlipDamage.y2 - mFlipDamage.y1;
+    return true;
+}
+
+// Mark an area that is drawn over the page, such as the frame statistics
+// overlay, as changed in the last Update()
+void PageManager::AddDamage(int x, int y, int w, int h)
+{
+    mDamage.Add(x, y, w, h);
+}
+
+void PageManager::PushDamageHistory(const DamageRect& damage)
+{
+    for (size_t i = std::size(mDamageHistory) - 1; i > 0; --i) {
+        mDamageHistory[i] = mDamageHistory[i - 1];
+    }
+    mDamageHistory[0] = damage;
+}
+
 HardwareKeyboard *PageManager::GetHardwareKeyboard()
 {
     if (!mHardwareKeyboard) {
@@ -1644,13 +1829,18 @@ int PageManager::Update()
         return -2;
     }
 
-    int res = (mCurrentSet ? mCurrentSet->Update() : -1);
+    mDamage = DamageRect();
+
+    int res = (mCurrentSet ? mCurrentSet->Update(mDamage) : -1);
 
     if (mMouseCursor) {
         int c_res = mMouseCursor->Update();
         if (c_res > res) {
             res = c_res;
         }
+        if (c_res > 0) {
+            mDamage.full = true;
+        }
     }
     return res;
 }
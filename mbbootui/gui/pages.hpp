@@ -64,6 +64,25 @@ class MouseCursor;
 class GUIObject;
 class HardwareKeyboard;
 
+// Bounding box of the parts of the screen that changed during an update
+struct DamageRect
+{
+    bool full = false;
+    int x1 = 0;
+    int y1 = 0;
+    int x2 = 0;
+    int y2 = 0;
+
+    bool IsEmpty() const
+    {
+        return !full && (x1 >= x2 || y1 >= y2);
+    }
+
+    void Add(int x, int y, int w, int h);
+    void Add(const DamageRect& other);
+    bool Intersects(int x, int y, int w, int h) const;
+};
+
 class Page
 {
 public:
@@ -77,7 +96,8 @@ public:
 
 public:
     virtual int Render();
-    virtual int Update();
+    virtual int RenderDamage(const DamageRect& damage);
+    virtual int Update(DamageRect& damage);
     virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
     virtual int NotifyKey(int key, bool down);
     virtual int NotifyCharInput(int ch);
@@ -117,6 +137,7 @@ public:
     int SetPage(const std::string& page);
     int SetOverlay(Page* page);
     const ResourceManager* GetResources();
+    void WaitForResources();
 
     // Helper routine for identifing if we're the current page
     int IsCurrentPage(Page* page);
@@ -124,7 +145,8 @@ public:
 
     // These are routing routines
     int Render();
-    int Update();
+    int RenderDamage(const DamageRect& damage);
+    int Update(DamageRect& damage);
     int NotifyTouch(TOUCH_STATE state, int x, int y);
     int NotifyKey(int key, bool down);
     int NotifyCharInput(int ch);
@@ -174,6 +196,9 @@ public:
     // These are routing routines
     static int Render();
     static int Update();
+    static int RenderDamage(bool needRender);
+    static bool GetFlipRegion(int& x, int& y, int& w, int& h);
+    static void AddDamage(int x, int y, int w, int h);
     static int NotifyTouch(TOUCH_STATE state, int x, int y);
     static int NotifyKey(int key, bool down);
     static int NotifyCharInput(int ch);
@@ -191,6 +216,7 @@ public:
 protected:
     static PageSet* FindPackage(const std::string& name);
     static void LoadLanguageListDir(const std::string& dir);
+    static void PushDamageHistory(const DamageRect& damage);
 
 protected:
     static std::unordered_map<std::string, PageSet*> mPageSets;
@@ -199,6 +225,13 @@ protected:
     static HardwareKeyboard *mHardwareKeyboard;
     static bool mReloadTheme;
     static std::string mStartPage;
+    // Damage from the last Update()
+    static DamageRect mDamage;
+    // Damage of previous frames, most recent first. Used for repainting
+    // drawing surfaces that were last displayed several flips ago.
+    static DamageRect mDamageHistory[2];
+    // Region that changed in the frame about to be flipped
+    static DamageRect mFlipDamage;
     static LoadingContext* currentLoadingContext;
 };
 
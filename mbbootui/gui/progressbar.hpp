@@ -34,6 +34,13 @@ public:
     //  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
     virtual int Update();
 
+    // GetDamage - Returns the area that changed in the last update
+    virtual bool GetDamage(int& x, int& y, int& w, int& h)
+    {
+        GetRenderPos(x, y, w, h);
+        return true;
+    }
+
     // NotifyVarChange - Notify of a variable change
     //  Returns 0 on success, <0 on error
     virtual int NotifyVarChange(const std::string& varName, const std::string& value);
@@ -2,29 +2,141 @@
 
 #include "gui/objects.hpp"
 
+#include <algorithm>
+#include <cinttypes>
+#include <deque>
 #include <iomanip>
 #include <iostream>
+#include <thread>
+#include <vector>
 
+#include <dirent.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mbutil/delete.h"
+#include "mbutil/directory.h"
+#include "mbutil/hash.h"
 
 #include "twrp-functions.hpp"
 
+#include "config/config.hpp"
+
 #include "gui/gui.h"
 
 #define LOG_TAG "mbbootui/gui/resources"
 
 #define TMP_RESOURCE_NAME   "/tmp/extract.bin"
 
+#define MAX_LOADER_THREADS  4
+
+// The image cache is cleared when it grows beyond this size
+#define MAX_IMAGE_CACHE_SIZE    (64 * 1024 * 1024)
+
+// Worker threads that decode images while the theme XML is being processed
+class ResourceLoader
+{
+public:
+    static ResourceLoader& Get()
+    {
+        static ResourceLoader loader;
+        return loader;
+    }
+
+    void Submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mJobs.push_back(std::move(job));
+        }
+        mCond.notify_one();
+    }
+
+private:
+    ResourceLoader()
+    {
+        unsigned int count = std::clamp(std::thread::hardware_concurrency(),
+                                        1u, static_cast<unsigned int>(MAX_LOADER_THREADS));
+        for (unsigned int i = 0; i < count; ++i) {
+            mThreads.emplace_back(&ResourceLoader::Run, this);
+        }
+    }
+
+    ~ResourceLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCond.notify_all();
+
+        for (auto& thread : mThreads) {
+            thread.join();
+        }
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+
+        while (true) {
+            mCond.wait(lock, [this] { return mStop || !mJobs.empty(); });
+            if (mJobs.empty()) {
+                return;
+            }
+
+            auto job = std::move(mJobs.front());
+            mJobs.pop_front();
+
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::deque<std::function<void()>> mJobs;
+    std::vector<std::thread> mThreads;
+    bool mStop = false;
+};
+
 Resource::Resource(xml_node<>* node, ZipArchive* pZip __unused)
+    : mLoaded(true)
 {
     if (node && node->first_attribute("name")) {
         mName = node->first_attribute("name")->value();
     }
 }
 
+void Resource::LoadAsync(std::function<void()> job)
+{
+    mLoaded = false;
+
+    ResourceLoader::Get().Submit([this, job = std::move(job)] {
+        job();
+
+        {
+            std::lock_guard<std::mutex> lock(mLoadMutex);
+            mLoaded = true;
+        }
+        mLoadCond.notify_all();
+    });
+}
+
+void Resource::WaitLoaded()
+{
+    if (mLoaded) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mLoadMutex);
+    mLoadCond.wait(lock, [this] { return mLoaded.load(); });
+}
+
 int Resource::ExtractResource(ZipArchive* pZip,
                               const std::string& folderName,
                               const std::string& fileName,
@@ -57,24 +169,145 @@ int Resource::ExtractResource(ZipArchive* pZip,
     return ret;
 }
 
-void Resource::LoadImage(ZipArchive* pZip, const std::string& file,
-                         gr_surface* surface)
+// Clear the image cache if it has grown too large. Entries are never removed
+// individually, so stale images from old themes accumulate until then.
+static void init_image_cache()
+{
+    if (auto r = mb::util::mkdir_recursive(tw_image_cache_path, 0700); !r) {
+        LOGW("%s: Failed to create directory: %s",
+             tw_image_cache_path.c_str(), r.error().message().c_str());
+        return;
+    }
+
+    DIR* dir = opendir(tw_image_cache_path.c_str());
+    if (!dir) {
+        return;
+    }
+
+    off_t total = 0;
+    struct stat sb;
+    while (struct dirent* de = readdir(dir)) {
+        if (fstatat(dirfd(dir), de->d_name, &sb, 0) == 0
+                && S_ISREG(sb.st_mode)) {
+            total += sb.st_size;
+        }
+    }
+    closedir(dir);
+
+    if (total > MAX_IMAGE_CACHE_SIZE) {
+        LOGI("Clearing image cache (%" PRId64 " bytes)",
+             static_cast<int64_t>(total));
+        (void) mb::util::delete_contents(tw_image_cache_path, {});
+    }
+}
+
+// Find the file that res_create_surface() decodes for an image in the theme
+// directory
+static std::string find_image_file(const std::string& file)
 {
+    std::string paths[] = {
+        tw_resource_path + "/images/" + file + ".png",
+        file,
+        tw_resource_path + "/images/" + file,
+    };
+
+    for (auto const& path : paths) {
+        if (access(path.c_str(), R_OK) == 0) {
+            return path;
+        }
+    }
+
+    return {};
+}
+
+// Get the cache path for the decoded and scaled version of an image. This
+// depends only on the image data. Everything else that affects decoding and
+// scaling is part of the tag, which is checked when loading from the cache.
+static bool get_image_cache_path(const std::string& source, int retain_aspect,
+                                 std::string& path, std::string& tag)
+{
+    static std::once_flag init_flag;
+
+    if (tw_image_cache_path.empty() || source.empty()) {
+        return false;
+    }
+
+    std::call_once(init_flag, init_image_cache);
+
+    auto digest = mb::util::sha512_hash(source);
+    if (!digest) {
+        return false;
+    }
+
+    char hex[41];
+    for (size_t i = 0; i < 20; ++i) {
+        snprintf(hex + i * 2, 3, "%02x", digest.value()[i]);
+    }
+
+    path = tw_image_cache_path;
+    path += '/';
+    path += hex;
+    path += retain_aspect ? "-a.bin" : ".bin";
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s/%d/%.4f/%.4f", mb::version(),
+             static_cast<int>(tw_device.tw_pixel_format()),
+             get_scale_w(), get_scale_h());
+    tag = buf;
+
+    return true;
+}
+
+void Resource::LoadScaledImage(ZipArchive* pZip, const std::string& file,
+                               int retain_aspect, gr_surface* surface)
+{
+    // Images are loaded concurrently, so each needs its own temporary file
+    static std::atomic<unsigned int> counter(0);
+    std::string tmpname = TMP_RESOURCE_NAME ".";
+    tmpname += std::to_string(counter++);
+
+    // JPG includes the .jpg extension in the filename so extension should be blank
+    bool extracted = ExtractResource(pZip, "images", file, ".png", tmpname) == 0
+            || ExtractResource(pZip, "images", file, "", tmpname) == 0;
+    std::string source = extracted ? tmpname : pZip ? "" : find_image_file(file);
+    std::string cache_path;
+    std::string cache_tag;
+    bool use_cache = get_image_cache_path(source, retain_aspect,
+                                          cache_path, cache_tag);
+
+    *surface = nullptr;
+
+    if (use_cache && res_load_surface(cache_path.c_str(), cache_tag.c_str(),
+                                      surface) == 0) {
+        if (extracted) {
+            unlink(tmpname.c_str());
+        }
+        return;
+    }
+
+    gr_surface temp_surface = nullptr;
     int rc = 0;
-    if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0) {
-        rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-        unlink(TMP_RESOURCE_NAME);
-    } else if (ExtractResource(pZip, "images", file, "", TMP_RESOURCE_NAME) == 0) {
-        // JPG includes the .jpg extension in the filename so extension should be blank
-        rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-        unlink(TMP_RESOURCE_NAME);
+    if (extracted) {
+        rc = res_create_surface(tmpname.c_str(), &temp_surface);
+        unlink(tmpname.c_str());
     } else if (!pZip) {
         // File name in xml may have included .png so try without adding .png
-        rc = res_create_surface(file.c_str(), surface);
+        rc = res_create_surface(file.c_str(), &temp_surface);
     }
     if (rc != 0) {
         LOGI("Failed to load image from %s%s, error %d", file.c_str(), pZip ? " (zip)" : "", rc);
     }
+
+    CheckAndScaleImage(temp_surface, surface, retain_aspect);
+
+    if (use_cache && *surface) {
+        // Write to a temporary file so that a partial entry is never loaded
+        std::string tmp_path = cache_path + ".tmp" + std::to_string(counter++);
+        if (res_save_surface(*surface, tmp_path.c_str(), cache_tag.c_str()) != 0
+                || rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+            unlink(tmp_path.c_str());
+        }
+    }
 }
 
 void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect)
@@ -196,7 +429,6 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
     std::string file;
-    gr_surface temp_surface = nullptr;
 
     mSurface = nullptr;
     if (!node) {
@@ -213,12 +445,18 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
 
     bool retain_aspect = (node->first_attribute("retainaspect") != nullptr);
     // the value does not matter, if retainaspect is present, we assume that we want to retain it
-    LoadImage(pZip, file, &temp_surface);
-    CheckAndScaleImage(temp_surface, &mSurface, retain_aspect);
+    LoadAsync([this, pZip, file, retain_aspect] {
+        LoadScaledImage(pZip, file, retain_aspect, &mSurface);
+        if (!mSurface) {
+            LOGE("Resource (image)-(%s) failed to load",
+                 (GetName().empty() ? file : GetName()).c_str());
+        }
+    });
 }
 
 ImageResource::~ImageResource()
 {
+    WaitLoaded();
     if (mSurface) {
         res_free_surface(mSurface);
     }
@@ -228,7 +466,6 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
     std::string file;
-    int fileNum = 1;
 
     if (!node) {
         return;
@@ -243,24 +480,29 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
 
     bool retain_aspect = (node->first_attribute("retainaspect") != nullptr);
     // the value does not matter, if retainaspect is present, we assume that we want to retain it
-    for (;;) {
-        std::ostringstream fileName;
-        fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
-
-        gr_surface surface, temp_surface = nullptr;
-        LoadImage(pZip, fileName.str(), &temp_surface);
-        CheckAndScaleImage(temp_surface, &surface, retain_aspect);
-        if (surface) {
-            mSurfaces.push_back(surface);
-            fileNum++;
-        } else {
-            break; // Done loading animation images
+    LoadAsync([this, pZip, file, retain_aspect] {
+        for (int fileNum = 1; ; ++fileNum) {
+            std::ostringstream fileName;
+            fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
+
+            gr_surface surface;
+            LoadScaledImage(pZip, fileName.str(), retain_aspect, &surface);
+            if (surface) {
+                mSurfaces.push_back(surface);
+            } else {
+                break; // Done loading animation images
+            }
         }
-    }
+        if (mSurfaces.empty()) {
+            LOGE("Resource (animation)-(%s) failed to load",
+                 (GetName().empty() ? file : GetName()).c_str());
+        }
+    });
 }
 
 AnimationResource::~AnimationResource()
 {
+    WaitLoaded();
     for (auto it = mSurfaces.begin(); it != mSurfaces.end(); ++it) {
         res_free_surface(*it);
     }
@@ -278,10 +520,12 @@ FontResource* ResourceManager::FindFont(const std::string& name) const
     return nullptr;
 }
 
+// Images and animations that failed to load are skipped. This waits for the
+// matching resource to finish loading.
 ImageResource* ResourceManager::FindImage(const std::string& name) const
 {
     for (auto it = mImages.begin(); it != mImages.end(); ++it) {
-        if (name == (*it)->GetName()) {
+        if (name == (*it)->GetName() && (*it)->GetResource()) {
             return *it;
         }
     }
@@ -291,7 +535,7 @@ ImageResource* ResourceManager::FindImage(const std::string& name) const
 AnimationResource* ResourceManager::FindAnimation(const std::string& name) const
 {
     for (auto it = mAnimations.begin(); it != mAnimations.end(); ++it) {
-        if (name == (*it)->GetName()) {
+        if (name == (*it)->GetName() && (*it)->GetResourceCount()) {
             return *it;
         }
     }
@@ -410,20 +654,19 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
                 LOGE("Unable to locate font name for type fontoverride.");
             }
         } else if (type == "image") {
-            ImageResource* res = new ImageResource(child, pZip);
-            if (res->GetResource()) {
-                mImages.push_back(res);
+            // Decoded in the background; failures are logged by the resource
+            if (child->first_attribute("filename")) {
+                mImages.push_back(new ImageResource(child, pZip));
             } else {
+                LOGE("No filename specified for image resource.");
                 error = true;
-                delete res;
             }
         } else if (type == "animation") {
-            AnimationResource* res = new AnimationResource(child, pZip);
-            if (res->GetResourceCount()) {
-                mAnimations.push_back(res);
+            if (child->first_attribute("filename")) {
+                mAnimations.push_back(new AnimationResource(child, pZip));
             } else {
+                LOGE("No filename specified for animation resource.");
                 error = true;
-                delete res;
             }
         } else if (type == "string") {
             if (xml_attribute<>* attr = child->first_attribute("name")) {
@@ -457,6 +700,17 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
     }
 }
 
+void ResourceManager::WaitForResources()
+{
+    for (auto it = mImages.begin(); it != mImages.end(); ++it) {
+        (*it)->WaitLoaded();
+    }
+
+    for (auto it = mAnimations.begin(); it != mAnimations.end(); ++it) {
+        (*it)->WaitLoaded();
+    }
+}
+
 ResourceManager::~ResourceManager()
 {
     for (auto it = mFonts.begin(); it != mFonts.end(); ++it) {
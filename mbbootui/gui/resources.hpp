@@ -3,6 +3,11 @@
 #ifndef _RESOURCE_HEADER
 #define _RESOURCE_HEADER
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
 #include "minuitwrp/minui.h"
 
 #include "gui/rapidxml.hpp"
@@ -22,17 +27,28 @@ public:
         return mName;
     }
 
+    // Block until the job passed to LoadAsync() has completed
+    void WaitLoaded();
+
 private:
     std::string mName;
+    std::atomic<bool> mLoaded;
+    std::mutex mLoadMutex;
+    std::condition_variable mLoadCond;
 
 protected:
+    // Run a loading job on the resource loader threads. Must be called at
+    // most once, from the constructor of the derived class, whose destructor
+    // must call WaitLoaded().
+    void LoadAsync(std::function<void()> job);
+
     static int ExtractResource(ZipArchive* pZip,
                                const std::string& folderName,
                                const std::string& fileName,
                                const std::string& fileExtn,
                                const std::string& destFile);
-    static void LoadImage(ZipArchive* pZip,
-                          const std::string& file, gr_surface* surface);
+    static void LoadScaledImage(ZipArchive* pZip, const std::string& file,
+                                int retain_aspect, gr_surface* surface);
     static void CheckAndScaleImage(gr_surface source, gr_surface* destination,
                                    int retain_aspect);
 };
@@ -85,6 +101,7 @@ public:
 public:
     gr_surface GetResource()
     {
+        WaitLoaded();
 #if 0
         return this ? mSurface : nullptr;
 #else
@@ -94,6 +111,7 @@ public:
 
     int GetWidth()
     {
+        WaitLoaded();
 #if 0
         return gr_get_width(this ? mSurface : nullptr);
 #else
@@ -103,6 +121,7 @@ public:
 
     int GetHeight()
     {
+        WaitLoaded();
 #if 0
         return gr_get_height(this ? mSurface : nullptr);
 #else
@@ -123,6 +142,7 @@ public:
 public:
     gr_surface GetResource()
     {
+        WaitLoaded();
 #if 0
         return (!this || mSurfaces.empty()) ? nullptr : mSurfaces.at(0);
 #else
@@ -132,6 +152,7 @@ public:
 
     gr_surface GetResource(int entry)
     {
+        WaitLoaded();
 #if 0
         return (!this || mSurfaces.empty()) ? nullptr : mSurfaces.at(entry);
 #else
@@ -159,6 +180,7 @@ public:
 
     int GetResourceCount()
     {
+        WaitLoaded();
         return mSurfaces.size();
     }
 
@@ -173,6 +195,8 @@ public:
     virtual ~ResourceManager();
     void AddStringResource(std::string resource_source, std::string resource_name, std::string value);
     void LoadResources(xml_node<>* resList, ZipArchive* pZip, std::string resource_source);
+    // Wait for images and animations that are still being decoded
+    void WaitForResources();
 
 public:
     FontResource* FindFont(const std::string& name) const;
@@ -229,6 +229,10 @@ int GUIScrollList::Render()
 
     int yPos = mRenderY + mHeaderH + y_offset;
 
+    // Rows outside of the area being repainted are skipped
+    int clipX, clipY, clipW, clipH;
+    bool clipped = gr_get_clip_bounds(&clipX, &clipY, &clipW, &clipH);
+
     // render all visible items
     for (size_t line = 0; line < lines; line++) {
         size_t itemindex = line + firstDisplayedItem;
@@ -236,6 +240,12 @@ int GUIScrollList::Render()
             break;
         }
 
+        if (clipped && (yPos >= clipY + clipH
+                || yPos + actualItemHeight <= clipY)) {
+            yPos += actualItemHeight;
+            continue;
+        }
+
         RenderItem(itemindex, yPos, itemindex == selectedItem);
 
         // Add the separator
@@ -348,6 +358,16 @@ void GUIScrollList::RenderStdItem(int yPos, bool selected, ImageResource* icon,
     gr_textEx_scaleW(textX, textY, text, mFont->GetResource(), mRenderW, TEXT_ONLY_RIGHT, 0);
 }
 
+// The list never draws outside of its own area
+bool GUIScrollList::GetDamage(int& x, int& y, int& w, int& h)
+{
+    x = mRenderX;
+    y = mRenderY;
+    w = mRenderW;
+    h = mRenderH;
+    return true;
+}
+
 int GUIScrollList::Update()
 {
     if (!isConditionTrue()) {
@@ -35,6 +35,9 @@ public:
     //  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
     virtual int Update();
 
+    // GetDamage - Returns the area that changed in the last update
+    virtual bool GetDamage(int& x, int& y, int& w, int& h);
+
     // NotifyTouch - Notify of a touch event
     //  Return 0 on success, >0 to ignore remainder of touch, and <0 on error
     virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
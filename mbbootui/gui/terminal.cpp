@@ -25,6 +25,7 @@
 #include <cstring>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <linux/input.h>
 #include <sys/wait.h>
 #include <termio.h>
@@ -37,6 +38,12 @@
 
 #define LOG_TAG "mbbootui/gui/terminal"
 
+// Number of lines kept in the scrollback buffer
+#define TERMINAL_MAX_LINES      2000
+
+// Maximum number of bytes read from the pty per frame
+#define TERMINAL_MAX_READ       65536
+
 #if 0
 #define debug_printf printf
 #else
@@ -117,6 +124,19 @@ public:
         _exit(127);
     }
 
+    // Check if data can be read without blocking
+    bool hasInput() const
+    {
+        if (!started()) {
+            return false;
+        }
+        struct pollfd pfd;
+        pfd.fd = fdMaster;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        return poll(&pfd, 1, 0) > 0;
+    }
+
     int read(char* buffer, size_t size)
     {
         if (!started()) {
@@ -283,8 +303,9 @@ public:
     {
         std::string text; // in UTF-8 format
         //std::vector<AttributeRange> attrs;
+        unsigned int revision; // unique for every version of every line
 
-        Line() {}
+        Line() : revision(0) {}
 
         size_t utf8forward(size_t start) const
         {
@@ -324,6 +345,69 @@ public:
         }
     };
 
+    // Fixed-size ring of lines for the scrollback buffer. The slots are reused,
+    // so appending lines does not allocate once the buffer has filled up.
+    class LineRing
+    {
+    public:
+        explicit LineRing(size_t capacity) : slots(capacity), start(0), count(0)
+        {
+        }
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        bool full() const
+        {
+            return count == slots.size();
+        }
+
+        Line& operator[](size_t n)
+        {
+            return slots[(start + n) % slots.size()];
+        }
+
+        const Line& operator[](size_t n) const
+        {
+            return slots[(start + n) % slots.size()];
+        }
+
+        // Append an empty line. The ring must not be full.
+        void push_back(unsigned int revision)
+        {
+            Line& line = slots[(start + count) % slots.size()];
+            line.text.clear();
+            line.revision = revision;
+            ++count;
+        }
+
+        // Remove the n oldest lines
+        void pop_front(size_t n)
+        {
+            n = std::min(n, count);
+            start = (start + n) % slots.size();
+            count -= n;
+        }
+
+        // Remove all lines after the first n
+        void truncate(size_t n)
+        {
+            count = std::min(n, count);
+        }
+
+        void clear()
+        {
+            start = count = 0;
+        }
+
+    private:
+        std::vector<Line> slots;
+        size_t start;
+        size_t count;
+    };
+
     // A single character cell with a Unicode code point
     struct Cell
     {
@@ -353,12 +437,14 @@ public:
         }
     };
 
-    TerminalEngine()
+    TerminalEngine() : lines(TERMINAL_MAX_LINES)
     {
         // the default size will be overwritten by the GUI window when the size is known
         width = 40;
         height = 10;
 
+        revision = 0;
+        unpackedY = NO_LINE;
         clear();
         updateCounter = 0;
         state = kStateGround;
@@ -384,25 +470,35 @@ public:
         }
     }
 
+    // Read everything that is available, up to TERMINAL_MAX_READ bytes, so
+    // that fast output does not block the writer until the next frame
     void readPty()
     {
-        char buffer[1024];
-        int rc = pty.read(buffer, sizeof(buffer));
-        debug_printf("readPty: %d bytes\n", rc);
-        if (rc < 0) {
-            output("\r\nChild process exited.\r\n");
-            // TODO: maybe exit terminal here
-        } else {
+        char buffer[4096];
+        size_t total = 0;
+        do {
+            int rc = pty.read(buffer, sizeof(buffer));
+            debug_printf("readPty: %d bytes\n", rc);
+            if (rc < 0) {
+                output("\r\nChild process exited.\r\n");
+                // TODO: maybe exit terminal here
+                return;
+            }
             for (int i = 0; i < rc; ++i) {
                 output(buffer[i]);
             }
-        }
+            if (rc == 0) {
+                break;
+            }
+            total += rc;
+        } while (total < TERMINAL_MAX_READ && pty.hasInput());
     }
 
     void clear()
     {
         cursorX = cursorY = 0;
         lines.clear();
+        unpackedY = NO_LINE;
         setY(0);
         unpackLine(0);
         ++updateCounter;
@@ -487,6 +583,12 @@ public:
         return lines[n];
     }
 
+    // Changes whenever the contents of line n change
+    unsigned int getLineRevision(size_t n) const
+    {
+        return lines[n].revision;
+    }
+
     int getCursorX() const
     {
         return cursorX;
@@ -513,10 +615,15 @@ public:
     {
         //y = min(height, max(y, 0));
         y = std::max(y, 0);
-        cursorY = y;
         while (lines.size() <= (size_t) y) {
-            lines.push_back(Line());
+            if (lines.full()) {
+                // Drop the oldest line from the scrollback buffer
+                dropLines(1);
+                --y;
+            }
+            lines.push_back(++revision);
         }
+        cursorY = y;
         ++updateCounter;
     }
 
@@ -541,8 +648,28 @@ public:
     }
 
 private:
+    static constexpr size_t NO_LINE = static_cast<size_t>(-1);
+
+    // Remove the n oldest lines, keeping the unpacked line in sync
+    void dropLines(size_t n)
+    {
+        if (unpackedY != NO_LINE) {
+            unpackedY = unpackedY >= n ? unpackedY - n : NO_LINE;
+        }
+        lines.pop_front(n);
+    }
+
+    // Mark the line being edited as changed
+    void touchLine()
+    {
+        lines[unpackedY].revision = ++revision;
+    }
+
     void packLine()
     {
+        if (unpackedY == NO_LINE) {
+            return;
+        }
         std::string& s = lines[unpackedY].text;
         s.clear();
         for (size_t i = 0; i < unpackedLine.cells.size(); ++i) {
@@ -643,6 +770,7 @@ private:
             unpackedLine.cells.resize(cursorX + 1);
         }
         unpackedLine.cells[cursorX].cp = cp;
+        touchLine();
 
         right();
         if (cursorX >= width) {
@@ -754,14 +882,14 @@ private:
             default:
             case 0:
                 unpackedLine.eraseFrom(cursorX);
-                if (lines.size() > (size_t) cursorY + 1) {
-                    lines.erase(lines.begin() + cursorY + 1, lines.end());
-                }
+                touchLine();
+                lines.truncate(cursorY + 1);
                 break;
             case 1:
                 unpackedLine.eraseTo(cursorX);
+                touchLine();
                 if (cursorY > 0) {
-                    lines.erase(lines.begin(), lines.begin() + cursorY - 1);
+                    dropLines(cursorY - 1);
                     cursorY = 0;
                 }
                 break;
@@ -787,6 +915,7 @@ private:
                 unpackedLine.cells.clear();
                 break;
             }
+            touchLine();
             break;
         }
         // case 'L': // IL - insert line
@@ -800,9 +929,10 @@ private:
 private:
     int cursorX, cursorY; // 0-based, char based. TODO: decide how to handle scrollback
     int width, height; // window size in chars
-    std::vector<Line> lines; // the text buffer
+    LineRing lines; // the text buffer
     UnpackedLine unpackedLine; // current line for editing
-    size_t unpackedY; // number of current line
+    size_t unpackedY; // number of current line or NO_LINE
+    unsigned int revision; // last assigned line revision
     int updateCounter; // changes whenever terminal could require redraw
 
     Pseudoterminal pty;
@@ -839,6 +969,10 @@ GUITerminal::GUITerminal(xml_node<>* node) : GUIScrollList(node)
 
     engine = &gEngine;
     updateCounter = 0;
+    lastFirstItem = -1;
+    lastYOffset = 0;
+    lastItemCount = 0;
+    damageY = damageH = 0;
 }
 
 int GUITerminal::Update()
@@ -864,13 +998,81 @@ int GUITerminal::Update()
 
     if (mUpdate) {
         mUpdate = 0;
-        if (Render() == 0) {
+        if (UpdateDamage()) {
             return 2;
         }
     }
     return 0;
 }
 
+bool GUITerminal::GetDamage(int& x, int& y, int& w, int& h)
+{
+    x = mRenderX;
+    y = damageY;
+    w = mRenderW;
+    h = damageH;
+    return true;
+}
+
+// Compare the visible rows with what was drawn at the last update and record
+// the area that needs to be repainted. Scrolling, which also moves the fast
+// scroll bar, repaints the whole terminal; otherwise only the rows whose text
+// or cursor changed are repainted. Returns false if nothing changed.
+bool GUITerminal::UpdateDamage()
+{
+    size_t count = GetItemCount();
+    size_t rows = GetDisplayItemCount() + 2;
+    size_t cursorY = engine->getCursorY();
+    int firstChanged = -1;
+    int lastChanged = -1;
+
+    bool scrolled = firstDisplayedItem != lastFirstItem
+            || y_offset != lastYOffset
+            || count != lastItemCount
+            || rowStates.size() != rows;
+
+    rowStates.resize(rows);
+
+    for (size_t row = 0; row < rows; ++row) {
+        size_t itemindex = firstDisplayedItem + row;
+        RowState state;
+        state.revision = itemindex < count
+                ? engine->getLineRevision(itemindex) : 0;
+        state.cursorX = itemindex == cursorY ? engine->getCursorX() : -1;
+
+        if (state.revision != rowStates[row].revision
+                || state.cursorX != rowStates[row].cursorX) {
+            if (firstChanged < 0) {
+                firstChanged = row;
+            }
+            lastChanged = row;
+        }
+        rowStates[row] = state;
+    }
+
+    lastFirstItem = firstDisplayedItem;
+    lastYOffset = y_offset;
+    lastItemCount = count;
+
+    int top = mRenderY + mHeaderH;
+    int bottom = mRenderY + mRenderH;
+
+    if (scrolled) {
+        damageY = mRenderY;
+        damageH = mRenderH;
+        return true;
+    } else if (firstChanged < 0) {
+        damageY = damageH = 0;
+        return false;
+    }
+
+    int y1 = top + y_offset + firstChanged * actualItemHeight;
+    int y2 = top + y_offset + (lastChanged + 1) * actualItemHeight;
+    damageY = std::max(y1, top);
+    damageH = std::max(std::min(y2, bottom) - damageY, 0);
+    return damageH > 0;
+}
+
 // NotifyTouch - Notify of a touch event
 //  Return 0 on success, >0 to ignore remainder of touch, and <0 on error
 int GUITerminal::NotifyTouch(TOUCH_STATE state, int x, int y)
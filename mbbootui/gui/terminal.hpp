@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "gui/scrolllist.hpp"
 
 class TerminalEngine;
@@ -31,6 +33,9 @@ public:
     //  Return 0 if nothing to update, 1 on success and contiue, >1 if full render required, and <0 on error
     virtual int Update();
 
+    // GetDamage - Returns the rows that changed in the last update
+    virtual bool GetDamage(int& x, int& y, int& w, int& h);
+
     // NotifyTouch - Notify of a touch event
     //  Return 0 on success, >0 to ignore remainder of touch, and <0 on error (Return error to allow other handlers)
     virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
@@ -52,8 +57,20 @@ public:
 
 protected:
     void InitAndResize();
+    bool UpdateDamage();
+
+    // What was last drawn in a visible row
+    struct RowState
+    {
+        unsigned int revision; // line revision or 0 if the row is empty
+        int cursorX; // cursor column or -1 if the cursor is not in this row
+    };
 
     TerminalEngine* engine; // non-visual parts of the terminal (text buffer etc.), not owned
     int updateCounter; // to track if anything changed in the back-end
     bool lastCondition; // to track if the condition became true and we might need to resize the terminal engine
+    std::vector<RowState> rowStates; // visible rows at the last update
+    int lastFirstItem, lastYOffset; // scroll position at the last update
+    size_t lastItemCount; // number of lines at the last update
+    int damageY, damageH; // rows to repaint after the last update
 };
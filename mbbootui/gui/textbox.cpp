@@ -60,9 +60,8 @@ int GUITextBox::Update()
 
     if (mUpdate) {
         mUpdate = 0;
-        if (Render() == 0) {
-            return 2;
-        }
+        // Repainted by PageManager within GetDamage()
+        return 2;
     }
     return 0;
 }
@@ -31,6 +31,7 @@
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
 #include "mbpatcher/patcherconfig.h"
+#include "mbutil/archive_file.h"
 #include "mbutil/copy.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
@@ -61,6 +62,8 @@
 #define MBBOOTUI_LOG_PATH           MBBOOTUI_BASE_PATH "/exec.log"
 #define MBBOOTUI_SCREENSHOTS_PATH   MBBOOTUI_BASE_PATH "/screenshots";
 #define MBBOOTUI_SETTINGS_PATH      MBBOOTUI_BASE_PATH "/settings.bin"
+#define MBBOOTUI_IMAGE_CACHE_PATH   MBBOOTUI_BASE_PATH "/imagecache"
+#define MBBOOTUI_FRAME_STATS_PATH   MBBOOTUI_BASE_PATH "/framestats"
 
 #define MBBOOTUI_RUNTIME_PATH       "/mbbootui"
 #define MBBOOTUI_THEME_PATH         MBBOOTUI_RUNTIME_PATH "/theme"
@@ -129,6 +132,7 @@ static bool detect_device()
 static bool extract_theme(const std::string &path, const std::string &target,
                           const std::string &theme_name)
 {
+    mb::util::ArchiveInputFile file;
     ScopedArchive in(archive_read_new(), archive_read_free);
     if (!in) {
         LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
@@ -150,7 +154,13 @@ static bool extract_theme(const std::string &path, const std::string &target,
     archive_write_disk_set_standard_lookup(out.get());
     archive_write_disk_set_options(out.get(), flags);
 
-    if (archive_read_open_filename(in.get(), path.c_str(), 10240) != ARCHIVE_OK) {
+    if (auto r = file.open(path); !r) {
+        LOGE("%s: Failed to open file: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (file.open_archive(in.get()) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
              path.c_str(), archive_error_string(in.get()));
         return false;
@@ -417,6 +427,8 @@ int main(int argc, char *argv[])
     tw_resource_path = MBBOOTUI_THEME_PATH;
     tw_settings_path = MBBOOTUI_SETTINGS_PATH;
     tw_screenshots_path = MBBOOTUI_SCREENSHOTS_PATH;
+    tw_image_cache_path = MBBOOTUI_IMAGE_CACHE_PATH;
+    tw_frame_stats_path = MBBOOTUI_FRAME_STATS_PATH;
     // Disallow custom themes, which could manipulate variables in such as way
     // as to execute malicious code
     tw_theme_zip_path = "";
@@ -15,7 +15,9 @@
  */
 
 #include <drm_fourcc.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,8 +46,21 @@ struct drm_surface
     uint32_t handle;
 };
 
-static drm_surface *drm_surfaces[2];
+// Triple buffering lets the next frame be drawn while a page flip is queued
+#define DRM_NUM_BUFFERS 3
+
+// Give up on page flip events if one does not arrive within this time
+#define DRM_FLIP_TIMEOUT_MS 500
+
+static drm_surface *drm_surfaces[DRM_NUM_BUFFERS];
+// Buffer being drawn to
 static int current_buffer;
+// Buffer being scanned out
+static int displayed_buffer;
+// Buffer queued for the next vblank or -1 if no flip is pending
+static int pending_buffer = -1;
+static bool drm_blanked;
+static bool drm_use_page_flip;
 
 static drmModeCrtc *main_monitor_crtc;
 static drmModeConnector *main_monitor_connector;
@@ -81,14 +96,64 @@ static void drm_enable_crtc(int drm_fd, drmModeCrtc *crtc,
     }
 }
 
+static void drm_page_flip_handler(int fd __unused,
+                                  unsigned int frame __unused,
+                                  unsigned int sec __unused,
+                                  unsigned int usec __unused,
+                                  void *data __unused)
+{
+    displayed_buffer = pending_buffer;
+    pending_buffer = -1;
+}
+
+// Wait until the pending page flip, if any, completes at vblank
+static void drm_wait_for_flip()
+{
+    drmEventContext ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.version = 2;
+    ev.page_flip_handler = drm_page_flip_handler;
+
+    while (pending_buffer >= 0) {
+        struct pollfd pfd;
+        pfd.fd = drm_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int ret = poll(&pfd, 1, DRM_FLIP_TIMEOUT_MS);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret <= 0) {
+            if (ret == 0) {
+                printf("Timed out waiting for page flip\n");
+            } else {
+                perror("poll() failed");
+            }
+            // Assume the flip happened and stop relying on the events
+            displayed_buffer = pending_buffer;
+            pending_buffer = -1;
+            drm_use_page_flip = false;
+            break;
+        }
+
+        if (drmHandleEvent(drm_fd, &ev) != 0) {
+            printf("drmHandleEvent failed\n");
+        }
+    }
+}
+
 static void drm_blank(minui_backend* backend __unused, bool blank)
 {
+    drm_wait_for_flip();
+
     if (blank) {
         drm_disable_crtc(drm_fd, main_monitor_crtc);
     } else {
         drm_enable_crtc(drm_fd, main_monitor_crtc,
-                        drm_surfaces[current_buffer]);
+                        drm_surfaces[displayed_buffer]);
     }
+
+    drm_blanked = blank;
 }
 
 static void drm_destroy_surface(struct drm_surface *surface)
@@ -473,42 +538,81 @@ static GRSurface* drm_init(minui_backend* backend __unused)
 
     drmModeFreeResources(res);
 
-    drm_surfaces[0] = drm_create_surface(width, height);
-    drm_surfaces[1] = drm_create_surface(width, height);
-    if (!drm_surfaces[0] || !drm_surfaces[1]) {
-        drm_destroy_surface(drm_surfaces[0]);
-        drm_destroy_surface(drm_surfaces[1]);
-        drmModeFreeResources(res);
+    bool created = true;
+    for (i = 0; i < DRM_NUM_BUFFERS; i++) {
+        drm_surfaces[i] = drm_create_surface(width, height);
+        if (!drm_surfaces[i]) {
+            created = false;
+        }
+    }
+    if (!created) {
+        for (i = 0; i < DRM_NUM_BUFFERS; i++) {
+            drm_destroy_surface(drm_surfaces[i]);
+            drm_surfaces[i] = nullptr;
+        }
         close(drm_fd);
         return nullptr;
     }
 
     current_buffer = 0;
+    displayed_buffer = DRM_NUM_BUFFERS - 1;
+    pending_buffer = -1;
+    drm_blanked = false;
+    drm_use_page_flip = true;
 
-    drm_enable_crtc(drm_fd, main_monitor_crtc, drm_surfaces[1]);
+    drm_enable_crtc(drm_fd, main_monitor_crtc,
+                    drm_surfaces[displayed_buffer]);
 
-    return &(drm_surfaces[0]->base);
+    return &(drm_surfaces[current_buffer]->base);
 }
 
+// Queue the current buffer for display at the next vblank and return the next
+// buffer to draw to. Only one flip is queued at a time, so this blocks until
+// the previous frame has been shown, which paces rendering to the refresh rate
+// without drawing to a buffer that is still being scanned out.
 static GRSurface* drm_flip(minui_backend* backend __unused)
 {
-    int ret;
-
-    ret = drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id,
-                          drm_surfaces[current_buffer]->fb_id, 0, nullptr);
-    if (ret < 0) {
-        printf("drmModePageFlip failed ret=%d\n", ret);
-        return nullptr;
+    drm_wait_for_flip();
+
+    drm_surface *surface = drm_surfaces[current_buffer];
+
+    if (drm_blanked) {
+        // Shown when the screen is unblanked
+        displayed_buffer = current_buffer;
+    } else if (drm_use_page_flip
+            && drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id,
+                               surface->fb_id, DRM_MODE_PAGE_FLIP_EVENT,
+                               nullptr) == 0) {
+        pending_buffer = current_buffer;
+    } else {
+        if (drm_use_page_flip) {
+            printf("drmModePageFlip failed; using drmModeSetCrtc\n");
+            drm_use_page_flip = false;
+        }
+        drm_enable_crtc(drm_fd, main_monitor_crtc, surface);
+        displayed_buffer = current_buffer;
     }
-    current_buffer = 1 - current_buffer;
+
+    // Neither displayed nor pending since the previous flip has completed
+    current_buffer = (current_buffer + 1) % DRM_NUM_BUFFERS;
     return &(drm_surfaces[current_buffer]->base);
 }
 
+static int drm_buffer_age(minui_backend* backend __unused)
+{
+    // The surfaces are always displayed in the same order and drawing is never
+    // done to the one on screen or the one queued for display
+    return DRM_NUM_BUFFERS;
+}
+
 static void drm_exit(minui_backend* backend __unused)
 {
+    drm_wait_for_flip();
     drm_disable_crtc(drm_fd, main_monitor_crtc);
-    drm_destroy_surface(drm_surfaces[0]);
-    drm_destroy_surface(drm_surfaces[1]);
+    for (int i = 0; i < DRM_NUM_BUFFERS; i++) {
+        drm_destroy_surface(drm_surfaces[i]);
+        drm_surfaces[i] = nullptr;
+    }
     drmModeFreeCrtc(main_monitor_crtc);
     drmModeFreeConnector(main_monitor_connector);
     close(drm_fd);
@@ -520,6 +624,7 @@ static minui_backend drm_backend = {
     .flip = drm_flip,
     .blank = drm_blank,
     .exit = drm_exit,
+    .buffer_age = drm_buffer_age,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(drm)() {
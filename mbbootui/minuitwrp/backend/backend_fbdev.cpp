@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,11 +43,16 @@ static GRSurface* fbdev_init(minui_backend*);
 static GRSurface* fbdev_flip(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
+static int fbdev_buffer_age(minui_backend*);
+static GRSurface* fbdev_flip_region(minui_backend*, int, int, int, int);
 
 static GRSurface gr_framebuffer[2];
 static bool double_buffered;
 static GRSurface* gr_draw = nullptr;
 static int displayed_buffer;
+// Region of the displayed framebuffer that is not up to date in the other
+// framebuffer (x1, y1, x2, y2)
+static int stale_region[4];
 
 static fb_var_screeninfo vi;
 static int fb_fd = -1;
@@ -56,6 +63,8 @@ static minui_backend my_backend = {
     .flip = fbdev_flip,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
+    .buffer_age = fbdev_buffer_age,
+    .flip_region = fbdev_flip_region,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(fbdev)()
@@ -330,6 +339,83 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
             set_displayed_framebuffer(1-displayed_buffer);
         }
     }
+
+    stale_region[0] = 0;
+    stale_region[1] = 0;
+    stale_region[2] = gr_draw->width;
+    stale_region[3] = gr_draw->height;
+
+    return gr_draw;
+}
+
+static void copy_region(GRSurface *dest, int x1, int y1, int x2, int y2)
+{
+    size_t offset = x1 * gr_draw->pixel_bytes;
+    size_t size = (x2 - x1) * gr_draw->pixel_bytes;
+
+    for (int y = y1; y < y2; ++y) {
+        memcpy(dest->data + y * dest->row_bytes + offset,
+               gr_draw->data + y * gr_draw->row_bytes + offset, size);
+    }
+}
+
+static int fbdev_buffer_age(minui_backend* backend __unused)
+{
+    // The in-memory surface persists across flips unless the BGRA byte
+    // swapping modified it in place
+    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
+        return 0;
+    }
+    return 1;
+}
+
+static GRSurface* fbdev_flip_region(minui_backend* backend,
+                                    int x, int y, int w, int h)
+{
+    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888
+            || (tw_device.tw_flags()
+                    & mb::device::TwFlag::BoardHasFlippedScreen)) {
+        return fbdev_flip(backend);
+    }
+
+    int x1 = std::max(x, 0);
+    int y1 = std::max(y, 0);
+    int x2 = std::min(x + w, static_cast<int>(gr_draw->width));
+    int y2 = std::min(y + h, static_cast<int>(gr_draw->height));
+
+    if (x1 >= x2 || y1 >= y2) {
+        x1 = y1 = x2 = y2 = 0;
+    }
+
+    if (double_buffered) {
+        // The back framebuffer also lacks what changed in the previous flip
+        int cx1 = x1, cy1 = y1, cx2 = x2, cy2 = y2;
+        if (stale_region[0] < stale_region[2]
+                && stale_region[1] < stale_region[3]) {
+            if (cx1 >= cx2 || cy1 >= cy2) {
+                cx1 = stale_region[0];
+                cy1 = stale_region[1];
+                cx2 = stale_region[2];
+                cy2 = stale_region[3];
+            } else {
+                cx1 = std::min(cx1, stale_region[0]);
+                cy1 = std::min(cy1, stale_region[1]);
+                cx2 = std::max(cx2, stale_region[2]);
+                cy2 = std::max(cy2, stale_region[3]);
+            }
+        }
+
+        copy_region(&gr_framebuffer[1-displayed_buffer], cx1, cy1, cx2, cy2);
+        set_displayed_framebuffer(1-displayed_buffer);
+    } else {
+        copy_region(&gr_framebuffer[0], x1, y1, x2, y2);
+    }
+
+    stale_region[0] = x1;
+    stale_region[1] = y1;
+    stale_region[2] = x2;
+    stale_region[3] = y2;
+
     return gr_draw;
 }
 
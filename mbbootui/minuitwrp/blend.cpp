@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "blend.h"
+
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define BLEND_NEON 1
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#  define BLEND_SSE2 1
+#endif
+
+// (x * a + y * (255 - a)) / 255, rounded to nearest
+static inline uint32_t blend_channel(uint32_t x, uint32_t y, uint32_t a)
+{
+    uint32_t t = x * a + y * (255 - a) + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t blend_pixel(uint32_t src, uint32_t dst)
+{
+    uint32_t a = src >> 24;
+
+    if (a == 255) {
+        return src;
+    } else if (a == 0) {
+        return dst;
+    }
+
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        result |= blend_channel((src >> shift) & 0xff,
+                                (dst >> shift) & 0xff, a) << shift;
+    }
+    return result;
+}
+
+#if BLEND_SSE2
+
+// Blend 4 pixels
+static inline __m128i blend_sse2(__m128i src, __m128i dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i c128 = _mm_set1_epi16(128);
+
+    __m128i s_lo = _mm_unpacklo_epi8(src, zero);
+    __m128i s_hi = _mm_unpackhi_epi8(src, zero);
+    __m128i d_lo = _mm_unpacklo_epi8(dst, zero);
+    __m128i d_hi = _mm_unpackhi_epi8(dst, zero);
+
+    // Broadcast each pixel's alpha to its four channels
+    __m128i a_lo = _mm_shufflehi_epi16(
+            _mm_shufflelo_epi16(s_lo, _MM_SHUFFLE(3, 3, 3, 3)),
+            _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i a_hi = _mm_shufflehi_epi16(
+            _mm_shufflelo_epi16(s_hi, _MM_SHUFFLE(3, 3, 3, 3)),
+            _MM_SHUFFLE(3, 3, 3, 3));
+
+    __m128i t_lo = _mm_add_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(s_lo, a_lo),
+                          _mm_mullo_epi16(d_lo, _mm_sub_epi16(c255, a_lo))),
+            c128);
+    __m128i t_hi = _mm_add_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(s_hi, a_hi),
+                          _mm_mullo_epi16(d_hi, _mm_sub_epi16(c255, a_hi))),
+            c128);
+
+    t_lo = _mm_srli_epi16(_mm_add_epi16(t_lo, _mm_srli_epi16(t_lo, 8)), 8);
+    t_hi = _mm_srli_epi16(_mm_add_epi16(t_hi, _mm_srli_epi16(t_hi, 8)), 8);
+
+    return _mm_packus_epi16(t_lo, t_hi);
+}
+
+#elif BLEND_NEON
+
+// Blend 8 deinterleaved pixels
+static inline uint8x8x4_t blend_neon(uint8x8x4_t src, uint8x8x4_t dst)
+{
+    uint8x8_t a = src.val[3];
+    uint8x8_t inv_a = vmvn_u8(a);
+    uint8x8x4_t result;
+
+    for (int i = 0; i < 4; ++i) {
+        uint16x8_t t = vmlal_u8(vmull_u8(src.val[i], a), dst.val[i], inv_a);
+        result.val[i] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+    }
+
+    return result;
+}
+
+#endif
+
+void blend_fill_span(uint32_t *dst, uint32_t color, int n)
+{
+    // Compilers vectorize this into wide stores
+    std::fill_n(dst, n, color);
+}
+
+void blend_color_span(uint32_t *dst, uint32_t color, int n)
+{
+    uint32_t a = color >> 24;
+
+    if (a == 255) {
+        blend_fill_span(dst, color, n);
+        return;
+    } else if (a == 0) {
+        return;
+    }
+
+    int i = 0;
+
+#if BLEND_SSE2
+    __m128i src = _mm_set1_epi32(static_cast<int>(color));
+    for (; i + 4 <= n; i += 4) {
+        auto *p = reinterpret_cast<__m128i *>(dst + i);
+        _mm_storeu_si128(p, blend_sse2(src, _mm_loadu_si128(p)));
+    }
+#elif BLEND_NEON
+    uint8x8x4_t src;
+    for (int c = 0; c < 4; ++c) {
+        src.val[c] = vdup_n_u8(static_cast<uint8_t>(color >> (c * 8)));
+    }
+    for (; i + 8 <= n; i += 8) {
+        auto *p = reinterpret_cast<uint8_t *>(dst + i);
+        vst4_u8(p, blend_neon(src, vld4_u8(p)));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = blend_pixel(color, dst[i]);
+    }
+}
+
+void blend_image_span(uint32_t *dst, const uint32_t *src, int n)
+{
+    int i = 0;
+
+#if BLEND_SSE2
+    const __m128i alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i a = _mm_and_si128(s, alpha_mask);
+        auto *p = reinterpret_cast<__m128i *>(dst + i);
+
+        // Skip the arithmetic for fully opaque and fully transparent runs,
+        // which make up most of a typical UI image
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, alpha_mask)) == 0xffff) {
+            _mm_storeu_si128(p, s);
+        } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(
+                a, _mm_setzero_si128())) != 0xffff) {
+            _mm_storeu_si128(p, blend_sse2(s, _mm_loadu_si128(p)));
+        }
+    }
+#elif BLEND_NEON
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t *>(src + i));
+        auto *p = reinterpret_cast<uint8_t *>(dst + i);
+        uint64_t a = vget_lane_u64(vreinterpret_u64_u8(s.val[3]), 0);
+
+        if (a == UINT64_MAX) {
+            vst4_u8(p, s);
+        } else if (a != 0) {
+            vst4_u8(p, blend_neon(s, vld4_u8(p)));
+        }
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = blend_pixel(src[i], dst[i]);
+    }
+}
+
+void blend_mask_span(uint32_t *dst, const uint8_t *mask, uint32_t color,
+                     int n)
+{
+    color &= 0x00ffffff;
+
+    int i = 0;
+
+#if BLEND_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c = _mm_set1_epi32(static_cast<int>(color));
+
+    for (; i + 4 <= n; i += 4) {
+        uint32_t m;
+        std::copy_n(mask + i, 4, reinterpret_cast<uint8_t *>(&m));
+        if (m == 0) {
+            continue;
+        }
+
+        // Move each coverage value into the alpha byte of its pixel
+        __m128i a = _mm_cvtsi32_si128(static_cast<int>(m));
+        a = _mm_unpacklo_epi16(_mm_unpacklo_epi8(zero, a), zero);
+        a = _mm_slli_epi32(a, 16);
+
+        auto *p = reinterpret_cast<__m128i *>(dst + i);
+        _mm_storeu_si128(p, blend_sse2(_mm_or_si128(c, a),
+                                       _mm_loadu_si128(p)));
+    }
+#elif BLEND_NEON
+    uint8x8x4_t src;
+    for (int ch = 0; ch < 3; ++ch) {
+        src.val[ch] = vdup_n_u8(static_cast<uint8_t>(color >> (ch * 8)));
+    }
+
+    for (; i + 8 <= n; i += 8) {
+        src.val[3] = vld1_u8(mask + i);
+        if (vget_lane_u64(vreinterpret_u64_u8(src.val[3]), 0) == 0) {
+            continue;
+        }
+
+        auto *p = reinterpret_cast<uint8_t *>(dst + i);
+        vst4_u8(p, blend_neon(src, vld4_u8(p)));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = blend_pixel(color | (static_cast<uint32_t>(mask[i]) << 24),
+                             dst[i]);
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Span kernels for drawing directly into 32-bit surfaces. Pixels are handled
+// as little-endian words with the alpha (or unused) channel in the top byte.
+// Blending uses the same straight alpha equation as the pixelflinger context:
+//
+//     dst = src * src_alpha + dst * (1 - src_alpha)
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#  define GR_HAVE_BLEND_KERNELS 1
+#endif
+
+// Set n pixels to color
+void blend_fill_span(uint32_t *dst, uint32_t color, int n);
+
+// Blend color, which has its alpha in the top byte, over n pixels
+void blend_color_span(uint32_t *dst, uint32_t color, int n);
+
+// Blend n pixels with per-pixel alpha over dst
+void blend_image_span(uint32_t *dst, const uint32_t *src, int n);
+
+// Blend color over n pixels, using the coverage values in mask as the alpha.
+// The top byte of color is ignored.
+void blend_mask_span(uint32_t *dst, const uint8_t *mask, uint32_t color,
+                     int n);
@@ -18,7 +18,12 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/poll.h>
+#include <sys/timerfd.h>
 #include <limits.h>
 #include <linux/input.h>
 #include <sys/types.h>
@@ -37,6 +42,12 @@
 
 #define MAX_DEVICES         32
 
+// epoll data for the non-device file descriptors
+#define EV_ID_TIMER         (MAX_DEVICES + 0)
+#define EV_ID_WAKE          (MAX_DEVICES + 1)
+#define EV_ID_INOTIFY       (MAX_DEVICES + 2)
+#define EV_MAX_EVENTS       (MAX_DEVICES + 3)
+
 #define VIBRATOR_TIME       50ms
 
 #ifndef SYN_REPORT
@@ -110,6 +121,13 @@ static struct timespec lastInputStat;
 static unsigned long lastInputMTime;
 static int has_mouse = 0;
 
+// All input devices, the hold/repeat timer, the wake event and the /dev/input
+// watch are waited on with a single epoll instance
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int wake_fd = -1;
+static int inotify_fd = -1;
+
 static inline int ABS(int x)
 {
     return x < 0 ? -x : x;
@@ -300,7 +318,19 @@ int ev_has_mouse(void)
     return has_mouse;
 }
 
-int ev_init(void)
+static void ev_watch_fd(int fd, uint32_t id)
+{
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = id;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        printf("Failed to add fd %d to epoll: %s\n", fd, strerror(errno));
+    }
+}
+
+static void ev_open_devices(void)
 {
     DIR *dir;
     struct dirent *de;
@@ -323,6 +353,7 @@ int ev_init(void)
             ev_fds[ev_count].fd = fd;
             ev_fds[ev_count].events = POLLIN;
             evs[ev_count].fd = &ev_fds[ev_count];
+            ev_watch_fd(fd, ev_count);
 
             /* Load virtualkeys if there are any */
             vk_init(&evs[ev_count]);
@@ -342,11 +373,10 @@ int ev_init(void)
         lastInputMTime = st.st_mtime;
     }
     clock_gettime(CLOCK_MONOTONIC, &lastInputStat);
-
-    return 0;
 }
 
-void ev_exit(void)
+// Closing a device also removes it from the epoll set
+static void ev_close_devices(void)
 {
     while (ev_count-- > 0) {
         if (evs[ev_count].vk_count) {
@@ -358,6 +388,106 @@ void ev_exit(void)
     ev_count = 0;
 }
 
+int ev_init(void)
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        printf("Failed to create epoll instance: %s\n", strerror(errno));
+        return -1;
+    }
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd >= 0) {
+        ev_watch_fd(timer_fd, EV_ID_TIMER);
+    } else {
+        printf("Failed to create timerfd: %s\n", strerror(errno));
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd >= 0) {
+        ev_watch_fd(wake_fd, EV_ID_WAKE);
+    } else {
+        printf("Failed to create eventfd: %s\n", strerror(errno));
+    }
+
+    // If this fails, /dev/input is checked for changes every few seconds
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0) {
+        if (inotify_add_watch(inotify_fd, "/dev/input",
+                              IN_CREATE | IN_DELETE) >= 0) {
+            ev_watch_fd(inotify_fd, EV_ID_INOTIFY);
+        } else {
+            close(inotify_fd);
+            inotify_fd = -1;
+        }
+    }
+
+    ev_open_devices();
+
+    return 0;
+}
+
+void ev_exit(void)
+{
+    ev_close_devices();
+
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+        wake_fd = -1;
+    }
+    if (timer_fd >= 0) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+}
+
+// Wake up ev_get(). This can be called from any thread.
+void ev_wake(void)
+{
+    if (wake_fd >= 0) {
+        uint64_t value = 1;
+        ssize_t n = write(wake_fd, &value, sizeof(value));
+        (void) n;
+    }
+}
+
+// Make ev_get() return after timeout_ms even if no input arrives, for touch
+// and key hold and repeat. A timeout of 0 cancels the timer.
+void ev_set_timer(int timeout_ms)
+{
+    if (timer_fd < 0) {
+        return;
+    }
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = timeout_ms / 1000;
+    spec.it_value.tv_nsec = (timeout_ms % 1000) * 1000000L;
+
+    timerfd_settime(timer_fd, 0, &spec, nullptr);
+}
+
+static void ev_reload_devices(void)
+{
+    printf("Reloading input devices\n");
+    ev_close_devices();
+    ev_open_devices();
+}
+
+static void ev_drain(int fd)
+{
+    char buf[512];
+    while (read(fd, buf, sizeof(buf)) > 0);
+}
+
 #if 0 // Unused
 static int vk_inside_display(__s32 value, struct input_absinfo *info, int screen_size)
 {
@@ -738,42 +868,60 @@ static int vk_modify(struct ev *e, struct input_event *ev)
     return 0;
 }
 
+// Returns 0 if an input event was read, -1 if input was received but
+// consumed, or -2 if the timeout, the hold/repeat timer or ev_wake() woke up
+// the caller
 int ev_get(struct input_event *ev, int timeout_ms)
 {
+    struct epoll_event events[EV_MAX_EVENTS];
+    bool reload = false;
+    bool got_input = false;
     int r;
-    unsigned n;
-    struct timespec curr;
-
-    clock_gettime(CLOCK_MONOTONIC, &curr);
-    if (curr.tv_sec - lastInputStat.tv_sec >= 2) {
-        struct stat st;
-        stat("/dev/input", &st);
-        if (st.st_mtime > lastInputMTime) {
-            printf("Reloading input devices\n");
-            ev_exit();
-            ev_init();
-            lastInputMTime = st.st_mtime;
+
+    if (inotify_fd < 0) {
+        struct timespec curr;
+        clock_gettime(CLOCK_MONOTONIC, &curr);
+        if (curr.tv_sec - lastInputStat.tv_sec >= 2) {
+            struct stat st;
+            stat("/dev/input", &st);
+            if (st.st_mtime > lastInputMTime) {
+                ev_reload_devices();
+                lastInputMTime = st.st_mtime;
+            }
+            lastInputStat = curr;
         }
-        lastInputStat = curr;
     }
 
-    r = poll(ev_fds, ev_count, timeout_ms);
+    do {
+        r = epoll_wait(epoll_fd, events, EV_MAX_EVENTS, timeout_ms);
+    } while (r < 0 && errno == EINTR);
 
-    if (r > 0) {
-        for (n = 0; n < ev_count; n++) {
-            if (ev_fds[n].revents & POLLIN) {
-                r = read(ev_fds[n].fd, ev, sizeof(*ev));
-                if (r == sizeof(*ev)) {
-                    if (!vk_modify(&evs[n], ev)) {
-                        return 0;
-                    }
-                }
+    // Level triggered, so devices that are not read from here are reported by
+    // the next call
+    for (int i = 0; i < r; ++i) {
+        uint32_t id = events[i].data.u32;
+
+        if (id < ev_count) {
+            got_input = true;
+            ssize_t n = read(ev_fds[id].fd, ev, sizeof(*ev));
+            if (n == sizeof(*ev) && !vk_modify(&evs[id], ev)) {
+                return 0;
             }
+        } else if (id == EV_ID_TIMER) {
+            ev_drain(timer_fd);
+        } else if (id == EV_ID_WAKE) {
+            ev_drain(wake_fd);
+        } else if (id == EV_ID_INOTIFY) {
+            ev_drain(inotify_fd);
+            reload = true;
         }
-        return -1;
     }
 
-    return -2;
+    if (reload) {
+        ev_reload_devices();
+    }
+
+    return got_input ? -1 : -2;
 }
 
 int ev_wait(int timeout)
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +39,7 @@
 #include "backend/backend.h"
 #include "minui.h"
 #include "graphics.h"
+#include "blend.h"
 #include "gui/placement.h"
 
 struct GRFont
@@ -71,6 +74,17 @@ static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
 
+// Outer clip rectangle that gr_clip() and gr_noclip() are confined to
+static bool gr_has_clip_bounds = false;
+static int gr_clip_bounds[4]; // x1, y1, x2, y2
+
+// Scissor box of the pixelflinger context, mirrored for the fast paths
+static bool gr_scissor_enabled = false;
+static int gr_scissor[4]; // x1, y1, x2, y2
+
+// Color channels as passed to pixelflinger (after any R/B swapping)
+static unsigned char gr_current_color[4] = { 255, 255, 255, 255 };
+
 #if 0 // unused
 static bool outside(int x, int y)
 {
@@ -133,18 +147,244 @@ int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, in
     return gr_ttf_textExWH(gl, x, y + y_scale, s, vfont, measured_width + x, -1);
 }
 
+static void gr_set_scissor(bool enabled, int x, int y, int w, int h)
+{
+    gr_scissor_enabled = enabled;
+    gr_scissor[0] = x;
+    gr_scissor[1] = y;
+    gr_scissor[2] = x + w;
+    gr_scissor[3] = y + h;
+}
+
+// Intersect a destination rectangle with the drawing surface and the scissor
+// box. Returns false if nothing is left to draw.
+static bool gr_clip_rect(int& x1, int& y1, int& x2, int& y2)
+{
+    x1 = std::max(x1, 0);
+    y1 = std::max(y1, 0);
+    x2 = std::min(x2, gr_draw->width);
+    y2 = std::min(y2, gr_draw->height);
+
+    if (gr_scissor_enabled) {
+        x1 = std::max(x1, gr_scissor[0]);
+        y1 = std::max(y1, gr_scissor[1]);
+        x2 = std::min(x2, gr_scissor[2]);
+        y2 = std::min(y2, gr_scissor[3]);
+    }
+
+    return x1 < x2 && y1 < y2;
+}
+
+static uint32_t* gr_draw_row(int x, int y)
+{
+    return reinterpret_cast<uint32_t*>(gr_draw->data + y * gr_draw->row_bytes)
+            + x;
+}
+
+// Whether the drawing surface is a 32-bit format with the same channel order
+// as RGBA_8888 images. Returns false for formats that need a conversion.
+static bool gr_draw_is_rgba()
+{
+#ifdef GR_HAVE_BLEND_KERNELS
+    return gr_draw->format == GGL_PIXEL_FORMAT_RGBA_8888
+            || gr_draw->format == GGL_PIXEL_FORMAT_RGBX_8888;
+#else
+    return false;
+#endif
+}
+
+// Pack the current color in the memory layout of the drawing surface
+static bool gr_pack_color(uint32_t& pixel)
+{
+    if (!gr_draw_is_rgba()) {
+        return false;
+    }
+
+    const unsigned char *c = gr_current_color;
+    pixel = c[0] | (c[1] << 8) | (c[2] << 16)
+            | (static_cast<uint32_t>(c[3]) << 24);
+    return true;
+}
+
+// Solid and translucent rectangle fill without going through pixelflinger
+static bool gr_fast_fill(int x, int y, int w, int h)
+{
+    int x1 = x, y1 = y, x2 = x + w, y2 = y + h;
+    uint32_t pixel;
+
+    if (gr_draw->format == GGL_PIXEL_FORMAT_RGB_565) {
+        if (!gr_is_curr_clr_opaque) {
+            return false;
+        }
+        if (!gr_clip_rect(x1, y1, x2, y2)) {
+            return true;
+        }
+
+        const unsigned char *c = gr_current_color;
+        uint16_t value = static_cast<uint16_t>(
+                ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3));
+
+        for (int row = y1; row < y2; ++row) {
+            auto *dst = reinterpret_cast<uint16_t*>(
+                    gr_draw->data + row * gr_draw->row_bytes) + x1;
+            std::fill_n(dst, x2 - x1, value);
+        }
+        return true;
+    }
+
+    if (!gr_pack_color(pixel)) {
+        return false;
+    }
+    if (!gr_clip_rect(x1, y1, x2, y2)) {
+        return true;
+    }
+
+    for (int row = y1; row < y2; ++row) {
+        if (gr_is_curr_clr_opaque) {
+            blend_fill_span(gr_draw_row(x1, row), pixel, x2 - x1);
+        } else {
+            blend_color_span(gr_draw_row(x1, row), pixel, x2 - x1);
+        }
+    }
+    return true;
+}
+
+// Image blit without going through pixelflinger. Only used when the source
+// rectangle lies within the image, since pixelflinger would otherwise repeat
+// the texture.
+static bool gr_fast_blit(GGLSurface *surface, int sx, int sy, int w, int h,
+                         int dx, int dy)
+{
+    if (!gr_draw_is_rgba()
+            || (surface->format != GGL_PIXEL_FORMAT_RGBA_8888
+                    && surface->format != GGL_PIXEL_FORMAT_RGBX_8888)
+            || sx < 0 || sy < 0 || w < 0 || h < 0
+            || sx + w > static_cast<int>(surface->width)
+            || sy + h > static_cast<int>(surface->height)) {
+        return false;
+    }
+
+    int x1 = dx, y1 = dy, x2 = dx + w, y2 = dy + h;
+    if (!gr_clip_rect(x1, y1, x2, y2)) {
+        return true;
+    }
+
+    sx += x1 - dx;
+    sy += y1 - dy;
+    int n = x2 - x1;
+
+    for (int row = y1; row < y2; ++row) {
+        auto const *src = reinterpret_cast<const uint32_t*>(surface->data)
+                + (sy + row - y1) * surface->stride + sx;
+        uint32_t *dst = gr_draw_row(x1, row);
+
+        if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
+            memcpy(dst, src, n * sizeof(uint32_t));
+        } else {
+            blend_image_span(dst, src, n);
+        }
+    }
+    return true;
+}
+
+bool gr_fast_blend_mask(const GGLSurface *mask, int dx, int dy, int w, int h)
+{
+    uint32_t pixel;
+
+    if (mask->format != GGL_PIXEL_FORMAT_A_8 || !gr_pack_color(pixel)
+            || w < 0 || h < 0
+            || w > static_cast<int>(mask->width)
+            || h > static_cast<int>(mask->height)) {
+        return false;
+    }
+
+    int x1 = dx, y1 = dy, x2 = dx + w, y2 = dy + h;
+    if (!gr_clip_rect(x1, y1, x2, y2)) {
+        return true;
+    }
+
+    for (int row = y1; row < y2; ++row) {
+        const uint8_t *src = mask->data + (row - dy) * mask->stride
+                + (x1 - dx);
+        blend_mask_span(gr_draw_row(x1, row), src, pixel, x2 - x1);
+    }
+    return true;
+}
+
 void gr_clip(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
+
+    if (gr_has_clip_bounds) {
+        int x1 = std::max(x, gr_clip_bounds[0]);
+        int y1 = std::max(y, gr_clip_bounds[1]);
+        int x2 = std::min(x + w, gr_clip_bounds[2]);
+        int y2 = std::min(y + h, gr_clip_bounds[3]);
+
+        x = x1;
+        y = y1;
+        w = std::max(x2 - x1, 0);
+        h = std::max(y2 - y1, 0);
+    }
+
     gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
+
+    gr_set_scissor(true, x, y, w, h);
 }
 
 void gr_noclip()
 {
     GGLContext *gl = gr_context;
+
+    if (gr_has_clip_bounds) {
+        gl->scissor(gl, gr_clip_bounds[0], gr_clip_bounds[1],
+                    gr_clip_bounds[2] - gr_clip_bounds[0],
+                    gr_clip_bounds[3] - gr_clip_bounds[1]);
+        gl->enable(gl, GGL_SCISSOR_TEST);
+
+        gr_set_scissor(true, gr_clip_bounds[0], gr_clip_bounds[1],
+                       gr_clip_bounds[2] - gr_clip_bounds[0],
+                       gr_clip_bounds[3] - gr_clip_bounds[1]);
+        return;
+    }
+
     gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
     gl->disable(gl, GGL_SCISSOR_TEST);
+
+    gr_set_scissor(false, 0, 0, 0, 0);
+}
+
+// Confine all drawing, including later gr_clip() calls, to a rectangle. This
+// is used for repainting only the damaged part of the screen.
+void gr_set_clip_bounds(int x, int y, int w, int h)
+{
+    gr_has_clip_bounds = true;
+    gr_clip_bounds[0] = x;
+    gr_clip_bounds[1] = y;
+    gr_clip_bounds[2] = x + w;
+    gr_clip_bounds[3] = y + h;
+    gr_noclip();
+}
+
+void gr_reset_clip_bounds()
+{
+    gr_has_clip_bounds = false;
+    gr_noclip();
+}
+
+// Get the bounds set by gr_set_clip_bounds(). Returns false if there are none.
+bool gr_get_clip_bounds(int *x, int *y, int *w, int *h)
+{
+    if (!gr_has_clip_bounds) {
+        return false;
+    }
+
+    *x = gr_clip_bounds[0];
+    *y = gr_clip_bounds[1];
+    *w = gr_clip_bounds[2] - gr_clip_bounds[0];
+    *h = gr_clip_bounds[3] - gr_clip_bounds[1];
+    return true;
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
@@ -207,12 +447,20 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
         color[1] = ((g << 8) | g) + 1;
         color[2] = ((r << 8) | b) + 1;
         color[3] = ((a << 8) | a) + 1;
+
+        gr_current_color[0] = b;
+        gr_current_color[2] = r;
     } else {
         color[0] = ((r << 8) | r) + 1;
         color[1] = ((g << 8) | g) + 1;
         color[2] = ((b << 8) | b) + 1;
         color[3] = ((a << 8) | a) + 1;
+
+        gr_current_color[0] = r;
+        gr_current_color[2] = b;
     }
+    gr_current_color[1] = g;
+    gr_current_color[3] = a;
     gl->color4xv(gl, color);
 
     gr_is_curr_clr_opaque = (a == 255);
@@ -244,6 +492,10 @@ void gr_clear()
 
 void gr_fill(int x, int y, int w, int h)
 {
+    if (gr_fast_fill(x, y, w, h)) {
+        return;
+    }
+
     GGLContext *gl = gr_context;
 
     if (gr_is_curr_clr_opaque) {
@@ -266,6 +518,10 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    if (gr_fast_blit(surface, sx, sy, w, h, dx, dy)) {
+        return;
+    }
+
     if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -300,15 +556,42 @@ unsigned int gr_get_height(gr_surface surface)
     return ((GGLSurface*) surface)->height;
 }
 
-void gr_flip()
+static void gr_set_draw_surface(GRSurface *surface)
 {
-    gr_draw = gr_backend->flip(gr_backend);
+    gr_draw = surface;
     // On double buffered back ends, when we flip, we need to tell
     // pixel flinger to draw to the other buffer
     gr_mem_surface.data = (GGLubyte*)gr_draw->data;
     gr_context->colorBuffer(gr_context, &gr_mem_surface);
 }
 
+void gr_flip()
+{
+    gr_set_draw_surface(gr_backend->flip(gr_backend));
+}
+
+// Like gr_flip(), but only the given rectangle changed since the previous flip
+void gr_flip_region(int x, int y, int w, int h)
+{
+    if (!gr_backend->flip_region) {
+        gr_flip();
+        return;
+    }
+
+    gr_set_draw_surface(gr_backend->flip_region(gr_backend, x, y, w, h));
+}
+
+// Number of flips since the drawing surface was last displayed or 0 if its
+// contents are undefined and the whole screen must be redrawn
+int gr_buffer_age()
+{
+    if (!gr_backend->buffer_age) {
+        return 0;
+    }
+
+    return gr_backend->buffer_age(gr_backend);
+}
+
 static void get_memory_surface(GGLSurface* ms)
 {
     ms->version = sizeof(*ms);
@@ -19,6 +19,8 @@
 
 #include "minui.h"
 
+#include <pixelflinger/pixelflinger.h>
+
 // TODO: lose the function pointers.
 struct minui_backend
 {
@@ -35,6 +37,20 @@ struct minui_backend
 
     // Device cleanup when drawing is done.
     void (*exit)(minui_backend*);
+
+    // Returns the number of flips since the current drawing surface was
+    // last displayed or 0 if its contents are undefined. Optional; a null
+    // pointer is treated as always returning 0.
+    int (*buffer_age)(minui_backend*);
+
+    // Like flip(), but the caller guarantees that only the given rectangle
+    // changed since the previous flip. Optional; flip() is used if null.
+    GRSurface* (*flip_region)(minui_backend*, int x, int y, int w, int h);
 };
 
+// Blend the current color through an A_8 coverage mask placed at (dx, dy).
+// Returns false if the drawing surface is not supported and pixelflinger must
+// be used instead.
+bool gr_fast_blend_mask(const GGLSurface *mask, int dx, int dy, int w, int h);
+
 #endif
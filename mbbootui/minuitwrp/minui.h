@@ -49,11 +49,16 @@ int gr_fb_width(void);
 int gr_fb_height(void);
 gr_pixel *gr_fb_data(void);
 void gr_flip(void);
+void gr_flip_region(int x, int y, int w, int h);
+int gr_buffer_age(void);
 void gr_fb_blank(bool blank);
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 void gr_clip(int x, int y, int w, int h);
 void gr_noclip();
+void gr_set_clip_bounds(int x, int y, int w, int h);
+void gr_reset_clip_bounds();
+bool gr_get_clip_bounds(int *x, int *y, int *w, int *h);
 void gr_fill(int x, int y, int w, int h);
 void gr_line(int x0, int y0, int x1, int y1, int width);
 gr_surface gr_render_circle(int radius, unsigned char r, unsigned char g, unsigned char b, unsigned char a);
@@ -87,6 +92,8 @@ struct input_event;
 int ev_init(void);
 void ev_exit(void);
 int ev_get(struct input_event *ev, int timeout_ms);
+void ev_wake(void);
+void ev_set_timer(int timeout_ms);
 int ev_has_mouse(void);
 
 // Resources
@@ -95,6 +102,9 @@ int ev_has_mouse(void);
 int res_create_surface(const char* name, gr_surface* pSurface);
 void res_free_surface(gr_surface surface);
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h);
+// Raw copies of decoded surfaces. The tag must match for the load to succeed.
+int res_save_surface(gr_surface surface, const char* path, const char* tag);
+int res_load_surface(const char* path, const char* tag, gr_surface* pSurface);
 
 #ifdef __cplusplus
 }
@@ -41,6 +41,21 @@ extern "C" {
 
 #define SURFACE_DATA_ALIGNMENT 8
 
+#define SURFACE_FILE_MAGIC "MBSF"
+#define SURFACE_FILE_VERSION 1
+#define SURFACE_FILE_TAG_SIZE 64
+#define SURFACE_FILE_MAX_DIMENSION 16384
+
+struct SurfaceFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    char tag[SURFACE_FILE_TAG_SIZE];
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+};
+
 static GGLSurface* malloc_surface(size_t data_size)
 {
     size_t size = sizeof(GGLSurface) + data_size + SURFACE_DATA_ALIGNMENT;
@@ -401,6 +416,88 @@ void res_free_surface(gr_surface surface)
     }
 }
 
+// Write the pixels of a surface created by res_create_surface() or
+// res_scale_surface() to a file
+int res_save_surface(gr_surface surface, const char* path, const char* tag)
+{
+    GGLSurface* pSurface = (GGLSurface*) surface;
+    if (!pSurface || pSurface->stride != (GGLint) pSurface->width
+            || strlen(tag) >= SURFACE_FILE_TAG_SIZE) {
+        return -1;
+    }
+
+    SurfaceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SURFACE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SURFACE_FILE_VERSION;
+    strcpy(header.tag, tag);
+    header.width = pSurface->width;
+    header.height = pSurface->height;
+    header.format = pSurface->format;
+
+    FILE* fp = fopen(path, "wbe");
+    if (fp == nullptr) {
+        return -2;
+    }
+
+    size_t size = (size_t) pSurface->width * pSurface->height * 4;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+            && fwrite(pSurface->data, 1, size, fp) == size;
+
+    if (fclose(fp) != 0 || !ok) {
+        unlink(path);
+        return -3;
+    }
+
+    return 0;
+}
+
+// Read a surface written by res_save_surface()
+int res_load_surface(const char* path, const char* tag, gr_surface* pSurface)
+{
+    GGLSurface* surface = nullptr;
+    SurfaceFileHeader header;
+    int result = 0;
+    size_t size;
+
+    *pSurface = nullptr;
+
+    FILE* fp = fopen(path, "rbe");
+    if (fp == nullptr) {
+        return -1;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1
+            || memcmp(header.magic, SURFACE_FILE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != SURFACE_FILE_VERSION
+            || strncmp(header.tag, tag, sizeof(header.tag)) != 0
+            || header.width == 0 || header.width > SURFACE_FILE_MAX_DIMENSION
+            || header.height == 0 || header.height > SURFACE_FILE_MAX_DIMENSION) {
+        result = -2;
+        goto exit;
+    }
+
+    surface = init_display_surface(header.width, header.height);
+    if (surface == nullptr) {
+        result = -8;
+        goto exit;
+    }
+    surface->format = header.format;
+
+    size = (size_t) header.width * header.height * 4;
+    if (fread(surface->data, 1, size, fp) != size) {
+        res_free_surface(surface);
+        result = -3;
+        goto exit;
+    }
+
+    *pSurface = (gr_surface) surface;
+
+exit:
+    fclose(fp);
+    return result;
+}
+
 // Scale image function
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h)
 {
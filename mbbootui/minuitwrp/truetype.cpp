@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "minui.h"
+#include "graphics.h"
 
 #include <cutils/hashmap.h>
 #include <ft2build.h>
@@ -16,7 +17,34 @@
 #include <pthread.h>
 
 #define STRING_CACHE_MAX_ENTRIES 400
-#define STRING_CACHE_TRUNCATE_ENTRIES 150
+#define STRING_CACHE_MAX_BYTES (512 * 1024)
+
+// Glyph bitmaps are packed into square A_8 pages using a simple shelf
+// allocator. Pages are sized to hold about 8 lines of text. When the last page
+// is full, the whole atlas is discarded and rebuilt from the glyphs that are
+// in use.
+#define GLYPH_ATLAS_MIN_PAGE_SIZE 256
+#define GLYPH_ATLAS_MAX_PAGE_SIZE 1024
+#define GLYPH_ATLAS_LINES_PER_PAGE 8
+#define GLYPH_ATLAS_MAX_PAGES 8
+
+typedef struct
+{
+    uint8_t *data;
+    int shelf_x;
+    int shelf_y;
+    int shelf_height;
+} GlyphAtlasPage;
+
+typedef struct
+{
+    unsigned int glyph_hits;
+    unsigned int glyph_misses;
+    unsigned int atlas_resets;
+    unsigned int string_hits;
+    unsigned int string_misses;
+    unsigned int string_evictions;
+} TrueTypeCacheStats;
 
 typedef struct
 {
@@ -35,9 +63,14 @@ typedef struct
     int base;
     FT_Face face;
     Hashmap *glyph_cache;
+    GlyphAtlasPage atlas[GLYPH_ATLAS_MAX_PAGES];
+    int atlas_pages;
+    int atlas_page_size;
     Hashmap *string_cache;
     struct StringCacheEntry *string_cache_head;
     struct StringCacheEntry *string_cache_tail;
+    size_t string_cache_bytes;
+    TrueTypeCacheStats stats;
     pthread_mutex_t mutex;
     TrueTypeFontKey *key;
 } TrueTypeFont;
@@ -45,7 +78,16 @@ typedef struct
 typedef struct
 {
     FT_BBox bbox;
-    FT_BitmapGlyph glyph;
+    int advance;
+    int left;
+    int top;
+    int width;
+    int rows;
+    // Points into an atlas page, or to a separate allocation if the glyph is
+    // too large for a page
+    uint8_t *bitmap;
+    int pitch;
+    bool owns_bitmap;
 } TrueTypeCacheEntry;
 
 typedef struct
@@ -232,6 +274,12 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
     res->base = -1;
     res->refcount = 1;
     res->glyph_cache = hashmapCreate(32, hashmapIntHash, hashmapIntEquals);
+    res->atlas_page_size = GLYPH_ATLAS_MIN_PAGE_SIZE;
+    while (res->atlas_page_size < GLYPH_ATLAS_MAX_PAGE_SIZE
+            && res->atlas_page_size < GLYPH_ATLAS_LINES_PER_PAGE
+                    * (face->size->metrics.height >> 6)) {
+        res->atlas_page_size *= 2;
+    }
     res->string_cache = hashmapCreate(128, gr_ttf_string_cache_hash, gr_ttf_string_cache_equals);
     pthread_mutex_init(&res->mutex, 0);
 
@@ -274,12 +322,28 @@ void *gr_ttf_scaleFont(void *font, int max_width, int measured_width)
 static bool gr_ttf_freeFontCache(void *key, void *value, void *context __unused)
 {
     TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
-    FT_Done_Glyph((FT_Glyph)e->glyph);
+    if (e->owns_bitmap) {
+        free(e->bitmap);
+    }
     free(e);
     free(key);
     return true;
 }
 
+// Drop all cached glyphs and atlas pages
+static void gr_ttf_glyph_cache_clear(TrueTypeFont *font)
+{
+    hashmapForEach(font->glyph_cache, gr_ttf_freeFontCache, nullptr);
+    hashmapFree(font->glyph_cache);
+    font->glyph_cache = hashmapCreate(32, hashmapIntHash, hashmapIntEquals);
+
+    for (int i = 0; i < font->atlas_pages; ++i) {
+        free(font->atlas[i].data);
+    }
+    memset(font->atlas, 0, sizeof(font->atlas));
+    font->atlas_pages = 0;
+}
+
 static bool gr_ttf_freeStringCache(void *key, void *value, void *context __unused)
 {
     StringCacheKey *k = (StringCacheKey *)key;
@@ -312,7 +376,7 @@ void gr_ttf_freeFont(void *font)
         FT_Done_Face(d->face);
         hashmapForEach(d->string_cache, gr_ttf_freeStringCache, nullptr);
         hashmapFree(d->string_cache);
-        hashmapForEach(d->glyph_cache, gr_ttf_freeFontCache, nullptr);
+        gr_ttf_glyph_cache_clear(d);
         hashmapFree(d->glyph_cache);
         pthread_mutex_destroy(&d->mutex);
         free(d);
@@ -326,60 +390,146 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_
     return (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
 }
 
-static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index)
+// Reserve space for a width x height bitmap in the glyph atlas. Returns false
+// if the atlas is full.
+static bool gr_ttf_atlas_alloc(TrueTypeFont *font, int width, int height,
+                               uint8_t **bitmap)
 {
-    TrueTypeCacheEntry *res = (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
-    if (!res) {
-        int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
-        if (error) {
-            fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_index, error);
-            return nullptr;
-        }
+    int size = font->atlas_page_size;
+    // Leave a pixel between glyphs
+    int w = width + 1;
+    int h = height + 1;
 
-        FT_BitmapGlyph glyph;
-        error = FT_Get_Glyph(font->face->glyph, (FT_Glyph*)&glyph);
-        if (error) {
-            fprintf(stderr, "Failed to copy glyph %d: %d\n", char_index, error);
-            return nullptr;
+    if (font->atlas_pages > 0) {
+        GlyphAtlasPage *page = &font->atlas[font->atlas_pages - 1];
+
+        if (page->shelf_x + w > size) {
+            page->shelf_y += page->shelf_height;
+            page->shelf_x = 0;
+            page->shelf_height = 0;
         }
 
-        res = (TrueTypeCacheEntry *)malloc(sizeof(TrueTypeCacheEntry));
-        memset(res, 0, sizeof(TrueTypeCacheEntry));
-        res->glyph = glyph;
-        FT_Glyph_Get_CBox((FT_Glyph)glyph, FT_GLYPH_BBOX_PIXELS, &res->bbox);
+        if (page->shelf_y + h <= size) {
+            *bitmap = page->data + page->shelf_y * size
+                    + page->shelf_x;
+            page->shelf_x += w;
+            page->shelf_height = MAX(page->shelf_height, h);
+            return true;
+        }
+    }
 
-        int *key = (int *)malloc(sizeof(int));
-        *key = char_index;
+    if (font->atlas_pages == GLYPH_ATLAS_MAX_PAGES) {
+        return false;
+    }
 
-        hashmapPut(font->glyph_cache, key, res);
+    GlyphAtlasPage *page = &font->atlas[font->atlas_pages];
+    page->data = (uint8_t *) malloc(size * size);
+    if (!page->data) {
+        return false;
     }
+    page->shelf_x = w;
+    page->shelf_y = 0;
+    page->shelf_height = h;
+    ++font->atlas_pages;
 
-    return res;
+    *bitmap = page->data;
+    return true;
 }
 
-static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base)
+static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index)
 {
-    unsigned y;
-    uint8_t *src_itr = glyph->bitmap.buffer;
-    uint8_t *dest_itr = dest->data;
+    TrueTypeCacheEntry *res = (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
+    if (res) {
+        ++font->stats.glyph_hits;
+        return res;
+    }
 
-    if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
-        fprintf(stderr, "Unsupported pixel mode in FT_BitmapGlyph %d\n", glyph->bitmap.pixel_mode);
-        return -1;
+    ++font->stats.glyph_misses;
+
+    int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
+    if (error) {
+        fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_index, error);
+        return nullptr;
+    }
+
+    FT_GlyphSlot slot = font->face->glyph;
+    FT_Bitmap *bitmap = &slot->bitmap;
+
+    res = (TrueTypeCacheEntry *)malloc(sizeof(TrueTypeCacheEntry));
+    memset(res, 0, sizeof(TrueTypeCacheEntry));
+    res->advance = slot->advance.x >> 6;
+    res->left = slot->bitmap_left;
+    res->top = slot->bitmap_top;
+    res->bbox.xMin = slot->bitmap_left;
+    res->bbox.xMax = slot->bitmap_left + bitmap->width;
+    res->bbox.yMin = slot->bitmap_top - bitmap->rows;
+    res->bbox.yMax = slot->bitmap_top;
+
+    if (bitmap->pixel_mode != FT_PIXEL_MODE_GRAY) {
+        fprintf(stderr, "Unsupported pixel mode in FT_Bitmap %d\n", bitmap->pixel_mode);
+    } else if (bitmap->width > 0 && bitmap->rows > 0) {
+        int width = bitmap->width;
+        int rows = bitmap->rows;
+        uint8_t *dest;
+        int pitch = font->atlas_page_size;
+
+        if (width >= pitch || rows >= pitch) {
+            dest = (uint8_t *) malloc(width * rows);
+            pitch = width;
+            res->owns_bitmap = true;
+        } else if (!gr_ttf_atlas_alloc(font, width, rows, &dest)) {
+            // Start over with an empty atlas. The glyphs that are still in
+            // use are loaded again on demand.
+            ++font->stats.atlas_resets;
+            gr_ttf_glyph_cache_clear(font);
+            if (!gr_ttf_atlas_alloc(font, width, rows, &dest)) {
+                dest = nullptr;
+            }
+        }
+
+        if (!dest) {
+            fprintf(stderr, "Failed to allocate bitmap for glyph %d\n", char_index);
+            free(res);
+            return nullptr;
+        }
+
+        for (int y = 0; y < rows; ++y) {
+            memcpy(dest + y * pitch, bitmap->buffer + y * bitmap->pitch, width);
+        }
+
+        res->bitmap = dest;
+        res->pitch = pitch;
+        res->width = width;
+        res->rows = rows;
     }
 
-    dest_itr += (offY + base - glyph->top)*dest->stride + (offX + glyph->left);
+    int *key = (int *)malloc(sizeof(int));
+    *key = char_index;
+
+    hashmapPut(font->glyph_cache, key, res);
+
+    return res;
+}
 
-    // FIXME: if glyph->left is negative and everything else is 0 (e.g. letter 'j' in Roboto-Regular),
-    // the result might end up being before the buffer - I'm not sure how to properly handle this.
-    if (dest_itr < dest->data) {
-        dest_itr = dest->data;
+static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, TrueTypeCacheEntry *glyph, int offX, int offY, int base)
+{
+    if (!glyph->bitmap) {
+        return 0;
     }
 
-    for (y = 0; y < glyph->bitmap.rows; ++y) {
-        memcpy(dest_itr, src_itr, glyph->bitmap.width);
-        src_itr += glyph->bitmap.pitch;
-        dest_itr += dest->stride;
+    // Clip the glyph to the surface. Glyphs can extend past the advance of
+    // the first or last character (e.g. letter 'j' in Roboto-Regular).
+    int dest_x = offX + glyph->left;
+    int dest_y = offY + base - glyph->top;
+    int x1 = MAX(dest_x, 0);
+    int y1 = MAX(dest_y, 0);
+    int x2 = MIN(dest_x + glyph->width, (int) dest->width);
+    int y2 = MIN(dest_y + glyph->rows, (int) dest->height);
+
+    for (int y = y1; y < y2; ++y) {
+        memcpy(dest->data + y * dest->stride + x1,
+               glyph->bitmap + (y - dest_y) * glyph->pitch + (x1 - dest_x),
+               x2 - x1);
     }
     return 0;
 }
@@ -463,7 +613,7 @@ static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const cha
 
         ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
-            diff = ent->glyph->root.advance.x >> 16;
+            diff = ent->advance;
 
             if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
                 FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
@@ -512,8 +662,8 @@ static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const cha
 
         ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
-            gr_ttf_copy_glyph_to_surface(surface, ent->glyph, x, 0, font->base);
-            x += ent->glyph->root.advance.x >> 16;
+            gr_ttf_copy_glyph_to_surface(surface, ent, x, 0, font->base);
+            x += ent->advance;
         }
 
         prev_idx = char_idx;
@@ -533,6 +683,60 @@ static StringCacheEntry *gr_ttf_string_cache_peek(TrueTypeFont *font, const char
     return (StringCacheEntry *)hashmapGet(font->string_cache, &k);
 }
 
+static size_t gr_ttf_string_cache_entry_size(StringCacheEntry *e)
+{
+    return e->surface.height * e->surface.width + sizeof(StringCacheEntry);
+}
+
+static void gr_ttf_string_cache_unlink(TrueTypeFont *font, StringCacheEntry *e)
+{
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        font->string_cache_head = e->next;
+    }
+
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        font->string_cache_tail = e->prev;
+    }
+
+    e->prev = nullptr;
+    e->next = nullptr;
+}
+
+static void gr_ttf_string_cache_append(TrueTypeFont *font, StringCacheEntry *e)
+{
+    e->prev = font->string_cache_tail;
+    e->next = nullptr;
+
+    if (font->string_cache_tail) {
+        font->string_cache_tail->next = e;
+    } else {
+        font->string_cache_head = e;
+    }
+    font->string_cache_tail = e;
+}
+
+// Evict least recently used strings until the cache is within its limits. The
+// most recently used entry is always kept.
+static void gr_ttf_string_cache_trim(TrueTypeFont *font)
+{
+    while (font->string_cache_head != font->string_cache_tail
+            && (hashmapSize(font->string_cache) > STRING_CACHE_MAX_ENTRIES
+                    || font->string_cache_bytes > STRING_CACHE_MAX_BYTES)) {
+        StringCacheEntry *ent = font->string_cache_head;
+
+        gr_ttf_string_cache_unlink(font, ent);
+        hashmapRemove(font->string_cache, ent->key);
+        font->string_cache_bytes -= gr_ttf_string_cache_entry_size(ent);
+        ++font->stats.string_evictions;
+
+        gr_ttf_freeStringCache(ent->key, ent, nullptr);
+    }
+}
+
 static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char *text, int max_width)
 {
     StringCacheEntry *res;
@@ -543,6 +747,8 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
 
     res = (StringCacheEntry *)hashmapGet(font->string_cache, &k);
     if (!res) {
+        ++font->stats.string_misses;
+
         res = (StringCacheEntry *)malloc(sizeof(StringCacheEntry));
         memset(res, 0, sizeof(StringCacheEntry));
         res->rendered_bytes = gr_ttf_render_text(font, &res->surface, text, max_width);
@@ -558,47 +764,19 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
 
         res->key = new_key;
 
-        if (font->string_cache_tail) {
-            res->prev = font->string_cache_tail;
-            res->prev->next = res;
-        } else {
-            font->string_cache_head = res;
-        }
-        font->string_cache_tail = res;
-
+        gr_ttf_string_cache_append(font, res);
         hashmapPut(font->string_cache, new_key, res);
-    } else if (res->next) {
-        // move this entry to the tail of the linked list
-        // if it isn't already there
-        if (res->prev) {
-            res->prev->next = res->next;
-        }
-
-        res->next->prev = res->prev;
-
-        if (!res->prev) {
-            font->string_cache_head = res->next;
-        }
-
-        res->next = nullptr;
-        res->prev = font->string_cache_tail;
-        res->prev->next = res;
-        font->string_cache_tail = res;
+        font->string_cache_bytes += gr_ttf_string_cache_entry_size(res);
 
-        // truncate old entries
-        if (hashmapSize(font->string_cache) >= STRING_CACHE_MAX_ENTRIES) {
-            printf("Truncating string cache entries.\n");
-            int i;
-            StringCacheEntry *ent;
-            for (i = 0; i < STRING_CACHE_TRUNCATE_ENTRIES; ++i) {
-                ent = font->string_cache_head;
-                font->string_cache_head = ent->next;
-                font->string_cache_head->prev = nullptr;
-
-                hashmapRemove(font->string_cache, ent->key);
+        gr_ttf_string_cache_trim(font);
+    } else {
+        ++font->stats.string_hits;
 
-                gr_ttf_freeStringCache(ent->key, ent, nullptr);
-            }
+        // move this entry to the tail of the linked list
+        // if it isn't already there
+        if (res->next) {
+            gr_ttf_string_cache_unlink(font, res);
+            gr_ttf_string_cache_append(font, res);
         }
     }
     return res;
@@ -661,7 +839,7 @@ int gr_ttf_maxExW(const char *s, void *font, int max_width)
             continue;
         }
 
-        total_w += ent->glyph->root.advance.x >> 16;
+        total_w += ent->advance;
         max_bytes += utf_bytes;
     }
     pthread_mutex_unlock(&f->mutex);
@@ -700,6 +878,11 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         }
     }
 
+    if (gr_fast_blend_mask(&e->surface, x, y, e->surface.width, y_bottom - y)) {
+        pthread_mutex_unlock(&font->mutex);
+        return res;
+    }
+
     gl->bindTexture(gl, &e->surface);
     gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
     gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
@@ -730,35 +913,32 @@ int gr_ttf_getMaxFontHeight(void *font)
     return res;
 }
 
-static bool gr_ttf_dump_stats_count_string_cache(void *key __unused, void *value, void *context)
-{
-    int *string_cache_size = (int *) context;
-    StringCacheEntry *e = (StringCacheEntry *) value;
-    *string_cache_size += e->surface.height*e->surface.width + sizeof(StringCacheEntry);
-    return true;
-}
-
 static bool gr_ttf_dump_stats_font(void *key, void *value, void *context)
 {
     TrueTypeFontKey *k = (TrueTypeFontKey *)key;
     TrueTypeFont *f = (TrueTypeFont *)value;
     int *total_string_cache_size = (int *)context;
-    int string_cache_size = 0;
+    int string_cache_size;
 
     pthread_mutex_lock(&f->mutex);
 
-    hashmapForEach(f->string_cache, gr_ttf_dump_stats_count_string_cache, &string_cache_size);
+    string_cache_size = f->string_cache_bytes;
 
     printf("  Font %s (size %d, dpi %d):\n"
            "    refcount: %d\n"
            "    max_height: %d\n"
            "    base: %d\n"
-           "    glyph_cache: %zu entries\n"
-           "    string_cache: %zu entries (%.2f kB)\n",
+           "    glyph_cache: %zu entries, %d atlas pages (%.2f kB)\n"
+           "    glyph_cache: %u hits, %u misses, %u atlas resets\n"
+           "    string_cache: %zu entries (%.2f kB)\n"
+           "    string_cache: %u hits, %u misses, %u evictions\n",
            k->path, k->size, k->dpi,
            f->refcount, f->max_height, f->base,
-           hashmapSize(f->glyph_cache),
-           hashmapSize(f->string_cache), ((double)string_cache_size)/1024);
+           hashmapSize(f->glyph_cache), f->atlas_pages,
+           ((double)f->atlas_pages * f->atlas_page_size * f->atlas_page_size)/1024,
+           f->stats.glyph_hits, f->stats.glyph_misses, f->stats.atlas_resets,
+           hashmapSize(f->string_cache), ((double)string_cache_size)/1024,
+           f->stats.string_hits, f->stats.string_misses, f->stats.string_evictions);
 
     pthread_mutex_unlock(&f->mutex);
 
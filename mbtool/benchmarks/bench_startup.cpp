@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mbcommon/integer.h"
+
+using namespace mb;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    unsigned int iterations = 50;
+    std::vector<std::string> tools;
+};
+
+struct Result
+{
+    double min = 0;
+    double mean = 0;
+    double max = 0;
+    bool ok = true;
+};
+
+/*!
+ * \brief Run a command with stdin, stdout, and stderr redirected
+ *
+ * \param argv Command
+ * \param out_fd fd for stdout and stderr or -1 for /dev/null
+ *
+ * \return Whether the command exited with a zero status
+ */
+static bool run(const std::vector<const char *> &argv, int out_fd)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to fork: %s\n", strerror(errno));
+        return false;
+    } else if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+        if (null_fd < 0) {
+            _exit(127);
+        }
+        if (out_fd < 0) {
+            out_fd = null_fd;
+        }
+
+        dup2(null_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(out_fd, STDERR_FILENO);
+
+        execv(argv[0], const_cast<char * const *>(argv.data()));
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*!
+ * \brief Get the tools listed in the usage text of the multicall binary
+ */
+static std::vector<std::string> list_tools(const char *binary)
+{
+    std::vector<std::string> tools;
+    int pipe_fds[2];
+
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+        return tools;
+    }
+
+    // Without arguments, the usage text is printed and the exit status is
+    // non-zero
+    (void) run({binary, nullptr}, pipe_fds[1]);
+    close(pipe_fds[1]);
+
+    std::string output;
+    char buf[4096];
+    ssize_t n;
+
+    while ((n = read(pipe_fds[0], buf, sizeof(buf))) > 0) {
+        output.append(buf, static_cast<size_t>(n));
+    }
+    close(pipe_fds[0]);
+
+    static constexpr std::string_view header = "Available tools:\n";
+
+    auto pos = output.find(header);
+    if (pos == std::string::npos) {
+        return tools;
+    }
+
+    std::string_view list(output);
+    list.remove_prefix(pos + header.size());
+
+    while (!list.empty()) {
+        auto end = list.find('\n');
+        auto line = list.substr(0, end);
+
+        if (line.size() > 2 && line.substr(0, 2) == "  ") {
+            tools.emplace_back(line.substr(2));
+        }
+
+        if (end == std::string_view::npos) {
+            break;
+        }
+        list.remove_prefix(end + 1);
+    }
+
+    return tools;
+}
+
+static Result bench_tool(const char *binary, const std::string &tool,
+                         unsigned int iterations)
+{
+    Result result;
+    std::vector<double> times;
+
+    for (unsigned int i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        bool ok = run({binary, tool.c_str(), "--help", nullptr}, -1);
+        auto stop = Clock::now();
+
+        if (!ok) {
+            result.ok = false;
+            return result;
+        }
+
+        times.push_back(std::chrono::duration<double>(stop - start).count());
+    }
+
+    auto [min, max] = std::minmax_element(times.begin(), times.end());
+    result.min = *min;
+    result.max = *max;
+
+    for (auto t : times) {
+        result.mean += t;
+    }
+    result.mean /= static_cast<double>(times.size());
+
+    return result;
+}
+
+static void usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: mbtool_benchmarks [<option>...] <mbtool binary>\n"
+            "\n"
+            "Options:\n"
+            "  -n, --iterations <n>   Runs per tool (default: 50)\n"
+            "  -t, --tool <tool>      Tool to benchmark (default: all)\n"
+            "                         (can be specified multiple times)\n"
+            "\n"
+            "Each run executes \"<mbtool binary> <tool> --help\" with output\n"
+            "discarded, so the times mostly consist of process startup (exec,\n"
+            "dynamic linking if any, and static initialization) and argument\n"
+            "parsing.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    Options opts;
+    int opt;
+
+    static const char short_options[] = "n:t:h";
+
+    static const option long_options[] = {
+        {"iterations", required_argument, nullptr, 'n'},
+        {"tool",       required_argument, nullptr, 't'},
+        {"help",       no_argument,       nullptr, 'h'},
+        {nullptr,      0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'n':
+            if (!str_to_num(optarg, 10, opts.iterations)
+                    || opts.iterations == 0) {
+                fprintf(stderr, "Invalid iterations: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 't':
+            opts.tools.emplace_back(optarg);
+            break;
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    const char *binary = argv[optind];
+
+    if (opts.tools.empty()) {
+        opts.tools = list_tools(binary);
+        if (opts.tools.empty()) {
+            fprintf(stderr, "%s: Failed to list tools\n", binary);
+            return EXIT_FAILURE;
+        }
+    }
+
+    bool ok = true;
+
+    printf("%-20s %12s %12s %12s\n", "tool", "min", "mean", "max");
+
+    for (auto const &tool : opts.tools) {
+        auto result = bench_tool(binary, tool, opts.iterations);
+
+        if (!result.ok) {
+            printf("%-20s %12s\n", tool.c_str(), "failed");
+            ok = false;
+            continue;
+        }
+
+        printf("%-20s %10.3fms %10.3fms %10.3fms\n", tool.c_str(),
+               result.min * 1000, result.mean * 1000, result.max * 1000);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
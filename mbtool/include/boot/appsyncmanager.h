@@ -20,6 +20,9 @@
 #pragma once
 
 #include <string>
+#include <vector>
+
+#include <sys/types.h>
 
 #include "boot/packages.h"
 #include "util/roms.h"
@@ -28,11 +31,12 @@
 namespace mb
 {
 
-struct RomConfigAndPackages
+struct SharedDataPackage
 {
-    std::shared_ptr<Rom> rom;
-    RomConfig config;
-    Packages packages;
+    std::string pkg;
+    uid_t uid;
+    //! Whether the package's data can be (or was) shared
+    bool ok;
 };
 
 class AppSyncManager
@@ -43,10 +47,11 @@ public:
     static std::string get_shared_data_path(const std::string &pkg);
 
     static bool initialize_directories();
-    static bool create_shared_data_directory(const std::string &pkg, uid_t uid);
-    static bool fix_shared_data_permissions();
+    static void create_shared_data_directories(
+            std::vector<SharedDataPackage> &pkgs);
 
-    static bool mount_shared_directory(const std::string &pkg, uid_t uid);
+    static void mount_shared_directories(
+            std::vector<SharedDataPackage> &pkgs);
     static bool unmount_shared_directory(const std::string &pkg);
 };
 
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+/*!
+ * \brief Records the time spent in each stage of the multiboot init process
+ *
+ * Timestamps are collected in memory while init runs and are only written out
+ * by write() once a location for them is available. Optionally, snapshots of
+ * `/proc` are taken at each stage boundary so that the result can also be
+ * rendered with bootchart tools.
+ */
+class BootTrace
+{
+public:
+    using StageId = std::size_t;
+
+    BootTrace();
+
+    void set_enabled(bool enabled);
+    bool enabled() const;
+
+    StageId begin(const char *name);
+    void end(StageId id);
+    void mark(const char *name);
+
+    oc::result<void> write(const std::string &dir) const;
+
+private:
+    struct Stage
+    {
+        const char *name;
+        uint64_t begin_ns;
+        uint64_t end_ns;
+    };
+
+    struct Sample
+    {
+        uint64_t jiffies;
+        std::string stat;
+        std::string diskstats;
+        std::string ps;
+    };
+
+    void take_sample();
+
+    oc::result<void> write_json(const std::string &path) const;
+    oc::result<void> write_bootchart(const std::string &dir) const;
+
+    bool m_enabled;
+    std::vector<Stage> m_stages;
+    std::vector<Sample> m_samples;
+};
+
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mbcommon/common.h"
+
+#include "boot/packages.h"
+#include "boot/rom_registry.h"
+#include "util/roms.h"
+
+namespace mb
+{
+
+/*!
+ * \brief State that outlives individual daemon requests
+ *
+ * A connection worker serves many requests over its lifetime. This keeps the
+ * results that are expensive to compute and rarely change around between
+ * them. Every accessor checks that its cached value is still valid, so
+ * callers never see stale data from changes made outside of the daemon.
+ * Mutations made by the daemon itself should call invalidate().
+ */
+class DaemonState
+{
+public:
+    DaemonState();
+    ~DaemonState();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DaemonState)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(DaemonState)
+
+    std::shared_ptr<Rom> current_rom();
+
+    const std::vector<RomRegistryEntry> & installed_roms();
+    std::shared_ptr<Rom> find_installed_rom(const std::string &id);
+
+    std::shared_ptr<const Packages> packages(const std::string &path);
+
+    void invalidate();
+
+private:
+    struct CachedPackages
+    {
+        struct stat sb;
+        std::shared_ptr<const Packages> pkgs;
+    };
+
+    RomRegistry m_registry;
+    std::optional<std::shared_ptr<Rom>> m_current_rom;
+    std::unordered_map<std::string, CachedPackages> m_packages;
+};
+
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <cstdint>
+
+namespace mb
+{
+
+//! Summary of the statistics for one request type
+struct DaemonRequestStats
+{
+    uint8_t type;
+    uint64_t count;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t total_us;
+    uint64_t max_us;
+    uint64_t p50_us;
+    uint64_t p90_us;
+    uint64_t p99_us;
+};
+
+bool daemon_stats_init();
+
+void daemon_stats_record(uint8_t type, uint64_t duration_us,
+                         uint64_t bytes_in, uint64_t bytes_out);
+
+std::vector<DaemonRequestStats> daemon_stats_snapshot();
+
+void daemon_stats_reset();
+
+void daemon_stats_dump();
+
+}
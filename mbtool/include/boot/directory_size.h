@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mbcommon/outcome.h"
+
+#include "mbutil/file_op_progress.h"
+
+namespace mb
+{
+
+struct DirectoryStats
+{
+    //! Total size of the regular files in bytes
+    uint64_t size;
+    //! Number of regular files
+    uint64_t files;
+};
+
+oc::result<DirectoryStats>
+get_directory_stats(const std::string &path,
+                    const std::vector<std::string> &exclusions,
+                    util::FileOpProgress *progress = nullptr);
+oc::result<uint64_t> get_directory_size(const std::string &path,
+                                        const std::vector<std::string> &exclusions);
+
+class DirectorySizeCache
+{
+public:
+    oc::result<uint64_t> get(const std::string &path,
+                             const std::vector<std::string> &exclusions);
+
+private:
+    struct Entry
+    {
+        std::vector<std::string> exclusions;
+        dev_t dev;
+        ino_t ino;
+        struct timespec mtime;
+        struct timespec ctime;
+        std::chrono::steady_clock::time_point time;
+        uint64_t size;
+    };
+
+    std::unordered_map<std::string, Entry> m_entries;
+};
+
+}
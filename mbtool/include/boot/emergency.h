@@ -19,6 +19,10 @@
 
 #pragma once
 
+#include <memory>
+
+#include "mblog/kmsg_logger.h"
+
 #define KLOG_CLOSE         0
 #define KLOG_OPEN          1
 #define KLOG_READ          2
@@ -34,6 +38,8 @@
 namespace mb
 {
 
+void emergency_set_kmsg_logger(std::shared_ptr<log::KmsgLogger> logger);
+
 [[noreturn]] void emergency_reboot();
 
 }
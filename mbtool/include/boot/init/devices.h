@@ -18,8 +18,9 @@
 #pragma once
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
-#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -52,22 +53,42 @@ class DeviceHandler {
     ~DeviceHandler(){};
 
     void HandleDeviceEvent(const Uevent& uevent);
+    // Handle uevents in order. Parent directories are opened once per batch
+    // and nodes and symlinks are created relative to them.
+    void HandleDeviceEvents(const Uevent* uevents, size_t count);
+    void HandleDeviceEvents(const std::vector<Uevent>& uevents);
 
     std::vector<std::string> GetBlockDeviceSymlinks(const Uevent& uevent) const;
 
     BlockDevMap GetBlockDeviceMap() const;
 
+    // Incremented whenever a block device is added
+    uint64_t GetBlockDeviceGeneration() const;
+    // Wait until the block device generation differs from |generation|.
+    // Returns false if |deadline| passes first.
+    bool WaitForBlockDevice(uint64_t generation,
+                            std::chrono::steady_clock::time_point deadline) const;
+
   private:
+    class DirCache;
+
     bool FindPlatformDevice(std::string path, std::string* platform_device_path) const;
-    void MakeDevice(const std::string& path, bool block, int major, int minor) const;
-    void HandleDevice(const std::string& action, const std::string& devpath, bool block, int major,
-                      int minor, const std::vector<std::string>& links) const;
+    void MakeDevice(DirCache& dirs, const std::string& path, bool block, int major,
+                    int minor) const;
+    void HandleDevice(DirCache& dirs, const std::string& action, const std::string& devpath,
+                      bool block, int major, int minor,
+                      const std::vector<std::string>& links) const;
+    std::string ProcessUevent(DirCache& dirs, const Uevent& uevent) const;
 
     std::string sysfs_mount_point_;
-    mutable std::optional<std::string> boot_device_;
+    // Resolved once since events may be handled from several threads
+    mutable std::once_flag boot_device_once_;
+    mutable std::string boot_device_;
 
     BlockDevMap block_dev_mappings_;
     mutable std::mutex block_dev_mappings_guard_;
+    mutable std::condition_variable block_dev_added_;
+    uint64_t block_dev_generation_ = 0;
 };
 
 // Exposed for testing
@@ -19,7 +19,9 @@
 
 #include <chrono>
 #include <functional>
+#include <memory>
 #include <optional>
+#include <vector>
 
 #include <dirent.h>
 
@@ -37,6 +39,8 @@ enum class ListenerAction {
 };
 
 using ListenerCallback = std::function<ListenerAction(const Uevent&)>;
+// Receives all uevents that were pending on the socket at once
+using BatchListenerCallback = std::function<ListenerAction(const std::vector<Uevent>&)>;
 
 class UeventListener {
   public:
@@ -47,12 +51,16 @@ class UeventListener {
                                             const ListenerCallback& callback) const;
     void Poll(const ListenerCallback& callback, int cancel_fd,
               const std::optional<std::chrono::milliseconds> relative_timeout = {}) const;
+    void PollBatch(const BatchListenerCallback& callback, int cancel_fd,
+                   const std::optional<std::chrono::milliseconds> relative_timeout = {}) const;
 
   private:
-    bool ReadUevent(Uevent* uevent) const;
+    bool ReadUevents(std::vector<Uevent>* uevents) const;
     ListenerAction RegenerateUeventsForDir(DIR* d, const ListenerCallback& callback) const;
 
     android::base::unique_fd device_fd_;
+    // Receive buffer for UEVENT_BATCH_MAX messages. Allocated on first use.
+    mutable std::unique_ptr<char[]> recv_buf_;
 };
 
 }  // namespace init
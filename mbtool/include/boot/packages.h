@@ -177,9 +177,18 @@ public:
     std::unordered_map<std::string, std::string> sigs;
 
     bool load_xml(const std::string &path);
+    bool load_xml_cached(const std::string &path,
+                         const std::string &snapshot_dir);
 
     std::shared_ptr<Package> find_by_uid(uid_t uid) const;
     std::shared_ptr<Package> find_by_pkg(const std::string &pkg_id) const;
+
+private:
+    // Indexes into pkgs (rebuilt by the load functions)
+    std::unordered_map<std::string, std::shared_ptr<Package>> _by_name;
+    std::unordered_map<uid_t, std::shared_ptr<Package>> _by_uid;
+
+    void build_index();
 };
 
 }
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mbcommon/common.h"
+
+#include "util/roms.h"
+
+namespace mb
+{
+
+struct RomRegistryEntry
+{
+    std::shared_ptr<Rom> rom;
+    std::string system_path;
+    std::string cache_path;
+    std::string data_path;
+    //! ro.build.version.release (empty if unknown)
+    std::string version;
+    //! ro.build.display.id (empty if unknown)
+    std::string build;
+};
+
+class RomRegistry
+{
+public:
+    RomRegistry();
+    ~RomRegistry();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(RomRegistry)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(RomRegistry)
+
+    const std::vector<RomRegistryEntry> & installed_roms();
+
+    void invalidate();
+
+private:
+    std::vector<RomRegistryEntry> m_entries;
+    bool m_valid;
+    int m_inotify_fd;
+    int m_mounts_fd;
+
+    bool is_stale();
+    void rescan();
+    void add_watch(std::string path);
+};
+
+}
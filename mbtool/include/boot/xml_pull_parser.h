@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+/*!
+ * \brief Streaming parser for text XML and Android Binary XML (ABX)
+ *
+ * Only elements and their attributes are reported. Text, comments, processing
+ * instructions, and document type declarations are skipped. The format is
+ * detected from the magic at the beginning of the data.
+ */
+class XmlPullParser
+{
+public:
+    enum class Event
+    {
+        StartTag,
+        EndTag,
+        EndDocument,
+    };
+
+    struct Attribute
+    {
+        std::string_view name;
+        std::string value;
+    };
+
+    explicit XmlPullParser(std::string_view data);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(XmlPullParser)
+
+    oc::result<Event> next();
+    oc::result<void> skip_subtree();
+
+    bool is_binary() const;
+    //! Name of the current tag
+    std::string_view name() const;
+    //! Attributes of the current start tag
+    const std::vector<Attribute> & attributes() const;
+    //! Offset of the data that has not been parsed yet
+    size_t offset() const;
+
+private:
+    oc::result<Event> next_text();
+    oc::result<Event> next_binary();
+
+    oc::result<void> read_text_start_tag();
+
+    oc::result<std::string_view> read_binary_utf();
+    oc::result<std::string_view> read_binary_interned();
+    oc::result<void> read_binary_value(unsigned char type, std::string &out);
+
+    std::string_view m_data;
+    size_t m_pos;
+    bool m_binary;
+    //! Whether attribute values should be decoded
+    bool m_want_values;
+
+    size_t m_depth;
+    //! Whether an end tag should be reported for a self-closing tag
+    bool m_pending_end;
+
+    std::string_view m_name;
+    std::vector<Attribute> m_attrs;
+
+    //! Interned strings in ABX files
+    std::vector<std::string_view> m_interned;
+};
+
+}
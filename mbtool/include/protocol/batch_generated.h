@@ -0,0 +1,236 @@
+// Written to match flatc output for protocol/v3/batch.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+
+#ifndef FLATBUFFERS_GENERATED_BATCH_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_BATCH_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct BatchRequestItem;
+
+struct BatchRequest;
+
+struct BatchResponseItem;
+
+struct BatchResponse;
+
+struct BatchRequestItem FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_REQUEST = 4
+  };
+  const flatbuffers::Vector<uint8_t> *request() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_REQUEST);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_REQUEST) &&
+           verifier.Verify(request()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchRequestItemBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_request(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> request) {
+    fbb_.AddOffset(BatchRequestItem::VT_REQUEST, request);
+  }
+  explicit BatchRequestItemBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchRequestItemBuilder &operator=(const BatchRequestItemBuilder &);
+  flatbuffers::Offset<BatchRequestItem> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchRequestItem>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchRequestItem> CreateBatchRequestItem(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> request = 0) {
+  BatchRequestItemBuilder builder_(_fbb);
+  builder_.add_request(request);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchRequestItem> CreateBatchRequestItemDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<uint8_t> *request = nullptr) {
+  return mbtool::daemon::v3::CreateBatchRequestItem(
+      _fbb,
+      request ? _fbb.CreateVector<uint8_t>(*request) : 0);
+}
+
+struct BatchRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_REQUESTS = 4,
+    VT_STOP_ON_FAILURE = 6
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<BatchRequestItem>> *requests() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<BatchRequestItem>> *>(VT_REQUESTS);
+  }
+  bool stop_on_failure() const {
+    return GetField<uint8_t>(VT_STOP_ON_FAILURE, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_REQUESTS) &&
+           verifier.Verify(requests()) &&
+           verifier.VerifyVectorOfTables(requests()) &&
+           VerifyField<uint8_t>(verifier, VT_STOP_ON_FAILURE) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_requests(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchRequestItem>>> requests) {
+    fbb_.AddOffset(BatchRequest::VT_REQUESTS, requests);
+  }
+  void add_stop_on_failure(bool stop_on_failure) {
+    fbb_.AddElement<uint8_t>(BatchRequest::VT_STOP_ON_FAILURE, static_cast<uint8_t>(stop_on_failure), 0);
+  }
+  explicit BatchRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchRequestBuilder &operator=(const BatchRequestBuilder &);
+  flatbuffers::Offset<BatchRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchRequest> CreateBatchRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchRequestItem>>> requests = 0,
+    bool stop_on_failure = false) {
+  BatchRequestBuilder builder_(_fbb);
+  builder_.add_requests(requests);
+  builder_.add_stop_on_failure(stop_on_failure);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchRequest> CreateBatchRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<BatchRequestItem>> *requests = nullptr,
+    bool stop_on_failure = false) {
+  return mbtool::daemon::v3::CreateBatchRequest(
+      _fbb,
+      requests ? _fbb.CreateVector<flatbuffers::Offset<BatchRequestItem>>(*requests) : 0,
+      stop_on_failure);
+}
+
+struct BatchResponseItem FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_RESPONSE = 4
+  };
+  const flatbuffers::Vector<uint8_t> *response() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_RESPONSE);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_RESPONSE) &&
+           verifier.Verify(response()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchResponseItemBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_response(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> response) {
+    fbb_.AddOffset(BatchResponseItem::VT_RESPONSE, response);
+  }
+  explicit BatchResponseItemBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchResponseItemBuilder &operator=(const BatchResponseItemBuilder &);
+  flatbuffers::Offset<BatchResponseItem> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchResponseItem>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchResponseItem> CreateBatchResponseItem(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> response = 0) {
+  BatchResponseItemBuilder builder_(_fbb);
+  builder_.add_response(response);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchResponseItem> CreateBatchResponseItemDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<uint8_t> *response = nullptr) {
+  return mbtool::daemon::v3::CreateBatchResponseItem(
+      _fbb,
+      response ? _fbb.CreateVector<uint8_t>(*response) : 0);
+}
+
+struct BatchResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_RESPONSES = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<BatchResponseItem>> *responses() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<BatchResponseItem>> *>(VT_RESPONSES);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_RESPONSES) &&
+           verifier.Verify(responses()) &&
+           verifier.VerifyVectorOfTables(responses()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_responses(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchResponseItem>>> responses) {
+    fbb_.AddOffset(BatchResponse::VT_RESPONSES, responses);
+  }
+  explicit BatchResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchResponseBuilder &operator=(const BatchResponseBuilder &);
+  flatbuffers::Offset<BatchResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchResponse> CreateBatchResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchResponseItem>>> responses = 0) {
+  BatchResponseBuilder builder_(_fbb);
+  builder_.add_responses(responses);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchResponse> CreateBatchResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<BatchResponseItem>> *responses = nullptr) {
+  return mbtool::daemon::v3::CreateBatchResponse(
+      _fbb,
+      responses ? _fbb.CreateVector<flatbuffers::Offset<BatchResponseItem>>(*responses) : 0);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_BATCH_MBTOOL_DAEMON_V3_H_
@@ -0,0 +1,196 @@
+// Written to match flatc output for protocol/v3/file_read_stream.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+
+#ifndef FLATBUFFERS_GENERATED_FILEREADSTREAM_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_FILEREADSTREAM_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct FileReadStreamError;
+
+struct FileReadStreamRequest;
+
+struct FileReadStreamResponse;
+
+struct FileReadStreamError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERRNO_VALUE = 4,
+    VT_MSG = 6
+  };
+  int32_t errno_value() const {
+    return GetField<int32_t>(VT_ERRNO_VALUE, 0);
+  }
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ERRNO_VALUE) &&
+           VerifyOffset(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileReadStreamErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_errno_value(int32_t errno_value) {
+    fbb_.AddElement<int32_t>(FileReadStreamError::VT_ERRNO_VALUE, errno_value, 0);
+  }
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(FileReadStreamError::VT_MSG, msg);
+  }
+  explicit FileReadStreamErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileReadStreamErrorBuilder &operator=(const FileReadStreamErrorBuilder &);
+  flatbuffers::Offset<FileReadStreamError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<FileReadStreamError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileReadStreamError> CreateFileReadStreamError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  FileReadStreamErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  builder_.add_errno_value(errno_value);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<FileReadStreamError> CreateFileReadStreamErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreateFileReadStreamError(
+      _fbb,
+      errno_value,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct FileReadStreamRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ID = 4,
+    VT_COUNT = 6,
+    VT_CHUNK_SIZE = 8
+  };
+  int32_t id() const {
+    return GetField<int32_t>(VT_ID, 0);
+  }
+  uint64_t count() const {
+    return GetField<uint64_t>(VT_COUNT, 0);
+  }
+  uint32_t chunk_size() const {
+    return GetField<uint32_t>(VT_CHUNK_SIZE, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ID) &&
+           VerifyField<uint64_t>(verifier, VT_COUNT) &&
+           VerifyField<uint32_t>(verifier, VT_CHUNK_SIZE) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileReadStreamRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_id(int32_t id) {
+    fbb_.AddElement<int32_t>(FileReadStreamRequest::VT_ID, id, 0);
+  }
+  void add_count(uint64_t count) {
+    fbb_.AddElement<uint64_t>(FileReadStreamRequest::VT_COUNT, count, 0);
+  }
+  void add_chunk_size(uint32_t chunk_size) {
+    fbb_.AddElement<uint32_t>(FileReadStreamRequest::VT_CHUNK_SIZE, chunk_size, 0);
+  }
+  explicit FileReadStreamRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileReadStreamRequestBuilder &operator=(const FileReadStreamRequestBuilder &);
+  flatbuffers::Offset<FileReadStreamRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<FileReadStreamRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileReadStreamRequest> CreateFileReadStreamRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t id = 0,
+    uint64_t count = 0,
+    uint32_t chunk_size = 0) {
+  FileReadStreamRequestBuilder builder_(_fbb);
+  builder_.add_count(count);
+  builder_.add_chunk_size(chunk_size);
+  builder_.add_id(id);
+  return builder_.Finish();
+}
+
+struct FileReadStreamResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_BYTES_READ = 4,
+    VT_ERROR = 6
+  };
+  uint64_t bytes_read() const {
+    return GetField<uint64_t>(VT_BYTES_READ, 0);
+  }
+  const FileReadStreamError *error() const {
+    return GetPointer<const FileReadStreamError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_READ) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileReadStreamResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_bytes_read(uint64_t bytes_read) {
+    fbb_.AddElement<uint64_t>(FileReadStreamResponse::VT_BYTES_READ, bytes_read, 0);
+  }
+  void add_error(flatbuffers::Offset<FileReadStreamError> error) {
+    fbb_.AddOffset(FileReadStreamResponse::VT_ERROR, error);
+  }
+  explicit FileReadStreamResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileReadStreamResponseBuilder &operator=(const FileReadStreamResponseBuilder &);
+  flatbuffers::Offset<FileReadStreamResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<FileReadStreamResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileReadStreamResponse> CreateFileReadStreamResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t bytes_read = 0,
+    flatbuffers::Offset<FileReadStreamError> error = 0) {
+  FileReadStreamResponseBuilder builder_(_fbb);
+  builder_.add_bytes_read(bytes_read);
+  builder_.add_error(error);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_FILEREADSTREAM_MBTOOL_DAEMON_V3_H_
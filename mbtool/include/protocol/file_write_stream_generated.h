@@ -0,0 +1,176 @@
+// Written to match flatc output for protocol/v3/file_write_stream.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+
+#ifndef FLATBUFFERS_GENERATED_FILEWRITESTREAM_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_FILEWRITESTREAM_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct FileWriteStreamError;
+
+struct FileWriteStreamRequest;
+
+struct FileWriteStreamResponse;
+
+struct FileWriteStreamError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERRNO_VALUE = 4,
+    VT_MSG = 6
+  };
+  int32_t errno_value() const {
+    return GetField<int32_t>(VT_ERRNO_VALUE, 0);
+  }
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ERRNO_VALUE) &&
+           VerifyOffset(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileWriteStreamErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_errno_value(int32_t errno_value) {
+    fbb_.AddElement<int32_t>(FileWriteStreamError::VT_ERRNO_VALUE, errno_value, 0);
+  }
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(FileWriteStreamError::VT_MSG, msg);
+  }
+  explicit FileWriteStreamErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileWriteStreamErrorBuilder &operator=(const FileWriteStreamErrorBuilder &);
+  flatbuffers::Offset<FileWriteStreamError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<FileWriteStreamError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileWriteStreamError> CreateFileWriteStreamError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  FileWriteStreamErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  builder_.add_errno_value(errno_value);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<FileWriteStreamError> CreateFileWriteStreamErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreateFileWriteStreamError(
+      _fbb,
+      errno_value,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct FileWriteStreamRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ID = 4
+  };
+  int32_t id() const {
+    return GetField<int32_t>(VT_ID, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ID) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileWriteStreamRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_id(int32_t id) {
+    fbb_.AddElement<int32_t>(FileWriteStreamRequest::VT_ID, id, 0);
+  }
+  explicit FileWriteStreamRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileWriteStreamRequestBuilder &operator=(const FileWriteStreamRequestBuilder &);
+  flatbuffers::Offset<FileWriteStreamRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<FileWriteStreamRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileWriteStreamRequest> CreateFileWriteStreamRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t id = 0) {
+  FileWriteStreamRequestBuilder builder_(_fbb);
+  builder_.add_id(id);
+  return builder_.Finish();
+}
+
+struct FileWriteStreamResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_BYTES_WRITTEN = 4,
+    VT_ERROR = 6
+  };
+  uint64_t bytes_written() const {
+    return GetField<uint64_t>(VT_BYTES_WRITTEN, 0);
+  }
+  const FileWriteStreamError *error() const {
+    return GetPointer<const FileWriteStreamError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_WRITTEN) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileWriteStreamResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_bytes_written(uint64_t bytes_written) {
+    fbb_.AddElement<uint64_t>(FileWriteStreamResponse::VT_BYTES_WRITTEN, bytes_written, 0);
+  }
+  void add_error(flatbuffers::Offset<FileWriteStreamError> error) {
+    fbb_.AddOffset(FileWriteStreamResponse::VT_ERROR, error);
+  }
+  explicit FileWriteStreamResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileWriteStreamResponseBuilder &operator=(const FileWriteStreamResponseBuilder &);
+  flatbuffers::Offset<FileWriteStreamResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<FileWriteStreamResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileWriteStreamResponse> CreateFileWriteStreamResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t bytes_written = 0,
+    flatbuffers::Offset<FileWriteStreamError> error = 0) {
+  FileWriteStreamResponseBuilder builder_(_fbb);
+  builder_.add_bytes_written(bytes_written);
+  builder_.add_error(error);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_FILEWRITESTREAM_MBTOOL_DAEMON_V3_H_
@@ -0,0 +1,420 @@
+// Written to match flatc output for protocol/v3/job.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+
+#ifndef FLATBUFFERS_GENERATED_JOB_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_JOB_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct JobStartError;
+
+struct JobStartRequest;
+
+struct JobStartResponse;
+
+struct JobCancelError;
+
+struct JobCancelRequest;
+
+struct JobCancelResponse;
+
+struct JobEventResponse;
+
+struct JobStartError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_MSG = 4
+  };
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobStartErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(JobStartError::VT_MSG, msg);
+  }
+  explicit JobStartErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobStartErrorBuilder &operator=(const JobStartErrorBuilder &);
+  flatbuffers::Offset<JobStartError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobStartError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobStartError> CreateJobStartError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  JobStartErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<JobStartError> CreateJobStartErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreateJobStartError(
+      _fbb,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct JobStartRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_REQUEST = 4
+  };
+  const flatbuffers::Vector<uint8_t> *request() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_REQUEST);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_REQUEST) &&
+           verifier.Verify(request()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobStartRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_request(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> request) {
+    fbb_.AddOffset(JobStartRequest::VT_REQUEST, request);
+  }
+  explicit JobStartRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobStartRequestBuilder &operator=(const JobStartRequestBuilder &);
+  flatbuffers::Offset<JobStartRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobStartRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobStartRequest> CreateJobStartRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> request = 0) {
+  JobStartRequestBuilder builder_(_fbb);
+  builder_.add_request(request);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<JobStartRequest> CreateJobStartRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<uint8_t> *request = nullptr) {
+  return mbtool::daemon::v3::CreateJobStartRequest(
+      _fbb,
+      request ? _fbb.CreateVector<uint8_t>(*request) : 0);
+}
+
+struct JobStartResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4,
+    VT_ERROR = 6
+  };
+  uint32_t job_id() const {
+    return GetField<uint32_t>(VT_JOB_ID, 0);
+  }
+  const JobStartError *error() const {
+    return GetPointer<const JobStartError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_JOB_ID) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobStartResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint32_t job_id) {
+    fbb_.AddElement<uint32_t>(JobStartResponse::VT_JOB_ID, job_id, 0);
+  }
+  void add_error(flatbuffers::Offset<JobStartError> error) {
+    fbb_.AddOffset(JobStartResponse::VT_ERROR, error);
+  }
+  explicit JobStartResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobStartResponseBuilder &operator=(const JobStartResponseBuilder &);
+  flatbuffers::Offset<JobStartResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobStartResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobStartResponse> CreateJobStartResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0,
+    flatbuffers::Offset<JobStartError> error = 0) {
+  JobStartResponseBuilder builder_(_fbb);
+  builder_.add_error(error);
+  builder_.add_job_id(job_id);
+  return builder_.Finish();
+}
+
+struct JobCancelError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_MSG = 4
+  };
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobCancelErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(JobCancelError::VT_MSG, msg);
+  }
+  explicit JobCancelErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobCancelErrorBuilder &operator=(const JobCancelErrorBuilder &);
+  flatbuffers::Offset<JobCancelError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobCancelError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobCancelError> CreateJobCancelError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  JobCancelErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<JobCancelError> CreateJobCancelErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreateJobCancelError(
+      _fbb,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct JobCancelRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4
+  };
+  uint32_t job_id() const {
+    return GetField<uint32_t>(VT_JOB_ID, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_JOB_ID) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobCancelRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint32_t job_id) {
+    fbb_.AddElement<uint32_t>(JobCancelRequest::VT_JOB_ID, job_id, 0);
+  }
+  explicit JobCancelRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobCancelRequestBuilder &operator=(const JobCancelRequestBuilder &);
+  flatbuffers::Offset<JobCancelRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobCancelRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobCancelRequest> CreateJobCancelRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0) {
+  JobCancelRequestBuilder builder_(_fbb);
+  builder_.add_job_id(job_id);
+  return builder_.Finish();
+}
+
+struct JobCancelResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERROR = 4
+  };
+  const JobCancelError *error() const {
+    return GetPointer<const JobCancelError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobCancelResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_error(flatbuffers::Offset<JobCancelError> error) {
+    fbb_.AddOffset(JobCancelResponse::VT_ERROR, error);
+  }
+  explicit JobCancelResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobCancelResponseBuilder &operator=(const JobCancelResponseBuilder &);
+  flatbuffers::Offset<JobCancelResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobCancelResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobCancelResponse> CreateJobCancelResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<JobCancelError> error = 0) {
+  JobCancelResponseBuilder builder_(_fbb);
+  builder_.add_error(error);
+  return builder_.Finish();
+}
+
+struct JobEventResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4,
+    VT_BYTES_DONE = 6,
+    VT_FILES_DONE = 8,
+    VT_FINISHED = 10,
+    VT_CANCELLED = 12,
+    VT_RESPONSE = 14
+  };
+  uint32_t job_id() const {
+    return GetField<uint32_t>(VT_JOB_ID, 0);
+  }
+  uint64_t bytes_done() const {
+    return GetField<uint64_t>(VT_BYTES_DONE, 0);
+  }
+  uint64_t files_done() const {
+    return GetField<uint64_t>(VT_FILES_DONE, 0);
+  }
+  bool finished() const {
+    return GetField<uint8_t>(VT_FINISHED, 0) != 0;
+  }
+  bool cancelled() const {
+    return GetField<uint8_t>(VT_CANCELLED, 0) != 0;
+  }
+  const flatbuffers::Vector<uint8_t> *response() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_RESPONSE);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_JOB_ID) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_DONE) &&
+           VerifyField<uint64_t>(verifier, VT_FILES_DONE) &&
+           VerifyField<uint8_t>(verifier, VT_FINISHED) &&
+           VerifyField<uint8_t>(verifier, VT_CANCELLED) &&
+           VerifyOffset(verifier, VT_RESPONSE) &&
+           verifier.Verify(response()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobEventResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint32_t job_id) {
+    fbb_.AddElement<uint32_t>(JobEventResponse::VT_JOB_ID, job_id, 0);
+  }
+  void add_bytes_done(uint64_t bytes_done) {
+    fbb_.AddElement<uint64_t>(JobEventResponse::VT_BYTES_DONE, bytes_done, 0);
+  }
+  void add_files_done(uint64_t files_done) {
+    fbb_.AddElement<uint64_t>(JobEventResponse::VT_FILES_DONE, files_done, 0);
+  }
+  void add_finished(bool finished) {
+    fbb_.AddElement<uint8_t>(JobEventResponse::VT_FINISHED, static_cast<uint8_t>(finished), 0);
+  }
+  void add_cancelled(bool cancelled) {
+    fbb_.AddElement<uint8_t>(JobEventResponse::VT_CANCELLED, static_cast<uint8_t>(cancelled), 0);
+  }
+  void add_response(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> response) {
+    fbb_.AddOffset(JobEventResponse::VT_RESPONSE, response);
+  }
+  explicit JobEventResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobEventResponseBuilder &operator=(const JobEventResponseBuilder &);
+  flatbuffers::Offset<JobEventResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobEventResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobEventResponse> CreateJobEventResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0,
+    uint64_t bytes_done = 0,
+    uint64_t files_done = 0,
+    bool finished = false,
+    bool cancelled = false,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> response = 0) {
+  JobEventResponseBuilder builder_(_fbb);
+  builder_.add_files_done(files_done);
+  builder_.add_bytes_done(bytes_done);
+  builder_.add_response(response);
+  builder_.add_job_id(job_id);
+  builder_.add_cancelled(cancelled);
+  builder_.add_finished(finished);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<JobEventResponse> CreateJobEventResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0,
+    uint64_t bytes_done = 0,
+    uint64_t files_done = 0,
+    bool finished = false,
+    bool cancelled = false,
+    const std::vector<uint8_t> *response = nullptr) {
+  return mbtool::daemon::v3::CreateJobEventResponse(
+      _fbb,
+      job_id,
+      bytes_done,
+      files_done,
+      finished,
+      cancelled,
+      response ? _fbb.CreateVector<uint8_t>(*response) : 0);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_JOB_MBTOOL_DAEMON_V3_H_
@@ -0,0 +1,155 @@
+// Written to match flatc output for protocol/v3/mb_clone_rom.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+
+#ifndef FLATBUFFERS_GENERATED_MBCLONEROM_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_MBCLONEROM_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct MbCloneRomError;
+
+struct MbCloneRomRequest;
+
+struct MbCloneRomResponse;
+
+struct MbCloneRomError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbCloneRomErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  explicit MbCloneRomErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbCloneRomErrorBuilder &operator=(const MbCloneRomErrorBuilder &);
+  flatbuffers::Offset<MbCloneRomError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbCloneRomError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbCloneRomError> CreateMbCloneRomError(
+    flatbuffers::FlatBufferBuilder &_fbb) {
+  MbCloneRomErrorBuilder builder_(_fbb);
+  return builder_.Finish();
+}
+
+struct MbCloneRomRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_SOURCE_ROM_ID = 4,
+    VT_TARGET_ROM_ID = 6
+  };
+  const flatbuffers::String *source_rom_id() const {
+    return GetPointer<const flatbuffers::String *>(VT_SOURCE_ROM_ID);
+  }
+  const flatbuffers::String *target_rom_id() const {
+    return GetPointer<const flatbuffers::String *>(VT_TARGET_ROM_ID);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_SOURCE_ROM_ID) &&
+           verifier.Verify(source_rom_id()) &&
+           VerifyOffset(verifier, VT_TARGET_ROM_ID) &&
+           verifier.Verify(target_rom_id()) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbCloneRomRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_source_rom_id(flatbuffers::Offset<flatbuffers::String> source_rom_id) {
+    fbb_.AddOffset(MbCloneRomRequest::VT_SOURCE_ROM_ID, source_rom_id);
+  }
+  void add_target_rom_id(flatbuffers::Offset<flatbuffers::String> target_rom_id) {
+    fbb_.AddOffset(MbCloneRomRequest::VT_TARGET_ROM_ID, target_rom_id);
+  }
+  explicit MbCloneRomRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbCloneRomRequestBuilder &operator=(const MbCloneRomRequestBuilder &);
+  flatbuffers::Offset<MbCloneRomRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbCloneRomRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbCloneRomRequest> CreateMbCloneRomRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> source_rom_id = 0,
+    flatbuffers::Offset<flatbuffers::String> target_rom_id = 0) {
+  MbCloneRomRequestBuilder builder_(_fbb);
+  builder_.add_target_rom_id(target_rom_id);
+  builder_.add_source_rom_id(source_rom_id);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<MbCloneRomRequest> CreateMbCloneRomRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *source_rom_id = nullptr,
+    const char *target_rom_id = nullptr) {
+  return mbtool::daemon::v3::CreateMbCloneRomRequest(
+      _fbb,
+      source_rom_id ? _fbb.CreateString(source_rom_id) : 0,
+      target_rom_id ? _fbb.CreateString(target_rom_id) : 0);
+}
+
+struct MbCloneRomResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERROR = 4
+  };
+  const MbCloneRomError *error() const {
+    return GetPointer<const MbCloneRomError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbCloneRomResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_error(flatbuffers::Offset<MbCloneRomError> error) {
+    fbb_.AddOffset(MbCloneRomResponse::VT_ERROR, error);
+  }
+  explicit MbCloneRomResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbCloneRomResponseBuilder &operator=(const MbCloneRomResponseBuilder &);
+  flatbuffers::Offset<MbCloneRomResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbCloneRomResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbCloneRomResponse> CreateMbCloneRomResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<MbCloneRomError> error = 0) {
+  MbCloneRomResponseBuilder builder_(_fbb);
+  builder_.add_error(error);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_MBCLONEROM_MBTOOL_DAEMON_V3_H_
@@ -0,0 +1,234 @@
+// Written to match flatc output for protocol/v3/mb_get_stats.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+
+#ifndef FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct MbRequestStats;
+
+struct MbGetStatsRequest;
+
+struct MbGetStatsResponse;
+
+struct MbRequestStats FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_TYPE = 4,
+    VT_COUNT = 6,
+    VT_BYTES_IN = 8,
+    VT_BYTES_OUT = 10,
+    VT_TOTAL_US = 12,
+    VT_MAX_US = 14,
+    VT_P50_US = 16,
+    VT_P90_US = 18,
+    VT_P99_US = 20
+  };
+  uint8_t type() const {
+    return GetField<uint8_t>(VT_TYPE, 0);
+  }
+  uint64_t count() const {
+    return GetField<uint64_t>(VT_COUNT, 0);
+  }
+  uint64_t bytes_in() const {
+    return GetField<uint64_t>(VT_BYTES_IN, 0);
+  }
+  uint64_t bytes_out() const {
+    return GetField<uint64_t>(VT_BYTES_OUT, 0);
+  }
+  uint64_t total_us() const {
+    return GetField<uint64_t>(VT_TOTAL_US, 0);
+  }
+  uint64_t max_us() const {
+    return GetField<uint64_t>(VT_MAX_US, 0);
+  }
+  uint64_t p50_us() const {
+    return GetField<uint64_t>(VT_P50_US, 0);
+  }
+  uint64_t p90_us() const {
+    return GetField<uint64_t>(VT_P90_US, 0);
+  }
+  uint64_t p99_us() const {
+    return GetField<uint64_t>(VT_P99_US, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_TYPE) &&
+           VerifyField<uint64_t>(verifier, VT_COUNT) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_IN) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_OUT) &&
+           VerifyField<uint64_t>(verifier, VT_TOTAL_US) &&
+           VerifyField<uint64_t>(verifier, VT_MAX_US) &&
+           VerifyField<uint64_t>(verifier, VT_P50_US) &&
+           VerifyField<uint64_t>(verifier, VT_P90_US) &&
+           VerifyField<uint64_t>(verifier, VT_P99_US) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbRequestStatsBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_type(uint8_t type) {
+    fbb_.AddElement<uint8_t>(MbRequestStats::VT_TYPE, type, 0);
+  }
+  void add_count(uint64_t count) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_COUNT, count, 0);
+  }
+  void add_bytes_in(uint64_t bytes_in) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_BYTES_IN, bytes_in, 0);
+  }
+  void add_bytes_out(uint64_t bytes_out) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_BYTES_OUT, bytes_out, 0);
+  }
+  void add_total_us(uint64_t total_us) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_TOTAL_US, total_us, 0);
+  }
+  void add_max_us(uint64_t max_us) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_MAX_US, max_us, 0);
+  }
+  void add_p50_us(uint64_t p50_us) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_P50_US, p50_us, 0);
+  }
+  void add_p90_us(uint64_t p90_us) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_P90_US, p90_us, 0);
+  }
+  void add_p99_us(uint64_t p99_us) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_P99_US, p99_us, 0);
+  }
+  explicit MbRequestStatsBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbRequestStatsBuilder &operator=(const MbRequestStatsBuilder &);
+  flatbuffers::Offset<MbRequestStats> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbRequestStats>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbRequestStats> CreateMbRequestStats(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint8_t type = 0,
+    uint64_t count = 0,
+    uint64_t bytes_in = 0,
+    uint64_t bytes_out = 0,
+    uint64_t total_us = 0,
+    uint64_t max_us = 0,
+    uint64_t p50_us = 0,
+    uint64_t p90_us = 0,
+    uint64_t p99_us = 0) {
+  MbRequestStatsBuilder builder_(_fbb);
+  builder_.add_p99_us(p99_us);
+  builder_.add_p90_us(p90_us);
+  builder_.add_p50_us(p50_us);
+  builder_.add_max_us(max_us);
+  builder_.add_total_us(total_us);
+  builder_.add_bytes_out(bytes_out);
+  builder_.add_bytes_in(bytes_in);
+  builder_.add_count(count);
+  builder_.add_type(type);
+  return builder_.Finish();
+}
+
+struct MbGetStatsRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_RESET = 4
+  };
+  bool reset() const {
+    return GetField<uint8_t>(VT_RESET, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_RESET) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbGetStatsRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_reset(bool reset) {
+    fbb_.AddElement<uint8_t>(MbGetStatsRequest::VT_RESET, static_cast<uint8_t>(reset), 0);
+  }
+  explicit MbGetStatsRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbGetStatsRequestBuilder &operator=(const MbGetStatsRequestBuilder &);
+  flatbuffers::Offset<MbGetStatsRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbGetStatsRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbGetStatsRequest> CreateMbGetStatsRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    bool reset = false) {
+  MbGetStatsRequestBuilder builder_(_fbb);
+  builder_.add_reset(reset);
+  return builder_.Finish();
+}
+
+struct MbGetStatsResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_STATS = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>> *stats() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>> *>(VT_STATS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_STATS) &&
+           verifier.Verify(stats()) &&
+           verifier.VerifyVectorOfTables(stats()) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbGetStatsResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_stats(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>>> stats) {
+    fbb_.AddOffset(MbGetStatsResponse::VT_STATS, stats);
+  }
+  explicit MbGetStatsResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbGetStatsResponseBuilder &operator=(const MbGetStatsResponseBuilder &);
+  flatbuffers::Offset<MbGetStatsResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbGetStatsResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbGetStatsResponse> CreateMbGetStatsResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>>> stats = 0) {
+  MbGetStatsResponseBuilder builder_(_fbb);
+  builder_.add_stats(stats);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<MbGetStatsResponse> CreateMbGetStatsResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<MbRequestStats>> *stats = nullptr) {
+  return mbtool::daemon::v3::CreateMbGetStatsResponse(
+      _fbb,
+      stats ? _fbb.CreateVector<flatbuffers::Offset<MbRequestStats>>(*stats) : 0);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
@@ -1,4 +1,5 @@
-// automatically generated by the FlatBuffers compiler, do not modify
+// Written to match flatc output for protocol/request.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
 
 
 #ifndef FLATBUFFERS_GENERATED_REQUEST_MBTOOL_DAEMON_V3_H_
@@ -6,20 +7,26 @@
 
 #include "flatbuffers/flatbuffers.h"
 
+#include "batch_generated.h"
 #include "crypto_decrypt_generated.h"
 #include "crypto_get_pw_type_generated.h"
 #include "file_chmod_generated.h"
 #include "file_close_generated.h"
 #include "file_open_generated.h"
 #include "file_read_generated.h"
+#include "file_read_stream_generated.h"
 #include "file_seek_generated.h"
 #include "file_selinux_get_label_generated.h"
 #include "file_selinux_set_label_generated.h"
 #include "file_stat_generated.h"
 #include "file_write_generated.h"
+#include "file_write_stream_generated.h"
+#include "job_generated.h"
+#include "mb_clone_rom_generated.h"
 #include "mb_get_booted_rom_id_generated.h"
 #include "mb_get_installed_roms_generated.h"
 #include "mb_get_packages_count_generated.h"
+#include "mb_get_stats_generated.h"
 #include "mb_get_version_generated.h"
 #include "mb_set_kernel_generated.h"
 #include "mb_switch_rom_generated.h"
@@ -33,6 +40,7 @@
 #include "path_selinux_get_label_generated.h"
 #include "path_selinux_set_label_generated.h"
 #include "reboot_generated.h"
+#include "shared_buffer_generated.h"
 #include "shutdown_generated.h"
 #include "signed_exec_generated.h"
 
@@ -73,11 +81,20 @@ enum RequestType {
   RequestType_CryptoDecryptRequest = 27,
   RequestType_CryptoGetPwTypeRequest = 28,
   RequestType_PathReadlinkRequest = 29,
+  RequestType_FileReadStreamRequest = 30,
+  RequestType_FileWriteStreamRequest = 31,
+  RequestType_BatchRequest = 32,
+  RequestType_MbGetStatsRequest = 33,
+  RequestType_SharedBufferSetupRequest = 34,
+  RequestType_FileReadSharedRequest = 35,
+  RequestType_MbCloneRomRequest = 36,
+  RequestType_JobStartRequest = 37,
+  RequestType_JobCancelRequest = 38,
   RequestType_MIN = RequestType_NONE,
-  RequestType_MAX = RequestType_PathReadlinkRequest
+  RequestType_MAX = RequestType_JobCancelRequest
 };
 
-inline const RequestType (&EnumValuesRequestType())[30] {
+inline const RequestType (&EnumValuesRequestType())[39] {
   static const RequestType values[] = {
     RequestType_NONE,
     RequestType_FileChmodRequest,
@@ -108,7 +125,16 @@ inline const RequestType (&EnumValuesRequestType())[30] {
     RequestType_PathMkdirRequest,
     RequestType_CryptoDecryptRequest,
     RequestType_CryptoGetPwTypeRequest,
-    RequestType_PathReadlinkRequest
+    RequestType_PathReadlinkRequest,
+    RequestType_FileReadStreamRequest,
+    RequestType_FileWriteStreamRequest,
+    RequestType_BatchRequest,
+    RequestType_MbGetStatsRequest,
+    RequestType_SharedBufferSetupRequest,
+    RequestType_FileReadSharedRequest,
+    RequestType_MbCloneRomRequest,
+    RequestType_JobStartRequest,
+    RequestType_JobCancelRequest
   };
   return values;
 }
@@ -145,6 +171,15 @@ inline const char * const *EnumNamesRequestType() {
     "CryptoDecryptRequest",
     "CryptoGetPwTypeRequest",
     "PathReadlinkRequest",
+    "FileReadStreamRequest",
+    "FileWriteStreamRequest",
+    "BatchRequest",
+    "MbGetStatsRequest",
+    "SharedBufferSetupRequest",
+    "FileReadSharedRequest",
+    "MbCloneRomRequest",
+    "JobStartRequest",
+    "JobCancelRequest",
     nullptr
   };
   return names;
@@ -275,6 +310,42 @@ template<> struct RequestTypeTraits<PathReadlinkRequest> {
   static const RequestType enum_value = RequestType_PathReadlinkRequest;
 };
 
+template<> struct RequestTypeTraits<FileReadStreamRequest> {
+  static const RequestType enum_value = RequestType_FileReadStreamRequest;
+};
+
+template<> struct RequestTypeTraits<FileWriteStreamRequest> {
+  static const RequestType enum_value = RequestType_FileWriteStreamRequest;
+};
+
+template<> struct RequestTypeTraits<BatchRequest> {
+  static const RequestType enum_value = RequestType_BatchRequest;
+};
+
+template<> struct RequestTypeTraits<MbGetStatsRequest> {
+  static const RequestType enum_value = RequestType_MbGetStatsRequest;
+};
+
+template<> struct RequestTypeTraits<SharedBufferSetupRequest> {
+  static const RequestType enum_value = RequestType_SharedBufferSetupRequest;
+};
+
+template<> struct RequestTypeTraits<FileReadSharedRequest> {
+  static const RequestType enum_value = RequestType_FileReadSharedRequest;
+};
+
+template<> struct RequestTypeTraits<MbCloneRomRequest> {
+  static const RequestType enum_value = RequestType_MbCloneRomRequest;
+};
+
+template<> struct RequestTypeTraits<JobStartRequest> {
+  static const RequestType enum_value = RequestType_JobStartRequest;
+};
+
+template<> struct RequestTypeTraits<JobCancelRequest> {
+  static const RequestType enum_value = RequestType_JobCancelRequest;
+};
+
 bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj, RequestType type);
 bool VerifyRequestTypeVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
@@ -377,6 +448,33 @@ struct Request FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const PathReadlinkRequest *request_as_PathReadlinkRequest() const {
     return request_type() == RequestType_PathReadlinkRequest ? static_cast<const PathReadlinkRequest *>(request()) : nullptr;
   }
+  const FileReadStreamRequest *request_as_FileReadStreamRequest() const {
+    return request_type() == RequestType_FileReadStreamRequest ? static_cast<const FileReadStreamRequest *>(request()) : nullptr;
+  }
+  const FileWriteStreamRequest *request_as_FileWriteStreamRequest() const {
+    return request_type() == RequestType_FileWriteStreamRequest ? static_cast<const FileWriteStreamRequest *>(request()) : nullptr;
+  }
+  const BatchRequest *request_as_BatchRequest() const {
+    return request_type() == RequestType_BatchRequest ? static_cast<const BatchRequest *>(request()) : nullptr;
+  }
+  const MbGetStatsRequest *request_as_MbGetStatsRequest() const {
+    return request_type() == RequestType_MbGetStatsRequest ? static_cast<const MbGetStatsRequest *>(request()) : nullptr;
+  }
+  const SharedBufferSetupRequest *request_as_SharedBufferSetupRequest() const {
+    return request_type() == RequestType_SharedBufferSetupRequest ? static_cast<const SharedBufferSetupRequest *>(request()) : nullptr;
+  }
+  const FileReadSharedRequest *request_as_FileReadSharedRequest() const {
+    return request_type() == RequestType_FileReadSharedRequest ? static_cast<const FileReadSharedRequest *>(request()) : nullptr;
+  }
+  const MbCloneRomRequest *request_as_MbCloneRomRequest() const {
+    return request_type() == RequestType_MbCloneRomRequest ? static_cast<const MbCloneRomRequest *>(request()) : nullptr;
+  }
+  const JobStartRequest *request_as_JobStartRequest() const {
+    return request_type() == RequestType_JobStartRequest ? static_cast<const JobStartRequest *>(request()) : nullptr;
+  }
+  const JobCancelRequest *request_as_JobCancelRequest() const {
+    return request_type() == RequestType_JobCancelRequest ? static_cast<const JobCancelRequest *>(request()) : nullptr;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_REQUEST_TYPE) &&
@@ -502,6 +600,42 @@ template<> inline const PathReadlinkRequest *Request::request_as<PathReadlinkReq
   return request_as_PathReadlinkRequest();
 }
 
+template<> inline const FileReadStreamRequest *Request::request_as<FileReadStreamRequest>() const {
+  return request_as_FileReadStreamRequest();
+}
+
+template<> inline const FileWriteStreamRequest *Request::request_as<FileWriteStreamRequest>() const {
+  return request_as_FileWriteStreamRequest();
+}
+
+template<> inline const BatchRequest *Request::request_as<BatchRequest>() const {
+  return request_as_BatchRequest();
+}
+
+template<> inline const MbGetStatsRequest *Request::request_as<MbGetStatsRequest>() const {
+  return request_as_MbGetStatsRequest();
+}
+
+template<> inline const SharedBufferSetupRequest *Request::request_as<SharedBufferSetupRequest>() const {
+  return request_as_SharedBufferSetupRequest();
+}
+
+template<> inline const FileReadSharedRequest *Request::request_as<FileReadSharedRequest>() const {
+  return request_as_FileReadSharedRequest();
+}
+
+template<> inline const MbCloneRomRequest *Request::request_as<MbCloneRomRequest>() const {
+  return request_as_MbCloneRomRequest();
+}
+
+template<> inline const JobStartRequest *Request::request_as<JobStartRequest>() const {
+  return request_as_JobStartRequest();
+}
+
+template<> inline const JobCancelRequest *Request::request_as<JobCancelRequest>() const {
+  return request_as_JobCancelRequest();
+}
+
 struct RequestBuilder {
   flatbuffers::FlatBufferBuilder &fbb_;
   flatbuffers::uoffset_t start_;
@@ -654,6 +788,42 @@ inline bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj,
       auto ptr = reinterpret_cast<const PathReadlinkRequest *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case RequestType_FileReadStreamRequest: {
+      auto ptr = reinterpret_cast<const FileReadStreamRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_FileWriteStreamRequest: {
+      auto ptr = reinterpret_cast<const FileWriteStreamRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_BatchRequest: {
+      auto ptr = reinterpret_cast<const BatchRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_MbGetStatsRequest: {
+      auto ptr = reinterpret_cast<const MbGetStatsRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_SharedBufferSetupRequest: {
+      auto ptr = reinterpret_cast<const SharedBufferSetupRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_FileReadSharedRequest: {
+      auto ptr = reinterpret_cast<const FileReadSharedRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_MbCloneRomRequest: {
+      auto ptr = reinterpret_cast<const MbCloneRomRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_JobStartRequest: {
+      auto ptr = reinterpret_cast<const JobStartRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_JobCancelRequest: {
+      auto ptr = reinterpret_cast<const JobCancelRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
@@ -1,4 +1,5 @@
-// automatically generated by the FlatBuffers compiler, do not modify
+// Written to match flatc output for protocol/response.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
 
 
 #ifndef FLATBUFFERS_GENERATED_RESPONSE_MBTOOL_DAEMON_V3_H_
@@ -6,20 +7,26 @@
 
 #include "flatbuffers/flatbuffers.h"
 
+#include "batch_generated.h"
 #include "crypto_decrypt_generated.h"
 #include "crypto_get_pw_type_generated.h"
 #include "file_chmod_generated.h"
 #include "file_close_generated.h"
 #include "file_open_generated.h"
 #include "file_read_generated.h"
+#include "file_read_stream_generated.h"
 #include "file_seek_generated.h"
 #include "file_selinux_get_label_generated.h"
 #include "file_selinux_set_label_generated.h"
 #include "file_stat_generated.h"
 #include "file_write_generated.h"
+#include "file_write_stream_generated.h"
+#include "job_generated.h"
+#include "mb_clone_rom_generated.h"
 #include "mb_get_booted_rom_id_generated.h"
 #include "mb_get_installed_roms_generated.h"
 #include "mb_get_packages_count_generated.h"
+#include "mb_get_stats_generated.h"
 #include "mb_get_version_generated.h"
 #include "mb_set_kernel_generated.h"
 #include "mb_switch_rom_generated.h"
@@ -33,6 +40,7 @@
 #include "path_selinux_get_label_generated.h"
 #include "path_selinux_set_label_generated.h"
 #include "reboot_generated.h"
+#include "shared_buffer_generated.h"
 #include "shutdown_generated.h"
 #include "signed_exec_generated.h"
 
@@ -80,11 +88,21 @@ enum ResponseType {
   ResponseType_CryptoDecryptResponse = 30,
   ResponseType_CryptoGetPwTypeResponse = 31,
   ResponseType_PathReadlinkResponse = 32,
+  ResponseType_FileReadStreamResponse = 33,
+  ResponseType_FileWriteStreamResponse = 34,
+  ResponseType_BatchResponse = 35,
+  ResponseType_MbGetStatsResponse = 36,
+  ResponseType_SharedBufferSetupResponse = 37,
+  ResponseType_FileReadSharedResponse = 38,
+  ResponseType_MbCloneRomResponse = 39,
+  ResponseType_JobStartResponse = 40,
+  ResponseType_JobCancelResponse = 41,
+  ResponseType_JobEventResponse = 42,
   ResponseType_MIN = ResponseType_NONE,
-  ResponseType_MAX = ResponseType_PathReadlinkResponse
+  ResponseType_MAX = ResponseType_JobEventResponse
 };
 
-inline const ResponseType (&EnumValuesResponseType())[33] {
+inline const ResponseType (&EnumValuesResponseType())[43] {
   static const ResponseType values[] = {
     ResponseType_NONE,
     ResponseType_Invalid,
@@ -118,7 +136,17 @@ inline const ResponseType (&EnumValuesResponseType())[33] {
     ResponseType_PathMkdirResponse,
     ResponseType_CryptoDecryptResponse,
     ResponseType_CryptoGetPwTypeResponse,
-    ResponseType_PathReadlinkResponse
+    ResponseType_PathReadlinkResponse,
+    ResponseType_FileReadStreamResponse,
+    ResponseType_FileWriteStreamResponse,
+    ResponseType_BatchResponse,
+    ResponseType_MbGetStatsResponse,
+    ResponseType_SharedBufferSetupResponse,
+    ResponseType_FileReadSharedResponse,
+    ResponseType_MbCloneRomResponse,
+    ResponseType_JobStartResponse,
+    ResponseType_JobCancelResponse,
+    ResponseType_JobEventResponse
   };
   return values;
 }
@@ -158,6 +186,16 @@ inline const char * const *EnumNamesResponseType() {
     "CryptoDecryptResponse",
     "CryptoGetPwTypeResponse",
     "PathReadlinkResponse",
+    "FileReadStreamResponse",
+    "FileWriteStreamResponse",
+    "BatchResponse",
+    "MbGetStatsResponse",
+    "SharedBufferSetupResponse",
+    "FileReadSharedResponse",
+    "MbCloneRomResponse",
+    "JobStartResponse",
+    "JobCancelResponse",
+    "JobEventResponse",
     nullptr
   };
   return names;
@@ -300,6 +338,46 @@ template<> struct ResponseTypeTraits<PathReadlinkResponse> {
   static const ResponseType enum_value = ResponseType_PathReadlinkResponse;
 };
 
+template<> struct ResponseTypeTraits<FileReadStreamResponse> {
+  static const ResponseType enum_value = ResponseType_FileReadStreamResponse;
+};
+
+template<> struct ResponseTypeTraits<FileWriteStreamResponse> {
+  static const ResponseType enum_value = ResponseType_FileWriteStreamResponse;
+};
+
+template<> struct ResponseTypeTraits<BatchResponse> {
+  static const ResponseType enum_value = ResponseType_BatchResponse;
+};
+
+template<> struct ResponseTypeTraits<MbGetStatsResponse> {
+  static const ResponseType enum_value = ResponseType_MbGetStatsResponse;
+};
+
+template<> struct ResponseTypeTraits<SharedBufferSetupResponse> {
+  static const ResponseType enum_value = ResponseType_SharedBufferSetupResponse;
+};
+
+template<> struct ResponseTypeTraits<FileReadSharedResponse> {
+  static const ResponseType enum_value = ResponseType_FileReadSharedResponse;
+};
+
+template<> struct ResponseTypeTraits<MbCloneRomResponse> {
+  static const ResponseType enum_value = ResponseType_MbCloneRomResponse;
+};
+
+template<> struct ResponseTypeTraits<JobStartResponse> {
+  static const ResponseType enum_value = ResponseType_JobStartResponse;
+};
+
+template<> struct ResponseTypeTraits<JobCancelResponse> {
+  static const ResponseType enum_value = ResponseType_JobCancelResponse;
+};
+
+template<> struct ResponseTypeTraits<JobEventResponse> {
+  static const ResponseType enum_value = ResponseType_JobEventResponse;
+};
+
 bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj, ResponseType type);
 bool VerifyResponseTypeVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
@@ -467,6 +545,36 @@ struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const PathReadlinkResponse *response_as_PathReadlinkResponse() const {
     return response_type() == ResponseType_PathReadlinkResponse ? static_cast<const PathReadlinkResponse *>(response()) : nullptr;
   }
+  const FileReadStreamResponse *response_as_FileReadStreamResponse() const {
+    return response_type() == ResponseType_FileReadStreamResponse ? static_cast<const FileReadStreamResponse *>(response()) : nullptr;
+  }
+  const FileWriteStreamResponse *response_as_FileWriteStreamResponse() const {
+    return response_type() == ResponseType_FileWriteStreamResponse ? static_cast<const FileWriteStreamResponse *>(response()) : nullptr;
+  }
+  const BatchResponse *response_as_BatchResponse() const {
+    return response_type() == ResponseType_BatchResponse ? static_cast<const BatchResponse *>(response()) : nullptr;
+  }
+  const MbGetStatsResponse *response_as_MbGetStatsResponse() const {
+    return response_type() == ResponseType_MbGetStatsResponse ? static_cast<const MbGetStatsResponse *>(response()) : nullptr;
+  }
+  const SharedBufferSetupResponse *response_as_SharedBufferSetupResponse() const {
+    return response_type() == ResponseType_SharedBufferSetupResponse ? static_cast<const SharedBufferSetupResponse *>(response()) : nullptr;
+  }
+  const FileReadSharedResponse *response_as_FileReadSharedResponse() const {
+    return response_type() == ResponseType_FileReadSharedResponse ? static_cast<const FileReadSharedResponse *>(response()) : nullptr;
+  }
+  const MbCloneRomResponse *response_as_MbCloneRomResponse() const {
+    return response_type() == ResponseType_MbCloneRomResponse ? static_cast<const MbCloneRomResponse *>(response()) : nullptr;
+  }
+  const JobStartResponse *response_as_JobStartResponse() const {
+    return response_type() == ResponseType_JobStartResponse ? static_cast<const JobStartResponse *>(response()) : nullptr;
+  }
+  const JobCancelResponse *response_as_JobCancelResponse() const {
+    return response_type() == ResponseType_JobCancelResponse ? static_cast<const JobCancelResponse *>(response()) : nullptr;
+  }
+  const JobEventResponse *response_as_JobEventResponse() const {
+    return response_type() == ResponseType_JobEventResponse ? static_cast<const JobEventResponse *>(response()) : nullptr;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_RESPONSE_TYPE) &&
@@ -604,6 +712,46 @@ template<> inline const PathReadlinkResponse *Response::response_as<PathReadlink
   return response_as_PathReadlinkResponse();
 }
 
+template<> inline const FileReadStreamResponse *Response::response_as<FileReadStreamResponse>() const {
+  return response_as_FileReadStreamResponse();
+}
+
+template<> inline const FileWriteStreamResponse *Response::response_as<FileWriteStreamResponse>() const {
+  return response_as_FileWriteStreamResponse();
+}
+
+template<> inline const BatchResponse *Response::response_as<BatchResponse>() const {
+  return response_as_BatchResponse();
+}
+
+template<> inline const MbGetStatsResponse *Response::response_as<MbGetStatsResponse>() const {
+  return response_as_MbGetStatsResponse();
+}
+
+template<> inline const SharedBufferSetupResponse *Response::response_as<SharedBufferSetupResponse>() const {
+  return response_as_SharedBufferSetupResponse();
+}
+
+template<> inline const FileReadSharedResponse *Response::response_as<FileReadSharedResponse>() const {
+  return response_as_FileReadSharedResponse();
+}
+
+template<> inline const MbCloneRomResponse *Response::response_as<MbCloneRomResponse>() const {
+  return response_as_MbCloneRomResponse();
+}
+
+template<> inline const JobStartResponse *Response::response_as<JobStartResponse>() const {
+  return response_as_JobStartResponse();
+}
+
+template<> inline const JobCancelResponse *Response::response_as<JobCancelResponse>() const {
+  return response_as_JobCancelResponse();
+}
+
+template<> inline const JobEventResponse *Response::response_as<JobEventResponse>() const {
+  return response_as_JobEventResponse();
+}
+
 struct ResponseBuilder {
   flatbuffers::FlatBufferBuilder &fbb_;
   flatbuffers::uoffset_t start_;
@@ -768,6 +916,46 @@ inline bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj,
       auto ptr = reinterpret_cast<const PathReadlinkResponse *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case ResponseType_FileReadStreamResponse: {
+      auto ptr = reinterpret_cast<const FileReadStreamResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_FileWriteStreamResponse: {
+      auto ptr = reinterpret_cast<const FileWriteStreamResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_BatchResponse: {
+      auto ptr = reinterpret_cast<const BatchResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_MbGetStatsResponse: {
+      auto ptr = reinterpret_cast<const MbGetStatsResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_SharedBufferSetupResponse: {
+      auto ptr = reinterpret_cast<const SharedBufferSetupResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_FileReadSharedResponse: {
+      auto ptr = reinterpret_cast<const FileReadSharedResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_MbCloneRomResponse: {
+      auto ptr = reinterpret_cast<const MbCloneRomResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_JobStartResponse: {
+      auto ptr = reinterpret_cast<const JobStartResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_JobCancelResponse: {
+      auto ptr = reinterpret_cast<const JobCancelResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_JobEventResponse: {
+      auto ptr = reinterpret_cast<const JobEventResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
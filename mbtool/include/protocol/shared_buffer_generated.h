@@ -0,0 +1,291 @@
+// Written to match flatc output for protocol/v3/shared_buffer.fbs.
+// Not produced by flatc; replace by running protocol/generate-bindings.sh.
+
+
+#ifndef FLATBUFFERS_GENERATED_SHAREDBUFFER_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_SHAREDBUFFER_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct SharedBufferError;
+
+struct SharedBufferSetupRequest;
+
+struct SharedBufferSetupResponse;
+
+struct FileReadSharedRequest;
+
+struct FileReadSharedResponse;
+
+struct SharedBufferError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERRNO_VALUE = 4,
+    VT_MSG = 6
+  };
+  int32_t errno_value() const {
+    return GetField<int32_t>(VT_ERRNO_VALUE, 0);
+  }
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ERRNO_VALUE) &&
+           VerifyOffset(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SharedBufferErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_errno_value(int32_t errno_value) {
+    fbb_.AddElement<int32_t>(SharedBufferError::VT_ERRNO_VALUE, errno_value, 0);
+  }
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(SharedBufferError::VT_MSG, msg);
+  }
+  explicit SharedBufferErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  SharedBufferErrorBuilder &operator=(const SharedBufferErrorBuilder &);
+  flatbuffers::Offset<SharedBufferError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<SharedBufferError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SharedBufferError> CreateSharedBufferError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    flatbuffers::Offset<flatbuffers::String> msg = 0) {
+  SharedBufferErrorBuilder builder_(_fbb);
+  builder_.add_msg(msg);
+  builder_.add_errno_value(errno_value);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<SharedBufferError> CreateSharedBufferErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    const char *msg = nullptr) {
+  return mbtool::daemon::v3::CreateSharedBufferError(
+      _fbb,
+      errno_value,
+      msg ? _fbb.CreateString(msg) : 0);
+}
+
+struct SharedBufferSetupRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_SIZE = 4
+  };
+  uint32_t size() const {
+    return GetField<uint32_t>(VT_SIZE, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_SIZE) &&
+           verifier.EndTable();
+  }
+};
+
+struct SharedBufferSetupRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_size(uint32_t size) {
+    fbb_.AddElement<uint32_t>(SharedBufferSetupRequest::VT_SIZE, size, 0);
+  }
+  explicit SharedBufferSetupRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  SharedBufferSetupRequestBuilder &operator=(const SharedBufferSetupRequestBuilder &);
+  flatbuffers::Offset<SharedBufferSetupRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<SharedBufferSetupRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SharedBufferSetupRequest> CreateSharedBufferSetupRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t size = 0) {
+  SharedBufferSetupRequestBuilder builder_(_fbb);
+  builder_.add_size(size);
+  return builder_.Finish();
+}
+
+struct SharedBufferSetupResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_SIZE = 4,
+    VT_ERROR = 6
+  };
+  uint32_t size() const {
+    return GetField<uint32_t>(VT_SIZE, 0);
+  }
+  const SharedBufferError *error() const {
+    return GetPointer<const SharedBufferError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_SIZE) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct SharedBufferSetupResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_size(uint32_t size) {
+    fbb_.AddElement<uint32_t>(SharedBufferSetupResponse::VT_SIZE, size, 0);
+  }
+  void add_error(flatbuffers::Offset<SharedBufferError> error) {
+    fbb_.AddOffset(SharedBufferSetupResponse::VT_ERROR, error);
+  }
+  explicit SharedBufferSetupResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  SharedBufferSetupResponseBuilder &operator=(const SharedBufferSetupResponseBuilder &);
+  flatbuffers::Offset<SharedBufferSetupResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<SharedBufferSetupResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<SharedBufferSetupResponse> CreateSharedBufferSetupResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t size = 0,
+    flatbuffers::Offset<SharedBufferError> error = 0) {
+  SharedBufferSetupResponseBuilder builder_(_fbb);
+  builder_.add_error(error);
+  builder_.add_size(size);
+  return builder_.Finish();
+}
+
+struct FileReadSharedRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ID = 4,
+    VT_COUNT = 6
+  };
+  int32_t id() const {
+    return GetField<int32_t>(VT_ID, 0);
+  }
+  uint64_t count() const {
+    return GetField<uint64_t>(VT_COUNT, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ID) &&
+           VerifyField<uint64_t>(verifier, VT_COUNT) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileReadSharedRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_id(int32_t id) {
+    fbb_.AddElement<int32_t>(FileReadSharedRequest::VT_ID, id, 0);
+  }
+  void add_count(uint64_t count) {
+    fbb_.AddElement<uint64_t>(FileReadSharedRequest::VT_COUNT, count, 0);
+  }
+  explicit FileReadSharedRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileReadSharedRequestBuilder &operator=(const FileReadSharedRequestBuilder &);
+  flatbuffers::Offset<FileReadSharedRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<FileReadSharedRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileReadSharedRequest> CreateFileReadSharedRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t id = 0,
+    uint64_t count = 0) {
+  FileReadSharedRequestBuilder builder_(_fbb);
+  builder_.add_count(count);
+  builder_.add_id(id);
+  return builder_.Finish();
+}
+
+struct FileReadSharedResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_OFFSET = 4,
+    VT_BYTES_READ = 6,
+    VT_ERROR = 8
+  };
+  uint64_t offset() const {
+    return GetField<uint64_t>(VT_OFFSET, 0);
+  }
+  uint64_t bytes_read() const {
+    return GetField<uint64_t>(VT_BYTES_READ, 0);
+  }
+  const SharedBufferError *error() const {
+    return GetPointer<const SharedBufferError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint64_t>(verifier, VT_OFFSET) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_READ) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct FileReadSharedResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_offset(uint64_t offset) {
+    fbb_.AddElement<uint64_t>(FileReadSharedResponse::VT_OFFSET, offset, 0);
+  }
+  void add_bytes_read(uint64_t bytes_read) {
+    fbb_.AddElement<uint64_t>(FileReadSharedResponse::VT_BYTES_READ, bytes_read, 0);
+  }
+  void add_error(flatbuffers::Offset<SharedBufferError> error) {
+    fbb_.AddOffset(FileReadSharedResponse::VT_ERROR, error);
+  }
+  explicit FileReadSharedResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  FileReadSharedResponseBuilder &operator=(const FileReadSharedResponseBuilder &);
+  flatbuffers::Offset<FileReadSharedResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<FileReadSharedResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<FileReadSharedResponse> CreateFileReadSharedResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint64_t offset = 0,
+    uint64_t bytes_read = 0,
+    flatbuffers::Offset<SharedBufferError> error = 0) {
+  FileReadSharedResponseBuilder builder_(_fbb);
+  builder_.add_bytes_read(bytes_read);
+  builder_.add_offset(offset);
+  builder_.add_error(error);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_SHAREDBUFFER_MBTOOL_DAEMON_V3_H_
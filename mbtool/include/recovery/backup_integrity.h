@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbutil/hash.h"
+
+namespace mb
+{
+
+//! Name of the integrity manifest in a backup directory
+constexpr char BACKUP_NAME_INTEGRITY[] = "integrity.sha512";
+
+/*!
+ * \brief Collects the digests of the files in a backup directory
+ *
+ * Files are hashed in fixed-size chunks so that large archives and images can
+ * be hashed (and later verified) in parallel. Files can be added from multiple
+ * threads concurrently.
+ */
+class BackupIntegrity
+{
+public:
+    explicit BackupIntegrity(std::string backup_dir);
+
+    bool add_file(const std::string &name);
+    bool add_files_with_prefix(const std::string &prefix);
+
+    bool write();
+
+private:
+    struct Entry
+    {
+        uint64_t size;
+        std::vector<util::Sha512Digest> digests;
+    };
+
+    std::string m_backup_dir;
+    std::mutex m_mutex;
+    std::map<std::string, Entry> m_entries;
+};
+
+bool verify_backup_integrity(const std::string &backup_dir);
+
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+//! Block size used by block-based OTA transfer lists
+constexpr uint64_t TRANSFER_BLOCK_SIZE = 4096;
+
+enum class TransferCommandType
+{
+    Erase,
+    Zero,
+    New,
+};
+
+//! Half-open range of blocks
+struct TransferBlockRange
+{
+    uint64_t begin;
+    uint64_t end;
+};
+
+struct TransferCommand
+{
+    TransferCommandType type;
+    std::vector<TransferBlockRange> ranges;
+};
+
+struct TransferList
+{
+    unsigned int version;
+    uint64_t total_blocks;
+    std::vector<TransferCommand> commands;
+};
+
+oc::result<TransferList> parse_transfer_list(std::string_view data);
+
+oc::result<void> block_image_update(const std::string &zip_file,
+                                    const std::string &transfer_list_path,
+                                    const std::string &new_data_path,
+                                    const std::string &target);
+
+}
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 #include "mbbootimg/reader.h"
 #include "mbbootimg/writer.h"
@@ -27,9 +28,10 @@
 namespace mb
 {
 
-bool bi_copy_data_to_fd(bootimg::Reader &reader, int fd);
+bool bi_copy_stream_to_fd(File &stream, int fd);
 bool bi_copy_file_to_data(const std::string &path, bootimg::Writer &writer);
 bool bi_copy_data_to_file(bootimg::Reader &reader, const std::string &path);
 bool bi_copy_data_to_data(bootimg::Reader &reader, bootimg::Writer &writer);
+bool bi_copy_string_to_data(std::string_view data, bootimg::Writer &writer);
 
 }
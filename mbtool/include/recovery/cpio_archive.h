@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "mbcommon/common.h"
+
+struct archive_entry;
+
+namespace mb
+{
+
+/*!
+ * \brief In-memory cpio archive
+ *
+ * The archive is kept as a list of entries in their original order. Entries
+ * that are not modified are written back with their original headers and
+ * data. New entries are appended to the end of the archive.
+ */
+class CpioArchive
+{
+public:
+    using ReadFn = std::function<bool(std::string &chunk)>;
+    using WriteFn = std::function<bool(std::string_view chunk)>;
+
+    CpioArchive();
+    ~CpioArchive();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CpioArchive)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(CpioArchive)
+
+    bool load_file(const std::string &path);
+    bool load_data(std::string_view data);
+    bool load_stream(const ReadFn &read_fn);
+    bool save_file(const std::string &path) const;
+    bool save_data(std::string &data) const;
+    bool save_stream(const WriteFn &write_fn) const;
+
+    void set_filters(std::vector<int> filters);
+
+    bool exists(std::string_view path) const;
+    std::optional<mode_t> perms(std::string_view path) const;
+    std::optional<std::string> contents(std::string_view path) const;
+    std::optional<std::string> symlink_target(std::string_view path) const;
+
+    bool set_contents(std::string_view path, std::string data,
+                      std::optional<mode_t> perms = {});
+    bool add_symlink(std::string_view path, std::string_view target);
+    bool rename(std::string_view old_path, std::string_view new_path);
+    bool remove(std::string_view path);
+
+private:
+    struct Entry
+    {
+        std::unique_ptr<archive_entry, void (*)(archive_entry *)> header;
+        std::string path;
+        std::string data;
+    };
+
+    std::vector<Entry> _entries;
+    int _format;
+    std::vector<int> _filters;
+
+    Entry *find(std::string_view path);
+    const Entry *find(std::string_view path) const;
+    bool check_parent(std::string_view path) const;
+    Entry &add_entry(std::string path, mode_t type, mode_t perms);
+};
+
+}
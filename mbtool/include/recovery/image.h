@@ -21,6 +21,8 @@
 
 #include <string>
 
+#include "mbcommon/outcome.h"
+
 namespace mb
 {
 
@@ -35,6 +37,14 @@ enum class CreateImageResult
 };
 
 CreateImageResult create_ext4_image(const std::string &path, uint64_t size);
+oc::result<void> create_ext4_sparse_image(const std::string &sparse_path,
+                                          uint64_t size);
 bool fsck_ext4_image(const std::string &image);
+bool ext4_image_is_clean(const std::string &image);
+
+oc::result<void> ext4_image_to_sparse(const std::string &image,
+                                      const std::string &sparse_path);
+oc::result<void> sparse_to_ext4_image(const std::string &sparse_path,
+                                      const std::string &image);
 
 }
@@ -19,7 +19,9 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -29,6 +31,7 @@
 #include "mbcommon/outcome.h"
 #include "mbdevice/device.h"
 
+#include "recovery/preflight.h"
 #include "util/roms.h"
 
 namespace mb
@@ -53,7 +56,7 @@ public:
 
 
 protected:
-    static const std::string CANCELLED;
+    static constexpr char CANCELLED[] = "cancelled";
 
     enum class ProceedState
     {
@@ -67,6 +70,7 @@ protected:
     virtual void display_msg(std::string_view msg);
     virtual void updater_print(std::string_view msg);
     virtual void command_output(std::string_view line);
+    virtual void timeline_output(std::string_view line);
     virtual std::string get_install_type() = 0;
     virtual std::unordered_map<std::string, std::string> get_properties();
     virtual ProceedState on_initialize();
@@ -118,6 +122,49 @@ protected:
 
 private:
     bool _ran;
+    std::chrono::steady_clock::time_point _timeline_start;
+    std::string _payload_key;
+
+    // ETA of the updater, kept up to date from its progress commands
+    std::optional<EtaTracker> _eta_tracker;
+    double _progress_base;
+    double _progress_scope;
+
+    // Directory for large files that are kept for the whole installation.
+    // This is the temporary directory unless they don't fit within the memory
+    // budget.
+    std::string _staging_dir;
+    // Largest peak RSS of all stages so far
+    uint64_t _peak_rss;
+
+    void record_timing(const char *kind, std::string_view name,
+                       std::chrono::steady_clock::time_point start,
+                       bool success);
+
+    static bool timing_succeeded(bool ret)
+    {
+        return ret;
+    }
+
+    static bool timing_succeeded(ProceedState ret)
+    {
+        return ret != ProceedState::Fail;
+    }
+
+    template<typename T>
+    static bool timing_succeeded(const oc::result<T> &ret)
+    {
+        return !!ret;
+    }
+
+    template<typename Fn>
+    auto timed(const char *kind, std::string_view name, Fn &&fn)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto ret = fn();
+        record_timing(kind, name, start, timing_succeeded(ret));
+        return ret;
+    }
 
     static oc::result<bool> is_aroma(const std::string &path);
     static oc::result<bool> is_legacy_props(const std::string &path);
@@ -128,10 +175,13 @@ private:
                            const std::vector<std::string> &argv);
 
     bool create_chroot();
+    bool mount_chroot_template();
     bool destroy_chroot() const;
     bool mount_efs() const;
 
     bool extract_multiboot_files();
+    bool copy_cached_payload(const std::string &cache_dir);
+    void store_cached_payload(const std::string &cache_dir);
     bool set_up_busybox_wrapper();
     bool create_image(const std::string &path, uint64_t size);
     bool system_image_copy(const std::string &source,
@@ -145,6 +195,8 @@ private:
     bool set_up_legacy_properties();
     bool set_up_modern_properties();
     bool set_up_properties();
+    void updater_command(std::string_view line, std::string &print_buf);
+    void updater_progress(double fraction);
     bool updater_fd_reader(int stdio_fd, int command_fd);
     bool run_real_updater();
     bool run_debug_shell();
@@ -26,38 +26,29 @@
 
 namespace mb
 {
-class File;
+namespace bootimg
+{
+class Reader;
+class Writer;
+}
 
 class InstallerUtil
 {
 public:
-    static bool unpack_ramdisk(const std::string &input_file,
-                               const std::string &output_dir,
-                               int &format_out,
-                               std::vector<int> &filters_out);
-    static bool pack_ramdisk(const std::string &input_dir,
-                             const std::string &output_file,
-                             int format,
-                             const std::vector<int> &filters);
-
     static bool patch_boot_image(const std::string &input_file,
                                  const std::string &output_file,
                                  const std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk(const std::string &input_file,
-                              const std::string &output_file,
+    static bool patch_ramdisk(CpioArchive &cpio,
                               unsigned int depth,
                               const std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                  const std::vector<std::function<RamdiskPatcherFn>> &rps);
-    static bool patch_kernel_rkp(const std::string &input_file,
-                                 const std::string &output_file);
+    static bool patch_ramdisk_entry(bootimg::Reader &reader,
+                                    bootimg::Writer &writer,
+                                    const std::vector<std::function<RamdiskPatcherFn>> &rps);
+    static bool patch_kernel(bootimg::Reader &reader,
+                             bootimg::Writer &writer);
 
     static bool replace_file(const std::string &replace,
                              const std::string &with);
-
-private:
-    static bool copy_file_to_file(File &fin, File &fout, uint64_t to_copy);
-    static bool copy_file_to_file_eof(File &fin, File &fout);
 };
 
 }
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mb
+{
+
+struct KernelPatch
+{
+    // Name for log messages
+    const char *name;
+    // Bytes to search for
+    std::string_view pattern;
+    // Bytes to replace the pattern with (same size as the pattern)
+    std::string_view replacement;
+    // Required alignment of the match offset in the uncompressed kernel (eg. 4
+    // for arm64 instructions)
+    size_t alignment = 1;
+    // Maximum number of matches to patch (0 for unlimited). Further matches are
+    // left alone.
+    size_t max_matches = 1;
+};
+
+const std::vector<KernelPatch> & default_kernel_patches();
+
+/*!
+ * \brief Applies a table of byte patches to a kernel in a single pass
+ */
+class KernelPatcher
+{
+public:
+    using WriteFn = std::function<bool(std::string_view data)>;
+
+    KernelPatcher(const std::vector<KernelPatch> &patches, WriteFn write_fn);
+
+    bool write(const void *data, size_t size);
+    bool finish();
+
+    size_t matches(size_t index) const;
+    size_t total_matches() const;
+
+private:
+    struct State
+    {
+        int32_t next[256];
+        // Patches whose pattern ends at this state (including via fail links)
+        std::vector<uint16_t> outputs;
+    };
+
+    const std::vector<KernelPatch> &m_patches;
+    WriteFn m_write_fn;
+
+    // Aho-Corasick automaton over all patterns
+    std::vector<State> m_states;
+    int32_t m_state;
+    size_t m_max_len;
+
+    // Data that may still be patched, starting at m_buf_offset
+    std::string m_buf;
+    uint64_t m_buf_offset;
+    // End of the last applied patch. Overlapping matches are skipped.
+    uint64_t m_patched_end;
+    std::vector<size_t> m_matches;
+
+    void build();
+    void on_match(size_t index, uint64_t end);
+};
+
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+#include "mbutil/archive.h"
+
+namespace mb
+{
+
+struct PreflightSource
+{
+    // Directory or image file
+    std::string path;
+    // Names of top-level entries to skip (directories only)
+    std::vector<std::string> exclusions;
+};
+
+struct PreflightEstimate
+{
+    // Number of uncompressed bytes to process
+    uint64_t total_bytes = 0;
+    // Number of files (0 if unknown, eg. for images)
+    uint64_t file_count = 0;
+    // Output size divided by input size
+    double compression_ratio = 1.0;
+    // Uncompressed bytes per second that can be read and (de)compressed (0 if
+    // not measured)
+    double process_rate = 0;
+    // Bytes per second that can be written to the target device (0 if not
+    // measured)
+    double write_rate = 0;
+    // Estimated duration of the whole job
+    std::chrono::seconds eta{0};
+};
+
+oc::result<PreflightEstimate>
+preflight_backup(const std::vector<PreflightSource> &sources,
+                 const std::string &output_dir,
+                 util::CompressionType compression,
+                 const util::CompressionOptions &options);
+
+oc::result<PreflightEstimate>
+preflight_install(const std::string &zip_file, const std::string &target_dir);
+
+std::string format_duration(std::chrono::seconds duration);
+
+/*!
+ * \brief Keeps an ETA up to date as a job makes progress
+ */
+class EtaTracker
+{
+public:
+    explicit EtaTracker(std::chrono::seconds estimate);
+
+    std::chrono::seconds update(double fraction);
+    bool report_due(double fraction);
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::seconds m_estimate;
+    std::chrono::steady_clock::time_point m_last_report;
+    double m_last_report_fraction;
+};
+
+/*!
+ * \brief Periodically polls the progress of a job that has no progress
+ *        callbacks of its own
+ */
+class ProgressMonitor
+{
+public:
+    // Returns the completed fraction of the job
+    using ProgressFn = std::function<double()>;
+    using ReportFn = std::function<void(double fraction,
+                                        std::chrono::seconds remaining)>;
+
+    ProgressMonitor(std::chrono::seconds estimate, ProgressFn progress_fn,
+                    ReportFn report_fn);
+    ~ProgressMonitor();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProgressMonitor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProgressMonitor)
+
+    void stop();
+
+private:
+    EtaTracker m_tracker;
+    ProgressFn m_progress_fn;
+    ReportFn m_report_fn;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop;
+    std::thread m_thread;
+
+    void run();
+};
+
+}
@@ -22,10 +22,12 @@
 #include <functional>
 #include <string>
 
+#include "recovery/cpio_archive.h"
+
 namespace mb
 {
 
-using RamdiskPatcherFn = bool(const std::string &dir);
+using RamdiskPatcherFn = bool(CpioArchive &cpio);
 
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id);
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <ctime>
+
+#include <sys/types.h>
+
+namespace mb
+{
+
+class BlockDevIndex
+{
+public:
+    static BlockDevIndex & instance();
+
+    std::string find(const std::vector<std::string> &search_dirs,
+                     std::string_view partition);
+
+    bool exists(const std::string &path);
+    bool is_block_dev(const std::string &path);
+
+    void clear();
+
+private:
+    struct Entry
+    {
+        // Whether the entry has been stat'd (or its type is known from
+        // readdir())
+        bool resolved;
+        // Whether stat() succeeded
+        bool exists;
+        mode_t mode;
+    };
+
+    struct Directory
+    {
+        bool exists;
+        timespec mtime;
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    const Entry * lookup(const std::string &dir, std::string_view name);
+    Directory & load(const std::string &dir);
+    bool refresh(const std::string &dir, Directory &d);
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, Directory> _dirs;
+};
+
+}
@@ -25,6 +25,7 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <utility>
 
 #include "mbcommon/common.h"
@@ -56,6 +57,12 @@ private:
     LegacyPropArea *m_prop_area;
     LegacyPropInfo *m_prop_infos;
 
+    // Index of the TOC for lookups by name. The keys point to the names in
+    // the property area, which never change once a property is added. Only
+    // this (the writing) process uses the index, so the shared layout is
+    // unchanged for readers.
+    std::unordered_map<std::string_view, LegacyPropInfo *> m_index;
+
     bool initialize_workspace();
 
     LegacyPropInfo * find_property(std::string_view name);
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace mb
+{
+
+// Memory budget
+
+uint64_t memory_budget();
+void set_memory_budget(uint64_t bytes);
+bool memory_budget_allows(uint64_t bytes);
+
+// Usage reporting
+
+struct MemoryUsage
+{
+    // Peak RSS of this process since the last reset_peak_rss()
+    uint64_t peak_rss;
+    // Largest peak RSS of any child process that has been waited for
+    uint64_t child_peak_rss;
+    // Bytes used on the tmpfs mounts containing the tracked paths
+    uint64_t tmpfs_used;
+};
+
+std::optional<uint64_t> memory_available();
+void reset_peak_rss();
+MemoryUsage memory_usage(const std::vector<std::string> &tmpfs_paths);
+
+}
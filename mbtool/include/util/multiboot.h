@@ -27,12 +27,14 @@
 #define MULTIBOOT_LOG_INSTALLER         INTERNAL_STORAGE "/MultiBoot.log"
 #define MULTIBOOT_LOG_APPSYNC           MULTIBOOT_DIR "/appsync.log"
 #define MULTIBOOT_LOG_DAEMON            MULTIBOOT_DIR "/daemon.log"
+#define MULTIBOOT_LOG_DAEMON_BINARY     MULTIBOOT_DIR "/daemon.mblog"
 
 #define ABOOT_PARTITION                 "/dev/block/platform/msm_sdcc.1/by-name/aboot"
 
 #define UNIVERSAL_BY_NAME_DIR           "/dev/block/by-name"
 
 #define PACKAGES_XML                    "/data/system/packages.xml"
+#define PACKAGES_SNAPSHOT_DIR           "/dev/.mbtool/packages"
 
 #define BUILD_PROP_PATH                 "/system/build.prop"
 #define DEFAULT_PROP_PATH               "/default.prop"
@@ -40,6 +42,10 @@
 
 #define DEVICE_JSON_PATH                "/device.json"
 
+// Booted ROM, written once by init. The ramdisk does not outlive the boot.
+#define CURRENT_ROM_CACHE_PATH          "/.mbtool_current_rom"
+#define BOOT_ID_PATH                    "/proc/sys/kernel/random/boot_id"
+
 #define FILE_CONTEXTS_BIN               "/file_contexts.bin"
 #define FILE_CONTEXTS                   "/file_contexts"
 
@@ -64,6 +70,7 @@
 #define CHROOT_SYSTEM_LOOP_DEV          "/mb/loop.system"
 #define CHROOT_CACHE_LOOP_DEV           "/mb/loop.cache"
 #define CHROOT_DATA_LOOP_DEV            "/mb/loop.data"
+#define CHROOT_INSTALL_ZIP              "/mb/install.zip"
 
 // SELinux context for mbtool utils
 #define MB_EXEC_CONTEXT                 "u:r:mb_exec:s0"
@@ -17,14 +17,21 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "mbcommon/common.h"
 
-class SocketConnection;
+class PropertyClient;
 
 class PropertyService
 {
@@ -39,6 +46,10 @@ public:
 
     std::optional<std::string> get(const std::string &name);
     bool set(const std::string &name, std::string_view value);
+    bool set_many(const std::vector<std::pair<std::string, std::string>> &props);
+
+    bool wait(const std::string &name, std::string_view value,
+              std::chrono::milliseconds timeout);
 
     bool start_thread();
     bool stop_thread();
@@ -54,13 +65,23 @@ private:
     int m_stopper_pipe[2];
     std::thread m_thread;
 
+    // Connections being served by the service thread, keyed by fd
+    std::unordered_map<int, std::unique_ptr<PropertyClient>> m_clients;
+
+    // Serializes writes to the property area and wakes up waiters
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+
     uint32_t set_internal(const std::string &name, std::string_view value);
 
     int create_socket();
 
     void socket_handler_loop();
-    void socket_handle_set_property();
-    void socket_handle_set_property_impl(SocketConnection &socket,
-                                         const std::string &name,
-                                         std::string_view value, bool legacy);
+    void socket_accept_clients(int epfd);
+    bool socket_handle_client(PropertyClient &client);
+    bool socket_handle_message(PropertyClient &client);
+    void socket_handle_incomplete(PropertyClient &client);
+    uint32_t socket_handle_set_property(const char *cmd_name,
+                                        const std::string &name,
+                                        std::string_view value);
 };
@@ -77,11 +77,13 @@ private:
     void add_data_roms();
     void add_extsd_roms();
 public:
+    void add_all();
     void add_installed();
 
     std::shared_ptr<Rom> find_by_id(const std::string &id) const;
 
     static std::shared_ptr<Rom> get_current_rom();
+    static bool cache_current_rom(const std::string &id);
 
     static std::shared_ptr<Rom> create_rom(const std::string &id);
     static bool is_valid(const std::string &id);
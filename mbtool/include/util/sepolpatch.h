@@ -39,6 +39,12 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
                                          uint16_t class_val,
                                          uint32_t perm_val,
                                          bool remove);
+SELinuxResult selinux_raw_set_avtab_perms(policydb_t *pdb,
+                                          uint16_t source_type_val,
+                                          uint16_t target_type_val,
+                                          uint16_t class_val,
+                                          uint32_t perms_mask,
+                                          bool remove);
 SELinuxResult selinux_raw_set_type_trans(policydb_t *pdb,
                                          uint16_t source_type_val,
                                          uint16_t target_type_val,
@@ -60,6 +66,8 @@ SELinuxResult selinux_raw_set_attribute(policydb_t *pdb,
 SELinuxResult selinux_raw_copy_constraints(policydb_t *pdb,
                                            uint16_t source_type_val,
                                            uint16_t target_type_val);
+SELinuxResult selinux_raw_create_type(policydb_t *pdb,
+                                      const char *name);
 SELinuxResult selinux_raw_add_to_role(policydb_t *pdb,
                                       uint16_t role_val,
                                       uint16_t type_val);
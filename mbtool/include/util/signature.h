@@ -19,6 +19,12 @@
 
 #pragma once
 
+#include <optional>
+
+#include <cstdint>
+
+#include <sys/types.h>
+
 namespace mb
 {
 
@@ -29,7 +35,29 @@ enum class SigVerifyResult
     Failure,
 };
 
+/*!
+ * \brief Attributes that identify the contents of a file
+ *
+ * These are part of the key for the verified-signature cache. Any write to the
+ * file changes ctime, so a cache entry never matches modified contents.
+ */
+struct SigFileId
+{
+    dev_t dev;
+    ino_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+
+    bool operator==(const SigFileId &other) const;
+    bool operator!=(const SigFileId &other) const;
+};
+
+std::optional<SigFileId> sig_file_id(int fd);
+
 SigVerifyResult verify_signature(const char *path, const char *sig_path);
+SigVerifyResult verify_signature_fd(int fd, int sig_fd, const char *name,
+                                    const std::optional<SigFileId> &id);
 
 int sigverify_main(int argc, char *argv[]);
 
@@ -19,17 +19,25 @@
 
 #pragma once
 
+#include "mbutil/file_op_progress.h"
+
 #include "util/roms.h"
 
 namespace mb
 {
 
 bool wipe_directory(const std::string &directory,
-                    const std::vector<std::string> &exclusions);
-bool wipe_system(const std::shared_ptr<Rom> &rom);
-bool wipe_cache(const std::shared_ptr<Rom> &rom);
-bool wipe_data(const std::shared_ptr<Rom> &rom);
-bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom);
-bool wipe_multiboot(const std::shared_ptr<Rom> &rom);
+                    const std::vector<std::string> &exclusions,
+                    util::FileOpProgress *progress = nullptr);
+bool wipe_system(const std::shared_ptr<Rom> &rom,
+                 util::FileOpProgress *progress = nullptr);
+bool wipe_cache(const std::shared_ptr<Rom> &rom,
+                util::FileOpProgress *progress = nullptr);
+bool wipe_data(const std::shared_ptr<Rom> &rom,
+               util::FileOpProgress *progress = nullptr);
+bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom,
+                       util::FileOpProgress *progress = nullptr);
+bool wipe_multiboot(const std::shared_ptr<Rom> &rom,
+                    util::FileOpProgress *progress = nullptr);
 
 }
@@ -30,8 +30,8 @@
 
 #include <fcntl.h>
 #include <getopt.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -53,6 +53,7 @@
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
 #include "mbutil/fts.h"
+#include "mbutil/process.h"
 #include "mbutil/properties.h"
 #include "mbutil/selinux.h"
 #include "mbutil/socket.h"
@@ -82,10 +83,16 @@
 
 #define COMMAND_BUF_SIZE                1024
 
+// Matches the backlog that installd uses
+#define INSTALLD_SOCKET_BACKLOG         5
+
 #define PACKAGES_XML_PATH_FMT           "%s/system/packages.xml"
 
 using namespace std::chrono;
 
+static constexpr auto INSTALLD_CONNECT_TIMEOUT = 5s;
+static constexpr auto INSTALLD_CONNECT_RETRY_INTERVAL = 20ms;
+
 namespace mb
 {
 
@@ -94,8 +101,6 @@ using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 static RomConfig config;
 static Packages packages;
 
-static std::vector<RomConfigAndPackages> cfg_pkgs_list; // 'dat naming tho ;)
-
 /*!
  * \brief Try loading the config file in /data/media/0/MultiBoot/[ROM ID]/config.json
  */
@@ -107,33 +112,19 @@ static bool load_config_files()
         return false;
     }
 
-    Roms roms;
-    roms.add_installed();
-
-    for (const std::shared_ptr<Rom> &rom : roms.roms) {
-        std::string config_path = rom->config_path();
-        std::string packages_path = format(PACKAGES_XML_PATH_FMT,
-                                           rom->full_data_path().c_str());
-
-        cfg_pkgs_list.emplace_back();
-        cfg_pkgs_list.back().rom = rom;
-
-        RomConfig &rom_config = cfg_pkgs_list.back().config;
-        Packages &rom_packages = cfg_pkgs_list.back().packages;
+    // Only the current ROM's configuration and packages are used. The other
+    // ROMs' packages.xml files are not parsed since appsync stays resident.
+    std::string config_path = current_rom->config_path();
+    std::string packages_path = format(PACKAGES_XML_PATH_FMT,
+                                       current_rom->full_data_path().c_str());
 
-        if (!rom_config.load_file(config_path)) {
-            LOGW("%s: Failed to load config for ROM %s",
-                 config_path.c_str(), rom->id.c_str());
-        }
-        if (!rom_packages.load_xml(packages_path)) {
-            LOGW("%s: Failed to load packages for ROM %s",
-                 packages_path.c_str(), rom->id.c_str());
-        }
-
-        if (rom->id == current_rom->id) {
-            config = rom_config;
-            packages = rom_packages;
-        }
+    if (!config.load_file(config_path)) {
+        LOGW("%s: Failed to load config for ROM %s",
+             config_path.c_str(), current_rom->id.c_str());
+    }
+    if (!packages.load_xml_cached(packages_path, PACKAGES_SNAPSHOT_DIR)) {
+        LOGW("%s: Failed to load packages for ROM %s",
+             packages_path.c_str(), current_rom->id.c_str());
     }
 
     LOGD("[Config] ROM ID:                    %s", config.id.c_str());
@@ -162,6 +153,8 @@ static bool prepare_appsync()
 
     auto start = steady_clock::now();
 
+    std::vector<SharedDataPackage> data_pkgs;
+
     for (auto it = config.shared_pkgs.begin();
             it != config.shared_pkgs.end();) {
         SharedPackage &shared_pkg = *it;
@@ -175,26 +168,16 @@ static bool prepare_appsync()
             continue;
         }
 
-        // Ensure that the data directory exists if data sharing is enabled
-        if (shared_pkg.share_data
-                && !AppSyncManager::create_shared_data_directory(
-                        shared_pkg.pkg_id, pkg->get_uid())) {
-            LOGW("Failed to create shared data directory for package %s. "
-                 "App data will not be shared", shared_pkg.pkg_id.c_str());
-            shared_pkg.share_data = false;
+        if (shared_pkg.share_data) {
+            data_pkgs.push_back({shared_pkg.pkg_id, pkg->get_uid(), true});
         }
 
         ++it;
     }
 
-    // Ensure that the shared data is under the u:object_r:app_data_file:s0
-    // context. Otherwise, apps won't be able to write to the shared directory
-    bool disable_data_sharing = false;
-    if (!AppSyncManager::fix_shared_data_permissions()) {
-        LOGW("Failed to fix permissions on shared data directory");
-        LOGW("Data sharing will be disabled for all packages");
-        disable_data_sharing = true;
-    }
+    // Ensure that the data directories exist and have the correct ownership
+    // and labels
+    AppSyncManager::create_shared_data_directories(data_pkgs);
 
     auto stop = steady_clock::now();
     LOGD("Initialization stage 1 took %" PRIu64 "ms",
@@ -204,17 +187,23 @@ static bool prepare_appsync()
     start = steady_clock::now();
 
     // Actually share the data
-    for (SharedPackage &shared_pkg : config.shared_pkgs) {
-        auto pkg = packages.find_by_pkg(shared_pkg.pkg_id);
+    AppSyncManager::mount_shared_directories(data_pkgs);
 
-        if (disable_data_sharing) {
-            shared_pkg.share_data = false;
+    for (auto const &data_pkg : data_pkgs) {
+        if (data_pkg.ok) {
+            continue;
         }
 
-        if (shared_pkg.share_data && !AppSyncManager::mount_shared_directory(
-                pkg->name, pkg->get_uid())) {
-            LOGW("Failed to mount shared data directory");
-            shared_pkg.share_data = false;
+        LOGW("Failed to share data directory for package %s. "
+             "App data will not be shared", data_pkg.pkg.c_str());
+
+        auto it = std::find_if(config.shared_pkgs.begin(),
+                               config.shared_pkgs.end(),
+                               [&](const SharedPackage &p) {
+            return p.pkg_id == data_pkg.pkg;
+        });
+        if (it != config.shared_pkgs.end()) {
+            it->share_data = false;
         }
     }
 
@@ -288,6 +277,13 @@ static int create_new_socket()
         return -1;
     }
 
+    // Listen before installd does so that connect_to_installd() does not
+    // have to wait for installd to start. Calling listen() again in installd
+    // only updates the backlog.
+    if (listen(fd, INSTALLD_SOCKET_BACKLOG) < 0) {
+        LOGW("Failed to listen on socket: %s", strerror(errno));
+    }
+
     chown(addr.sun_path, INSTALLD_SOCKET_UID, INSTALLD_SOCKET_GID);
     chmod(addr.sun_path, INSTALLD_SOCKET_PERMS);
     (void) util::selinux_set_context(addr.sun_path, INSTALLD_SOCKET_CONTEXT);
@@ -299,86 +295,53 @@ static int create_new_socket()
 }
 
 /*
- * Socket messages are prefixed with 16-bit unsigned value (little-endian)
+ * Socket messages are prefixed with 16-bit unsigned value (host byte order)
  * indicating the number of bytes that follow. The data should be treated as
- * a string and a null terminator must be added to the end.
+ * a string (without a null terminator). The CyanogenMod async variant of
+ * installd additionally prefixes each message with a 32-bit transaction ID.
+ *
+ * The proxy never re-encodes messages. Bytes are forwarded exactly as they
+ * were received and only the framing is inspected so that commands appsync
+ * hooks can be identified before they reach installd.
  */
 
 /*!
- * \brief Receive a message from a socket
+ * \brief One direction of the connection between the client and installd
+ *
+ * Data read from \a in_fd is appended to \a buf. The range [\a start,
+ * \a scanned) contains complete messages that have been inspected and are
+ * waiting to be written to \a out_fd. The range [\a scanned, \a end) contains
+ * a partially received message.
  */
-static bool receive_message(int fd, char *buf, std::size_t size,
-                            bool is_async, int &async_id)
+struct RelayChannel
 {
-    if (is_async) {
-        auto ret = util::socket_read_int32(fd);
-        if (!ret) {
-            LOGE("Failed to receive async command ID: %s",
-                 ret.error().message().c_str());
-            return false;
-        }
-        async_id = ret.value();
-    }
-
-    auto count = util::socket_read_uint16(fd);
-    if (!count) {
-        LOGE("Failed to read command size: %s",
-             count.error().message().c_str());
-        return false;
-    }
-
-    if (count.value() < 1 || count.value() >= size) {
-        LOGE("Invalid size %u", count.value());
-        return false;
-    }
-
-    if (auto ret = util::socket_read(fd, buf, count.value());
-            !ret || ret.value() != count.value()) {
-        LOGE("Failed to read command: %s", ret.error().message().c_str());
-        return false;
-    }
-
-    buf[count.value()] = 0;
-
-    return true;
-}
+    const char *name;
+    int in_fd;
+    int out_fd;
+    bool hook;
+    std::size_t start;
+    std::size_t scanned;
+    std::size_t end;
+    // Large enough for several maximum size messages so that a burst of
+    // commands can be moved with a single read() and write()
+    char buf[4 * COMMAND_BUF_SIZE];
+};
 
 /*!
- * \brief Send a message to a socket
+ * \brief Size of the header preceding each message
  */
-static bool send_message(int fd, const char *command,
-                         bool is_async, int async_id)
+static std::size_t message_header_size(bool is_async)
 {
-    auto count = static_cast<uint16_t>(strlen(command));
-
-    if (is_async) {
-        if (auto ret = util::socket_write_int32(fd, async_id); !ret) {
-            LOGE("Failed to write async command ID: %s",
-                 ret.error().message().c_str());
-            return false;
-        }
-    }
-
-    if (auto ret = util::socket_write_uint16(fd, count); !ret) {
-        LOGE("Failed to write command size: %s", ret.error().message().c_str());
-        return false;
-    }
-
-    if (auto ret = util::socket_write(fd, command, count);
-            !ret || ret.value() != count) {
-        LOGE("Failed to write command: %s", ret.error().message().c_str());
-        return false;
-    }
-
-    return true;
+    return (is_async ? sizeof(int32_t) : 0) + sizeof(uint16_t);
 }
 
 /*!
  * \brief Connect to the installd socket at INSTALLD_SOCKET_PATH
  *
- * Because installd is spawned right before this function is called, this
- * function will make 5 attempts to connect to the socket. If an attempt fails,
- * it will wait 1 second before trying again.
+ * The socket is already listening when installd is spawned (see
+ * create_new_socket()), so the connection is queued until installd accepts
+ * it. If connecting fails anyway, this function will keep retrying until
+ * INSTALLD_CONNECT_TIMEOUT passes.
  *
  * \return fd if the connection succeeds. Otherwise, -1
  */
@@ -395,21 +358,21 @@ static int connect_to_installd()
         return -1;
     }
 
-    int attempt;
-    for (attempt = 0; attempt < 5; ++attempt) {
-        LOGV("Connecting to installd [Attempt %d/%d]", attempt + 1, 5);
-        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
-            LOGW("Failed: %s", strerror(errno));
-            std::this_thread::sleep_for(1s);
-        } else {
-            break;
+    auto deadline = steady_clock::now() + INSTALLD_CONNECT_TIMEOUT;
+    int attempts = 1;
+
+    LOGV("Connecting to installd");
+
+    while (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+        if (steady_clock::now() >= deadline) {
+            LOGD("Failed to connect to installd after %d attempts: %s",
+                 attempts, strerror(errno));
+            close(fd);
+            return -1;
         }
-    }
 
-    if (attempt == 5) {
-        LOGD("Failed to connect to installd after 5 attempts");
-        close(fd);
-        return -1;
+        ++attempts;
+        std::this_thread::sleep_for(INSTALLD_CONNECT_RETRY_INTERVAL);
     }
 
     LOGD("Connected to installd");
@@ -458,19 +421,6 @@ static std::vector<std::string> parse_args(const char *cmdline)
     return args;
 }
 
-static std::string args_to_string(const std::vector<std::string> &args)
-{
-    std::string output("[");
-    for (size_t i = 0; i < args.size(); ++i) {
-        if (i != 0) {
-            output += ", ";
-        }
-        output += args[i];
-    }
-    output += "]";
-    return output;
-}
-
 static bool do_remove(const std::vector<std::string> &args)
 {
 #define TAG "[remove] "
@@ -538,173 +488,274 @@ static void handle_command(const std::vector<std::string> &args)
     }
 }
 
-static bool handle_installd_event(int client_fd, int installd_fd,
-                                  bool is_async)
+/*!
+ * \brief Find the hook for a command without parsing the whole message
+ *
+ * \return Hook for the command if the first word of \p msg matches one of the
+ *         commands in `cmds`. Otherwise, nullptr
+ */
+static const CommandInfo * find_command(const char *msg, std::size_t size)
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    auto space = static_cast<const char *>(memchr(msg, ' ', size));
+    std::size_t name_size = space ? static_cast<std::size_t>(space - msg) : size;
 
-    int async_id;
+    for (auto const &cmd : cmds) {
+        if (strlen(cmd.name) == name_size
+                && memcmp(cmd.name, msg, name_size) == 0) {
+            return &cmd;
+        }
+    }
 
-    auto start = steady_clock::now();
+    return nullptr;
+}
 
-    auto start_installd = steady_clock::now();
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive reply from installd");
-        return false;
+/*!
+ * \brief Inspect a complete command from the client before it is forwarded
+ */
+static void inspect_command(const char *msg, std::size_t size,
+                            bool can_appsync)
+{
+    // Get size is so annoying we don't want it to show... EVER!
+    if (size >= 7 && memcmp(msg, "getsize", 7) == 0
+            && (size == 7 || msg[7] == ' ')) {
+        return;
     }
-    auto stop_installd = steady_clock::now();
 
-    std::vector<std::string> args = parse_args(buf);
-    LOGD("Received async (probably) reply: %s", args_to_string(args).c_str());
+    LOGD("Received command: %.*s", static_cast<int>(size), msg);
 
-    auto start_send = steady_clock::now();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
-        return false;
+    if (!can_appsync || !find_command(msg, size)) {
+        return;
     }
-    auto stop_send = steady_clock::now();
 
+    auto start = steady_clock::now();
+    handle_command(parse_args(std::string(msg, size).c_str()));
     auto stop = steady_clock::now();
 
-    LOGD("Command stats:");
-    LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-         static_cast<uint64_t>(duration_cast<milliseconds>(
-                stop_send - start_send).count()));
-    LOGD("- Time to receive reply from installd: %" PRIu64 "ms",
-         static_cast<uint64_t>(duration_cast<milliseconds>(
-                stop_installd - start_installd).count()));
-    LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
+    LOGD("- Time to hook installd command: %" PRIu64 "ms",
          static_cast<uint64_t>(duration_cast<milliseconds>(
                 stop - start).count()));
-    LOGD("---");
-
-    return true;
 }
 
-static bool handle_android_event(int client_fd, int installd_fd,
-                                 bool can_appsync, bool is_async)
+/*!
+ * \brief Walk the newly received bytes and mark complete messages for sending
+ *
+ * \return False if the stream contains an invalid message. Otherwise, true
+ */
+static bool scan_messages(RelayChannel &ch, bool can_appsync, bool is_async)
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    const std::size_t header_size = message_header_size(is_async);
+
+    while (ch.end - ch.scanned >= header_size) {
+        uint16_t count;
+        memcpy(&count, ch.buf + ch.scanned + header_size - sizeof(count),
+               sizeof(count));
+
+        if (count < 1 || count >= COMMAND_BUF_SIZE) {
+            LOGE("[%s] Invalid size %u", ch.name, count);
+            return false;
+        }
 
-    steady_clock::time_point start_hook, stop_hook;
+        if (ch.end - ch.scanned < header_size + count) {
+            break;
+        }
 
-    int async_id;
+        if (ch.hook) {
+            inspect_command(ch.buf + ch.scanned + header_size, count,
+                            can_appsync);
+        }
 
-    if (!receive_message(client_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive request from client");
-        return false;
+        ch.scanned += header_size + count;
     }
 
-    auto start = steady_clock::now();
+    return true;
+}
 
-    std::vector<std::string> args = parse_args(buf);
+/*!
+ * \brief Read as much data as is available from the channel's input
+ *
+ * \return False if the connection was closed or an error occurred. Otherwise,
+ *         true
+ */
+static bool relay_read(RelayChannel &ch, bool can_appsync, bool is_async)
+{
+    // Make room at the end of the buffer by discarding sent data
+    if (ch.start > 0 && ch.end == sizeof(ch.buf)) {
+        memmove(ch.buf, ch.buf + ch.start, ch.end - ch.start);
+        ch.scanned -= ch.start;
+        ch.end -= ch.start;
+        ch.start = 0;
+    }
+
+    while (ch.end < sizeof(ch.buf)) {
+        ssize_t n = read(ch.in_fd, ch.buf + ch.end, sizeof(ch.buf) - ch.end);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            LOGE("[%s] Failed to read: %s", ch.name, strerror(errno));
+            return false;
+        } else if (n == 0) {
+            LOGD("[%s] Connection closed", ch.name);
+            return false;
+        }
 
-    bool log_result = true;
+        ch.end += static_cast<std::size_t>(n);
+    }
 
-    if (args.empty()) {
-        LOGE("Invalid command (empty message)");
-    } else {
-        const std::string &cmd = args[0];
-
-        if (cmd == "ping"
-                || cmd == "freecache") {
-            LOGD("Received unimportant command: [%s, ...]", cmd.c_str());
-        } else if (cmd == "aapt"
-                || cmd == "aapt_with_common") {
-            LOGD("Received CyanogenMod-specific command: %s",
-                 args_to_string(args).c_str());
-        } else if (cmd == "rmrcl"
-                || cmd == "asyncDexopt"
-                || cmd == "changeDexOwner") {
-            LOGD("Received Touchwiz-specific command: %s",
-                 args_to_string(args).c_str());
-            if (cmd == "asyncDexopt") {
-                LOGD("Expecting future installd reply for 'asyncDexopt'");
-            }
-        } else if (cmd == "getsize") {
-            // Get size is so annoying we don't want it to show... EVER!
-            log_result = false;
-        } else if (cmd == "install"
-                || cmd == "dexopt"
-                || cmd == "markbootcomplete"
-                || cmd == "movedex"
-                || cmd == "rmdex"
-                || cmd == "remove"
-                || cmd == "rename"
-                || cmd == "fixuid"
-                || cmd == "rmcache"
-                || cmd == "rmcodecache"
-                || cmd == "rmuserdata"
-                || cmd == "movefiles"
-                || cmd == "linklib"
-                || cmd == "mkuserdata"
-                || cmd == "mkuserconfig"
-                || cmd == "rmuser"
-                || cmd == "idmap"
-                || cmd == "restorecondata"
-                || cmd == "patchoat") {
-            LOGD("Received command: %s", args_to_string(args).c_str());
-
-            if (can_appsync) {
-                start_hook = steady_clock::now();
-                handle_command(args);
-                stop_hook = steady_clock::now();
+    return scan_messages(ch, can_appsync, is_async);
+}
+
+/*!
+ * \brief Write as many complete messages as possible to the channel's output
+ *
+ * \return False if an error occurred. Otherwise, true
+ */
+static bool relay_write(RelayChannel &ch)
+{
+    while (ch.start < ch.scanned) {
+        ssize_t n = send(ch.out_fd, ch.buf + ch.start, ch.scanned - ch.start,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
             }
-        } else {
-            LOGW("Unrecognized command: %s", args_to_string(args).c_str());
+            LOGE("[%s] Failed to write: %s", ch.name, strerror(errno));
+            return false;
         }
+
+        ch.start += static_cast<std::size_t>(n);
     }
 
-    auto start_installd = steady_clock::now();
-    if (!send_message(installd_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send request to installd");
-        return false;
+    if (ch.start == ch.end) {
+        ch.start = ch.scanned = ch.end = 0;
     }
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive reply from installd");
-        return false;
+
+    return true;
+}
+
+/*!
+ * \brief Compute the epoll events to wait for on \p fd
+ *
+ * Reading from a channel's input is paused while its buffer is full and
+ * writing is only waited for when there is data that couldn't be sent.
+ */
+static uint32_t relay_events(int fd, const RelayChannel (&chs)[2])
+{
+    uint32_t events = 0;
+
+    for (auto const &ch : chs) {
+        if (ch.in_fd == fd && !(ch.start == 0 && ch.end == sizeof(ch.buf))) {
+            events |= EPOLLIN;
+        }
+        if (ch.out_fd == fd && ch.start < ch.scanned) {
+            events |= EPOLLOUT;
+        }
     }
-    auto stop_installd = steady_clock::now();
 
-    args = parse_args(buf);
+    return events;
+}
 
-    if (log_result) {
-        LOGD("Sending reply: %s", args_to_string(args).c_str());
+/*!
+ * \brief Relay messages between the client and installd until either side
+ *        disconnects
+ */
+static void relay_connection(int client_fd, int installd_fd,
+                             bool can_appsync, bool is_async)
+{
+    for (int fd : { client_fd, installd_fd }) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            LOGE("Failed to make socket non-blocking: %s", strerror(errno));
+            return;
+        }
     }
 
-    auto start_send = steady_clock::now();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
-        return false;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        LOGE("Failed to create epoll instance: %s", strerror(errno));
+        return;
     }
-    auto stop_send = steady_clock::now();
 
-    auto stop = steady_clock::now();
+    auto close_epfd = finally([&]{
+        close(epfd);
+    });
 
-    if (log_result) {
-        LOGD("Command stats:");
-        LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-             static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop_send - start_send).count()));
-        LOGD("- Time to complete installd command:   %" PRIu64 "ms",
-             static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop_installd - start_installd).count()));
-        if (can_appsync) {
-            LOGD("- Time to hook installd command:       %" PRIu64 "ms",
-                 static_cast<uint64_t>(duration_cast<milliseconds>(
-                        stop_hook - start_hook).count()));
+    RelayChannel chs[2];
+    chs[0].name = "client";
+    chs[0].in_fd = client_fd;
+    chs[0].out_fd = installd_fd;
+    chs[0].hook = true;
+    chs[1].name = "installd";
+    chs[1].in_fd = installd_fd;
+    chs[1].out_fd = client_fd;
+    chs[1].hook = false;
+    for (auto &ch : chs) {
+        ch.start = ch.scanned = ch.end = 0;
+    }
+
+    uint32_t registered[2] = {};
+
+    for (std::size_t i = 0; i < 2; ++i) {
+        epoll_event ev = {};
+        ev.events = registered[i] = EPOLLIN;
+        ev.data.fd = chs[i].in_fd;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, chs[i].in_fd, &ev) < 0) {
+            LOGE("Failed to add fd to epoll instance: %s", strerror(errno));
+            return;
         }
-        LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-             static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop - start).count()));
-        LOGD("---");
     }
 
-    return true;
+    while (true) {
+        epoll_event events[2];
+
+        int n = epoll_wait(epfd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to wait for events: %s", strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t revents = events[i].events;
+
+            for (auto &ch : chs) {
+                if (ch.out_fd == fd && revents & (EPOLLOUT | EPOLLERR)
+                        && !relay_write(ch)) {
+                    return;
+                }
+                if (ch.in_fd == fd && revents & (EPOLLIN | EPOLLHUP | EPOLLERR)
+                        && (!relay_read(ch, can_appsync, is_async)
+                                || !relay_write(ch))) {
+                    return;
+                }
+            }
+        }
+
+        // Update the events for each fd if the buffer states changed
+        for (std::size_t i = 0; i < 2; ++i) {
+            uint32_t wanted = relay_events(chs[i].in_fd, chs);
+            if (wanted == registered[i]) {
+                continue;
+            }
+
+            epoll_event ev = {};
+            ev.events = registered[i] = wanted;
+            ev.data.fd = chs[i].in_fd;
+
+            if (epoll_ctl(epfd, EPOLL_CTL_MOD, chs[i].in_fd, &ev) < 0) {
+                LOGE("Failed to modify epoll events: %s", strerror(errno));
+                return;
+            }
+        }
+    }
 }
 
 /**
@@ -727,6 +778,17 @@ static bool handle_android_event(int client_fd, int installd_fd,
  */
 static bool proxy_process(int fd, bool can_appsync)
 {
+    // Check if we're using some variant of the CyanogenMood async installd.
+    // Messages are relayed as they arrive in both directions, so replies
+    // that arrive out of order are passed through untouched.
+    // See: https://github.com/CyanogenMod/android_frameworks_native/commit/8124b181d4b5a3a44796fdb0e3ea4e4171f102c7
+    bool is_async = false;
+    if (auto r = util::file_find_one_of(INSTALLD_PATH,
+            { "failed to read transaction id" }); r && r.value()) {
+        is_async = true;
+    }
+    LOGD("installd is CyanogenMod async version: %d", is_async);
+
     while (true) {
         int client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
         if (client_fd < 0) {
@@ -752,43 +814,9 @@ static bool proxy_process(int fd, bool can_appsync)
             close(installd_fd);
         });
 
-        // Check if we're using some variant of the CyanogenMood async installd
-        // NOTE: We'll effectively make the connection sychronous because we
-        //       always wait for a reply before receiving the next command.
-        // See: https://github.com/CyanogenMod/android_frameworks_native/commit/8124b181d4b5a3a44796fdb0e3ea4e4171f102c7
-        bool is_async = false;
-        if (auto r = util::file_find_one_of(INSTALLD_PATH,
-                { "failed to read transaction id" }); r && r.value()) {
-            is_async = true;
-        }
-        LOGD("installd is CyanogenMod async version: %d", is_async);
-
         LOGD("---");
 
-        pollfd fds[2] = {};
-        fds[0].fd = client_fd;
-        fds[0].events = POLLIN;
-        fds[1].fd = installd_fd;
-        fds[1].events = POLLIN;
-
-        while (true) {
-            fds[0].revents = 0;
-            fds[1].revents = 1;
-
-            if (poll(fds, 2, -1) < 0) {
-                LOGE("Failed to poll() fds: %s", strerror(errno));
-                break;
-            }
-
-            if (fds[0].revents & POLLIN && !handle_android_event(
-                    client_fd, installd_fd, can_appsync, is_async)) {
-                break;
-            }
-            if (fds[1].revents & POLLIN && !handle_installd_event(
-                    client_fd, installd_fd, is_async)) {
-                break;
-            }
-        }
+        relay_connection(client_fd, installd_fd, can_appsync, is_async);
     }
 }
 
@@ -941,6 +969,7 @@ int appsync_main(int argc, char *argv[])
 
     // mbtool logging
     log::set_logger(std::make_shared<log::StdioLogger>(fp.get()));
+    log::set_async(true);
 
     LOGI("=== APPSYNC VERSION %s ===", version());
 
@@ -971,7 +1000,18 @@ int appsync_main(int argc, char *argv[])
         }
     }
 
-    return hijack_socket(can_appsync) ? EXIT_SUCCESS : EXIT_FAILURE;
+    // The package list is only needed for preparing the shared directories.
+    // appsync stays resident as installd's proxy, so don't keep it or the
+    // freed memory around.
+    packages = Packages();
+    util::release_free_memory();
+
+    bool ret = hijack_socket(can_appsync);
+
+    // The log file is closed when returning
+    log::set_async(false);
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 }
@@ -20,17 +20,24 @@
 #include "boot/appsyncmanager.h"
 
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include <cerrno>
+#include <cstring>
 
+#include <fcntl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include "mbcommon/finally.h"
 #include "mblog/logging.h"
 #include "mbutil/chown.h"
 #include "mbutil/directory.h"
 #include "mbutil/fts.h"
+#include "mbutil/metadata.h"
 #include "mbutil/selinux.h"
 
 #define LOG_TAG "mbtool/boot/appsyncmanager"
@@ -39,6 +46,23 @@
 
 #define USER_DATA_DIR                   "/data/data"
 
+// Linux 5.2
+#ifndef __NR_open_tree
+#  define __NR_open_tree                428
+#endif
+#ifndef __NR_move_mount
+#  define __NR_move_mount               429
+#endif
+#ifndef OPEN_TREE_CLONE
+#  define OPEN_TREE_CLONE               1
+#endif
+#ifndef OPEN_TREE_CLOEXEC
+#  define OPEN_TREE_CLOEXEC             O_CLOEXEC
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#  define MOVE_MOUNT_F_EMPTY_PATH       0x00000004
+#endif
+
 static std::string _as_data_dir;
 static std::string _user_data_dir;
 
@@ -107,82 +131,226 @@ bool AppSyncManager::initialize_directories()
     return true;
 }
 
-bool AppSyncManager::create_shared_data_directory(const std::string &pkg, uid_t uid)
+/*!
+ * \brief Bind mount a directory relative to directory fds
+ *
+ * On Linux 5.2+, this uses `open_tree()` and `move_mount()` so that neither
+ * path is resolved from the root again. Otherwise, or if the new mount API
+ * fails, this falls back to `mount()` with \p source and \p target.
+ */
+static bool bind_mount_at(int source_dfd, const std::string &source_name,
+                          const std::string &source,
+                          int target_dfd, const std::string &target_name,
+                          const std::string &target)
 {
-    std::string data_path = get_shared_data_path(pkg);
-
-    if (auto r = util::mkdir_recursive(data_path, 0751); !r) {
-        LOGW("[%s] %s: Failed to create directory: %s",
-             pkg.c_str(), data_path.c_str(), r.error().message().c_str());
-        return false;
+    static bool new_mount_api = true;
+
+    if (new_mount_api) {
+        int tree_fd = static_cast<int>(syscall(
+                __NR_open_tree, source_dfd, source_name.c_str(),
+                OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC));
+        if (tree_fd >= 0) {
+            auto close_tree_fd = finally([&] {
+                close(tree_fd);
+            });
+
+            if (syscall(__NR_move_mount, tree_fd, "", target_dfd,
+                        target_name.c_str(), MOVE_MOUNT_F_EMPTY_PATH) == 0) {
+                return true;
+            }
+        }
+
+        if (errno == ENOSYS) {
+            new_mount_api = false;
+        }
     }
 
-    // Ensure that the shared data directory permissions are correct
-    if (chmod(data_path.c_str(), 0751) < 0) {
-        LOGW("[%s] %s: Failed to chmod: %s",
-             pkg.c_str(), data_path.c_str(), strerror(errno));
-        return false;
+    return mount(source.c_str(), target.c_str(), "", MS_BIND, "") == 0;
+}
+
+/*!
+ * \brief Create and fix the permissions of shared data directories
+ *
+ * All of the directories are created relative to the shared data directory's
+ * fd. Then, the ownership and SELinux label of each package's shared data
+ * and of its mount point in /data/data are set with a single walk per tree.
+ * The trees are processed concurrently.
+ *
+ * \param pkgs Packages whose data should be shared. SharedDataPackage::ok is
+ *             set to false for the packages that failed.
+ */
+void AppSyncManager::create_shared_data_directories(
+        std::vector<SharedDataPackage> &pkgs)
+{
+    int as_dfd = open(_as_data_dir.c_str(),
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (as_dfd < 0) {
+        LOGW("%s: Failed to open directory: %s",
+             _as_data_dir.c_str(), strerror(errno));
+        for (auto &pkg : pkgs) {
+            pkg.ok = false;
+        }
+        return;
     }
 
-    if (auto r = util::chown(
-            data_path, uid, uid, util::ChownFlag::Recursive); !r) {
-        LOGW("[%s] %s: Failed to chown: %s",
-             pkg.c_str(), data_path.c_str(), r.error().message().c_str());
-        return false;
+    auto close_as_dfd = finally([&] {
+        close(as_dfd);
+    });
+
+    int user_dfd = open(_user_data_dir.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (user_dfd < 0) {
+        LOGW("%s: Failed to open directory: %s",
+             _user_data_dir.c_str(), strerror(errno));
+        for (auto &pkg : pkgs) {
+            pkg.ok = false;
+        }
+        return;
     }
 
-    return true;
-}
+    auto close_user_dfd = finally([&] {
+        close(user_dfd);
+    });
+
+    for (auto &pkg : pkgs) {
+        if (!pkg.ok) {
+            continue;
+        }
+
+        const char *name = pkg.pkg.c_str();
+
+        // Ensure that the shared data directory permissions are correct
+        if (mkdirat(as_dfd, name, 0751) < 0 && errno != EEXIST) {
+            LOGW("[%s] Failed to create shared data directory: %s",
+                 name, strerror(errno));
+            pkg.ok = false;
+        } else if (fchmodat(as_dfd, name, 0751, 0) < 0) {
+            LOGW("[%s] Failed to chmod shared data directory: %s",
+                 name, strerror(errno));
+            pkg.ok = false;
+        } else if (mkdirat(user_dfd, name, 0755) < 0 && errno != EEXIST) {
+            LOGW("[%s] Failed to create data directory: %s",
+                 name, strerror(errno));
+            pkg.ok = false;
+        }
+    }
 
-bool AppSyncManager::fix_shared_data_permissions()
-{
+    // Ensure that the shared data is under the u:object_r:app_data_file:s0
+    // context. Otherwise, apps won't be able to write to the shared directory
     std::string context("u:object_r:app_data_file:s0");
     if (auto ret = util::selinux_lget_context(
             "/data/data/com.android.systemui")) {
         context.swap(ret.value());
     }
 
-    if (auto ret = util::selinux_lset_context_recursive(
-            _as_data_dir, context); !ret) {
-        LOGW("%s: Failed to set context recursively to %s: %s",
+    if (auto ret = util::apply_metadata(
+            _as_data_dir, {{}, {}, {}, context}, {}); !ret) {
+        LOGW("%s: Failed to set context to %s: %s",
              _as_data_dir.c_str(), context.c_str(),
              ret.error().message().c_str());
-        return false;
     }
 
-    return true;
+    std::atomic<size_t> next{0};
+
+    auto worker = [&] {
+        for (size_t i; (i = next++) < pkgs.size();) {
+            auto &pkg = pkgs[i];
+            if (!pkg.ok) {
+                continue;
+            }
+
+            auto data_path = get_shared_data_path(pkg.pkg);
+            auto target = _user_data_dir + "/" + pkg.pkg;
+
+            if (auto r = util::apply_metadata(
+                    data_path, {pkg.uid, pkg.uid, {}, context},
+                    util::MetadataFlag::Recursive); !r) {
+                LOGW("[%s] %s: Failed to fix permissions: %s",
+                     pkg.pkg.c_str(), data_path.c_str(),
+                     r.error().message().c_str());
+                pkg.ok = false;
+            } else if (auto r = util::apply_metadata(
+                    target, {pkg.uid, pkg.uid, {}, {}},
+                    util::MetadataFlag::Recursive); !r) {
+                LOGW("[%s] %s: Failed to chown: %s",
+                     pkg.pkg.c_str(), target.c_str(),
+                     r.error().message().c_str());
+                pkg.ok = false;
+            }
+        }
+    };
+
+    size_t threads = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), pkgs.size());
+
+    if (threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(worker);
+        }
+        for (auto &t : workers) {
+            t.join();
+        }
+    }
 }
 
-bool AppSyncManager::mount_shared_directory(const std::string &pkg, uid_t uid)
+/*!
+ * \brief Bind mount shared data directories over the packages' data
+ *
+ * The directories must have been created with
+ * create_shared_data_directories(). Packages whose SharedDataPackage::ok is
+ * false are skipped and it is set to false for those that failed to mount.
+ */
+void AppSyncManager::mount_shared_directories(
+        std::vector<SharedDataPackage> &pkgs)
 {
-    std::string data_path = get_shared_data_path(pkg);
-    std::string target(_user_data_dir);
-    target += "/";
-    target += pkg;
-
-    if (auto r = util::mkdir_recursive(target, 0755); !r) {
-        LOGW("[%s] %s: Failed to create directory: %s",
-             pkg.c_str(), target.c_str(), r.error().message().c_str());
-        return false;
+    int as_dfd = open(_as_data_dir.c_str(),
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int user_dfd = open(_user_data_dir.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    auto close_dfds = finally([&] {
+        if (as_dfd >= 0) {
+            close(as_dfd);
+        }
+        if (user_dfd >= 0) {
+            close(user_dfd);
+        }
+    });
+
+    if (as_dfd < 0 || user_dfd < 0) {
+        LOGW("Failed to open data directories: %s", strerror(errno));
+        for (auto &pkg : pkgs) {
+            pkg.ok = false;
+        }
+        return;
     }
-    if (auto r = util::chown(target, uid, uid, util::ChownFlag::Recursive); !r) {
-        LOGW("[%s] %s: Failed to chown: %s",
-             pkg.c_str(), target.c_str(), r.error().message().c_str());
-        return false;
-    }
-
-    LOGV("[%s] Bind mounting data directory:", pkg.c_str());
-    LOGV("[%s] - Source: %s", pkg.c_str(), data_path.c_str());
-    LOGV("[%s] - Target: %s", pkg.c_str(), target.c_str());
 
-    if (!unmount_shared_directory(pkg)) {
-        return false;
-    } else if (mount(data_path.c_str(), target.c_str(), "", MS_BIND, "") < 0) {
-        LOGW("[%s] Failed to bind mount: %s", pkg.c_str(), strerror(errno));
-        return false;
+    for (auto &pkg : pkgs) {
+        if (!pkg.ok) {
+            continue;
+        }
+
+        auto data_path = get_shared_data_path(pkg.pkg);
+        auto target = _user_data_dir + "/" + pkg.pkg;
+
+        LOGV("[%s] Bind mounting data directory:", pkg.pkg.c_str());
+        LOGV("[%s] - Source: %s", pkg.pkg.c_str(), data_path.c_str());
+        LOGV("[%s] - Target: %s", pkg.pkg.c_str(), target.c_str());
+
+        if (!unmount_shared_directory(pkg.pkg)) {
+            pkg.ok = false;
+        } else if (!bind_mount_at(as_dfd, pkg.pkg, data_path,
+                                  user_dfd, pkg.pkg, target)) {
+            LOGW("[%s] Failed to bind mount: %s",
+                 pkg.pkg.c_str(), strerror(errno));
+            pkg.ok = false;
+        }
     }
-
-    return true;
 }
 
 bool AppSyncManager::unmount_shared_directory(const std::string &pkg)
@@ -19,12 +19,25 @@
 
 #include "boot/auditd.h"
 
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include <cerrno>
+#include <cinttypes>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <getopt.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "mbcommon/finally.h"
@@ -38,6 +51,188 @@
 namespace mb
 {
 
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+//! Maximum number of netlink messages received per recvmmsg() call
+static constexpr size_t AUDIT_BATCH_SIZE = 32;
+//! Time window in which identical AVC denials are only counted
+static constexpr auto AVC_DEDUP_WINDOW = 5s;
+//! Maximum number of distinct AVC denials tracked at a time
+static constexpr size_t AVC_DEDUP_MAX_ENTRIES = 256;
+
+namespace
+{
+
+struct AvcEntry
+{
+    //! When the first occurrence was logged
+    steady_clock::time_point first_seen;
+    //! Audit timestamp (eg. "1514764800.123:456") of the first occurrence
+    std::string first_stamp;
+    //! Audit timestamp of the most recent occurrence
+    std::string last_stamp;
+    //! Number of occurrences that were not logged
+    uint64_t repeats;
+};
+
+/*!
+ * \brief Collapses identical AVC denials into a single summary record
+ *
+ * The first occurrence of a denial is logged immediately. Repeats within
+ * AVC_DEDUP_WINDOW are only counted and reported once the window expires.
+ */
+class AvcDeduplicator
+{
+public:
+    void add(int type, std::string_view msg, steady_clock::time_point now);
+    void expire(steady_clock::time_point now, bool all);
+    std::optional<steady_clock::time_point> next_expiry() const;
+
+private:
+    std::unordered_map<std::string, AvcEntry> m_entries;
+
+    static void report(int type, const std::string &msg,
+                       const AvcEntry &entry);
+};
+
+}
+
+/*!
+ * \brief Split an audit record into its timestamp and the message
+ *
+ * Audit records start with "audit(<timestamp>:<serial>): ". The timestamp and
+ * the serial number differ for every record, so they are not part of the
+ * message that is compared.
+ */
+static std::pair<std::string_view, std::string_view>
+split_audit_stamp(std::string_view data)
+{
+    constexpr std::string_view prefix = "audit(";
+    constexpr std::string_view suffix = "): ";
+
+    if (data.substr(0, prefix.size()) == prefix) {
+        auto end = data.find(suffix, prefix.size());
+        if (end != std::string_view::npos) {
+            return {data.substr(prefix.size(), end - prefix.size()),
+                    data.substr(end + suffix.size())};
+        }
+    }
+
+    return {{}, data};
+}
+
+static void log_audit_record(int type, std::string_view data)
+{
+    LOGV("type=%d %.*s", type, static_cast<int>(data.size()), data.data());
+}
+
+void AvcDeduplicator::add(int type, std::string_view data,
+                          steady_clock::time_point now)
+{
+    auto [stamp, msg] = split_audit_stamp(data);
+
+    if (auto it = m_entries.find(std::string(msg)); it != m_entries.end()) {
+        ++it->second.repeats;
+        it->second.last_stamp = stamp;
+        return;
+    }
+
+    if (m_entries.size() >= AVC_DEDUP_MAX_ENTRIES) {
+        // Too many distinct denials. Report the pending repeats rather than
+        // growing without bound.
+        expire(now, true);
+    }
+
+    log_audit_record(type, data);
+
+    m_entries.emplace(std::string(msg),
+                      AvcEntry{now, std::string(stamp), std::string(stamp), 0});
+}
+
+/*!
+ * \brief Report and forget the denials whose window has expired
+ *
+ * \param now Current time
+ * \param all Whether to report all denials regardless of their age
+ */
+void AvcDeduplicator::expire(steady_clock::time_point now, bool all)
+{
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (all || now - it->second.first_seen >= AVC_DEDUP_WINDOW) {
+            if (it->second.repeats > 0) {
+                report(AUDIT_AVC, it->first, it->second);
+            }
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/*!
+ * \brief Get the time when the oldest tracked denial expires
+ */
+std::optional<steady_clock::time_point> AvcDeduplicator::next_expiry() const
+{
+    std::optional<steady_clock::time_point> result;
+
+    for (auto const &[msg, entry] : m_entries) {
+        auto expiry = entry.first_seen + AVC_DEDUP_WINDOW;
+        if (!result || expiry < *result) {
+            result = expiry;
+        }
+    }
+
+    return result;
+}
+
+void AvcDeduplicator::report(int type, const std::string &msg,
+                             const AvcEntry &entry)
+{
+    LOGV("type=%d %s (repeated %" PRIu64 " times between audit(%s) and "
+         "audit(%s))", type, msg.c_str(), entry.repeats,
+         entry.first_stamp.c_str(), entry.last_stamp.c_str());
+}
+
+/*!
+ * \brief Get the payload of a received audit message
+ *
+ * \return Payload or nothing if the message is invalid or was not sent by the
+ *         kernel
+ */
+static std::optional<std::string_view>
+get_audit_payload(const audit_message &msg, const mmsghdr &hdr,
+                  const sockaddr_nl &addr)
+{
+    size_t len = hdr.msg_len;
+
+    if (hdr.msg_hdr.msg_namelen != sizeof(addr) || addr.nl_pid != 0) {
+        // Not from the kernel
+        return std::nullopt;
+    } else if (!NLMSG_OK(&msg.nlh, len)) {
+        return std::nullopt;
+    }
+
+    // The kernel sets nlmsg_len to the length of the payload for audit events
+    size_t size = std::min<size_t>(msg.nlh.nlmsg_len,
+                                   len - offsetof(audit_message, data));
+
+    std::string_view data(msg.data, size);
+    while (!data.empty() && (data.back() == '\0' || data.back() == '\n')) {
+        data.remove_suffix(1);
+    }
+
+    return data;
+}
+
+/*!
+ * \brief Receive and log audit events until an error occurs
+ *
+ * All messages that are queued on the socket are received with a single
+ * recvmmsg() call and their records are flushed to the logger together. AVC
+ * denials are deduplicated with AvcDeduplicator.
+ */
 static bool audit_mainloop()
 {
     int fd = audit_open();
@@ -54,19 +249,86 @@ static bool audit_mainloop()
         return false;
     }
 
+    // Each message is large, so keep the buffers off the stack
+    std::vector<audit_message> msgs(AUDIT_BATCH_SIZE);
+    std::vector<sockaddr_nl> addrs(AUDIT_BATCH_SIZE);
+    std::vector<iovec> iovs(AUDIT_BATCH_SIZE);
+    std::vector<mmsghdr> hdrs(AUDIT_BATCH_SIZE);
+
+    AvcDeduplicator avc;
+
     while (true) {
-        audit_message reply;
-        reply.nlh.nlmsg_type = 0;
-        reply.nlh.nlmsg_len = 0;
-        reply.data[0] = '\0';
+        for (size_t i = 0; i < AUDIT_BATCH_SIZE; ++i) {
+            iovs[i].iov_base = &msgs[i];
+            iovs[i].iov_len = sizeof(msgs[i]);
+
+            hdrs[i] = {};
+            hdrs[i].msg_hdr.msg_name = &addrs[i];
+            hdrs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            hdrs[i].msg_hdr.msg_iov = &iovs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // Wake up when the oldest pending denial summary is due
+        int timeout = -1;
+        if (auto expiry = avc.next_expiry()) {
+            auto remaining = duration_cast<milliseconds>(
+                    *expiry - steady_clock::now()).count();
+            timeout = static_cast<int>(std::max<decltype(remaining)>(
+                    remaining + 1, 0));
+        }
 
-        if (audit_get_reply(fd, &reply, GET_REPLY_BLOCKING, 0) < 0) {
-            LOGE("Failed to get reply from audit socket: %s", strerror(errno));
+        pollfd pfd{fd, POLLIN, 0};
+        int ret = poll(&pfd, 1, timeout);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to poll audit socket: %s", strerror(errno));
             return false;
         }
 
-        LOGV("type=%d %.*s",
-             reply.nlh.nlmsg_type, reply.nlh.nlmsg_len, reply.data);
+        int n = 0;
+
+        if (ret > 0) {
+            n = recvmmsg(fd, hdrs.data(),
+                         static_cast<unsigned int>(hdrs.size()), MSG_DONTWAIT,
+                         nullptr);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                } else if (errno == ENOBUFS) {
+                    // The kernel dropped events because we fell behind
+                    LOGW("Audit socket receive buffer overflowed");
+                    continue;
+                }
+                LOGE("Failed to get reply from audit socket: %s",
+                     strerror(errno));
+                return false;
+            }
+        }
+
+        auto now = steady_clock::now();
+
+        for (int i = 0; i < n; ++i) {
+            auto data = get_audit_payload(msgs[i], hdrs[i], addrs[i]);
+            if (!data) {
+                continue;
+            }
+
+            int type = msgs[i].nlh.nlmsg_type;
+
+            if (type == AUDIT_AVC) {
+                avc.add(type, *data, now);
+            } else {
+                log_audit_record(type, *data);
+            }
+        }
+
+        avc.expire(now, false);
+
+        // Write everything from this batch to the logger at once
+        log::flush();
     }
 
     // unreachable
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot/boot_trace.h"
+
+#include <memory>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <dirent.h>
+#include <sys/utsname.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+
+#define LOG_TAG "mbtool/boot/boot_trace"
+
+// Same layout as the files produced by Android init's bootchart support so
+// that the directory can be tarred up and passed to pybootchartgui
+#define BOOTCHART_DIR           "bootchart"
+#define TRACE_FILE              "boot_trace.json"
+
+namespace mb
+{
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+static uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u
+            + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/*!
+ * \brief Get the uptime in jiffies as bootchart expects
+ */
+static uint64_t uptime_jiffies()
+{
+    auto uptime = util::file_read_all("/proc/uptime");
+    if (!uptime) {
+        return 0;
+    }
+
+    return static_cast<uint64_t>(strtod(uptime.value().c_str(), nullptr)
+            * 100);
+}
+
+/*!
+ * \brief Concatenate the `stat` files of all running processes
+ */
+static std::string read_process_stats()
+{
+    std::string result;
+
+    ScopedDIR dp(opendir("/proc"), closedir);
+    if (!dp) {
+        return result;
+    }
+
+    while (auto ent = readdir(dp.get())) {
+        if (ent->d_name[0] < '0' || ent->d_name[0] > '9') {
+            continue;
+        }
+
+        std::string path("/proc/");
+        path += ent->d_name;
+        path += "/stat";
+
+        if (auto stat = util::file_read_all(path)) {
+            result += stat.value();
+        }
+    }
+
+    return result;
+}
+
+BootTrace::BootTrace()
+    : m_enabled(true)
+{
+}
+
+/*!
+ * \brief Enable or disable tracing
+ *
+ * Tracing is enabled by default because whether the trace is wanted is not
+ * known until the data partition is mounted. Disabling the trace discards
+ * everything recorded so far and stops further recording.
+ */
+void BootTrace::set_enabled(bool enabled)
+{
+    m_enabled = enabled;
+
+    if (!enabled) {
+        m_stages.clear();
+        m_stages.shrink_to_fit();
+        m_samples.clear();
+        m_samples.shrink_to_fit();
+    }
+}
+
+bool BootTrace::enabled() const
+{
+    return m_enabled;
+}
+
+/*!
+ * \brief Record the start of a stage
+ *
+ * \param name Stage name. Must be a string literal (or otherwise outlive the
+ *             BootTrace instance).
+ *
+ * \return ID to pass to end()
+ */
+BootTrace::StageId BootTrace::begin(const char *name)
+{
+    if (!m_enabled) {
+        return 0;
+    }
+
+    take_sample();
+    m_stages.push_back({name, monotonic_ns(), 0});
+
+    return m_stages.size() - 1;
+}
+
+/*!
+ * \brief Record the end of a stage started with begin()
+ */
+void BootTrace::end(StageId id)
+{
+    if (!m_enabled || id >= m_stages.size()) {
+        return;
+    }
+
+    m_stages[id].end_ns = monotonic_ns();
+    take_sample();
+}
+
+/*!
+ * \brief Record a zero-length stage
+ */
+void BootTrace::mark(const char *name)
+{
+    end(begin(name));
+}
+
+void BootTrace::take_sample()
+{
+    Sample sample;
+    sample.jiffies = uptime_jiffies();
+
+    if (auto stat = util::file_read_all("/proc/stat")) {
+        sample.stat = std::move(stat.value());
+    }
+    if (auto diskstats = util::file_read_all("/proc/diskstats")) {
+        sample.diskstats = std::move(diskstats.value());
+    }
+    sample.ps = read_process_stats();
+
+    m_samples.push_back(std::move(sample));
+}
+
+/*!
+ * \brief Write the trace to a directory
+ *
+ * This writes the stage timings to `boot_trace.json` and the `/proc`
+ * snapshots to the `bootchart` subdirectory in \p dir. Nothing is written if
+ * tracing is disabled.
+ */
+oc::result<void> BootTrace::write(const std::string &dir) const
+{
+    if (!m_enabled) {
+        return oc::success();
+    }
+
+    std::string bootchart_dir(dir);
+    bootchart_dir += "/" BOOTCHART_DIR;
+
+    if (auto r = util::mkdir_recursive(bootchart_dir, 0755);
+            !r && r.error() != std::errc::file_exists) {
+        LOGE("%s: Failed to create directory: %s",
+             bootchart_dir.c_str(), r.error().message().c_str());
+        return r.as_failure();
+    }
+
+    OUTCOME_TRYV(write_json(dir + "/" TRACE_FILE));
+    OUTCOME_TRYV(write_bootchart(bootchart_dir));
+
+    return oc::success();
+}
+
+oc::result<void> BootTrace::write_json(const std::string &path) const
+{
+    ScopedFILE fp(fopen(path.c_str(), "we"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return ec_from_errno();
+    }
+
+    // Stage names are identifiers, so they never need to be escaped
+    fprintf(fp.get(), "{\"version\":1,\"clock\":\"monotonic\",\"stages\":[");
+
+    for (std::size_t i = 0; i < m_stages.size(); ++i) {
+        auto const &stage = m_stages[i];
+
+        fprintf(fp.get(), "%s\n{\"name\":\"%s\",\"begin_us\":%" PRIu64
+                ",\"duration_us\":", i == 0 ? "" : ",", stage.name,
+                stage.begin_ns / 1000);
+        if (stage.end_ns) {
+            fprintf(fp.get(), "%" PRIu64 "}",
+                    (stage.end_ns - stage.begin_ns) / 1000);
+        } else {
+            // Stage did not finish (eg. the process exec'd)
+            fprintf(fp.get(), "null}");
+        }
+    }
+
+    fprintf(fp.get(), "\n]}\n");
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s", path.c_str(), strerror(errno));
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+oc::result<void> BootTrace::write_bootchart(const std::string &dir) const
+{
+    std::string header("version = Android init 0.8\n");
+    header += "title = Boot chart for mbtool init\n";
+
+    utsname uts;
+    if (uname(&uts) == 0) {
+        header += format("system.uname = %s %s %s %s\n",
+                         uts.sysname, uts.release, uts.version, uts.machine);
+        header += format("system.cpu = %s\n", uts.machine);
+    }
+    header += "system.release = mbtool\n";
+
+    if (auto cmdline = util::file_read_all("/proc/cmdline")) {
+        header += "system.kernel.options = ";
+        header += cmdline.value();
+        if (header.back() != '\n') {
+            header += '\n';
+        }
+    }
+
+    std::string stat, diskstats, ps;
+
+    for (auto const &sample : m_samples) {
+        auto ts = format("%" PRIu64 "\n", sample.jiffies);
+
+        stat += ts;
+        stat += sample.stat;
+        stat += '\n';
+        diskstats += ts;
+        diskstats += sample.diskstats;
+        diskstats += '\n';
+        ps += ts;
+        ps += sample.ps;
+        ps += '\n';
+    }
+
+    for (auto const &[name, data] : {
+        std::make_pair("header", &header),
+        std::make_pair("proc_stat.log", &stat),
+        std::make_pair("proc_diskstats.log", &diskstats),
+        std::make_pair("proc_ps.log", &ps),
+    }) {
+        std::string path(dir);
+        path += "/";
+        path += name;
+
+        if (auto r = util::file_write_string(path, *data); !r) {
+            LOGE("%s: Failed to write file: %s",
+                 path.c_str(), r.error().message().c_str());
+            return r.as_failure();
+        }
+    }
+
+    return oc::success();
+}
+
+}
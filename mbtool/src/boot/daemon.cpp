@@ -21,12 +21,16 @@
 
 #include <algorithm>
 #include <chrono>
-#include <thread>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <sched.h>
+#include <signal.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -39,6 +43,7 @@
 #include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mblog/binary_logger.h"
 #include "mblog/logging.h"
 #include "mblog/kmsg_logger.h"
 #include "mblog/stdio_logger.h"
@@ -48,6 +53,7 @@
 #include "mbutil/selinux.h"
 #include "mbutil/socket.h"
 
+#include "boot/daemon_stats.h"
 #include "boot/daemon_v3.h"
 #include "boot/packages.h"
 #include "util/multiboot.h"
@@ -75,8 +81,31 @@ static bool sigstop_when_ready = false;
 static bool allow_root_client = false;
 static bool log_to_kmsg = false;
 static bool log_to_stdio = false;
+static bool log_binary = false;
 static bool no_unshare = false;
 
+//! Set by the SIGUSR1 handler to request a dump of the request statistics
+static volatile sig_atomic_t dump_stats_requested = 0;
+
+//! Number of connection workers to start with the daemon
+static constexpr size_t PREFORKED_WORKERS = 2;
+//! Maximum number of connection workers
+static constexpr size_t MAX_WORKERS = 4;
+
+//! Maximum time to wait for the old daemon to exit with --replace
+static constexpr auto REPLACE_EXIT_TIMEOUT = std::chrono::seconds(2);
+
+#define WORKER_TITLE "mbtool connection worker"
+
+struct Worker
+{
+    pid_t pid;
+    //! Daemon's end of the control socket pair
+    int ctrl_fd;
+    //! Whether the worker is currently serving a connection
+    bool busy;
+};
+
 static ScopedFILE log_fp(nullptr, [](FILE *fp) {
     if (fp) {
         return std::fclose(fp);
@@ -84,20 +113,28 @@ static ScopedFILE log_fp(nullptr, [](FILE *fp) {
     return 0;
 });
 
-static bool verify_credentials(uid_t uid)
+/*!
+ * \brief Per-process cache of credential verification results
+ *
+ * Connection workers serve many connections, so the parsed packages.xml and
+ * the result for each UID are kept until packages.xml is replaced or modified.
+ */
+struct CredentialCache
 {
-    // Rely on the OS for signature checking and simply compare strings in
-    // packages.xml. The only way that file changes is if the package is
-    // removed and reinstalled, in which case, Android will kill the client and
-    // the connection will terminate. Or, the client already has root access, in
-    // which case, there's not much we can do to prevent damage.
+    //! Identity of packages.xml when the cache was filled
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
 
-    Packages pkgs;
-    if (!pkgs.load_xml(PACKAGES_XML)) {
-        LOGE("Failed to load " PACKAGES_XML);
-        return false;
-    }
+    std::optional<Packages> pkgs;
+    std::unordered_map<uid_t, bool> results;
+};
+
+static CredentialCache credential_cache;
 
+static bool check_credentials(const Packages &pkgs, uid_t uid)
+{
     std::shared_ptr<Package> pkg = pkgs.find_by_uid(uid);
     if (!pkg) {
         LOGE("Failed to find package for UID %u", uid);
@@ -108,12 +145,13 @@ static bool verify_credentials(uid_t uid)
     LOGD("%s has %zu signatures", pkg->name.c_str(), pkg->sig_indexes.size());
 
     for (const std::string &index : pkg->sig_indexes) {
-        if (pkgs.sigs.find(index) == pkgs.sigs.end()) {
+        auto it = pkgs.sigs.find(index);
+        if (it == pkgs.sigs.end()) {
             LOGW("Signature index %s has no key", index.c_str());
             continue;
         }
 
-        if (pkgs.sigs[index] == signing_cert) {
+        if (it->second == signing_cert) {
             LOGV("%s matches whitelisted signatures", pkg->name.c_str());
             return true;
         }
@@ -123,6 +161,56 @@ static bool verify_credentials(uid_t uid)
     return false;
 }
 
+static bool verify_credentials(uid_t uid)
+{
+    // Rely on the OS for signature checking and simply compare strings in
+    // packages.xml. The only way that file changes is if the package is
+    // removed and reinstalled, in which case, Android will kill the client and
+    // the connection will terminate. Or, the client already has root access, in
+    // which case, there's not much we can do to prevent damage.
+
+    auto &cache = credential_cache;
+
+    struct stat sb;
+    if (stat(PACKAGES_XML, &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", PACKAGES_XML, strerror(errno));
+        cache.pkgs.reset();
+        cache.results.clear();
+        return false;
+    }
+
+    // Android replaces packages.xml atomically, but check everything in case
+    // it was modified in place
+    if (!cache.pkgs || cache.dev != sb.st_dev || cache.ino != sb.st_ino
+            || cache.size != sb.st_size
+            || cache.mtime.tv_sec != sb.st_mtim.tv_sec
+            || cache.mtime.tv_nsec != sb.st_mtim.tv_nsec) {
+        cache.pkgs.reset();
+        cache.results.clear();
+
+        Packages pkgs;
+        if (!pkgs.load_xml_cached(PACKAGES_XML, PACKAGES_SNAPSHOT_DIR)) {
+            LOGE("Failed to load " PACKAGES_XML);
+            return false;
+        }
+
+        cache.dev = sb.st_dev;
+        cache.ino = sb.st_ino;
+        cache.size = sb.st_size;
+        cache.mtime = sb.st_mtim;
+        cache.pkgs = std::move(pkgs);
+    }
+
+    if (auto it = cache.results.find(uid); it != cache.results.end()) {
+        LOGV("Using cached verification result for UID %u", uid);
+        return it->second;
+    }
+
+    bool ret = check_credentials(*cache.pkgs, uid);
+    cache.results.emplace(uid, ret);
+    return ret;
+}
+
 static bool client_connection(int fd)
 {
     LOGD("Accepted connection from %d", fd);
@@ -195,6 +283,235 @@ static bool client_connection(int fd)
     }
 }
 
+/*!
+ * \brief Prepare a forked process for serving client connections
+ *
+ * This unshares the mount namespace (unless disabled), changes the process
+ * title so --replace doesn't kill existing connections, restores the default
+ * SIGCHLD handler, and ignores SIGUSR1, which is only handled by the daemon.
+ *
+ * Pooled workers outlive the point at which they were forked, so their mount
+ * namespace is made a slave of the daemon's. Mounts made later (eg. the
+ * external SD card mounted by vold) then propagate into the worker while the
+ * worker's own mounts stay private. One-shot connection processes get a fully
+ * private copy.
+ *
+ * \param title Initial process title
+ * \param long_lived Whether the process serves multiple connections
+ *
+ * \return Whether the process was successfully initialized
+ */
+static bool init_connection_process(const char *title, bool long_lived)
+{
+    if (!no_unshare) {
+        if (unshare(CLONE_NEWNS) < 0) {
+            LOGE("unshare() failed: %s", strerror(errno));
+            return false;
+        }
+
+        unsigned long propagation = long_lived ? MS_SLAVE : MS_PRIVATE;
+
+        if (mount("", "/", "", propagation | MS_REC, "") < 0) {
+            LOGE("Failed to set %s mount propagation: %s",
+                 long_lived ? "slave" : "private", strerror(errno));
+            return false;
+        }
+    }
+
+    // Change the process name so --replace doesn't kill existing
+    // connections
+    if (auto ret = util::set_process_title(title); !ret) {
+        LOGE("Failed to set process title: %s",
+             ret.error().message().c_str());
+        return false;
+    }
+
+    // Restore default SIGCHLD handler
+    struct sigaction sa;
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGCHLD, &sa, 0) < 0) {
+        LOGE("Failed to set default SIGCHLD handler: %s",
+             strerror(errno));
+        return false;
+    }
+
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGUSR1, &sa, 0) < 0) {
+        LOGE("Failed to ignore SIGUSR1: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Close fds inherited from the daemon that a child must not keep
+ *
+ * The listening socket must be closed so that a replacement daemon can bind
+ * to it. The daemon's ends of the worker control sockets must be closed so
+ * that the other workers see EOF when the daemon exits.
+ */
+static void close_daemon_fds(int listen_fd, const std::vector<Worker> &workers)
+{
+    close(listen_fd);
+
+    for (auto const &w : workers) {
+        close(w.ctrl_fd);
+    }
+}
+
+/*!
+ * \brief Main loop of a pre-forked connection worker
+ *
+ * The worker waits for the daemon to hand it a client fd over \p ctrl_fd,
+ * serves the connection, and then writes a single byte back to signal that
+ * it is idle again. The worker exits once the daemon closes its end of the
+ * control socket.
+ */
+[[noreturn]]
+static void run_worker(int ctrl_fd)
+{
+    while (true) {
+        std::vector<int> fds(1);
+
+        if (auto r = util::socket_receive_fds(ctrl_fd, fds); !r) {
+            if (r.error() != std::errc::io_error) {
+                LOGE("Failed to receive client fd: %s",
+                     r.error().message().c_str());
+            }
+            _exit(EXIT_SUCCESS);
+        }
+
+        int client_fd = fds[0];
+
+        // SCM_RIGHTS does not carry over the close-on-exec flag
+        if (fcntl(client_fd, F_SETFD, FD_CLOEXEC) < 0) {
+            LOGW("Failed to set FD_CLOEXEC on client fd: %s",
+                 strerror(errno));
+        }
+
+        (void) client_connection(client_fd);
+        close(client_fd);
+
+        (void) util::set_process_title(WORKER_TITLE);
+
+        if (auto r = util::socket_write(ctrl_fd, "", 1); !r || r.value() != 1) {
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*!
+ * \brief Fork a new connection worker and add it to \p workers
+ *
+ * \param listen_fd Listening socket
+ * \param client_fd Client connection currently being dispatched or -1. The
+ *                  worker receives its own copy over the control socket, so
+ *                  the inherited copy is closed.
+ * \param workers Existing workers
+ */
+static bool spawn_worker(int listen_fd, int client_fd,
+                         std::vector<Worker> &workers)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        LOGE("Failed to create worker socket pair: %s", strerror(errno));
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGE("Failed to fork worker: %s", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    } else if (pid == 0) {
+        close(sv[0]);
+        close_daemon_fds(listen_fd, workers);
+        if (client_fd >= 0) {
+            close(client_fd);
+        }
+
+        if (!init_connection_process(WORKER_TITLE, true)) {
+            _exit(127);
+        }
+
+        run_worker(sv[1]);
+    }
+
+    close(sv[1]);
+    workers.push_back({pid, sv[0], false});
+
+    LOGD("Started connection worker %d", pid);
+
+    return true;
+}
+
+/*!
+ * \brief Serve a single connection in a one-shot child process
+ *
+ * This is used when all workers are busy and the pool is at its maximum size.
+ */
+static void fork_connection(int listen_fd, int client_fd,
+                            const std::vector<Worker> &workers)
+{
+    pid_t child_pid = fork();
+    if (child_pid < 0) {
+        LOGE("Failed to fork: %s", strerror(errno));
+    } else if (child_pid == 0) {
+        close_daemon_fds(listen_fd, workers);
+
+        if (!init_connection_process("mbtool connection initializing",
+                                     false)) {
+            _exit(127);
+        }
+
+        bool ret = client_connection(client_fd);
+        close(client_fd);
+        _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+}
+
+/*!
+ * \brief Hand a client connection to an idle worker
+ *
+ * \return Whether a worker accepted the connection
+ */
+static bool dispatch_to_worker(int listen_fd, int client_fd,
+                               std::vector<Worker> &workers)
+{
+    while (true) {
+        auto it = std::find_if(workers.begin(), workers.end(),
+                               [](const Worker &w) { return !w.busy; });
+        if (it == workers.end()) {
+            if (workers.size() >= MAX_WORKERS
+                    || !spawn_worker(listen_fd, client_fd, workers)) {
+                return false;
+            }
+            it = workers.end() - 1;
+        }
+
+        if (auto r = util::socket_send_fds(it->ctrl_fd, {client_fd}); !r) {
+            // Worker died before we noticed; drop it and try another one
+            LOGW("Failed to send client fd to worker %d: %s",
+                 it->pid, r.error().message().c_str());
+            close(it->ctrl_fd);
+            workers.erase(it);
+            continue;
+        }
+
+        it->busy = true;
+        return true;
+    }
+}
+
+static void dump_stats_handler(int)
+{
+    dump_stats_requested = 1;
+}
+
 static bool run_daemon()
 {
     int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
@@ -253,65 +570,104 @@ static bool run_daemon()
             LOGE("Failed to set SIGCHLD handler: %s", strerror(errno));
             return false;
         }
+
+        // No SA_RESTART so that poll() is interrupted and the dump happens
+        // right away
+        sa.sa_handler = dump_stats_handler;
+        if (sigaction(SIGUSR1, &sa, 0) < 0) {
+            LOGE("Failed to set SIGUSR1 handler: %s", strerror(errno));
+            return false;
+        }
     }
 
+    // Must happen before any workers are forked so that they share the
+    // statistics with the daemon
+    (void) daemon_stats_init();
+
+    // The daemon stays resident for as long as the ROM runs. Drop whatever is
+    // left over from patching the policy and other startup work before the
+    // workers are forked so that they do not inherit it either.
+    util::release_free_memory();
+
     LOGD("Socket ready, waiting for connections");
 
-    int client_fd;
-    while ((client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
-        pid_t child_pid = fork();
-        if (child_pid < 0) {
-            LOGE("Failed to fork: %s", strerror(errno));
-        } else if (child_pid == 0) {
-            if (!no_unshare) {
-                if (unshare(CLONE_NEWNS) < 0) {
-                    LOGE("unshare() failed: %s", strerror(errno));
-                    _exit(127);
-                }
+    std::vector<Worker> workers;
+    std::vector<pollfd> fds;
 
-                if (mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
-                    LOGE("Failed to set private mount propagation: %s",
-                         strerror(errno));
-                    _exit(127);
-                }
+    auto stop_workers = finally([&] {
+        // Workers exit once they see EOF on their control socket
+        for (auto const &w : workers) {
+            close(w.ctrl_fd);
+        }
+    });
+
+    for (size_t i = 0; i < PREFORKED_WORKERS; ++i) {
+        (void) spawn_worker(fd, -1, workers);
+    }
+
+    while (true) {
+        if (dump_stats_requested) {
+            dump_stats_requested = 0;
+            daemon_stats_dump();
+        }
+
+        fds.clear();
+        fds.push_back({fd, POLLIN, 0});
+        for (auto const &w : workers) {
+            fds.push_back({w.ctrl_fd, POLLIN, 0});
+        }
+
+        if (poll(fds.data(), static_cast<nfds_t>(fds.size()), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            LOGE("Failed to poll sockets: %s", strerror(errno));
+            return false;
+        }
 
-            // Change the process name so --replace doesn't kill existing
-            // connections
-            if (auto ret = util::set_process_title(
-                    "mbtool connection initializing"); !ret) {
-                LOGE("Failed to set process title: %s",
-                     ret.error().message().c_str());
-                _exit(127);
+        // Process worker status changes first so that idle workers are
+        // available for new connections. fds[i + 1] corresponds to
+        // workers[i], so iterate backwards to allow erasing.
+        for (size_t i = workers.size(); i-- > 0;) {
+            auto revents = fds[i + 1].revents;
+            if (revents == 0) {
+                continue;
             }
 
-            // Restore default SIGCHLD handler
-            struct sigaction sa;
-            sa.sa_handler = SIG_DFL;
-            sigemptyset(&sa.sa_mask);
-            sa.sa_flags = 0;
-            if (sigaction(SIGCHLD, &sa, 0) < 0) {
-                LOGE("Failed to set default SIGCHLD handler: %s",
-                     strerror(errno));
-                _exit(127);
+            char dummy;
+            if ((revents & POLLIN)
+                    && read(workers[i].ctrl_fd, &dummy, 1) == 1) {
+                workers[i].busy = false;
+            } else {
+                // SIGCHLD is ignored, so the process has already been reaped
+                LOGD("Connection worker %d exited", workers[i].pid);
+                close(workers[i].ctrl_fd);
+                workers.erase(workers.begin() + static_cast<ptrdiff_t>(i));
             }
+        }
 
-            // Don't need the listening socket fd
-            close(fd);
+        if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            LOGE("Listening socket is in an error state");
+            return false;
+        } else if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
 
-            bool ret = client_connection(client_fd);
-            close(client_fd);
-            _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+        int client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            LOGE("Failed to accept connection on socket: %s", strerror(errno));
+            return false;
         }
-        close(client_fd);
-    }
 
-    if (client_fd < 0) {
-        LOGE("Failed to accept connection on socket: %s", strerror(errno));
-        return false;
-    }
+        if (!dispatch_to_worker(fd, client_fd, workers)) {
+            fork_connection(fd, client_fd, workers);
+        }
 
-    return true;
+        close(client_fd);
+    }
 }
 
 static bool redirect_stdio_to_dev_null()
@@ -369,17 +725,25 @@ static bool daemon_init()
             return false;
         }
 
-        log_fp.reset(fopen(get_raw_path(MULTIBOOT_LOG_DAEMON).c_str(), "we"));
+        const char *log_path = log_binary
+                ? MULTIBOOT_LOG_DAEMON_BINARY : MULTIBOOT_LOG_DAEMON;
+
+        log_fp.reset(fopen(get_raw_path(log_path).c_str(),
+                           log_binary ? "wbe" : "we"));
         if (!log_fp) {
             LOGE("Failed to open log file %s: %s",
-                 MULTIBOOT_LOG_DAEMON, strerror(errno));
+                 log_path, strerror(errno));
             return false;
         }
 
         fix_multiboot_permissions();
 
         // mbtool logging
-        log::set_logger(std::make_shared<log::StdioLogger>(log_fp.get()));
+        if (log_binary) {
+            log::set_logger(std::make_shared<log::BinaryLogger>(log_fp.get()));
+        } else {
+            log::set_logger(std::make_shared<log::StdioLogger>(log_fp.get()));
+        }
     }
 
     LOGD("Initialized daemon");
@@ -478,13 +842,13 @@ static void daemon_usage(bool error)
             "                   fully initialized\n"
             "  --log-to-kmsg    Send log output to kernel log instead of file\n"
             "  --log-to-stdio   Send log output to stdout/stderr\n"
+            "  --log-binary     Write log file in the binary format (decode\n"
+            "                   with mblogdecode)\n"
             "  --no-unshare     Don't unshare mount namespace\n");
 }
 
 int daemon_main(int argc, char *argv[])
 {
-    using namespace std::chrono_literals;
-
     int opt;
     bool fork_flag = false;
     bool replace_flag = false;
@@ -497,6 +861,7 @@ int daemon_main(int argc, char *argv[])
         OPT_LOG_TO_KMSG = 1003,
         OPT_LOG_TO_STDIO = 1004,
         OPT_NO_UNSHARE = 1005,
+        OPT_LOG_BINARY = 1006,
     };
 
     static struct option long_options[] = {
@@ -508,6 +873,7 @@ int daemon_main(int argc, char *argv[])
         {"sigstop-when-ready", no_argument, 0, OPT_SIGSTOP_WHEN_READY},
         {"log-to-kmsg",        no_argument, 0, OPT_LOG_TO_KMSG},
         {"log-to-stdio",       no_argument, 0, OPT_LOG_TO_STDIO},
+        {"log-binary",         no_argument, 0, OPT_LOG_BINARY},
         {"no-unshare",         no_argument, 0, OPT_NO_UNSHARE},
         {0, 0, 0, 0}
     };
@@ -548,6 +914,10 @@ int daemon_main(int argc, char *argv[])
             log_to_stdio = true;
             break;
 
+        case OPT_LOG_BINARY:
+            log_binary = true;
+            break;
+
         case OPT_NO_UNSHARE:
             no_unshare = true;
             break;
@@ -574,6 +944,8 @@ int daemon_main(int argc, char *argv[])
     }
 
     if (replace_flag) {
+        std::vector<pid_t> killed;
+
         ScopedDIR dp(opendir("/proc"), closedir);
         if (dp) {
             pid_t curpid = getpid();
@@ -607,13 +979,17 @@ int daemon_main(int argc, char *argv[])
 
                 if (args[0] == "mbtool" && args[1] == "daemon") {
                     LOGV("Killing PID %d", pid);
-                    kill(pid, SIGTERM);
+                    if (kill(pid, SIGTERM) == 0) {
+                        killed.push_back(pid);
+                    }
                 }
             }
         }
 
         // Give processes a chance to exit
-        std::this_thread::sleep_for(500ms);
+        if (!util::wait_for_processes_exit(killed, REPLACE_EXIT_TIMEOUT)) {
+            LOGW("Some daemon processes did not exit in time");
+        }
     }
 
     if (fork_flag) {
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot/daemon_state.h"
+
+#include "util/multiboot.h"
+
+namespace mb
+{
+
+static bool same_file(const struct stat &a, const struct stat &b)
+{
+    return a.st_dev == b.st_dev
+            && a.st_ino == b.st_ino
+            && a.st_size == b.st_size
+            && a.st_mtim.tv_sec == b.st_mtim.tv_sec
+            && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec
+            && a.st_ctim.tv_sec == b.st_ctim.tv_sec
+            && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
+DaemonState::DaemonState() = default;
+
+DaemonState::~DaemonState() = default;
+
+/*!
+ * \brief Get the currently booted ROM
+ *
+ * The booted ROM cannot change without a reboot, so it is only detected once.
+ *
+ * \return Booted ROM or nullptr if it could not be determined
+ */
+std::shared_ptr<Rom> DaemonState::current_rom()
+{
+    if (!m_current_rom) {
+        m_current_rom = Roms::get_current_rom();
+    }
+
+    return *m_current_rom;
+}
+
+/*!
+ * \brief Get the list of installed ROMs
+ *
+ * \sa RomRegistry::installed_roms()
+ */
+const std::vector<RomRegistryEntry> & DaemonState::installed_roms()
+{
+    return m_registry.installed_roms();
+}
+
+/*!
+ * \brief Find an installed ROM by its ID
+ *
+ * \return ROM or nullptr if no ROM with the ID is installed
+ */
+std::shared_ptr<Rom> DaemonState::find_installed_rom(const std::string &id)
+{
+    for (auto const &entry : m_registry.installed_roms()) {
+        if (entry.rom->id == id) {
+            return entry.rom;
+        }
+    }
+
+    return {};
+}
+
+/*!
+ * \brief Get the parsed contents of a packages.xml file
+ *
+ * The file is only loaded again if it was modified or replaced since the last
+ * call. Otherwise, the previous result is returned.
+ *
+ * \param path Path to packages.xml
+ *
+ * \return Packages or nullptr if the file could not be loaded
+ */
+std::shared_ptr<const Packages> DaemonState::packages(const std::string &path)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        m_packages.erase(path);
+        return {};
+    }
+
+    if (auto it = m_packages.find(path); it != m_packages.end()) {
+        if (same_file(it->second.sb, sb)) {
+            return it->second.pkgs;
+        }
+        m_packages.erase(it);
+    }
+
+    auto pkgs = std::make_shared<Packages>();
+    if (!pkgs->load_xml_cached(path, PACKAGES_SNAPSHOT_DIR)) {
+        return {};
+    }
+
+    m_packages.emplace(path, CachedPackages{sb, pkgs});
+
+    return pkgs;
+}
+
+/*!
+ * \brief Drop all cached state
+ *
+ * This should be called after the daemon itself modifies ROMs (eg. switching
+ * or wiping).
+ */
+void DaemonState::invalidate()
+{
+    m_registry.invalidate();
+    m_current_rom.reset();
+    m_packages.clear();
+}
+
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot/daemon_stats.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <sys/mman.h>
+
+#include "mblog/logging.h"
+
+#include "protocol/request_generated.h"
+
+#define LOG_TAG "mbtool/boot/daemon_stats"
+
+namespace v3 = mbtool::daemon::v3;
+
+namespace mb
+{
+
+// Latencies are recorded in a log-linear histogram (in the style of
+// HdrHistogram). Values below 2^SUB_BUCKET_BITS get their own bucket. Larger
+// values are grouped by their most significant bit and each group is split
+// into 2^SUB_BUCKET_BITS linear sub-buckets, so the relative error of a
+// bucket is at most 1/2^SUB_BUCKET_BITS.
+static constexpr unsigned int SUB_BUCKET_BITS = 3;
+static constexpr unsigned int SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+//! Largest most significant bit that is tracked (~71 minutes in µs)
+static constexpr unsigned int MAX_MSB = 31;
+static constexpr size_t HISTOGRAM_BUCKETS =
+        (MAX_MSB - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+static constexpr size_t REQUEST_TYPES = v3::RequestType_MAX + 1;
+
+using Counter = std::atomic<uint64_t>;
+
+static_assert(Counter::is_always_lock_free,
+              "Counters must be lock-free to be shared between processes");
+
+struct TypeStats
+{
+    Counter count;
+    Counter bytes_in;
+    Counter bytes_out;
+    Counter total_us;
+    Counter max_us;
+    Counter histogram[HISTOGRAM_BUCKETS];
+};
+
+// Requests are served by forked connection workers, so the statistics live in
+// a shared anonymous mapping that is created by the daemon before any worker
+// is forked.
+static TypeStats *g_stats = nullptr;
+
+static size_t bucket_index(uint64_t value)
+{
+    if (value < SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+
+    auto msb = static_cast<unsigned int>(63 - __builtin_clzll(value));
+    if (msb > MAX_MSB) {
+        msb = MAX_MSB;
+        value = (uint64_t(1) << (MAX_MSB + 1)) - 1;
+    }
+
+    auto sub = static_cast<size_t>(value >> (msb - SUB_BUCKET_BITS));
+    return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub - SUB_BUCKETS;
+}
+
+//! Largest value that maps to a bucket
+static uint64_t bucket_upper_bound(size_t index)
+{
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    auto shift = static_cast<unsigned int>(index / SUB_BUCKETS - 1);
+    uint64_t sub = index % SUB_BUCKETS + SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+static uint64_t percentile(const uint64_t (&histogram)[HISTOGRAM_BUCKETS],
+                           uint64_t count, unsigned int pct, uint64_t max)
+{
+    // Rank of the sample, rounded up
+    uint64_t rank = (count * pct + 99) / 100;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram[i];
+        if (seen >= rank && seen > 0) {
+            return std::min(bucket_upper_bound(i), max);
+        }
+    }
+
+    return max;
+}
+
+/*!
+ * \brief Allocate the shared statistics storage
+ *
+ * This must be called before the connection workers are forked.
+ */
+bool daemon_stats_init()
+{
+    if (g_stats) {
+        return true;
+    }
+
+    void *ptr = mmap(nullptr, sizeof(TypeStats) * REQUEST_TYPES,
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                     -1, 0);
+    if (ptr == MAP_FAILED) {
+        LOGE("Failed to allocate request statistics: %s", strerror(errno));
+        return false;
+    }
+
+    // Anonymous mappings are zero-filled, which is a valid initial state for
+    // the lock-free atomics
+    g_stats = static_cast<TypeStats *>(ptr);
+    return true;
+}
+
+/*!
+ * \brief Record a handled request
+ *
+ * This is a no-op if daemon_stats_init() has not been called.
+ *
+ * \param type RequestType of the request
+ * \param duration_us Time taken by the handler
+ * \param bytes_in Bytes received for the request
+ * \param bytes_out Bytes sent for the request
+ */
+void daemon_stats_record(uint8_t type, uint64_t duration_us,
+                         uint64_t bytes_in, uint64_t bytes_out)
+{
+    if (!g_stats || type >= REQUEST_TYPES) {
+        return;
+    }
+
+    auto &s = g_stats[type];
+    constexpr auto relaxed = std::memory_order_relaxed;
+
+    s.count.fetch_add(1, relaxed);
+    s.bytes_in.fetch_add(bytes_in, relaxed);
+    s.bytes_out.fetch_add(bytes_out, relaxed);
+    s.total_us.fetch_add(duration_us, relaxed);
+    s.histogram[bucket_index(duration_us)].fetch_add(1, relaxed);
+
+    auto max = s.max_us.load(relaxed);
+    while (duration_us > max
+            && !s.max_us.compare_exchange_weak(max, duration_us, relaxed));
+}
+
+/*!
+ * \brief Get the statistics for every request type that has been used
+ *
+ * The counters are updated concurrently by the workers, so the values of
+ * different fields may be off by the requests that are in flight.
+ */
+std::vector<DaemonRequestStats> daemon_stats_snapshot()
+{
+    std::vector<DaemonRequestStats> result;
+
+    if (!g_stats) {
+        return result;
+    }
+
+    constexpr auto relaxed = std::memory_order_relaxed;
+
+    for (size_t type = 0; type < REQUEST_TYPES; ++type) {
+        auto &s = g_stats[type];
+
+        uint64_t histogram[HISTOGRAM_BUCKETS];
+        uint64_t count = 0;
+
+        // Use the histogram total so the percentiles are self-consistent
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            histogram[i] = s.histogram[i].load(relaxed);
+            count += histogram[i];
+        }
+
+        if (count == 0) {
+            continue;
+        }
+
+        DaemonRequestStats stats;
+        stats.type = static_cast<uint8_t>(type);
+        stats.count = count;
+        stats.bytes_in = s.bytes_in.load(relaxed);
+        stats.bytes_out = s.bytes_out.load(relaxed);
+        stats.total_us = s.total_us.load(relaxed);
+        stats.max_us = s.max_us.load(relaxed);
+        stats.p50_us = percentile(histogram, count, 50, stats.max_us);
+        stats.p90_us = percentile(histogram, count, 90, stats.max_us);
+        stats.p99_us = percentile(histogram, count, 99, stats.max_us);
+
+        result.push_back(stats);
+    }
+
+    return result;
+}
+
+//! Clear all statistics
+void daemon_stats_reset()
+{
+    if (!g_stats) {
+        return;
+    }
+
+    constexpr auto relaxed = std::memory_order_relaxed;
+
+    for (size_t type = 0; type < REQUEST_TYPES; ++type) {
+        auto &s = g_stats[type];
+
+        s.count.store(0, relaxed);
+        s.bytes_in.store(0, relaxed);
+        s.bytes_out.store(0, relaxed);
+        s.total_us.store(0, relaxed);
+        s.max_us.store(0, relaxed);
+
+        for (auto &bucket : s.histogram) {
+            bucket.store(0, relaxed);
+        }
+    }
+}
+
+//! Log the statistics for every request type that has been used
+void daemon_stats_dump()
+{
+    auto stats = daemon_stats_snapshot();
+
+    LOGI("Request statistics (%zu types)", stats.size());
+
+    for (auto const &s : stats) {
+        LOGI("%s: count=%" PRIu64 " in=%" PRIu64 "B out=%" PRIu64 "B"
+             " avg=%" PRIu64 "us p50=%" PRIu64 "us p90=%" PRIu64 "us"
+             " p99=%" PRIu64 "us max=%" PRIu64 "us",
+             v3::EnumNameRequestType(static_cast<v3::RequestType>(s.type)),
+             s.count, s.bytes_in, s.bytes_out, s.total_us / s.count,
+             s.p50_us, s.p90_us, s.p99_us, s.max_us);
+    }
+}
+
+}
@@ -19,15 +19,28 @@
 
 #include "boot/daemon_v3.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <unordered_map>
-#include <unordered_set>
 
 #include <fcntl.h>
+#include <linux/memfd.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "mbcommon/common.h"
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
@@ -36,8 +49,8 @@
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
+#include "mbutil/dir_walker.h"
 #include "mbutil/directory.h"
-#include "mbutil/fts.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
 #include "mbutil/reboot.h"
@@ -45,8 +58,13 @@
 #include "mbutil/socket.h"
 #include "mbutil/string.h"
 
+#include "boot/daemon_state.h"
+#include "boot/daemon_stats.h"
+#include "boot/directory_size.h"
 #include "boot/init.h"
 #include "boot/packages.h"
+#include "util/clone.h"
+#include "util/multiboot.h"
 #include "util/romconfig.h"
 #include "util/roms.h"
 #include "util/signature.h"
@@ -74,47 +92,565 @@ namespace mb
 namespace v3 = mbtool::daemon::v3;
 namespace fb = flatbuffers;
 
-static std::unordered_map<int, int> fd_map;
-static int fd_count = 0;
+//! Default chunk size for FileReadStreamRequest
+static constexpr uint32_t STREAM_DEFAULT_CHUNK_SIZE = 256 * 1024;
+//! Maximum chunk size accepted or produced by the streaming requests
+static constexpr uint32_t STREAM_MAX_CHUNK_SIZE = 1024 * 1024;
+//! Default size of the buffer created by SharedBufferSetupRequest
+static constexpr uint32_t SHARED_BUFFER_DEFAULT_SIZE = 4 * 1024 * 1024;
+//! Maximum size of the buffer created by SharedBufferSetupRequest
+static constexpr uint32_t SHARED_BUFFER_MAX_SIZE = 64 * 1024 * 1024;
+//! Interval between progress events of a running job
+static constexpr std::chrono::milliseconds JOB_PROGRESS_INTERVAL(250);
+//! Maximum number of jobs that run concurrently on a connection
+static constexpr size_t JOB_MAX_THREADS = 4;
+//! Maximum number of queued and running jobs on a connection
+static constexpr size_t JOB_MAX_PENDING = 64;
+
+/*!
+ * \brief Work of a request that can also run as a job
+ *
+ * The work is prepared on the connection thread, so it must not refer to the
+ * request buffer or to anything else that belongs to the connection.
+ */
+struct V3Work
+{
+    //! Build the finished response. \p progress is nullptr if the request is
+    //! not running as a job.
+    std::function<void(fb::FlatBufferBuilder &builder,
+                       util::FileOpProgress *progress)> fn;
+    //! Whether the daemon state must be invalidated afterwards
+    bool invalidates_state = false;
+    //! Whether the work can still be cancelled after it started
+    bool cancellable = true;
+};
+
+enum class JobCancelResult
+{
+    Cancelled,
+    NotFound,
+    NotCancellable,
+};
+
+/*!
+ * \brief Runs the jobs of a v3 client connection
+ *
+ * Jobs run on a pool of up to JOB_MAX_THREADS threads that are started on
+ * demand. While jobs are running, a reporter thread sends a progress event
+ * for each one whose counters changed since its previous event. The final
+ * event is sent by the thread that ran the job or, if the job was cancelled
+ * before it started, by the reporter thread.
+ *
+ * When the runner is destroyed, queued jobs are dropped and running jobs are
+ * cancelled and waited for. No further events are sent at that point.
+ */
+class V3JobRunner
+{
+public:
+    using SendFn = std::function<void(const fb::FlatBufferBuilder &)>;
+
+    explicit V3JobRunner(SendFn send) : _send(std::move(send))
+    {
+    }
+
+    ~V3JobRunner()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+            _queue.clear();
+            for (auto const &[id, job] : _jobs) {
+                job->progress.cancelled = true;
+            }
+        }
+        _cv.notify_all();
+        _reporter_cv.notify_all();
+
+        for (auto &t : _threads) {
+            t.join();
+        }
+        if (_reporter.joinable()) {
+            _reporter.join();
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(V3JobRunner)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(V3JobRunner)
+
+    //! Queue \p work and return its job ID or nothing if too many are pending
+    std::optional<uint32_t> start(V3Work work)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_jobs.size() >= JOB_MAX_PENDING) {
+            return std::nullopt;
+        }
+
+        auto job = std::make_shared<Job>();
+        job->id = _next_id++;
+        job->work = std::move(work);
+
+        _jobs.emplace(job->id, job);
+        _queue.push_back(job);
+
+        if (_threads.size() < JOB_MAX_THREADS
+                && _active + _queue.size() > _threads.size()) {
+            _threads.emplace_back(&V3JobRunner::worker, this);
+        }
+        if (!_reporter.joinable()) {
+            _reporter = std::thread(&V3JobRunner::reporter, this);
+        }
+
+        _cv.notify_one();
+        _reporter_cv.notify_one();
+
+        return job->id;
+    }
+
+    JobCancelResult cancel(uint32_t id)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = _jobs.find(id);
+        if (it == _jobs.end()) {
+            return JobCancelResult::NotFound;
+        }
+
+        auto job = it->second;
+
+        if (!job->started) {
+            job->progress.cancelled = true;
+            _queue.erase(std::find(_queue.begin(), _queue.end(), job));
+            _jobs.erase(it);
+            _dropped.push_back(std::move(job));
+            _reporter_cv.notify_one();
+        } else if (!job->work.cancellable) {
+            return JobCancelResult::NotCancellable;
+        } else {
+            job->progress.cancelled = true;
+        }
+
+        return JobCancelResult::Cancelled;
+    }
+
+    //! Whether a job changed the daemon state since the last call
+    bool take_state_changed()
+    {
+        return _state_changed.exchange(false);
+    }
+
+private:
+    struct Job
+    {
+        uint32_t id;
+        V3Work work;
+        util::FileOpProgress progress;
+        // Protected by the runner's mutex
+        bool started = false;
+
+        // Protected by event_mutex
+        std::mutex event_mutex;
+        bool finished = false;
+        uint64_t sent_bytes = 0;
+        uint64_t sent_files = 0;
+    };
+
+    SendFn _send;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _reporter_cv;
+    std::unordered_map<uint32_t, std::shared_ptr<Job>> _jobs;
+    std::deque<std::shared_ptr<Job>> _queue;
+    std::vector<std::shared_ptr<Job>> _dropped;
+    std::vector<std::thread> _threads;
+    std::thread _reporter;
+    size_t _active = 0;
+    uint32_t _next_id = 1;
+    std::atomic<bool> _stopping{false};
+    std::atomic<bool> _state_changed{false};
+
+    /*!
+     * \brief Send an event for \p job
+     *
+     * Progress events are only sent if the counters changed. Nothing is sent
+     * after the final event or once the runner is stopping.
+     */
+    void send_event(Job &job, bool finished,
+                    const std::vector<uint8_t> *response)
+    {
+        std::lock_guard<std::mutex> lock(job.event_mutex);
+
+        uint64_t bytes = job.progress.bytes;
+        uint64_t files = job.progress.files;
+
+        if (_stopping || job.finished || (!finished
+                && bytes == job.sent_bytes && files == job.sent_files)) {
+            return;
+        }
+
+        job.finished = finished;
+        job.sent_bytes = bytes;
+        job.sent_files = files;
+
+        fb::FlatBufferBuilder builder;
+
+        auto event = v3::CreateJobEventResponseDirect(
+                builder, job.id, bytes, files, finished,
+                finished && job.progress.cancelled, response);
+
+        builder.Finish(v3::CreateResponse(
+                builder, v3::ResponseType_JobEventResponse, event.Union()));
+
+        _send(builder);
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true) {
+            _cv.wait(lock, [&] { return _stopping || !_queue.empty(); });
+            if (_stopping) {
+                return;
+            }
+
+            auto job = std::move(_queue.front());
+            _queue.pop_front();
+            job->started = true;
+            ++_active;
+
+            lock.unlock();
+
+            fb::FlatBufferBuilder builder;
+            job->work.fn(builder, &job->progress);
+
+            if (job->work.invalidates_state) {
+                _state_changed = true;
+            }
+
+            std::vector<uint8_t> response(
+                    builder.GetBufferPointer(),
+                    builder.GetBufferPointer() + builder.GetSize());
+            send_event(*job, true, &response);
+
+            lock.lock();
+
+            --_active;
+            _jobs.erase(job->id);
+        }
+    }
+
+    void reporter()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true) {
+            if (_jobs.empty() && _dropped.empty()) {
+                _reporter_cv.wait(lock, [&] {
+                    return _stopping || !_jobs.empty() || !_dropped.empty();
+                });
+            } else {
+                _reporter_cv.wait_for(lock, JOB_PROGRESS_INTERVAL, [&] {
+                    return _stopping || !_dropped.empty();
+                });
+            }
+            if (_stopping) {
+                return;
+            }
+
+            auto dropped = std::move(_dropped);
+            _dropped.clear();
 
-static bool v3_send_response(int fd, const fb::FlatBufferBuilder &builder)
+            std::vector<std::shared_ptr<Job>> running;
+            for (auto const &[id, job] : _jobs) {
+                if (job->started) {
+                    running.push_back(job);
+                }
+            }
+
+            lock.unlock();
+
+            for (auto const &job : dropped) {
+                send_event(*job, true, nullptr);
+            }
+            for (auto const &job : running) {
+                send_event(*job, false, nullptr);
+            }
+
+            lock.lock();
+        }
+    }
+};
+
+/*!
+ * \brief State belonging to a single v3 client connection
+ *
+ * Nothing connection-specific may be stored in globals so that multiple
+ * connections can be served from the same process.
+ */
+class V3Session
 {
-    return util::socket_write_bytes(
-            fd, builder.GetBufferPointer(), builder.GetSize()).has_value();
+public:
+    explicit V3Session(int fd)
+        : _fd(fd)
+        , _jobs([this](const fb::FlatBufferBuilder &builder) {
+            send_event(builder);
+        })
+    {
+    }
+
+    ~V3Session()
+    {
+        // Ensure opened fd's are closed if the connection is lost
+        for (auto const &p : _files) {
+            close(p.second);
+        }
+
+        set_shared_buffer(nullptr, 0);
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(V3Session)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(V3Session)
+
+    //! Client socket
+    int fd() const
+    {
+        return _fd;
+    }
+
+    //! Send a finished response or capture it if a batch is being processed
+    bool send_response(const fb::FlatBufferBuilder &builder)
+    {
+        if (_captured) {
+            _captured->emplace_back(
+                    builder.GetBufferPointer(),
+                    builder.GetBufferPointer() + builder.GetSize());
+            return true;
+        }
+
+        _bytes_out += builder.GetSize();
+
+        return util::socket_write_bytes(
+                _fd, builder.GetBufferPointer(), builder.GetSize())
+                .has_value();
+    }
+
+    /*!
+     * \brief Hold the socket for the duration of a request
+     *
+     * Job events are not sent while the lock is held, so they can't end up in
+     * the middle of data streamed by a request or before the response to the
+     * JobStartRequest that created the job.
+     */
+    std::unique_lock<std::mutex> lock_socket()
+    {
+        return std::unique_lock<std::mutex>(_socket_mutex);
+    }
+
+    //! Send a job event. This must not be called from the connection thread.
+    bool send_event(const fb::FlatBufferBuilder &builder)
+    {
+        std::lock_guard<std::mutex> lock(_socket_mutex);
+
+        return util::socket_write_bytes(
+                _fd, builder.GetBufferPointer(), builder.GetSize())
+                .has_value();
+    }
+
+    V3JobRunner &jobs()
+    {
+        return _jobs;
+    }
+
+    //! Count data that was streamed outside of the request/response buffers
+    void add_stream_bytes(uint64_t in, uint64_t out)
+    {
+        _bytes_in += in;
+        _bytes_out += out;
+    }
+
+    //! Get the bytes transferred since the last call and reset the counters
+    void take_byte_counts(uint64_t &in, uint64_t &out)
+    {
+        in = _bytes_in;
+        out = _bytes_out;
+        _bytes_in = 0;
+        _bytes_out = 0;
+    }
+
+    //! Capture responses into \p responses instead of sending them
+    void set_captured_responses(std::vector<std::vector<uint8_t>> *responses)
+    {
+        _captured = responses;
+    }
+
+    //! Take ownership of \p ffd and return its ID
+    int add_file(int ffd)
+    {
+        int id = _next_id++;
+        _files[id] = ffd;
+        return id;
+    }
+
+    //! Get fd for ID or -1 if the ID is invalid
+    int file(int id) const
+    {
+        auto it = _files.find(id);
+        return it == _files.end() ? -1 : it->second;
+    }
+
+    //! Release ownership of fd for ID or return -1 if the ID is invalid
+    int remove_file(int id)
+    {
+        auto it = _files.find(id);
+        if (it == _files.end()) {
+            return -1;
+        }
+
+        int ffd = it->second;
+        _files.erase(it);
+        return ffd;
+    }
+
+    //! Replace the shared buffer with the mapping at \p data
+    void set_shared_buffer(unsigned char *data, size_t size)
+    {
+        if (_shm_data) {
+            munmap(_shm_data, _shm_size);
+        }
+        _shm_data = data;
+        _shm_size = size;
+        _shm_head = 0;
+    }
+
+    //! Shared buffer or nullptr if the client has not set one up
+    unsigned char *shared_buffer() const
+    {
+        return _shm_data;
+    }
+
+    size_t shared_buffer_size() const
+    {
+        return _shm_size;
+    }
+
+    //! Offset in the shared ring where a transfer of \p size bytes starts
+    size_t shared_buffer_offset(size_t size) const
+    {
+        return _shm_head + size > _shm_size ? 0 : _shm_head;
+    }
+
+    //! Mark \p size bytes at \p offset as used by the latest transfer
+    void shared_buffer_consume(size_t offset, size_t size)
+    {
+        _shm_head = offset + size;
+    }
+
+    //! Scratch buffer of at least \p size bytes reused by streaming requests
+    std::vector<unsigned char> &stream_buffer(size_t size)
+    {
+        if (_stream_buf.size() < size) {
+            _stream_buf.resize(size);
+        }
+        return _stream_buf;
+    }
+
+private:
+    int _fd;
+    std::vector<std::vector<uint8_t>> *_captured = nullptr;
+    std::unordered_map<int, int> _files;
+    int _next_id = 0;
+    std::vector<unsigned char> _stream_buf;
+    uint64_t _bytes_in = 0;
+    uint64_t _bytes_out = 0;
+    unsigned char *_shm_data = nullptr;
+    size_t _shm_size = 0;
+    size_t _shm_head = 0;
+    std::mutex _socket_mutex;
+    // Must be destroyed first so that no job outlives the session
+    V3JobRunner _jobs;
+};
+
+/*!
+ * \brief Create a sealable, close-on-exec memfd
+ *
+ * \return File descriptor or -1 with errno set to ENOSYS if the kernel does not
+ *         support memfds
+ */
+static int create_memfd(const char *name)
+{
+    return static_cast<int>(syscall(__NR_memfd_create, name,
+                                    MFD_CLOEXEC | MFD_ALLOW_SEALING));
+}
+
+static bool v3_send_response(V3Session &session,
+                             const fb::FlatBufferBuilder &builder)
+{
+    return session.send_response(builder);
 }
 
-static bool v3_send_response_invalid(int fd)
+static bool v3_send_response_invalid(V3Session &session)
 {
     fb::FlatBufferBuilder builder;
     auto response = v3::CreateResponse(builder, v3::ResponseType_Invalid,
                                        v3::CreateInvalid(builder).Union());
     builder.Finish(response);
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_send_response_unsupported(int fd)
+static bool v3_send_response_unsupported(V3Session &session)
 {
     fb::FlatBufferBuilder builder;
     auto response = v3::CreateResponse(builder, v3::ResponseType_Unsupported,
                                        v3::CreateUnsupported(builder).Union());
     builder.Finish(response);
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_chmod(int fd, const v3::Request *msg)
+/*!
+ * \brief State shared by all requests served by this connection worker
+ */
+static DaemonState & daemon_state()
 {
-    auto request = static_cast<const v3::FileChmodRequest *>(msg->request());
-    if (fd_map.find(request->id()) == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    static DaemonState state;
+    return state;
+}
+
+/*!
+ * \brief Process a request that can also run as a job synchronously
+ *
+ * \param work Prepared work or nothing if the request is invalid
+ */
+static bool v3_run_work(V3Session &session, const std::optional<V3Work> &work)
+{
+    if (!work) {
+        return v3_send_response_invalid(session);
     }
 
-    int ffd = fd_map[request->id()];
+    fb::FlatBufferBuilder builder;
+    work->fn(builder, nullptr);
+
+    if (work->invalidates_state) {
+        daemon_state().invalidate();
+    }
+
+    return v3_send_response(session, builder);
+}
+
+static bool v3_file_chmod(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileChmodRequest *>(msg->request());
+    int ffd = session.file(request->id());
+    if (ffd < 0) {
+        return v3_send_response_invalid(session);
+    }
 
     // Don't allow setting setuid or setgid permissions
     mode_t mode = static_cast<mode_t>(request->mode());
     mode_t masked = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
     if (masked != mode) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     fb::FlatBufferBuilder builder;
@@ -135,21 +671,18 @@ static bool v3_file_chmod(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_FileChmodResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_close(int fd, const v3::Request *msg)
+static bool v3_file_close(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileCloseRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    // Remove ID from the session
+    int ffd = session.remove_file(request->id());
+    if (ffd < 0) {
+        return v3_send_response_invalid(session);
     }
 
-    // Remove ID from map
-    int ffd = it->second;
-    fd_map.erase(it);
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileCloseError> error;
 
@@ -168,14 +701,14 @@ static bool v3_file_close(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_FileCloseResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_open(int fd, const v3::Request *msg)
+static bool v3_file_open(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileOpenRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     int flags = O_CLOEXEC;
@@ -210,8 +743,7 @@ static bool v3_file_open(int fd, const v3::Request *msg)
 
     if (ffd >= 0) {
         // Assign a new ID
-        id = fd_count++;
-        fd_map[id] = ffd;
+        id = session.add_file(ffd);
     } else {
         error = v3::CreateFileOpenErrorDirect(
                 builder, saved_errno, strerror(saved_errno));
@@ -225,19 +757,17 @@ static bool v3_file_open(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_FileOpenResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_read(int fd, const v3::Request *msg)
+static bool v3_file_read(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileReadRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = session.file(request->id());
+    if (ffd < 0) {
+        return v3_send_response_invalid(session);
     }
 
-    int ffd = it->second;
-
     std::vector<unsigned char> buf(static_cast<size_t>(request->count()));
 
     fb::FlatBufferBuilder builder;
@@ -263,18 +793,56 @@ static bool v3_file_read(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_FileReadResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_seek(int fd, const v3::Request *msg)
+static bool v3_file_read_shared(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileReadSharedRequest *>(
+            msg->request());
+    int ffd = session.file(request->id());
+    if (ffd < 0 || !session.shared_buffer()) {
+        return v3_send_response_invalid(session);
+    }
+
+    auto count = static_cast<size_t>(std::min<uint64_t>(
+            request->count(), session.shared_buffer_size()));
+    size_t offset = session.shared_buffer_offset(count);
+
+    fb::FlatBufferBuilder builder;
+    fb::Offset<v3::SharedBufferError> error;
+
+    // The data goes straight from the page cache into the client's mapping
+    ssize_t ret = read(ffd, session.shared_buffer() + offset, count);
+    int saved_errno = errno;
+
+    if (ret >= 0) {
+        session.shared_buffer_consume(offset, static_cast<size_t>(ret));
+        session.add_stream_bytes(0, static_cast<uint64_t>(ret));
+    } else {
+        error = v3::CreateSharedBufferErrorDirect(
+                builder, saved_errno, strerror(saved_errno));
+    }
+
+    auto response = v3::CreateFileReadSharedResponse(
+            builder, offset, ret >= 0 ? static_cast<uint64_t>(ret) : 0, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_FileReadSharedResponse,
+            response.Union()));
+
+    return v3_send_response(session, builder);
+}
+
+static bool v3_file_seek(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSeekRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = session.file(request->id());
+    if (ffd < 0) {
+        return v3_send_response_invalid(session);
     }
 
-    int ffd = it->second;
     int64_t offset = request->offset();
     int whence;
 
@@ -285,7 +853,7 @@ static bool v3_file_seek(int fd, const v3::Request *msg)
     } else if (request->whence() == v3::FileSeekWhence_SEEK_END) {
         whence = SEEK_END;
     } else {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     fb::FlatBufferBuilder builder;
@@ -310,20 +878,19 @@ static bool v3_file_seek(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_FileSeekResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_selinux_get_label(int fd, const v3::Request *msg)
+static bool v3_file_selinux_get_label(V3Session &session,
+                                      const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSELinuxGetLabelRequest *>(
             msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = session.file(request->id());
+    if (ffd < 0) {
+        return v3_send_response_invalid(session);
     }
 
-    int ffd = it->second;
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileSELinuxGetLabelError> error;
 
@@ -343,20 +910,19 @@ static bool v3_file_selinux_get_label(int fd, const v3::Request *msg)
             builder, v3::ResponseType_PathSELinuxGetLabelResponse,
             response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
+static bool v3_file_selinux_set_label(V3Session &session,
+                                      const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileSELinuxSetLabelRequest *>(
             msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end() || !request->label()) {
-        return v3_send_response_invalid(fd);
+    int ffd = session.file(request->id());
+    if (ffd < 0 || !request->label()) {
+        return v3_send_response_invalid(session);
     }
 
-    int ffd = it->second;
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileSELinuxSetLabelError> error;
 
@@ -375,19 +941,17 @@ static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
             builder, v3::ResponseType_FileSELinuxSetLabelResponse,
             response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_stat(int fd, const v3::Request *msg)
+static bool v3_file_stat(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileStatRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end()) {
-        return v3_send_response_invalid(fd);
+    int ffd = session.file(request->id());
+    if (ffd < 0) {
+        return v3_send_response_invalid(session);
     }
 
-    int ffd = it->second;
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileStatError> error;
     fb::Offset<v3::StructStat> statbuf;
@@ -425,19 +989,17 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_FileStatResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_file_write(int fd, const v3::Request *msg)
+static bool v3_file_write(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileWriteRequest *>(msg->request());
-    auto it = fd_map.find(request->id());
-    if (it == fd_map.end() || !request->data()) {
-        return v3_send_response_invalid(fd);
+    int ffd = session.file(request->id());
+    if (ffd < 0 || !request->data()) {
+        return v3_send_response_invalid(session);
     }
 
-    int ffd = it->second;
-
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileWriteError> error;
 
@@ -457,21 +1019,288 @@ static bool v3_file_write(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_FileWriteResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
+}
+
+/*!
+ * \brief Get the number of bytes between the current offset and EOF
+ *
+ * \return Number of bytes or std::nullopt if \p ffd is not a seekable regular
+ *         file or block device
+ */
+static std::optional<uint64_t> remaining_file_size(int ffd)
+{
+    struct stat sb;
+    if (fstat(ffd, &sb) < 0
+            || !(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+        return std::nullopt;
+    }
+
+    off64_t cur = lseek64(ffd, 0, SEEK_CUR);
+    if (cur < 0) {
+        return std::nullopt;
+    }
+
+    off64_t end = sb.st_size;
+    if (S_ISBLK(sb.st_mode)) {
+        end = lseek64(ffd, 0, SEEK_END);
+        if (end < 0 || lseek64(ffd, cur, SEEK_SET) < 0) {
+            return std::nullopt;
+        }
+    }
+
+    return end > cur ? static_cast<uint64_t>(end - cur) : 0;
+}
+
+/*!
+ * \brief Send a chunk of exactly \p size bytes from \p ffd
+ *
+ * The chunk length is sent up front, so this must only be used when \p size
+ * bytes are known to be available. sendfile() is used until it fails, after
+ * which \p use_sendfile is cleared and read() is used instead.
+ *
+ * \return Whether the chunk was fully sent. If false, the stream can't be
+ *         terminated cleanly and the connection must be dropped.
+ */
+static bool send_sized_chunk(int fd, int ffd, size_t size, bool &use_sendfile,
+                             std::vector<unsigned char> &buf)
+{
+    if (auto r = util::socket_write_int32(fd, static_cast<int32_t>(size)); !r) {
+        return false;
+    }
+
+    size_t sent = 0;
+
+    while (sent < size && use_sendfile) {
+        ssize_t n = sendfile(fd, ffd, nullptr, size - sent);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            use_sendfile = false;
+        } else {
+            sent += static_cast<size_t>(n);
+        }
+    }
+
+    while (sent < size) {
+        ssize_t n = read(ffd, buf.data(), std::min(buf.size(), size - sent));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            LOGE("File ended or failed in the middle of a stream chunk: %s",
+                 n < 0 ? strerror(errno) : "EOF");
+            return false;
+        }
+
+        auto w = util::socket_write(fd, buf.data(), static_cast<size_t>(n));
+        if (!w || w.value() != static_cast<size_t>(n)) {
+            return false;
+        }
+
+        sent += static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+static bool v3_send_file_read_stream_response(V3Session &session,
+                                              fb::FlatBufferBuilder &builder,
+                                              uint64_t bytes_read, int error_code)
+{
+    builder.Clear();
+
+    fb::Offset<v3::FileReadStreamError> error;
+
+    if (error_code != 0) {
+        error = v3::CreateFileReadStreamErrorDirect(
+                builder, error_code, strerror(error_code));
+    }
+
+    auto response = v3::CreateFileReadStreamResponse(
+            builder, bytes_read, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_FileReadStreamResponse,
+            response.Union()));
+
+    return v3_send_response(session, builder);
+}
+
+static bool v3_file_read_stream(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileReadStreamRequest *>(
+            msg->request());
+    int fd = session.fd();
+
+    fb::FlatBufferBuilder builder;
+
+    int ffd = session.file(request->id());
+    if (ffd < 0) {
+        return v3_send_file_read_stream_response(session, builder, 0, EBADF);
+    }
+
+    uint32_t chunk_size = request->chunk_size() == 0
+            ? STREAM_DEFAULT_CHUNK_SIZE
+            : std::min(request->chunk_size(), STREAM_MAX_CHUNK_SIZE);
+    auto &buf = session.stream_buffer(chunk_size);
+
+    // Let the client know that the data follows
+    if (!v3_send_file_read_stream_response(session, builder, 0, 0)) {
+        return false;
+    }
+
+    uint64_t remaining = request->count();
+    uint64_t bytes_read = 0;
+    int error_code = 0;
+
+    // If the size is known, the chunk lengths can be sent before the data,
+    // which allows using sendfile()
+    auto available = remaining_file_size(ffd);
+    bool sized = available.has_value();
+    bool use_sendfile = sized;
+    if (sized) {
+        remaining = std::min(remaining, *available);
+    }
+
+    while (remaining > 0) {
+        size_t size = static_cast<size_t>(
+                std::min<uint64_t>(remaining, chunk_size));
+
+        if (sized) {
+            if (!send_sized_chunk(fd, ffd, size, use_sendfile, buf)) {
+                return false;
+            }
+        } else {
+            ssize_t n = read(ffd, buf.data(), size);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                error_code = errno;
+                break;
+            } else if (n == 0) {
+                break;
+            }
+
+            size = static_cast<size_t>(n);
+
+            if (auto r = util::socket_write_bytes(fd, buf.data(), size); !r) {
+                return false;
+            }
+        }
+
+        remaining -= size;
+        bytes_read += size;
+        session.add_stream_bytes(0, size);
+    }
+
+    // Zero-length chunk terminates the stream
+    if (auto r = util::socket_write_int32(fd, 0); !r) {
+        return false;
+    }
+
+    return v3_send_file_read_stream_response(
+            session, builder, bytes_read, error_code);
+}
+
+static bool v3_send_file_write_stream_response(V3Session &session,
+                                               fb::FlatBufferBuilder &builder,
+                                               uint64_t bytes_written, int error_code)
+{
+    builder.Clear();
+
+    fb::Offset<v3::FileWriteStreamError> error;
+
+    if (error_code != 0) {
+        error = v3::CreateFileWriteStreamErrorDirect(
+                builder, error_code, strerror(error_code));
+    }
+
+    auto response = v3::CreateFileWriteStreamResponse(
+            builder, bytes_written, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_FileWriteStreamResponse,
+            response.Union()));
+
+    return v3_send_response(session, builder);
+}
+
+static bool v3_file_write_stream(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::FileWriteStreamRequest *>(
+            msg->request());
+    int fd = session.fd();
+
+    fb::FlatBufferBuilder builder;
+
+    int ffd = session.file(request->id());
+    if (ffd < 0) {
+        return v3_send_file_write_stream_response(session, builder, 0, EBADF);
+    }
+
+    // Let the client know that it can start sending data
+    if (!v3_send_file_write_stream_response(session, builder, 0, 0)) {
+        return false;
+    }
+
+    uint64_t bytes_written = 0;
+    int error_code = 0;
+
+    while (true) {
+        auto len = util::socket_read_int32(fd);
+        if (!len) {
+            LOGE("Failed to read stream chunk length: %s",
+                 len.error().message().c_str());
+            return false;
+        } else if (len.value() < 0
+                || static_cast<uint32_t>(len.value()) > STREAM_MAX_CHUNK_SIZE) {
+            LOGE("Invalid stream chunk length: %d", len.value());
+            return false;
+        } else if (len.value() == 0) {
+            break;
+        }
+
+        size_t size = static_cast<size_t>(len.value());
+        auto &buf = session.stream_buffer(size);
+
+        auto n = util::socket_read(fd, buf.data(), size);
+        if (!n || n.value() != size) {
+            LOGE("Failed to read stream chunk");
+            return false;
+        }
+
+        session.add_stream_bytes(size, 0);
+
+        // After a failure, keep draining chunks so that the client and the
+        // daemon stay in sync
+        if (error_code == 0) {
+            auto w = util::socket_write(ffd, buf.data(), size);
+            if (!w) {
+                error_code = w.error().value();
+            } else {
+                bytes_written += w.value();
+            }
+        }
+    }
+
+    return v3_send_file_write_stream_response(
+            session, builder, bytes_written, error_code);
 }
 
-static bool v3_path_chmod(int fd, const v3::Request *msg)
+static bool v3_path_chmod(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathChmodRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     // Don't allow setting setuid or setgid permissions
     mode_t mode = static_cast<mode_t>(request->mode());
     mode_t masked = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
     if (masked != mode) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     fb::FlatBufferBuilder builder;
@@ -492,103 +1321,124 @@ static bool v3_path_chmod(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_PathChmodResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_path_copy(int fd, const v3::Request *msg)
+static std::optional<V3Work> v3_path_copy_work(const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathCopyRequest *>(msg->request());
     if (!request->source() || !request->target()) {
-        return v3_send_response_invalid(fd);
+        return std::nullopt;
     }
 
-    fb::FlatBufferBuilder builder;
-    fb::Offset<v3::PathCopyError> error;
+    return V3Work{[source = request->source()->str(),
+                   target = request->target()->str()](
+            fb::FlatBufferBuilder &builder, util::FileOpProgress *progress) {
+        fb::Offset<v3::PathCopyError> error;
 
-    auto ret = util::copy_contents(request->source()->str(),
-                                   request->target()->str());
-    if (!ret) {
-        error = v3::CreatePathCopyErrorDirect(
-                builder, ret.error().ec.value(), ret.error().message().c_str());
-    }
+        auto ret = util::copy_contents(source, target, util::CopyFlag::Sparse,
+                                       progress);
+        if (!ret) {
+            error = v3::CreatePathCopyErrorDirect(
+                    builder, ret.error().ec.value(),
+                    ret.error().message().c_str());
+        }
 
-    auto response = v3::CreatePathCopyResponseDirect(
-            builder, !!ret, ret ? nullptr : ret.error().message().c_str(),
-            error);
+        auto response = v3::CreatePathCopyResponseDirect(
+                builder, !!ret, ret ? nullptr : ret.error().message().c_str(),
+                error);
 
-    // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathCopyResponse, response.Union()));
+        // Wrap response
+        builder.Finish(v3::CreateResponse(
+                builder, v3::ResponseType_PathCopyResponse, response.Union()));
+    }};
+}
 
-    return v3_send_response(fd, builder);
+static bool v3_path_copy(V3Session &session, const v3::Request *msg)
+{
+    return v3_run_work(session, v3_path_copy_work(msg));
 }
 
-static bool v3_path_delete(int fd, const v3::Request *msg)
+static std::optional<V3Work> v3_path_delete_work(const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathDeleteRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return std::nullopt;
     }
 
-    bool ret = true;
-    std::error_code ec;
-
     switch (request->flag()) {
     case v3::PathDeleteFlag_REMOVE:
-        if (!(ret = remove(request->path()->c_str()) == 0)) {
-            ec = ec_from_errno();
-        }
-        break;
     case v3::PathDeleteFlag_UNLINK:
-        if (!(ret = unlink(request->path()->c_str()) == 0)) {
-            ec = ec_from_errno();
-        }
-        break;
     case v3::PathDeleteFlag_RMDIR:
-        if (!(ret = rmdir(request->path()->c_str()) == 0)) {
-            ec = ec_from_errno();
-        }
-        break;
     case v3::PathDeleteFlag_RECURSIVE:
-        if (auto r = util::delete_recursive(request->path()->str()); !r) {
-            ret = false;
-            ec = r.error().ec;
-        }
         break;
     default:
-        return v3_send_response_invalid(fd);
+        return std::nullopt;
     }
 
-    fb::FlatBufferBuilder builder;
-    fb::Offset<v3::PathDeleteError> error;
+    return V3Work{[path = request->path()->str(), flag = request->flag()](
+            fb::FlatBufferBuilder &builder, util::FileOpProgress *progress) {
+        bool ret = true;
+        std::error_code ec;
 
-    if (!ret) {
-        error = v3::CreatePathDeleteErrorDirect(
-                builder, ec.value(), ec.message().c_str());
-    }
+        switch (flag) {
+        case v3::PathDeleteFlag_REMOVE:
+            if (!(ret = remove(path.c_str()) == 0)) {
+                ec = ec_from_errno();
+            }
+            break;
+        case v3::PathDeleteFlag_UNLINK:
+            if (!(ret = unlink(path.c_str()) == 0)) {
+                ec = ec_from_errno();
+            }
+            break;
+        case v3::PathDeleteFlag_RMDIR:
+            if (!(ret = rmdir(path.c_str()) == 0)) {
+                ec = ec_from_errno();
+            }
+            break;
+        case v3::PathDeleteFlag_RECURSIVE:
+            if (auto r = util::delete_recursive(path, {}, progress); !r) {
+                ret = false;
+                ec = r.error().ec;
+            }
+            break;
+        }
 
-    auto response = v3::CreatePathDeleteResponseDirect(
-            builder, ret, ret ? nullptr : ec.message().c_str(), error);
+        fb::Offset<v3::PathDeleteError> error;
 
-    // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathDeleteResponse, response.Union()));
+        if (!ret) {
+            error = v3::CreatePathDeleteErrorDirect(
+                    builder, ec.value(), ec.message().c_str());
+        }
+
+        auto response = v3::CreatePathDeleteResponseDirect(
+                builder, ret, ret ? nullptr : ec.message().c_str(), error);
+
+        // Wrap response
+        builder.Finish(v3::CreateResponse(
+                builder, v3::ResponseType_PathDeleteResponse,
+                response.Union()));
+    }};
+}
 
-    return v3_send_response(fd, builder);
+static bool v3_path_delete(V3Session &session, const v3::Request *msg)
+{
+    return v3_run_work(session, v3_path_delete_work(msg));
 }
 
-static bool v3_path_mkdir(int fd, const v3::Request *msg)
+static bool v3_path_mkdir(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathMkdirRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     // Don't allow setting setuid or setgid permissions
     mode_t mode = static_cast<mode_t>(request->mode());
     mode_t masked = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
     if (masked != mode) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     fb::FlatBufferBuilder builder;
@@ -616,14 +1466,14 @@ static bool v3_path_mkdir(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_PathMkdirResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_path_readlink(int fd, const v3::Request *msg)
+static bool v3_path_readlink(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathReadlinkRequest *>(msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     auto target = util::read_link(request->path()->str());
@@ -644,15 +1494,16 @@ static bool v3_path_readlink(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_PathReadlinkResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_path_selinux_get_label(int fd, const v3::Request *msg)
+static bool v3_path_selinux_get_label(V3Session &session,
+                                      const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathSELinuxGetLabelRequest *>(
             msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     oc::result<std::string> label = oc::success();
@@ -680,15 +1531,16 @@ static bool v3_path_selinux_get_label(int fd, const v3::Request *msg)
             builder, v3::ResponseType_PathSELinuxGetLabelResponse,
             response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
+static bool v3_path_selinux_set_label(V3Session &session,
+                                      const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathSELinuxSetLabelRequest *>(
             msg->request());
     if (!request->path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     oc::result<void> ret = oc::success();
@@ -717,132 +1569,215 @@ static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
             builder, v3::ResponseType_PathSELinuxSetLabelResponse,
             response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-class DirectorySizeGetter : public util::FtsWrapper {
+static std::optional<V3Work>
+v3_path_get_directory_size_work(const v3::Request *msg)
+{
+    auto request = static_cast<const v3::PathGetDirectorySizeRequest *>(
+            msg->request());
+    if (!request->path()) {
+        return std::nullopt;
+    }
+
+    std::vector<std::string> exclusions;
+    if (request->exclusions()) {
+        for (auto const *exclusion : *request->exclusions()) {
+            exclusions.push_back(exclusion->str());
+        }
+    }
+
+    return V3Work{[path = request->path()->str(),
+                   exclusions = std::move(exclusions)](
+            fb::FlatBufferBuilder &builder, util::FileOpProgress *progress) {
+        // The cache lives for as long as the connection worker. It is only
+        // used from the connection thread, so jobs always walk the tree.
+        static DirectorySizeCache cache;
+
+        auto size = [&]() -> oc::result<uint64_t> {
+            if (!progress) {
+                return cache.get(path, exclusions);
+            }
+
+            OUTCOME_TRY(stats, get_directory_stats(
+                    path, exclusions, progress));
+            return stats.size;
+        }();
+
+        fb::Offset<v3::PathGetDirectorySizeError> error;
+        std::string error_msg;
+
+        if (!size) {
+            error_msg = size.error().message();
+            error = v3::CreatePathGetDirectorySizeErrorDirect(
+                    builder, size.error().value(), error_msg.c_str());
+        }
+
+        auto response = v3::CreatePathGetDirectorySizeResponseDirect(
+                builder, !!size, size ? nullptr : error_msg.c_str(),
+                size ? size.value() : 0, error);
+
+        // Wrap response
+        builder.Finish(v3::CreateResponse(
+                builder, v3::ResponseType_PathGetDirectorySizeResponse,
+                response.Union()));
+    }};
+}
+
+static bool v3_path_get_directory_size(V3Session &session,
+                                       const v3::Request *msg)
+{
+    return v3_run_work(session, v3_path_get_directory_size_work(msg));
+}
+
+// Output from signed binaries is sent in batches of lines. A batch is sent
+// once it reaches the size limit or when the interval has passed since the
+// previous batch.
+static constexpr size_t SIGNED_EXEC_OUTPUT_MAX_SIZE = 32 * 1024;
+static constexpr std::chrono::milliseconds SIGNED_EXEC_OUTPUT_INTERVAL(50);
+
+class SignedExecOutput
+{
 public:
-    DirectorySizeGetter(std::string path, std::vector<std::string> exclusions)
-        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
-        , _exclusions(std::move(exclusions))
-        , _total(0)
+    explicit SignedExecOutput(V3Session &session)
+        : m_session(session)
+        , m_last_sent(std::chrono::steady_clock::now())
     {
     }
 
-    Actions on_changed_path() override
+    void add_line(std::string_view line)
     {
-        // Exclude first-level directories
-        if (_curr->fts_level == 1) {
-            if (std::find(_exclusions.begin(), _exclusions.end(), _curr->fts_name)
-                    != _exclusions.end()) {
-                return Action::Skip;
-            }
+        // Don't let a single batch grow past the limit
+        if (m_buf.size() + line.size() > SIGNED_EXEC_OUTPUT_MAX_SIZE) {
+            flush();
         }
 
-        return Action::Ok;
+        m_buf += line;
+
+        if (m_buf.size() >= SIGNED_EXEC_OUTPUT_MAX_SIZE
+                || std::chrono::steady_clock::now() - m_last_sent
+                        >= SIGNED_EXEC_OUTPUT_INTERVAL) {
+            flush();
+        }
     }
 
-    Actions on_reached_file() override
+    void flush()
     {
-        dev_t dev = static_cast<dev_t>(_curr->fts_statp->st_dev);
-        ino_t ino = static_cast<ino_t>(_curr->fts_statp->st_ino);
-
-        // If this file has been visited before (hard link), then skip it
-        if (_links.find(dev) != _links.end()
-                && _links[dev].find(ino) != _links[dev].end()) {
-            return Action::Ok;
+        if (m_buf.empty()) {
+            return;
         }
 
-        _total += static_cast<uint64_t>(_curr->fts_statp->st_size);
-        _links[dev].emplace(ino);
+        m_builder.Clear();
+        auto line_id = m_builder.CreateString(m_buf);
 
-        return Action::Ok;
-    }
+        // Create response
+        auto response = v3::CreateSignedExecOutputResponse(m_builder, line_id);
+
+        // Wrap response
+        m_builder.Finish(v3::CreateResponse(
+                m_builder, v3::ResponseType_SignedExecOutputResponse,
+                response.Union()));
 
-    uint64_t total() const {
-        return _total;
+        if (!v3_send_response(m_session, m_builder)) {
+            // Can't kill the connection from here (yet...)
+            LOGE("Failed to send output: %s", strerror(errno));
+        }
+
+        m_buf.clear();
+        m_last_sent = std::chrono::steady_clock::now();
     }
 
 private:
-    std::vector<std::string> _exclusions;
-    std::unordered_map<dev_t, std::unordered_set<ino_t>> _links;
-    uint64_t _total;
+    V3Session &m_session;
+    fb::FlatBufferBuilder m_builder;
+    std::string m_buf;
+    std::chrono::steady_clock::time_point m_last_sent;
 };
 
-static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
+/*!
+ * \brief Run a command and send its output in batches
+ *
+ * \return Same as util::run_command()
+ */
+static int signed_exec_run(V3Session &session, const std::string &path,
+                           const std::vector<std::string> &argv)
 {
-    auto request = static_cast<const v3::PathGetDirectorySizeRequest *>(
-            msg->request());
-    if (!request->path()) {
-        return v3_send_response_invalid(fd);
-    }
+    util::CommandCtx ctx;
+    ctx.path = path;
+    ctx.argv = argv;
+    ctx.redirect_stdio = true;
 
-    std::vector<std::string> exclusions;
-    if (request->exclusions()) {
-        for (auto const *exclusion : *request->exclusions()) {
-            exclusions.push_back(exclusion->str());
-        }
+    if (!util::command_start(ctx)) {
+        return -1;
     }
 
-    DirectorySizeGetter dsg(request->path()->str(), std::move(exclusions));
-    bool ret = dsg.run();
-    int saved_errno = errno;
+    SignedExecOutput output(session);
 
-    fb::FlatBufferBuilder builder;
-    fb::Offset<v3::PathGetDirectorySizeError> error;
-
-    if (!ret) {
-        error = v3::CreatePathGetDirectorySizeErrorDirect(
-                builder, saved_errno, strerror(saved_errno));
-    }
-
-    auto response = v3::CreatePathGetDirectorySizeResponseDirect(
-            builder, ret, ret ? nullptr : strerror(saved_errno), dsg.total(),
-            error);
+    util::command_line_reader(ctx, [&](std::string_view line, bool error) {
+        (void) error;
+        output.add_line(line);
+    }, static_cast<int>(SIGNED_EXEC_OUTPUT_INTERVAL.count()), [&] {
+        output.flush();
+    });
 
-    // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_PathGetDirectorySizeResponse,
-            response.Union()));
+    output.flush();
 
-    return v3_send_response(fd, builder);
+    return util::command_wait(ctx);
 }
 
-static void signed_exec_output_cb(int fd, std::string_view line)
+
+/*!
+ * \brief Mount a private tmpfs for the binary to execute
+ *
+ * This is only used on kernels without memfd support.
+ */
+static bool signed_exec_mount_tmpfs(const char *temp_dir,
+                                    std::string &error_msg)
 {
-    fb::FlatBufferBuilder builder;
-    auto line_id = builder.CreateString(line.data(), line.size());
+    if (mount("", "/", "", MS_REMOUNT, "") < 0) {
+        error_msg = format("Failed to remount / as rw: %s", strerror(errno));
+        return false;
+    }
 
-    // Create response
-    auto response = v3::CreateSignedExecOutputResponse(builder, line_id);
+    if ((mkdir(temp_dir, 0000) < 0 && errno != EEXIST)
+            || chmod(temp_dir, 0000) < 0) {
+        error_msg = format("Failed to create temp directory: %s",
+                           strerror(errno));
+        return false;
+    }
 
-    // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_SignedExecOutputResponse,
-            response.Union()));
+    if (mount("", "/", "", MS_REMOUNT | MS_RDONLY, "") < 0) {
+        LOGW("Failed to remount / as ro: %s", strerror(errno));
+    }
 
-    if (!v3_send_response(fd, builder)) {
-        // Can't kill the connection from this callback (yet...)
-        LOGE("Failed to send output line: %s", strerror(errno));
+    if (mount("tmpfs", temp_dir, "tmpfs", 0, "mode=000,uid=0,gid=0") < 0) {
+        error_msg = format("Failed to mount tmpfs at temp directory: %s",
+                           strerror(errno));
+        return false;
     }
+
+    return true;
 }
 
-static bool v3_signed_exec(int fd, const v3::Request *msg)
+static bool v3_signed_exec(V3Session &session, const v3::Request *msg)
 {
-    using namespace std::placeholders;
-
     auto request = static_cast<const v3::SignedExecRequest *>(msg->request());
     if (!request->binary_path() || !request->signature_path()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     static const char *temp_dir = "/mbtool_exec_tmp";
 
     std::string target_binary;
-    std::string target_sig;
     std::vector<std::string> argv;
     int status;
+    int source_fd = -1;
+    int sig_fd = -1;
+    int target_fd = -1;
+    std::optional<SigFileId> source_id;
     SigVerifyResult sig_result;
+    bool use_memfd = false;
     bool mounted_tmpfs = false;
     // Variables that are part of the response
     v3::SignedExecResult result = v3::SignedExecResult_OTHER_ERROR;
@@ -850,11 +1785,6 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
     int exit_status = -1;
     int term_sig = -1;
 
-    target_binary = temp_dir;
-    target_binary += "/binary";
-    target_sig = temp_dir;
-    target_sig += "/binary.sig";
-
     // Unmount tmpfs when we're done
     auto unmount_tmpfs = finally([&]{
         if (mounted_tmpfs) {
@@ -862,57 +1792,106 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
         }
     });
 
-    if (mount("", "/", "", MS_REMOUNT, "") < 0) {
+    auto close_fds = finally([&]{
+        for (int fd : { source_fd, sig_fd, target_fd }) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    });
+
+    // Prefer a sealed memfd, which never touches the filesystem and can't be
+    // modified after it is verified. The binary is executed through its
+    // /proc/self/fd link.
+    target_fd = create_memfd("mbtool-signed-exec");
+    if (target_fd >= 0) {
+        use_memfd = true;
+        target_binary = format("/proc/self/fd/%d", target_fd);
+    } else if (errno != ENOSYS) {
         result = v3::SignedExecResult_OTHER_ERROR;
-        error_msg = format("Failed to remount / as rw: %s", strerror(errno));
+        error_msg = format("Failed to create memfd: %s", strerror(errno));
         LOGE("%s", error_msg.c_str());
         goto done;
-    }
-
-    if ((mkdir(temp_dir, 0000) < 0 && errno != EEXIST)
-            || chmod(temp_dir, 0000) < 0) {
+    } else if (!signed_exec_mount_tmpfs(temp_dir, error_msg)) {
         result = v3::SignedExecResult_OTHER_ERROR;
-        error_msg = format("Failed to create temp directory: %s",
-                           strerror(errno));
         LOGE("%s", error_msg.c_str());
         goto done;
+    } else {
+        mounted_tmpfs = true;
+        target_binary = temp_dir;
+        target_binary += "/binary";
     }
 
-    if (mount("", "/", "", MS_REMOUNT | MS_RDONLY, "") < 0) {
-        LOGW("Failed to remount / as ro: %s", strerror(errno));
+    // The binary and signature are only opened once so that replacing the
+    // files while this request is being handled has no effect
+    source_fd = open(request->binary_path()->c_str(), O_RDONLY | O_CLOEXEC);
+    if (source_fd < 0) {
+        result = v3::SignedExecResult_OTHER_ERROR;
+        error_msg = format("%s: Failed to open binary: %s",
+                           request->binary_path()->c_str(), strerror(errno));
+        LOGE("%s", error_msg.c_str());
+        goto done;
     }
 
-    if (mount("tmpfs", temp_dir, "tmpfs", 0, "mode=000,uid=0,gid=0") < 0) {
+    sig_fd = open(request->signature_path()->c_str(), O_RDONLY | O_CLOEXEC);
+    if (sig_fd < 0) {
         result = v3::SignedExecResult_OTHER_ERROR;
-        error_msg = format("Failed to mount tmpfs at temp directory: %s",
+        error_msg = format("%s: Failed to open signature: %s",
+                           request->signature_path()->c_str(),
                            strerror(errno));
         LOGE("%s", error_msg.c_str());
         goto done;
     }
-    mounted_tmpfs = true;
 
-    // Copy binary to tmpfs
-    if (auto r = util::copy_file(
-            request->binary_path()->str(), target_binary, 0); !r) {
+    source_id = sig_file_id(source_fd);
+
+    // Copy binary to the memfd or tmpfs
+    if (!use_memfd) {
+        target_fd = open(target_binary.c_str(),
+                         O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0000);
+        if (target_fd < 0) {
+            result = v3::SignedExecResult_OTHER_ERROR;
+            error_msg = format("Failed to create binary in tmpfs: %s",
+                               strerror(errno));
+            LOGE("%s", error_msg.c_str());
+            goto done;
+        }
+    }
+
+    if (auto r = util::copy_data_fd(source_fd, target_fd); !r) {
         result = v3::SignedExecResult_OTHER_ERROR;
-        error_msg = format("Failed to copy binary to tmpfs: %s",
+        error_msg = format("Failed to copy binary: %s",
                            r.error().message().c_str());
         LOGE("%s", error_msg.c_str());
         goto done;
     }
 
-    // Copy signature to tmpfs
-    if (auto r = util::copy_file(
-            request->signature_path()->str(), target_sig, 0); !r) {
+    if (use_memfd && fcntl(target_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW
+            | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
         result = v3::SignedExecResult_OTHER_ERROR;
-        error_msg = format("Failed to copy signature to tmpfs: %s",
-                           r.error().message().c_str());
+        error_msg = format("Failed to seal memfd: %s", strerror(errno));
         LOGE("%s", error_msg.c_str());
         goto done;
     }
 
+    // A previous verification of the original binary only applies to the copy
+    // if the binary did not change while it was being copied
+    if (source_id && sig_file_id(source_fd) != source_id) {
+        source_id = std::nullopt;
+    }
+
     // Verify signature
-    sig_result = verify_signature(target_binary.c_str(), target_sig.c_str());
+    sig_result = verify_signature_fd(target_fd, sig_fd,
+                                     request->binary_path()->c_str(),
+                                     source_id);
+
+    // The binary can't be executed while it is open for writing. The memfd
+    // must stay open since it has no other references, but it is sealed.
+    if (!use_memfd) {
+        close(target_fd);
+        target_fd = -1;
+    }
+
     if (sig_result != SigVerifyResult::Valid) {
         if (sig_result == SigVerifyResult::Invalid) {
             result = v3::SignedExecResult_INVALID_SIGNATURE;
@@ -929,7 +1908,7 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
     }
 
     // Make binary executable
-    if (chmod(target_binary.c_str(), 0700) < 0) {
+    if (!use_memfd && chmod(target_binary.c_str(), 0700) < 0) {
         result = v3::SignedExecResult_OTHER_ERROR;
         error_msg = format("Failed to chmod binary in tmpfs: %s",
                            strerror(errno));
@@ -955,8 +1934,7 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
     // TODO: Update libmbutil's command.cpp so the callback can return a bool
     //       Right now, if the connection is broken, the command will continue
     //       executing.
-    status = util::run_command(target_binary, argv, {}, {},
-                               std::bind(&signed_exec_output_cb, fd, _1));
+    status = signed_exec_run(session, target_binary, argv);
     if (status >= 0 && WIFEXITED(status)) {
         result = v3::SignedExecResult_PROCESS_EXITED;
         exit_status = WEXITSTATUS(status);
@@ -988,16 +1966,83 @@ done:
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_SignedExecResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
+}
+
+/*!
+ * \brief Create the shared buffer for the connection
+ *
+ * The memfd is sealed against resizing so that the client can't truncate it
+ * and crash the daemon with SIGBUS while it writes to the mapping.
+ */
+static bool v3_shared_buffer_setup(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::SharedBufferSetupRequest *>(
+            msg->request());
+
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = request->size() == 0
+            ? SHARED_BUFFER_DEFAULT_SIZE
+            : std::min(request->size(), SHARED_BUFFER_MAX_SIZE);
+    size = (size + page_size - 1) / page_size * page_size;
+
+    fb::FlatBufferBuilder builder;
+    fb::Offset<v3::SharedBufferError> error;
+    void *data = MAP_FAILED;
+    int saved_errno = 0;
+
+    int memfd = create_memfd("mbtool-shared-buffer");
+
+    auto close_memfd = finally([&] {
+        if (memfd >= 0) {
+            close(memfd);
+        }
+    });
+
+    if (memfd < 0
+            || ftruncate(memfd, static_cast<off_t>(size)) < 0
+            || fcntl(memfd, F_ADD_SEALS,
+                     F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0
+            || (data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            memfd, 0)) == MAP_FAILED) {
+        saved_errno = errno;
+        LOGE("Failed to create shared buffer: %s", strerror(saved_errno));
+        error = v3::CreateSharedBufferErrorDirect(
+                builder, saved_errno, strerror(saved_errno));
+    } else {
+        session.set_shared_buffer(static_cast<unsigned char *>(data), size);
+    }
+
+    auto response = v3::CreateSharedBufferSetupResponse(
+            builder, saved_errno == 0 ? static_cast<uint32_t>(size) : 0, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_SharedBufferSetupResponse,
+            response.Union()));
+
+    if (!v3_send_response(session, builder)) {
+        return false;
+    } else if (saved_errno != 0) {
+        return true;
+    }
+
+    if (auto r = util::socket_send_fds(session.fd(), {memfd}); !r) {
+        LOGE("Failed to send shared buffer fd: %s",
+             r.error().message().c_str());
+        return false;
+    }
+
+    return true;
 }
 
-static bool v3_mb_get_booted_rom_id(int fd, const v3::Request *msg)
+static bool v3_mb_get_booted_rom_id(V3Session &session, const v3::Request *msg)
 {
     (void) msg;
 
     fb::FlatBufferBuilder builder;
     fb::Offset<fb::String> id;
-    auto rom = Roms::get_current_rom();
+    auto rom = daemon_state().current_rom();
     if (rom) {
         id = builder.CreateString(rom->id);
     }
@@ -1010,68 +2055,30 @@ static bool v3_mb_get_booted_rom_id(int fd, const v3::Request *msg)
             builder, v3::ResponseType_MbGetBootedRomIdResponse,
             response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
+static bool v3_mb_get_installed_roms(V3Session &session, const v3::Request *msg)
 {
     (void) msg;
 
     fb::FlatBufferBuilder builder;
 
-    Roms roms;
-    roms.add_installed();
-
     std::vector<fb::Offset<v3::MbRom>> fb_roms;
 
-    for (auto r : roms.roms) {
-        std::string system_path = r->full_system_path();
-        std::string cache_path = r->full_cache_path();
-        std::string data_path = r->full_data_path();
-
-        auto fb_id = builder.CreateString(r->id);
-        auto fb_system_path = builder.CreateString(system_path);
-        auto fb_cache_path = builder.CreateString(cache_path);
-        auto fb_data_path = builder.CreateString(data_path);
+    for (auto const &entry : daemon_state().installed_roms()) {
+        auto fb_id = builder.CreateString(entry.rom->id);
+        auto fb_system_path = builder.CreateString(entry.system_path);
+        auto fb_cache_path = builder.CreateString(entry.cache_path);
+        auto fb_data_path = builder.CreateString(entry.data_path);
         fb::Offset<fb::String> fb_version;
         fb::Offset<fb::String> fb_build;
 
-        std::string build_prop;
-        if (r->system_is_image) {
-            build_prop += "/raw/images/";
-            build_prop += r->id;
-        } else {
-            build_prop += system_path;
+        if (!entry.version.empty()) {
+            fb_version = builder.CreateString(entry.version);
         }
-        build_prop += "/build.prop";
-
-        struct {
-            const char *key;
-            fb::Offset<fb::String> &offset;
-        } needed_props[] = {
-            { "ro.build.version.release", fb_version },
-            { "ro.build.display.id", fb_build },
-        };
-
-        RomConfig config;
-        config.load_file(r->config_path());
-        auto &props = config.cached_props;
-
-        util::property_file_iter(build_prop, {}, [&](std::string_view key,
-                                                     std::string_view value) {
-            for (auto const &item : needed_props) {
-                if (item.key == key) {
-                    props.insert_or_assign(std::string(key), std::string(value));
-                }
-            }
-
-            return util::PropertyIterAction::Continue;
-        });
-
-        for (auto const &item : needed_props) {
-            if (auto it = props.find(item.key); it != props.end()) {
-                item.offset = builder.CreateString(it->second);
-            }
+        if (!entry.build.empty()) {
+            fb_build = builder.CreateString(entry.build);
         }
 
         v3::MbRomBuilder mrb(builder);
@@ -1095,10 +2102,10 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
             builder, v3::ResponseType_MbGetInstalledRomsResponse,
             response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_mb_get_version(int fd, const v3::Request *msg)
+static bool v3_mb_get_version(V3Session &session, const v3::Request *msg)
 {
     (void) msg;
 
@@ -1111,14 +2118,44 @@ static bool v3_mb_get_version(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_MbGetVersionResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
+}
+
+static bool v3_mb_get_stats(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::MbGetStatsRequest *>(
+            msg->request());
+
+    fb::FlatBufferBuilder builder;
+
+    auto stats = daemon_stats_snapshot();
+    if (request->reset()) {
+        daemon_stats_reset();
+    }
+
+    std::vector<fb::Offset<v3::MbRequestStats>> fb_stats;
+    fb_stats.reserve(stats.size());
+
+    for (auto const &s : stats) {
+        fb_stats.push_back(v3::CreateMbRequestStats(
+                builder, s.type, s.count, s.bytes_in, s.bytes_out,
+                s.total_us, s.max_us, s.p50_us, s.p90_us, s.p99_us));
+    }
+
+    auto response = v3::CreateMbGetStatsResponseDirect(builder, &fb_stats);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_MbGetStatsResponse, response.Union()));
+
+    return v3_send_response(session, builder);
 }
 
-static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
+static bool v3_mb_set_kernel(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::MbSetKernelRequest *>(msg->request());
     if (!request->rom_id() || !request->boot_blockdev()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     fb::FlatBufferBuilder builder;
@@ -1127,6 +2164,8 @@ static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
     bool ret = set_kernel(request->rom_id()->str(),
                           request->boot_blockdev()->str());
 
+    daemon_state().invalidate();
+
     if (!ret) {
         error = v3::CreateMbSetKernelError(builder);
     }
@@ -1138,14 +2177,14 @@ static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_MbSetKernelResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
+static std::optional<V3Work> v3_mb_switch_rom_work(const v3::Request *msg)
 {
     auto request = static_cast<const v3::MbSwitchRomRequest *>(msg->request());
     if (!request->rom_id() || !request->boot_blockdev()) {
-        return v3_send_response_invalid(fd);
+        return std::nullopt;
     }
 
     std::vector<std::string> block_dev_dirs;
@@ -1156,137 +2195,239 @@ static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
         }
     }
 
-    bool force_update_checksums = request->force_update_checksums();
-
-    fb::FlatBufferBuilder builder;
-    fb::Offset<v3::MbSwitchRomError> error;
-
-    SwitchRomResult ret = switch_rom(request->rom_id()->str(),
-                                     request->boot_blockdev()->str(),
-                                     block_dev_dirs,
-                                     force_update_checksums);
-
-    bool success = ret == SwitchRomResult::Succeeded;
-    v3::MbSwitchRomResult fb_ret = v3::MbSwitchRomResult_FAILED;
-    switch (ret) {
-    case SwitchRomResult::Succeeded:
-        fb_ret = v3::MbSwitchRomResult_SUCCEEDED;
-        break;
-    case SwitchRomResult::Failed:
-        fb_ret = v3::MbSwitchRomResult_FAILED;
-        break;
-    case SwitchRomResult::ChecksumNotFound:
-        fb_ret = v3::MbSwitchRomResult_CHECKSUM_NOT_FOUND;
-        break;
-    case SwitchRomResult::ChecksumInvalid:
-        fb_ret = v3::MbSwitchRomResult_CHECKSUM_INVALID;
-        break;
-    }
+    // Switching can't be interrupted safely once the boot image is written
+    return V3Work{[rom_id = request->rom_id()->str(),
+                   boot_blockdev = request->boot_blockdev()->str(),
+                   block_dev_dirs = std::move(block_dev_dirs),
+                   force_update_checksums = request->force_update_checksums()](
+            fb::FlatBufferBuilder &builder, util::FileOpProgress *progress) {
+        (void) progress;
+
+        fb::Offset<v3::MbSwitchRomError> error;
+
+        SwitchRomResult ret = switch_rom(rom_id, boot_blockdev,
+                                         block_dev_dirs,
+                                         force_update_checksums);
+
+        bool success = ret == SwitchRomResult::Succeeded;
+        v3::MbSwitchRomResult fb_ret = v3::MbSwitchRomResult_FAILED;
+        switch (ret) {
+        case SwitchRomResult::Succeeded:
+            fb_ret = v3::MbSwitchRomResult_SUCCEEDED;
+            break;
+        case SwitchRomResult::Failed:
+            fb_ret = v3::MbSwitchRomResult_FAILED;
+            break;
+        case SwitchRomResult::ChecksumNotFound:
+            fb_ret = v3::MbSwitchRomResult_CHECKSUM_NOT_FOUND;
+            break;
+        case SwitchRomResult::ChecksumInvalid:
+            fb_ret = v3::MbSwitchRomResult_CHECKSUM_INVALID;
+            break;
+        }
 
-    if (!success) {
-        error = v3::CreateMbSwitchRomError(builder);
-    }
+        if (!success) {
+            error = v3::CreateMbSwitchRomError(builder);
+        }
 
-    // Create response
-    auto response = v3::CreateMbSwitchRomResponse(
-            builder, success, fb_ret, error);
+        // Create response
+        auto response = v3::CreateMbSwitchRomResponse(
+                builder, success, fb_ret, error);
 
-    // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbSwitchRomResponse, response.Union()));
+        // Wrap response
+        builder.Finish(v3::CreateResponse(
+                builder, v3::ResponseType_MbSwitchRomResponse,
+                response.Union()));
+    }, true, false};
+}
 
-    return v3_send_response(fd, builder);
+static bool v3_mb_switch_rom(V3Session &session, const v3::Request *msg)
+{
+    return v3_run_work(session, v3_mb_switch_rom_work(msg));
 }
 
-static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
+static std::optional<V3Work> v3_mb_wipe_rom_work(const v3::Request *msg)
 {
     auto request = static_cast<const v3::MbWipeRomRequest *>(msg->request());
     if (!request->rom_id()) {
-        return v3_send_response_invalid(fd);
+        return std::nullopt;
     }
 
     // Find and verify ROM is installed
-    Roms roms;
-    roms.add_installed();
-
-    auto rom = roms.find_by_id(request->rom_id()->str());
+    auto rom = daemon_state().find_installed_rom(request->rom_id()->str());
     if (!rom) {
         LOGE("Tried to wipe non-installed or invalid ROM ID: %s",
              request->rom_id()->c_str());
-        return v3_send_response_invalid(fd);
+        return std::nullopt;
     }
 
     // The GUI should check this, but we'll enforce it here
-    auto current_rom = Roms::get_current_rom();
+    auto current_rom = daemon_state().current_rom();
     if (current_rom && current_rom->id == rom->id) {
         LOGE("Cannot wipe currently booted ROM: %s", rom->id.c_str());
-        return v3_send_response_invalid(fd);
+        return std::nullopt;
     }
 
-    // Wipe the selected targets
-    std::vector<int16_t> succeeded;
-    std::vector<int16_t> failed;
+    std::vector<int16_t> targets;
 
     if (request->targets()) {
-        std::string raw_system = get_raw_path("/system");
-        if (mount("", raw_system.c_str(), "", MS_REMOUNT, "") < 0) {
-            LOGW("Failed to mount %s as writable: %s",
-                 raw_system.c_str(), strerror(errno));
-        }
+        targets.assign(request->targets()->begin(), request->targets()->end());
+    }
 
-        for (short target : *request->targets()) {
-            bool success = false;
-
-            if (target == v3::MbWipeTarget_SYSTEM) {
-                success = wipe_system(rom);
-            } else if (target == v3::MbWipeTarget_CACHE) {
-                success = wipe_cache(rom);
-            } else if (target == v3::MbWipeTarget_DATA) {
-                success = wipe_data(rom);
-            } else if (target == v3::MbWipeTarget_DALVIK_CACHE) {
-                success = wipe_dalvik_cache(rom);
-            } else if (target == v3::MbWipeTarget_MULTIBOOT) {
-                success = wipe_multiboot(rom);
-            } else {
-                LOGE("Unknown wipe target %d", target);
+    return V3Work{[rom = std::move(rom), targets = std::move(targets)](
+            fb::FlatBufferBuilder &builder, util::FileOpProgress *progress) {
+        // Wipe the selected targets
+        std::vector<int16_t> succeeded;
+        std::vector<int16_t> failed;
+
+        if (!targets.empty()) {
+            std::string raw_system = get_raw_path("/system");
+            if (mount("", raw_system.c_str(), "", MS_REMOUNT, "") < 0) {
+                LOGW("Failed to mount %s as writable: %s",
+                     raw_system.c_str(), strerror(errno));
             }
 
-            if (success) {
-                succeeded.push_back(target);
-            } else {
-                failed.push_back(target);
+            auto wipe_target = [&](int16_t target) {
+                if (target == v3::MbWipeTarget_SYSTEM) {
+                    return wipe_system(rom, progress);
+                } else if (target == v3::MbWipeTarget_CACHE) {
+                    return wipe_cache(rom, progress);
+                } else if (target == v3::MbWipeTarget_DATA) {
+                    return wipe_data(rom, progress);
+                } else if (target == v3::MbWipeTarget_DALVIK_CACHE) {
+                    return wipe_dalvik_cache(rom, progress);
+                } else if (target == v3::MbWipeTarget_MULTIBOOT) {
+                    return wipe_multiboot(rom, progress);
+                } else {
+                    LOGE("Unknown wipe target %d", target);
+                    return false;
+                }
+            };
+
+            // The targets are independent, so wipe them concurrently. The
+            // exception is the dalvik-cache, which lives inside the cache and
+            // data directories and is wiped afterwards. Duplicate targets are
+            // only wiped once.
+            std::unordered_map<int16_t, bool> results;
+            std::vector<std::thread> threads;
+
+            for (auto target : targets) {
+                if (target != v3::MbWipeTarget_DALVIK_CACHE) {
+                    results.emplace(target, false);
+                }
+            }
+
+            threads.reserve(results.size());
+
+            for (auto &[target, success] : results) {
+                threads.emplace_back([&, t = target, s = &success] {
+                    *s = wipe_target(t);
+                });
+            }
+
+            for (auto &t : threads) {
+                t.join();
+            }
+
+            for (auto target : targets) {
+                if (target == v3::MbWipeTarget_DALVIK_CACHE
+                        && results.find(target) == results.end()) {
+                    results.emplace(target, wipe_target(target));
+                }
+
+                if (results[target]) {
+                    succeeded.push_back(target);
+                } else {
+                    failed.push_back(target);
+                }
             }
         }
+
+        // Create response
+        auto response = v3::CreateMbWipeRomResponseDirect(
+                builder, &succeeded, &failed);
+
+        // Wrap response
+        builder.Finish(v3::CreateResponse(
+                builder, v3::ResponseType_MbWipeRomResponse,
+                response.Union()));
+    }, true};
+}
+
+static bool v3_mb_wipe_rom(V3Session &session, const v3::Request *msg)
+{
+    return v3_run_work(session, v3_mb_wipe_rom_work(msg));
+}
+
+static bool v3_mb_clone_rom(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::MbCloneRomRequest *>(msg->request());
+    if (!request->source_rom_id() || !request->target_rom_id()) {
+        return v3_send_response_invalid(session);
+    }
+
+    // Find and verify source ROM is installed
+    auto source = daemon_state().find_installed_rom(
+            request->source_rom_id()->str());
+    if (!source) {
+        LOGE("Tried to clone non-installed or invalid ROM ID: %s",
+             request->source_rom_id()->c_str());
+        return v3_send_response_invalid(session);
+    }
+
+    // The target ROM does not need to be installed
+    auto target = Roms::create_rom(request->target_rom_id()->str());
+    if (!target || target->id == source->id) {
+        LOGE("Invalid clone target ROM ID: %s",
+             request->target_rom_id()->c_str());
+        return v3_send_response_invalid(session);
+    }
+
+    auto current_rom = daemon_state().current_rom();
+    if (current_rom && current_rom->id == target->id) {
+        LOGE("Cannot overwrite currently booted ROM: %s", target->id.c_str());
+        return v3_send_response_invalid(session);
+    }
+
+    std::string raw_system = get_raw_path("/system");
+    if (mount("", raw_system.c_str(), "", MS_REMOUNT, "") < 0) {
+        LOGW("Failed to mount %s as writable: %s",
+             raw_system.c_str(), strerror(errno));
     }
 
     fb::FlatBufferBuilder builder;
+    fb::Offset<v3::MbCloneRomError> error;
+
+    bool ret = clone_rom(source, target);
+
+    daemon_state().invalidate();
+
+    if (!ret) {
+        error = v3::CreateMbCloneRomError(builder);
+    }
 
     // Create response
-    auto response = v3::CreateMbWipeRomResponseDirect(
-            builder, &succeeded, &failed);
+    auto response = v3::CreateMbCloneRomResponse(builder, error);
 
     // Wrap response
     builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbWipeRomResponse, response.Union()));
+            builder, v3::ResponseType_MbCloneRomResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
+static bool v3_mb_get_packages_count(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::MbGetPackagesCountRequest *>(
             msg->request());
     if (!request->rom_id()) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     // Find and verify ROM is installed
-    Roms roms;
-    roms.add_installed();
-
-    auto rom = roms.find_by_id(request->rom_id()->str());
+    auto rom = daemon_state().find_installed_rom(request->rom_id()->str());
     if (!rom) {
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     std::string packages_xml(rom->full_data_path());
@@ -1298,11 +2439,11 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
     unsigned int update_pkgs = 0;
     unsigned int other_pkgs = 0;
 
-    Packages pkgs;
-    bool ret = pkgs.load_xml(packages_xml);
+    auto pkgs = daemon_state().packages(packages_xml);
+    bool ret = !!pkgs;
 
     if (ret) {
-        for (std::shared_ptr<Package> pkg : pkgs.pkgs) {
+        for (auto const &pkg : pkgs->pkgs) {
             bool is_system = (pkg->pkg_flags & Package::Flag::SYSTEM)
                     || (pkg->pkg_public_flags & Package::PublicFlag::SYSTEM);
             bool is_update = (pkg->pkg_flags & Package::Flag::UPDATED_SYSTEM_APP)
@@ -1328,10 +2469,10 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
             builder, v3::ResponseType_MbGetPackagesCountResponse,
             response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_reboot(int fd, const v3::Request *msg)
+static bool v3_reboot(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::RebootRequest *>(msg->request());
 
@@ -1358,7 +2499,7 @@ static bool v3_reboot(int fd, const v3::Request *msg)
         break;
     default:
         LOGE("Invalid reboot type: %d", request->type());
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     if (!ret) {
@@ -1372,10 +2513,10 @@ static bool v3_reboot(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_RebootResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
 }
 
-static bool v3_shutdown(int fd, const v3::Request *msg)
+static bool v3_shutdown(V3Session &session, const v3::Request *msg)
 {
     auto request = static_cast<const v3::ShutdownRequest *>(msg->request());
 
@@ -1397,7 +2538,7 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
         break;
     default:
         LOGE("Invalid shutdown type: %d", request->type());
-        return v3_send_response_invalid(fd);
+        return v3_send_response_invalid(session);
     }
 
     if (!ret) {
@@ -1411,10 +2552,111 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
     builder.Finish(v3::CreateResponse(
             builder, v3::ResponseType_ShutdownResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    return v3_send_response(session, builder);
+}
+
+typedef std::optional<V3Work> (*work_prepare_fn)(const v3::Request *);
+
+struct WorkMap
+{
+    v3::RequestType type;
+    work_prepare_fn fn;
+};
+
+//! Requests that can run as jobs
+static WorkMap work_map[] = {
+    { v3::RequestType_PathCopyRequest, v3_path_copy_work },
+    { v3::RequestType_PathDeleteRequest, v3_path_delete_work },
+    { v3::RequestType_PathGetDirectorySizeRequest,
+      v3_path_get_directory_size_work },
+    { v3::RequestType_MbSwitchRomRequest, v3_mb_switch_rom_work },
+    { v3::RequestType_MbWipeRomRequest, v3_mb_wipe_rom_work },
+    { v3::RequestType_NONE, nullptr }
+};
+
+/*!
+ * \brief Start running a request in the background
+ *
+ * The wrapped request is validated and prepared right away, so any request
+ * that would be rejected on its own is answered with Invalid here.
+ */
+static bool v3_job_start(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::JobStartRequest *>(msg->request());
+    auto data = request->request();
+    const v3::Request *job_request = nullptr;
+
+    if (data) {
+        auto verifier = fb::Verifier(data->Data(), data->size());
+        if (v3::VerifyRequestBuffer(verifier)) {
+            job_request = v3::GetRequest(data->Data());
+        }
+    }
+
+    if (!job_request) {
+        return v3_send_response_invalid(session);
+    }
+
+    std::optional<V3Work> work;
+
+    for (auto iter = work_map; iter->fn; ++iter) {
+        if (job_request->request_type() == iter->type) {
+            work = iter->fn(job_request);
+            break;
+        }
+    }
+
+    if (!work) {
+        return v3_send_response_invalid(session);
+    }
+
+    fb::FlatBufferBuilder builder;
+    fb::Offset<v3::JobStartError> error;
+
+    auto id = session.jobs().start(std::move(*work));
+    if (!id) {
+        error = v3::CreateJobStartErrorDirect(builder, "Too many pending jobs");
+    }
+
+    auto response = v3::CreateJobStartResponse(builder, id ? *id : 0, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_JobStartResponse, response.Union()));
+
+    return v3_send_response(session, builder);
+}
+
+static bool v3_job_cancel(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::JobCancelRequest *>(msg->request());
+
+    fb::FlatBufferBuilder builder;
+    fb::Offset<v3::JobCancelError> error;
+
+    switch (session.jobs().cancel(request->job_id())) {
+    case JobCancelResult::Cancelled:
+        break;
+    case JobCancelResult::NotFound:
+        error = v3::CreateJobCancelErrorDirect(
+                builder, "Job does not exist or has finished");
+        break;
+    case JobCancelResult::NotCancellable:
+        error = v3::CreateJobCancelErrorDirect(
+                builder, "Job cannot be cancelled once started");
+        break;
+    }
+
+    auto response = v3::CreateJobCancelResponse(builder, error);
+
+    // Wrap response
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_JobCancelResponse, response.Union()));
+
+    return v3_send_response(session, builder);
 }
 
-typedef bool (*request_handler_fn)(int, const v3::Request *);
+typedef bool (*request_handler_fn)(V3Session &, const v3::Request *);
 
 struct RequestMap
 {
@@ -1422,16 +2664,21 @@ struct RequestMap
     request_handler_fn fn;
 };
 
+static bool v3_batch(V3Session &session, const v3::Request *msg);
+
 static RequestMap request_map[] = {
     { v3::RequestType_FileChmodRequest, v3_file_chmod },
     { v3::RequestType_FileCloseRequest, v3_file_close },
     { v3::RequestType_FileOpenRequest, v3_file_open },
     { v3::RequestType_FileReadRequest, v3_file_read },
+    { v3::RequestType_FileReadSharedRequest, v3_file_read_shared },
+    { v3::RequestType_FileReadStreamRequest, v3_file_read_stream },
     { v3::RequestType_FileSeekRequest, v3_file_seek },
     { v3::RequestType_FileSELinuxGetLabelRequest, v3_file_selinux_get_label },
     { v3::RequestType_FileSELinuxSetLabelRequest, v3_file_selinux_set_label },
     { v3::RequestType_FileStatRequest, v3_file_stat },
     { v3::RequestType_FileWriteRequest, v3_file_write },
+    { v3::RequestType_FileWriteStreamRequest, v3_file_write_stream },
     { v3::RequestType_PathChmodRequest, v3_path_chmod },
     { v3::RequestType_PathCopyRequest, v3_path_copy },
     { v3::RequestType_PathDeleteRequest, v3_path_delete },
@@ -1447,23 +2694,167 @@ static RequestMap request_map[] = {
     { v3::RequestType_MbSetKernelRequest, v3_mb_set_kernel },
     { v3::RequestType_MbSwitchRomRequest, v3_mb_switch_rom },
     { v3::RequestType_MbWipeRomRequest, v3_mb_wipe_rom },
+    { v3::RequestType_MbCloneRomRequest, v3_mb_clone_rom },
     { v3::RequestType_MbGetPackagesCountRequest, v3_mb_get_packages_count },
+    { v3::RequestType_MbGetStatsRequest, v3_mb_get_stats },
     { v3::RequestType_RebootRequest, v3_reboot },
+    { v3::RequestType_SharedBufferSetupRequest, v3_shared_buffer_setup },
     { v3::RequestType_ShutdownRequest, v3_shutdown },
+    { v3::RequestType_BatchRequest, v3_batch },
+    { v3::RequestType_JobStartRequest, v3_job_start },
+    { v3::RequestType_JobCancelRequest, v3_job_cancel },
     { v3::RequestType_NONE, nullptr }
 };
 
-bool connection_version_3(int fd)
+static request_handler_fn find_request_handler(v3::RequestType type)
 {
-    std::string command;
+    for (auto iter = request_map; iter->fn; ++iter) {
+        if (type == iter->type) {
+            return iter->fn;
+        }
+    }
 
-    auto close_all_fds = finally([&]{
-        // Ensure opened fd's are closed if the connection is lost
-        for (auto &p : fd_map) {
-            close(p.second);
+    return nullptr;
+}
+
+/*!
+ * \brief Check if a response indicates that its request failed
+ *
+ * A request failed if the daemon rejected it (Invalid or Unsupported) or if
+ * the response has its error field set.
+ */
+static bool v3_response_failed(const v3::Response *response)
+{
+#define ERROR_RESPONSE(TYPE) \
+    case v3::ResponseType_ ## TYPE: \
+        return static_cast<const v3::TYPE *>(response->response())->error();
+
+    switch (response->response_type()) {
+    case v3::ResponseType_Invalid:
+    case v3::ResponseType_Unsupported:
+        return true;
+    ERROR_RESPONSE(FileChmodResponse)
+    ERROR_RESPONSE(FileCloseResponse)
+    ERROR_RESPONSE(FileOpenResponse)
+    ERROR_RESPONSE(FileReadResponse)
+    ERROR_RESPONSE(FileReadSharedResponse)
+    ERROR_RESPONSE(FileSeekResponse)
+    ERROR_RESPONSE(FileStatResponse)
+    ERROR_RESPONSE(FileWriteResponse)
+    ERROR_RESPONSE(FileSELinuxGetLabelResponse)
+    ERROR_RESPONSE(FileSELinuxSetLabelResponse)
+    ERROR_RESPONSE(PathChmodResponse)
+    ERROR_RESPONSE(PathCopyResponse)
+    ERROR_RESPONSE(PathDeleteResponse)
+    ERROR_RESPONSE(PathMkdirResponse)
+    ERROR_RESPONSE(PathReadlinkResponse)
+    ERROR_RESPONSE(PathSELinuxGetLabelResponse)
+    ERROR_RESPONSE(PathSELinuxSetLabelResponse)
+    ERROR_RESPONSE(PathGetDirectorySizeResponse)
+    ERROR_RESPONSE(MbCloneRomResponse)
+    ERROR_RESPONSE(MbSetKernelResponse)
+    ERROR_RESPONSE(MbSwitchRomResponse)
+    ERROR_RESPONSE(MbGetPackagesCountResponse)
+    ERROR_RESPONSE(RebootResponse)
+    ERROR_RESPONSE(SharedBufferSetupResponse)
+    ERROR_RESPONSE(ShutdownResponse)
+    ERROR_RESPONSE(JobStartResponse)
+    ERROR_RESPONSE(JobCancelResponse)
+    default:
+        return false;
+    }
+
+#undef ERROR_RESPONSE
+}
+
+/*!
+ * \brief Process a batch of requests in one round trip
+ *
+ * Each item is dispatched through the normal request handlers with the
+ * session capturing the responses instead of writing them to the socket.
+ * Requests that write to the socket on their own (signed exec output,
+ * streaming transfers and shared buffer setup) and nested batches are answered
+ * with Invalid.
+ */
+static bool v3_batch(V3Session &session, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::BatchRequest *>(msg->request());
+    std::vector<std::vector<uint8_t>> responses;
+    bool ret = true;
+
+    session.set_captured_responses(&responses);
+
+    if (auto items = request->requests()) {
+        for (auto const *item : *items) {
+            auto data = item->request();
+            const v3::Request *sub_request = nullptr;
+
+            if (data) {
+                auto verifier = fb::Verifier(data->Data(), data->size());
+                if (v3::VerifyRequestBuffer(verifier)) {
+                    sub_request = v3::GetRequest(data->Data());
+                }
+            }
+
+            if (!sub_request) {
+                ret = v3_send_response_invalid(session);
+            } else {
+                switch (sub_request->request_type()) {
+                case v3::RequestType_BatchRequest:
+                case v3::RequestType_FileReadStreamRequest:
+                case v3::RequestType_FileWriteStreamRequest:
+                case v3::RequestType_SharedBufferSetupRequest:
+                case v3::RequestType_SignedExecRequest:
+                    ret = v3_send_response_invalid(session);
+                    break;
+                default:
+                    if (auto fn = find_request_handler(
+                            sub_request->request_type())) {
+                        ret = fn(session, sub_request);
+                    } else {
+                        ret = v3_send_response_unsupported(session);
+                    }
+                    break;
+                }
+            }
+
+            if (!ret) {
+                break;
+            }
+
+            if (request->stop_on_failure() && v3_response_failed(
+                    v3::GetResponse(responses.back().data()))) {
+                break;
+            }
         }
-        fd_map.clear();
-    });
+    }
+
+    session.set_captured_responses(nullptr);
+
+    if (!ret) {
+        return false;
+    }
+
+    fb::FlatBufferBuilder builder;
+    std::vector<fb::Offset<v3::BatchResponseItem>> response_items;
+    response_items.reserve(responses.size());
+
+    for (auto const &r : responses) {
+        response_items.push_back(
+                v3::CreateBatchResponseItemDirect(builder, &r));
+    }
+
+    auto response = v3::CreateBatchResponseDirect(builder, &response_items);
+
+    builder.Finish(v3::CreateResponse(
+            builder, v3::ResponseType_BatchResponse, response.Union()));
+
+    return v3_send_response(session, builder);
+}
+
+bool connection_version_3(int fd)
+{
+    V3Session session(fd);
 
     while (1) {
         auto data = util::socket_read_bytes(fd);
@@ -1480,26 +2871,41 @@ bool connection_version_3(int fd)
 
         const v3::Request *request = v3::GetRequest(data.value().data());
         v3::RequestType type = request->request_type();
-        request_handler_fn fn = nullptr;
+        request_handler_fn fn = find_request_handler(type);
 
-        for (auto iter = request_map; iter->fn; ++iter) {
-            if (type == iter->type) {
-                fn = iter->fn;
-                break;
-            }
+        // Pick up changes made by jobs that finished in the meantime
+        if (session.jobs().take_state_changed()) {
+            daemon_state().invalidate();
         }
 
         // NOTE: A false return value indicates a connection error, not a
         //       command failure!
         bool ret = true;
 
-        if (fn) {
-            ret = fn(fd, request);
-        } else {
-            // Invalid command; allow further commands
-            ret = v3_send_response_unsupported(fd);
+        auto start = std::chrono::steady_clock::now();
+
+        {
+            auto lock = session.lock_socket();
+
+            if (fn) {
+                ret = fn(session, request);
+            } else {
+                // Invalid command; allow further commands
+                ret = v3_send_response_unsupported(session);
+            }
         }
 
+        auto duration = std::chrono::steady_clock::now() - start;
+        uint64_t bytes_in;
+        uint64_t bytes_out;
+        session.take_byte_counts(bytes_in, bytes_out);
+
+        daemon_stats_record(
+                static_cast<uint8_t>(type),
+                static_cast<uint64_t>(std::chrono::duration_cast<
+                        std::chrono::microseconds>(duration).count()),
+                data.value().size() + bytes_in, bytes_out);
+
         if (!ret) {
             return false;
         }
@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot/directory_size.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbutil/dir_walker.h"
+
+namespace mb
+{
+
+using namespace std::chrono_literals;
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+//! Maximum age of a cached directory size
+static constexpr auto CACHE_MAX_AGE = 30s;
+//! Maximum number of cached directory sizes
+static constexpr size_t CACHE_MAX_ENTRIES = 64;
+
+namespace
+{
+
+struct HardLink
+{
+    dev_t dev;
+    ino_t ino;
+    uint64_t size;
+};
+
+/*!
+ * \brief Sum up the sizes of regular files in a tree
+ *
+ * Files with a single link are added to the total immediately. Files with
+ * multiple links are collected so that they can be counted once after all
+ * subtrees have been walked.
+ */
+class SizeWalker : public util::DirWalker
+{
+public:
+    SizeWalker(std::string path, std::vector<HardLink> &links,
+               util::FileOpProgress *progress)
+        : DirWalker(std::move(path), util::DirWalkerFlag::GroupSpecialFiles)
+        , _links(links)
+        , _progress(progress)
+        , _total(0)
+        , _files(0)
+    {
+    }
+
+    Actions on_reached_file() override
+    {
+        auto const *sb = _curr->fts_statp;
+
+        // Hard links are counted each time they are seen here, so the progress
+        // may end up slightly higher than the final result
+        if (_progress) {
+            if (_progress->cancelled) {
+                return Action::Fail | Action::Stop;
+            }
+
+            _progress->bytes += static_cast<uint64_t>(sb->st_size);
+            ++_progress->files;
+        }
+
+        if (sb->st_nlink > 1) {
+            _links.push_back({sb->st_dev, sb->st_ino,
+                              static_cast<uint64_t>(sb->st_size)});
+        } else {
+            _total += static_cast<uint64_t>(sb->st_size);
+            ++_files;
+        }
+
+        return Action::Ok;
+    }
+
+    uint64_t total() const
+    {
+        return _total;
+    }
+
+    uint64_t files() const
+    {
+        return _files;
+    }
+
+private:
+    std::vector<HardLink> &_links;
+    util::FileOpProgress *_progress;
+    uint64_t _total;
+    uint64_t _files;
+};
+
+}
+
+static DirectoryStats sum_hard_links(std::vector<HardLink> &links)
+{
+    std::sort(links.begin(), links.end(),
+              [](const HardLink &a, const HardLink &b) {
+        return a.dev < b.dev || (a.dev == b.dev && a.ino < b.ino);
+    });
+
+    DirectoryStats stats{};
+
+    for (size_t i = 0; i < links.size(); ++i) {
+        if (i == 0 || links[i].dev != links[i - 1].dev
+                || links[i].ino != links[i - 1].ino) {
+            stats.size += links[i].size;
+            ++stats.files;
+        }
+    }
+
+    return stats;
+}
+
+static oc::result<DirectoryStats>
+get_stats_serial(const std::string &path, util::FileOpProgress *progress)
+{
+    std::vector<HardLink> links;
+    SizeWalker walker(path, links, progress);
+
+    if (!walker.run()) {
+        if (progress && progress->cancelled) {
+            return std::make_error_code(std::errc::operation_canceled);
+        }
+        return ec_from_errno();
+    }
+
+    auto stats = sum_hard_links(links);
+    stats.size += walker.total();
+    stats.files += walker.files();
+
+    return stats;
+}
+
+/*!
+ * \brief Get the total size and number of the regular files in a directory
+ *        tree
+ *
+ * Each top-level subtree is walked on a separate thread. Hard links are only
+ * counted once, symlinks are not followed, and directories on other
+ * filesystems are not descended into.
+ *
+ * \param path Path to directory
+ * \param exclusions Names of top-level entries to skip
+ * \param progress Progress to update with the files seen so far or nullptr.
+ *                 If cancellation is requested, this fails with
+ *                 `std::errc::operation_canceled`.
+ *
+ * \return Directory statistics or the first error encountered
+ */
+oc::result<DirectoryStats>
+get_directory_stats(const std::string &path,
+                    const std::vector<std::string> &exclusions,
+                    util::FileOpProgress *progress)
+{
+    int fd = open(path.c_str(),
+                  O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOTDIR || errno == ELOOP) {
+            // Not a directory, so there's nothing to parallelize
+            return get_stats_serial(path, progress);
+        }
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    std::vector<std::string> names;
+
+    {
+        int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (dup_fd < 0) {
+            return ec_from_errno();
+        }
+
+        ScopedDIR dp(fdopendir(dup_fd), closedir);
+        if (!dp) {
+            int saved_errno = errno;
+            close(dup_fd);
+            return ec_from_errno(saved_errno);
+        }
+
+        errno = 0;
+        while (auto *ent = readdir(dp.get())) {
+            if (strcmp(ent->d_name, ".") != 0
+                    && strcmp(ent->d_name, "..") != 0
+                    && std::find(exclusions.begin(), exclusions.end(),
+                                 ent->d_name) == exclusions.end()) {
+                names.emplace_back(ent->d_name);
+            }
+            errno = 0;
+        }
+        if (errno) {
+            return ec_from_errno();
+        }
+    }
+
+    size_t threads = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), names.size());
+
+    std::vector<std::error_code> errors(names.size());
+    std::vector<std::vector<HardLink>> links(std::max<size_t>(threads, 1));
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> files{0};
+    std::atomic<size_t> next{0};
+
+    auto worker = [&](std::vector<HardLink> &thread_links) {
+        std::string child_path;
+
+        for (size_t i; (i = next++) < names.size();) {
+            struct stat child_sb;
+
+            if (fstatat(fd, names[i].c_str(), &child_sb,
+                        AT_SYMLINK_NOFOLLOW) < 0) {
+                errors[i] = ec_from_errno();
+                continue;
+            } else if (S_ISDIR(child_sb.st_mode)
+                    && child_sb.st_dev != sb.st_dev) {
+                continue;
+            }
+
+            child_path = path;
+            if (child_path.empty() || child_path.back() != '/') {
+                child_path += '/';
+            }
+            child_path += names[i];
+
+            SizeWalker walker(child_path, thread_links, progress);
+            if (!walker.run()) {
+                errors[i] = ec_from_errno();
+            }
+            total += walker.total();
+            files += walker.files();
+        }
+    };
+
+    if (threads <= 1) {
+        worker(links[0]);
+    } else {
+        std::vector<std::thread> workers;
+        workers.reserve(threads);
+
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(worker, std::ref(links[i]));
+        }
+        for (auto &t : workers) {
+            t.join();
+        }
+    }
+
+    if (progress && progress->cancelled) {
+        return std::make_error_code(std::errc::operation_canceled);
+    }
+
+    for (auto const &ec : errors) {
+        if (ec) {
+            return ec;
+        }
+    }
+
+    std::vector<HardLink> all_links;
+    for (auto &l : links) {
+        all_links.insert(all_links.end(), l.begin(), l.end());
+    }
+
+    auto stats = sum_hard_links(all_links);
+    stats.size += total;
+    stats.files += files;
+
+    return stats;
+}
+
+/*!
+ * \brief Get the total size of the regular files in a directory tree
+ *
+ * \sa get_directory_stats()
+ *
+ * \return Total size in bytes or the first error encountered
+ */
+oc::result<uint64_t> get_directory_size(const std::string &path,
+                                        const std::vector<std::string> &exclusions)
+{
+    OUTCOME_TRY(stats, get_directory_stats(path, exclusions));
+    return stats.size;
+}
+
+static bool timespec_equal(const struct timespec &a, const struct timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+/*!
+ * \brief Get directory size, reusing a recent result if possible
+ *
+ * A cached result is reused if it is less than 30 seconds old, the exclusions
+ * are the same, and the directory (identified by device and inode) has not
+ * been modified since. Changes deeper in the tree only show up once the
+ * cached result expires.
+ *
+ * \sa get_directory_size()
+ */
+oc::result<uint64_t>
+DirectorySizeCache::get(const std::string &path,
+                        const std::vector<std::string> &exclusions)
+{
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) < 0) {
+        m_entries.erase(path);
+        return ec_from_errno();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    if (auto it = m_entries.find(path); it != m_entries.end()) {
+        auto const &entry = it->second;
+
+        if (entry.exclusions == exclusions
+                && entry.dev == sb.st_dev
+                && entry.ino == sb.st_ino
+                && timespec_equal(entry.mtime, sb.st_mtim)
+                && timespec_equal(entry.ctime, sb.st_ctim)
+                && now - entry.time < CACHE_MAX_AGE) {
+            return entry.size;
+        }
+    }
+
+    OUTCOME_TRY(size, get_directory_size(path, exclusions));
+
+    if (m_entries.size() >= CACHE_MAX_ENTRIES) {
+        m_entries.clear();
+    }
+
+    m_entries.insert_or_assign(path, Entry{
+        exclusions, sb.st_dev, sb.st_ino, sb.st_mtim, sb.st_ctim, now, size
+    });
+
+    return size;
+}
+
+}
@@ -20,17 +20,27 @@
 #include "boot/emergency.h"
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string_view>
+#include <thread>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstring>
 
+#include <fcntl.h>
 #include <sys/klog.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/outcome.h"
+#include "mbcommon/string.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
 #include "mbutil/directory.h"
@@ -50,7 +60,18 @@ using namespace mb::device;
 namespace mb
 {
 
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+using namespace std::chrono_literals;
+
+// Maximum size of a single /dev/kmsg record
+static constexpr size_t KMSG_RECORD_MAX = 8192;
+// Initial capacity for the formatted kernel log
+static constexpr size_t KMSG_OUTPUT_RESERVE = 512 * 1024;
+// Time limit for reading /dev/kmsg
+static constexpr auto KMSG_READ_TIMEOUT = 500ms;
+// Time limit for writing the log files to all partitions
+static constexpr auto LOG_WRITE_TIMEOUT = 2s;
+// Size of each write to a log file
+static constexpr size_t LOG_WRITE_CHUNK_SIZE = 1024 * 1024;
 
 class BlockDevFinder : public util::FtsWrapper {
 public:
@@ -94,46 +115,270 @@ private:
     std::vector<std::string> _results;
 };
 
-static oc::result<void> dump_kernel_log(const char *file)
+static std::shared_ptr<log::KmsgLogger> g_kmsg_logger;
+
+/*!
+ * \brief Set the logger whose rate limited records are saved with the kernel
+ *        log during an emergency reboot
+ */
+void emergency_set_kmsg_logger(std::shared_ptr<log::KmsgLogger> logger)
+{
+    g_kmsg_logger = std::move(logger);
+}
+
+static int open_kmsg()
+{
+    static constexpr int open_mode = O_RDONLY | O_NONBLOCK | O_CLOEXEC;
+
+    int fd = open("/dev/kmsg", open_mode);
+    if (fd < 0 && errno == ENOENT) {
+        // Same as KmsgLogger in case /dev/kmsg has not been created yet
+        static constexpr char path[] = "/dev/kmsg.emergency";
+
+        if (mknod(path, S_IFCHR | 0600, makedev(1, 11)) == 0) {
+            fd = open(path, open_mode);
+            unlink(path);
+        }
+    }
+
+    return fd;
+}
+
+/*!
+ * \brief Append a /dev/kmsg record to \p out in the same format as dmesg
+ *
+ * A record looks like `<prio>,<seq>,<usec>,<flags>;<message>\n` and may be
+ * followed by continuation lines with key/value pairs, which are dropped.
+ */
+static void append_kmsg_record(std::string_view record, std::string &out)
+{
+    auto header_end = record.find(';');
+    if (header_end == std::string_view::npos) {
+        return;
+    }
+
+    auto header = record.substr(0, header_end);
+    auto message = record.substr(header_end + 1);
+    message = message.substr(0, message.find('\n'));
+
+    unsigned int prio = 0;
+    uint64_t usec = 0;
+
+    auto fields = split_sv(header, ',');
+    if (fields.size() >= 3) {
+        str_to_num(std::string(fields[0]).c_str(), 10, prio);
+        str_to_num(std::string(fields[2]).c_str(), 10, usec);
+    }
+
+    out += format("<%u>[%5" PRIu64 ".%06" PRIu64 "] ", prio & 7,
+                  usec / 1000000, usec % 1000000);
+    out += message;
+    out += '\n';
+}
+
+/*!
+ * \brief Read the kernel log from /dev/kmsg
+ *
+ * The device is read without blocking until all records have been read or
+ * \p deadline has passed. Each read returns one record, so the kernel's
+ * timestamps and log levels are preserved exactly.
+ */
+static oc::result<std::string>
+read_kmsg(std::chrono::steady_clock::time_point deadline)
+{
+    int fd = open_kmsg();
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    std::string out;
+    out.reserve(KMSG_OUTPUT_RESERVE);
+
+    std::vector<char> buf(KMSG_RECORD_MAX);
+
+    while (std::chrono::steady_clock::now() < deadline) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EPIPE) {
+                // Records were overwritten while reading. The next read
+                // continues with the oldest remaining record.
+                continue;
+            } else if (errno == EAGAIN) {
+                break;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
+        }
+
+        append_kmsg_record({buf.data(), static_cast<size_t>(n)}, out);
+    }
+
+    return out;
+}
+
+/*!
+ * \brief Read the kernel log with klogctl()
+ *
+ * This is the fallback for kernels without /dev/kmsg read support.
+ */
+static oc::result<std::string> read_klog()
 {
     int len = klogctl(KLOG_SIZE_BUFFER, nullptr, 0);
     if (len < 0) {
         return ec_from_errno();
     }
 
-    std::vector<char> buf(static_cast<size_t>(len));
+    std::string buf(static_cast<size_t>(len), '\0');
 
     len = klogctl(KLOG_READ_ALL, buf.data(), static_cast<int>(buf.size()));
     if (len < 0) {
         return ec_from_errno();
     }
 
-    ScopedFILE fp(fopen(file, "wbe"), fclose);
-    if (!fp) {
-        return ec_from_errno();
+    buf.resize(static_cast<size_t>(len));
+    if (!buf.empty() && buf.back() != '\n') {
+        buf += '\n';
     }
 
-    auto timestamp = util::format_time("%Y/%m/%d %H:%M:%S %Z\n",
-                                       std::chrono::system_clock::now());
-    if (timestamp && fwrite(timestamp.value().data(),
-            timestamp.value().length(), 1, fp.get()) != 1) {
-        return ec_from_errno();
+    return buf;
+}
+
+/*!
+ * \brief Build the contents of the emergency log file
+ *
+ * The file contains the current time, the kernel log, and the rate limited
+ * records that never made it to the kernel log.
+ */
+static std::string build_emergency_log()
+{
+    using namespace std::chrono;
+
+    std::string contents;
+
+    if (auto timestamp = util::format_time("%Y/%m/%d %H:%M:%S %Z\n",
+                                           system_clock::now())) {
+        contents += timestamp.value();
     }
 
-    if (len > 0) {
-        if (fwrite(buf.data(), static_cast<size_t>(len), 1, fp.get()) != 1) {
-            return ec_from_errno();
+    auto kernel_log = read_kmsg(steady_clock::now() + KMSG_READ_TIMEOUT);
+    if (!kernel_log) {
+        LOGW("Failed to read /dev/kmsg: %s",
+             kernel_log.error().message().c_str());
+        kernel_log = read_klog();
+    }
+
+    if (kernel_log) {
+        contents += kernel_log.value();
+    } else {
+        LOGW("Failed to read kernel log: %s",
+             kernel_log.error().message().c_str());
+    }
+
+    if (g_kmsg_logger) {
+        auto spilled = g_kmsg_logger->recent_spilled_records();
+        if (!spilled.empty()) {
+            contents += "--- Rate limited mbtool log records ---\n";
+            contents += spilled;
         }
-        if (buf[static_cast<size_t>(len - 1)] != '\n') {
-            if (fputc('\n', fp.get()) == EOF) {
-                return ec_from_errno();
+    }
+
+    return contents;
+}
+
+/*!
+ * \brief Write the emergency log to a file
+ *
+ * The file is allocated up front so that the data writes do not have to
+ * allocate blocks.
+ */
+static oc::result<void> write_log_file(const std::string &path,
+                                       std::string_view contents)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    // Not all filesystems support this and the write works either way
+    (void) fallocate(fd, 0, 0, static_cast<off_t>(contents.size()));
+
+    while (!contents.empty()) {
+        ssize_t n = write(fd, contents.data(),
+                          std::min(contents.size(), LOG_WRITE_CHUNK_SIZE));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            return ec_from_errno();
         }
+        contents.remove_prefix(static_cast<size_t>(n));
+    }
+
+    if (fdatasync(fd) < 0) {
+        return ec_from_errno();
     }
 
     return oc::success();
 }
 
+/*!
+ * \brief Write the emergency log to several files concurrently
+ *
+ * Each file is written on its own thread. This waits at most until
+ * \p deadline. Writers that have not finished by then (eg. because of a slow
+ * or broken storage device) are left running, so the reboot is never delayed
+ * by them.
+ *
+ * \return Whether all files were written before the deadline
+ */
+static bool write_log_files(const std::vector<std::string> &paths,
+                            std::string contents,
+                            std::chrono::steady_clock::time_point deadline)
+{
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t remaining;
+        std::string contents;
+    };
+
+    // Shared with the writer threads, which may outlive this function
+    auto state = std::make_shared<State>();
+    state->remaining = paths.size();
+    state->contents = std::move(contents);
+
+    for (auto const &path : paths) {
+        std::thread([state, path] {
+            if (auto r = write_log_file(path, state->contents); !r) {
+                LOGW("%s: Failed to write log: %s",
+                     path.c_str(), r.error().message().c_str());
+            }
+
+            std::lock_guard<std::mutex> lock(state->mutex);
+            --state->remaining;
+            state->cv.notify_all();
+        }).detach();
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    return state->cv.wait_until(lock, deadline, [&] {
+        return state->remaining == 0;
+    });
+}
+
 struct EmergencyMount
 {
     std::string mount_point;
@@ -219,6 +464,8 @@ void emergency_reboot()
         ems.push_back(std::move(em));
     }
 
+    std::vector<std::string> log_paths;
+
     for (auto const &em : ems) {
         if (auto r = util::mkdir_recursive(em.mount_point, 0755);
                 !r && r.error() != std::errc::file_exists) {
@@ -250,17 +497,26 @@ void emergency_reboot()
                 !r && r.error() != std::errc::file_exists) {
             LOGW("%s: Failed to create parent directory: %s",
                  log_path.c_str(), strerror(errno));
+            continue;
         }
 
         LOGI("Dumping kernel log to %s", log_path.c_str());
 
         rename(log_path.c_str(), log_path_old.c_str());
-        if (auto ret = dump_kernel_log(log_path.c_str()); !ret) {
-            LOGW("Failed to dump kernel log: %s",
-                 ret.error().message().c_str());
-        }
-        sync();
+        log_paths.push_back(std::move(log_path));
+    }
+
+    // Make sure queued records are in the kernel log
+    log::flush();
 
+    // The log is read once and written to every partition concurrently
+    if (!write_log_files(log_paths, build_emergency_log(),
+                         std::chrono::steady_clock::now()
+                                 + LOG_WRITE_TIMEOUT)) {
+        LOGW("Timed out while writing kernel logs");
+    }
+
+    for (auto const &em : ems) {
         (void) util::umount(em.mount_point);
     }
 
@@ -51,16 +51,19 @@
 #include "mbutil/chown.h"
 #include "mbutil/cmdline.h"
 #include "mbutil/command.h"
+#include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
 #include "mbutil/fstab.h"
+#include "mbutil/hash.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
+#include "boot/boot_trace.h"
 #include "boot/daemon.h"
 #include "boot/emergency.h"
 #include "boot/mount_fstab.h"
@@ -80,6 +83,18 @@
 #error Unknown PCRE path for architecture
 #endif
 
+#define LOG_DIR                 "/raw/data/multiboot/logs"
+
+// Boot stage timings are written here if the enable file exists
+#define BOOT_TRACE_DIR          LOG_DIR
+#define BOOT_TRACE_ENABLE_PATH  BOOT_TRACE_DIR "/boot_trace.enable"
+
+// Log records that were rate limited before reaching the kernel log
+#define KMSG_SPILL_PATH         LOG_DIR "/kmsg_spill.log"
+
+// Patched binary file_contexts from previous boots
+#define FILE_CONTEXTS_CACHE_DIR "/raw/data/multiboot/cache/file_contexts"
+
 #define LOG_TAG "mbtool/boot/init"
 
 using namespace mb::device;
@@ -92,7 +107,20 @@ using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
 static pid_t daemon_pid = -1;
 
-static PropertyService g_property_service;
+// Only init uses these, so they are created on first use instead of during
+// the static initialization of every tool in the multicall binary
+
+static PropertyService & property_service()
+{
+    static PropertyService service;
+    return service;
+}
+
+static BootTrace & boot_trace()
+{
+    static BootTrace trace;
+    return trace;
+}
 
 static void init_usage(FILE *stream)
 {
@@ -198,6 +226,8 @@ static bool stop_daemon()
 static bool set_kernel_properties()
 {
     if (auto cmdline = util::kernel_cmdline()) {
+        std::vector<std::pair<std::string, std::string>> props;
+
         for (auto const &[k, v] : cmdline.value()) {
             LOGV("Kernel cmdline option %s=%s",
                  k.c_str(), v ? v->c_str() : "(no value)");
@@ -205,9 +235,11 @@ static bool set_kernel_properties()
             if (starts_with(k, "androidboot.") && k.size() > 12 && v) {
                 std::string key("ro.boot.");
                 key += std::string_view(k).substr(12);
-                g_property_service.set(key, *v);
+                props.emplace_back(std::move(key), *v);
             }
         }
+
+        property_service().set_many(props);
     } else {
         LOGW("Failed get kernel cmdline: %s",
              cmdline.error().message().c_str());
@@ -227,8 +259,8 @@ static bool set_kernel_properties()
     };
 
     for (auto const &p : prop_map) {
-        auto value = g_property_service.get(p.src_prop);
-        g_property_service.set(p.dst_prop, value ? *value : p.default_value);
+        auto value = property_service().get(p.src_prop);
+        property_service().set(p.dst_prop, value ? *value : p.default_value);
     }
 
     return true;
@@ -236,7 +268,7 @@ static bool set_kernel_properties()
 
 static bool properties_setup()
 {
-    if (!g_property_service.initialize()) {
+    if (!property_service().initialize()) {
         LOGW("Failed to initialize properties area");
     }
 
@@ -246,13 +278,13 @@ static bool properties_setup()
     }
 
     // Load /default.prop
-    g_property_service.load_boot_props();
+    property_service().load_boot_props();
 
     // Load DBP props
-    g_property_service.load_properties_file(DBP_PROP_PATH, {});
+    property_service().load_properties_file(DBP_PROP_PATH, {});
 
     // Start properties service (to allow other processes to set properties)
-    if (!g_property_service.start_thread()) {
+    if (!property_service().start_thread()) {
         LOGW("Failed to start properties service");
     }
 
@@ -261,7 +293,7 @@ static bool properties_setup()
 
 static bool properties_cleanup()
 {
-    if (!g_property_service.stop_thread()) {
+    if (!property_service().stop_thread()) {
         LOGW("Failed to stop properties service");
     }
 
@@ -307,6 +339,15 @@ static bool replace_file(const char *replace, const char *with)
     return true;
 }
 
+static const char *extra_file_contexts =
+        "\n"
+        INTERNAL_STORAGE_ROOT                 " <<none>>\n"
+        INTERNAL_STORAGE_ROOT "/[0-9]+(/.*)?" " <<none>>\n"
+        "/raw(/.*)?"                          " <<none>>\n"
+        "/data/multiboot(/.*)?"               " <<none>>\n"
+        "/cache/multiboot(/.*)?"              " <<none>>\n"
+        "/system/multiboot(/.*)?"             " <<none>>\n";
+
 static bool fix_file_contexts(const char *path)
 {
     std::string new_path(path);
@@ -352,19 +393,48 @@ static bool fix_file_contexts(const char *path)
         }
     }
 
-    static const char *new_contexts =
-            "\n"
-            INTERNAL_STORAGE_ROOT                 " <<none>>\n"
-            INTERNAL_STORAGE_ROOT "/[0-9]+(/.*)?" " <<none>>\n"
-            "/raw(/.*)?"                          " <<none>>\n"
-            "/data/multiboot(/.*)?"               " <<none>>\n"
-            "/cache/multiboot(/.*)?"              " <<none>>\n"
-            "/system/multiboot(/.*)?"             " <<none>>\n";
-    fputs(new_contexts, fp_new.get());
+    fputs(extra_file_contexts, fp_new.get());
 
     return replace_file(path, new_path.c_str());
 }
 
+/*!
+ * \brief Get the path where the patched version of a binary file_contexts is
+ *        cached
+ *
+ * The cache key covers everything that affects the output: the original
+ * file, the PCRE library that the compiled regexes are tied to, the
+ * file-contexts-tool binary, and the rules that are added.
+ *
+ * \return Cache path or an empty string if the inputs could not be hashed
+ */
+static std::string binary_file_contexts_cache_path(const char *path)
+{
+    auto digests = util::sha512_hash_files(
+            {path, PCRE_PATH, "/sbin/file-contexts-tool"});
+    if (!digests) {
+        LOGW("%s: Failed to hash file_contexts inputs: %s",
+             path, digests.error().message().c_str());
+        return {};
+    }
+
+    SHA512_CTX ctx;
+    SHA512_Init(&ctx);
+    for (auto const &digest : digests.value()) {
+        SHA512_Update(&ctx, digest.data(), digest.size());
+    }
+    SHA512_Update(&ctx, extra_file_contexts, strlen(extra_file_contexts));
+
+    util::Sha512Digest key;
+    SHA512_Final(key.data(), &ctx);
+
+    std::string cache_path(FILE_CONTEXTS_CACHE_DIR "/");
+    cache_path += util::hex_string(key.data(), key.size());
+    cache_path += ".bin";
+
+    return cache_path;
+}
+
 static bool fix_binary_file_contexts(const char *path)
 {
     std::string new_path(path);
@@ -372,6 +442,22 @@ static bool fix_binary_file_contexts(const char *path)
     std::string tmp_path(path);
     tmp_path += ".tmp";
 
+    // Reuse the result from a previous boot if the inputs have not changed
+    std::string cache_path = binary_file_contexts_cache_path(path);
+
+    if (!cache_path.empty() && access(cache_path.c_str(), R_OK) == 0) {
+        if (auto r = util::copy_file(cache_path, new_path, 0); !r) {
+            LOGW("%s: Failed to copy cached file_contexts: %s",
+                 cache_path.c_str(), r.error().message().c_str());
+        } else if (replace_file(path, new_path.c_str())) {
+            LOGV("%s: Using cached file_contexts: %s",
+                 path, cache_path.c_str());
+            return true;
+        } else {
+            unlink(new_path.c_str());
+        }
+    }
+
     // Check signature
     SigVerifyResult result;
     result = verify_signature("/sbin/file-contexts-tool",
@@ -413,6 +499,28 @@ static bool fix_binary_file_contexts(const char *path)
 
     unlink(tmp_path.c_str());
 
+    if (!cache_path.empty()) {
+        // Write to a temporary file first so that an interrupted boot never
+        // leaves a truncated file behind under the final name
+        std::string cache_tmp_path(cache_path);
+        cache_tmp_path += ".tmp";
+
+        if (auto r = util::mkdir_recursive(FILE_CONTEXTS_CACHE_DIR, 0700);
+                !r && r.error() != std::errc::file_exists) {
+            LOGW("%s: Failed to create directory: %s",
+                 FILE_CONTEXTS_CACHE_DIR, r.error().message().c_str());
+        } else if (auto r2 = util::copy_file(new_path, cache_tmp_path, 0);
+                !r2) {
+            LOGW("%s: Failed to cache file_contexts: %s",
+                 cache_tmp_path.c_str(), r2.error().message().c_str());
+            unlink(cache_tmp_path.c_str());
+        } else if (rename(cache_tmp_path.c_str(), cache_path.c_str()) < 0) {
+            LOGW("%s: Failed to rename to %s: %s", cache_tmp_path.c_str(),
+                 cache_path.c_str(), strerror(errno));
+            unlink(cache_tmp_path.c_str());
+        }
+    }
+
     return replace_file(path, new_path.c_str());
 }
 
@@ -860,7 +968,10 @@ static bool disable_spota()
 {
     static const char *spota_dir = "/data/security/spota";
 
-    auto props = util::property_file_get_all(BUILD_PROP_PATH);
+    auto props = util::property_file_get_keys(BUILD_PROP_PATH, {
+        "ro.product.brand",
+        "ro.product.manufacturer",
+    });
 
     if (props && strcasecmp((*props)["ro.product.brand"].c_str(), "samsung") != 0
             && strcasecmp((*props)["ro.product.manufacturer"].c_str(), "samsung") != 0) {
@@ -888,7 +999,102 @@ static bool disable_spota()
     return true;
 }
 
-static bool extract_zip(const char *source, const char *target)
+struct ZipExtractEntry
+{
+    // Path in the zip file
+    const char *zip_path;
+    // Path to extract to
+    const char *target_path;
+    // Mode of the extracted file
+    mode_t mode;
+};
+
+// mbbootui extracts its own theme from the zip, so only the executable is
+// needed up front
+static constexpr ZipExtractEntry BOOT_UI_ENTRIES[] = {
+    { "exec", BOOT_UI_EXEC_PATH, 0500 },
+};
+
+// Entries are inflated straight into their target files with large reads
+static constexpr size_t ZIP_EXTRACT_BUF_SIZE = 1024 * 1024;
+
+static bool extract_zip_entry(void *handle, const char *source,
+                              const ZipExtractEntry &entry, char *buf)
+{
+    if (mz_zip_locate_entry(handle, entry.zip_path, nullptr) != MZ_OK) {
+        LOGE("%s: Failed to find '%s' in zip", source, entry.zip_path);
+        return false;
+    }
+
+    if (mz_zip_entry_read_open(handle, 0, nullptr) != MZ_OK) {
+        LOGE("%s: Failed to open '%s' in zip", source, entry.zip_path);
+        return false;
+    }
+
+    auto close_inner_file = finally([&] {
+        mz_zip_entry_close(handle);
+    });
+
+    int fd = open(entry.target_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  entry.mode);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             entry.target_path, strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    int bytes_read;
+
+    while ((bytes_read = mz_zip_entry_read(
+            handle, buf, static_cast<uint32_t>(ZIP_EXTRACT_BUF_SIZE))) > 0) {
+        for (int offset = 0; offset < bytes_read;) {
+            ssize_t n = write(fd, buf + offset,
+                              static_cast<size_t>(bytes_read - offset));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                LOGE("%s: Failed to write: %s", entry.target_path,
+                     n < 0 ? strerror(errno) : "Truncated write");
+                return false;
+            }
+            offset += static_cast<int>(n);
+        }
+    }
+    if (bytes_read != 0) {
+        LOGE("%s: Failed before reaching EOF of '%s'", source, entry.zip_path);
+        return false;
+    }
+
+    close_fd.dismiss();
+
+    if (close(fd) < 0) {
+        LOGE("%s: Error when closing file: %s",
+             entry.target_path, strerror(errno));
+        return false;
+    }
+
+    // The mode passed to open() is subject to the umask
+    if (chmod(entry.target_path, entry.mode) < 0) {
+        LOGE("%s: Failed to chmod: %s", entry.target_path, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Extract selected entries from a zip file
+ *
+ * Only the listed entries are inflated. Everything else in the zip is never
+ * read beyond the central directory.
+ */
+template<size_t N>
+static bool extract_zip(const char *source, const char *target,
+                        const ZipExtractEntry (&entries)[N])
 {
     void *stream;
     if (!mz_stream_android_create(&stream)) {
@@ -934,64 +1140,20 @@ static bool extract_zip(const char *source, const char *target)
         mz_zip_close(handle);
     });
 
-    if (mz_zip_locate_entry(handle, "exec", nullptr) != MZ_OK) {
-        LOGE("%s: Failed to find 'exec' in zip", source);
-        return false;
-    }
-
-    if (mz_zip_entry_read_open(handle, 0, nullptr) != MZ_OK) {
-        LOGE("%s: Failed to open file in zip", source);
-        return false;
-    }
-
-    auto close_inner_file = finally([&] {
-        mz_zip_entry_close(handle);
-    });
-
-    std::string target_file(target);
-    target_file += "/exec";
-
     (void) util::mkdir_recursive(target, 0755);
 
-    FILE *fp = fopen(target_file.c_str(), "wbe");
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             target_file.c_str(), strerror(errno));
-        return false;
-    }
-
-    auto close_fp = finally([&] {
-        fclose(fp);
-    });
-
-    char buf[UINT16_MAX];
-    int bytes_read;
+    std::unique_ptr<char[]> buf(new char[ZIP_EXTRACT_BUF_SIZE]);
 
-    while ((bytes_read = mz_zip_entry_read(handle, buf, sizeof(buf))) > 0) {
-        size_t bytes_written = fwrite(buf, 1, static_cast<size_t>(bytes_read),
-                                      fp);
-        if (bytes_written == 0) {
-            LOGE("%s: Truncated write", target);
+    for (auto const &entry : entries) {
+        if (!extract_zip_entry(handle, source, entry, buf.get())) {
             return false;
         }
     }
-    if (bytes_read != 0) {
-        LOGE("%s: Failed before reaching inner file's EOF", source);
-        return false;
-    }
-
-    close_fp.dismiss();
-
-    if (fclose(fp) < 0) {
-        LOGE("%s: Error when closing file: %s",
-             target_file.c_str(), strerror(errno));
-        return false;
-    }
 
     return true;
 }
 
-static bool launch_boot_menu()
+static bool launch_boot_menu(const Device &device)
 {
     struct stat sb;
     bool skip = false;
@@ -1020,6 +1182,13 @@ static bool launch_boot_menu()
         return true;
     }
 
+    // mbbootui would exit right away, so don't bother verifying and
+    // extracting it
+    if (!device.tw_supported()) {
+        LOGV("Boot UI is not supported for the device. Skipping...");
+        return true;
+    }
+
     if (stat(BOOT_UI_ZIP_PATH, &sb) < 0) {
         LOGV("Boot UI is missing. Skipping...");
         return true;
@@ -1033,11 +1202,6 @@ static bool launch_boot_menu()
         return false;
     }
 
-    if (!extract_zip(BOOT_UI_ZIP_PATH, BOOT_UI_PATH)) {
-        LOGE("%s: Failed to extract zip", BOOT_UI_ZIP_PATH);
-        return false;
-    }
-
     auto clean_up = finally([]{
         if (auto r = util::delete_recursive(BOOT_UI_PATH); !r) {
             LOGW("%s: Failed to recursively delete: %s",
@@ -1045,8 +1209,13 @@ static bool launch_boot_menu()
         }
     });
 
-    if (chmod(BOOT_UI_EXEC_PATH, 0500) < 0) {
-        LOGE("%s: Failed to chmod: %s", BOOT_UI_EXEC_PATH, strerror(errno));
+    auto extract_stage = boot_trace().begin("extract_zip");
+    bool extracted = extract_zip(BOOT_UI_ZIP_PATH, BOOT_UI_PATH,
+                                 BOOT_UI_ENTRIES);
+    boot_trace().end(extract_stage);
+
+    if (!extracted) {
+        LOGE("%s: Failed to extract zip", BOOT_UI_ZIP_PATH);
         return false;
     }
 
@@ -1135,6 +1304,8 @@ int init_main(int argc, char *argv[])
     mount("proc", "/proc", "proc", 0, nullptr);
     mount("sysfs", "/sys", "sysfs", 0, nullptr);
 
+    boot_trace().mark("start");
+
     // Create mount points
     mkdir("/system", 0755);
     mkdir("/cache", 0770);
@@ -1146,7 +1317,12 @@ int init_main(int argc, char *argv[])
     redirect_stdio_null();
 
     // Log to kmsg
-    log::set_logger(std::make_shared<log::KmsgLogger>(true));
+    auto kmsg_logger = std::make_shared<log::KmsgLogger>(true);
+    log::set_logger(kmsg_logger);
+    emergency_set_kmsg_logger(kmsg_logger);
+    // Keep the uevent and property service threads from serializing on the
+    // logger
+    log::set_async(true);
     if (klogctl(KLOG_CONSOLE_LEVEL, nullptr, 7) < 0) {
         LOGE("Failed to set loglevel: %s", strerror(errno));
     }
@@ -1183,7 +1359,9 @@ int init_main(int argc, char *argv[])
     add_props_to_dbp_prop();
 
     // initialize properties
+    auto stage = boot_trace().begin("properties_setup");
     properties_setup();
+    boot_trace().end(stage);
 
     std::string fstab(find_fstab());
 
@@ -1213,30 +1391,55 @@ int init_main(int argc, char *argv[])
             | MountFlag::MountCache
             | MountFlag::MountData
             | MountFlag::MountExternalSd;
+    stage = boot_trace().begin("mount_fstab");
     if (!mount_fstab(fstab.c_str(), rom, device, flags,
                      uevent_thread.device_handler())) {
         LOGE("Failed to mount fstab");
         emergency_reboot();
     }
+    boot_trace().end(stage);
 
     LOGV("Successfully mounted fstab");
 
-    if (!launch_boot_menu()) {
+    // Keep rate limited log records now that the data partition is available
+    if (auto r = util::mkdir_recursive(LOG_DIR, 0775);
+            !r && r.error() != std::errc::file_exists) {
+        LOGW("%s: Failed to create directory: %s",
+             LOG_DIR, r.error().message().c_str());
+    } else if (!kmsg_logger->set_spill_file(KMSG_SPILL_PATH)) {
+        LOGW("%s: Failed to open log spill file: %s",
+             KMSG_SPILL_PATH, strerror(errno));
+    }
+
+    // The data partition is available now, so we can tell whether the trace
+    // is wanted
+    boot_trace().set_enabled(access(BOOT_TRACE_ENABLE_PATH, F_OK) == 0);
+
+    stage = boot_trace().begin("launch_boot_menu");
+    if (!launch_boot_menu(device)) {
         LOGE("Failed to run boot menu");
         // Continue anyway since boot menu might not run on every device
     }
+    boot_trace().end(stage);
 
     // Mount selinuxfs
     selinux_mount();
     // Load pre-boot policy
+    stage = boot_trace().begin("patch_sepolicy_preboot");
     patch_sepolicy(util::SELINUX_DEFAULT_POLICY_FILE, util::SELINUX_LOAD_FILE,
                    SELinuxPatch::PreBoot);
+    boot_trace().end(stage);
 
     // Mount ROM (bind mount directory or mount images, etc.)
+    stage = boot_trace().begin("mount_rom");
     if (!mount_rom(rom)) {
         LOGE("Failed to mount ROM directories and images");
         emergency_reboot();
     }
+    boot_trace().end(stage);
+
+    // Let the daemon and other tools skip detecting the booted ROM
+    Roms::cache_current_rom(rom->id);
 
     std::string config_path(rom->config_path());
     RomConfig config;
@@ -1248,14 +1451,18 @@ int init_main(int argc, char *argv[])
     LOGD("Enable appsync: %d", config.indiv_app_sharing);
 
     // Make runtime ramdisk modifications
+    stage = boot_trace().begin("fix_file_contexts");
     if (access(FILE_CONTEXTS, R_OK) == 0) {
         fix_file_contexts(FILE_CONTEXTS);
     }
     if (access(FILE_CONTEXTS_BIN, R_OK) == 0) {
         fix_binary_file_contexts(FILE_CONTEXTS_BIN);
     }
+    boot_trace().end(stage);
     write_fstab_hack(fstab.c_str());
+    stage = boot_trace().begin("add_mbtool_services");
     add_mbtool_services(config.indiv_app_sharing);
+    boot_trace().end(stage);
     strip_manual_mounts();
 
     // Disable installd on Android 7.0+
@@ -1272,6 +1479,7 @@ int init_main(int argc, char *argv[])
     // Patch SELinux policy
     struct stat sb;
     if (stat(util::SELINUX_DEFAULT_POLICY_FILE, &sb) == 0) {
+        stage = boot_trace().begin("patch_sepolicy");
         if (!patch_sepolicy(util::SELINUX_DEFAULT_POLICY_FILE,
                             util::SELINUX_DEFAULT_POLICY_FILE,
                             SELinuxPatch::Main)) {
@@ -1279,6 +1487,7 @@ int init_main(int argc, char *argv[])
                  util::SELINUX_DEFAULT_POLICY_FILE);
             emergency_reboot();
         }
+        boot_trace().end(stage);
     }
 
     // Kill uevent thread and close uevent socket
@@ -1297,6 +1506,16 @@ int init_main(int argc, char *argv[])
     unlink("/init");
     rename("/init.orig", "/init");
 
+    // This is the last point where /proc is still mounted. Only the exec of
+    // the real init remains after this, which can't be timed from here.
+    boot_trace().mark("exec_init");
+    if (boot_trace().enabled()) {
+        if (auto r = boot_trace().write(BOOT_TRACE_DIR); !r) {
+            LOGW("Failed to write boot trace: %s",
+                 r.error().message().c_str());
+        }
+    }
+
     // Unmount partitions
     selinux_unmount();
     umount("/dev/pts");
@@ -1312,6 +1531,8 @@ int init_main(int argc, char *argv[])
 
     // Start real init
     LOGD("Launching real init ...");
+    // The drain thread and its queue do not survive the exec
+    log::set_async(false);
     execlp("/init", "/init", nullptr);
     LOGE("Failed to exec real init: %s", strerror(errno));
     emergency_reboot();
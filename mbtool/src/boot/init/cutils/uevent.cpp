@@ -17,6 +17,8 @@
 
 #include "boot/init/cutils/uevent.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <cstring>
 
@@ -52,6 +54,40 @@ ssize_t uevent_kernel_multicast_uid_recv(int socket, void *buffer, size_t length
     return uevent_kernel_recv(socket, buffer, length, true, uid);
 }
 
+/**
+ * Checks that a received netlink message was sent by the kernel.
+ */
+static bool check_sender(const msghdr &hdr, const sockaddr_nl &addr,
+                         bool require_group, uid_t *uid)
+{
+    *uid = static_cast<uid_t>(-1);
+
+    // msghdr is not const-correct on all libcs
+    cmsghdr *cmsg = CMSG_FIRSTHDR(const_cast<msghdr *>(&hdr));
+    if (!cmsg || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        // Ignoring netlink message with no sender credentials
+        return false;
+    }
+
+    auto *cred = reinterpret_cast<ucred *>(CMSG_DATA(cmsg));
+    *uid = cred->uid;
+    if (cred->uid != 0) {
+        // Ignoring netlink message from non-root user
+        return false;
+    }
+
+    if (addr.nl_pid != 0) {
+        // Ignore non-kernel
+        return false;
+    }
+    if (require_group && addr.nl_groups == 0) {
+        // Ignore unicast messages when requested
+        return false;
+    }
+
+    return true;
+}
+
 ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require_group, uid_t *uid)
 {
     iovec iov = { buffer, length };
@@ -73,35 +109,62 @@ ssize_t uevent_kernel_recv(int socket, void *buffer, size_t length, bool require
         return n;
     }
 
-    auto clear_buf_and_set_error = mb::finally([&] {
+    if (!check_sender(hdr, addr, require_group, uid)) {
         // Clear residual potentially malicious data
         bzero(buffer, length);
         errno = EIO;
-    });
-
-    cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
-    if (!cmsg || cmsg->cmsg_type != SCM_CREDENTIALS) {
-        // Ignoring netlink message with no sender credentials
         return -1;
     }
 
-    auto *cred = reinterpret_cast<ucred *>(CMSG_DATA(cmsg));
-    *uid = cred->uid;
-    if (cred->uid != 0) {
-        // Ignoring netlink message from non-root user
-        return -1;
-    }
+    return n;
+}
 
-    if (addr.nl_pid != 0) {
-        // Ignore non-kernel
-        return -1;
+/**
+ * Like uevent_kernel_multicast_recv(), but receives up to |count| messages
+ * (at most UEVENT_BATCH_MAX) with a single recvmmsg() call without blocking.
+ * Message i is stored at |buffer| + i * |length| and its size is stored in
+ * |sizes|[i]. Messages that did not originate from the kernel are cleared and
+ * their size is set to -1.
+ *
+ * Returns the number of messages received or -1 if recvmmsg() fails.
+ */
+int uevent_kernel_multicast_recv_batch(int socket, void *buffer, size_t length, size_t count,
+                                       ssize_t *sizes)
+{
+    iovec iovs[UEVENT_BATCH_MAX];
+    sockaddr_nl addrs[UEVENT_BATCH_MAX];
+    char controls[UEVENT_BATCH_MAX][CMSG_SPACE(sizeof(ucred))];
+    mmsghdr hdrs[UEVENT_BATCH_MAX];
+
+    count = std::min<size_t>(count, UEVENT_BATCH_MAX);
+
+    for (size_t i = 0; i < count; ++i) {
+        iovs[i] = { static_cast<char *>(buffer) + i * length, length };
+        hdrs[i] = {};
+        hdrs[i].msg_hdr.msg_name = &addrs[i];
+        hdrs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+        hdrs[i].msg_hdr.msg_control = controls[i];
+        hdrs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
     }
-    if (require_group && addr.nl_groups == 0) {
-        // Ignore unicast messages when requested
-        return -1;
+
+    int n = recvmmsg(socket, hdrs, static_cast<unsigned int>(count), MSG_DONTWAIT, nullptr);
+    if (n <= 0) {
+        return n;
     }
 
-    clear_buf_and_set_error.dismiss();
+    for (int i = 0; i < n; ++i) {
+        uid_t uid;
+
+        if (check_sender(hdrs[i].msg_hdr, addrs[i], true, &uid)) {
+            sizes[i] = static_cast<ssize_t>(hdrs[i].msg_len);
+        } else {
+            // Clear residual potentially malicious data
+            bzero(iovs[i].iov_base, length);
+            sizes[i] = -1;
+        }
+    }
 
     return n;
 }
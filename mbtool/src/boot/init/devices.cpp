@@ -18,10 +18,14 @@
 #include "boot/init/devices.h"
 
 #include <memory>
+#include <string_view>
+#include <utility>
 
 #include <cerrno>
+#include <climits>
 #include <cstring>
 
+#include <fcntl.h>
 #include <sys/sysmacros.h>
 #include <unistd.h>
 
@@ -33,11 +37,65 @@
 #include "mbutil/directory.h"
 #include "mbutil/path.h"
 
+#include "boot/init/unique_fd.h"
+
 #define LOG_TAG "mbtool/boot/init/devices"
 
 namespace android {
 namespace init {
 
+// Caches descriptors for the parent directories of device nodes and symlinks
+// so that each directory is only looked up and created once per batch of
+// uevents. A cache must not be shared between threads.
+class DeviceHandler::DirCache {
+  public:
+    // Returns a descriptor for the parent directory of |path|, creating the
+    // directory if |create| is true. Returns -1 on failure.
+    int GetParent(const std::string& path, bool create) {
+        auto dir = mb::util::dir_name(path);
+
+        if (auto it = fds_.find(dir); it != fds_.end()) {
+            return it->second.get();
+        }
+
+        int fd = open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT && create) {
+            if (auto r = mb::util::mkdir_recursive(dir, 0755); !r) {
+                LOGE("Failed to create directory %s: %s",
+                     dir.c_str(), r.error().message().c_str());
+                return -1;
+            }
+
+            fd = open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (fd < 0) {
+            if (create) {
+                LOGE("Failed to open directory %s: %s", dir.c_str(), strerror(errno));
+            }
+            return -1;
+        }
+
+        fds_.emplace(std::move(dir), android::base::unique_fd(fd));
+        return fd;
+    }
+
+  private:
+    std::unordered_map<std::string, android::base::unique_fd> fds_;
+};
+
+// Subsystems whose device nodes are placed in a subdirectory of /dev.
+// Keep up to date with ueventd.rc
+static const std::unordered_map<std::string_view, const char*> kSubsystemDirs{
+    {"graphics", "/dev/graphics/"},
+    {"drm", "/dev/dri/"},
+    {"oncrpc", "/dev/oncrpc/"},
+    {"adsp", "/dev/adsp/"},
+    {"msm_camera", "/dev/msm_camera/"},
+    {"input", "/dev/input/"},
+    {"mtd", "/dev/mtd/"},
+    {"sound", "/dev/snd/"},
+};
+
 static std::string GetBootDevice()
 {
     std::string result;
@@ -136,11 +194,13 @@ bool DeviceHandler::FindPlatformDevice(std::string path, std::string* platform_d
     return false;
 }
 
-void DeviceHandler::MakeDevice(const std::string& path, bool block, int major, int minor) const {
+void DeviceHandler::MakeDevice(DirCache& dirs, const std::string& path, bool block, int major,
+                               int minor) const {
     mode_t mode = 0600 | (block ? S_IFBLK : S_IFCHR);
 
     dev_t dev = static_cast<dev_t>(makedev(major, minor));
-    if (mknod(path.c_str(), mode, dev) < 0) {
+    int dfd = dirs.GetParent(path, true);
+    if (dfd < 0 || mknodat(dfd, mb::util::base_name(path).c_str(), mode, dev) < 0) {
         LOGW("%s: Failed to create device: %s", path.c_str(), strerror(errno));
     }
 }
@@ -195,11 +255,11 @@ std::vector<std::string> DeviceHandler::GetBlockDeviceSymlinks(const Uevent& uev
     };
 
     // Legacy /dev/block/bootdevice support
-    if (!boot_device_) {
+    std::call_once(boot_device_once_, [this] {
         boot_device_ = GetBootDevice();
-    }
-    if (!boot_device_->empty()
-            && device.find(*boot_device_) != std::string::npos) {
+    });
+    if (!boot_device_.empty()
+            && device.find(boot_device_) != std::string::npos) {
         LOGE("Boot device is %s", device.c_str());
         link_paths.emplace_back("/dev/block/bootdevice");
     }
@@ -232,18 +292,32 @@ BlockDevMap DeviceHandler::GetBlockDeviceMap() const
     return block_dev_mappings_;
 }
 
-void DeviceHandler::HandleDevice(const std::string& action, const std::string& devpath, bool block,
-                                 int major, int minor, const std::vector<std::string>& links) const {
+uint64_t DeviceHandler::GetBlockDeviceGeneration() const
+{
+    std::lock_guard<std::mutex> lock(block_dev_mappings_guard_);
+    return block_dev_generation_;
+}
+
+bool DeviceHandler::WaitForBlockDevice(uint64_t generation,
+                                       std::chrono::steady_clock::time_point deadline) const
+{
+    std::unique_lock<std::mutex> lock(block_dev_mappings_guard_);
+    return block_dev_added_.wait_until(lock, deadline, [&] {
+        return block_dev_generation_ != generation;
+    });
+}
+
+void DeviceHandler::HandleDevice(DirCache& dirs, const std::string& action,
+                                 const std::string& devpath, bool block, int major, int minor,
+                                 const std::vector<std::string>& links) const {
     if (action == "add") {
-        MakeDevice(devpath, block, major, minor);
+        MakeDevice(dirs, devpath, block, major, minor);
         for (const auto& link : links) {
-            if (auto r = mb::util::mkdir_parent(link, 0755); !r) {
-                LOGE("Failed to create directory %s: %s",
-                     mb::util::dir_name(link).c_str(),
-                     r.error().message().c_str());
-            }
+            int dfd = dirs.GetParent(link, true);
+            if (dfd < 0) continue;
 
-            if (symlink(devpath.c_str(), link.c_str()) && errno != EEXIST) {
+            if (symlinkat(devpath.c_str(), dfd, mb::util::base_name(link).c_str())
+                    && errno != EEXIST) {
                 LOGE("Failed to symlink %s to %s: %s",
                      devpath.c_str(), link.c_str(), strerror(errno));
             }
@@ -252,17 +326,27 @@ void DeviceHandler::HandleDevice(const std::string& action, const std::string& d
 
     if (action == "remove") {
         for (const auto& link : links) {
-            if (auto p = mb::util::read_link(link); p && p.value() == devpath) {
-                unlink(link.c_str());
+            int dfd = dirs.GetParent(link, false);
+            if (dfd < 0) continue;
+
+            auto name = mb::util::base_name(link);
+            char target[PATH_MAX];
+            auto n = readlinkat(dfd, name.c_str(), target, sizeof(target));
+            if (n >= 0 && std::string_view(target, static_cast<size_t>(n)) == devpath) {
+                unlinkat(dfd, name.c_str(), 0);
             }
         }
-        unlink(devpath.c_str());
+        if (int dfd = dirs.GetParent(devpath, false); dfd >= 0) {
+            unlinkat(dfd, mb::util::base_name(devpath).c_str(), 0);
+        }
     }
 }
 
-void DeviceHandler::HandleDeviceEvent(const Uevent& uevent) {
+// Returns the device node path or an empty string if the uevent is not for a
+// /dev device
+std::string DeviceHandler::ProcessUevent(DirCache& dirs, const Uevent& uevent) const {
     // if it's not a /dev device, nothing to do
-    if (uevent.major < 0 || uevent.minor < 0) return;
+    if (uevent.major < 0 || uevent.minor < 0) return {};
 
     std::string devpath;
     std::vector<std::string> links;
@@ -289,52 +373,70 @@ void DeviceHandler::HandleDeviceEvent(const Uevent& uevent) {
             }
         } else {
             // ignore other USB events
-            return;
+            return {};
         }
     // Keep up to date with ueventd.rc
     } else if (uevent.subsystem == "adf") {
         devpath = "/dev/" + uevent.device_name;
-    } else if (uevent.subsystem == "graphics") {
-        devpath = "/dev/graphics/" + mb::util::base_name(uevent.path);
-    } else if (uevent.subsystem == "drm") {
-        devpath = "/dev/dri/" + mb::util::base_name(uevent.path);
-    } else if (uevent.subsystem == "oncrpc") {
-        devpath = "/dev/oncrpc/" + mb::util::base_name(uevent.path);
-    } else if (uevent.subsystem == "adsp") {
-        devpath = "/dev/adsp/" + mb::util::base_name(uevent.path);
-    } else if (uevent.subsystem == "msm_camera") {
-        devpath = "/dev/msm_camera/" + mb::util::base_name(uevent.path);
-    } else if (uevent.subsystem == "input") {
-        devpath = "/dev/input/" + mb::util::base_name(uevent.path);
-    } else if (uevent.subsystem == "mtd") {
-        devpath = "/dev/mtd/" + mb::util::base_name(uevent.path);
-    } else if (uevent.subsystem == "sound") {
-        devpath = "/dev/snd/" + mb::util::base_name(uevent.path);
+    } else if (auto it = kSubsystemDirs.find(uevent.subsystem); it != kSubsystemDirs.end()) {
+        devpath = it->second + mb::util::base_name(uevent.path);
     } else {
         devpath = "/dev/" + mb::util::base_name(uevent.path);
     }
 
-    (void) mb::util::mkdir_parent(devpath, 0755);
+    HandleDevice(dirs, uevent.action, devpath, block, uevent.major, uevent.minor, links);
 
-    HandleDevice(uevent.action, devpath, block, uevent.major, uevent.minor, links);
+    return devpath;
+}
 
-    // Add/remove block device mapping
-    if (uevent.subsystem == "block") {
-        if (uevent.action == "add") {
-            BlockDevInfo info;
-            info.path = devpath;
-            info.partition_num = uevent.partition_num;
-            info.major = uevent.major;
-            info.minor = uevent.minor;
-            info.partition_name = uevent.partition_name;
-
-            std::lock_guard<std::mutex> lock(block_dev_mappings_guard_);
-            block_dev_mappings_.insert_or_assign(uevent.path, std::move(info));
-        } else if (uevent.action == "remove") {
-            std::lock_guard<std::mutex> lock(block_dev_mappings_guard_);
-            block_dev_mappings_.erase(uevent.path);
+void DeviceHandler::HandleDeviceEvent(const Uevent& uevent) {
+    HandleDeviceEvents(&uevent, 1);
+}
+
+void DeviceHandler::HandleDeviceEvents(const std::vector<Uevent>& uevents) {
+    HandleDeviceEvents(uevents.data(), uevents.size());
+}
+
+void DeviceHandler::HandleDeviceEvents(const Uevent* uevents, size_t count) {
+    DirCache dirs;
+    std::vector<std::pair<const Uevent*, std::string>> block_events;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto devpath = ProcessUevent(dirs, uevents[i]);
+        if (!devpath.empty() && uevents[i].subsystem == "block") {
+            block_events.emplace_back(&uevents[i], std::move(devpath));
         }
     }
+
+    if (block_events.empty()) return;
+
+    // Add/remove block device mappings for the whole batch at once
+    bool added = false;
+
+    {
+        std::lock_guard<std::mutex> lock(block_dev_mappings_guard_);
+
+        for (auto& [uevent, devpath] : block_events) {
+            if (uevent->action == "add") {
+                BlockDevInfo info;
+                info.path = std::move(devpath);
+                info.partition_num = uevent->partition_num;
+                info.major = uevent->major;
+                info.minor = uevent->minor;
+                info.partition_name = uevent->partition_name;
+
+                block_dev_mappings_.insert_or_assign(uevent->path, std::move(info));
+                ++block_dev_generation_;
+                added = true;
+            } else if (uevent->action == "remove") {
+                block_dev_mappings_.erase(uevent->path);
+            }
+        }
+    }
+
+    if (added) {
+        block_dev_added_.notify_all();
+    }
 }
 
 DeviceHandler::DeviceHandler()
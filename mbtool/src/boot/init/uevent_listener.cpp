@@ -102,28 +102,60 @@ UeventListener::UeventListener() {
     fcntl(device_fd_, F_SETFL, O_NONBLOCK);
 }
 
-bool UeventListener::ReadUevent(Uevent* uevent) const {
-    char msg[UEVENT_MSG_LEN + 2];
-    auto n = uevent_kernel_multicast_recv(device_fd_, msg, UEVENT_MSG_LEN);
-    if (n <= 0) {
-        if (errno != EAGAIN && errno != EWOULDBLOCK) {
-            LOGE("Error reading from Uevent Fd");
-        }
-        return false;
-    }
-    if (n >= UEVENT_MSG_LEN) {
-        LOGE("Uevent overflowed buffer, discarding");
-        // Return true here even if we discard as we may have more uevents pending and we
-        // want to keep processing them.
-        return true;
+// Drains all uevents that are pending on the socket, receiving up to
+// UEVENT_BATCH_MAX messages per syscall. Returns false if no messages could be
+// read.
+bool UeventListener::ReadUevents(std::vector<Uevent>* uevents) const {
+    // The extra two bytes are for the terminating NULs
+    constexpr size_t msg_size = UEVENT_MSG_LEN + 2;
+
+    if (!recv_buf_) {
+        recv_buf_ = std::make_unique<char[]>(msg_size * UEVENT_BATCH_MAX);
     }
 
-    msg[n] = '\0';
-    msg[n + 1] = '\0';
+    uevents->clear();
+    bool received = false;
+
+    while (true) {
+        ssize_t sizes[UEVENT_BATCH_MAX];
+        int count = uevent_kernel_multicast_recv_batch(device_fd_, recv_buf_.get(), msg_size,
+                                                       UEVENT_BATCH_MAX, sizes);
+        if (count <= 0) {
+            if (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOGE("Error reading from Uevent Fd");
+            }
+            break;
+        }
+
+        // Discarded messages count as received as we may have more uevents pending and we want
+        // to keep processing them.
+        received = true;
+
+        for (int i = 0; i < count; ++i) {
+            char* msg = recv_buf_.get() + static_cast<size_t>(i) * msg_size;
+            auto n = sizes[i];
+
+            if (n < 0) {
+                LOGE("Ignoring uevent that was not sent by the kernel");
+                continue;
+            }
+            if (n >= UEVENT_MSG_LEN) {
+                LOGE("Uevent overflowed buffer, discarding");
+                continue;
+            }
+
+            msg[n] = '\0';
+            msg[n + 1] = '\0';
 
-    ParseEvent(msg, uevent);
+            ParseEvent(msg, &uevents->emplace_back());
+        }
 
-    return true;
+        if (count < UEVENT_BATCH_MAX) {
+            break;
+        }
+    }
+
+    return received;
 }
 
 // RegenerateUevents*() walks parts of the /sys tree and pokes the uevent files to cause the kernel
@@ -143,8 +175,9 @@ ListenerAction UeventListener::RegenerateUeventsForDir(DIR* d,
         write(fd, "add\n", 4);
         close(fd);
 
-        Uevent uevent;
-        while (ReadUevent(&uevent)) {
+        std::vector<Uevent> uevents;
+        ReadUevents(&uevents);
+        for (auto const& uevent : uevents) {
             if (callback(uevent) == ListenerAction::kStop) return ListenerAction::kStop;
         }
     }
@@ -188,6 +221,16 @@ void UeventListener::RegenerateUevents(const ListenerCallback& callback) const {
 
 void UeventListener::Poll(const ListenerCallback& callback, int cancel_fd,
                           const std::optional<std::chrono::milliseconds> relative_timeout) const {
+    PollBatch([&](const std::vector<Uevent>& uevents) {
+        for (auto const& uevent : uevents) {
+            if (callback(uevent) == ListenerAction::kStop) return ListenerAction::kStop;
+        }
+        return ListenerAction::kContinue;
+    }, cancel_fd, relative_timeout);
+}
+
+void UeventListener::PollBatch(const BatchListenerCallback& callback, int cancel_fd,
+                               const std::optional<std::chrono::milliseconds> relative_timeout) const {
     using namespace std::chrono;
 
     nfds_t ufds_size = 1;
@@ -230,11 +273,12 @@ void UeventListener::Poll(const ListenerCallback& callback, int cancel_fd,
             break;
         }
         if (ufds[0].revents & POLLIN) {
-            // We're non-blocking, so if we receive a poll event keep processing until
-            // we have exhausted all uevent messages.
-            Uevent uevent;
-            while (ReadUevent(&uevent)) {
-                if (callback(uevent) == ListenerAction::kStop) return;
+            // We're non-blocking, so if we receive a poll event drain all uevent messages
+            // and hand them to the callback together.
+            std::vector<Uevent> uevents;
+            if (ReadUevents(&uevents) && !uevents.empty()
+                    && callback(uevents) == ListenerAction::kStop) {
+                return;
             }
         }
     }
@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <chrono>
+#include <functional>
 #include <thread>
 
 #include <cerrno>
@@ -48,6 +49,7 @@
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
 #include "mbutil/fstab.h"
+#include "mbutil/loopdev.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
@@ -82,6 +84,11 @@ using namespace mb::device;
 namespace mb
 {
 
+// Avoid caching image contents in both the loop device and the backing file.
+// The block size is left alone because mkfs.ext4 uses 1K blocks for small
+// images.
+static constexpr util::LoopDeviceOptions IMAGE_LOOP_OPTIONS{true, 0};
+
 /*!
  * \brief Try mounting each entry in a list of fstab entry until one works.
  *
@@ -368,7 +375,9 @@ static bool mount_ext4(const char *source, const char *target)
     }
 }
 
-static bool try_extsd_mount(const char *block_dev, const char *mount_point)
+static bool try_extsd_mount(const char *block_dev,
+                            const oc::result<std::string> &fstype,
+                            const char *mount_point)
 {
     bool use_fuse_exfat = false;
 
@@ -390,7 +399,6 @@ static bool try_extsd_mount(const char *block_dev, const char *mount_point)
         }
     }
 
-    auto fstype = util::blkid_get_fs_type(block_dev);
     if (!fstype) {
         LOGE("%s: Failed to detect filesystem type: %s",
              block_dev, fstype.error().message().c_str());
@@ -468,15 +476,19 @@ static bool mount_extsd_fstab_entries(const android::init::DeviceHandler &handle
     }
 
     // We can't wait for a block device path to appear since we don't know the
-    // block device path. Thus, we'll match the paths a number of times with a
-    // delay between each attempt.
-    static const int max_attempts = 10;
+    // block device path. Instead, match the known block devices and then wait
+    // for the uevent thread to report new ones until the deadline passes.
+    auto deadline = std::chrono::steady_clock::now() + 20s;
 
-    for (int i = 0; i < max_attempts; ++i) {
-        LOGV("[Attempt %d/%d] Finding and mounting external SD",
-             i + 1, max_attempts);
+    // Avoid reprobing the same devices every time a new device shows up
+    util::BlkidCache blkid_cache;
 
+    while (true) {
+        // Must be read before the map so that no device added in between is
+        // missed
+        auto generation = handler.GetBlockDeviceGeneration();
         auto devices_map = handler.GetBlockDeviceMap();
+        std::vector<std::string> candidates;
 
         for (const util::FstabRec &rec : extsd_recs) {
             std::vector<std::string> patterns =
@@ -502,22 +514,30 @@ static bool mount_extsd_fstab_entries(const android::init::DeviceHandler &handle
                             continue;
                         }
 
-                        if (try_extsd_mount(info.path.c_str(), mount_point)) {
-                            return true;
-                        }
+                        candidates.push_back(info.path);
                     }
                 }
             }
         }
 
-        if (i < max_attempts - 1) {
-            LOGW("No external SD patterns were matched; waiting 1 second");
-            std::this_thread::sleep_for(1s);
+        // Probe all candidates at once since SD cards can be slow to read
+        auto fstypes = blkid_cache.get_fs_types(candidates);
+
+        for (size_t j = 0; j < candidates.size(); ++j) {
+            if (try_extsd_mount(candidates[j].c_str(), fstypes[j],
+                                mount_point)) {
+                return true;
+            }
+        }
+
+        LOGW("No external SD could be mounted; waiting for new block devices");
+
+        if (!handler.WaitForBlockDevice(generation, deadline)) {
+            break;
         }
     }
 
-    LOGE("No external SD patterns were matched after %d attempts",
-         max_attempts);
+    LOGE("No external SD could be mounted before the deadline");
 
     return false;
 }
@@ -552,7 +572,7 @@ static bool mount_target(const char *source, const char *target, bool bind,
     auto ret = util::mount(source, target,
                            bind ? "" : "auto",
                            (bind ? MS_BIND : 0) | (read_only ? MS_RDONLY : 0),
-                           "");
+                           "", IMAGE_LOOP_OPTIONS);
     if (!ret) {
         LOGE("%s: Failed to mount: %s: %s", target, source, strerror(errno));
         return false;
@@ -599,11 +619,8 @@ static bool mount_target(const char *source, const char *target, bool bind,
 /*!
  * \brief Mount all system image files to /raw/images/[ROM ID]
  */
-static bool mount_all_system_images()
+static bool mount_all_system_images(const Roms &roms)
 {
-    Roms roms;
-    roms.add_installed();
-
     bool failed = false;
 
     for (const std::shared_ptr<Rom> &rom : roms.roms) {
@@ -898,38 +915,6 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         return false;
     }
 
-    bool ret = true;
-
-    // Mount system
-    if (ret && !recs.system.empty()) {
-        if (create_dir_and_mount(recs.system, SYSTEM_MOUNT_POINT, 0755)) {
-            successful.push_back(SYSTEM_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " SYSTEM_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
-    // Mount cache
-    if (ret && !recs.cache.empty()) {
-        if (create_dir_and_mount(recs.cache, CACHE_MOUNT_POINT, 0755)) {
-            successful.push_back(CACHE_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " CACHE_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
-    // Mount data
-    if (ret && !recs.data.empty()) {
-        if (create_dir_and_mount(recs.data, DATA_MOUNT_POINT, 0755)) {
-            successful.push_back(DATA_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " DATA_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
     // Mount external SD only if ROM is installed on the external SD. This is
     // necessary because mount_extsd_fstab_entries() blocks until an SD card is
     // found or a timeout occurs.
@@ -940,12 +925,60 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         LOGV("Skipping extsd mount because ROM is not an extsd-slot");
     }
 
-    if (ret && !recs.extsd.empty() && require_extsd) {
-        if (mount_extsd_fstab_entries(
-                handler, recs.extsd, EXTSD_MOUNT_POINT, 0755)) {
-            successful.push_back(EXTSD_MOUNT_POINT);
+    // None of the partitions mounted under /raw depend on each other, so they
+    // are all mounted concurrently. This way, a slow mount (eg. a journal
+    // replay or an fsck of the external SD) doesn't delay the others.
+    struct MountJob
+    {
+        const char *mount_point;
+        std::function<bool()> func;
+        bool result;
+    };
+
+    std::vector<MountJob> jobs;
+
+    for (auto const &[entries, mount_point] : {
+        std::make_pair(&recs.system, SYSTEM_MOUNT_POINT),
+        std::make_pair(&recs.cache, CACHE_MOUNT_POINT),
+        std::make_pair(&recs.data, DATA_MOUNT_POINT),
+    }) {
+        if (!entries->empty()) {
+            // Structured bindings can't be captured directly in C++17
+            jobs.push_back({mount_point, [e = entries, m = mount_point] {
+                return create_dir_and_mount(*e, m, 0755);
+            }, false});
+        }
+    }
+
+    if (!recs.extsd.empty() && require_extsd) {
+        jobs.push_back({EXTSD_MOUNT_POINT, [&] {
+            return mount_extsd_fstab_entries(
+                    handler, recs.extsd, EXTSD_MOUNT_POINT, 0755);
+        }, false});
+    }
+
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(jobs.size());
+
+        for (auto &job : jobs) {
+            threads.emplace_back([&job] {
+                job.result = job.func();
+            });
+        }
+
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    bool ret = true;
+
+    for (auto const &job : jobs) {
+        if (job.result) {
+            successful.push_back(job.mount_point);
         } else {
-            LOGE("Failed to mount " EXTSD_MOUNT_POINT);
+            LOGE("Failed to mount %s", job.mount_point);
             ret = false;
         }
     }
@@ -990,6 +1023,21 @@ bool mount_rom(const std::shared_ptr<Rom> &rom)
         return false;
     }
 
+    Roms roms;
+    roms.add_installed();
+
+    // Set up enough loop devices for the ROM's images and the system images
+    // of every installed ROM at once instead of searching for a free one
+    // before each mount
+    int loopdevs = rom->system_is_image + rom->cache_is_image
+            + rom->data_is_image;
+    for (auto const &r : roms.roms) {
+        loopdevs += r->system_is_image;
+    }
+    if (loopdevs > 0) {
+        util::loopdev_pool_init(loopdevs);
+    }
+
     if (!mount_target(target_system.c_str(), "/system", !rom->system_is_image,
                       true)) {
         return false;
@@ -1016,7 +1064,7 @@ bool mount_rom(const std::shared_ptr<Rom> &rom)
         return false;
     }
 
-    mount_all_system_images();
+    mount_all_system_images(roms);
 
     bool require_extsd = rom->system_source == Rom::Source::ExternalSd
             || rom->cache_source == Rom::Source::ExternalSd
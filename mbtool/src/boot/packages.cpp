@@ -22,15 +22,23 @@
 #include <algorithm>
 
 #include <cassert>
+#include <cctype>
 #include <cstdlib>
 #include <cinttypes>
 #include <cstring>
 #include <ctime>
 
-#include <pugixml.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/integer.h"
+#include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+
+#include "boot/xml_pull_parser.h"
 
 #define LOG_TAG "mbtool/util/packages"
 
@@ -93,12 +101,9 @@ static const char *ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_REQUIRES_ISA
 static const char *ATTR_SAMSUNG_SECONDARY_NATIVE_LIBRARY_DIR
                                              = "secondaryNativeLibraryDir";
 
-static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg);
-static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg);
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs);
-static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs);
+static void log_parse_error(const XmlPullParser &parser, std::error_code ec);
+static bool skip_tag(XmlPullParser &parser);
+static bool parse_tag_packages(XmlPullParser &parser, Packages *pkgs);
 
 
 Package::Package() :
@@ -317,52 +322,111 @@ bool Packages::load_xml(const std::string &path)
 {
     pkgs.clear();
     sigs.clear();
+    _by_name.clear();
+    _by_uid.clear();
 
-    pugi::xml_document doc;
-    pugi::xml_parse_result result = doc.load_file(path.c_str());
-    if (!result) {
-        LOGE("Failed to parse XML file: %s: %s",
-             path.c_str(), result.description());
+    auto data = util::file_read_all(path);
+    if (!data) {
+        LOGE("%s: Failed to read file: %s",
+             path.c_str(), data.error().message().c_str());
         return false;
     }
 
-    pugi::xml_node root = doc.root();
+    XmlPullParser parser(data.value());
 
-    for (pugi::xml_node cur_node : root.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
+    while (true) {
+        auto event = parser.next();
+        if (!event) {
+            log_parse_error(parser, event.error());
+            LOGE("Failed to parse XML file: %s", path.c_str());
+            return false;
+        } else if (event.value() == XmlPullParser::Event::EndDocument) {
+            break;
         }
 
-        if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
-            if (!parse_tag_packages(cur_node, this)) {
+        // Only start tags can appear at the root
+        auto name = parser.name();
+
+        if (name == TAG_PACKAGES) {
+            if (!parse_tag_packages(parser, this)) {
+                LOGE("Failed to parse XML file: %s", path.c_str());
                 return false;
             }
         } else {
-            LOGW("Unrecognized root tag: %s", cur_node.name());
+            LOGW("Unrecognized root tag: %.*s",
+                 static_cast<int>(name.size()), name.data());
+            if (!skip_tag(parser)) {
+                LOGE("Failed to parse XML file: %s", path.c_str());
+                return false;
+            }
         }
     }
 
+    build_index();
+
     return true;
 }
 
-static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg)
+static void log_parse_error(const XmlPullParser &parser, std::error_code ec)
 {
-    assert(strcmp(node.name(), TAG_CERT) == 0);
+    LOGE("XML parse error at offset %" MB_PRIzu ": %s",
+         parser.offset(), ec.message().c_str());
+}
+
+static bool skip_tag(XmlPullParser &parser)
+{
+    if (auto r = parser.skip_subtree(); !r) {
+        log_parse_error(parser, r.error());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get next child start tag of the current element
+ *
+ * \return True if a child start tag was found. False if the end tag of the
+ *         current element was reached or an error occurred (\p error is set).
+ */
+static bool next_child(XmlPullParser &parser, bool &error)
+{
+    auto event = parser.next();
+    if (!event) {
+        log_parse_error(parser, event.error());
+        error = true;
+        return false;
+    }
+
+    // EndDocument cannot be returned while inside an element
+    error = false;
+    return event.value() == XmlPullParser::Event::StartTag;
+}
+
+static bool parse_tag_cert(XmlPullParser &parser, Packages *pkgs,
+                           const std::shared_ptr<Package> &pkg)
+{
+    assert(parser.name() == TAG_CERT);
 
     std::string index;
     std::string key;
 
-    for (pugi::xml_attribute attr : node.attributes()) {
-        const pugi::char_t *name = attr.name();
-        const pugi::char_t *value = attr.value();
-
-        if (strcmp(name, ATTR_INDEX) == 0) {
-            index = value;
-        } else if (strcmp(name, ATTR_KEY) == 0) {
-            key = value;
+    for (auto const &attr : parser.attributes()) {
+        if (attr.name == ATTR_INDEX) {
+            index = attr.value;
+        } else if (attr.name == ATTR_KEY) {
+            // ABX stores the key as bytes, which are formatted as uppercase
+            // hex. Normalize to the lowercase form used in text XML and by
+            // the whitelisted certificates.
+            key = attr.value;
+            std::transform(key.begin(), key.end(), key.begin(), [](char c) {
+                return static_cast<char>(
+                        tolower(static_cast<unsigned char>(c)));
+            });
         } else {
-            LOGW("Unrecognized attribute '%s' in <%s>", name, TAG_CERT);
+            LOGW("Unrecognized attribute '%.*s' in <%s>",
+                 static_cast<int>(attr.name.size()), attr.name.data(),
+                 TAG_CERT);
         }
     }
 
@@ -386,207 +450,547 @@ static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
         }
     }
 
-    return true;
+    // <cert> has no children that are used
+    return skip_tag(parser);
 }
 
-static bool parse_tag_sigs(pugi::xml_node node, Packages *pkgs,
-                           std::shared_ptr<Package> pkg)
+static bool parse_tag_sigs(XmlPullParser &parser, Packages *pkgs,
+                           const std::shared_ptr<Package> &pkg)
 {
-    assert(strcmp(node.name(), TAG_SIGS) == 0);
+    assert(parser.name() == TAG_SIGS);
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
-        }
+    bool error;
 
-        if (strcmp(cur_node.name(), TAG_SIGS) == 0) {
-            LOGW("Nested <%s> is not allowed", TAG_SIGS);
-        } else if (strcmp(cur_node.name(), TAG_CERT) == 0) {
-            if (!parse_tag_cert(cur_node, pkgs, pkg)) {
+    while (next_child(parser, error)) {
+        auto name = parser.name();
+
+        if (name == TAG_CERT) {
+            if (!parse_tag_cert(parser, pkgs, pkg)) {
                 return false;
             }
+            continue;
+        } else if (name == TAG_SIGS) {
+            LOGW("Nested <%s> is not allowed", TAG_SIGS);
         } else {
-            LOGW("Unrecognized <%s> within <%s>", cur_node.name(), TAG_SIGS);
+            LOGW("Unrecognized <%.*s> within <%s>",
+                 static_cast<int>(name.size()), name.data(), TAG_SIGS);
+        }
+
+        if (!skip_tag(parser)) {
+            return false;
         }
     }
 
-    return true;
+    return !error;
 }
 
-static bool parse_tag_package(pugi::xml_node node, Packages *pkgs)
+static bool parse_tag_package(XmlPullParser &parser, Packages *pkgs)
 {
-    assert(strcmp(node.name(), TAG_PACKAGE) == 0);
+    assert(parser.name() == TAG_PACKAGE);
 
     std::shared_ptr<Package> pkg(new Package());
 
-    for (pugi::xml_attribute attr : node.attributes()) {
-        const pugi::char_t *name = attr.name();
-        const pugi::char_t *value = attr.value();
+    for (auto const &attr : parser.attributes()) {
+        auto name = attr.name;
+        const char *value = attr.value.c_str();
 
-        if (strcmp(name, ATTR_CODE_PATH) == 0) {
-            pkg->code_path = value;
-        } else if (strcmp(name, ATTR_CPU_ABI_OVERRIDE) == 0) {
-            pkg->cpu_abi_override = value;
-        } else if (strcmp(name, ATTR_FLAGS) == 0) {
+        if (name == ATTR_CODE_PATH) {
+            pkg->code_path = attr.value;
+        } else if (name == ATTR_CPU_ABI_OVERRIDE) {
+            pkg->cpu_abi_override = attr.value;
+        } else if (name == ATTR_FLAGS) {
             int64_t flags; // Parse as signed integer
             if (!str_to_num(value, 10, flags)) {
                 LOGE("Invalid flags: '%s'", value);
                 return false;
             }
             pkg->pkg_flags = static_cast<Package::Flag>(flags);
-        } else if (strcmp(name, ATTR_PUBLIC_FLAGS) == 0) {
+        } else if (name == ATTR_PUBLIC_FLAGS) {
             int64_t flags; // Parse as signed integer
             if (!str_to_num(value, 10, flags)) {
                 LOGE("Invalid public flags: '%s'", value);
                 return false;
             }
             pkg->pkg_public_flags = static_cast<Package::PublicFlag>(flags);
-        } else if (strcmp(name, ATTR_PRIVATE_FLAGS) == 0) {
+        } else if (name == ATTR_PRIVATE_FLAGS) {
             int64_t flags; // Parse as signed integer
             if (!str_to_num(value, 10, flags)) {
                 LOGE("Invalid private flags: '%s'", value);
                 return false;
             }
             pkg->pkg_private_flags = static_cast<Package::PrivateFlag>(flags);
-        } else if (strcmp(name, ATTR_FT) == 0) {
+        } else if (name == ATTR_FT) {
             if (!str_to_num(value, 16, pkg->timestamp)) {
                 LOGE("Invalid ft timestamp: '%s'", value);
                 return false;
             }
-        } else if (strcmp(name, ATTR_INSTALL_STATUS) == 0) {
-            pkg->install_status = value;
-        } else if (strcmp(name, ATTR_INSTALLER) == 0) {
-            pkg->installer = value;
-        } else if (strcmp(name, ATTR_IT) == 0) {
+        } else if (name == ATTR_INSTALL_STATUS) {
+            pkg->install_status = attr.value;
+        } else if (name == ATTR_INSTALLER) {
+            pkg->installer = attr.value;
+        } else if (name == ATTR_IT) {
             if (!str_to_num(value, 16, pkg->first_install_time)) {
                 LOGE("Invalid first install timestamp: '%s'", value);
                 return false;
             }
-        } else if (strcmp(name, ATTR_NAME) == 0) {
-            pkg->name = value;
-        } else if (strcmp(name, ATTR_NATIVE_LIBRARY_PATH) == 0) {
-            pkg->native_library_path = value;
-        } else if (strcmp(name, ATTR_PRIMARY_CPU_ABI) == 0) {
-            pkg->primary_cpu_abi = value;
-        } else if (strcmp(name, ATTR_REAL_NAME) == 0) {
-            pkg->real_name = value;
-        } else if (strcmp(name, ATTR_RESOURCE_PATH) == 0) {
-            pkg->resource_path = value;
-        } else if (strcmp(name, ATTR_SECONDARY_CPU_ABI) == 0) {
-            pkg->secondary_cpu_abi = value;
-        } else if (strcmp(name, ATTR_SHARED_USER_ID) == 0) {
+        } else if (name == ATTR_NAME) {
+            pkg->name = attr.value;
+        } else if (name == ATTR_NATIVE_LIBRARY_PATH) {
+            pkg->native_library_path = attr.value;
+        } else if (name == ATTR_PRIMARY_CPU_ABI) {
+            pkg->primary_cpu_abi = attr.value;
+        } else if (name == ATTR_REAL_NAME) {
+            pkg->real_name = attr.value;
+        } else if (name == ATTR_RESOURCE_PATH) {
+            pkg->resource_path = attr.value;
+        } else if (name == ATTR_SECONDARY_CPU_ABI) {
+            pkg->secondary_cpu_abi = attr.value;
+        } else if (name == ATTR_SHARED_USER_ID) {
             if (!str_to_num(value, 10, pkg->shared_user_id)) {
                 LOGE("Invalid shared user ID: '%s'", value);
                 return false;
             }
             pkg->is_shared_user = 1;
-        } else if (strcmp(name, ATTR_UID_ERROR) == 0) {
-            pkg->uid_error = value;
-        } else if (strcmp(name, ATTR_USER_ID) == 0) {
+        } else if (name == ATTR_UID_ERROR) {
+            pkg->uid_error = attr.value;
+        } else if (name == ATTR_USER_ID) {
             if (!str_to_num(value, 10, pkg->user_id)) {
                 LOGE("Invalid user ID: '%s'", value);
                 return false;
             }
             pkg->is_shared_user = 0;
-        } else if (strcmp(name, ATTR_UT) == 0) {
+        } else if (name == ATTR_UT) {
             if (!str_to_num(value, 16, pkg->last_update_time)) {
                 LOGE("Invalid last update timestamp: '%s'", value);
                 return false;
             }
-        } else if (strcmp(name, ATTR_VERSION) == 0) {
+        } else if (name == ATTR_VERSION) {
             if (!str_to_num(value, 10, pkg->version)) {
                 LOGE("Invalid version: '%s'", value);
                 return false;
             }
-        } else if (strcmp(name, ATTR_SAMSUNG_DM) == 0
-                || strcmp(name, ATTR_SAMSUNG_DT) == 0
-                || strcmp(name, ATTR_SAMSUNG_NATIVE_LIBRARY_DIR) == 0
-                || strcmp(name, ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_DIR) == 0
-                || strcmp(name, ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_REQUIRES_ISA) == 0
-                || strcmp(name, ATTR_SAMSUNG_SECONDARY_NATIVE_LIBRARY_DIR) == 0) {
+        } else if (name == ATTR_SAMSUNG_DM
+                || name == ATTR_SAMSUNG_DT
+                || name == ATTR_SAMSUNG_NATIVE_LIBRARY_DIR
+                || name == ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_DIR
+                || name == ATTR_SAMSUNG_NATIVE_LIBRARY_ROOT_REQUIRES_ISA
+                || name == ATTR_SAMSUNG_SECONDARY_NATIVE_LIBRARY_DIR) {
             // Ignore Samsung-specific attributes
         } else {
-            LOGW("Unrecognized attribute '%s' in <%s>", name, TAG_PACKAGE);
+            LOGW("Unrecognized attribute '%.*s' in <%s>",
+                 static_cast<int>(name.size()), name.data(), TAG_PACKAGE);
         }
     }
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
-        }
+    bool error;
 
-        if (strcmp(cur_node.name(), TAG_PACKAGE) == 0) {
-            LOGW("Nested <%s> is not allowed", TAG_PACKAGE);
-        } else if (strcmp(cur_node.name(), TAG_DEFINED_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_DOMAIN_VERIFICATION) == 0
-                || strcmp(cur_node.name(), TAG_PERMS) == 0
-                || strcmp(cur_node.name(), TAG_PROPER_SIGNING_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_SIGNING_KEYSET) == 0
-                || strcmp(cur_node.name(), TAG_UPGRADE_KEYSET) == 0) {
-            // Ignore
-        } else if (strcmp(cur_node.name(), TAG_SIGS) == 0) {
-            if (!parse_tag_sigs(cur_node, pkgs, pkg)) {
+    while (next_child(parser, error)) {
+        auto name = parser.name();
+
+        if (name == TAG_SIGS) {
+            if (!parse_tag_sigs(parser, pkgs, pkg)) {
                 return false;
             }
+            continue;
+        } else if (name == TAG_PACKAGE) {
+            LOGW("Nested <%s> is not allowed", TAG_PACKAGE);
+        } else if (name == TAG_DEFINED_KEYSET
+                || name == TAG_DOMAIN_VERIFICATION
+                || name == TAG_PERMS
+                || name == TAG_PROPER_SIGNING_KEYSET
+                || name == TAG_SIGNING_KEYSET
+                || name == TAG_UPGRADE_KEYSET) {
+            // Ignore
         } else {
-            LOGW("Unrecognized <%s> within <%s>", cur_node.name(), TAG_PACKAGE);
+            LOGW("Unrecognized <%.*s> within <%s>",
+                 static_cast<int>(name.size()), name.data(), TAG_PACKAGE);
+        }
+
+        if (!skip_tag(parser)) {
+            return false;
         }
     }
 
+    if (error) {
+        return false;
+    }
+
     pkgs->pkgs.push_back(std::move(pkg));
 
     return true;
 }
 
-static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
+static bool parse_tag_packages(XmlPullParser &parser, Packages *pkgs)
 {
-    assert(strcmp(node.name(), TAG_PACKAGES) == 0);
+    assert(parser.name() == TAG_PACKAGES);
 
-    for (pugi::xml_node cur_node : node.children()) {
-        if (cur_node.type() != pugi::xml_node_type::node_element) {
-            continue;
-        }
+    bool error;
 
-        if (strcmp(cur_node.name(), TAG_PACKAGES) == 0) {
-            LOGW("Nested <%s> is not allowed", TAG_PACKAGES);
-        } else if (strcmp(cur_node.name(), TAG_PACKAGE) == 0) {
-            if (!parse_tag_package(cur_node, pkgs)) {
+    while (next_child(parser, error)) {
+        auto name = parser.name();
+
+        if (name == TAG_PACKAGE) {
+            if (!parse_tag_package(parser, pkgs)) {
                 return false;
             }
-        } else if (strcmp(cur_node.name(), TAG_DATABASE_VERSION) == 0
-                || strcmp(cur_node.name(), TAG_KEYSET_SETTINGS) == 0
-                || strcmp(cur_node.name(), TAG_LAST_PLATFORM_VERSION) == 0
-                || strcmp(cur_node.name(), TAG_PERMISSION_TREES) == 0
-                || strcmp(cur_node.name(), TAG_PERMISSIONS) == 0
-                || strcmp(cur_node.name(), TAG_RENAMED_PACKAGE) == 0
-                || strcmp(cur_node.name(), TAG_SHARED_USER) == 0
-                || strcmp(cur_node.name(), TAG_UPDATED_PACKAGE) == 0
-                || strcmp(cur_node.name(), TAG_VERSION) == 0) {
+            continue;
+        } else if (name == TAG_PACKAGES) {
+            LOGW("Nested <%s> is not allowed", TAG_PACKAGES);
+        } else if (name == TAG_DATABASE_VERSION
+                || name == TAG_KEYSET_SETTINGS
+                || name == TAG_LAST_PLATFORM_VERSION
+                || name == TAG_PERMISSION_TREES
+                || name == TAG_PERMISSIONS
+                || name == TAG_RENAMED_PACKAGE
+                || name == TAG_SHARED_USER
+                || name == TAG_UPDATED_PACKAGE
+                || name == TAG_VERSION) {
             // Ignore
         } else {
-            LOGW("Unrecognized <%s> within <%s>", cur_node.name(), TAG_PACKAGES);
+            LOGW("Unrecognized <%.*s> within <%s>",
+                 static_cast<int>(name.size()), name.data(), TAG_PACKAGES);
+        }
+
+        // Skipped subtrees are scanned without decoding attribute values
+        if (!skip_tag(parser)) {
+            return false;
         }
     }
 
+    return !error;
+}
+
+// Snapshot format (native byte order, since snapshots never leave the device):
+//   magic, XML file identity (dev, ino, size, mtime, ctime), signatures,
+//   packages. Strings are stored as a 32-bit length followed by the bytes.
+static constexpr char SNAPSHOT_MAGIC[8] = {
+    'M', 'B', 'P', 'K', 'G', 'S', '0', '2'
+};
+
+namespace
+{
+
+class SnapshotWriter
+{
+public:
+    std::string buf;
+
+    template<typename T>
+    void write(T value)
+    {
+        buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void write(const std::string &str)
+    {
+        write(static_cast<uint32_t>(str.size()));
+        buf += str;
+    }
+};
+
+class SnapshotReader
+{
+public:
+    SnapshotReader(std::string_view data) : _data(data)
+    {
+    }
+
+    template<typename T>
+    bool read(T &value)
+    {
+        if (_data.size() < sizeof(value)) {
+            return false;
+        }
+        memcpy(&value, _data.data(), sizeof(value));
+        _data.remove_prefix(sizeof(value));
+        return true;
+    }
+
+    bool read(std::string &str)
+    {
+        uint32_t size;
+        if (!read(size) || _data.size() < size) {
+            return false;
+        }
+        str.assign(_data.data(), size);
+        _data.remove_prefix(size);
+        return true;
+    }
+
+    bool at_end() const
+    {
+        return _data.empty();
+    }
+
+private:
+    std::string_view _data;
+};
+
+}
+
+static void write_file_identity(SnapshotWriter &writer, const struct stat &sb)
+{
+    writer.write(static_cast<uint64_t>(sb.st_dev));
+    writer.write(static_cast<uint64_t>(sb.st_ino));
+    writer.write(static_cast<uint64_t>(sb.st_size));
+    writer.write(static_cast<int64_t>(sb.st_mtim.tv_sec));
+    writer.write(static_cast<int64_t>(sb.st_mtim.tv_nsec));
+    writer.write(static_cast<int64_t>(sb.st_ctim.tv_sec));
+    writer.write(static_cast<int64_t>(sb.st_ctim.tv_nsec));
+}
+
+static std::string serialize_snapshot(const Packages &pkgs,
+                                      const struct stat &sb)
+{
+    SnapshotWriter writer;
+
+    writer.buf.append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    write_file_identity(writer, sb);
+
+    writer.write(static_cast<uint32_t>(pkgs.sigs.size()));
+    for (auto const &[index, key] : pkgs.sigs) {
+        writer.write(index);
+        writer.write(key);
+    }
+
+    writer.write(static_cast<uint32_t>(pkgs.pkgs.size()));
+    for (auto const &pkg : pkgs.pkgs) {
+        writer.write(pkg->name);
+        writer.write(pkg->real_name);
+        writer.write(pkg->code_path);
+        writer.write(pkg->resource_path);
+        writer.write(pkg->native_library_path);
+        writer.write(pkg->primary_cpu_abi);
+        writer.write(pkg->secondary_cpu_abi);
+        writer.write(pkg->cpu_abi_override);
+        writer.write(static_cast<uint64_t>(pkg->pkg_flags));
+        writer.write(static_cast<uint64_t>(pkg->pkg_public_flags));
+        writer.write(static_cast<uint64_t>(pkg->pkg_private_flags));
+        writer.write(pkg->timestamp);
+        writer.write(pkg->first_install_time);
+        writer.write(pkg->last_update_time);
+        writer.write(static_cast<int32_t>(pkg->version));
+        writer.write(static_cast<int32_t>(pkg->is_shared_user));
+        writer.write(static_cast<int32_t>(pkg->user_id));
+        writer.write(static_cast<int32_t>(pkg->shared_user_id));
+        writer.write(pkg->uid_error);
+        writer.write(pkg->install_status);
+        writer.write(pkg->installer);
+
+        writer.write(static_cast<uint32_t>(pkg->sig_indexes.size()));
+        for (auto const &index : pkg->sig_indexes) {
+            writer.write(index);
+        }
+    }
+
+    return std::move(writer.buf);
+}
+
+static bool read_int(SnapshotReader &reader, int &value)
+{
+    int32_t temp;
+    if (!reader.read(temp)) {
+        return false;
+    }
+    value = temp;
+    return true;
+}
+
+template<typename FlagsType>
+static bool read_flags(SnapshotReader &reader, FlagsType &value)
+{
+    uint64_t temp;
+    if (!reader.read(temp)) {
+        return false;
+    }
+    value = static_cast<typename FlagsType::enum_type>(temp);
     return true;
 }
 
+static bool deserialize_snapshot(Packages &pkgs, std::string_view data,
+                                 const struct stat &sb)
+{
+    if (data.size() < sizeof(SNAPSHOT_MAGIC)
+            || memcmp(data.data(), SNAPSHOT_MAGIC,
+                      sizeof(SNAPSHOT_MAGIC)) != 0) {
+        return false;
+    }
+    data.remove_prefix(sizeof(SNAPSHOT_MAGIC));
+
+    // The snapshot is only valid for the exact file it was created from
+    SnapshotWriter identity;
+    write_file_identity(identity, sb);
+
+    if (data.substr(0, identity.buf.size()) != identity.buf) {
+        return false;
+    }
+    data.remove_prefix(identity.buf.size());
+
+    SnapshotReader reader(data);
+    uint32_t count;
+
+    if (!reader.read(count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        std::string index;
+        std::string key;
+
+        if (!reader.read(index) || !reader.read(key)) {
+            return false;
+        }
+        pkgs.sigs.insert_or_assign(std::move(index), std::move(key));
+    }
+
+    if (!reader.read(count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        auto pkg = std::make_shared<Package>();
+        uint32_t sig_count;
+
+        if (!reader.read(pkg->name)
+                || !reader.read(pkg->real_name)
+                || !reader.read(pkg->code_path)
+                || !reader.read(pkg->resource_path)
+                || !reader.read(pkg->native_library_path)
+                || !reader.read(pkg->primary_cpu_abi)
+                || !reader.read(pkg->secondary_cpu_abi)
+                || !reader.read(pkg->cpu_abi_override)
+                || !read_flags(reader, pkg->pkg_flags)
+                || !read_flags(reader, pkg->pkg_public_flags)
+                || !read_flags(reader, pkg->pkg_private_flags)
+                || !reader.read(pkg->timestamp)
+                || !reader.read(pkg->first_install_time)
+                || !reader.read(pkg->last_update_time)
+                || !read_int(reader, pkg->version)
+                || !read_int(reader, pkg->is_shared_user)
+                || !read_int(reader, pkg->user_id)
+                || !read_int(reader, pkg->shared_user_id)
+                || !reader.read(pkg->uid_error)
+                || !reader.read(pkg->install_status)
+                || !reader.read(pkg->installer)
+                || !reader.read(sig_count)) {
+            return false;
+        }
+
+        for (uint32_t j = 0; j < sig_count; ++j) {
+            std::string index;
+            if (!reader.read(index)) {
+                return false;
+            }
+            pkg->sig_indexes.push_back(std::move(index));
+        }
+
+        pkgs.pkgs.push_back(std::move(pkg));
+    }
+
+    return reader.at_end();
+}
+
+static std::string snapshot_path(const std::string &snapshot_dir,
+                                 const std::string &path)
+{
+    std::string name(path);
+    std::replace(name.begin(), name.end(), '/', '_');
+
+    std::string result(snapshot_dir);
+    result += '/';
+    result += name;
+    result += ".bin";
+    return result;
+}
+
+/*!
+ * \brief Load packages.xml, using a binary snapshot if it is up to date
+ *
+ * The snapshot in \p snapshot_dir is only used if it was created from the
+ * same file (device, inode, size, mtime and ctime). Otherwise, the XML file is
+ * parsed and a new snapshot is written. A snapshot that cannot be written is
+ * not an error. \p snapshot_dir is created with mode 0700 since the snapshots
+ * are trusted as much as the original file.
+ *
+ * \param path Path to packages.xml
+ * \param snapshot_dir Directory for snapshots
+ *
+ * \return Whether the packages were loaded
+ */
+bool Packages::load_xml_cached(const std::string &path,
+                               const std::string &snapshot_dir)
+{
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return load_xml(path);
+    }
+
+    std::string snapshot = snapshot_path(snapshot_dir, path);
+
+    if (auto data = util::file_read_all(snapshot)) {
+        pkgs.clear();
+        sigs.clear();
+
+        if (deserialize_snapshot(*this, data.value(), sb)) {
+            build_index();
+            return true;
+        }
+
+        LOGW("%s: Ignoring outdated or invalid snapshot", snapshot.c_str());
+    }
+
+    if (!load_xml(path)) {
+        return false;
+    }
+
+    if (auto r = util::mkdir_recursive(snapshot_dir, 0700); !r) {
+        LOGW("%s: Failed to create directory: %s",
+             snapshot_dir.c_str(), r.error().message().c_str());
+        return true;
+    }
+
+    // Write to a temporary file first so concurrent readers never see a
+    // partial snapshot
+    std::string data = serialize_snapshot(*this, sb);
+    std::string temp_path = format("%s.%d", snapshot.c_str(), getpid());
+
+    if (auto r = util::file_write_data(temp_path, data.data(), data.size());
+            !r) {
+        LOGW("%s: Failed to write snapshot: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        unlink(temp_path.c_str());
+    } else if (rename(temp_path.c_str(), snapshot.c_str()) < 0) {
+        LOGW("%s: Failed to rename snapshot: %s",
+             temp_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+    }
+
+    return true;
+}
+
+void Packages::build_index()
+{
+    _by_name.clear();
+    _by_uid.clear();
+
+    // Keep the first match, like the linear searches did
+    for (auto const &pkg : pkgs) {
+        _by_name.emplace(pkg->name, pkg);
+
+        if (!pkg->is_shared_user) {
+            _by_uid.emplace(static_cast<uid_t>(pkg->user_id), pkg);
+        }
+    }
+}
+
 std::shared_ptr<Package> Packages::find_by_uid(uid_t uid) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return !pkg->is_shared_user && pkg->user_id == static_cast<int>(uid);
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = _by_uid.find(uid);
+    return it == _by_uid.end() ? std::shared_ptr<Package>() : it->second;
 }
 
 std::shared_ptr<Package> Packages::find_by_pkg(const std::string &pkg_id) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return pkg->name == pkg_id;
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = _by_name.find(pkg_id);
+    return it == _by_name.end() ? std::shared_ptr<Package>() : it->second;
 }
 
 }
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot/rom_registry.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "mblog/logging.h"
+#include "mbutil/path.h"
+#include "mbutil/properties.h"
+
+#include "util/multiboot.h"
+#include "util/romconfig.h"
+
+#define LOG_TAG "mbtool/boot/rom_registry"
+
+namespace mb
+{
+
+static constexpr uint32_t WATCH_MASK =
+        IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE
+        | IN_DELETE_SELF | IN_MOVE_SELF;
+
+static std::string build_prop_path(const Rom &rom,
+                                   const std::string &system_path)
+{
+    std::string path;
+    if (rom.system_is_image) {
+        path += "/raw/images/";
+        path += rom.id;
+    } else {
+        path += system_path;
+    }
+    path += "/build.prop";
+    return path;
+}
+
+RomRegistry::RomRegistry()
+    : m_valid(false)
+    , m_inotify_fd(-1)
+    , m_mounts_fd(-1)
+{
+}
+
+RomRegistry::~RomRegistry()
+{
+    if (m_inotify_fd >= 0) {
+        close(m_inotify_fd);
+    }
+    if (m_mounts_fd >= 0) {
+        close(m_mounts_fd);
+    }
+}
+
+/*!
+ * \brief Get the list of installed ROMs
+ *
+ * The ROMs are only rescanned if something that could affect the result has
+ * changed since the last scan.
+ *
+ * \return Installed ROMs and the build properties needed by clients
+ */
+const std::vector<RomRegistryEntry> & RomRegistry::installed_roms()
+{
+    if (is_stale()) {
+        rescan();
+    }
+
+    return m_entries;
+}
+
+/*!
+ * \brief Force the next call to installed_roms() to rescan
+ */
+void RomRegistry::invalidate()
+{
+    m_valid = false;
+}
+
+bool RomRegistry::is_stale()
+{
+    if (!m_valid || m_inotify_fd < 0) {
+        return true;
+    }
+
+    // Mounting or unmounting (eg. the external SD card) shows up as a priority
+    // event on the mount table
+    if (m_mounts_fd >= 0) {
+        pollfd pfd = {};
+        pfd.fd = m_mounts_fd;
+        pfd.events = POLLPRI;
+
+        if (poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLPRI | POLLERR))) {
+            return true;
+        }
+    }
+
+    // Any event, including a queue overflow, can change the result
+    alignas(inotify_event) char buf[4096];
+    ssize_t n = read(m_inotify_fd, buf, sizeof(buf));
+    if (n < 0) {
+        return errno != EAGAIN;
+    }
+
+    return true;
+}
+
+void RomRegistry::rescan()
+{
+    m_valid = false;
+    m_entries.clear();
+
+    if (m_inotify_fd >= 0) {
+        close(m_inotify_fd);
+    }
+    if (m_mounts_fd >= 0) {
+        close(m_mounts_fd);
+    }
+
+    m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify_fd < 0) {
+        LOGW("Failed to initialize inotify: %s", strerror(errno));
+    }
+
+    m_mounts_fd = open("/proc/self/mounts", O_RDONLY | O_CLOEXEC);
+    if (m_mounts_fd < 0) {
+        LOGW("Failed to open mount table: %s", strerror(errno));
+    }
+
+    // Add the watches before scanning so that changes made during the scan
+    // are not missed
+    if (m_inotify_fd >= 0) {
+        Roms all_roms;
+        all_roms.add_all();
+
+        add_watch(get_raw_path(MULTIBOOT_DIR));
+        add_watch(get_raw_path("/data/multiboot"));
+
+        if (auto extsd = Roms::get_extsd_partition(); !extsd.empty()) {
+            add_watch(extsd + "/multiboot");
+        }
+
+        for (auto const &r : all_roms.roms) {
+            std::string system_path = r->full_system_path();
+
+            add_watch(util::dir_name(r->boot_image_path()));
+            add_watch(util::dir_name(build_prop_path(*r, system_path)));
+
+            if (r->system_is_image && !system_path.empty()) {
+                add_watch(util::dir_name(system_path));
+            }
+        }
+    }
+
+    Roms roms;
+    roms.add_installed();
+
+    for (auto const &r : roms.roms) {
+        RomRegistryEntry entry;
+        entry.rom = r;
+        entry.system_path = r->full_system_path();
+        entry.cache_path = r->full_cache_path();
+        entry.data_path = r->full_data_path();
+
+        struct {
+            const char *key;
+            std::string &value;
+        } needed_props[] = {
+            { "ro.build.version.release", entry.version },
+            { "ro.build.display.id", entry.build },
+        };
+
+        RomConfig config;
+        config.load_file(r->config_path());
+        auto &props = config.cached_props;
+
+        util::property_file_iter(build_prop_path(*r, entry.system_path), {},
+                                 [&](std::string_view key,
+                                     std::string_view value) {
+            for (auto const &item : needed_props) {
+                if (item.key == key) {
+                    props.insert_or_assign(std::string(key),
+                                           std::string(value));
+                }
+            }
+
+            return util::PropertyIterAction::Continue;
+        });
+
+        for (auto const &item : needed_props) {
+            if (auto it = props.find(item.key); it != props.end()) {
+                item.value = it->second;
+            }
+        }
+
+        m_entries.push_back(std::move(entry));
+    }
+
+    m_valid = true;
+}
+
+/*!
+ * \brief Watch a directory or its closest existing parent
+ *
+ * Watching the parent of a missing directory ensures that the registry is
+ * invalidated when the directory is created.
+ */
+void RomRegistry::add_watch(std::string path)
+{
+    while (m_inotify_fd >= 0 && !path.empty()) {
+        if (inotify_add_watch(m_inotify_fd, path.c_str(), WATCH_MASK) >= 0) {
+            return;
+        } else if (errno != ENOENT && errno != ENOTDIR) {
+            LOGW("%s: Failed to add inotify watch: %s",
+                 path.c_str(), strerror(errno));
+            // Without the watch, changes could be missed
+            close(m_inotify_fd);
+            m_inotify_fd = -1;
+            return;
+        } else if (path == "/" || path == ".") {
+            return;
+        }
+
+        path = util::dir_name(std::move(path));
+    }
+}
+
+}
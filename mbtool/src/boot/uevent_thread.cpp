@@ -19,6 +19,9 @@
 
 #include "boot/uevent_thread.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <cerrno>
 #include <cstring>
 
@@ -36,6 +39,42 @@ namespace mb
 
 using namespace android::init;
 
+/*!
+ * \brief Handle regenerated uevents using multiple threads
+ *
+ * Like Android init's parallel coldboot, the events are split across workers.
+ * Each worker handles a contiguous range so that partitions of the same disk,
+ * which share symlink directories, end up in the same batch. Coldboot only
+ * produces add events and each one touches its own device node and symlinks,
+ * so the order in which they are handled does not matter.
+ */
+static void coldboot(DeviceHandler &handler, const std::vector<Uevent> &uevents)
+{
+    std::size_t n_threads = std::min<std::size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u), uevents.size());
+
+    if (n_threads <= 1) {
+        handler.HandleDeviceEvents(uevents);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(n_threads);
+
+    for (std::size_t i = 0; i < n_threads; ++i) {
+        std::size_t begin = uevents.size() * i / n_threads;
+        std::size_t end = uevents.size() * (i + 1) / n_threads;
+
+        threads.emplace_back([&, begin, end] {
+            handler.HandleDeviceEvents(uevents.data() + begin, end - begin);
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
 UeventThread::UeventThread()
     : m_cancel_pipe()
     , m_is_running(false)
@@ -68,12 +107,17 @@ bool UeventThread::start()
     // if it fails
     m_uevent_listener = UeventListener();
 
-    // Regenerate events for devices already detected
+    // Regenerate events for devices already detected. The events are
+    // collected first so that the device nodes can be created in parallel.
+    std::vector<Uevent> uevents;
+
     m_uevent_listener->RegenerateUevents([&](const Uevent &uevent) {
-        m_device_handler.HandleDeviceEvent(uevent);
+        uevents.push_back(uevent);
         return ListenerAction::kContinue;
     });
 
+    coldboot(m_device_handler, uevents);
+
     m_thread = std::thread(&UeventThread::thread_func, this);
 
     close_pipe.dismiss();
@@ -117,8 +161,8 @@ const android::init::DeviceHandler & UeventThread::device_handler() const
 
 void UeventThread::thread_func()
 {
-    m_uevent_listener->Poll([&](const Uevent &uevent) {
-        m_device_handler.HandleDeviceEvent(uevent);
+    m_uevent_listener->PollBatch([&](const std::vector<Uevent> &uevents) {
+        m_device_handler.HandleDeviceEvents(uevents);
         return ListenerAction::kContinue;
     }, m_cancel_pipe[0]);
 }
@@ -0,0 +1,671 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "boot/xml_pull_parser.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+// Android Binary XML format (see BinaryXmlSerializer.java in
+// frameworks/base/core/java/com/android/internal/util)
+#define ABX_MAGIC                       "ABX\0"
+#define ABX_MAGIC_SIZE                  4
+
+// Tokens (low 4 bits)
+#define ABX_START_DOCUMENT              0
+#define ABX_END_DOCUMENT                1
+#define ABX_START_TAG                   2
+#define ABX_END_TAG                     3
+#define ABX_TEXT                        4
+#define ABX_CDSECT                      5
+#define ABX_ENTITY_REF                  6
+#define ABX_IGNORABLE_WHITESPACE        7
+#define ABX_PROCESSING_INSTRUCTION      8
+#define ABX_COMMENT                     9
+#define ABX_DOCDECL                     10
+#define ABX_ATTRIBUTE                   15
+
+// Value types (high 4 bits)
+#define ABX_TYPE_NULL                   (1 << 4)
+#define ABX_TYPE_STRING                 (2 << 4)
+#define ABX_TYPE_STRING_INTERNED        (3 << 4)
+#define ABX_TYPE_BYTES_HEX              (4 << 4)
+#define ABX_TYPE_BYTES_BASE64           (5 << 4)
+#define ABX_TYPE_INT                    (6 << 4)
+#define ABX_TYPE_INT_HEX                (7 << 4)
+#define ABX_TYPE_LONG                   (8 << 4)
+#define ABX_TYPE_LONG_HEX               (9 << 4)
+#define ABX_TYPE_FLOAT                  (10 << 4)
+#define ABX_TYPE_DOUBLE                 (11 << 4)
+#define ABX_TYPE_BOOLEAN_TRUE           (12 << 4)
+#define ABX_TYPE_BOOLEAN_FALSE          (13 << 4)
+
+// Index that introduces a new interned string
+#define ABX_INTERN_NEW                  0xffff
+
+namespace mb
+{
+
+static bool is_xml_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_name_end(char c)
+{
+    return is_xml_space(c) || c == '/' || c == '>' || c == '=';
+}
+
+/*!
+ * \brief Append a UTF-8 encoded code point
+ */
+static void append_utf8(std::string &out, uint32_t cp)
+{
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xc0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xe0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+}
+
+/*!
+ * \brief Decode the predefined entities and character references
+ */
+static oc::result<void> decode_entities(std::string_view in, std::string &out)
+{
+    out.clear();
+    out.reserve(in.size());
+
+    while (!in.empty()) {
+        auto amp = in.find('&');
+        out.append(in.substr(0, amp));
+        if (amp == std::string_view::npos) {
+            break;
+        }
+        in.remove_prefix(amp + 1);
+
+        auto semi = in.find(';');
+        if (semi == std::string_view::npos) {
+            return std::errc::illegal_byte_sequence;
+        }
+
+        auto entity = in.substr(0, semi);
+        in.remove_prefix(semi + 1);
+
+        if (entity == "amp") {
+            out += '&';
+        } else if (entity == "lt") {
+            out += '<';
+        } else if (entity == "gt") {
+            out += '>';
+        } else if (entity == "quot") {
+            out += '"';
+        } else if (entity == "apos") {
+            out += '\'';
+        } else if (entity.size() > 1 && entity[0] == '#') {
+            bool hex = entity[1] == 'x';
+            auto digits = entity.substr(hex ? 2 : 1);
+            uint32_t cp = 0;
+
+            if (digits.empty() || digits.size() > 8) {
+                return std::errc::illegal_byte_sequence;
+            }
+
+            for (char c : digits) {
+                uint32_t d;
+                if (c >= '0' && c <= '9') {
+                    d = static_cast<uint32_t>(c - '0');
+                } else if (hex && c >= 'a' && c <= 'f') {
+                    d = static_cast<uint32_t>(c - 'a' + 10);
+                } else if (hex && c >= 'A' && c <= 'F') {
+                    d = static_cast<uint32_t>(c - 'A' + 10);
+                } else {
+                    return std::errc::illegal_byte_sequence;
+                }
+                cp = cp * (hex ? 16 : 10) + d;
+            }
+
+            if (cp > 0x10ffff) {
+                return std::errc::illegal_byte_sequence;
+            }
+
+            append_utf8(out, cp);
+        } else {
+            return std::errc::illegal_byte_sequence;
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Format a signed integer the same way as Java's Long.toString(v, 16)
+ */
+static void format_signed_hex(std::string &out, int64_t value)
+{
+    char buf[32];
+    if (value < 0) {
+        snprintf(buf, sizeof(buf), "-%" PRIx64,
+                 static_cast<uint64_t>(0) - static_cast<uint64_t>(value));
+    } else {
+        snprintf(buf, sizeof(buf), "%" PRIx64, static_cast<uint64_t>(value));
+    }
+    out = buf;
+}
+
+static void format_base64(std::string &out, std::string_view in)
+{
+    static constexpr char chars[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    out.clear();
+    out.reserve((in.size() + 2) / 3 * 4);
+
+    for (size_t i = 0; i < in.size(); i += 3) {
+        uint32_t n = static_cast<uint32_t>(
+                static_cast<unsigned char>(in[i])) << 16;
+        if (i + 1 < in.size()) {
+            n |= static_cast<uint32_t>(
+                    static_cast<unsigned char>(in[i + 1])) << 8;
+        }
+        if (i + 2 < in.size()) {
+            n |= static_cast<unsigned char>(in[i + 2]);
+        }
+
+        out += chars[(n >> 18) & 0x3f];
+        out += chars[(n >> 12) & 0x3f];
+        out += i + 1 < in.size() ? chars[(n >> 6) & 0x3f] : '=';
+        out += i + 2 < in.size() ? chars[n & 0x3f] : '=';
+    }
+}
+
+XmlPullParser::XmlPullParser(std::string_view data)
+    : m_data(data)
+    , m_pos(0)
+    , m_binary(false)
+    , m_want_values(true)
+    , m_depth(0)
+    , m_pending_end(false)
+{
+    if (data.size() >= ABX_MAGIC_SIZE
+            && memcmp(data.data(), ABX_MAGIC, ABX_MAGIC_SIZE) == 0) {
+        m_binary = true;
+        m_pos = ABX_MAGIC_SIZE;
+    }
+}
+
+bool XmlPullParser::is_binary() const
+{
+    return m_binary;
+}
+
+std::string_view XmlPullParser::name() const
+{
+    return m_name;
+}
+
+const std::vector<XmlPullParser::Attribute> &
+XmlPullParser::attributes() const
+{
+    return m_attrs;
+}
+
+size_t XmlPullParser::offset() const
+{
+    return m_pos;
+}
+
+/*!
+ * \brief Advance to the next start tag, end tag, or end of the document
+ *
+ * \return The event or std::errc::illegal_byte_sequence if the data is
+ *         malformed
+ */
+oc::result<XmlPullParser::Event> XmlPullParser::next()
+{
+    m_attrs.clear();
+
+    if (m_pending_end) {
+        m_pending_end = false;
+        --m_depth;
+        return Event::EndTag;
+    }
+
+    OUTCOME_TRY(event, m_binary ? next_binary() : next_text());
+
+    if (event == Event::StartTag) {
+        ++m_depth;
+    } else if (event == Event::EndTag) {
+        if (m_depth == 0) {
+            return std::errc::illegal_byte_sequence;
+        }
+        --m_depth;
+    } else if (m_depth != 0) {
+        // Unterminated element
+        return std::errc::illegal_byte_sequence;
+    }
+
+    return event;
+}
+
+/*!
+ * \brief Skip the children of the current start tag
+ *
+ * After this returns, the current event is the matching end tag. Attribute
+ * values in the subtree are not decoded.
+ */
+oc::result<void> XmlPullParser::skip_subtree()
+{
+    size_t depth = m_depth;
+
+    m_want_values = false;
+
+    while (m_depth >= depth) {
+        auto event = next();
+        if (!event) {
+            m_want_values = true;
+            return event.as_failure();
+        }
+    }
+
+    m_want_values = true;
+    return oc::success();
+}
+
+oc::result<XmlPullParser::Event> XmlPullParser::next_text()
+{
+    while (true) {
+        if (m_pos >= m_data.size()) {
+            return Event::EndDocument;
+        }
+
+        auto rest = m_data.substr(m_pos);
+
+        if (rest[0] != '<') {
+            // Text is ignored
+            auto lt = rest.find('<');
+            m_pos = lt == std::string_view::npos
+                    ? m_data.size() : m_pos + lt;
+            continue;
+        }
+
+        std::string_view terminator;
+
+        if (rest.compare(0, 2, "<?") == 0) {
+            terminator = "?>";
+        } else if (rest.compare(0, 4, "<!--") == 0) {
+            terminator = "-->";
+        } else if (rest.compare(0, 9, "<![CDATA[") == 0) {
+            terminator = "]]>";
+        } else if (rest.compare(0, 2, "<!") == 0) {
+            // Document type declarations with internal subsets are not
+            // supported
+            terminator = ">";
+        }
+
+        if (!terminator.empty()) {
+            auto end = rest.find(terminator, 2);
+            if (end == std::string_view::npos) {
+                return std::errc::illegal_byte_sequence;
+            }
+            m_pos += end + terminator.size();
+            continue;
+        }
+
+        if (rest.compare(0, 2, "</") == 0) {
+            size_t i = 2;
+            while (i < rest.size() && !is_name_end(rest[i])) {
+                ++i;
+            }
+            m_name = rest.substr(2, i - 2);
+            while (i < rest.size() && is_xml_space(rest[i])) {
+                ++i;
+            }
+            if (m_name.empty() || i >= rest.size() || rest[i] != '>') {
+                return std::errc::illegal_byte_sequence;
+            }
+            m_pos += i + 1;
+            return Event::EndTag;
+        }
+
+        OUTCOME_TRYV(read_text_start_tag());
+        return Event::StartTag;
+    }
+}
+
+oc::result<void> XmlPullParser::read_text_start_tag()
+{
+    auto rest = m_data.substr(m_pos);
+    size_t i = 1;
+
+    while (i < rest.size() && !is_name_end(rest[i])) {
+        ++i;
+    }
+    m_name = rest.substr(1, i - 1);
+    if (m_name.empty()) {
+        return std::errc::illegal_byte_sequence;
+    }
+
+    while (true) {
+        while (i < rest.size() && is_xml_space(rest[i])) {
+            ++i;
+        }
+        if (i >= rest.size()) {
+            return std::errc::illegal_byte_sequence;
+        }
+
+        if (rest[i] == '>') {
+            m_pos += i + 1;
+            return oc::success();
+        } else if (rest[i] == '/') {
+            if (i + 1 >= rest.size() || rest[i + 1] != '>') {
+                return std::errc::illegal_byte_sequence;
+            }
+            m_pending_end = true;
+            m_pos += i + 2;
+            return oc::success();
+        }
+
+        size_t name_begin = i;
+        while (i < rest.size() && !is_name_end(rest[i])) {
+            ++i;
+        }
+        auto attr_name = rest.substr(name_begin, i - name_begin);
+
+        while (i < rest.size() && is_xml_space(rest[i])) {
+            ++i;
+        }
+        if (attr_name.empty() || i >= rest.size() || rest[i] != '=') {
+            return std::errc::illegal_byte_sequence;
+        }
+        ++i;
+        while (i < rest.size() && is_xml_space(rest[i])) {
+            ++i;
+        }
+        if (i >= rest.size() || (rest[i] != '"' && rest[i] != '\'')) {
+            return std::errc::illegal_byte_sequence;
+        }
+
+        char quote = rest[i++];
+        auto value_end = rest.find(quote, i);
+        if (value_end == std::string_view::npos) {
+            return std::errc::illegal_byte_sequence;
+        }
+
+        if (m_want_values) {
+            auto &attr = m_attrs.emplace_back();
+            attr.name = attr_name;
+            OUTCOME_TRYV(decode_entities(rest.substr(i, value_end - i),
+                                         attr.value));
+        }
+
+        i = value_end + 1;
+    }
+}
+
+oc::result<XmlPullParser::Event> XmlPullParser::next_binary()
+{
+    while (true) {
+        if (m_pos >= m_data.size()) {
+            return Event::EndDocument;
+        }
+
+        auto token = static_cast<unsigned char>(m_data[m_pos++]);
+        auto command = token & 0x0f;
+        auto type = static_cast<unsigned char>(token & 0xf0);
+
+        switch (command) {
+        case ABX_START_DOCUMENT:
+            break;
+
+        case ABX_END_DOCUMENT:
+            m_pos = m_data.size();
+            return Event::EndDocument;
+
+        case ABX_START_TAG: {
+            OUTCOME_TRY(name, read_binary_interned());
+            m_name = name;
+
+            // Attributes immediately follow the start tag
+            while (m_pos < m_data.size()
+                    && (m_data[m_pos] & 0x0f) == ABX_ATTRIBUTE) {
+                auto attr_type = static_cast<unsigned char>(
+                        m_data[m_pos++] & 0xf0);
+                OUTCOME_TRY(attr_name, read_binary_interned());
+
+                if (m_want_values) {
+                    auto &attr = m_attrs.emplace_back();
+                    attr.name = attr_name;
+                    OUTCOME_TRYV(read_binary_value(attr_type, attr.value));
+                } else {
+                    std::string discard;
+                    OUTCOME_TRYV(read_binary_value(attr_type, discard));
+                }
+            }
+
+            return Event::StartTag;
+        }
+
+        case ABX_END_TAG: {
+            OUTCOME_TRY(name, read_binary_interned());
+            m_name = name;
+            return Event::EndTag;
+        }
+
+        case ABX_TEXT:
+        case ABX_CDSECT:
+        case ABX_ENTITY_REF:
+        case ABX_IGNORABLE_WHITESPACE:
+        case ABX_PROCESSING_INSTRUCTION:
+        case ABX_COMMENT:
+        case ABX_DOCDECL:
+            if (type == ABX_TYPE_STRING) {
+                OUTCOME_TRYV(read_binary_utf());
+            } else if (type != ABX_TYPE_NULL) {
+                return std::errc::illegal_byte_sequence;
+            }
+            break;
+
+        default:
+            return std::errc::illegal_byte_sequence;
+        }
+    }
+}
+
+/*!
+ * \brief Read a string prefixed with its 16-bit big endian length
+ */
+oc::result<std::string_view> XmlPullParser::read_binary_utf()
+{
+    if (m_data.size() - m_pos < 2) {
+        return std::errc::illegal_byte_sequence;
+    }
+
+    uint16_t size;
+    memcpy(&size, m_data.data() + m_pos, sizeof(size));
+    size = mb_be16toh(size);
+    m_pos += 2;
+
+    if (m_data.size() - m_pos < size) {
+        return std::errc::illegal_byte_sequence;
+    }
+
+    auto result = m_data.substr(m_pos, size);
+    m_pos += size;
+
+    return result;
+}
+
+/*!
+ * \brief Read an interned string reference, adding it to the table if new
+ */
+oc::result<std::string_view> XmlPullParser::read_binary_interned()
+{
+    if (m_data.size() - m_pos < 2) {
+        return std::errc::illegal_byte_sequence;
+    }
+
+    uint16_t index;
+    memcpy(&index, m_data.data() + m_pos, sizeof(index));
+    index = mb_be16toh(index);
+    m_pos += 2;
+
+    if (index == ABX_INTERN_NEW) {
+        OUTCOME_TRY(str, read_binary_utf());
+        m_interned.push_back(str);
+        return str;
+    } else if (index >= m_interned.size()) {
+        return std::errc::illegal_byte_sequence;
+    }
+
+    return m_interned[index];
+}
+
+/*!
+ * \brief Read a typed attribute value, formatted the same way as
+ *        BinaryXmlPullParser.getAttributeValue()
+ */
+oc::result<void> XmlPullParser::read_binary_value(unsigned char type,
+                                                  std::string &out)
+{
+    auto read_be = [&](size_t size, uint64_t &value) -> oc::result<void> {
+        if (m_data.size() - m_pos < size) {
+            return std::errc::illegal_byte_sequence;
+        }
+        value = 0;
+        for (size_t i = 0; i < size; ++i) {
+            value = (value << 8)
+                    | static_cast<unsigned char>(m_data[m_pos + i]);
+        }
+        m_pos += size;
+        return oc::success();
+    };
+
+    uint64_t raw;
+    char buf[64];
+
+    switch (type) {
+    case ABX_TYPE_NULL:
+        out.clear();
+        break;
+
+    case ABX_TYPE_STRING: {
+        OUTCOME_TRY(str, read_binary_utf());
+        out = str;
+        break;
+    }
+
+    case ABX_TYPE_STRING_INTERNED: {
+        OUTCOME_TRY(str, read_binary_interned());
+        out = str;
+        break;
+    }
+
+    case ABX_TYPE_BYTES_HEX:
+    case ABX_TYPE_BYTES_BASE64: {
+        OUTCOME_TRY(bytes, read_binary_utf());
+        if (type == ABX_TYPE_BYTES_BASE64) {
+            format_base64(out, bytes);
+        } else {
+            static constexpr char digits[] = "0123456789ABCDEF";
+            out.clear();
+            out.reserve(bytes.size() * 2);
+            for (char c : bytes) {
+                auto b = static_cast<unsigned char>(c);
+                out += digits[b >> 4];
+                out += digits[b & 0xf];
+            }
+        }
+        break;
+    }
+
+    case ABX_TYPE_INT: {
+        OUTCOME_TRYV(read_be(4, raw));
+        snprintf(buf, sizeof(buf), "%" PRId32, static_cast<int32_t>(raw));
+        out = buf;
+        break;
+    }
+
+    case ABX_TYPE_INT_HEX: {
+        OUTCOME_TRYV(read_be(4, raw));
+        format_signed_hex(out, static_cast<int32_t>(raw));
+        break;
+    }
+
+    case ABX_TYPE_LONG: {
+        OUTCOME_TRYV(read_be(8, raw));
+        snprintf(buf, sizeof(buf), "%" PRId64, static_cast<int64_t>(raw));
+        out = buf;
+        break;
+    }
+
+    case ABX_TYPE_LONG_HEX: {
+        OUTCOME_TRYV(read_be(8, raw));
+        format_signed_hex(out, static_cast<int64_t>(raw));
+        break;
+    }
+
+    case ABX_TYPE_FLOAT: {
+        OUTCOME_TRYV(read_be(4, raw));
+        auto bits = static_cast<uint32_t>(raw);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        snprintf(buf, sizeof(buf), "%g", static_cast<double>(value));
+        out = buf;
+        break;
+    }
+
+    case ABX_TYPE_DOUBLE: {
+        OUTCOME_TRYV(read_be(8, raw));
+        double value;
+        memcpy(&value, &raw, sizeof(value));
+        snprintf(buf, sizeof(buf), "%g", value);
+        out = buf;
+        break;
+    }
+
+    case ABX_TYPE_BOOLEAN_TRUE:
+        out = "true";
+        break;
+
+    case ABX_TYPE_BOOLEAN_FALSE:
+        out = "false";
+        break;
+
+    default:
+        return std::errc::illegal_byte_sequence;
+    }
+
+    return oc::success();
+}
+
+}
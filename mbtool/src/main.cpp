@@ -58,7 +58,7 @@ struct Tool
     int (*func)(int, char **);
 };
 
-static Tool g_tools[] = {
+static constexpr Tool g_tools[] = {
     { "mbtool", mbtool_main },
     { "mbtool_recovery", mbtool_main },
     // Tools
@@ -20,12 +20,19 @@
 #include "recovery/backup.h"
 
 #include <algorithm>
-#include <cstdlib>
-#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
 #include <dirent.h>
 #include <getopt.h>
 #include <sys/mount.h>
@@ -46,8 +53,12 @@
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
+#include "boot/directory_size.h"
+#include "recovery/backup_integrity.h"
+#include "recovery/chunked_backup.h"
 #include "recovery/installer_util.h"
 #include "recovery/image.h"
+#include "recovery/preflight.h"
 #include "util/multiboot.h"
 #include "util/roms.h"
 #include "util/wipe.h"
@@ -78,10 +89,21 @@ constexpr char BACKUP_NAME_PREFIX_DATA[]   = "data";
 constexpr char BACKUP_NAME_BOOT_IMAGE[]    = "boot.img";
 constexpr char BACKUP_NAME_CONFIG[]        = "config.json";
 constexpr char BACKUP_NAME_THUMBNAIL[]     = "thumbnail.webp";
+constexpr char BACKUP_NAME_MANIFEST_EXT[]  = ".manifest";
+constexpr char BACKUP_NAME_CHUNK_STORE[]   = "chunks";
+constexpr char BACKUP_NAME_SPARSE_EXT[]    = ".sparse.img";
 
 // Max file size for FAT32
 constexpr uint64_t DEFAULT_ARCHIVE_SPLIT_SIZE = UINT32_MAX - 1;
 
+enum class BackupFormat
+{
+    // Compressed tar archive per partition
+    Tar,
+    // Manifest per partition referencing a deduplicated chunk store
+    Chunked,
+};
+
 using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
 
 enum class Result
@@ -102,6 +124,8 @@ static struct CompressionMap
     { util::CompressionType::Lz4,  "lz4",   ".tar.lz4" },
     { util::CompressionType::Gzip, "gzip",  ".tar.gz" },
     { util::CompressionType::Xz,   "xz",    ".tar.xz" },
+    // zstd is not listed because the bundled libarchive is not built with
+    // libzstd
     { util::CompressionType::None, nullptr, nullptr }
 };
 
@@ -188,6 +212,7 @@ static bool backup_directory(const std::string &output_file,
                              const std::string &directory,
                              const std::vector<std::string> &exclusions,
                              util::CompressionType compression,
+                             const util::CompressionOptions &options,
                              uint64_t split_archive_size)
 {
     ScopedDIR dp(opendir(directory.c_str()), closedir);
@@ -218,54 +243,61 @@ static bool backup_directory(const std::string &output_file,
     }
 
     return util::libarchive_tar_create(output_file, directory, contents,
-                                       compression, split_archive_size);
+                                       compression, split_archive_size,
+                                       options);
 }
 
 static bool restore_directory(const std::string &input_file,
                               const std::string &directory,
                               const std::vector<std::string> &exclusions,
                               util::CompressionType compression,
-                              bool is_split)
+                              bool is_split, unsigned int threads)
 {
     if (!wipe_directory(directory, exclusions)) {
         return false;
     }
 
     return util::libarchive_tar_extract(input_file, directory, {}, compression,
-                                        is_split);
+                                        is_split, threads);
 }
 
 static bool backup_image(const std::string &output_file,
                          const std::string &image,
+                         const std::string &mount_point,
                          const std::vector<std::string> &exclusions,
                          util::CompressionType compression,
+                         const util::CompressionOptions &options,
                          uint64_t split_archive_size)
 {
-    if (auto r = util::mkdir_recursive(BACKUP_MNT_DIR, 0755);
+    if (auto r = util::mkdir_recursive(mount_point, 0755);
             !r && r.error() != std::errc::file_exists) {
         LOGE("%s: Failed to create directory: %s",
-             BACKUP_MNT_DIR, strerror(errno));
+             mount_point.c_str(), r.error().message().c_str());
         return false;
     }
 
-    fsck_ext4_image(image);
+    if (!ext4_image_is_clean(image)) {
+        fsck_ext4_image(image);
+    }
 
     if (auto ret = util::mount(
-            image, BACKUP_MNT_DIR, "ext4", MS_RDONLY, ""); !ret) {
-        LOGE("Failed to mount %s at %s: %s", image.c_str(), BACKUP_MNT_DIR,
-             ret.error().message().c_str());
+            image, mount_point, "ext4", MS_RDONLY, ""); !ret) {
+        LOGE("Failed to mount %s at %s: %s", image.c_str(),
+             mount_point.c_str(), ret.error().message().c_str());
         return false;
     }
 
-    bool ret = backup_directory(output_file, BACKUP_MNT_DIR, exclusions,
-                                compression, split_archive_size);
+    bool ret = backup_directory(output_file, mount_point, exclusions,
+                                compression, options, split_archive_size);
 
-    if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
-        LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
+    if (auto umount_ret = util::umount(mount_point); !umount_ret) {
+        LOGE("Failed to unmount %s: %s", mount_point.c_str(),
              umount_ret.error().message().c_str());
         return false;
     }
 
+    rmdir(mount_point.c_str());
+    // Fails if other images are still mounted
     rmdir(BACKUP_MNT_DIR);
 
     return ret;
@@ -276,7 +308,7 @@ static bool restore_image(const std::string &input_file,
                           uint64_t size,
                           const std::vector<std::string> &exclusions,
                           util::CompressionType compression,
-                          bool is_split)
+                          bool is_split, unsigned int threads)
 {
     if (auto r = util::mkdir_parent(image, S_IRWXU); !r) {
         LOGE("%s: Failed to create parent directory: %s",
@@ -304,7 +336,9 @@ static bool restore_image(const std::string &input_file,
         return false;
     }
 
-    fsck_ext4_image(image);
+    if (!ext4_image_is_clean(image)) {
+        fsck_ext4_image(image);
+    }
 
     if (auto ret = util::mount(image, BACKUP_MNT_DIR, "ext4", 0, ""); !ret) {
         LOGE("Failed to mount %s at %s: %s", image.c_str(), BACKUP_MNT_DIR,
@@ -313,7 +347,7 @@ static bool restore_image(const std::string &input_file,
     }
 
     bool ret = restore_directory(input_file, BACKUP_MNT_DIR, exclusions,
-                                 compression, is_split);
+                                 compression, is_split, threads);
 
     if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
         LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
@@ -510,6 +544,7 @@ static Result restore_configs(const std::shared_ptr<Rom> &rom,
  * \param is_image Whether \a path is an ext4 image
  * \param exclusions List of top-level directories to exclude from the backup
  * \param compression Compression type
+ * \param options Compression level and thread count
  * \param split_archive_size Max size for each split file
  *
  * \return Result::Succeeded if the directory/image was successfully backed up
@@ -522,6 +557,7 @@ static Result backup_partition(const std::string &path,
                                bool is_image,
                                const std::vector<std::string> &exclusions,
                                util::CompressionType compression,
+                               const util::CompressionOptions &options,
                                uint64_t split_archive_size)
 {
     std::string archive(backup_dir);
@@ -530,15 +566,21 @@ static Result backup_partition(const std::string &path,
 
     bool ret = false;
 
+    // Each image gets its own mount point so that partitions can be backed
+    // up concurrently
+    std::string mount_point(BACKUP_MNT_DIR);
+    mount_point += '/';
+    mount_point += archive_name;
+
     struct stat sb;
     if (stat(path.c_str(), &sb) == 0) {
         LOGI("=== Backing up %s ===", path.c_str());
         if (is_image) {
-            ret = backup_image(archive, path, exclusions, compression,
-                               split_archive_size);
+            ret = backup_image(archive, path, mount_point, exclusions,
+                               compression, options, split_archive_size);
         } else {
             ret = backup_directory(archive, path, exclusions, compression,
-                                   split_archive_size);
+                                   options, split_archive_size);
         }
     } else {
         LOGW("=== %s does not exist ===", path.c_str());
@@ -559,6 +601,7 @@ static Result backup_partition(const std::string &path,
  *                   process before restoring
  * \param compression Compression type
  * \param is_split Whether the archive is split into multiple chunks
+ * \param threads Number of threads for writing files
  *
  * \return Result::Succeeded if the directory/image was successfully restored
  *         Result::Failed if an error occured
@@ -572,7 +615,7 @@ static Result restore_partition(const std::string &path,
                                 uint64_t image_size,
                                 const std::vector<std::string> &exclusions,
                                 util::CompressionType compression,
-                                bool is_split)
+                                bool is_split, unsigned int threads)
 {
     std::string archive(backup_dir);
     archive += '/';
@@ -588,10 +631,10 @@ static Result restore_partition(const std::string &path,
         LOGI("=== Restoring to %s ===", path.c_str());
         if (is_image) {
             ret = restore_image(archive, path, image_size, exclusions,
-                                compression, is_split);
+                                compression, is_split, threads);
         } else {
             ret = restore_directory(archive, path, exclusions, compression,
-                                    is_split);
+                                    is_split, threads);
         }
     } else {
         LOGW("=== %s does not exist ===", archive.c_str());
@@ -601,10 +644,318 @@ static Result restore_partition(const std::string &path,
     return ret ? Result::Succeeded : Result::Failed;
 }
 
+/*!
+ * \brief Backup a partition for a ROM into a chunk store
+ *
+ * Image-backed partitions are backed up as raw images, which does not require
+ * mounting them. Since the chunks are deduplicated, unused space in the image
+ * takes up almost no space in the chunk store.
+ *
+ * \param path Path to mountpoint/directory or image
+ * \param backup_dir Backup directory
+ * \param prefix Backup name prefix
+ * \param is_image Whether \a path is an ext4 image
+ * \param exclusions List of top-level directories to exclude from the backup
+ * \param chunk_store Chunk store directory
+ * \param prev_dir Directory containing a previous backup of the same ROM
+ *                 (can be empty)
+ *
+ * \return Result::Succeeded if the directory/image was successfully backed up
+ *         Result::Failed if an error occured
+ *         Result::FilesMissing if \a path does not exist
+ */
+static Result backup_partition_chunked(
+        const std::string &path, const std::string &backup_dir,
+        const std::string &prefix, bool is_image,
+        const std::vector<std::string> &exclusions,
+        const std::string &chunk_store, const std::string &prev_dir)
+{
+    std::string manifest(backup_dir);
+    manifest += '/';
+    manifest += prefix;
+    manifest += BACKUP_NAME_MANIFEST_EXT;
+
+    std::string prev_manifest;
+    if (!prev_dir.empty()) {
+        prev_manifest = prev_dir;
+        prev_manifest += '/';
+        prev_manifest += prefix;
+        prev_manifest += BACKUP_NAME_MANIFEST_EXT;
+
+        struct stat sb;
+        if (stat(prev_manifest.c_str(), &sb) < 0) {
+            LOGW("%s: Previous manifest not found", prev_manifest.c_str());
+            prev_manifest.clear();
+        }
+    }
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGW("=== %s does not exist ===", path.c_str());
+        return Result::FilesMissing;
+    }
+
+    LOGI("=== Backing up %s ===", path.c_str());
+
+    if (is_image && !ext4_image_is_clean(path)) {
+        fsck_ext4_image(path);
+    }
+
+    bool ret = chunked_backup(manifest, path, is_image
+                              ? ChunkedBackupKind::Image
+                              : ChunkedBackupKind::Tree,
+                              exclusions, chunk_store, prev_manifest);
+
+    return ret ? Result::Succeeded : Result::Failed;
+}
+
+/*!
+ * \brief Restore a partition for a ROM from a chunk store
+ *
+ * \param path Path to mountpoint/directory or image
+ * \param manifest Path to backup manifest
+ * \param is_image Whether \a path is an ext4 image
+ * \param exclusions List of top-level directories to exclude from the wipe
+ *                   process before restoring
+ * \param chunk_store Chunk store directory (if empty, the chunk store recorded
+ *                    in the manifest is used)
+ *
+ * \return Result::Succeeded if the directory/image was successfully restored
+ *         Result::Failed if an error occured
+ */
+static Result restore_partition_chunked(
+        const std::string &path, const std::string &manifest, bool is_image,
+        const std::vector<std::string> &exclusions,
+        const std::string &chunk_store)
+{
+    auto kind = chunked_backup_kind(manifest);
+    if (!kind) {
+        LOGE("%s: Failed to read manifest: %s",
+             manifest.c_str(), kind.error().message().c_str());
+        return Result::Failed;
+    }
+
+    // The ROM's partition layout must match the backup
+    if ((kind.value() == ChunkedBackupKind::Image) != is_image) {
+        LOGE("%s: Backup is of %s, but ROM uses %s", manifest.c_str(),
+             kind.value() == ChunkedBackupKind::Image
+                     ? "an image" : "a directory",
+             is_image ? "an image" : "a directory");
+        return Result::Failed;
+    }
+
+    LOGI("=== Restoring to %s ===", path.c_str());
+
+    if (is_image) {
+        if (auto r = util::mkdir_parent(path, S_IRWXU); !r) {
+            LOGE("%s: Failed to create parent directory: %s",
+                 path.c_str(), r.error().message().c_str());
+            return Result::Failed;
+        }
+    } else if (!wipe_directory(path, exclusions)) {
+        return Result::Failed;
+    }
+
+    bool ret = chunked_restore(manifest, path, chunk_store);
+
+    return ret ? Result::Succeeded : Result::Failed;
+}
+
+/*!
+ * \brief Backup an image-backed partition for a ROM by copying its blocks
+ *
+ * Only the allocated blocks of the image are copied to a sparse image, which
+ * avoids mounting the image and walking every file in it.
+ *
+ * \param image Path to ext4 image
+ * \param backup_dir Backup directory
+ * \param prefix Backup name prefix
+ *
+ * \return Result::Succeeded if the image was successfully backed up
+ *         Result::Failed if an error occured
+ *         Result::FilesMissing if \a image does not exist
+ */
+static Result backup_partition_blocks(const std::string &image,
+                                      const std::string &backup_dir,
+                                      const std::string &prefix)
+{
+    std::string output(backup_dir);
+    output += '/';
+    output += prefix;
+    output += BACKUP_NAME_SPARSE_EXT;
+
+    struct stat sb;
+    if (stat(image.c_str(), &sb) < 0) {
+        LOGW("=== %s does not exist ===", image.c_str());
+        return Result::FilesMissing;
+    }
+
+    LOGI("=== Backing up %s ===", image.c_str());
+
+    if (!ext4_image_is_clean(image)) {
+        fsck_ext4_image(image);
+    }
+
+    if (auto r = ext4_image_to_sparse(image, output); !r) {
+        LOGE("%s: Failed to copy image to %s: %s", image.c_str(),
+             output.c_str(), r.error().message().c_str());
+        return Result::Failed;
+    }
+
+    return Result::Succeeded;
+}
+
+/*!
+ * \brief Restore an image-backed partition for a ROM from a sparse image
+ *
+ * \param image Path to ext4 image
+ * \param sparse_path Path to sparse image
+ * \param is_image Whether the ROM's partition is an ext4 image
+ *
+ * \return Result::Succeeded if the image was successfully restored
+ *         Result::Failed if an error occured
+ */
+static Result restore_partition_blocks(const std::string &image,
+                                       const std::string &sparse_path,
+                                       bool is_image)
+{
+    if (!is_image) {
+        LOGE("%s: Block-level backup can only be restored to an image",
+             sparse_path.c_str());
+        return Result::Failed;
+    }
+
+    LOGI("=== Restoring to %s ===", image.c_str());
+
+    if (auto r = util::mkdir_parent(image, S_IRWXU); !r) {
+        LOGE("%s: Failed to create parent directory: %s",
+             image.c_str(), r.error().message().c_str());
+        return Result::Failed;
+    }
+
+    if (auto r = sparse_to_ext4_image(sparse_path, image); !r) {
+        LOGE("%s: Failed to restore image from %s: %s", image.c_str(),
+             sparse_path.c_str(), r.error().message().c_str());
+        return Result::Failed;
+    }
+
+    return Result::Succeeded;
+}
+
+/*!
+ * \brief Run backup jobs with a bounded number of jobs in flight
+ *
+ * No new jobs are started after a job fails.
+ *
+ * \param jobs Jobs to run
+ * \param max_jobs Maximum number of jobs to run concurrently
+ *
+ * \return Whether all jobs succeeded
+ */
+static bool run_backup_jobs(const std::vector<std::function<bool()>> &jobs,
+                            unsigned int max_jobs)
+{
+    std::atomic_size_t next_job{0};
+    std::atomic_bool failed{false};
+
+    auto worker = [&] {
+        while (!failed) {
+            size_t i = next_job++;
+            if (i >= jobs.size()) {
+                break;
+            }
+
+            if (!jobs[i]()) {
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t n_threads = std::min<size_t>(std::max(max_jobs, 1u), jobs.size());
+
+    threads.reserve(n_threads);
+
+    for (size_t i = 0; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    return !failed;
+}
+
+/*!
+ * \brief Estimate how long backing up the partitions will take
+ *
+ * \return Estimate or nothing if it could not be computed
+ */
+static std::optional<PreflightEstimate>
+estimate_backup(const std::vector<PreflightSource> &sources,
+                const std::string &output_dir,
+                util::CompressionType compression,
+                const util::CompressionOptions &options)
+{
+    LOGI("=== Estimating backup time ===");
+
+    auto estimate = preflight_backup(sources, output_dir, compression,
+                                     options);
+    if (!estimate) {
+        LOGW("Failed to compute estimate: %s",
+             estimate.error().message().c_str());
+        return std::nullopt;
+    }
+
+    LOGI("- Total size: %" PRIu64 " bytes in %" PRIu64 " files",
+         estimate.value().total_bytes, estimate.value().file_count);
+    LOGI("- Compression ratio: %.3f", estimate.value().compression_ratio);
+    LOGI("- Read/compress rate: %.1f MiB/s",
+         estimate.value().process_rate / (1024 * 1024));
+    LOGI("- Write rate: %.1f MiB/s",
+         estimate.value().write_rate / (1024 * 1024));
+    LOGI("- Estimated time: %s",
+         format_duration(estimate.value().eta).c_str());
+
+    return std::move(estimate.value());
+}
+
+/*!
+ * \brief Backup a ROM
+ *
+ * \param rom ROM
+ * \param output_dir Backup directory
+ * \param targets Targets to backup
+ * \param compression Compression type
+ * \param options Compression level and thread count
+ * \param split_archive_size Max size for each split file
+ * \param parallel Maximum number of partitions to back up concurrently. If
+ *                 nonzero, compression is also performed on a separate thread
+ *                 for each partition. If zero, everything is backed up
+ *                 sequentially.
+ * \param format Backup format for the partitions
+ * \param chunk_store Chunk store directory (BackupFormat::Chunked only)
+ * \param prev_dir Directory containing a previous backup of the same ROM for
+ *                 skipping unchanged files (BackupFormat::Chunked only, can be
+ *                 empty)
+ * \param block_copy Back up image-backed partitions by copying their
+ *                   allocated blocks instead of using \a format
+ * \param estimate_only Only estimate how long the backup would take
+ *
+ * \return Whether all targets were successfully backed up
+ */
 static bool backup_rom(const std::shared_ptr<Rom> &rom,
                        const std::string &output_dir, BackupTargets targets,
                        util::CompressionType compression,
-                       uint64_t split_archive_size)
+                       util::CompressionOptions options,
+                       uint64_t split_archive_size,
+                       unsigned int parallel,
+                       BackupFormat format,
+                       const std::string &chunk_store,
+                       const std::string &prev_dir,
+                       bool block_copy,
+                       bool estimate_only)
 {
     if (!targets) {
         LOGE("No backup targets specified");
@@ -638,6 +989,25 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
         LOGI("             %s", thumbnail_path.c_str());
     }
     LOGI("- Backup directory: %s", output_dir.c_str());
+    if (format == BackupFormat::Chunked) {
+        LOGI("- Chunk store: %s", chunk_store.c_str());
+    }
+
+    std::vector<PreflightSource> sources;
+    if (targets & BackupTarget::System) {
+        sources.push_back({system_path, { "multiboot" }});
+    }
+    if (targets & BackupTarget::Cache) {
+        sources.push_back({cache_path, { "multiboot" }});
+    }
+    if (targets & BackupTarget::Data) {
+        sources.push_back({data_path, { "media", "multiboot" }});
+    }
+
+    auto estimate = estimate_backup(sources, output_dir, compression, options);
+    if (estimate_only) {
+        return !!estimate;
+    }
 
     std::string output_system = get_compressed_backup_name(
             BACKUP_NAME_PREFIX_SYSTEM, compression);
@@ -646,56 +1016,272 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
     std::string output_data = get_compressed_backup_name(
             BACKUP_NAME_PREFIX_DATA, compression);
 
+    // Digests of everything written to the backup directory. Each target is
+    // hashed as soon as it is finished, while the other targets are still
+    // being backed up.
+    BackupIntegrity integrity(output_dir);
+
     // Backup boot image
-    if (targets & BackupTarget::Boot
-            && backup_boot_image(rom, output_dir) == Result::Failed) {
-        return false;
+    if (targets & BackupTarget::Boot) {
+        auto result = backup_boot_image(rom, output_dir);
+        if (result == Result::Failed || (result == Result::Succeeded
+                && !integrity.add_file(BACKUP_NAME_BOOT_IMAGE))) {
+            return false;
+        }
     }
 
     // Backup configs
-    if (targets & BackupTarget::Config
-            && backup_configs(rom, output_dir) == Result::Failed) {
-        return false;
+    if (targets & BackupTarget::Config) {
+        if (backup_configs(rom, output_dir) == Result::Failed
+                || !integrity.add_files_with_prefix(BACKUP_NAME_CONFIG)
+                || !integrity.add_files_with_prefix(BACKUP_NAME_THUMBNAIL)) {
+            return false;
+        }
     }
 
+    // The partitions are independent of each other, so they can be backed up
+    // concurrently if requested
+    options.pipelined = parallel > 0;
+
+    std::vector<std::function<bool()>> jobs;
+
+    auto hashed = [&integrity](const char *prefix, std::function<bool()> job) {
+        return [&integrity, prefix, job = std::move(job)] {
+            return job() && integrity.add_files_with_prefix(prefix);
+        };
+    };
+
     // Backup system
     if (targets & BackupTarget::System) {
-        Result ret = backup_partition(
-                system_path, output_dir, output_system,
-                rom->system_is_image, { "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        jobs.push_back(hashed(BACKUP_NAME_PREFIX_SYSTEM, [&] {
+            if (block_copy && rom->system_is_image) {
+                return backup_partition_blocks(
+                        system_path, output_dir,
+                        BACKUP_NAME_PREFIX_SYSTEM) != Result::Failed;
+            } else if (format == BackupFormat::Chunked) {
+                return backup_partition_chunked(
+                        system_path, output_dir, BACKUP_NAME_PREFIX_SYSTEM,
+                        rom->system_is_image, { "multiboot" }, chunk_store,
+                        prev_dir) != Result::Failed;
+            }
+            return backup_partition(
+                    system_path, output_dir, output_system,
+                    rom->system_is_image, { "multiboot" }, compression,
+                    options, split_archive_size) != Result::Failed;
+        }));
     }
 
     // Backup cache
     if (targets & BackupTarget::Cache) {
-        Result ret = backup_partition(
-                cache_path, output_dir, output_cache,
-                rom->cache_is_image, { "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        jobs.push_back(hashed(BACKUP_NAME_PREFIX_CACHE, [&] {
+            if (block_copy && rom->cache_is_image) {
+                return backup_partition_blocks(
+                        cache_path, output_dir,
+                        BACKUP_NAME_PREFIX_CACHE) != Result::Failed;
+            } else if (format == BackupFormat::Chunked) {
+                return backup_partition_chunked(
+                        cache_path, output_dir, BACKUP_NAME_PREFIX_CACHE,
+                        rom->cache_is_image, { "multiboot" }, chunk_store,
+                        prev_dir) != Result::Failed;
+            }
+            return backup_partition(
+                    cache_path, output_dir, output_cache,
+                    rom->cache_is_image, { "multiboot" }, compression,
+                    options, split_archive_size) != Result::Failed;
+        }));
     }
 
     // Backup data
     if (targets & BackupTarget::Data) {
-        Result ret = backup_partition(
-                data_path, output_dir, output_data,
-                rom->data_is_image, { "media", "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
+        jobs.push_back(hashed(BACKUP_NAME_PREFIX_DATA, [&] {
+            if (block_copy && rom->data_is_image) {
+                return backup_partition_blocks(
+                        data_path, output_dir,
+                        BACKUP_NAME_PREFIX_DATA) != Result::Failed;
+            } else if (format == BackupFormat::Chunked) {
+                return backup_partition_chunked(
+                        data_path, output_dir, BACKUP_NAME_PREFIX_DATA,
+                        rom->data_is_image, { "media", "multiboot" },
+                        chunk_store, prev_dir) != Result::Failed;
+            }
+            return backup_partition(
+                    data_path, output_dir, output_data,
+                    rom->data_is_image, { "media", "multiboot" }, compression,
+                    options, split_archive_size) != Result::Failed;
+        }));
+    }
+
+    std::optional<ProgressMonitor> monitor;
+
+    // The archivers have no progress callbacks, so the progress is measured
+    // by how much of the expected output has been written
+    if (estimate && estimate->total_bytes > 0) {
+        double expected = static_cast<double>(estimate->total_bytes)
+                * estimate->compression_ratio;
+
+        monitor.emplace(estimate->eta, [&output_dir, expected] {
+            auto size = get_directory_size(output_dir, {});
+            if (!size) {
+                return 0.0;
+            }
+            // Never claim to be done before the jobs are
+            return std::min(static_cast<double>(size.value()) / expected,
+                            0.99);
+        }, [](double fraction, std::chrono::seconds remaining) {
+            LOGI("Progress: %.0f%%, about %s remaining",
+                 fraction * 100, format_duration(remaining).c_str());
+        });
+    }
+
+    if (!run_backup_jobs(jobs, parallel)) {
+        return false;
+    }
+
+    return integrity.write();
+}
+
+/*!
+ * \brief Find the manifest of a chunked partition backup
+ *
+ * \return Path to manifest or an empty string if the partition was not backed
+ *         up in the chunked format
+ */
+static std::string find_chunked_backup(const std::string &backup_dir,
+                                       const std::string &prefix)
+{
+    std::string path(backup_dir);
+    path += '/';
+    path += prefix;
+    path += BACKUP_NAME_MANIFEST_EXT;
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return {};
+    }
+
+    return path;
+}
+
+/*!
+ * \brief Verify a backup without restoring it
+ *
+ * The files are checked against the integrity manifest (if the backup has one)
+ * while the tar archives are decompressed and read through and the chunks of
+ * chunked backups are checked against their names in parallel. Nothing is
+ * written to disk.
+ *
+ * \param backup_dir Backup directory
+ * \param chunk_store Chunk store directory (if empty, the chunk store recorded
+ *                    in each manifest is used)
+ *
+ * \return Whether the backup is intact
+ */
+static bool verify_backup(const std::string &backup_dir,
+                          const std::string &chunk_store)
+{
+    LOGI("Verifying:");
+    LOGI("- Backup directory: %s", backup_dir.c_str());
+    if (!chunk_store.empty()) {
+        LOGI("- Chunk store: %s", chunk_store.c_str());
+    }
+
+    std::vector<std::function<bool()>> jobs;
+
+    std::string integrity_path(backup_dir);
+    integrity_path += '/';
+    integrity_path += BACKUP_NAME_INTEGRITY;
+
+    if (access(integrity_path.c_str(), R_OK) == 0) {
+        jobs.push_back([&] {
+            LOGI("=== Verifying digests ===");
+            return verify_backup_integrity(backup_dir);
+        });
+    } else {
+        LOGW("%s: Backup has no integrity manifest; only the archives will be "
+             "checked", backup_dir.c_str());
+    }
+
+    struct Archive
+    {
+        std::string path;
+        util::CompressionType compression;
+        bool is_split;
+    };
+
+    std::vector<Archive> archives;
+    std::vector<std::string> manifests;
+
+    for (auto const &prefix : { BACKUP_NAME_PREFIX_SYSTEM,
+                                BACKUP_NAME_PREFIX_CACHE,
+                                BACKUP_NAME_PREFIX_DATA }) {
+        auto manifest = find_chunked_backup(backup_dir, prefix);
+        if (!manifest.empty()) {
+            manifests.push_back(std::move(manifest));
+            continue;
+        }
+
+        Archive archive;
+        auto name = find_compressed_backup(backup_dir, prefix,
+                                           archive.compression,
+                                           archive.is_split);
+        if (!name.empty()) {
+            archive.path = backup_dir;
+            archive.path += '/';
+            archive.path += name;
+            archives.push_back(std::move(archive));
         }
     }
 
-    return true;
+    for (auto const &archive : archives) {
+        jobs.push_back([&archive] {
+            LOGI("=== Verifying %s ===", archive.path.c_str());
+            return util::libarchive_tar_verify(archive.path,
+                                               archive.compression,
+                                               archive.is_split, 0);
+        });
+    }
+
+    for (auto const &manifest : manifests) {
+        jobs.push_back([&manifest, &chunk_store] {
+            LOGI("=== Verifying %s ===", manifest.c_str());
+            return chunked_verify(manifest, chunk_store);
+        });
+    }
+
+    if (jobs.empty()) {
+        LOGE("%s: Nothing to verify", backup_dir.c_str());
+        return false;
+    }
+
+    // Run everything at once so that no check is skipped after a failure
+    return run_backup_jobs(jobs, static_cast<unsigned int>(jobs.size()));
+}
+
+/*!
+ * \brief Find a block-level backup of a partition
+ *
+ * \return Path to sparse image or an empty string if the partition was not
+ *         backed up with block copying
+ */
+static std::string find_block_backup(const std::string &backup_dir,
+                                     const std::string &prefix)
+{
+    std::string path(backup_dir);
+    path += '/';
+    path += prefix;
+    path += BACKUP_NAME_SPARSE_EXT;
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return {};
+    }
+
+    return path;
 }
 
 static bool restore_rom(const std::shared_ptr<Rom> &rom,
-                        const std::string &input_dir, BackupTargets targets)
+                        const std::string &input_dir, BackupTargets targets,
+                        const std::string &chunk_store, unsigned int threads)
 {
     if (!targets) {
         LOGE("No restore targets specified");
@@ -755,68 +1341,124 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
     // Restore system
     if (targets & BackupTarget::System) {
-        auto image_size = util::mount_get_total_size(
-                Roms::get_system_partition());
-        if (!image_size) {
-            LOGE("Failed to get the size of the system partition");
-            return false;
-        }
+        std::string sparse_path = find_block_backup(
+                input_dir, BACKUP_NAME_PREFIX_SYSTEM);
+        std::string manifest = find_chunked_backup(
+                input_dir, BACKUP_NAME_PREFIX_SYSTEM);
+        if (!sparse_path.empty()) {
+            if (restore_partition_blocks(
+                    system_path, sparse_path,
+                    rom->system_is_image) == Result::Failed) {
+                return false;
+            }
+        } else if (!manifest.empty()) {
+            if (restore_partition_chunked(
+                    system_path, manifest, rom->system_is_image, {},
+                    chunk_store) == Result::Failed) {
+                return false;
+            }
+        } else {
+            auto image_size = util::mount_get_total_size(
+                    Roms::get_system_partition());
+            if (!image_size) {
+                LOGE("Failed to get the size of the system partition");
+                return false;
+            }
 
-        util::CompressionType compression;
-        bool is_split;
+            util::CompressionType compression;
+            bool is_split;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_SYSTEM, compression, is_split);
-        if (path.empty()) {
-            LOGE("Backup of /system not found");
-            return false;
-        }
+            std::string path = find_compressed_backup(
+                    input_dir, BACKUP_NAME_PREFIX_SYSTEM, compression,
+                    is_split);
+            if (path.empty()) {
+                LOGE("Backup of /system not found");
+                return false;
+            }
 
-        Result ret = restore_partition(
-                system_path, input_dir, path, rom->system_is_image,
-                image_size.value(), {}, compression, is_split);
-        if (ret == Result::Failed) {
-            return false;
+            Result ret = restore_partition(
+                    system_path, input_dir, path, rom->system_is_image,
+                    image_size.value(), {}, compression, is_split, threads);
+            if (ret == Result::Failed) {
+                return false;
+            }
         }
     }
 
     // Restore cache
     if (targets & BackupTarget::Cache) {
-        util::CompressionType compression;
-        bool is_split;
+        std::string sparse_path = find_block_backup(
+                input_dir, BACKUP_NAME_PREFIX_CACHE);
+        std::string manifest = find_chunked_backup(
+                input_dir, BACKUP_NAME_PREFIX_CACHE);
+        if (!sparse_path.empty()) {
+            if (restore_partition_blocks(
+                    cache_path, sparse_path,
+                    rom->cache_is_image) == Result::Failed) {
+                return false;
+            }
+        } else if (!manifest.empty()) {
+            if (restore_partition_chunked(
+                    cache_path, manifest, rom->cache_is_image, {},
+                    chunk_store) == Result::Failed) {
+                return false;
+            }
+        } else {
+            util::CompressionType compression;
+            bool is_split;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_CACHE, compression, is_split);
-        if (path.empty()) {
-            LOGE("Backup of /cache not found");
-            return false;
-        }
+            std::string path = find_compressed_backup(
+                    input_dir, BACKUP_NAME_PREFIX_CACHE, compression, is_split);
+            if (path.empty()) {
+                LOGE("Backup of /cache not found");
+                return false;
+            }
 
-        Result ret = restore_partition(
-                cache_path, input_dir, path, rom->cache_is_image,
-                DEFAULT_IMAGE_SIZE, {}, compression, is_split);
-        if (ret == Result::Failed) {
-            return false;
+            Result ret = restore_partition(
+                    cache_path, input_dir, path, rom->cache_is_image,
+                    DEFAULT_IMAGE_SIZE, {}, compression, is_split, threads);
+            if (ret == Result::Failed) {
+                return false;
+            }
         }
     }
 
     // Restore data
     if (targets & BackupTarget::Data) {
-        util::CompressionType compression;
-        bool is_split;
+        std::string sparse_path = find_block_backup(
+                input_dir, BACKUP_NAME_PREFIX_DATA);
+        std::string manifest = find_chunked_backup(
+                input_dir, BACKUP_NAME_PREFIX_DATA);
+        if (!sparse_path.empty()) {
+            if (restore_partition_blocks(
+                    data_path, sparse_path,
+                    rom->data_is_image) == Result::Failed) {
+                return false;
+            }
+        } else if (!manifest.empty()) {
+            if (restore_partition_chunked(
+                    data_path, manifest, rom->data_is_image, { "media" },
+                    chunk_store) == Result::Failed) {
+                return false;
+            }
+        } else {
+            util::CompressionType compression;
+            bool is_split;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_DATA, compression, is_split);
-        if (path.empty()) {
-            LOGE("Backup of /data not found");
-            return false;
-        }
+            std::string path = find_compressed_backup(
+                    input_dir, BACKUP_NAME_PREFIX_DATA, compression, is_split);
+            if (path.empty()) {
+                LOGE("Backup of /data not found");
+                return false;
+            }
 
-        Result ret = restore_partition(
-                data_path, input_dir, path, rom->data_is_image,
-                DEFAULT_IMAGE_SIZE, { "media" }, compression, is_split);
-        if (ret == Result::Failed) {
-            return false;
+            Result ret = restore_partition(
+                    data_path, input_dir, path, rom->data_is_image,
+                    DEFAULT_IMAGE_SIZE, { "media" }, compression, is_split,
+                    threads);
+            if (ret == Result::Failed) {
+                return false;
+            }
         }
     }
 
@@ -921,9 +1563,38 @@ static void backup_usage(FILE *stream)
             "  -c, --compression <compression type>\n"
             "                   Compression type (none, lz4, gzip, xz)\n"
             "                   (Default: lz4)\n"
+            "  -l, --level <level>\n"
+            "                   Compression level (Default: compressor default)\n"
+            "  -j, --threads <count>\n"
+            "                   Compression threads for xz (0 for one per CPU)\n"
+            "                   (Default: 1)\n"
             "  -s, --split-size <size>\n"
             "                   Split archive maximum size in bytes (0 to disable)\n"
             "                   (Default: %" PRIu64 " bytes)\n"
+            "  -p, --parallel <count>\n"
+            "                   Back up up to <count> partitions concurrently and\n"
+            "                   compress on separate threads (0 to back up\n"
+            "                   everything sequentially) (Default: 0)\n"
+            "  -F, --format <format>\n"
+            "                   Backup format for partitions (tar, chunked)\n"
+            "                   (Default: tar)\n"
+            "  -S, --chunk-store <directory>\n"
+            "                   Chunk store for the chunked format. Backups\n"
+            "                   sharing a chunk store are deduplicated against\n"
+            "                   each other. (Default: <backupdir>/chunks)\n"
+            "  -P, --previous <directory>\n"
+            "                   Previous chunked backup of the same ROM. Files\n"
+            "                   that have not changed since are not read again.\n"
+            "  -B, --block-copy Back up image-backed partitions by copying their\n"
+            "                   allocated blocks to a sparse image instead of\n"
+            "                   archiving their files\n"
+            "  -E, --estimate   Only estimate how long the backup would take\n"
+            "  -V, --verify     Verify the existing backup in <backupdir>\n"
+            "                   against its digests and check that its archives\n"
+            "                   and chunks can be read, without restoring\n"
+            "                   anything. Only -d/--backupdir and, for chunk\n"
+            "                   stores other than the one recorded in the\n"
+            "                   manifests, -S/--chunk-store are needed.\n"
             "  -d, --backupdir <directory>\n"
             "                   Directory to store backup\n"
             "  -f, --force      Allow overwriting old backup with the same name\n"
@@ -949,6 +1620,13 @@ static void restore_usage(FILE *stream)
             "                   (Default: 'all')\n"
             "  -d, --backupdir <directory>\n"
             "                   Backup directory to restore from\n"
+            "  -S, --chunk-store <directory>\n"
+            "                   Chunk store for chunked backups (Default: the\n"
+            "                   chunk store used when creating the backup)\n"
+            "  -j, --threads <count>\n"
+            "                   Threads for writing restored files (0 for one\n"
+            "                   per CPU, 1 to let libarchive write them)\n"
+            "                   (Default: 0)\n"
             "  -h, --help       Display this help message\n"
             "\n"
             "Valid backup targets: 'all' or some combination of the following:\n"
@@ -962,13 +1640,22 @@ int backup_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:c:d:s:fh";
+    static const char *short_options = "r:t:c:l:j:d:s:p:F:S:P:BEVfh";
     static struct option long_options[] = {
         {"romid",       required_argument, 0, 'r'},
         {"targets",     required_argument, 0, 't'},
         {"compression", required_argument, 0, 'c'},
+        {"level",       required_argument, 0, 'l'},
+        {"threads",     required_argument, 0, 'j'},
         {"backupdir",   required_argument, 0, 'd'},
         {"split-size",  required_argument, 0, 's'},
+        {"parallel",    required_argument, 0, 'p'},
+        {"format",      required_argument, 0, 'F'},
+        {"chunk-store", required_argument, 0, 'S'},
+        {"previous",    required_argument, 0, 'P'},
+        {"block-copy",  no_argument,       0, 'B'},
+        {"estimate",    no_argument,       0, 'E'},
+        {"verify",      no_argument,       0, 'V'},
         {"force",       no_argument,       0, 'f'},
         {"help",        no_argument,       0, 'h'},
         {0, 0, 0, 0}
@@ -980,7 +1667,15 @@ int backup_main(int argc, char *argv[])
     std::string targets_str("all");
     std::string backupdir;
     util::CompressionType compression = util::CompressionType::Lz4;
+    util::CompressionOptions compression_options;
     uint64_t split_archive_size = DEFAULT_ARCHIVE_SPLIT_SIZE;
+    unsigned int parallel = 0;
+    BackupFormat format = BackupFormat::Tar;
+    std::string chunk_store;
+    std::string prev_dir;
+    bool block_copy = false;
+    bool estimate_only = false;
+    bool verify = false;
     bool force = false;
 
     while ((opt = getopt_long(argc, argv, short_options,
@@ -998,6 +1693,21 @@ int backup_main(int argc, char *argv[])
                 return EXIT_FAILURE;
             }
             break;
+        case 'l': {
+            int level;
+            if (!str_to_num(optarg, 10, level)) {
+                fprintf(stderr, "Invalid compression level: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            compression_options.level = level;
+            break;
+        }
+        case 'j':
+            if (!str_to_num(optarg, 10, compression_options.threads)) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'd':
             backupdir = optarg;
             break;
@@ -1007,6 +1717,37 @@ int backup_main(int argc, char *argv[])
                 return EXIT_FAILURE;
             }
             break;
+        case 'p':
+            if (!str_to_num(optarg, 10, parallel)) {
+                fprintf(stderr, "Invalid parallel count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'F':
+            if (strcmp(optarg, "tar") == 0) {
+                format = BackupFormat::Tar;
+            } else if (strcmp(optarg, "chunked") == 0) {
+                format = BackupFormat::Chunked;
+            } else {
+                fprintf(stderr, "Invalid backup format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'S':
+            chunk_store = optarg;
+            break;
+        case 'P':
+            prev_dir = optarg;
+            break;
+        case 'B':
+            block_copy = true;
+            break;
+        case 'E':
+            estimate_only = true;
+            break;
+        case 'V':
+            verify = true;
+            break;
         case 'f':
             force = true;
             break;
@@ -1025,13 +1766,23 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (romid.empty()) {
-        fprintf(stderr, "No ROM ID specified\n");
+    if (backupdir.empty()) {
+        fprintf(stderr, "No backup directory specified\n");
         return EXIT_FAILURE;
     }
 
-    if (backupdir.empty()) {
-        fprintf(stderr, "No backup directory specified\n");
+    if (verify) {
+        if (verify_backup(backupdir, chunk_store)) {
+            LOGI("=== Backup is intact ===");
+            return EXIT_SUCCESS;
+        } else {
+            LOGI("=== Backup is damaged ===");
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (romid.empty()) {
+        fprintf(stderr, "No ROM ID specified\n");
         return EXIT_FAILURE;
     }
 
@@ -1073,8 +1824,36 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (format == BackupFormat::Chunked) {
+        if (chunk_store.empty()) {
+            chunk_store = backupdir;
+            chunk_store += '/';
+            chunk_store += BACKUP_NAME_CHUNK_STORE;
+        }
+
+        if (auto r = util::mkdir_recursive(chunk_store, 0700);
+                !r && r.error() != std::errc::file_exists) {
+            fprintf(stderr, "%s: Failed to create directory: %s\n",
+                    chunk_store.c_str(), r.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+
+        // The path is recorded in the manifests, so make sure it does not
+        // depend on the current directory
+        auto real_chunk_store = util::real_path(chunk_store);
+        if (!real_chunk_store) {
+            fprintf(stderr, "%s: Failed to resolve path: %s\n",
+                    chunk_store.c_str(),
+                    real_chunk_store.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+        chunk_store = std::move(real_chunk_store.value());
+    }
+
     bool ret = backup_rom(rom, backupdir, targets, compression,
-                          split_archive_size);
+                          compression_options, split_archive_size, parallel,
+                          format, chunk_store, prev_dir, block_copy,
+                          estimate_only);
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
@@ -1088,12 +1867,14 @@ int restore_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:d:h";
+    static const char *short_options = "r:t:d:S:j:h";
     static struct option long_options[] = {
-        {"romid",     required_argument, 0, 'r'},
-        {"targets",   required_argument, 0, 't'},
-        {"backupdir", required_argument, 0, 'd'},
-        {"help",      no_argument,       0, 'h'},
+        {"romid",       required_argument, 0, 'r'},
+        {"targets",     required_argument, 0, 't'},
+        {"backupdir",   required_argument, 0, 'd'},
+        {"chunk-store", required_argument, 0, 'S'},
+        {"threads",     required_argument, 0, 'j'},
+        {"help",        no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
 
@@ -1102,6 +1883,8 @@ int restore_main(int argc, char *argv[])
     std::string romid;
     std::string targets_str("all");
     std::string backupdir;
+    std::string chunk_store;
+    unsigned int threads = 0;
 
     while ((opt = getopt_long(argc, argv, short_options,
             long_options, &long_index)) != -1) {
@@ -1115,6 +1898,15 @@ int restore_main(int argc, char *argv[])
         case 'd':
             backupdir = optarg;
             break;
+        case 'S':
+            chunk_store = optarg;
+            break;
+        case 'j':
+            if (!str_to_num(optarg, 10, threads)) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'h':
             restore_usage(stdout);
             return EXIT_SUCCESS;
@@ -1174,7 +1966,7 @@ int restore_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    bool ret = restore_rom(rom, backupdir, targets);
+    bool ret = restore_rom(rom, backupdir, targets, chunk_store, threads);
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
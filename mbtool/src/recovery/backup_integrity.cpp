@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/backup_integrity.h"
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/string.h"
+
+#define LOG_TAG "mbtool/recovery/backup_integrity"
+
+#define INTEGRITY_MAGIC     "mbtool-backup-integrity"
+#define INTEGRITY_VERSION   1
+
+namespace mb
+{
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+/*
+ * The integrity manifest is a text file in the backup directory:
+ *
+ *     mbtool-backup-integrity 1
+ *     chunk-size <bytes>
+ *     <size> <digest>[,<digest>...] <name>
+ *     ...
+ *
+ * Each file is split into chunk-size pieces (the last one may be shorter) and
+ * each piece gets its own SHA-512 digest. Empty files have a single digest of
+ * no data.
+ */
+
+static constexpr uint64_t INTEGRITY_CHUNK_SIZE = 64 * 1024 * 1024;
+
+/*!
+ * \brief Get ranges for hashing a file in chunks
+ */
+static void add_ranges(std::vector<util::HashRange> &ranges,
+                       const std::string &path, uint64_t size,
+                       uint64_t chunk_size)
+{
+    uint64_t offset = 0;
+
+    do {
+        uint64_t n = std::min(size - offset, chunk_size);
+        ranges.push_back({path, offset, n});
+        offset += n;
+    } while (offset < size);
+}
+
+BackupIntegrity::BackupIntegrity(std::string backup_dir)
+    : m_backup_dir(std::move(backup_dir))
+{
+}
+
+/*!
+ * \brief Hash a file in the backup directory
+ *
+ * \param name Name of file relative to the backup directory
+ *
+ * \return Whether the file was successfully hashed
+ */
+bool BackupIntegrity::add_file(const std::string &name)
+{
+    std::string path(m_backup_dir);
+    path += '/';
+    path += name;
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    Entry entry;
+    entry.size = static_cast<uint64_t>(sb.st_size);
+
+    std::vector<util::HashRange> ranges;
+    add_ranges(ranges, path, entry.size, INTEGRITY_CHUNK_SIZE);
+
+    auto digests = util::sha512_hash_ranges(ranges);
+    if (!digests) {
+        LOGE("%s: Failed to hash file: %s",
+             path.c_str(), digests.error().message().c_str());
+        return false;
+    }
+
+    entry.digests = std::move(digests.value());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[name] = std::move(entry);
+
+    return true;
+}
+
+/*!
+ * \brief Hash every file in the backup directory that belongs to a target
+ *
+ * This includes files named \a prefix and files whose names start with
+ * "<prefix>.", such as `system.tar.gz.0` or `system.sparse.img`.
+ *
+ * \param prefix Backup name prefix
+ *
+ * \return Whether all matching files were successfully hashed
+ */
+bool BackupIntegrity::add_files_with_prefix(const std::string &prefix)
+{
+    ScopedDIR dp(opendir(m_backup_dir.c_str()), &closedir);
+    if (!dp) {
+        LOGE("%s: Failed to open directory: %s",
+             m_backup_dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::vector<std::string> names;
+    std::string dot_prefix(prefix);
+    dot_prefix += '.';
+
+    while (auto ent = readdir(dp.get())) {
+        if (ent->d_type == DT_DIR) {
+            continue;
+        }
+
+        std::string_view name(ent->d_name);
+        if (name == prefix || starts_with(name, dot_prefix)) {
+            names.emplace_back(name);
+        }
+    }
+
+    for (auto const &name : names) {
+        if (!add_file(name)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write integrity manifest to the backup directory
+ *
+ * \return Whether the manifest was successfully written
+ */
+bool BackupIntegrity::write()
+{
+    std::string path(m_backup_dir);
+    path += '/';
+    path += BACKUP_NAME_INTEGRITY;
+
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        unlink(temp_path.c_str());
+    });
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    bool ret = fprintf(fp.get(), INTEGRITY_MAGIC " %d\n",
+                       INTEGRITY_VERSION) >= 0
+            && fprintf(fp.get(), "chunk-size %" PRIu64 "\n",
+                       INTEGRITY_CHUNK_SIZE) >= 0;
+
+    for (auto it = m_entries.begin(); ret && it != m_entries.end(); ++it) {
+        std::string digests;
+
+        for (auto const &digest : it->second.digests) {
+            if (!digests.empty()) {
+                digests += ',';
+            }
+            digests += util::hex_string(digest.data(), digest.size());
+        }
+
+        ret = fprintf(fp.get(), "%" PRIu64 " %s %s\n", it->second.size,
+                      digests.c_str(), it->first.c_str()) >= 0;
+    }
+
+    if (!ret) {
+        LOGE("%s: Failed to write manifest: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    remove_temp.dismiss();
+
+    LOGI("%s: Recorded digests for %zu files",
+         path.c_str(), m_entries.size());
+
+    return true;
+}
+
+struct IntegrityEntry
+{
+    std::string name;
+    uint64_t size;
+    std::vector<std::string> digests;
+};
+
+static bool parse_integrity_entry(std::string_view line, IntegrityEntry &e)
+{
+    auto size_end = line.find(' ');
+    if (size_end == std::string_view::npos) {
+        return false;
+    }
+
+    auto digests_end = line.find(' ', size_end + 1);
+    if (digests_end == std::string_view::npos) {
+        return false;
+    }
+
+    std::string size_str(line.substr(0, size_end));
+    if (!str_to_num(size_str.c_str(), 10, e.size)) {
+        return false;
+    }
+
+    auto digests = line.substr(size_end + 1, digests_end - size_end - 1);
+    for (auto const &digest : split_sv(digests, ',')) {
+        if (digest.size() != util::Sha512Digest().size() * 2) {
+            return false;
+        }
+        e.digests.emplace_back(digest);
+    }
+
+    e.name = line.substr(digests_end + 1);
+
+    // Don't allow referencing files outside of the backup directory
+    return !e.name.empty() && e.name.find('/') == std::string_view::npos
+            && e.name != "." && e.name != "..";
+}
+
+/*!
+ * \brief Read integrity manifest
+ *
+ * \param path Manifest path
+ * \param chunk_size Output chunk size
+ * \param entries Output entries
+ *
+ * \return Whether the manifest was successfully read
+ */
+static bool read_integrity_manifest(const std::string &path,
+                                    uint64_t &chunk_size,
+                                    std::vector<IntegrityEntry> &entries)
+{
+    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char *buf = nullptr;
+    size_t buf_size = 0;
+    ssize_t n;
+    size_t line_num = 0;
+
+    auto free_buf = finally([&] {
+        free(buf);
+    });
+
+    while ((n = getline(&buf, &buf_size, fp.get())) >= 0) {
+        std::string_view line(buf, static_cast<size_t>(n));
+        if (!line.empty() && line.back() == '\n') {
+            line.remove_suffix(1);
+        }
+
+        bool valid;
+
+        if (line_num == 0) {
+            valid = line == INTEGRITY_MAGIC " 1";
+        } else if (line_num == 1) {
+            valid = starts_with(line, "chunk-size ")
+                    && str_to_num(std::string(line.substr(11)).c_str(), 10,
+                                  chunk_size)
+                    && chunk_size > 0;
+        } else {
+            auto &e = entries.emplace_back();
+            valid = parse_integrity_entry(line, e)
+                    && e.digests.size() == std::max<uint64_t>(
+                            (e.size + chunk_size - 1) / chunk_size, 1);
+        }
+
+        if (!valid) {
+            LOGE("%s:%zu: Invalid manifest line", path.c_str(), line_num + 1);
+            return false;
+        }
+
+        ++line_num;
+    }
+
+    if (ferror(fp.get())) {
+        LOGE("%s: Failed to read manifest: %s", path.c_str(), strerror(errno));
+        return false;
+    } else if (line_num < 2) {
+        LOGE("%s: Truncated manifest", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Verify the files in a backup directory against its integrity manifest
+ *
+ * The chunks of all files are hashed concurrently. Every corrupt chunk is
+ * reported instead of stopping at the first mismatch.
+ *
+ * \param backup_dir Backup directory
+ *
+ * \return Whether every file listed in the manifest is intact
+ */
+bool verify_backup_integrity(const std::string &backup_dir)
+{
+    std::string path(backup_dir);
+    path += '/';
+    path += BACKUP_NAME_INTEGRITY;
+
+    uint64_t chunk_size;
+    std::vector<IntegrityEntry> entries;
+
+    if (!read_integrity_manifest(path, chunk_size, entries)) {
+        return false;
+    }
+
+    bool ret = true;
+    std::vector<util::HashRange> ranges;
+    // Index of the file for each range
+    std::vector<size_t> owners;
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        auto const &e = entries[i];
+
+        std::string file_path(backup_dir);
+        file_path += '/';
+        file_path += e.name;
+
+        struct stat sb;
+        if (stat(file_path.c_str(), &sb) < 0) {
+            LOGE("%s: Failed to stat: %s", file_path.c_str(), strerror(errno));
+            ret = false;
+            continue;
+        } else if (static_cast<uint64_t>(sb.st_size) != e.size) {
+            LOGE("%s: Expected size %" PRIu64 ", but found %" PRIu64,
+                 file_path.c_str(), e.size,
+                 static_cast<uint64_t>(sb.st_size));
+            ret = false;
+            continue;
+        }
+
+        add_ranges(ranges, file_path, e.size, chunk_size);
+        owners.resize(ranges.size(), i);
+    }
+
+    LOGI("%s: Verifying %zu chunks in %zu files", backup_dir.c_str(),
+         ranges.size(), entries.size());
+
+    auto digests = util::sha512_hash_ranges(ranges, {},
+            [](size_t done, size_t total) {
+        LOGV("Verified %zu/%zu chunks", done, total);
+    });
+    if (!digests) {
+        LOGE("%s: Failed to hash files: %s",
+             backup_dir.c_str(), digests.error().message().c_str());
+        return false;
+    }
+
+    size_t chunk_index = 0;
+
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (i > 0 && owners[i] != owners[i - 1]) {
+            chunk_index = 0;
+        }
+
+        auto const &e = entries[owners[i]];
+        auto const &digest = digests.value()[i];
+
+        if (util::hex_string(digest.data(), digest.size())
+                != e.digests[chunk_index]) {
+            LOGE("%s: Chunk %zu (offset %" PRIu64 ") is corrupt",
+                 ranges[i].path.c_str(), chunk_index, ranges[i].offset);
+            ret = false;
+        }
+
+        ++chunk_index;
+    }
+
+    return ret;
+}
+
+}
@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/block_image.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/io_queue.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+
+// minizip
+#include "mz.h"
+#include "mz_strm_android.h"
+#include "mz_strm_buf.h"
+#include "mz_zip.h"
+
+#define LOG_TAG "mbtool/recovery/block_image"
+
+namespace mb
+{
+
+//! Size of each half of the double-buffered new data
+static constexpr size_t NEW_DATA_BUFFER_SIZE = 4 * 1024 * 1024;
+//! Largest single write when zeroing a range without kernel support
+static constexpr size_t ZERO_CHUNK_SIZE = 1024 * 1024;
+//! Size of compressed reads from the zip file
+static constexpr uint32_t ZIP_READ_SIZE = 256 * 1024;
+
+static oc::result<std::vector<TransferBlockRange>>
+parse_ranges(std::string_view str, uint64_t total_blocks)
+{
+    auto pieces = split_sv(str, ',');
+    uint64_t count;
+
+    if (pieces.size() < 3
+            || !str_to_num(std::string(pieces[0]).c_str(), 10, count)
+            || count != pieces.size() - 1 || count % 2 != 0) {
+        return std::errc::invalid_argument;
+    }
+
+    std::vector<TransferBlockRange> ranges;
+    ranges.reserve(count / 2);
+
+    for (size_t i = 1; i < pieces.size(); i += 2) {
+        TransferBlockRange range;
+
+        if (!str_to_num(std::string(pieces[i]).c_str(), 10, range.begin)
+                || !str_to_num(std::string(pieces[i + 1]).c_str(), 10,
+                               range.end)
+                || range.begin >= range.end || range.end > total_blocks) {
+            return std::errc::invalid_argument;
+        }
+
+        ranges.push_back(range);
+    }
+
+    return ranges;
+}
+
+/*!
+ * \brief Parse a transfer list for a full block-based OTA
+ *
+ * Only the commands that do not depend on the existing contents of the target
+ * (erase, zero, and new) are supported. Transfer lists for incremental OTAs
+ * contain commands like move, bsdiff, and stash, which cause this function to
+ * fail with std::errc::not_supported.
+ *
+ * \param data Contents of the transfer list
+ *
+ * \return Parsed transfer list or an error if the transfer list is invalid or
+ *         unsupported
+ */
+oc::result<TransferList> parse_transfer_list(std::string_view data)
+{
+    auto lines = split_sv(data, '\n');
+    TransferList tl;
+
+    if (lines.size() < 2
+            || !str_to_num(std::string(lines[0]).c_str(), 10, tl.version)
+            || tl.version < 1 || tl.version > 4
+            || !str_to_num(std::string(lines[1]).c_str(), 10,
+                           tl.total_blocks)) {
+        LOGE("Invalid transfer list header");
+        return std::errc::invalid_argument;
+    }
+
+    // Version 2 and newer have two more lines for the stash limits
+    size_t first_command = tl.version >= 2 ? 4 : 2;
+    if (lines.size() < first_command) {
+        LOGE("Transfer list is truncated");
+        return std::errc::invalid_argument;
+    }
+
+    for (size_t i = first_command; i < lines.size(); ++i) {
+        auto line = lines[i];
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        auto space = line.find(' ');
+        auto name = line.substr(0, space);
+        auto args = space == std::string_view::npos
+                ? std::string_view() : line.substr(space + 1);
+
+        TransferCommand cmd;
+
+        if (name == "erase") {
+            cmd.type = TransferCommandType::Erase;
+        } else if (name == "zero") {
+            cmd.type = TransferCommandType::Zero;
+        } else if (name == "new") {
+            cmd.type = TransferCommandType::New;
+        } else {
+            LOGE("Unsupported transfer list command: %.*s",
+                 static_cast<int>(name.size()), name.data());
+            return std::errc::not_supported;
+        }
+
+        if (auto ranges = parse_ranges(args, tl.total_blocks)) {
+            cmd.ranges = std::move(ranges.value());
+        } else {
+            LOGE("Invalid block ranges on line %" MB_PRIzu, i + 1);
+            return ranges.as_failure();
+        }
+
+        tl.commands.push_back(std::move(cmd));
+    }
+
+    return tl;
+}
+
+namespace
+{
+
+/*!
+ * \brief Zip file opened for reading with minizip
+ */
+class ZipReader
+{
+public:
+    ZipReader()
+        : m_stream(nullptr)
+        , m_buf_stream(nullptr)
+        , m_stream_open(false)
+        , m_handle(nullptr)
+    {
+    }
+
+    ~ZipReader()
+    {
+        if (m_handle) {
+            mz_zip_close(m_handle);
+        }
+        if (m_stream_open) {
+            mz_stream_close(m_buf_stream);
+        }
+        if (m_buf_stream) {
+            mz_stream_delete(&m_buf_stream);
+        }
+        if (m_stream) {
+            mz_stream_delete(&m_stream);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ZipReader)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ZipReader)
+
+    oc::result<void> open(const std::string &path)
+    {
+        if (!mz_stream_android_create(&m_stream)
+                || !mz_stream_buffered_create(&m_buf_stream)) {
+            return std::errc::not_enough_memory;
+        }
+
+        if (mz_stream_set_base(m_buf_stream, m_stream) != MZ_OK
+                || mz_stream_open(m_buf_stream, path.c_str(),
+                                  MZ_OPEN_MODE_READ) != MZ_OK) {
+            return std::errc::io_error;
+        }
+        m_stream_open = true;
+
+        m_handle = mz_zip_open(m_buf_stream, MZ_OPEN_MODE_READ);
+        if (!m_handle) {
+            return std::errc::invalid_argument;
+        }
+
+        return oc::success();
+    }
+
+    oc::result<void> open_entry(const std::string &name)
+    {
+        if (mz_zip_locate_entry(m_handle, name.c_str(), nullptr) != MZ_OK) {
+            return std::errc::no_such_file_or_directory;
+        }
+        if (mz_zip_entry_read_open(m_handle, 0, nullptr) != MZ_OK) {
+            return std::errc::io_error;
+        }
+        return oc::success();
+    }
+
+    void close_entry()
+    {
+        mz_zip_entry_close(m_handle);
+    }
+
+    //! Read until \p size bytes are read or the end of the entry is reached
+    oc::result<size_t> read(void *buf, size_t size)
+    {
+        auto ptr = static_cast<unsigned char *>(buf);
+        size_t total = 0;
+
+        while (total < size) {
+            auto n = mz_zip_entry_read(
+                    m_handle, ptr + total, static_cast<uint32_t>(
+                            std::min<size_t>(size - total, ZIP_READ_SIZE)));
+            if (n < 0) {
+                return std::errc::io_error;
+            } else if (n == 0) {
+                break;
+            }
+            total += static_cast<size_t>(n);
+        }
+
+        return total;
+    }
+
+    oc::result<std::string> read_entry(const std::string &name)
+    {
+        OUTCOME_TRYV(open_entry(name));
+
+        auto close = finally([&] {
+            close_entry();
+        });
+
+        std::string data;
+        size_t n;
+
+        do {
+            auto offset = data.size();
+            data.resize(offset + ZIP_READ_SIZE);
+            OUTCOME_TRY(n_read, read(data.data() + offset, ZIP_READ_SIZE));
+            n = n_read;
+            data.resize(offset + n);
+        } while (n == ZIP_READ_SIZE);
+
+        return data;
+    }
+
+private:
+    void *m_stream;
+    void *m_buf_stream;
+    bool m_stream_open;
+    void *m_handle;
+};
+
+/*!
+ * \brief Writes new data to the target with decompression and I/O overlapped
+ *
+ * The new data is inflated into one half of a double buffer while the writes
+ * from the other half are in flight on an IoQueue.
+ */
+class NewDataWriter
+{
+public:
+    NewDataWriter(ZipReader &zip, File &file)
+        : m_zip(zip)
+        , m_queue(file)
+        , m_cur(0)
+        , m_fill(0)
+    {
+        for (auto &buf : m_bufs) {
+            buf.resize(NEW_DATA_BUFFER_SIZE);
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(NewDataWriter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(NewDataWriter)
+
+    oc::result<void> write_range(uint64_t offset, uint64_t size)
+    {
+        while (size > 0) {
+            if (m_fill == NEW_DATA_BUFFER_SIZE) {
+                OUTCOME_TRYV(swap_buffers());
+            }
+
+            auto n = static_cast<size_t>(std::min<uint64_t>(
+                    size, NEW_DATA_BUFFER_SIZE - m_fill));
+            auto *ptr = m_bufs[m_cur].data() + m_fill;
+
+            OUTCOME_TRY(n_read, m_zip.read(ptr, n));
+            if (n_read != n) {
+                LOGE("New data ended before the transfer list");
+                return std::errc::invalid_argument;
+            }
+
+            m_pending.push_back({offset, ptr, n});
+            m_fill += n;
+            offset += n;
+            size -= n;
+        }
+
+        return oc::success();
+    }
+
+    //! Submit the buffered writes and wait for all writes to complete
+    oc::result<void> flush()
+    {
+        OUTCOME_TRYV(m_queue.wait());
+        OUTCOME_TRYV(submit_pending());
+        return m_queue.wait();
+    }
+
+private:
+    struct PendingWrite
+    {
+        uint64_t offset;
+        const unsigned char *data;
+        size_t size;
+    };
+
+    oc::result<void> submit_pending()
+    {
+        for (auto const &w : m_pending) {
+            OUTCOME_TRYV(m_queue.submit_write(w.offset, w.data, w.size));
+        }
+        m_pending.clear();
+        m_fill = 0;
+        m_cur ^= 1;
+        return oc::success();
+    }
+
+    oc::result<void> swap_buffers()
+    {
+        // The other half is only reused once its writes have completed
+        OUTCOME_TRYV(m_queue.wait());
+        return submit_pending();
+    }
+
+    ZipReader &m_zip;
+    // Declared before the queue so that they outlive any writes in flight
+    std::vector<unsigned char> m_bufs[2];
+    IoQueue m_queue;
+
+    size_t m_cur;
+    size_t m_fill;
+    std::vector<PendingWrite> m_pending;
+};
+
+}
+
+static oc::result<void> write_zeros(int fd, uint64_t offset, uint64_t size)
+{
+    std::vector<unsigned char> zeros(static_cast<size_t>(
+            std::min<uint64_t>(size, ZERO_CHUNK_SIZE)));
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, zeros.size()));
+        auto ret = pwrite64(fd, zeros.data(), n, static_cast<off64_t>(offset));
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        }
+        offset += static_cast<uint64_t>(ret);
+        size -= static_cast<uint64_t>(ret);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Discard or zero a range of the target
+ *
+ * For zeroing, BLKZEROOUT (block devices) or hole punching (image files) are
+ * tried first so that no data has to be written. Erasing is only a hint, so
+ * falling back to writing zeros is not necessary.
+ */
+static oc::result<void> clear_range(int fd, bool is_blkdev, uint64_t offset,
+                                    uint64_t size, bool zero)
+{
+    if (is_blkdev) {
+        uint64_t range[2] = { offset, size };
+        if (ioctl(fd, zero ? BLKZEROOUT : BLKDISCARD, &range) == 0) {
+            return oc::success();
+        }
+    } else if (fallocate64(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                           static_cast<off64_t>(offset),
+                           static_cast<off64_t>(size)) == 0) {
+        return oc::success();
+    }
+
+    if (!zero) {
+        return oc::success();
+    }
+
+    return write_zeros(fd, offset, size);
+}
+
+/*!
+ * \brief Apply a full block-based OTA to a block device or image
+ *
+ * This is equivalent to the block_image_update() edify function for transfer
+ * lists that only contain erase, zero, and new commands. The new data is read
+ * straight from the zip file and written with large writes that are kept in
+ * flight while the next chunk is inflated. Zeroed and erased ranges are
+ * discarded instead of written when possible.
+ *
+ * \param zip_file Path to the zip file
+ * \param transfer_list_path Path of the transfer list in the zip file
+ * \param new_data_path Path of the uncompressed new data in the zip file
+ * \param target Block device or image file to write to
+ *
+ * \return Nothing on success or the error code on failure
+ */
+oc::result<void> block_image_update(const std::string &zip_file,
+                                    const std::string &transfer_list_path,
+                                    const std::string &new_data_path,
+                                    const std::string &target)
+{
+    ZipReader zip;
+
+    if (auto r = zip.open(zip_file); !r) {
+        LOGE("%s: Failed to open zip: %s",
+             zip_file.c_str(), r.error().message().c_str());
+        return r.as_failure();
+    }
+
+    auto tl_data = zip.read_entry(transfer_list_path);
+    if (!tl_data) {
+        LOGE("%s: Failed to read %s: %s", zip_file.c_str(),
+             transfer_list_path.c_str(), tl_data.error().message().c_str());
+        return tl_data.as_failure();
+    }
+
+    OUTCOME_TRY(tl, parse_transfer_list(tl_data.value()));
+
+    int fd = open64(target.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        auto ec = ec_from_errno();
+        LOGE("%s: Failed to open: %s", target.c_str(), ec.message().c_str());
+        return ec;
+    }
+
+    auto close_fd = finally([&] {
+        if (fd >= 0) {
+            close(fd);
+        }
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        auto ec = ec_from_errno();
+        LOGE("%s: Failed to stat: %s", target.c_str(), ec.message().c_str());
+        return ec;
+    }
+
+    bool is_blkdev = S_ISBLK(sb.st_mode);
+
+    if (auto r = zip.open_entry(new_data_path); !r) {
+        LOGE("%s: Failed to open %s: %s", zip_file.c_str(),
+             new_data_path.c_str(), r.error().message().c_str());
+        return r.as_failure();
+    }
+
+    auto close_entry = finally([&] {
+        zip.close_entry();
+    });
+
+    FdFile file;
+    OUTCOME_TRYV(file.open(fd, false));
+
+    uint64_t new_blocks = 0;
+    uint64_t cleared_blocks = 0;
+
+    {
+        NewDataWriter writer(zip, file);
+
+        for (auto const &cmd : tl.commands) {
+            if (cmd.type == TransferCommandType::New) {
+                for (auto const &range : cmd.ranges) {
+                    if (auto r = writer.write_range(
+                            range.begin * TRANSFER_BLOCK_SIZE,
+                            (range.end - range.begin) * TRANSFER_BLOCK_SIZE);
+                            !r) {
+                        LOGE("%s: Failed to write new data: %s",
+                             target.c_str(), r.error().message().c_str());
+                        return r.as_failure();
+                    }
+                    new_blocks += range.end - range.begin;
+                }
+                continue;
+            }
+
+            // Ranges in a transfer list may be written more than once, so
+            // keep the writes in order
+            if (auto r = writer.flush(); !r) {
+                LOGE("%s: Failed to write new data: %s",
+                     target.c_str(), r.error().message().c_str());
+                return r.as_failure();
+            }
+
+            bool zero = cmd.type == TransferCommandType::Zero;
+
+            for (auto const &range : cmd.ranges) {
+                if (auto r = clear_range(
+                        fd, is_blkdev, range.begin * TRANSFER_BLOCK_SIZE,
+                        (range.end - range.begin) * TRANSFER_BLOCK_SIZE,
+                        zero); !r) {
+                    LOGE("%s: Failed to zero blocks %" PRIu64 "-%" PRIu64
+                         ": %s", target.c_str(), range.begin, range.end,
+                         r.error().message().c_str());
+                    return r.as_failure();
+                }
+                cleared_blocks += range.end - range.begin;
+            }
+        }
+
+        if (auto r = writer.flush(); !r) {
+            LOGE("%s: Failed to write new data: %s",
+                 target.c_str(), r.error().message().c_str());
+            return r.as_failure();
+        }
+    }
+
+    if (fsync(fd) < 0) {
+        auto ec = ec_from_errno();
+        LOGE("%s: Failed to sync: %s", target.c_str(), ec.message().c_str());
+        return ec;
+    }
+
+    LOGD("%s: Wrote %" PRIu64 " new blocks and cleared %" PRIu64 " blocks",
+         target.c_str(), new_blocks, cleared_blocks);
+
+    return oc::success();
+}
+
+}
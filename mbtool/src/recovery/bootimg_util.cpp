@@ -19,17 +19,22 @@
 
 #include "recovery/bootimg_util.h"
 
+#include <memory>
+
 #include <cerrno>
 #include <cstdio>
 #include <cstring>
 
 #include <unistd.h>
 
+#include "mbcommon/file.h"
+
 #include "mblog/logging.h"
 
 #define LOG_TAG "mbtool/recovery/bootimg_util"
 
-#define BUF_SIZE    10240
+// Large enough that entry stream decoders are not called for tiny chunks
+#define STREAM_BUF_SIZE (1024 * 1024)
 
 typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 
@@ -38,12 +43,12 @@ using namespace mb::bootimg;
 namespace mb
 {
 
-bool bi_copy_data_to_fd(Reader &reader, int fd)
+bool bi_copy_stream_to_fd(File &stream, int fd)
 {
-    char buf[BUF_SIZE];
+    auto buf = std::make_unique<char[]>(STREAM_BUF_SIZE);
 
     while (true) {
-        auto n_read = reader.read_data(buf, sizeof(buf));
+        auto n_read = stream.read(buf.get(), STREAM_BUF_SIZE);
         if (!n_read) {
             LOGE("Failed to read boot image entry data: %s",
                  n_read.error().message().c_str());
@@ -56,7 +61,7 @@ bool bi_copy_data_to_fd(Reader &reader, int fd)
 
         while (remain > 0) {
             ssize_t n_written = write(
-                    fd, buf + (n_read.value() - remain), remain);
+                    fd, buf.get() + (n_read.value() - remain), remain);
             if (n_written <= 0) {
                 LOGE("Failed to write data: %s", strerror(errno));
                 return false;
@@ -143,24 +148,30 @@ bool bi_copy_data_to_file(Reader &reader, const std::string &path)
 
 bool bi_copy_data_to_data(Reader &reader, Writer &writer)
 {
-    char buf[10240];
+    auto ret = writer.write_data_from(reader);
+    if (!ret) {
+        LOGE("Failed to copy boot image entry data: %s",
+             ret.error().message().c_str());
+        return false;
+    }
 
-    while (true) {
-        auto n_read = reader.read_data(buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read boot image entry data: %s",
-                 n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
+    return true;
+}
 
-        auto n_written = writer.write_data(buf, n_read.value());
-        if (!n_written) {
+bool bi_copy_string_to_data(std::string_view data, Writer &writer)
+{
+    while (!data.empty()) {
+        auto n = writer.write_data(data.data(), data.size());
+        if (!n) {
             LOGE("Failed to write entry data: %s",
-                 n_written.error().message().c_str());
+                 n.error().message().c_str());
+            return false;
+        } else if (n.value() == 0) {
+            LOGE("Failed to write entry data: Unexpected EOF");
             return false;
         }
+
+        data.remove_prefix(n.value());
     }
 
     return true;
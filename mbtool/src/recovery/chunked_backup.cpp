@@ -0,0 +1,1195 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/chunked_backup.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mbcommon/thread_pool.h"
+#include "mblog/logging.h"
+#include "mbutil/dir_walker.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/metadata.h"
+#include "mbutil/selinux.h"
+#include "mbutil/string.h"
+
+#define LOG_TAG "mbtool/recovery/chunked_backup"
+
+#define MANIFEST_MAGIC      "mbtool-chunked-backup"
+#define MANIFEST_VERSION    1
+
+#define KIND_TREE           "tree"
+#define KIND_IMAGE          "image"
+
+namespace mb
+{
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+/*
+ * Files are split into content-defined chunks so that an insertion or removal
+ * only changes the chunks around it. A chunk boundary is placed wherever the
+ * top 16 bits of a gear rolling hash are zero, giving chunks of ~80 KiB on
+ * average. Each chunk is stored once in the chunk store, named after its
+ * SHA-256 digest.
+ *
+ * Each backed up partition has a text manifest:
+ *
+ *     mbtool-chunked-backup 1
+ *     kind <tree|image>
+ *     store <chunk store directory>
+ *     <type> <path> <mode> <uid> <gid> <mtime sec> <mtime nsec> <size>
+ *         <inode> <rdev> <context> <extra>
+ *     ...
+ *
+ * The type is one of 'd' (directory), 'f' (regular file), 'l' (symlink) or
+ * 's' (device or fifo). Paths are relative to the partition root, with "."
+ * being the root itself. For regular files, extra is a comma-separated list
+ * of chunk IDs. For symlinks, it is the symlink target. Each entry is on a
+ * single line (wrapped above for readability). String fields are
+ * percent-encoded and empty strings are written as "-".
+ */
+
+static constexpr size_t CHUNK_MIN_SIZE = 16 * 1024;
+static constexpr size_t CHUNK_MAX_SIZE = 256 * 1024;
+static constexpr uint64_t CHUNK_BOUNDARY_MASK = 0xffffull << 48;
+
+static constexpr std::array<uint64_t, 256> make_gear_table()
+{
+    std::array<uint64_t, 256> table{};
+    // Fixed seed so that chunk boundaries are stable across versions
+    uint64_t state = 0;
+
+    for (auto &value : table) {
+        // splitmix64
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        value = z ^ (z >> 31);
+    }
+
+    return table;
+}
+
+static constexpr auto GEAR_TABLE = make_gear_table();
+
+/*!
+ * \brief Find the end of the first chunk in a buffer
+ *
+ * \return Size of the first chunk. This is \p size if no boundary was found.
+ */
+static size_t find_chunk_boundary(const unsigned char *data, size_t size)
+{
+    if (size <= CHUNK_MIN_SIZE) {
+        return size;
+    }
+
+    uint64_t hash = 0;
+
+    for (size_t i = CHUNK_MIN_SIZE; i < size; ++i) {
+        hash = (hash << 1) + GEAR_TABLE[data[i]];
+        if (!(hash & CHUNK_BOUNDARY_MASK)) {
+            return i + 1;
+        }
+    }
+
+    return size;
+}
+
+static bool is_valid_chunk_id(std::string_view id)
+{
+    return id.size() == SHA256_DIGEST_LENGTH * 2
+            && id.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+static std::string escape_field(std::string_view str)
+{
+    if (str.empty()) {
+        return "-";
+    } else if (str == "-") {
+        return "%2D";
+    }
+
+    std::string result;
+    result.reserve(str.size());
+
+    for (char c : str) {
+        auto uc = static_cast<unsigned char>(c);
+
+        if (uc <= 0x20 || uc == 0x7f || c == '%') {
+            char buf[4];
+            snprintf(buf, sizeof(buf), "%%%02X", uc);
+            result += buf;
+        } else {
+            result += c;
+        }
+    }
+
+    return result;
+}
+
+static bool unescape_field(std::string_view str, std::string &out)
+{
+    out.clear();
+
+    if (str == "-") {
+        return true;
+    }
+
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] != '%') {
+            out += str[i];
+            continue;
+        }
+
+        if (i + 2 >= str.size()) {
+            return false;
+        }
+
+        std::string hex(str.substr(i + 1, 2));
+        unsigned char value;
+        if (!str_to_num(hex.c_str(), 16, value)) {
+            return false;
+        }
+
+        out += static_cast<char>(value);
+        i += 2;
+    }
+
+    return true;
+}
+
+struct ManifestEntry
+{
+    // 'd', 'f', 'l' or 's'
+    char type;
+    // Path relative to the root ("." for the root itself)
+    std::string path;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t ino;
+    uint64_t rdev;
+    std::string context;
+    // Symlink target
+    std::string target;
+    // Chunks of a regular file's contents
+    std::vector<std::string> chunks;
+};
+
+struct Manifest
+{
+    ChunkedBackupKind kind;
+    std::string store_dir;
+    std::vector<ManifestEntry> entries;
+};
+
+static bool write_manifest_header(FILE *fp, const Manifest &manifest)
+{
+    return fprintf(fp, MANIFEST_MAGIC " %d\n", MANIFEST_VERSION) >= 0
+            && fprintf(fp, "kind %s\n",
+                       manifest.kind == ChunkedBackupKind::Image
+                       ? KIND_IMAGE : KIND_TREE) >= 0
+            && fprintf(fp, "store %s\n",
+                       escape_field(manifest.store_dir).c_str()) >= 0;
+}
+
+static bool write_manifest_entry(FILE *fp, const ManifestEntry &e)
+{
+    std::string extra;
+
+    if (e.type == 'l') {
+        extra = escape_field(e.target);
+    } else if (e.chunks.empty()) {
+        extra = "-";
+    } else {
+        extra = join(e.chunks, ",");
+    }
+
+    return fprintf(fp, "%c %s %o %u %u %" PRId64 " %" PRId64 " %" PRIu64
+                   " %" PRIu64 " %" PRIu64 " %s %s\n",
+                   e.type, escape_field(e.path).c_str(), e.mode, e.uid, e.gid,
+                   e.mtime_sec, e.mtime_nsec, e.size, e.ino, e.rdev,
+                   escape_field(e.context).c_str(), extra.c_str()) >= 0;
+}
+
+static bool parse_manifest_entry(std::string_view line, ManifestEntry &e)
+{
+    auto fields = split_sv(line, ' ');
+    if (fields.size() != 12 || fields[0].size() != 1) {
+        return false;
+    }
+
+    e.type = fields[0][0];
+    if (e.type != 'd' && e.type != 'f' && e.type != 'l' && e.type != 's') {
+        return false;
+    }
+
+    std::string num_fields[8];
+    for (size_t i = 0; i < 8; ++i) {
+        num_fields[i] = fields[i + 2];
+    }
+
+    if (!unescape_field(fields[1], e.path)
+            || !str_to_num(num_fields[0].c_str(), 8, e.mode)
+            || !str_to_num(num_fields[1].c_str(), 10, e.uid)
+            || !str_to_num(num_fields[2].c_str(), 10, e.gid)
+            || !str_to_num(num_fields[3].c_str(), 10, e.mtime_sec)
+            || !str_to_num(num_fields[4].c_str(), 10, e.mtime_nsec)
+            || !str_to_num(num_fields[5].c_str(), 10, e.size)
+            || !str_to_num(num_fields[6].c_str(), 10, e.ino)
+            || !str_to_num(num_fields[7].c_str(), 10, e.rdev)
+            || !unescape_field(fields[10], e.context)) {
+        return false;
+    }
+
+    // Don't allow escaping the restore target. Paths must be normalized so
+    // that symlinks restored earlier can be detected in chunked_restore().
+    if (e.path != ".") {
+        for (auto const &component : split_sv(e.path, '/')) {
+            if (component.empty() || component == "." || component == "..") {
+                return false;
+            }
+        }
+    }
+
+    e.target.clear();
+    e.chunks.clear();
+
+    if (e.type == 'l') {
+        return unescape_field(fields[11], e.target);
+    } else if (e.type == 'f' && fields[11] != "-") {
+        for (auto const &id : split_sv(fields[11], ',')) {
+            if (!is_valid_chunk_id(id)) {
+                return false;
+            }
+            e.chunks.emplace_back(id);
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Read a manifest
+ *
+ * \param path Manifest path
+ * \param manifest Output manifest
+ * \param header_only Only read the header
+ *
+ * \return Nothing on success or the error code on failure
+ */
+static oc::result<void> read_manifest(const std::string &path,
+                                      Manifest &manifest, bool header_only)
+{
+    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
+    if (!fp) {
+        return ec_from_errno();
+    }
+
+    char *buf = nullptr;
+    size_t buf_size = 0;
+    ssize_t n;
+    size_t line_num = 0;
+
+    auto free_buf = finally([&] {
+        free(buf);
+    });
+
+    manifest.entries.clear();
+
+    while ((n = getline(&buf, &buf_size, fp.get())) >= 0) {
+        std::string_view line(buf, static_cast<size_t>(n));
+        if (!line.empty() && line.back() == '\n') {
+            line.remove_suffix(1);
+        }
+
+        bool valid;
+
+        if (line_num == 0) {
+            valid = line == MANIFEST_MAGIC " 1";
+        } else if (line_num == 1) {
+            valid = true;
+            if (line == "kind " KIND_TREE) {
+                manifest.kind = ChunkedBackupKind::Tree;
+            } else if (line == "kind " KIND_IMAGE) {
+                manifest.kind = ChunkedBackupKind::Image;
+            } else {
+                valid = false;
+            }
+        } else if (line_num == 2) {
+            valid = starts_with(line, "store ")
+                    && unescape_field(line.substr(6), manifest.store_dir);
+        } else {
+            valid = parse_manifest_entry(line,
+                                         manifest.entries.emplace_back());
+        }
+
+        if (!valid) {
+            LOGE("%s:%zu: Invalid manifest line", path.c_str(), line_num + 1);
+            return std::errc::invalid_argument;
+        }
+
+        if (++line_num == 3 && header_only) {
+            return oc::success();
+        }
+    }
+
+    if (ferror(fp.get())) {
+        return ec_from_errno();
+    } else if (line_num < 3) {
+        LOGE("%s: Truncated manifest", path.c_str());
+        return std::errc::invalid_argument;
+    }
+
+    return oc::success();
+}
+
+class ChunkStore
+{
+public:
+    ChunkStore(std::string dir)
+        : m_dir(std::move(dir))
+        , m_new_chunks(0)
+        , m_new_bytes(0)
+    {
+    }
+
+    const std::string & dir() const
+    {
+        return m_dir;
+    }
+
+    uint64_t new_chunks() const
+    {
+        return m_new_chunks;
+    }
+
+    uint64_t new_bytes() const
+    {
+        return m_new_bytes;
+    }
+
+    bool has(const std::string &id)
+    {
+        if (m_known.find(id) != m_known.end()) {
+            return true;
+        }
+
+        struct stat sb;
+        if (stat(chunk_path(id).c_str(), &sb) == 0) {
+            m_known.insert(id);
+            return true;
+        }
+
+        return false;
+    }
+
+    /*!
+     * \brief Add a chunk to the store if it does not already exist
+     *
+     * \return Chunk ID or the error code on failure
+     */
+    oc::result<std::string> put(const unsigned char *data, size_t size)
+    {
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        SHA256(data, size, digest);
+
+        auto id = util::hex_string(digest, sizeof(digest));
+        if (has(id)) {
+            return id;
+        }
+
+        std::string dir(m_dir);
+        dir += '/';
+        dir += id.substr(0, 2);
+
+        if (auto r = util::mkdir_recursive(dir, 0700);
+                !r && r.error() != std::errc::file_exists) {
+            return r.as_failure();
+        }
+
+        // Concurrent backups may write the same chunk, so write to a unique
+        // temporary file first
+        std::string temp_path(dir);
+        temp_path += "/.tmp.XXXXXX";
+
+        int fd = mkostemp(temp_path.data(), O_CLOEXEC);
+        if (fd < 0) {
+            return ec_from_errno();
+        }
+
+        auto remove_temp = finally([&] {
+            unlink(temp_path.c_str());
+        });
+
+        auto r = write_fully(fd, data, size);
+        if (close(fd) < 0 && r) {
+            r = ec_from_errno();
+        }
+        OUTCOME_TRYV(r);
+
+        if (rename(temp_path.c_str(), chunk_path(id).c_str()) < 0) {
+            return ec_from_errno();
+        }
+
+        remove_temp.dismiss();
+
+        m_known.insert(id);
+        ++m_new_chunks;
+        m_new_bytes += size;
+
+        return id;
+    }
+
+    /*!
+     * \brief Read and verify a chunk
+     *
+     * \return Chunk data or the error code on failure
+     */
+    oc::result<std::string> get(const std::string &id) const
+    {
+        OUTCOME_TRY(data, util::file_read_all(chunk_path(id)));
+
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char *>(data.data()),
+               data.size(), digest);
+
+        if (util::hex_string(digest, sizeof(digest)) != id) {
+            return std::errc::bad_message;
+        }
+
+        return data;
+    }
+
+    static oc::result<void> write_fully(int fd, const void *data, size_t size)
+    {
+        auto ptr = static_cast<const char *>(data);
+
+        while (size > 0) {
+            auto n = write(fd, ptr, size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ec_from_errno();
+            }
+
+            ptr += n;
+            size -= static_cast<size_t>(n);
+        }
+
+        return oc::success();
+    }
+
+private:
+    std::string m_dir;
+    std::unordered_set<std::string> m_known;
+    uint64_t m_new_chunks;
+    uint64_t m_new_bytes;
+
+    std::string chunk_path(const std::string &id) const
+    {
+        std::string path(m_dir);
+        path += '/';
+        path += id.substr(0, 2);
+        path += '/';
+        path += id;
+        return path;
+    }
+};
+
+/*!
+ * \brief Split a file into chunks and add them to the store
+ */
+static oc::result<void> chunk_file(ChunkStore &store, int fd,
+                                   std::vector<std::string> &chunks)
+{
+    std::vector<unsigned char> buf(CHUNK_MAX_SIZE);
+    size_t filled = 0;
+    bool eof = false;
+
+    chunks.clear();
+
+    while (true) {
+        while (!eof && filled < buf.size()) {
+            auto n = read(fd, buf.data() + filled, buf.size() - filled);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ec_from_errno();
+            } else if (n == 0) {
+                eof = true;
+            } else {
+                filled += static_cast<size_t>(n);
+            }
+        }
+
+        if (filled == 0) {
+            break;
+        }
+
+        size_t size = find_chunk_boundary(buf.data(), filled);
+
+        OUTCOME_TRY(id, store.put(buf.data(), size));
+        chunks.push_back(std::move(id));
+
+        memmove(buf.data(), buf.data() + size, filled - size);
+        filled -= size;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Fill in a manifest entry for a path
+ *
+ * Regular files whose inode, size and mtime match the previous manifest reuse
+ * the previous chunk list without being read again.
+ */
+static oc::result<void> create_entry(
+        ChunkStore &store,
+        const std::unordered_map<std::string, ManifestEntry> &prev_entries,
+        const std::string &path, const struct stat &sb, char type,
+        ManifestEntry &e, bool &reused)
+{
+    e.type = type;
+    e.mode = sb.st_mode;
+    e.uid = sb.st_uid;
+    e.gid = sb.st_gid;
+    e.mtime_sec = sb.st_mtim.tv_sec;
+    e.mtime_nsec = sb.st_mtim.tv_nsec;
+    e.size = type == 'f' ? static_cast<uint64_t>(sb.st_size) : 0;
+    e.ino = sb.st_ino;
+    e.rdev = type == 's' ? sb.st_rdev : 0;
+    e.target.clear();
+    e.chunks.clear();
+    reused = false;
+
+    if (auto context = util::selinux_lget_context(path)) {
+        e.context = std::move(context.value());
+    } else if (context.error() == std::errc::no_such_file_or_directory) {
+        return context.as_failure();
+    } else {
+        // Not all filesystems support labels
+        e.context.clear();
+    }
+
+    if (type == 'l') {
+        std::vector<char> buf(static_cast<size_t>(sb.st_size) + 1);
+
+        auto n = readlink(path.c_str(), buf.data(), buf.size());
+        if (n < 0) {
+            return ec_from_errno();
+        }
+
+        e.target.assign(buf.data(), std::min(static_cast<size_t>(n),
+                                             buf.size()));
+    } else if (type == 'f') {
+        if (auto it = prev_entries.find(e.path); it != prev_entries.end()
+                && it->second.type == 'f' && it->second.ino == e.ino
+                && it->second.size == e.size
+                && it->second.mtime_sec == e.mtime_sec
+                && it->second.mtime_nsec == e.mtime_nsec
+                && std::all_of(it->second.chunks.begin(),
+                               it->second.chunks.end(),
+                               [&](const std::string &id) {
+                                   return store.has(id);
+                               })) {
+            e.chunks = it->second.chunks;
+            reused = true;
+            return oc::success();
+        }
+
+        int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            return ec_from_errno();
+        }
+
+        auto close_fd = finally([&] {
+            close(fd);
+        });
+
+        OUTCOME_TRYV(chunk_file(store, fd, e.chunks));
+    }
+
+    return oc::success();
+}
+
+class ManifestWalker : public util::DirWalker
+{
+public:
+    ManifestWalker(std::string path, const std::vector<std::string> &exclusions,
+                   ChunkStore &store,
+                   const std::unordered_map<std::string, ManifestEntry> &prev,
+                   FILE *fp)
+        : DirWalker(std::move(path), {})
+        , _exclusions(exclusions)
+        , _store(store)
+        , _prev(prev)
+        , _fp(fp)
+        , _files(0)
+        , _reused(0)
+    {
+    }
+
+    uint64_t files() const
+    {
+        return _files;
+    }
+
+    uint64_t reused() const
+    {
+        return _reused;
+    }
+
+    Actions on_changed_path() override
+    {
+        if (_curr->fts_level == 1 && std::find(
+                _exclusions.begin(), _exclusions.end(), _curr->fts_name)
+                != _exclusions.end()) {
+            return Action::Skip;
+        }
+        return Action::Ok;
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        return add_entry('d');
+    }
+
+    Actions on_reached_file() override
+    {
+        return add_entry('f');
+    }
+
+    Actions on_reached_symlink() override
+    {
+        return add_entry('l');
+    }
+
+    Actions on_reached_block_device() override
+    {
+        return add_entry('s');
+    }
+
+    Actions on_reached_character_device() override
+    {
+        return add_entry('s');
+    }
+
+    Actions on_reached_fifo() override
+    {
+        return add_entry('s');
+    }
+
+    Actions on_reached_socket() override
+    {
+        LOGW("%s: Skipping socket", _curr->fts_path);
+        return Action::Ok;
+    }
+
+private:
+    const std::vector<std::string> &_exclusions;
+    ChunkStore &_store;
+    const std::unordered_map<std::string, ManifestEntry> &_prev;
+    FILE *_fp;
+    ManifestEntry _entry;
+    uint64_t _files;
+    uint64_t _reused;
+
+    Actions add_entry(char type)
+    {
+        if (_curr->fts_level == 0) {
+            _entry.path = ".";
+        } else {
+            _entry.path = _curr->fts_path + _path.size() + 1;
+        }
+
+        bool reused;
+
+        if (auto r = create_entry(_store, _prev, _curr->fts_accpath,
+                                  *_curr->fts_statp, type, _entry, reused);
+                !r) {
+            _error_msg = format("%s: Failed to back up: %s", _curr->fts_path,
+                                r.error().message().c_str());
+            LOGE("%s", _error_msg.c_str());
+            return Action::Fail;
+        }
+
+        if (!write_manifest_entry(_fp, _entry)) {
+            _error_msg = format("Failed to write manifest: %s",
+                                strerror(errno));
+            LOGE("%s", _error_msg.c_str());
+            return Action::Fail;
+        }
+
+        if (type == 'f') {
+            ++_files;
+            _reused += reused;
+        }
+
+        return Action::Ok;
+    }
+};
+
+/*!
+ * \brief Create a deduplicated backup
+ *
+ * \param manifest_path Path to write the manifest to
+ * \param path Directory or image to back up
+ * \param kind Whether \p path is a directory tree or a single image
+ * \param exclusions List of top-level directories to exclude (only used for
+ *                   directory trees)
+ * \param store_dir Chunk store directory
+ * \param prev_manifest_path Manifest of a previous backup of the same path.
+ *                           Files that have not changed since then are not
+ *                           read again. Can be empty.
+ *
+ * \return Whether the backup was successfully created
+ */
+bool chunked_backup(const std::string &manifest_path,
+                    const std::string &path,
+                    ChunkedBackupKind kind,
+                    const std::vector<std::string> &exclusions,
+                    const std::string &store_dir,
+                    const std::string &prev_manifest_path)
+{
+    ChunkStore store(store_dir);
+
+    if (auto r = util::mkdir_recursive(store_dir, 0700);
+            !r && r.error() != std::errc::file_exists) {
+        LOGE("%s: Failed to create directory: %s",
+             store_dir.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    std::unordered_map<std::string, ManifestEntry> prev_entries;
+
+    if (!prev_manifest_path.empty()) {
+        Manifest prev;
+
+        if (auto r = read_manifest(prev_manifest_path, prev, false); !r) {
+            LOGW("%s: Failed to read previous manifest: %s",
+                 prev_manifest_path.c_str(), r.error().message().c_str());
+        } else if (prev.kind != kind) {
+            LOGW("%s: Previous manifest is for a different kind of backup",
+                 prev_manifest_path.c_str());
+        } else {
+            for (auto &e : prev.entries) {
+                auto entry_path = e.path;
+                prev_entries.emplace(std::move(entry_path), std::move(e));
+            }
+        }
+    }
+
+    std::string temp_path(manifest_path);
+    temp_path += ".tmp";
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        unlink(temp_path.c_str());
+    });
+
+    Manifest manifest;
+    manifest.kind = kind;
+    manifest.store_dir = store_dir;
+
+    if (!write_manifest_header(fp.get(), manifest)) {
+        LOGE("%s: Failed to write manifest: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    uint64_t files;
+    uint64_t reused;
+
+    if (kind == ChunkedBackupKind::Image) {
+        struct stat sb;
+        if (stat(path.c_str(), &sb) < 0) {
+            LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        ManifestEntry e;
+        e.path = ".";
+        bool entry_reused;
+
+        if (auto r = create_entry(store, prev_entries, path, sb, 'f', e,
+                                  entry_reused); !r) {
+            LOGE("%s: Failed to back up: %s",
+                 path.c_str(), r.error().message().c_str());
+            return false;
+        } else if (!write_manifest_entry(fp.get(), e)) {
+            LOGE("%s: Failed to write manifest: %s",
+                 temp_path.c_str(), strerror(errno));
+            return false;
+        }
+
+        files = 1;
+        reused = entry_reused;
+    } else {
+        ManifestWalker walker(path, exclusions, store, prev_entries, fp.get());
+        if (!walker.run()) {
+            return false;
+        }
+
+        files = walker.files();
+        reused = walker.reused();
+    }
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), manifest_path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             manifest_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    remove_temp.dismiss();
+
+    LOGI("%s: %" PRIu64 " files (%" PRIu64 " unchanged), %" PRIu64
+         " new chunks (%" PRIu64 " bytes)", path.c_str(), files, reused,
+         store.new_chunks(), store.new_bytes());
+
+    return true;
+}
+
+/*!
+ * \brief Get the kind of a deduplicated backup
+ *
+ * \param manifest_path Manifest path
+ *
+ * \return Backup kind or the error code on failure
+ */
+oc::result<ChunkedBackupKind>
+chunked_backup_kind(const std::string &manifest_path)
+{
+    Manifest manifest;
+    OUTCOME_TRYV(read_manifest(manifest_path, manifest, true));
+    return manifest.kind;
+}
+
+/*!
+ * \brief Verify the chunks referenced by a deduplicated backup
+ *
+ * Each chunk is read on the shared thread pool and checked against its SHA-256
+ * name. Every damaged or missing chunk is logged.
+ *
+ * \param manifest_path Manifest path
+ * \param store_dir Chunk store directory. If empty, the chunk store that was
+ *                  used when creating the backup is used.
+ *
+ * \return Whether every chunk is intact
+ */
+bool chunked_verify(const std::string &manifest_path,
+                    const std::string &store_dir)
+{
+    Manifest manifest;
+
+    if (auto r = read_manifest(manifest_path, manifest, false); !r) {
+        LOGE("%s: Failed to read manifest: %s",
+             manifest_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    const ChunkStore store(store_dir.empty() ? manifest.store_dir : store_dir);
+
+    // Otherwise, every chunk would be reported as missing
+    if (access(store.dir().c_str(), R_OK | X_OK) < 0) {
+        LOGE("%s: Failed to access chunk store: %s",
+             store.dir().c_str(), strerror(errno));
+        return false;
+    }
+
+    std::unordered_set<std::string> ids;
+    for (auto const &e : manifest.entries) {
+        ids.insert(e.chunks.begin(), e.chunks.end());
+    }
+
+    std::atomic_size_t failed{0};
+
+    {
+        TaskGroup group;
+
+        for (auto const &id : ids) {
+            group.run([&]() -> oc::result<void> {
+                if (auto r = store.get(id); !r) {
+                    LOGE("%s: Chunk %s is damaged: %s",
+                         manifest_path.c_str(), id.c_str(),
+                         r.error().message().c_str());
+                    ++failed;
+                }
+
+                // Keep going so that every damaged chunk is reported
+                return oc::success();
+            });
+        }
+
+        if (auto r = group.wait(); !r) {
+            LOGE("%s: Failed to verify chunks: %s",
+                 manifest_path.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    if (failed > 0) {
+        LOGE("%s: %zu of %zu chunks are damaged",
+             manifest_path.c_str(), failed.load(), ids.size());
+        return false;
+    }
+
+    LOGI("%s: Verified %zu chunks", manifest_path.c_str(), ids.size());
+    return true;
+}
+
+static oc::result<void> restore_file(ChunkStore &store, const ManifestEntry &e,
+                                     const std::string &path)
+{
+    int fd = open(path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    // Leave holes for all-zero chunks so that restored images stay sparse
+    for (auto const &id : e.chunks) {
+        OUTCOME_TRY(data, store.get(id));
+
+        if (std::all_of(data.begin(), data.end(),
+                        [](char c) { return c == '\0'; })) {
+            if (lseek(fd, static_cast<off_t>(data.size()), SEEK_CUR) < 0) {
+                return ec_from_errno();
+            }
+        } else {
+            OUTCOME_TRYV(ChunkStore::write_fully(
+                    fd, data.data(), data.size()));
+        }
+    }
+
+    // Extend the file if it ends with a hole
+    if (ftruncate(fd, static_cast<off_t>(e.size)) < 0) {
+        return ec_from_errno();
+    }
+
+    if (close(fd) < 0) {
+        fd = -1;
+        return ec_from_errno();
+    }
+
+    close_fd.dismiss();
+
+    return oc::success();
+}
+
+static oc::result<void> restore_metadata(const ManifestEntry &e,
+                                         const std::string &path)
+{
+    util::Metadata metadata;
+    metadata.uid = e.uid;
+    metadata.gid = e.gid;
+    metadata.mode = e.mode & 07777;
+    if (!e.context.empty()) {
+        metadata.context = e.context;
+    }
+
+    OUTCOME_TRYV(util::apply_metadata(path, metadata, {}));
+
+    timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = static_cast<time_t>(e.mtime_sec);
+    times[1].tv_nsec = static_cast<long>(e.mtime_nsec);
+
+    if (utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Check if any parent of \p path is a symlink that was restored
+ *
+ * Restoring an entry beneath a symlink would write wherever the symlink
+ * points to, possibly outside of the restore target.
+ */
+static bool has_symlink_parent(const std::unordered_set<std::string> &symlinks,
+                               const std::string &path)
+{
+    for (auto pos = path.find('/'); pos != std::string::npos;
+            pos = path.find('/', pos + 1)) {
+        if (symlinks.find(path.substr(0, pos)) != symlinks.end()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ * \brief Restore a deduplicated backup
+ *
+ * For directory trees, the contents are restored into \p path, which must
+ * exist and should be empty. For images, the image file at \p path is
+ * replaced.
+ *
+ * \param manifest_path Manifest path
+ * \param path Target directory or image
+ * \param store_dir Chunk store directory. If empty, the chunk store that was
+ *                  used when creating the backup is used.
+ *
+ * \return Whether the backup was successfully restored
+ */
+bool chunked_restore(const std::string &manifest_path,
+                     const std::string &path,
+                     const std::string &store_dir)
+{
+    Manifest manifest;
+
+    if (auto r = read_manifest(manifest_path, manifest, false); !r) {
+        LOGE("%s: Failed to read manifest: %s",
+             manifest_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    ChunkStore store(store_dir.empty() ? manifest.store_dir : store_dir);
+
+    // Directory metadata is applied last so that restoring the contents
+    // doesn't change the mtimes or fail due to permissions
+    std::vector<std::pair<const ManifestEntry *, std::string>> dirs;
+    // Symlinks restored so far (relative to the target)
+    std::unordered_set<std::string> symlinks;
+
+    for (auto const &e : manifest.entries) {
+        if (symlinks.find(e.path) != symlinks.end()
+                || has_symlink_parent(symlinks, e.path)) {
+            LOGE("%s: Entry is beneath or replaces a restored symlink: %s",
+                 manifest_path.c_str(), e.path.c_str());
+            return false;
+        }
+
+        std::string target(path);
+        if (e.path != ".") {
+            target += '/';
+            target += e.path;
+        } else if (manifest.kind == ChunkedBackupKind::Tree && e.type != 'd') {
+            LOGE("%s: Root entry must be a directory", manifest_path.c_str());
+            return false;
+        }
+
+        oc::result<void> r = oc::success();
+
+        switch (e.type) {
+        case 'd':
+            if (e.path == ".") {
+                r = util::mkdir_recursive(target, 0700);
+                if (!r && r.error() == std::errc::file_exists) {
+                    r = oc::success();
+                }
+            } else if (mkdir(target.c_str(), 0700) < 0 && errno != EEXIST) {
+                r = ec_from_errno();
+            }
+
+            if (r) {
+                dirs.emplace_back(&e, target);
+                continue;
+            }
+            break;
+        case 'f':
+            r = restore_file(store, e, target);
+            break;
+        case 'l':
+            if (symlink(e.target.c_str(), target.c_str()) < 0) {
+                r = ec_from_errno();
+            } else {
+                symlinks.insert(e.path);
+            }
+            break;
+        case 's':
+            if (mknod(target.c_str(), e.mode, static_cast<dev_t>(e.rdev)) < 0) {
+                r = ec_from_errno();
+            }
+            break;
+        }
+
+        if (r) {
+            r = restore_metadata(e, target);
+        }
+
+        if (!r) {
+            LOGE("%s: Failed to restore: %s",
+                 target.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+        if (auto r = restore_metadata(*it->first, it->second); !r) {
+            LOGE("%s: Failed to restore metadata: %s",
+                 it->second.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,734 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/cpio_archive.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <sys/stat.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+#include "mbutil/compress.h"
+#include "mbutil/file.h"
+
+#define LOG_TAG "mbtool/recovery/cpio_archive"
+
+typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
+
+namespace mb
+{
+
+/*!
+ * \brief Normalize a path in the archive
+ *
+ * Leading `/` and `./` components and trailing `/` characters are removed so
+ * that paths can be compared directly.
+ */
+static std::string_view normalize_path(std::string_view path)
+{
+    while (true) {
+        if (!path.empty() && path.front() == '/') {
+            path.remove_prefix(1);
+        } else if (path.size() >= 2 && path[0] == '.' && path[1] == '/') {
+            path.remove_prefix(2);
+        } else {
+            break;
+        }
+    }
+
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+
+    return path;
+}
+
+/*!
+ * \brief Read callback state for CpioArchive::load_stream()
+ *
+ * The read function runs on a separate thread and passes chunks to the
+ * decompressor through a bounded queue.
+ */
+class ChunkReader
+{
+public:
+    // Maximum number of chunks waiting to be decompressed
+    static constexpr size_t MAX_QUEUED_CHUNKS = 16;
+
+    explicit ChunkReader(const CpioArchive::ReadFn &read_fn)
+        : m_read_fn(read_fn)
+        , m_eof(false)
+        , m_failed(false)
+        , m_stop(false)
+        , m_thread(&ChunkReader::worker, this)
+    {
+    }
+
+    ~ChunkReader()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+
+        m_thread.join();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ChunkReader)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ChunkReader)
+
+    static la_ssize_t la_read_cb(archive *a, void *userdata,
+                                 const void **buffer)
+    {
+        auto *ctx = static_cast<ChunkReader *>(userdata);
+
+        std::unique_lock lock(ctx->m_mutex);
+
+        ctx->m_cv.wait(lock, [&] {
+            return !ctx->m_chunks.empty() || ctx->m_eof || ctx->m_failed;
+        });
+
+        if (!ctx->m_chunks.empty()) {
+            ctx->m_current = std::move(ctx->m_chunks.front());
+            ctx->m_chunks.pop_front();
+            lock.unlock();
+            ctx->m_cv.notify_all();
+
+            *buffer = ctx->m_current.data();
+            return static_cast<la_ssize_t>(ctx->m_current.size());
+        } else if (ctx->m_failed) {
+            archive_set_error(a, EIO, "Failed to read data");
+            return -1;
+        } else {
+            return 0;
+        }
+    }
+
+private:
+    const CpioArchive::ReadFn &m_read_fn;
+
+    std::mutex m_mutex;
+    // Signalled when a chunk is queued or dequeued or the state changes
+    std::condition_variable m_cv;
+    std::deque<std::string> m_chunks;
+    bool m_eof;
+    bool m_failed;
+    bool m_stop;
+
+    // Chunk currently being decompressed
+    std::string m_current;
+
+    std::thread m_thread;
+
+    void worker()
+    {
+        while (true) {
+            std::string chunk;
+            bool ret = m_read_fn(chunk);
+
+            std::unique_lock lock(m_mutex);
+
+            if (!ret) {
+                m_failed = true;
+            } else if (chunk.empty()) {
+                m_eof = true;
+            } else {
+                m_cv.wait(lock, [&] {
+                    return m_stop || m_chunks.size() < MAX_QUEUED_CHUNKS;
+                });
+
+                if (!m_stop) {
+                    m_chunks.push_back(std::move(chunk));
+                }
+            }
+
+            bool done = m_stop || m_eof || m_failed;
+            lock.unlock();
+            m_cv.notify_all();
+
+            if (done) {
+                break;
+            }
+        }
+    }
+};
+
+CpioArchive::CpioArchive()
+    : _format(ARCHIVE_FORMAT_CPIO_SVR4_NOCRC)
+{
+}
+
+CpioArchive::~CpioArchive() = default;
+
+/*!
+ * \brief Load a (possibly compressed) cpio archive from a file
+ */
+bool CpioArchive::load_file(const std::string &path)
+{
+    auto data = util::file_read_all(path);
+    if (!data) {
+        LOGE("%s: Failed to read file: %s",
+             path.c_str(), data.error().message().c_str());
+        return false;
+    }
+
+    return load_data(data.value());
+}
+
+/*!
+ * \brief Load a (possibly compressed) cpio archive from memory
+ */
+bool CpioArchive::load_data(std::string_view data)
+{
+    return load_stream([&](std::string &chunk) {
+        chunk = data;
+        data = {};
+        return true;
+    });
+}
+
+/*!
+ * \brief Load a (possibly compressed) cpio archive from a stream
+ *
+ * \p read_fn is called on a separate thread, so reading the input overlaps
+ * with decompressing and parsing the archive. It should store the next chunk
+ * of data in its parameter and return true, store an empty chunk at EOF, or
+ * return false if an error occurs.
+ *
+ * The archive's format and compression filters are remembered so that
+ * save_stream() writes the archive back in the same format.
+ */
+bool CpioArchive::load_stream(const ReadFn &read_fn)
+{
+    ScopedArchive in(archive_read_new(), archive_read_free);
+    if (!in) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    archive_read_support_filter_gzip(in.get());
+    archive_read_support_filter_lz4(in.get());
+    archive_read_support_filter_lzma(in.get());
+    archive_read_support_filter_xz(in.get());
+    archive_read_support_format_cpio(in.get());
+
+    ChunkReader reader(read_fn);
+
+    if (archive_read_open(in.get(), &reader, nullptr, &ChunkReader::la_read_cb,
+                          nullptr) != ARCHIVE_OK) {
+        LOGE("Failed to open cpio archive: %s",
+             archive_error_string(in.get()));
+        return false;
+    }
+
+    std::vector<Entry> entries;
+
+    while (true) {
+        archive_entry *entry;
+
+        int ret = archive_read_next_header(in.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("Failed to read header: %s", archive_error_string(in.get()));
+            return false;
+        }
+
+        const char *pathname = archive_entry_pathname(entry);
+        if (!pathname || !*pathname) {
+            LOGE("Header has null or empty filename");
+            return false;
+        }
+
+        Entry &e = entries.emplace_back(Entry{
+            { archive_entry_clone(entry), archive_entry_free },
+            std::string(normalize_path(pathname)),
+            {},
+        });
+        if (!e.header) {
+            LOGE("Failed to allocate archive entry");
+            return false;
+        }
+
+        if (e.path != pathname) {
+            archive_entry_set_pathname(e.header.get(), e.path.c_str());
+        }
+
+        char buf[10240];
+        la_ssize_t n;
+
+        while ((n = archive_read_data(in.get(), buf, sizeof(buf))) > 0) {
+            e.data.append(buf, static_cast<size_t>(n));
+        }
+
+        if (n < 0) {
+            LOGE("%s: Failed to read entry data: %s",
+                 e.path.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+    }
+
+    std::vector<int> filters;
+    for (int i = 0; i < archive_filter_count(in.get()); ++i) {
+        int code = archive_filter_code(in.get(), i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            filters.push_back(code);
+        }
+    }
+
+    _format = archive_format(in.get());
+
+    if (archive_read_close(in.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close cpio archive: %s",
+             archive_error_string(in.get()));
+        return false;
+    }
+
+    _entries.swap(entries);
+    _filters.swap(filters);
+
+    return true;
+}
+
+/*!
+ * \brief Set the compression filters used by save_stream()
+ *
+ * \param filters libarchive filter codes (eg. `ARCHIVE_FILTER_GZIP`). This is
+ *                needed if the archive was loaded from data that was
+ *                decompressed elsewhere.
+ */
+void CpioArchive::set_filters(std::vector<int> filters)
+{
+    _filters = std::move(filters);
+}
+
+/*!
+ * \brief Write the archive to a file
+ */
+bool CpioArchive::save_file(const std::string &path) const
+{
+    std::string data;
+
+    if (!save_data(data)) {
+        return false;
+    }
+
+    if (auto r = util::file_write_string(path, data); !r) {
+        LOGE("%s: Failed to write file: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the archive to memory
+ */
+bool CpioArchive::save_data(std::string &data) const
+{
+    data.clear();
+
+    return save_stream([&](std::string_view chunk) {
+        data += chunk;
+        return true;
+    });
+}
+
+/*!
+ * \brief Write the archive to a stream
+ *
+ * The archive is written in the format and with the compression filters of
+ * the archive that was loaded. Gzip and lz4, which are by far the most common
+ * for ramdisks, are compressed in parallel blocks by util::ParallelCompressor.
+ * Other filters are handled by libarchive and xz is allowed to use multiple
+ * threads.
+ *
+ * lz4 ramdisks are always written in the legacy format because that is the
+ * only one the kernel can decompress. libarchive can only write lz4 frames.
+ *
+ * \p write_fn is called with each chunk of output data in order and should
+ * return false if the data could not be written.
+ */
+bool CpioArchive::save_stream(const WriteFn &write_fn) const
+{
+    std::optional<util::ParallelFormat> parallel_format;
+
+    if (_filters.size() == 1 && _filters[0] == ARCHIVE_FILTER_GZIP) {
+        parallel_format = util::ParallelFormat::Gzip;
+    } else if (_filters.size() == 1 && _filters[0] == ARCHIVE_FILTER_LZ4) {
+        parallel_format = util::ParallelFormat::Lz4Legacy;
+    }
+
+    ScopedArchive out(archive_write_new(), archive_write_free);
+    if (!out) {
+        LOGE("Failed to allocate archive writer instance");
+        return false;
+    }
+
+    if (archive_write_set_format(out.get(), _format) != ARCHIVE_OK) {
+        LOGE("Failed to set output archive format: %s",
+             archive_error_string(out.get()));
+        return false;
+    }
+
+    if (!parallel_format) {
+        for (int filter : _filters) {
+            if (archive_write_add_filter(out.get(), filter) != ARCHIVE_OK) {
+                LOGE("Failed to add output archive filter: %s",
+                     archive_error_string(out.get()));
+                return false;
+            }
+
+            if (filter == ARCHIVE_FILTER_XZ) {
+                auto threads = std::to_string(
+                        std::max(std::thread::hardware_concurrency(), 1u));
+
+                if (archive_write_set_filter_option(
+                        out.get(), "xz", "threads", threads.c_str())
+                        != ARCHIVE_OK) {
+                    LOGW("Multithreaded compression not supported: %s",
+                         archive_error_string(out.get()));
+                }
+            }
+        }
+    }
+
+    archive_write_set_bytes_per_block(out.get(), 512);
+
+    std::optional<util::ParallelCompressor> compressor;
+    WriteFn raw_write_fn;
+
+    if (parallel_format) {
+        compressor.emplace(*parallel_format, write_fn);
+        raw_write_fn = [&](std::string_view chunk) {
+            return compressor->write(chunk.data(), chunk.size());
+        };
+    } else {
+        raw_write_fn = write_fn;
+    }
+
+    auto write_cb = [](archive *a, void *userdata, const void *buf,
+                       size_t size) -> la_ssize_t {
+        auto *fn = static_cast<WriteFn *>(userdata);
+
+        if (!(*fn)({static_cast<const char *>(buf), size})) {
+            archive_set_error(a, EIO, "Failed to write data");
+            return -1;
+        }
+
+        return static_cast<la_ssize_t>(size);
+    };
+
+    if (archive_write_open(out.get(), &raw_write_fn, nullptr, write_cb,
+                           nullptr) != ARCHIVE_OK) {
+        LOGE("Failed to open archive for writing: %s",
+             archive_error_string(out.get()));
+        return false;
+    }
+
+    for (auto const &e : _entries) {
+        if (archive_write_header(out.get(), e.header.get()) != ARCHIVE_OK) {
+            LOGE("%s: Failed to write header: %s",
+                 e.path.c_str(), archive_error_string(out.get()));
+            return false;
+        }
+
+        if (!e.data.empty() && archive_write_data(
+                out.get(), e.data.data(), e.data.size())
+                != static_cast<la_ssize_t>(e.data.size())) {
+            LOGE("%s: Failed to write entry data: %s",
+                 e.path.c_str(), archive_error_string(out.get()));
+            return false;
+        }
+    }
+
+    if (archive_write_close(out.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close archive: %s", archive_error_string(out.get()));
+        return false;
+    }
+
+    if (compressor && !compressor->finish()) {
+        LOGE("Failed to write compressed stream");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check if an entry exists
+ */
+bool CpioArchive::exists(std::string_view path) const
+{
+    return find(path) != nullptr;
+}
+
+/*!
+ * \brief Get permissions of an entry
+ *
+ * \return Permission bits or nullopt if the entry does not exist
+ */
+std::optional<mode_t> CpioArchive::perms(std::string_view path) const
+{
+    if (auto const *e = find(path)) {
+        return archive_entry_perm(e->header.get());
+    }
+    return std::nullopt;
+}
+
+/*!
+ * \brief Get contents of a regular file
+ *
+ * \return File contents or nullopt if the entry does not exist or is not a
+ *         regular file
+ */
+std::optional<std::string> CpioArchive::contents(std::string_view path) const
+{
+    if (auto const *e = find(path);
+            e && archive_entry_filetype(e->header.get()) == AE_IFREG) {
+        return e->data;
+    }
+    return std::nullopt;
+}
+
+/*!
+ * \brief Get target of a symlink
+ *
+ * \return Symlink target or nullopt if the entry does not exist or is not a
+ *         symlink
+ */
+std::optional<std::string>
+CpioArchive::symlink_target(std::string_view path) const
+{
+    if (auto const *e = find(path);
+            e && archive_entry_filetype(e->header.get()) == AE_IFLNK) {
+        const char *target = archive_entry_symlink(e->header.get());
+        return std::string(target ? target : "");
+    }
+    return std::nullopt;
+}
+
+/*!
+ * \brief Add or replace a regular file
+ *
+ * If \p path is an existing regular file, only its contents (and permissions,
+ * if \p perms is specified) are changed. Otherwise, any existing entry is
+ * removed and a new file is added to the end of the archive with \p perms or
+ * 0644 permissions. Like on a real filesystem, the parent directory must
+ * exist.
+ */
+bool CpioArchive::set_contents(std::string_view path, std::string data,
+                               std::optional<mode_t> perms)
+{
+    Entry *e = find(path);
+
+    if (e && archive_entry_filetype(e->header.get()) != AE_IFREG) {
+        remove(path);
+        e = nullptr;
+    }
+
+    if (!e) {
+        if (!check_parent(path)) {
+            return false;
+        }
+
+        e = &add_entry(std::string(normalize_path(path)), AE_IFREG,
+                       perms.value_or(0644));
+    } else {
+        if (perms) {
+            archive_entry_set_perm(e->header.get(), *perms);
+        }
+
+        // The entry no longer shares its data with any other link
+        archive_entry_set_nlink(e->header.get(), 1);
+        archive_entry_set_hardlink(e->header.get(), nullptr);
+    }
+
+    e->data = std::move(data);
+    archive_entry_set_size(e->header.get(),
+                           static_cast<la_int64_t>(e->data.size()));
+
+    return true;
+}
+
+/*!
+ * \brief Add a symlink to the end of the archive
+ *
+ * The entry must not already exist and the parent directory must exist.
+ */
+bool CpioArchive::add_symlink(std::string_view path, std::string_view target)
+{
+    if (find(path)) {
+        LOGE("%.*s: Entry already exists",
+             static_cast<int>(path.size()), path.data());
+        return false;
+    } else if (!check_parent(path)) {
+        return false;
+    }
+
+    Entry &e = add_entry(std::string(normalize_path(path)), AE_IFLNK, 0777);
+    archive_entry_set_symlink(e.header.get(), std::string(target).c_str());
+
+    return true;
+}
+
+/*!
+ * \brief Rename an entry
+ *
+ * Like rename(2), an existing entry at \p new_path is replaced. The renamed
+ * entry keeps its position in the archive.
+ */
+bool CpioArchive::rename(std::string_view old_path, std::string_view new_path)
+{
+    if (!find(old_path)) {
+        LOGE("%.*s: Entry does not exist",
+             static_cast<int>(old_path.size()), old_path.data());
+        return false;
+    } else if (!check_parent(new_path)) {
+        return false;
+    }
+
+    if (normalize_path(old_path) == normalize_path(new_path)) {
+        return true;
+    }
+
+    remove(new_path);
+
+    Entry *e = find(old_path);
+    e->path = normalize_path(new_path);
+    archive_entry_set_pathname(e->header.get(), e->path.c_str());
+
+    return true;
+}
+
+/*!
+ * \brief Remove an entry
+ *
+ * \return Whether the entry existed
+ */
+bool CpioArchive::remove(std::string_view path)
+{
+    auto it = std::find_if(_entries.begin(), _entries.end(),
+                           [&](const Entry &e) {
+        return e.path == normalize_path(path);
+    });
+
+    if (it == _entries.end()) {
+        return false;
+    }
+
+    _entries.erase(it);
+    return true;
+}
+
+CpioArchive::Entry *CpioArchive::find(std::string_view path)
+{
+    return const_cast<Entry *>(std::as_const(*this).find(path));
+}
+
+const CpioArchive::Entry *CpioArchive::find(std::string_view path) const
+{
+    path = normalize_path(path);
+
+    for (auto const &e : _entries) {
+        if (e.path == path) {
+            return &e;
+        }
+    }
+
+    return nullptr;
+}
+
+/*!
+ * \brief Check that the parent directory of an entry exists
+ */
+bool CpioArchive::check_parent(std::string_view path) const
+{
+    path = normalize_path(path);
+
+    auto pos = path.rfind('/');
+    if (pos == std::string_view::npos) {
+        return true;
+    }
+
+    auto parent = path.substr(0, pos);
+
+    if (auto const *e = find(parent);
+            !e || archive_entry_filetype(e->header.get()) != AE_IFDIR) {
+        LOGE("%.*s: Parent directory does not exist",
+             static_cast<int>(path.size()), path.data());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Append a new entry owned by root to the end of the archive
+ */
+CpioArchive::Entry &CpioArchive::add_entry(std::string path, mode_t type,
+                                           mode_t perms)
+{
+    // Give the entry an unused inode number so that it is not mistaken for a
+    // hard link
+    la_int64_t ino = 0;
+    for (auto const &e : _entries) {
+        ino = std::max(ino, archive_entry_ino64(e.header.get()));
+    }
+
+    Entry &e = _entries.emplace_back(Entry{
+        { archive_entry_new(), archive_entry_free },
+        std::move(path),
+        {},
+    });
+
+    archive_entry *header = e.header.get();
+    archive_entry_set_pathname(header, e.path.c_str());
+    archive_entry_set_filetype(header, type);
+    archive_entry_set_perm(header, perms);
+    archive_entry_set_uid(header, 0);
+    archive_entry_set_gid(header, 0);
+    archive_entry_set_nlink(header, 1);
+    archive_entry_set_ino64(header, ino + 1);
+    archive_entry_set_mtime(header, time(nullptr), 0);
+    archive_entry_set_size(header, 0);
+
+    return e;
+}
+
+}
@@ -0,0 +1,640 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/ext4_format.h"
+
+#include <algorithm>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+#include <cinttypes>
+#include <cstring>
+#include <ctime>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/recovery/ext4_format"
+
+// Superblock offsets (see fs/ext4/ext4.h in the kernel)
+#define EXT4_SUPERBLOCK_OFFSET          1024
+#define EXT4_SUPERBLOCK_SIZE            1024
+
+#define EXT4_SB_INODES_COUNT            0x00
+#define EXT4_SB_BLOCKS_COUNT_LO         0x04
+#define EXT4_SB_FREE_BLOCKS_COUNT_LO    0x0c
+#define EXT4_SB_FREE_INODES_COUNT       0x10
+#define EXT4_SB_FIRST_DATA_BLOCK        0x14
+#define EXT4_SB_LOG_BLOCK_SIZE          0x18
+#define EXT4_SB_LOG_CLUSTER_SIZE        0x1c
+#define EXT4_SB_BLOCKS_PER_GROUP        0x20
+#define EXT4_SB_CLUSTERS_PER_GROUP      0x24
+#define EXT4_SB_INODES_PER_GROUP        0x28
+#define EXT4_SB_WTIME                   0x30
+#define EXT4_SB_MAX_MNT_COUNT           0x36
+#define EXT4_SB_MAGIC                   0x38
+#define EXT4_SB_STATE                   0x3a
+#define EXT4_SB_ERRORS                  0x3c
+#define EXT4_SB_LASTCHECK               0x40
+#define EXT4_SB_REV_LEVEL               0x4c
+#define EXT4_SB_FIRST_INO               0x54
+#define EXT4_SB_INODE_SIZE              0x58
+#define EXT4_SB_BLOCK_GROUP_NR          0x5a
+#define EXT4_SB_FEATURE_COMPAT          0x5c
+#define EXT4_SB_FEATURE_INCOMPAT        0x60
+#define EXT4_SB_FEATURE_RO_COMPAT       0x64
+#define EXT4_SB_UUID                    0x68
+#define EXT4_SB_JOURNAL_INUM            0xe0
+#define EXT4_SB_HASH_SEED               0xec
+#define EXT4_SB_DEF_HASH_VERSION        0xfc
+#define EXT4_SB_JNL_BACKUP_TYPE         0xfd
+#define EXT4_SB_MKFS_TIME               0x108
+#define EXT4_SB_JNL_BLOCKS              0x10c
+#define EXT4_SB_MIN_EXTRA_ISIZE         0x15c
+#define EXT4_SB_WANT_EXTRA_ISIZE        0x15e
+#define EXT4_SB_FLAGS                   0x160
+
+#define EXT4_SUPER_MAGIC                0xef53
+#define EXT4_VALID_FS                   0x0001
+#define EXT4_ERRORS_CONTINUE            1
+#define EXT4_DYNAMIC_REV                1
+#define EXT4_GOOD_OLD_FIRST_INO         11
+#define EXT4_HASH_HALF_MD4              1
+#define EXT4_JNL_BACKUP_BLOCKS          1
+#define EXT4_FLAGS_SIGNED_HASH          0x0001
+#define EXT4_FLAGS_UNSIGNED_HASH        0x0002
+
+#define EXT4_FEATURE_COMPAT_HAS_JOURNAL     0x0004
+#define EXT4_FEATURE_COMPAT_EXT_ATTR        0x0008
+#define EXT4_FEATURE_COMPAT_DIR_INDEX       0x0020
+#define EXT4_FEATURE_INCOMPAT_FILETYPE      0x0002
+#define EXT4_FEATURE_INCOMPAT_EXTENTS       0x0040
+#define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+#define EXT4_FEATURE_RO_COMPAT_LARGE_FILE   0x0002
+#define EXT4_FEATURE_RO_COMPAT_HUGE_FILE    0x0008
+#define EXT4_FEATURE_RO_COMPAT_GDT_CSUM     0x0010
+#define EXT4_FEATURE_RO_COMPAT_DIR_NLINK    0x0020
+#define EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE  0x0040
+
+// Group descriptor offsets and flags
+#define EXT4_BG_BLOCK_BITMAP_LO         0x00
+#define EXT4_BG_INODE_BITMAP_LO         0x04
+#define EXT4_BG_INODE_TABLE_LO          0x08
+#define EXT4_BG_FREE_BLOCKS_COUNT_LO    0x0c
+#define EXT4_BG_FREE_INODES_COUNT_LO    0x0e
+#define EXT4_BG_USED_DIRS_COUNT_LO      0x10
+#define EXT4_BG_FLAGS                   0x12
+#define EXT4_BG_ITABLE_UNUSED_LO        0x1c
+#define EXT4_BG_CHECKSUM                0x1e
+
+#define EXT4_BG_INODE_UNINIT            0x0001
+#define EXT4_BG_INODE_ZEROED            0x0004
+
+#define EXT4_DESC_SIZE                  32
+
+// Inode offsets and flags
+#define EXT4_INODE_MODE                 0x00
+#define EXT4_INODE_SIZE_LO              0x04
+#define EXT4_INODE_ATIME                0x08
+#define EXT4_INODE_CTIME                0x0c
+#define EXT4_INODE_MTIME                0x10
+#define EXT4_INODE_LINKS_COUNT          0x1a
+#define EXT4_INODE_BLOCKS_LO            0x1c
+#define EXT4_INODE_FLAGS                0x20
+#define EXT4_INODE_BLOCK                0x28
+#define EXT4_INODE_EXTRA_ISIZE          0x80
+#define EXT4_INODE_CRTIME               0x90
+
+#define EXT4_INODE_BLOCK_SIZE           60
+#define EXT4_EXTENTS_FL                 0x00080000
+
+#define EXT4_ROOT_INO                   2
+#define EXT4_JOURNAL_INO                8
+#define EXT4_LOST_FOUND_INO             11
+
+#define EXT4_FT_DIR                     2
+
+// Extent tree header
+#define EXT4_EXT_MAGIC                  0xf30a
+#define EXT4_EXT_MAX_LEN                32768
+
+// Journal superblock (big endian, see include/linux/jbd2.h in the kernel)
+#define JBD2_MAGIC_NUMBER               0xc03b3998
+#define JBD2_SUPERBLOCK_V2              4
+
+#define JBD2_SB_MAGIC                   0x00
+#define JBD2_SB_BLOCKTYPE               0x04
+#define JBD2_SB_BLOCKSIZE               0x0c
+#define JBD2_SB_MAXLEN                  0x10
+#define JBD2_SB_FIRST                   0x14
+#define JBD2_SB_SEQUENCE                0x18
+#define JBD2_SB_UUID                    0x30
+#define JBD2_SB_NR_USERS                0x40
+
+// Layout parameters. These match the defaults mke2fs uses for a filesystem of
+// the "default" usage type.
+constexpr uint32_t BLOCK_SIZE = 4096;
+constexpr uint32_t LOG_BLOCK_SIZE = 2;
+constexpr uint32_t BLOCKS_PER_GROUP = BLOCK_SIZE * 8;
+constexpr uint32_t INODE_SIZE = 256;
+constexpr uint32_t INODES_PER_BLOCK = BLOCK_SIZE / INODE_SIZE;
+constexpr uint64_t INODE_RATIO = 16384;
+constexpr uint16_t EXTRA_ISIZE = 32;
+// Groups with less than this many blocks of data are dropped
+constexpr uint32_t MIN_GROUP_DATA_BLOCKS = 50;
+
+namespace mb
+{
+
+struct Ext4Layout
+{
+    uint32_t blocks_count;
+    uint32_t groups;
+    uint32_t gdt_blocks;
+    uint32_t inodes_per_group;
+    uint32_t itable_blocks;
+    uint32_t journal_blocks;
+};
+
+static void write_le16(unsigned char *data, uint16_t value)
+{
+    value = mb_htole16(value);
+    memcpy(data, &value, sizeof(value));
+}
+
+static void write_le32(unsigned char *data, uint32_t value)
+{
+    value = mb_htole32(value);
+    memcpy(data, &value, sizeof(value));
+}
+
+static void write_be32(unsigned char *data, uint32_t value)
+{
+    value = mb_htobe32(value);
+    memcpy(data, &value, sizeof(value));
+}
+
+//! CRC16 (polynomial 0x8005, reflected) as used by ext4 group descriptors
+static uint16_t crc16(uint16_t crc, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? static_cast<uint16_t>((crc >> 1) ^ 0xa001)
+                    : static_cast<uint16_t>(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+static bool is_power_of(uint32_t n, uint32_t base)
+{
+    while (n > 1 && n % base == 0) {
+        n /= base;
+    }
+    return n == 1;
+}
+
+//! Whether a group contains a superblock backup with `sparse_super`
+static bool group_has_super(uint32_t group)
+{
+    return group <= 1 || is_power_of(group, 3) || is_power_of(group, 5)
+            || is_power_of(group, 7);
+}
+
+//! Number of blocks in a group
+static uint32_t group_blocks(const Ext4Layout &layout, uint32_t group)
+{
+    if (group == layout.groups - 1) {
+        return layout.blocks_count - group * BLOCKS_PER_GROUP;
+    }
+    return BLOCKS_PER_GROUP;
+}
+
+//! Offset of the block bitmap from the beginning of a group
+static uint32_t group_bitmap_offset(const Ext4Layout &layout, uint32_t group)
+{
+    return group_has_super(group) ? 1 + layout.gdt_blocks : 0;
+}
+
+//! Number of metadata blocks at the beginning of a group
+static uint32_t group_overhead(const Ext4Layout &layout, uint32_t group)
+{
+    return group_bitmap_offset(layout, group) + 2 + layout.itable_blocks;
+}
+
+//! Journal size used by mke2fs, limited to what fits in the first group
+static uint32_t default_journal_blocks(uint32_t blocks_count)
+{
+    if (blocks_count < 2048) {
+        return 0;
+    } else if (blocks_count < 32768) {
+        return 1024;
+    } else if (blocks_count < 256 * 1024) {
+        return 4096;
+    } else if (blocks_count < 512 * 1024) {
+        return 8192;
+    } else {
+        return 16384;
+    }
+}
+
+/*!
+ * \brief Compute the layout of a filesystem
+ *
+ * A trailing group that is too small to hold its own metadata is not part of
+ * the filesystem, as with mke2fs.
+ */
+static oc::result<Ext4Layout> compute_layout(uint64_t size)
+{
+    uint64_t blocks = size / BLOCK_SIZE;
+
+    // Filesystems larger than 16 TiB require the 64bit feature
+    if (blocks > UINT32_MAX) {
+        return std::errc::file_too_large;
+    }
+
+    Ext4Layout layout{};
+    layout.blocks_count = static_cast<uint32_t>(blocks);
+
+    while (true) {
+        if (layout.blocks_count == 0) {
+            return std::errc::invalid_argument;
+        }
+
+        layout.groups = (layout.blocks_count + BLOCKS_PER_GROUP - 1)
+                / BLOCKS_PER_GROUP;
+        layout.gdt_blocks = (layout.groups * EXT4_DESC_SIZE + BLOCK_SIZE - 1)
+                / BLOCK_SIZE;
+
+        uint64_t inodes = static_cast<uint64_t>(layout.blocks_count)
+                * BLOCK_SIZE / INODE_RATIO;
+        uint64_t per_group = (inodes + layout.groups - 1) / layout.groups;
+        per_group = (per_group + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK
+                * INODES_PER_BLOCK;
+        layout.inodes_per_group = static_cast<uint32_t>(std::clamp<uint64_t>(
+                per_group, INODES_PER_BLOCK, BLOCK_SIZE * 8));
+        layout.itable_blocks = layout.inodes_per_group / INODES_PER_BLOCK;
+
+        uint32_t last = layout.groups - 1;
+        if (last > 0 && group_blocks(layout, last)
+                < group_overhead(layout, last) + MIN_GROUP_DATA_BLOCKS) {
+            layout.blocks_count = last * BLOCKS_PER_GROUP;
+            continue;
+        }
+
+        break;
+    }
+
+    layout.journal_blocks = default_journal_blocks(layout.blocks_count);
+
+    // The root directory, lost+found, and journal are in the first group
+    if (group_overhead(layout, 0) + 2 + layout.journal_blocks
+            > group_blocks(layout, 0)) {
+        return std::errc::invalid_argument;
+    }
+
+    return layout;
+}
+
+/*!
+ * \brief Fill in the i_block field of an inode with a single extent
+ */
+static void write_extent(unsigned char *i_block, uint32_t start, uint16_t len)
+{
+    write_le16(i_block + 0, EXT4_EXT_MAGIC);
+    write_le16(i_block + 2, 1); // eh_entries
+    write_le16(i_block + 4, 4); // eh_max
+    write_le16(i_block + 6, 0); // eh_depth
+    write_le32(i_block + 12, 0); // ee_block
+    write_le16(i_block + 16, len); // ee_len
+    write_le16(i_block + 18, 0); // ee_start_hi
+    write_le32(i_block + 20, start); // ee_start_lo
+}
+
+static void write_inode(unsigned char *inode, uint16_t mode, uint16_t links,
+                        uint32_t start, uint32_t blocks, uint32_t now)
+{
+    write_le16(inode + EXT4_INODE_MODE, mode);
+    write_le32(inode + EXT4_INODE_SIZE_LO, blocks * BLOCK_SIZE);
+    write_le32(inode + EXT4_INODE_ATIME, now);
+    write_le32(inode + EXT4_INODE_CTIME, now);
+    write_le32(inode + EXT4_INODE_MTIME, now);
+    write_le16(inode + EXT4_INODE_LINKS_COUNT, links);
+    write_le32(inode + EXT4_INODE_BLOCKS_LO, blocks * (BLOCK_SIZE / 512));
+    write_le32(inode + EXT4_INODE_FLAGS, EXT4_EXTENTS_FL);
+    write_extent(inode + EXT4_INODE_BLOCK, start,
+                 static_cast<uint16_t>(blocks));
+    write_le16(inode + EXT4_INODE_EXTRA_ISIZE, EXTRA_ISIZE);
+    write_le32(inode + EXT4_INODE_CRTIME, now);
+}
+
+//! Append a directory entry and return the pointer to the next one
+static unsigned char * write_dirent(unsigned char *p, uint32_t inode,
+                                    uint16_t rec_len, const char *name)
+{
+    auto name_len = strlen(name);
+
+    write_le32(p, inode);
+    write_le16(p + 4, rec_len);
+    p[6] = static_cast<unsigned char>(name_len);
+    p[7] = EXT4_FT_DIR;
+    memcpy(p + 8, name, name_len);
+
+    return p + rec_len;
+}
+
+static void set_bits(unsigned char *bitmap, uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; ++i) {
+        bitmap[i / 8] |= static_cast<unsigned char>(1u << (i % 8));
+    }
+}
+
+static oc::result<void> write_block(File &file, uint64_t block,
+                                    const unsigned char *data)
+{
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(block * BLOCK_SIZE),
+                           SEEK_SET));
+    OUTCOME_TRYV(file_write_exact(file, data, BLOCK_SIZE));
+    return oc::success();
+}
+
+/*!
+ * \brief Write a new ext4 filesystem
+ *
+ * Only the superblocks, group descriptors, bitmaps, and the blocks used by
+ * the root directory, lost+found, and the journal superblock are written.
+ * Everything is written in increasing offset order, so \p file does not need
+ * to support backward seeks (eg. a sparse::SparseWriter). The inode tables and
+ * the journal are initialized lazily: unused inodes are tracked with
+ * `uninit_bg` and the journal is clean, so neither is read before it has been
+ * written.
+ *
+ * The filesystem uses 4 KiB blocks and the features that ext4 has supported
+ * since Linux 2.6.28 (no `flex_bg`, `metadata_csum`, or `64bit`), so it can be
+ * mounted by every kernel that mbtool runs on.
+ *
+ * \param file File to write to. The file position does not matter.
+ * \param size Size of the filesystem. This is rounded down to a multiple of
+ *             the block size.
+ * \param zeroed Whether the unwritten blocks of \p file are known to read as
+ *               zeros (eg. a newly truncated file). If true, the inode tables
+ *               are marked as zeroed so the kernel does not zero them in the
+ *               background after the first mount.
+ *
+ * \return Nothing on success or the error code on failure. The file is left
+ *         in an unspecified state on failure.
+ */
+oc::result<void> ext4_format(File &file, uint64_t size, bool zeroed)
+{
+    OUTCOME_TRY(layout, compute_layout(size));
+
+    auto now = static_cast<uint32_t>(time(nullptr));
+    uint32_t inodes_count = layout.inodes_per_group * layout.groups;
+
+    unsigned char uuid[16];
+    unsigned char hash_seed[16];
+    {
+        std::random_device rd;
+        std::uniform_int_distribution<unsigned int> dist(0, 255);
+        for (auto &b : uuid) {
+            b = static_cast<unsigned char>(dist(rd));
+        }
+        for (auto &b : hash_seed) {
+            b = static_cast<unsigned char>(dist(rd));
+        }
+        // Random (version 4) UUID
+        uuid[6] = static_cast<unsigned char>((uuid[6] & 0x0f) | 0x40);
+        uuid[8] = static_cast<unsigned char>((uuid[8] & 0x3f) | 0x80);
+    }
+
+    // Blocks in the first group after the inode table
+    uint32_t root_block = group_overhead(layout, 0);
+    uint32_t lost_found_block = root_block + 1;
+    uint32_t journal_block = lost_found_block + 1;
+
+    // Group descriptors and free block counts
+    std::vector<unsigned char> gdt(
+            static_cast<size_t>(layout.gdt_blocks) * BLOCK_SIZE);
+    uint32_t free_blocks = 0;
+
+    for (uint32_t group = 0; group < layout.groups; ++group) {
+        unsigned char *desc = gdt.data() + group * EXT4_DESC_SIZE;
+        uint32_t first = group * BLOCKS_PER_GROUP;
+        uint32_t bitmap = first + group_bitmap_offset(layout, group);
+        uint32_t used = group_overhead(layout, group);
+        uint32_t free_inodes = layout.inodes_per_group;
+        uint16_t dirs = 0;
+        uint16_t flags = zeroed ? EXT4_BG_INODE_ZEROED : 0;
+
+        if (group == 0) {
+            used += 2 + layout.journal_blocks;
+            free_inodes -= EXT4_GOOD_OLD_FIRST_INO;
+            dirs = 2;
+        } else {
+            flags |= EXT4_BG_INODE_UNINIT;
+        }
+
+        uint32_t group_free = group_blocks(layout, group) - used;
+        free_blocks += group_free;
+
+        write_le32(desc + EXT4_BG_BLOCK_BITMAP_LO, bitmap);
+        write_le32(desc + EXT4_BG_INODE_BITMAP_LO, bitmap + 1);
+        write_le32(desc + EXT4_BG_INODE_TABLE_LO, bitmap + 2);
+        write_le16(desc + EXT4_BG_FREE_BLOCKS_COUNT_LO,
+                   static_cast<uint16_t>(group_free));
+        write_le16(desc + EXT4_BG_FREE_INODES_COUNT_LO,
+                   static_cast<uint16_t>(free_inodes));
+        write_le16(desc + EXT4_BG_USED_DIRS_COUNT_LO, dirs);
+        write_le16(desc + EXT4_BG_FLAGS, flags);
+        write_le16(desc + EXT4_BG_ITABLE_UNUSED_LO,
+                   static_cast<uint16_t>(free_inodes));
+
+        unsigned char group_le[4];
+        write_le32(group_le, group);
+
+        uint16_t crc = crc16(0xffff, uuid, sizeof(uuid));
+        crc = crc16(crc, group_le, sizeof(group_le));
+        crc = crc16(crc, desc, EXT4_BG_CHECKSUM);
+        write_le16(desc + EXT4_BG_CHECKSUM, crc);
+    }
+
+    // Inode table block containing the reserved inodes
+    std::vector<unsigned char> itable(BLOCK_SIZE);
+    write_inode(itable.data() + (EXT4_ROOT_INO - 1) * INODE_SIZE,
+                0040755, 3, root_block, 1, now);
+    write_inode(itable.data() + (EXT4_LOST_FOUND_INO - 1) * INODE_SIZE,
+                0040700, 2, lost_found_block, 1, now);
+    if (layout.journal_blocks > 0) {
+        static_assert(EXT4_EXT_MAX_LEN >= 16384, "Journal needs one extent");
+        write_inode(itable.data() + (EXT4_JOURNAL_INO - 1) * INODE_SIZE,
+                    0100600, 1, journal_block, layout.journal_blocks, now);
+    }
+
+    // Superblock (without the group number)
+    unsigned char sb[EXT4_SUPERBLOCK_SIZE] = {};
+    {
+        uint32_t compat = EXT4_FEATURE_COMPAT_EXT_ATTR
+                | EXT4_FEATURE_COMPAT_DIR_INDEX;
+        if (layout.journal_blocks > 0) {
+            compat |= EXT4_FEATURE_COMPAT_HAS_JOURNAL;
+        }
+
+        write_le32(sb + EXT4_SB_INODES_COUNT, inodes_count);
+        write_le32(sb + EXT4_SB_BLOCKS_COUNT_LO, layout.blocks_count);
+        write_le32(sb + EXT4_SB_FREE_BLOCKS_COUNT_LO, free_blocks);
+        write_le32(sb + EXT4_SB_FREE_INODES_COUNT,
+                   inodes_count - EXT4_GOOD_OLD_FIRST_INO);
+        write_le32(sb + EXT4_SB_FIRST_DATA_BLOCK, 0);
+        write_le32(sb + EXT4_SB_LOG_BLOCK_SIZE, LOG_BLOCK_SIZE);
+        write_le32(sb + EXT4_SB_LOG_CLUSTER_SIZE, LOG_BLOCK_SIZE);
+        write_le32(sb + EXT4_SB_BLOCKS_PER_GROUP, BLOCKS_PER_GROUP);
+        write_le32(sb + EXT4_SB_CLUSTERS_PER_GROUP, BLOCKS_PER_GROUP);
+        write_le32(sb + EXT4_SB_INODES_PER_GROUP, layout.inodes_per_group);
+        write_le32(sb + EXT4_SB_WTIME, now);
+        write_le16(sb + EXT4_SB_MAX_MNT_COUNT, 0xffff);
+        write_le16(sb + EXT4_SB_MAGIC, EXT4_SUPER_MAGIC);
+        write_le16(sb + EXT4_SB_STATE, EXT4_VALID_FS);
+        write_le16(sb + EXT4_SB_ERRORS, EXT4_ERRORS_CONTINUE);
+        write_le32(sb + EXT4_SB_LASTCHECK, now);
+        write_le32(sb + EXT4_SB_REV_LEVEL, EXT4_DYNAMIC_REV);
+        write_le32(sb + EXT4_SB_FIRST_INO, EXT4_GOOD_OLD_FIRST_INO);
+        write_le16(sb + EXT4_SB_INODE_SIZE, INODE_SIZE);
+        write_le32(sb + EXT4_SB_FEATURE_COMPAT, compat);
+        write_le32(sb + EXT4_SB_FEATURE_INCOMPAT,
+                   EXT4_FEATURE_INCOMPAT_FILETYPE
+                   | EXT4_FEATURE_INCOMPAT_EXTENTS);
+        write_le32(sb + EXT4_SB_FEATURE_RO_COMPAT,
+                   EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER
+                   | EXT4_FEATURE_RO_COMPAT_LARGE_FILE
+                   | EXT4_FEATURE_RO_COMPAT_HUGE_FILE
+                   | EXT4_FEATURE_RO_COMPAT_GDT_CSUM
+                   | EXT4_FEATURE_RO_COMPAT_DIR_NLINK
+                   | EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE);
+        memcpy(sb + EXT4_SB_UUID, uuid, sizeof(uuid));
+        memcpy(sb + EXT4_SB_HASH_SEED, hash_seed, sizeof(hash_seed));
+        sb[EXT4_SB_DEF_HASH_VERSION] = EXT4_HASH_HALF_MD4;
+        write_le32(sb + EXT4_SB_MKFS_TIME, now);
+        write_le16(sb + EXT4_SB_MIN_EXTRA_ISIZE, EXTRA_ISIZE);
+        write_le16(sb + EXT4_SB_WANT_EXTRA_ISIZE, EXTRA_ISIZE);
+        // Same as what mke2fs picks for the platform's char type
+        write_le32(sb + EXT4_SB_FLAGS, std::is_signed_v<char>
+                   ? EXT4_FLAGS_SIGNED_HASH : EXT4_FLAGS_UNSIGNED_HASH);
+
+        if (layout.journal_blocks > 0) {
+            const unsigned char *inode = itable.data()
+                    + (EXT4_JOURNAL_INO - 1) * INODE_SIZE;
+
+            write_le32(sb + EXT4_SB_JOURNAL_INUM, EXT4_JOURNAL_INO);
+            sb[EXT4_SB_JNL_BACKUP_TYPE] = EXT4_JNL_BACKUP_BLOCKS;
+            // Copy of i_block, i_size_high, and i_size
+            memcpy(sb + EXT4_SB_JNL_BLOCKS, inode + EXT4_INODE_BLOCK,
+                   EXT4_INODE_BLOCK_SIZE);
+            write_le32(sb + EXT4_SB_JNL_BLOCKS + 16 * 4,
+                       layout.journal_blocks * BLOCK_SIZE);
+        }
+    }
+
+    std::vector<unsigned char> block(BLOCK_SIZE);
+
+    for (uint32_t group = 0; group < layout.groups; ++group) {
+        uint32_t first = group * BLOCKS_PER_GROUP;
+        uint32_t bitmap = first + group_bitmap_offset(layout, group);
+
+        if (group_has_super(group)) {
+            std::fill(block.begin(), block.end(), 0);
+            memcpy(block.data() + (group == 0 ? EXT4_SUPERBLOCK_OFFSET : 0),
+                   sb, sizeof(sb));
+            write_le16(block.data() + (group == 0 ? EXT4_SUPERBLOCK_OFFSET : 0)
+                       + EXT4_SB_BLOCK_GROUP_NR, static_cast<uint16_t>(group));
+            OUTCOME_TRYV(write_block(file, first, block.data()));
+
+            for (uint32_t i = 0; i < layout.gdt_blocks; ++i) {
+                OUTCOME_TRYV(write_block(file, first + 1 + i,
+                                         gdt.data() + i * BLOCK_SIZE));
+            }
+        }
+
+        // Block bitmap. Blocks past the end of the last group are marked as
+        // in use.
+        std::fill(block.begin(), block.end(), 0);
+        set_bits(block.data(), 0, group_overhead(layout, group));
+        if (group == 0) {
+            set_bits(block.data(), root_block,
+                     journal_block + layout.journal_blocks);
+        }
+        set_bits(block.data(), group_blocks(layout, group), BLOCKS_PER_GROUP);
+        OUTCOME_TRYV(write_block(file, bitmap, block.data()));
+
+        // The inode bitmaps of the other groups are not initialized
+        if (group == 0) {
+            std::fill(block.begin(), block.end(), 0);
+            set_bits(block.data(), 0, EXT4_GOOD_OLD_FIRST_INO);
+            set_bits(block.data(), layout.inodes_per_group, BLOCK_SIZE * 8);
+            OUTCOME_TRYV(write_block(file, bitmap + 1, block.data()));
+
+            OUTCOME_TRYV(write_block(file, bitmap + 2, itable.data()));
+
+            // Root directory
+            std::fill(block.begin(), block.end(), 0);
+            auto *p = write_dirent(block.data(), EXT4_ROOT_INO, 12, ".");
+            p = write_dirent(p, EXT4_ROOT_INO, 12, "..");
+            write_dirent(p, EXT4_LOST_FOUND_INO, BLOCK_SIZE - 24,
+                         "lost+found");
+            OUTCOME_TRYV(write_block(file, root_block, block.data()));
+
+            // lost+found
+            std::fill(block.begin(), block.end(), 0);
+            p = write_dirent(block.data(), EXT4_LOST_FOUND_INO, 12, ".");
+            write_dirent(p, EXT4_ROOT_INO, BLOCK_SIZE - 12, "..");
+            OUTCOME_TRYV(write_block(file, lost_found_block, block.data()));
+
+            // Journal superblock for an empty journal. The remaining journal
+            // blocks are not read until they have been written.
+            if (layout.journal_blocks > 0) {
+                std::fill(block.begin(), block.end(), 0);
+                write_be32(block.data() + JBD2_SB_MAGIC, JBD2_MAGIC_NUMBER);
+                write_be32(block.data() + JBD2_SB_BLOCKTYPE,
+                           JBD2_SUPERBLOCK_V2);
+                write_be32(block.data() + JBD2_SB_BLOCKSIZE, BLOCK_SIZE);
+                write_be32(block.data() + JBD2_SB_MAXLEN,
+                           layout.journal_blocks);
+                write_be32(block.data() + JBD2_SB_FIRST, 1);
+                write_be32(block.data() + JBD2_SB_SEQUENCE, 1);
+                memcpy(block.data() + JBD2_SB_UUID, uuid, sizeof(uuid));
+                write_be32(block.data() + JBD2_SB_NR_USERS, 1);
+                OUTCOME_TRYV(write_block(file, journal_block, block.data()));
+            }
+        }
+    }
+
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(size), SEEK_SET));
+
+    LOGD("Wrote ext4 filesystem: %" PRIu32 " blocks, %" PRIu32 " groups,"
+         " %" PRIu32 " inodes, %" PRIu32 " journal blocks",
+         layout.blocks_count, layout.groups, inodes_count,
+         layout.journal_blocks);
+
+    return oc::success();
+}
+
+}
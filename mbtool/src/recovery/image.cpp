@@ -19,15 +19,28 @@
 
 #include "recovery/image.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <cerrno>
 #include <cinttypes>
 #include <cstring>
 
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include "mbcommon/endian.h"
+#include "mbcommon/error_code.h"
+#include "mbcommon/file/fd.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_flash.h"
+#include "mbsparse/sparse_writer.h"
 #include "mblog/logging.h"
 #include "mbutil/command.h"
 #include "mbutil/directory.h"
@@ -35,11 +48,270 @@
 #include "mbutil/path.h"
 #include "mbutil/string.h"
 
+#include "recovery/ext4_format.h"
+
 #define LOG_TAG "mbtool/recovery/image"
 
+// Superblock offsets and flags (see fs/ext4/ext4.h in the kernel)
+#define EXT4_SUPERBLOCK_OFFSET          1024
+#define EXT4_SUPERBLOCK_SIZE            1024
+
+#define EXT4_SB_BLOCKS_COUNT_LO         0x04
+#define EXT4_SB_FIRST_DATA_BLOCK        0x14
+#define EXT4_SB_LOG_BLOCK_SIZE          0x18
+#define EXT4_SB_BLOCKS_PER_GROUP        0x20
+#define EXT4_SB_MAGIC                   0x38
+#define EXT4_SB_STATE                   0x3a
+#define EXT4_SB_FEATURE_INCOMPAT        0x60
+#define EXT4_SB_DESC_SIZE               0xfe
+#define EXT4_SB_BLOCKS_COUNT_HI         0x150
+#define EXT4_SB_ERROR_COUNT             0x194
+
+#define EXT4_SUPER_MAGIC                0xef53
+
+#define EXT4_VALID_FS                   0x0001
+#define EXT4_ERROR_FS                   0x0002
+
+#define EXT4_FEATURE_INCOMPAT_RECOVER   0x0004
+#define EXT4_FEATURE_INCOMPAT_META_BG   0x0010
+#define EXT4_FEATURE_INCOMPAT_64BIT     0x0080
+
+// Group descriptor offsets and flags
+#define EXT4_BG_BLOCK_BITMAP_LO         0x00
+#define EXT4_BG_FLAGS                   0x12
+#define EXT4_BG_BLOCK_BITMAP_HI         0x20
+
+#define EXT4_BG_BLOCK_UNINIT            0x0002
+
+#define EXT4_MIN_DESC_SIZE              32
+#define EXT4_MIN_DESC_SIZE_64BIT        64
+
+// Amount of data copied per read/write between the image and sparse file
+constexpr size_t BLOCK_COPY_BUFFER_SIZE = 1024 * 1024;
+
 namespace mb
 {
 
+struct Ext4Geometry
+{
+    uint32_t block_size;
+    uint64_t blocks_count;
+    uint32_t first_data_block;
+    uint32_t blocks_per_group;
+    uint32_t desc_size;
+    bool is_64bit;
+    bool uses_meta_bg;
+    bool clean;
+};
+
+static uint16_t read_le16(const unsigned char *data)
+{
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return mb_le16toh(value);
+}
+
+static uint32_t read_le32(const unsigned char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return mb_le32toh(value);
+}
+
+/*!
+ * \brief Read the geometry of an ext4 image from its superblock
+ *
+ * \return Geometry or the error code if the superblock could not be read or
+ *         is not a valid ext2/3/4 superblock
+ */
+static oc::result<Ext4Geometry> read_ext4_geometry(File &file)
+{
+    unsigned char sb[EXT4_SUPERBLOCK_SIZE];
+
+    OUTCOME_TRYV(file.seek(EXT4_SUPERBLOCK_OFFSET, SEEK_SET));
+    OUTCOME_TRYV(file_read_exact(file, sb, sizeof(sb)));
+
+    if (read_le16(sb + EXT4_SB_MAGIC) != EXT4_SUPER_MAGIC) {
+        return std::errc::invalid_argument;
+    }
+
+    uint32_t log_block_size = read_le32(sb + EXT4_SB_LOG_BLOCK_SIZE);
+    uint32_t incompat = read_le32(sb + EXT4_SB_FEATURE_INCOMPAT);
+    uint16_t state = read_le16(sb + EXT4_SB_STATE);
+
+    Ext4Geometry geo;
+
+    // Block sizes range from 1 KiB to 64 KiB
+    if (log_block_size > 6) {
+        return std::errc::invalid_argument;
+    }
+
+    geo.block_size = 1024u << log_block_size;
+    geo.is_64bit = incompat & EXT4_FEATURE_INCOMPAT_64BIT;
+    geo.uses_meta_bg = incompat & EXT4_FEATURE_INCOMPAT_META_BG;
+    geo.blocks_count = read_le32(sb + EXT4_SB_BLOCKS_COUNT_LO);
+    if (geo.is_64bit) {
+        geo.blocks_count |= static_cast<uint64_t>(
+                read_le32(sb + EXT4_SB_BLOCKS_COUNT_HI)) << 32;
+    }
+    geo.first_data_block = read_le32(sb + EXT4_SB_FIRST_DATA_BLOCK);
+    geo.blocks_per_group = read_le32(sb + EXT4_SB_BLOCKS_PER_GROUP);
+    geo.desc_size = geo.is_64bit
+            ? read_le16(sb + EXT4_SB_DESC_SIZE) : EXT4_MIN_DESC_SIZE;
+    geo.clean = (state & EXT4_VALID_FS) && !(state & EXT4_ERROR_FS)
+            && !(incompat & EXT4_FEATURE_INCOMPAT_RECOVER)
+            && read_le32(sb + EXT4_SB_ERROR_COUNT) == 0;
+
+    if (geo.blocks_per_group == 0 || geo.blocks_per_group > geo.block_size * 8
+            || geo.desc_size < EXT4_MIN_DESC_SIZE
+            || geo.desc_size > geo.block_size
+            || (geo.desc_size & (geo.desc_size - 1))
+            || geo.first_data_block >= geo.blocks_count) {
+        return std::errc::invalid_argument;
+    }
+
+    return geo;
+}
+
+/*!
+ * \brief Byte ranges of an image to copy, merged as they are added
+ */
+class RangeList
+{
+public:
+    void add(uint64_t begin, uint64_t end)
+    {
+        if (begin >= end) {
+            return;
+        }
+
+        if (!m_ranges.empty() && m_ranges.back().second >= begin) {
+            m_ranges.back().second = std::max(m_ranges.back().second, end);
+        } else {
+            m_ranges.emplace_back(begin, end);
+        }
+    }
+
+    const std::vector<std::pair<uint64_t, uint64_t>> & ranges() const
+    {
+        return m_ranges;
+    }
+
+    uint64_t total_size() const
+    {
+        uint64_t total = 0;
+        for (auto const &r : m_ranges) {
+            total += r.second - r.first;
+        }
+        return total;
+    }
+
+private:
+    std::vector<std::pair<uint64_t, uint64_t>> m_ranges;
+};
+
+/*!
+ * \brief Find the ranges of a file that contain data using `SEEK_DATA`
+ *
+ * If the underlying filesystem does not support `SEEK_DATA`, the entire range
+ * is considered to contain data.
+ */
+static oc::result<void> find_data_ranges(int fd, uint64_t begin, uint64_t end,
+                                         RangeList &ranges)
+{
+    uint64_t offset = begin;
+
+    while (offset < end) {
+        off64_t data = lseek64(fd, static_cast<off64_t>(offset), SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                // No more data
+                break;
+            } else if (errno == EINVAL) {
+                ranges.add(offset, end);
+                break;
+            }
+            return ec_from_errno();
+        }
+
+        off64_t hole = lseek64(fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            return ec_from_errno();
+        }
+
+        ranges.add(std::min(static_cast<uint64_t>(data), end),
+                   std::min(static_cast<uint64_t>(hole), end));
+        offset = static_cast<uint64_t>(hole);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Find the allocated blocks of an ext4 image using its block bitmaps
+ *
+ * Block groups whose bitmaps have not been initialized (`BLOCK_UNINIT`) still
+ * contain metadata, such as backup superblocks, so they fall back to
+ * `SEEK_DATA`.
+ */
+static oc::result<void> find_allocated_ranges(FdFile &file, int fd,
+                                              const Ext4Geometry &geo,
+                                              RangeList &ranges)
+{
+    uint64_t block_size = geo.block_size;
+    uint64_t groups = (geo.blocks_count - geo.first_data_block
+            + geo.blocks_per_group - 1) / geo.blocks_per_group;
+
+    // Boot sector and superblock for 1 KiB block sizes
+    ranges.add(0, static_cast<uint64_t>(geo.first_data_block) * block_size);
+
+    // Read all group descriptors
+    std::vector<unsigned char> descs(static_cast<size_t>(groups)
+            * geo.desc_size);
+    OUTCOME_TRYV(file.seek(static_cast<int64_t>(
+            (geo.first_data_block + 1) * block_size), SEEK_SET));
+    OUTCOME_TRYV(file_read_exact(file, descs.data(), descs.size()));
+
+    std::vector<unsigned char> bitmap(geo.block_size);
+
+    for (uint64_t group = 0; group < groups; ++group) {
+        const unsigned char *desc = descs.data() + group * geo.desc_size;
+        uint64_t first_block = geo.first_data_block
+                + group * geo.blocks_per_group;
+        uint64_t n_blocks = std::min<uint64_t>(
+                geo.blocks_per_group, geo.blocks_count - first_block);
+
+        if (read_le16(desc + EXT4_BG_FLAGS) & EXT4_BG_BLOCK_UNINIT) {
+            OUTCOME_TRYV(find_data_ranges(
+                    fd, first_block * block_size,
+                    (first_block + n_blocks) * block_size, ranges));
+            continue;
+        }
+
+        uint64_t bitmap_block = read_le32(desc + EXT4_BG_BLOCK_BITMAP_LO);
+        if (geo.desc_size >= EXT4_MIN_DESC_SIZE_64BIT) {
+            bitmap_block |= static_cast<uint64_t>(
+                    read_le32(desc + EXT4_BG_BLOCK_BITMAP_HI)) << 32;
+        }
+        if (bitmap_block >= geo.blocks_count) {
+            return std::errc::invalid_argument;
+        }
+
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(
+                bitmap_block * block_size), SEEK_SET));
+        OUTCOME_TRYV(file_read_exact(file, bitmap.data(), bitmap.size()));
+
+        for (uint64_t i = 0; i < n_blocks; ++i) {
+            if (bitmap[i / 8] & (1u << (i % 8))) {
+                uint64_t block = first_block + i;
+                ranges.add(block * block_size, (block + 1) * block_size);
+            }
+        }
+    }
+
+    return oc::success();
+}
+
 static int run_command_and_log(const std::vector<std::string> &args)
 {
     LOGV("Running command: [%s]", join(args, ", ").c_str());
@@ -89,6 +361,31 @@ static bool run_mkfs_ext4(const char *path, uint64_t size)
     return ret >= 0 && WIFEXITED(ret) && WEXITSTATUS(ret) == 0;
 }
 
+/*!
+ * \brief Create an ext4 image without running any external tools
+ *
+ * The image is a sparse file, so only the filesystem metadata is written. If
+ * this fails, the partially written image is removed.
+ */
+static oc::result<void> create_native_image(const char *path, uint64_t size)
+{
+    StandardFile file;
+
+    OUTCOME_TRYV(file.open(path, FileOpenMode::WriteOnly));
+
+    auto remove_image = finally([&] {
+        unlink(path);
+    });
+
+    OUTCOME_TRYV(file.truncate(size));
+    OUTCOME_TRYV(ext4_format(file, size, true));
+    OUTCOME_TRYV(file.close());
+
+    remove_image.dismiss();
+
+    return oc::success();
+}
+
 CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
 {
     // Ensure we have enough space since we're creating a sparse file that may
@@ -110,6 +407,13 @@ CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
             LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
             return CreateImageResult::Failed;
         } else {
+            if (auto r = create_native_image(path.c_str(), size)) {
+                return CreateImageResult::Succeeded;
+            } else {
+                LOGW("%s: Failed to create image natively: %s",
+                     path.c_str(), r.error().message().c_str());
+            }
+
             if (!run_make_ext4fs(path.c_str(), size)
                     && !run_mkfs_ext4(path.c_str(), size)) {
                 LOGE("%s: Failed to create image", path.c_str());
@@ -123,6 +427,36 @@ CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
     return CreateImageResult::ImageExists;
 }
 
+/*!
+ * \brief Create a sparse file containing an empty ext4 image
+ *
+ * The result is the same as creating an image with create_ext4_image() and
+ * converting it with ext4_image_to_sparse(), except that the image never
+ * exists on disk. Blocks that are not part of the filesystem metadata are
+ * stored as "don't care" chunks.
+ *
+ * \param sparse_path Path to output sparse file
+ * \param size Size of the expanded image
+ *
+ * \return Nothing on success or the error code on failure
+ */
+oc::result<void> create_ext4_sparse_image(const std::string &sparse_path,
+                                          uint64_t size)
+{
+    StandardFile out_file;
+    OUTCOME_TRYV(out_file.open(sparse_path, FileOpenMode::WriteOnly));
+
+    sparse::SparseWriter writer;
+    OUTCOME_TRYV(writer.open(&out_file));
+
+    OUTCOME_TRYV(ext4_format(writer, size, false));
+
+    OUTCOME_TRYV(writer.close());
+    OUTCOME_TRYV(out_file.close());
+
+    return oc::success();
+}
+
 bool fsck_ext4_image(const std::string &image)
 {
     int ret = run_command_and_log({ "e2fsck", "-f", "-y", image });
@@ -133,4 +467,147 @@ bool fsck_ext4_image(const std::string &image)
     return true;
 }
 
+/*!
+ * \brief Check if an ext4 image was cleanly unmounted and has no errors
+ *
+ * If this returns true, running fsck_ext4_image() on the image is not
+ * necessary before mounting it or copying its blocks.
+ */
+bool ext4_image_is_clean(const std::string &image)
+{
+    StandardFile file;
+
+    if (auto r = file.open(image, FileOpenMode::ReadOnly); !r) {
+        return false;
+    }
+
+    auto geo = read_ext4_geometry(file);
+    return geo && geo.value().clean;
+}
+
+/*!
+ * \brief Copy the allocated blocks of an ext4 image to a sparse file
+ *
+ * Only the blocks marked as allocated in the block bitmaps are stored. The
+ * remaining blocks are stored as "don't care" chunks. If the image's
+ * superblock or group descriptors cannot be parsed, the data ranges reported
+ * by `SEEK_DATA` are copied instead.
+ *
+ * \param image Path to ext4 image
+ * \param sparse_path Path to output sparse file
+ *
+ * \return Nothing on success or the error code on failure
+ */
+oc::result<void> ext4_image_to_sparse(const std::string &image,
+                                      const std::string &sparse_path)
+{
+    int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    FdFile in_file;
+    OUTCOME_TRYV(in_file.open(fd, true));
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    auto image_size = static_cast<uint64_t>(sb.st_size);
+    RangeList ranges;
+
+    if (auto geo = read_ext4_geometry(in_file); !geo || geo.value().uses_meta_bg
+            || geo.value().blocks_count * geo.value().block_size
+                    > image_size) {
+        LOGW("%s: Cannot read block bitmaps; copying all data",
+             image.c_str());
+        OUTCOME_TRYV(find_data_ranges(fd, 0, image_size, ranges));
+    } else if (auto r = find_allocated_ranges(in_file, fd, geo.value(),
+                                              ranges); !r) {
+        LOGW("%s: Failed to read block bitmaps: %s; copying all data",
+             image.c_str(), r.error().message().c_str());
+        ranges = {};
+        OUTCOME_TRYV(find_data_ranges(fd, 0, image_size, ranges));
+    }
+
+    LOGI("%s: Copying %" PRIu64 " of %" PRIu64 " bytes", image.c_str(),
+         ranges.total_size(), image_size);
+
+    StandardFile out_file;
+    OUTCOME_TRYV(out_file.open(sparse_path, FileOpenMode::WriteOnly));
+
+    sparse::SparseWriter writer;
+    OUTCOME_TRYV(writer.open(&out_file));
+
+    std::vector<unsigned char> buf(BLOCK_COPY_BUFFER_SIZE);
+
+    for (auto const &[begin, end] : ranges.ranges()) {
+        OUTCOME_TRYV(in_file.seek(static_cast<int64_t>(begin), SEEK_SET));
+        OUTCOME_TRYV(writer.seek(static_cast<int64_t>(begin), SEEK_SET));
+
+        for (uint64_t offset = begin; offset < end;) {
+            auto n = static_cast<size_t>(std::min<uint64_t>(
+                    buf.size(), end - offset));
+
+            OUTCOME_TRYV(file_read_exact(in_file, buf.data(), n));
+            OUTCOME_TRYV(file_write_exact(writer, buf.data(), n));
+
+            offset += n;
+        }
+    }
+
+    // The rest of the image is unallocated
+    OUTCOME_TRYV(writer.seek(static_cast<int64_t>(image_size), SEEK_SET));
+
+    OUTCOME_TRYV(writer.close());
+    OUTCOME_TRYV(out_file.close());
+
+    return oc::success();
+}
+
+/*!
+ * \brief Recreate an ext4 image from a sparse file
+ *
+ * Any existing image at \p image is replaced. The new image is a sparse file
+ * where only the blocks stored in the sparse file are written.
+ *
+ * \param sparse_path Path to sparse file created by ext4_image_to_sparse()
+ * \param image Path to output image
+ *
+ * \return Nothing on success or the error code on failure
+ */
+oc::result<void> sparse_to_ext4_image(const std::string &sparse_path,
+                                      const std::string &image)
+{
+    StandardFile in_file;
+    OUTCOME_TRYV(in_file.open(sparse_path, FileOpenMode::ReadOnly));
+
+    sparse::SparseFile sparse_file;
+    OUTCOME_TRYV(sparse_file.open(&in_file));
+
+    if (unlink(image.c_str()) < 0 && errno != ENOENT) {
+        return ec_from_errno();
+    }
+
+    StandardFile out_file;
+    OUTCOME_TRYV(out_file.open(image, FileOpenMode::WriteOnly));
+
+    // Holes in the new file read back as zeros, so neither holes nor zero
+    // fills need to be written
+    OUTCOME_TRYV(out_file.truncate(sparse_file.size()));
+
+    sparse::SparseFlashCallbacks callbacks;
+    callbacks.zero_out = [](uint64_t, uint64_t) -> oc::result<bool> {
+        return true;
+    };
+
+    OUTCOME_TRYV(sparse::flash_sparse_file(sparse_file, out_file, callbacks));
+
+    OUTCOME_TRYV(sparse_file.close());
+    OUTCOME_TRYV(out_file.close());
+
+    return oc::success();
+}
+
 }
@@ -21,14 +21,19 @@
 
 // C++
 #include <algorithm>
+#include <array>
 #include <chrono>
+#include <unordered_map>
+#include <unordered_set>
 
 // C
+#include <cstdlib>
 #include <cstring>
 
 // Linux/posix
 #include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sched.h>
 #include <signal.h>
 #include <sys/mount.h>
@@ -37,6 +42,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <openssl/sha.h>
+
 // Linux
 #include <linux/loop.h>
 
@@ -68,11 +75,20 @@
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
+// minizip
+#include "mz.h"
+#include "mz_strm_android.h"
+#include "mz_strm_buf.h"
+#include "mz_zip.h"
+
 // Local
+#include "boot/directory_size.h"
 #include "recovery/image.h"
 #include "recovery/installer_util.h"
 #include "util/android_api.h"
+#include "util/block_dev_index.h"
 #include "util/legacy_property_service.h"
+#include "util/memory_budget.h"
 #include "util/multiboot.h"
 #include "util/signature.h"
 #include "util/romconfig.h"
@@ -102,16 +118,111 @@
 
 #define HELPER_TOOL             "/update-binary-tool"
 
+// Caches shared by consecutive installations. They live in the recovery's
+// tmpfs, so they are discarded on reboot.
+#define CACHE_DIR               "/tmp/mbtool-cache"
+#define PAYLOAD_CACHE_DIR       CACHE_DIR "/payload"
+#define PAYLOAD_CACHE_KEY_FILE  CACHE_DIR "/payload.key"
+#define CHROOT_TEMPLATE_DIR     CACHE_DIR "/chroot-template"
+#define CHROOT_TEMPLATE_KEY_FILE CACHE_DIR "/chroot-template.key"
+#define CHROOT_OVERLAY_DIR      CACHE_DIR "/chroot-overlay"
+
 
 using namespace mb::device;
 
 namespace mb
 {
 
+// Avoid caching image contents in both the loop device and the backing file.
+// The block size is left alone because mkfs.ext4 uses 1K blocks for small
+// images.
+static constexpr util::LoopDeviceOptions IMAGE_LOOP_OPTIONS{true, 0};
+
+//! Size of the reads from the updater's pipes
+static constexpr size_t UPDATER_READ_BUF_SIZE = 64 * 1024;
+
 using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
-const std::string Installer::CANCELLED = "cancelled";
+struct PayloadFile
+{
+    // Path in the zip file
+    const char *zip_path;
+    // Path relative to the temporary directory
+    const char *temp_path;
+    // Whether the file must match its detached signature (<temp_path>.sig)
+    bool verify;
+};
+
+// Multiboot files that are the same in every zip patched by a given version of
+// the patcher. The ROM's original update-binary and info.prop are not part of
+// the payload and are always extracted from the zip.
+static constexpr PayloadFile PAYLOAD_FILES[] = {
+    {
+        "META-INF/com/google/android/update-binary",
+        "mbtool",
+        true
+    },
+    {
+        "META-INF/com/google/android/update-binary.sig",
+        "mbtool.sig",
+        false
+    },
+    {
+        "multiboot/bb-wrapper.sh",
+        "bb-wrapper.sh",
+        true
+    },
+    {
+        "multiboot/bb-wrapper.sh.sig",
+        "bb-wrapper.sh.sig",
+        false
+    },
+    {
+        "multiboot/device.json",
+        "device.json",
+        false
+    },
+    {
+        "multiboot/binaries/file-contexts-tool",
+        "binaries/file-contexts-tool",
+        true
+    },
+    {
+        "multiboot/binaries/file-contexts-tool.sig",
+        "binaries/file-contexts-tool.sig",
+        false
+    },
+    {
+        "multiboot/binaries/fsck-wrapper",
+        "binaries/fsck-wrapper",
+        true
+    },
+    {
+        "multiboot/binaries/fsck-wrapper.sig",
+        "binaries/fsck-wrapper.sig",
+        false
+    },
+    {
+        "multiboot/binaries/mbtool",
+        "binaries/mbtool",
+        true
+    },
+    {
+        "multiboot/binaries/mbtool.sig",
+        "binaries/mbtool.sig",
+        false
+    },
+    {
+        "multiboot/binaries/mount.exfat",
+        "binaries/mount.exfat",
+        true
+    },
+    {
+        "multiboot/binaries/mount.exfat.sig",
+        "binaries/mount.exfat.sig",
+        false
+    },
+};
 
 
 Installer::Installer(std::string zip_file, std::string chroot_dir,
@@ -124,6 +235,10 @@ Installer::Installer(std::string zip_file, std::string chroot_dir,
     , _output_fd(output_fd)
     , _flags(flags)
     , _ran(false)
+    , _progress_base(0)
+    , _progress_scope(0)
+    , _staging_dir(_temp)
+    , _peak_rss(0)
 {
     _passthrough = _output_fd >= 0;
 
@@ -237,6 +352,206 @@ static bool log_file_write_string(const std::string &path,
 }
 
 
+/*!
+ * \brief Compute the cache key for the multiboot payload of a zip file
+ *
+ * The key is a SHA-256 digest of the mbtool version and the name, CRC32 and
+ * uncompressed size of every file in PAYLOAD_FILES. Only the zip's central
+ * directory is read, so this is cheap compared to extracting the payload.
+ *
+ * \return Hex-encoded key or an empty string if the key could not be computed
+ */
+static std::string payload_cache_key(const std::string &zip_file)
+{
+    void *stream;
+    if (!mz_stream_android_create(&stream)) {
+        LOGE("Failed to create base stream");
+        return {};
+    }
+
+    auto destroy_stream = finally([&] {
+        mz_stream_delete(&stream);
+    });
+
+    void *buf_stream;
+    if (!mz_stream_buffered_create(&buf_stream)) {
+        LOGE("Failed to create buffered stream");
+        return {};
+    }
+
+    auto destroy_buf_stream = finally([&] {
+        mz_stream_delete(&buf_stream);
+    });
+
+    if (mz_stream_set_base(buf_stream, stream) != MZ_OK) {
+        LOGE("Failed to set base stream for buffered stream");
+        return {};
+    }
+
+    if (mz_stream_open(buf_stream, zip_file.c_str(),
+                       MZ_OPEN_MODE_READ) != MZ_OK) {
+        LOGE("%s: Failed to open stream", zip_file.c_str());
+        return {};
+    }
+
+    auto close_stream = finally([&] {
+        mz_stream_close(buf_stream);
+    });
+
+    auto *handle = mz_zip_open(buf_stream, MZ_OPEN_MODE_READ);
+    if (!handle) {
+        LOGE("%s: Failed to open zip", zip_file.c_str());
+        return {};
+    }
+
+    auto close_zip = finally([&]{
+        mz_zip_close(handle);
+    });
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+
+    auto update = [&](std::string_view data) {
+        SHA256_Update(&ctx, data.data(), data.size());
+        SHA256_Update(&ctx, "\n", 1);
+    };
+
+    update(version());
+    update(git_version());
+
+    for (auto const &file : PAYLOAD_FILES) {
+        mz_zip_file *file_info;
+
+        if (mz_zip_locate_entry(handle, file.zip_path, nullptr) != MZ_OK
+                || mz_zip_entry_get_info(handle, &file_info) != MZ_OK) {
+            LOGW("%s: Failed to find %s in zip",
+                 zip_file.c_str(), file.zip_path);
+            return {};
+        }
+
+        update(file.zip_path);
+        update(format("%08" PRIx32 " %" PRIu64,
+                      static_cast<uint32_t>(file_info->crc),
+                      static_cast<uint64_t>(file_info->uncompressed_size)));
+    }
+
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256_Final(digest, &ctx);
+
+    return util::hex_string(digest, sizeof(digest));
+}
+
+/*!
+ * \brief Check if a cache entry was completely populated for a key
+ */
+static bool cache_key_matches(const char *key_file, const std::string &key)
+{
+    auto contents = util::file_read_all(key_file);
+    return contents && contents.value() == key;
+}
+
+/*!
+ * \brief Create the parts of the chroot that do not change between
+ *        installations
+ *
+ * This creates the directory skeleton, the copy of /sbin and the special files
+ * in /dev under \p root.
+ *
+ * \param root Root of the chroot tree
+ * \param mount_dev Whether to mount a tmpfs at `<root>/dev` before populating
+ *                  it
+ */
+static bool create_chroot_tree(const std::string &root, bool mount_dev)
+{
+    auto path = [&](const char *p) {
+        return root + p;
+    };
+
+    // Create remaining directories
+    if (log_mkdir(path("/mb").c_str(), 0755) < 0
+            || log_mkdir(path("/dev").c_str(), 0755) < 0
+            || log_mkdir(path("/etc").c_str(), 0755) < 0
+            || log_mkdir(path("/proc").c_str(), 0755) < 0
+            || log_mkdir(path("/sbin").c_str(), 0755) < 0
+            || log_mkdir(path("/sys").c_str(), 0755) < 0
+            || log_mkdir(path("/tmp").c_str(), 0755) < 0
+            || log_mkdir(path("/data").c_str(), 0755) < 0
+            || log_mkdir(path("/cache").c_str(), 0755) < 0
+            || log_mkdir(path("/system").c_str(), 0755) < 0
+            || log_mkdir(path("/firmware").c_str(), 0755) < 0
+            || log_mkdir(path("/efs").c_str(), 0755) < 0) {
+        return false;
+    }
+
+    if (mount_dev
+            && log_mount("none", path("/dev").c_str(), "tmpfs", 0, "") < 0) {
+        return false;
+    }
+
+    if (log_mkdir(path("/dev/pts").c_str(), 0755) < 0
+            || log_mkdir(path("/dev/socket").c_str(), 0755) < 0) {
+        return false;
+    }
+
+    // Copy the contents of sbin since we need to mess with some of the binaries
+    // there. Also, for whatever reason, bind mounting /sbin results in EINVAL
+    // no matter if it's done from here or from busybox.
+    if (!log_copy_dir("/sbin", path("/sbin"),
+                      util::CopyFlag::CopyAttributes
+                    | util::CopyFlag::CopyXattrs
+                    | util::CopyFlag::ExcludeTopLevel)) {
+        return false;
+    }
+
+    // Remove reboot binary
+    remove(path("/sbin/reboot").c_str());
+
+    // Don't create unnecessary special files in /dev to avoid install scripts
+    // from overwriting partitions
+    if (log_mknod(path("/dev/console").c_str(), S_IFCHR | 0644, makedev(5, 1)) < 0
+            || log_mknod(path("/dev/null").c_str(), S_IFCHR | 0644, makedev(1, 3)) < 0
+            || log_mknod(path("/dev/ptmx").c_str(), S_IFCHR | 0644, makedev(5, 2)) < 0
+            || log_mknod(path("/dev/random").c_str(), S_IFCHR | 0644, makedev(1, 8)) < 0
+            || log_mknod(path("/dev/tty").c_str(), S_IFCHR | 0644, makedev(5, 0)) < 0
+            || log_mknod(path("/dev/urandom").c_str(), S_IFCHR | 0644, makedev(1, 9)) < 0
+            || log_mknod(path("/dev/zero").c_str(), S_IFCHR | 0644, makedev(1, 5)) < 0
+            || log_mknod(path("/dev/loop-control").c_str(), S_IFCHR | 0644, makedev(10, 237)) < 0
+            || log_mknod(path("/dev/fuse").c_str(), S_IFCHR | 0644, makedev(10, 229))) {
+        return false;
+    }
+
+    // Create a few loopback devices since some installers expect them to exist,
+    // but don't create them. They are not necessary for mbtool to work.
+    if (log_mkdir(path("/dev/block").c_str(), 0755) < 0
+            || log_mknod(path("/dev/block/loop0").c_str(), S_IFBLK | 0644, makedev(7, 0)) < 0
+            || log_mknod(path("/dev/block/loop1").c_str(), S_IFBLK | 0644, makedev(7, 1)) < 0
+            || log_mknod(path("/dev/block/loop2").c_str(), S_IFBLK | 0644, makedev(7, 2)) < 0
+            || log_mknod(path("/dev/block/loop3").c_str(), S_IFBLK | 0644, makedev(7, 3)) < 0
+            || log_mknod(path("/dev/block/loop4").c_str(), S_IFBLK | 0644, makedev(7, 4)) < 0
+            || log_mknod(path("/dev/block/loop5").c_str(), S_IFBLK | 0644, makedev(7, 5)) < 0
+            || log_mknod(path("/dev/block/loop6").c_str(), S_IFBLK | 0644, makedev(7, 6)) < 0
+            || log_mknod(path("/dev/block/loop7").c_str(), S_IFBLK | 0644, makedev(7, 7)) < 0) {
+        return false;
+    }
+
+    // We need /dev/input/* and /dev/graphics/* for AROMA
+    if (!log_copy_dir("/dev/input", path("/dev/input"),
+                      util::CopyFlag::CopyAttributes
+                    | util::CopyFlag::CopyXattrs
+                    | util::CopyFlag::ExcludeTopLevel)) {
+        return false;
+    }
+    if (!log_copy_dir("/dev/graphics", path("/dev/graphics"),
+                      util::CopyFlag::CopyAttributes
+                    | util::CopyFlag::CopyXattrs
+                    | util::CopyFlag::ExcludeTopLevel)) {
+        return false;
+    }
+
+    return true;
+}
+
+
 /*
  * Helper functions
  */
@@ -252,7 +567,9 @@ int Installer::run_command(const std::vector<std::string> &argv)
 {
     using namespace std::placeholders;
 
-    return util::run_command(
+    auto start = std::chrono::steady_clock::now();
+
+    int ret = util::run_command(
         argv[0],
         argv,
         {},
@@ -260,6 +577,11 @@ int Installer::run_command(const std::vector<std::string> &argv)
         _passthrough ? util::CmdLineCb{}
             : std::bind(&Installer::output_cb, this, _1, _2)
     );
+
+    record_timing("command", argv[0], start,
+                  ret >= 0 && WIFEXITED(ret) && WEXITSTATUS(ret) == 0);
+
+    return ret;
 }
 
 int Installer::run_command_chroot(const std::string &dir,
@@ -267,7 +589,9 @@ int Installer::run_command_chroot(const std::string &dir,
 {
     using namespace std::placeholders;
 
-    return util::run_command(
+    auto start = std::chrono::steady_clock::now();
+
+    int ret = util::run_command(
         argv[0],
         argv,
         {},
@@ -275,6 +599,73 @@ int Installer::run_command_chroot(const std::string &dir,
         _passthrough ? util::CmdLineCb{}
             : std::bind(&Installer::output_cb, this, _1, _2)
     );
+
+    record_timing("command", argv[0], start,
+                  ret >= 0 && WIFEXITED(ret) && WEXITSTATUS(ret) == 0);
+
+    return ret;
+}
+
+/*!
+ * \brief Record a timeline entry
+ *
+ * Each entry is passed to timeline_output() as a single line of
+ * space-separated `key=value` pairs:
+ *
+ *     mbtool-timeline kind=<kind> name=<name> start_ms=<ms> duration_ms=<ms> status=<ok|fail>
+ *
+ * \p kind is one of `stage`, `step`, `command` or `total`. `start_ms` is
+ * relative to the start of the installation. Whitespace and `=` characters in
+ * \p name are replaced with `_`.
+ *
+ * Entries for stages and the total also report memory usage:
+ *
+ *     ... peak_rss_kb=<kiB> child_peak_rss_kb=<kiB> tmpfs_kb=<kiB>
+ *
+ * `peak_rss_kb` is the peak RSS of mbtool during the stage (or the whole
+ * installation), `child_peak_rss_kb` is the largest peak RSS of any command
+ * that has finished so far, and `tmpfs_kb` is the usage of the tmpfs mounts
+ * used by the installer when the stage ends.
+ */
+void Installer::record_timing(const char *kind, std::string_view name,
+                              std::chrono::steady_clock::time_point start,
+                              bool success)
+{
+    using namespace std::chrono;
+
+    auto now = steady_clock::now();
+    auto start_ms = duration_cast<milliseconds>(start - _timeline_start);
+    auto duration_ms = duration_cast<milliseconds>(now - start);
+
+    std::string clean_name(name);
+    for (char &c : clean_name) {
+        if (static_cast<unsigned char>(c) <= 0x20 || c == '=' || c == 0x7f) {
+            c = '_';
+        }
+    }
+
+    std::string usage_str;
+
+    bool is_total = strcmp(kind, "total") == 0;
+    if (is_total || strcmp(kind, "stage") == 0) {
+        auto usage = memory_usage({
+            _temp, _staging_dir, _chroot, in_chroot("/tmp"), CACHE_DIR,
+        });
+        _peak_rss = std::max(_peak_rss, usage.peak_rss);
+
+        usage_str = format(
+                " peak_rss_kb=%" PRIu64 " child_peak_rss_kb=%" PRIu64
+                " tmpfs_kb=%" PRIu64,
+                (is_total ? _peak_rss : usage.peak_rss) / 1024,
+                usage.child_peak_rss / 1024, usage.tmpfs_used / 1024);
+    }
+
+    timeline_output(format(
+            "mbtool-timeline kind=%s name=%s start_ms=%" PRId64
+            " duration_ms=%" PRId64 " status=%s%s", kind, clean_name.c_str(),
+            static_cast<int64_t>(start_ms.count()),
+            static_cast<int64_t>(duration_ms.count()),
+            success ? "ok" : "fail", usage_str.c_str()));
 }
 
 std::string Installer::in_chroot(const std::string &path) const
@@ -317,33 +708,22 @@ bool Installer::create_chroot()
         return false;
     }
 
-    // Create chroot and mount tmpfs there
-    if (log_mkdir(_chroot.c_str(), 0700) < 0
-            || log_mount("tmpfs", _chroot.c_str(), "tmpfs", 0, "") < 0) {
+    if (log_mkdir(_chroot.c_str(), 0700) < 0) {
         return false;
     }
 
-    // Create remaining directories
-    if (log_mkdir(in_chroot("/mb").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/dev").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/etc").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/proc").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/sbin").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/sys").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/tmp").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/data").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/cache").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/system").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/firmware").c_str(), 0755) < 0
-            || log_mkdir(in_chroot("/efs").c_str(), 0755) < 0) {
-        return false;
+    if (!mount_chroot_template()) {
+        LOGD("Building chroot from scratch");
+
+        // Mount tmpfs at the chroot and create everything there
+        if (log_mount("tmpfs", _chroot.c_str(), "tmpfs", 0, "") < 0
+                || !create_chroot_tree(_chroot, true)) {
+            return false;
+        }
     }
 
     // Other mounts
-    if (log_mount("none", in_chroot("/dev").c_str(), "tmpfs", 0, "") < 0
-            || log_mkdir(in_chroot("/dev/pts").c_str(), 0755) < 0
-            || log_mount("none", in_chroot("/dev/pts").c_str(), "devpts", 0, "") < 0
-            || log_mkdir(in_chroot("/dev/socket").c_str(), 0755) < 0
+    if (log_mount("none", in_chroot("/dev/pts").c_str(), "devpts", 0, "") < 0
             || log_mount("none", in_chroot("/proc").c_str(), "proc", 0, "") < 0
             || log_mount("none", in_chroot("/sys").c_str(), "sysfs", 0, "") < 0
             || log_mount("none", in_chroot("/tmp").c_str(), "tmpfs", 0, "") < 0) {
@@ -360,67 +740,104 @@ bool Installer::create_chroot()
         return false;
     }
 
-    // Copy the contents of sbin since we need to mess with some of the binaries
-    // there. Also, for whatever reason, bind mounting /sbin results in EINVAL
-    // no matter if it's done from here or from busybox.
-    if (!log_copy_dir("/sbin", in_chroot("/sbin"),
-                      util::CopyFlag::CopyAttributes
-                    | util::CopyFlag::CopyXattrs
-                    | util::CopyFlag::ExcludeTopLevel)) {
+    // Mount EFS partition so patched Odin images can properly set up multi-CSC
+    if (!mount_efs()) {
         return false;
     }
 
-    // Remove reboot binary
-    remove(in_chroot("/sbin/reboot").c_str());
+    (void) util::create_empty_file(in_chroot("/.chroot"));
 
-    // Don't create unnecessary special files in /dev to avoid install scripts
-    // from overwriting partitions
-    if (log_mknod(in_chroot("/dev/console").c_str(), S_IFCHR | 0644, makedev(5, 1)) < 0
-            || log_mknod(in_chroot("/dev/null").c_str(), S_IFCHR | 0644, makedev(1, 3)) < 0
-            || log_mknod(in_chroot("/dev/ptmx").c_str(), S_IFCHR | 0644, makedev(5, 2)) < 0
-            || log_mknod(in_chroot("/dev/random").c_str(), S_IFCHR | 0644, makedev(1, 8)) < 0
-            || log_mknod(in_chroot("/dev/tty").c_str(), S_IFCHR | 0644, makedev(5, 0)) < 0
-            || log_mknod(in_chroot("/dev/urandom").c_str(), S_IFCHR | 0644, makedev(1, 9)) < 0
-            || log_mknod(in_chroot("/dev/zero").c_str(), S_IFCHR | 0644, makedev(1, 5)) < 0
-            || log_mknod(in_chroot("/dev/loop-control").c_str(), S_IFCHR | 0644, makedev(10, 237)) < 0
-            || log_mknod(in_chroot("/dev/fuse").c_str(), S_IFCHR | 0644, makedev(10, 229))) {
+    return true;
+}
+
+/*!
+ * \brief Mount the chroot from the cached chroot template
+ *
+ * The template holds the parts of the chroot that do not change between
+ * installations (see create_chroot_tree()). It is built once for each payload
+ * key and is then used as the lower layer of an overlayfs mount at the chroot.
+ * The upper layer is a fresh tmpfs for every installation, so nothing written
+ * by one installation is visible to the next.
+ *
+ * \return Whether the chroot was mounted. If false, nothing is mounted at the
+ *         chroot and it should be built from scratch. This is the case if the
+ *         kernel does not support overlayfs.
+ */
+bool Installer::mount_chroot_template()
+{
+    if (_payload_key.empty()) {
         return false;
     }
 
-    // Create a few loopback devices since some installers expect them to exist,
-    // but don't create them. They are not necessary for mbtool to work.
-    if (log_mkdir(in_chroot("/dev/block").c_str(), 0755) < 0
-            || log_mknod(in_chroot("/dev/block/loop0").c_str(), S_IFBLK | 0644, makedev(7, 0)) < 0
-            || log_mknod(in_chroot("/dev/block/loop1").c_str(), S_IFBLK | 0644, makedev(7, 1)) < 0
-            || log_mknod(in_chroot("/dev/block/loop2").c_str(), S_IFBLK | 0644, makedev(7, 2)) < 0
-            || log_mknod(in_chroot("/dev/block/loop3").c_str(), S_IFBLK | 0644, makedev(7, 3)) < 0
-            || log_mknod(in_chroot("/dev/block/loop4").c_str(), S_IFBLK | 0644, makedev(7, 4)) < 0
-            || log_mknod(in_chroot("/dev/block/loop5").c_str(), S_IFBLK | 0644, makedev(7, 5)) < 0
-            || log_mknod(in_chroot("/dev/block/loop6").c_str(), S_IFBLK | 0644, makedev(7, 6)) < 0
-            || log_mknod(in_chroot("/dev/block/loop7").c_str(), S_IFBLK | 0644, makedev(7, 7)) < 0) {
+    if (cache_key_matches(CHROOT_TEMPLATE_KEY_FILE, _payload_key)) {
+        LOGD("Reusing chroot template: %s", CHROOT_TEMPLATE_DIR);
+    } else {
+        unlink(CHROOT_TEMPLATE_KEY_FILE);
+
+        if (!log_delete_recursive(CHROOT_TEMPLATE_DIR)) {
+            return false;
+        }
+
+        // Unlike a chroot built from scratch, the template stays on tmpfs
+        // after the installation. It is mostly a copy of /sbin.
+        if (auto size = get_directory_size("/sbin", {});
+                !size || !memory_budget_allows(size.value())) {
+            LOGD("Not creating chroot template: exceeds memory budget");
+            return false;
+        }
+
+        LOGD("Creating chroot template: %s", CHROOT_TEMPLATE_DIR);
+
+        if (auto r = util::mkdir_recursive(CACHE_DIR, 0700); !r) {
+            LOGW("%s: Failed to create directory: %s",
+                 CACHE_DIR, r.error().message().c_str());
+            return false;
+        }
+
+        // The key is written last so that a partially created template is
+        // never used
+        if (log_mkdir(CHROOT_TEMPLATE_DIR, 0755) < 0
+                || !create_chroot_tree(CHROOT_TEMPLATE_DIR, false)
+                || !log_file_write_string(CHROOT_TEMPLATE_KEY_FILE,
+                                          _payload_key)) {
+            (void) util::delete_recursive(CHROOT_TEMPLATE_DIR);
+            return false;
+        }
+    }
+
+    std::string upper_dir(CHROOT_OVERLAY_DIR "/upper");
+    std::string work_dir(CHROOT_OVERLAY_DIR "/work");
+
+    if (!log_unmount_all(CHROOT_OVERLAY_DIR)
+            || !log_delete_recursive(CHROOT_OVERLAY_DIR)) {
         return false;
     }
 
-    // We need /dev/input/* and /dev/graphics/* for AROMA
-    if (!log_copy_dir("/dev/input", in_chroot("/dev/input"),
-                      util::CopyFlag::CopyAttributes
-                    | util::CopyFlag::CopyXattrs
-                    | util::CopyFlag::ExcludeTopLevel)) {
+    if (log_mkdir(CHROOT_OVERLAY_DIR, 0700) < 0
+            || log_mount("tmpfs", CHROOT_OVERLAY_DIR, "tmpfs", 0, "") < 0) {
         return false;
     }
-    if (!log_copy_dir("/dev/graphics", in_chroot("/dev/graphics"),
-                      util::CopyFlag::CopyAttributes
-                    | util::CopyFlag::CopyXattrs
-                    | util::CopyFlag::ExcludeTopLevel)) {
+
+    auto unmount_overlay_dir = finally([&] {
+        log_umount(CHROOT_OVERLAY_DIR);
+    });
+
+    if (log_mkdir(upper_dir.c_str(), 0755) < 0
+            || log_mkdir(work_dir.c_str(), 0755) < 0) {
         return false;
     }
 
-    // Mount EFS partition so patched Odin images can properly set up multi-CSC
-    if (!mount_efs()) {
+    std::string options = format("lowerdir=%s,upperdir=%s,workdir=%s",
+                                 CHROOT_TEMPLATE_DIR, upper_dir.c_str(),
+                                 work_dir.c_str());
+
+    if (mount("overlay", _chroot.c_str(), "overlay", 0, options.c_str()) < 0) {
+        LOGW("Failed to mount overlayfs at %s: %s",
+             _chroot.c_str(), strerror(errno));
         return false;
     }
 
-    (void) util::create_empty_file(in_chroot("/.chroot"));
+    unmount_overlay_dir.dismiss();
 
     return true;
 }
@@ -467,6 +884,13 @@ bool Installer::destroy_chroot() const
 
     (void) util::delete_recursive(_chroot);
 
+    // Remove the upper layer if the chroot was created from the template
+    if (!log_unmount_all(CHROOT_OVERLAY_DIR)) {
+        return false;
+    }
+
+    (void) util::delete_recursive(CHROOT_OVERLAY_DIR);
+
     if (log_is_mounted("/efs")) {
         log_umount("/efs");
     }
@@ -564,6 +988,10 @@ bool Installer::mount_efs() const
 
 /*!
  * \brief Extract needed multiboot files from the patched zip file
+ *
+ * The multiboot payload (see PAYLOAD_FILES) is only extracted and verified if
+ * it is not already cached from a previous installation of a zip with the same
+ * payload key.
  */
 bool Installer::extract_multiboot_files()
 {
@@ -572,48 +1000,19 @@ bool Installer::extract_multiboot_files()
             "META-INF/com/google/android/update-binary.orig",
             _temp + "/updater"
         },
-        {
-            "META-INF/com/google/android/update-binary",
-            _temp + "/mbtool"
-        },
-        {
-            "META-INF/com/google/android/update-binary.sig",
-            _temp + "/mbtool.sig"
-        },
-        {
-            "multiboot/bb-wrapper.sh",
-            _temp + "/bb-wrapper.sh"
-        },
-        {
-            "multiboot/bb-wrapper.sh.sig",
-            _temp + "/bb-wrapper.sh.sig"
-        },
-        {
-            "multiboot/device.json",
-            _temp + "/device.json"
-        },
         {
             "multiboot/info.prop",
             _temp + "/info.prop"
         },
     };
 
-    std::vector<std::string> binaries{
-        "file-contexts-tool",
-        "file-contexts-tool.sig",
-        "fsck-wrapper",
-        "fsck-wrapper.sig",
-        "mbtool",
-        "mbtool.sig",
-        "mount.exfat",
-        "mount.exfat.sig",
-    };
+    bool cached = !_payload_key.empty()
+            && cache_key_matches(PAYLOAD_CACHE_KEY_FILE, _payload_key);
 
-    for (auto const &binary : binaries) {
-        files.push_back({
-            "multiboot/binaries/" + binary,
-            _temp + "/binaries/" + binary
-        });
+    if (!cached) {
+        for (auto const &file : PAYLOAD_FILES) {
+            files.push_back({ file.zip_path, _temp + "/" + file.temp_path });
+        }
     }
 
     if (!util::extract_files2(_zip_file, files)) {
@@ -621,22 +1020,31 @@ bool Installer::extract_multiboot_files()
         return false;
     }
 
-    std::vector<std::string> sigcheck{
-        _temp + "/mbtool",
-        _temp + "/bb-wrapper.sh",
-        _temp + "/binaries/file-contexts-tool",
-        _temp + "/binaries/fsck-wrapper",
-        _temp + "/binaries/mbtool",
-        _temp + "/binaries/mount.exfat",
-    };
+    if (cached) {
+        LOGD("Using cached multiboot payload: %s", PAYLOAD_CACHE_DIR);
 
-    for (auto const &item : sigcheck) {
-        SigVerifyResult result =
-                verify_signature(item.c_str(), (item + ".sig").c_str());
-        if (result != SigVerifyResult::Valid) {
-            LOGE("%s: Signature verification failed", item.c_str());
+        if (!copy_cached_payload(PAYLOAD_CACHE_DIR)) {
             return false;
         }
+    } else {
+        for (auto const &file : PAYLOAD_FILES) {
+            if (!file.verify) {
+                continue;
+            }
+
+            std::string item = _temp + "/" + file.temp_path;
+
+            SigVerifyResult result =
+                    verify_signature(item.c_str(), (item + ".sig").c_str());
+            if (result != SigVerifyResult::Valid) {
+                LOGE("%s: Signature verification failed", item.c_str());
+                return false;
+            }
+        }
+
+        if (!_payload_key.empty()) {
+            store_cached_payload(PAYLOAD_CACHE_DIR);
+        }
     }
 
     std::string updater(_temp);
@@ -664,6 +1072,90 @@ bool Installer::extract_multiboot_files()
     return true;
 }
 
+/*!
+ * \brief Copy the cached multiboot payload to the temporary directory
+ *
+ * The files in the cache were verified before they were added, so their
+ * signatures are not checked again.
+ */
+bool Installer::copy_cached_payload(const std::string &cache_dir)
+{
+    if (log_mkdir((_temp + "/binaries").c_str(), 0755) < 0 && errno != EEXIST) {
+        return false;
+    }
+
+    for (auto const &file : PAYLOAD_FILES) {
+        std::string source = cache_dir + "/" + file.temp_path;
+        std::string target = _temp + "/" + file.temp_path;
+
+        if (auto r = util::copy_file(source, target,
+                                     util::CopyFlag::CopyAttributes); !r) {
+            LOGE("%s: Failed to copy to %s: %s", source.c_str(),
+                 target.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Add the verified multiboot payload to the cache
+ *
+ * Only one payload is cached, so this replaces any previously cached payload.
+ * Failures are not fatal and only cause the payload to be extracted again
+ * during the next installation.
+ */
+void Installer::store_cached_payload(const std::string &cache_dir)
+{
+    unlink(PAYLOAD_CACHE_KEY_FILE);
+
+    // The cache stays on tmpfs after the installation
+    uint64_t payload_size = 0;
+
+    for (auto const &file : PAYLOAD_FILES) {
+        struct stat sb;
+        if (stat((_temp + "/" + file.temp_path).c_str(), &sb) == 0) {
+            payload_size += static_cast<uint64_t>(sb.st_size);
+        }
+    }
+
+    if (!memory_budget_allows(payload_size)) {
+        LOGD("Not caching multiboot payload: exceeds memory budget");
+        (void) util::delete_recursive(cache_dir);
+        return;
+    }
+
+    if (!log_delete_recursive(cache_dir)) {
+        return;
+    }
+
+    if (auto r = util::mkdir_recursive(cache_dir + "/binaries", 0700); !r) {
+        LOGW("%s: Failed to create directory: %s",
+             cache_dir.c_str(), r.error().message().c_str());
+        return;
+    }
+
+    for (auto const &file : PAYLOAD_FILES) {
+        std::string source = _temp + "/" + file.temp_path;
+        std::string target = cache_dir + "/" + file.temp_path;
+
+        if (auto r = util::copy_file(source, target,
+                                     util::CopyFlag::CopyAttributes); !r) {
+            LOGW("%s: Failed to copy to %s: %s", source.c_str(),
+                 target.c_str(), r.error().message().c_str());
+            (void) util::delete_recursive(cache_dir);
+            return;
+        }
+    }
+
+    // The key is written last so that a partially populated cache is never
+    // used
+    if (!log_file_write_string(PAYLOAD_CACHE_KEY_FILE, _payload_key)) {
+        (void) util::delete_recursive(cache_dir);
+    }
+}
+
 /*!
  * \brief Replace busybox in the chroot with a wrapper that disables certain
  *        functions
@@ -813,7 +1305,7 @@ bool Installer::mount_dir_or_image(const std::string &source,
             return false;
         }
         if (auto ret = util::loopdev_set_up_device(
-                loopdev.value(), source, 0, false); !ret) {
+                loopdev.value(), source, 0, false, IMAGE_LOOP_OPTIONS); !ret) {
             LOGE("Failed to attach %s to %s: %s",
                  loopdev.value().c_str(), source.c_str(),
                  ret.error().message().c_str());
@@ -964,72 +1456,163 @@ bool Installer::set_up_properties()
             : set_up_modern_properties();
 }
 
-bool Installer::updater_fd_reader(int stdio_fd, int command_fd)
+/*!
+ * \brief Handle one line from the updater's command pipe
+ *
+ * The parsing is similar to AOSP recovery's. ui_print messages are appended to
+ * \p print_buf instead of being printed right away so that the messages from
+ * one read reach updater_print() together.
+ */
+void Installer::updater_command(std::string_view line, std::string &print_buf)
 {
-    int status;
-    pid_t pid = fork();
+    if (!line.empty() && line.back() == '\n') {
+        line.remove_suffix(1);
+    }
+
+    auto start = line.find_first_not_of(' ');
+    if (start == std::string_view::npos) {
+        return;
+    }
+    line.remove_prefix(start);
+
+    auto cmd = line.substr(0, line.find(' '));
+    auto arg = line.size() > cmd.size()
+            ? line.substr(cmd.size() + 1) : std::string_view();
+
+    if (cmd == "progress") {
+        // progress <fraction> <seconds>: The next <fraction> of the progress
+        // bar belongs to the following operations
+        _progress_base = std::min(_progress_base + _progress_scope, 1.0);
+        _progress_scope = std::strtod(std::string(arg).c_str(), nullptr);
+        updater_progress(_progress_base);
+    } else if (cmd == "set_progress") {
+        // set_progress <fraction>: Progress within the current part
+        double fraction = std::strtod(std::string(arg).c_str(), nullptr);
+        updater_progress(_progress_base + _progress_scope * fraction);
+    } else if (cmd == "wipe_cache"
+            || cmd == "clear_display"
+            || cmd == "enable_reboot") {
+        // Ignore
+    } else if (cmd == "ui_print") {
+        if (arg.empty()) {
+            print_buf += '\n';
+        } else {
+            print_buf += arg;
+        }
+    } else if (cmd == "log") {
+        LOGD("Updater log: %.*s", static_cast<int>(arg.size()), arg.data());
+    } else {
+        LOGE("Unknown updater command: %.*s",
+             static_cast<int>(cmd.size()), cmd.data());
+    }
+}
 
-    if (pid < 0) {
-        LOGE("Failed to fork updater fd reader process");
-    } else if (pid == 0) {
-        // Don't need command_fd in the child process
-        close(command_fd);
+/*!
+ * \brief Update the ETA for the overall progress reported by the updater
+ */
+void Installer::updater_progress(double fraction)
+{
+    if (!_eta_tracker) {
+        return;
+    }
 
-        // Read program output in child process (stdout, stderr)
-        char buf[1024];
+    auto remaining = _eta_tracker->update(fraction);
 
-        ScopedFILE fp(fdopen(stdio_fd, "rb"), fclose);
-        if (!fp) {
-            _exit(EXIT_FAILURE);
-        }
+    if (_eta_tracker->report_due(fraction)) {
+        LOGI("Updater progress: %.0f%%, about %s remaining",
+             fraction * 100, format_duration(remaining).c_str());
+    }
+}
 
-        while (fgets(buf, sizeof(buf), fp.get())) {
-            command_output(buf);
+/*!
+ * \brief Read the updater's output and command pipes until both are closed
+ *
+ * Both pipes are multiplexed with poll() in this process. Each read drains as
+ * much as the pipe holds, and all complete lines from it are handled at once:
+ * the output lines are passed to command_output() as a single chunk and the
+ * ui_print messages to a single updater_print() call. This keeps verbose
+ * updaters from being throttled by per-line writes and flushes.
+ */
+bool Installer::updater_fd_reader(int stdio_fd, int command_fd)
+{
+    std::array<pollfd, 2> fds{{
+        { stdio_fd, POLLIN, 0 },
+        { command_fd, POLLIN, 0 },
+    }};
+    std::array<std::string, 2> partial;
+    std::vector<char> buf(UPDATER_READ_BUF_SIZE);
+    std::string print_buf;
+    size_t open_fds = fds.size();
+
+    // Handle the first len bytes of partial[i], which end at a line boundary
+    // unless the pipe was closed or the line is too long
+    auto handle = [&](size_t i, size_t len) {
+        std::string_view data(partial[i].data(), len);
+
+        if (i == 0) {
+            command_output(data);
+        } else {
+            while (!data.empty()) {
+                auto pos = data.find('\n');
+                auto line = data.substr(
+                        0, pos == std::string_view::npos ? pos : pos + 1);
+                updater_command(line, print_buf);
+                data.remove_prefix(line.size());
+            }
         }
 
-        _exit(EXIT_SUCCESS);
-    } else {
-        // Read special command fd in parent process
+        partial[i].erase(0, len);
+    };
 
-        char buf[1024];
-        char *save_ptr;
+    while (open_fds > 0) {
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to poll updater pipes: %s", strerror(errno));
+            return false;
+        }
 
-        // Similar parsing to AOSP recovery
-        ScopedFILE fp(fdopen(command_fd, "rb"), fclose);
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (fds[i].fd < 0 || fds[i].revents == 0) {
+                continue;
+            }
 
-        while (fgets(buf, sizeof(buf), fp.get())) {
-            char *cmd = strtok_r(buf, " \n", &save_ptr);
-            if (!cmd) {
+            ssize_t n = read(fds[i].fd, buf.data(), buf.size());
+            if (n < 0 && errno == EINTR) {
                 continue;
-            } else if (strcmp(cmd, "progress") == 0
-                    || strcmp(cmd, "set_progress") == 0
-                    || strcmp(cmd, "wipe_cache") == 0
-                    || strcmp(cmd, "clear_display") == 0
-                    || strcmp(cmd, "enable_reboot") == 0) {
-                // Ignore
-            } else if (strcmp(cmd, "ui_print") == 0) {
-                char *str = strtok_r(nullptr, "\n", &save_ptr);
-                if (str) {
-                    updater_print(str);
-                } else {
-                    updater_print("\n");
+            } else if (n <= 0) {
+                if (n < 0) {
+                    LOGW("Failed to read updater pipe: %s", strerror(errno));
                 }
-            } else {
-                LOGE("Unknown updater command: %s", cmd);
+
+                if (!partial[i].empty()) {
+                    handle(i, partial[i].size());
+                }
+
+                // poll() ignores negative fds
+                fds[i].fd = -1;
+                --open_fds;
+                continue;
             }
-        }
 
-        do {
-            if (waitpid(pid, &status, 0) < 0) {
-                LOGE("Failed to waitpid(): %s", strerror(errno));
-                return false;
+            partial[i].append(buf.data(), static_cast<size_t>(n));
+
+            auto end = partial[i].rfind('\n');
+            if (end != std::string::npos) {
+                handle(i, end + 1);
+            } else if (partial[i].size() >= UPDATER_READ_BUF_SIZE) {
+                handle(i, partial[i].size());
             }
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+        }
 
-        return true;
+        if (!print_buf.empty()) {
+            updater_print(print_buf);
+            print_buf.clear();
+        }
     }
 
-    return false;
+    return true;
 }
 
 /*!
@@ -1108,7 +1691,7 @@ bool Installer::run_real_updater()
         "/mb/updater",
         format("%d", _interface),
         format("%d", _passthrough ? _output_fd : pipe_fds[1]),
-        "/mb/install.zip"
+        CHROOT_INSTALL_ZIP
     };
 
     std::vector<const char *> argv_c;
@@ -1169,7 +1752,7 @@ bool Installer::run_real_updater()
                 close(stdio_fds[1]);
 
                 if (!updater_fd_reader(stdio_fds[0], pipe_fds[0])) {
-                    LOGW("Updater fd reader process failed");
+                    LOGW("Failed to read updater output");
                 }
 
                 close(pipe_fds[0]);
@@ -1297,6 +1880,11 @@ void Installer::command_output(std::string_view line)
     printf("%.*s\n", static_cast<int>(line.size()), line.data());
 }
 
+void Installer::timeline_output(std::string_view line)
+{
+    LOGD("%.*s", static_cast<int>(line.size()), line.data());
+}
+
 std::unordered_map<std::string, std::string> Installer::get_properties()
 {
     return std::unordered_map<std::string, std::string>();
@@ -1370,6 +1958,10 @@ Installer::ProceedState Installer::install_stage_initialize()
         { "system.img", false },
         { "system.img.sparse", false },
     };
+    _payload_key = payload_cache_key(_zip_file);
+    LOGD("Multiboot payload key: %s",
+         _payload_key.empty() ? "(none)" : _payload_key.c_str());
+
     if (!util::archive_exists(_zip_file, info)) {
         LOGE("Failed to read zip file");
     } else {
@@ -1398,7 +1990,7 @@ Installer::ProceedState Installer::install_stage_create_chroot()
 
     display_msg("Creating chroot environment");
 
-    if (!create_chroot()) {
+    if (!timed("step", "create_chroot", [&] { return create_chroot(); })) {
         display_msg("Failed to create chroot environment");
         return ProceedState::Fail;
     }
@@ -1419,7 +2011,8 @@ Installer::ProceedState Installer::install_stage_set_up_environment()
         return ProceedState::Fail;
     }
 
-    if (!extract_multiboot_files()) {
+    if (!timed("step", "extract_multiboot_files",
+               [&] { return extract_multiboot_files(); })) {
         display_msg("Failed to extract multiboot files from zip");
         return ProceedState::Fail;
     }
@@ -1457,12 +2050,14 @@ Installer::ProceedState Installer::install_stage_check_device()
         return ProceedState::Fail;
     }
 
-    std::string prop_product_device =
-            util::property_get_string("ro.product.device", {});
-    std::string prop_build_product =
-            util::property_get_string("ro.build.product", {});
-    std::string prop_patcher_device =
-            util::property_get_string(PROP_DEVICE, {});
+    auto device_props = util::property_get_many({
+        "ro.product.device",
+        "ro.build.product",
+        PROP_DEVICE,
+    });
+    std::string prop_product_device = device_props[0].value_or("");
+    std::string prop_build_product = device_props[1].value_or("");
+    std::string prop_patcher_device = device_props[2].value_or("");
 
     LOGD("ro.product.device = %s", prop_product_device.c_str());
     LOGD("ro.build.product = %s", prop_build_product.c_str());
@@ -1498,15 +2093,17 @@ Installer::ProceedState Installer::install_stage_check_device()
         return ProceedState::Fail;
     }
 
-    auto find_existing_path = [](const std::string &path) {
-        return access(path.c_str(), R_OK) == 0;
-    };
-
     auto const &boot_devs = _device.boot_block_devs();
     auto const &recovery_devs = _device.recovery_block_devs();
     auto const &system_devs = _device.system_block_devs();
     auto const &extra_devs = _device.extra_block_devs();
 
+    // The lists usually share directories (eg. multiple by-name directories),
+    // so look the paths up in the index instead of checking each one
+    auto find_existing_path = [](const std::string &path) {
+        return BlockDevIndex::instance().exists(path);
+    };
+
     // Find boot blockdev path
     it = std::find_if(boot_devs.begin(), boot_devs.end(),
                       find_existing_path);
@@ -1542,9 +2139,15 @@ Installer::ProceedState Installer::install_stage_check_device()
 
     // Other block devices to copy
     std::vector<std::string> devs;
-    devs.insert(devs.end(), boot_devs.begin(), boot_devs.end());
-    devs.insert(devs.end(), recovery_devs.begin(), recovery_devs.end());
-    devs.insert(devs.end(), extra_devs.begin(), extra_devs.end());
+    std::unordered_set<std::string> seen_devs;
+
+    for (auto const *list : {&boot_devs, &recovery_devs, &extra_devs}) {
+        for (auto const &dev : *list) {
+            if (seen_devs.insert(dev).second) {
+                devs.push_back(dev);
+            }
+        }
+    }
 
     // Copy block devices to the chroot
     for (auto const &dev : devs) {
@@ -1643,9 +2246,24 @@ Installer::ProceedState Installer::install_stage_set_up_chroot()
 {
     LOGD("[Installer] Chroot set up stage");
 
+    // The boot image backup and the patched boot image are kept until the end
+    // of the installation. Stage them on /data if they would take up too much
+    // of the RAM on tmpfs.
+    if (auto size = util::get_blockdev_size(_boot_block_dev);
+            size && !memory_budget_allows(2 * size.value())) {
+        std::string dir(Roms::get_data_partition());
+        dir += "/.mbtool-staging";
+
+        if (log_delete_recursive(dir) && log_mkdir(dir.c_str(), 0700) == 0) {
+            LOGD("Boot images exceed memory budget; staging in %s",
+                 dir.c_str());
+            _staging_dir = std::move(dir);
+        }
+    }
+
     // Save a copy of the boot image that we'll restore if the installation fails
     if (auto r = util::copy_contents(
-            _boot_block_dev, _temp + "/boot.orig"); !r) {
+            _boot_block_dev, _staging_dir + "/boot.orig"); !r) {
         LOGE("%s", r.error().message().c_str());
         display_msg("Failed to back up boot partition");
         return ProceedState::Fail;
@@ -1672,7 +2290,7 @@ Installer::ProceedState Installer::install_stage_set_up_chroot()
     // necessary to flash something that also tries to touch /init.
     LOGV("Patching ramdisk to undo init modifications");
 
-    std::string temp_boot_img(_temp);
+    std::string temp_boot_img(_staging_dir);
     temp_boot_img += "/boot.img";
 
     if (InstallerUtil::patch_boot_image(_boot_block_dev, temp_boot_img, {
@@ -1727,10 +2345,18 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
         return ProceedState::Continue;
     }
 
-    if (!mount_dir_or_image(_cache_path,
-                            in_chroot(CHROOT_CACHE_BIND_MOUNT),
-                            in_chroot(CHROOT_CACHE_LOOP_DEV),
-                            _rom->cache_is_image, DEFAULT_IMAGE_SIZE)) {
+    // Set up the loop devices for the images at once
+    if (int images = _rom->system_is_image + _rom->cache_is_image
+            + _rom->data_is_image; images > 0) {
+        util::loopdev_pool_init(images);
+    }
+
+    if (!timed("step", "mount_dir_or_image:/cache", [&] {
+        return mount_dir_or_image(_cache_path,
+                                  in_chroot(CHROOT_CACHE_BIND_MOUNT),
+                                  in_chroot(CHROOT_CACHE_LOOP_DEV),
+                                  _rom->cache_is_image, DEFAULT_IMAGE_SIZE);
+    })) {
         return ProceedState::Fail;
     }
 
@@ -1743,10 +2369,12 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
         return ProceedState::Fail;
     }
 
-    if (!mount_dir_or_image(_data_path,
-                            in_chroot(CHROOT_DATA_BIND_MOUNT),
-                            in_chroot(CHROOT_DATA_LOOP_DEV),
-                            _rom->data_is_image, DEFAULT_IMAGE_SIZE)) {
+    if (!timed("step", "mount_dir_or_image:/data", [&] {
+        return mount_dir_or_image(_data_path,
+                                  in_chroot(CHROOT_DATA_BIND_MOUNT),
+                                  in_chroot(CHROOT_DATA_LOOP_DEV),
+                                  _rom->data_is_image, DEFAULT_IMAGE_SIZE);
+    })) {
         return ProceedState::Fail;
     }
 
@@ -1807,16 +2435,18 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
         system_path = _temp_image_path;
     }
 
-    if (!mount_dir_or_image(system_path,
-                            in_chroot(CHROOT_SYSTEM_BIND_MOUNT),
-                            in_chroot(CHROOT_SYSTEM_LOOP_DEV),
-                            system_is_image, system_size.value())) {
+    if (!timed("step", "mount_dir_or_image:/system", [&] {
+        return mount_dir_or_image(system_path,
+                                  in_chroot(CHROOT_SYSTEM_BIND_MOUNT),
+                                  in_chroot(CHROOT_SYSTEM_LOOP_DEV),
+                                  system_is_image, system_size.value());
+    })) {
         return ProceedState::Fail;
     }
 
     // Bind-mount zip file
-    (void) util::create_empty_file(in_chroot("/mb/install.zip"));
-    if (log_mount(_zip_file.c_str(), in_chroot("/mb/install.zip").c_str(),
+    (void) util::create_empty_file(in_chroot(CHROOT_INSTALL_ZIP));
+    if (log_mount(_zip_file.c_str(), in_chroot(CHROOT_INSTALL_ZIP).c_str(),
                   "", MS_BIND, "") < 0) {
         return ProceedState::Fail;
     }
@@ -1862,8 +2492,29 @@ Installer::ProceedState Installer::install_stage_installation()
     struct stat sb;
     if (lstat(in_chroot("/.skip-install").c_str(), &sb) < 0
             && errno == ENOENT) {
+        if (auto r = timed("step", "preflight_install", [&] {
+            return preflight_install(_zip_file, in_chroot("/system"));
+        })) {
+            LOGI("Preflight: %" PRIu64 " bytes in %" PRIu64 " files, "
+                 "compression ratio %.3f, decompression rate %.1f MiB/s, "
+                 "write rate %.1f MiB/s",
+                 r.value().total_bytes, r.value().file_count,
+                 r.value().compression_ratio,
+                 r.value().process_rate / (1024 * 1024),
+                 r.value().write_rate / (1024 * 1024));
+            display_msg("Estimated time: " + format_duration(r.value().eta));
+
+            _progress_base = 0;
+            _progress_scope = 0;
+            _eta_tracker.emplace(r.value().eta);
+        } else {
+            LOGW("%s: Failed to estimate installation time: %s",
+                 _zip_file.c_str(), r.error().message().c_str());
+        }
+
         auto start = steady_clock::now();
-        updater_ret = run_real_updater();
+        updater_ret = timed("step", "run_real_updater",
+                            [&] { return run_real_updater(); });
         auto stop = steady_clock::now();
         auto ms = duration_cast<milliseconds>(stop - start);
 
@@ -1895,16 +2546,12 @@ Installer::ProceedState Installer::install_stage_installation()
     run_command_chroot(_chroot, { HELPER_TOOL, "mount", "/system" });
 
     // Grab version and display ID so that can be cached in config.json later
-    if (auto props = util::property_file_get_all(in_chroot(BUILD_PROP_PATH))) {
-        auto to_cache = {
-            "ro.build.version.release",
-            "ro.build.display.id",
-        };
-
-        for (auto const &prop : to_cache) {
-            if (auto it = props->find(prop); it != props->end()) {
-                _cached_prop[it->first] = it->second;
-            }
+    if (auto props = util::property_file_get_keys(in_chroot(BUILD_PROP_PATH), {
+        "ro.build.version.release",
+        "ro.build.display.id",
+    })) {
+        for (auto &[key, value] : *props) {
+            _cached_prop[key] = std::move(value);
         }
     }
 
@@ -1988,7 +2635,7 @@ Installer::ProceedState Installer::install_stage_finish()
 
     display_msg("Patching boot image");
 
-    std::string temp_boot_img(_temp);
+    std::string temp_boot_img(_staging_dir);
     temp_boot_img += "/boot.img";
 
     if (!InstallerUtil::patch_boot_image(_boot_block_dev, temp_boot_img, {
@@ -2076,13 +2723,17 @@ void Installer::install_stage_cleanup(Installer::ProceedState ret)
 
     if (ret == ProceedState::Fail && !_boot_block_dev.empty()) {
         if (auto r = util::copy_contents(
-                _temp + "/boot.orig", _boot_block_dev); !r) {
+                _staging_dir + "/boot.orig", _boot_block_dev); !r) {
             LOGE("Failed to restore boot partition: %s",
                  r.error().message().c_str());
             display_msg("Failed to restore boot partition");
         }
     }
 
+    if (_staging_dir != _temp) {
+        (void) util::delete_recursive(_staging_dir);
+    }
+
     if (!destroy_chroot()) {
         display_msg("Failed to destroy chroot environment. You should "
                     "reboot into recovery again to avoid flashing issues.");
@@ -2102,44 +2753,68 @@ bool Installer::start_installation()
         _ran = true;
     }
 
+    _timeline_start = std::chrono::steady_clock::now();
+
     ProceedState ret = ProceedState::Fail;
 
     auto when_finished = finally([&] {
-        install_stage_cleanup(ret);
+        reset_peak_rss();
+        timed("stage", "cleanup", [&] {
+            install_stage_cleanup(ret);
+            return true;
+        });
+
+        record_timing("total", "installation", _timeline_start,
+                      ret != ProceedState::Fail);
     });
 
+    auto run_stage = [this](const char *name,
+                            ProceedState (Installer::*stage)()) {
+        reset_peak_rss();
+        return timed("stage", name, [&] { return (this->*stage)(); });
+    };
+
 
-    ret = install_stage_initialize();
+    ret = run_stage("initialize",
+            &Installer::install_stage_initialize);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_create_chroot();
+    ret = run_stage("create_chroot",
+            &Installer::install_stage_create_chroot);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_set_up_environment();
+    ret = run_stage("set_up_environment",
+            &Installer::install_stage_set_up_environment);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_check_device();
+    ret = run_stage("check_device",
+            &Installer::install_stage_check_device);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_get_install_type();
+    ret = run_stage("get_install_type",
+            &Installer::install_stage_get_install_type);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_set_up_chroot();
+    ret = run_stage("set_up_chroot",
+            &Installer::install_stage_set_up_chroot);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_mount_filesystems();
+    ret = run_stage("mount_filesystems",
+            &Installer::install_stage_mount_filesystems);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ProceedState install_ret = install_stage_installation();
+    ProceedState install_ret = run_stage("installation",
+            &Installer::install_stage_installation);
 
-    ret = install_stage_unmount_filesystems();
+    ret = run_stage("unmount_filesystems",
+            &Installer::install_stage_unmount_filesystems);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
@@ -2147,7 +2822,8 @@ bool Installer::start_installation()
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_finish();
+    ret = run_stage("finish",
+            &Installer::install_stage_finish);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
@@ -21,6 +21,7 @@
 
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include <cerrno>
 #include <cstdio>
@@ -31,301 +32,58 @@
 #include <sys/stat.h>
 
 #include <archive.h>
-#include <archive_entry.h>
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
 #include "mbbootimg/writer.h"
 
-#include "mbcommon/file.h"
-#include "mbcommon/file_util.h"
-#include "mbcommon/file/standard.h"
-#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 
 #include "mblog/logging.h"
 
-#include "mbutil/delete.h"
+#include "mbutil/compress.h"
 #include "mbutil/path.h"
 
 #include "recovery/bootimg_util.h"
+#include "recovery/kernel_patcher.h"
 #include "util/multiboot.h"
 
 #define LOG_TAG "mbtool/recovery/installer_util"
 
 using namespace mb::bootimg;
 
-typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
-typedef std::unique_ptr<archive_entry, decltype(archive_entry_free) *> ScopedArchiveEntry;
 typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
 
 namespace mb
 {
 
-bool InstallerUtil::unpack_ramdisk(const std::string &input_file,
-                                   const std::string &output_dir,
-                                   int &format_out,
-                                   std::vector<int> &filters_out)
-{
-    ScopedArchive ain(archive_read_new(), archive_read_free);
-    ScopedArchive aout(archive_write_disk_new(), archive_write_free);
-
-    if (!ain || !aout) {
-        LOGE("Failed to allocate archive reader or writer instance");
-        return false;
-    }
-
-    archive_read_support_filter_gzip(ain.get());
-    archive_read_support_filter_lz4(ain.get());
-    archive_read_support_filter_lzma(ain.get());
-    archive_read_support_filter_xz(ain.get());
-    archive_read_support_format_cpio(ain.get());
-
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(aout.get());
-    archive_write_disk_set_options(aout.get(),
-                                   ARCHIVE_EXTRACT_TIME
-                                 | ARCHIVE_EXTRACT_SECURE_SYMLINKS
-                                 | ARCHIVE_EXTRACT_SECURE_NODOTDOT
-                                 | ARCHIVE_EXTRACT_OWNER
-                                 | ARCHIVE_EXTRACT_PERM);
-
-    if (archive_read_open_filename(ain.get(), input_file.c_str(), 10240)
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    // Can't use O_PATH because we support devices running kernel <3.5
-    int cwd_fd = open(".", O_DIRECTORY | O_CLOEXEC);
-    if (cwd_fd < 0) {
-        LOGE("Failed to open current directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto close_cwd_fd = finally([&] {
-        if (fchdir(cwd_fd) < 0) {
-            LOGW("Failed to change back to previous directory: %s",
-                 strerror(errno));
-        }
-
-        close(cwd_fd);
-    });
-
-    if (chdir(output_dir.c_str()) < 0) {
-        LOGE("%s: Failed to change directory: %s",
-             output_dir.c_str(), strerror(errno));
-        return false;
-    }
-
-    while (true) {
-        archive_entry *entry;
-
-        int ret = archive_read_next_header(ain.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 input_file.c_str(), archive_error_string(ain.get()));
-            return false;
-        }
-
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", input_file.c_str());
-            return false;
-        }
-
-        // Don't allow absolute paths (libarchive will reject '..'s)
-        while (*path && *path == '/') {
-            ++path;
-        }
+static constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
 
-        archive_entry_set_pathname(entry, path);
-
-        // Extract file
-        ret = archive_read_extract2(ain.get(), entry, aout.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to extract file: %s", path,
-                 archive_error_string(ain.get()));
-            return false;
-        }
-    }
-
-    // Save format
-    format_out = archive_format(ain.get());
-    filters_out.clear();
-    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
-        int code = archive_filter_code(ain.get(), i);
-        if (code != ARCHIVE_FILTER_NONE) {
-            filters_out.push_back(code);
-        }
-    }
-
-    if (archive_read_close(ain.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", input_file.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    return true;
-}
-
-static int metadata_filter(archive *a, void *data, archive_entry *entry)
+/*!
+ * \brief Get the libarchive filter for a boot image entry compression format
+ */
+static std::optional<int> compression_filter(Compression compression)
 {
-    (void) data;
-    (void) entry;
-
-    if (archive_read_disk_can_descend(a)) {
-        archive_read_disk_descend(a);
+    switch (compression) {
+    case Compression::Gzip:
+        return ARCHIVE_FILTER_GZIP;
+    case Compression::Lz4Legacy:
+    case Compression::Lz4Frame:
+        return ARCHIVE_FILTER_LZ4;
+    case Compression::Xz:
+        return ARCHIVE_FILTER_XZ;
+    case Compression::Lzma:
+        return ARCHIVE_FILTER_LZMA;
+    default:
+        return std::nullopt;
     }
-    return 1;
-}
-
-bool InstallerUtil::pack_ramdisk(const std::string &input_dir,
-                                 const std::string &output_file,
-                                 int format,
-                                 const std::vector<int> &filters)
-{
-    ScopedArchive ain(archive_read_disk_new(), archive_read_free);
-    ScopedArchive aout(archive_write_new(), archive_write_free);
-    ScopedArchiveEntry entry(archive_entry_new(), archive_entry_free);
-    std::string full_path;
-    int ret;
-
-    if (!ain || !aout || !entry) {
-        LOGE("Failed to allocate archive reader, writer, or entry instance");
-        return false;
-    }
-
-    // Set up disk reader parameters
-    archive_read_disk_set_symlink_physical(ain.get());
-    archive_read_disk_set_metadata_filter_callback(
-            ain.get(), metadata_filter, nullptr);
-    // We don't want to look up usernames and group names on Android
-    //archive_read_disk_set_standard_lookup(in.get());
-
-    if (archive_write_set_format(aout.get(), format) != ARCHIVE_OK) {
-        LOGE("Failed to set output archive format: %s",
-             archive_error_string(aout.get()));
-        return false;
-    }
-    for (const int &filter : filters) {
-        if (archive_write_add_filter(aout.get(), filter) != ARCHIVE_OK) {
-            LOGE("Failed to add output archive filter: %s",
-                 archive_error_string(aout.get()));
-            return false;
-        }
-    }
-
-    archive_write_set_bytes_per_block(aout.get(), 512);
-
-    // Open output file
-    if (archive_write_open_filename(aout.get(), output_file.c_str())
-            != ARCHIVE_OK) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    ret = archive_read_disk_open(ain.get(), input_dir.c_str());
-    if (ret != ARCHIVE_OK) {
-        LOGE("%s: %s", input_dir.c_str(), archive_error_string(ain.get()));
-        return false;
-    }
-
-    while (true) {
-        // libarchive doesn't clear the entry automatically
-        archive_entry_clear(entry.get());
-
-        ret = archive_read_next_header2(ain.get(), entry.get());
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read next header: %s", input_dir.c_str(),
-                 archive_error_string(ain.get()));
-            return false;
-        }
-
-        if (archive_entry_filetype(entry.get()) != AE_IFREG) {
-            archive_entry_set_size(entry.get(), 0);
-        }
-
-        const char *curpath = archive_entry_pathname(entry.get());
-        if (curpath && !input_dir.empty()) {
-            auto relpath = util::relative_path(curpath, input_dir);
-            if (!relpath) {
-                LOGE("Failed to compute relative path of %s starting at %s: %s",
-                     curpath, input_dir.c_str(),
-                     relpath.error().message().c_str());
-                return false;
-            }
-            if (relpath.value().empty()) {
-                // If the relative path is empty, then the current path is
-                // the root of the directory tree. We don't need that, so
-                // skip it.
-                continue;
-            }
-            archive_entry_set_pathname(entry.get(), relpath.value().c_str());
-        }
-
-        ret = archive_write_header(aout.get(), entry.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", output_file.c_str(),
-                 archive_error_string(aout.get()));
-            return false;
-        }
-
-        char buf[10240];
-        la_ssize_t n;
-
-        if (archive_entry_size(entry.get()) > 0) {
-            while ((n = archive_read_data(ain.get(), buf, sizeof(buf))) > 0) {
-                if (archive_write_data(aout.get(), buf, static_cast<size_t>(n))
-                        != n) {
-                    LOGE("Failed to write archive entry data: %s",
-                         archive_error_string(aout.get()));
-                    return false;
-                }
-            }
-
-            if (n < 0) {
-                LOGE("Failed to read archive entry data: %s",
-                     archive_error_string(ain.get()));
-                return false;
-            }
-        }
-    }
-
-    archive_read_close(ain.get());
-
-    if (archive_write_close(aout.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", output_file.c_str(), archive_error_string(aout.get()));
-        return false;
-    }
-
-    return true;
 }
 
 bool InstallerUtil::patch_boot_image(const std::string &input_file,
                                      const std::string &output_file,
                                      const std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
-    std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
-
-    // std::string is guaranteed to be contiguous in C++11
-    if (!mkdtemp(tmpdir.data())) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
-        return false;
-    }
-
-    auto delete_temp_dir = finally([&]{
-        (void) util::delete_recursive(tmpdir);
-    });
-
     Reader reader;
     Writer writer;
 
@@ -423,49 +181,13 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
             if (type == EntryType::Ramdisk) {
                 LOGD("%s: Writing patched ramdisk", output_file.c_str());
 
-                std::string ramdisk_in(tmpdir);
-                ramdisk_in += "/ramdisk.in";
-                std::string ramdisk_out(tmpdir);
-                ramdisk_out += "/ramdisk.out";
-
-                auto delete_temp_files = finally([&]{
-                    unlink(ramdisk_in.c_str());
-                    unlink(ramdisk_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(reader, ramdisk_in)) {
-                    return false;
-                }
-
-                if (!patch_ramdisk(ramdisk_in, ramdisk_out, 0, rps)) {
-                    return false;
-                }
-
-                if (!bi_copy_file_to_data(ramdisk_out, writer)) {
+                if (!patch_ramdisk_entry(reader, writer, rps)) {
                     return false;
                 }
             } else if (type == EntryType::Kernel) {
                 LOGD("%s: Writing patched kernel", output_file.c_str());
 
-                std::string kernel_in(tmpdir);
-                kernel_in += "/kernel.in";
-                std::string kernel_out(tmpdir);
-                kernel_out += "/kernel.out";
-
-                auto delete_temp_files = finally([&]{
-                    unlink(kernel_in.c_str());
-                    unlink(kernel_out.c_str());
-                });
-
-                if (!bi_copy_data_to_file(reader, kernel_in)) {
-                    return false;
-                }
-
-                if (!patch_kernel_rkp(kernel_in, kernel_out)) {
-                    return false;
-                }
-
-                if (!bi_copy_file_to_data(kernel_out, writer)) {
+                if (!patch_kernel(reader, writer)) {
                     return false;
                 }
             } else {
@@ -488,60 +210,86 @@ bool InstallerUtil::patch_boot_image(const std::string &input_file,
     return true;
 }
 
-bool InstallerUtil::patch_ramdisk(const std::string &input_file,
-                                  const std::string &output_file,
-                                  unsigned int depth,
-                                  const std::vector<std::function<RamdiskPatcherFn>> &rps)
+/*!
+ * \brief Patch the ramdisk entry of a boot image
+ *
+ * The ramdisk is decompressed by an entry stream from \p reader into a
+ * CpioArchive and, after patching, streamed from the compressor straight to
+ * \p writer. Reading and decompressing the entry runs concurrently with
+ * parsing the archive and the compressed output is written while later blocks
+ * are still being compressed, so the only full copy of the ramdisk is the
+ * uncompressed archive in memory.
+ */
+bool InstallerUtil::patch_ramdisk_entry(Reader &reader, Writer &writer,
+                                        const std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
-    if (depth > 1) {
-        LOGV("Ignoring doubly-nested ramdisk");
-        return true;
-    }
+    CpioArchive cpio;
 
-    std::string tmpdir = format("%s.XXXXXX", output_file.c_str());
-
-    if (!mkdtemp(tmpdir.data())) {
-        LOGE("Failed to create temporary directory: %s", strerror(errno));
+    auto stream = reader.open_entry_stream(EntryType::Ramdisk);
+    if (!stream) {
+        LOGE("Failed to open ramdisk entry: %s",
+             stream.error().message().c_str());
         return false;
     }
 
-    auto delete_temp_dir = finally([&]{
-        (void) util::delete_recursive(tmpdir);
-    });
+    auto read_fn = [&](std::string &chunk) {
+        chunk.resize(COPY_BUFFER_SIZE);
 
-    int format;
-    std::vector<int> filters;
+        auto n = stream.value()->read(chunk.data(), chunk.size());
+        if (!n) {
+            LOGE("Failed to read boot image entry data: %s",
+                 n.error().message().c_str());
+            return false;
+        }
 
-    // Extract ramdisk
-    if (!unpack_ramdisk(input_file, tmpdir, format, filters)) {
-        return false;
-    }
+        chunk.resize(n.value());
+        return true;
+    };
 
-    // Patch ramdisk
-    std::string nested(tmpdir);
-    nested += "/sbin/ramdisk.cpio";
-    struct stat sb;
-    bool ret;
+    auto write_fn = [&](std::string_view chunk) {
+        return bi_copy_string_to_data(chunk, writer);
+    };
 
-    if (stat(nested.c_str(), &sb) == 0) {
-        ret = patch_ramdisk(nested, nested, depth + 1, rps);
-    } else {
-        ret = patch_ramdisk_dir(tmpdir, rps);
+    if (!cpio.load_stream(read_fn)) {
+        return false;
     }
 
-    // Pack ramdisk
-    if (!pack_ramdisk(tmpdir, output_file, format, filters)) {
-        return false;
+    // Recompress with the original format
+    if (auto filter = compression_filter(stream.value()->compression())) {
+        cpio.set_filters({*filter});
     }
 
-    return ret;
+    return patch_ramdisk(cpio, 0, rps)
+            && cpio.save_stream(write_fn);
 }
 
-bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
-                                      const std::vector<std::function<RamdiskPatcherFn>> &rps)
+/*!
+ * \brief Patch a ramdisk in memory
+ *
+ * If the ramdisk contains a nested ramdisk at `sbin/ramdisk.cpio` (eg. on some
+ * Sony devices), the nested ramdisk is patched instead.
+ */
+bool InstallerUtil::patch_ramdisk(CpioArchive &cpio,
+                                  unsigned int depth,
+                                  const std::vector<std::function<RamdiskPatcherFn>> &rps)
 {
+    if (depth > 1) {
+        LOGV("Ignoring doubly-nested ramdisk");
+        return true;
+    }
+
+    if (auto data = cpio.contents("sbin/ramdisk.cpio")) {
+        CpioArchive nested;
+
+        return nested.load_data(data.value())
+                && patch_ramdisk(nested, depth + 1, rps)
+                && nested.save_data(data.value())
+                && cpio.set_contents("sbin/ramdisk.cpio",
+                                     std::move(data.value()));
+    }
+
     for (auto const &rp : rps) {
-        if (!rp(ramdisk_dir)) {
+        if (!rp(cpio)) {
             return false;
         }
     }
@@ -549,106 +297,103 @@ bool InstallerUtil::patch_ramdisk_dir(const std::string &ramdisk_dir,
     return true;
 }
 
-bool InstallerUtil::patch_kernel_rkp(const std::string &input_file,
-                                     const std::string &output_file)
+/*!
+ * \brief Copy the kernel entry of a boot image, applying the kernel patches
+ *
+ * Raw kernels are streamed from \p reader to \p writer through a
+ * KernelPatcher. gzip and LZ4 legacy compressed kernels are decompressed,
+ * patched, and recompressed with the same format. If no patch applies to a
+ * compressed kernel, the original data is written unchanged. Any data after
+ * the end of the compressed stream (eg. an appended device tree) is kept.
+ */
+bool InstallerUtil::patch_kernel(Reader &reader, Writer &writer)
 {
-    // We'll use SuperSU's patch for negating the effects of
-    // CONFIG_RKP_NS_PROT=y in newer Samsung kernels. This kernel feature
-    // prevents exec()'ing anything as a privileged user unless the binary
-    // resides in rootfs or whichever filesystem was first mounted at /system.
-    //
-    // It is trivial to update mbtool to only use rootfs, but we need to
-    // override fsck tools by bind-mounting dummy binaries from an ext4 image
-    // when booting from an external SD. Unless we patch the SELinux policy to
-    // allow vold to execute u:r:rootfs:s0-labeled fsck binaries, this patch
-    // must remain.
-
-    static const unsigned char source_pattern[] = {
-        0x49, 0x01, 0x00, 0x54, 0x01, 0x14, 0x40, 0xB9, 0x3F, 0xA0,
-        0x0F, 0x71, 0xE9, 0x00, 0x00, 0x54, 0x01, 0x08, 0x40, 0xB9,
-        0x3F, 0xA0, 0x0F, 0x71, 0x89, 0x00, 0x00, 0x54, 0x00, 0x18,
-        0x40, 0xB9, 0x1F, 0xA0, 0x0F, 0x71, 0x88, 0x01, 0x00, 0x54,
-    };
-    static const unsigned char target_pattern[] = {
-        0xA1, 0x02, 0x00, 0x54, 0x01, 0x14, 0x40, 0xB9, 0x3F, 0xA0,
-        0x0F, 0x71, 0x40, 0x02, 0x00, 0x54, 0x01, 0x08, 0x40, 0xB9,
-        0x3F, 0xA0, 0x0F, 0x71, 0xE0, 0x01, 0x00, 0x54, 0x00, 0x18,
-        0x40, 0xB9, 0x1F, 0xA0, 0x0F, 0x71, 0x81, 0x01, 0x00, 0x54,
-    };
+    auto const &patches = default_kernel_patches();
 
-    StandardFile fin;
-    StandardFile fout;
-    std::optional<uint64_t> offset;
+    std::vector<char> chunk(COPY_BUFFER_SIZE);
+    std::optional<util::ParallelFormat> format;
+    bool first = true;
 
-    // Open input file
-    auto open_ret = fin.open(input_file, FileOpenMode::ReadOnly);
-    if (!open_ret) {
-        LOGE("%s: Failed to open for reading: %s",
-             input_file.c_str(), open_ret.error().message().c_str());
-        return false;
-    }
+    // Used for raw kernels
+    std::optional<KernelPatcher> raw_patcher;
 
-    // Open output file
-    open_ret = fout.open(output_file, FileOpenMode::WriteOnly);
-    if (!open_ret) {
-        LOGE("%s: Failed to open for writing: %s",
-             output_file.c_str(), open_ret.error().message().c_str());
-        return false;
-    }
-
-    FileSearcher searcher(&fin, source_pattern, sizeof(source_pattern));
+    // Used for compressed kernels
+    std::string original;
+    std::string recompressed;
+    std::optional<util::ParallelCompressor> compressor;
+    std::optional<KernelPatcher> patcher;
+    std::optional<util::StreamDecompressor> decompressor;
 
-    if (auto r = searcher.next()) {
-        offset = r.value();
-    } else {
-        LOGE("%s: Error when searching for pattern: %s",
-             input_file.c_str(), r.error().message().c_str());
-        return false;
-    }
+    while (true) {
+        auto n = reader.read_data(chunk.data(), chunk.size());
+        if (!n) {
+            LOGE("Failed to read boot image entry data: %s",
+                 n.error().message().c_str());
+            return false;
+        }
 
-    // Copy data
-    auto seek_ret = fin.seek(0, SEEK_SET);
-    if (!seek_ret) {
-        LOGE("%s: Failed to seek to beginning: %s",
-             input_file.c_str(), seek_ret.error().message().c_str());
-        return false;
-    }
+        if (first) {
+            first = false;
+            format = util::StreamDecompressor::detect_format(
+                    {chunk.data(), n.value()});
 
-    if (offset) {
-        LOGD("RKP pattern found at offset: 0x%" PRIx64, *offset);
+            if (format) {
+                LOGD("Kernel is compressed; patching decompressed data");
 
-        if (!copy_file_to_file(fin, fout, *offset)) {
-            return false;
+                compressor.emplace(*format, [&](std::string_view data) {
+                    recompressed += data;
+                    return true;
+                });
+                patcher.emplace(patches, [&](std::string_view data) {
+                    return compressor->write(data.data(), data.size());
+                });
+                decompressor.emplace(*format, [&](std::string_view data) {
+                    return patcher->write(data.data(), data.size());
+                });
+            } else {
+                raw_patcher.emplace(patches, [&](std::string_view data) {
+                    return bi_copy_string_to_data(data, writer);
+                });
+            }
         }
 
-        seek_ret = fin.seek(sizeof(source_pattern), SEEK_CUR);
-        if (!seek_ret) {
-            LOGE("%s: Failed to skip pattern: %s",
-                 input_file.c_str(), seek_ret.error().message().c_str());
-            return false;
+        if (n.value() == 0) {
+            break;
         }
 
-        auto ret = file_write_exact(fout, target_pattern,
-                                    sizeof(target_pattern));
-        if (!ret) {
-            LOGE("%s: Failed to write target pattern: %s",
-                 output_file.c_str(), ret.error().message().c_str());
-            return false;
+        if (raw_patcher) {
+            if (!raw_patcher->write(chunk.data(), n.value())) {
+                return false;
+            }
+        } else {
+            original.append(chunk.data(), n.value());
+
+            if (!decompressor->write(chunk.data(), n.value())) {
+                LOGE("Failed to decompress kernel");
+                return false;
+            }
         }
     }
 
-    if (!copy_file_to_file_eof(fin, fout)) {
-        return false;
+    if (raw_patcher) {
+        return raw_patcher->finish();
+    } else if (!decompressor) {
+        // Empty kernel
+        return true;
     }
 
-    auto close_ret = fout.close();
-    if (!close_ret) {
-        LOGE("%s: Failed to close file: %s",
-             output_file.c_str(), close_ret.error().message().c_str());
+    if (!decompressor->finish() || !patcher->finish()
+            || !compressor->finish()) {
+        LOGE("Failed to recompress kernel");
         return false;
     }
 
-    return true;
+    if (patcher->total_matches() == 0) {
+        return bi_copy_string_to_data(original, writer);
+    }
+
+    return bi_copy_string_to_data(recompressed, writer)
+            && bi_copy_string_to_data(decompressor->trailing_data(), writer);
 }
 
 bool InstallerUtil::replace_file(const std::string &replace,
@@ -687,54 +432,4 @@ bool InstallerUtil::replace_file(const std::string &replace,
     return true;
 }
 
-bool InstallerUtil::copy_file_to_file(File &fin, File &fout, uint64_t to_copy)
-{
-    char buf[10240];
-
-    while (to_copy > 0) {
-        size_t to_read = static_cast<size_t>(
-                std::min<uint64_t>(to_copy, sizeof(buf)));
-
-        auto n = file_read_retry(fin, buf, to_read);
-        if (!n || n.value() != to_read) {
-            LOGE("Failed to read data: %s", n.error().message().c_str());
-            return false;
-        }
-
-        n = file_write_retry(fout, buf, to_read);
-        if (!n || n.value() != to_read) {
-            LOGE("Failed to write data: %s", n.error().message().c_str());
-            return false;
-        }
-
-        to_copy -= to_read;
-    }
-
-    return true;
-}
-
-bool InstallerUtil::copy_file_to_file_eof(File &fin, File &fout)
-{
-    char buf[10240];
-
-    while (true) {
-        auto n_read = file_read_retry(fin, buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read data: %s", n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
-
-        auto n_written = file_write_retry(fout, buf, n_read.value());
-        if (!n_written || n_written.value() != n_read.value()) {
-            LOGE("Failed to write data: %s",
-                 n_written.error().message().c_str());
-            return false;
-        }
-    }
-
-    return true;
-}
-
 }
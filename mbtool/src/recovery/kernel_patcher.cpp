@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/kernel_patcher.h"
+
+#include <algorithm>
+#include <deque>
+
+#include <cinttypes>
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/recovery/kernel_patcher"
+
+namespace mb
+{
+
+/*!
+ * \brief Get the patches that are applied to every kernel
+ */
+const std::vector<KernelPatch> & default_kernel_patches()
+{
+    // We'll use SuperSU's patch for negating the effects of
+    // CONFIG_RKP_NS_PROT=y in newer Samsung kernels. This kernel feature
+    // prevents exec()'ing anything as a privileged user unless the binary
+    // resides in rootfs or whichever filesystem was first mounted at /system.
+    //
+    // It is trivial to update mbtool to only use rootfs, but we need to
+    // override fsck tools by bind-mounting dummy binaries from an ext4 image
+    // when booting from an external SD. Unless we patch the SELinux policy to
+    // allow vold to execute u:r:rootfs:s0-labeled fsck binaries, this patch
+    // must remain.
+    static constexpr char rkp_ns_prot_source[] = {
+        '\x49', '\x01', '\x00', '\x54', '\x01', '\x14', '\x40', '\xB9',
+        '\x3F', '\xA0', '\x0F', '\x71', '\xE9', '\x00', '\x00', '\x54',
+        '\x01', '\x08', '\x40', '\xB9', '\x3F', '\xA0', '\x0F', '\x71',
+        '\x89', '\x00', '\x00', '\x54', '\x00', '\x18', '\x40', '\xB9',
+        '\x1F', '\xA0', '\x0F', '\x71', '\x88', '\x01', '\x00', '\x54',
+    };
+    static constexpr char rkp_ns_prot_target[] = {
+        '\xA1', '\x02', '\x00', '\x54', '\x01', '\x14', '\x40', '\xB9',
+        '\x3F', '\xA0', '\x0F', '\x71', '\x40', '\x02', '\x00', '\x54',
+        '\x01', '\x08', '\x40', '\xB9', '\x3F', '\xA0', '\x0F', '\x71',
+        '\xE0', '\x01', '\x00', '\x54', '\x00', '\x18', '\x40', '\xB9',
+        '\x1F', '\xA0', '\x0F', '\x71', '\x81', '\x01', '\x00', '\x54',
+    };
+
+    static const std::vector<KernelPatch> patches{
+        {
+            "RKP namespace protection",
+            {rkp_ns_prot_source, sizeof(rkp_ns_prot_source)},
+            {rkp_ns_prot_target, sizeof(rkp_ns_prot_target)},
+            1,
+            1,
+        },
+    };
+
+    return patches;
+}
+
+/*!
+ * \class KernelPatcher
+ *
+ * \brief Applies a table of byte patches to a kernel in a single pass
+ *
+ * All patterns are matched at once with an Aho-Corasick automaton, so adding
+ * patches does not add passes over the kernel. The data is streamed to the
+ * write callback and only the last `longest pattern - 1` bytes are held back
+ * so that a match spanning two writes can still be patched.
+ *
+ * Matches are found in the original data. A match that overlaps a region that
+ * was already patched is skipped.
+ */
+
+/*!
+ * \brief Construct a patcher
+ *
+ * \param patches Patch table. It must outlive the patcher and every pattern
+ *                must be non-empty and the same size as its replacement.
+ * \param write_fn Function to call with each chunk of output
+ */
+KernelPatcher::KernelPatcher(const std::vector<KernelPatch> &patches,
+                             WriteFn write_fn)
+    : m_patches(patches)
+    , m_write_fn(std::move(write_fn))
+    , m_state(0)
+    , m_max_len(0)
+    , m_buf_offset(0)
+    , m_patched_end(0)
+    , m_matches(patches.size())
+{
+    build();
+}
+
+void KernelPatcher::build()
+{
+    m_states.clear();
+    m_states.emplace_back();
+    std::fill(std::begin(m_states[0].next), std::end(m_states[0].next), -1);
+
+    // Build the trie
+    for (size_t i = 0; i < m_patches.size(); ++i) {
+        auto const &pattern = m_patches[i].pattern;
+        int32_t s = 0;
+
+        for (char c : pattern) {
+            auto b = static_cast<unsigned char>(c);
+
+            if (m_states[static_cast<size_t>(s)].next[b] < 0) {
+                m_states[static_cast<size_t>(s)].next[b] =
+                        static_cast<int32_t>(m_states.size());
+                m_states.emplace_back();
+                std::fill(std::begin(m_states.back().next),
+                          std::end(m_states.back().next), -1);
+            }
+
+            s = m_states[static_cast<size_t>(s)].next[b];
+        }
+
+        m_states[static_cast<size_t>(s)].outputs.push_back(
+                static_cast<uint16_t>(i));
+        m_max_len = std::max(m_max_len, pattern.size());
+    }
+
+    // Turn it into a DFA by following the failure links breadth first
+    std::vector<int32_t> fail(m_states.size(), 0);
+    std::deque<int32_t> queue;
+
+    for (auto &next : m_states[0].next) {
+        if (next < 0) {
+            next = 0;
+        } else {
+            queue.push_back(next);
+        }
+    }
+
+    while (!queue.empty()) {
+        auto s = static_cast<size_t>(queue.front());
+        queue.pop_front();
+
+        auto const &inherited = m_states[static_cast<size_t>(fail[s])].outputs;
+        m_states[s].outputs.insert(m_states[s].outputs.end(),
+                                   inherited.begin(), inherited.end());
+
+        for (size_t b = 0; b < 256; ++b) {
+            auto &next = m_states[s].next[b];
+            auto fallback = m_states[static_cast<size_t>(fail[s])].next[b];
+
+            if (next < 0) {
+                next = fallback;
+            } else {
+                fail[static_cast<size_t>(next)] = fallback;
+                queue.push_back(next);
+            }
+        }
+    }
+}
+
+/*!
+ * \brief Scan and patch data
+ *
+ * \return Whether all data that can no longer be patched was written
+ *         successfully
+ */
+bool KernelPatcher::write(const void *data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+    uint64_t offset = m_buf_offset + m_buf.size();
+
+    m_buf.append(reinterpret_cast<const char *>(ptr), size);
+
+    for (size_t i = 0; i < size; ++i) {
+        m_state = m_states[static_cast<size_t>(m_state)].next[ptr[i]];
+
+        for (auto index : m_states[static_cast<size_t>(m_state)].outputs) {
+            on_match(index, offset + i + 1);
+        }
+    }
+
+    // Keep enough data to patch a match that spans two writes
+    size_t keep = std::min(m_buf.size(), m_max_len > 0 ? m_max_len - 1 : 0);
+    size_t to_write = m_buf.size() - keep;
+
+    if (to_write > 0) {
+        if (!m_write_fn({m_buf.data(), to_write})) {
+            return false;
+        }
+
+        m_buf.erase(0, to_write);
+        m_buf_offset += to_write;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write the remaining data
+ *
+ * Patches that did not match are logged, but are not an error.
+ */
+bool KernelPatcher::finish()
+{
+    if (!m_buf.empty()) {
+        if (!m_write_fn(m_buf)) {
+            return false;
+        }
+
+        m_buf_offset += m_buf.size();
+        m_buf.clear();
+    }
+
+    for (size_t i = 0; i < m_patches.size(); ++i) {
+        if (m_matches[i] == 0) {
+            LOGD("Kernel patch not applicable: %s", m_patches[i].name);
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get number of times a patch was applied
+ */
+size_t KernelPatcher::matches(size_t index) const
+{
+    return m_matches[index];
+}
+
+/*!
+ * \brief Get number of times any patch was applied
+ */
+size_t KernelPatcher::total_matches() const
+{
+    size_t total = 0;
+    for (auto n : m_matches) {
+        total += n;
+    }
+    return total;
+}
+
+void KernelPatcher::on_match(size_t index, uint64_t end)
+{
+    auto const &patch = m_patches[index];
+    uint64_t start = end - patch.pattern.size();
+
+    if (patch.max_matches != 0 && m_matches[index] >= patch.max_matches) {
+        return;
+    } else if (patch.alignment > 1 && start % patch.alignment != 0) {
+        return;
+    } else if (start < m_patched_end) {
+        LOGW("%s: Skipping match at 0x%" PRIx64 " that overlaps another patch",
+             patch.name, start);
+        return;
+    }
+
+    LOGD("%s: Patching match at offset 0x%" PRIx64, patch.name, start);
+
+    // The buffer always holds the last m_max_len - 1 bytes, so the whole match
+    // is still in it
+    m_buf.replace(static_cast<size_t>(start - m_buf_offset),
+                  patch.replacement.size(), patch.replacement);
+
+    m_patched_end = end;
+    ++m_matches[index];
+}
+
+}
@@ -0,0 +1,612 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/preflight.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/dir_walker.h"
+
+// minizip
+#include "mz.h"
+#include "mz_strm_android.h"
+#include "mz_strm_buf.h"
+#include "mz_zip.h"
+
+#include "boot/directory_size.h"
+
+#define LOG_TAG "mbtool/recovery/preflight"
+
+namespace mb
+{
+
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+//! Amount of file data to sample for the compression ratio and rate
+static constexpr uint64_t SAMPLE_SIZE = 8 * 1024 * 1024;
+//! Largest file to include in the sample
+static constexpr uint64_t SAMPLE_MAX_FILE_SIZE = 1024 * 1024;
+//! Maximum number of files to include in the sample
+static constexpr size_t SAMPLE_MAX_FILES = 512;
+//! Amount of data to write when sampling the write rate
+static constexpr size_t WRITE_SAMPLE_SIZE = 8 * 1024 * 1024;
+//! Name of the temporary files created in the output directory
+static constexpr char SAMPLE_NAME[] = ".mbtool-preflight";
+
+//! Minimum time between ETA reports
+static constexpr auto REPORT_INTERVAL = 10s;
+//! Progress that triggers an ETA report regardless of the interval
+static constexpr double REPORT_STEP = 0.1;
+//! Interval at which ProgressMonitor polls the progress
+static constexpr auto POLL_INTERVAL = 2s;
+
+namespace
+{
+
+/*!
+ * \brief Collect a sample of small regular files from a tree
+ *
+ * The paths are relative to the root of the tree. Files with multiple links
+ * are skipped so that the sample does not contain hard link entries.
+ */
+class SampleWalker : public util::DirWalker
+{
+public:
+    explicit SampleWalker(const std::string &path)
+        : DirWalker(path, util::DirWalkerFlag::GroupSpecialFiles)
+        , _prefix_len(path.size() + (path.back() == '/' ? 0 : 1))
+        , _size(0)
+    {
+    }
+
+    Actions on_reached_file() override
+    {
+        auto const *sb = _curr->fts_statp;
+        auto size = static_cast<uint64_t>(sb->st_size);
+
+        if (size == 0 || size > SAMPLE_MAX_FILE_SIZE || sb->st_nlink > 1) {
+            return Action::Ok;
+        }
+
+        _paths.emplace_back(_curr->fts_path + _prefix_len);
+        _size += size;
+
+        if (_size >= SAMPLE_SIZE || _paths.size() >= SAMPLE_MAX_FILES) {
+            return Action::Stop;
+        }
+
+        return Action::Ok;
+    }
+
+    const std::vector<std::string> & paths() const
+    {
+        return _paths;
+    }
+
+    uint64_t size() const
+    {
+        return _size;
+    }
+
+private:
+    size_t _prefix_len;
+    std::vector<std::string> _paths;
+    uint64_t _size;
+};
+
+}
+
+static double seconds_since(steady_clock::time_point start)
+{
+    return duration<double>(steady_clock::now() - start).count();
+}
+
+static seconds compute_eta(const PreflightEstimate &estimate,
+                           uint64_t write_bytes)
+{
+    double secs = 0;
+
+    if (estimate.process_rate > 0) {
+        secs += static_cast<double>(estimate.total_bytes)
+                / estimate.process_rate;
+    }
+    if (estimate.write_rate > 0) {
+        secs += static_cast<double>(write_bytes) / estimate.write_rate;
+    }
+
+    return seconds(static_cast<seconds::rep>(std::ceil(secs)));
+}
+
+static std::string sample_path(const std::string &dir)
+{
+    std::string path(dir);
+    if (path.empty() || path.back() != '/') {
+        path += '/';
+    }
+    path += SAMPLE_NAME;
+    return path;
+}
+
+/*!
+ * \brief Measure how fast data can be written to the device backing a
+ *        directory
+ *
+ * The data is flushed with fdatasync() so that the page cache does not hide
+ * the actual device speed. The temporary file is removed afterwards.
+ *
+ * \return Bytes per second
+ */
+static oc::result<double> sample_write_rate(const std::string &dir)
+{
+    auto path = sample_path(dir);
+
+    int fd = open(path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+                  0600);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto remove_file = finally([&] {
+        close(fd);
+        unlink(path.c_str());
+    });
+
+    // Incompressible data so that filesystems with transparent compression
+    // are measured fairly
+    std::vector<uint64_t> buf(1024 * 1024 / sizeof(uint64_t));
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    for (auto &word : buf) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        word = state;
+    }
+
+    auto start = steady_clock::now();
+
+    for (size_t written = 0; written < WRITE_SAMPLE_SIZE;) {
+        auto const *ptr = reinterpret_cast<const char *>(buf.data());
+        size_t size = buf.size() * sizeof(uint64_t);
+
+        while (size > 0) {
+            ssize_t n = write(fd, ptr, size);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return ec_from_errno();
+            }
+            ptr += n;
+            size -= static_cast<size_t>(n);
+            written += static_cast<size_t>(n);
+        }
+    }
+
+    if (fdatasync(fd) < 0) {
+        return ec_from_errno();
+    }
+
+    return WRITE_SAMPLE_SIZE / std::max(seconds_since(start), 1e-3);
+}
+
+/*!
+ * \brief Back up a slice of a tree to measure compression ratio and rate
+ *
+ * The sample is archived with the same code path and options as the real
+ * backup, so reading, tar overhead and compression are all accounted for.
+ */
+static bool sample_compression(const std::string &dir,
+                               const std::string &output_dir,
+                               util::CompressionType compression,
+                               const util::CompressionOptions &options,
+                               PreflightEstimate &estimate)
+{
+    SampleWalker walker(dir);
+    if (!walker.run()) {
+        LOGW("%s: Failed to collect sample: %s",
+             dir.c_str(), walker.error().c_str());
+        return false;
+    } else if (walker.paths().empty()) {
+        return false;
+    }
+
+    auto path = sample_path(output_dir);
+
+    auto remove_file = finally([&] {
+        unlink(path.c_str());
+    });
+
+    auto start = steady_clock::now();
+
+    if (!util::libarchive_tar_create(path, dir, walker.paths(), compression,
+                                     0, options)) {
+        LOGW("%s: Failed to archive sample", dir.c_str());
+        return false;
+    }
+
+    double elapsed = seconds_since(start);
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        LOGW("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto size = static_cast<double>(walker.size());
+
+    estimate.compression_ratio = static_cast<double>(sb.st_size) / size;
+    estimate.process_rate = size / std::max(elapsed, 1e-3);
+
+    return true;
+}
+
+/*!
+ * \brief Estimate how long a backup will take
+ *
+ * The total size and number of files are computed with the parallel directory
+ * size walker. Image files are counted by their allocated size. The
+ * compression ratio and the read and compression rate are sampled by archiving
+ * up to 8 MiB of small files from the largest directory source, and the write
+ * rate is sampled by writing 8 MiB to \p output_dir.
+ *
+ * The ETA adds the time needed to read and compress everything to the time
+ * needed to write the compressed output. The two overlap only partially in
+ * practice (mostly while the page cache can absorb the writes), so the
+ * estimate errs on the long side.
+ *
+ * \param sources Directories and images to back up
+ * \param output_dir Backup directory
+ * \param compression Compression type
+ * \param options Compression level and thread count
+ *
+ * \return Estimate or the first error encountered while computing the sizes.
+ *         Failure to take a sample is not an error, but the corresponding
+ *         rates will be zero.
+ */
+oc::result<PreflightEstimate>
+preflight_backup(const std::vector<PreflightSource> &sources,
+                 const std::string &output_dir,
+                 util::CompressionType compression,
+                 const util::CompressionOptions &options)
+{
+    PreflightEstimate estimate;
+    const PreflightSource *largest = nullptr;
+    uint64_t largest_size = 0;
+
+    for (auto const &source : sources) {
+        struct stat sb;
+        if (stat(source.path.c_str(), &sb) < 0) {
+            return ec_from_errno();
+        }
+
+        if (!S_ISDIR(sb.st_mode)) {
+            estimate.total_bytes += static_cast<uint64_t>(sb.st_blocks) * 512;
+            continue;
+        }
+
+        OUTCOME_TRY(stats, get_directory_stats(source.path,
+                                               source.exclusions));
+
+        estimate.total_bytes += stats.size;
+        estimate.file_count += stats.files;
+
+        if (!largest || stats.size > largest_size) {
+            largest = &source;
+            largest_size = stats.size;
+        }
+    }
+
+    if (largest) {
+        sample_compression(largest->path, output_dir, compression, options,
+                           estimate);
+    }
+
+    if (auto r = sample_write_rate(output_dir)) {
+        estimate.write_rate = r.value();
+    } else {
+        LOGW("%s: Failed to sample write rate: %s",
+             output_dir.c_str(), r.error().message().c_str());
+    }
+
+    estimate.eta = compute_eta(estimate, static_cast<uint64_t>(
+            static_cast<double>(estimate.total_bytes)
+            * estimate.compression_ratio));
+
+    return estimate;
+}
+
+/*!
+ * \brief Estimate how long installing a zip file will take
+ *
+ * The total size, number of files and compression ratio come from the zip's
+ * central directory. The decompression rate is sampled by decompressing up to
+ * 8 MiB from the first entries, and the write rate is sampled by writing 8 MiB
+ * to \p target_dir. The ETA assumes that every file in the zip is extracted
+ * once.
+ *
+ * \param zip_file Path to zip file
+ * \param target_dir Directory on the device that the zip will be installed to
+ *
+ * \return Estimate or an error if the zip could not be read. Failure to sample
+ *         the write rate is not an error, but the rate will be zero.
+ */
+oc::result<PreflightEstimate>
+preflight_install(const std::string &zip_file, const std::string &target_dir)
+{
+    PreflightEstimate estimate;
+
+    void *stream;
+    if (!mz_stream_android_create(&stream)) {
+        return std::make_error_code(std::errc::not_enough_memory);
+    }
+
+    auto destroy_stream = finally([&] {
+        mz_stream_delete(&stream);
+    });
+
+    void *buf_stream;
+    if (!mz_stream_buffered_create(&buf_stream)) {
+        return std::make_error_code(std::errc::not_enough_memory);
+    }
+
+    auto destroy_buf_stream = finally([&] {
+        mz_stream_delete(&buf_stream);
+    });
+
+    if (mz_stream_set_base(buf_stream, stream) != MZ_OK
+            || mz_stream_open(buf_stream, zip_file.c_str(),
+                              MZ_OPEN_MODE_READ) != MZ_OK) {
+        return std::make_error_code(std::errc::io_error);
+    }
+
+    auto close_stream = finally([&] {
+        mz_stream_close(buf_stream);
+    });
+
+    auto *handle = mz_zip_open(buf_stream, MZ_OPEN_MODE_READ);
+    if (!handle) {
+        return std::make_error_code(std::errc::invalid_argument);
+    }
+
+    auto close_zip = finally([&] {
+        mz_zip_close(handle);
+    });
+
+    uint64_t compressed_bytes = 0;
+    int32_t ret;
+
+    for (ret = mz_zip_goto_first_entry(handle); ret == MZ_OK;
+            ret = mz_zip_goto_next_entry(handle)) {
+        mz_zip_file *file_info;
+
+        if (mz_zip_entry_get_info(handle, &file_info) != MZ_OK) {
+            return std::make_error_code(std::errc::io_error);
+        }
+
+        estimate.total_bytes +=
+                static_cast<uint64_t>(file_info->uncompressed_size);
+        compressed_bytes += static_cast<uint64_t>(file_info->compressed_size);
+
+        if (file_info->filename_size == 0
+                || file_info->filename[file_info->filename_size - 1] != '/') {
+            ++estimate.file_count;
+        }
+    }
+
+    if (ret != MZ_END_OF_LIST) {
+        return std::make_error_code(std::errc::io_error);
+    }
+
+    if (estimate.total_bytes > 0) {
+        estimate.compression_ratio = static_cast<double>(compressed_bytes)
+                / static_cast<double>(estimate.total_bytes);
+    }
+
+    // Sample the decompression rate
+    std::vector<char> buf(64 * 1024);
+    uint64_t sampled = 0;
+    auto start = steady_clock::now();
+
+    for (ret = mz_zip_goto_first_entry(handle);
+            ret == MZ_OK && sampled < SAMPLE_SIZE;
+            ret = mz_zip_goto_next_entry(handle)) {
+        if (mz_zip_entry_read_open(handle, 0, nullptr) != MZ_OK) {
+            break;
+        }
+
+        int32_t n;
+        while (sampled < SAMPLE_SIZE && (n = mz_zip_entry_read(
+                handle, buf.data(), static_cast<uint32_t>(buf.size()))) > 0) {
+            sampled += static_cast<uint64_t>(n);
+        }
+
+        mz_zip_entry_close(handle);
+    }
+
+    if (sampled > 0) {
+        estimate.process_rate = static_cast<double>(sampled)
+                / std::max(seconds_since(start), 1e-3);
+    }
+
+    if (auto r = sample_write_rate(target_dir)) {
+        estimate.write_rate = r.value();
+    } else {
+        LOGW("%s: Failed to sample write rate: %s",
+             target_dir.c_str(), r.error().message().c_str());
+    }
+
+    estimate.eta = compute_eta(estimate, estimate.total_bytes);
+
+    return estimate;
+}
+
+/*!
+ * \brief Format a duration as HH:MM:SS
+ */
+std::string format_duration(seconds duration)
+{
+    auto secs = static_cast<uint64_t>(std::max<seconds::rep>(
+            duration.count(), 0));
+
+    return format("%02" PRIu64 ":%02" PRIu64 ":%02" PRIu64,
+                  secs / 3600, secs / 60 % 60, secs % 60);
+}
+
+/*!
+ * \brief Start tracking a job
+ *
+ * \param estimate Estimated duration of the whole job, eg. from
+ *                 PreflightEstimate::eta
+ */
+EtaTracker::EtaTracker(seconds estimate)
+    : m_start(steady_clock::now())
+    , m_estimate(estimate)
+    , m_last_report(m_start)
+    , m_last_report_fraction(0)
+{
+}
+
+/*!
+ * \brief Compute the remaining time for the current progress
+ *
+ * The remaining time projected from the observed rate is blended with the
+ * remaining part of the preflight estimate. The observed rate gets more weight
+ * as the job progresses, so the ETA starts out at the estimate and converges
+ * to the actual rate.
+ *
+ * \param fraction Completed fraction of the job (clamped to [0, 1])
+ *
+ * \return Remaining time
+ */
+seconds EtaTracker::update(double fraction)
+{
+    fraction = std::clamp(fraction, 0.0, 1.0);
+
+    double elapsed = seconds_since(m_start);
+    double from_estimate = static_cast<double>(m_estimate.count())
+            * (1 - fraction);
+    double remaining = from_estimate;
+
+    if (fraction > 0) {
+        double from_rate = elapsed * (1 - fraction) / fraction;
+        remaining = fraction * from_rate + (1 - fraction) * from_estimate;
+    }
+
+    return seconds(static_cast<seconds::rep>(std::ceil(remaining)));
+}
+
+/*!
+ * \brief Check whether the ETA should be reported again
+ *
+ * This limits reports to one every 10 seconds unless the progress has advanced
+ * by at least 10% since the last report.
+ *
+ * \param fraction Completed fraction of the job
+ */
+bool EtaTracker::report_due(double fraction)
+{
+    auto now = steady_clock::now();
+
+    if (now - m_last_report < REPORT_INTERVAL
+            && fraction - m_last_report_fraction < REPORT_STEP) {
+        return false;
+    }
+
+    m_last_report = now;
+    m_last_report_fraction = fraction;
+    return true;
+}
+
+/*!
+ * \brief Start polling the progress of a job
+ *
+ * \param estimate Estimated duration of the whole job
+ * \param progress_fn Function that returns the completed fraction of the job.
+ *                    It is called from a separate thread.
+ * \param report_fn Function to call with the progress and remaining time when
+ *                  EtaTracker::report_due() allows it
+ */
+ProgressMonitor::ProgressMonitor(seconds estimate, ProgressFn progress_fn,
+                                 ReportFn report_fn)
+    : m_tracker(estimate)
+    , m_progress_fn(std::move(progress_fn))
+    , m_report_fn(std::move(report_fn))
+    , m_stop(false)
+    , m_thread(&ProgressMonitor::run, this)
+{
+}
+
+ProgressMonitor::~ProgressMonitor()
+{
+    stop();
+}
+
+/*!
+ * \brief Stop polling
+ *
+ * This waits for the polling thread to exit. No reports are made afterwards.
+ */
+void ProgressMonitor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void ProgressMonitor::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_cv.wait_for(lock, POLL_INTERVAL, [&] { return m_stop; })) {
+        lock.unlock();
+
+        double fraction = m_progress_fn();
+        auto remaining = m_tracker.update(fraction);
+
+        if (m_tracker.report_due(fraction)) {
+            m_report_fn(fraction, remaining);
+        }
+
+        lock.lock();
+    }
+}
+
+}
@@ -31,11 +31,13 @@
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
+#include "mbcommon/file/mmap.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
 #include "mbutil/archive.h"
+#include "mbutil/archive_file.h"
 #include "mbutil/chown.h"
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
@@ -310,14 +312,14 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
         return false;
     }
 
-    // Go to ramdisk
-    auto entry = reader.go_to_entry(EntryType::Ramdisk);
-    if (!entry) {
-        if (entry.error() == ReaderError::EndOfEntries) {
+    // Open decompressed ramdisk
+    auto stream = reader.open_entry_stream(EntryType::Ramdisk);
+    if (!stream) {
+        if (stream.error() == ReaderError::EndOfEntries) {
             LOGE("%s: Boot image is missing ramdisk", boot_image_file.c_str());
         } else {
-            LOGE("%s: Failed to find ramdisk entry: %s",
-                 boot_image_file.c_str(), entry.error().message().c_str());
+            LOGE("%s: Failed to open ramdisk entry: %s",
+                 boot_image_file.c_str(), stream.error().message().c_str());
         }
         return false;
     }
@@ -338,7 +340,7 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
             close(tmpfd);
         });
 
-        return bi_copy_data_to_fd(reader, tmpfd)
+        return bi_copy_stream_to_fd(*stream.value(), tmpfd)
                 && extract_ramdisk_fd(tmpfd, output_dir, nested);
     }
 }
@@ -346,6 +348,15 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
 bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
                                       bool nested)
 {
+    // The archive reader gets views of the mapping instead of copies
+    MmapFile file;
+
+    if (auto r = file.open(fd); !r) {
+        LOGE("Failed to map ramdisk: %s", r.error().message().c_str());
+        return false;
+    }
+
+    util::ArchiveFileReader reader(file);
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
     archive_entry *entry;
@@ -356,19 +367,13 @@ bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
         return false;
     }
 
-    // Seek to beginning
-    if (lseek(fd, 0, SEEK_SET) < 0) {
-        LOGE("Failed to seek to beginning: %s", strerror(errno));
-        return false;
-    }
-
     archive_read_support_filter_gzip(in.get());
     archive_read_support_filter_lz4(in.get());
     archive_read_support_filter_lzma(in.get());
     archive_read_support_filter_xz(in.get());
     archive_read_support_format_cpio(in.get());
 
-    if (archive_read_open_fd(in.get(), fd, 10240) != ARCHIVE_OK) {
+    if (reader.open(in.get()) != ARCHIVE_OK) {
         LOGE("Failed to open archive: %s", archive_error_string(in.get()));
         return false;
     }
@@ -59,6 +59,7 @@ public:
     RecoveryInstaller(std::string zip_file, int interface, int output_fd);
 
     virtual void display_msg(std::string_view msg) override;
+    virtual void timeline_output(std::string_view line) override;
     virtual std::string get_install_type() override;
     virtual std::unordered_map<std::string, std::string> get_properties() override;
     virtual ProceedState on_initialize() override;
@@ -86,6 +87,24 @@ void RecoveryInstaller::display_msg(std::string_view msg)
     writev(_output_fd, iovs.data(), iovs.size());
 }
 
+void RecoveryInstaller::timeline_output(std::string_view line)
+{
+    Installer::timeline_output(line);
+
+    // The recovery saves "log" commands to its install log without showing
+    // them in the UI
+    static constexpr char prefix[] = "log ";
+    static constexpr char suffix[] = "\n";
+
+    const std::array<iovec, 3> iovs = {{
+        { const_cast<char *>(prefix), strlen(prefix) },
+        { const_cast<char *>(line.data()), line.size() },
+        { const_cast<char *>(suffix), strlen(suffix) },
+    }};
+
+    writev(_output_fd, iovs.data(), iovs.size());
+}
+
 std::string RecoveryInstaller::get_install_type()
 {
     if (_prop.find("mbtool.installer.install-location") != _prop.end()) {
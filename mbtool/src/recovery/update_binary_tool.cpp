@@ -32,6 +32,8 @@
 #include "mbutil/file.h"
 #include "mbutil/mount.h"
 
+#include "recovery/block_image.h"
+
 #include "util/multiboot.h"
 #include "util/wipe.h"
 
@@ -41,6 +43,7 @@
 #define ACTION_MOUNT "mount"
 #define ACTION_UNMOUNT "unmount"
 #define ACTION_FORMAT "format"
+#define ACTION_BLOCK_IMAGE_UPDATE "block-image-update"
 #define SYSTEM "/system"
 #define CACHE "/cache"
 #define DATA "/data"
@@ -168,14 +171,45 @@ static bool do_format(const char *mountpoint)
     return true;
 }
 
+static bool do_block_image_update(const char *mountpoint,
+                                  const char *transfer_list,
+                                  const char *new_data)
+{
+    const char *source_path;
+    bool is_image;
+
+    if (!get_paths(mountpoint, &source_path, &is_image)) {
+        LOGE(TAG "%s: Invalid mountpoint", mountpoint);
+        return false;
+    } else if (!is_image) {
+        LOGE(TAG "%s: Block images can only be written to image files",
+             mountpoint);
+        return false;
+    }
+
+    if (!block_image_update(CHROOT_INSTALL_ZIP, transfer_list, new_data,
+                            source_path)) {
+        LOGE(TAG "%s: Failed to apply block image", mountpoint);
+        return false;
+    }
+
+    LOGD(TAG "Successfully applied %s to %s", new_data, mountpoint);
+
+    return true;
+}
+
 static void update_binary_tool_usage(FILE *stream)
 {
     fprintf(stream,
-            "Usage: update-binary-tool [action] [mountpoint]\n\n"
+            "Usage: update-binary-tool [action] [mountpoint]\n"
+            "   or: update-binary-tool block-image-update [mountpoint]"
+            " [transfer list] [new data]\n\n"
             "Actions:\n"
             "  mount          Mount a filesystem in multiboot environment\n"
             "  unmount        Unmount a filesystem in multiboot environment\n"
             "  format         Format a filesystem in multiboot environment\n"
+            "  block-image-update\n"
+            "                 Apply a full block-based OTA from the zip file\n"
             "\n"
             "Mountpoints:\n"
             "  /system        (Mount|Unmount|Format) multibooted /system\n"
@@ -214,7 +248,7 @@ int update_binary_tool_main(int argc, char *argv[])
         }
     }
 
-    if (argc - optind != 2) {
+    if (argc - optind < 2) {
         update_binary_tool_usage(stderr);
         return EXIT_FAILURE;
     }
@@ -225,14 +259,17 @@ int update_binary_tool_main(int argc, char *argv[])
     const char *action = argv[optind];
     const char *mountpoint = argv[optind + 1];
 
+    bool is_block_image_update = strcmp(action, ACTION_BLOCK_IMAGE_UPDATE) == 0;
     bool is_valid_action = strcmp(action, ACTION_MOUNT) == 0
             || strcmp(action, ACTION_UNMOUNT) == 0
-            || strcmp(action, ACTION_FORMAT) == 0;
+            || strcmp(action, ACTION_FORMAT) == 0
+            || is_block_image_update;
     bool is_valid_mountpoint = strcmp(mountpoint, SYSTEM) == 0
             || strcmp(mountpoint, CACHE) == 0
             || strcmp(mountpoint, DATA) == 0;
 
-    if (!is_valid_action || !is_valid_mountpoint) {
+    if (!is_valid_action || !is_valid_mountpoint
+            || argc - optind != (is_block_image_update ? 4 : 2)) {
         update_binary_tool_usage(stderr);
         return EXIT_FAILURE;
     }
@@ -250,6 +287,9 @@ int update_binary_tool_main(int argc, char *argv[])
         ret = do_unmount(mountpoint);
     } else if (strcmp(action, ACTION_FORMAT) == 0) {
         ret = do_format(mountpoint);
+    } else if (is_block_image_update) {
+        ret = do_block_image_update(mountpoint, argv[optind + 2],
+                                    argv[optind + 3]);
     }
 
     return ret ? EXIT_SUCCESS : EXIT_FAILURE;
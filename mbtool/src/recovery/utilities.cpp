@@ -20,6 +20,7 @@
 #include "recovery/utilities.h"
 
 #include <algorithm>
+#include <unordered_map>
 
 #include <cstring>
 
@@ -36,6 +37,7 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mbdevice/binary.h"
 #include "mbdevice/device.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
@@ -47,6 +49,8 @@
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
+#include "util/block_dev_index.h"
+#include "util/clone.h"
 #include "util/multiboot.h"
 #include "util/romconfig.h"
 #include "util/roms.h"
@@ -62,6 +66,95 @@ namespace mb
 
 static const char *devices_file = nullptr;
 
+static Device to_device(const Device &device)
+{
+    return device;
+}
+
+static Device to_device(const BinaryDeviceRef &ref)
+{
+    return ref.to_device();
+}
+
+template<typename Database>
+static bool find_device(const Database &db,
+                        const std::vector<std::string> &codenames,
+                        Device &device)
+{
+    for (auto const &codename : codenames) {
+        auto d = db.find_by_codename(codename);
+        if (!d) {
+            continue;
+        }
+
+        auto candidate = to_device(*d);
+        if (candidate.validate()) {
+            LOGW("%s: Skipping invalid device", candidate.id().c_str());
+            continue;
+        }
+
+        device = std::move(candidate);
+        return true;
+    }
+
+    return false;
+}
+
+/*!
+ * \brief Find device by matching its block devices against the system
+ *
+ * This is used when no device has a matching codename. The boot and system
+ * block device paths of every device are collected into a reverse index, so
+ * each unique path is only stat'd once, no matter how many devices list it.
+ * Since many devices share generic paths, a device is only chosen if it
+ * matches more paths than any other device.
+ */
+template<typename Database>
+static bool find_device_by_block_devs(const Database &db, Device &device)
+{
+    std::unordered_map<std::string, std::vector<size_t>> index;
+
+    auto add_paths = [&](const std::vector<std::string> &paths, size_t i) {
+        for (auto const &path : paths) {
+            auto &candidates = index[path];
+            if (candidates.empty() || candidates.back() != i) {
+                candidates.push_back(i);
+            }
+        }
+    };
+
+    for (size_t i = 0; i < db.size(); ++i) {
+        auto d = to_device(*db.at(i));
+        if (d.validate()) {
+            continue;
+        }
+
+        add_paths(d.boot_block_devs(), i);
+        add_paths(d.system_block_devs(), i);
+    }
+
+    std::vector<size_t> scores(db.size());
+
+    for (auto const &[path, candidates] : index) {
+        struct stat sb;
+        if (stat(path.c_str(), &sb) == 0 && S_ISBLK(sb.st_mode)) {
+            for (auto i : candidates) {
+                ++scores[i];
+            }
+        }
+    }
+
+    auto best = std::max_element(scores.begin(), scores.end());
+    if (best == scores.end() || *best == 0
+            || std::count(scores.begin(), scores.end(), *best) != 1) {
+        return false;
+    }
+
+    device = to_device(*db.at(static_cast<size_t>(best - scores.begin())));
+    LOGW("%s: Detected device from block devices", device.id().c_str());
+    return true;
+}
+
 static bool get_device(const char *path, Device &device)
 {
     std::string prop_product_device =
@@ -79,28 +172,36 @@ static bool get_device(const char *path, Device &device)
         return false;
     }
 
-    std::vector<Device> devices;
-    JsonError error;
-
-    if (!device_list_from_json(contents.value(), devices, error)) {
-        LOGE("%s: Failed to load devices", path);
-        return false;
+    std::vector<std::string> codenames;
+    for (auto const &codename : {prop_product_device, prop_build_product}) {
+        if (!codename.empty()) {
+            codenames.push_back(codename);
+        }
     }
 
-    for (auto &d : devices) {
-        if (d.validate()) {
-            LOGW("Skipping invalid device");
-            continue;
+    if (BinaryDeviceDatabase::is_binary(contents.value())) {
+        BinaryDeviceDatabase db;
+
+        if (!db.open(contents.value())) {
+            LOGE("%s: Invalid binary device list", path);
+            return false;
         }
 
-        auto const &codenames = d.codenames();
-        auto it = std::find_if(codenames.begin(), codenames.end(),
-                               [&](const std::string &item) {
-            return item == prop_product_device || item == prop_build_product;
-        });
+        if (find_device(db, codenames, device)
+                || find_device_by_block_devs(db, device)) {
+            return true;
+        }
+    } else {
+        DeviceDatabase db;
+        JsonError error;
 
-        if (it != codenames.end()) {
-            device = std::move(d);
+        if (!db.load(contents.value(), {}, error)) {
+            LOGE("%s: Failed to load devices", path);
+            return false;
+        }
+
+        if (find_device(db, codenames, device)
+                || find_device_by_block_devs(db, device)) {
             return true;
         }
     }
@@ -126,8 +227,7 @@ static bool utilities_switch_rom(const char *rom_id, bool force)
     auto const &boot_devs = device.boot_block_devs();
     auto it = std::find_if(boot_devs.begin(), boot_devs.end(),
                            [&](const std::string &path) {
-        struct stat sb;
-        return stat(path.c_str(), &sb) == 0 && S_ISBLK(sb.st_mode);
+        return BlockDevIndex::instance().is_block_dev(path);
     });
 
     if (it == boot_devs.end()) {
@@ -205,6 +305,21 @@ static bool utilities_wipe_multiboot(const char *rom_id)
     return wipe_multiboot(rom);
 }
 
+static bool utilities_clone_rom(const char *source_id, const char *target_id)
+{
+    auto source = Roms::create_rom(source_id);
+    if (!source) {
+        return false;
+    }
+
+    auto target = Roms::create_rom(target_id);
+    if (!target) {
+        return false;
+    }
+
+    return clone_rom(source, target);
+}
+
 static void generate_aroma_config(std::string &data)
 {
     std::string rom_menu_items;
@@ -479,6 +594,7 @@ static void utilities_usage(bool error)
             "   OR: utilities [opt...] wipe-data [ROM ID]\n"
             "   OR: utilities [opt...] wipe-dalvik-cache [ROM ID]\n"
             "   OR: utilities [opt...] wipe-multiboot [ROM ID]\n"
+            "   OR: utilities [opt...] clone [source ROM ID] [target ROM ID]\n"
             "\n"
             "Options:\n"
             "  -f, --force      Force (only for 'switch' action)\n"
@@ -532,8 +648,9 @@ int utilities_main(int argc, char *argv[])
     }
 
     const std::string action = argv[optind];
-    if ((action == "generate" && argc - optind != 3)
-            || (action != "generate" && argc - optind != 2)) {
+    bool two_args = action == "generate" || action == "clone";
+    if ((two_args && argc - optind != 3)
+            || (!two_args && argc - optind != 2)) {
         utilities_usage(true);
         return EXIT_FAILURE;
     }
@@ -560,6 +677,8 @@ int utilities_main(int argc, char *argv[])
         ret = utilities_wipe_dalvik_cache(argv[optind + 1]);
     } else if (action == "wipe-multiboot") {
         ret = utilities_wipe_multiboot(argv[optind + 1]);
+    } else if (action == "clone") {
+        ret = utilities_clone_rom(argv[optind + 1], argv[optind + 2]);
     } else {
         LOGE("Unknown action: %s", action.c_str());
     }
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/block_dev_index.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/path.h"
+
+#define LOG_TAG "mbtool/util/block_dev_index"
+
+namespace mb
+{
+
+/*!
+ * \class BlockDevIndex
+ *
+ * \brief Name to path index of block device directories
+ *
+ * Every directory (eg. `/dev/block/platform/msm_sdcc.1/by-name`) is read once
+ * with readdir() when it is first needed. Entries whose type is reported by
+ * readdir() need no further syscalls and symlinks are only stat'd the first
+ * time they are looked up. A name that is not found causes the directory to be
+ * reread if its mtime changed, so device nodes created later (eg. by ueventd)
+ * are picked up. Entries that are removed after they were seen are not
+ * detected.
+ *
+ * This class is thread safe.
+ */
+
+/*!
+ * \brief Get the process-wide index
+ */
+BlockDevIndex & BlockDevIndex::instance()
+{
+    static BlockDevIndex index;
+    return index;
+}
+
+/*!
+ * \brief Find the block device for a partition name
+ *
+ * \param search_dirs Directories to search in order
+ * \param partition Partition name. Names starting with `mmcblk` are looked up
+ *                  in `/dev/block` first.
+ *
+ * \return Path to the first existing entry or an empty string if none exist.
+ */
+std::string BlockDevIndex::find(const std::vector<std::string> &search_dirs,
+                                std::string_view partition)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto make_path = [&](const std::string &dir) {
+        std::string path(dir);
+        path += '/';
+        path += partition;
+        return path;
+    };
+
+    if (starts_with(partition, "mmcblk")) {
+        static const std::string dev_block("/dev/block");
+
+        if (lookup(dev_block, partition)) {
+            return make_path(dev_block);
+        }
+    }
+
+    for (auto const &dir : search_dirs) {
+        if (lookup(dir, partition)) {
+            return make_path(dir);
+        }
+    }
+
+    return {};
+}
+
+/*!
+ * \brief Check if a path exists, following symlinks
+ */
+bool BlockDevIndex::exists(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return lookup(util::dir_name(path), util::base_name_sv(path));
+}
+
+/*!
+ * \brief Check if a path is (or links to) a block device
+ */
+bool BlockDevIndex::is_block_dev(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto entry = lookup(util::dir_name(path), util::base_name_sv(path));
+    return entry && S_ISBLK(entry->mode);
+}
+
+/*!
+ * \brief Forget all directories
+ */
+void BlockDevIndex::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _dirs.clear();
+}
+
+/*!
+ * \brief Look up an entry and stat it if needed
+ *
+ * \pre The caller must hold _mutex
+ *
+ * \return Entry if it exists or nullptr otherwise
+ */
+const BlockDevIndex::Entry *
+BlockDevIndex::lookup(const std::string &dir, std::string_view name)
+{
+    if (name.empty() || name == "." || name == ".."
+            || name.find('/') != std::string_view::npos) {
+        return nullptr;
+    }
+
+    auto &d = load(dir);
+    std::string key(name);
+
+    auto it = d.entries.find(key);
+    if (it == d.entries.end()) {
+        if (!refresh(dir, d)) {
+            return nullptr;
+        }
+
+        it = d.entries.find(key);
+        if (it == d.entries.end()) {
+            return nullptr;
+        }
+    }
+
+    auto &entry = it->second;
+
+    if (!entry.resolved) {
+        std::string path(dir);
+        path += '/';
+        path += name;
+
+        struct stat sb;
+        entry.exists = stat(path.c_str(), &sb) == 0;
+        entry.mode = entry.exists ? sb.st_mode : 0;
+        entry.resolved = true;
+    }
+
+    return entry.exists ? &entry : nullptr;
+}
+
+/*!
+ * \brief Get directory, reading it for the first time if needed
+ *
+ * \pre The caller must hold _mutex
+ */
+BlockDevIndex::Directory & BlockDevIndex::load(const std::string &dir)
+{
+    auto [it, inserted] = _dirs.try_emplace(dir);
+    auto &d = it->second;
+
+    if (inserted) {
+        d.exists = false;
+        d.mtime = {};
+        (void) refresh(dir, d);
+    }
+
+    return d;
+}
+
+/*!
+ * \brief Reread directory if it changed since it was last read
+ *
+ * \pre The caller must hold _mutex
+ *
+ * \return Whether the entries changed
+ */
+bool BlockDevIndex::refresh(const std::string &dir, Directory &d)
+{
+    int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) {
+        if (errno != ENOENT && errno != ENOTDIR) {
+            LOGW("%s: Failed to open directory: %s",
+                 dir.c_str(), strerror(errno));
+        }
+
+        bool changed = d.exists;
+        d.exists = false;
+        d.entries.clear();
+        return changed;
+    }
+
+    // fdopendir() takes ownership of the fd
+    DIR *dp = nullptr;
+    auto close_dir = finally([&] {
+        if (dp) {
+            closedir(dp);
+        } else {
+            close(dfd);
+        }
+    });
+
+    // Take the mtime before reading, so changes made while reading cause
+    // another reread later
+    struct stat sb;
+    if (fstat(dfd, &sb) < 0) {
+        LOGW("%s: Failed to stat directory: %s",
+             dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (d.exists && sb.st_mtim.tv_sec == d.mtime.tv_sec
+            && sb.st_mtim.tv_nsec == d.mtime.tv_nsec) {
+        return false;
+    }
+
+    dp = fdopendir(dfd);
+    if (!dp) {
+        LOGW("%s: Failed to open directory: %s",
+             dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::unordered_map<std::string, Entry> entries;
+
+    while (auto ent = readdir(dp)) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        Entry entry = {};
+
+        switch (ent->d_type) {
+        case DT_BLK:
+            entry.mode = S_IFBLK;
+            break;
+        case DT_CHR:
+            entry.mode = S_IFCHR;
+            break;
+        case DT_DIR:
+            entry.mode = S_IFDIR;
+            break;
+        case DT_REG:
+            entry.mode = S_IFREG;
+            break;
+        default:
+            // Symlinks (by-name entries) and unknown types are stat'd lazily
+            break;
+        }
+
+        entry.resolved = entry.mode != 0;
+        entry.exists = entry.resolved;
+
+        entries.emplace(ent->d_name, entry);
+    }
+
+    d.exists = true;
+    d.mtime = sb.st_mtim;
+    d.entries = std::move(entries);
+
+    return true;
+}
+
+}
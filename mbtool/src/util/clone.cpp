@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/clone.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mblog/logging.h"
+#include "mbutil/copy.h"
+#include "mbutil/directory.h"
+#include "mbutil/mount.h"
+#include "mbutil/path.h"
+
+#include "recovery/image.h"
+#include "recovery/installer_util.h"
+#include "recovery/ramdisk_patcher.h"
+#include "util/multiboot.h"
+#include "util/romconfig.h"
+#include "util/wipe.h"
+
+#define LOG_TAG "mbtool/util/clone"
+
+namespace mb
+{
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+constexpr char CLONE_MNT_DIR[] = "/dev/.mbtool_clone";
+
+// Everything is copied with the fastest mechanism the filesystems allow:
+// reflinks where supported, then copy_file_range(), then a hole-preserving
+// userspace copy
+static const util::CopyFlags CLONE_COPY_FLAGS =
+        util::CopyFlag::CopyAttributes
+        | util::CopyFlag::CopyXattrs
+        | util::CopyFlag::Sparse
+        | util::CopyFlag::Reflink;
+
+/*!
+ * \brief Copy the contents of a directory into another directory
+ *
+ * \param source Source directory
+ * \param target Target directory (created if it does not exist)
+ * \param exclusions List of top-level entries to skip
+ *
+ * \return Whether all entries were copied
+ */
+static bool copy_tree(const std::string &source, const std::string &target,
+                      const std::vector<std::string> &exclusions)
+{
+    if (auto r = util::mkdir_recursive(target, 0755); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             target.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    ScopedDIR dp(opendir(source.c_str()), closedir);
+    if (!dp) {
+        LOGE("%s: Failed to open directory: %s",
+             source.c_str(), strerror(errno));
+        return false;
+    }
+
+    dirent *ent;
+    while ((ent = readdir(dp.get()))) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0
+                || std::find(exclusions.begin(), exclusions.end(),
+                             ent->d_name) != exclusions.end()) {
+            continue;
+        }
+
+        std::string path(source);
+        path += '/';
+        path += ent->d_name;
+
+        struct stat sb;
+        if (lstat(path.c_str(), &sb) < 0) {
+            LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (S_ISDIR(sb.st_mode)) {
+            if (auto r = util::copy_dir(path, target, CLONE_COPY_FLAGS
+                                        | util::CopyFlag::Parallel); !r) {
+                LOGE("%s", r.error().message().c_str());
+                return false;
+            }
+        } else {
+            std::string target_path(target);
+            target_path += '/';
+            target_path += ent->d_name;
+
+            if (auto r = util::copy_file(path, target_path,
+                                         CLONE_COPY_FLAGS); !r) {
+                LOGE("%s", r.error().message().c_str());
+                return false;
+            }
+        }
+    }
+
+    if (auto r = util::copy_stat(source, target); !r) {
+        LOGE("%s", r.error().message().c_str());
+        return false;
+    }
+    if (auto r = util::copy_xattrs(source, target); !r) {
+        LOGE("%s", r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool mount_image(const std::string &image,
+                        const std::string &mount_point, bool read_only)
+{
+    if (auto r = util::mkdir_recursive(mount_point, 0755); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             mount_point.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (!ext4_image_is_clean(image)) {
+        fsck_ext4_image(image);
+    }
+
+    if (auto r = util::mount(image, mount_point, "ext4",
+                             read_only ? MS_RDONLY : 0, ""); !r) {
+        LOGE("Failed to mount %s at %s: %s", image.c_str(),
+             mount_point.c_str(), r.error().message().c_str());
+        rmdir(mount_point.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool umount_image(const std::string &mount_point)
+{
+    if (auto r = util::umount(mount_point); !r) {
+        LOGE("Failed to unmount %s: %s", mount_point.c_str(),
+             r.error().message().c_str());
+        return false;
+    }
+
+    rmdir(mount_point.c_str());
+    // Fails if the other image is still mounted
+    rmdir(CLONE_MNT_DIR);
+
+    return true;
+}
+
+/*!
+ * \brief Clone a ROM's system, cache, or data
+ *
+ * If both sides are images, the image file itself is copied, which lets the
+ * kernel share or copy the extents without walking the filesystem inside. In
+ * every other case, images are loop mounted and the file trees are copied.
+ *
+ * \param source Source directory or image
+ * \param source_is_image Whether \a source is an ext4 image
+ * \param target Target directory or image
+ * \param target_is_image Whether \a target is an ext4 image
+ * \param exclusions List of top-level entries to neither wipe nor copy
+ *
+ * \return Whether the target now matches the source
+ */
+static bool clone_partition(const std::string &source, bool source_is_image,
+                            const std::string &target, bool target_is_image,
+                            const std::vector<std::string> &exclusions)
+{
+    LOGI("=== Cloning %s to %s ===", source.c_str(), target.c_str());
+
+    struct stat sb;
+    if (stat(source.c_str(), &sb) < 0) {
+        if (errno != ENOENT) {
+            LOGE("%s: Failed to stat: %s", source.c_str(), strerror(errno));
+            return false;
+        }
+
+        // Leave the wiped target behind so it doesn't contain stale data
+        LOGW("=== %s does not exist ===", source.c_str());
+        return target_is_image
+                ? unlink(target.c_str()) == 0 || errno == ENOENT
+                : wipe_directory(target, exclusions);
+    }
+
+    if (source_is_image && target_is_image) {
+        if (auto r = util::mkdir_parent(target, S_IRWXU); !r) {
+            LOGE("%s: Failed to create parent directory: %s",
+                 target.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        if (auto r = util::copy_file(source, target, CLONE_COPY_FLAGS); !r) {
+            LOGE("%s", r.error().message().c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    std::string source_dir(source);
+    std::string target_dir(target);
+
+    if (target_is_image) {
+        if (unlink(target.c_str()) < 0 && errno != ENOENT) {
+            LOGE("%s: Failed to remove: %s", target.c_str(), strerror(errno));
+            return false;
+        }
+
+        if (auto r = util::mkdir_parent(target, S_IRWXU); !r) {
+            LOGE("%s: Failed to create parent directory: %s",
+                 target.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        if (create_ext4_image(target, DEFAULT_IMAGE_SIZE)
+                != CreateImageResult::Succeeded) {
+            LOGE("%s: Failed to create image", target.c_str());
+            return false;
+        }
+
+        target_dir = CLONE_MNT_DIR;
+        target_dir += "/target";
+
+        if (!mount_image(target, target_dir, false)) {
+            return false;
+        }
+    } else if (!wipe_directory(target, exclusions)) {
+        LOGE("%s: Failed to wipe directory", target.c_str());
+        return false;
+    }
+
+    if (source_is_image) {
+        source_dir = CLONE_MNT_DIR;
+        source_dir += "/source";
+
+        if (!mount_image(source, source_dir, true)) {
+            if (target_is_image) {
+                umount_image(target_dir);
+            }
+            return false;
+        }
+    }
+
+    // The primary ROM's directories hold the other ROMs
+    std::vector<std::string> new_exclusions{ "multiboot" };
+    new_exclusions.insert(new_exclusions.end(),
+                          exclusions.begin(), exclusions.end());
+
+    bool ret = copy_tree(source_dir, target_dir, new_exclusions);
+
+    if (source_is_image && !umount_image(source_dir)) {
+        ret = false;
+    }
+    if (target_is_image && !umount_image(target_dir)) {
+        ret = false;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Clone boot image, configuration file, and thumbnail for a ROM
+ *
+ * The boot image is repatched with the target ROM's ID. Like with restoring
+ * backups, the checksums are not updated, so switching to the target ROM
+ * requires the user to confirm that the boot image is trusted.
+ */
+static bool clone_multiboot_files(const std::shared_ptr<Rom> &source,
+                                  const std::shared_ptr<Rom> &target)
+{
+    std::string source_boot_image(source->boot_image_path());
+    std::string target_boot_image(target->boot_image_path());
+    std::string source_config(source->config_path());
+    std::string target_config(target->config_path());
+    std::string source_thumbnail(source->thumbnail_path());
+    std::string target_thumbnail(target->thumbnail_path());
+
+    if (auto r = util::mkdir_parent(target_config, 0775); !r) {
+        LOGE("%s: Failed to create parent directory: %s",
+             target_config.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    struct stat sb;
+
+    if (stat(source_boot_image.c_str(), &sb) == 0) {
+        LOGI("=== Cloning %s ===", source_boot_image.c_str());
+
+        std::vector<std::function<RamdiskPatcherFn>> rps;
+        rps.push_back(rp_write_rom_id(target->id));
+
+        if (!InstallerUtil::patch_boot_image(
+                source_boot_image, target_boot_image, rps)) {
+            LOGE("Failed to patch boot image");
+            return false;
+        }
+    } else {
+        LOGW("=== %s does not exist ===", source_boot_image.c_str());
+    }
+
+    if (stat(source_config.c_str(), &sb) == 0) {
+        LOGI("=== Cloning %s ===", source_config.c_str());
+
+        RomConfig config;
+        if (!config.load_file(source_config)) {
+            LOGE("%s: Failed to load config", source_config.c_str());
+            return false;
+        }
+
+        config.id = target->id;
+
+        if (!config.save_file(target_config)) {
+            LOGE("%s: Failed to save config", target_config.c_str());
+            return false;
+        }
+    } else {
+        LOGW("=== %s does not exist ===", source_config.c_str());
+    }
+
+    if (stat(source_thumbnail.c_str(), &sb) == 0) {
+        LOGI("=== Cloning %s ===", source_thumbnail.c_str());
+
+        if (auto r = util::copy_file(source_thumbnail, target_thumbnail, 0);
+                !r) {
+            LOGE("%s", r.error().message().c_str());
+            return false;
+        }
+    } else {
+        LOGW("=== %s does not exist ===", source_thumbnail.c_str());
+    }
+
+    fix_multiboot_permissions();
+
+    return true;
+}
+
+/*!
+ * \brief Duplicate a ROM into another slot
+ *
+ * The target ROM's system, cache, and data are replaced with copies of the
+ * source ROM's. The slots do not need to be of the same type. Any mix of
+ * directories and images is supported.
+ *
+ * \note The caller must ensure that the target ROM is not currently booted
+ *
+ * \param source ROM to copy
+ * \param target ROM to overwrite
+ *
+ * \return Whether the ROM was successfully cloned
+ */
+bool clone_rom(const std::shared_ptr<Rom> &source,
+               const std::shared_ptr<Rom> &target)
+{
+    if (source->id == target->id) {
+        LOGE("Cannot clone ROM onto itself: %s", source->id.c_str());
+        return false;
+    }
+
+    const std::string source_system(source->full_system_path());
+    const std::string source_cache(source->full_cache_path());
+    const std::string source_data(source->full_data_path());
+    const std::string target_system(target->full_system_path());
+    const std::string target_cache(target->full_cache_path());
+    const std::string target_data(target->full_data_path());
+
+    if (source_system.empty() || source_cache.empty() || source_data.empty()
+            || target_system.empty() || target_cache.empty()
+            || target_data.empty()) {
+        LOGE("Failed to determine full paths");
+        return false;
+    }
+
+    LOGI("Cloning %s to %s", source->id.c_str(), target->id.c_str());
+
+    if (target->system_is_image) {
+        // Ensure the image is no longer mounted
+        std::string mount_point("/raw/images/");
+        mount_point += target->id;
+        (void) util::umount(mount_point);
+    }
+
+    return clone_multiboot_files(source, target)
+            && clone_partition(source_system, source->system_is_image,
+                               target_system, target->system_is_image, {})
+            && clone_partition(source_cache, source->cache_is_image,
+                               target_cache, target->cache_is_image, {})
+            && clone_partition(source_data, source->data_is_image,
+                               target_data, target->data_is_image,
+                               { "media" });
+}
+
+}
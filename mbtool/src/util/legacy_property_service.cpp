@@ -38,10 +38,6 @@
 #include "mbutil/properties.h"
 
 
-#define TOC_NAME_LEN(toc)       ((toc) >> 24)
-#define TOC_TO_INFO(area, toc)  (reinterpret_cast<LegacyPropInfo *>(reinterpret_cast<char *>(area) + ((toc) & 0xFFFFFF)))
-
-
 static constexpr unsigned int PROP_AREA_MAGIC = 0x504f5250;
 static constexpr unsigned int PROP_AREA_VERSION = 0x45434f76;
 
@@ -123,6 +119,7 @@ bool LegacyPropertyService::set(std::string_view name, std::string_view value)
         m_prop_area->toc[m_prop_area->count] =
                 (name.size() << 24) | (reinterpret_cast<uintptr_t>(pi)
                         - reinterpret_cast<uintptr_t>(m_prop_area));
+        m_index.emplace(std::string_view(pi->name, name.size()), pi);
 
         m_prop_area->count++;
         m_prop_area->serial++;
@@ -197,6 +194,8 @@ bool LegacyPropertyService::initialize()
     pa->version = PROP_AREA_VERSION;
 
     m_prop_area = pa;
+    m_index.clear();
+    m_index.reserve(PA_COUNT_MAX);
     m_initialized = true;
 
     return true;
@@ -204,24 +203,10 @@ bool LegacyPropertyService::initialize()
 
 LegacyPropInfo * LegacyPropertyService::find_property(std::string_view name)
 {
-    unsigned count = m_prop_area->count;
-    unsigned *toc = m_prop_area->toc;
-
-    while (count--) {
-        unsigned entry = *toc++;
-        if (TOC_NAME_LEN(entry) != name.size()) {
-            continue;
-        }
-
-        LegacyPropInfo *pi = TOC_TO_INFO(m_prop_area, entry);
-        if (memcmp(name.data(), pi->name, name.size()) != 0) {
-            continue;
-        }
-
-        return pi;
-    }
-
-    return nullptr;
+    // The area is only written by this class, so the index always matches
+    // the TOC
+    auto it = m_index.find(name);
+    return it == m_index.end() ? nullptr : it->second;
 }
 
 void LegacyPropertyService::update_property(LegacyPropInfo *pi,
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/memory_budget.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "mbcommon/integer.h"
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/util/memory_budget"
+
+// Environment variable for overriding the budget (in MiB)
+#define MEMORY_BUDGET_ENV       "MBTOOL_MEMORY_BUDGET"
+
+// Not defined in older kernel headers
+#ifndef TMPFS_MAGIC
+#  define TMPFS_MAGIC           0x01021994
+#endif
+
+namespace mb
+{
+
+static std::once_flag g_budget_once;
+static std::atomic<uint64_t> g_budget(UINT64_MAX);
+
+/*!
+ * \brief Read a field (in kiB) from a `/proc` status file
+ */
+static std::optional<uint64_t> read_kib_field(const char *path,
+                                              const char *field)
+{
+    FILE *fp = fopen(path, "re");
+    if (!fp) {
+        return std::nullopt;
+    }
+
+    char line[256];
+    size_t field_len = strlen(field);
+    std::optional<uint64_t> result;
+
+    while (fgets(line, sizeof(line), fp)) {
+        uint64_t value;
+
+        if (strncmp(line, field, field_len) == 0 && line[field_len] == ':'
+                && sscanf(line + field_len + 1, "%" SCNu64, &value) == 1) {
+            result = value * 1024;
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    return result;
+}
+
+static void init_budget()
+{
+    if (const char *value = getenv(MEMORY_BUDGET_ENV)) {
+        uint64_t mib;
+
+        if (str_to_num(value, 10, mib) && mib <= UINT64_MAX / 1024 / 1024) {
+            g_budget = mib * 1024 * 1024;
+            LOGD("Memory budget from environment: %" PRIu64 " bytes",
+                 g_budget.load());
+            return;
+        }
+
+        LOGW("Ignoring invalid %s value: %s", MEMORY_BUDGET_ENV, value);
+    }
+
+    // Leave room for the recovery and for whatever the ROM's own installer
+    // puts on tmpfs
+    if (auto available = memory_available()) {
+        g_budget = *available / 2;
+        LOGD("Memory budget: %" PRIu64 " bytes", g_budget.load());
+    } else {
+        LOGW("Failed to determine available memory; memory budget disabled");
+    }
+}
+
+/*!
+ * \brief Get the amount of memory that may be used for staging data in RAM
+ *
+ * This covers memory allocations, memfds, and files on tmpfs. The budget is
+ * half of the memory that was available when this function is first called,
+ * unless it is overridden with the `MBTOOL_MEMORY_BUDGET` environment variable
+ * (in MiB) or set_memory_budget().
+ *
+ * \return Budget in bytes or `UINT64_MAX` if there is no limit
+ */
+uint64_t memory_budget()
+{
+    std::call_once(g_budget_once, init_budget);
+    return g_budget;
+}
+
+/*!
+ * \brief Override the memory budget
+ *
+ * \param bytes Budget in bytes or `UINT64_MAX` for no limit
+ */
+void set_memory_budget(uint64_t bytes)
+{
+    // Prevent a later memory_budget() call from overwriting the value
+    std::call_once(g_budget_once, [] {});
+    g_budget = bytes;
+}
+
+/*!
+ * \brief Check if staging some data in RAM fits within the memory budget
+ *
+ * The amount of memory that is currently available is also taken into
+ * account since it may have shrunk since the budget was computed.
+ *
+ * \param bytes Estimated peak size of the data that would be kept in RAM
+ *
+ * \return Whether the data should be kept in RAM. If false, the caller should
+ *         stream the data or stage it on disk.
+ */
+bool memory_budget_allows(uint64_t bytes)
+{
+    auto budget = memory_budget();
+    if (budget == UINT64_MAX) {
+        return true;
+    }
+
+    if (auto available = memory_available()) {
+        budget = std::min(budget, *available);
+    }
+
+    return bytes <= budget;
+}
+
+/*!
+ * \brief Get the amount of memory available for new allocations
+ *
+ * \return `MemAvailable` from `/proc/meminfo` (or `MemFree` + `Cached` on
+ *         kernels older than 3.14) or std::nullopt if it cannot be determined
+ */
+std::optional<uint64_t> memory_available()
+{
+    if (auto available = read_kib_field("/proc/meminfo", "MemAvailable")) {
+        return available;
+    }
+
+    auto free = read_kib_field("/proc/meminfo", "MemFree");
+    auto cached = read_kib_field("/proc/meminfo", "Cached");
+    if (free && cached) {
+        return *free + *cached;
+    }
+
+    return std::nullopt;
+}
+
+/*!
+ * \brief Reset the peak RSS of this process to its current RSS
+ *
+ * This requires Linux 4.0 or newer. On older kernels, the peak RSS always
+ * covers the lifetime of the process.
+ */
+void reset_peak_rss()
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (write(fd, "5", 1) < 0) {
+            LOGV("Failed to reset peak RSS: %s", strerror(errno));
+        }
+        close(fd);
+    }
+}
+
+/*!
+ * \brief Get the current memory usage
+ *
+ * \param tmpfs_paths Paths whose filesystems should be counted if they are
+ *                    tmpfs mounts. Each mount is only counted once.
+ *
+ * \return Memory usage. Values that cannot be determined are 0.
+ */
+MemoryUsage memory_usage(const std::vector<std::string> &tmpfs_paths)
+{
+    MemoryUsage usage{};
+
+    if (auto hwm = read_kib_field("/proc/self/status", "VmHWM")) {
+        usage.peak_rss = *hwm;
+    }
+
+    rusage ru;
+    if (getrusage(RUSAGE_CHILDREN, &ru) == 0) {
+        usage.child_peak_rss = static_cast<uint64_t>(ru.ru_maxrss) * 1024;
+    }
+
+    std::vector<dev_t> devices;
+
+    for (auto const &path : tmpfs_paths) {
+        struct stat sb;
+        struct statfs sfs;
+
+        if (stat(path.c_str(), &sb) < 0
+                || std::find(devices.begin(), devices.end(), sb.st_dev)
+                        != devices.end()
+                || statfs(path.c_str(), &sfs) < 0
+                || static_cast<uint64_t>(sfs.f_type) != TMPFS_MAGIC) {
+            continue;
+        }
+
+        devices.push_back(sb.st_dev);
+        usage.tmpfs_used += static_cast<uint64_t>(sfs.f_blocks - sfs.f_bfree)
+                * static_cast<uint64_t>(sfs.f_bsize);
+    }
+
+    return usage;
+}
+
+}
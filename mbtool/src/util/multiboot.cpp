@@ -21,15 +21,17 @@
 
 #include <cerrno>
 #include <cstring>
+
+#include <grp.h>
+#include <pwd.h>
 #include <sys/stat.h>
 
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/chmod.h"
-#include "mbutil/chown.h"
 #include "mbutil/copy.h"
 #include "mbutil/file.h"
 #include "mbutil/fts.h"
+#include "mbutil/metadata.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
@@ -82,7 +84,10 @@ public:
         // CopyFlag::ExcludeTopLevel flag)
         if (auto r = util::copy_dir(_curr->fts_accpath, _target,
                                     util::CopyFlag::CopyAttributes
-                                  | util::CopyFlag::CopyXattrs); !r) {
+                                  | util::CopyFlag::CopyXattrs
+                                  | util::CopyFlag::Sparse
+                                  | util::CopyFlag::Parallel
+                                  | util::CopyFlag::Reflink); !r) {
             _error_msg = format("Failed to copy directory: %s",
                                 r.error().message().c_str());
             LOGW("%s", _error_msg.c_str());
@@ -140,7 +145,8 @@ private:
     {
         if (auto r = util::copy_file(_curr->fts_accpath, _curtgtpath,
                                      util::CopyFlag::CopyAttributes
-                                   | util::CopyFlag::CopyXattrs); !r) {
+                                   | util::CopyFlag::CopyXattrs
+                                   | util::CopyFlag::Sparse); !r) {
             _error_msg = format("Failed to copy file: %s",
                                 r.error().message().c_str());
             LOGW("%s", _error_msg.c_str());
@@ -165,7 +171,8 @@ bool copy_system(const std::string &source, const std::string &target)
 /*!
  * \brief Fix permissions and label on /data/media/0/MultiBoot/
  *
- * This function will do the following on /data/media/0/MultiBoot/:
+ * This function will do the following on /data/media/0/MultiBoot/ in a
+ * single pass over the tree:
  * 1. Recursively change ownership to media_rw:media_rw
  * 2. Recursively change mode to 0775
  * 3. Recursively change the SELinux label to the same label as /data/media/0/
@@ -176,28 +183,34 @@ bool fix_multiboot_permissions()
 {
     (void) util::create_empty_file(MULTIBOOT_DIR "/.nomedia");
 
-    if (auto r = util::chown(MULTIBOOT_DIR, "media_rw", "media_rw",
-                             util::ChownFlag::Recursive); !r) {
-        LOGE("Failed to chown %s: %s", MULTIBOOT_DIR,
-             r.error().message().c_str());
+    util::Metadata metadata;
+    metadata.mode = 0775;
+
+    // WARNING: Not thread safe! Android doesn't have getpwnam_r() or
+    // getgrnam_r()
+    if (struct passwd *pw = getpwnam("media_rw")) {
+        metadata.uid = pw->pw_uid;
+    } else {
+        LOGE("Failed to look up media_rw user");
         return false;
     }
-
-    if (auto r = util::chmod(MULTIBOOT_DIR, 0775,
-                             util::ChmodFlag::Recursive); !r) {
-        LOGE("Failed to chmod %s: %s", MULTIBOOT_DIR,
-             r.error().message().c_str());
+    if (struct group *gr = getgrnam("media_rw")) {
+        metadata.gid = gr->gr_gid;
+    } else {
+        LOGE("Failed to look up media_rw group");
         return false;
     }
 
     if (auto context = util::selinux_lget_context(INTERNAL_STORAGE)) {
-        if (auto ret = util::selinux_lset_context_recursive(
-                MULTIBOOT_DIR, context.value()); !ret) {
-            LOGE("%s: Failed to set context to %s: %s",
-                 MULTIBOOT_DIR, context.value().c_str(),
-                 ret.error().message().c_str());
-            return false;
-        }
+        metadata.context = std::move(context.value());
+    }
+
+    if (auto r = util::apply_metadata(
+            MULTIBOOT_DIR, metadata,
+            util::MetadataFlag::Recursive | util::MetadataFlag::Parallel); !r) {
+        LOGE("%s: Failed to fix permissions: %s",
+             MULTIBOOT_DIR, r.error().message().c_str());
+        return false;
     }
 
     return true;
@@ -17,6 +17,7 @@
 
 #include "util/property_service.h"
 
+#include <algorithm>
 #include <chrono>
 #include <string_view>
 
@@ -27,8 +28,7 @@
 
 #include <fcntl.h>
 #include <netinet/in.h>
-#include <sys/poll.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -52,126 +52,155 @@
 
 #define LOG_TAG "mbtool/util/property_service"
 
-class SocketConnection
+// mbtool-specific command for setting multiple properties in one message. The
+// payload is a uint32 count followed by that many name/value string pairs (in
+// the same format as PROP_MSG_SETPROP2). The reply contains one uint32 result
+// per property.
+#define PROP_MSG_SETPROP_BATCH 0x4d420001
+
+using namespace std::chrono;
+
+// Time a client has to send a complete message
+static constexpr milliseconds CLIENT_TIMEOUT(2000);
+
+static constexpr size_t MAX_STRING_SIZE = 0xffff;
+static constexpr uint32_t MAX_BATCH_SIZE = 1024;
+static constexpr size_t MAX_MESSAGE_SIZE = 1024 * 1024;
+
+class PropertyClient
 {
 public:
-    SocketConnection(int fd)
+    PropertyClient(int fd)
         : m_fd(fd)
+        , m_deadline(steady_clock::now() + CLIENT_TIMEOUT)
     {
     }
 
-    ~SocketConnection()
+    ~PropertyClient()
     {
         close(m_fd);
     }
 
-    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SocketConnection)
-    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(SocketConnection)
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PropertyClient)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PropertyClient)
 
-    int fd()
+    int fd() const
     {
         return m_fd;
     }
 
-    mb::oc::result<void> recv_data(void *data, size_t size,
-                                   std::chrono::milliseconds &timeout)
+    steady_clock::time_point deadline() const
     {
-        char *ptr = static_cast<char *>(data);
-        size_t remain = size;
-
-        while (timeout.count() > 0 && remain > 0) {
-            OUTCOME_TRYV(poll_socket(timeout));
+        return m_deadline;
+    }
 
-            auto result = TEMP_FAILURE_RETRY(
-                    recv(m_fd, ptr, remain, MSG_DONTWAIT));
-            if (result < 0) {
+    /*!
+     * \brief Read all data that is currently available
+     *
+     * \return Whether the peer still has the connection open or an error if
+     *         the data could not be read
+     */
+    mb::oc::result<bool> receive()
+    {
+        char buf[4096];
+
+        while (true) {
+            auto n = TEMP_FAILURE_RETRY(
+                    recv(m_fd, buf, sizeof(buf), MSG_DONTWAIT));
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
                 return mb::ec_from_errno();
-            } else if (result == 0) {
-                break;
+            } else if (n == 0) {
+                return false;
+            }
+
+            if (m_data.size() + static_cast<size_t>(n) > MAX_MESSAGE_SIZE) {
+                return std::errc::message_size;
             }
 
-            ptr += result;
-            remain -= result;
+            m_data.append(buf, static_cast<size_t>(n));
         }
+    }
 
-        if (remain > 0) {
-            return std::errc::io_error;
+    bool read_uint32(size_t &pos, uint32_t &value) const
+    {
+        if (m_data.size() - pos < sizeof(value)) {
+            return false;
         }
 
-        return mb::oc::success();
-    }
+        memcpy(&value, m_data.data() + pos, sizeof(value));
+        pos += sizeof(value);
 
+        return true;
+    }
 
-    mb::oc::result<uint32_t> recv_uint32(std::chrono::milliseconds &timeout)
+    /*!
+     * \brief Read a NULL-padded string from a fixed size field
+     *
+     * \return Whether the full field has been received
+     */
+    bool read_fixed_string(size_t &pos, size_t size, std::string &str) const
     {
-        uint32_t value;
-        OUTCOME_TRYV(recv_data(&value, sizeof(value), timeout));
-        return value;
+        if (m_data.size() - pos < size) {
+            return false;
+        }
+
+        auto begin = m_data.data() + pos;
+        str.assign(begin, strnlen(begin, size - 1));
+        pos += size;
+
+        return true;
     }
 
-    mb::oc::result<std::string> recv_string(std::chrono::milliseconds &timeout)
+    /*!
+     * \brief Read a length-prefixed string
+     *
+     * \return Whether the full string has been received or an error if the
+     *         string is too long
+     */
+    mb::oc::result<bool> read_string(size_t &pos, std::string &str) const
     {
-        OUTCOME_TRY(len, recv_uint32(timeout));
-        if (len == 0) {
-            return "";
-        } else if (len > 0xffff) {
+        uint32_t len;
+        if (!read_uint32(pos, len)) {
+            return false;
+        } else if (len > MAX_STRING_SIZE) {
             return std::errc::not_enough_memory;
+        } else if (m_data.size() - pos < len) {
+            return false;
         }
 
-        std::string str;
-        str.resize(len);
-
-        OUTCOME_TRYV(recv_data(str.data(), str.size(), timeout));
+        str.assign(m_data, pos, len);
+        pos += len;
 
-        return std::move(str);
+        return true;
     }
 
-    mb::oc::result<void> send_uint32(uint32_t value)
+    mb::oc::result<void> send_uint32s(const uint32_t *values, size_t count)
     {
+        size_t size = count * sizeof(*values);
+
         auto result = TEMP_FAILURE_RETRY(
-                send(m_fd, &value, sizeof(value), 0));
+                send(m_fd, values, size, MSG_DONTWAIT | MSG_NOSIGNAL));
         if (result < 0) {
             return mb::ec_from_errno();
-        } else if (result != sizeof(value)) {
+        } else if (static_cast<size_t>(result) != size) {
             return std::errc::io_error;
         }
 
         return mb::oc::success();
     }
 
-private:
-    int m_fd;
-
-    mb::oc::result<void> poll_socket(std::chrono::milliseconds &timeout)
+    mb::oc::result<void> send_uint32(uint32_t value)
     {
-        using namespace std::chrono;
-
-        pollfd pfd;
-        pfd.fd = m_fd;
-        pfd.events = POLLIN;
-        pfd.revents = 0;
-
-        while (timeout.count() > 0) {
-            auto start = steady_clock::now();
-            int nr = poll(&pfd, 1, timeout.count());
-
-            if (nr > 0) {
-                return mb::oc::success();
-            } else if (nr == 0) {
-                break;
-            } else if (errno != EINTR) {
-                return mb::ec_from_errno();
-            }
-
-            auto end = steady_clock::now();
-            auto elapsed = duration_cast<milliseconds>(end - start);
-
-            timeout = (elapsed > timeout) ? 0ms : (timeout - elapsed);
-        }
-
-        LOGW("Socket timed out waiting for data");
-        return std::errc::timed_out;
+        return send_uint32s(&value, 1);
     }
+
+private:
+    int m_fd;
+    steady_clock::time_point m_deadline;
+    std::string m_data;
 };
 
 PropertyService::PropertyService()
@@ -243,6 +272,14 @@ static bool is_legal_property_name(const std::string_view &name)
     return true;
 }
 
+/*!
+ * \brief Set a property
+ *
+ * \pre The caller must hold \ref m_mutex
+ *
+ * \return PROP_SUCCESS if the property was set. Otherwise, one of the
+ *         PROP_ERROR_* values.
+ */
 uint32_t PropertyService::set_internal(const std::string &name,
                                        std::string_view value)
 {
@@ -278,14 +315,61 @@ uint32_t PropertyService::set_internal(const std::string &name,
         }
     }
 
+    m_cond.notify_all();
+
     return PROP_SUCCESS;
 }
 
 bool PropertyService::set(const std::string &name, std::string_view value)
 {
+    std::lock_guard lock(m_mutex);
     return set_internal(name, value) == PROP_SUCCESS;
 }
 
+/*!
+ * \brief Set multiple properties at once
+ *
+ * This is equivalent to calling set() for each property, but only acquires
+ * the lock once.
+ *
+ * \return Whether all of the properties were set
+ */
+bool PropertyService::set_many(
+        const std::vector<std::pair<std::string, std::string>> &props)
+{
+    std::lock_guard lock(m_mutex);
+    bool ret = true;
+
+    for (auto const &[name, value] : props) {
+        ret = set_internal(name, value) == PROP_SUCCESS && ret;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Wait for a property to be set to a value
+ *
+ * Waiters are woken up whenever a property is set through this service, so no
+ * polling is involved.
+ *
+ * \param name Property name
+ * \param value Value to wait for
+ * \param timeout Maximum time to wait
+ *
+ * \return Whether the property has the specified value
+ */
+bool PropertyService::wait(const std::string &name, std::string_view value,
+                           milliseconds timeout)
+{
+    std::unique_lock lock(m_mutex);
+
+    return m_cond.wait_for(lock, timeout, [&] {
+        auto current = get(name);
+        return current && *current == value;
+    });
+}
+
 bool PropertyService::start_thread()
 {
     if (m_setter_fd >= 0) {
@@ -390,141 +474,300 @@ int PropertyService::create_socket()
 
 void PropertyService::socket_handler_loop()
 {
-    pollfd fds[2];
-    fds[0].fd = m_stopper_pipe[0];
-    fds[0].events = POLLIN;
-    fds[1].fd = m_setter_fd;
-    fds[1].events = POLLIN;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        LOGE("Failed to create epoll instance: %s", strerror(errno));
+        return;
+    }
+
+    auto close_epfd = mb::finally([&] {
+        m_clients.clear();
+        close(epfd);
+    });
+
+    for (int fd : { m_stopper_pipe[0], m_setter_fd }) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("Failed to add fd to epoll instance: %s", strerror(errno));
+            return;
+        }
+    }
 
     while (true) {
-        fds[0].revents = 0;
-        fds[1].revents = 0;
+        int timeout = -1;
+
+        if (!m_clients.empty()) {
+            auto now = steady_clock::now();
+            auto deadline = steady_clock::time_point::max();
+
+            for (auto const &[fd, client] : m_clients) {
+                (void) fd;
+                deadline = std::min(deadline, client->deadline());
+            }
 
-        if (poll(fds, 2, -1) < 0) {
+            timeout = deadline <= now ? 0 : static_cast<int>(
+                    ceil<milliseconds>(deadline - now).count());
+        }
+
+        epoll_event events[16];
+        int n = epoll_wait(epfd, events, static_cast<int>(std::size(events)),
+                           timeout);
+        if (n < 0) {
             if (errno == EINTR) {
                 continue;
             } else {
-                LOGE("Failed to poll socket: %s", strerror(errno));
+                LOGE("Failed to poll sockets: %s", strerror(errno));
+                return;
+            }
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+
+            if (fd == m_stopper_pipe[0]) {
+                LOGV("Received notification to stop property service");
                 return;
+            } else if (fd == m_setter_fd) {
+                socket_accept_clients(epfd);
+            } else if (auto it = m_clients.find(fd); it != m_clients.end()) {
+                if (!socket_handle_client(*it->second)) {
+                    // Closing the fd removes it from the epoll instance
+                    m_clients.erase(it);
+                }
             }
         }
-        if (fds[0].revents & POLLIN) {
-            LOGV("Received notification to stop property service");
-            break;
+
+        auto now = steady_clock::now();
+
+        for (auto it = m_clients.begin(); it != m_clients.end();) {
+            if (it->second->deadline() <= now) {
+                LOGW("Socket timed out waiting for data");
+                socket_handle_incomplete(*it->second);
+                it = m_clients.erase(it);
+            } else {
+                ++it;
+            }
         }
-        if (fds[1].revents & POLLIN) {
-            socket_handle_set_property();
+    }
+}
+
+void PropertyService::socket_accept_clients(int epfd)
+{
+    while (true) {
+        int fd = accept4(m_setter_fd, nullptr, nullptr,
+                         SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                LOGE("Failed to accept socket connection: %s",
+                     strerror(errno));
+            }
+            return;
+        }
+
+        auto client = std::make_unique<PropertyClient>(fd);
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOGE("Failed to add socket to epoll instance: %s",
+                 strerror(errno));
+            continue;
         }
+
+        m_clients.emplace(fd, std::move(client));
     }
 }
 
-void PropertyService::socket_handle_set_property()
+/*!
+ * \brief Handle new data from a client
+ *
+ * \return Whether the connection should be kept open
+ */
+bool PropertyService::socket_handle_client(PropertyClient &client)
 {
-    static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT(2000);
+    auto is_open = client.receive();
+    if (!is_open) {
+        LOGE("Failed to receive data from the socket: %s",
+             is_open.error().message().c_str());
+        socket_handle_incomplete(client);
+        return false;
+    }
 
-    int fd = accept4(m_setter_fd, nullptr, nullptr, SOCK_CLOEXEC);
-    if (fd == -1) {
-        LOGE("Failed to accept socket connection: %s", strerror(errno));
-        return;
+    if (socket_handle_message(client)) {
+        return false;
+    } else if (!is_open.value()) {
+        LOGE("Socket closed before receiving full message");
+        socket_handle_incomplete(client);
+        return false;
     }
 
-    SocketConnection socket(fd);
-    auto timeout = DEFAULT_TIMEOUT;
+    return true;
+}
+
+/*!
+ * \brief Handle the message from a client if it has been fully received
+ *
+ * \return Whether the message was handled (or rejected) and a reply, if any,
+ *         has been sent
+ */
+bool PropertyService::socket_handle_message(PropertyClient &client)
+{
+    size_t pos = 0;
+    uint32_t cmd;
 
-    auto cmd = socket.recv_uint32(timeout);
-    if (!cmd) {
-        LOGE("Failed to read command from socket: %s",
-             cmd.error().message().c_str());
-        (void) socket.send_uint32(PROP_ERROR_READ_CMD);
-        return;
+    if (!client.read_uint32(pos, cmd)) {
+        return false;
     }
 
-    switch (cmd.value()) {
+    switch (cmd) {
     case PROP_MSG_SETPROP: {
-        char name[PROP_NAME_MAX];
-        char value[PROP_VALUE_MAX];
+        std::string name;
+        std::string value;
 
-        if (auto r = socket.recv_data(name, PROP_NAME_MAX, timeout); !r) {
-            LOGE("Failed to receive name from the socket: %s",
-                 r.error().message().c_str());
-            return;
+        if (!client.read_fixed_string(pos, PROP_NAME_MAX, name)
+                || !client.read_fixed_string(pos, PROP_VALUE_MAX, value)) {
+            return false;
         }
 
-        if (auto r = socket.recv_data(value, PROP_VALUE_MAX, timeout); !r) {
-            LOGE("Failed to receive value from the socket: %s",
-                 r.error().message().c_str());
-            return;
+        std::lock_guard lock(m_mutex);
+
+        // The legacy protocol has no reply
+        (void) socket_handle_set_property("PROP_MSG_SETPROP", name, value);
+        return true;
+    }
+
+    case PROP_MSG_SETPROP2: {
+        std::string name;
+        std::string value;
+
+        for (auto *str : { &name, &value }) {
+            auto r = client.read_string(pos, *str);
+            if (!r) {
+                LOGE("Failed to receive data from the socket: %s",
+                     r.error().message().c_str());
+                (void) client.send_uint32(PROP_ERROR_READ_DATA);
+                return true;
+            } else if (!r.value()) {
+                return false;
+            }
         }
 
-        name[PROP_NAME_MAX - 1] = '\0';
-        value[PROP_VALUE_MAX - 1] = '\0';
+        uint32_t result;
 
-        socket_handle_set_property_impl(socket, name, value, true);
-        break;
+        {
+            std::lock_guard lock(m_mutex);
+            result = socket_handle_set_property(
+                    "PROP_MSG_SETPROP2", name, value);
+        }
+
+        (void) client.send_uint32(result);
+        return true;
     }
 
-    case PROP_MSG_SETPROP2: {
-        auto name = socket.recv_string(timeout);
-        if (!name) {
-            LOGE("Failed to receive name from the socket: %s",
-                 name.error().message().c_str());
-            (void) socket.send_uint32(PROP_ERROR_READ_DATA);
-            return;
+    case PROP_MSG_SETPROP_BATCH: {
+        uint32_t count;
+
+        if (!client.read_uint32(pos, count)) {
+            return false;
+        } else if (count > MAX_BATCH_SIZE) {
+            LOGE("[PROP_MSG_SETPROP_BATCH] Too many properties: %u", count);
+            (void) client.send_uint32(PROP_ERROR_READ_DATA);
+            return true;
         }
 
-        auto value = socket.recv_string(timeout);
-        if (!value) {
-            LOGE("Failed to receive value from the socket: %s",
-                 value.error().message().c_str());
-            (void) socket.send_uint32(PROP_ERROR_READ_DATA);
-            return;
+        std::vector<std::pair<std::string, std::string>> props(count);
+
+        for (auto &[name, value] : props) {
+            for (auto *str : { &name, &value }) {
+                auto r = client.read_string(pos, *str);
+                if (!r) {
+                    LOGE("Failed to receive data from the socket: %s",
+                         r.error().message().c_str());
+                    (void) client.send_uint32(PROP_ERROR_READ_DATA);
+                    return true;
+                } else if (!r.value()) {
+                    return false;
+                }
+            }
         }
 
-        socket_handle_set_property_impl(socket, name.value(), value.value(),
-                                        false);
-        break;
-      }
+        std::vector<uint32_t> results;
+        results.reserve(count);
+
+        {
+            std::lock_guard lock(m_mutex);
+
+            for (auto const &[name, value] : props) {
+                results.push_back(socket_handle_set_property(
+                        "PROP_MSG_SETPROP_BATCH", name, value));
+            }
+        }
+
+        (void) client.send_uint32s(results.data(), results.size());
+        return true;
+    }
 
     default:
-        LOGE("Invalid command: %u", cmd.value());
-        (void) socket.send_uint32(PROP_ERROR_INVALID_CMD);
-        break;
+        LOGE("Invalid command: %u", cmd);
+        (void) client.send_uint32(PROP_ERROR_INVALID_CMD);
+        return true;
     }
 }
 
-void PropertyService::socket_handle_set_property_impl(SocketConnection &socket,
-                                                      const std::string &name,
-                                                      std::string_view value,
-                                                      bool legacy)
+/*!
+ * \brief Send an error reply to a client that did not send a full message
+ */
+void PropertyService::socket_handle_incomplete(PropertyClient &client)
 {
-    const char *cmd_name = legacy ? "PROP_MSG_SETPROP" : "PROP_MSG_SETPROP2";
+    size_t pos = 0;
+    uint32_t cmd;
 
+    if (!client.read_uint32(pos, cmd)) {
+        LOGE("Failed to read command from socket");
+        (void) client.send_uint32(PROP_ERROR_READ_CMD);
+    } else if (cmd != PROP_MSG_SETPROP) {
+        (void) client.send_uint32(PROP_ERROR_READ_DATA);
+    }
+}
+
+/*!
+ * \brief Handle a property set request from a client
+ *
+ * \pre The caller must hold \ref m_mutex
+ *
+ * \return Result to send back to the client
+ */
+uint32_t PropertyService::socket_handle_set_property(const char *cmd_name,
+                                                     const std::string &name,
+                                                     std::string_view value)
+{
     if (!is_legal_property_name(name)) {
         LOGE("[%s] Invalid property name: '%s'", cmd_name, name.c_str());
-        (void) socket.send_uint32(PROP_ERROR_INVALID_NAME);
-        return;
+        return PROP_ERROR_INVALID_NAME;
     }
 
     if (mb::starts_with(name, "ctl.")) {
         LOGW("[%s] Ignoring control message: '%s'='%s'",
              cmd_name, name.c_str(), std::string(value).c_str());
-        if (!legacy) {
-            (void) socket.send_uint32(PROP_SUCCESS);
-        }
-    } else {
-        uint32_t result = set(name, value);
-        if (!legacy) {
-            (void) socket.send_uint32(result);
-        }
+        return PROP_SUCCESS;
     }
+
+    return set_internal(name, value);
 }
 
 bool PropertyService::load_properties_file(const std::string &path,
                                            std::string_view filter)
 {
+    std::lock_guard lock(m_mutex);
+
     if (!mb::util::property_file_iter(path, filter, [&](std::string_view key,
                                                         std::string_view value) {
-        set(std::string(key), value);
+        set_internal(std::string(key), value);
         return mb::util::PropertyIterAction::Continue;
     })) {
         LOGW("%s: Failed to load property file", path.c_str());
@@ -20,16 +20,23 @@
 #include "util/roms.h"
 
 #include <algorithm>
+#include <mutex>
+#include <optional>
+#include <string_view>
 
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
+#include <unistd.h>
 
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/file.h"
 #include "mbutil/mount.h"
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
@@ -39,7 +46,7 @@
 #define LOG_TAG "mbtool/util/roms"
 
 
-static std::vector<std::string> extsd_mount_points{
+static constexpr const char *extsd_mount_points[] = {
     "/raw/extsd",
     "/external_sd",
     "/external_sdcard",
@@ -287,12 +294,17 @@ void Roms::add_extsd_roms()
     std::move(temp_roms.begin(), temp_roms.end(), std::back_inserter(roms));
 }
 
+void Roms::add_all()
+{
+    add_builtin();
+    add_data_roms();
+    add_extsd_roms();
+}
+
 void Roms::add_installed()
 {
     Roms all_roms;
-    all_roms.add_builtin();
-    all_roms.add_data_roms();
-    all_roms.add_extsd_roms();
+    all_roms.add_all();
 
     struct stat sb;
 
@@ -331,8 +343,156 @@ std::shared_ptr<Rom> Roms::find_by_id(const std::string &id) const
     return std::shared_ptr<Rom>();
 }
 
+//! Largest valid current ROM cache file
+static constexpr size_t CURRENT_ROM_CACHE_MAX_SIZE = 256;
+
+static std::string get_boot_id()
+{
+    auto boot_id = util::file_first_line(BOOT_ID_PATH);
+    if (!boot_id) {
+        return {};
+    }
+
+    return std::move(boot_id.value());
+}
+
+/*!
+ * \brief Read the booted ROM ID cached by init
+ *
+ * The cache is only trusted if it is a regular file owned by root that only
+ * root can access and if it was written during the current boot.
+ *
+ * \return ROM ID or an empty string if the cache is missing or invalid
+ */
+static std::string read_current_rom_cache()
+{
+    int fd = open(CURRENT_ROM_CACHE_PATH, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return {};
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0
+            || !S_ISREG(sb.st_mode)
+            || sb.st_uid != 0
+            || (sb.st_mode & 077) != 0
+            || sb.st_size <= 0
+            || static_cast<size_t>(sb.st_size) > CURRENT_ROM_CACHE_MAX_SIZE) {
+        return {};
+    }
+
+    char buf[CURRENT_ROM_CACHE_MAX_SIZE];
+    ssize_t n;
+    do {
+        n = pread(fd, buf, sizeof(buf), 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != sb.st_size) {
+        return {};
+    }
+
+    // Format: <boot ID>\n<ROM ID>\n
+    std::string_view contents(buf, static_cast<size_t>(n));
+    auto boot_id_end = contents.find('\n');
+    if (boot_id_end == std::string_view::npos || contents.back() != '\n') {
+        return {};
+    }
+
+    auto boot_id = contents.substr(0, boot_id_end);
+    std::string rom_id(contents.substr(boot_id_end + 1,
+                                       contents.size() - boot_id_end - 2));
+
+    if (boot_id.empty() || boot_id != get_boot_id()
+            || !Roms::is_valid(rom_id)) {
+        return {};
+    }
+
+    return rom_id;
+}
+
+/*!
+ * \brief Cache the booted ROM ID for the rest of the boot
+ *
+ * This should be called once by init after the ROM has been mounted. The file
+ * lives on the ramdisk, so it does not survive a reboot. It also records the
+ * kernel's boot ID so that a stale file is never trusted.
+ *
+ * \param id Booted ROM ID
+ *
+ * \return Whether the cache was written
+ */
+bool Roms::cache_current_rom(const std::string &id)
+{
+    auto boot_id = get_boot_id();
+    if (boot_id.empty()) {
+        LOGW("%s: Failed to read boot ID", BOOT_ID_PATH);
+        return false;
+    }
+
+    std::string contents(boot_id);
+    contents += '\n';
+    contents += id;
+    contents += '\n';
+
+    std::string temp_path(CURRENT_ROM_CACHE_PATH ".tmp");
+
+    int fd = open(temp_path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGW("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        unlink(temp_path.c_str());
+    });
+
+    bool ok = fchmod(fd, 0600) == 0
+            && write(fd, contents.data(), contents.size())
+                    == static_cast<ssize_t>(contents.size());
+    int saved_errno = errno;
+
+    if (close(fd) < 0 && ok) {
+        ok = false;
+        saved_errno = errno;
+    }
+
+    if (!ok) {
+        LOGW("%s: Failed to write file: %s",
+             temp_path.c_str(), strerror(saved_errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), CURRENT_ROM_CACHE_PATH) < 0) {
+        LOGW("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             CURRENT_ROM_CACHE_PATH, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Get the currently booted ROM
+ *
+ * If init cached the booted ROM, then the ROM is created directly from the
+ * cached ID. Otherwise, the installed ROMs are scanned.
+ *
+ * \return Booted ROM or nullptr if it could not be determined
+ */
 std::shared_ptr<Rom> Roms::get_current_rom()
 {
+    if (auto id = read_current_rom_cache(); !id.empty()) {
+        if (auto rom = create_rom(id)) {
+            return rom;
+        }
+    }
+
     Roms roms;
     roms.add_installed();
 
@@ -414,54 +574,98 @@ bool Roms::is_valid(const std::string &id)
             || (id != "extsd-slot-" && starts_with(id.c_str(), "extsd-slot-"));
 }
 
-std::string Roms::get_system_partition()
+// Resolving the partition mount points takes up to three stat() calls and is
+// done for nearly every path that mbtool builds, so the results are memoized.
+// The cache is dropped whenever util::MountTable reports that the mount table
+// changed, which only costs a poll() when nothing happened. Creating one of
+// the candidate directories without mounting anything on it is not detected.
+
+enum PartitionIndex
 {
-    struct stat sb;
-    if (stat("/raw/system", &sb) == 0) {
-        return "/raw/system";
-    } else if (stat("/raw-system", &sb) == 0) {
-        return "/raw-system";
-    } else if (stat("/system", &sb) == 0) {
-        return "/system";
-    } else {
-        return std::string();
+    PARTITION_SYSTEM,
+    PARTITION_CACHE,
+    PARTITION_DATA,
+    PARTITION_COUNT,
+};
+
+static const char * const partition_candidates[PARTITION_COUNT][3] = {
+    { "/raw/system", "/raw-system", "/system" },
+    { "/raw/cache", "/raw-cache", "/cache" },
+    { "/raw/data", "/raw-data", "/data" },
+};
+
+static std::mutex partition_cache_lock;
+static std::string partition_cache[PARTITION_COUNT];
+static std::optional<util::MountTable> partition_mount_table;
+static pid_t partition_mount_table_pid = 0;
+
+// Must be called with partition_cache_lock held. Returns whether the cached
+// entries can be trusted.
+static bool check_partition_cache()
+{
+    // The poll state of the mountinfo fd is shared with forked children, so
+    // each process uses its own table
+    if (!partition_mount_table || partition_mount_table_pid != getpid()) {
+        partition_mount_table.emplace();
+        partition_mount_table_pid = getpid();
+    }
+
+    auto changed = partition_mount_table->refresh();
+    if (!changed || changed.value()) {
+        for (auto &entry : partition_cache) {
+            entry.clear();
+        }
     }
+
+    return !!changed;
 }
 
-std::string Roms::get_cache_partition()
+static std::string get_partition(PartitionIndex index)
 {
+    std::lock_guard<std::mutex> lock(partition_cache_lock);
+
+    bool cacheable = check_partition_cache();
+
+    auto &cached = partition_cache[index];
+    if (!cached.empty()) {
+        return cached;
+    }
+
     struct stat sb;
-    if (stat("/raw/cache", &sb) == 0) {
-        return "/raw/cache";
-    } else if (stat("/raw-cache", &sb) == 0) {
-        return "/raw-cache";
-    } else if (stat("/cache", &sb) == 0) {
-        return "/cache";
-    } else {
-        return std::string();
+    for (auto const *candidate : partition_candidates[index]) {
+        if (stat(candidate, &sb) == 0) {
+            if (cacheable) {
+                cached = candidate;
+            }
+            return candidate;
+        }
     }
+
+    // Missing mount points are not cached since they are expected to appear
+    return {};
+}
+
+std::string Roms::get_system_partition()
+{
+    return get_partition(PARTITION_SYSTEM);
+}
+
+std::string Roms::get_cache_partition()
+{
+    return get_partition(PARTITION_CACHE);
 }
 
 std::string Roms::get_data_partition()
 {
-    struct stat sb;
-    if (stat("/raw/data", &sb) == 0) {
-        return "/raw/data";
-    } else if (stat("/raw-data", &sb) == 0) {
-        return "/raw-data";
-    } else if (stat("/data", &sb) == 0) {
-        return "/data";
-    } else {
-        return std::string();
-    }
+    return get_partition(PARTITION_DATA);
 }
 
 std::string Roms::get_extsd_partition()
 {
     // Try hard-coded mount points first
     struct stat sb;
-    for (const std::string &mount_point : extsd_mount_points) {
-        if (stat(mount_point.c_str(), &sb) == 0) {
+    for (const char *mount_point : extsd_mount_points) {
+        if (stat(mount_point, &sb) == 0) {
             if (util::is_mounted(mount_point)) {
                 return mount_point;
             }
@@ -522,22 +726,24 @@ std::string Roms::get_mountpoint(Rom::Source source)
 //       get_system_partition(), get_cache_partition(), and get_data_partition()
 std::string get_raw_path(const std::string &path)
 {
+    std::string_view suffix(path);
     std::string result;
 
     // This is faster than doing util::path_split()...
     if (path == "/system" || starts_with(path.c_str(), "/system/")) {
         result = Roms::get_system_partition();
-        result += path.substr(7);
+        suffix.remove_prefix(7);
     } else if (path == "/cache" || starts_with(path.c_str(), "/cache/")) {
         result = Roms::get_cache_partition();
-        result += path.substr(6);
+        suffix.remove_prefix(6);
     } else if (path == "/data" || starts_with(path.c_str(), "/data/")) {
         result = Roms::get_data_partition();
-        result += path.substr(5);
+        suffix.remove_prefix(5);
     } else {
-        result = path;
+        return path;
     }
 
+    result += suffix;
     return result;
 }
 
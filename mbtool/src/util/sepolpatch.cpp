@@ -19,11 +19,16 @@
 
 #include "util/sepolpatch.h"
 
+#include <algorithm>
 #include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 #include <climits>
 #include <cstdio>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/mman.h>
@@ -31,6 +36,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <openssl/sha.h>
+
 // libsepol is not very C++ friendly. 'bool' is a struct field in conditional.h
 #define bool bool2
 #include <sepol/policydb/expand.h>
@@ -42,14 +49,23 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/string.h"
+#include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
 #include "mbutil/selinux.h"
+#include "mbutil/string.h"
 
 #include "util/android_api.h"
 #include "util/multiboot.h"
 
 #define LOG_TAG "mbtool/util/sepolpatch"
 
+// Patched policies from previous boots
+#define SEPOLICY_CACHE_DIR          "/raw/data/multiboot/cache/sepolicy"
+#define SEPOLICY_CACHE_MAX_ENTRIES  8
+#define SEPOLICY_CACHE_MAGIC        "MBSEPOL1"
+
 
 extern "C" int policydb_index_decls(sepol_handle_t *handle, policydb_t *p);
 
@@ -76,6 +92,30 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
                                          uint16_t class_val,
                                          uint32_t perm_val,
                                          bool remove)
+{
+    return selinux_raw_set_avtab_perms(pdb, source_type_val, target_type_val,
+                                       class_val, 1U << (perm_val - 1),
+                                       remove);
+}
+
+/*!
+ * Add or remove several permissions of a rule at once.
+ *
+ * \param pdb Policy DB object
+ * \param source_type_val Source type for rule
+ * \param target_type_val Target type for rule
+ * \param class_val Class for rule
+ * \param perms_mask Bitmask of permissions (bit `perm_val - 1` for each)
+ * \param remove Whether to remove the permissions
+ *
+ * \return Whether a change was made
+ */
+SELinuxResult selinux_raw_set_avtab_perms(policydb_t *pdb,
+                                          uint16_t source_type_val,
+                                          uint16_t target_type_val,
+                                          uint16_t class_val,
+                                          uint32_t perms_mask,
+                                          bool remove)
 {
     avtab_datum_t *av;
     avtab_key_t key;
@@ -91,7 +131,7 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
             return SELinuxResult::Unchanged;
         } else {
             avtab_datum_t av_new;
-            av_new.data = (1U << (perm_val - 1));
+            av_new.data = perms_mask;
             if (avtab_insert(&pdb->te_avtab, &key, &av_new) != 0) {
                 return SELinuxResult::Error;
             }
@@ -101,9 +141,9 @@ SELinuxResult selinux_raw_set_avtab_rule(policydb_t *pdb,
         auto old_data = av->data;
 
         if (remove) {
-            av->data &= ~(1U << (perm_val - 1));
+            av->data &= ~perms_mask;
         } else {
-            av->data |= (1U << (perm_val - 1));
+            av->data |= perms_mask;
         }
 
         return (av->data == old_data)
@@ -655,6 +695,29 @@ bool selinux_grant_all_perms(policydb_t *pdb,
  */
 SELinuxResult selinux_create_type(policydb_t *pdb,
                                   const char *name)
+{
+    auto ret = selinux_raw_create_type(pdb, name);
+
+    if (ret == SELinuxResult::Changed && !selinux_raw_reindex(pdb)) {
+        return SELinuxResult::Error;
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Create type in SELinux binary policy without reindexing
+ *
+ * The caller must call selinux_raw_reindex() before using any of the
+ * value-indexed maps (eg. `type_val_to_struct`) with the new type.
+ *
+ * \param pdb Policy object
+ * \param name Name of type to add
+ *
+ * \return Whether the type was created
+ */
+SELinuxResult selinux_raw_create_type(policydb_t *pdb,
+                                      const char *name)
 {
     if (find_type(pdb, name)) {
         // Type already exists
@@ -726,10 +789,6 @@ SELinuxResult selinux_create_type(policydb_t *pdb,
         return SELinuxResult::Error;
     }
 
-    if (!selinux_raw_reindex(pdb)) {
-        return SELinuxResult::Error;
-    }
-
     return SELinuxResult::Changed;
 }
 
@@ -840,36 +899,330 @@ static void selinux_strip_no_audit(policydb_t *pdb)
 
 // Patching functions
 
+/*!
+ * \brief State shared by all of the patches applied to a policy in one go
+ *
+ * Every rule used to be added one permission at a time, with the source,
+ * target, class, and permission looked up by name each time and the policy
+ * reindexed after every type or role change. The session resolves each rule
+ * once, sets all of its permission bits with a single avtab operation, caches
+ * the type and class lookups as well as the full permission mask of each
+ * class, and defers reindexing until finish() is called.
+ *
+ * Because reindexing is deferred, `type_val_to_struct` and
+ * `p_type_val_to_name` only cover the first indexed_types() types until the
+ * session finishes.
+ */
+class PatchSession
+{
+public:
+    explicit PatchSession(policydb_t *pdb);
+
+    policydb_t * pdb() const;
+
+    type_datum_t * find_type(const char *name);
+    class_datum_t * find_class(const char *name);
+
+    const std::vector<uint16_t> & attributes() const;
+    uint32_t indexed_types() const;
+
+    bool create_type(const char *name);
+    bool add_to_role(const char *role_name, const char *type_name);
+    bool set_attribute(const char *type_name, const char *attr_name);
+    bool set_rules(const char *source, const char *target, const char *clazz,
+                   const std::vector<std::string> &perms, bool remove);
+    bool grant_all_perms(uint16_t source_val, uint16_t target_val);
+
+    bool finish();
+
+private:
+    uint32_t class_perms_mask(uint16_t class_val);
+
+    policydb_t *m_pdb;
+    std::unordered_map<std::string, type_datum_t *> m_types;
+    std::unordered_map<std::string, class_datum_t *> m_classes;
+    // Mask of all permissions in each class (indexed by class value - 1).
+    // Zero means it has not been computed yet.
+    std::vector<uint32_t> m_class_perms;
+    std::vector<uint16_t> m_attributes;
+    uint32_t m_indexed_types;
+    bool m_needs_reindex;
+};
+
+PatchSession::PatchSession(policydb_t *pdb)
+    : m_pdb(pdb)
+    , m_class_perms(pdb->p_classes.nprim)
+    , m_indexed_types(pdb->p_types.nprim)
+    , m_needs_reindex(false)
+{
+    for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
+        if (pdb->type_val_to_struct[type_val - 1]->flavor == TYPE_ATTRIB) {
+            m_attributes.push_back(static_cast<uint16_t>(type_val));
+        }
+    }
+}
+
+policydb_t * PatchSession::pdb() const
+{
+    return m_pdb;
+}
+
+type_datum_t * PatchSession::find_type(const char *name)
+{
+    auto it = m_types.find(name);
+    if (it == m_types.end()) {
+        it = m_types.emplace(name, mb::find_type(m_pdb, name)).first;
+    }
+    return it->second;
+}
+
+class_datum_t * PatchSession::find_class(const char *name)
+{
+    auto it = m_classes.find(name);
+    if (it == m_classes.end()) {
+        it = m_classes.emplace(name, mb::find_class(m_pdb, name)).first;
+    }
+    return it->second;
+}
+
+/*!
+ * \brief Values of all attributes that existed when the session was created
+ */
+const std::vector<uint16_t> & PatchSession::attributes() const
+{
+    return m_attributes;
+}
+
+/*!
+ * \brief Number of types covered by the policy's value-indexed maps
+ */
+uint32_t PatchSession::indexed_types() const
+{
+    return m_indexed_types;
+}
+
+bool PatchSession::create_type(const char *name)
+{
+    auto ret = selinux_raw_create_type(m_pdb, name);
+    if (ret == SELinuxResult::Error) {
+        LOGE("Failed to create type %s", name);
+        return false;
+    } else if (ret == SELinuxResult::Changed) {
+        m_types.erase(name);
+        m_needs_reindex = true;
+    }
+
+    return true;
+}
+
+bool PatchSession::add_to_role(const char *role_name, const char *type_name)
+{
+    role_datum_t *role = find_role(m_pdb, role_name);
+    if (!role) {
+        LOGE("Role %s does not exist", role_name);
+        return false;
+    }
+
+    type_datum_t *type = find_type(type_name);
+    if (!type) {
+        LOGE("Type %s does not exist", type_name);
+        return false;
+    }
+
+    // The role cache is rebuilt when the policy is reindexed
+    if (!ebitmap_get_bit(&role->types.types, type->s.value - 1)) {
+        if (ebitmap_set_bit(&role->types.types, type->s.value - 1, 1) < 0) {
+            return false;
+        }
+        m_needs_reindex = true;
+    }
+
+    return true;
+}
+
+bool PatchSession::set_attribute(const char *type_name, const char *attr_name)
+{
+    type_datum_t *type = find_type(type_name);
+    if (!type || type->flavor != TYPE_TYPE) {
+        LOGE("Type %s does not exist", type_name);
+        return false;
+    }
+
+    type_datum_t *attr = find_type(attr_name);
+    if (!attr || attr->flavor != TYPE_ATTRIB) {
+        LOGE("Attribute %s does not exist", attr_name);
+        return false;
+    }
+
+    auto ret = selinux_raw_set_attribute(
+            m_pdb, static_cast<uint16_t>(type->s.value),
+            static_cast<uint16_t>(attr->s.value));
+    return ret != SELinuxResult::Error;
+}
+
+/*!
+ * \brief Add or remove a set of permissions for an allow rule
+ *
+ * The source, target, and class are resolved once and all of the permission
+ * bits are applied with a single avtab lookup.
+ */
+bool PatchSession::set_rules(const char *source, const char *target,
+                             const char *clazz,
+                             const std::vector<std::string> &perms,
+                             bool remove)
+{
+    type_datum_t *source_datum = find_type(source);
+    if (!source_datum) {
+        LOGE("Source type %s does not exist", source);
+        return false;
+    }
+
+    type_datum_t *target_datum = find_type(target);
+    if (!target_datum) {
+        LOGE("Target type %s does not exist", target);
+        return false;
+    }
+
+    class_datum_t *class_datum = find_class(clazz);
+    if (!class_datum) {
+        LOGE("Class %s does not exist", clazz);
+        return false;
+    }
+
+    uint32_t mask = 0;
+
+    for (auto const &perm : perms) {
+        perm_datum_t *perm_datum = find_perm(class_datum, perm.c_str());
+        if (!perm_datum) {
+            LOGE("Perm %s does not exist in class %s", perm.c_str(), clazz);
+            return false;
+        }
+
+        mask |= 1U << (perm_datum->s.value - 1);
+    }
+
+    auto ret = selinux_raw_set_avtab_perms(
+            m_pdb, static_cast<uint16_t>(source_datum->s.value),
+            static_cast<uint16_t>(target_datum->s.value),
+            static_cast<uint16_t>(class_datum->s.value), mask, remove);
+    if (ret == SELinuxResult::Error) {
+        LOGE("Failed to %s rule: allow %s %s:%s { ... };",
+             remove ? "remove" : "add", source, target, clazz);
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t PatchSession::class_perms_mask(uint16_t class_val)
+{
+    uint32_t &mask = m_class_perms[class_val - 1];
+
+    if (mask == 0) {
+        auto clazz = m_pdb->class_val_to_struct[class_val - 1];
+
+        hashtab_t tables[] = { clazz->permissions.table, nullptr, nullptr };
+        if (clazz->comdatum) {
+            tables[1] = clazz->comdatum->permissions.table;
+        }
+
+        for (auto table = tables; *table; ++table) {
+            for (uint32_t bucket = 0; bucket < (*table)->size; ++bucket) {
+                for (hashtab_ptr_t cur = (*table)->htable[bucket]; cur;
+                        cur = cur->next) {
+                    auto perm_datum = static_cast<perm_datum_t *>(cur->datum);
+                    mask |= 1U << (perm_datum->s.value - 1);
+                }
+            }
+        }
+    }
+
+    return mask;
+}
+
+/*!
+ * \brief Allow every permission of every class
+ *
+ * Same as selinux_raw_grant_all_perms(), but with one avtab operation per
+ * class instead of one per permission.
+ */
+bool PatchSession::grant_all_perms(uint16_t source_val, uint16_t target_val)
+{
+    for (uint32_t class_val = 1; class_val <= m_pdb->p_classes.nprim;
+            ++class_val) {
+        uint32_t mask = class_perms_mask(static_cast<uint16_t>(class_val));
+        if (mask == 0) {
+            continue;
+        }
+
+        if (selinux_raw_set_avtab_perms(
+                m_pdb, source_val, target_val,
+                static_cast<uint16_t>(class_val), mask, false)
+                == SELinuxResult::Error) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Reindex the policy if any patch requires it
+ */
+bool PatchSession::finish()
+{
+    if (m_needs_reindex) {
+        if (!selinux_raw_reindex(m_pdb)) {
+            LOGE("Failed to reindex policy");
+            return false;
+        }
+
+        m_indexed_types = m_pdb->p_types.nprim;
+        m_needs_reindex = false;
+    }
+
+    return true;
+}
+
 // Fail fast
 #define ff(expr) \
     do { \
         if (!(expr)) return false; \
     } while (0)
 
-static inline bool add_rules(policydb_t *pdb,
+static inline bool add_rules(PatchSession &s,
                              const char *source,
                              const char *target,
                              const char *clazz,
                              const std::vector<std::string> &perms)
 {
-    for (auto const &perm : perms) {
-        if (!selinux_add_rule(pdb, source, target, clazz, perm.c_str())) {
-            return false;
-        }
-    }
-
-    return true;
+    return s.set_rules(source, target, clazz, perms, false);
 }
 
 [[maybe_unused]]
-static inline bool remove_rules(policydb_t *pdb,
+static inline bool remove_rules(PatchSession &s,
                                 const char *source,
                                 const char *target,
                                 const char *clazz,
                                 const std::vector<std::string> &perms)
 {
-    for (auto const &perm : perms) {
-        if (!selinux_remove_rule(pdb, source, target, clazz, perm.c_str())) {
+    return s.set_rules(source, target, clazz, perms, true);
+}
+
+/*!
+ * \brief Grant all permissions from a type to every attribute
+ */
+static bool grant_all_perms_to_attributes(PatchSession &s, const char *name)
+{
+    type_datum_t *type = s.find_type(name);
+    if (!type) {
+        return false;
+    }
+
+    for (auto const &attr : s.attributes()) {
+        if (!s.grant_all_perms(static_cast<uint16_t>(type->s.value), attr)) {
+            LOGE("Failed to grant all perms for: %s -> %s",
+                 name, s.pdb()->p_type_val_to_name[attr - 1]);
             return false;
         }
     }
@@ -877,7 +1230,7 @@ static inline bool remove_rules(policydb_t *pdb,
     return true;
 }
 
-static bool apply_pre_boot_patches(policydb_t *pdb)
+static bool apply_pre_boot_patches(PatchSession &s)
 {
     // We are going to allow everything. The stage 1 policy is not a security
     // concern because the real (secure) policy will be loaded by the real /init
@@ -885,45 +1238,20 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
     // environment for the real /init.
 
     // For most ROMs, we can just make the kernel domain permissive
-    ff(selinux_make_permissive(pdb, "kernel"));
+    ff(selinux_make_permissive(s.pdb(), "kernel"));
 
     // For TW 6.0 ROMs, the kernel #define's the permissive flag to be 0, so
     // per-type permissive flags are completely ignored. For these ROMs, we'll
     // allow every attribute to do everything.
-
-    type_datum_t *kernel = find_type(pdb, "kernel");
-    if (!kernel) {
-        return false;
-    }
-
-    // For all attributes
-    for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
-        // Skip non-attributes
-        if (pdb->type_val_to_struct[type_val - 1]->flavor != TYPE_ATTRIB) {
-            continue;
-        }
-
-        auto ret = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(kernel->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
-            LOGE("Failed to grant all perms for: %s -> %s",
-                 "kernel", pdb->p_type_val_to_name[type_val - 1]);
-            return false;
-        }
-    }
+    ff(grant_all_perms_to_attributes(s, "kernel"));
 
     // Allow the real init to load the "secure" SELinux policy
-    ff(selinux_add_rule(pdb, "kernel", "kernel", "security", "load_policy"));
+    ff(add_rules(s, "kernel", "kernel", "security", { "load_policy" }));
 
     return true;
 }
 
-static bool copy_attributes(policydb_t *pdb,
+static bool copy_attributes(PatchSession &s,
                             const char *source_type,
                             const char *target_type)
 {
@@ -932,18 +1260,19 @@ static bool copy_attributes(policydb_t *pdb,
         return false;
     }
 
-    auto source = find_type(pdb, source_type);
+    auto source = s.find_type(source_type);
     if (!source) {
         LOGE("Source type %s does not exist", source_type);
         return false;
     }
 
-    auto target = find_type(pdb, target_type);
+    auto target = s.find_type(target_type);
     if (!target) {
         LOGE("Target type %s does not exist", target_type);
         return false;
     }
 
+    policydb_t *pdb = s.pdb();
     std::vector<uint16_t> attributes;
     ebitmap_node *n;
     unsigned int bit;
@@ -963,8 +1292,7 @@ static bool copy_attributes(policydb_t *pdb,
                 pdb, static_cast<uint16_t>(target->s.value), attr);
         if (ret == SELinuxResult::Error) {
             LOGE("Failed to set attribute %s for type %s",
-                 pdb->p_type_val_to_name[attr - 1],
-                 pdb->p_type_val_to_name[target->s.value - 1]);
+                 pdb->p_type_val_to_name[attr - 1], target_type);
             return false;
         }
     }
@@ -972,7 +1300,7 @@ static bool copy_attributes(policydb_t *pdb,
     return true;
 }
 
-static bool copy_constraints(policydb_t *pdb,
+static bool copy_constraints(PatchSession &s,
                              const char *source_type,
                              const char *target_type)
 {
@@ -981,20 +1309,20 @@ static bool copy_constraints(policydb_t *pdb,
         return false;
     }
 
-    auto source = find_type(pdb, source_type);
+    auto source = s.find_type(source_type);
     if (!source) {
         LOGE("Source type %s does not exist", source_type);
         return false;
     }
 
-    auto target = find_type(pdb, target_type);
+    auto target = s.find_type(target_type);
     if (!target) {
         LOGE("Target type %s does not exist", target_type);
         return false;
     }
 
     auto ret = selinux_raw_copy_constraints(
-            pdb, static_cast<uint16_t>(source->s.value),
+            s.pdb(), static_cast<uint16_t>(source->s.value),
             static_cast<uint16_t>(target->s.value));
     switch (ret) {
     case SELinuxResult::Changed:
@@ -1002,15 +1330,14 @@ static bool copy_constraints(policydb_t *pdb,
         break;
     case SELinuxResult::Error:
         LOGE("Failed to copy constraints for: %s -> %s",
-             pdb->p_type_val_to_name[source->s.value - 1],
-             pdb->p_type_val_to_name[target->s.value - 1]);
+             source_type, target_type);
         return false;
     }
 
     return true;
 }
 
-static bool copy_avtab_rules(policydb_t *pdb,
+static bool copy_avtab_rules(PatchSession &s,
                              const char *source_type,
                              const char *target_type)
 {
@@ -1023,18 +1350,20 @@ static bool copy_avtab_rules(policydb_t *pdb,
         return false;
     }
 
-    source = find_type(pdb, source_type);
+    source = s.find_type(source_type);
     if (!source) {
         LOGE("Source type %s does not exist", source_type);
         return false;
     }
 
-    target = find_type(pdb, target_type);
+    target = s.find_type(target_type);
     if (!target) {
         LOGE("Target type %s does not exist", target_type);
         return false;
     }
 
+    policydb_t *pdb = s.pdb();
+
     // Gather rules to copy
     for (uint32_t i = 0; i < pdb->te_avtab.nslot; ++i) {
         for (avtab_ptr_t cur = pdb->te_avtab.htable[i]; cur; cur = cur->next) {
@@ -1074,7 +1403,7 @@ static bool copy_avtab_rules(policydb_t *pdb,
  * \brief Patch SEPolicy to allow media_data_file-labeled /data/media to work on
  *        Android >= 5.0
  */
-static bool fix_data_media_rules(policydb_t *pdb)
+static bool fix_data_media_rules(PatchSession &s)
 {
     auto sdk_version = get_sdk_version(SdkVersionSource::BuildProp);
     const char *expected_type;
@@ -1088,7 +1417,7 @@ static bool fix_data_media_rules(policydb_t *pdb)
     LOGV("Expected SELinux type (API %lu) for %s: %s",
          sdk_version, INTERNAL_STORAGE_ROOT, expected_type);
 
-    if (!find_type(pdb, expected_type)) {
+    if (!s.find_type(expected_type)) {
         LOGW("Type %s doesn't exist. Won't touch %s related rules",
              expected_type, INTERNAL_STORAGE_ROOT);
         return true;
@@ -1115,172 +1444,152 @@ static bool fix_data_media_rules(policydb_t *pdb)
     LOGV("Type of %s: %s", INTERNAL_STORAGE_ROOT, type.c_str());
 
     if (type != expected_type) {
-        if (!find_type(pdb, type.c_str())) {
+        if (!s.find_type(type.c_str())) {
             LOGV("Type %s does not exist. Creating it", type.c_str());
-            ff(selinux_create_type(pdb, type.c_str()) != SELinuxResult::Error);
+            ff(s.create_type(type.c_str()));
         }
 
         LOGV("Copying %s attributes to %s", expected_type, type.c_str());
-        ff(copy_attributes(pdb, expected_type, type.c_str()));
+        ff(copy_attributes(s, expected_type, type.c_str()));
 
         LOGV("Copying %s constraints to %s", expected_type, type.c_str());
-        ff(copy_constraints(pdb, expected_type, type.c_str()));
+        ff(copy_constraints(s, expected_type, type.c_str()));
 
         LOGV("Copying %s avtab rules to %s", expected_type, type.c_str());
-        ff(copy_avtab_rules(pdb, expected_type, type.c_str()));
+        ff(copy_avtab_rules(s, expected_type, type.c_str()));
     }
 
     return true;
 }
 
-static bool create_mbtool_types(policydb_t *pdb)
+static bool create_mbtool_types(PatchSession &s)
 {
+    policydb_t *pdb = s.pdb();
+
     // Used for running any mbtool commands
-    ff(selinux_create_type(pdb, "mb_exec") != SELinuxResult::Error);
-    ff(selinux_add_to_role(pdb, "r", "mb_exec"));
-    ff(selinux_set_attribute(pdb, "mb_exec", "domain"));
-    ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedobject"));
-    ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedsubject"));
+    ff(s.create_type("mb_exec"));
+    ff(s.add_to_role("r", "mb_exec"));
+    ff(s.set_attribute("mb_exec", "domain"));
+    ff(s.set_attribute("mb_exec", "mlstrustedobject"));
+    ff(s.set_attribute("mb_exec", "mlstrustedsubject"));
 
     // Allow setting the current process context from init to mb_exec
-    ff(add_rules(pdb, "init", "mb_exec", "process", {
+    ff(add_rules(s, "init", "mb_exec", "process", {
         "noatsecure", "rlimitinh", "setcurrent", "siginh", "transition",
         //"dyntransition",
     }));
 
     // Allow installd to connect to appsync's socket
-    ff(add_rules(pdb, "installd", "mb_exec", "unix_stream_socket", {
+    ff(add_rules(s, "installd", "mb_exec", "unix_stream_socket", {
         "accept", "listen", "read", "write",
     }));
-    if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "system_server", "mb_exec", "unix_stream_socket", {
+    if (s.find_type("system_server")) {
+        ff(add_rules(s, "system_server", "mb_exec", "unix_stream_socket", {
             "connectto",
         }));
     } else {
-        ff(add_rules(pdb, "system", "mb_exec", "unix_stream_socket", {
+        ff(add_rules(s, "system", "mb_exec", "unix_stream_socket", {
             "connectto",
         }));
     }
 
-    // Allow apps to connect to the daemon
-    for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
+    // Allow apps to connect to the daemon. Types created by this session are
+    // not in the name map yet, but none of them are app types.
+    for (uint32_t type_val = 1; type_val <= s.indexed_types(); ++type_val) {
         auto const &name = pdb->p_type_val_to_name[type_val - 1];
         int dummy;
 
         if (strcmp(name, "untrusted_app") == 0
                 || (starts_with(name, "untrusted_app_")
                         && str_to_num(name + 14, 10, dummy))) {
-            ff(add_rules(pdb, name, "mb_exec", "unix_stream_socket", {
+            ff(add_rules(s, name, "mb_exec", "unix_stream_socket", {
                 "connectto",
             }));
         }
     }
 
     // Allow zygote to write to our stdout pipe when rebooting
-    ff(add_rules(pdb, "zygote", "init", "fifo_file", { "write" }));
+    ff(add_rules(s, "zygote", "init", "fifo_file", { "write" }));
 
     // Allow 'am' to use fds (eg. pipes) inherited from the daemon
-    if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "system_server", "mb_exec", "fd", { "use" }));
-        ff(add_rules(pdb, "system_server", "mb_exec", "fifo_file", { "write" }));
+    if (s.find_type("system_server")) {
+        ff(add_rules(s, "system_server", "mb_exec", "fd", { "use" }));
+        ff(add_rules(s, "system_server", "mb_exec", "fifo_file", { "write" }));
     }
 
     // Allow rebooting via the android.intent.action.REBOOT intent
-    if (find_type(pdb, "activity_service")) {
-        ff(add_rules(pdb, "zygote", "activity_service", "service_manager", { "find" }));
+    if (s.find_type("activity_service")) {
+        ff(add_rules(s, "zygote", "activity_service", "service_manager", { "find" }));
     }
-    if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "zygote", "system_server", "binder", { "call" }));
+    if (s.find_type("system_server")) {
+        ff(add_rules(s, "zygote", "system_server", "binder", { "call" }));
     }
 
-    ff(add_rules(pdb, "zygote", "init", "unix_stream_socket", { "read", "write" }));
-    ff(add_rules(pdb, "zygote", "servicemanager", "binder", { "call" }));
+    ff(add_rules(s, "zygote", "init", "unix_stream_socket", { "read", "write" }));
+    ff(add_rules(s, "zygote", "servicemanager", "binder", { "call" }));
 
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "binder", { "transfer" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "file", { "open", "read" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "process", { "getattr" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "open" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "read" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "process", { "getattr" }));
+    ff(add_rules(s, "servicemanager", "mb_exec", "binder", { "transfer" }));
+    ff(add_rules(s, "servicemanager", "mb_exec", "dir", { "search" }));
+    ff(add_rules(s, "servicemanager", "mb_exec", "file", { "open", "read" }));
+    ff(add_rules(s, "servicemanager", "mb_exec", "process", { "getattr" }));
+    ff(add_rules(s, "servicemanager", "zygote", "dir", { "search" }));
+    ff(add_rules(s, "servicemanager", "zygote", "file", { "open" }));
+    ff(add_rules(s, "servicemanager", "zygote", "file", { "read" }));
+    ff(add_rules(s, "servicemanager", "zygote", "process", { "getattr" }));
 
     // For in-app flashing
-    ff(add_rules(pdb, "rootfs", "tmpfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "kernel", "mb_exec", "fd", { "use" }));
+    ff(add_rules(s, "rootfs", "tmpfs", "filesystem", { "associate" }));
+    ff(add_rules(s, "tmpfs",  "rootfs", "filesystem", { "associate" }));
+    ff(add_rules(s, "kernel", "mb_exec", "fd", { "use" }));
 
     // Give mb_exec <insert diety here> permissions
-    type_datum_t *mb_exec = find_type(pdb, "mb_exec");
-    if (!mb_exec) {
-        return false;
-    }
-
-    // For all attributes
-    for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
-        // Skip non-attributes
-        if (pdb->type_val_to_struct[type_val - 1]->flavor != TYPE_ATTRIB) {
-            continue;
-        }
-
-        auto ret = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(mb_exec->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
-            LOGE("Failed to grant all perms for: %s -> %s",
-                 "mb_exec", pdb->p_type_val_to_name[type_val - 1]);
-            return false;
-        }
-    }
+    ff(grant_all_perms_to_attributes(s, "mb_exec"));
 
     return true;
 }
 
-static bool apply_main_patches(policydb_t *pdb)
+static bool apply_main_patches(PatchSession &s)
 {
-    ff(fix_data_media_rules(pdb));
-    ff(create_mbtool_types(pdb));
+    ff(fix_data_media_rules(s));
+    ff(create_mbtool_types(s));
 
     return true;
 }
 
-static bool apply_cwm_recovery_patches(policydb_t *pdb)
+static bool apply_cwm_recovery_patches(PatchSession &s)
 {
     // Debugging rules (for CWM and Philz)
-    ff(add_rules(pdb, "adbd",  "block_device",    "blk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "system_file",     "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "tmpfs",           "file",       { "relabelto" }));
-
-    ff(add_rules(pdb, "rootfs", "tmpfs",          "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs",         "filesystem", { "associate" }));
+    ff(add_rules(s, "adbd",  "block_device",    "blk_file",   { "relabelto" }));
+    ff(add_rules(s, "adbd",  "graphics_device", "chr_file",   { "relabelto" }));
+    ff(add_rules(s, "adbd",  "graphics_device", "dir",        { "relabelto" }));
+    ff(add_rules(s, "adbd",  "input_device",    "chr_file",   { "relabelto" }));
+    ff(add_rules(s, "adbd",  "input_device",    "dir",        { "relabelto" }));
+    ff(add_rules(s, "adbd",  "rootfs",          "dir",        { "relabelto" }));
+    ff(add_rules(s, "adbd",  "rootfs",          "file",       { "relabelto" }));
+    ff(add_rules(s, "adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
+    ff(add_rules(s, "adbd",  "system_file",     "file",       { "relabelto" }));
+    ff(add_rules(s, "adbd",  "tmpfs",           "file",       { "relabelto" }));
+
+    ff(add_rules(s, "rootfs", "tmpfs",          "filesystem", { "associate" }));
+    ff(add_rules(s, "tmpfs",  "rootfs",         "filesystem", { "associate" }));
 
     return true;
 }
 
 bool selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch)
 {
+    PatchSession session(pdb);
     bool ret = false;
 
     switch (patch) {
     case SELinuxPatch::PreBoot:
-        ret = apply_pre_boot_patches(pdb);
+        ret = apply_pre_boot_patches(session);
         break;
     case SELinuxPatch::Main:
-        ret = apply_main_patches(pdb);
+        ret = apply_main_patches(session);
         break;
     case SELinuxPatch::CwmRecovery:
-        ret = apply_cwm_recovery_patches(pdb);
+        ret = apply_cwm_recovery_patches(session);
         break;
     case SELinuxPatch::StripNoAudit:
         selinux_strip_no_audit(pdb);
@@ -1290,13 +1599,223 @@ bool selinux_apply_patch(policydb_t *pdb, SELinuxPatch patch)
         break;
     }
 
-    return ret;
+    // Always reindex so that the policy is consistent even after a failure
+    return session.finish() && ret;
 }
 
+/*!
+ * \brief Get the inputs besides the policy itself that affect a patch
+ *
+ * The main patch adjusts the rules for /data/media based on the SDK version
+ * and on the current label of the directory.
+ */
+static std::string patch_environment(SELinuxPatch patch)
+{
+    if (patch != SELinuxPatch::Main) {
+        return {};
+    }
+
+    std::string env = format("sdk=%lu;",
+                             get_sdk_version(SdkVersionSource::BuildProp));
+
+    if (auto context = util::selinux_lget_context(INTERNAL_STORAGE_ROOT)) {
+        env += "context=";
+        env += context.value();
+    } else {
+        env += "errno=";
+        env += std::to_string(context.error().value());
+    }
+
+    return env;
+}
+
+/*!
+ * \brief Get the path of the cache entry for a policy and patch
+ *
+ * The key is a SHA-256 digest of the original policy, the patch type, the
+ * mbtool version, and anything else that the patch depends on.
+ */
+static std::string sepolicy_cache_path(const std::string &policy,
+                                       SELinuxPatch patch)
+{
+    auto patch_val = static_cast<int>(patch);
+    std::string env = patch_environment(patch);
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, policy.data(), policy.size());
+    SHA256_Update(&ctx, &patch_val, sizeof(patch_val));
+    SHA256_Update(&ctx, version(), strlen(version()) + 1);
+    SHA256_Update(&ctx, git_version(), strlen(git_version()) + 1);
+    SHA256_Update(&ctx, env.data(), env.size());
+
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256_Final(digest, &ctx);
+
+    std::string path(SEPOLICY_CACHE_DIR "/");
+    path += util::hex_string(digest, sizeof(digest));
+    return path;
+}
+
+/*!
+ * \brief Load a patched policy from the cache
+ *
+ * Cache entries consist of #SEPOLICY_CACHE_MAGIC, the SHA-256 digest of the
+ * policy, and then the policy itself. The entry is rejected if the digest
+ * does not match (eg. the file was truncated).
+ */
+static bool load_cached_sepolicy(const std::string &path, std::string &policy)
+{
+    static constexpr size_t header_size =
+            sizeof(SEPOLICY_CACHE_MAGIC) - 1 + SHA256_DIGEST_LENGTH;
+
+    auto data = util::file_read_all(path);
+    if (!data) {
+        if (data.error() != std::errc::no_such_file_or_directory) {
+            LOGW("%s: Failed to read cached policy: %s",
+                 path.c_str(), data.error().message().c_str());
+        }
+        return false;
+    }
+
+    auto const &contents = data.value();
+
+    if (contents.size() <= header_size
+            || contents.compare(0, sizeof(SEPOLICY_CACHE_MAGIC) - 1,
+                                SEPOLICY_CACHE_MAGIC) != 0) {
+        LOGW("%s: Invalid cached policy header", path.c_str());
+        return false;
+    }
+
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char *>(contents.data())
+                   + header_size,
+           contents.size() - header_size, digest);
+
+    if (memcmp(digest, contents.data() + sizeof(SEPOLICY_CACHE_MAGIC) - 1,
+               sizeof(digest)) != 0) {
+        LOGW("%s: Cached policy is corrupt", path.c_str());
+        return false;
+    }
+
+    policy = contents.substr(header_size);
+    return true;
+}
+
+/*!
+ * \brief Remove the oldest cache entries beyond #SEPOLICY_CACHE_MAX_ENTRIES
+ */
+static void prune_sepolicy_cache()
+{
+    std::unique_ptr<DIR, decltype(closedir) *> dp(
+            opendir(SEPOLICY_CACHE_DIR), closedir);
+    if (!dp) {
+        return;
+    }
+
+    std::vector<std::pair<time_t, std::string>> entries;
+
+    while (auto ent = readdir(dp.get())) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string path(SEPOLICY_CACHE_DIR "/");
+        path += ent->d_name;
+
+        struct stat sb;
+        if (stat(path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) {
+            entries.emplace_back(sb.st_mtime, std::move(path));
+        }
+    }
+
+    if (entries.size() <= SEPOLICY_CACHE_MAX_ENTRIES) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size() - SEPOLICY_CACHE_MAX_ENTRIES; ++i) {
+        unlink(entries[i].second.c_str());
+    }
+}
+
+/*!
+ * \brief Store a patched policy in the cache
+ *
+ * \param path Cache entry path
+ * \param policy Patched policy image
+ */
+static void store_cached_sepolicy(const std::string &path,
+                                  std::string_view policy)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char *>(policy.data()),
+           policy.size(), digest);
+
+    std::string contents(SEPOLICY_CACHE_MAGIC);
+    contents.append(reinterpret_cast<const char *>(digest), sizeof(digest));
+    contents += policy;
+
+    std::string tmp_path(path);
+    tmp_path += ".tmp";
+
+    if (auto r = util::file_write_string(tmp_path, contents); !r) {
+        LOGW("%s: Failed to write cached policy: %s",
+             tmp_path.c_str(), r.error().message().c_str());
+        unlink(tmp_path.c_str());
+    } else if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s",
+             tmp_path.c_str(), path.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+    } else {
+        prune_sepolicy_cache();
+    }
+}
+
+/*!
+ * \brief Patch a policy file
+ *
+ * Patched policies are cached in #SEPOLICY_CACHE_DIR (if the directory can be
+ * created) so that the parse/patch/write cycle only happens when the input
+ * policy, the patch, or mbtool changes.
+ *
+ * \param source Path to input policy
+ * \param target Path to write patched policy to
+ * \param patch Patch to apply
+ *
+ * \return Whether the patched policy was written
+ */
 bool patch_sepolicy(const std::string &source,
                     const std::string &target,
                     SELinuxPatch patch)
 {
+    std::string cache_path;
+    // Source policy, if it was already read for computing the cache key
+    std::optional<std::string> source_data;
+
+    if (auto r = util::mkdir_recursive(SEPOLICY_CACHE_DIR, 0700);
+            !r && r.error() != std::errc::file_exists) {
+        LOGV("%s: Cache not available: %s",
+             SEPOLICY_CACHE_DIR, r.error().message().c_str());
+    } else if (auto data = util::file_read_all(source); !data) {
+        LOGW("%s: Failed to read policy: %s",
+             source.c_str(), data.error().message().c_str());
+    } else {
+        source_data = std::move(data.value());
+        cache_path = sepolicy_cache_path(*source_data, patch);
+
+        std::string cached;
+        if (load_cached_sepolicy(cache_path, cached)) {
+            LOGD("%s: Using cached patched policy: %s",
+                 source.c_str(), cache_path.c_str());
+            if (util::selinux_write_policy_data(target, cached)) {
+                return true;
+            }
+            LOGW("Falling back to patching the policy");
+        }
+    }
+
     policydb_t pdb;
 
     if (policydb_init(&pdb) < 0) {
@@ -1308,11 +1827,16 @@ bool patch_sepolicy(const std::string &source,
         policydb_destroy(&pdb);
     });
 
-    if (!util::selinux_read_policy(source, &pdb)) {
+    // Parse the copy that was already read instead of reading the source again
+    if (!(source_data
+            ? util::selinux_read_policy_data(*source_data, &pdb)
+            : util::selinux_read_policy(source, &pdb))) {
         LOGE("%s: Failed to load SELinux policy", source.c_str());
         return false;
     }
 
+    source_data.reset();
+
     LOGD("Policy version: %u", pdb.policyvers);
 
     if (!selinux_apply_patch(&pdb, patch)) {
@@ -1320,7 +1844,20 @@ bool patch_sepolicy(const std::string &source,
         return false;
     }
 
-    if (!util::selinux_write_policy(target, &pdb)) {
+    // The policy is serialized once and the same image is both cached and
+    // written to the target
+    std::string image;
+
+    if (!util::selinux_policy_to_image(&pdb, image)) {
+        LOGE("Failed to serialize SELinux policy");
+        return false;
+    }
+
+    if (!cache_path.empty()) {
+        store_cached_sepolicy(cache_path, image);
+    }
+
+    if (!util::selinux_write_policy_data(target, image)) {
         LOGE("%s: Failed to write SELinux policy", target.c_str());
         return false;
     }
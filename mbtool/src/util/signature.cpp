@@ -19,10 +19,18 @@
 
 #include "util/signature.h"
 
+#include <array>
+
+#include <cerrno>
+#include <cinttypes>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifdef __clang__
 #  pragma GCC diagnostic push
@@ -32,14 +40,18 @@
 #endif
 
 #include <openssl/err.h>
+#include <openssl/sha.h>
 #include <openssl/x509.h>
 
 #ifdef __clang__
 #  pragma GCC diagnostic pop
 #endif
 
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbsign/sign.h"
+#include "mbutil/string.h"
 
 #include "util/validcerts.h"
 
@@ -47,6 +59,15 @@
 
 #define COMPILE_ERROR_STRINGS 0
 
+// Verified-signature cache. Entries are empty files named after the digest of
+// the cache key. The directory is only trusted if it is owned by root and not
+// accessible by anyone else.
+#define SIG_CACHE_DIR "/dev/.mbtool_sigcache"
+
+// Writes to a file that was changed very recently may not change its ctime
+// (the timestamps have jiffy granularity), so those files are never cached
+#define SIG_CACHE_MIN_AGE_NS (2 * INT64_C(1000000000))
+
 using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
 using mb::sign::ScopedEVP_PKEY;
 using ScopedX509 = std::unique_ptr<X509, decltype(X509_free) *>;
@@ -106,48 +127,187 @@ static void openssl_log_errors()
     ERR_print_errors_cb(&log_callback, nullptr);
 }
 
-static SigVerifyResult verify_signature_with_key(const char *path,
-                                                 const char *sig_path,
-                                                 EVP_PKEY &public_key)
+static int64_t timespec_to_ns(const timespec &ts)
 {
-    ScopedBIO bio_data_in(BIO_new_file(path, "rb"), BIO_free);
-    if (!bio_data_in) {
-        LOGE("%s: Failed to open input file", path);
-        openssl_log_errors();
-        return SigVerifyResult::Failure;
+    return static_cast<int64_t>(ts.tv_sec) * INT64_C(1000000000) + ts.tv_nsec;
+}
+
+bool SigFileId::operator==(const SigFileId &other) const
+{
+    return dev == other.dev
+            && ino == other.ino
+            && size == other.size
+            && mtime_ns == other.mtime_ns
+            && ctime_ns == other.ctime_ns;
+}
+
+bool SigFileId::operator!=(const SigFileId &other) const
+{
+    return !(*this == other);
+}
+
+/*!
+ * \brief Get the attributes identifying the contents of a file
+ *
+ * \param fd File descriptor of a regular file
+ *
+ * \return SigFileId for the file or std::nullopt if the file cannot be
+ *         identified reliably, in which case the cache should not be used
+ */
+std::optional<SigFileId> sig_file_id(int fd)
+{
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+        return std::nullopt;
     }
 
-    ScopedBIO bio_sig_in(BIO_new_file(sig_path, "rb"), BIO_free);
-    if (!bio_sig_in) {
-        LOGE("%s: Failed to open signature file", sig_path);
-        openssl_log_errors();
-        return SigVerifyResult::Failure;
+    timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) < 0) {
+        return std::nullopt;
     }
 
-    auto ret = sign::verify_data(*bio_data_in, *bio_sig_in, public_key);
-    if (!ret) {
-        if (ret.error().ec == sign::Error::BadSignature) {
-            return SigVerifyResult::Invalid;
-        } else {
-            LOGE("%s: Failed to verify signature: %s", sig_path,
-                 ret.error().ec.message().c_str());
-            if (ret.error().has_openssl_error) {
-                openssl_log_errors();
+    int64_t ctime_ns = timespec_to_ns(sb.st_ctim);
+
+    if (timespec_to_ns(now) - ctime_ns < SIG_CACHE_MIN_AGE_NS) {
+        return std::nullopt;
+    }
+
+    return SigFileId{
+        sb.st_dev,
+        sb.st_ino,
+        static_cast<uint64_t>(sb.st_size),
+        timespec_to_ns(sb.st_mtim),
+        ctime_ns,
+    };
+}
+
+static bool read_fd_fully(int fd, std::string &out)
+{
+    std::string result;
+    char buf[4096];
+
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            return SigVerifyResult::Failure;
+            return false;
+        } else if (n == 0) {
+            break;
         }
+
+        result.append(buf, static_cast<size_t>(n));
     }
 
-    return SigVerifyResult::Valid;
+    out.swap(result);
+    return true;
 }
 
-SigVerifyResult verify_signature(const char *path, const char *sig_path)
+/*!
+ * \brief Open the cache directory if it can be trusted
+ *
+ * \return Directory fd or -1 if the cache is unavailable
+ */
+static int sig_cache_open()
+{
+    if (geteuid() != 0) {
+        return -1;
+    }
+
+    if (mkdir(SIG_CACHE_DIR, 0700) < 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    int dfd = open(SIG_CACHE_DIR, O_RDONLY | O_DIRECTORY | O_NOFOLLOW
+            | O_CLOEXEC);
+    if (dfd < 0) {
+        return -1;
+    }
+
+    struct stat sb;
+    if (fstat(dfd, &sb) < 0 || sb.st_uid != 0 || (sb.st_mode & 0077) != 0) {
+        LOGW("%s: Not using untrusted signature cache", SIG_CACHE_DIR);
+        close(dfd);
+        return -1;
+    }
+
+    return dfd;
+}
+
+/*!
+ * \brief Get the name of the cache entry for a file and its signature
+ *
+ * The key covers the file attributes, the signature contents, and the
+ * certificate the signature is checked against.
+ */
+static std::string sig_cache_entry(const SigFileId &id, const std::string &sig)
+{
+    std::string attrs = format("v1:%" PRIuMAX ":%" PRIuMAX ":%" PRIu64
+                               ":%" PRId64 ":%" PRId64 ":",
+                               static_cast<uintmax_t>(id.dev),
+                               static_cast<uintmax_t>(id.ino),
+                               id.size, id.mtime_ns, id.ctime_ns);
+
+    std::array<unsigned char, SHA512_DIGEST_LENGTH> sig_digest;
+    SHA512(reinterpret_cast<const unsigned char *>(sig.data()), sig.size(),
+           sig_digest.data());
+
+    SHA512_CTX ctx;
+    SHA512_Init(&ctx);
+    SHA512_Update(&ctx, attrs.data(), attrs.size());
+    SHA512_Update(&ctx, sig_digest.data(), sig_digest.size());
+    SHA512_Update(&ctx, signing_cert, strlen(signing_cert));
+
+    std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
+    SHA512_Final(digest.data(), &ctx);
+
+    return util::hex_string(digest.data(), digest.size());
+}
+
+static bool sig_cache_contains(const std::string &entry)
 {
+    int dfd = sig_cache_open();
+    if (dfd < 0) {
+        return false;
+    }
+
+    struct stat sb;
+    bool found = fstatat(dfd, entry.c_str(), &sb, AT_SYMLINK_NOFOLLOW) == 0
+            && S_ISREG(sb.st_mode) && sb.st_uid == 0;
+
+    close(dfd);
+    return found;
+}
+
+static void sig_cache_add(const std::string &entry)
+{
+    int dfd = sig_cache_open();
+    if (dfd < 0) {
+        return;
+    }
+
+    int fd = openat(dfd, entry.c_str(), O_WRONLY | O_CREAT | O_EXCL
+            | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        close(fd);
+    } else if (errno != EEXIST) {
+        LOGW("%s: Failed to add cache entry: %s",
+             SIG_CACHE_DIR, strerror(errno));
+    }
+
+    close(dfd);
+}
+
+static ScopedEVP_PKEY load_public_key()
+{
+    ScopedEVP_PKEY null_key(nullptr, EVP_PKEY_free);
+
     std::string der;
     if (!hex2bin(signing_cert, der)) {
         LOGE("Failed to convert hex-encoded certificate to binary: %s",
              signing_cert);
-        return SigVerifyResult::Failure;
+        return null_key;
     }
 
     // Cast to (void *) is okay since BIO_new_mem_buf() creates a read-only
@@ -157,7 +317,7 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
     if (!bio_x509_cert) {
         LOGE("Failed to create BIO for X509 certificate: %s", signing_cert);
         openssl_log_errors();
-        return SigVerifyResult::Failure;
+        return null_key;
     }
 
     // Load DER-encoded certificate
@@ -165,7 +325,7 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
     if (!cert) {
         LOGE("Failed to load X509 certificate: %s", signing_cert);
         openssl_log_errors();
-        return SigVerifyResult::Failure;
+        return null_key;
     }
 
     // Get public key from certificate
@@ -174,10 +334,126 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
         LOGE("Failed to load public key from X509 certificate: %s",
              signing_cert);
         openssl_log_errors();
+        return null_key;
+    }
+
+    return public_key;
+}
+
+static SigVerifyResult verify_signature_with_key(int fd,
+                                                 const std::string &sig,
+                                                 const char *name,
+                                                 EVP_PKEY &public_key)
+{
+    ScopedBIO bio_data_in(BIO_new_fd(fd, BIO_NOCLOSE), BIO_free);
+    if (!bio_data_in) {
+        LOGE("%s: Failed to create BIO for input file", name);
+        openssl_log_errors();
+        return SigVerifyResult::Failure;
+    }
+
+    ScopedBIO bio_sig_in(BIO_new_mem_buf(
+            sig.data(), static_cast<int>(sig.size())), BIO_free);
+    if (!bio_sig_in) {
+        LOGE("%s: Failed to create BIO for signature", name);
+        openssl_log_errors();
+        return SigVerifyResult::Failure;
+    }
+
+    auto ret = sign::verify_data(*bio_data_in, *bio_sig_in, public_key);
+    if (!ret) {
+        if (ret.error().ec == sign::Error::BadSignature) {
+            return SigVerifyResult::Invalid;
+        } else {
+            LOGE("%s: Failed to verify signature: %s", name,
+                 ret.error().ec.message().c_str());
+            if (ret.error().has_openssl_error) {
+                openssl_log_errors();
+            }
+            return SigVerifyResult::Failure;
+        }
+    }
+
+    return SigVerifyResult::Valid;
+}
+
+/*!
+ * \brief Verify the signature of an open file
+ *
+ * If \p id is set, the result is looked up in and added to the verified-
+ * signature cache. Only valid signatures are cached.
+ *
+ * \param fd File descriptor of the file to verify. It is read from the
+ *           beginning.
+ * \param sig_fd File descriptor of the signature file
+ * \param name Name of the file for log messages
+ * \param id Identity of the contents of \p fd (from sig_file_id()). This may
+ *           describe a different file if \p fd is a private copy of it that
+ *           was made while the original file's identity did not change.
+ */
+SigVerifyResult verify_signature_fd(int fd, int sig_fd, const char *name,
+                                    const std::optional<SigFileId> &id)
+{
+    std::string sig;
+    if (!read_fd_fully(sig_fd, sig)) {
+        LOGE("%s: Failed to read signature: %s", name, strerror(errno));
+        return SigVerifyResult::Failure;
+    }
+
+    std::string entry;
+
+    if (id) {
+        entry = sig_cache_entry(*id, sig);
+
+        if (sig_cache_contains(entry)) {
+            LOGV("%s: Signature was previously verified", name);
+            return SigVerifyResult::Valid;
+        }
+    }
+
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        LOGE("%s: Failed to seek: %s", name, strerror(errno));
+        return SigVerifyResult::Failure;
+    }
+
+    auto public_key = load_public_key();
+    if (!public_key) {
+        return SigVerifyResult::Failure;
+    }
+
+    auto result = verify_signature_with_key(fd, sig, name, *public_key);
+
+    if (result == SigVerifyResult::Valid && id) {
+        sig_cache_add(entry);
+    }
+
+    return result;
+}
+
+SigVerifyResult verify_signature(const char *path, const char *sig_path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open input file: %s", path, strerror(errno));
         return SigVerifyResult::Failure;
     }
 
-    return verify_signature_with_key(path, sig_path, *public_key);
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    int sig_fd = open(sig_path, O_RDONLY | O_CLOEXEC);
+    if (sig_fd < 0) {
+        LOGE("%s: Failed to open signature file: %s",
+             sig_path, strerror(errno));
+        return SigVerifyResult::Failure;
+    }
+
+    auto close_sig_fd = finally([&] {
+        close(sig_fd);
+    });
+
+    return verify_signature_fd(fd, sig_fd, path, sig_file_id(fd));
 }
 
 static void sigverify_usage(FILE *stream)
@@ -19,18 +19,30 @@
 
 #include "util/switcher.h"
 
+#include <algorithm>
 #include <array>
+#include <thread>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <openssl/sha.h>
 
+#include "mbcommon/error_code.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/io_queue.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
@@ -43,6 +55,8 @@
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
+#include "util/block_dev_index.h"
+#include "util/memory_budget.h"
 #include "util/multiboot.h"
 #include "util/roms.h"
 
@@ -50,6 +64,11 @@
 
 #define CHECKSUMS_PATH "/data/multiboot/checksums.prop"
 
+// Size of each read and write when copying and flashing images
+static constexpr size_t FLASH_CHUNK_SIZE = 1024 * 1024;
+// Granularity at which the block device contents are compared to the image
+static constexpr size_t COMPARE_BLOCK_SIZE = 4096;
+
 namespace mb
 {
 
@@ -176,7 +195,9 @@ struct Flashable
     std::string block_dev;
     std::string expected_hash;
     std::string hash;
-    std::string data;
+    // Private copy of the image. This is what gets hashed and flashed.
+    int fd = -1;
+    uint64_t size = 0;
 };
 
 /*!
@@ -190,33 +211,6 @@ struct Flashable
  *
  * \return Block device path if found. Otherwise, an empty string.
  */
-static std::string find_block_dev(const std::vector<std::string> &search_dirs,
-                                  const std::string &partition)
-{
-    struct stat sb;
-
-    if (starts_with(partition, "mmcblk")) {
-        std::string path("/dev/block/");
-        path += partition;
-
-        if (stat(path.c_str(), &sb) == 0) {
-            return path;
-        }
-    }
-
-    for (auto const &path : search_dirs) {
-        std::string block_dev(path);
-        block_dev += "/";
-        block_dev += partition;
-
-        if (stat(block_dev.c_str(), &sb) == 0) {
-            return block_dev;
-        }
-    }
-
-    return {};
-}
-
 static bool add_extra_images(const std::string &multiboot_dir,
                              const std::vector<std::string> &block_dev_dirs,
                              std::vector<Flashable> *flashables)
@@ -258,7 +252,8 @@ static bool add_extra_images(const std::string &multiboot_dir,
             continue;
         }
 
-        std::string block_dev = find_block_dev(block_dev_dirs, partition);
+        std::string block_dev =
+                BlockDevIndex::instance().find(block_dev_dirs, partition);
         if (block_dev.empty()) {
             LOGW("Couldn't find block device for partition %s",
                  partition.c_str());
@@ -277,6 +272,245 @@ static bool add_extra_images(const std::string &multiboot_dir,
     return true;
 }
 
+/*!
+ * \brief Create a file that no other process can open
+ *
+ * If \p in_memory is true and the kernel supports it, a sealable memfd is
+ * used. Otherwise, a temporary file is created in \p temp_dir and immediately
+ * unlinked.
+ *
+ * \param temp_dir Directory for the temporary file
+ * \param in_memory Whether the file may be kept in RAM
+ * \param sealable Whether the returned file can be sealed
+ *
+ * \return File descriptor or the error code on failure
+ */
+static oc::result<int> create_private_file(const std::string &temp_dir,
+                                           bool in_memory, bool &sealable)
+{
+    if (in_memory) {
+        int fd = static_cast<int>(syscall(__NR_memfd_create, "mbtool-flashable",
+                                          MFD_CLOEXEC | MFD_ALLOW_SEALING));
+        if (fd >= 0) {
+            sealable = true;
+            return fd;
+        } else if (errno != ENOSYS) {
+            return ec_from_errno();
+        }
+    }
+
+    std::string path(temp_dir);
+    path += "/.flashable.XXXXXX";
+
+    int fd = mkostemp(path.data(), O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    if (unlink(path.c_str()) < 0) {
+        auto ec = ec_from_errno();
+        close(fd);
+        return ec;
+    }
+
+    sealable = false;
+    return fd;
+}
+
+/*!
+ * \brief Copy a file in chunks and compute its SHA512 digest
+ *
+ * Only #FLASH_CHUNK_SIZE bytes are held in memory at a time.
+ *
+ * \param input Source file
+ * \param output Target file
+ * \param size Number of bytes copied
+ *
+ * \return Hex digest or the error code on failure
+ */
+static oc::result<std::string> copy_and_hash_file(File &input, File &output,
+                                                  uint64_t &size)
+{
+    SHA512_CTX ctx;
+    SHA512_Init(&ctx);
+
+    std::vector<unsigned char> buf(FLASH_CHUNK_SIZE);
+
+    size = 0;
+
+    while (true) {
+        OUTCOME_TRY(n, file_read_retry(input, buf.data(), buf.size()));
+        if (n == 0) {
+            break;
+        }
+
+        SHA512_Update(&ctx, buf.data(), n);
+        OUTCOME_TRYV(file_write_exact(output, buf.data(), n));
+
+        size += n;
+    }
+
+    std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
+    SHA512_Final(digest.data(), &ctx);
+
+    return util::hex_string(digest.data(), digest.size());
+}
+
+/*!
+ * \brief Copy an image to a private file and compute its SHA512 digest
+ *
+ * The private copy is what gets verified and flashed so that a malicious app
+ * can't change the image between the hash verification step and the flashing
+ * step. If possible, the copy is sealed against further modification.
+ *
+ * \param f Flashable to populate the fd, size, and hash fields of
+ * \param temp_dir Directory for the private copy if it is not kept in RAM
+ * \param in_memory Whether the private copy may be kept in RAM
+ *
+ * \return Nothing on success or the error code on failure
+ */
+static oc::result<void> copy_and_hash(Flashable &f, const std::string &temp_dir,
+                                      bool in_memory)
+{
+    FdFile input;
+    OUTCOME_TRYV(input.open(f.image, FileOpenMode::ReadOnly));
+
+    bool sealable;
+    OUTCOME_TRY(fd, create_private_file(temp_dir, in_memory, sealable));
+    f.fd = fd;
+
+    FdFile output(fd, false);
+
+    OUTCOME_TRY(hash, copy_and_hash_file(input, output, f.size));
+
+    if (sealable && fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW
+            | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        return ec_from_errno();
+    }
+
+    f.hash = std::move(hash);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Read as much as possible at an offset
+ *
+ * \return Number of bytes read, which is only less than \p size at EOF, or the
+ *         error code on failure
+ */
+static oc::result<size_t> read_fully_at(File &file, uint64_t offset,
+                                        void *buf, size_t size)
+{
+    auto ptr = static_cast<unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size) {
+        OUTCOME_TRY(n, file.read_at(offset + total, ptr + total, size - total));
+        if (n == 0) {
+            break;
+        }
+        total += n;
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Write an image to a block device
+ *
+ * The block device is compared to the image in #COMPARE_BLOCK_SIZE blocks and
+ * only the runs of blocks that differ are written. The writes are performed
+ * with several requests in flight to keep the storage device's queue busy.
+ *
+ * \param block_dev Block device path
+ * \param fd Image file descriptor
+ * \param size Image size
+ *
+ * \return Nothing on success or the error code on failure
+ */
+static oc::result<void> flash_image(const std::string &block_dev,
+                                    int fd, uint64_t size)
+{
+    if (size > SIZE_MAX) {
+        return std::errc::file_too_large;
+    }
+
+    void *map = nullptr;
+
+    if (size > 0) {
+        map = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED,
+                   fd, 0);
+        if (map == MAP_FAILED) {
+            return ec_from_errno();
+        }
+    }
+
+    auto unmap = finally([&] {
+        if (map) {
+            munmap(map, static_cast<size_t>(size));
+        }
+    });
+
+    auto data = static_cast<const unsigned char *>(map);
+
+    FdFile file;
+
+    OUTCOME_TRYV(file.open(block_dev, FileOpenMode::ReadWrite));
+
+    std::vector<unsigned char> buf(FLASH_CHUNK_SIZE);
+    uint64_t written = 0;
+
+    {
+        IoQueue queue(file);
+
+        for (uint64_t offset = 0; offset < size; offset += FLASH_CHUNK_SIZE) {
+            auto n = static_cast<size_t>(
+                    std::min<uint64_t>(FLASH_CHUNK_SIZE, size - offset));
+
+            OUTCOME_TRY(n_read, read_fully_at(file, offset, buf.data(), n));
+
+            // Start of the current run of differing blocks or n if there is
+            // no run in progress
+            size_t run_begin = n;
+
+            auto flush_run = [&](size_t run_end) -> oc::result<void> {
+                if (run_begin != n) {
+                    OUTCOME_TRYV(queue.submit_write(
+                            offset + run_begin, data + offset + run_begin,
+                            run_end - run_begin));
+
+                    written += run_end - run_begin;
+                    run_begin = n;
+                }
+                return oc::success();
+            };
+
+            for (size_t block = 0; block < n; block += COMPARE_BLOCK_SIZE) {
+                size_t block_size = std::min(COMPARE_BLOCK_SIZE, n - block);
+                bool differs = block + block_size > n_read
+                        || memcmp(buf.data() + block,
+                                  data + offset + block, block_size) != 0;
+
+                if (!differs) {
+                    OUTCOME_TRYV(flush_run(block));
+                } else if (run_begin == n) {
+                    run_begin = block;
+                }
+            }
+
+            OUTCOME_TRYV(flush_run(n));
+        }
+
+        OUTCOME_TRYV(queue.wait());
+    }
+
+    LOGD("%s: Wrote %" PRIu64 " of %" PRIu64 " bytes (remaining blocks"
+         " were unchanged)", block_dev.c_str(), written, size);
+
+    return file.close();
+}
+
 /*!
  * \brief Switch to another ROM
  *
@@ -327,12 +561,20 @@ SwitchRomResult switch_rom(const std::string &id,
         return SwitchRomResult::Failed;
     }
 
-    // We'll read the files we want to flash into memory so a malicious app
-    // can't change the file between the hash verification step and flashing
-    // step.
+    // We'll copy the files we want to flash to private files so a malicious
+    // app can't change the file between the hash verification step and
+    // flashing step.
 
     std::vector<Flashable> flashables;
 
+    auto close_fds = finally([&] {
+        for (auto const &f : flashables) {
+            if (f.fd >= 0) {
+                close(f.fd);
+            }
+        }
+    });
+
     flashables.emplace_back();
     flashables.back().image = bootimg_path;
     flashables.back().block_dev = boot_blockdev;
@@ -341,27 +583,56 @@ SwitchRomResult switch_rom(const std::string &id,
         LOGW("Failed to find extra images");
     }
 
-    ChecksumProps props;
-    props.load_file();
+    // All of the private copies are alive at the same time, so only keep them
+    // in RAM if they fit within the memory budget together
+    uint64_t total_size = 0;
 
-    for (Flashable &f : flashables) {
-        // If memory becomes an issue, an alternative method is to create a
-        // temporary directory in /data/multiboot/ that's only writable by root
-        // and copy the images there.
-        if (auto r = util::file_read_all(f.image)) {
-            f.data = std::move(r.value());
-        } else {
-            LOGE("%s: Failed to read image: %s",
-                 f.image.c_str(), r.error().message().c_str());
-            return SwitchRomResult::Failed;
+    for (auto const &f : flashables) {
+        struct stat sb;
+        if (stat(f.image.c_str(), &sb) == 0) {
+            total_size += static_cast<uint64_t>(sb.st_size);
+        }
+    }
+
+    bool in_memory = memory_budget_allows(total_size);
+    if (!in_memory) {
+        LOGD("Images (%" PRIu64 " bytes) exceed memory budget;"
+             " staging copies in %s", total_size, multiboot_path.c_str());
+    }
+
+    // Copy and hash all of the images in parallel
+    {
+        std::vector<std::error_code> errors(flashables.size());
+        std::vector<std::thread> threads;
+
+        threads.reserve(flashables.size());
+
+        for (size_t i = 0; i < flashables.size(); ++i) {
+            threads.emplace_back([&, i] {
+                if (auto r = copy_and_hash(flashables[i], multiboot_path,
+                                           in_memory); !r) {
+                    errors[i] = r.error();
+                }
+            });
         }
 
-        // Get actual sha512sum
-        std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
-        SHA512(reinterpret_cast<const unsigned char *>(f.data.data()),
-               f.data.size(), digest.data());
-        f.hash = util::hex_string(digest.data(), digest.size());
+        for (auto &t : threads) {
+            t.join();
+        }
+
+        for (size_t i = 0; i < flashables.size(); ++i) {
+            if (errors[i]) {
+                LOGE("%s: Failed to read image: %s",
+                     flashables[i].image.c_str(), errors[i].message().c_str());
+                return SwitchRomResult::Failed;
+            }
+        }
+    }
+
+    ChecksumProps props;
+    props.load_file();
 
+    for (Flashable &f : flashables) {
         if (force_update_checksums) {
             props.set(id, util::base_name(f.image), f.hash);
         }
@@ -393,8 +664,7 @@ SwitchRomResult switch_rom(const std::string &id,
 
     // Now we can flash the images
     for (Flashable &f : flashables) {
-        if (auto r = util::file_write_data(
-                f.block_dev, f.data.data(), f.data.size()); !r) {
+        if (auto r = flash_image(f.block_dev, f.fd, f.size); !r) {
             LOGE("%s: Failed to write image: %s",
                  f.block_dev.c_str(), r.error().message().c_str());
             return SwitchRomResult::Failed;
@@ -451,36 +721,44 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
         return false;
     }
 
-    auto data = util::file_read_all(boot_blockdev);
-    if (!data) {
-        LOGE("%s: Failed to read block device: %s",
-             boot_blockdev.c_str(), data.error().message().c_str());
+    // The image is streamed to its destination so that only one chunk is held
+    // in memory at a time
+    FdFile input;
+    FdFile output;
+
+    if (auto r = input.open(boot_blockdev, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open block device: %s",
+             boot_blockdev.c_str(), r.error().message().c_str());
+        return false;
+    }
+    if (auto r = output.open(bootimg_path, FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             bootimg_path.c_str(), r.error().message().c_str());
         return false;
     }
 
-    // Get actual sha512sum
-    std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
-    SHA512(reinterpret_cast<const unsigned char *>(data.value().data()),
-           data.value().size(), digest.data());
-    std::string hash = util::hex_string(digest.data(), digest.size());
+    uint64_t size;
+    auto hash = copy_and_hash_file(input, output, size);
+    if (!hash) {
+        LOGE("%s: Failed to copy to %s: %s", boot_blockdev.c_str(),
+             bootimg_path.c_str(), hash.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = output.close(); !r) {
+        LOGE("%s: Failed to write image: %s",
+             bootimg_path.c_str(), r.error().message().c_str());
+        return false;
+    }
 
     // Add to checksums.prop
     ChecksumProps props;
     props.load_file();
-    props.set(id, "boot.img", hash);
+    props.set(id, "boot.img", hash.value());
 
     // NOTE: This function isn't responsible for updating the checksums for
     //       any extra images. We don't want to mask any malicious changes.
 
-    // Cast is okay. The data is just passed to fwrite (ie. no signed
-    // extension issues)
-    if (auto r = util::file_write_data(
-            bootimg_path, data.value().data(), data.value().size()); !r) {
-        LOGE("%s: Failed to write image: %s",
-             bootimg_path.c_str(), r.error().message().c_str());
-        return false;
-    }
-
     LOGD("Updating checksums file");
     props.save_file();
 
@@ -19,8 +19,6 @@
 
 #include "util/wipe.h"
 
-#include <algorithm>
-
 #include <cerrno>
 #include <cstring>
 
@@ -30,10 +28,10 @@
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/delete.h"
-#include "mbutil/fts.h"
 #include "mbutil/mount.h"
 #include "mbutil/string.h"
 
+#include "recovery/image.h"
 #include "util/multiboot.h"
 
 #define LOG_TAG "mbtool/util/wipe"
@@ -41,71 +39,9 @@
 namespace mb
 {
 
-class WipeDirectory : public util::FtsWrapper {
-public:
-    WipeDirectory(std::string path, std::vector<std::string> exclusions)
-        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
-        , _exclusions(std::move(exclusions))
-    {
-    }
-
-    Actions on_changed_path() override
-    {
-        // Exclude first-level directories
-        if (_curr->fts_level == 1) {
-            if (std::find(_exclusions.begin(), _exclusions.end(), _curr->fts_name)
-                    != _exclusions.end()) {
-                return Action::Skip;
-            }
-        }
-
-        return Action::Ok;
-    }
-
-    Actions on_reached_directory_pre() override
-    {
-        // Do nothing. Need depth-first search, so directories are deleted
-        // in FTS_DP
-        return Action::Ok;
-    }
-
-    Actions on_reached_directory_post() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_file() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_symlink() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
-
-    Actions on_reached_special_file() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
-    }
-
-private:
-    std::vector<std::string> _exclusions;
-
-    bool delete_path()
-    {
-        if (_curr->fts_level >= 1 && remove(_curr->fts_accpath) < 0) {
-            _error_msg = format("%s: Failed to remove: %s",
-                                _curr->fts_path, strerror(errno));
-            LOGW("%s", _error_msg.c_str());
-            return false;
-        }
-        return true;
-    }
-};
-
 bool wipe_directory(const std::string &directory,
-                    const std::vector<std::string> &exclusions)
+                    const std::vector<std::string> &exclusions,
+                    util::FileOpProgress *progress)
 {
     struct stat sb;
     if (stat(directory.c_str(), &sb) < 0 && errno == ENOENT) {
@@ -117,22 +53,35 @@ bool wipe_directory(const std::string &directory,
     new_exclusions.insert(new_exclusions.end(),
                           exclusions.begin(), exclusions.end());
 
-    WipeDirectory wd(directory, std::move(new_exclusions));
-    return wd.run();
+    if (auto r = util::delete_contents(directory, new_exclusions,
+                                       util::DeleteFlag::Parallel, progress);
+            !r) {
+        LOGW("%s: Failed to remove: %s", r.error().path.c_str(),
+             r.error().ec.message().c_str());
+        return false;
+    }
+
+    return true;
 }
 
 /*!
- * \brief Log deletion of file
+ * \brief Log wiping of image
+ *
+ * Instead of deleting the files inside the image, the image is replaced with a
+ * new empty ext4 image of the same size. If the tools for creating the image
+ * are not available, the image is just deleted.
  *
- * \note The path will be deleted only if it is a regular file.
+ * \note The path will be wiped only if it is a regular file.
  *
- * \param path File to delete
+ * \param path Image to wipe
+ * \param progress Progress to count the image in or nullptr
  *
- * \return True if file was deleted or doesn't exist. False, otherwise.
+ * \return True if the image was wiped or doesn't exist. False, otherwise.
  */
-static bool log_wipe_file(const std::string &path)
+static bool log_wipe_image(const std::string &path,
+                           util::FileOpProgress *progress)
 {
-    LOGV("Wiping file %s", path.c_str());
+    LOGV("Wiping image %s", path.c_str());
 
     struct stat sb;
     if (stat(path.c_str(), &sb) < 0) {
@@ -145,13 +94,26 @@ static bool log_wipe_file(const std::string &path)
     }
 
     if (!S_ISREG(sb.st_mode)) {
-        LOGE("%s: Cannot wipe file: not a regular file", path.c_str());
+        LOGE("%s: Cannot wipe image: not a regular file", path.c_str());
         return false;
     }
 
-    bool ret = unlink(path.c_str()) == 0 || errno == ENOENT;
-    LOGV("-> %s", ret ? "Succeeded" : "Failed");
-    return ret;
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+        LOGV("-> Failed: %s", strerror(errno));
+        return false;
+    }
+
+    if (create_ext4_image(path, static_cast<uint64_t>(sb.st_size))
+            != CreateImageResult::Succeeded) {
+        LOGW("%s: Failed to recreate empty image", path.c_str());
+    }
+
+    if (progress) {
+        ++progress->files;
+    }
+
+    LOGV("-> Succeeded");
+    return true;
 }
 
 /*!
@@ -162,11 +124,13 @@ static bool log_wipe_file(const std::string &path)
  *
  * \param mountpoint Mountpoint root to wipe
  * \param exclusions List of first-level paths to exclude
+ * \param progress Progress to update or nullptr
  *
  * \return True if the path was wiped or doesn't exist. False, otherwise
  */
 static bool log_wipe_directory(const std::string &mountpoint,
-                               const std::vector<std::string> &exclusions)
+                               const std::vector<std::string> &exclusions,
+                               util::FileOpProgress *progress)
 {
     if (exclusions.empty()) {
         LOGV("Wiping directory %s", mountpoint.c_str());
@@ -190,15 +154,17 @@ static bool log_wipe_directory(const std::string &mountpoint,
         return false;
     }
 
-    bool ret = wipe_directory(mountpoint, exclusions);
+    bool ret = wipe_directory(mountpoint, exclusions, progress);
     LOGV("-> %s", ret ? "Succeeded" : "Failed");
     return ret;
 }
 
-static bool log_delete_recursive(const std::string &path)
+static bool log_delete_recursive(const std::string &path,
+                                 util::FileOpProgress *progress)
 {
     LOGV("Recursively deleting %s", path.c_str());
-    if (auto r = util::delete_recursive(path)) {
+    if (auto r = util::delete_recursive(path, util::DeleteFlag::Parallel,
+                                        progress)) {
         LOGV("-> Succeeded");
         return true;
     } else {
@@ -207,7 +173,8 @@ static bool log_delete_recursive(const std::string &path)
     }
 }
 
-bool wipe_system(const std::shared_ptr<Rom> &rom)
+bool wipe_system(const std::shared_ptr<Rom> &rom,
+                 util::FileOpProgress *progress)
 {
     std::string path = rom->full_system_path();
     if (path.empty()) {
@@ -222,16 +189,17 @@ bool wipe_system(const std::shared_ptr<Rom> &rom)
         mount_point += rom->id;
         (void) util::umount(mount_point);
 
-        ret = log_wipe_file(path);
+        ret = log_wipe_image(path, progress);
     } else {
-        ret = log_wipe_directory(path, {});
+        ret = log_wipe_directory(path, {}, progress);
         // Try removing ROM's /system if it's empty
         remove(path.c_str());
     }
     return ret;
 }
 
-bool wipe_cache(const std::shared_ptr<Rom> &rom)
+bool wipe_cache(const std::shared_ptr<Rom> &rom,
+                util::FileOpProgress *progress)
 {
     std::string path = rom->full_cache_path();
     if (path.empty()) {
@@ -241,16 +209,17 @@ bool wipe_cache(const std::shared_ptr<Rom> &rom)
 
     bool ret;
     if (rom->cache_is_image) {
-        ret = log_wipe_file(path);
+        ret = log_wipe_image(path, progress);
     } else {
-        ret = log_wipe_directory(path, {});
+        ret = log_wipe_directory(path, {}, progress);
         // Try removing ROM's /cache if it's empty
         remove(path.c_str());
     }
     return ret;
 }
 
-bool wipe_data(const std::shared_ptr<Rom> &rom)
+bool wipe_data(const std::shared_ptr<Rom> &rom,
+               util::FileOpProgress *progress)
 {
     std::string path = rom->full_data_path();
     if (path.empty()) {
@@ -260,9 +229,9 @@ bool wipe_data(const std::shared_ptr<Rom> &rom)
 
     bool ret;
     if (rom->data_is_image) {
-        ret = log_wipe_file(path);
+        ret = log_wipe_image(path, progress);
     } else {
-        ret = log_wipe_directory(path, { "media" });
+        ret = log_wipe_directory(path, { "media" }, progress);
         // Try removing ROM's /data/media and /data if they're empty
         remove((path + "/media").c_str());
         remove(path.c_str());
@@ -270,7 +239,8 @@ bool wipe_data(const std::shared_ptr<Rom> &rom)
     return ret;
 }
 
-bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom)
+bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom,
+                       util::FileOpProgress *progress)
 {
     if (rom->data_is_image || rom->cache_is_image) {
         LOGE("Wiping dalvik-cache for ROMs that use data or cache images is "
@@ -297,17 +267,18 @@ bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom)
     // util::delete_recursive() returns true if the path does not
     // exist (ie. returns false only on errors), which is exactly
     // what we want
-    return log_delete_recursive(data_path)
-            && log_delete_recursive(cache_path);
+    return log_delete_recursive(data_path, progress)
+            && log_delete_recursive(cache_path, progress);
 }
 
-bool wipe_multiboot(const std::shared_ptr<Rom> &rom)
+bool wipe_multiboot(const std::shared_ptr<Rom> &rom,
+                    util::FileOpProgress *progress)
 {
     // Delete /data/media/0/MultiBoot/[ROM ID]
     std::string multiboot_path(MULTIBOOT_DIR);
     multiboot_path += '/';
     multiboot_path += rom->id;
-    return log_delete_recursive(multiboot_path);
+    return log_delete_recursive(multiboot_path, progress);
 }
 
 }
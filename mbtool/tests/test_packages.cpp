@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <unordered_map>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "mbutil/file.h"
+
+#include "boot/packages.h"
+
+using namespace mb;
+
+// Signing certificate bytes (shortened)
+static constexpr unsigned char CERT_BYTES[] = {
+    0x30, 0x82, 0x03, 0xab, 0xcd, 0xef, 0x9a, 0x0f,
+};
+static constexpr char CERT_HEX[] = "308203abcdef9a0f";
+
+/*!
+ * \brief Minimal Android Binary XML writer (see BinaryXmlSerializer.java)
+ */
+class AbxWriter
+{
+public:
+    AbxWriter()
+    {
+        _buf.append("ABX\0", 4);
+        token(0, 1); // START_DOCUMENT, TYPE_NULL
+    }
+
+    void start_tag(const std::string &name)
+    {
+        token(2, 3); // START_TAG, TYPE_STRING_INTERNED
+        interned(name);
+    }
+
+    void end_tag(const std::string &name)
+    {
+        token(3, 3); // END_TAG, TYPE_STRING_INTERNED
+        interned(name);
+    }
+
+    void attr_string(const std::string &name, const std::string &value)
+    {
+        token(15, 2); // ATTRIBUTE, TYPE_STRING
+        interned(name);
+        utf(value);
+    }
+
+    void attr_int(const std::string &name, int32_t value)
+    {
+        token(15, 6); // ATTRIBUTE, TYPE_INT
+        interned(name);
+        be(static_cast<uint32_t>(value), 4);
+    }
+
+    void attr_bytes_hex(const std::string &name, const void *data,
+                        size_t size)
+    {
+        token(15, 4); // ATTRIBUTE, TYPE_BYTES_HEX
+        interned(name);
+        utf(std::string(static_cast<const char *>(data), size));
+    }
+
+    std::string finish()
+    {
+        token(1, 1); // END_DOCUMENT, TYPE_NULL
+        return _buf;
+    }
+
+private:
+    std::string _buf;
+    std::unordered_map<std::string, uint16_t> _interned;
+
+    void token(unsigned char command, unsigned char type)
+    {
+        _buf += static_cast<char>(command | (type << 4));
+    }
+
+    void be(uint64_t value, size_t size)
+    {
+        for (size_t i = size; i > 0; --i) {
+            _buf += static_cast<char>((value >> ((i - 1) * 8)) & 0xff);
+        }
+    }
+
+    void utf(const std::string &str)
+    {
+        be(str.size(), 2);
+        _buf += str;
+    }
+
+    void interned(const std::string &str)
+    {
+        if (auto it = _interned.find(str); it != _interned.end()) {
+            be(it->second, 2);
+        } else {
+            be(0xffff, 2);
+            utf(str);
+            _interned.emplace(str, static_cast<uint16_t>(_interned.size()));
+        }
+    }
+};
+
+class PackagesTest : public ::testing::Test
+{
+protected:
+    std::string _path;
+
+    void SetUp() override
+    {
+        char tmpl[] = "/tmp/mbtool-packages-XXXXXX";
+        int fd = mkstemp(tmpl);
+        ASSERT_GE(fd, 0) << strerror(errno);
+        close(fd);
+        _path = tmpl;
+    }
+
+    void TearDown() override
+    {
+        unlink(_path.c_str());
+    }
+
+    void write_file(const std::string &data)
+    {
+        ASSERT_TRUE(util::file_write_data(_path, data.data(), data.size()));
+    }
+};
+
+TEST_F(PackagesTest, LoadAbxCertKeyAsLowercaseHex)
+{
+    AbxWriter w;
+    w.start_tag("packages");
+    w.start_tag("package");
+    w.attr_string("name", "com.github.chenxiaolong.dualbootpatcher");
+    w.attr_int("userId", 10123);
+    w.start_tag("sigs");
+    w.attr_int("count", 1);
+    w.attr_int("schemeVersion", 3);
+    w.start_tag("cert");
+    w.attr_int("index", 0);
+    w.attr_bytes_hex("key", CERT_BYTES, sizeof(CERT_BYTES));
+    w.end_tag("cert");
+    w.end_tag("sigs");
+    w.end_tag("package");
+    w.end_tag("packages");
+    ASSERT_NO_FATAL_FAILURE(write_file(w.finish()));
+
+    Packages pkgs;
+    ASSERT_TRUE(pkgs.load_xml(_path));
+
+    auto pkg = pkgs.find_by_uid(10123);
+    ASSERT_TRUE(pkg);
+    ASSERT_EQ(pkg->sig_indexes, std::vector<std::string>{"0"});
+
+    auto it = pkgs.sigs.find("0");
+    ASSERT_NE(it, pkgs.sigs.end());
+    ASSERT_EQ(it->second, CERT_HEX);
+}
+
+TEST_F(PackagesTest, LoadTextCertKeyAsLowercaseHex)
+{
+    ASSERT_NO_FATAL_FAILURE(write_file(
+            "<?xml version='1.0' encoding='utf-8' standalone='yes' ?>\n"
+            "<packages>\n"
+            "  <package name=\"com.github.chenxiaolong.dualbootpatcher\""
+            " userId=\"10123\">\n"
+            "    <sigs count=\"1\" schemeVersion=\"3\">\n"
+            "      <cert index=\"0\" key=\"308203ABCDEF9A0F\" />\n"
+            "    </sigs>\n"
+            "  </package>\n"
+            "</packages>\n"));
+
+    Packages pkgs;
+    ASSERT_TRUE(pkgs.load_xml(_path));
+
+    auto it = pkgs.sigs.find("0");
+    ASSERT_NE(it, pkgs.sigs.end());
+    ASSERT_EQ(it->second, CERT_HEX);
+}
@@ -3,6 +3,8 @@
 #include "compile.h"
 
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -41,6 +43,225 @@ out:
     return rc;
 }
 
+struct compile_state
+{
+    struct pcre_shim *shim;
+    struct saved_data *data;
+    const char *path;
+    unsigned int next;
+    int failed;
+};
+
+static void * compile_worker(void *arg)
+{
+    struct compile_state *state = arg;
+    struct spec *specs = state->data->spec_arr;
+    struct regex_error_data error_data;
+    char errbuf[256];
+    unsigned int i;
+
+    while (!__atomic_load_n(&state->failed, __ATOMIC_RELAXED)) {
+        i = __atomic_fetch_add(&state->next, 1, __ATOMIC_RELAXED);
+        if (i >= state->data->nspec) {
+            break;
+        }
+
+        memset(&error_data, 0, sizeof(error_data));
+
+        if (compile_regex(state->shim, state->data, &specs[i], &error_data)) {
+            regex_format_error(state->shim, &error_data,
+                               errbuf, sizeof(errbuf));
+            selinux_log("%s:  line %u has invalid regex %s:  %s\n",
+                        state->path, specs[i].lineno, specs[i].regex_str,
+                        errbuf);
+            __atomic_store_n(&state->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Compile the regexes of all specs. The specs are independent of each other,
+ * so they are handed out to up to `jobs` threads one at a time. The calling
+ * thread also takes part.
+ */
+static int compile_specs(struct pcre_shim *shim, struct saved_data *data,
+                         const char *path, unsigned int jobs)
+{
+    struct compile_state state;
+    pthread_t *threads = NULL;
+    unsigned int num_threads = 0;
+    unsigned int i;
+
+    state.shim = shim;
+    state.data = data;
+    state.path = path;
+    state.next = 0;
+    state.failed = 0;
+
+    if (jobs > data->nspec) {
+        jobs = data->nspec;
+    }
+
+    if (jobs > 1) {
+        threads = calloc(jobs - 1, sizeof(*threads));
+        if (!threads) {
+            selinux_log("Failed to calloc threads: %s\n", strerror(errno));
+            return -1;
+        }
+
+        /* Fall back to fewer threads if some cannot be created */
+        for (i = 0; i < jobs - 1; i++) {
+            if (pthread_create(&threads[num_threads], NULL,
+                               compile_worker, &state) == 0) {
+                num_threads++;
+            }
+        }
+    }
+
+    compile_worker(&state);
+
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    if (state.failed) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Cache File Format
+ *
+ * A single line stored alongside the target file (<target>.hash):
+ *
+ *     <binary format version> <FNV-1a hash of source> <regex version>
+ *
+ * If it matches the current source file and regex library, the existing
+ * target file is up to date and does not need to be compiled again.
+ */
+static int get_cache_key(struct pcre_shim *shim,
+                         const char *source_file, char **key_out)
+{
+    /* 64-bit FNV-1a */
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    unsigned char buf[65536];
+    const char *version;
+    size_t n, i;
+    FILE *fp;
+    int rc;
+
+    version = regex_version(shim);
+    if (!version) {
+        return -1;
+    }
+
+    fp = fopen(source_file, "rbe");
+    if (!fp) {
+        selinux_log("%s: Failed to open for reading: %s\n",
+                    source_file, strerror(errno));
+        return -1;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (i = 0; i < n; i++) {
+            hash ^= buf[i];
+            hash *= UINT64_C(0x100000001b3);
+        }
+    }
+
+    rc = ferror(fp) ? -1 : 0;
+    fclose(fp);
+
+    if (rc < 0) {
+        selinux_log("%s: Failed to read file\n", source_file);
+        return -1;
+    }
+
+    rc = asprintf(key_out, "%u %016" PRIx64 " %s\n",
+                  SELINUX_COMPILED_FCONTEXT_MAX_VERS, hash, version);
+    return rc < 0 ? -1 : 0;
+}
+
+static int is_cache_valid(const char *target_file, const char *cache_file,
+                          const char *key)
+{
+    char *line = NULL;
+    size_t line_len = 0;
+    FILE *fp;
+    int valid = 0;
+
+    if (access(target_file, R_OK) < 0) {
+        return 0;
+    }
+
+    fp = fopen(cache_file, "re");
+    if (!fp) {
+        return 0;
+    }
+
+    if (getline(&line, &line_len, fp) > 0) {
+        valid = strcmp(line, key) == 0;
+    }
+
+    free(line);
+    fclose(fp);
+    return valid;
+}
+
+static int write_cache_file(const char *cache_file, const char *key)
+{
+    char *tmp = NULL;
+    FILE *fp = NULL;
+    int fd = -1;
+    int rc;
+
+    rc = asprintf(&tmp, "%s.XXXXXX", cache_file);
+    if (rc < 0) {
+        return -1;
+    }
+
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        goto err;
+    }
+
+    fp = fdopen(fd, "we");
+    if (!fp) {
+        close(fd);
+        goto err_unlink;
+    }
+
+    if (fputs(key, fp) == EOF) {
+        fclose(fp);
+        goto err_unlink;
+    }
+
+    if (fclose(fp) == EOF) {
+        goto err_unlink;
+    }
+
+    if (rename(tmp, cache_file) < 0) {
+        goto err_unlink;
+    }
+
+    free(tmp);
+    return 0;
+
+err_unlink:
+    unlink(tmp);
+err:
+    selinux_log("%s: Failed to write cache file: %s\n",
+                cache_file, strerror(errno));
+    free(tmp);
+    return -1;
+}
+
 /*
  * File Format
  *
@@ -247,9 +468,12 @@ static void free_specs(struct pcre_shim *shim, struct saved_data *data)
 }
 
 int compile(struct pcre_shim *shim,
-            const char *source_file, const char *target_file)
+            const char *source_file, const char *target_file,
+            unsigned int jobs, int use_cache)
 {
     char *tmp = NULL;
+    char *cache_file = NULL;
+    char *cache_key = NULL;
     int fd, rc;
     struct selabel_handle *rec = NULL;
     struct saved_data *data = NULL;
@@ -261,6 +485,26 @@ int compile(struct pcre_shim *shim,
         return -1;
     }
 
+    if (use_cache) {
+        if (asprintf(&cache_file, "%s.hash", target_file) < 0) {
+            return -1;
+        }
+
+        if (get_cache_key(shim, source_file, &cache_key) < 0) {
+            free(cache_file);
+            return -1;
+        }
+
+        if (is_cache_valid(target_file, cache_file, cache_key)) {
+            free(cache_file);
+            free(cache_key);
+            return 0;
+        }
+
+        /* Make sure a stale cache file never refers to the new target */
+        unlink(cache_file);
+    }
+
     /* Generate dummy handle for process_line() function */
     rec = (struct selabel_handle *) calloc(1, sizeof(*rec));
     if (!rec) {
@@ -282,6 +526,11 @@ int compile(struct pcre_shim *shim,
         goto err;
     }
 
+    rc = compile_specs(shim, data, source_file, jobs);
+    if (rc < 0) {
+        goto err;
+    }
+
     rc = sort_specs(data);
     if (rc) {
         goto err;
@@ -317,12 +566,19 @@ int compile(struct pcre_shim *shim,
         goto err_unlink;
     }
 
+    /* The target is still valid if this fails; it just will not be reused */
+    if (use_cache) {
+        write_cache_file(cache_file, cache_key);
+    }
+
     rc = 0;
 out:
     free_specs(shim, data);
     free(rec);
     free(data);
     free(tmp);
+    free(cache_file);
+    free(cache_key);
 
     return rc;
 
@@ -7,7 +7,8 @@ extern "C" {
 #endif
 
 int compile(struct pcre_shim *shim,
-            const char *source_file, const char *target_file);
+            const char *source_file, const char *target_file,
+            unsigned int jobs, int use_cache);
 
 #ifdef __cplusplus
 }
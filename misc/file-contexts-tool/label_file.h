@@ -44,6 +44,7 @@ struct spec
     char regcomp;                   /* regex_str has been compiled to regex */
     char from_mmap;                 /* this spec is from an mmap of the data */
     size_t prefix_len;              /* length of fixed path prefix */
+    unsigned int lineno;            /* line number in the spec file */
 };
 
 /* A regular expression stem */
@@ -369,7 +370,8 @@ static inline int process_line(struct pcre_shim *shim,
     struct spec *spec_arr;
     unsigned int nspec = data->nspec;
     char const *errbuf;
-    struct regex_error_data error_data;
+
+    (void) shim;
 
     items = read_spec_entries(line_buf, &errbuf, 3, &regex, &type, &context);
     if (items < 0) {
@@ -429,13 +431,12 @@ static inline int process_line(struct pcre_shim *shim,
      */
     data->nspec++;
 
-    if (compile_regex(shim, data, &spec_arr[nspec], &error_data)) {
-        selinux_log("%s:  line %u has invalid regex %s:  %s\n",
-                    path, lineno, regex,
-                    (errbuf ? errbuf : "out of memory"));
-        errno = EINVAL;
-        return -1;
-    }
+    /*
+     * The regex is not compiled here. compile_specs() in compile.c compiles
+     * all of them once the whole file has been read so that the work can be
+     * spread across multiple threads.
+     */
+    spec_arr[nspec].lineno = lineno;
 
     if (type) {
         mode_t mode = string_to_mode(type);
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "compile.h"
 #include "decompile.h"
@@ -18,6 +19,10 @@ static void usage(FILE *stream, const char *progname)
             "Options:\n"
             "  -p, --pcre <PCRE lib path>\n"
             "                   Path to PCRE shared library\n"
+            "  -j, --jobs <N>   Number of threads for compiling regexes\n"
+            "                   (default: number of CPUs)\n"
+            "  -c, --cache      Skip compiling if <target file>.hash shows that\n"
+            "                   the target was built from the same source\n"
             "  -h, --help       Display this help message\n",
             progname, progname);
 }
@@ -30,12 +35,18 @@ int main(int argc, char *argv[])
     const char *source_path = NULL;
     const char *target_path = NULL;
     const char *pcre_path = NULL;
+    unsigned int jobs = 0;
+    int use_cache = 0;
     struct pcre_shim shim;
+    char *end;
+    long value;
     int ret;
 
-    static const char *short_options = "p:h";
+    static const char *short_options = "p:j:ch";
     static struct option long_options[] = {
         {"pcre", required_argument, 0, 'p'},
+        {"jobs", required_argument, 0, 'j'},
+        {"cache", no_argument,      0, 'c'},
         {"help", no_argument,       0, 'h'},
         {0, 0, 0, 0}
     };
@@ -46,6 +57,17 @@ int main(int argc, char *argv[])
         case 'p':
             pcre_path = optarg;
             break;
+        case 'j':
+            value = strtol(optarg, &end, 10);
+            if (!*optarg || *end || value < 1 || value > 256) {
+                fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            jobs = (unsigned int) value;
+            break;
+        case 'c':
+            use_cache = 1;
+            break;
         case 'h':
             usage(stdout, argv[0]);
             return EXIT_SUCCESS;
@@ -73,12 +95,17 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (jobs == 0) {
+        value = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = value > 0 ? (unsigned int) value : 1;
+    }
+
     if (pcre_shim_load(&shim, pcre_path) < 0) {
         return EXIT_FAILURE;
     }
 
     if (strcmp(action, "compile") == 0) {
-        ret = compile(&shim, source_path, target_path);
+        ret = compile(&shim, source_path, target_path, jobs, use_cache);
     } else if (strcmp(action, "decompile") == 0) {
         ret = decompile(&shim, source_path, target_path);
     } else {
@@ -19,12 +19,13 @@
 
 #define FUSE_USE_VERSION 26
 
-#include <mutex>
 #include <new>
 #include <optional>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -59,6 +60,7 @@
 // libmbcommon
 #include "mbcommon/file.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 
 // libmbsparse
 #include "mbsparse/sparse.h"
@@ -71,12 +73,12 @@
 
 static char source_fd_path[50];
 static uint64_t sparse_size;
+static std::vector<unsigned char> sparse_index;
 
 struct context
 {
     mb::StandardFile source_file;
     mb::sparse::SparseFile sparse_file;
-    std::mutex mutex;
 };
 
 static std::optional<int> extract_errno(std::error_code ec)
@@ -122,6 +124,17 @@ static int fuse_open(const char *path, fuse_file_info *fi)
         return -extract_errno(ret.error()).value_or(EIO);
     }
 
+    // The index was validated against this image when it was loaded. Using it
+    // avoids reading every chunk header before the first read and makes
+    // SparseFile::read_at() safe to call from multiple threads.
+    ret = ctx->sparse_file.load_index(sparse_index.data(), sparse_index.size());
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to load chunk index: %s\n",
+                source_fd_path, ret.error().message().c_str());
+        delete ctx;
+        return -extract_errno(ret.error()).value_or(EIO);
+    }
+
     fi->fh = reinterpret_cast<uint64_t>(ctx);
 
     return 0;
@@ -140,21 +153,24 @@ static int fuse_release(const char *path, fuse_file_info *fi)
 }
 
 /*!
- * \brief Read from sparse file
+ * \brief Read callback for fuse
  *
- * \warning Bad stuff will happen if \a ctx->mutex is not locked when this
- *          function is called
+ * The kernel may issue several reads for the same handle at the same time. The
+ * source file is read with pread() and the chunk index is never modified after
+ * fuse_open(), so no locking is needed.
  */
-static int fuse_read_locked(context *ctx, char *buf, size_t size,
-                            OFF_T offset)
+static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
+                     fuse_file_info *fi)
 {
-    // Seek to position
-    auto new_offset = ctx->sparse_file.seek(offset, SEEK_SET);
-    if (!new_offset) {
-        return -extract_errno(new_offset.error()).value_or(EIO);
+    (void) path;
+
+    if (offset < 0) {
+        return -EINVAL;
     }
 
-    auto n = ctx->sparse_file.read(buf, size);
+    context *ctx = reinterpret_cast<context *>(fi->fh);
+
+    auto n = ctx->sparse_file.read_at(static_cast<uint64_t>(offset), buf, size);
     if (!n) {
         return -extract_errno(n.error()).value_or(EIO);
     }
@@ -163,36 +179,105 @@ static int fuse_read_locked(context *ctx, char *buf, size_t size,
 }
 
 /*!
- * \brief Read callback for fuse
+ * \brief getattr (stat) callback for fuse
  */
-static int fuse_read(const char *path, char *buf, size_t size, OFF_T offset,
-                     fuse_file_info *fi)
+static int fuse_getattr(const char *path, struct stat *stbuf)
 {
     (void) path;
 
-    context *ctx = reinterpret_cast<context *>(fi->fh);
+    stbuf->st_mode = S_IFREG | 0444;
+    stbuf->st_size = static_cast<OFF_T>(sparse_size);
 
-    std::lock_guard<std::mutex> lock(ctx->mutex);
-    return fuse_read_locked(ctx, buf, size, offset);
+    return 0;
 }
 
 /*!
- * \brief getattr (stat) callback for fuse
+ * \brief Read sparse chunk index from \p path
  */
-static int fuse_getattr(const char *path, struct stat *stbuf)
+static mb::oc::result<std::vector<unsigned char>>
+read_index_file(const char *path)
 {
-    (void) path;
+    mb::StandardFile file;
+    std::vector<unsigned char> data;
+    unsigned char buf[10240];
 
-    stbuf->st_mode = S_IFREG | 0444;
-    stbuf->st_size = static_cast<OFF_T>(sparse_size);
+    OUTCOME_TRYV(file.open(path, mb::FileOpenMode::ReadOnly));
+
+    while (true) {
+        OUTCOME_TRY(n, mb::file_read_retry(file, buf, sizeof(buf)));
+        if (n == 0) {
+            break;
+        }
+
+        data.insert(data.end(), buf, buf + n);
+    }
+
+    return std::move(data);
+}
+
+/*!
+ * \brief Write sparse chunk index to \p path
+ */
+static mb::oc::result<void>
+write_index_file(const char *path, const std::vector<unsigned char> &data)
+{
+    mb::StandardFile file;
+
+    OUTCOME_TRYV(file.open(path, mb::FileOpenMode::WriteOnly));
+    OUTCOME_TRYV(mb::file_write_exact(file, data.data(), data.size()));
+    OUTCOME_TRYV(file.close());
+
+    return mb::oc::success();
+}
+
+/*!
+ * \brief Load or build the sparse chunk index
+ *
+ * If \p index_path is not null and contains a valid index for the image, it is
+ * used. Otherwise, the index is built from the chunk headers and saved to
+ * \p index_path so that the next mount can skip that step.
+ */
+static int load_sparse_index(mb::sparse::SparseFile &sparse_file,
+                             const char *index_path)
+{
+    if (index_path) {
+        if (auto data = read_index_file(index_path)) {
+            if (sparse_file.load_index(data.value().data(),
+                                       data.value().size())) {
+                sparse_index = std::move(data.value());
+                return 0;
+            }
+
+            fprintf(stderr, "%s: Ignoring invalid chunk index\n", index_path);
+        } else if (data.error() != std::errc::no_such_file_or_directory) {
+            fprintf(stderr, "%s: Failed to read chunk index: %s\n",
+                    index_path, data.error().message().c_str());
+        }
+    }
+
+    auto data = sparse_file.save_index();
+    if (!data) {
+        fprintf(stderr, "%s: Failed to build chunk index: %s\n",
+                source_fd_path, data.error().message().c_str());
+        return -extract_errno(data.error()).value_or(EIO);
+    }
+
+    sparse_index = std::move(data.value());
+
+    if (index_path) {
+        if (auto r = write_index_file(index_path, sparse_index); !r) {
+            fprintf(stderr, "%s: Failed to write chunk index: %s\n",
+                    index_path, r.error().message().c_str());
+        }
+    }
 
     return 0;
 }
 
 /*!
- * \brief Get size of sparse file (needed for fuse_getattr())
+ * \brief Get size of sparse file (needed for fuse_getattr()) and its index
  */
-static int get_sparse_file_size()
+static int get_sparse_file_size(const char *index_path)
 {
     mb::StandardFile source_file;
     mb::sparse::SparseFile sparse_file;
@@ -213,13 +298,14 @@ static int get_sparse_file_size()
 
     sparse_size = sparse_file.size();
 
-    return 0;
+    return load_sparse_index(sparse_file, index_path);
 }
 
 struct arg_ctx
 {
     char *source_file = nullptr;
     char *target_file = nullptr;
+    char *index_file = nullptr;
     bool show_help = false;
 };
 
@@ -232,6 +318,7 @@ static fuse_opt fuse_opts[] =
 {
     FUSE_OPT_KEY("-h",     KEY_HELP),
     FUSE_OPT_KEY("--help", KEY_HELP),
+    { "--index=%s", offsetof(arg_ctx, index_file), 0 },
     FUSE_OPT_END
 };
 
@@ -243,6 +330,8 @@ static void usage(FILE *stream, const char *progname)
             "general options:\n"
             "    -o opt,[opt...]        comma-separated list of mount options\n"
             "    -h   --help            show this help message\n"
+            "    --index=<file>         load chunk index from (or save it to)\n"
+            "                           <file>\n"
             "\n",
             progname);
 }
@@ -302,7 +391,7 @@ int main(int argc, char *argv[])
         snprintf(source_fd_path, sizeof(source_fd_path),
                  "/proc/self/fd/%d", fd);
 
-        if (get_sparse_file_size() < 0) {
+        if (get_sparse_file_size(arg_ctx.index_file) < 0) {
             close(fd);
             return EXIT_FAILURE;
         }
@@ -323,6 +412,7 @@ int main(int argc, char *argv[])
     fuse_opt_free_args(&args);
     free(arg_ctx.source_file);
     free(arg_ctx.target_file);
+    free(arg_ctx.index_file);
 
     return fuse_ret;
 }
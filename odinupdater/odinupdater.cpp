@@ -19,7 +19,10 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <thread>
 #include <vector>
 
@@ -30,13 +33,16 @@
 #include <cstring>
 
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
 // libmbcommon
 #include "mbcommon/error_code.h"
-#include "mbcommon/file/standard.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/mmap.h"
 #include "mbcommon/file_error.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
@@ -44,11 +50,13 @@
 
 // libmbsparse
 #include "mbsparse/sparse.h"
+#include "mbsparse/sparse_flash.h"
 
 // libmbdevice
 #include "mbdevice/json.h"
 
 // libmbutil
+#include "mbutil/archive_file.h"
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
@@ -82,6 +90,7 @@ using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
 using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
 using namespace mb::device;
+using mb::util::ArchiveFileReader;
 
 enum class ExtractResult : uint8_t
 {
@@ -93,6 +102,10 @@ enum class ExtractResult : uint8_t
 static int interface;
 static int output_fd;
 static const char *zip_file;
+// The zip file is mapped when possible so that libarchive reads it without
+// copying. Otherwise, it is read through the file descriptor.
+static mb::MmapFile zip_mmap;
+static mb::FdFile zip_fd;
 
 static std::string sales_code;
 static std::string system_block_dev;
@@ -172,15 +185,30 @@ static bool umount_system()
     return run_command({ "umount", "/system" });
 }
 
-static bool la_open_zip(archive *a, const char *filename)
+/*!
+ * \brief Open zip for random access
+ *
+ * The seekable zip reader loads the central directory when the archive is
+ * opened and seeks directly to the local header of each entry. Entries that
+ * are skipped are never decompressed, unlike with the streaming reader, which
+ * has to inflate any entry whose size is only known from its data descriptor.
+ */
+static bool la_open_zip(archive *a, const char *filename,
+                        std::optional<ArchiveFileReader> &reader)
 {
-    if (archive_read_support_format_zip(a) != ARCHIVE_OK) {
+    if (archive_read_support_format_zip_seekable(a) != ARCHIVE_OK) {
         error("libarchive: Failed to enable zip support: %s",
               archive_error_string(a));
         return false;
     }
 
-    if (archive_read_open_filename(a, zip_file, 10240) != ARCHIVE_OK) {
+    if (zip_mmap.is_open()) {
+        reader.emplace(zip_mmap);
+    } else {
+        reader.emplace(zip_fd);
+    }
+
+    if (reader->open(a) != ARCHIVE_OK) {
         error("libarchive: %s: Failed to open zip: %s",
               filename, archive_error_string(a));
         return false;
@@ -241,6 +269,7 @@ static bool load_block_devs()
     Device device;
 
     {
+        std::optional<ArchiveFileReader> reader;
         archive *a = archive_read_new();
         if (!a) {
             error("Out of memory");
@@ -251,7 +280,7 @@ static bool load_block_devs()
             archive_read_free(a);
         });
 
-        if (!la_open_zip(a, zip_file)) {
+        if (!la_open_zip(a, zip_file, reader)) {
             return false;
         }
 
@@ -323,36 +352,83 @@ static bool load_block_devs()
     return true;
 }
 
+/*!
+ * \brief File that decompresses an entry's data on a background thread
+ *
+ * The data is inflated into a ring of large buffers by a separate thread,
+ * which is started by the first read, so that decompression overlaps with
+ * writing the data out on the caller's thread.
+ */
 class LibArchiveEntryFile : public mb::File
 {
 public:
+    static constexpr size_t buffer_size = 1024 * 1024;
+    static constexpr size_t buffer_count = 4;
+
     LibArchiveEntryFile(archive *a)
         : m_archive(a)
+        , m_buffers(buffer_count)
+    {
+    }
+
+    ~LibArchiveEntryFile() override
     {
+        stop();
     }
 
     mb::oc::result<void> close() override
     {
+        stop();
         return mb::oc::success();
     }
 
     mb::oc::result<size_t> read(void *buf, size_t size) override
     {
+        if (m_stop) {
+            return mb::FileError::InvalidState;
+        }
+
+        if (!m_thread.joinable() && !m_done) {
+            m_thread = std::thread(&LibArchiveEntryFile::decompress_loop, this);
+        }
+
         size_t total = 0;
 
         while (size > 0) {
-            la_ssize_t n = archive_read_data(m_archive, buf, size);
-            if (n < 0) {
-                error("libarchive: Failed to read data: %s",
-                      archive_error_string(m_archive));
-                return mb::ec_from_errno(archive_errno(m_archive));
-            } else if (n == 0) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_filled_cv.wait(lock, [&] {
+                return m_filled > 0 || m_done;
+            });
+
+            if (m_filled == 0) {
+                if (m_error && total == 0) {
+                    error("libarchive: Failed to read data: %s",
+                          m_error_msg.c_str());
+                    return mb::ec_from_errno(m_errno);
+                }
                 break;
             }
 
-            total += static_cast<size_t>(n);
-            size -= static_cast<size_t>(n);
+            // The producer does not touch filled buffers
+            lock.unlock();
+
+            auto &buffer = m_buffers[m_read_index];
+            size_t n = std::min(size, buffer.size - m_read_offset);
+
+            memcpy(buf, buffer.data.data() + m_read_offset, n);
+            total += n;
+            size -= n;
             buf = static_cast<char *>(buf) + n;
+            m_read_offset += n;
+
+            if (m_read_offset == buffer.size) {
+                m_read_index = (m_read_index + 1) % buffer_count;
+                m_read_offset = 0;
+
+                lock.lock();
+                --m_filled;
+                m_empty_cv.notify_one();
+            }
         }
 
         return total;
@@ -384,25 +460,146 @@ public:
     }
 
 private:
+    struct Buffer
+    {
+        std::vector<char> data = std::vector<char>(buffer_size);
+        size_t size = 0;
+    };
+
+    void decompress_loop()
+    {
+        size_t index = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_empty_cv.wait(lock, [&] {
+                    return m_filled < buffer_count || m_stop;
+                });
+                if (m_stop) {
+                    return;
+                }
+            }
+
+            auto &buffer = m_buffers[index];
+            bool eof = false;
+            buffer.size = 0;
+
+            while (buffer.size < buffer_size) {
+                la_ssize_t n = archive_read_data(
+                        m_archive, buffer.data.data() + buffer.size,
+                        buffer_size - buffer.size);
+                if (n < 0) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_error = true;
+                    auto msg = archive_error_string(m_archive);
+                    m_error_msg = msg ? msg : "Unknown error";
+                    m_errno = archive_errno(m_archive);
+                    m_done = true;
+                    m_filled_cv.notify_one();
+                    return;
+                } else if (n == 0) {
+                    eof = true;
+                    break;
+                }
+
+                buffer.size += static_cast<size_t>(n);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (buffer.size > 0) {
+                    ++m_filled;
+                }
+                m_done = eof;
+                m_filled_cv.notify_one();
+            }
+
+            if (eof) {
+                return;
+            }
+
+            index = (index + 1) % buffer_count;
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_empty_cv.notify_one();
+
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
     archive *m_archive;
+    std::vector<Buffer> m_buffers;
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+    std::condition_variable m_filled_cv;
+    std::condition_variable m_empty_cv;
+    // Protected by m_mutex
+    size_t m_filled = 0;
+    bool m_done = false;
+    bool m_stop = false;
+    bool m_error = false;
+    std::string m_error_msg;
+    int m_errno = 0;
+
+    // Only used by the reader
+    size_t m_read_index = 0;
+    size_t m_read_offset = 0;
 };
 
+/*!
+ * \brief Zero a range of a block device with BLKZEROOUT
+ *
+ * \return True if the range was zeroed, false if the ioctl is not supported
+ *         for the range (eg. because it is not 512-byte aligned) and the zeros
+ *         need to be written instead, or an error code.
+ */
+static mb::oc::result<bool> zero_out_range(int fd, uint64_t offset,
+                                           uint64_t size)
+{
+#ifdef BLKZEROOUT
+    uint64_t range[2] = { offset, size };
+
+    if (ioctl(fd, BLKZEROOUT, &range) == 0) {
+        return true;
+    } else if (errno != ENOTTY && errno != EINVAL && errno != EOPNOTSUPP) {
+        return mb::ec_from_errno();
+    }
+#else
+    (void) fd;
+    (void) offset;
+    (void) size;
+#endif
+
+    return false;
+}
+
 static ExtractResult extract_sparse_file(const char *zip_filename,
                                          const char *out_filename)
 {
     using namespace std::placeholders;
 
+    std::optional<ArchiveFileReader> reader;
     ScopedArchive a{archive_read_new(), &archive_read_free};
     LibArchiveEntryFile file(a.get());
     mb::sparse::SparseFile sparse_file;
-    mb::StandardFile out_file;
+    mb::FdFile out_file;
 
     if (!a) {
         error("Out of memory");
         return ExtractResult::Error;
     }
 
-    if (!la_open_zip(a.get(), zip_file)) {
+    if (!la_open_zip(a.get(), zip_file, reader)) {
         return ExtractResult::Error;
     }
 
@@ -412,35 +609,35 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return r;
     }
 
+    // Reject corrupted images before they are fully written to the partition
+    sparse_file.set_verify_crc32(true);
+
     if (auto r = sparse_file.open(&file); !r) {
         error("Failed to open sparse file: %s",
               r.error().message().c_str());
         return ExtractResult::Error;
     }
 
-    if (auto r = out_file.open(out_filename, mb::FileOpenMode::WriteOnly); !r) {
+    // The fd is needed for the block device ioctls
+    int out_fd = open(out_filename, O_WRONLY | O_CLOEXEC);
+    if (out_fd < 0) {
+        error("%s: Failed to open for writing: %s",
+              out_filename, strerror(errno));
+        return ExtractResult::Error;
+    }
+
+    if (auto r = out_file.open(out_fd, true); !r) {
+        close(out_fd);
         error("%s: Failed to open for writing: %s",
               out_filename, r.error().message().c_str());
         return ExtractResult::Error;
     }
 
-    char buf[10240];
-    uint64_t cur_bytes = 0;
-    uint64_t max_bytes = sparse_file.size();
     uint64_t old_bytes = 0;
 
-    set_progress(0);
-
-    while (true) {
-        auto n = sparse_file.read(buf, sizeof(buf));
-        if (!n) {
-            error("Failed to read sparse file %s: %s",
-                  zip_filename, n.error().message().c_str());
-            return ExtractResult::Error;
-        } else if (n.value() == 0) {
-            break;
-        }
-
+    mb::sparse::SparseFlashCallbacks callbacks;
+    callbacks.zero_out = std::bind(zero_out_range, out_fd, _1, _2);
+    callbacks.progress = [&](uint64_t cur_bytes, uint64_t max_bytes) {
         // Rate limit: update progress only after difference exceeds 0.1%
         double old_ratio = static_cast<double>(old_bytes) / max_bytes;
         double new_ratio = static_cast<double>(cur_bytes) / max_bytes;
@@ -448,21 +645,17 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
             set_progress(new_ratio);
             old_bytes = cur_bytes;
         }
+    };
 
-        char *out_ptr = buf;
-
-        while (n.value() > 0) {
-            auto n_written = out_file.write(buf, n.value());
-            if (!n_written) {
-                error("%s: Failed to write file: %s",
-                      out_filename, n_written.error().message().c_str());
-                return ExtractResult::Error;
-            }
+    set_progress(0);
 
-            n.value() -= n_written.value();
-            out_ptr += n_written.value();
-            cur_bytes += n_written.value();
-        }
+    // Holes are skipped instead of discarded. The data in them is unspecified
+    // and discarding would cost more than it saves on eMMC.
+    if (auto r = mb::sparse::flash_sparse_file(sparse_file, out_file,
+                                               callbacks); !r) {
+        error("%s: Failed to flash sparse file %s: %s",
+              out_filename, zip_filename, r.error().message().c_str());
+        return ExtractResult::Error;
     }
 
     if (auto r = out_file.close(); !r) {
@@ -477,9 +670,10 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
 static ExtractResult extract_raw_file(const char *zip_filename,
                                       const char *out_filename)
 {
+    std::optional<ArchiveFileReader> reader;
     ScopedArchive a{archive_read_new(), &archive_read_free};
-    char buf[10240];
-    la_ssize_t n;
+    LibArchiveEntryFile file(a.get());
+    std::vector<char> buf(LibArchiveEntryFile::buffer_size);
     int fd;
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = 0;
@@ -492,7 +686,7 @@ static ExtractResult extract_raw_file(const char *zip_filename,
         return ExtractResult::Error;
     }
 
-    if (!la_open_zip(a.get(), zip_file)) {
+    if (!la_open_zip(a.get(), zip_file, reader)) {
         return ExtractResult::Error;
     }
 
@@ -517,33 +711,44 @@ static ExtractResult extract_raw_file(const char *zip_filename,
 
     set_progress(0);
 
-    while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
-        // Rate limit: update progress only after difference exceeds 0.1%
-        old_ratio = static_cast<double>(old_bytes) / max_bytes;
-        new_ratio = static_cast<double>(cur_bytes) / max_bytes;
-        if (new_ratio - old_ratio >= 0.001) {
-            set_progress(new_ratio);
-            old_bytes = cur_bytes;
+    // Data is inflated on another thread while this one writes
+    while (true) {
+        auto n = file.read(buf.data(), buf.size());
+        if (!n) {
+            error("%s: Failed to read %s: %s",
+                  zip_file, zip_filename, n.error().message().c_str());
+            return ExtractResult::Error;
+        } else if (n.value() == 0) {
+            break;
         }
 
-        char *out_ptr = buf;
-        ssize_t nwritten;
+        char *out_ptr = buf.data();
+        size_t remain = n.value();
 
         do {
-            if ((nwritten = write(fd, out_ptr, static_cast<size_t>(n))) < 0) {
+            ssize_t nwritten = write(fd, out_ptr, remain);
+            if (nwritten < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
                 error("%s: Failed to write: %s",
                       out_filename, strerror(errno));
                 return ExtractResult::Error;
             }
 
-            n -= nwritten;
+            remain -= static_cast<size_t>(nwritten);
             out_ptr += nwritten;
-        } while (n > 0);
-    }
-    if (n != 0) {
-        error("libarchive: %s: Failed to read %s: %s",
-              zip_file, zip_filename, archive_error_string(a.get()));
-        return ExtractResult::Error;
+        } while (remain > 0);
+
+        cur_bytes += n.value();
+
+        // Rate limit: update progress only after difference exceeds 0.1%
+        old_ratio = static_cast<double>(old_bytes) / max_bytes;
+        new_ratio = static_cast<double>(cur_bytes) / max_bytes;
+        if (new_ratio - old_ratio >= 0.001) {
+            set_progress(new_ratio);
+            old_bytes = cur_bytes;
+        }
     }
 
     return ExtractResult::Ok;
@@ -783,6 +988,15 @@ static bool apply_multi_csc()
 
 static bool flash_carrier_package_zip(const char *zip_path)
 {
+    mb::MmapFile zip;
+
+    if (auto r = zip.open(zip_path); !r) {
+        error("%s: Failed to map file: %s",
+              zip_path, r.error().message().c_str());
+        return false;
+    }
+
+    ArchiveFileReader reader(zip);
     ScopedArchive matcher{archive_match_new(), &archive_match_free};
     ScopedArchive in{archive_read_new(), &archive_read_free};
     ScopedArchive out{archive_write_disk_new(), &archive_write_free};
@@ -799,8 +1013,8 @@ static bool flash_carrier_package_zip(const char *zip_path)
         return false;
     }
 
-    // Set up archive reader parameters
-    archive_read_support_format_zip(in.get());
+    // Set up archive reader parameters. Excluded entries are seeked over.
+    archive_read_support_format_zip_seekable(in.get());
 
     // Set up disk writer parameters
     archive_write_disk_set_standard_lookup(out.get());
@@ -816,8 +1030,7 @@ static bool flash_carrier_package_zip(const char *zip_path)
                                  | ARCHIVE_EXTRACT_MAC_METADATA
                                  | ARCHIVE_EXTRACT_SPARSE);
 
-    if (archive_read_open_filename(in.get(), zip_path, 10240)
-            != ARCHIVE_OK) {
+    if (reader.open(in.get()) != ARCHIVE_OK) {
         error("libarchive: %s: Failed to open file: %s",
               zip_path, archive_error_string(in.get()));
         return false;
@@ -1066,5 +1279,17 @@ int main(int argc, char *argv[])
 
     zip_file = argv[3];
 
+    if (auto r = zip_mmap.open(zip_file); !r) {
+        info("%s: Failed to map file, reading it instead: %s",
+             zip_file, r.error().message().c_str());
+
+        if (auto r2 = zip_fd.open(zip_file, mb::FileOpenMode::ReadOnly);
+                !r2) {
+            error("%s: Failed to open file: %s",
+                  zip_file, r2.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
     return flash_zip() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -3,20 +3,26 @@
 cd "$(dirname "${BASH_SOURCE[0]}")"
 
 files=(
+    v3/batch.fbs
     v3/crypto_decrypt.fbs
     v3/crypto_get_pw_type.fbs
     v3/file_chmod.fbs
     v3/file_close.fbs
     v3/file_open.fbs
     v3/file_read.fbs
+    v3/file_read_stream.fbs
     v3/file_seek.fbs
     v3/file_selinux_get_label.fbs
     v3/file_selinux_set_label.fbs
     v3/file_stat.fbs
     v3/file_write.fbs
+    v3/file_write_stream.fbs
+    v3/job.fbs
+    v3/mb_clone_rom.fbs
     v3/mb_get_booted_rom_id.fbs
     v3/mb_get_installed_roms.fbs
     v3/mb_get_packages_count.fbs
+    v3/mb_get_stats.fbs
     v3/mb_get_version.fbs
     v3/mb_set_kernel.fbs
     v3/mb_switch_rom.fbs
@@ -30,6 +36,7 @@ files=(
     v3/path_selinux_get_label.fbs
     v3/path_selinux_set_label.fbs
     v3/reboot.fbs
+    v3/shared_buffer.fbs
     v3/shutdown.fbs
     v3/signed_exec.fbs
     request.fbs
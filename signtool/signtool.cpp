@@ -18,13 +18,20 @@
  */
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <getopt.h>
+
 #include <openssl/err.h>
 
+// libmbcommon
+#include "mbcommon/integer.h"
+
 // libmbsign
 #include "mbsign/sign.h"
 
@@ -38,38 +45,21 @@ static void openssl_log_errors()
 static void usage(FILE *stream)
 {
     fprintf(stream,
-            "Usage: signtool <PKCS12 file> <input file> <output signature file>\n\n"
+            "Usage: signtool <PKCS12 file> <input file> <output signature file>\n"
+            "   or: signtool -m [-j <threads>] <PKCS12 file> <input file>...\n\n"
+            "Options:\n"
+            "  -m, --multiple   Sign multiple files. The signature for each\n"
+            "                   input file is written to <input file>.sig\n"
+            "  -j, --jobs <n>   Number of files to sign in parallel in multiple\n"
+            "                   file mode (default: number of CPUs)\n"
+            "  -h, --help       Display this help message\n\n"
             "NOTE: This is not a general purpose tool for signing files!\n"
             "It is only meant for use with mbtool.\n");
 }
 
-int main(int argc, char *argv[])
+static int sign_single(EVP_PKEY &private_key, const char *file_input,
+                       const char *file_output)
 {
-    ERR_load_crypto_strings();
-    OpenSSL_add_all_algorithms();
-
-    if (argc != 4) {
-        usage(stderr);
-        return EXIT_FAILURE;
-    }
-
-    const char *file_pkcs12 = argv[1];
-    const char *file_input = argv[2];
-    const char *file_output = argv[3];
-
-    const char *pass = getenv("MBSIGN_PASSPHRASE");
-    if (!pass) {
-        fprintf(stderr,
-                "The MBSIGN_PASSPHRASE environment variable is not set\n");
-        return EXIT_FAILURE;
-    }
-
-    auto private_key = mb::sign::load_private_key_from_file(
-            file_pkcs12, mb::sign::KeyFormat::Pkcs12, pass);
-    if (!private_key) {
-        return EXIT_FAILURE;
-    }
-
     ScopedBIO bio_data_in(BIO_new_file(file_input, "rb"), BIO_free);
     if (!bio_data_in) {
         fprintf(stderr, "%s: Failed to open input file\n", file_input);
@@ -84,7 +74,7 @@ int main(int argc, char *argv[])
     }
 
     if (auto ret = mb::sign::sign_data(
-            *bio_data_in, *bio_sig_out, *private_key.value()); !ret) {
+            *bio_data_in, *bio_sig_out, private_key); !ret) {
         fprintf(stderr, "Failed to sign data: %s\n",
                 ret.error().ec.message().c_str());
         if (ret.error().has_openssl_error) {
@@ -107,3 +97,97 @@ int main(int argc, char *argv[])
 
     return EXIT_SUCCESS;
 }
+
+static int sign_multiple(EVP_PKEY &private_key, unsigned int threads,
+                         char **inputs, int count)
+{
+    std::vector<mb::sign::BatchFile> files;
+
+    for (int i = 0; i < count; ++i) {
+        files.push_back({inputs[i], std::string(inputs[i]) + ".sig"});
+    }
+
+    bool ret = mb::sign::sign_files(files, private_key, threads,
+                                    [&](size_t i, auto const &result) {
+        if (!result) {
+            fprintf(stderr, "%s: Failed to sign file: %s\n",
+                    files[i].path.c_str(),
+                    result.error().ec.message().c_str());
+            if (result.error().has_openssl_error) {
+                openssl_log_errors();
+            }
+        }
+    });
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+    ERR_load_crypto_strings();
+    OpenSSL_add_all_algorithms();
+
+    int opt;
+    bool multiple = false;
+    unsigned int threads = 0;
+
+    static const char short_options[] = "mj:h";
+
+    static struct option long_options[] = {
+        {"multiple", no_argument,       nullptr, 'm'},
+        {"jobs",     required_argument, nullptr, 'j'},
+        {"help",     no_argument,       nullptr, 'h'},
+        {nullptr,    0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'm':
+            multiple = true;
+            break;
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, threads) || threads == 0) {
+                fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (multiple ? argc - optind < 2 : argc - optind != 3) {
+        usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    const char *file_pkcs12 = argv[optind];
+
+    const char *pass = getenv("MBSIGN_PASSPHRASE");
+    if (!pass) {
+        fprintf(stderr,
+                "The MBSIGN_PASSPHRASE environment variable is not set\n");
+        return EXIT_FAILURE;
+    }
+
+    auto private_key = mb::sign::load_private_key_from_file(
+            file_pkcs12, mb::sign::KeyFormat::Pkcs12, pass);
+    if (!private_key) {
+        return EXIT_FAILURE;
+    }
+
+    if (multiple) {
+        return sign_multiple(*private_key.value(), threads,
+                             argv + optind + 1, argc - optind - 1);
+    } else {
+        return sign_single(*private_key.value(), argv[optind + 1],
+                           argv[optind + 2]);
+    }
+}